@@ -236,6 +236,16 @@ public class Collectd
    */
   native public static int dispatchValues (ValueList vl);
 
+  /**
+   * Dispatches the value lists encoded in the first <code>length</code>
+   * bytes of a direct buffer. Use {@link ValueListBuffer} rather than
+   * calling this function directly.
+   *
+   * @return The number of value lists that could not be dispatched, or -1 if
+   *         the buffer could not be parsed.
+   */
+  native static int dispatchBuffer (java.nio.ByteBuffer buffer, int length);
+
   /**
    * Java representation of collectd/src/plugin.h:plugin_dispatch_notification
    *
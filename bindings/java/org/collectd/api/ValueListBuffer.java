@@ -0,0 +1,176 @@
+/**
+ * collectd - bindings/java/org/collectd/api/ValueListBuffer.java
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+package org.collectd.api;
+
+import java.nio.BufferOverflowException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.Charset;
+import java.util.List;
+
+/**
+ * Collects value lists in a direct buffer and dispatches all of them to
+ * collectd with a single native call.
+ *
+ * Each call to {@link Collectd#dispatchValues(ValueList)} has to cross the
+ * JNI boundary and take the ValueList object apart field by field. Plugins
+ * that dispatch many value lists per read interval can {@link #add} them to a
+ * ValueListBuffer instead and call {@link #dispatch} once at the end. The
+ * value list is encoded when it is added, so the caller is free to modify
+ * and reuse the ValueList object afterwards.
+ *
+ * A ValueListBuffer is not thread-safe.
+ */
+public class ValueListBuffer
+{
+  /** Default size of the buffer in bytes. */
+  public static final int DEFAULT_SIZE = 65536;
+
+  private static final Charset UTF8 = Charset.forName ("UTF-8");
+
+  private static final byte KIND_LONG   = 0;
+  private static final byte KIND_DOUBLE = 1;
+
+  private final ByteBuffer _buffer;
+
+  public ValueListBuffer ()
+  {
+    this (DEFAULT_SIZE);
+  }
+
+  public ValueListBuffer (int size)
+  {
+    this._buffer = ByteBuffer.allocateDirect (size);
+    this._buffer.order (ByteOrder.nativeOrder ());
+  }
+
+  /**
+   * Appends a value list to the buffer. If the buffer is full, the value
+   * lists collected so far are dispatched first. A value list that doesn't
+   * fit into an empty buffer is dispatched with
+   * {@link Collectd#dispatchValues(ValueList)} right away.
+   *
+   * @return Zero when successful, non-zero otherwise.
+   */
+  public int add (ValueList vl)
+  {
+    int start = this._buffer.position ();
+
+    try
+    {
+      encode (vl);
+      return (0);
+    }
+    catch (BufferOverflowException e)
+    {
+      this._buffer.position (start);
+    }
+
+    if (start == 0)
+      return (Collectd.dispatchValues (vl));
+
+    dispatch ();
+
+    try
+    {
+      encode (vl);
+      return (0);
+    }
+    catch (BufferOverflowException e)
+    {
+      this._buffer.clear ();
+      return (Collectd.dispatchValues (vl));
+    }
+  } /* int add */
+
+  /**
+   * Dispatches all value lists in the buffer and empties it.
+   *
+   * @return The number of value lists that could not be dispatched, or -1 if
+   *         collectd could not parse the buffer.
+   */
+  public int dispatch ()
+  {
+    int status;
+
+    if (this._buffer.position () == 0)
+      return (0);
+
+    status = Collectd.dispatchBuffer (this._buffer, this._buffer.position ());
+    this._buffer.clear ();
+    return (status);
+  } /* int dispatch */
+
+  private void encode (ValueList vl)
+  {
+    List<Number> values = vl.getValues ();
+    int start = this._buffer.position ();
+
+    /* The size is filled in below. */
+    this._buffer.putInt (0);
+    this._buffer.putLong (vl.getTime ());
+    this._buffer.putLong (vl.getInterval ());
+    putString (vl.getHost ());
+    putString (vl.getPlugin ());
+    putString (vl.getPluginInstance ());
+    putString (vl.getType ());
+    putString (vl.getTypeInstance ());
+
+    this._buffer.putShort ((short) values.size ());
+    for (int i = 0; i < values.size (); i++)
+    {
+      Number n = values.get (i);
+
+      if ((n instanceof Double) || (n instanceof Float))
+      {
+        this._buffer.put (KIND_DOUBLE);
+        this._buffer.putDouble (n.doubleValue ());
+      }
+      else
+      {
+        this._buffer.put (KIND_LONG);
+        this._buffer.putLong (n.longValue ());
+      }
+    }
+
+    this._buffer.putInt (start, this._buffer.position () - start);
+  } /* void encode */
+
+  private void putString (String s)
+  {
+    if (s == null)
+    {
+      this._buffer.putShort ((short) 0);
+      return;
+    }
+
+    byte[] b = s.getBytes (UTF8);
+    if (b.length > 0xffff)
+      throw (new BufferOverflowException ());
+
+    this._buffer.putShort ((short) b.length);
+    this._buffer.put (b);
+  } /* void putString */
+} /* class ValueListBuffer */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
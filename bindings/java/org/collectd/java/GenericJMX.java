@@ -38,6 +38,7 @@ import org.collectd.api.CollectdReadInterface;
 import org.collectd.api.CollectdShutdownInterface;
 import org.collectd.api.OConfigValue;
 import org.collectd.api.OConfigItem;
+import org.collectd.api.ValueListBuffer;
 
 public class GenericJMX implements CollectdConfigInterface,
        CollectdReadInterface,
@@ -47,6 +48,7 @@ public class GenericJMX implements CollectdConfigInterface,
     = new TreeMap<String,GenericJMXConfMBean> ();
 
   private List<GenericJMXConfConnection> _connections = null;
+  private ValueListBuffer _buffer = new ValueListBuffer ();
 
   public GenericJMX ()
   {
@@ -113,7 +115,7 @@ public class GenericJMX implements CollectdConfigInterface,
     {
       try
       {
-        this._connections.get (i).query ();
+        this._connections.get (i).query (this._buffer);
       }
       catch (Exception e)
       {
@@ -122,6 +124,9 @@ public class GenericJMX implements CollectdConfigInterface,
       }
     }
 
+    /* Hand all values of this interval to the daemon at once. */
+    this._buffer.dispatch ();
+
     return (0);
   } /* }}} int read */
 
@@ -44,6 +44,7 @@ import org.collectd.api.Collectd;
 import org.collectd.api.PluginData;
 import org.collectd.api.OConfigValue;
 import org.collectd.api.OConfigItem;
+import org.collectd.api.ValueListBuffer;
 
 class GenericJMXConfConnection
 {
@@ -233,7 +234,7 @@ class GenericJMXConfConnection
             + "present."));
   } /* }}} GenericJMXConfConnection (OConfigItem ci) */
 
-  public void query () /* {{{ */
+  public void query (ValueListBuffer buffer) /* {{{ */
   {
     PluginData pd;
 
@@ -256,7 +257,7 @@ class GenericJMXConfConnection
       int status;
 
       status = this._mbeans.get (i).query (this._mbean_connection, pd,
-          this._instance_prefix);
+          this._instance_prefix, buffer);
       if (status != 0)
       {
         disconnect ();
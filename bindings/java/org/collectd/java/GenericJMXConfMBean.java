@@ -39,6 +39,7 @@ import org.collectd.api.Collectd;
 import org.collectd.api.PluginData;
 import org.collectd.api.OConfigValue;
 import org.collectd.api.OConfigItem;
+import org.collectd.api.ValueListBuffer;
 
 class GenericJMXConfMBean
 {
@@ -160,7 +161,7 @@ class GenericJMXConfMBean
   } /* }}} */
 
   public int query (MBeanServerConnection conn, PluginData pd, /* {{{ */
-      String instance_prefix)
+      String instance_prefix, ValueListBuffer buffer)
   {
     Set<ObjectName> names;
     Iterator<ObjectName> iter;
@@ -233,7 +234,7 @@ class GenericJMXConfMBean
       Collectd.logDebug ("GenericJMXConfMBean: instance = " + instance.toString ());
 
       for (int i = 0; i < this._values.size (); i++)
-        this._values.get (i).query (conn, objName, pd_tmp);
+        this._values.get (i).query (conn, objName, pd_tmp, buffer);
     }
 
     return (0);
@@ -49,6 +49,7 @@ import org.collectd.api.Collectd;
 import org.collectd.api.DataSet;
 import org.collectd.api.DataSource;
 import org.collectd.api.ValueList;
+import org.collectd.api.ValueListBuffer;
 import org.collectd.api.PluginData;
 import org.collectd.api.OConfigValue;
 import org.collectd.api.OConfigItem;
@@ -201,7 +202,7 @@ class GenericJMXConfValue
   } /* }}} List<Number> genericCompositeToNumber */
 
   private void submitTable (List<Object> objects, ValueList vl, /* {{{ */
-      String instancePrefix)
+      String instancePrefix, ValueListBuffer buffer)
   {
     List<CompositeData> cdlist;
     Set<String> keySet = null;
@@ -257,12 +258,12 @@ class GenericJMXConfValue
         vl.setTypeInstance (instancePrefix + key);
       vl.setValues (values);
 
-      Collectd.dispatchValues (vl);
+      buffer.add (vl);
     }
   } /* }}} void submitTable */
 
   private void submitScalar (List<Object> objects, ValueList vl, /* {{{ */
-      String instancePrefix)
+      String instancePrefix, ValueListBuffer buffer)
   {
     List<Number> values;
 
@@ -280,7 +281,7 @@ class GenericJMXConfValue
       vl.setTypeInstance (instancePrefix);
     vl.setValues (values);
 
-    Collectd.dispatchValues (vl);
+    buffer.add (vl);
   } /* }}} void submitScalar */
 
   private Object queryAttributeRecursive (CompositeData parent, /* {{{ */
@@ -558,16 +559,18 @@ class GenericJMXConfValue
   } /* }}} GenericJMXConfValue (OConfigItem ci) */
 
   /**
-   * Query values via JMX according to the object's configuration and dispatch
-   * them to collectd.
+   * Query values via JMX according to the object's configuration and add
+   * them to a buffer to be dispatched to collectd.
    *
    * @param conn    Connection to the MBeanServer.
    * @param objName Object name of the MBean to query.
    * @param pd      Preset naming components. The members host, plugin and
    *                plugin instance will be used.
+   * @param buffer  Buffer the value lists are added to. The caller is
+   *                responsible for dispatching it.
    */
   public void query (MBeanServerConnection conn, ObjectName objName, /* {{{ */
-      PluginData pd)
+      PluginData pd, ValueListBuffer buffer)
   {
     ValueList vl;
     List<DataSource> dsrc;
@@ -655,9 +658,9 @@ class GenericJMXConfValue
     }
 
     if (this._is_table)
-      submitTable (values, vl, instancePrefix);
+      submitTable (values, vl, instancePrefix, buffer);
     else
-      submitScalar (values, vl, instancePrefix);
+      submitScalar (values, vl, instancePrefix, buffer);
   } /* }}} void query */
 } /* class GenericJMXConfValue */
 
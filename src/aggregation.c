@@ -29,6 +29,7 @@
 #include "common.h"
 #include "meta_data.h"
 #include "plugin.h"
+#include "utils_atomic.h"
 #include "utils_cache.h" /* for uc_get_rate() */
 #include "utils_subst.h"
 #include "utils_vl_lookup.h"
@@ -36,6 +37,10 @@
 #define AGG_MATCHES_ALL(str) (strcmp("/.*/", str) == 0)
 #define AGG_FUNC_PLACEHOLDER "%{aggregation}"
 
+/* Number of partial aggregates per instance. Each write thread updates "its"
+ * partial, the read callback merges them. */
+#define AGG_STRIPES 16
+
 struct aggregation_s /* {{{ */
 {
   lookup_identifier_t ident;
@@ -57,14 +62,9 @@ struct aggregation_s /* {{{ */
 }; /* }}} */
 typedef struct aggregation_s aggregation_t;
 
-struct agg_instance_s;
-typedef struct agg_instance_s agg_instance_t;
-struct agg_instance_s /* {{{ */
+struct agg_partial_s /* {{{ */
 {
   pthread_mutex_t lock;
-  lookup_identifier_t ident;
-
-  int ds_type;
 
   derive_t num;
   gauge_t sum;
@@ -72,6 +72,18 @@ struct agg_instance_s /* {{{ */
 
   gauge_t min;
   gauge_t max;
+} __attribute__((aligned(64))); /* }}} */
+typedef struct agg_partial_s agg_partial_t;
+
+struct agg_instance_s;
+typedef struct agg_instance_s agg_instance_t;
+struct agg_instance_s /* {{{ */
+{
+  lookup_identifier_t ident;
+
+  int ds_type;
+
+  agg_partial_t partials[AGG_STRIPES];
 
   rate_to_value_state_t *state_num;
   rate_to_value_state_t *state_sum;
@@ -88,6 +100,32 @@ static lookup_t *lookup;
 static pthread_mutex_t agg_instance_list_lock = PTHREAD_MUTEX_INITIALIZER;
 static agg_instance_t *agg_instance_list_head;
 
+static pthread_key_t agg_stripe_key;
+static unsigned int agg_stripe_next;
+
+/* Returns the partial aggregate used by the calling thread. Threads are
+ * assigned stripes round-robin on first use. */
+static agg_partial_t *agg_instance_partial(agg_instance_t *inst) /* {{{ */
+{
+  uintptr_t stripe = (uintptr_t)pthread_getspecific(agg_stripe_key);
+
+  if (stripe == 0) {
+    stripe = 1 + (C_ATOMIC_ADD(&agg_stripe_next, 1) % AGG_STRIPES);
+    pthread_setspecific(agg_stripe_key, (void *)stripe);
+  }
+
+  return inst->partials + (stripe - 1);
+} /* }}} agg_partial_t *agg_instance_partial */
+
+static void agg_partial_reset(agg_partial_t *p) /* {{{ */
+{
+  p->num = 0;
+  p->sum = 0.0;
+  p->squares_sum = 0.0;
+  p->min = NAN;
+  p->max = NAN;
+} /* }}} void agg_partial_reset */
+
 static bool agg_is_regex(char const *str) /* {{{ */
 {
   if (str == NULL)
@@ -134,10 +172,11 @@ static void agg_instance_destroy(agg_instance_t *inst) /* {{{ */
   sfree(inst->state_max);
   sfree(inst->state_stddev);
 
+  for (size_t i = 0; i < AGG_STRIPES; i++)
+    pthread_mutex_destroy(&inst->partials[i].lock);
+
   memset(inst, 0, sizeof(*inst));
   inst->ds_type = -1;
-  inst->min = NAN;
-  inst->max = NAN;
 } /* }}} void agg_instance_destroy */
 
 static int agg_instance_create_name(agg_instance_t *inst, /* {{{ */
@@ -227,20 +266,22 @@ static agg_instance_t *agg_instance_create(data_set_t const *ds, /* {{{ */
                                            aggregation_t *agg) {
   DEBUG("aggregation plugin: Creating new instance.");
 
-  agg_instance_t *inst = calloc(1, sizeof(*inst));
-  if (inst == NULL) {
-    ERROR("aggregation plugin: calloc() failed.");
+  agg_instance_t *inst = NULL;
+  if (posix_memalign((void **)&inst, __alignof__(*inst), sizeof(*inst)) != 0) {
+    ERROR("aggregation plugin: posix_memalign() failed.");
     return NULL;
   }
-  pthread_mutex_init(&inst->lock, /* attr = */ NULL);
+  memset(inst, 0, sizeof(*inst));
+
+  for (size_t i = 0; i < AGG_STRIPES; i++) {
+    pthread_mutex_init(&inst->partials[i].lock, /* attr = */ NULL);
+    agg_partial_reset(inst->partials + i);
+  }
 
   inst->ds_type = ds->ds[0].type;
 
   agg_instance_create_name(inst, vl, agg);
 
-  inst->min = NAN;
-  inst->max = NAN;
-
 #define INIT_STATE(field)                                                      \
   do {                                                                         \
     inst->state_##field = NULL;                                                \
@@ -300,18 +341,19 @@ static int agg_instance_update(agg_instance_t *inst, /* {{{ */
     return 0;
   }
 
-  pthread_mutex_lock(&inst->lock);
+  agg_partial_t *p = agg_instance_partial(inst);
+  pthread_mutex_lock(&p->lock);
 
-  inst->num++;
-  inst->sum += rate[0];
-  inst->squares_sum += (rate[0] * rate[0]);
+  p->num++;
+  p->sum += rate[0];
+  p->squares_sum += (rate[0] * rate[0]);
 
-  if (isnan(inst->min) || (inst->min > rate[0]))
-    inst->min = rate[0];
-  if (isnan(inst->max) || (inst->max < rate[0]))
-    inst->max = rate[0];
+  if (isnan(p->min) || (p->min > rate[0]))
+    p->min = rate[0];
+  if (isnan(p->max) || (p->max < rate[0]))
+    p->max = rate[0];
 
-  pthread_mutex_unlock(&inst->lock);
+  pthread_mutex_unlock(&p->lock);
 
   sfree(rate);
   return 0;
@@ -385,32 +427,43 @@ static int agg_instance_read(agg_instance_t *inst, cdtime_t t) /* {{{ */
     }                                                                          \
   } while (0)
 
-  pthread_mutex_lock(&inst->lock);
+  /* Merge and reset the partial aggregates. The locks are not held while
+   * dispatching. */
+  agg_partial_t total;
+  agg_partial_reset(&total);
+
+  for (size_t i = 0; i < AGG_STRIPES; i++) {
+    agg_partial_t *p = inst->partials + i;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->num > 0) {
+      total.num += p->num;
+      total.sum += p->sum;
+      total.squares_sum += p->squares_sum;
+      if (isnan(total.min) || (total.min > p->min))
+        total.min = p->min;
+      if (isnan(total.max) || (total.max < p->max))
+        total.max = p->max;
+    }
+    agg_partial_reset(p);
+    pthread_mutex_unlock(&p->lock);
+  }
 
-  READ_FUNC(num, (gauge_t)inst->num);
+  READ_FUNC(num, (gauge_t)total.num);
 
   /* All other aggregations are only defined when there have been any values
    * at all. */
-  if (inst->num > 0) {
-    READ_FUNC(sum, inst->sum);
-    READ_FUNC(average, (inst->sum / ((gauge_t)inst->num)));
-    READ_FUNC(min, inst->min);
-    READ_FUNC(max, inst->max);
+  if (total.num > 0) {
+    READ_FUNC(sum, total.sum);
+    READ_FUNC(average, (total.sum / ((gauge_t)total.num)));
+    READ_FUNC(min, total.min);
+    READ_FUNC(max, total.max);
     READ_FUNC(stddev,
-              sqrt((((gauge_t)inst->num) * inst->squares_sum) -
-                   (inst->sum * inst->sum)) /
-                  ((gauge_t)inst->num));
+              sqrt((((gauge_t)total.num) * total.squares_sum) -
+                   (total.sum * total.sum)) /
+                  ((gauge_t)total.num));
   }
 
-  /* Reset internal state. */
-  inst->num = 0;
-  inst->sum = 0.0;
-  inst->squares_sum = 0.0;
-  inst->min = NAN;
-  inst->max = NAN;
-
-  pthread_mutex_unlock(&inst->lock);
-
   meta_data_destroy(vl.meta);
   vl.meta = NULL;
 
@@ -681,7 +734,14 @@ static int agg_read(void) /* {{{ */
   cdtime_t t = cdtime();
   int success = 0;
 
+  /* New instances are only ever prepended to the list and instances are not
+   * removed while the plugin is running, so the list can be walked from a
+   * snapshot of the head without holding the lock. This keeps the write
+   * callback from blocking on instance creation while values are being
+   * dispatched. */
   pthread_mutex_lock(&agg_instance_list_lock);
+  agg_instance_t *head = agg_instance_list_head;
+  pthread_mutex_unlock(&agg_instance_list_lock);
 
   /* agg_instance_list_head only holds data, after the "write" callback has
    * been called with a matching value list at least once. So on startup,
@@ -689,13 +749,10 @@ static int agg_read(void) /* {{{ */
    * the read() callback is called first, agg_instance_list_head is NULL and
    * "success" may be zero. This is expected and should not result in an error.
    * Therefore we need to handle this case separately. */
-  if (agg_instance_list_head == NULL) {
-    pthread_mutex_unlock(&agg_instance_list_lock);
+  if (head == NULL)
     return 0;
-  }
 
-  for (agg_instance_t *this = agg_instance_list_head; this != NULL;
-       this = this->next) {
+  for (agg_instance_t *this = head; this != NULL; this = this->next) {
     int status = agg_instance_read(this, t);
     if (status != 0)
       WARNING("aggregation plugin: Reading an aggregation instance "
@@ -705,8 +762,6 @@ static int agg_read(void) /* {{{ */
       success++;
   }
 
-  pthread_mutex_unlock(&agg_instance_list_lock);
-
   return (success > 0) ? 0 : -1;
 } /* }}} int agg_read */
 
@@ -734,6 +789,8 @@ static int agg_write(data_set_t const *ds, value_list_t const *vl, /* {{{ */
 } /* }}} int agg_write */
 
 void module_register(void) {
+  pthread_key_create(&agg_stripe_key, /* destructor = */ NULL);
+
   plugin_register_complex_config("aggregation", agg_config);
   plugin_register_read("aggregation", agg_read);
   plugin_register_write("aggregation", agg_write, /* user_data = */ NULL);
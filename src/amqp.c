@@ -65,6 +65,25 @@ int amqp_socket_close(amqp_socket_t *);
 /*
  * Data types
  */
+/* Statistics shared by all threads consuming the same subscription. The
+ * structure is reference counted: one reference is held by every thread and
+ * one by the read callback. */
+struct camqp_stats_s {
+  pthread_mutex_t lock;
+  size_t refcount;
+  char name[DATA_MAX_NAME_LEN];
+
+  derive_t messages;
+  derive_t commands;
+  derive_t errors;
+
+  /* Age of the received messages, taken from the "timestamp" property. */
+  cdtime_t lag_sum;
+  cdtime_t lag_max;
+  uint64_t lag_num;
+};
+typedef struct camqp_stats_s camqp_stats_t;
+
 struct camqp_config_s {
   bool publish;
   char *name;
@@ -96,6 +115,14 @@ struct camqp_config_s {
   char *queue;
   bool queue_durable;
   bool queue_auto_delete;
+  /* Number of unacknowledged messages the broker may send ahead. Zero
+   * disables acknowledgements altogether. */
+  int prefetch_count;
+  int threads;
+  camqp_stats_t *stats;
+  /* Deliveries processed but not acknowledged yet. */
+  uint64_t unacked_tag;
+  int unacked_num;
 
   amqp_connection_state_t connection;
   pthread_mutex_t lock;
@@ -133,8 +160,28 @@ static void camqp_close_connection(camqp_config_t *conf) /* {{{ */
   amqp_destroy_connection(conf->connection);
   close(sockfd);
   conf->connection = NULL;
+  conf->unacked_num = 0;
 } /* }}} void camqp_close_connection */
 
+static void camqp_stats_release(void *ptr) /* {{{ */
+{
+  camqp_stats_t *stats = ptr;
+  size_t refcount;
+
+  if (stats == NULL)
+    return;
+
+  pthread_mutex_lock(&stats->lock);
+  refcount = --stats->refcount;
+  pthread_mutex_unlock(&stats->lock);
+
+  if (refcount > 0)
+    return;
+
+  pthread_mutex_destroy(&stats->lock);
+  sfree(stats);
+} /* }}} void camqp_stats_release */
+
 static void camqp_config_free(void *ptr) /* {{{ */
 {
   camqp_config_t *conf = ptr;
@@ -156,9 +203,44 @@ static void camqp_config_free(void *ptr) /* {{{ */
   sfree(conf->prefix);
   sfree(conf->postfix);
 
+  camqp_stats_release(conf->stats);
+
   sfree(conf);
 } /* }}} void camqp_config_free */
 
+/* Creates a copy of a subscriber's configuration so that another thread can
+ * consume from the same queue using its own connection. */
+static camqp_config_t *camqp_config_clone(camqp_config_t const *src) /* {{{ */
+{
+  camqp_config_t *conf = malloc(sizeof(*conf));
+  if (conf == NULL)
+    return NULL;
+  memcpy(conf, src, sizeof(*conf));
+
+  conf->name = sstrdup(src->name);
+  conf->host = sstrdup(src->host);
+  conf->vhost = sstrdup(src->vhost);
+  conf->user = sstrdup(src->user);
+  conf->password = sstrdup(src->password);
+  conf->exchange = sstrdup(src->exchange);
+  conf->exchange_type = sstrdup(src->exchange_type);
+  conf->queue = sstrdup(src->queue);
+  conf->routing_key = sstrdup(src->routing_key);
+  conf->prefix = sstrdup(src->prefix);
+  conf->postfix = sstrdup(src->postfix);
+  conf->connection = NULL;
+  conf->unacked_num = 0;
+  pthread_mutex_init(&conf->lock, /* attr = */ NULL);
+
+  if (conf->stats != NULL) {
+    pthread_mutex_lock(&conf->stats->lock);
+    conf->stats->refcount++;
+    pthread_mutex_unlock(&conf->stats->lock);
+  }
+
+  return conf;
+} /* }}} camqp_config_t *camqp_config_clone */
+
 static char *camqp_bytes_cstring(amqp_bytes_t *in) /* {{{ */
 {
   char *ret;
@@ -348,6 +430,22 @@ static int camqp_setup_queue(camqp_config_t *conf) /* {{{ */
   }
   DEBUG("amqp plugin: Successfully created queue \"%s\".", conf->queue);
 
+  if (conf->prefetch_count > 0) {
+    amqp_basic_qos_ok_t *qos_ret =
+        amqp_basic_qos(conf->connection,
+                       /* channel        = */ CAMQP_CHANNEL,
+                       /* prefetch_size  = */ 0,
+                       /* prefetch_count = */ (uint16_t)conf->prefetch_count,
+                       /* global         = */ 0);
+    if ((qos_ret == NULL) && camqp_is_error(conf)) {
+      char errbuf[1024];
+      ERROR("amqp plugin: amqp_basic_qos failed: %s",
+            camqp_strerror(conf, errbuf, sizeof(errbuf)));
+      camqp_close_connection(conf);
+      return -1;
+    }
+  }
+
   /* bind to an exchange */
   if (conf->exchange != NULL) {
     amqp_queue_bind_ok_t *qb_ret;
@@ -380,7 +478,7 @@ static int camqp_setup_queue(camqp_config_t *conf) /* {{{ */
                          /* queue        = */ amqp_cstring_bytes(conf->queue),
                          /* consumer_tag = */ AMQP_EMPTY_BYTES,
                          /* no_local     = */ 0,
-                         /* no_ack       = */ 1,
+                         /* no_ack       = */ (conf->prefetch_count > 0) ? 0 : 1,
                          /* exclusive    = */ 0,
                          /* arguments    = */ AMQP_EMPTY_TABLE);
   if ((cm_ret == NULL) && camqp_is_error(conf)) {
@@ -564,10 +662,29 @@ static int camqp_read_body(camqp_config_t *conf, /* {{{ */
   } /* while (received < body_size) */
 
   if (strcasecmp("text/collectd", content_type) == 0) {
-    status = cmd_handle_putval(stderr, body);
-    if (status != 0)
-      ERROR("amqp plugin: cmd_handle_putval failed with status %i.", status);
-    return status;
+    /* A message may carry any number of PUTVAL commands, one per line, which
+     * allows producers to amortize the per-message overhead. */
+    char *saveptr = NULL;
+    int commands = 0;
+    int errors = 0;
+
+    for (char *line = strtok_r(body, "\r\n", &saveptr); line != NULL;
+         line = strtok_r(NULL, "\r\n", &saveptr)) {
+      commands++;
+      status = cmd_handle_putval(stderr, line);
+      if (status != 0) {
+        ERROR("amqp plugin: cmd_handle_putval failed with status %i.", status);
+        errors++;
+      }
+    }
+
+    if (conf->stats != NULL) {
+      pthread_mutex_lock(&conf->stats->lock);
+      conf->stats->commands += commands;
+      conf->stats->errors += errors;
+      pthread_mutex_unlock(&conf->stats->lock);
+    }
+    return (errors > 0) ? -1 : 0;
   } else if (strcasecmp("application/json", content_type) == 0) {
     ERROR("amqp plugin: camqp_read_body: Parsing JSON data has not "
           "been implemented yet. FIXME!");
@@ -603,6 +720,27 @@ static int camqp_read_header(camqp_config_t *conf) /* {{{ */
   }
 
   properties = frame.payload.properties.decoded;
+
+  if (conf->stats != NULL) {
+    cdtime_t lag = 0;
+    if (properties->_flags & AMQP_BASIC_TIMESTAMP_FLAG) {
+      cdtime_t sent = TIME_T_TO_CDTIME_T((time_t)properties->timestamp);
+      cdtime_t now = cdtime();
+      if (now > sent)
+        lag = now - sent;
+    }
+
+    pthread_mutex_lock(&conf->stats->lock);
+    conf->stats->messages++;
+    if (properties->_flags & AMQP_BASIC_TIMESTAMP_FLAG) {
+      conf->stats->lag_sum += lag;
+      conf->stats->lag_num++;
+      if (conf->stats->lag_max < lag)
+        conf->stats->lag_max = lag;
+    }
+    pthread_mutex_unlock(&conf->stats->lock);
+  }
+
   content_type = camqp_bytes_cstring(&properties->content_type);
   if (content_type == NULL) {
     ERROR("amqp plugin: Unable to determine content type.");
@@ -616,6 +754,24 @@ static int camqp_read_header(camqp_config_t *conf) /* {{{ */
   return status;
 } /* }}} int camqp_read_header */
 
+static void camqp_ack(camqp_config_t *conf) /* {{{ */
+{
+  int status;
+
+  if (conf->unacked_num == 0)
+    return;
+
+  status = amqp_basic_ack(conf->connection, CAMQP_CHANNEL, conf->unacked_tag,
+                          /* multiple = */ 1);
+  if (status != 0) {
+    ERROR("amqp plugin: amqp_basic_ack failed with status %i.", status);
+    camqp_close_connection(conf);
+    return;
+  }
+
+  conf->unacked_num = 0;
+} /* }}} void camqp_ack */
+
 static void *camqp_subscribe_thread(void *user_data) /* {{{ */
 {
   camqp_config_t *conf = user_data;
@@ -656,7 +812,24 @@ static void *camqp_subscribe_thread(void *user_data) /* {{{ */
       continue;
     }
 
+    amqp_basic_deliver_t *deliver = frame.payload.method.decoded;
+    uint64_t delivery_tag = deliver->delivery_tag;
+
     camqp_read_header(conf);
+    if (conf->connection == NULL)
+      continue;
+
+    if (conf->prefetch_count > 0) {
+      conf->unacked_tag = delivery_tag;
+      conf->unacked_num++;
+
+      /* Acknowledge all processed deliveries at once when half of the
+       * prefetch window is used up or when no further data is pending. */
+      if ((2 * conf->unacked_num >= conf->prefetch_count) ||
+          (!amqp_frames_enqueued(conf->connection) &&
+           !amqp_data_in_buffer(conf->connection)))
+        camqp_ack(conf);
+    }
 
     amqp_maybe_release_buffers(conf->connection);
   } /* while (subscriber_threads_running) */
@@ -666,6 +839,87 @@ static void *camqp_subscribe_thread(void *user_data) /* {{{ */
   return NULL;
 } /* }}} void *camqp_subscribe_thread */
 
+static int camqp_stats_read(user_data_t *user_data) /* {{{ */
+{
+  camqp_stats_t *stats = user_data->data;
+  value_list_t vl = VALUE_LIST_INIT;
+  derive_t messages, commands, errors;
+  gauge_t lag_avg = NAN, lag_max = NAN;
+
+  pthread_mutex_lock(&stats->lock);
+  messages = stats->messages;
+  commands = stats->commands;
+  errors = stats->errors;
+  if (stats->lag_num > 0) {
+    lag_avg = CDTIME_T_TO_DOUBLE(stats->lag_sum) / (gauge_t)stats->lag_num;
+    lag_max = CDTIME_T_TO_DOUBLE(stats->lag_max);
+  }
+  stats->lag_sum = 0;
+  stats->lag_max = 0;
+  stats->lag_num = 0;
+  pthread_mutex_unlock(&stats->lock);
+
+  sstrncpy(vl.plugin, "amqp", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, stats->name, sizeof(vl.plugin_instance));
+  vl.values_len = 1;
+
+  vl.values = &(value_t){.derive = messages};
+  sstrncpy(vl.type, "total_objects", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "messages", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.derive = commands};
+  sstrncpy(vl.type, "total_values", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "commands", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.derive = errors};
+  sstrncpy(vl.type, "total_values", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "errors", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.gauge = lag_avg};
+  sstrncpy(vl.type, "delay", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "lag-average", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.gauge = lag_max};
+  sstrncpy(vl.type_instance, "lag-max", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  return 0;
+} /* }}} int camqp_stats_read */
+
+static int camqp_stats_init(camqp_config_t *conf) /* {{{ */
+{
+  char cbname[128];
+  int status;
+
+  conf->stats = calloc(1, sizeof(*conf->stats));
+  if (conf->stats == NULL) {
+    ERROR("amqp plugin: calloc failed.");
+    return ENOMEM;
+  }
+  pthread_mutex_init(&conf->stats->lock, /* attr = */ NULL);
+  sstrncpy(conf->stats->name, conf->name, sizeof(conf->stats->name));
+  /* One reference for "conf" and one for the read callback. */
+  conf->stats->refcount = 2;
+
+  snprintf(cbname, sizeof(cbname), "amqp/%s", conf->name);
+  status = plugin_register_complex_read(
+      /* group = */ NULL, cbname, camqp_stats_read, /* interval = */ 0,
+      &(user_data_t){
+          .data = conf->stats, .free_func = camqp_stats_release,
+      });
+  if (status != 0) {
+    ERROR("amqp plugin: Registering read callback \"%s\" failed.", cbname);
+    conf->stats->refcount = 1;
+    return status;
+  }
+
+  return 0;
+} /* }}} int camqp_stats_init */
+
 static int camqp_subscribe_init(camqp_config_t *conf) /* {{{ */
 {
   int status;
@@ -708,8 +962,10 @@ static int camqp_write_locked(camqp_config_t *conf, /* {{{ */
 
   amqp_basic_properties_t props = {._flags = AMQP_BASIC_CONTENT_TYPE_FLAG |
                                              AMQP_BASIC_DELIVERY_MODE_FLAG |
-                                             AMQP_BASIC_APP_ID_FLAG,
+                                             AMQP_BASIC_APP_ID_FLAG |
+                                             AMQP_BASIC_TIMESTAMP_FLAG,
                                    .delivery_mode = conf->delivery_mode,
+                                   .timestamp = (uint64_t)time(NULL),
                                    .app_id = amqp_cstring_bytes("collectd")};
 
   if (conf->format == CAMQP_FORMAT_COMMAND)
@@ -827,6 +1083,7 @@ static int camqp_config_set_format(oconfig_item_t *ci, /* {{{ */
 static int camqp_config_connection(oconfig_item_t *ci, /* {{{ */
                                    bool publish) {
   camqp_config_t *conf;
+  bool report_stats = false;
   int status;
 
   conf = calloc(1, sizeof(*conf));
@@ -861,6 +1118,9 @@ static int camqp_config_connection(oconfig_item_t *ci, /* {{{ */
   conf->queue = NULL;
   conf->queue_durable = false;
   conf->queue_auto_delete = true;
+  conf->prefetch_count = 0;
+  conf->threads = 1;
+  conf->stats = NULL;
   /* general */
   conf->connection = NULL;
   pthread_mutex_init(&conf->lock, /* attr = */ NULL);
@@ -899,6 +1159,21 @@ static int camqp_config_connection(oconfig_item_t *ci, /* {{{ */
       status = cf_util_get_boolean(child, &conf->queue_durable);
     else if ((strcasecmp("QueueAutoDelete", child->key) == 0) && !publish)
       status = cf_util_get_boolean(child, &conf->queue_auto_delete);
+    else if ((strcasecmp("PrefetchCount", child->key) == 0) && !publish) {
+      status = cf_util_get_int(child, &conf->prefetch_count);
+      if ((status == 0) &&
+          ((conf->prefetch_count < 0) || (conf->prefetch_count > 65535))) {
+        ERROR("amqp plugin: \"PrefetchCount\" must be in the range 0-65535.");
+        status = -1;
+      }
+    } else if ((strcasecmp("Threads", child->key) == 0) && !publish) {
+      status = cf_util_get_int(child, &conf->threads);
+      if ((status == 0) && (conf->threads < 1)) {
+        ERROR("amqp plugin: \"Threads\" must be at least 1.");
+        status = -1;
+      }
+    } else if ((strcasecmp("ReportStats", child->key) == 0) && !publish)
+      status = cf_util_get_boolean(child, &report_stats);
     else if (strcasecmp("RoutingKey", child->key) == 0)
       status = cf_util_get_string(child, &conf->routing_key);
     else if ((strcasecmp("Persistent", child->key) == 0) && publish) {
@@ -958,6 +1233,13 @@ static int camqp_config_connection(oconfig_item_t *ci, /* {{{ */
               "without the \"Exchange\" option. It will be ignored.");
   }
 
+  if ((status == 0) && (conf->threads > 1) && (conf->queue == NULL)) {
+    ERROR("amqp plugin: The \"Threads\" option requires the \"Queue\" "
+          "option, because each thread would otherwise declare its own "
+          "queue and receive a copy of every message.");
+    status = -1;
+  }
+
   if (status != 0) {
     camqp_config_free(conf);
     return status;
@@ -982,6 +1264,30 @@ static int camqp_config_connection(oconfig_item_t *ci, /* {{{ */
       return status;
     }
   } else {
+    if (report_stats) {
+      status = camqp_stats_init(conf);
+      if (status != 0) {
+        camqp_config_free(conf);
+        return status;
+      }
+    }
+
+    /* Every thread gets a copy of the configuration and its own connection;
+     * the broker distributes the queue's messages among them. */
+    for (int i = 1; i < conf->threads; i++) {
+      camqp_config_t *clone = camqp_config_clone(conf);
+      if (clone == NULL) {
+        ERROR("amqp plugin: camqp_config_clone failed.");
+        break;
+      }
+
+      status = camqp_subscribe_init(clone);
+      if (status != 0) {
+        camqp_config_free(clone);
+        break;
+      }
+    }
+
     status = camqp_subscribe_init(conf);
     if (status != 0) {
       camqp_config_free(conf);
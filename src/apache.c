@@ -28,6 +28,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_curl_engine.h"
 
 #include <curl/curl.h>
 
@@ -51,12 +52,14 @@ struct apache_s {
   size_t apache_buffer_fill;
   int timeout;
   CURL *curl;
+  curl_engine_request_t request;
 }; /* apache_s */
 
 typedef struct apache_s apache_t;
 
 /* TODO: Remove this prototype */
 static int apache_read_host(user_data_t *user_data);
+static void apache_done(curl_engine_request_t *req, CURLcode status);
 
 static void apache_free(void *arg) {
   apache_t *st = arg;
@@ -72,11 +75,12 @@ static void apache_free(void *arg) {
   sfree(st->cacert);
   sfree(st->ssl_ciphers);
   sfree(st->server);
-  sfree(st->apache_buffer);
   if (st->curl) {
+    curl_engine_cancel(&st->request);
     curl_easy_cleanup(st->curl);
     st->curl = NULL;
   }
+  sfree(st->apache_buffer);
   sfree(st);
 } /* apache_free */
 
@@ -264,6 +268,11 @@ static int init_host(apache_t *st) /* {{{ */
   curl_easy_setopt(st->curl, CURLOPT_NOSIGNAL, 1L);
   curl_easy_setopt(st->curl, CURLOPT_WRITEFUNCTION, apache_curl_callback);
   curl_easy_setopt(st->curl, CURLOPT_WRITEDATA, st);
+  curl_easy_setopt(st->curl, CURLOPT_URL, st->url);
+
+  st->request.curl = st->curl;
+  st->request.done = apache_done;
+  st->request.user_data = st;
 
   /* not set as yet if the user specified string doesn't match apache or
    * lighttpd, then ignore it. Headers will be parsed to find out the
@@ -464,26 +473,63 @@ static void submit_scoreboard(char *buf, apache_t *st) {
   }
 }
 
-static int apache_read_host(user_data_t *user_data) /* {{{ */
-{
-  apache_t *st = user_data->data;
+/* Handles one "Key: Value" line of the "server-status?auto" output. */
+static void apache_parse_field(apache_t *st, const char *key, /* {{{ */
+                               char *value) {
+  if (strcmp(key, "Scoreboard") == 0) {
+    submit_scoreboard(value, st);
+    return;
+  }
 
-  assert(st->url != NULL);
-  /* (Assured by `config_add') */
+  char *endptr = NULL;
+  long long v = strtoll(value, &endptr, 10);
+  if (endptr == value)
+    return;
 
-  if (st->curl == NULL) {
-    if (init_host(st) != 0)
-      return -1;
-  }
-  assert(st->curl != NULL);
+  if (strcmp(key, "Total Accesses") == 0)
+    submit_derive("apache_requests", "", v, st);
+  else if (strcmp(key, "Total kBytes") == 0)
+    submit_derive("apache_bytes", "", 1024LL * v, st);
+  else if ((strcmp(key, "BusyServers") == 0)    /* Apache 1.* */
+           || (strcmp(key, "BusyWorkers") == 0)) /* Apache 2.* */
+    submit_gauge("apache_connections", NULL, v, st);
+  else if ((strcmp(key, "IdleServers") == 0)    /* Apache 1.x */
+           || (strcmp(key, "IdleWorkers") == 0)) /* Apache 2.x */
+    submit_gauge("apache_idle_workers", NULL, v, st);
+} /* }}} void apache_parse_field */
+
+/* Splits the buffer into lines and fields in place, without copying. */
+static void apache_parse(apache_t *st) /* {{{ */
+{
+  char *line = st->apache_buffer;
+
+  while ((line != NULL) && (*line != 0)) {
+    char *next = strpbrk(line, "\r\n");
+    if (next != NULL)
+      *next++ = 0;
+
+    char *value = strstr(line, ": ");
+    if (value != NULL) {
+      *value = 0;
+      value += strlen(": ");
+      while (isspace((unsigned char)*value))
+        value++;
+      apache_parse_field(st, line, value);
+    }
 
-  st->apache_buffer_fill = 0;
+    line = next;
+  }
+} /* }}} void apache_parse */
 
-  curl_easy_setopt(st->curl, CURLOPT_URL, st->url);
+/* Called by the cURL engine once the transfer started by apache_read_host()
+ * has finished. */
+static void apache_done(curl_engine_request_t *req, /* {{{ */
+                        CURLcode status) {
+  apache_t *st = req->user_data;
 
-  if (curl_easy_perform(st->curl) != CURLE_OK) {
+  if (status != CURLE_OK) {
     ERROR("apache: curl_easy_perform failed: %s", st->apache_curl_error);
-    return -1;
+    return;
   }
 
   /* fallback - server_type to apache if not set at this time */
@@ -495,8 +541,7 @@ static int apache_read_host(user_data_t *user_data) /* {{{ */
 
   char *content_type;
   static const char *text_plain = "text/plain";
-  int status =
-      curl_easy_getinfo(st->curl, CURLINFO_CONTENT_TYPE, &content_type);
+  status = curl_easy_getinfo(st->curl, CURLINFO_CONTENT_TYPE, &content_type);
   if ((status == CURLE_OK) && (content_type != NULL) &&
       (strncasecmp(content_type, text_plain, strlen(text_plain)) != 0)) {
     WARNING("apache plugin: `Content-Type' response header is not `%s' "
@@ -505,35 +550,43 @@ static int apache_read_host(user_data_t *user_data) /* {{{ */
             text_plain, content_type);
   }
 
-  char *ptr = st->apache_buffer;
-  char *saveptr = NULL;
-  char *line;
-  while ((line = strtok_r(ptr, "\n\r", &saveptr)) != NULL) {
-    ptr = NULL;
-    char *fields[4];
-
-    int fields_num = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
-
-    if (fields_num == 3) {
-      if ((strcmp(fields[0], "Total") == 0) &&
-          (strcmp(fields[1], "Accesses:") == 0))
-        submit_derive("apache_requests", "", atoll(fields[2]), st);
-      else if ((strcmp(fields[0], "Total") == 0) &&
-               (strcmp(fields[1], "kBytes:") == 0))
-        submit_derive("apache_bytes", "", 1024LL * atoll(fields[2]), st);
-    } else if (fields_num == 2) {
-      if (strcmp(fields[0], "Scoreboard:") == 0)
-        submit_scoreboard(fields[1], st);
-      else if ((strcmp(fields[0], "BusyServers:") == 0) /* Apache 1.* */
-               || (strcmp(fields[0], "BusyWorkers:") == 0) /* Apache 2.* */)
-        submit_gauge("apache_connections", NULL, atol(fields[1]), st);
-      else if ((strcmp(fields[0], "IdleServers:") == 0) /* Apache 1.x */
-               || (strcmp(fields[0], "IdleWorkers:") == 0) /* Apache 2.x */)
-        submit_gauge("apache_idle_workers", NULL, atol(fields[1]), st);
-    }
+  apache_parse(st);
+
+  st->apache_buffer_fill = 0;
+} /* }}} void apache_done */
+
+static int apache_read_host(user_data_t *user_data) /* {{{ */
+{
+  apache_t *st = user_data->data;
+
+  assert(st->url != NULL);
+  /* (Assured by `config_add') */
+
+  if (st->curl == NULL) {
+    if (init_host(st) != 0)
+      return -1;
+  }
+  assert(st->curl != NULL);
+
+  /* The transfer is performed by the engine thread; results are dispatched
+   * from apache_done(). */
+  if (curl_engine_busy(&st->request)) {
+    WARNING("apache plugin: Request for \"%s\" is still in progress, "
+            "skipping this interval.",
+            st->url);
+    return 0;
   }
 
   st->apache_buffer_fill = 0;
+  if (st->apache_buffer != NULL)
+    st->apache_buffer[0] = 0;
+
+  int status = curl_engine_submit(&st->request);
+  if (status != 0) {
+    ERROR("apache plugin: Submitting request for \"%s\" failed: %s", st->url,
+          STRERROR(status));
+    return -1;
+  }
 
   return 0;
 } /* }}} int apache_read_host */
@@ -546,7 +599,14 @@ static int apache_init(void) /* {{{ */
   return 0;
 } /* }}} int apache_init */
 
+static int apache_shutdown(void) /* {{{ */
+{
+  curl_engine_shutdown();
+  return 0;
+} /* }}} int apache_shutdown */
+
 void module_register(void) {
   plugin_register_complex_config("apache", config);
   plugin_register_init("apache", apache_init);
+  plugin_register_shutdown("apache", apache_shutdown);
 } /* void module_register */
@@ -0,0 +1,108 @@
+/**
+ * collectd - src/benchmark.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Minimal micro-benchmark harness, the counterpart of testing.h. Benchmarks
+ * are defined with DEF_BENCH() and run with RUN_BENCH(). Each run prints one
+ * JSON object per line, e.g.
+ *
+ *   {"benchmark":"format_name","iterations":1000000,"ns_per_op":123.4,
+ *    "ops_per_sec":8103727.7}
+ *
+ * The environment variable BENCH_SCALE multiplies all iteration counts, e.g.
+ * "BENCH_SCALE=0.01 make bench" for a quick run. BENCH_FILTER restricts the
+ * run to benchmarks whose name contains the given string.
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H 1
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Benchmarks store results here so that the compiler can't optimize the
+ * measured code away. */
+static volatile uint64_t bench_sink__;
+
+#define DEF_BENCH(func) static void bench_##func(uint64_t iterations)
+
+#define RUN_BENCH(func, iterations)                                            \
+  bench_run__(#func, bench_##func, (iterations))
+
+#define BENCH_SINK(value) bench_sink__ += (uint64_t)(value)
+
+#define END_BENCH exit(0);
+
+static inline uint64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec) * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t bench_iterations(uint64_t iterations) {
+  char const *scale = getenv("BENCH_SCALE");
+  if (scale != NULL) {
+    double tmp = ((double)iterations) * atof(scale);
+    iterations = (tmp < 1.0) ? 1 : (uint64_t)tmp;
+  }
+  return iterations;
+}
+
+static inline bool bench_enabled(char const *name) {
+  char const *filter = getenv("BENCH_FILTER");
+  return (filter == NULL) || (strstr(name, filter) != NULL);
+}
+
+/* Prints the result of a benchmark which took "elapsed" nanoseconds for
+ * "iterations" operations. */
+static inline void bench_report(char const *name, uint64_t iterations,
+                                uint64_t elapsed) {
+  if (elapsed == 0)
+    elapsed = 1;
+  printf("{\"benchmark\":\"%s\",\"iterations\":%" PRIu64 ",\"ns_per_op\":%.1f,"
+         "\"ops_per_sec\":%.1f}\n",
+         name, iterations, ((double)elapsed) / ((double)iterations),
+         1e9 * ((double)iterations) / ((double)elapsed));
+  fflush(stdout);
+}
+
+static inline void bench_run__(char const *name, void (*func)(uint64_t),
+                               uint64_t iterations) {
+  if (!bench_enabled(name))
+    return;
+
+  iterations = bench_iterations(iterations);
+
+  /* Warm up caches and lazily initialized state. */
+  func((iterations / 10) + 1);
+
+  uint64_t start = bench_now();
+  func(iterations);
+  bench_report(name, iterations, bench_now() - start);
+}
+
+#endif /* BENCHMARK_H */
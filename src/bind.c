@@ -58,6 +58,17 @@
 #include <libxml/parser.h>
 #include <libxml/xpath.h>
 
+#if HAVE_LIBYAJL
+#include <yajl/yajl_parse.h>
+#if HAVE_YAJL_YAJL_VERSION_H
+#include <yajl/yajl_version.h>
+#endif
+
+#if defined(YAJL_MAJOR) && (YAJL_MAJOR > 1)
+#define HAVE_YAJL_V2 1
+#endif
+#endif /* HAVE_LIBYAJL */
+
 #ifndef BIND_DEFAULT_URL
 #define BIND_DEFAULT_URL "http://localhost:8053/"
 #endif
@@ -102,6 +113,14 @@ struct list_info_ptr_s {
 };
 typedef struct list_info_ptr_s list_info_ptr_t;
 
+/* Compiled XPath expression, cached across reads. */
+struct bind_xpath_s {
+  char *expression;
+  xmlXPathCompExpr *compiled;
+  struct bind_xpath_s *next;
+};
+typedef struct bind_xpath_s bind_xpath_t;
+
 /* FIXME: Enabled by default for backwards compatibility. */
 /* TODO: Remove time parsing code. */
 static bool config_parse_time = true;
@@ -114,6 +133,7 @@ static _Bool global_zone_maint_stats = 1;
 static _Bool global_resolver_stats;
 static _Bool global_memory_stats = 1;
 static int timeout = -1;
+static _Bool format_json;
 
 static cb_view_t *views;
 static size_t views_num;
@@ -125,6 +145,8 @@ static size_t bind_buffer_size;
 static size_t bind_buffer_fill;
 static char bind_curl_error[CURL_ERROR_SIZE];
 
+static bind_xpath_t *xpath_cache;
+
 /* Translation table for the `nsstats' values. */
 static const translation_info_t nsstats_translation_table[] = /* {{{ */
     {
@@ -331,6 +353,55 @@ static int bind_xml_list_callback(const char *name, /* {{{ */
   return 0;
 } /* }}} int bind_xml_list_callback */
 
+/*
+ * Evaluates an XPath expression, compiling it only the first time it is used.
+ * The expressions used by this plugin are fixed strings, so the cache is
+ * bounded and lives until shutdown.
+ */
+static xmlXPathObject *bind_xpath_eval(const char *expression, /* {{{ */
+                                       xmlXPathContext *ctx) {
+  bind_xpath_t *xpath;
+
+  for (xpath = xpath_cache; xpath != NULL; xpath = xpath->next)
+    if (strcmp(expression, xpath->expression) == 0)
+      break;
+
+  if (xpath == NULL) {
+    xpath = calloc(1, sizeof(*xpath));
+    if (xpath == NULL) {
+      ERROR("bind plugin: calloc failed.");
+      return NULL;
+    }
+
+    xpath->compiled = xmlXPathCompile(BAD_CAST expression);
+    if (xpath->compiled == NULL) {
+      ERROR("bind plugin: Unable to compile XPath expression `%s'.",
+            expression);
+      sfree(xpath);
+      return NULL;
+    }
+    xpath->expression = sstrdup(expression);
+
+    xpath->next = xpath_cache;
+    xpath_cache = xpath;
+  }
+
+  return xmlXPathCompiledEval(xpath->compiled, ctx);
+} /* }}} xmlXPathObject *bind_xpath_eval */
+
+static void bind_xpath_cache_free(void) /* {{{ */
+{
+  while (xpath_cache != NULL) {
+    bind_xpath_t *next = xpath_cache->next;
+
+    xmlXPathFreeCompExpr(xpath_cache->compiled);
+    sfree(xpath_cache->expression);
+    sfree(xpath_cache);
+
+    xpath_cache = next;
+  }
+} /* }}} void bind_xpath_cache_free */
+
 static int bind_xml_read_derive(xmlDoc *doc, xmlNode *node, /* {{{ */
                                 derive_t *ret_value) {
   char *str_ptr = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
@@ -378,11 +449,42 @@ static int bind_xml_read_gauge(xmlDoc *doc, xmlNode *node, /* {{{ */
   return 0;
 } /* }}} int bind_xml_read_gauge */
 
+/* Parses the "current-time" format used by BIND, e.g. 2013-02-27T16:48:12Z. */
+static int bind_parse_timestamp(const char *str, time_t *ret_value) /* {{{ */
+{
+  struct tm tm = {0};
+  char *tmp = strptime(str, "%Y-%m-%dT%T", &tm);
+  if (tmp == NULL) {
+    ERROR("bind plugin: bind_parse_timestamp: strptime failed.");
+    return -1;
+  }
+
+#if HAVE_TIMEGM
+  time_t t = timegm(&tm);
+  if (t == ((time_t)-1)) {
+    ERROR("bind plugin: timegm() failed: %s", STRERRNO);
+    return -1;
+  }
+  *ret_value = t;
+#else
+  time_t t = mktime(&tm);
+  if (t == ((time_t)-1)) {
+    ERROR("bind plugin: mktime() failed: %s", STRERRNO);
+    return -1;
+  }
+  /* mktime assumes that tm is local time. Luckily, it also sets timezone to
+   * the offset used for the conversion, and we undo the conversion to convert
+   * back to UTC. */
+  *ret_value = t - timezone;
+#endif
+
+  return 0;
+} /* }}} int bind_parse_timestamp */
+
 static int bind_xml_read_timestamp(const char *xpath_expression, /* {{{ */
                                    xmlDoc *doc, xmlXPathContext *xpathCtx,
                                    time_t *ret_value) {
-  xmlXPathObject *xpathObj =
-      xmlXPathEvalExpression(BAD_CAST xpath_expression, xpathCtx);
+  xmlXPathObject *xpathObj = bind_xpath_eval(xpath_expression, xpathCtx);
   if (xpathObj == NULL) {
     ERROR("bind plugin: Unable to evaluate XPath expression `%s'.",
           xpath_expression);
@@ -416,36 +518,10 @@ static int bind_xml_read_timestamp(const char *xpath_expression, /* {{{ */
     return -1;
   }
 
-  struct tm tm = {0};
-  char *tmp = strptime(str_ptr, "%Y-%m-%dT%T", &tm);
+  int status = bind_parse_timestamp(str_ptr, ret_value);
   xmlFree(str_ptr);
-  if (tmp == NULL) {
-    ERROR("bind plugin: bind_xml_read_timestamp: strptime failed.");
-    xmlXPathFreeObject(xpathObj);
-    return -1;
-  }
-
-#if HAVE_TIMEGM
-  time_t t = timegm(&tm);
-  if (t == ((time_t)-1)) {
-    ERROR("bind plugin: timegm() failed: %s", STRERRNO);
-    return -1;
-  }
-  *ret_value = t;
-#else
-  time_t t = mktime(&tm);
-  if (t == ((time_t)-1)) {
-    ERROR("bind plugin: mktime() failed: %s", STRERRNO);
-    return -1;
-  }
-  /* mktime assumes that tm is local time. Luckily, it also sets timezone to
-   * the offset used for the conversion, and we undo the conversion to convert
-   * back to UTC. */
-  *ret_value = t - timezone;
-#endif
-
   xmlXPathFreeObject(xpathObj);
-  return 0;
+  return status;
 } /* }}} int bind_xml_read_timestamp */
 
 /*
@@ -462,8 +538,7 @@ static int bind_parse_generic_name_value(const char *xpath_expression, /* {{{ */
                                          void *user_data, xmlDoc *doc,
                                          xmlXPathContext *xpathCtx,
                                          time_t current_time, int ds_type) {
-  xmlXPathObject *xpathObj =
-      xmlXPathEvalExpression(BAD_CAST xpath_expression, xpathCtx);
+  xmlXPathObject *xpathObj = bind_xpath_eval(xpath_expression, xpathCtx);
   if (xpathObj == NULL) {
     ERROR("bind plugin: Unable to evaluate XPath expression `%s'.",
           xpath_expression);
@@ -541,8 +616,7 @@ static int bind_parse_generic_value_list(const char *xpath_expression, /* {{{ */
                                          void *user_data, xmlDoc *doc,
                                          xmlXPathContext *xpathCtx,
                                          time_t current_time, int ds_type) {
-  xmlXPathObject *xpathObj =
-      xmlXPathEvalExpression(BAD_CAST xpath_expression, xpathCtx);
+  xmlXPathObject *xpathObj = bind_xpath_eval(xpath_expression, xpathCtx);
   if (xpathObj == NULL) {
     ERROR("bind plugin: Unable to evaluate XPath expression `%s'.",
           xpath_expression);
@@ -601,8 +675,7 @@ static int bind_parse_generic_name_attr_value_list(
     list_callback_t list_callback, void *user_data, xmlDoc *doc,
     xmlXPathContext *xpathCtx, time_t current_time, int ds_type) {
 
-  xmlXPathObject *xpathObj =
-      xmlXPathEvalExpression(BAD_CAST xpath_expression, xpathCtx);
+  xmlXPathObject *xpathObj = bind_xpath_eval(xpath_expression, xpathCtx);
   if (xpathObj == NULL) {
     ERROR("bind plugin: Unable to evaluate XPath expression `%s'.",
           xpath_expression);
@@ -671,10 +744,9 @@ static int bind_xml_stats_handle_zone(int version, xmlDoc *doc, /* {{{ */
     xmlFree(n);
     xmlFree(c);
   } else {
-    xmlXPathObject *path_obj =
-        xmlXPathEvalExpression(BAD_CAST "name", path_ctx);
+    xmlXPathObject *path_obj = bind_xpath_eval("name", path_ctx);
     if (path_obj == NULL) {
-      ERROR("bind plugin: xmlXPathEvalExpression failed.");
+      ERROR("bind plugin: bind_xpath_eval failed.");
       return -1;
     }
 
@@ -750,8 +822,7 @@ static int bind_xml_stats_search_zones(int version, xmlDoc *doc, /* {{{ */
     return -1;
   }
 
-  xmlXPathObject *zone_nodes =
-      xmlXPathEvalExpression(BAD_CAST "zones/zone", path_ctx);
+  xmlXPathObject *zone_nodes = bind_xpath_eval("zones/zone", path_ctx);
   if (zone_nodes == NULL) {
     ERROR("bind plugin: Cannot find any <view> tags.");
     xmlXPathFreeContext(zone_path_context);
@@ -796,10 +867,9 @@ static int bind_xml_stats_handle_view(int version, xmlDoc *doc, /* {{{ */
     xmlFree(view_name);
     view_name = NULL;
   } else {
-    xmlXPathObject *path_obj =
-        xmlXPathEvalExpression(BAD_CAST "name", path_ctx);
+    xmlXPathObject *path_obj = bind_xpath_eval("name", path_ctx);
     if (path_obj == NULL) {
-      ERROR("bind plugin: xmlXPathEvalExpression failed.");
+      ERROR("bind plugin: bind_xpath_eval failed.");
       return -1;
     }
 
@@ -913,8 +983,7 @@ static int bind_xml_stats_search_views(int version, xmlDoc *doc, /* {{{ */
     return -1;
   }
 
-  xmlXPathObject *view_nodes =
-      xmlXPathEvalExpression(BAD_CAST "views/view", xpathCtx);
+  xmlXPathObject *view_nodes = bind_xpath_eval("views/view", xpathCtx);
   if (view_nodes == NULL) {
     ERROR("bind plugin: Cannot find any <view> tags.");
     xmlXPathFreeContext(view_path_context);
@@ -1272,13 +1341,16 @@ static int bind_xml_stats(int version, xmlDoc *doc, /* {{{ */
   return 0;
 } /* }}} int bind_xml_stats */
 
-static int bind_xml(const char *data) /* {{{ */
+static int bind_xml(const char *data, size_t data_len) /* {{{ */
 {
   int ret = -1;
 
-  xmlDoc *doc = xmlParseMemory(data, strlen(data));
+  /* Blank text nodes are never looked at, so don't create them. */
+  xmlDoc *doc =
+      xmlReadMemory(data, (int)data_len, /* URL = */ NULL, /* encoding = */ NULL,
+                    XML_PARSE_NONET | XML_PARSE_NOBLANKS | XML_PARSE_COMPACT);
   if (doc == NULL) {
-    ERROR("bind plugin: xmlParseMemory failed.");
+    ERROR("bind plugin: xmlReadMemory failed.");
     return -1;
   }
 
@@ -1293,8 +1365,7 @@ static int bind_xml(const char *data) /* {{{ */
   // version 3.* of statistics XML (since BIND9.9)
   //
 
-  xmlXPathObject *xpathObj =
-      xmlXPathEvalExpression(BAD_CAST "/statistics", xpathCtx);
+  xmlXPathObject *xpathObj = bind_xpath_eval("/statistics", xpathCtx);
   if (xpathObj == NULL || xpathObj->nodesetval == NULL ||
       xpathObj->nodesetval->nodeNr == 0) {
     DEBUG("bind plugin: Statistics appears not to be v3");
@@ -1346,14 +1417,14 @@ static int bind_xml(const char *data) /* {{{ */
   // versions 1.* or 2.* of statistics XML
   //
 
-  xpathObj = xmlXPathEvalExpression(BAD_CAST "/isc/bind/statistics", xpathCtx);
+  xpathObj = bind_xpath_eval("/isc/bind/statistics", xpathCtx);
   if (xpathObj == NULL) {
     ERROR("bind plugin: Cannot find the <statistics> tag.");
     xmlXPathFreeContext(xpathCtx);
     xmlFreeDoc(doc);
     return -1;
   } else if (xpathObj->nodesetval == NULL) {
-    ERROR("bind plugin: xmlXPathEvalExpression failed.");
+    ERROR("bind plugin: bind_xpath_eval failed.");
     xmlXPathFreeObject(xpathObj);
     xmlXPathFreeContext(xpathCtx);
     xmlFreeDoc(doc);
@@ -1408,6 +1479,453 @@ static int bind_xml(const char *data) /* {{{ */
   return ret;
 } /* }}} int bind_xml */
 
+#if HAVE_LIBYAJL
+/*
+ * JSON statistics channel (BIND 9.10 and later)
+ *
+ * The documents are parsed while they are being downloaded, without building
+ * a tree. Only the endpoints needed for the enabled statistics are requested
+ * and subtrees of no interest, such as the per-context memory statistics, are
+ * skipped without looking at their contents.
+ */
+#if HAVE_YAJL_V2
+typedef size_t yajl_len_t;
+#else
+typedef unsigned int yajl_len_t;
+#endif
+
+#define BIND_JSON_MAX_DEPTH 8
+
+/* Top level objects of the "server" and "mem" documents. */
+struct bind_json_section_s {
+  const char *document;
+  const char *name;
+  _Bool *enabled;
+  const translation_info_t *table;
+  size_t table_length;
+  const char *plugin_instance;
+  const char *type;
+  int ds_type;
+};
+typedef struct bind_json_section_s bind_json_section_t;
+
+static const bind_json_section_t json_sections[] = /* {{{ */
+    {{"server", "opcodes", &global_opcodes, NULL, 0, "global-opcodes",
+      "dns_opcode", DS_TYPE_DERIVE},
+     {"server", "qtypes", &global_qtypes, NULL, 0, "global-qtypes", "dns_qtype",
+      DS_TYPE_DERIVE},
+     {"server", "nsstats", &global_server_stats, nsstats_translation_table,
+      STATIC_ARRAY_SIZE(nsstats_translation_table), "global-server_stats",
+      NULL, DS_TYPE_DERIVE},
+     {"server", "zonestats", &global_zone_maint_stats,
+      zonestats_translation_table,
+      STATIC_ARRAY_SIZE(zonestats_translation_table),
+      "global-zone_maint_stats", NULL, DS_TYPE_DERIVE},
+     {"server", "resstats", &global_resolver_stats, resstats_translation_table,
+      STATIC_ARRAY_SIZE(resstats_translation_table), "global-resolver_stats",
+      NULL, DS_TYPE_DERIVE},
+     {"mem", "memory", &global_memory_stats, memsummary_translation_table,
+      STATIC_ARRAY_SIZE(memsummary_translation_table), "global-memory_stats",
+      NULL, DS_TYPE_GAUGE}};
+/* }}} */
+
+struct bind_json_state_s {
+  yajl_handle yajl;
+  const char *document;
+
+  /* Number of open maps and arrays and the key of the current element on
+   * each level. Elements of arrays have an empty key. */
+  int depth;
+  char keys[BIND_JSON_MAX_DEPTH][DATA_MAX_NAME_LEN];
+
+  /* Depth of the outermost map or array being skipped, zero if none. */
+  int skip_depth;
+
+  time_t current_time;
+
+  /* Set while inside a configured view. */
+  cb_view_t *view;
+
+  /* The zone object being parsed and the configured zone it matches. */
+  char zone_name[DATA_MAX_NAME_LEN];
+  char zone_class[DATA_MAX_NAME_LEN];
+  char *zone;
+};
+typedef struct bind_json_state_s bind_json_state_t;
+
+static const bind_json_section_t *
+bind_json_section(const char *document, const char *name) /* {{{ */
+{
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(json_sections); i++) {
+    const bind_json_section_t *section = json_sections + i;
+
+    if ((strcmp(document, section->document) == 0) &&
+        (strcmp(name, section->name) == 0))
+      return *section->enabled ? section : NULL;
+  }
+
+  return NULL;
+} /* }}} bind_json_section_t *bind_json_section */
+
+static cb_view_t *bind_json_view(const char *name) /* {{{ */
+{
+  for (size_t i = 0; i < views_num; i++)
+    if (strcasecmp(name, views[i].name) == 0)
+      return views + i;
+
+  return NULL;
+} /* }}} cb_view_t *bind_json_view */
+
+/* Looks up the zone object being parsed in the configuration of its view.
+ * Zones are identified as "<name>/<class>", as with the XML version 3. */
+static char *bind_json_zone(bind_json_state_t *s) /* {{{ */
+{
+  char zone_name[2 * DATA_MAX_NAME_LEN];
+
+  if ((s->zone_name[0] == 0) || (s->zone_class[0] == 0))
+    return NULL;
+
+  snprintf(zone_name, sizeof(zone_name), "%s/%s", s->zone_name,
+           s->zone_class);
+
+  for (size_t i = 0; i < s->view->zones_num; i++)
+    if (strcasecmp(zone_name, s->view->zones[i]) == 0)
+      return s->view->zones[i];
+
+  return NULL;
+} /* }}} char *bind_json_zone */
+
+/* Decides whether the map or array just opened at s->depth is of interest.
+ * The keys of all enclosing levels are known at this point. */
+static bool bind_json_wanted(bind_json_state_t *s) /* {{{ */
+{
+  const char(*k)[DATA_MAX_NAME_LEN] = s->keys;
+  bool server = (strcmp("server", s->document) == 0);
+
+  switch (s->depth) {
+  case 1:
+    return true;
+  case 2:
+    if (strcmp("views", k[0]) == 0)
+      return views_num > 0;
+    return bind_json_section(s->document, k[0]) != NULL;
+  case 3:
+    /* views/<view> */
+    if (strcmp("views", k[0]) != 0)
+      return false;
+    s->view = bind_json_view(k[1]);
+    return s->view != NULL;
+  case 4:
+    /* views/<view>/resolver is part of the "server" document,
+     * views/<view>/zones of the "zones" document. */
+    if (strcmp("resolver", k[2]) == 0)
+      return server && (s->view->qtypes || s->view->resolver_stats ||
+                        s->view->cacherrsets);
+    if (strcmp("zones", k[2]) == 0)
+      return !server && (s->view->zones_num > 0);
+    return false;
+  case 5:
+    if (strcmp("resolver", k[2]) == 0)
+      return (s->view->qtypes && (strcmp("qtypes", k[3]) == 0)) ||
+             (s->view->resolver_stats && (strcmp("stats", k[3]) == 0)) ||
+             (s->view->cacherrsets && (strcmp("cache", k[3]) == 0));
+
+    /* an element of views/<view>/zones */
+    s->zone_name[0] = 0;
+    s->zone_class[0] = 0;
+    s->zone = NULL;
+    return true;
+  case 6:
+    /* views/<view>/zones/<n>/{rcodes,qtypes} */
+    if ((strcmp("rcodes", k[4]) != 0) && (strcmp("qtypes", k[4]) != 0))
+      return false;
+    s->zone = bind_json_zone(s);
+    return s->zone != NULL;
+  default:
+    return false;
+  }
+} /* }}} bool bind_json_wanted */
+
+static int bind_json_open(void *ctx) /* {{{ */
+{
+  bind_json_state_t *s = ctx;
+
+  s->depth++;
+  if (s->depth <= BIND_JSON_MAX_DEPTH)
+    s->keys[s->depth - 1][0] = 0;
+
+  if ((s->skip_depth == 0) && !bind_json_wanted(s))
+    s->skip_depth = s->depth;
+
+  return 1;
+} /* }}} int bind_json_open */
+
+static int bind_json_close(void *ctx) /* {{{ */
+{
+  bind_json_state_t *s = ctx;
+
+  if (s->skip_depth == s->depth)
+    s->skip_depth = 0;
+  s->depth--;
+
+  return 1;
+} /* }}} int bind_json_close */
+
+static int bind_json_map_key(void *ctx, const unsigned char *key, /* {{{ */
+                             yajl_len_t key_len) {
+  bind_json_state_t *s = ctx;
+
+  if ((s->skip_depth != 0) || (s->depth < 1) ||
+      (s->depth > BIND_JSON_MAX_DEPTH))
+    return 1;
+
+  char *buffer = s->keys[s->depth - 1];
+  size_t len = ((size_t)key_len < DATA_MAX_NAME_LEN) ? (size_t)key_len
+                                                     : DATA_MAX_NAME_LEN - 1;
+  memcpy(buffer, key, len);
+  buffer[len] = 0;
+
+  return 1;
+} /* }}} int bind_json_map_key */
+
+static int bind_json_string(void *ctx, const unsigned char *str, /* {{{ */
+                            yajl_len_t str_len) {
+  bind_json_state_t *s = ctx;
+  char buffer[DATA_MAX_NAME_LEN];
+
+  if ((s->skip_depth != 0) || ((size_t)str_len >= sizeof(buffer)))
+    return 1;
+
+  memcpy(buffer, str, str_len);
+  buffer[str_len] = 0;
+
+  if ((s->depth == 1) && (strcmp("current-time", s->keys[0]) == 0)) {
+    if (bind_parse_timestamp(buffer, &s->current_time) != 0)
+      ERROR("bind plugin: Reading `current-time' failed.");
+    DEBUG("bind plugin: Current server time is %i.", (int)s->current_time);
+  } else if ((s->depth == 5) && (strcmp("zones", s->keys[2]) == 0)) {
+    if (strcmp("name", s->keys[4]) == 0)
+      sstrncpy(s->zone_name, buffer, sizeof(s->zone_name));
+    else if (strcmp("class", s->keys[4]) == 0)
+      sstrncpy(s->zone_class, buffer, sizeof(s->zone_class));
+  }
+
+  return 1;
+} /* }}} int bind_json_string */
+
+static void bind_json_submit_table(bind_json_state_t *s, /* {{{ */
+                                   const translation_info_t *table,
+                                   size_t table_length,
+                                   const char *plugin_instance, value_t value) {
+  translation_table_ptr_t table_ptr = {table, table_length, plugin_instance};
+
+  bind_xml_table_callback(s->keys[s->depth - 1], value, s->current_time,
+                          &table_ptr);
+} /* }}} void bind_json_submit_table */
+
+static void bind_json_submit_list(bind_json_state_t *s, /* {{{ */
+                                  const char *plugin_instance,
+                                  const char *type, value_t value) {
+  list_info_ptr_t list_info = {plugin_instance, type};
+
+  bind_xml_list_callback(s->keys[s->depth - 1], value, s->current_time,
+                         &list_info);
+} /* }}} void bind_json_submit_list */
+
+static int bind_json_number(void *ctx, const char *number, /* {{{ */
+                            yajl_len_t number_len) {
+  bind_json_state_t *s = ctx;
+  char buffer[64];
+  value_t value;
+
+  if ((s->skip_depth != 0) || (s->depth < 2) ||
+      ((size_t)number_len >= sizeof(buffer)))
+    return 1;
+
+  memcpy(buffer, number, number_len);
+  buffer[number_len] = 0;
+
+  if (s->depth == 2) {
+    const bind_json_section_t *section =
+        bind_json_section(s->document, s->keys[0]);
+    if ((section == NULL) || (parse_value(buffer, &value, section->ds_type)))
+      return 1;
+
+    if (section->table != NULL)
+      bind_json_submit_table(s, section->table, section->table_length,
+                             section->plugin_instance, value);
+    else
+      bind_json_submit_list(s, section->plugin_instance, section->type, value);
+  } else if ((s->depth == 5) && (strcmp("resolver", s->keys[2]) == 0)) {
+    char plugin_instance[DATA_MAX_NAME_LEN];
+    const char *section = s->keys[3];
+
+    if (strcmp("qtypes", section) == 0) {
+      if (parse_value(buffer, &value, DS_TYPE_DERIVE) != 0)
+        return 1;
+      snprintf(plugin_instance, sizeof(plugin_instance), "%s-qtypes",
+               s->view->name);
+      bind_json_submit_list(s, plugin_instance, "dns_qtype", value);
+    } else if (strcmp("stats", section) == 0) {
+      if (parse_value(buffer, &value, DS_TYPE_DERIVE) != 0)
+        return 1;
+      snprintf(plugin_instance, sizeof(plugin_instance), "%s-resolver_stats",
+               s->view->name);
+      bind_json_submit_table(s, resstats_translation_table,
+                             STATIC_ARRAY_SIZE(resstats_translation_table),
+                             plugin_instance, value);
+    } else if (strcmp("cache", section) == 0) {
+      if (parse_value(buffer, &value, DS_TYPE_GAUGE) != 0)
+        return 1;
+      snprintf(plugin_instance, sizeof(plugin_instance), "%s-cache_rr_sets",
+               s->view->name);
+      bind_json_submit_list(s, plugin_instance, "dns_qtype_cached", value);
+    }
+  } else if ((s->depth == 6) && (s->zone != NULL)) {
+    char plugin_instance[DATA_MAX_NAME_LEN];
+
+    if (parse_value(buffer, &value, DS_TYPE_DERIVE) != 0)
+      return 1;
+
+    snprintf(plugin_instance, sizeof(plugin_instance), "%s-zone-%s",
+             s->view->name, s->zone);
+    if (strcmp("rcodes", s->keys[4]) == 0)
+      bind_json_submit_table(s, nsstats_translation_table,
+                             STATIC_ARRAY_SIZE(nsstats_translation_table),
+                             plugin_instance, value);
+    else
+      bind_json_submit_list(s, plugin_instance, "dns_qtype", value);
+  }
+
+  return 1;
+} /* }}} int bind_json_number */
+
+static yajl_callbacks bind_json_callbacks = {
+    /* null = */ NULL,
+    /* boolean = */ NULL,
+    /* integer = */ NULL,
+    /* double = */ NULL,
+    /* number = */ bind_json_number,
+    /* string = */ bind_json_string,
+    /* start_map = */ bind_json_open,
+    /* map_key = */ bind_json_map_key,
+    /* end_map = */ bind_json_close,
+    /* start_array = */ bind_json_open,
+    /* end_array = */ bind_json_close};
+
+static size_t bind_json_curl_callback(void *buf, size_t size, /* {{{ */
+                                      size_t nmemb, void *user_data) {
+  bind_json_state_t *s = user_data;
+  size_t len = size * nmemb;
+
+  if (len == 0)
+    return len;
+
+  yajl_status status = yajl_parse(s->yajl, (unsigned char *)buf, len);
+  if (status == yajl_status_ok)
+    return len;
+#if !HAVE_YAJL_V2
+  else if (status == yajl_status_insufficient_data)
+    return len;
+#endif
+
+  unsigned char *msg =
+      yajl_get_error(s->yajl, /* verbose = */ 1,
+                     /* jsonText = */ (unsigned char *)buf, (unsigned int)len);
+  ERROR("bind plugin: yajl_parse failed: %s", msg);
+  yajl_free_error(s->yajl, msg);
+  return 0; /* abort write callback */
+} /* }}} size_t bind_json_curl_callback */
+
+/* Downloads and parses one document, e.g. "server" for "/json/v1/server". */
+static int bind_json_fetch(const char *document) /* {{{ */
+{
+  const char *base = (url != NULL) ? url : BIND_DEFAULT_URL;
+  size_t base_len = strlen(base);
+  bool slash = (base_len > 0) && (base[base_len - 1] == '/');
+
+  char *document_url =
+      ssnprintf_alloc("%s%sjson/v1/%s", base, slash ? "" : "/", document);
+  if (document_url == NULL) {
+    ERROR("bind plugin: ssnprintf_alloc failed.");
+    return -1;
+  }
+
+  bind_json_state_t s = {
+      .document = document,
+  };
+  s.yajl = yajl_alloc(&bind_json_callbacks,
+#if HAVE_YAJL_V2
+                      /* alloc funcs = */ NULL,
+#else
+                      /* alloc funcs = */ NULL, NULL,
+#endif
+                      /* context = */ &s);
+  if (s.yajl == NULL) {
+    ERROR("bind plugin: yajl_alloc failed.");
+    sfree(document_url);
+    return -1;
+  }
+
+  curl_easy_setopt(curl, CURLOPT_URL, document_url);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &s);
+
+  CURLcode rc = curl_easy_perform(curl);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+  if (rc != CURLE_OK) {
+    ERROR("bind plugin: curl_easy_perform(%s) failed: %s", document_url,
+          bind_curl_error);
+    yajl_free(s.yajl);
+    sfree(document_url);
+    return -1;
+  }
+
+#if HAVE_YAJL_V2
+  yajl_status status = yajl_complete_parse(s.yajl);
+#else
+  yajl_status status = yajl_parse_complete(s.yajl);
+#endif
+  if (status != yajl_status_ok) {
+    unsigned char *errmsg =
+        yajl_get_error(s.yajl, /* verbose = */ 0,
+                       /* jsonText = */ NULL, /* jsonTextLen = */ 0);
+    ERROR("bind plugin: Parsing %s failed: %s", document_url, (char *)errmsg);
+    yajl_free_error(s.yajl, errmsg);
+    yajl_free(s.yajl);
+    sfree(document_url);
+    return -1;
+  }
+
+  yajl_free(s.yajl);
+  sfree(document_url);
+  return 0;
+} /* }}} int bind_json_fetch */
+
+static int bind_json(void) /* {{{ */
+{
+  bool server = global_opcodes || global_qtypes || global_server_stats ||
+                global_zone_maint_stats || global_resolver_stats;
+  bool zones = false;
+  int status = 0;
+
+  for (size_t i = 0; i < views_num; i++) {
+    if (views[i].qtypes || views[i].resolver_stats || views[i].cacherrsets)
+      server = true;
+    if (views[i].zones_num > 0)
+      zones = true;
+  }
+
+  if (server && (bind_json_fetch("server") != 0))
+    status = -1;
+  if (global_memory_stats && (bind_json_fetch("mem") != 0))
+    status = -1;
+  if (zones && (bind_json_fetch("zones") != 0))
+    status = -1;
+
+  return status;
+} /* }}} int bind_json */
+#endif /* HAVE_LIBYAJL */
+
 static int bind_config_add_view_zone(cb_view_t *view, /* {{{ */
                                      oconfig_item_t *ci) {
   if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING)) {
@@ -1509,7 +2027,27 @@ static int bind_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_boolean(child, &config_parse_time);
     else if (strcasecmp("Timeout", child->key) == 0)
       cf_util_get_int(child, &timeout);
-    else {
+    else if (strcasecmp("Format", child->key) == 0) {
+      char *format = NULL;
+      if (cf_util_get_string(child, &format) != 0)
+        continue;
+
+      if (strcasecmp("XML", format) == 0)
+        format_json = 0;
+      else if (strcasecmp("JSON", format) == 0)
+        format_json = 1;
+      else
+        WARNING("bind plugin: Unknown format `%s' will be ignored.", format);
+      sfree(format);
+
+#if !HAVE_LIBYAJL
+      if (format_json) {
+        ERROR("bind plugin: The JSON format requires libyajl, which was "
+              "not available at compile time.");
+        return -1;
+      }
+#endif
+    } else {
       WARNING("bind plugin: Unknown configuration option "
               "`%s' will be ignored.",
               child->key);
@@ -1531,7 +2069,12 @@ static int bind_init(void) /* {{{ */
   }
 
   curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bind_curl_callback);
+#if HAVE_LIBYAJL
+  if (format_json)
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bind_json_curl_callback);
+  else
+#endif
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bind_curl_callback);
   curl_easy_setopt(curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
   curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, bind_curl_error);
   curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
@@ -1552,6 +2095,11 @@ static int bind_read(void) /* {{{ */
     return -1;
   }
 
+#if HAVE_LIBYAJL
+  if (format_json)
+    return bind_json();
+#endif
+
   bind_buffer_fill = 0;
 
   curl_easy_setopt(curl, CURLOPT_URL, (url != NULL) ? url : BIND_DEFAULT_URL);
@@ -1561,7 +2109,7 @@ static int bind_read(void) /* {{{ */
     return -1;
   }
 
-  int status = bind_xml(bind_buffer);
+  int status = bind_xml(bind_buffer, bind_buffer_fill);
   if (status != 0)
     return -1;
   else
@@ -1575,6 +2123,8 @@ static int bind_shutdown(void) /* {{{ */
     curl = NULL;
   }
 
+  bind_xpath_cache_free();
+
   return 0;
 } /* }}} int bind_shutdown */
 
@@ -30,6 +30,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
@@ -126,6 +127,29 @@ struct ceph_daemon {
   struct last_data **last_poll_data;
   /** index of last poll data */
   int last_idx;
+
+  /**
+   * Keys of the counter values, resolved against the schema on the first
+   * read: maps the key to a struct ceph_key.
+   */
+  c_avl_tree_t *keys;
+};
+
+/** Kind of value of a counter, determined by the key's last part */
+enum ceph_key_part_d {
+  KEY_PART_VALUE = 0,
+  KEY_PART_AVGCOUNT,
+  KEY_PART_SUM,
+  KEY_PART_AVGTIME,
+};
+
+/** A counter value's key, resolved against the schema */
+struct ceph_key {
+  /** Index of the counter in ds_names and ds_types or -1 if unknown */
+  int ds_index;
+  enum ceph_key_part_d part;
+  /** Last poll data of the ".sum" keys of latency counters */
+  struct last_data *last;
 };
 
 /******* JSON parsing *******/
@@ -176,11 +200,6 @@ struct values_tmp {
   uint64_t avgcount;
   /** current index of counters - used to get type of counter */
   int index;
-  /**
-   * similar to index, but current index of latency type counters -
-   * used to get last poll data of counter
-   */
-  int latency_index;
   /**
    * values list - maintain across counters since
    * host/plugin/plugin instance are always the same
@@ -381,7 +400,19 @@ static void ceph_daemons_print(void) {
   }
 }
 
-static void ceph_daemon_free(struct ceph_daemon *d) {
+/** Frees the schema and everything derived from it */
+static void ceph_daemon_clear_schema(struct ceph_daemon *d) {
+  if (d->keys != NULL) {
+    void *key;
+    void *value;
+    while (c_avl_pick(d->keys, &key, &value) == 0) {
+      sfree(key);
+      sfree(value);
+    }
+    c_avl_destroy(d->keys);
+    d->keys = NULL;
+  }
+
   for (int i = 0; i < d->last_idx; i++) {
     sfree(d->last_poll_data[i]);
   }
@@ -392,8 +423,13 @@ static void ceph_daemon_free(struct ceph_daemon *d) {
   for (int i = 0; i < d->ds_num; i++) {
     sfree(d->ds_names[i]);
   }
+  d->ds_num = 0;
   sfree(d->ds_types);
   sfree(d->ds_names);
+}
+
+static void ceph_daemon_free(struct ceph_daemon *d) {
+  ceph_daemon_clear_schema(d);
   sfree(d);
 }
 
@@ -752,135 +788,85 @@ static int node_handler_define_schema(void *arg, const char *val,
 }
 
 /**
- * Latency counter does not yet have an entry in last poll data - add it.
+ * Add an entry for a latency counter to the last poll data.
  */
-static int add_last(struct ceph_daemon *d, const char *ds_n, double cur_sum,
-                    uint64_t cur_count) {
-  d->last_poll_data[d->last_idx] =
-      malloc(sizeof(*d->last_poll_data[d->last_idx]));
-  if (!d->last_poll_data[d->last_idx]) {
-    return -ENOMEM;
+static struct last_data *add_last(struct ceph_daemon *d, const char *ds_n,
+                                  double cur_sum, uint64_t cur_count) {
+  struct last_data **tmp_last = realloc(
+      d->last_poll_data, ((d->last_idx + 1) * sizeof(struct last_data *)));
+  if (!tmp_last) {
+    return NULL;
   }
-  sstrncpy(d->last_poll_data[d->last_idx]->ds_name, ds_n,
-           sizeof(d->last_poll_data[d->last_idx]->ds_name));
-  d->last_poll_data[d->last_idx]->last_sum = cur_sum;
-  d->last_poll_data[d->last_idx]->last_count = cur_count;
-  d->last_idx = (d->last_idx + 1);
-  return 0;
-}
+  d->last_poll_data = tmp_last;
 
-/**
- * Update latency counter or add new entry if it doesn't exist
- */
-static int update_last(struct ceph_daemon *d, const char *ds_n, int index,
-                       double cur_sum, uint64_t cur_count) {
-  if ((d->last_idx > index) &&
-      (strcmp(d->last_poll_data[index]->ds_name, ds_n) == 0)) {
-    d->last_poll_data[index]->last_sum = cur_sum;
-    d->last_poll_data[index]->last_count = cur_count;
-    return 0;
-  }
-
-  if (!d->last_poll_data) {
-    d->last_poll_data = malloc(sizeof(*d->last_poll_data));
-    if (!d->last_poll_data) {
-      return -ENOMEM;
-    }
-  } else {
-    struct last_data **tmp_last = realloc(
-        d->last_poll_data, ((d->last_idx + 1) * sizeof(struct last_data *)));
-    if (!tmp_last) {
-      return -ENOMEM;
-    }
-    d->last_poll_data = tmp_last;
+  struct last_data *last = malloc(sizeof(*last));
+  if (!last) {
+    return NULL;
   }
-  return add_last(d, ds_n, cur_sum, cur_count);
-}
+  sstrncpy(last->ds_name, ds_n, sizeof(last->ds_name));
+  last->last_sum = cur_sum;
+  last->last_count = cur_count;
 
-/**
- * If using index guess failed (shouldn't happen, but possible if counters
- * get rearranged), resort to searching for counter name
- */
-static int backup_search_for_last_avg(struct ceph_daemon *d, const char *ds_n) {
-  for (int i = 0; i < d->last_idx; i++) {
-    if (strcmp(d->last_poll_data[i]->ds_name, ds_n) == 0) {
-      return i;
-    }
-  }
-  return -1;
+  d->last_poll_data[d->last_idx] = last;
+  d->last_idx = (d->last_idx + 1);
+  return last;
 }
 
 /**
  * Calculate average b/t current data and last poll data
- * if last poll data exists
  */
-static double get_last_avg(struct ceph_daemon *d, const char *ds_n, int index,
-                           double cur_sum, uint64_t cur_count) {
-  double result = -1.1, sum_delt = 0.0;
-  uint64_t count_delt = 0;
-  int tmp_index = 0;
-  if (d->last_idx > index) {
-    if (strcmp(d->last_poll_data[index]->ds_name, ds_n) == 0) {
-      tmp_index = index;
-    }
-    // test previous index
-    else if ((index > 0) &&
-             (strcmp(d->last_poll_data[index - 1]->ds_name, ds_n) == 0)) {
-      tmp_index = (index - 1);
-    } else {
-      tmp_index = backup_search_for_last_avg(d, ds_n);
-    }
+static double get_last_avg(struct last_data *last, double cur_sum,
+                           uint64_t cur_count) {
+  double result = NAN;
 
-    if ((tmp_index > -1) &&
-        (cur_count > d->last_poll_data[tmp_index]->last_count)) {
-      sum_delt = (cur_sum - d->last_poll_data[tmp_index]->last_sum);
-      count_delt = (cur_count - d->last_poll_data[tmp_index]->last_count);
-      result = (sum_delt / count_delt);
-    }
+  if (cur_count > last->last_count) {
+    double sum_delt = (cur_sum - last->last_sum);
+    uint64_t count_delt = (cur_count - last->last_count);
+    result = (sum_delt / count_delt);
   }
 
-  if (result == -1.1) {
-    result = NAN;
-  }
-  if (update_last(d, ds_n, tmp_index, cur_sum, cur_count) == -ENOMEM) {
-    return -ENOMEM;
-  }
+  last->last_sum = cur_sum;
+  last->last_count = cur_count;
   return result;
 }
 
 /**
  * If using index guess failed, resort to searching for counter name
  */
-static uint32_t backup_search_for_type(struct ceph_daemon *d, char *ds_name) {
+static int backup_search_for_index(struct ceph_daemon *d, char *ds_name) {
   for (int i = 0; i < d->ds_num; i++) {
     if (strcmp(d->ds_names[i], ds_name) == 0) {
-      return d->ds_types[i];
+      return i;
     }
   }
-  return DSET_TYPE_UNFOUND;
+  return -1;
 }
 
 /**
- * Process counter data and dispatch values
+ * Resolve a counter value's key against the schema. This is done on the
+ * first read only: later reads look the key up in d->keys.
  */
-static int node_handler_fetch_data(void *arg, const char *val,
-                                   const char *key) {
-  value_t uv;
-  double tmp_d;
-  uint64_t tmp_u;
-  struct values_tmp *vtmp = (struct values_tmp *)arg;
-  uint32_t type = DSET_TYPE_UNFOUND;
+static struct ceph_key *ceph_daemon_resolve_key(struct values_tmp *vtmp,
+                                                const char *key) {
+  struct ceph_daemon *d = vtmp->d;
   int index = vtmp->index;
-
   char ds_name[DATA_MAX_NAME_LEN];
 
   if (parse_keys(ds_name, sizeof(ds_name), key)) {
-    return 1;
+    return NULL;
   }
 
-  if (index >= vtmp->d->ds_num) {
+  struct ceph_key *k = calloc(1, sizeof(*k));
+  char *k_key = strdup(key);
+  if ((k == NULL) || (k_key == NULL)) {
+    sfree(k);
+    sfree(k_key);
+    return NULL;
+  }
+
+  if (index >= d->ds_num) {
     // don't overflow bounds of array
-    index = (vtmp->d->ds_num - 1);
+    index = (d->ds_num - 1);
   }
 
   /**
@@ -889,28 +875,83 @@ static int node_handler_fetch_data(void *arg, const char *val,
    * use index to guess point in array for retrieving type. if that doesn't
    * work, use the old way to get the counter type
    */
-  if (strcmp(ds_name, vtmp->d->ds_names[index]) == 0) {
+  if (strcmp(ds_name, d->ds_names[index]) == 0) {
     // found match
-    type = vtmp->d->ds_types[index];
-  } else if ((index > 0) &&
-             (strcmp(ds_name, vtmp->d->ds_names[index - 1]) == 0)) {
+    k->ds_index = index;
+  } else if ((index > 0) && (strcmp(ds_name, d->ds_names[index - 1]) == 0)) {
     // try previous key
-    type = vtmp->d->ds_types[index - 1];
+    k->ds_index = index - 1;
+  } else {
+    // couldn't find right type by guessing, check the old way
+    k->ds_index = backup_search_for_index(d, ds_name);
   }
 
-  if (type == DSET_TYPE_UNFOUND) {
-    // couldn't find right type by guessing, check the old way
-    type = backup_search_for_type(vtmp->d, ds_name);
+  if (k->ds_index < 0) {
+    ERROR("ceph plugin: ds %s was not properly initialized.", ds_name);
+  } else if (d->ds_types[k->ds_index] == DSET_LATENCY) {
+    if (has_suffix(key, ".avgcount")) {
+      k->part = KEY_PART_AVGCOUNT;
+    } else if (has_suffix(key, ".sum")) {
+      k->part = KEY_PART_SUM;
+    } else if (has_suffix(key, ".avgtime")) {
+      k->part = KEY_PART_AVGTIME;
+    } else {
+      WARNING("ceph plugin: ignoring unknown latency metric: %s", key);
+      k->ds_index = -1;
+    }
+  }
+
+  if (c_avl_insert(d->keys, k_key, k) != 0) {
+    sfree(k);
+    sfree(k_key);
+    return NULL;
+  }
+
+  return k;
+}
+
+/**
+ * Process counter data and dispatch values
+ */
+static int node_handler_fetch_data(void *arg, const char *val,
+                                   const char *key) {
+  value_t uv;
+  double tmp_d;
+  uint64_t tmp_u;
+  struct values_tmp *vtmp = (struct values_tmp *)arg;
+  struct ceph_daemon *d = vtmp->d;
+  struct ceph_key *k = NULL;
+
+  if (d->keys == NULL) {
+    d->keys = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (d->keys == NULL) {
+      return -ENOMEM;
+    }
+  }
+
+  if (c_avl_get(d->keys, key, (void *)&k) != 0) {
+    k = ceph_daemon_resolve_key(vtmp, key);
+    if (k == NULL) {
+      return -ENOMEM;
+    }
   }
 
+  if (k->ds_index < 0) {
+    // not in the schema - reported once when resolving the key
+    return 0;
+  }
+
+  uint32_t type = d->ds_types[k->ds_index];
+  char const *ds_name = d->ds_names[k->ds_index];
+
   switch (type) {
   case DSET_LATENCY:
-    if (has_suffix(key, ".avgcount")) {
+    if (k->part == KEY_PART_AVGCOUNT) {
       sscanf(val, "%" PRIu64, &vtmp->avgcount);
       // return after saving avgcount - don't dispatch value
       // until latency calculation
       return 0;
-    } else if (has_suffix(key, ".sum")) {
+    } else if (k->part == KEY_PART_SUM) {
       if (vtmp->avgcount == 0) {
         vtmp->avgcount = 1;
       }
@@ -919,16 +960,19 @@ static int node_handler_fetch_data(void *arg, const char *val,
       if (long_run_latency_avg) {
         return 0;
       }
-      double sum, result;
+      double sum;
       sscanf(val, "%lf", &sum);
-      result = get_last_avg(vtmp->d, ds_name, vtmp->latency_index, sum,
-                            vtmp->avgcount);
-      if (result == -ENOMEM) {
-        return -ENOMEM;
+      if (k->last == NULL) {
+        // the first average is reported on the next read
+        k->last = add_last(d, ds_name, sum, vtmp->avgcount);
+        if (k->last == NULL) {
+          return -ENOMEM;
+        }
+        uv.gauge = NAN;
+      } else {
+        uv.gauge = get_last_avg(k->last, sum, vtmp->avgcount);
       }
-      uv.gauge = result;
-      vtmp->latency_index = (vtmp->latency_index + 1);
-    } else if (has_suffix(key, ".avgtime")) {
+    } else {
 
       /* The "avgtime" metric reports ("sum" / "avgcount"), i.e. the average
        * time per request since the start of the Ceph daemon. Report this only
@@ -942,10 +986,6 @@ static int node_handler_fetch_data(void *arg, const char *val,
       double result;
       sscanf(val, "%lf", &result);
       uv.gauge = result;
-      vtmp->latency_index = (vtmp->latency_index + 1);
-    } else {
-      WARNING("ceph plugin: ignoring unknown latency metric: %s", key);
-      return 0;
     }
     break;
   case DSET_BYTES:
@@ -1043,7 +1083,6 @@ static int cconn_process_data(struct cconn *io, yajl_struct *yajl,
            sizeof(vtmp->vlist.plugin_instance));
 
   vtmp->d = io->d;
-  vtmp->latency_index = 0;
   vtmp->index = 0;
   yajl->handler_arg = vtmp;
   ret = traverse_json(io->json, io->json_len, hand);
@@ -1086,9 +1125,7 @@ static int cconn_process_json(struct cconn *io) {
     break;
   case ASOK_REQ_SCHEMA:
     // init daemon specific variables
-    io->d->ds_num = 0;
-    io->d->last_idx = 0;
-    io->d->last_poll_data = NULL;
+    ceph_daemon_clear_schema(io->d);
     io->yajl.handler = node_handler_define_schema;
     io->yajl.handler_arg = io->d;
     result = traverse_json(io->json, io->json_len, hand);
@@ -1256,10 +1293,6 @@ static int cconn_prepare(struct cconn *io, struct pollfd *fds) {
   if (io->request_type == ASOK_REQ_NONE) {
     /* The request has already been serviced. */
     return 0;
-  } else if ((io->request_type == ASOK_REQ_DATA) && (io->d->ds_num == 0)) {
-    /* If there are no counters to report on, don't bother
-     * connecting */
-    return 0;
   }
 
   switch (io->state) {
@@ -1327,6 +1360,11 @@ static ssize_t cconn_main_loop(uint32_t request_type) {
         .request_type = request_type,
         .state = CSTATE_UNCONNECTED,
     };
+
+    /* The schema is only fetched once. If that failed, e.g. because the
+     * daemon wasn't running yet, try again instead of reading the data. */
+    if ((request_type == ASOK_REQ_DATA) && (g_daemons[i]->ds_num == 0))
+      io_array[i].request_type = ASOK_REQ_SCHEMA;
   }
 
   /** Calculate the time at which we should give up */
@@ -25,27 +25,39 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_ignorelist.h"
 #include "utils_mount.h"
 
-static char const *config_keys[] = {"CGroup", "IgnoreSelected"};
+#if HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+static char const *config_keys[] = {"CGroup", "IgnoreSelected", "MaxDepth"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static ignorelist_t *il_cgroup;
 
-__attribute__((nonnull(1))) __attribute__((nonnull(2))) static void
-cgroups_submit_one(char const *plugin_instance, char const *type_instance,
-                   value_t value) {
+__attribute__((nonnull(1))) __attribute__((nonnull(2)))
+__attribute__((nonnull(3))) static void
+cgroups_submit(char const *plugin_instance, char const *type,
+               char const *type_instance, value_t *values, size_t values_num) {
   value_list_t vl = VALUE_LIST_INIT;
 
-  vl.values = &value;
-  vl.values_len = 1;
+  vl.values = values;
+  vl.values_len = values_num;
   sstrncpy(vl.plugin, "cgroups", sizeof(vl.plugin));
   sstrncpy(vl.plugin_instance, plugin_instance, sizeof(vl.plugin_instance));
-  sstrncpy(vl.type, "cpu", sizeof(vl.type));
+  sstrncpy(vl.type, type, sizeof(vl.type));
   sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
 
   plugin_dispatch_values(&vl);
+} /* void cgroups_submit */
+
+__attribute__((nonnull(1))) __attribute__((nonnull(2))) static void
+cgroups_submit_one(char const *plugin_instance, char const *type_instance,
+                   value_t value) {
+  cgroups_submit(plugin_instance, "cpu", type_instance, &value, 1);
 } /* void cgroups_submit_one */
 
 /*
@@ -154,10 +166,596 @@ static int read_cpuacct_root(const char *dirname, const char *filename,
   return 0;
 }
 
+/*
+ * cgroup v2 (unified hierarchy) support.
+ *
+ * All cgroups down to "MaxDepth" levels below the mount point are kept in
+ * the `cg2_entries' tree, keyed by the path relative to the mount point.
+ * The hierarchy is walked once and then kept up to date using inotify
+ * events on cgroup creation and removal. If inotify is unavailable, the
+ * hierarchy is walked on every read. The stat files of selected cgroups
+ * are kept open and re-read with pread(2).
+ */
+enum {
+  CG2_CPU_STAT,
+  CG2_MEMORY_STAT,
+  CG2_IO_STAT,
+  CG2_CPU_PRESSURE,
+  CG2_MEMORY_PRESSURE,
+  CG2_IO_PRESSURE,
+  CG2_FILE_MAX
+};
+
+static char const *const cg2_file_names[CG2_FILE_MAX] = {
+        [CG2_CPU_STAT] = "cpu.stat",
+        [CG2_MEMORY_STAT] = "memory.stat",
+        [CG2_IO_STAT] = "io.stat",
+        [CG2_CPU_PRESSURE] = "cpu.pressure",
+        [CG2_MEMORY_PRESSURE] = "memory.pressure",
+        [CG2_IO_PRESSURE] = "io.pressure",
+};
+
+/* memory.stat keys reported with the "memory" type */
+static char const *const cg2_memory_keys[] = {
+    "anon",  "file",        "kernel_stack", "slab",           "sock",
+    "shmem", "file_mapped", "file_dirty",   "file_writeback",
+};
+
+#define CG2_FD_UNKNOWN (-1) /* not opened yet */
+#define CG2_FD_MISSING (-2) /* doesn't exist, e.g. controller not enabled */
+#define CG2_READ_BUFFER_SIZE 8192
+
+typedef struct {
+  char *path;       /* relative to the mount point */
+  char const *name; /* last component of the path */
+  int depth;        /* 1 for children of the root cgroup */
+  int wd;           /* inotify watch descriptor or -1 */
+  int fds[CG2_FILE_MAX];
+  bool seen;
+} cg2_entry_t;
+
+/* Parent directory of a walk_directory() call */
+typedef struct {
+  char const *path;
+  int depth;
+} cg2_walk_t;
+
+static int cg2_max_depth = 4;
+static long cg2_clk_tck;
+
+static char *cg2_mount;
+static c_avl_tree_t *cg2_entries; /* path -> cg2_entry_t */
+static c_avl_tree_t *cg2_watches; /* &wd -> cg2_entry_t */
+static int cg2_inotify_fd = -1;
+static int cg2_root_wd = -1;
+static bool cg2_rescan = true;
+static bool cg2_keep_open = true;
+
+static int cg2_wd_compare(void const *a, void const *b) {
+  int wd_a = *(int const *)a;
+  int wd_b = *(int const *)b;
+  return (wd_a > wd_b) - (wd_a < wd_b);
+} /* int cg2_wd_compare */
+
+static void cg2_entry_close(cg2_entry_t *e) {
+  for (size_t i = 0; i < CG2_FILE_MAX; i++) {
+    if (e->fds[i] >= 0)
+      close(e->fds[i]);
+    e->fds[i] = CG2_FD_UNKNOWN;
+  }
+} /* void cg2_entry_close */
+
+static void cg2_entry_free(cg2_entry_t *e) {
+  if (e == NULL)
+    return;
+
+  cg2_entry_close(e);
+  if (e->wd >= 0) {
+    c_avl_remove(cg2_watches, &e->wd, NULL, NULL);
+#if HAVE_SYS_INOTIFY_H
+    if (cg2_inotify_fd >= 0)
+      inotify_rm_watch(cg2_inotify_fd, e->wd);
+#endif
+  }
+  sfree(e->path);
+  sfree(e);
+} /* void cg2_entry_free */
+
+/* Close all files kept open, used if we're running out of descriptors */
+static void cg2_close_all(void) {
+  c_avl_iterator_t *iter = c_avl_get_iterator(cg2_entries);
+  cg2_entry_t *e;
+  void *key;
+
+  while (c_avl_iterator_next(iter, &key, (void **)&e) == 0)
+    cg2_entry_close(e);
+  c_avl_iterator_destroy(iter);
+} /* void cg2_close_all */
+
+/* Give up on inotify and walk the whole hierarchy on every read. */
+static void cg2_inotify_disable(void) {
+  c_avl_iterator_t *iter;
+  cg2_entry_t *e;
+  void *key;
+
+  if (cg2_inotify_fd >= 0)
+    close(cg2_inotify_fd);
+  cg2_inotify_fd = -1;
+  cg2_root_wd = -1;
+
+  while (c_avl_pick(cg2_watches, &key, (void **)&e) == 0)
+    ;
+  iter = c_avl_get_iterator(cg2_entries);
+  while (c_avl_iterator_next(iter, &key, (void **)&e) == 0)
+    e->wd = -1;
+  c_avl_iterator_destroy(iter);
+} /* void cg2_inotify_disable */
+
+/* Watch the cgroup directory `path' (relative) for sub-cgroups being
+ * created or removed. Returns the watch descriptor or -1. */
+static int cg2_watch(char const *path) {
+#if HAVE_SYS_INOTIFY_H
+  char abs_path[PATH_MAX];
+
+  if (cg2_inotify_fd < 0)
+    return -1;
+
+  snprintf(abs_path, sizeof(abs_path), "%s/%s", cg2_mount, path);
+  int wd = inotify_add_watch(cg2_inotify_fd, abs_path,
+                             IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                 IN_MOVED_TO | IN_ONLYDIR);
+  if (wd < 0 && errno != ENOENT) {
+    WARNING("cgroups plugin: inotify_add_watch (\"%s\") failed: %s. Falling "
+            "back to walking the hierarchy on every read.",
+            abs_path, STRERRNO);
+    cg2_inotify_disable();
+  }
+  return wd;
+#else
+  return -1;
+#endif
+} /* int cg2_watch */
+
+static cg2_entry_t *cg2_entry_add(char const *path, int depth) {
+  cg2_entry_t *e = NULL;
+
+  if (c_avl_get(cg2_entries, path, (void **)&e) == 0)
+    return e;
+
+  e = calloc(1, sizeof(*e));
+  if (e == NULL)
+    return NULL;
+  e->path = strdup(path);
+  if (e->path == NULL) {
+    sfree(e);
+    return NULL;
+  }
+  char const *slash = strrchr(e->path, '/');
+  e->name = (slash != NULL) ? slash + 1 : e->path;
+  e->depth = depth;
+  e->wd = -1;
+  for (size_t i = 0; i < CG2_FILE_MAX; i++)
+    e->fds[i] = CG2_FD_UNKNOWN;
+
+  if (c_avl_insert(cg2_entries, e->path, e) != 0) {
+    cg2_entry_free(e);
+    return NULL;
+  }
+
+  /* Only watch directories whose children are collected */
+  if (depth < cg2_max_depth) {
+    int wd = cg2_watch(e->path);
+    if (wd >= 0) {
+      e->wd = wd;
+      if (c_avl_insert(cg2_watches, &e->wd, e) != 0)
+        e->wd = -1;
+    }
+  }
+
+  return e;
+} /* cg2_entry_t *cg2_entry_add */
+
+static void cg2_entry_remove(char const *path) {
+  cg2_entry_t *e = NULL;
+
+  if (c_avl_remove(cg2_entries, path, NULL, (void **)&e) == 0)
+    cg2_entry_free(e);
+} /* void cg2_entry_remove */
+
+static int cg2_scan(char const *path, int depth);
+
+static int cg2_scan_one(const char *dirname, const char *filename,
+                        void *user_data) {
+  cg2_walk_t *parent = user_data;
+  char abs_path[PATH_MAX];
+  char path[PATH_MAX];
+  struct stat statbuf;
+
+  snprintf(abs_path, sizeof(abs_path), "%s/%s", dirname, filename);
+  if (lstat(abs_path, &statbuf) != 0 || !S_ISDIR(statbuf.st_mode))
+    return 0;
+
+  if (parent->path[0] != 0)
+    snprintf(path, sizeof(path), "%s/%s", parent->path, filename);
+  else
+    sstrncpy(path, filename, sizeof(path));
+
+  cg2_entry_t *e = cg2_entry_add(path, parent->depth + 1);
+  if (e == NULL)
+    return 0;
+  e->seen = true;
+
+  if (e->depth < cg2_max_depth)
+    cg2_scan(e->path, e->depth);
+  return 0;
+} /* int cg2_scan_one */
+
+/* Add all sub-cgroups of `path' (relative to the mount point) */
+static int cg2_scan(char const *path, int depth) {
+  char abs_path[PATH_MAX];
+  cg2_walk_t parent = {.path = path, .depth = depth};
+
+  snprintf(abs_path, sizeof(abs_path), "%s/%s", cg2_mount, path);
+  return walk_directory(abs_path, cg2_scan_one, &parent,
+                        /* include_hidden = */ 0);
+} /* int cg2_scan */
+
+/* Walk the whole hierarchy and drop cgroups which no longer exist */
+static void cg2_full_rescan(void) {
+  c_avl_iterator_t *iter;
+  cg2_entry_t *e;
+  void *key;
+  char **gone = NULL;
+  size_t gone_num = 0;
+
+  iter = c_avl_get_iterator(cg2_entries);
+  while (c_avl_iterator_next(iter, &key, (void **)&e) == 0)
+    e->seen = false;
+  c_avl_iterator_destroy(iter);
+
+  cg2_scan("", 0);
+
+  iter = c_avl_get_iterator(cg2_entries);
+  while (c_avl_iterator_next(iter, &key, (void **)&e) == 0) {
+    if (e->seen)
+      continue;
+    char **tmp = realloc(gone, (gone_num + 1) * sizeof(*gone));
+    if (tmp == NULL)
+      break;
+    gone = tmp;
+    gone[gone_num++] = e->path;
+  }
+  c_avl_iterator_destroy(iter);
+
+  /* entries own the paths, so take them out one by one */
+  for (size_t i = 0; i < gone_num; i++) {
+    if (c_avl_remove(cg2_entries, gone[i], NULL, (void **)&e) == 0)
+      cg2_entry_free(e);
+  }
+  sfree(gone);
+} /* void cg2_full_rescan */
+
+#if HAVE_SYS_INOTIFY_H
+/* Apply cgroup creation and removal events received since the last read */
+static void cg2_handle_events(void) {
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  while ((len = read(cg2_inotify_fd, events, sizeof(events))) > 0) {
+    struct inotify_event const *ev;
+
+    for (char *ptr = events; ptr < events + len;
+         ptr += sizeof(*ev) + ev->len) {
+      ev = (struct inotify_event const *)ptr;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+        cg2_rescan = true;
+        continue;
+      }
+      if (!(ev->mask & IN_ISDIR) || (ev->len == 0) || (ev->name[0] == '.'))
+        continue;
+
+      char const *parent_path = "";
+      int parent_depth = 0;
+      if (ev->wd != cg2_root_wd) {
+        cg2_entry_t *parent = NULL;
+        if (c_avl_get(cg2_watches, &ev->wd, (void **)&parent) != 0)
+          continue;
+        parent_path = parent->path;
+        parent_depth = parent->depth;
+      }
+
+      char path[PATH_MAX];
+      if (parent_path[0] != 0)
+        snprintf(path, sizeof(path), "%s/%s", parent_path, ev->name);
+      else
+        sstrncpy(path, ev->name, sizeof(path));
+
+      if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+        cg2_entry_t *e = cg2_entry_add(path, parent_depth + 1);
+        /* sub-cgroups may have been created before the watch was added */
+        if ((e != NULL) && (e->depth < cg2_max_depth))
+          cg2_scan(e->path, e->depth);
+      } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        /* a cgroup can only be removed when it has no sub-cgroups */
+        cg2_entry_remove(path);
+      }
+
+      /* cg2_inotify_disable() may have been called from cg2_watch() */
+      if (cg2_inotify_fd < 0)
+        return;
+    }
+  }
+
+  if ((len < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+    WARNING("cgroups plugin: Reading inotify events failed: %s", STRERRNO);
+    cg2_inotify_disable();
+  }
+} /* void cg2_handle_events */
+#endif
+
+static void cg2_reset(void) {
+  cg2_entry_t *e;
+  void *key;
+
+  if (cg2_inotify_fd >= 0)
+    close(cg2_inotify_fd);
+  cg2_inotify_fd = -1;
+  cg2_root_wd = -1;
+
+  if (cg2_watches != NULL)
+    while (c_avl_pick(cg2_watches, &key, (void **)&e) == 0)
+      ;
+  if (cg2_entries != NULL)
+    while (c_avl_pick(cg2_entries, &key, (void **)&e) == 0) {
+      e->wd = -1;
+      cg2_entry_free(e);
+    }
+
+  sfree(cg2_mount);
+  cg2_rescan = true;
+} /* void cg2_reset */
+
+static int cg2_setup(char const *mount_dir) {
+  cg2_reset();
+
+  if (cg2_entries == NULL)
+    cg2_entries = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (cg2_watches == NULL)
+    cg2_watches = c_avl_create(cg2_wd_compare);
+  cg2_mount = strdup(mount_dir);
+  if (cg2_entries == NULL || cg2_watches == NULL || cg2_mount == NULL) {
+    ERROR("cgroups plugin: Allocating cgroup v2 state failed.");
+    return -1;
+  }
+
+#if HAVE_SYS_INOTIFY_H
+  cg2_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (cg2_inotify_fd < 0)
+    INFO("cgroups plugin: inotify_init1 failed: %s. The hierarchy will be "
+         "walked on every read.",
+         STRERRNO);
+  cg2_root_wd = cg2_watch("");
+#endif
+
+  return 0;
+} /* int cg2_setup */
+
+/* Read a stat file of the cgroup into `buf'. Returns the number of bytes
+ * read or -1 if the file is not available. */
+static ssize_t cg2_read_file(cg2_entry_t *e, int idx, char *buf,
+                             size_t buf_size) {
+  char abs_path[PATH_MAX];
+  int fd = e->fds[idx];
+
+  if (fd == CG2_FD_MISSING)
+    return -1;
+
+  if (fd < 0) {
+    snprintf(abs_path, sizeof(abs_path), "%s/%s/%s", cg2_mount, e->path,
+             cg2_file_names[idx]);
+    fd = open(abs_path, O_RDONLY | O_CLOEXEC);
+    if ((fd < 0) && ((errno == EMFILE) || (errno == ENFILE)) &&
+        cg2_keep_open) {
+      WARNING("cgroups plugin: Running out of file descriptors, cgroup "
+              "files will be reopened on every read.");
+      cg2_keep_open = false;
+      cg2_close_all();
+      fd = open(abs_path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+      if (errno == ENOENT)
+        e->fds[idx] = CG2_FD_MISSING;
+      else
+        ERROR("cgroups plugin: open (\"%s\") failed: %s", abs_path, STRERRNO);
+      return -1;
+    }
+    if (cg2_keep_open)
+      e->fds[idx] = fd;
+  }
+
+  ssize_t len = pread(fd, buf, buf_size - 1, 0);
+  if (!cg2_keep_open)
+    close(fd);
+  if (len < 0) {
+    /* ENODEV if the cgroup has been removed */
+    if (e->fds[idx] >= 0) {
+      close(e->fds[idx]);
+      e->fds[idx] = CG2_FD_UNKNOWN;
+    }
+    return -1;
+  }
+
+  buf[len] = 0;
+  return len;
+} /* ssize_t cg2_read_file */
+
+/* cpu.stat: "<key> <value>" lines, times in microseconds. User and system
+ * times are converted to USER_HZ ticks to match cpuacct.stat of cgroup v1. */
+static void cg2_parse_cpu_stat(cg2_entry_t *e, char *buf) {
+  char *saveptr = NULL;
+
+  for (char *line = strtok_r(buf, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[2];
+    if (strsplit(line, fields, STATIC_ARRAY_SIZE(fields)) != 2)
+      continue;
+
+    char const *type_instance;
+    if (strcmp(fields[0], "user_usec") == 0)
+      type_instance = "user";
+    else if (strcmp(fields[0], "system_usec") == 0)
+      type_instance = "system";
+    else
+      continue;
+
+    uint64_t usec = (uint64_t)strtoull(fields[1], NULL, 10);
+    value_t value = {
+        .derive = (derive_t)(usec * (uint64_t)cg2_clk_tck / 1000000)};
+    cgroups_submit_one(e->name, type_instance, value);
+  }
+} /* void cg2_parse_cpu_stat */
+
+/* memory.stat: "<key> <bytes>" lines */
+static void cg2_parse_memory_stat(cg2_entry_t *e, char *buf) {
+  char *saveptr = NULL;
+
+  for (char *line = strtok_r(buf, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[2];
+    if (strsplit(line, fields, STATIC_ARRAY_SIZE(fields)) != 2)
+      continue;
+
+    for (size_t i = 0; i < STATIC_ARRAY_SIZE(cg2_memory_keys); i++) {
+      if (strcmp(fields[0], cg2_memory_keys[i]) != 0)
+        continue;
+
+      value_t value;
+      if (parse_value(fields[1], &value, DS_TYPE_GAUGE) == 0)
+        cgroups_submit(e->name, "memory", fields[0], &value, 1);
+      break;
+    }
+  }
+} /* void cg2_parse_memory_stat */
+
+/* io.stat: "<major>:<minor> rbytes=N wbytes=N rios=N wios=N ..." lines,
+ * summed over all devices */
+static void cg2_parse_io_stat(cg2_entry_t *e, char *buf) {
+  char *saveptr = NULL;
+  derive_t rbytes = 0, wbytes = 0, rios = 0, wios = 0;
+
+  for (char *line = strtok_r(buf, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[16];
+    int fields_num = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
+
+    for (int i = 1; i < fields_num; i++) {
+      char *eq = strchr(fields[i], '=');
+      if (eq == NULL)
+        continue;
+      *eq = 0;
+      derive_t v = (derive_t)strtoull(eq + 1, NULL, 10);
+
+      if (strcmp(fields[i], "rbytes") == 0)
+        rbytes += v;
+      else if (strcmp(fields[i], "wbytes") == 0)
+        wbytes += v;
+      else if (strcmp(fields[i], "rios") == 0)
+        rios += v;
+      else if (strcmp(fields[i], "wios") == 0)
+        wios += v;
+    }
+  }
+
+  value_t octets[] = {{.derive = rbytes}, {.derive = wbytes}};
+  value_t ops[] = {{.derive = rios}, {.derive = wios}};
+  cgroups_submit(e->name, "disk_octets", "", octets,
+                 STATIC_ARRAY_SIZE(octets));
+  cgroups_submit(e->name, "disk_ops", "", ops, STATIC_ARRAY_SIZE(ops));
+} /* void cg2_parse_io_stat */
+
+/* *.pressure: "some|full avg10=.. avg60=.. avg300=.. total=<usec>" lines.
+ * The total stall time is reported in milliseconds. */
+static void cg2_parse_pressure(cg2_entry_t *e, char const *resource,
+                               char *buf) {
+  char *saveptr = NULL;
+
+  for (char *line = strtok_r(buf, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[8];
+    int fields_num = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
+
+    for (int i = 1; i < fields_num; i++) {
+      if (strncmp(fields[i], "total=", strlen("total=")) != 0)
+        continue;
+
+      char type_instance[DATA_MAX_NAME_LEN];
+      snprintf(type_instance, sizeof(type_instance), "%s-%s", resource,
+               fields[0]);
+      uint64_t usec =
+          (uint64_t)strtoull(fields[i] + strlen("total="), NULL, 10);
+      value_t value = {.derive = (derive_t)(usec / 1000)};
+      cgroups_submit(e->name, "total_time_in_ms", type_instance, &value, 1);
+      break;
+    }
+  }
+} /* void cg2_parse_pressure */
+
+static void cg2_read_entry(cg2_entry_t *e) {
+  char buf[CG2_READ_BUFFER_SIZE];
+
+  if (cg2_read_file(e, CG2_CPU_STAT, buf, sizeof(buf)) > 0)
+    cg2_parse_cpu_stat(e, buf);
+  if (cg2_read_file(e, CG2_MEMORY_STAT, buf, sizeof(buf)) > 0)
+    cg2_parse_memory_stat(e, buf);
+  if (cg2_read_file(e, CG2_IO_STAT, buf, sizeof(buf)) > 0)
+    cg2_parse_io_stat(e, buf);
+  if (cg2_read_file(e, CG2_CPU_PRESSURE, buf, sizeof(buf)) > 0)
+    cg2_parse_pressure(e, "cpu", buf);
+  if (cg2_read_file(e, CG2_MEMORY_PRESSURE, buf, sizeof(buf)) > 0)
+    cg2_parse_pressure(e, "memory", buf);
+  if (cg2_read_file(e, CG2_IO_PRESSURE, buf, sizeof(buf)) > 0)
+    cg2_parse_pressure(e, "io", buf);
+} /* void cg2_read_entry */
+
+static int cgroups_read_v2(char const *mount_dir) {
+  if ((cg2_mount == NULL) || (strcmp(cg2_mount, mount_dir) != 0)) {
+    if (cg2_setup(mount_dir) != 0)
+      return -1;
+  }
+
+#if HAVE_SYS_INOTIFY_H
+  if (cg2_inotify_fd >= 0)
+    cg2_handle_events();
+#endif
+  if (cg2_rescan || (cg2_inotify_fd < 0)) {
+    cg2_full_rescan();
+    cg2_rescan = false;
+  }
+
+  c_avl_iterator_t *iter = c_avl_get_iterator(cg2_entries);
+  cg2_entry_t *e;
+  void *key;
+  while (c_avl_iterator_next(iter, &key, (void **)&e) == 0) {
+    if (ignorelist_match(il_cgroup, e->name))
+      continue;
+    cg2_read_entry(e);
+  }
+  c_avl_iterator_destroy(iter);
+
+  return 0;
+} /* int cgroups_read_v2 */
+
 static int cgroups_init(void) {
   if (il_cgroup == NULL)
     il_cgroup = ignorelist_create(1);
 
+  if (cg2_clk_tck <= 0) {
+    cg2_clk_tck = sysconf(_SC_CLK_TCK);
+    if (cg2_clk_tck <= 0)
+      cg2_clk_tck = 100;
+  }
+
   return 0;
 }
 
@@ -174,6 +772,14 @@ static int cgroups_config(const char *key, const char *value) {
     else
       ignorelist_set_invert(il_cgroup, 1);
     return 0;
+  } else if (strcasecmp(key, "MaxDepth") == 0) {
+    int depth = atoi(value);
+    if (depth < 1) {
+      ERROR("cgroups plugin: MaxDepth must be at least 1.");
+      return 1;
+    }
+    cg2_max_depth = depth;
+    return 0;
   }
 
   return -1;
@@ -182,6 +788,7 @@ static int cgroups_config(const char *key, const char *value) {
 static int cgroups_read(void) {
   cu_mount_t *mnt_list = NULL;
   bool cgroup_found = false;
+  char *cgroup2_dir = NULL;
 
   if (cu_mount_getlist(&mnt_list) == NULL) {
     ERROR("cgroups plugin: cu_mount_getlist failed.");
@@ -190,6 +797,13 @@ static int cgroups_read(void) {
 
   for (cu_mount_t *mnt_ptr = mnt_list; mnt_ptr != NULL;
        mnt_ptr = mnt_ptr->next) {
+    /* Remember the unified hierarchy, it's used if there's no cgroup v1
+     * cpuacct controller. */
+    if ((cgroup2_dir == NULL) && (strcmp(mnt_ptr->type, "cgroup2") == 0)) {
+      cgroup2_dir = strdup(mnt_ptr->dir);
+      continue;
+    }
+
     /* Find the cgroup mountpoint which contains the cpuacct
      * controller. */
     if ((strcmp(mnt_ptr->type, "cgroup") != 0) ||
@@ -207,18 +821,40 @@ static int cgroups_read(void) {
 
   cu_mount_freelist(mnt_list);
 
+  if (!cgroup_found && (cgroup2_dir != NULL)) {
+    int status = cgroups_read_v2(cgroup2_dir);
+    sfree(cgroup2_dir);
+    return status;
+  }
+  sfree(cgroup2_dir);
+
   if (!cgroup_found) {
     WARNING("cgroups plugin: Unable to find cgroup "
-            "mount-point with the \"cpuacct\" option.");
+            "mount-point with the \"cpuacct\" option or a cgroup2 "
+            "mount-point.");
     return -1;
   }
 
   return 0;
 } /* int cgroup_read */
 
+static int cgroups_shutdown(void) {
+  cg2_reset();
+  c_avl_destroy(cg2_watches);
+  cg2_watches = NULL;
+  c_avl_destroy(cg2_entries);
+  cg2_entries = NULL;
+
+  ignorelist_free(il_cgroup);
+  il_cgroup = NULL;
+
+  return 0;
+} /* int cgroups_shutdown */
+
 void module_register(void) {
   plugin_register_config("cgroups", cgroups_config, config_keys,
                          config_keys_num);
   plugin_register_init("cgroups", cgroups_init);
   plugin_register_read("cgroups", cgroups_read);
+  plugin_register_shutdown("cgroups", cgroups_shutdown);
 } /* void module_register */
@@ -24,6 +24,8 @@
  *   Florian Forster <octo at collectd.org>
  **/
 
+#define _GNU_SOURCE /* For sendmmsg(2) */
+
 #if HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -33,9 +35,12 @@
 #endif
 
 #include <errno.h>
+#include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,6 +48,12 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
 #include "utils_heap.h"
 
 #include "collectd/client.h"
@@ -52,6 +63,13 @@
 #define DEF_NUM_PLUGINS 20
 #define DEF_NUM_VALUES 100000
 #define DEF_INTERVAL 10.0
+#define DEF_NUM_THREADS 1
+
+/* Number of packets handed to the kernel with one sendmmsg(2) call when
+ * replaying a capture. */
+#define REPLAY_BATCH_SIZE 64
+/* Largest payload of a UDP datagram. */
+#define REPLAY_PACKET_MAX 65507
 
 static int conf_num_hosts = DEF_NUM_HOSTS;
 static int conf_num_plugins = DEF_NUM_PLUGINS;
@@ -59,15 +77,56 @@ static int conf_num_values = DEF_NUM_VALUES;
 static double conf_interval = DEF_INTERVAL;
 static const char *conf_destination = NET_DEFAULT_V6_ADDR;
 static const char *conf_service = NET_DEFAULT_PORT;
-
-static lcc_network_t *net;
-
-static c_heap_t *values_heap;
+static int conf_num_threads = DEF_NUM_THREADS;
+static double conf_zipf_exponent = 0.0;
+static bool conf_flood = false;
+static const char *conf_replay_file = NULL;
+
+typedef struct {
+  pthread_mutex_t lock;
+  uint64_t calls;
+  uint64_t sent;
+  uint64_t failed;
+  uint64_t bytes;
+  double latency_sum;
+  double latency_max;
+} tg_stats_t;
+
+typedef struct {
+  pthread_t thread;
+
+  /* Generator mode: the value lists owned by this thread and the network
+   * object used to send them. */
+  c_heap_t *values_heap;
+  lcc_network_t *net;
+  unsigned short rand_state[3];
+
+  /* Replay mode: the socket the captured packets are sent over. */
+  int fd;
+
+  tg_stats_t stats;
+} tg_worker_t;
+
+typedef struct {
+  const char *data;
+  size_t size;
+} tg_packet_t;
+
+static tg_worker_t *workers;
+
+/* Cumulative distribution functions used to pick hosts and plugins when
+ * "-z" is given. NULL means uniformly distributed. */
+static double *hosts_cdf;
+static double *plugins_cdf;
+
+static char *replay_buffer;
+static tg_packet_t *replay_packets;
+static size_t replay_packets_num;
 
 static struct sigaction sigint_action;
 static struct sigaction sigterm_action;
 
-static bool loop = true;
+static volatile bool loop = true;
 
 __attribute__((noreturn)) static void exit_usage(int exit_status) /* {{{ */
 {
@@ -86,12 +145,20 @@ __attribute__((noreturn)) static void exit_usage(int exit_status) /* {{{ */
       "                   (Default: %s)\n"
       "    -D <port>      Destination port of the network packets.\n"
       "                   (Default: %s)\n"
+      "    -t <number>    Number of sending threads. (Default: %i)\n"
+      "    -z <exponent>  Distribute value lists over hosts and plugins\n"
+      "                   following Zipf's law with this exponent.\n"
+      "                   (Default: uniform distribution)\n"
+      "    -f             Flood mode: send as fast as possible, ignoring the\n"
+      "                   interval.\n"
+      "    -r <file>      Replay the network packets recorded in <file>\n"
+      "                   instead of generating value lists.\n"
       "    -h             Print usage information (this output).\n"
       "\n"
       "Copyright (C) 2010-2012  Florian Forster\n"
       "Licensed under the MIT license.\n",
       DEF_NUM_VALUES, DEF_NUM_HOSTS, DEF_NUM_PLUGINS, DEF_INTERVAL,
-      NET_DEFAULT_V6_ADDR, NET_DEFAULT_PORT);
+      NET_DEFAULT_V6_ADDR, NET_DEFAULT_PORT, DEF_NUM_THREADS);
   exit(exit_status);
 } /* }}} void exit_usage */
 
@@ -123,6 +190,43 @@ static double dtime(void) /* {{{ */
 } /* }}} double dtime */
 #endif
 
+/* Like dtime(), but not affected by changes to the system clock. Used to
+ * measure how long sending takes. */
+static double mtime(void) /* {{{ */
+{
+#if HAVE_CLOCK_GETTIME
+  struct timespec ts = {0};
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    perror("clock_gettime");
+
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+  return dtime();
+#endif
+} /* }}} double mtime */
+
+/* Sleeps until the wall clock reaches "t". Wakes up at least once a second
+ * to check whether the user asked us to shut down. */
+static void wait_until(double t) /* {{{ */
+{
+  double now = dtime();
+
+  while (loop && (now < t)) {
+    double diff = t - now;
+    if (diff > 1.0)
+      diff = 1.0;
+
+    struct timespec ts = {
+        .tv_sec = (time_t)diff,
+    };
+    ts.tv_nsec = (long)((diff - ((double)ts.tv_sec)) * 1e9);
+
+    nanosleep(&ts, /* remaining = */ NULL);
+    now = dtime();
+  }
+} /* }}} void wait_until */
+
 static int compare_time(const void *v0, const void *v1) /* {{{ */
 {
   const lcc_value_list_t *vl0 = v0;
@@ -151,6 +255,54 @@ static int get_boundet_random(int min, int max) /* {{{ */
                       (((double)RAND_MAX) + 1.0)));
 } /* }}} int get_boundet_random */
 
+/* Returns the cumulative distribution function of a Zipf distribution over
+ * "num" elements, i.e. the probability of picking element k (counting from
+ * one) is proportional to 1/k^exponent. */
+static double *zipf_create(int num, double exponent) /* {{{ */
+{
+  double *cdf;
+  double sum = 0.0;
+
+  cdf = calloc((size_t)num, sizeof(*cdf));
+  if (cdf == NULL) {
+    fprintf(stderr, "calloc failed.\n");
+    return NULL;
+  }
+
+  for (int i = 0; i < num; i++) {
+    sum += 1.0 / pow((double)(i + 1), exponent);
+    cdf[i] = sum;
+  }
+  for (int i = 0; i < num; i++)
+    cdf[i] /= sum;
+
+  return cdf;
+} /* }}} double *zipf_create */
+
+/* Returns a random number in [0, num), either uniformly distributed or
+ * following the distribution described by "cdf". */
+static int get_distributed_random(double const *cdf, int num) /* {{{ */
+{
+  double r;
+  int lo = 0;
+  int hi = num - 1;
+
+  if (cdf == NULL)
+    return get_boundet_random(0, num);
+
+  r = ((double)random()) / (((double)RAND_MAX) + 1.0);
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+
+    if (cdf[mid] <= r)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+} /* }}} int get_distributed_random */
+
 static lcc_value_list_t *create_value_list(void) /* {{{ */
 {
   lcc_value_list_t *vl;
@@ -179,7 +331,7 @@ static lcc_value_list_t *create_value_list(void) /* {{{ */
 
   vl->values_len = 1;
 
-  host_num = get_boundet_random(0, conf_num_hosts);
+  host_num = get_distributed_random(hosts_cdf, conf_num_hosts);
 
   vl->interval = conf_interval;
   vl->time = 1.0 + dtime() + (host_num % (1 + (int)vl->interval));
@@ -192,7 +344,7 @@ static lcc_value_list_t *create_value_list(void) /* {{{ */
   snprintf(vl->identifier.host, sizeof(vl->identifier.host), "host%04i",
            host_num);
   snprintf(vl->identifier.plugin, sizeof(vl->identifier.plugin), "plugin%03i",
-           get_boundet_random(0, conf_num_plugins));
+           get_distributed_random(plugins_cdf, conf_num_plugins));
   strncpy(vl->identifier.type,
           (vl->values_types[0] == LCC_TYPE_GAUGE) ? "gauge" : "derive",
           sizeof(vl->identifier.type));
@@ -213,17 +365,36 @@ static void destroy_value_list(lcc_value_list_t *vl) /* {{{ */
   free(vl);
 } /* }}} void destroy_value_list */
 
-static int send_value(lcc_value_list_t *vl) /* {{{ */
+static void stats_add(tg_stats_t *stats, uint64_t sent, /* {{{ */
+                      uint64_t failed, uint64_t bytes, double latency) {
+  pthread_mutex_lock(&stats->lock);
+  stats->calls++;
+  stats->sent += sent;
+  stats->failed += failed;
+  stats->bytes += bytes;
+  stats->latency_sum += latency;
+  if (stats->latency_max < latency)
+    stats->latency_max = latency;
+  pthread_mutex_unlock(&stats->lock);
+} /* }}} void stats_add */
+
+static int send_value(tg_worker_t *w, lcc_value_list_t *vl) /* {{{ */
 {
+  double start;
   int status;
 
+  /* random() serializes all callers on a global lock; use the thread's own
+   * generator state instead. */
   if (vl->values_types[0] == LCC_TYPE_GAUGE)
-    vl->values[0].gauge =
-        100.0 * ((gauge_t)random()) / (((gauge_t)RAND_MAX) + 1.0);
+    vl->values[0].gauge = 100.0 * ((gauge_t)nrand48(w->rand_state)) /
+                          ((gauge_t)2147483648.0);
   else
-    vl->values[0].derive += (derive_t)get_boundet_random(0, 100);
+    vl->values[0].derive += (derive_t)(nrand48(w->rand_state) % 100);
 
-  status = lcc_network_values_send(net, vl);
+  start = mtime();
+  status = lcc_network_values_send(w->net, vl);
+  stats_add(&w->stats, (status == 0) ? 1 : 0, (status == 0) ? 0 : 1,
+            /* bytes = */ 0, mtime() - start);
   if (status != 0)
     fprintf(stderr, "lcc_network_values_send failed with status %i.\n", status);
 
@@ -232,6 +403,323 @@ static int send_value(lcc_value_list_t *vl) /* {{{ */
   return 0;
 } /* }}} int send_value */
 
+static void *generator_thread(void *arg) /* {{{ */
+{
+  tg_worker_t *w = arg;
+  double last_time = 0;
+
+  while (loop) {
+    lcc_value_list_t *vl = c_heap_peek_root(w->values_heap);
+
+    if (vl == NULL)
+      break;
+
+    if (!conf_flood && (vl->time != last_time)) {
+      wait_until(vl->time);
+      last_time = vl->time;
+    }
+
+    /* send_value() moves the value's time forward. */
+    if (loop) {
+      send_value(w, vl);
+      c_heap_update_root(w->values_heap);
+    }
+  }
+
+  return NULL;
+} /* }}} void *generator_thread */
+
+static int replay_send(tg_worker_t *w, tg_packet_t const *packets, /* {{{ */
+                       size_t packets_num) {
+  uint64_t sent = 0;
+  uint64_t failed = 0;
+  uint64_t bytes = 0;
+  double start = mtime();
+
+#if HAVE_SENDMMSG
+  struct mmsghdr msgs[REPLAY_BATCH_SIZE];
+  struct iovec iov[REPLAY_BATCH_SIZE];
+  size_t done = 0;
+
+  memset(msgs, 0, sizeof(msgs));
+
+  for (size_t i = 0; i < packets_num; i++) {
+    iov[i].iov_base = (void *)packets[i].data;
+    iov[i].iov_len = packets[i].size;
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (done < packets_num) {
+    int status = sendmmsg(w->fd, msgs + done, (unsigned int)(packets_num - done),
+                          /* flags = */ 0);
+    if (status < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      /* Skip the packet the error was reported for. */
+      failed++;
+      done++;
+      continue;
+    }
+
+    for (size_t i = done; i < done + (size_t)status; i++)
+      bytes += msgs[i].msg_len;
+    sent += (uint64_t)status;
+    done += (size_t)status;
+  }
+#else
+  for (size_t i = 0; i < packets_num; i++) {
+    ssize_t status;
+
+    do {
+      status = send(w->fd, packets[i].data, packets[i].size, /* flags = */ 0);
+    } while ((status < 0) && ((errno == EINTR) || (errno == EAGAIN)));
+
+    if (status < 0) {
+      failed++;
+      continue;
+    }
+    sent++;
+    bytes += (uint64_t)status;
+  }
+#endif
+
+  stats_add(&w->stats, sent, failed, bytes, mtime() - start);
+  return 0;
+} /* }}} int replay_send */
+
+static void *replay_thread(void *arg) /* {{{ */
+{
+  tg_worker_t *w = arg;
+  double next = dtime();
+
+  while (loop) {
+    if (!conf_flood) {
+      wait_until(next);
+      next += conf_interval;
+    }
+
+    for (size_t i = 0; loop && (i < replay_packets_num);
+         i += REPLAY_BATCH_SIZE) {
+      size_t num = replay_packets_num - i;
+      if (num > REPLAY_BATCH_SIZE)
+        num = REPLAY_BATCH_SIZE;
+
+      replay_send(w, replay_packets + i, num);
+    }
+  }
+
+  return NULL;
+} /* }}} void *replay_thread */
+
+/* Reads a recording of network packets. Each packet is preceded by its size
+ * as a 32 bit unsigned integer in network byte order. This is the format
+ * used by the "BinaryExec" option of the exec plugin. */
+static int replay_read(const char *file) /* {{{ */
+{
+  FILE *fh;
+  size_t size = 0;
+  size_t alloc = 0;
+
+  fh = fopen(file, "r");
+  if (fh == NULL) {
+    fprintf(stderr, "Opening \"%s\" failed: %s\n", file, strerror(errno));
+    return -1;
+  }
+
+  while (42) {
+    if (size == alloc) {
+      size_t new_alloc = (alloc == 0) ? 65536 : 2 * alloc;
+      char *tmp = realloc(replay_buffer, new_alloc);
+      if (tmp == NULL) {
+        fprintf(stderr, "realloc failed.\n");
+        fclose(fh);
+        return -1;
+      }
+      replay_buffer = tmp;
+      alloc = new_alloc;
+    }
+
+    size_t status = fread(replay_buffer + size, 1, alloc - size, fh);
+    if (status == 0)
+      break;
+    size += status;
+  }
+
+  if (ferror(fh)) {
+    fprintf(stderr, "Reading \"%s\" failed.\n", file);
+    fclose(fh);
+    return -1;
+  }
+  fclose(fh);
+
+  for (size_t offset = 0; offset < size;) {
+    uint32_t packet_size;
+
+    if ((size - offset) < sizeof(packet_size)) {
+      fprintf(stderr, "\"%s\": Truncated packet at offset %zu.\n", file,
+              offset);
+      return -1;
+    }
+    memcpy(&packet_size, replay_buffer + offset, sizeof(packet_size));
+    packet_size = ntohl(packet_size);
+    offset += sizeof(packet_size);
+
+    if ((packet_size == 0) || (packet_size > REPLAY_PACKET_MAX) ||
+        (packet_size > (size - offset))) {
+      fprintf(stderr, "\"%s\": Invalid packet size %" PRIu32
+                      " at offset %zu.\n",
+              file, packet_size, offset - sizeof(packet_size));
+      return -1;
+    }
+
+    tg_packet_t *tmp = realloc(replay_packets, (replay_packets_num + 1) *
+                                                   sizeof(*replay_packets));
+    if (tmp == NULL) {
+      fprintf(stderr, "realloc failed.\n");
+      return -1;
+    }
+    replay_packets = tmp;
+    replay_packets[replay_packets_num] = (tg_packet_t){
+        .data = replay_buffer + offset, .size = (size_t)packet_size,
+    };
+    replay_packets_num++;
+
+    offset += packet_size;
+  }
+
+  if (replay_packets_num == 0) {
+    fprintf(stderr, "\"%s\" does not contain any packets.\n", file);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int replay_read */
+
+/* Opens a UDP socket connected to the destination. Uses the same TTL as the
+ * value lists sent by the generator. */
+static int replay_socket(void) /* {{{ */
+{
+  struct addrinfo *ai_list;
+  int fd = -1;
+  int status;
+
+  struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
+                              .ai_flags = AI_ADDRCONFIG,
+                              .ai_socktype = SOCK_DGRAM};
+
+  status = getaddrinfo(conf_destination, conf_service, &ai_hints, &ai_list);
+  if (status != 0) {
+    fprintf(stderr, "getaddrinfo (\"%s\", \"%s\") failed: %s\n",
+            conf_destination, conf_service, gai_strerror(status));
+    return -1;
+  }
+
+  for (struct addrinfo *ai_ptr = ai_list; ai_ptr != NULL;
+       ai_ptr = ai_ptr->ai_next) {
+    int ttl = 42;
+
+    fd = socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    if (ai_ptr->ai_family == AF_INET) {
+      struct sockaddr_in *addr = (struct sockaddr_in *)ai_ptr->ai_addr;
+      int optname = IN_MULTICAST(ntohl(addr->sin_addr.s_addr))
+                        ? IP_MULTICAST_TTL
+                        : IP_TTL;
+      setsockopt(fd, IPPROTO_IP, optname, &ttl, sizeof(ttl));
+    } else if (ai_ptr->ai_family == AF_INET6) {
+      struct sockaddr_in6 *addr = (struct sockaddr_in6 *)ai_ptr->ai_addr;
+      int optname = IN6_IS_ADDR_MULTICAST(&addr->sin6_addr)
+                        ? IPV6_MULTICAST_HOPS
+                        : IPV6_UNICAST_HOPS;
+      setsockopt(fd, IPPROTO_IPV6, optname, &ttl, sizeof(ttl));
+    }
+
+    if (connect(fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+      continue;
+    }
+    break;
+  }
+
+  freeaddrinfo(ai_list);
+
+  if (fd < 0)
+    fprintf(stderr, "Unable to open a socket to \"%s\", port \"%s\".\n",
+            conf_destination, conf_service);
+  return fd;
+} /* }}} int replay_socket */
+
+static lcc_network_t *network_create(void) /* {{{ */
+{
+  lcc_network_t *net;
+  lcc_server_t *srv;
+
+  net = lcc_network_create();
+  if (net == NULL) {
+    fprintf(stderr, "lcc_network_create failed.\n");
+    return NULL;
+  }
+
+  srv = lcc_server_create(net, conf_destination, conf_service);
+  if (srv == NULL) {
+    fprintf(stderr, "lcc_server_create failed.\n");
+    lcc_network_destroy(net);
+    return NULL;
+  }
+
+  lcc_server_set_ttl(srv, 42);
+#if 0
+  lcc_server_set_security_level (srv, ENCRYPT,
+      "admin", "password1");
+#endif
+
+  return net;
+} /* }}} lcc_network_t *network_create */
+
+/* Adds up the statistics of all workers. The maximum latency is reset, so
+ * that each report shows the maximum of the last period. */
+static void stats_collect(tg_stats_t *ret) /* {{{ */
+{
+  *ret = (tg_stats_t){.calls = 0};
+
+  for (int i = 0; i < conf_num_threads; i++) {
+    tg_stats_t *s = &workers[i].stats;
+
+    pthread_mutex_lock(&s->lock);
+    ret->calls += s->calls;
+    ret->sent += s->sent;
+    ret->failed += s->failed;
+    ret->bytes += s->bytes;
+    ret->latency_sum += s->latency_sum;
+    if (ret->latency_max < s->latency_max)
+      ret->latency_max = s->latency_max;
+    s->latency_max = 0.0;
+    pthread_mutex_unlock(&s->lock);
+  }
+} /* }}} void stats_collect */
+
+static void stats_print(tg_stats_t const *cur, tg_stats_t const *prev, /* {{{ */
+                        double duration) {
+  uint64_t calls = cur->calls - prev->calls;
+  double latency_avg = 0.0;
+
+  if (calls > 0)
+    latency_avg = (cur->latency_sum - prev->latency_sum) / (double)calls;
+
+  printf("%.0f %s/s", (double)(cur->sent - prev->sent) / duration,
+         (conf_replay_file != NULL) ? "packets" : "values");
+  if (conf_replay_file != NULL)
+    printf(" (%.2f MB/s)",
+           (double)(cur->bytes - prev->bytes) / (duration * 1e6));
+  printf(", %" PRIu64 " failed, send latency avg %.1f us, max %.1f us\n",
+         cur->failed - prev->failed, 1e6 * latency_avg, 1e6 * cur->latency_max);
+  fflush(stdout);
+} /* }}} void stats_print */
+
 static int get_integer_opt(const char *str, int *ret_value) /* {{{ */
 {
   char *endptr;
@@ -284,7 +772,7 @@ static int read_options(int argc, char **argv) /* {{{ */
 {
   int opt;
 
-  while ((opt = getopt(argc, argv, "n:H:p:i:d:D:h")) != -1) {
+  while ((opt = getopt(argc, argv, "n:H:p:i:d:D:t:z:fr:h")) != -1) {
     switch (opt) {
     case 'n':
       get_integer_opt(optarg, &conf_num_values);
@@ -310,6 +798,22 @@ static int read_options(int argc, char **argv) /* {{{ */
       conf_service = optarg;
       break;
 
+    case 't':
+      get_integer_opt(optarg, &conf_num_threads);
+      break;
+
+    case 'z':
+      get_double_opt(optarg, &conf_zipf_exponent);
+      break;
+
+    case 'f':
+      conf_flood = true;
+      break;
+
+    case 'r':
+      conf_replay_file = optarg;
+      break;
+
     case 'h':
       exit_usage(EXIT_SUCCESS);
 
@@ -318,13 +822,31 @@ static int read_options(int argc, char **argv) /* {{{ */
     } /* switch (opt) */
   }   /* while (getopt) */
 
+  if ((conf_num_values < 1) || (conf_num_hosts < 1) || (conf_num_plugins < 1) ||
+      (conf_num_threads < 1)) {
+    fprintf(stderr, "The number of values, hosts, plugins and threads must be "
+                    "positive.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!(conf_interval > 0.0)) {
+    fprintf(stderr, "The interval must be positive.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (conf_zipf_exponent < 0.0) {
+    fprintf(stderr, "The Zipf exponent must not be negative.\n");
+    exit(EXIT_FAILURE);
+  }
+
   return 0;
 } /* }}} int read_options */
 
 int main(int argc, char **argv) /* {{{ */
 {
+  sigset_t sigmask;
+  tg_stats_t prev = {.calls = 0};
+  tg_stats_t cur;
+  double start_time;
   double last_time;
-  int values_sent = 0;
 
   read_options(argc, argv);
 
@@ -334,93 +856,142 @@ int main(int argc, char **argv) /* {{{ */
   sigterm_action.sa_handler = signal_handler;
   sigaction(SIGTERM, &sigterm_action, /* old = */ NULL);
 
-  values_heap = c_heap_create(compare_time);
-  if (values_heap == NULL) {
-    fprintf(stderr, "c_heap_create failed.\n");
+  workers = calloc((size_t)conf_num_threads, sizeof(*workers));
+  if (workers == NULL) {
+    fprintf(stderr, "calloc failed.\n");
     exit(EXIT_FAILURE);
   }
 
-  net = lcc_network_create();
-  if (net == NULL) {
-    fprintf(stderr, "lcc_network_create failed.\n");
-    exit(EXIT_FAILURE);
-  } else {
-    lcc_server_t *srv;
+  for (int i = 0; i < conf_num_threads; i++) {
+    tg_worker_t *w = workers + i;
+    long seed = random();
+
+    pthread_mutex_init(&w->stats.lock, /* attr = */ NULL);
+    w->fd = -1;
+    w->rand_state[0] = (unsigned short)seed;
+    w->rand_state[1] = (unsigned short)(seed >> 16);
+    w->rand_state[2] = (unsigned short)i;
+
+    if (conf_replay_file != NULL) {
+      w->fd = replay_socket();
+      if (w->fd < 0)
+        exit(EXIT_FAILURE);
+      continue;
+    }
 
-    srv = lcc_server_create(net, conf_destination, conf_service);
-    if (srv == NULL) {
-      fprintf(stderr, "lcc_server_create failed.\n");
+    /* Each heap is only used by its worker thread. */
+    w->values_heap =
+        c_heap_create_ex(compare_time, C_HEAP_UNLOCKED, /* index_offset = */ 0);
+    if (w->values_heap == NULL) {
+      fprintf(stderr, "c_heap_create failed.\n");
       exit(EXIT_FAILURE);
     }
 
-    lcc_server_set_ttl(srv, 42);
-#if 0
-    lcc_server_set_security_level (srv, ENCRYPT,
-        "admin", "password1");
-#endif
+    w->net = network_create();
+    if (w->net == NULL)
+      exit(EXIT_FAILURE);
   }
 
-  fprintf(stdout, "Creating %i values ... ", conf_num_values);
-  fflush(stdout);
-  for (int i = 0; i < conf_num_values; i++) {
-    lcc_value_list_t *vl;
-
-    vl = create_value_list();
-    if (vl == NULL) {
-      fprintf(stderr, "create_value_list failed.\n");
+  if (conf_replay_file != NULL) {
+    if (replay_read(conf_replay_file) != 0)
       exit(EXIT_FAILURE);
+    fprintf(stdout, "Replaying %zu packets from \"%s\".\n", replay_packets_num,
+            conf_replay_file);
+  } else {
+    if (conf_zipf_exponent > 0.0) {
+      hosts_cdf = zipf_create(conf_num_hosts, conf_zipf_exponent);
+      plugins_cdf = zipf_create(conf_num_plugins, conf_zipf_exponent);
+      if ((hosts_cdf == NULL) || (plugins_cdf == NULL))
+        exit(EXIT_FAILURE);
     }
 
-    c_heap_insert(values_heap, vl);
+    fprintf(stdout, "Creating %i values ... ", conf_num_values);
+    fflush(stdout);
+    for (int i = 0; i < conf_num_values; i++) {
+      lcc_value_list_t *vl;
+
+      vl = create_value_list();
+      if (vl == NULL) {
+        fprintf(stderr, "create_value_list failed.\n");
+        exit(EXIT_FAILURE);
+      }
+
+      c_heap_insert(workers[i % conf_num_threads].values_heap, vl);
+    }
+    fprintf(stdout, "done\n");
+  }
+
+  /* Only the main thread handles signals, so it is woken up from its sleep
+   * and can tell the workers to stop. */
+  sigemptyset(&sigmask);
+  sigaddset(&sigmask, SIGINT);
+  sigaddset(&sigmask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sigmask, /* old = */ NULL);
+
+  for (int i = 0; i < conf_num_threads; i++) {
+    int status = pthread_create(
+        &workers[i].thread, /* attr = */ NULL,
+        (conf_replay_file != NULL) ? replay_thread : generator_thread,
+        workers + i);
+    if (status != 0) {
+      fprintf(stderr, "pthread_create failed: %s\n", strerror(status));
+      exit(EXIT_FAILURE);
+    }
   }
-  fprintf(stdout, "done\n");
 
-  last_time = 0;
+  pthread_sigmask(SIG_UNBLOCK, &sigmask, /* old = */ NULL);
+
+  start_time = mtime();
+  last_time = start_time;
   while (loop) {
-    lcc_value_list_t *vl = c_heap_get_root(values_heap);
+    struct timespec ts = {.tv_sec = 1};
+    double now;
 
-    if (vl == NULL)
+    nanosleep(&ts, /* remaining = */ NULL);
+    if (!loop)
       break;
 
-    if (vl->time != last_time) {
-      printf("%i values have been sent.\n", values_sent);
+    now = mtime();
+    stats_collect(&cur);
+    stats_print(&cur, &prev, now - last_time);
+    prev = cur;
+    last_time = now;
+  }
 
-      /* Check if we need to sleep */
-      double now = dtime();
+  fprintf(stdout, "Shutting down.\n");
+  fflush(stdout);
 
-      while (now < vl->time) {
-        double diff = vl->time - now;
-        struct timespec ts = {
-            .tv_sec = (time_t)diff,
-        };
-        ts.tv_nsec = (long)((diff - ((double)ts.tv_sec)) * 1e9);
+  for (int i = 0; i < conf_num_threads; i++)
+    pthread_join(workers[i].thread, /* retval = */ NULL);
 
-        nanosleep(&ts, /* remaining = */ NULL);
-        now = dtime();
+  stats_collect(&cur);
+  fprintf(stdout, "%" PRIu64 " %s sent, %" PRIu64 " failed in %.1f seconds.\n",
+          cur.sent, (conf_replay_file != NULL) ? "packets" : "values",
+          cur.failed, mtime() - start_time);
 
-        if (!loop)
-          break;
-      }
-      last_time = vl->time;
-    }
+  for (int i = 0; i < conf_num_threads; i++) {
+    tg_worker_t *w = workers + i;
 
-    send_value(vl);
-    values_sent++;
+    while (w->values_heap != NULL) {
+      lcc_value_list_t *vl = c_heap_get_root(w->values_heap);
+      if (vl == NULL)
+        break;
+      destroy_value_list(vl);
+    }
+    c_heap_destroy(w->values_heap);
 
-    c_heap_insert(values_heap, vl);
+    if (w->net != NULL)
+      lcc_network_destroy(w->net);
+    if (w->fd >= 0)
+      close(w->fd);
+    pthread_mutex_destroy(&w->stats.lock);
   }
+  free(workers);
 
-  fprintf(stdout, "Shutting down.\n");
-  fflush(stdout);
-
-  while (42) {
-    lcc_value_list_t *vl = c_heap_get_root(values_heap);
-    if (vl == NULL)
-      break;
-    destroy_value_list(vl);
-  }
-  c_heap_destroy(values_heap);
+  free(hosts_cdf);
+  free(plugins_cdf);
+  free(replay_packets);
+  free(replay_buffer);
 
-  lcc_network_destroy(net);
   exit(EXIT_SUCCESS);
 } /* }}} int main */
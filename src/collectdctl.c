@@ -94,6 +94,7 @@ __attribute__((noreturn)) static void exit_usage(const char *name, int status) {
       "\nAvailable commands:\n\n"
 
       " * getval <identifier>\n"
+      " * getvals <pattern>\n"
       " * flush [timeout=<seconds>] [plugin=<name>] [identifier=<id>]\n"
       " * listval\n"
       " * putval <identifier> [interval=<seconds>] <value-list(s)>\n"
@@ -228,6 +229,44 @@ static int getval(lcc_connection_t *c, int argc, char **argv) {
 #undef BAIL_OUT
 } /* getval */
 
+static int getvals(lcc_connection_t *c, int argc, char **argv) {
+  lcc_getvals_result_t *results = NULL;
+  size_t results_num = 0;
+  int status;
+
+  assert(strcasecmp(argv[0], "getvals") == 0);
+
+  if (argc != 2) {
+    fprintf(stderr, "ERROR: getvals: Missing pattern.\n");
+    return -1;
+  }
+
+  status = lcc_getvals(c, argv[1], &results, &results_num);
+  if (status != 0) {
+    fprintf(stderr, "ERROR: %s\n", lcc_strerror(c));
+    return -1;
+  }
+
+  for (size_t i = 0; i < results_num; i++) {
+    char id[1024];
+
+    status = lcc_identifier_to_string(c, id, sizeof(id),
+                                      &results[i].identifier);
+    if (status != 0) {
+      fprintf(stderr, "ERROR: getvals: Failed to stringify identifier: %s\n",
+              lcc_strerror(c));
+      continue;
+    }
+
+    for (size_t j = 0; j < results[i].values_num; j++)
+      printf("%s %s=%e\n", id, results[i].values_names[j],
+             results[i].values[j]);
+  }
+
+  lcc_getvals_free(results, results_num);
+  return 0;
+} /* getvals */
+
 static int flush(lcc_connection_t *c, int argc, char **argv) {
   int timeout = -1;
 
@@ -568,6 +607,8 @@ int main(int argc, char **argv) {
 
   if (strcasecmp(argv[optind], "getval") == 0)
     status = getval(c, argc - optind, argv + optind);
+  else if (strcasecmp(argv[optind], "getvals") == 0)
+    status = getvals(c, argc - optind, argv + optind);
   else if (strcasecmp(argv[optind], "flush") == 0)
     status = flush(c, argc - optind, argv + optind);
   else if (strcasecmp(argv[optind], "listval") == 0)
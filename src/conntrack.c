@@ -30,6 +30,13 @@
 #error "No applicable input method."
 #endif
 
+#if HAVE_LINUX_NETFILTER_NFNETLINK_CONNTRACK_H
+#include <arpa/inet.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <linux/netlink.h>
+#endif
+
 #define CONNTRACK_FILE "/proc/sys/net/netfilter/nf_conntrack_count"
 #define CONNTRACK_MAX_FILE "/proc/sys/net/netfilter/nf_conntrack_max"
 #define CONNTRACK_FILE_OLD "/proc/sys/net/ipv4/netfilter/ip_conntrack_count"
@@ -43,6 +50,15 @@ static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int old_files;
 
+/* The counters are requested with a single ctnetlink message, which needs
+ * CAP_NET_ADMIN. If that fails, the files in /proc are read instead. */
+static enum { SRC_DUNNO, SRC_NETLINK, SRC_PROC } conntrack_source = SRC_DUNNO;
+
+#if HAVE_LINUX_NETFILTER_NFNETLINK_CONNTRACK_H
+static int conntrack_fd = -1;
+static uint32_t conntrack_seq;
+#endif
+
 static int conntrack_config(const char *key, const char *value) {
   if (strcmp(key, "OldFiles") == 0)
     old_files = 1;
@@ -64,19 +80,143 @@ static void conntrack_submit(const char *type, const char *type_instance,
   plugin_dispatch_values(&vl);
 } /* static void conntrack_submit */
 
-static int conntrack_read(void) {
-  value_t conntrack, conntrack_max, conntrack_pct;
+/* Queries the CTA_STATS_GLOBAL counters. If the kernel doesn't report the
+ * maximum, "conntrack_max" is left untouched. Returns zero on success. */
+static int conntrack_read_netlink(value_t *conntrack,
+                                  value_t *conntrack_max) {
+#if HAVE_LINUX_NETFILTER_NFNETLINK_CONNTRACK_H
+  union {
+    struct nlmsghdr nlh;
+    char buf[1024];
+  } msg;
+
+  if (conntrack_fd < 0) {
+    conntrack_fd =
+        socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+    if (conntrack_fd < 0) {
+      DEBUG("conntrack plugin: socket(AF_NETLINK) failed: %s", STRERRNO);
+      return -1;
+    }
+  }
 
-  char const *path = old_files ? CONNTRACK_FILE_OLD : CONNTRACK_FILE;
-  if (parse_value_file(path, &conntrack, DS_TYPE_GAUGE) != 0) {
-    ERROR("conntrack plugin: Reading \"%s\" failed.", path);
+  struct {
+    struct nlmsghdr nlh;
+    struct nfgenmsg nfg;
+  } req = {
+      .nlh.nlmsg_len = sizeof(req),
+      .nlh.nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET_STATS,
+      .nlh.nlmsg_flags = NLM_F_REQUEST,
+      .nlh.nlmsg_seq = ++conntrack_seq,
+      .nfg.nfgen_family = AF_UNSPEC,
+      .nfg.version = NFNETLINK_V0,
+  };
+  struct sockaddr_nl nladdr = {.nl_family = AF_NETLINK};
+
+  if (sendto(conntrack_fd, &req, sizeof(req), 0, (struct sockaddr *)&nladdr,
+             sizeof(nladdr)) < 0) {
+    DEBUG("conntrack plugin: sendto failed: %s", STRERRNO);
+    close(conntrack_fd);
+    conntrack_fd = -1;
     return -1;
   }
 
-  path = old_files ? CONNTRACK_MAX_FILE_OLD : CONNTRACK_MAX_FILE;
-  if (parse_value_file(path, &conntrack_max, DS_TYPE_GAUGE) != 0) {
-    ERROR("conntrack plugin: Reading \"%s\" failed.", path);
-    return -1;
+  while (42) {
+    ssize_t len = recv(conntrack_fd, msg.buf, sizeof(msg.buf), 0);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      DEBUG("conntrack plugin: recv failed: %s", STRERRNO);
+      close(conntrack_fd);
+      conntrack_fd = -1;
+      return -1;
+    }
+
+    for (struct nlmsghdr *h = &msg.nlh; NLMSG_OK(h, len);
+         h = NLMSG_NEXT(h, len)) {
+      /* Skip replies to requests that timed out before. */
+      if (h->nlmsg_seq != conntrack_seq)
+        continue;
+
+      if (h->nlmsg_type == NLMSG_ERROR) {
+        DEBUG("conntrack plugin: The kernel returned error %i.",
+              ((struct nlmsgerr *)NLMSG_DATA(h))->error);
+        return -1;
+      }
+
+      bool have_entries = false;
+      struct nlattr *attr = (void *)((char *)NLMSG_DATA(h) +
+                                     NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+      int attr_len = (int)h->nlmsg_len -
+                     NLMSG_LENGTH(NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+
+      while ((attr_len >= (int)sizeof(*attr)) &&
+             (attr->nla_len >= sizeof(*attr)) &&
+             (attr->nla_len <= attr_len)) {
+        int type = attr->nla_type & NLA_TYPE_MASK;
+        uint32_t value;
+
+        if (attr->nla_len >= NLA_HDRLEN + sizeof(value)) {
+          memcpy(&value, (char *)attr + NLA_HDRLEN, sizeof(value));
+          if (type == CTA_STATS_GLOBAL_ENTRIES) {
+            conntrack->gauge = (gauge_t)ntohl(value);
+            have_entries = true;
+          }
+#if HAVE_DECL_CTA_STATS_GLOBAL_MAX_ENTRIES
+          else if (type == CTA_STATS_GLOBAL_MAX_ENTRIES)
+            conntrack_max->gauge = (gauge_t)ntohl(value);
+#endif
+        }
+
+        attr_len -= NLA_ALIGN(attr->nla_len);
+        attr = (void *)((char *)attr + NLA_ALIGN(attr->nla_len));
+      }
+
+      return have_entries ? 0 : -1;
+    }
+  }
+#else
+  return -1;
+#endif
+} /* static int conntrack_read_netlink */
+
+static int conntrack_read(void) {
+  value_t conntrack = {.gauge = NAN};
+  value_t conntrack_max = {.gauge = NAN};
+  value_t conntrack_pct;
+  char const *path;
+
+  if (old_files)
+    conntrack_source = SRC_PROC;
+
+  if (conntrack_source != SRC_PROC) {
+    int status = conntrack_read_netlink(&conntrack, &conntrack_max);
+    if ((status != 0) && (conntrack_source == SRC_DUNNO)) {
+      INFO("conntrack plugin: Reading from netlink failed. "
+           "Will read from /proc from now on.");
+      conntrack_source = SRC_PROC;
+    } else if (status != 0) {
+      ERROR("conntrack plugin: Reading from netlink failed.");
+      return -1;
+    } else {
+      conntrack_source = SRC_NETLINK;
+    }
+  }
+
+  if (conntrack_source == SRC_PROC) {
+    path = old_files ? CONNTRACK_FILE_OLD : CONNTRACK_FILE;
+    if (parse_value_file(path, &conntrack, DS_TYPE_GAUGE) != 0) {
+      ERROR("conntrack plugin: Reading \"%s\" failed.", path);
+      return -1;
+    }
+  }
+
+  /* Older kernels don't report the maximum via netlink. */
+  if (isnan(conntrack_max.gauge)) {
+    path = old_files ? CONNTRACK_MAX_FILE_OLD : CONNTRACK_MAX_FILE;
+    if (parse_value_file(path, &conntrack_max, DS_TYPE_GAUGE) != 0) {
+      ERROR("conntrack plugin: Reading \"%s\" failed.", path);
+      return -1;
+    }
   }
 
   conntrack_pct.gauge = (conntrack.gauge / conntrack_max.gauge) * 100;
@@ -88,8 +228,18 @@ static int conntrack_read(void) {
   return 0;
 } /* static int conntrack_read */
 
+static int conntrack_shutdown(void) {
+#if HAVE_LINUX_NETFILTER_NFNETLINK_CONNTRACK_H
+  if (conntrack_fd >= 0)
+    close(conntrack_fd);
+  conntrack_fd = -1;
+#endif
+  return 0;
+} /* static int conntrack_shutdown */
+
 void module_register(void) {
   plugin_register_config("conntrack", conntrack_config, config_keys,
                          config_keys_num);
   plugin_register_read("conntrack", conntrack_read);
+  plugin_register_shutdown("conntrack", conntrack_shutdown);
 } /* void module_register */
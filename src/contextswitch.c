@@ -76,43 +76,34 @@ static int cs_read(void) {
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-  FILE *fh;
-  char buffer[64];
-  int numfields;
-  char *fields[3];
-  derive_t result = 0;
+  static proc_file_t *pf;
+  char *buffer;
+  char *line;
+  uint64_t result = 0;
   int status = -2;
 
-  fh = fopen("/proc/stat", "r");
-  if (fh == NULL) {
+  if ((pf == NULL) && ((pf = proc_file_open("/proc/stat")) == NULL)) {
     ERROR("contextswitch plugin: unable to open /proc/stat: %s", STRERRNO);
     return -1;
   }
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
-    char *endptr;
-
-    numfields = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
-    if (numfields != 2)
-      continue;
+  if (proc_file_read(pf, &buffer) < 0)
+    return -1;
 
-    if (strcmp("ctxt", fields[0]) != 0)
+  for (char *ptr = buffer; (line = proc_file_line(&ptr)) != NULL;) {
+    if (strncmp("ctxt ", line, strlen("ctxt ")) != 0)
       continue;
 
-    errno = 0;
-    endptr = NULL;
-    result = (derive_t)strtoll(fields[1], &endptr, /* base = */ 10);
-    if ((endptr == fields[1]) || (errno != 0)) {
-      ERROR("contextswitch plugin: Cannot parse ctxt value: %s", fields[1]);
+    if (parse_uint64_fields(line + strlen("ctxt "), &result, 1, NULL) != 1) {
+      ERROR("contextswitch plugin: Cannot parse ctxt value: %s", line);
       status = -1;
       break;
     }
 
-    cs_submit(result);
+    cs_submit((derive_t)result);
     status = 0;
     break;
   }
-  fclose(fh);
 
   if (status == -2)
     ERROR("contextswitch plugin: Unable to find context switch value.");
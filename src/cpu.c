@@ -31,6 +31,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_summary.h"
 
 #ifdef HAVE_MACH_KERN_RETURN_H
 #include <mach/kern_return.h>
@@ -200,10 +201,25 @@ static bool report_percent;
 static bool report_num_cpu;
 static bool report_guest;
 static bool subtract_guest = true;
-
-static const char *config_keys[] = {"ReportByCpu",      "ReportByState",
-                                    "ReportNumCpu",     "ValuesPercentage",
-                                    "ReportGuestState", "SubtractGuestState"};
+/* Dispatch all states of a CPU as one value list of type "cpu_states" or
+ * "percent_states" rather than one value list per state. */
+static bool combine_states;
+
+/* High-resolution mode: when sample_interval is non-zero, the read callback
+ * runs every sample_interval and the percentages of each sample are added to
+ * cpu_summaries. Once per dispatch_interval, the mean, minimum, maximum and
+ * 99th percentile of those samples are dispatched. The summary of the global
+ * aggregation is stored first, followed by the summaries of each CPU. */
+static cdtime_t sample_interval;
+static cdtime_t dispatch_interval;
+static cdtime_t next_dispatch;
+static summary_t *cpu_summaries;
+static size_t cpu_summaries_num;
+
+static const char *config_keys[] = {
+    "ReportByCpu",      "ReportByState",      "ReportNumCpu", "ValuesPercentage",
+    "ReportGuestState", "SubtractGuestState", "SampleInterval",
+    "CombineStates"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int cpu_config(char const *key, char const *value) /* {{{ */
@@ -220,7 +236,16 @@ static int cpu_config(char const *key, char const *value) /* {{{ */
     report_guest = IS_TRUE(value);
   else if (strcasecmp(key, "SubtractGuestState") == 0)
     subtract_guest = IS_TRUE(value);
-  else
+  else if (strcasecmp(key, "CombineStates") == 0)
+    combine_states = IS_TRUE(value);
+  else if (strcasecmp(key, "SampleInterval") == 0) {
+    double tmp = atof(value);
+    if (tmp < 0.0) {
+      WARNING("cpu plugin: SampleInterval must not be negative.");
+      return -1;
+    }
+    sample_interval = DOUBLE_TO_CDTIME_T(tmp);
+  } else
     return -1;
 
   return 0;
@@ -335,6 +360,9 @@ static void submit_value(int cpu_num, int cpu_state, const char *type,
   if (cpu_num >= 0) {
     snprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "%i", cpu_num);
   }
+  /* The read callback runs every SampleInterval in high-resolution mode. */
+  if (sample_interval != 0)
+    vl.interval = dispatch_interval;
   plugin_dispatch_values(&vl);
 }
 
@@ -352,6 +380,67 @@ static void submit_derive(int cpu_num, int cpu_state, derive_t value) {
   submit_value(cpu_num, cpu_state, "cpu", (value_t){.derive = value});
 }
 
+/* Dispatches the values of all states but "active" of one CPU, or of the
+ * global aggregation if cpu_num is -1, as one value list. */
+static void submit_states(int cpu_num, const char *type,
+                          value_t values[static COLLECTD_CPU_STATE_ACTIVE]) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = values;
+  vl.values_len = COLLECTD_CPU_STATE_ACTIVE;
+
+  sstrncpy(vl.plugin, "cpu", sizeof(vl.plugin));
+  sstrncpy(vl.type, type, sizeof(vl.type));
+
+  if (cpu_num >= 0) {
+    snprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "%i", cpu_num);
+  }
+  if (sample_interval != 0)
+    vl.interval = dispatch_interval;
+  plugin_dispatch_values(&vl);
+}
+
+/* Dispatches the percentages of all states but "active" as one value list.
+ * States which are NAN are only skipped if all of them are. */
+static void
+submit_percent_states(int cpu_num,
+                      gauge_t percent[static COLLECTD_CPU_STATE_MAX]) {
+  value_t values[COLLECTD_CPU_STATE_ACTIVE];
+  bool have_value = false;
+
+  for (size_t state = 0; state < COLLECTD_CPU_STATE_ACTIVE; state++) {
+    values[state].gauge = percent[state];
+    if (!isnan(percent[state]))
+      have_value = true;
+  }
+
+  if (have_value)
+    submit_states(cpu_num, "percent_states", values);
+}
+
+static void submit_summary(int cpu_num, int cpu_state, summary_t *s) {
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t values[] = {
+      {.gauge = summary_min(s)},
+      {.gauge = summary_max(s)},
+      {.gauge = summary_percentile(s, 99.0)},
+  };
+
+  vl.values = values;
+  vl.values_len = STATIC_ARRAY_SIZE(values);
+  vl.interval = dispatch_interval;
+
+  sstrncpy(vl.plugin, "cpu", sizeof(vl.plugin));
+  sstrncpy(vl.type, "percent_summary", sizeof(vl.type));
+  sstrncpy(vl.type_instance, cpu_state_names[cpu_state],
+           sizeof(vl.type_instance));
+
+  if (cpu_num >= 0) {
+    snprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "%i", cpu_num);
+  }
+  plugin_dispatch_values(&vl);
+}
+
 /* Takes the zero-index number of a CPU and makes sure that the module-global
  * cpu_states buffer is large enough. Returne ENOMEM on erorr. */
 static int cpu_states_alloc(size_t cpu_num) /* {{{ */
@@ -461,14 +550,19 @@ static void aggregate(gauge_t *sum_by_state) /* {{{ */
 #endif /* }}} HAVE_PERFSTAT */
 } /* }}} void aggregate */
 
+/* Called with the percentage of one state of one CPU, or of the global
+ * aggregation if cpu_num is -1. */
+typedef void (*cpu_percent_cb_t)(int cpu_num, int cpu_state, gauge_t percent);
+
 /* Commits (dispatches) the values for one CPU or the global aggregation.
  * cpu_num is the index of the CPU to be committed or -1 in case of the global
  * aggregation. rates is a pointer to COLLECTD_CPU_STATE_MAX gauge_t values
  * holding the
  * current rate; each rate may be NAN. Calculates the percentage of each state
- * and dispatches the metric. */
+ * and passes it to callback, which dispatches the metric. */
 static void cpu_commit_one(int cpu_num, /* {{{ */
-                           gauge_t rates[static COLLECTD_CPU_STATE_MAX]) {
+                           gauge_t rates[static COLLECTD_CPU_STATE_MAX],
+                           cpu_percent_cb_t callback) {
   gauge_t sum;
 
   sum = rates[COLLECTD_CPU_STATE_ACTIVE];
@@ -476,13 +570,21 @@ static void cpu_commit_one(int cpu_num, /* {{{ */
 
   if (!report_by_state) {
     gauge_t percent = 100.0 * rates[COLLECTD_CPU_STATE_ACTIVE] / sum;
-    submit_percent(cpu_num, COLLECTD_CPU_STATE_ACTIVE, percent);
+    callback(cpu_num, COLLECTD_CPU_STATE_ACTIVE, percent);
+    return;
+  }
+
+  if (combine_states && (callback == submit_percent)) {
+    gauge_t percent[COLLECTD_CPU_STATE_MAX];
+    for (size_t state = 0; state < COLLECTD_CPU_STATE_ACTIVE; state++)
+      percent[state] = 100.0 * rates[state] / sum;
+    submit_percent_states(cpu_num, percent);
     return;
   }
 
   for (size_t state = 0; state < COLLECTD_CPU_STATE_ACTIVE; state++) {
     gauge_t percent = 100.0 * rates[state] / sum;
-    submit_percent(cpu_num, state, percent);
+    callback(cpu_num, state, percent);
   }
 } /* }}} void cpu_commit_one */
 
@@ -513,6 +615,25 @@ static void cpu_reset(void) /* {{{ */
 /* Legacy behavior: Dispatches the raw derive values without any aggregation. */
 static void cpu_commit_without_aggregation(void) /* {{{ */
 {
+  if (combine_states) {
+    for (size_t cpu_num = 0; cpu_num < global_cpu_num; cpu_num++) {
+      value_t values[COLLECTD_CPU_STATE_ACTIVE];
+      bool have_value = false;
+
+      /* States the operating system doesn't report are reported as zero. */
+      for (size_t state = 0; state < COLLECTD_CPU_STATE_ACTIVE; state++) {
+        cpu_state_t *s = get_cpu_state(cpu_num, state);
+        values[state].derive = s->has_value ? s->conv.last_value.derive : 0;
+        if (s->has_value)
+          have_value = true;
+      }
+
+      if (have_value)
+        submit_states((int)cpu_num, "cpu_states", values);
+    }
+    return;
+  }
+
   for (int state = 0; state < COLLECTD_CPU_STATE_ACTIVE; state++) {
     for (size_t cpu_num = 0; cpu_num < global_cpu_num; cpu_num++) {
       cpu_state_t *s = get_cpu_state(cpu_num, state);
@@ -525,25 +646,17 @@ static void cpu_commit_without_aggregation(void) /* {{{ */
   }
 } /* }}} void cpu_commit_without_aggregation */
 
-/* Aggregates the internal state and dispatches the metrics. */
-static void cpu_commit(void) /* {{{ */
+/* Aggregates the internal state and passes the percentages to callback. */
+static void cpu_commit_percent(cpu_percent_cb_t callback) /* {{{ */
 {
   gauge_t global_rates[COLLECTD_CPU_STATE_MAX] = {
       NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN /* Batman! */
   };
 
-  if (report_num_cpu)
-    cpu_commit_num_cpu((gauge_t)global_cpu_num);
-
-  if (report_by_state && report_by_cpu && !report_percent) {
-    cpu_commit_without_aggregation();
-    return;
-  }
-
   aggregate(global_rates);
 
   if (!report_by_cpu) {
-    cpu_commit_one(-1, global_rates);
+    cpu_commit_one(-1, global_rates, callback);
     return;
   }
 
@@ -556,10 +669,102 @@ static void cpu_commit(void) /* {{{ */
       if (this_cpu_states[state].has_value)
         local_rates[state] = this_cpu_states[state].rate;
 
-    cpu_commit_one((int)cpu_num, local_rates);
+    cpu_commit_one((int)cpu_num, local_rates, callback);
+  }
+} /* }}} void cpu_commit_percent */
+
+/* Aggregates the internal state and dispatches the metrics. */
+static void cpu_commit(void) /* {{{ */
+{
+  if (report_num_cpu)
+    cpu_commit_num_cpu((gauge_t)global_cpu_num);
+
+  if (report_by_state && report_by_cpu && !report_percent) {
+    cpu_commit_without_aggregation();
+    return;
   }
+
+  cpu_commit_percent(submit_percent);
 } /* }}} void cpu_commit */
 
+/* Returns the summary of one CPU, or of the global aggregation if cpu_num is
+ * -1, allocating it if necessary. Returns NULL on error. */
+static summary_t *get_cpu_summary(int cpu_num, int state) /* {{{ */
+{
+  size_t index = (((size_t)(cpu_num + 1)) * COLLECTD_CPU_STATE_MAX) + state;
+
+  if (index >= cpu_summaries_num) {
+    size_t sz = index - (index % COLLECTD_CPU_STATE_MAX) +
+                COLLECTD_CPU_STATE_MAX;
+    summary_t *tmp = realloc(cpu_summaries, sz * sizeof(*cpu_summaries));
+    if (tmp == NULL) {
+      ERROR("cpu plugin: realloc failed.");
+      return NULL;
+    }
+    cpu_summaries = tmp;
+    memset(cpu_summaries + cpu_summaries_num, 0,
+           (sz - cpu_summaries_num) * sizeof(*cpu_summaries));
+    cpu_summaries_num = sz;
+  }
+
+  return &cpu_summaries[index];
+} /* }}} summary_t *get_cpu_summary */
+
+static void cpu_sample_percent(int cpu_num, int cpu_state, /* {{{ */
+                               gauge_t percent) {
+  summary_t *s = get_cpu_summary(cpu_num, cpu_state);
+  if (s != NULL)
+    summary_add(s, percent);
+} /* }}} void cpu_sample_percent */
+
+/* High-resolution mode: dispatches the summaries of all samples since the
+ * last dispatch and resets them. For the legacy "cpu" type, the counters are
+ * dispatched as usual since their rate is the mean over the interval. */
+static void cpu_commit_summaries(void) /* {{{ */
+{
+  bool percent = !(report_by_state && report_by_cpu && !report_percent);
+
+  if (report_num_cpu)
+    cpu_commit_num_cpu((gauge_t)global_cpu_num);
+
+  if (!percent)
+    cpu_commit_without_aggregation();
+
+  for (size_t i = 0; i < cpu_summaries_num; i++) {
+    summary_t *s = &cpu_summaries[i];
+    int cpu_num = ((int)(i / COLLECTD_CPU_STATE_MAX)) - 1;
+    int state = (int)(i % COLLECTD_CPU_STATE_MAX);
+
+    if (summary_num(s) == 0)
+      continue;
+
+    if (percent && !combine_states)
+      submit_percent(cpu_num, state, summary_mean(s));
+    submit_summary(cpu_num, state, s);
+  }
+
+  /* The summaries are reset only now, so the means can be combined. */
+  for (size_t i = 0; i < cpu_summaries_num; i += COLLECTD_CPU_STATE_MAX) {
+    summary_t *s = &cpu_summaries[i];
+    int cpu_num = ((int)(i / COLLECTD_CPU_STATE_MAX)) - 1;
+
+    if (percent && combine_states && report_by_state) {
+      gauge_t mean[COLLECTD_CPU_STATE_MAX];
+      for (size_t state = 0; state < COLLECTD_CPU_STATE_MAX; state++)
+        mean[state] = (summary_num(s + state) != 0) ? summary_mean(s + state)
+                                                    : NAN;
+      submit_percent_states(cpu_num, mean);
+    } else if (percent && combine_states &&
+               (summary_num(s + COLLECTD_CPU_STATE_ACTIVE) != 0)) {
+      submit_percent(cpu_num, COLLECTD_CPU_STATE_ACTIVE,
+                     summary_mean(s + COLLECTD_CPU_STATE_ACTIVE));
+    }
+
+    for (size_t state = 0; state < COLLECTD_CPU_STATE_MAX; state++)
+      summary_reset(s + state);
+  }
+} /* }}} void cpu_commit_summaries */
+
 /* Adds a derive value to the internal state. This should be used by each read
  * function for each state. At the end of the iteration, the read function
  * should call cpu_commit(). */
@@ -592,7 +797,7 @@ static int cpu_stage(size_t cpu_num, size_t state, derive_t d,
   return 0;
 } /* }}} int cpu_stage */
 
-static int cpu_read(void) {
+static int cpu_read(__attribute__((unused)) user_data_t *ud) {
   cdtime_t now = cdtime();
 
 #if PROCESSOR_CPU_LOAD_INFO /* {{{ */
@@ -633,52 +838,56 @@ static int cpu_read(void) {
 /* }}} #endif PROCESSOR_CPU_LOAD_INFO */
 
 #elif defined(KERNEL_LINUX) /* {{{ */
-  int cpu;
-  FILE *fh;
-  char buf[1024];
+  static proc_file_t *pf;
+  char *buffer;
+  char *line;
 
-  char *fields[11];
+  /* fields[0] is the "cpu<N>" name, values[i] corresponds to fields[i + 1]. */
+  uint64_t values[10];
   int numfields;
 
-  if ((fh = fopen("/proc/stat", "r")) == NULL) {
-    ERROR("cpu plugin: fopen (/proc/stat) failed: %s", STRERRNO);
+  if ((pf == NULL) && ((pf = proc_file_open("/proc/stat")) == NULL)) {
+    ERROR("cpu plugin: open (/proc/stat) failed: %s", STRERRNO);
     return -1;
   }
 
-  while (fgets(buf, 1024, fh) != NULL) {
-    if (strncmp(buf, "cpu", 3))
+  if (proc_file_read(pf, &buffer) < 0)
+    return -1;
+
+  for (char *ptr = buffer; (line = proc_file_line(&ptr)) != NULL;) {
+    if (strncmp(line, "cpu", 3))
       continue;
-    if ((buf[3] < '0') || (buf[3] > '9'))
+    if ((line[3] < '0') || (line[3] > '9'))
       continue;
 
-    numfields = strsplit(buf, fields, STATIC_ARRAY_SIZE(fields));
+    char *endptr;
+    int cpu = (int)strtol(line + 3, &endptr, 10);
+
+    numfields = 1 + (int)parse_uint64_fields(endptr, values,
+                                             STATIC_ARRAY_SIZE(values), NULL);
     if (numfields < 5)
       continue;
 
-    cpu = atoi(fields[0] + 3);
-
     /* Do not stage User and Nice immediately: we may need to alter them later:
      */
-    long long user_value = atoll(fields[1]);
-    long long nice_value = atoll(fields[2]);
-    cpu_stage(cpu, COLLECTD_CPU_STATE_SYSTEM, (derive_t)atoll(fields[3]), now);
-    cpu_stage(cpu, COLLECTD_CPU_STATE_IDLE, (derive_t)atoll(fields[4]), now);
+    long long user_value = (long long)values[0];
+    long long nice_value = (long long)values[1];
+    cpu_stage(cpu, COLLECTD_CPU_STATE_SYSTEM, (derive_t)values[2], now);
+    cpu_stage(cpu, COLLECTD_CPU_STATE_IDLE, (derive_t)values[3], now);
 
     if (numfields >= 8) {
-      cpu_stage(cpu, COLLECTD_CPU_STATE_WAIT, (derive_t)atoll(fields[5]), now);
-      cpu_stage(cpu, COLLECTD_CPU_STATE_INTERRUPT, (derive_t)atoll(fields[6]),
-                now);
-      cpu_stage(cpu, COLLECTD_CPU_STATE_SOFTIRQ, (derive_t)atoll(fields[7]),
-                now);
+      cpu_stage(cpu, COLLECTD_CPU_STATE_WAIT, (derive_t)values[4], now);
+      cpu_stage(cpu, COLLECTD_CPU_STATE_INTERRUPT, (derive_t)values[5], now);
+      cpu_stage(cpu, COLLECTD_CPU_STATE_SOFTIRQ, (derive_t)values[6], now);
     }
 
     if (numfields >= 9) { /* Steal (since Linux 2.6.11) */
-      cpu_stage(cpu, COLLECTD_CPU_STATE_STEAL, (derive_t)atoll(fields[8]), now);
+      cpu_stage(cpu, COLLECTD_CPU_STATE_STEAL, (derive_t)values[7], now);
     }
 
     if (numfields >= 10) { /* Guest (since Linux 2.6.24) */
       if (report_guest) {
-        long long value = atoll(fields[9]);
+        long long value = (long long)values[8];
         cpu_stage(cpu, COLLECTD_CPU_STATE_GUEST, (derive_t)value, now);
         /* Guest is included in User; optionally subtract Guest from User: */
         if (subtract_guest) {
@@ -691,7 +900,7 @@ static int cpu_read(void) {
 
     if (numfields >= 11) { /* Guest_nice (since Linux 2.6.33) */
       if (report_guest) {
-        long long value = atoll(fields[10]);
+        long long value = (long long)values[9];
         cpu_stage(cpu, COLLECTD_CPU_STATE_GUEST_NICE, (derive_t)value, now);
         /* Guest_nice is included in Nice; optionally subtract Guest_nice from
            Nice: */
@@ -707,7 +916,6 @@ static int cpu_read(void) {
     cpu_stage(cpu, COLLECTD_CPU_STATE_USER, (derive_t)user_value, now);
     cpu_stage(cpu, COLLECTD_CPU_STATE_NICE, (derive_t)nice_value, now);
   }
-  fclose(fh);
 /* }}} #endif defined(KERNEL_LINUX) */
 
 #elif defined(HAVE_LIBKSTAT) /* {{{ */
@@ -876,13 +1084,46 @@ static int cpu_read(void) {
   }
 #endif                       /* }}} HAVE_PERFSTAT */
 
-  cpu_commit();
+  if (sample_interval == 0) {
+    cpu_commit();
+  } else {
+    cpu_commit_percent(cpu_sample_percent);
+    if (now >= next_dispatch) {
+      cpu_commit_summaries();
+      next_dispatch += dispatch_interval;
+      if (next_dispatch <= now)
+        next_dispatch = now + dispatch_interval;
+    }
+  }
   cpu_reset();
   return 0;
 }
 
+static int cpu_init(void) {
+  if (sample_interval != 0) {
+    dispatch_interval = plugin_get_interval();
+    if (sample_interval >= dispatch_interval) {
+      WARNING("cpu plugin: SampleInterval (%.3f) is not smaller than the "
+              "interval (%.3f); disabling high-resolution mode.",
+              CDTIME_T_TO_DOUBLE(sample_interval),
+              CDTIME_T_TO_DOUBLE(dispatch_interval));
+      sample_interval = 0;
+    } else {
+      next_dispatch = cdtime() + dispatch_interval;
+    }
+  }
+
+  /* An interval of zero uses the plugin's interval. */
+  int status = plugin_register_complex_read(/* group = */ NULL, "cpu",
+                                            cpu_read, sample_interval,
+                                            /* user data = */ NULL);
+  if (status != 0)
+    return status;
+
+  return init();
+} /* int cpu_init */
+
 void module_register(void) {
-  plugin_register_init("cpu", init);
+  plugin_register_init("cpu", cpu_init);
   plugin_register_config("cpu", cpu_config, config_keys, config_keys_num);
-  plugin_register_read("cpu", cpu_read);
 } /* void module_register */
@@ -26,6 +26,7 @@
 #include "plugin.h"
 
 static int num_cpu;
+static read_batch_t *cpufreq_files;
 
 static int cpufreq_init(void) {
   int status;
@@ -33,6 +34,13 @@ static int cpufreq_init(void) {
 
   num_cpu = 0;
 
+  read_batch_destroy(cpufreq_files);
+  cpufreq_files = read_batch_create(64);
+  if (cpufreq_files == NULL) {
+    ERROR("cpufreq plugin: read_batch_create failed.");
+    return -1;
+  }
+
   while (1) {
     status = snprintf(filename, sizeof(filename),
                       "/sys/devices/system/cpu/cpu%d/cpufreq/"
@@ -44,6 +52,12 @@ static int cpufreq_init(void) {
     if (access(filename, R_OK))
       break;
 
+    /* The file of CPU "i" has index "i". */
+    if (read_batch_add(cpufreq_files, filename) != num_cpu) {
+      ERROR("cpufreq plugin: read_batch_add failed.");
+      return -1;
+    }
+
     num_cpu++;
   }
 
@@ -68,14 +82,21 @@ static void cpufreq_submit(int cpu_num, value_t value) {
 }
 
 static int cpufreq_read(void) {
-  for (int i = 0; i < num_cpu; i++) {
-    char filename[PATH_MAX];
-    snprintf(filename, sizeof(filename),
-             "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", i);
+  read_batch_read(cpufreq_files);
 
+  for (int i = 0; i < num_cpu; i++) {
+    char *buffer = NULL;
     value_t v;
-    if (parse_value_file(filename, &v, DS_TYPE_GAUGE) != 0) {
-      WARNING("cpufreq plugin: Reading \"%s\" failed.", filename);
+
+    if (read_batch_get(cpufreq_files, i, &buffer) <= 0) {
+      WARNING("cpufreq plugin: Reading \"%s\" failed.",
+              read_batch_path(cpufreq_files, i));
+      continue;
+    }
+    strstripnewline(buffer);
+    if (parse_value(buffer, &v, DS_TYPE_GAUGE) != 0) {
+      WARNING("cpufreq plugin: Parsing \"%s\" failed.",
+              read_batch_path(cpufreq_files, i));
       continue;
     }
 
@@ -88,7 +109,14 @@ static int cpufreq_read(void) {
   return 0;
 } /* int cpufreq_read */
 
+static int cpufreq_shutdown(void) {
+  read_batch_destroy(cpufreq_files);
+  cpufreq_files = NULL;
+  return 0;
+} /* int cpufreq_shutdown */
+
 void module_register(void) {
   plugin_register_init("cpufreq", cpufreq_init);
   plugin_register_read("cpufreq", cpufreq_read);
+  plugin_register_shutdown("cpufreq", cpufreq_shutdown);
 }
@@ -25,18 +25,56 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_cache.h"
 
+#include <pthread.h>
+
+/* When "OpenFiles" is greater than zero, files are kept open and lines are
+ * buffered in memory. The files are kept in an LRU list, most recently used
+ * first; the tree maps the file names to the list entries. */
+struct csv_file_s;
+typedef struct csv_file_s csv_file_t;
+struct csv_file_s {
+  char *filename;
+  int fd;
+  dev_t dev;
+  ino_t ino;
+
+  char *header;
+
+  char *buffer;
+  size_t buffer_fill;
+
+  cdtime_t interval;
+  cdtime_t last_write;
+  cdtime_t first_buffered;
+
+  csv_file_t *prev;
+  csv_file_t *next;
+};
+
 /*
  * Private variables
  */
-static const char *config_keys[] = {"DataDir", "StoreRates"};
+static const char *config_keys[] = {"DataDir", "StoreRates", "OpenFiles",
+                                    "BufferSize", "FlushInterval"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static char *datadir;
 static int store_rates;
 static int use_stdio;
 
+static size_t open_files_max;
+static size_t buffer_size = 4096;
+static cdtime_t flush_interval = TIME_T_TO_CDTIME_T_STATIC(10);
+
+static c_avl_tree_t *files_tree;
+static csv_file_t *files_head;
+static csv_file_t *files_tail;
+static cdtime_t files_last_check;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int value_list_to_string(char *buffer, int buffer_len,
                                 const data_set_t *ds, const value_list_t *vl) {
   int offset;
@@ -175,6 +213,288 @@ static int csv_create_file(const char *filename, const data_set_t *ds) {
   return 0;
 } /* int csv_create_file */
 
+static int csv_lock_fd(int fd, short type) /* {{{ */
+{
+  struct flock fl = {0};
+
+  fl.l_pid = getpid();
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+
+  return fcntl(fd, F_SETLK, &fl);
+} /* }}} int csv_lock_fd */
+
+static char *csv_header(const data_set_t *ds) /* {{{ */
+{
+  size_t size = sizeof("epoch\n");
+  for (size_t i = 0; i < ds->ds_num; i++)
+    size += strlen(ds->ds[i].name) + 1;
+
+  char *header = malloc(size);
+  if (header == NULL)
+    return NULL;
+
+  sstrncpy(header, "epoch", size);
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    strncat(header, ",", size - strlen(header) - 1);
+    strncat(header, ds->ds[i].name, size - strlen(header) - 1);
+  }
+  strncat(header, "\n", size - strlen(header) - 1);
+
+  return header;
+} /* }}} char *csv_header */
+
+/* Opens the file for appending, creating it with a header line if it does not
+ * exist (anymore). */
+static int csv_file_open(csv_file_t *f) /* {{{ */
+{
+  struct stat sb;
+
+  if (check_create_dir(f->filename))
+    return -1;
+
+  f->fd = open(f->filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (f->fd < 0) {
+    ERROR("csv plugin: open (%s) failed: %s", f->filename, STRERRNO);
+    return -1;
+  }
+
+  if (fstat(f->fd, &sb) != 0) {
+    ERROR("csv plugin: fstat (%s) failed: %s", f->filename, STRERRNO);
+    close(f->fd);
+    f->fd = -1;
+    return -1;
+  }
+  f->dev = sb.st_dev;
+  f->ino = sb.st_ino;
+
+  if ((sb.st_size == 0) && (f->header != NULL)) {
+    if (swrite(f->fd, f->header, strlen(f->header)) != 0) {
+      ERROR("csv plugin: write (%s) failed: %s", f->filename, STRERRNO);
+      close(f->fd);
+      f->fd = -1;
+      return -1;
+    }
+  }
+
+  return 0;
+} /* }}} int csv_file_open */
+
+/* Writes the buffered lines to disk. If the file has been removed or replaced
+ * since it has been opened, e.g. by a log rotation tool, it is re-opened. */
+static int csv_file_flush(csv_file_t *f) /* {{{ */
+{
+  struct stat sb;
+  int status;
+
+  if (f->buffer_fill == 0)
+    return 0;
+
+  if ((f->fd >= 0) &&
+      ((stat(f->filename, &sb) != 0) || (sb.st_dev != f->dev) ||
+       (sb.st_ino != f->ino))) {
+    DEBUG("csv plugin: \"%s\" has been replaced, re-opening it.",
+          f->filename);
+    close(f->fd);
+    f->fd = -1;
+  }
+
+  if ((f->fd < 0) && (csv_file_open(f) != 0))
+    return -1;
+
+  status = csv_lock_fd(f->fd, F_WRLCK);
+  if (status != 0) {
+    ERROR("csv plugin: flock (%s) failed: %s", f->filename, STRERRNO);
+    return -1;
+  }
+
+  status = swrite(f->fd, f->buffer, f->buffer_fill);
+  if (status != 0)
+    ERROR("csv plugin: write (%s) failed: %s", f->filename, STRERRNO);
+  csv_lock_fd(f->fd, F_UNLCK);
+
+  /* Drop the data on error; retrying would only duplicate partial lines. */
+  f->buffer_fill = 0;
+  return status;
+} /* }}} int csv_file_flush */
+
+static void csv_file_unlink(csv_file_t *f) /* {{{ */
+{
+  if (f->prev != NULL)
+    f->prev->next = f->next;
+  else
+    files_head = f->next;
+
+  if (f->next != NULL)
+    f->next->prev = f->prev;
+  else
+    files_tail = f->prev;
+
+  f->prev = f->next = NULL;
+} /* }}} void csv_file_unlink */
+
+static void csv_file_push(csv_file_t *f) /* {{{ */
+{
+  f->prev = NULL;
+  f->next = files_head;
+  if (files_head != NULL)
+    files_head->prev = f;
+  files_head = f;
+  if (files_tail == NULL)
+    files_tail = f;
+} /* }}} void csv_file_push */
+
+/* Flushes and closes the file and removes it from the cache. Must be called
+ * with files_lock held. */
+static void csv_file_close(csv_file_t *f) /* {{{ */
+{
+  csv_file_flush(f);
+
+  c_avl_remove(files_tree, f->filename, NULL, NULL);
+  csv_file_unlink(f);
+
+  if (f->fd >= 0)
+    close(f->fd);
+  sfree(f->filename);
+  sfree(f->header);
+  sfree(f->buffer);
+  sfree(f);
+} /* }}} void csv_file_close */
+
+/* Returns the cache entry for "filename", opening the file if necessary. Must
+ * be called with files_lock held. */
+static csv_file_t *csv_file_get(const char *filename, /* {{{ */
+                                const data_set_t *ds, const value_list_t *vl) {
+  csv_file_t *f = NULL;
+
+  if (files_tree == NULL) {
+    files_tree = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (files_tree == NULL) {
+      ERROR("csv plugin: c_avl_create failed.");
+      return NULL;
+    }
+  }
+
+  if (c_avl_get(files_tree, filename, (void *)&f) == 0) {
+    csv_file_unlink(f);
+    csv_file_push(f);
+    return f;
+  }
+
+  while ((files_tail != NULL) &&
+         ((size_t)c_avl_size(files_tree) >= open_files_max))
+    csv_file_close(files_tail);
+
+  f = calloc(1, sizeof(*f));
+  if (f == NULL) {
+    ERROR("csv plugin: calloc failed.");
+    return NULL;
+  }
+  f->fd = -1;
+  f->interval = vl->interval;
+  f->filename = strdup(filename);
+  f->header = csv_header(ds);
+  f->buffer = malloc(buffer_size);
+  if ((f->filename == NULL) || (f->header == NULL) || (f->buffer == NULL)) {
+    ERROR("csv plugin: malloc failed.");
+    sfree(f->filename);
+    sfree(f->header);
+    sfree(f->buffer);
+    sfree(f);
+    return NULL;
+  }
+
+  if (csv_file_open(f) != 0) {
+    sfree(f->filename);
+    sfree(f->header);
+    sfree(f->buffer);
+    sfree(f);
+    return NULL;
+  }
+
+  if (c_avl_insert(files_tree, f->filename, f) != 0) {
+    ERROR("csv plugin: c_avl_insert failed.");
+    close(f->fd);
+    sfree(f->filename);
+    sfree(f->header);
+    sfree(f->buffer);
+    sfree(f);
+    return NULL;
+  }
+  csv_file_push(f);
+
+  return f;
+} /* }}} csv_file_t *csv_file_get */
+
+/* Flushes files holding data older than "timeout" and closes those that have
+ * not been written to for a while, such as the files of the previous day.
+ * Must be called with files_lock held. */
+static void csv_files_check(cdtime_t now, cdtime_t timeout, /* {{{ */
+                            const char *identifier) {
+  csv_file_t *next;
+
+  for (csv_file_t *f = files_head; f != NULL; f = next) {
+    next = f->next;
+
+    if ((identifier != NULL) && (strstr(f->filename, identifier) == NULL))
+      continue;
+
+    cdtime_t idle = now - f->last_write;
+    if ((idle > flush_interval) && (idle > 2 * f->interval)) {
+      csv_file_close(f);
+      continue;
+    }
+
+    if ((f->buffer_fill > 0) && ((now - f->first_buffered) >= timeout))
+      csv_file_flush(f);
+  }
+
+  files_last_check = now;
+} /* }}} void csv_files_check */
+
+static int csv_write_cached(const char *filename, /* {{{ */
+                            const data_set_t *ds, const value_list_t *vl,
+                            const char *values) {
+  size_t len = strlen(values);
+  cdtime_t now = cdtime();
+  int status = 0;
+
+  pthread_mutex_lock(&files_lock);
+
+  csv_file_t *f = csv_file_get(filename, ds, vl);
+  if (f == NULL) {
+    pthread_mutex_unlock(&files_lock);
+    return -1;
+  }
+
+  if ((f->buffer_fill + len + 1) > buffer_size)
+    status = csv_file_flush(f);
+
+  if ((len + 1) > buffer_size) {
+    /* The line does not fit into the buffer at all: write it directly. */
+    if ((status == 0) &&
+        ((swrite(f->fd, values, len) != 0) || (swrite(f->fd, "\n", 1) != 0))) {
+      ERROR("csv plugin: write (%s) failed: %s", f->filename, STRERRNO);
+      status = -1;
+    }
+  } else {
+    if (f->buffer_fill == 0)
+      f->first_buffered = now;
+    memcpy(f->buffer + f->buffer_fill, values, len);
+    f->buffer[f->buffer_fill + len] = '\n';
+    f->buffer_fill += len + 1;
+  }
+
+  f->interval = vl->interval;
+  f->last_write = now;
+
+  if ((now - files_last_check) >= flush_interval)
+    csv_files_check(now, flush_interval, /* identifier = */ NULL);
+
+  pthread_mutex_unlock(&files_lock);
+  return status;
+} /* }}} int csv_write_cached */
+
 static int csv_config(const char *key, const char *value) {
   if (strcasecmp("DataDir", key) == 0) {
     if (datadir != NULL) {
@@ -205,6 +525,27 @@ static int csv_config(const char *key, const char *value) {
       store_rates = 1;
     else
       store_rates = 0;
+  } else if (strcasecmp("OpenFiles", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 0) {
+      ERROR("csv plugin: `OpenFiles' must not be negative.");
+      return -1;
+    }
+    open_files_max = (size_t)tmp;
+  } else if (strcasecmp("BufferSize", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 1) {
+      ERROR("csv plugin: `BufferSize' must be greater than 0.");
+      return -1;
+    }
+    buffer_size = (size_t)tmp;
+  } else if (strcasecmp("FlushInterval", key) == 0) {
+    double tmp = atof(value);
+    if (tmp <= 0.0) {
+      ERROR("csv plugin: `FlushInterval' must be greater than 0.");
+      return -1;
+    }
+    flush_interval = DOUBLE_TO_CDTIME_T(tmp);
   } else {
     return -1;
   }
@@ -251,6 +592,9 @@ static int csv_write(const data_set_t *ds, const value_list_t *vl,
     return 0;
   }
 
+  if (open_files_max > 0)
+    return csv_write_cached(filename, ds, vl, values);
+
   if (stat(filename, &statbuf) == -1) {
     if (errno == ENOENT) {
       if (csv_create_file(filename, ds))
@@ -291,7 +635,27 @@ static int csv_write(const data_set_t *ds, const value_list_t *vl,
   return 0;
 } /* int csv_write */
 
+static int csv_flush(cdtime_t timeout, const char *identifier,
+                     __attribute__((unused)) user_data_t *user_data) {
+  pthread_mutex_lock(&files_lock);
+  csv_files_check(cdtime(), timeout, identifier);
+  pthread_mutex_unlock(&files_lock);
+  return 0;
+} /* int csv_flush */
+
+static int csv_shutdown(void) {
+  pthread_mutex_lock(&files_lock);
+  while (files_head != NULL)
+    csv_file_close(files_head);
+  c_avl_destroy(files_tree);
+  files_tree = NULL;
+  pthread_mutex_unlock(&files_lock);
+  return 0;
+} /* int csv_shutdown */
+
 void module_register(void) {
   plugin_register_config("csv", csv_config, config_keys, config_keys_num);
   plugin_register_write("csv", csv_write, /* user_data = */ NULL);
+  plugin_register_flush("csv", csv_flush, /* user_data = */ NULL);
+  plugin_register_shutdown("csv", csv_shutdown);
 } /* void module_register */
@@ -25,6 +25,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_curl_engine.h"
 #include "utils_curl_stats.h"
 #include "utils_match.h"
 #include "utils_time.h"
@@ -77,6 +78,9 @@ struct web_page_s /* {{{ */
   size_t buffer_size;
   size_t buffer_fill;
 
+  curl_engine_request_t request;
+  cdtime_t start;
+
   web_match_t *matches;
 }; /* }}} */
 
@@ -84,6 +88,7 @@ struct web_page_s /* {{{ */
  * Private functions
  */
 static int cc_read_page(user_data_t *ud);
+static void cc_page_done(curl_engine_request_t *req, CURLcode status);
 
 static size_t cc_curl_callback(void *buf, /* {{{ */
                                size_t size, size_t nmemb, void *user_data) {
@@ -138,6 +143,8 @@ static void cc_web_page_free(void *arg) /* {{{ */
   if (wp == NULL)
     return;
 
+  curl_engine_cancel(&wp->request);
+
   if (wp->curl != NULL)
     curl_easy_cleanup(wp->curl);
   wp->curl = NULL;
@@ -346,6 +353,10 @@ static int cc_page_init_curl(web_page_t *wp) /* {{{ */
   curl_easy_setopt(wp->curl, CURLOPT_FOLLOWLOCATION, 1L);
   curl_easy_setopt(wp->curl, CURLOPT_MAXREDIRS, 50L);
 
+  wp->request.curl = wp->curl;
+  wp->request.done = cc_page_done;
+  wp->request.user_data = wp;
+
   if (wp->user != NULL) {
 #ifdef HAVE_CURLOPT_USERNAME
     curl_easy_setopt(wp->curl, CURLOPT_USERNAME, wp->user);
@@ -556,6 +567,12 @@ static int cc_init(void) /* {{{ */
   return 0;
 } /* }}} int cc_init */
 
+static int cc_shutdown(void) /* {{{ */
+{
+  curl_engine_shutdown();
+  return 0;
+} /* }}} int cc_shutdown */
+
 static void cc_submit(const web_page_t *wp, const web_match_t *wm, /* {{{ */
                       value_t value) {
   value_list_t vl = VALUE_LIST_INIT;
@@ -600,35 +617,20 @@ static void cc_submit_response_time(const web_page_t *wp, /* {{{ */
   plugin_dispatch_values(&vl);
 } /* }}} void cc_submit_response_time */
 
-static int cc_read_page(user_data_t *ud) /* {{{ */
-{
-
-  if ((ud == NULL) || (ud->data == NULL)) {
-    ERROR("curl plugin: cc_read_page: Invalid user data.");
-    return -1;
-  }
-
-  web_page_t *wp = (web_page_t *)ud->data;
-
-  int status;
-  cdtime_t start = 0;
-
-  if (wp->response_time)
-    start = cdtime();
-
-  wp->buffer_fill = 0;
-
-  curl_easy_setopt(wp->curl, CURLOPT_URL, wp->url);
+/* Called by the cURL engine once the transfer started by cc_read_page() has
+ * finished. */
+static void cc_page_done(curl_engine_request_t *req, /* {{{ */
+                         CURLcode status) {
+  web_page_t *wp = req->user_data;
 
-  status = curl_easy_perform(wp->curl);
   if (status != CURLE_OK) {
     ERROR("curl plugin: curl_easy_perform failed with status %i: %s", status,
           wp->curl_errbuf);
-    return -1;
+    return;
   }
 
   if (wp->response_time)
-    cc_submit_response_time(wp, CDTIME_T_TO_DOUBLE(cdtime() - start));
+    cc_submit_response_time(wp, CDTIME_T_TO_DOUBLE(cdtime() - wp->start));
   if (wp->stats != NULL)
     curl_stats_dispatch(wp->stats, wp->curl, NULL, "curl", wp->instance);
 
@@ -647,8 +649,8 @@ static int cc_read_page(user_data_t *ud) /* {{{ */
   for (web_match_t *wm = wp->matches; wm != NULL; wm = wm->next) {
     cu_match_value_t *mv;
 
-    status = match_apply(wm->match, wp->buffer);
-    if (status != 0) {
+    int ret = match_apply(wm->match, wp->buffer);
+    if (ret != 0) {
       WARNING("curl plugin: match_apply failed.");
       continue;
     }
@@ -662,6 +664,41 @@ static int cc_read_page(user_data_t *ud) /* {{{ */
     cc_submit(wp, wm, mv->value);
     match_value_reset(mv);
   } /* for (wm = wp->matches; wm != NULL; wm = wm->next) */
+} /* }}} void cc_page_done */
+
+static int cc_read_page(user_data_t *ud) /* {{{ */
+{
+
+  if ((ud == NULL) || (ud->data == NULL)) {
+    ERROR("curl plugin: cc_read_page: Invalid user data.");
+    return -1;
+  }
+
+  web_page_t *wp = (web_page_t *)ud->data;
+
+  /* The transfer is performed by the engine thread; results are dispatched
+   * from cc_page_done(). A page that has not finished since the last
+   * interval is skipped rather than queued twice. */
+  if (curl_engine_busy(&wp->request)) {
+    WARNING("curl plugin: Request for \"%s\" is still in progress, "
+            "skipping this interval.",
+            wp->url);
+    return 0;
+  }
+
+  wp->buffer_fill = 0;
+  if (wp->buffer != NULL)
+    wp->buffer[0] = 0;
+  wp->start = cdtime();
+
+  curl_easy_setopt(wp->curl, CURLOPT_URL, wp->url);
+
+  int status = curl_engine_submit(&wp->request);
+  if (status != 0) {
+    ERROR("curl plugin: Submitting request for \"%s\" failed: %s", wp->url,
+          STRERROR(status));
+    return -1;
+  }
 
   return 0;
 } /* }}} int cc_read_page */
@@ -669,4 +706,5 @@ static int cc_read_page(user_data_t *ud) /* {{{ */
 void module_register(void) {
   plugin_register_complex_config("curl", cc_config);
   plugin_register_init("curl", cc_init);
+  plugin_register_shutdown("curl", cc_shutdown);
 } /* void module_register */
@@ -27,6 +27,7 @@
 #include "plugin.h"
 #include "utils_avltree.h"
 #include "utils_complain.h"
+#include "utils_curl_engine.h"
 #include "utils_curl_stats.h"
 
 #include <sys/types.h>
@@ -58,14 +59,18 @@ struct cj_key_s /* {{{ */
 /* }}} */
 
 /* cj_tree_entry_t is a union of either a metric configuration ("key") or a tree
- * mapping array indexes / map keys to a descendant cj_tree_entry_t*. */
-typedef struct {
+ * mapping array indexes / map keys to a descendant cj_tree_entry_t*. For
+ * trees, "any" points to the wildcard child, if one has been configured, so
+ * that it does not have to be looked up for every unmatched key. */
+typedef struct cj_tree_entry_s cj_tree_entry_t;
+struct cj_tree_entry_s {
   enum { KEY, TREE } type;
   union {
     c_avl_tree_t *tree;
     cj_key_t *key;
   };
-} cj_tree_entry_t;
+  cj_tree_entry_t *any;
+};
 
 /* cj_state_t is a stack providing the configuration relevant for the context
  * that is currently being parsed. If entry->type == KEY, the parser should
@@ -102,10 +107,15 @@ struct cj_s /* {{{ */
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
+  curl_engine_request_t request;
 
   yajl_handle yajl;
   c_avl_tree_t *tree;
+  cj_tree_entry_t root;
   int depth;
+  /* Number of nested maps and arrays entered below a value that has no
+   * configuration. Their contents are ignored without touching "state". */
+  int skip;
   cj_state_t state[YAJL_MAX_DEPTH];
 };
 typedef struct cj_s cj_t; /* }}} */
@@ -117,6 +127,7 @@ typedef unsigned int yajl_len_t;
 #endif
 
 static int cj_read(user_data_t *ud);
+static void cj_curl_done(curl_engine_request_t *req, CURLcode status);
 static void cj_submit_impl(cj_t *db, cj_key_t *key, value_t *value);
 
 /* cj_submit is a function pointer to cj_submit_impl, allowing the unit-test to
@@ -191,21 +202,14 @@ static int cj_load_key(cj_t *db, char const *key) {
 
   sstrncpy(db->state[db->depth].name, key, sizeof(db->state[db->depth].name));
 
-  if (db->state[db->depth - 1].entry == NULL ||
-      db->state[db->depth - 1].entry->type != TREE) {
+  cj_tree_entry_t *parent = db->state[db->depth - 1].entry;
+  if (parent == NULL || parent->type != TREE)
     return 0;
-  }
 
-  c_avl_tree_t *tree = db->state[db->depth - 1].entry->tree;
   cj_tree_entry_t *e = NULL;
-
-  if (c_avl_get(tree, key, (void *)&e) == 0) {
-    db->state[db->depth].entry = e;
-  } else if (c_avl_get(tree, CJ_ANY, (void *)&e) == 0) {
-    db->state[db->depth].entry = e;
-  } else {
-    db->state[db->depth].entry = NULL;
-  }
+  if (c_avl_get(parent->tree, key, (void *)&e) != 0)
+    e = parent->any;
+  db->state[db->depth].entry = e;
 
   return 0;
 }
@@ -226,6 +230,11 @@ static void cj_advance_array(cj_t *db) {
 #define CJ_CB_CONTINUE 1
 
 static int cj_cb_null(void *ctx) {
+  cj_t *db = (cj_t *)ctx;
+
+  if (db->skip > 0)
+    return CJ_CB_CONTINUE;
+
   cj_advance_array(ctx);
   return CJ_CB_CONTINUE;
 }
@@ -233,18 +242,22 @@ static int cj_cb_null(void *ctx) {
 static int cj_cb_number(void *ctx, const char *number, yajl_len_t number_len) {
   cj_t *db = (cj_t *)ctx;
 
+  if (db->skip > 0)
+    return CJ_CB_CONTINUE;
+  if (db->state[db->depth].entry == NULL) {
+    cj_advance_array(ctx);
+    return CJ_CB_CONTINUE;
+  }
+
   /* Create a null-terminated version of the string. */
   char buffer[number_len + 1];
   memcpy(buffer, number, number_len);
   buffer[sizeof(buffer) - 1] = 0;
 
-  if (db->state[db->depth].entry == NULL ||
-      db->state[db->depth].entry->type != KEY) {
-    if (db->state[db->depth].entry != NULL) {
-      NOTICE("curl_json plugin: Found \"%s\", but the configuration expects a "
-             "map.",
-             buffer);
-    }
+  if (db->state[db->depth].entry->type != KEY) {
+    NOTICE("curl_json plugin: Found \"%s\", but the configuration expects a "
+           "map.",
+           buffer);
     cj_advance_array(ctx);
     return CJ_CB_CONTINUE;
   }
@@ -269,6 +282,9 @@ static int cj_cb_number(void *ctx, const char *number, yajl_len_t number_len) {
  * NULL. */
 static int cj_cb_map_key(void *ctx, unsigned char const *in_name,
                          yajl_len_t in_name_len) {
+  if (((cj_t *)ctx)->skip > 0)
+    return CJ_CB_CONTINUE;
+
   char name[in_name_len + 1];
 
   memmove(name, in_name, in_name_len);
@@ -294,15 +310,36 @@ static int cj_cb_boolean(void *ctx, int boolVal) {
 
 static int cj_cb_end(void *ctx) {
   cj_t *db = (cj_t *)ctx;
+
+  if (db->skip > 0) {
+    db->skip--;
+    /* The skipped container has been closed: continue where it started. */
+    if (db->skip == 0)
+      cj_advance_array(ctx);
+    return CJ_CB_CONTINUE;
+  }
+
   memset(&db->state[db->depth], 0, sizeof(db->state[db->depth]));
   db->depth--;
   cj_advance_array(ctx);
   return CJ_CB_CONTINUE;
 }
 
+/* Enters a map or array. If there is no configuration for it, the whole
+ * container is skipped. Returns true if the caller should descend. */
+static bool cj_enter(cj_t *db) {
+  if ((db->skip > 0) || (db->state[db->depth].entry == NULL)) {
+    db->skip++;
+    return false;
+  }
+  return true;
+}
+
 static int cj_cb_start_map(void *ctx) {
   cj_t *db = (cj_t *)ctx;
 
+  if (!cj_enter(db))
+    return CJ_CB_CONTINUE;
   if ((db->depth + 1) >= YAJL_MAX_DEPTH) {
     ERROR("curl_json plugin: %s depth exceeds max, aborting.",
           db->url ? db->url : db->sock);
@@ -317,6 +354,8 @@ static int cj_cb_end_map(void *ctx) { return cj_cb_end(ctx); }
 static int cj_cb_start_array(void *ctx) {
   cj_t *db = (cj_t *)ctx;
 
+  if (!cj_enter(db))
+    return CJ_CB_CONTINUE;
   if ((db->depth + 1) >= YAJL_MAX_DEPTH) {
     ERROR("curl_json plugin: %s depth exceeds max, aborting.",
           db->url ? db->url : db->sock);
@@ -333,7 +372,8 @@ static int cj_cb_start_array(void *ctx) {
 
 static int cj_cb_end_array(void *ctx) {
   cj_t *db = (cj_t *)ctx;
-  db->state[db->depth].in_array = false;
+  if (db->skip == 0)
+    db->state[db->depth].in_array = false;
   return cj_cb_end(ctx);
 }
 
@@ -388,10 +428,16 @@ static void cj_free(void *arg) /* {{{ */
   if (db == NULL)
     return;
 
+  curl_engine_cancel(&db->request);
+
   if (db->curl != NULL)
     curl_easy_cleanup(db->curl);
   db->curl = NULL;
 
+  if (db->yajl != NULL)
+    yajl_free(db->yajl);
+  db->yajl = NULL;
+
   if (db->tree != NULL)
     cj_tree_free(db->tree);
   db->tree = NULL;
@@ -449,6 +495,10 @@ static int cj_append_key(cj_t *db, cj_key_t *key) { /* {{{ */
   if (db->tree == NULL)
     db->tree = cj_avl_create();
 
+  db->root.type = TREE;
+  db->root.tree = db->tree;
+
+  cj_tree_entry_t *parent = &db->root;
   c_avl_tree_t *tree = db->tree;
 
   char const *start = key->path;
@@ -474,12 +524,15 @@ static int cj_append_key(cj_t *db, cj_key_t *key) { /* {{{ */
       e->type = TREE;
       e->tree = cj_avl_create();
 
-      c_avl_insert(tree, strdup(name), e);
+      if ((c_avl_insert(tree, strdup(name), e) == 0) &&
+          (strcmp(CJ_ANY, name) == 0))
+        parent->any = e;
     }
 
     if (e->type != TREE)
       return EINVAL;
 
+    parent = e;
     tree = e->tree;
     start = end + 1;
   }
@@ -495,7 +548,9 @@ static int cj_append_key(cj_t *db, cj_key_t *key) { /* {{{ */
   e->type = KEY;
   e->key = key;
 
-  c_avl_insert(tree, strdup(start), e);
+  if ((c_avl_insert(tree, strdup(start), e) == 0) &&
+      (strcmp(CJ_ANY, start) == 0))
+    parent->any = e;
   return 0;
 } /* }}} int cj_append_key */
 
@@ -583,6 +638,10 @@ static int cj_init_curl(cj_t *db) /* {{{ */
   curl_easy_setopt(db->curl, CURLOPT_FOLLOWLOCATION, 1L);
   curl_easy_setopt(db->curl, CURLOPT_MAXREDIRS, 50L);
 
+  db->request.curl = db->curl;
+  db->request.done = cj_curl_done;
+  db->request.user_data = db;
+
   if (db->user != NULL) {
 #ifdef HAVE_CURLOPT_USERNAME
     curl_easy_setopt(db->curl, CURLOPT_USERNAME, db->user);
@@ -733,10 +792,11 @@ static int cj_config_add_url(oconfig_item_t *ci) /* {{{ */
     cb_name = ssnprintf_alloc("curl_json-%s-%s", db->instance,
                               db->url ? db->url : db->sock);
 
-    plugin_register_complex_read(/* group = */ NULL, cb_name, cj_read, interval,
-                                 &(user_data_t){
-                                     .data = db, .free_func = cj_free,
-                                 });
+    plugin_register_complex_read(
+        /* group = */ "curl_json", cb_name, cj_read, interval,
+        &(user_data_t){
+            .data = db, .free_func = cj_free,
+        });
     sfree(cb_name);
   } else {
     cj_free(db);
@@ -848,41 +908,13 @@ static int cj_sock_perform(cj_t *db) /* {{{ */
   return 0;
 } /* }}} int cj_sock_perform */
 
-static int cj_curl_perform(cj_t *db) /* {{{ */
-{
-  int status;
-  long rc;
-  char *url;
-
-  curl_easy_setopt(db->curl, CURLOPT_URL, db->url);
-
-  status = curl_easy_perform(db->curl);
-  if (status != CURLE_OK) {
-    ERROR("curl_json plugin: curl_easy_perform failed with status %i: %s (%s)",
-          status, db->curl_errbuf, db->url);
-    return -1;
-  }
-  if (db->stats != NULL)
-    curl_stats_dispatch(db->stats, db->curl, cj_host(db), "curl_json",
-                        db->instance);
-
-  curl_easy_getinfo(db->curl, CURLINFO_EFFECTIVE_URL, &url);
-  curl_easy_getinfo(db->curl, CURLINFO_RESPONSE_CODE, &rc);
-
-  /* The response code is zero if a non-HTTP transport was used. */
-  if ((rc != 0) && (rc != 200)) {
-    ERROR("curl_json plugin: curl_easy_perform failed with "
-          "response code %ld (%s)",
-          rc, url);
-    return -1;
-  }
-  return 0;
-} /* }}} int cj_curl_perform */
-
-static int cj_perform(cj_t *db) /* {{{ */
+/* Resets the parser state and allocates a new parser for one response. */
+static int cj_parse_begin(cj_t *db) /* {{{ */
 {
-  int status;
-  yajl_handle yprev = db->yajl;
+  db->depth = 0;
+  db->skip = 0;
+  memset(&db->state, 0, sizeof(db->state));
+  db->state[0].entry = &db->root;
 
   db->yajl = yajl_alloc(&ycallbacks,
 #if HAVE_YAJL_V2
@@ -893,19 +925,23 @@ static int cj_perform(cj_t *db) /* {{{ */
                         /* context = */ (void *)db);
   if (db->yajl == NULL) {
     ERROR("curl_json plugin: yajl_alloc failed.");
-    db->yajl = yprev;
+    db->state[0].entry = NULL;
     return -1;
   }
 
-  if (db->url)
-    status = cj_curl_perform(db);
-  else
-    status = cj_sock_perform(db);
-  if (status < 0) {
-    yajl_free(db->yajl);
-    db->yajl = yprev;
-    return -1;
-  }
+  return 0;
+} /* }}} int cj_parse_begin */
+
+static void cj_parse_abort(cj_t *db) /* {{{ */
+{
+  yajl_free(db->yajl);
+  db->yajl = NULL;
+  db->state[0].entry = NULL;
+} /* }}} void cj_parse_abort */
+
+static int cj_parse_end(cj_t *db) /* {{{ */
+{
+  int status;
 
 #if HAVE_YAJL_V2
   status = yajl_complete_parse(db->yajl);
@@ -919,15 +955,46 @@ static int cj_perform(cj_t *db) /* {{{ */
                             /* jsonText = */ NULL, /* jsonTextLen = */ 0);
     ERROR("curl_json plugin: yajl_parse_complete failed: %s", (char *)errmsg);
     yajl_free_error(db->yajl, errmsg);
-    yajl_free(db->yajl);
-    db->yajl = yprev;
+    cj_parse_abort(db);
     return -1;
   }
 
-  yajl_free(db->yajl);
-  db->yajl = yprev;
+  cj_parse_abort(db);
   return 0;
-} /* }}} int cj_perform */
+} /* }}} int cj_parse_end */
+
+/* Called by the cURL engine once the transfer started by cj_read() has
+ * finished. The response has been fed to the parser by cj_curl_callback(). */
+static void cj_curl_done(curl_engine_request_t *req, /* {{{ */
+                         CURLcode status) {
+  cj_t *db = req->user_data;
+  long rc;
+  char *url;
+
+  if (status != CURLE_OK) {
+    ERROR("curl_json plugin: curl_easy_perform failed with status %i: %s (%s)",
+          status, db->curl_errbuf, db->url);
+    cj_parse_abort(db);
+    return;
+  }
+  if (db->stats != NULL)
+    curl_stats_dispatch(db->stats, db->curl, cj_host(db), "curl_json",
+                        db->instance);
+
+  curl_easy_getinfo(db->curl, CURLINFO_EFFECTIVE_URL, &url);
+  curl_easy_getinfo(db->curl, CURLINFO_RESPONSE_CODE, &rc);
+
+  /* The response code is zero if a non-HTTP transport was used. */
+  if ((rc != 0) && (rc != 200)) {
+    ERROR("curl_json plugin: curl_easy_perform failed with "
+          "response code %ld (%s)",
+          rc, url);
+    cj_parse_abort(db);
+    return;
+  }
+
+  cj_parse_end(db);
+} /* }}} void cj_curl_done */
 
 static int cj_read(user_data_t *ud) /* {{{ */
 {
@@ -940,21 +1007,40 @@ static int cj_read(user_data_t *ud) /* {{{ */
 
   db = (cj_t *)ud->data;
 
-  db->depth = 0;
-  memset(&db->state, 0, sizeof(db->state));
+  /* URLs are fetched by the engine thread and parsed as data arrives; the
+   * values are dispatched from cj_curl_done(). */
+  if (db->url != NULL) {
+    if (curl_engine_busy(&db->request)) {
+      WARNING("curl_json plugin: Request for \"%s\" is still in progress, "
+              "skipping this interval.",
+              db->url);
+      return 0;
+    }
 
-  /* This is not a compound literal because EPEL6's GCC is not cool enough to
-   * handle anonymous unions within compound literals. */
-  cj_tree_entry_t root = {0};
-  root.type = TREE;
-  root.tree = db->tree;
-  db->state[0].entry = &root;
+    if (cj_parse_begin(db) != 0)
+      return -1;
 
-  int status = cj_perform(db);
+    curl_easy_setopt(db->curl, CURLOPT_URL, db->url);
 
-  db->state[0].entry = NULL;
+    int status = curl_engine_submit(&db->request);
+    if (status != 0) {
+      ERROR("curl_json plugin: Submitting request for \"%s\" failed: %s",
+            db->url, STRERROR(status));
+      cj_parse_abort(db);
+      return -1;
+    }
+    return 0;
+  }
 
-  return status;
+  if (cj_parse_begin(db) != 0)
+    return -1;
+
+  if (cj_sock_perform(db) < 0) {
+    cj_parse_abort(db);
+    return -1;
+  }
+
+  return cj_parse_end(db);
 } /* }}} int cj_read */
 
 static int cj_init(void) /* {{{ */
@@ -965,7 +1051,22 @@ static int cj_init(void) /* {{{ */
   return 0;
 } /* }}} int cj_init */
 
+/* All state is kept per URL and freed with the read callbacks, which have
+ * been unregistered at this point. */
+static int cj_reconfigure(void) /* {{{ */
+{
+  return 0;
+} /* }}} int cj_reconfigure */
+
+static int cj_shutdown(void) /* {{{ */
+{
+  curl_engine_shutdown();
+  return 0;
+} /* }}} int cj_shutdown */
+
 void module_register(void) {
   plugin_register_complex_config("curl_json", cj_config);
   plugin_register_init("curl_json", cj_init);
+  plugin_register_shutdown("curl_json", cj_shutdown);
+  plugin_register_reconfigure("curl_json", cj_reconfigure);
 } /* void module_register */
@@ -52,10 +52,7 @@ static cj_t *test_setup(char *json, char *key_path) {
 
   assert(cj_append_key(db, key) == 0);
 
-  cj_tree_entry_t root = {0};
-  root.type = TREE;
-  root.tree = db->tree;
-  db->state[0].entry = &root;
+  db->state[0].entry = &db->root;
 
   cj_curl_callback(json, strlen(json), 1, db);
 #if HAVE_YAJL_V2
@@ -120,6 +117,12 @@ DEF_TEST(parse) {
       {"[[0,1,2],[3,4,5],[6,7,8]]", "2/0", 6},
       {"[[0,1,2],[3,4,5],[6,7,8]]", "2/1", 7},
       {"[[0,1,2],[3,4,5],[6,7,8]]", "2/2", 8},
+      /* unconfigured subtrees are skipped */
+      {"{\"skip\":{\"a\":[1,{\"b\":[2,3]},4],\"c\":5},\"foo\":7}", "foo",
+       7},
+      {"[{\"x\":[1,2,[3]]},[9],11]", "2", 11},
+      {"{\"n\":{\"q\":{\"deep\":[[1]]},\"r\":{\"z\":6}}}", "n/*/z", 6},
+      {"{\"x\":{\"y\":3}}", "*/y", 3},
       /* testcase from #2266 */
       {"{\"a\":[[10,11,12,13,14]]}", "a/0/0", 10},
       {"{\"a\":[[10,11,12,13,14]]}", "a/0/1", 11},
@@ -23,6 +23,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_curl_engine.h"
 #include "utils_curl_stats.h"
 #include "utils_llist.h"
 
@@ -30,6 +31,11 @@
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
+#if defined(LIBXML_READER_ENABLED) && defined(LIBXML_PATTERN_ENABLED)
+#include <libxml/pattern.h>
+#include <libxml/xmlreader.h>
+#define CX_HAVE_STREAM 1
+#endif
 
 #include <curl/curl.h>
 
@@ -42,6 +48,7 @@ struct cx_values_s /* {{{ */
 {
   char path[DATA_MAX_NAME_LEN];
   size_t path_len;
+  xmlXPathCompExprPtr comp;
 };
 typedef struct cx_values_s cx_values_t;
 /* }}} */
@@ -57,6 +64,11 @@ struct cx_xpath_s /* {{{ */
   char *plugin_instance_from;
   int is_table;
   unsigned long magic;
+
+  /* XPath expressions compiled at configuration time. */
+  xmlXPathCompExprPtr path_comp;
+  xmlXPathCompExprPtr instance_comp;
+  xmlXPathCompExprPtr plugin_instance_comp;
 };
 typedef struct cx_xpath_s cx_xpath_t;
 /* }}} */
@@ -96,6 +108,13 @@ struct cx_s /* {{{ */
   char *buffer;
   size_t buffer_size;
   size_t buffer_fill;
+  curl_engine_request_t request;
+
+  /* Reused for every document; namespaces are registered once. */
+  xmlXPathContextPtr xpath_ctx;
+  bool stream;
+  /* NULL-terminated [URI, prefix] pairs for xmlTextReaderPreservePattern. */
+  const xmlChar **stream_ns;
 
   llist_t *xpath_list; /* list of xpath blocks */
 };
@@ -104,6 +123,8 @@ typedef struct cx_s cx_t; /* }}} */
 /*
  * Private functions
  */
+static void cx_done(curl_engine_request_t *req, CURLcode status);
+
 static size_t cx_curl_callback(void *buf, /* {{{ */
                                size_t size, size_t nmemb, void *user_data) {
   size_t len = size * nmemb;
@@ -140,6 +161,16 @@ static void cx_xpath_free(cx_xpath_t *xpath) /* {{{ */
   if (xpath == NULL)
     return;
 
+  if (xpath->path_comp != NULL)
+    xmlXPathFreeCompExpr(xpath->path_comp);
+  if (xpath->instance_comp != NULL)
+    xmlXPathFreeCompExpr(xpath->instance_comp);
+  if (xpath->plugin_instance_comp != NULL)
+    xmlXPathFreeCompExpr(xpath->plugin_instance_comp);
+  for (size_t i = 0; i < xpath->values_len; i++)
+    if (xpath->values[i].comp != NULL)
+      xmlXPathFreeCompExpr(xpath->values[i].comp);
+
   sfree(xpath->path);
   sfree(xpath->type);
   sfree(xpath->instance_prefix);
@@ -177,6 +208,8 @@ static void cx_free(void *arg) /* {{{ */
   if (db == NULL)
     return;
 
+  curl_engine_cancel(&db->request);
+
   if (db->curl != NULL)
     curl_easy_cleanup(db->curl);
   db->curl = NULL;
@@ -184,6 +217,11 @@ static void cx_free(void *arg) /* {{{ */
   if (db->xpath_list != NULL)
     cx_xpath_list_free(db->xpath_list);
 
+  if (db->xpath_ctx != NULL)
+    xmlXPathFreeContext(db->xpath_ctx);
+  db->xpath_ctx = NULL;
+  sfree(db->stream_ns);
+
   sfree(db->buffer);
   sfree(db->instance);
   sfree(db->plugin_name);
@@ -249,11 +287,20 @@ static int cx_check_type(const data_set_t *ds, cx_xpath_t *xpath) /* {{{ */
   return 0;
 } /* }}} cx_check_type */
 
+static xmlXPathCompExprPtr cx_compile_xpath(char const *expr) /* {{{ */
+{
+  xmlXPathCompExprPtr comp = xmlXPathCompile(BAD_CAST expr);
+  if (comp == NULL)
+    ERROR("curl_xml plugin: Unable to compile xpath expression \"%s\".", expr);
+
+  return comp;
+} /* }}} cx_compile_xpath */
+
 static xmlXPathObjectPtr cx_evaluate_xpath(xmlXPathContextPtr xpath_ctx,
+                                           xmlXPathCompExprPtr comp,
                                            char *expr) /* {{{ */
 {
-  xmlXPathObjectPtr xpath_obj =
-      xmlXPathEvalExpression(BAD_CAST expr, xpath_ctx);
+  xmlXPathObjectPtr xpath_obj = xmlXPathCompiledEval(comp, xpath_ctx);
   if (xpath_obj == NULL) {
     WARNING("curl_xml plugin: "
             "Error unable to evaluate xpath expression \"%s\". Skipping...",
@@ -280,8 +327,9 @@ static int cx_if_not_text_node(xmlNodePtr node) /* {{{ */
  * Returned value should be freed with xmlFree().
  */
 static char *cx_get_text_node_value(xmlXPathContextPtr xpath_ctx, /* {{{ */
-                                    char *expr, const char *from_option) {
-  xmlXPathObjectPtr values_node_obj = cx_evaluate_xpath(xpath_ctx, expr);
+                                    xmlXPathCompExprPtr comp, char *expr,
+                                    const char *from_option) {
+  xmlXPathObjectPtr values_node_obj = cx_evaluate_xpath(xpath_ctx, comp, expr);
   if (values_node_obj == NULL)
     return NULL; /* Error already logged. */
 
@@ -329,8 +377,9 @@ static int cx_handle_single_value_xpath(xmlXPathContextPtr xpath_ctx, /* {{{ */
                                         cx_xpath_t *xpath, const data_set_t *ds,
                                         value_list_t *vl, int index) {
 
-  char *node_value = cx_get_text_node_value(
-      xpath_ctx, xpath->values[index].path, "ValuesFrom");
+  char *node_value =
+      cx_get_text_node_value(xpath_ctx, xpath->values[index].comp,
+                             xpath->values[index].path, "ValuesFrom");
 
   if (node_value == NULL)
     return -1;
@@ -389,8 +438,8 @@ static int cx_handle_instance_xpath(xmlXPathContextPtr xpath_ctx, /* {{{ */
 
   /* Handle type instance */
   if (xpath->instance != NULL) {
-    char *node_value =
-        cx_get_text_node_value(xpath_ctx, xpath->instance, "InstanceFrom");
+    char *node_value = cx_get_text_node_value(
+        xpath_ctx, xpath->instance_comp, xpath->instance, "InstanceFrom");
     if (node_value == NULL)
       return -1;
 
@@ -408,7 +457,8 @@ static int cx_handle_instance_xpath(xmlXPathContextPtr xpath_ctx, /* {{{ */
   /* Handle plugin instance */
   if (xpath->plugin_instance_from != NULL) {
     char *node_value = cx_get_text_node_value(
-        xpath_ctx, xpath->plugin_instance_from, "PluginInstanceFrom");
+        xpath_ctx, xpath->plugin_instance_comp, xpath->plugin_instance_from,
+        "PluginInstanceFrom");
 
     if (node_value == NULL)
       return -1;
@@ -427,7 +477,8 @@ static int cx_handle_xpath(const cx_t *db, /* {{{ */
   if (cx_check_type(ds, xpath) != 0)
     return -1;
 
-  xmlXPathObjectPtr base_node_obj = cx_evaluate_xpath(xpath_ctx, xpath->path);
+  xmlXPathObjectPtr base_node_obj =
+      cx_evaluate_xpath(xpath_ctx, xpath->path_comp, xpath->path);
   if (base_node_obj == NULL)
     return -1; /* error is logged already */
 
@@ -501,63 +552,153 @@ static int cx_handle_parsed_xml(cx_t *db, xmlDocPtr doc, /* {{{ */
   return status;
 } /* }}} cx_handle_parsed_xml */
 
-static int cx_parse_xml(cx_t *db, char *xml) /* {{{ */
+#if CX_HAVE_STREAM
+/* Parses the document with a text reader which only keeps the subtrees
+ * matching the base xpath expressions (and their ancestors). The result is an
+ * ordinary document the compiled expressions can be evaluated against. */
+static xmlDocPtr cx_parse_stream(cx_t *db, char *xml, size_t xml_len) /* {{{ */
 {
-  /* Load the XML */
-  xmlDocPtr doc = xmlParseDoc(BAD_CAST xml);
-  if (doc == NULL) {
-    ERROR("curl_xml plugin: Failed to parse the xml document  - %s", xml);
-    return -1;
+  xmlTextReaderPtr reader =
+      xmlReaderForMemory(xml, (int)xml_len, db->url, /* encoding = */ NULL,
+                         /* options = */ 0);
+  if (reader == NULL) {
+    ERROR("curl_xml plugin: xmlReaderForMemory failed.");
+    return NULL;
+  }
+
+  for (llentry_t *le = llist_head(db->xpath_list); le != NULL; le = le->next) {
+    cx_xpath_t *xpath = le->value;
+    if (xmlTextReaderPreservePattern(reader, BAD_CAST xpath->path,
+                                     db->stream_ns) < 0) {
+      ERROR("curl_xml plugin: Unable to stream xpath expression \"%s\".",
+            xpath->path);
+      xmlFreeTextReader(reader);
+      return NULL;
+    }
+  }
+
+  int status;
+  while ((status = xmlTextReaderRead(reader)) == 1)
+    /* only the preserved nodes are kept */;
+
+  if (status != 0) {
+    ERROR("curl_xml plugin: Failed to parse the xml document from %s.",
+          db->url);
+    xmlFreeTextReader(reader);
+    return NULL;
+  }
+
+  /* The document is owned by the caller from now on. */
+  xmlDocPtr doc = xmlTextReaderCurrentDoc(reader);
+  xmlFreeTextReader(reader);
+  return doc;
+} /* }}} xmlDocPtr cx_parse_stream */
+#endif
+
+static int cx_parse_xml(cx_t *db, char *xml, size_t xml_len) /* {{{ */
+{
+  xmlDocPtr doc;
+
+#if CX_HAVE_STREAM
+  if (db->stream) {
+    doc = cx_parse_stream(db, xml, xml_len);
+    if (doc == NULL)
+      return -1; /* Error already logged. */
+  } else
+#endif
+  {
+    /* Load the XML */
+    doc = xmlParseDoc(BAD_CAST xml);
+    if (doc == NULL) {
+      ERROR("curl_xml plugin: Failed to parse the xml document  - %s", xml);
+      return -1;
+    }
   }
 
-  xmlXPathContextPtr xpath_ctx = xmlXPathNewContext(doc);
-  if (xpath_ctx == NULL) {
+  xmlXPathContextPtr xpath_ctx = db->xpath_ctx;
+  xpath_ctx->doc = doc;
+  xpath_ctx->node = NULL;
+
+  int status = cx_handle_parsed_xml(db, doc, xpath_ctx);
+  /* Cleanup */
+  xpath_ctx->doc = NULL;
+  xpath_ctx->node = NULL;
+  xmlFreeDoc(doc);
+  return status;
+} /* }}} cx_parse_xml */
+
+/* Creates the XPath context shared by all reads of "db" and, in streaming
+ * mode, makes sure the base expressions can be matched by the text reader. */
+static int cx_init_xpath(cx_t *db) /* {{{ */
+{
+  db->xpath_ctx = xmlXPathNewContext(/* doc = */ NULL);
+  if (db->xpath_ctx == NULL) {
     ERROR("curl_xml plugin: Failed to create the xml context");
-    xmlFreeDoc(doc);
     return -1;
   }
 
   for (size_t i = 0; i < db->namespaces_num; i++) {
     cx_namespace_t const *ns = db->namespaces + i;
-    int status =
-        xmlXPathRegisterNs(xpath_ctx, BAD_CAST ns->prefix, BAD_CAST ns->url);
+    int status = xmlXPathRegisterNs(db->xpath_ctx, BAD_CAST ns->prefix,
+                                    BAD_CAST ns->url);
     if (status != 0) {
       ERROR("curl_xml plugin: "
             "unable to register NS with prefix=\"%s\" and href=\"%s\"\n",
             ns->prefix, ns->url);
-      xmlXPathFreeContext(xpath_ctx);
-      xmlFreeDoc(doc);
       return status;
     }
   }
 
-  int status = cx_handle_parsed_xml(db, doc, xpath_ctx);
-  /* Cleanup */
-  xmlXPathFreeContext(xpath_ctx);
-  xmlFreeDoc(doc);
-  return status;
-} /* }}} cx_parse_xml */
+  if (!db->stream)
+    return 0;
 
-static int cx_read(user_data_t *ud) /* {{{ */
-{
-  if ((ud == NULL) || (ud->data == NULL)) {
-    ERROR("curl_xml plugin: cx_read: Invalid user data.");
+#if CX_HAVE_STREAM
+  db->stream_ns = calloc(2 * db->namespaces_num + 1, sizeof(*db->stream_ns));
+  if (db->stream_ns == NULL) {
+    ERROR("curl_xml plugin: calloc failed.");
     return -1;
   }
+  for (size_t i = 0; i < db->namespaces_num; i++) {
+    db->stream_ns[2 * i] = BAD_CAST db->namespaces[i].url;
+    db->stream_ns[2 * i + 1] = BAD_CAST db->namespaces[i].prefix;
+  }
 
+  for (llentry_t *le = llist_head(db->xpath_list); le != NULL; le = le->next) {
+    cx_xpath_t *xpath = le->value;
+    xmlPatternPtr pattern = xmlPatterncompile(BAD_CAST xpath->path,
+                                              /* dict = */ NULL,
+                                              /* flags = */ 0, db->stream_ns);
+    bool streamable = (pattern != NULL) && (xmlPatternStreamable(pattern) == 1);
+    if (pattern != NULL)
+      xmlFreePattern(pattern);
+
+    if (!streamable) {
+      ERROR("curl_xml plugin: The xpath expression \"%s\" is too complex "
+            "to be used with `Stream'. Only simple location paths, without "
+            "predicates, are supported.",
+            xpath->path);
+      return -1;
+    }
+  }
+  return 0;
+#else
+  ERROR("curl_xml plugin: `Stream' is not supported by this libxml2 build.");
+  return -1;
+#endif
+} /* }}} int cx_init_xpath */
+
+/* Called by the cURL engine once the transfer started by cx_read() has
+ * finished. */
+static void cx_done(curl_engine_request_t *req, CURLcode status) /* {{{ */
+{
+  cx_t *db = req->user_data;
   long rc;
   char *url;
-  cx_t *db = (cx_t *)ud->data;
-
-  db->buffer_fill = 0;
-
-  curl_easy_setopt(db->curl, CURLOPT_URL, db->url);
 
-  int status = curl_easy_perform(db->curl);
   if (status != CURLE_OK) {
     ERROR("curl_xml plugin: curl_easy_perform failed with status %i: %s (%s)",
           status, db->curl_errbuf, db->url);
-    return -1;
+    return;
   }
   if (db->stats != NULL)
     curl_stats_dispatch(db->stats, db->curl, cx_host(db), "curl_xml",
@@ -571,13 +712,43 @@ static int cx_read(user_data_t *ud) /* {{{ */
     ERROR(
         "curl_xml plugin: curl_easy_perform failed with response code %ld (%s)",
         rc, url);
+    return;
+  }
+
+  cx_parse_xml(db, db->buffer, db->buffer_fill);
+  db->buffer_fill = 0;
+} /* }}} void cx_done */
+
+static int cx_read(user_data_t *ud) /* {{{ */
+{
+  if ((ud == NULL) || (ud->data == NULL)) {
+    ERROR("curl_xml plugin: cx_read: Invalid user data.");
     return -1;
   }
 
-  status = cx_parse_xml(db, db->buffer);
+  cx_t *db = (cx_t *)ud->data;
+
+  /* The transfer is performed by the engine thread; the document is parsed
+   * and dispatched from cx_done(). */
+  if (curl_engine_busy(&db->request)) {
+    WARNING("curl_xml plugin: Request for \"%s\" is still in progress, "
+            "skipping this interval.",
+            db->url);
+    return 0;
+  }
+
   db->buffer_fill = 0;
 
-  return status;
+  curl_easy_setopt(db->curl, CURLOPT_URL, db->url);
+
+  int status = curl_engine_submit(&db->request);
+  if (status != 0) {
+    ERROR("curl_xml plugin: Submitting request for \"%s\" failed: %s",
+          db->url, STRERROR(status));
+    return -1;
+  }
+
+  return 0;
 } /* }}} int cx_read */
 
 /* Configuration handling functions {{{ */
@@ -608,6 +779,7 @@ static int cx_config_add_values(const char *name, cx_xpath_t *xpath, /* {{{ */
     xpath->values[i].path_len = sizeof(ci->values[i].value.string);
     sstrncpy(xpath->values[i].path, ci->values[i].value.string,
              sizeof(xpath->values[i].path));
+    xpath->values[i].comp = NULL;
   }
 
   return 0;
@@ -675,6 +847,36 @@ static int cx_config_add_xpath(cx_t *db, oconfig_item_t *ci) /* {{{ */
     return -1;
   }
 
+  /* Namespace prefixes are resolved when the expressions are evaluated, so
+   * the order of `Namespace' and `xpath' options does not matter. */
+  xpath->path_comp = cx_compile_xpath(xpath->path);
+  if (xpath->path_comp == NULL) {
+    cx_xpath_free(xpath);
+    return -1;
+  }
+  if (xpath->instance != NULL) {
+    xpath->instance_comp = cx_compile_xpath(xpath->instance);
+    if (xpath->instance_comp == NULL) {
+      cx_xpath_free(xpath);
+      return -1;
+    }
+  }
+  if (xpath->plugin_instance_from != NULL) {
+    xpath->plugin_instance_comp =
+        cx_compile_xpath(xpath->plugin_instance_from);
+    if (xpath->plugin_instance_comp == NULL) {
+      cx_xpath_free(xpath);
+      return -1;
+    }
+  }
+  for (size_t i = 0; i < xpath->values_len; i++) {
+    xpath->values[i].comp = cx_compile_xpath(xpath->values[i].path);
+    if (xpath->values[i].comp == NULL) {
+      cx_xpath_free(xpath);
+      return -1;
+    }
+  }
+
   llentry_t *le = llentry_create(xpath->path, xpath);
   if (le == NULL) {
     ERROR("curl_xml plugin: llentry_create failed.");
@@ -737,6 +939,10 @@ static int cx_init_curl(cx_t *db) /* {{{ */
   curl_easy_setopt(db->curl, CURLOPT_FOLLOWLOCATION, 1L);
   curl_easy_setopt(db->curl, CURLOPT_MAXREDIRS, 50L);
 
+  db->request.curl = db->curl;
+  db->request.done = cx_done;
+  db->request.user_data = db;
+
   if (db->user != NULL) {
 #ifdef HAVE_CURLOPT_USERNAME
     curl_easy_setopt(db->curl, CURLOPT_USERNAME, db->user);
@@ -855,6 +1061,8 @@ static int cx_config_add_url(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_string(child, &db->post_body);
     else if (strcasecmp("Namespace", child->key) == 0)
       status = cx_config_add_namespace(db, child);
+    else if (strcasecmp("Stream", child->key) == 0)
+      status = cf_util_get_boolean(child, &db->stream);
     else if (strcasecmp("Interval", child->key) == 0)
       status = cf_util_get_cdtime(child, &interval);
     else if (strcasecmp("Timeout", child->key) == 0)
@@ -884,6 +1092,11 @@ static int cx_config_add_url(oconfig_item_t *ci) /* {{{ */
     return -1;
   }
 
+  if (cx_init_xpath(db) != 0) {
+    cx_free(db);
+    return -1;
+  }
+
   if (cx_init_curl(db) != 0) {
     cx_free(db);
     return -1;
@@ -940,7 +1153,14 @@ static int cx_init(void) /* {{{ */
   return 0;
 } /* }}} int cx_init */
 
+static int cx_shutdown(void) /* {{{ */
+{
+  curl_engine_shutdown();
+  return 0;
+} /* }}} int cx_shutdown */
+
 void module_register(void) {
   plugin_register_complex_config("curl_xml", cx_config);
   plugin_register_init("curl_xml", cx_init);
+  plugin_register_shutdown("curl_xml", cx_shutdown);
 } /* void module_register */
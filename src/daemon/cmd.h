@@ -24,11 +24,14 @@
 #ifndef CMD_H
 #define CMD_H
 
+#include "utils_time.h"
+
 #include <stdbool.h>
 
 struct cmdline_config {
   bool test_config;
   bool test_readall;
+  cdtime_t benchmark; /* benchmark the read callbacks for this long */
   bool create_basedir;
   const char *configfile;
   bool daemonize;
@@ -36,6 +39,6 @@ struct cmdline_config {
 
 void stop_collectd(void);
 struct cmdline_config init_config(int argc, char **argv);
-int run_loop(bool test_readall);
+int run_loop(bool test_readall, cdtime_t benchmark);
 
 #endif /* CMD_H */
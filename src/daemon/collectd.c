@@ -31,6 +31,8 @@
 #include "common.h"
 #include "configfile.h"
 #include "plugin.h"
+#include "utils_cache.h"
+#include "utils_cache_shm.h"
 
 #include <netdb.h>
 #include <sys/types.h>
@@ -120,6 +122,19 @@ static int init_global_variables(void) {
   }
   DEBUG("timeout_g = %i;", timeout_g);
 
+  str = global_option_get("CacheHistoryRetention");
+  double retention = (str != NULL) ? atof(str) : 0.0;
+  if (retention < 0.0) {
+    fprintf(stderr, "CacheHistoryRetention must not be negative.\n");
+    return -1;
+  }
+  uc_set_history_retention(DOUBLE_TO_CDTIME_T(retention));
+
+  if (uc_shm_set_file(global_option_get("CacheSnapshotFile")) != 0) {
+    fprintf(stderr, "Setting the CacheSnapshotFile failed.\n");
+    return -1;
+  }
+
   if (init_hostname() != 0)
     return -1;
   DEBUG("hostname_g = %s;", hostname_g);
@@ -200,6 +215,7 @@ __attribute__((noreturn)) static void exit_usage(int status) {
          "                    Default: " CONFIGFILE "\n"
          "    -t              Test config and exit.\n"
          "    -T              Test plugin read and exit.\n"
+         "    -b <seconds>    Benchmark plugin reads and exit.\n"
          "    -P <file>       PID-file.\n"
          "                    Default: " PIDFILE "\n"
 #if COLLECT_DAEMON
@@ -258,6 +274,9 @@ static int do_loop(void) {
   cdtime_t wait_until = cdtime() + interval;
 
   while (loop == 0) {
+    if (plugin_reload_pending())
+      cf_reload();
+
 #if HAVE_LIBKSTAT
     update_kstat();
 #endif
@@ -282,6 +301,10 @@ static int do_loop(void) {
         ERROR("nanosleep failed: %s", STRERRNO);
         return -1;
       }
+
+      /* Reloading doesn't change the read schedule, so sleep on afterwards. */
+      if (plugin_reload_pending())
+        cf_reload();
     }
   } /* while (loop == 0) */
 
@@ -289,13 +312,15 @@ static int do_loop(void) {
 } /* int do_loop */
 
 static int do_shutdown(void) {
-  return plugin_shutdown_all();
+  int status = plugin_shutdown_all();
+  uc_shm_set_file(NULL);
+  return status;
 } /* int do_shutdown */
 
 static void read_cmdline(int argc, char **argv, struct cmdline_config *config) {
   /* read options */
   while (1) {
-    int c = getopt(argc, argv, "BhtTC:"
+    int c = getopt(argc, argv, "BhtTb:C:"
 #if COLLECT_DAEMON
                                "fP:"
 #endif
@@ -321,6 +346,20 @@ static void read_cmdline(int argc, char **argv, struct cmdline_config *config) {
       config->daemonize = false;
 #endif /* COLLECT_DAEMON */
       break;
+    case 'b': {
+      char *endptr = NULL;
+      double seconds = strtod(optarg, &endptr);
+      if ((endptr == optarg) || (*endptr != 0) || !(seconds > 0.0)) {
+        fprintf(stderr, "Invalid benchmark duration: %s\n", optarg);
+        exit_usage(1);
+      }
+      config->benchmark = DOUBLE_TO_CDTIME_T(seconds);
+      global_option_set("ReadThreads", "-1", 1);
+#if COLLECT_DAEMON
+      config->daemonize = false;
+#endif /* COLLECT_DAEMON */
+      break;
+    }
 #if COLLECT_DAEMON
     case 'P':
       global_option_set("PIDFile", optarg, 1);
@@ -399,7 +438,7 @@ struct cmdline_config init_config(int argc, char **argv) {
   return config;
 }
 
-int run_loop(bool test_readall) {
+int run_loop(bool test_readall, cdtime_t benchmark) {
   int exit_status = 0;
 
   if (do_init() != 0) {
@@ -412,6 +451,11 @@ int run_loop(bool test_readall) {
       ERROR("Error: one or more plugin read callbacks failed.");
       exit_status = 1;
     }
+  } else if (benchmark > 0) {
+    if (plugin_read_all_bench(benchmark) != 0) {
+      ERROR("Error: one or more plugin read callbacks failed.");
+      exit_status = 1;
+    }
   } else {
     INFO("Initialization complete, entering read-loop.");
     do_loop();
@@ -35,6 +35,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_atomic.h"
 #include "utils_cache.h"
 
 /* for getaddrinfo */
@@ -56,6 +57,21 @@
 #include <arpa/inet.h>
 #endif
 
+#if KERNEL_LINUX && HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+/* IORING_OP_READ is an enum; it was added shortly before IORING_FEAT_FAST_POLL
+ * (Linux 5.7). Kernels without it fail the reads with EINVAL. */
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) &&            \
+    defined(__NR_io_uring_register) && defined(IORING_FEAT_FAST_POLL)
+#define HAVE_IO_URING 1
+#endif
+#endif
+#ifndef HAVE_IO_URING
+#define HAVE_IO_URING 0
+#endif
+
 #if HAVE_CAPABILITY
 #include <sys/capability.h>
 #endif
@@ -292,21 +308,29 @@ int swrite(int fd, const void *buf, size_t count) {
 }
 
 int strsplit(char *string, char **fields, size_t size) {
-  size_t i;
-  char *ptr;
-  char *saveptr;
+  size_t i = 0;
+  char *ptr = string;
+
+  /* Like strtok_r(), but without its per-call setup. strspn() and strcspn()
+   * are vectorized by the C library. */
+  while (i < size) {
+    ptr += strspn(ptr, " \t\r\n");
+    if (*ptr == 0)
+      break;
 
-  i = 0;
-  ptr = string;
-  saveptr = NULL;
-  while ((fields[i] = strtok_r(ptr, " \t\r\n", &saveptr)) != NULL) {
-    ptr = NULL;
+    fields[i] = ptr;
     i++;
 
-    if (i >= size)
+    ptr += strcspn(ptr, " \t\r\n");
+    if (*ptr == 0)
       break;
+    *ptr = 0;
+    ptr++;
   }
 
+  if (i < size)
+    fields[i] = NULL;
+
   return (int)i;
 }
 
@@ -378,8 +402,11 @@ int escape_string(char *buffer, size_t buffer_size) {
   if (buffer_size < 3)
     return EINVAL;
 
-  temp = calloc(1, buffer_size);
-  if (temp == NULL)
+  /* Identifier fields fit on the stack. */
+  char stack_buffer[2 * DATA_MAX_NAME_LEN];
+  if (buffer_size <= sizeof(stack_buffer))
+    temp = stack_buffer;
+  else if ((temp = malloc(buffer_size)) == NULL)
     return ENOMEM;
 
   temp[0] = '"';
@@ -407,7 +434,8 @@ int escape_string(char *buffer, size_t buffer_size) {
   temp[j + 1] = 0;
 
   sstrncpy(buffer, temp, buffer_size);
-  sfree(temp);
+  if (temp != stack_buffer)
+    sfree(temp);
   return 0;
 } /* int escape_string */
 
@@ -460,29 +488,32 @@ size_t strstripnewline(char *buffer) {
 } /* size_t strstripnewline */
 
 int escape_slashes(char *buffer, size_t buffer_size) {
-  size_t buffer_len;
-
-  buffer_len = strlen(buffer);
+  /* Most names don't contain any slashes. strchr() is vectorized by the C
+   * library, so they are scanned quickly and not written to. */
+  char *slash = strchr(buffer, '/');
+  if (slash == NULL)
+    return 0;
 
-  if (buffer_len <= 1) {
-    if (strcmp("/", buffer) == 0) {
+  if (slash == buffer) {
+    if (buffer[1] == 0) {
       if (buffer_size < 5)
         return -1;
       sstrncpy(buffer, "root", buffer_size);
+      return 0;
     }
-    return 0;
-  }
 
-  /* Move one to the left */
-  if (buffer[0] == '/') {
-    memmove(buffer, buffer + 1, buffer_len);
-    buffer_len--;
+    /* Move one to the left */
+    memmove(buffer, buffer + 1, strlen(buffer));
+    slash = strchr(buffer, '/');
   }
 
-  for (size_t i = 0; i < buffer_len; i++) {
-    if (buffer[i] == '/')
-      buffer[i] = '_';
-  }
+  if (slash == NULL)
+    return 0;
+
+  /* Slashes tend to come in numbers, so a plain loop is faster from here. */
+  for (char *c = slash; *c != 0; c++)
+    if (*c == '/')
+      *c = '_';
 
   return 0;
 } /* int escape_slashes */
@@ -857,6 +888,45 @@ int format_name(char *ret, int ret_len, const char *hostname,
   return 0;
 } /* int format_name */
 
+int format_vl(char *ret, size_t ret_len, const value_list_t *vl) {
+  if (vl->identifier.hash != 0) {
+    size_t len = strlen(vl->identifier.name);
+    if (len >= ret_len)
+      return ENOBUFS;
+    memcpy(ret, vl->identifier.name, len + 1);
+    return 0;
+  }
+
+  return format_name(ret, (int)ret_len, vl->host, vl->plugin,
+                     vl->plugin_instance, vl->type, vl->type_instance);
+} /* int format_vl */
+
+/* FNV-1a */
+uint32_t identifier_hash(const char *name) {
+  uint32_t hash = 2166136261u;
+
+  for (const unsigned char *c = (const unsigned char *)name; *c != 0; c++) {
+    hash ^= (uint32_t)*c;
+    hash *= 16777619u;
+  }
+
+  /* Zero marks an identifier which has not been computed. */
+  return (hash != 0) ? hash : 1;
+} /* uint32_t identifier_hash */
+
+int identifier_update(value_list_t *vl) {
+  vl->identifier.hash = 0;
+
+  int status = format_name(vl->identifier.name, sizeof(vl->identifier.name),
+                           vl->host, vl->plugin, vl->plugin_instance, vl->type,
+                           vl->type_instance);
+  if (status != 0)
+    return status;
+
+  vl->identifier.hash = identifier_hash(vl->identifier.name);
+  return 0;
+} /* int identifier_update */
+
 int format_values(char *ret, size_t ret_len, /* {{{ */
                   const data_set_t *ds, const value_list_t *vl,
                   bool store_rates) {
@@ -994,6 +1064,7 @@ int parse_identifier_vl(const char *str, value_list_t *vl) /* {{{ */
   sstrncpy(vl->type, type, sizeof(vl->type));
   sstrncpy(vl->type_instance, (type_instance != NULL) ? type_instance : "",
            sizeof(vl->type_instance));
+  vl->identifier.hash = 0;
 
   return 0;
 } /* }}} int parse_identifier_vl */
@@ -1260,6 +1331,527 @@ ssize_t read_file_contents(const char *filename, char *buf, size_t bufsize) {
   return ret;
 }
 
+struct proc_file_s {
+  char *path;
+  int fd;
+  char *buffer;
+  size_t buffer_size;
+};
+
+proc_file_t *proc_file_open(char const *path) {
+  proc_file_t *pf = calloc(1, sizeof(*pf));
+  if (pf == NULL)
+    return NULL;
+
+  pf->path = strdup(path);
+  pf->buffer_size = 4096;
+  pf->buffer = malloc(pf->buffer_size);
+  if ((pf->path == NULL) || (pf->buffer == NULL)) {
+    proc_file_close(pf);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  pf->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (pf->fd < 0) {
+    int status = errno;
+    proc_file_close(pf);
+    errno = status;
+    return NULL;
+  }
+
+  return pf;
+}
+
+static ssize_t proc_file_pread(proc_file_t *pf) {
+  size_t offset = 0;
+
+  while (42) {
+    /* Leave room for the terminating null byte. */
+    if (offset + 1 >= pf->buffer_size) {
+      size_t new_size = 2 * pf->buffer_size;
+      char *tmp = realloc(pf->buffer, new_size);
+      if (tmp == NULL) {
+        errno = ENOMEM;
+        return -1;
+      }
+      pf->buffer = tmp;
+      pf->buffer_size = new_size;
+    }
+
+    ssize_t status = pread(pf->fd, pf->buffer + offset,
+                           pf->buffer_size - offset - 1, (off_t)offset);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    } else if (status == 0) {
+      break;
+    }
+    offset += (size_t)status;
+  }
+
+  pf->buffer[offset] = 0;
+  return (ssize_t)offset;
+}
+
+ssize_t proc_file_read(proc_file_t *pf, char **ret_buffer) {
+  if ((pf == NULL) || (ret_buffer == NULL))
+    return -EINVAL;
+
+  ssize_t status = -1;
+  if (pf->fd >= 0)
+    status = proc_file_pread(pf);
+
+  /* The file may have been replaced, e.g. when a module was reloaded. Try to
+   * re-open it once before giving up. */
+  if (status < 0) {
+    if (pf->fd >= 0)
+      close(pf->fd);
+    pf->fd = open(pf->path, O_RDONLY | O_CLOEXEC);
+    if (pf->fd < 0) {
+      P_ERROR("proc_file_read: open(\"%s\") failed: %s", pf->path, STRERRNO);
+      return -1;
+    }
+
+    status = proc_file_pread(pf);
+    if (status < 0) {
+      P_ERROR("proc_file_read: Reading \"%s\" failed: %s", pf->path,
+              STRERRNO);
+      return -1;
+    }
+  }
+
+  *ret_buffer = pf->buffer;
+  return status;
+}
+
+void proc_file_close(proc_file_t *pf) {
+  if (pf == NULL)
+    return;
+
+  if (pf->fd >= 0)
+    close(pf->fd);
+  sfree(pf->buffer);
+  sfree(pf->path);
+  sfree(pf);
+}
+
+struct read_batch_file_s {
+  char *path;
+  int fd;
+  char *buffer;
+  ssize_t status; /* bytes read or negative errno */
+};
+typedef struct read_batch_file_s read_batch_file_t;
+
+struct read_batch_s {
+  read_batch_file_t *files;
+  size_t files_num;
+  size_t buffer_size;
+
+#if HAVE_IO_URING
+  int ring_fd;
+  bool ring_failed;
+  bool fds_registered;
+  bool fds_changed;
+  unsigned sq_entries;
+  void *sq_ptr;
+  size_t sq_size;
+  void *cq_ptr;
+  size_t cq_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+#endif
+};
+
+#if HAVE_IO_URING
+static void read_batch_ring_close(read_batch_t *b) {
+  if (b->sqes != NULL)
+    munmap(b->sqes, b->sqes_size);
+  if ((b->cq_ptr != NULL) && (b->cq_ptr != b->sq_ptr))
+    munmap(b->cq_ptr, b->cq_size);
+  if (b->sq_ptr != NULL)
+    munmap(b->sq_ptr, b->sq_size);
+  b->sqes = NULL;
+  b->cq_ptr = NULL;
+  b->sq_ptr = NULL;
+
+  /* Closing the ring also releases the registered files. */
+  if (b->ring_fd >= 0)
+    close(b->ring_fd);
+  b->ring_fd = -1;
+  b->fds_registered = false;
+}
+
+static int read_batch_ring_open(read_batch_t *b) {
+  struct io_uring_params p = {0};
+
+  unsigned entries = 1;
+  while ((entries < b->files_num) && (entries < 256))
+    entries *= 2;
+
+  b->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (b->ring_fd < 0)
+    return errno;
+
+  b->sq_entries = p.sq_entries;
+  b->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  b->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    if (b->cq_size > b->sq_size)
+      b->sq_size = b->cq_size;
+    b->cq_size = b->sq_size;
+  }
+
+  b->sq_ptr = mmap(NULL, b->sq_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, b->ring_fd, IORING_OFF_SQ_RING);
+  if (b->sq_ptr == MAP_FAILED) {
+    b->sq_ptr = NULL;
+    goto failure;
+  }
+
+  if (single_mmap) {
+    b->cq_ptr = b->sq_ptr;
+  } else {
+    b->cq_ptr = mmap(NULL, b->cq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, b->ring_fd, IORING_OFF_CQ_RING);
+    if (b->cq_ptr == MAP_FAILED) {
+      b->cq_ptr = NULL;
+      goto failure;
+    }
+  }
+
+  b->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  b->sqes = mmap(NULL, b->sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, b->ring_fd, IORING_OFF_SQES);
+  if (b->sqes == MAP_FAILED) {
+    b->sqes = NULL;
+    goto failure;
+  }
+
+  char *sq = b->sq_ptr;
+  b->sq_head = (unsigned *)(sq + p.sq_off.head);
+  b->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  b->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  b->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+  char *cq = b->cq_ptr;
+  b->cq_head = (unsigned *)(cq + p.cq_off.head);
+  b->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  b->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  b->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  b->fds_changed = true;
+  return 0;
+
+failure:;
+  int status = errno;
+  read_batch_ring_close(b);
+  return status;
+}
+
+/* Registers the file descriptors with the ring, so that the kernel doesn't
+ * have to look them up for every read. Closed files are registered as -1.
+ * Failing is not fatal, the reads use the plain descriptors then. */
+static void read_batch_ring_register(read_batch_t *b) {
+  if (b->fds_registered) {
+    syscall(__NR_io_uring_register, b->ring_fd, IORING_UNREGISTER_FILES, NULL,
+            0);
+    b->fds_registered = false;
+  }
+
+  int *fds = calloc(b->files_num, sizeof(*fds));
+  if (fds == NULL)
+    return;
+  for (size_t i = 0; i < b->files_num; i++)
+    fds[i] = b->files[i].fd;
+
+  if (syscall(__NR_io_uring_register, b->ring_fd, IORING_REGISTER_FILES, fds,
+              (unsigned)b->files_num) == 0)
+    b->fds_registered = true;
+  sfree(fds);
+  b->fds_changed = false;
+}
+
+/* Reads all open files of the batch with one io_uring_enter(2) call per
+ * "sq_entries" files. Returns non-zero if the ring can't be used, in which
+ * case the caller falls back to pread(2). */
+static int read_batch_ring_read(read_batch_t *b) {
+  if ((b->ring_fd < 0) && (read_batch_ring_open(b) != 0))
+    return -1;
+  if (b->fds_changed)
+    read_batch_ring_register(b);
+
+  size_t next = 0;
+  while (next < b->files_num) {
+    unsigned tail = *b->sq_tail;
+    unsigned pending = 0;
+
+    for (; (next < b->files_num) && (pending < b->sq_entries); next++) {
+      read_batch_file_t *f = b->files + next;
+      if (f->fd < 0)
+        continue;
+
+      unsigned index = tail & *b->sq_mask;
+      struct io_uring_sqe *sqe = b->sqes + index;
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READ;
+      if (b->fds_registered) {
+        sqe->fd = (int)next;
+        sqe->flags = IOSQE_FIXED_FILE;
+      } else {
+        sqe->fd = f->fd;
+      }
+      sqe->addr = (uint64_t)(uintptr_t)f->buffer;
+      sqe->len = (uint32_t)(b->buffer_size - 1);
+      sqe->off = 0;
+      sqe->user_data = (uint64_t)next;
+      b->sq_array[index] = index;
+
+      tail++;
+      pending++;
+    }
+    C_ATOMIC_STORE_REL(b->sq_tail, tail);
+
+    while (pending > 0) {
+      unsigned to_submit = tail - C_ATOMIC_LOAD_ACQ(b->sq_head);
+      if (syscall(__NR_io_uring_enter, b->ring_fd, to_submit, pending,
+                  IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+
+      unsigned head = *b->cq_head;
+      unsigned cq_tail = C_ATOMIC_LOAD_ACQ(b->cq_tail);
+      for (; head != cq_tail; head++) {
+        struct io_uring_cqe *cqe = b->cqes + (head & *b->cq_mask);
+        if (cqe->user_data < b->files_num)
+          b->files[cqe->user_data].status = (ssize_t)cqe->res;
+        pending--;
+      }
+      C_ATOMIC_STORE_REL(b->cq_head, head);
+    }
+  }
+
+  /* Kernels before 5.6 don't know IORING_OP_READ. */
+  for (size_t i = 0; i < b->files_num; i++)
+    if (b->files[i].status == -EINVAL)
+      return -1;
+
+  return 0;
+}
+#endif /* HAVE_IO_URING */
+
+read_batch_t *read_batch_create(size_t buffer_size) {
+  if (buffer_size < 2) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  read_batch_t *b = calloc(1, sizeof(*b));
+  if (b == NULL)
+    return NULL;
+
+  b->buffer_size = buffer_size;
+#if HAVE_IO_URING
+  b->ring_fd = -1;
+#endif
+  return b;
+}
+
+int read_batch_add(read_batch_t *b, char const *path) {
+  if ((b == NULL) || (path == NULL))
+    return -EINVAL;
+  if (b->files_num >= INT_MAX)
+    return -ENOSPC;
+
+  read_batch_file_t *tmp =
+      realloc(b->files, (b->files_num + 1) * sizeof(*b->files));
+  if (tmp == NULL)
+    return -ENOMEM;
+  b->files = tmp;
+
+  read_batch_file_t *f = b->files + b->files_num;
+  *f = (read_batch_file_t){
+      .path = strdup(path),
+      .fd = -1,
+      .buffer = calloc(1, b->buffer_size),
+      .status = -ENOENT,
+  };
+  if ((f->path == NULL) || (f->buffer == NULL)) {
+    sfree(f->path);
+    sfree(f->buffer);
+    return -ENOMEM;
+  }
+
+#if HAVE_IO_URING
+  /* The registered files are indexed by file number. */
+  b->fds_changed = true;
+#endif
+  return (int)b->files_num++;
+}
+
+int read_batch_read(read_batch_t *b) {
+  if (b == NULL)
+    return -EINVAL;
+
+  for (size_t i = 0; i < b->files_num; i++) {
+    read_batch_file_t *f = b->files + i;
+    f->status = -EBADF;
+    if (f->fd >= 0)
+      continue;
+
+    f->fd = open(f->path, O_RDONLY | O_CLOEXEC);
+    if (f->fd < 0) {
+      f->status = -errno;
+      continue;
+    }
+#if HAVE_IO_URING
+    b->fds_changed = true;
+#endif
+  }
+
+  bool done = false;
+#if HAVE_IO_URING
+  if (!b->ring_failed) {
+    done = (read_batch_ring_read(b) == 0);
+    if (!done) {
+      DEBUG("read_batch_read: Using io_uring failed, falling back to pread.");
+      b->ring_failed = true;
+      read_batch_ring_close(b);
+    }
+  }
+#endif
+
+  if (!done) {
+    for (size_t i = 0; i < b->files_num; i++) {
+      read_batch_file_t *f = b->files + i;
+      if (f->fd < 0)
+        continue;
+
+      do
+        f->status = pread(f->fd, f->buffer, b->buffer_size - 1, 0);
+      while ((f->status < 0) && (errno == EINTR));
+      if (f->status < 0)
+        f->status = -errno;
+    }
+  }
+
+  int failed = 0;
+  for (size_t i = 0; i < b->files_num; i++) {
+    read_batch_file_t *f = b->files + i;
+    if (f->status >= 0) {
+      f->buffer[f->status] = 0;
+      continue;
+    }
+
+    /* The file may have been replaced, e.g. when a device was re-added. It is
+     * re-opened by the next read. */
+    failed++;
+    f->buffer[0] = 0;
+    if (f->fd >= 0) {
+      close(f->fd);
+      f->fd = -1;
+#if HAVE_IO_URING
+      b->fds_changed = true;
+#endif
+    }
+  }
+
+  return failed;
+}
+
+ssize_t read_batch_get(read_batch_t *b, int index, char **ret_buffer) {
+  if ((b == NULL) || (index < 0) || ((size_t)index >= b->files_num))
+    return -EINVAL;
+
+  read_batch_file_t *f = b->files + index;
+  if (ret_buffer != NULL)
+    *ret_buffer = f->buffer;
+  return f->status;
+}
+
+char const *read_batch_path(read_batch_t *b, int index) {
+  if ((b == NULL) || (index < 0) || ((size_t)index >= b->files_num))
+    return NULL;
+  return b->files[index].path;
+}
+
+void read_batch_destroy(read_batch_t *b) {
+  if (b == NULL)
+    return;
+
+#if HAVE_IO_URING
+  read_batch_ring_close(b);
+#endif
+  for (size_t i = 0; i < b->files_num; i++) {
+    if (b->files[i].fd >= 0)
+      close(b->files[i].fd);
+    sfree(b->files[i].path);
+    sfree(b->files[i].buffer);
+  }
+  sfree(b->files);
+  sfree(b);
+}
+
+char *proc_file_line(char **ptr) {
+  char *line = *ptr;
+  if ((line == NULL) || (line[0] == 0))
+    return NULL;
+
+  char *end = strchr(line, '\n');
+  if (end == NULL) {
+    *ptr = line + strlen(line);
+  } else {
+    *end = 0;
+    *ptr = end + 1;
+  }
+
+  return line;
+}
+
+size_t parse_uint64_fields(char const *str, uint64_t *values, size_t values_num,
+                           char const **ret_end) {
+  size_t num = 0;
+
+  while (num < values_num) {
+    while ((*str == ' ') || (*str == '\t'))
+      str++;
+
+    if ((*str < '0') || (*str > '9'))
+      break;
+
+    /* The token must end in whitespace or at the end of the string. */
+    char const *p = str;
+    uint64_t v = 0;
+    while ((*p >= '0') && (*p <= '9')) {
+      v = 10 * v + (uint64_t)(*p - '0');
+      p++;
+    }
+    if ((*p != 0) && (*p != ' ') && (*p != '\t') && (*p != '\n'))
+      break;
+
+    values[num] = v;
+    num++;
+    str = p;
+  }
+
+  if (ret_end != NULL)
+    *ret_end = str;
+  return num;
+}
+
 counter_t counter_diff(counter_t old_value, counter_t new_value) {
   counter_t diff;
 
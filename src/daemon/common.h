@@ -315,9 +315,16 @@ double htond(double d);
 int format_name(char *ret, int ret_len, const char *hostname,
                 const char *plugin, const char *plugin_instance,
                 const char *type, const char *type_instance);
-#define FORMAT_VL(ret, ret_len, vl)                                            \
-  format_name(ret, ret_len, (vl)->host, (vl)->plugin, (vl)->plugin_instance,   \
-              (vl)->type, (vl)->type_instance)
+/* Formats the identifier of "vl". Copies the interned identifier if it has
+ * been computed. */
+int format_vl(char *ret, size_t ret_len, const value_list_t *vl);
+#define FORMAT_VL(ret, ret_len, vl) format_vl(ret, ret_len, vl)
+
+/* Returns the (non-zero) hash of an identifier as formatted by format_name(). */
+uint32_t identifier_hash(const char *name);
+/* (Re-)computes the interned identifier of "vl". Returns zero on success. On
+ * failure, the identifier is reset. */
+int identifier_update(value_list_t *vl);
 int format_values(char *ret, size_t ret_len, const data_set_t *ds,
                   const value_list_t *vl, bool store_rates);
 
@@ -354,6 +361,70 @@ int walk_directory(const char *dir, dirwalk_callback_f callback,
 /* Returns the number of bytes read or negative on error. */
 ssize_t read_file_contents(char const *filename, char *buf, size_t bufsize);
 
+/* A file, typically below /proc or /sys, that is kept open between reads and
+ * re-read from offset zero with pread(2). This avoids the open(2) / close(2)
+ * pair, and the path lookup, on every read interval. */
+struct proc_file_s;
+typedef struct proc_file_s proc_file_t;
+
+/* Returns NULL on error, in which case errno is set. */
+proc_file_t *proc_file_open(char const *path);
+
+/* Reads the entire file into an internal buffer which grows as required. The
+ * buffer is null-terminated and stays valid until the next call to
+ * proc_file_read() or proc_file_close(); the caller may modify it. Returns the
+ * number of bytes read or negative on error. */
+ssize_t proc_file_read(proc_file_t *pf, char **ret_buffer);
+
+void proc_file_close(proc_file_t *pf);
+
+/* A set of small files, e.g. one attribute per CPU or device below /sys, which
+ * are read together once per interval. Like proc_file_t the files are kept
+ * open and read from offset zero. On Linux all reads of a batch are submitted
+ * with one io_uring_enter(2) call, using registered file descriptors; where
+ * io_uring is not available, pread(2) is used. A batch must only be used by
+ * one thread at a time. */
+struct read_batch_s;
+typedef struct read_batch_s read_batch_t;
+
+/* Creates an empty batch. The files are read into buffers of "buffer_size"
+ * bytes, including the terminating null byte; longer files are truncated.
+ * Returns NULL on error, in which case errno is set. */
+read_batch_t *read_batch_create(size_t buffer_size);
+
+/* Adds "path" to the batch. The file is opened by the next read_batch_read().
+ * Returns the index of the file or a negative errno value. */
+int read_batch_add(read_batch_t *b, char const *path);
+
+/* Reads all files of the batch. Files which can't be opened or read are
+ * closed and retried by the next call. Returns the number of files which
+ * could not be read. */
+int read_batch_read(read_batch_t *b);
+
+/* Returns the number of bytes read from file "index" by the last
+ * read_batch_read() or a negative errno value. "ret_buffer" is set to the
+ * null-terminated content, which stays valid until the next read; the caller
+ * may modify it. */
+ssize_t read_batch_get(read_batch_t *b, int index, char **ret_buffer);
+
+/* Returns the path of file "index" or NULL. */
+char const *read_batch_path(read_batch_t *b, int index);
+
+void read_batch_destroy(read_batch_t *b);
+
+/* Returns the next line of the buffer pointed to by "ptr", replacing the
+ * newline with a null byte and advancing "ptr" to the following line. Returns
+ * NULL when the end of the buffer has been reached. */
+char *proc_file_line(char **ptr);
+
+/* Parses up to "values_num" whitespace-separated, unsigned decimal numbers from
+ * "str" into "values". Parsing stops at the first token which is not a
+ * number or at the end of the line. If "ret_end" is not NULL, it is set to
+ * the first character not consumed, i.e. the start of that token. Returns the
+ * number of values parsed. */
+size_t parse_uint64_fields(char const *str, uint64_t *values, size_t values_num,
+                           char const **ret_end);
+
 counter_t counter_diff(counter_t old_value, counter_t new_value);
 
 /* Convert a rate back to a value_t. When converting to a derive_t, counter_t
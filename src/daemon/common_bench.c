@@ -0,0 +1,117 @@
+/**
+ * collectd - src/daemon/common_bench.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Benchmarks for the string helpers used on the dispatch path and by the
+ * command parsers. The strings are sized like typical identifier fields.
+ */
+
+#include "collectd.h"
+
+#include "benchmark.h"
+#include "common.h"
+
+static char const *const bench_names[] = {
+    "host042.example.com", "interface", "eth0", "if_octets", "",
+    "cpu", "0", "idle", "df", "root",
+};
+
+/* The common case: no slashes, so nothing is rewritten. */
+DEF_BENCH(escape_slashes) {
+  char buffer[DATA_MAX_NAME_LEN];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    sstrncpy(buffer, bench_names[i % STATIC_ARRAY_SIZE(bench_names)],
+             sizeof(buffer));
+    escape_slashes(buffer, sizeof(buffer));
+    BENCH_SINK(buffer[0]);
+  }
+}
+
+DEF_BENCH(escape_slashes_mount_point) {
+  char buffer[DATA_MAX_NAME_LEN];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    sstrncpy(buffer, "/var/lib/collectd/rrd", sizeof(buffer));
+    escape_slashes(buffer, sizeof(buffer));
+    BENCH_SINK(buffer[0]);
+  }
+}
+
+DEF_BENCH(escape_string) {
+  char buffer[DATA_MAX_NAME_LEN];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    sstrncpy(buffer, bench_names[i % STATIC_ARRAY_SIZE(bench_names)],
+             sizeof(buffer));
+    escape_string(buffer, sizeof(buffer));
+    BENCH_SINK(buffer[0]);
+  }
+}
+
+DEF_BENCH(escape_string_quoted) {
+  char buffer[DATA_MAX_NAME_LEN];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    sstrncpy(buffer, "a \"quoted\" value", sizeof(buffer));
+    escape_string(buffer, sizeof(buffer));
+    BENCH_SINK(buffer[0]);
+  }
+}
+
+/* A PUTVAL line as received by the unixsock and exec plugins. */
+DEF_BENCH(strsplit) {
+  char const *line = "PUTVAL host042.example.com/interface-eth0/if_octets "
+                     "interval=10 1520000000:123456:654321";
+  char buffer[256];
+  char *fields[16];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    sstrncpy(buffer, line, sizeof(buffer));
+    BENCH_SINK(strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields)));
+  }
+}
+
+DEF_BENCH(sstrncpy) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    sstrncpy(vl.host, bench_names[0], sizeof(vl.host));
+    sstrncpy(vl.plugin, bench_names[1], sizeof(vl.plugin));
+    sstrncpy(vl.plugin_instance, bench_names[2], sizeof(vl.plugin_instance));
+    sstrncpy(vl.type, bench_names[3], sizeof(vl.type));
+    sstrncpy(vl.type_instance, bench_names[4], sizeof(vl.type_instance));
+    BENCH_SINK(vl.type[0]);
+  }
+}
+
+int main(void) {
+  RUN_BENCH(escape_slashes, 20000000);
+  RUN_BENCH(escape_slashes_mount_point, 10000000);
+  RUN_BENCH(escape_string, 20000000);
+  RUN_BENCH(escape_string_quoted, 5000000);
+  RUN_BENCH(strsplit, 5000000);
+  RUN_BENCH(sstrncpy, 10000000);
+
+  END_BENCH;
+}
@@ -361,6 +361,172 @@ DEF_TEST(value_to_rate) {
   return 0;
 }
 
+DEF_TEST(identifier_update) {
+  value_list_t vl = {
+      .host = "example.com",
+      .plugin = "common_test",
+      .plugin_instance = "pi",
+      .type = "example",
+  };
+  char buffer[6 * DATA_MAX_NAME_LEN];
+
+  EXPECT_EQ_INT(0, vl.identifier.hash);
+  CHECK_ZERO(FORMAT_VL(buffer, sizeof(buffer), &vl));
+  EXPECT_EQ_STR("example.com/common_test-pi/example", buffer);
+
+  CHECK_ZERO(identifier_update(&vl));
+  OK(vl.identifier.hash != 0);
+  EXPECT_EQ_STR("example.com/common_test-pi/example", vl.identifier.name);
+  OK(vl.identifier.hash == identifier_hash(vl.identifier.name));
+
+  /* The interned identifier is used once it has been computed. */
+  sstrncpy(vl.type_instance, "ti", sizeof(vl.type_instance));
+  CHECK_ZERO(FORMAT_VL(buffer, sizeof(buffer), &vl));
+  EXPECT_EQ_STR("example.com/common_test-pi/example", buffer);
+
+  CHECK_ZERO(identifier_update(&vl));
+  CHECK_ZERO(FORMAT_VL(buffer, sizeof(buffer), &vl));
+  EXPECT_EQ_STR("example.com/common_test-pi/example-ti", buffer);
+
+  EXPECT_EQ_INT(ENOBUFS, FORMAT_VL(buffer, 8, &vl));
+
+  return 0;
+}
+
+DEF_TEST(parse_uint64_fields) {
+  struct {
+    char const *str;
+    size_t want_num;
+    uint64_t want[4];
+    char const *want_end;
+  } cases[] = {
+      {"1 2 3", 3, {1, 2, 3}, ""},
+      {"  42\t\t7 ", 2, {42, 7}, ""},
+      {"18446744073709551615", 1, {18446744073709551615ULL}, ""},
+      {"1 2 foo 3", 2, {1, 2}, "foo 3"},
+      {"1 2x 3", 1, {1}, "2x 3"},
+      {"1 2 3 4 5", 4, {1, 2, 3, 4}, " 5"},
+      {"1\n2", 1, {1}, "\n2"},
+      {"", 0, {0}, ""},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    uint64_t values[4] = {0};
+    char const *end = NULL;
+
+    EXPECT_EQ_INT((int)cases[i].want_num,
+                  (int)parse_uint64_fields(cases[i].str, values,
+                                           STATIC_ARRAY_SIZE(values), &end));
+    for (size_t j = 0; j < cases[i].want_num; j++)
+      EXPECT_EQ_UINT64(cases[i].want[j], values[j]);
+    EXPECT_EQ_STR(cases[i].want_end, end);
+  }
+
+  return 0;
+}
+
+DEF_TEST(proc_file) {
+  char path[] = "/tmp/common_test.XXXXXX";
+  int fd = mkstemp(path);
+  OK(fd >= 0);
+
+  CHECK_ZERO(swrite(fd, "a 1\nb 2\n", 8));
+
+  proc_file_t *pf;
+  CHECK_NOT_NULL(pf = proc_file_open(path));
+
+  char *buffer = NULL;
+  EXPECT_EQ_INT(8, (int)proc_file_read(pf, &buffer));
+  EXPECT_EQ_STR("a 1\nb 2\n", buffer);
+
+  char *ptr = buffer;
+  EXPECT_EQ_STR("a 1", proc_file_line(&ptr));
+  EXPECT_EQ_STR("b 2", proc_file_line(&ptr));
+  OK(proc_file_line(&ptr) == NULL);
+
+  /* Re-reading picks up new content and grows the buffer. */
+  char large[10000];
+  memset(large, 'x', sizeof(large));
+  CHECK_ZERO(swrite(fd, large, sizeof(large)));
+  EXPECT_EQ_INT(8 + (int)sizeof(large), (int)proc_file_read(pf, &buffer));
+  EXPECT_EQ_INT(8 + (int)sizeof(large), (int)strlen(buffer));
+
+  proc_file_close(pf);
+  close(fd);
+  unlink(path);
+
+  OK(proc_file_open("/nonexistent/common_test") == NULL);
+
+  return 0;
+}
+
+DEF_TEST(read_batch) {
+  char dir[] = "/tmp/common_test.XXXXXX";
+  CHECK_NOT_NULL(mkdtemp(dir));
+
+  read_batch_t *b;
+  CHECK_NOT_NULL(b = read_batch_create(8));
+
+  /* More files than fit into one submission of the ring. */
+  char path[64];
+  for (int i = 0; i < 300; i++) {
+    snprintf(path, sizeof(path), "%s/%d", dir, i);
+    FILE *fh = fopen(path, "w");
+    CHECK_NOT_NULL(fh);
+    fprintf(fh, "%d\n", i);
+    fclose(fh);
+    EXPECT_EQ_INT(i, read_batch_add(b, path));
+  }
+  snprintf(path, sizeof(path), "%s/missing", dir);
+  EXPECT_EQ_INT(300, read_batch_add(b, path));
+
+  EXPECT_EQ_INT(1, read_batch_read(b));
+
+  int failed = 0;
+  for (int i = 0; i < 300; i++) {
+    char want[16];
+    snprintf(want, sizeof(want), "%d\n", i);
+    char *buffer = NULL;
+    if ((read_batch_get(b, i, &buffer) != (ssize_t)strlen(want)) ||
+        (strcmp(want, buffer) != 0))
+      failed++;
+  }
+  EXPECT_EQ_INT(0, failed);
+  EXPECT_EQ_INT(-ENOENT, (int)read_batch_get(b, 300, NULL));
+  EXPECT_EQ_STR(path, read_batch_path(b, 300));
+  EXPECT_EQ_INT(-EINVAL, (int)read_batch_get(b, 301, NULL));
+
+  /* Changed content is picked up, long content is truncated and files which
+   * appear later are opened. */
+  snprintf(path, sizeof(path), "%s/0", dir);
+  FILE *fh = fopen(path, "w");
+  CHECK_NOT_NULL(fh);
+  fprintf(fh, "123456789\n");
+  fclose(fh);
+  snprintf(path, sizeof(path), "%s/missing", dir);
+  CHECK_NOT_NULL(fh = fopen(path, "w"));
+  fprintf(fh, "here\n");
+  fclose(fh);
+
+  EXPECT_EQ_INT(0, read_batch_read(b));
+  char *buffer = NULL;
+  EXPECT_EQ_INT(7, (int)read_batch_get(b, 0, &buffer));
+  EXPECT_EQ_STR("1234567", buffer);
+  EXPECT_EQ_INT(5, (int)read_batch_get(b, 300, &buffer));
+  EXPECT_EQ_STR("here\n", buffer);
+
+  read_batch_destroy(b);
+  for (int i = 0; i < 300; i++) {
+    snprintf(path, sizeof(path), "%s/%d", dir, i);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s/missing", dir);
+  unlink(path);
+  rmdir(dir);
+
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(sstrncpy);
   RUN_TEST(sstrdup);
@@ -371,6 +537,10 @@ int main(void) {
   RUN_TEST(strunescape);
   RUN_TEST(parse_values);
   RUN_TEST(value_to_rate);
+  RUN_TEST(identifier_update);
+  RUN_TEST(parse_uint64_fields);
+  RUN_TEST(proc_file);
+  RUN_TEST(read_batch);
 
   END_TEST;
 }
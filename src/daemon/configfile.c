@@ -84,6 +84,7 @@ typedef struct cf_global_option_s {
  * Prototypes of callback functions
  */
 static int dispatch_value_typesdb(oconfig_item_t *ci);
+static int dispatch_value_typesdbcache(oconfig_item_t *ci);
 static int dispatch_value_plugindir(oconfig_item_t *ci);
 static int dispatch_loadplugin(oconfig_item_t *ci);
 static int dispatch_block_plugin(oconfig_item_t *ci);
@@ -95,6 +96,8 @@ static cf_callback_t *first_callback;
 static cf_complex_callback_t *complex_callback_head;
 
 static cf_value_map_t cf_value_map[] = {{"TypesDB", dispatch_value_typesdb},
+                                        {"TypesDBCache",
+                                         dispatch_value_typesdbcache},
                                         {"PluginDir", dispatch_value_plugindir},
                                         {"LoadPlugin", dispatch_loadplugin},
                                         {"Plugin", dispatch_block_plugin}};
@@ -106,13 +109,29 @@ static cf_global_option_t cf_global_options[] = {
     {"Hostname", NULL, 0, NULL},
     {"FQDNLookup", NULL, 0, "true"},
     {"Interval", NULL, 0, NULL},
+    {"InitThreads", NULL, 0, "1"},
     {"ReadThreads", NULL, 0, "5"},
+    {"ReadPhaseMode", NULL, 0, NULL},
+    {"ReadThreadsCPUs", NULL, 0, NULL},
     {"WriteThreads", NULL, 0, "5"},
+    {"WriteThreadsCPUs", NULL, 0, NULL},
+    {"WriteBatchSize", NULL, 0, "64"},
     {"WriteQueueLimitHigh", NULL, 0, NULL},
     {"WriteQueueLimitLow", NULL, 0, NULL},
+    {"LoadShedding", NULL, 0, "false"},
+    {"NotificationThreads", NULL, 0, "0"},
+    {"NotificationQueueLimit", NULL, 0, "1000"},
+    {"NotificationCoalesceWindow", NULL, 0, "0"},
+    {"LogRateLimit", NULL, 0, "0"},
     {"Timeout", NULL, 0, "2"},
+    {"CacheHistoryRetention", NULL, 0, "0"},
+    {"CacheSnapshotFile", NULL, 0, NULL},
     {"AutoLoadPlugin", NULL, 0, "false"},
     {"CollectInternalStats", NULL, 0, "false"},
+    {"InternalStatsListen", NULL, 0, NULL},
+    {"CoarseTimestamps", NULL, 0, "false"},
+    {"ConfigParseWorkers", NULL, 0, "0"},
+    {"ConfigCache", NULL, 0, NULL},
     {"PreCacheChain", NULL, 0, "PreCache"},
     {"PostCacheChain", NULL, 0, "PostCache"},
     {"MaxReadInterval", NULL, 0, "86400"}};
@@ -237,6 +256,18 @@ static int dispatch_value_typesdb(oconfig_item_t *ci) {
   return 0;
 } /* int dispatch_value_typesdb */
 
+static int dispatch_value_typesdbcache(oconfig_item_t *ci) {
+  assert(strcasecmp(ci->key, "TypesDBCache") == 0);
+
+  if (ci->values_num != 1 || ci->values[0].type != OCONFIG_TYPE_STRING) {
+    ERROR("configfile: The `TypesDBCache' option needs exactly one string "
+          "argument.");
+    return -1;
+  }
+
+  return types_list_set_cache_dir(ci->values[0].value.string);
+} /* int dispatch_value_typesdbcache */
+
 static int dispatch_value_plugindir(oconfig_item_t *ci) {
   assert(strcasecmp(ci->key, "PluginDir") == 0);
 
@@ -267,7 +298,10 @@ static int dispatch_loadplugin(oconfig_item_t *ci) {
 
   /* default to the global interval set before loading this plugin */
   plugin_ctx_t ctx = {
-      .interval = cf_get_default_interval(), .name = strdup(name),
+      .interval = cf_get_default_interval(),
+      .name = strdup(name),
+      .spool_limit = 1024,
+      .spool_replay_rate = 1000,
   };
   if (ctx.name == NULL)
     return ENOMEM;
@@ -283,13 +317,77 @@ static int dispatch_loadplugin(oconfig_item_t *ci) {
       cf_util_get_cdtime(child, &ctx.flush_interval);
     else if (strcasecmp("FlushTimeout", child->key) == 0)
       cf_util_get_cdtime(child, &ctx.flush_timeout);
-    else {
+    else if (strcasecmp("WriteQueue", child->key) == 0)
+      cf_util_get_boolean(child, &ctx.write_queue);
+    else if (strcasecmp("WriteQueueLimitHigh", child->key) == 0) {
+      if (cf_util_get_int(child, &ctx.write_queue_limit_high) == 0)
+        ctx.write_queue = true;
+    } else if (strcasecmp("WriteQueueLimitLow", child->key) == 0) {
+      if (cf_util_get_int(child, &ctx.write_queue_limit_low) == 0)
+        ctx.write_queue = true;
+    } else if (strcasecmp("SpoolDirectory", child->key) == 0) {
+      if (cf_util_get_string(child, &ctx.spool_directory) == 0)
+        ctx.write_queue = true;
+    } else if (strcasecmp("SpoolLimit", child->key) == 0)
+      cf_util_get_int(child, &ctx.spool_limit);
+    else if (strcasecmp("SpoolReplayRate", child->key) == 0)
+      cf_util_get_int(child, &ctx.spool_replay_rate);
+    else if (strcasecmp("Priority", child->key) == 0) {
+      char *priority = NULL;
+      if (cf_util_get_string(child, &priority) != 0)
+        continue;
+      if (strcasecmp("Low", priority) == 0)
+        ctx.priority = PLUGIN_PRIORITY_LOW;
+      else if (strcasecmp("Normal", priority) == 0)
+        ctx.priority = PLUGIN_PRIORITY_NORMAL;
+      else if (strcasecmp("Critical", priority) == 0)
+        ctx.priority = PLUGIN_PRIORITY_CRITICAL;
+      else
+        WARNING("configfile: Unknown priority \"%s\" for plugin \"%s\". "
+                "Expected \"Low\", \"Normal\" or \"Critical\".",
+                priority, name);
+      sfree(priority);
+    }
+    else if (strcasecmp("InitAfter", child->key) == 0) {
+      for (int j = 0; j < child->values_num; j++) {
+        if (child->values[j].type != OCONFIG_TYPE_STRING) {
+          WARNING("configfile: The `InitAfter' option of plugin \"%s\" "
+                  "requires string arguments.",
+                  name);
+          continue;
+        }
+        plugin_init_after(name, child->values[j].value.string);
+      }
+    } else {
       WARNING("Ignoring unknown LoadPlugin option \"%s\" "
               "for plugin \"%s\"",
               child->key, name);
     }
   }
 
+  if ((ctx.write_queue_limit_high < 0) || (ctx.write_queue_limit_low < 0)) {
+    ERROR("configfile: WriteQueueLimitHigh and WriteQueueLimitLow must be "
+          "positive or zero (plugin \"%s\").",
+          name);
+    ctx.write_queue_limit_high = 0;
+    ctx.write_queue_limit_low = 0;
+  } else if (ctx.write_queue_limit_low == 0) {
+    ctx.write_queue_limit_low = ctx.write_queue_limit_high / 2;
+  } else if (ctx.write_queue_limit_low > ctx.write_queue_limit_high) {
+    ERROR("configfile: WriteQueueLimitLow must not be larger than "
+          "WriteQueueLimitHigh (plugin \"%s\").",
+          name);
+    ctx.write_queue_limit_low = ctx.write_queue_limit_high;
+  }
+
+  if ((ctx.spool_limit < 0) || (ctx.spool_replay_rate < 0)) {
+    ERROR("configfile: SpoolLimit and SpoolReplayRate must be positive or "
+          "zero (plugin \"%s\").",
+          name);
+    ctx.spool_limit = 1024;
+    ctx.spool_replay_rate = 1000;
+  }
+
   plugin_ctx_t old_ctx = plugin_set_ctx(ctx);
   int ret_val = plugin_load(name, global);
   /* reset to the "global" context */
@@ -533,6 +631,424 @@ static int cf_ci_append_children(oconfig_item_t *dst, oconfig_item_t *src) {
 #define CF_MAX_DEPTH 8
 static oconfig_item_t *cf_read_generic(const char *path, const char *pattern,
                                        int depth);
+static oconfig_item_t *cf_read_dir(const char *dir, const char *pattern,
+                                   int depth);
+
+/*
+ * With "ConfigCache", every file and directory the configuration is read from
+ * is recorded together with its inode, size and times. The cached tree is
+ * used as long as none of them has changed. The numbers are kept as doubles
+ * so that they can be stored as oconfig values.
+ */
+typedef struct {
+  char *path;
+  bool exists;
+  double ino;
+  double size;
+  double mtime;
+  double ctime;
+} cf_dep_t;
+
+#define CF_CACHE_MAGIC "collectd config cache 1\n"
+
+static bool cf_deps_enabled;
+static bool cf_deps_failed;
+static cf_dep_t *cf_deps;
+static size_t cf_deps_num;
+
+/* Number of processes independent include files are parsed in. The parser
+ * is not reentrant, so threads are no option. */
+static int cf_parse_workers;
+static bool cf_is_worker;
+/* Forking workers isn't safe once other threads are running. */
+static bool cf_reloading;
+
+/* The configuration in effect, compared against by cf_reload(). */
+static char *cf_current_file;
+static oconfig_item_t *cf_current;
+
+static void cf_dep_stat(cf_dep_t *d, struct stat const *st) {
+  struct stat tmp;
+
+  if (st == NULL) {
+    if (stat(d->path, &tmp) != 0) {
+      d->exists = false;
+      d->ino = d->size = d->mtime = d->ctime = 0.0;
+      return;
+    }
+    st = &tmp;
+  }
+
+  d->exists = true;
+  d->ino = (double)st->st_ino;
+  d->size = (double)st->st_size;
+  d->mtime = (double)st->st_mtime;
+  d->ctime = (double)st->st_ctime;
+} /* void cf_dep_stat */
+
+static int cf_deps_append(cf_dep_t const *d) {
+  cf_dep_t *tmp = realloc(cf_deps, (cf_deps_num + 1) * sizeof(*cf_deps));
+  if (tmp == NULL) {
+    cf_deps_failed = true;
+    return ENOMEM;
+  }
+  cf_deps = tmp;
+
+  cf_deps[cf_deps_num] = *d;
+  cf_deps[cf_deps_num].path = strdup(d->path);
+  if (cf_deps[cf_deps_num].path == NULL) {
+    cf_deps_failed = true;
+    return ENOMEM;
+  }
+  cf_deps_num++;
+
+  return 0;
+} /* int cf_deps_append */
+
+/* Records "path". If "st" is NULL, the path is stat'ed. */
+static void cf_deps_add(const char *path, struct stat const *st) {
+  if (!cf_deps_enabled)
+    return;
+
+  cf_dep_t d = {.path = (char *)path};
+  cf_dep_stat(&d, st);
+  cf_deps_append(&d);
+} /* void cf_deps_add */
+
+static void cf_deps_free(void) {
+  for (size_t i = 0; i < cf_deps_num; i++)
+    sfree(cf_deps[i].path);
+  sfree(cf_deps);
+  cf_deps_num = 0;
+  cf_deps_enabled = false;
+} /* void cf_deps_free */
+
+/* Writes the dependencies starting at index "first". */
+static int cf_deps_write(FILE *fh, size_t first) {
+  uint32_t num = (uint32_t)(cf_deps_num - first);
+
+  if (fwrite(&num, sizeof(num), 1, fh) != 1)
+    return -1;
+
+  for (size_t i = first; i < cf_deps_num; i++) {
+    cf_dep_t *d = cf_deps + i;
+    oconfig_value_t values[] = {
+        {.value.string = d->path, .type = OCONFIG_TYPE_STRING},
+        {.value.boolean = d->exists, .type = OCONFIG_TYPE_BOOLEAN},
+        {.value.number = d->ino, .type = OCONFIG_TYPE_NUMBER},
+        {.value.number = d->size, .type = OCONFIG_TYPE_NUMBER},
+        {.value.number = d->mtime, .type = OCONFIG_TYPE_NUMBER},
+        {.value.number = d->ctime, .type = OCONFIG_TYPE_NUMBER},
+    };
+    oconfig_item_t ci = {
+        .key = (char *)"File",
+        .values = values,
+        .values_num = STATIC_ARRAY_SIZE(values),
+    };
+
+    if (oconfig_write_binary(fh, &ci) != 0)
+      return -1;
+  }
+
+  return 0;
+} /* int cf_deps_write */
+
+/* Reads dependencies written by cf_deps_write(). If "ret_valid" is NULL, they
+ * are appended to the list of dependencies. Otherwise, "ret_valid" is set to
+ * false if any of them has changed. */
+static int cf_deps_read(FILE *fh, bool *ret_valid) {
+  uint32_t num;
+
+  if (fread(&num, sizeof(num), 1, fh) != 1)
+    return -1;
+
+  if (ret_valid != NULL)
+    *ret_valid = true;
+
+  for (uint32_t i = 0; i < num; i++) {
+    oconfig_item_t *ci = oconfig_read_binary(fh);
+    if (ci == NULL)
+      return -1;
+
+    oconfig_value_t *v = ci->values;
+    if ((ci->values_num != 6) || (v[0].type != OCONFIG_TYPE_STRING) ||
+        (v[1].type != OCONFIG_TYPE_BOOLEAN)) {
+      oconfig_free(ci);
+      return -1;
+    }
+
+    cf_dep_t d = {
+        .path = v[0].value.string,
+        .exists = (v[1].value.boolean != 0),
+        .ino = v[2].value.number,
+        .size = v[3].value.number,
+        .mtime = v[4].value.number,
+        .ctime = v[5].value.number,
+    };
+
+    if (ret_valid == NULL) {
+      cf_deps_append(&d);
+    } else {
+      cf_dep_t now = {.path = d.path};
+      cf_dep_stat(&now, NULL);
+      if ((now.exists != d.exists) || (now.ino != d.ino) ||
+          (now.size != d.size) || (now.mtime != d.mtime) ||
+          (now.ctime != d.ctime)) {
+        DEBUG("configfile: `%s' has changed, not using the cache.", d.path);
+        *ret_valid = false;
+      }
+    }
+
+    oconfig_free(ci);
+    if ((ret_valid != NULL) && !*ret_valid)
+      return 0;
+  }
+
+  return 0;
+} /* int cf_deps_read */
+
+/* Returns the cached configuration tree if "cache" was written for "file" and
+ * none of the files it was read from has changed since. */
+static oconfig_item_t *cf_cache_load(const char *cache, const char *file) {
+  FILE *fh = fopen(cache, "r");
+  if (fh == NULL) {
+    if (errno != ENOENT)
+      WARNING("configfile: Opening the cache `%s' failed: %s", cache,
+              STRERRNO);
+    return NULL;
+  }
+
+  char magic[sizeof(CF_CACHE_MAGIC) - 1];
+  oconfig_item_t *header = NULL;
+  oconfig_item_t *root = NULL;
+  bool valid = false;
+
+  if ((fread(magic, sizeof(magic), 1, fh) == 1) &&
+      (memcmp(magic, CF_CACHE_MAGIC, sizeof(magic)) == 0))
+    header = oconfig_read_binary(fh);
+
+  if ((header != NULL) && (header->values_num == 1) &&
+      (header->values[0].type == OCONFIG_TYPE_STRING) &&
+      (strcmp(header->values[0].value.string, file) == 0) &&
+      (cf_deps_read(fh, &valid) == 0) && valid)
+    root = oconfig_read_binary(fh);
+
+  if (header != NULL)
+    oconfig_free(header);
+  fclose(fh);
+
+  return root;
+} /* oconfig_item_t *cf_cache_load */
+
+static void cf_cache_save(const char *cache, const char *file,
+                          const oconfig_item_t *root) {
+  char tmp[PATH_MAX];
+  int status;
+
+  status = snprintf(tmp, sizeof(tmp), "%s.%d", cache, (int)getpid());
+  if ((status < 0) || ((size_t)status >= sizeof(tmp))) {
+    WARNING("configfile: The cache file name `%s' is too long.", cache);
+    return;
+  }
+
+  FILE *fh = fopen(tmp, "w");
+  if (fh == NULL) {
+    WARNING("configfile: Creating the cache `%s' failed: %s", tmp, STRERRNO);
+    return;
+  }
+
+  oconfig_value_t value = {.value.string = (char *)file,
+                           .type = OCONFIG_TYPE_STRING};
+  oconfig_item_t header = {
+      .key = (char *)"Config", .values = &value, .values_num = 1,
+  };
+
+  status = 0;
+  if ((fwrite(CF_CACHE_MAGIC, strlen(CF_CACHE_MAGIC), 1, fh) != 1) ||
+      (oconfig_write_binary(fh, &header) != 0) ||
+      (cf_deps_write(fh, /* first = */ 0) != 0) ||
+      (oconfig_write_binary(fh, root) != 0))
+    status = -1;
+  if (fclose(fh) != 0)
+    status = -1;
+
+  if ((status != 0) || (rename(tmp, cache) != 0)) {
+    WARNING("configfile: Writing the cache `%s' failed: %s", cache, STRERRNO);
+    unlink(tmp);
+  }
+} /* void cf_cache_save */
+
+/* Reads one path. Returns zero and the tree in "ret" on success, ENOENT if
+ * the path is to be skipped and another error code on failure. */
+typedef int (*cf_read_item_cb)(const char *path, const char *pattern,
+                               int depth, oconfig_item_t **ret);
+
+/* Runs in a forked worker process: reads every "step"th path, starting with
+ * "first", and writes the results and the recorded dependencies to "fd". */
+static void cf_read_worker(int fd, cf_read_item_cb cb, char **paths,
+                           size_t paths_num, size_t first, size_t step,
+                           const char *pattern, int depth) {
+  size_t deps_first = cf_deps_num;
+  size_t num = (paths_num - first + step - 1) / step;
+  int *status = calloc(num, sizeof(*status));
+  oconfig_item_t **trees = calloc(num, sizeof(*trees));
+  FILE *fh = fdopen(fd, "w");
+
+  if ((status == NULL) || (trees == NULL) || (fh == NULL))
+    _exit(EXIT_FAILURE);
+
+  cf_is_worker = true;
+
+  /* Parse everything first, so the parent reading from other workers doesn't
+   * hold this one up. */
+  for (size_t i = 0; i < num; i++)
+    status[i] = cb(paths[first + i * step], pattern, depth, &trees[i]);
+
+  bool ok = true;
+  for (size_t i = 0; ok && (i < num); i++) {
+    int32_t tmp = (int32_t)status[i];
+    if (fwrite(&tmp, sizeof(tmp), 1, fh) != 1)
+      ok = false;
+    else if ((status[i] == 0) && (oconfig_write_binary(fh, trees[i]) != 0))
+      ok = false;
+  }
+  if (ok && (cf_deps_write(fh, deps_first) != 0))
+    ok = false;
+  if (fclose(fh) != 0)
+    ok = false;
+
+  _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+} /* void cf_read_worker */
+
+/* Reads a worker's results. Returns zero if all of them could be read. */
+static int cf_read_worker_results(pid_t pid, int fd, size_t paths_num,
+                                  size_t first, size_t step, int *status,
+                                  oconfig_item_t **trees) {
+  FILE *fh = fdopen(fd, "r");
+  bool ok = (fh != NULL);
+
+  for (size_t i = first; ok && (i < paths_num); i += step) {
+    int32_t tmp;
+
+    if (fread(&tmp, sizeof(tmp), 1, fh) != 1) {
+      ok = false;
+      break;
+    }
+    if (tmp == 0) {
+      trees[i] = oconfig_read_binary(fh);
+      if (trees[i] == NULL) {
+        ok = false;
+        break;
+      }
+    }
+    status[i] = (int)tmp;
+  }
+  if (ok && (cf_deps_read(fh, /* ret_valid = */ NULL) != 0))
+    ok = false;
+
+  if (fh != NULL)
+    fclose(fh);
+  else
+    close(fd);
+
+  int wstatus = 0;
+  if ((waitpid(pid, &wstatus, 0) != pid) || !WIFEXITED(wstatus) ||
+      (WEXITSTATUS(wstatus) != EXIT_SUCCESS))
+    ok = false;
+
+  if (ok)
+    return 0;
+
+  for (size_t i = first; i < paths_num; i += step) {
+    if (trees[i] != NULL)
+      oconfig_free(trees[i]);
+    trees[i] = NULL;
+  }
+  return -1;
+} /* int cf_read_worker_results */
+
+/* Calls "cb" for all paths, in "ConfigParseWorkers" processes if possible.
+ * The results are stored in "status" and "trees" in the order of "paths". */
+static void cf_read_all(cf_read_item_cb cb, char **paths, size_t paths_num,
+                        const char *pattern, int depth, int *status,
+                        oconfig_item_t **trees) {
+  size_t workers = (cf_parse_workers > 0) ? (size_t)cf_parse_workers : 0;
+  if (workers > paths_num)
+    workers = paths_num;
+
+  pid_t *pids = NULL;
+  int *fds = NULL;
+  bool *done = NULL;
+  if (!cf_is_worker && !cf_reloading && (workers > 1)) {
+    pids = calloc(workers, sizeof(*pids));
+    fds = calloc(workers, sizeof(*fds));
+    done = calloc(workers, sizeof(*done));
+  }
+
+  if ((pids == NULL) || (fds == NULL) || (done == NULL)) {
+    for (size_t i = 0; i < paths_num; i++)
+      status[i] = cb(paths[i], pattern, depth, &trees[i]);
+    sfree(pids);
+    sfree(fds);
+    sfree(done);
+    return;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  for (size_t k = 0; k < workers; k++) {
+    int pipe_fds[2];
+
+    pids[k] = -1;
+    if (pipe(pipe_fds) != 0) {
+      WARNING("configfile: pipe failed: %s", STRERRNO);
+      continue;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(pipe_fds[0]);
+      cf_read_worker(pipe_fds[1], cb, paths, paths_num, k, workers, pattern,
+                     depth);
+      /* not reached */
+    }
+    close(pipe_fds[1]);
+
+    if (pid < 0) {
+      WARNING("configfile: fork failed: %s", STRERRNO);
+      close(pipe_fds[0]);
+      continue;
+    }
+    pids[k] = pid;
+    fds[k] = pipe_fds[0];
+  }
+
+  for (size_t k = 0; k < workers; k++) {
+    if (pids[k] < 0)
+      continue;
+
+    if (cf_read_worker_results(pids[k], fds[k], paths_num, k, workers, status,
+                               trees) == 0)
+      done[k] = true;
+    else
+      WARNING("configfile: Parser process %d failed, reading its files "
+              "again.",
+              (int)pids[k]);
+  }
+
+  /* Read whatever couldn't be read by a worker. */
+  for (size_t k = 0; k < workers; k++) {
+    if (done[k])
+      continue;
+    for (size_t i = k; i < paths_num; i += workers)
+      status[i] = cb(paths[i], pattern, depth, &trees[i]);
+  }
+
+  sfree(pids);
+  sfree(fds);
+  sfree(done);
+} /* void cf_read_all */
 
 static int cf_include_all(oconfig_item_t *root, int depth) {
   for (int i = 0; i < root->children_num; i++) {
@@ -614,6 +1130,8 @@ static oconfig_item_t *cf_read_file(const char *file, const char *pattern,
 #endif /* HAVE_FNMATCH_H && HAVE_LIBGEN_H */
   }
 
+  cf_deps_add(file, /* stat = */ NULL);
+
   root = oconfig_parse_file(file);
   if (root == NULL) {
     ERROR("configfile: Cannot read file `%s'.", file);
@@ -633,6 +1151,14 @@ static int cf_compare_string(const void *p1, const void *p2) {
   return strcmp(*(const char **)p1, *(const char **)p2);
 }
 
+/* cf_read_item_cb for the entries of a directory. Entries that can't be read
+ * are skipped. */
+static int cf_read_dir_entry(const char *path, const char *pattern, int depth,
+                             oconfig_item_t **ret) {
+  *ret = cf_read_generic(path, pattern, depth);
+  return (*ret == NULL) ? ENOENT : 0;
+} /* int cf_read_dir_entry */
+
 static oconfig_item_t *cf_read_dir(const char *dir, const char *pattern,
                                    int depth) {
   oconfig_item_t *root = NULL;
@@ -644,6 +1170,8 @@ static oconfig_item_t *cf_read_dir(const char *dir, const char *pattern,
 
   assert(depth < CF_MAX_DEPTH);
 
+  cf_deps_add(dir, /* stat = */ NULL);
+
   dh = opendir(dir);
   if (dh == NULL) {
     ERROR("configfile: opendir failed: %s", STRERRNO);
@@ -701,26 +1229,41 @@ static oconfig_item_t *cf_read_dir(const char *dir, const char *pattern,
   qsort((void *)filenames, filenames_num, sizeof(*filenames),
         cf_compare_string);
 
+  closedir(dh);
+
+  int *results_status = calloc(filenames_num, sizeof(*results_status));
+  oconfig_item_t **results = calloc(filenames_num, sizeof(*results));
+  if ((results_status == NULL) || (results == NULL)) {
+    ERROR("configfile: calloc failed.");
+    for (int i = 0; i < filenames_num; ++i)
+      free(filenames[i]);
+    free(filenames);
+    free(results_status);
+    free(results);
+    free(root);
+    return NULL;
+  }
+
+  cf_read_all(cf_read_dir_entry, filenames, (size_t)filenames_num, pattern,
+              depth, results_status, results);
+
   for (int i = 0; i < filenames_num; ++i) {
-    oconfig_item_t *temp;
-    char *name = filenames[i];
+    oconfig_item_t *temp = results[i];
 
-    temp = cf_read_generic(name, pattern, depth);
-    if (temp == NULL) {
-      /* An error should already have been reported. */
-      sfree(name);
+    free(filenames[i]);
+
+    /* An error should already have been reported. */
+    if ((results_status[i] != 0) || (temp == NULL))
       continue;
-    }
 
     cf_ci_append_children(root, temp);
     sfree(temp->children);
     sfree(temp);
-
-    free(name);
   }
 
-  closedir(dh);
   free(filenames);
+  free(results_status);
+  free(results);
   return root;
 } /* oconfig_item_t *cf_read_dir */
 
@@ -736,11 +1279,36 @@ static oconfig_item_t *cf_read_dir(const char *dir, const char *pattern,
  * simpler function is used which does not do any such expansion.
  */
 #if HAVE_WORDEXP_H
+/* cf_read_item_cb for the paths a pattern expanded to. */
+static int cf_read_expanded(const char *path, const char *pattern, int depth,
+                            oconfig_item_t **ret) {
+  struct stat statbuf;
+
+  *ret = NULL;
+
+  if (stat(path, &statbuf) != 0) {
+    WARNING("configfile: stat (%s) failed: %s", path, STRERRNO);
+    return ENOENT;
+  }
+
+  if (S_ISREG(statbuf.st_mode))
+    *ret = cf_read_file(path, pattern, depth);
+  else if (S_ISDIR(statbuf.st_mode))
+    *ret = cf_read_dir(path, pattern, depth);
+  else {
+    WARNING("configfile: %s is neither a file nor a "
+            "directory.",
+            path);
+    return ENOENT;
+  }
+
+  return (*ret == NULL) ? EINVAL : 0;
+} /* int cf_read_expanded */
+
 static oconfig_item_t *cf_read_generic(const char *path, const char *pattern,
                                        int depth) {
   oconfig_item_t *root = NULL;
   int status;
-  const char *path_ptr;
   wordexp_t we;
 
   if (depth >= CF_MAX_DEPTH) {
@@ -750,6 +1318,18 @@ static oconfig_item_t *cf_read_generic(const char *path, const char *pattern,
     return NULL;
   }
 
+#if HAVE_LIBGEN_H
+  /* Files added to or removed from the directory a wildcard refers to change
+   * the directory's times. */
+  if (cf_deps_enabled && (strpbrk(path, "*?[") != NULL)) {
+    char *tmp = sstrdup(path);
+    char *dir = dirname(tmp);
+    if (strpbrk(dir, "*?[") == NULL)
+      cf_deps_add(dir, /* stat = */ NULL);
+    sfree(tmp);
+  }
+#endif
+
   status = wordexp(path, &we, WRDE_NOCMD);
   if (status != 0) {
     ERROR("configfile: wordexp (%s) failed.", path);
@@ -757,8 +1337,15 @@ static oconfig_item_t *cf_read_generic(const char *path, const char *pattern,
   }
 
   root = calloc(1, sizeof(*root));
-  if (root == NULL) {
+  int *results_status = calloc(we.we_wordc, sizeof(*results_status));
+  oconfig_item_t **results = calloc(we.we_wordc, sizeof(*results));
+  if ((root == NULL) ||
+      ((we.we_wordc > 0) && ((results_status == NULL) || (results == NULL)))) {
     ERROR("configfile: calloc failed.");
+    sfree(root);
+    sfree(results_status);
+    sfree(results);
+    wordfree(&we);
     return NULL;
   }
 
@@ -767,40 +1354,37 @@ static oconfig_item_t *cf_read_generic(const char *path, const char *pattern,
   qsort((void *)we.we_wordv, we.we_wordc, sizeof(*we.we_wordv),
         cf_compare_string);
 
-  for (size_t i = 0; i < we.we_wordc; i++) {
-    oconfig_item_t *temp;
-    struct stat statbuf;
+  cf_read_all(cf_read_expanded, we.we_wordv, we.we_wordc, pattern, depth,
+              results_status, results);
 
-    path_ptr = we.we_wordv[i];
+  bool failed = false;
+  for (size_t i = 0; i < we.we_wordc; i++) {
+    oconfig_item_t *temp = results[i];
 
-    status = stat(path_ptr, &statbuf);
-    if (status != 0) {
-      WARNING("configfile: stat (%s) failed: %s", path_ptr, STRERRNO);
+    if (temp == NULL) {
+      if (results_status[i] != ENOENT)
+        failed = true;
       continue;
     }
 
-    if (S_ISREG(statbuf.st_mode))
-      temp = cf_read_file(path_ptr, pattern, depth);
-    else if (S_ISDIR(statbuf.st_mode))
-      temp = cf_read_dir(path_ptr, pattern, depth);
-    else {
-      WARNING("configfile: %s is neither a file nor a "
-              "directory.",
-              path);
+    if (failed) {
+      oconfig_free(temp);
       continue;
     }
 
-    if (temp == NULL) {
-      oconfig_free(root);
-      return NULL;
-    }
-
     cf_ci_append_children(root, temp);
     sfree(temp->children);
     sfree(temp);
   }
 
   wordfree(&we);
+  sfree(results_status);
+  sfree(results);
+
+  if (failed) {
+    oconfig_free(root);
+    return NULL;
+  }
 
   return root;
 } /* oconfig_item_t *cf_read_generic */
@@ -1006,11 +1590,64 @@ int cf_register_complex(const char *type, int (*callback)(oconfig_item_t *)) {
   return 0;
 } /* int cf_register_complex */
 
+/* "ConfigParseWorkers" and "ConfigCache" have to be known before the included
+ * files are read, so they are taken from the main file right away. */
+static void cf_read_early_options(const oconfig_item_t *root) {
+  for (int i = 0; i < root->children_num; i++) {
+    const oconfig_item_t *ci = root->children + i;
+
+    if ((strcasecmp("ConfigParseWorkers", ci->key) == 0) ||
+        (strcasecmp("ConfigCache", ci->key) == 0))
+      dispatch_global_option(ci);
+  }
+
+  cf_parse_workers = (int)global_option_get_long("ConfigParseWorkers", 0);
+} /* void cf_read_early_options */
+
+static oconfig_item_t *cf_read_main(const char *filename) {
+  struct stat statbuf;
+
+  if ((stat(filename, &statbuf) != 0) || !S_ISREG(statbuf.st_mode))
+    return cf_read_generic(filename, /* pattern = */ NULL, /* depth = */ 0);
+
+  oconfig_item_t *root = oconfig_parse_file(filename);
+  if (root == NULL) {
+    ERROR("configfile: Cannot read file `%s'.", filename);
+    return NULL;
+  }
+
+  cf_read_early_options(root);
+
+  const char *cache = global_option_get("ConfigCache");
+  if (cache != NULL) {
+    oconfig_item_t *cached = cf_cache_load(cache, filename);
+    if (cached != NULL) {
+      DEBUG("configfile: Using the cached configuration from `%s'.", cache);
+      oconfig_free(root);
+      return cached;
+    }
+
+    cf_deps_enabled = true;
+    cf_deps_failed = false;
+    cf_deps_add(filename, &statbuf);
+  }
+
+  if (cf_include_all(root, /* depth = */ 0) != 0) {
+    oconfig_free(root);
+    root = NULL;
+  } else if ((cache != NULL) && !cf_deps_failed) {
+    cf_cache_save(cache, filename, root);
+  }
+
+  cf_deps_free();
+  return root;
+} /* oconfig_item_t *cf_read_main */
+
 int cf_read(const char *filename) {
   oconfig_item_t *conf;
   int ret = 0;
 
-  conf = cf_read_generic(filename, /* pattern = */ NULL, /* depth = */ 0);
+  conf = cf_read_main(filename);
   if (conf == NULL) {
     ERROR("Unable to read config file %s.", filename);
     return -1;
@@ -1030,7 +1667,12 @@ int cf_read(const char *filename) {
     }
   }
 
-  oconfig_free(conf);
+  /* Kept for cf_reload(). */
+  sfree(cf_current_file);
+  cf_current_file = strdup(filename);
+  if (cf_current != NULL)
+    oconfig_free(cf_current);
+  cf_current = conf;
 
   /* Read the default types.db if no `TypesDB' option was given. */
   if (cf_default_typesdb) {
@@ -1042,6 +1684,276 @@ int cf_read(const char *filename) {
 
 } /* int cf_read */
 
+/*
+ * Reloading the configuration
+ *
+ * The new tree is compared with the configuration in effect. Plugins whose
+ * <Plugin> blocks have changed are reconfigured if they registered a
+ * reconfigure callback, and changed <Chain> blocks replace all chains. Other
+ * changes require a restart. For the next comparison, "cf_current" keeps the
+ * old items of everything that hasn't been applied.
+ */
+typedef enum {
+  CF_ITEM_OTHER,
+  CF_ITEM_PLUGIN,
+  CF_ITEM_CHAIN
+} cf_item_kind_t;
+
+static bool cf_value_equal(const oconfig_value_t *a,
+                           const oconfig_value_t *b) {
+  if (a->type != b->type)
+    return false;
+
+  switch (a->type) {
+  case OCONFIG_TYPE_STRING:
+    return strcmp(a->value.string, b->value.string) == 0;
+  case OCONFIG_TYPE_NUMBER:
+    return a->value.number == b->value.number;
+  case OCONFIG_TYPE_BOOLEAN:
+    return a->value.boolean == b->value.boolean;
+  }
+
+  return false;
+} /* bool cf_value_equal */
+
+static bool cf_item_equal(const oconfig_item_t *a, const oconfig_item_t *b) {
+  if ((strcmp(a->key, b->key) != 0) || (a->values_num != b->values_num) ||
+      (a->children_num != b->children_num))
+    return false;
+
+  for (int i = 0; i < a->values_num; i++)
+    if (!cf_value_equal(a->values + i, b->values + i))
+      return false;
+
+  for (int i = 0; i < a->children_num; i++)
+    if (!cf_item_equal(a->children + i, b->children + i))
+      return false;
+
+  return true;
+} /* bool cf_item_equal */
+
+/* Returns the name of the plugin configured by the top-level item "ci", or
+ * NULL if "ci" is not a <Plugin> block. Like cf_read(), only blocks with
+ * children are considered. */
+static const char *cf_plugin_block_name(const oconfig_item_t *ci) {
+  if ((ci->key == NULL) || (ci->children == NULL) ||
+      (strcasecmp("Plugin", ci->key) != 0) || (ci->values_num < 1) ||
+      (ci->values[0].type != OCONFIG_TYPE_STRING))
+    return NULL;
+
+  if (strcmp("libvirt", ci->values[0].value.string) == 0)
+    return "virt";
+  return ci->values[0].value.string;
+} /* const char *cf_plugin_block_name */
+
+static cf_item_kind_t cf_item_kind(const oconfig_item_t *ci) {
+  if (cf_plugin_block_name(ci) != NULL)
+    return CF_ITEM_PLUGIN;
+
+  if (ci->children != NULL) {
+    if (strcasecmp("Chain", ci->key) == 0)
+      return CF_ITEM_CHAIN;
+  } else if ((strcasecmp("PreCacheChain", ci->key) == 0) ||
+             (strcasecmp("PostCacheChain", ci->key) == 0)) {
+    return CF_ITEM_CHAIN;
+  }
+
+  return CF_ITEM_OTHER;
+} /* cf_item_kind_t cf_item_kind */
+
+/* Items moved by cf_items_move() are left behind with a NULL key. */
+static bool cf_item_selected(const oconfig_item_t *ci, cf_item_kind_t kind,
+                             const char *plugin) {
+  if ((ci->key == NULL) || (cf_item_kind(ci) != kind))
+    return false;
+
+  return (kind != CF_ITEM_PLUGIN) ||
+         (strcasecmp(plugin, cf_plugin_block_name(ci)) == 0);
+} /* bool cf_item_selected */
+
+/* Returns true if the top-level items of "kind" (and of "plugin", for
+ * CF_ITEM_PLUGIN) are the same, in the same order, in both trees. */
+static bool cf_items_equal(const oconfig_item_t *a, const oconfig_item_t *b,
+                           cf_item_kind_t kind, const char *plugin) {
+  int i = 0;
+  int j = 0;
+
+  while (true) {
+    while ((i < a->children_num) &&
+           !cf_item_selected(a->children + i, kind, plugin))
+      i++;
+    while ((j < b->children_num) &&
+           !cf_item_selected(b->children + j, kind, plugin))
+      j++;
+
+    if ((i >= a->children_num) || (j >= b->children_num))
+      return (i >= a->children_num) && (j >= b->children_num);
+
+    if (!cf_item_equal(a->children + i, b->children + j))
+      return false;
+    i++;
+    j++;
+  }
+} /* bool cf_items_equal */
+
+/* Moves the selected top-level items of "src" to "dst", which must have room
+ * for them. */
+static void cf_items_move(oconfig_item_t *dst, oconfig_item_t *src,
+                          cf_item_kind_t kind, const char *plugin) {
+  for (int i = 0; i < src->children_num; i++) {
+    oconfig_item_t *ci = src->children + i;
+
+    if (!cf_item_selected(ci, kind, plugin))
+      continue;
+
+    dst->children[dst->children_num] = *ci;
+    dst->children[dst->children_num].parent = dst;
+    dst->children_num++;
+    *ci = (oconfig_item_t){0};
+  }
+} /* void cf_items_move */
+
+/* Sets "PreCacheChain" and "PostCacheChain" as configured in "root". */
+static void cf_set_chain_options(const oconfig_item_t *root) {
+  global_option_set("PreCacheChain", NULL, /* from_cli = */ false);
+  global_option_set("PostCacheChain", NULL, /* from_cli = */ false);
+
+  for (int i = 0; i < root->children_num; i++) {
+    const oconfig_item_t *ci = root->children + i;
+
+    if ((ci->key != NULL) && (ci->children == NULL) &&
+        (cf_item_kind(ci) == CF_ITEM_CHAIN))
+      dispatch_global_option(ci);
+  }
+} /* void cf_set_chain_options */
+
+/* Reconfigures the plugin "name" with its blocks in "conf". Returns zero upon
+ * success, ENOTSUP if the plugin can't be reconfigured at runtime. */
+static int cf_reload_plugin(const char *name, const oconfig_item_t *conf) {
+  int status = plugin_reconfigure(name);
+  if (status == ENOTSUP) {
+    WARNING("configfile: The configuration of the `%s' plugin has changed, "
+            "but the plugin can't be reconfigured at runtime. Restart the "
+            "daemon to apply the change.",
+            name);
+    return status;
+  } else if (status != 0) {
+    ERROR("configfile: Reconfiguring the `%s' plugin failed with status %i. "
+          "The plugin may not collect any values until the configuration is "
+          "reloaded again.",
+          name, status);
+    return status;
+  }
+
+  for (int i = 0; i < conf->children_num; i++)
+    if (cf_item_selected(conf->children + i, CF_ITEM_PLUGIN, name))
+      if (dispatch_block_plugin(conf->children + i) != 0)
+        status = -1;
+
+  return status;
+} /* int cf_reload_plugin */
+
+int cf_reload(void) {
+  if ((cf_current == NULL) || (cf_current_file == NULL)) {
+    ERROR("configfile: Cannot reload a configuration that hasn't been read.");
+    return EINVAL;
+  }
+
+  INFO("configfile: Reloading the configuration from `%s'.",
+       cf_current_file);
+
+  cf_reloading = true;
+  oconfig_item_t *conf = cf_read_main(cf_current_file);
+  cf_reloading = false;
+  if (conf == NULL) {
+    ERROR("configfile: Reading `%s' failed. Keeping the current "
+          "configuration.",
+          cf_current_file);
+    return -1;
+  }
+
+  oconfig_item_t *old = cf_current;
+  oconfig_item_t *applied = calloc(1, sizeof(*applied));
+  if (applied != NULL)
+    applied->children =
+        calloc(old->children_num + conf->children_num,
+               sizeof(*applied->children));
+  if ((applied == NULL) || (applied->children == NULL)) {
+    ERROR("configfile: calloc failed.");
+    if (applied != NULL)
+      oconfig_free(applied);
+    oconfig_free(conf);
+    return ENOMEM;
+  }
+
+  int ret = 0;
+
+  if (!cf_items_equal(old, conf, CF_ITEM_OTHER, NULL))
+    WARNING("configfile: Options outside of <Plugin> and <Chain> blocks "
+            "have changed. Restart the daemon to apply them.");
+  cf_items_move(applied, old, CF_ITEM_OTHER, NULL);
+
+  bool chains_changed = !cf_items_equal(old, conf, CF_ITEM_CHAIN, NULL);
+  if (chains_changed) {
+    cf_set_chain_options(conf);
+    if (plugin_reconfigure_chains(conf) != 0) {
+      cf_set_chain_options(old);
+      chains_changed = false;
+      ret = -1;
+    } else {
+      INFO("configfile: Replaced the filter chains.");
+    }
+  }
+  cf_items_move(applied, chains_changed ? conf : old, CF_ITEM_CHAIN, NULL);
+
+  /* Every plugin configured in either tree is looked at once. */
+  char **names = NULL;
+  size_t names_num = 0;
+  for (int i = 0; i < conf->children_num + old->children_num; i++) {
+    const oconfig_item_t *ci = (i < conf->children_num)
+                                   ? conf->children + i
+                                   : old->children + (i - conf->children_num);
+    const char *name = cf_plugin_block_name(ci);
+
+    bool seen = (name == NULL);
+    for (size_t j = 0; !seen && (j < names_num); j++)
+      seen = (strcasecmp(names[j], name) == 0);
+    if (!seen)
+      strarray_add(&names, &names_num, name);
+  }
+
+  int changed = 0;
+  int reconfigured = 0;
+  for (size_t i = 0; i < names_num; i++) {
+    bool use_new = true;
+
+    /* Changes that haven't been applied are tried again on the next reload. */
+    if (!cf_items_equal(old, conf, CF_ITEM_PLUGIN, names[i])) {
+      changed++;
+      int status = cf_reload_plugin(names[i], conf);
+      if (status == 0)
+        reconfigured++;
+      else
+        use_new = false;
+      if ((status != 0) && (status != ENOTSUP))
+        ret = -1;
+    }
+
+    cf_items_move(applied, use_new ? conf : old, CF_ITEM_PLUGIN, names[i]);
+  }
+  strarray_free(names, names_num);
+
+  INFO("configfile: Reloaded the configuration: %i of %i changed plugins "
+       "have been reconfigured.",
+       reconfigured, changed);
+
+  oconfig_free(old);
+  oconfig_free(conf);
+  cf_current = applied;
+
+  return ret;
+} /* int cf_reload */
+
 /* Assures the config option is a string, duplicates it and returns the copy in
  * "ret_string". If necessary "*ret_string" is freed first. Returns zero upon
  * success. */
@@ -89,6 +89,19 @@ int cf_register_complex(const char *type, int (*callback)(oconfig_item_t *));
  */
 int cf_read(const char *filename);
 
+/*
+ * DESCRIPTION
+ *  `cf_reload' reads the config file passed to `cf_read' again and applies
+ *  the changes to <Plugin> blocks of plugins that support it (see
+ *  `plugin_register_reconfigure') and to <Chain> blocks. Other changes are
+ *  logged and require a restart. Must not be called concurrently with itself.
+ *
+ * RETURN VALUE
+ *  Returns zero if all changes that can be applied at runtime have been
+ *  applied and non-zero otherwise.
+ */
+int cf_reload(void);
+
 int global_option_set(const char *option, const char *value, bool from_cli);
 const char *global_option_get(const char *option);
 long global_option_get_long(const char *option, long default_value);
@@ -0,0 +1,278 @@
+/**
+ * collectd - src/daemon/daemon_bench.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Benchmarks for the daemon's hot paths: formatting and parsing identifiers,
+ * the value cache, the filter chains and dispatching values through the write
+ * queue to a write callback.
+ */
+
+#include "collectd.h"
+
+#include "benchmark.h"
+#include "common.h"
+#include "filter_chain.h"
+#include "liboconfig/oconfig.h"
+#include "plugin_bench.h"
+#include "utils_cache.h"
+#include "utils_time.h"
+
+/* Number of distinct identifiers the benchmarks cycle through. */
+#define BENCH_IDENTIFIERS 1000
+
+/* Maximum number of value lists in the write queue while dispatching. */
+#define BENCH_PENDING 4096
+
+static value_list_t bench_vls[BENCH_IDENTIFIERS];
+static value_t bench_values[BENCH_IDENTIFIERS][2];
+
+/* Time of the next round of values; updates must be newer than the values in
+ * the cache. */
+static cdtime_t bench_time;
+
+static void bench_vls_init(void) {
+  bench_time = cdtime();
+
+  for (size_t i = 0; i < BENCH_IDENTIFIERS; i++) {
+    value_list_t *vl = bench_vls + i;
+
+    bench_values[i][0].derive = (derive_t)i;
+    bench_values[i][1].derive = (derive_t)(2 * i);
+
+    *vl = (value_list_t){
+        .values = bench_values[i],
+        .values_len = STATIC_ARRAY_SIZE(bench_values[i]),
+        .interval = TIME_T_TO_CDTIME_T(10),
+        .plugin = "interface",
+        .type = "bench",
+    };
+    snprintf(vl->host, sizeof(vl->host), "host%03zu.example.com", i % 100);
+    snprintf(vl->plugin_instance, sizeof(vl->plugin_instance), "eth%zu",
+             i / 100);
+    identifier_update(vl);
+  }
+}
+
+static value_list_t *bench_vl_next(uint64_t i) {
+  value_list_t *vl = bench_vls + (i % BENCH_IDENTIFIERS);
+
+  if ((i % BENCH_IDENTIFIERS) == 0)
+    bench_time += TIME_T_TO_CDTIME_T(10);
+
+  vl->time = bench_time;
+  vl->values[0].derive++;
+  vl->values[1].derive += 2;
+  return vl;
+}
+
+DEF_BENCH(format_name) {
+  char name[6 * DATA_MAX_NAME_LEN];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    value_list_t *vl = bench_vls + (i % BENCH_IDENTIFIERS);
+    format_name(name, sizeof(name), vl->host, vl->plugin, vl->plugin_instance,
+                vl->type, vl->type_instance);
+    BENCH_SINK(name[0]);
+  }
+}
+
+DEF_BENCH(parse_identifier) {
+  char buffer[6 * DATA_MAX_NAME_LEN];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    char *host, *plugin, *plugin_instance, *type, *type_instance;
+
+    sstrncpy(buffer, bench_vls[i % BENCH_IDENTIFIERS].identifier.name,
+             sizeof(buffer));
+    parse_identifier(buffer, &host, &plugin, &plugin_instance, &type,
+                     &type_instance, /* default host = */ NULL);
+    BENCH_SINK(host[0]);
+  }
+}
+
+DEF_BENCH(uc_update) {
+  data_set_t const *ds = plugin_get_ds("bench");
+
+  for (uint64_t i = 0; i < iterations; i++)
+    BENCH_SINK(uc_update(ds, bench_vl_next(i)));
+}
+
+/* A write callback with "StoreRates" enabled: the rates are looked up right
+ * after the cache has been updated. */
+DEF_BENCH(uc_get_rate) {
+  data_set_t const *ds = plugin_get_ds("bench");
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    value_list_t *vl = bench_vl_next(i);
+
+    uc_update(ds, vl);
+    gauge_t *rates = uc_get_rate(ds, vl);
+    BENCH_SINK(rates != NULL);
+    sfree(rates);
+  }
+}
+
+/* "bench" match for the filter chain: matches if the value list's plugin
+ * instance equals the configured string. */
+static int bench_match_create(oconfig_item_t const *ci, void **user_data) {
+  if ((ci->children_num != 1) ||
+      (strcasecmp("PluginInstance", ci->children[0].key) != 0))
+    return -1;
+
+  char *instance = NULL;
+  int status = cf_util_get_string(ci->children, &instance);
+  if (status != 0)
+    return status;
+
+  *user_data = instance;
+  return 0;
+}
+
+static int bench_match_destroy(void **user_data) {
+  sfree(*user_data);
+  return 0;
+}
+
+static int bench_match(__attribute__((unused)) data_set_t const *ds,
+                       value_list_t const *vl,
+                       __attribute__((unused)) notification_meta_t **meta,
+                       void **user_data) {
+  return (strcmp(vl->plugin_instance, *user_data) == 0) ? FC_MATCH_MATCHES
+                                                         : FC_MATCH_NO_MATCH;
+}
+
+static bool bench_match_identifier_only(__attribute__((unused))
+                                        void **user_data) {
+  return true;
+}
+
+/* Creates the "bench" chain from a configuration file, like the daemon does. */
+static fc_chain_t *bench_chain_init(void) {
+  match_proc_t mproc = {
+      .create = bench_match_create,
+      .destroy = bench_match_destroy,
+      .match = bench_match,
+      .identifier_only = bench_match_identifier_only,
+  };
+  fc_register_match("bench", mproc);
+
+  char file[] = "/tmp/collectd-bench.XXXXXX";
+  int fd = mkstemp(file);
+  if (fd < 0)
+    return NULL;
+  FILE *fh = fdopen(fd, "w");
+  if (fh == NULL) {
+    close(fd);
+    unlink(file);
+    return NULL;
+  }
+
+  /* Ten rules, each of which matches one of the plugin instances. */
+  fprintf(fh, "<Chain \"bench\">\n");
+  for (int i = 0; i < 10; i++)
+    fprintf(fh, "  <Rule>\n"
+                "    <Match \"bench\">\n"
+                "      PluginInstance \"eth%d\"\n"
+                "    </Match>\n"
+                "    Target \"return\"\n"
+                "  </Rule>\n",
+            i);
+  fprintf(fh, "  Target \"stop\"\n"
+              "</Chain>\n");
+  fclose(fh);
+
+  oconfig_item_t *ci = oconfig_parse_file(file);
+  unlink(file);
+  if (ci == NULL)
+    return NULL;
+
+  for (int i = 0; i < ci->children_num; i++)
+    fc_configure(ci->children + i);
+  oconfig_free(ci);
+
+  return fc_chain_get_by_name("bench");
+}
+
+static fc_chain_t *bench_chain;
+
+DEF_BENCH(fc_process_chain) {
+  data_set_t const *ds = plugin_get_ds("bench");
+
+  for (uint64_t i = 0; i < iterations; i++)
+    BENCH_SINK(fc_process_chain(ds, bench_vl_next(i), bench_chain));
+}
+
+/* Same as above, but without the identifier the daemon computes when
+ * dispatching, so that the rules' decisions can't be cached. */
+DEF_BENCH(fc_process_chain_uncached) {
+  data_set_t const *ds = plugin_get_ds("bench");
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    value_list_t vl = *bench_vl_next(i);
+    vl.identifier.hash = 0;
+    BENCH_SINK(fc_process_chain(ds, &vl, bench_chain));
+  }
+}
+
+DEF_BENCH(plugin_dispatch_values) {
+  uint64_t start = plugin_bench_written();
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    value_list_t vl = *bench_vl_next(i);
+    vl.identifier.hash = 0;
+    plugin_dispatch_values(&vl);
+
+    if (((i % BENCH_PENDING) == 0) &&
+        (plugin_bench_wait(start + i + 1, BENCH_PENDING) != 0))
+      exit(1);
+  }
+
+  if (plugin_bench_wait(start + iterations, /* pending = */ 0) != 0)
+    exit(1);
+}
+
+int main(void) {
+  if (plugin_bench_init() != 0) {
+    fprintf(stderr, "plugin_bench_init failed\n");
+    return 1;
+  }
+  bench_vls_init();
+
+  bench_chain = bench_chain_init();
+  if (bench_chain == NULL) {
+    fprintf(stderr, "Creating the filter chain failed\n");
+    return 1;
+  }
+
+  RUN_BENCH(format_name, 2000000);
+  RUN_BENCH(parse_identifier, 2000000);
+  RUN_BENCH(uc_update, 1000000);
+  RUN_BENCH(uc_get_rate, 1000000);
+  RUN_BENCH(fc_process_chain, 1000000);
+  RUN_BENCH(fc_process_chain_uncached, 1000000);
+  RUN_BENCH(plugin_dispatch_values, 500000);
+
+  plugin_bench_shutdown();
+
+  END_BENCH;
+}
@@ -30,7 +30,9 @@
 #include "configfile.h"
 #include "filter_chain.h"
 #include "plugin.h"
+#include "utils_atomic.h"
 #include "utils_complain.h"
+#include "utils_probe.h"
 
 /*
  * Data types
@@ -54,6 +56,7 @@ struct fc_target_s {
   char name[DATA_MAX_NAME_LEN];
   void *user_data;
   target_proc_t proc;
+  plugin_latency_t *latency; /* shared by all instances of a target type */
   fc_target_t *next;
 }; /* }}} */
 
@@ -67,6 +70,59 @@ struct fc_rule_s {
   fc_rule_t *next;
 }; /* }}} */
 
+/* Cache of a rule's match result by identifier, used for rules whose matches
+ * only depend on the identifier. Direct mapped by the identifier's hash. */
+#ifndef FC_DECISION_CACHE_SIZE
+#define FC_DECISION_CACHE_SIZE 1024 /* power of two */
+#endif
+struct fc_decision_s;
+typedef struct fc_decision_s fc_decision_t; /* {{{ */
+struct fc_decision_s {
+  char *name; /* vl->identifier.name; NULL if unused */
+  uint32_t hash;
+  /* The identifier's name doesn't tell where the plugin and type instances
+   * start, so the lengths of the plugin and type are part of the key. */
+  uint16_t plugin_len;
+  uint16_t type_len;
+  bool matches;
+}; /* }}} */
+
+struct fc_decision_cache_s;
+typedef struct fc_decision_cache_s fc_decision_cache_t; /* {{{ */
+struct fc_decision_cache_s {
+  pthread_mutex_t lock;
+  fc_decision_t entries[FC_DECISION_CACHE_SIZE];
+}; /* }}} */
+
+/* Chains are compiled into a flat program. Each rule becomes its matches
+ * followed by its targets; the chain's default targets come last. Only the
+ * first match of a rule is executed directly: it evaluates all of the rule's
+ * matches and continues either with the first target ("matched") or with the
+ * next rule ("next"). Jumps are resolved to the chain they refer to. */
+typedef enum {
+  FC_OP_MATCH,
+  FC_OP_TARGET,
+  FC_OP_JUMP,
+  FC_OP_STOP,
+  FC_OP_RETURN
+} fc_op_t;
+
+struct fc_insn_s;
+typedef struct fc_insn_s fc_insn_t; /* {{{ */
+struct fc_insn_s {
+  fc_op_t op;
+  bool is_default; /* one of the chain's default targets */
+  fc_rule_t *rule;
+  fc_match_t *match;   /* FC_OP_MATCH */
+  fc_target_t *target; /* FC_OP_TARGET, FC_OP_JUMP */
+  fc_chain_t *chain;   /* FC_OP_JUMP */
+
+  /* FC_OP_MATCH, first match of a rule only */
+  size_t matched;
+  size_t next;
+  fc_decision_cache_t *cache; /* may be NULL */
+}; /* }}} */
+
 /* List of chains, used for `chain_list_head' */
 struct fc_chain_s /* {{{ */
 {
@@ -74,6 +130,9 @@ struct fc_chain_s /* {{{ */
   fc_rule_t *rules;
   fc_target_t *targets;
   fc_chain_t *next;
+
+  fc_insn_t *program; /* NULL until compiled */
+  size_t program_len;
 }; /* }}} */
 
 /* Writer configuration. */
@@ -90,6 +149,12 @@ struct fc_writer_s {
 static fc_match_t *match_list_head;
 static fc_target_t *target_list_head;
 static fc_chain_t *chain_list_head;
+static pthread_mutex_t compile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Chains replaced by fc_reconfigure(). They are never freed, because dispatch
+ * threads may still be processing them. */
+static fc_chain_t **chains_retired;
+static size_t chains_retired_num;
 
 /*
  * Private functions
@@ -146,11 +211,32 @@ static void fc_free_rules(fc_rule_t *r) /* {{{ */
   free(r);
 } /* }}} void fc_free_rules */
 
+static void fc_free_decision_cache(fc_decision_cache_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return;
+
+  for (size_t i = 0; i < FC_DECISION_CACHE_SIZE; i++)
+    free(c->entries[i].name);
+  pthread_mutex_destroy(&c->lock);
+  free(c);
+} /* }}} void fc_free_decision_cache */
+
+static void fc_free_program(fc_chain_t *c) /* {{{ */
+{
+  for (size_t i = 0; i < c->program_len; i++)
+    fc_free_decision_cache(c->program[i].cache);
+  free(c->program);
+  c->program = NULL;
+  c->program_len = 0;
+} /* }}} void fc_free_program */
+
 static void fc_free_chains(fc_chain_t *c) /* {{{ */
 {
   if (c == NULL)
     return;
 
+  fc_free_program(c);
   fc_free_rules(c->rules);
   fc_free_targets(c->targets);
 
@@ -292,6 +378,7 @@ static int fc_config_add_target(fc_target_t **targets_head, /* {{{ */
 
   sstrncpy(t->name, ptr->name, sizeof(t->name));
   memcpy(&t->proc, &ptr->proc, sizeof(t->proc));
+  t->latency = ptr->latency;
   t->user_data = NULL;
   t->next = NULL;
 
@@ -396,8 +483,22 @@ static int fc_config_add_rule(fc_chain_t *chain, /* {{{ */
   return 0;
 } /* }}} int fc_config_add_rule */
 
-static int fc_config_add_chain(const oconfig_item_t *ci) /* {{{ */
-{
+static fc_chain_t *fc_chain_find(fc_chain_t *head, /* {{{ */
+                                 const char *chain_name) {
+  if (chain_name == NULL)
+    return NULL;
+
+  for (fc_chain_t *chain = head; chain != NULL; chain = chain->next)
+    if (strcasecmp(chain_name, chain->name) == 0)
+      return chain;
+
+  return NULL;
+} /* }}} fc_chain_t *fc_chain_find */
+
+/* Adds the chain to the list starting at `*head'. If a chain with the same
+ * name exists, the rules and targets are appended to it. */
+static int fc_config_add_chain(fc_chain_t **head, /* {{{ */
+                               const oconfig_item_t *ci) {
   fc_chain_t *chain = NULL;
   int status = 0;
   int new_chain = 1;
@@ -408,8 +509,8 @@ static int fc_config_add_chain(const oconfig_item_t *ci) /* {{{ */
     return -1;
   }
 
-  if (chain_list_head != NULL) {
-    if ((chain = fc_chain_get_by_name(ci->values[0].value.string)) != NULL)
+  if (*head != NULL) {
+    if ((chain = fc_chain_find(*head, ci->values[0].value.string)) != NULL)
       new_chain = 0;
   }
 
@@ -441,23 +542,25 @@ static int fc_config_add_chain(const oconfig_item_t *ci) /* {{{ */
   } /* for (ci->children) */
 
   if (status != 0) {
-    fc_free_chains(chain);
+    /* An existing chain is still linked into the list. */
+    if (new_chain)
+      fc_free_chains(chain);
     return -1;
   }
 
-  if (chain_list_head != NULL) {
+  if (*head != NULL) {
     if (!new_chain)
       return 0;
 
     fc_chain_t *ptr;
 
-    ptr = chain_list_head;
+    ptr = *head;
     while (ptr->next != NULL)
       ptr = ptr->next;
 
     ptr->next = chain;
   } else {
-    chain_list_head = chain;
+    *head = chain;
   }
 
   return 0;
@@ -523,10 +626,7 @@ static int fc_bit_jump_invoke(const data_set_t *ds, /* {{{ */
 
   chain_name = *user_data;
 
-  for (chain = chain_list_head; chain != NULL; chain = chain->next)
-    if (strcasecmp(chain_name, chain->name) == 0)
-      break;
-
+  chain = fc_chain_get_by_name(chain_name);
   if (chain == NULL) {
     ERROR("Filter subsystem: Built-in target `jump': There is no chain "
           "named `%s'.",
@@ -759,6 +859,16 @@ int fc_register_match(const char *name, match_proc_t proc) /* {{{ */
 } /* }}} int fc_register_match */
 
 /* Add a target to list of available targets. */
+/* The built-in targets don't modify the value list. Their execution time is
+ * dominated by the chains and writers they invoke, so it isn't recorded. */
+static bool fc_target_is_builtin(target_proc_t const *proc) /* {{{ */
+{
+  return (proc->invoke == fc_bit_jump_invoke) ||
+         (proc->invoke == fc_bit_stop_invoke) ||
+         (proc->invoke == fc_bit_return_invoke) ||
+         (proc->invoke == fc_bit_write_invoke);
+} /* }}} bool fc_target_is_builtin */
+
 int fc_register_target(const char *name, target_proc_t proc) /* {{{ */
 {
   fc_target_t *t;
@@ -771,6 +881,8 @@ int fc_register_target(const char *name, target_proc_t proc) /* {{{ */
 
   sstrncpy(t->name, name, sizeof(t->name));
   memcpy(&t->proc, &proc, sizeof(t->proc));
+  if (!fc_target_is_builtin(&t->proc))
+    t->latency = plugin_latency_register("target", name);
 
   if (target_list_head == NULL) {
     target_list_head = t;
@@ -789,128 +901,310 @@ int fc_register_target(const char *name, target_proc_t proc) /* {{{ */
 
 fc_chain_t *fc_chain_get_by_name(const char *chain_name) /* {{{ */
 {
-  if (chain_name == NULL)
-    return NULL;
+  return fc_chain_find(C_ATOMIC_LOAD_ACQ(&chain_list_head), chain_name);
+} /* }}} int fc_chain_get_by_name */
 
-  for (fc_chain_t *chain = chain_list_head; chain != NULL; chain = chain->next)
-    if (strcasecmp(chain_name, chain->name) == 0)
-      return chain;
+/* Invokes a target. Targets other than the built-in ones may change the value
+ * list's host, plugin or type fields, so the interned identifier is updated
+ * afterwards. */
+static int fc_target_invoke(fc_target_t *target, /* {{{ */
+                            const data_set_t *ds, value_list_t *vl) {
+  if (fc_target_is_builtin(&target->proc))
+    /* FIXME: Pass the meta-data to match targets here (when implemented). */
+    return (*target->proc.invoke)(ds, vl, /* meta = */ NULL,
+                                  &target->user_data);
 
-  return NULL;
-} /* }}} int fc_chain_get_by_name */
+  cdtime_t start = plugin_latency_start();
+  int status =
+      (*target->proc.invoke)(ds, vl, /* meta = */ NULL, &target->user_data);
+  plugin_latency_stop(target->latency, start);
 
-int fc_process_chain(const data_set_t *ds, value_list_t *vl, /* {{{ */
-                     fc_chain_t *chain) {
-  fc_target_t *target;
-  int status = FC_TARGET_CONTINUE;
+  if (vl->identifier.hash != 0)
+    identifier_update(vl);
 
-  if (chain == NULL)
-    return -1;
+  return status;
+} /* }}} int fc_target_invoke */
 
-  DEBUG("fc_process_chain (chain = %s);", chain->name);
+static fc_decision_cache_t *fc_decision_cache_create(void) /* {{{ */
+{
+  fc_decision_cache_t *c = calloc(1, sizeof(*c));
+  if (c == NULL)
+    return NULL;
+
+  pthread_mutex_init(&c->lock, /* attr = */ NULL);
+  return c;
+} /* }}} fc_decision_cache_t *fc_decision_cache_create */
+
+static fc_decision_t *fc_decision_entry(fc_decision_cache_t *c, /* {{{ */
+                                        value_list_t const *vl) {
+  return c->entries + (vl->identifier.hash & (FC_DECISION_CACHE_SIZE - 1));
+} /* }}} fc_decision_t *fc_decision_entry */
+
+/* Returns true and sets `matches' if the cache holds a decision for `vl'. The
+ * cache is only an optimization, so it is skipped if another thread holds the
+ * lock. */
+static bool fc_decision_lookup(fc_decision_cache_t *c, /* {{{ */
+                               value_list_t const *vl, bool *matches) {
+  if (pthread_mutex_trylock(&c->lock) != 0)
+    return false;
+
+  fc_decision_t *d = fc_decision_entry(c, vl);
+  bool found = (d->name != NULL) && (d->hash == vl->identifier.hash) &&
+               (d->plugin_len == strlen(vl->plugin)) &&
+               (d->type_len == strlen(vl->type)) &&
+               (strcmp(d->name, vl->identifier.name) == 0);
+  if (found)
+    *matches = d->matches;
+
+  pthread_mutex_unlock(&c->lock);
+  return found;
+} /* }}} bool fc_decision_lookup */
+
+static void fc_decision_store(fc_decision_cache_t *c, /* {{{ */
+                              value_list_t const *vl, bool matches) {
+  char *name = strdup(vl->identifier.name);
+  if (name == NULL)
+    return;
+
+  pthread_mutex_lock(&c->lock);
+  fc_decision_t *d = fc_decision_entry(c, vl);
+  free(d->name);
+  *d = (fc_decision_t){
+      .name = name,
+      .hash = vl->identifier.hash,
+      .plugin_len = (uint16_t)strlen(vl->plugin),
+      .type_len = (uint16_t)strlen(vl->type),
+      .matches = matches,
+  };
+  pthread_mutex_unlock(&c->lock);
+} /* }}} void fc_decision_store */
+
+static size_t fc_program_len(fc_chain_t const *chain) /* {{{ */
+{
+  size_t len = 0;
 
   for (fc_rule_t *rule = chain->rules; rule != NULL; rule = rule->next) {
-    fc_match_t *match;
-    status = FC_TARGET_CONTINUE;
+    /* Rules without targets have no effect. */
+    if (rule->targets == NULL)
+      continue;
+    for (fc_match_t *m = rule->matches; m != NULL; m = m->next)
+      len++;
+    for (fc_target_t *t = rule->targets; t != NULL; t = t->next)
+      len++;
+  }
 
-    if (rule->name[0] != 0) {
-      DEBUG("fc_process_chain (%s): Testing the `%s' rule.", chain->name,
-            rule->name);
+  for (fc_target_t *t = chain->targets; t != NULL; t = t->next)
+    len++;
+
+  return len;
+} /* }}} size_t fc_program_len */
+
+/* Appends the targets starting at `t' to the program. Targets following a
+ * "stop" or "return" target can't be reached and are omitted. */
+static size_t fc_compile_targets(fc_chain_t *head, /* {{{ */
+                                 fc_chain_t const *chain, fc_insn_t *program,
+                                 size_t pc, fc_rule_t *rule, fc_target_t *t) {
+  for (; t != NULL; t = t->next) {
+    fc_insn_t *insn = program + pc;
+    pc++;
+
+    *insn = (fc_insn_t){
+        .op = FC_OP_TARGET, .is_default = (rule == NULL), .rule = rule,
+        .target = t,
+    };
+
+    if (t->proc.invoke == fc_bit_jump_invoke) {
+      insn->chain = fc_chain_find(head, t->user_data);
+      /* Otherwise, the target logs the error when it is invoked. */
+      if (insn->chain != NULL)
+        insn->op = FC_OP_JUMP;
+      else
+        WARNING("Filter subsystem: Chain %s: Built-in target `jump': There "
+                "is no chain named `%s'.",
+                chain->name, (char *)t->user_data);
+    } else if (t->proc.invoke == fc_bit_stop_invoke) {
+      insn->op = FC_OP_STOP;
+      break;
+    } else if (t->proc.invoke == fc_bit_return_invoke) {
+      insn->op = FC_OP_RETURN;
+      break;
     }
+  }
 
-    /* N. B.: rule->matches may be NULL. */
-    for (match = rule->matches; match != NULL; match = match->next) {
-      /* FIXME: Pass the meta-data to match targets here (when implemented). */
-      status =
-          (*match->proc.match)(ds, vl, /* meta = */ NULL, &match->user_data);
-      if (status < 0) {
-        WARNING("fc_process_chain (%s): A match failed.", chain->name);
-        break;
-      } else if (status != FC_MATCH_MATCHES)
-        break;
-    }
+  return pc;
+} /* }}} size_t fc_compile_targets */
 
-    /* for-loop has been aborted: Either error or no match. */
-    if (match != NULL) {
-      status = FC_TARGET_CONTINUE;
+/* Must be called with `compile_lock' held. Jumps are resolved to the chains
+ * in the list starting at `head'. */
+static int fc_chain_compile(fc_chain_t *head, fc_chain_t *chain) /* {{{ */
+{
+  if (chain->program != NULL)
+    return 0;
+
+  /* A chain without rules and targets still gets a (one element) program, so
+   * it isn't compiled again. */
+  size_t len = fc_program_len(chain);
+  fc_insn_t *program = calloc((len > 0) ? len : 1, sizeof(*program));
+  if (program == NULL) {
+    ERROR("fc_chain_compile: calloc failed.");
+    return -1;
+  }
+
+  size_t pc = 0;
+  for (fc_rule_t *rule = chain->rules; rule != NULL; rule = rule->next) {
+    if (rule->targets == NULL)
       continue;
-    }
 
-    if (rule->name[0] != 0) {
-      DEBUG("fc_process_chain (%s): Rule `%s' matches.", chain->name,
-            rule->name);
-    }
+    size_t first = pc;
+    bool identifier_only = true;
+    for (fc_match_t *m = rule->matches; m != NULL; m = m->next) {
+      program[pc] = (fc_insn_t){.op = FC_OP_MATCH, .rule = rule, .match = m};
+      pc++;
 
-    for (target = rule->targets; target != NULL; target = target->next) {
-      /* If we get here, all matches have matched the value. Execute the
-       * target. */
-      /* FIXME: Pass the meta-data to match targets here (when implemented). */
-      status =
-          (*target->proc.invoke)(ds, vl, /* meta = */ NULL, &target->user_data);
-      if (status < 0) {
-        WARNING("fc_process_chain (%s): A target failed.", chain->name);
-        continue;
-      } else if (status == FC_TARGET_CONTINUE)
-        continue;
-      else if (status == FC_TARGET_STOP)
-        break;
-      else if (status == FC_TARGET_RETURN)
-        break;
-      else {
-        WARNING("fc_process_chain (%s): Unknown return value "
-                "from target `%s': %i",
-                chain->name, target->name, status);
-      }
+      if ((m->proc.identifier_only == NULL) ||
+          !(*m->proc.identifier_only)(&m->user_data))
+        identifier_only = false;
     }
 
-    if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN)) {
-      if (rule->name[0] != 0) {
-        DEBUG("fc_process_chain (%s): Rule `%s' signaled "
-              "the %s condition.",
-              chain->name, rule->name,
-              (status == FC_TARGET_STOP) ? "stop" : "return");
-      }
-      break;
+    /* A rule without matches always matches; no FC_OP_MATCH needed. */
+    size_t matched = pc;
+    pc = fc_compile_targets(head, chain, program, pc, rule, rule->targets);
+
+    if (first < matched) {
+      program[first].matched = matched;
+      program[first].next = pc;
+      if (identifier_only)
+        program[first].cache = fc_decision_cache_create();
     }
-  } /* for (rule) */
+  }
+  pc = fc_compile_targets(head, chain, program, pc, /* rule = */ NULL,
+                          chain->targets);
 
-  if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN))
-    return status;
+  chain->program_len = pc;
+  C_ATOMIC_STORE_REL(&chain->program, program);
+
+  DEBUG("fc_chain_compile (%s): compiled to %" PRIsz " instructions.",
+        chain->name, pc);
+  return 0;
+} /* }}} int fc_chain_compile */
+
+int fc_compile(void) /* {{{ */
+{
+  int status = 0;
+
+  pthread_mutex_lock(&compile_lock);
+  for (fc_chain_t *chain = chain_list_head; chain != NULL; chain = chain->next)
+    if (fc_chain_compile(chain_list_head, chain) != 0)
+      status = -1;
+  pthread_mutex_unlock(&compile_lock);
+
+  return status;
+} /* }}} int fc_compile */
 
-  DEBUG("fc_process_chain (%s): Executing the default targets.", chain->name);
+/* Evaluates the matches of the rule starting at `insn'. */
+static bool fc_rule_matches(fc_chain_t const *chain, /* {{{ */
+                            fc_insn_t const *insn, const data_set_t *ds,
+                            value_list_t const *vl, bool *cacheable) {
+  fc_insn_t const *end = chain->program + insn->matched;
+
+  for (; insn < end; insn++) {
+    fc_match_t *match = insn->match;
 
-  status = FC_TARGET_CONTINUE;
-  for (target = chain->targets; target != NULL; target = target->next) {
-    /* If we get here, all matches have matched the value. Execute the
-     * target. */
     /* FIXME: Pass the meta-data to match targets here (when implemented). */
-    status =
-        (*target->proc.invoke)(ds, vl, /* meta = */ NULL, &target->user_data);
+    int status =
+        (*match->proc.match)(ds, vl, /* meta = */ NULL, &match->user_data);
     if (status < 0) {
-      WARNING("fc_process_chain (%s): The default target failed.", chain->name);
-    } else if (status == FC_TARGET_CONTINUE)
+      WARNING("fc_process_chain (%s): A match failed.", chain->name);
+      *cacheable = false;
+      return false;
+    } else if (status != FC_MATCH_MATCHES)
+      return false;
+  }
+
+  return true;
+} /* }}} bool fc_rule_matches */
+
+int fc_process_chain(const data_set_t *ds, value_list_t *vl, /* {{{ */
+                     fc_chain_t *chain) {
+  if (chain == NULL)
+    return -1;
+
+  fc_insn_t *program = C_ATOMIC_LOAD_ACQ(&chain->program);
+  if (program == NULL) {
+    pthread_mutex_lock(&compile_lock);
+    int status = fc_chain_compile(chain_list_head, chain);
+    pthread_mutex_unlock(&compile_lock);
+    if (status != 0)
+      return -1;
+    program = chain->program;
+  }
+
+  DEBUG("fc_process_chain (chain = %s);", chain->name);
+
+  size_t pc = 0;
+  while (pc < chain->program_len) {
+    fc_insn_t *insn = program + pc;
+    int status;
+
+    switch (insn->op) {
+    case FC_OP_MATCH: {
+      bool matches;
+      bool cacheable = (insn->cache != NULL) && (vl->identifier.hash != 0);
+
+      if (!cacheable || !fc_decision_lookup(insn->cache, vl, &matches)) {
+        matches = fc_rule_matches(chain, insn, ds, vl, &cacheable);
+        if (cacheable)
+          fc_decision_store(insn->cache, vl, matches);
+      }
+      C_PROBE3(filter__match, chain->name, insn->rule->name, matches);
+
+      if (insn->rule->name[0] != 0)
+        DEBUG("fc_process_chain (%s): Rule `%s' %s.", chain->name,
+              insn->rule->name, matches ? "matches" : "does not match");
+
+      pc = matches ? insn->matched : insn->next;
       continue;
-    else if (status == FC_TARGET_STOP)
+    }
+    case FC_OP_TARGET:
+      status = fc_target_invoke(insn->target, ds, vl);
+      C_PROBE3(filter__target, chain->name, insn->target->name, status);
       break;
-    else if (status == FC_TARGET_RETURN)
+    case FC_OP_JUMP:
+      status = fc_process_chain(ds, vl, insn->chain);
+      if ((status >= 0) && (status != FC_TARGET_STOP))
+        status = FC_TARGET_CONTINUE;
       break;
-    else {
+    case FC_OP_STOP:
+      status = FC_TARGET_STOP;
+      break;
+    case FC_OP_RETURN:
+      status = FC_TARGET_RETURN;
+      break;
+    default:
+      status = -1;
+    }
+
+    if (status < 0) {
+      if (insn->is_default)
+        WARNING("fc_process_chain (%s): The default target failed.",
+                chain->name);
+      else
+        WARNING("fc_process_chain (%s): A target failed.", chain->name);
+    } else if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN)) {
+      DEBUG("fc_process_chain (%s): Target `%s' signaled the %s condition.",
+            chain->name, insn->target->name,
+            (status == FC_TARGET_STOP) ? "stop" : "return");
+      /* "return" in a default target only ends this chain. */
+      if (insn->is_default && (status == FC_TARGET_RETURN))
+        return FC_TARGET_CONTINUE;
+      return status;
+    } else if (status != FC_TARGET_CONTINUE) {
       WARNING("fc_process_chain (%s): Unknown return value "
               "from target `%s': %i",
-              chain->name, target->name, status);
+              chain->name, insn->target->name, status);
     }
-  }
 
-  if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN)) {
-    assert(target != NULL);
-    DEBUG("fc_process_chain (%s): Default target `%s' signaled "
-          "the %s condition.",
-          chain->name, target->name,
-          (status == FC_TARGET_STOP) ? "stop" : "return");
-    if (status == FC_TARGET_STOP)
-      return FC_TARGET_STOP;
-    else
-      return FC_TARGET_CONTINUE;
+    pc++;
   }
 
   DEBUG("fc_process_chain (%s): Signaling `continue' at end of chain.",
@@ -935,9 +1229,56 @@ int fc_configure(const oconfig_item_t *ci) /* {{{ */
     return -EINVAL;
 
   if (strcasecmp("Chain", ci->key) == 0)
-    return fc_config_add_chain(ci);
+    return fc_config_add_chain(&chain_list_head, ci);
 
   WARNING("Filter subsystem: Unknown top level config option `%s'.", ci->key);
 
   return -1;
 } /* }}} int fc_configure */
+
+int fc_reconfigure(const oconfig_item_t *root) /* {{{ */
+{
+  fc_chain_t *head = NULL;
+  int status = 0;
+
+  fc_init_once();
+
+  for (int i = 0; (status == 0) && (i < root->children_num); i++) {
+    oconfig_item_t const *ci = root->children + i;
+
+    /* Like cf_read(), only blocks are dispatched to the filter chains. */
+    if ((ci->children != NULL) && (strcasecmp("Chain", ci->key) == 0))
+      status = fc_config_add_chain(&head, ci);
+  }
+
+  fc_chain_t **tmp = realloc(chains_retired, (chains_retired_num + 1) *
+                                                 sizeof(*chains_retired));
+  if (tmp == NULL) {
+    ERROR("fc_reconfigure: realloc failed.");
+    status = -1;
+  } else {
+    chains_retired = tmp;
+  }
+
+  pthread_mutex_lock(&compile_lock);
+  for (fc_chain_t *chain = head; (status == 0) && (chain != NULL);
+       chain = chain->next)
+    status = fc_chain_compile(head, chain);
+
+  if (status != 0) {
+    pthread_mutex_unlock(&compile_lock);
+    ERROR("Filter subsystem: Configuring the new chains failed. "
+          "Keeping the current chains.");
+    fc_free_chains(head);
+    return -1;
+  }
+
+  if (chain_list_head != NULL) {
+    chains_retired[chains_retired_num] = chain_list_head;
+    chains_retired_num++;
+  }
+  C_ATOMIC_STORE_REL(&chain_list_head, head);
+  pthread_mutex_unlock(&compile_lock);
+
+  return 0;
+} /* }}} int fc_reconfigure */
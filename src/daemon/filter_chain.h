@@ -46,6 +46,10 @@ struct match_proc_s {
   int (*destroy)(void **user_data);
   int (*match)(const data_set_t *ds, const value_list_t *vl,
                notification_meta_t **meta, void **user_data);
+  /* Optional. Returns true if the result of "match" only depends on the
+   * identifier (host, plugin, plugin instance, type and type instance) of the
+   * value list. The results of rules consisting of such matches are cached. */
+  bool (*identifier_only)(void **user_data);
 };
 typedef struct match_proc_s match_proc_t;
 
@@ -91,6 +95,11 @@ int fc_rule_delete (const char *chain_name, int position);
  */
 fc_chain_t *fc_chain_get_by_name(const char *chain_name);
 
+/* Compiles all chains into the form used by fc_process_chain(). Called once
+ * the configuration has been read, so that all jump targets are known; chains
+ * not compiled by then are compiled when they are first processed. */
+int fc_compile(void);
+
 int fc_process_chain(const data_set_t *ds, value_list_t *vl, fc_chain_t *chain);
 
 int fc_default_action(const data_set_t *ds, value_list_t *vl);
@@ -100,4 +109,10 @@ int fc_default_action(const data_set_t *ds, value_list_t *vl);
  */
 int fc_configure(const oconfig_item_t *ci);
 
+/* Replaces all chains with the <Chain> blocks below `root'. The new chains are
+ * compiled before they replace the current ones; if any of them can't be
+ * configured, the current chains remain in place. The previous chains are
+ * retired, not freed, so threads still processing them are not affected. */
+int fc_reconfigure(const oconfig_item_t *root);
+
 #endif /* FILTER_CHAIN_H */
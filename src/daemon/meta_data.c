@@ -30,8 +30,19 @@
 #include "meta_data.h"
 #include "plugin.h"
 
+#include "utils_atomic.h"
+#include "utils_memstats.h"
+
 #define MD_MAX_NONSTRING_CHARS 128
 
+/* Number of entries stored inside the meta_data_store_t itself. Meta data
+ * with more entries moves the array to the heap. */
+#define MD_INLINE_ENTRIES 4
+
+/* Upper bound for the number of interned keys. Keys seen after the table is
+ * full are copied into each entry instead. */
+#define MD_INTERN_MAX 4096
+
 /*
  * Data types
  */
@@ -47,17 +58,44 @@ typedef union meta_value_u meta_value_t;
 struct meta_entry_s;
 typedef struct meta_entry_s meta_entry_t;
 struct meta_entry_s {
-  char *key;
+  const char *key; /* interned, unless key_owned is set */
   meta_value_t value;
   int type;
-  meta_entry_t *next;
+  bool key_owned;
+};
+
+/* The entries of one or more meta_data_t objects. A store that is referenced
+ * by more than one meta_data_t is never modified: the first write through
+ * any of them copies the store first. */
+struct meta_data_store_s;
+typedef struct meta_data_store_s meta_data_store_t;
+struct meta_data_store_s {
+  int refs;
+  size_t num;
+  size_t size;
+  meta_entry_t *entries;
+  meta_entry_t inline_entries[MD_INLINE_ENTRIES];
 };
 
 struct meta_data_s {
-  meta_entry_t *head;
-  pthread_mutex_t lock;
+  meta_data_store_t *store; /* NULL if there are no entries */
 };
 
+struct md_intern_s;
+typedef struct md_intern_s md_intern_t;
+struct md_intern_s {
+  md_intern_t *next;
+  uint32_t hash;
+  char key[];
+};
+
+static md_intern_t **md_intern_table;
+static size_t md_intern_size;
+static size_t md_intern_num;
+static pthread_rwlock_t md_intern_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static memstat_t *md_memstat;
+
 /*
  * Private functions
  */
@@ -79,205 +117,328 @@ static char *md_strdup(const char *orig) /* {{{ */
   return dest;
 } /* }}} char *md_strdup */
 
-static meta_entry_t *md_entry_alloc(const char *key) /* {{{ */
+/* Accounts the memory of all meta data: the meta_data_t objects, their stores,
+ * owned keys and string values, and the intern table. */
+static void md_account(int64_t bytes, int64_t objects) /* {{{ */
 {
-  meta_entry_t *e;
+  memstat_add(memstat_lazy(&md_memstat, "meta_data"), bytes, objects);
+} /* }}} void md_account */
 
-  e = calloc(1, sizeof(*e));
-  if (e == NULL) {
-    ERROR("md_entry_alloc: calloc failed.");
-    return NULL;
-  }
+static int64_t md_value_bytes(int type, meta_value_t value) /* {{{ */
+{
+  if ((type != MD_TYPE_STRING) || (value.mv_string == NULL))
+    return 0;
+  return (int64_t)strlen(value.mv_string) + 1;
+} /* }}} int64_t md_value_bytes */
 
-  e->key = md_strdup(key);
-  if (e->key == NULL) {
-    free(e);
-    ERROR("md_entry_alloc: md_strdup failed.");
-    return NULL;
-  }
+static int64_t md_entry_bytes(const meta_entry_t *e) /* {{{ */
+{
+  int64_t bytes = md_value_bytes(e->type, e->value);
+  if (e->key_owned)
+    bytes += (int64_t)strlen(e->key) + 1;
+  return bytes;
+} /* }}} int64_t md_entry_bytes */
 
-  e->type = 0;
-  e->next = NULL;
+static uint32_t md_key_hash(const char *key) /* {{{ */
+{
+  uint32_t hash = 2166136261u;
 
-  return e;
-} /* }}} meta_entry_t *md_entry_alloc */
+  for (const unsigned char *p = (const unsigned char *)key; *p != 0; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
 
-/* XXX: The lock on md must be held while calling this function! */
-static meta_entry_t *md_entry_clone_contents(const meta_entry_t *orig) /* {{{ */
+  return hash;
+} /* }}} uint32_t md_key_hash */
+
+/* XXX: The write lock on md_intern_lock must be held! */
+static int md_intern_grow(void) /* {{{ */
 {
-  meta_entry_t *copy;
+  size_t new_size = (md_intern_size == 0) ? 64 : 2 * md_intern_size;
+  md_intern_t **new_table = calloc(new_size, sizeof(*new_table));
+  if (new_table == NULL)
+    return ENOMEM;
+
+  for (size_t i = 0; i < md_intern_size; i++) {
+    md_intern_t *this = md_intern_table[i];
+    while (this != NULL) {
+      md_intern_t *next = this->next;
+      size_t idx = this->hash & (new_size - 1);
+
+      this->next = new_table[idx];
+      new_table[idx] = this;
+      this = next;
+    }
+  }
 
-  /* WARNINGS :
-   *  - we do not check that orig != NULL here. You should have done it before.
-   *  - we do not set copy->next. DO NOT FORGET TO SET copy->next IN YOUR
-   * FUNCTION
-   */
+  free(md_intern_table);
+  md_account((int64_t)((new_size - md_intern_size) * sizeof(*new_table)), 0);
+  md_intern_table = new_table;
+  md_intern_size = new_size;
+  return 0;
+} /* }}} int md_intern_grow */
 
-  copy = md_entry_alloc(orig->key);
-  if (copy == NULL)
+/* XXX: A lock on md_intern_lock must be held! */
+static const char *md_intern_find(const char *key, uint32_t hash) /* {{{ */
+{
+  if (md_intern_size == 0)
     return NULL;
-  copy->type = orig->type;
-  if (copy->type == MD_TYPE_STRING)
-    copy->value.mv_string = strdup(orig->value.mv_string);
-  else
-    copy->value = orig->value;
 
-  return copy;
-} /* }}} meta_entry_t *md_entry_clone_contents */
+  for (md_intern_t *this = md_intern_table[hash & (md_intern_size - 1)];
+       this != NULL; this = this->next)
+    if ((this->hash == hash) && (strcmp(this->key, key) == 0))
+      return this->key;
+
+  return NULL;
+} /* }}} const char *md_intern_find */
 
-static meta_entry_t *md_entry_clone(const meta_entry_t *orig) /* {{{ */
+/* Returns the interned copy of "key". Interned keys are never freed. If the
+ * intern table is full, a private copy is returned and "owned" is set. */
+static const char *md_intern(const char *key, bool *owned) /* {{{ */
 {
-  meta_entry_t *copy;
+  uint32_t hash = md_key_hash(key);
+  const char *ret;
+
+  *owned = false;
+
+  pthread_rwlock_rdlock(&md_intern_lock);
+  ret = md_intern_find(key, hash);
+  pthread_rwlock_unlock(&md_intern_lock);
+  if (ret != NULL)
+    return ret;
+
+  pthread_rwlock_wrlock(&md_intern_lock);
+  ret = md_intern_find(key, hash);
+  if (ret != NULL) {
+    pthread_rwlock_unlock(&md_intern_lock);
+    return ret;
+  }
 
-  if (orig == NULL)
+  if ((md_intern_num >= MD_INTERN_MAX) ||
+      ((md_intern_num >= md_intern_size) && (md_intern_grow() != 0))) {
+    pthread_rwlock_unlock(&md_intern_lock);
+    *owned = true;
+    return md_strdup(key);
+  }
+
+  size_t len = strlen(key);
+  md_intern_t *new = malloc(sizeof(*new) + len + 1);
+  if (new == NULL) {
+    pthread_rwlock_unlock(&md_intern_lock);
     return NULL;
+  }
+  new->hash = hash;
+  memcpy(new->key, key, len + 1);
+  md_account((int64_t)(sizeof(*new) + len + 1), 0);
 
-  copy = md_entry_clone_contents(orig);
+  size_t idx = hash & (md_intern_size - 1);
+  new->next = md_intern_table[idx];
+  md_intern_table[idx] = new;
+  md_intern_num++;
 
-  copy->next = md_entry_clone(orig->next);
-  return copy;
-} /* }}} meta_entry_t *md_entry_clone */
+  pthread_rwlock_unlock(&md_intern_lock);
+  return new->key;
+} /* }}} const char *md_intern */
 
-static void md_entry_free(meta_entry_t *e) /* {{{ */
+static void md_entry_clear(meta_entry_t *e) /* {{{ */
 {
-  if (e == NULL)
-    return;
-
-  free(e->key);
-
+  md_account(-md_entry_bytes(e), 0);
+  if (e->key_owned)
+    free((char *)e->key);
   if (e->type == MD_TYPE_STRING)
     free(e->value.mv_string);
+} /* }}} void md_entry_clear */
 
-  if (e->next != NULL)
-    md_entry_free(e->next);
+static int md_entry_copy(meta_entry_t *dest, /* {{{ */
+                         const meta_entry_t *src) {
+  *dest = *src;
 
-  free(e);
-} /* }}} void md_entry_free */
+  if (src->key_owned) {
+    dest->key = md_strdup(src->key);
+    if (dest->key == NULL)
+      return -ENOMEM;
+  }
 
-static int md_entry_insert(meta_data_t *md, meta_entry_t *e) /* {{{ */
-{
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  if (src->type == MD_TYPE_STRING) {
+    dest->value.mv_string = md_strdup(src->value.mv_string);
+    if (dest->value.mv_string == NULL) {
+      if (dest->key_owned)
+        free((char *)dest->key);
+      return -ENOMEM;
+    }
+  }
 
-  if ((md == NULL) || (e == NULL))
-    return -EINVAL;
+  md_account(md_entry_bytes(dest), 0);
+  return 0;
+} /* }}} int md_entry_copy */
 
-  pthread_mutex_lock(&md->lock);
+static meta_data_store_t *md_store_alloc(void) /* {{{ */
+{
+  meta_data_store_t *s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL) {
-    if (strcasecmp(e->key, this->key) == 0)
-      break;
+  s->refs = 1;
+  s->entries = s->inline_entries;
+  s->size = MD_INLINE_ENTRIES;
+  md_account((int64_t)sizeof(*s), 0);
 
-    prev = this;
-    this = this->next;
-  }
+  return s;
+} /* }}} meta_data_store_t *md_store_alloc */
 
-  if (this == NULL) {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else {
-      assert(prev != NULL);
-      prev->next = e;
-    }
+static void md_store_release(meta_data_store_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  if (C_ATOMIC_SUB(&s->refs, 1) > 0)
+    return;
 
-    e->next = NULL;
-  } else /* (this != NULL) */
-  {
-    if (prev == NULL)
-      md->head = e;
-    else
-      prev->next = e;
+  for (size_t i = 0; i < s->num; i++)
+    md_entry_clear(s->entries + i);
 
-    e->next = this->next;
+  int64_t bytes = (int64_t)sizeof(*s);
+  if (s->entries != s->inline_entries) {
+    bytes += (int64_t)(s->size * sizeof(*s->entries));
+    free(s->entries);
   }
+  free(s);
+  md_account(-bytes, 0);
+} /* }}} void md_store_release */
 
-  pthread_mutex_unlock(&md->lock);
+static int md_store_reserve(meta_data_store_t *s, size_t num) /* {{{ */
+{
+  if (num <= s->size)
+    return 0;
 
-  if (this != NULL) {
-    this->next = NULL;
-    md_entry_free(this);
+  size_t new_size = 2 * s->size;
+  while (new_size < num)
+    new_size *= 2;
+
+  meta_entry_t *new_entries;
+  if (s->entries == s->inline_entries) {
+    new_entries = malloc(new_size * sizeof(*new_entries));
+    if (new_entries != NULL)
+      memcpy(new_entries, s->inline_entries, s->num * sizeof(*new_entries));
+  } else {
+    new_entries = realloc(s->entries, new_size * sizeof(*new_entries));
   }
+  if (new_entries == NULL)
+    return -ENOMEM;
 
+  size_t old_size = (s->entries == s->inline_entries) ? 0 : s->size;
+  md_account((int64_t)((new_size - old_size) * sizeof(*new_entries)), 0);
+  s->entries = new_entries;
+  s->size = new_size;
   return 0;
-} /* }}} int md_entry_insert */
+} /* }}} int md_store_reserve */
 
-/* XXX: The lock on md must be held while calling this function! */
-static int md_entry_insert_clone(meta_data_t *md, meta_entry_t *orig) /* {{{ */
+/* Returns a store owned exclusively by md, copying a shared store first. */
+static meta_data_store_t *md_store_writable(meta_data_t *md) /* {{{ */
 {
-  meta_entry_t *e;
-  meta_entry_t *this;
-  meta_entry_t *prev;
-
-  /* WARNINGS :
-   *  - we do not check that md and e != NULL here. You should have done it
-   * before.
-   *  - we do not use the lock. You should have set it before.
-   */
-
-  e = md_entry_clone_contents(orig);
-
-  prev = NULL;
-  this = md->head;
-  while (this != NULL) {
-    if (strcasecmp(e->key, this->key) == 0)
-      break;
+  meta_data_store_t *orig = md->store;
 
-    prev = this;
-    this = this->next;
+  if (orig == NULL) {
+    md->store = md_store_alloc();
+    return md->store;
   }
 
-  if (this == NULL) {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else {
-      assert(prev != NULL);
-      prev->next = e;
-    }
+  /* Only md itself could add another reference, so a count of one can't
+   * change under our feet. */
+  if (C_ATOMIC_LOAD(&orig->refs) == 1)
+    return orig;
 
-    e->next = NULL;
-  } else /* (this != NULL) */
-  {
-    if (prev == NULL)
-      md->head = e;
-    else
-      prev->next = e;
+  meta_data_store_t *copy = md_store_alloc();
+  if (copy == NULL)
+    return NULL;
 
-    e->next = this->next;
+  if (md_store_reserve(copy, orig->num) != 0) {
+    md_store_release(copy);
+    return NULL;
   }
 
-  if (this != NULL) {
-    this->next = NULL;
-    md_entry_free(this);
+  for (size_t i = 0; i < orig->num; i++) {
+    if (md_entry_copy(copy->entries + i, orig->entries + i) != 0) {
+      md_store_release(copy);
+      return NULL;
+    }
+    copy->num++;
   }
 
-  return 0;
-} /* }}} int md_entry_insert_clone */
+  md->store = copy;
+  md_store_release(orig);
+  return copy;
+} /* }}} meta_data_store_t *md_store_writable */
 
-/* XXX: The lock on md must be held while calling this function! */
 static meta_entry_t *md_entry_lookup(meta_data_t *md, /* {{{ */
                                      const char *key) {
-  meta_entry_t *e;
-
-  if ((md == NULL) || (key == NULL))
+  if ((md == NULL) || (key == NULL) || (md->store == NULL))
     return NULL;
 
-  for (e = md->head; e != NULL; e = e->next)
-    if (strcasecmp(key, e->key) == 0)
-      break;
+  for (size_t i = 0; i < md->store->num; i++) {
+    meta_entry_t *e = md->store->entries + i;
+    if ((e->key == key) || (strcasecmp(key, e->key) == 0))
+      return e;
+  }
 
-  return e;
+  return NULL;
 } /* }}} meta_entry_t *md_entry_lookup */
 
+/* Sets "key" to "value". On success, ownership of a string value is passed to
+ * md; on failure, the caller keeps it. */
+static int md_entry_set(meta_data_t *md, const char *key, /* {{{ */
+                        int type, meta_value_t value) {
+  meta_data_store_t *s = md_store_writable(md);
+  if (s == NULL)
+    return -ENOMEM;
+
+  meta_entry_t *e = md_entry_lookup(md, key);
+  if ((e != NULL) && (strcmp(e->key, key) == 0)) {
+    /* Same spelling: keep the key. */
+    md_account(md_value_bytes(type, value) - md_value_bytes(e->type, e->value),
+               0);
+    if (e->type == MD_TYPE_STRING)
+      free(e->value.mv_string);
+    e->value = value;
+    e->type = type;
+    return 0;
+  }
+
+  bool key_owned;
+  const char *k = md_intern(key, &key_owned);
+  if (k == NULL)
+    return -ENOMEM;
+
+  if (e == NULL) {
+    if (md_store_reserve(s, s->num + 1) != 0) {
+      if (key_owned)
+        free((char *)k);
+      return -ENOMEM;
+    }
+    e = s->entries + s->num;
+    s->num++;
+  } else {
+    md_entry_clear(e);
+  }
+
+  e->key = k;
+  e->key_owned = key_owned;
+  e->value = value;
+  e->type = type;
+  md_account(md_entry_bytes(e), 0);
+  return 0;
+} /* }}} int md_entry_set */
+
 /*
  * Each value_list_t*, as it is going through the system, is handled by exactly
  * one thread. Plugins which pass a value_list_t* to another thread, e.g. the
  * rrdtool plugin, must create a copy first. The meta data within a
  * value_list_t* is not thread safe and doesn't need to be.
  *
+ * Copies created by meta_data_clone() share their entries with the original
+ * until either of them is modified. Since shared entries are immutable, copies
+ * may be read and modified by different threads without locking.
+ *
  * The meta data associated with cache entries are a different story. There, we
  * need to ensure exclusive locking to prevent leaks and other funky business.
  * This is ensured by the uc_meta_data_get_*() functions.
@@ -295,8 +456,7 @@ meta_data_t *meta_data_create(void) /* {{{ */
     ERROR("meta_data_create: calloc failed.");
     return NULL;
   }
-
-  pthread_mutex_init(&md->lock, /* attr = */ NULL);
+  md_account((int64_t)sizeof(*md), 1);
 
   return md;
 } /* }}} meta_data_t *meta_data_create */
@@ -312,16 +472,17 @@ meta_data_t *meta_data_clone(meta_data_t *orig) /* {{{ */
   if (copy == NULL)
     return NULL;
 
-  pthread_mutex_lock(&orig->lock);
-  copy->head = md_entry_clone(orig->head);
-  pthread_mutex_unlock(&orig->lock);
+  if (orig->store != NULL) {
+    C_ATOMIC_ADD(&orig->store->refs, 1);
+    copy->store = orig->store;
+  }
 
   return copy;
 } /* }}} meta_data_t *meta_data_clone */
 
 int meta_data_clone_merge(meta_data_t **dest, meta_data_t *orig) /* {{{ */
 {
-  if (orig == NULL)
+  if ((orig == NULL) || (orig->store == NULL))
     return 0;
 
   if (*dest == NULL) {
@@ -329,11 +490,29 @@ int meta_data_clone_merge(meta_data_t **dest, meta_data_t *orig) /* {{{ */
     return 0;
   }
 
-  pthread_mutex_lock(&orig->lock);
-  for (meta_entry_t *e = orig->head; e != NULL; e = e->next) {
-    md_entry_insert_clone((*dest), e);
+  if ((*dest)->store == NULL) {
+    C_ATOMIC_ADD(&orig->store->refs, 1);
+    (*dest)->store = orig->store;
+    return 0;
+  }
+
+  for (size_t i = 0; i < orig->store->num; i++) {
+    meta_entry_t *e = orig->store->entries + i;
+    meta_value_t value = e->value;
+
+    if (e->type == MD_TYPE_STRING) {
+      value.mv_string = md_strdup(e->value.mv_string);
+      if (value.mv_string == NULL)
+        return -ENOMEM;
+    }
+
+    int status = md_entry_set(*dest, e->key, e->type, value);
+    if (status != 0) {
+      if (e->type == MD_TYPE_STRING)
+        free(value.mv_string);
+      return status;
+    }
   }
-  pthread_mutex_unlock(&orig->lock);
 
   return 0;
 } /* }}} int meta_data_clone_merge */
@@ -343,9 +522,9 @@ void meta_data_destroy(meta_data_t *md) /* {{{ */
   if (md == NULL)
     return;
 
-  md_entry_free(md->head);
-  pthread_mutex_destroy(&md->lock);
+  md_store_release(md->store);
   free(md);
+  md_account(-(int64_t)sizeof(*md), -1);
 } /* }}} void meta_data_destroy */
 
 int meta_data_exists(meta_data_t *md, const char *key) /* {{{ */
@@ -353,17 +532,7 @@ int meta_data_exists(meta_data_t *md, const char *key) /* {{{ */
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next) {
-    if (strcasecmp(key, e->key) == 0) {
-      pthread_mutex_unlock(&md->lock);
-      return 1;
-    }
-  }
-
-  pthread_mutex_unlock(&md->lock);
-  return 0;
+  return md_entry_lookup(md, key) != NULL;
 } /* }}} int meta_data_exists */
 
 int meta_data_type(meta_data_t *md, const char *key) /* {{{ */
@@ -371,78 +540,53 @@ int meta_data_type(meta_data_t *md, const char *key) /* {{{ */
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next) {
-    if (strcasecmp(key, e->key) == 0) {
-      pthread_mutex_unlock(&md->lock);
-      return e->type;
-    }
-  }
-
-  pthread_mutex_unlock(&md->lock);
-  return 0;
+  meta_entry_t *e = md_entry_lookup(md, key);
+  return (e != NULL) ? e->type : 0;
 } /* }}} int meta_data_type */
 
 int meta_data_toc(meta_data_t *md, char ***toc) /* {{{ */
 {
-  int i = 0, count = 0;
+  int count;
 
   if ((md == NULL) || (toc == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next)
-    ++count;
+  if (md->store == NULL)
+    return 0;
 
-  if (count == 0) {
-    pthread_mutex_unlock(&md->lock);
+  count = (int)md->store->num;
+  if (count == 0)
     return count;
-  }
 
   *toc = calloc(count, sizeof(**toc));
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next)
-    (*toc)[i++] = strdup(e->key);
+  for (int i = 0; i < count; i++)
+    (*toc)[i] = strdup(md->store->entries[i].key);
 
-  pthread_mutex_unlock(&md->lock);
   return count;
 } /* }}} int meta_data_toc */
 
 int meta_data_delete(meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  meta_data_store_t *s;
+  meta_entry_t *e;
 
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
-  prev = NULL;
-  this = md->head;
-  while (this != NULL) {
-    if (strcasecmp(key, this->key) == 0)
-      break;
-
-    prev = this;
-    this = this->next;
-  }
-
-  if (this == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  /* Don't copy a shared store just to find out the key doesn't exist. */
+  if (md_entry_lookup(md, key) == NULL)
     return -ENOENT;
-  }
 
-  if (prev == NULL)
-    md->head = this->next;
-  else
-    prev->next = this->next;
+  s = md_store_writable(md);
+  if (s == NULL)
+    return -ENOMEM;
 
-  pthread_mutex_unlock(&md->lock);
+  e = md_entry_lookup(md, key);
+  md_entry_clear(e);
 
-  this->next = NULL;
-  md_entry_free(this);
+  size_t idx = (size_t)(e - s->entries);
+  memmove(e, e + 1, (s->num - idx - 1) * sizeof(*e));
+  s->num--;
 
   return 0;
 } /* }}} int meta_data_delete */
@@ -452,92 +596,58 @@ int meta_data_delete(meta_data_t *md, const char *key) /* {{{ */
  */
 int meta_data_add_string(meta_data_t *md, /* {{{ */
                          const char *key, const char *value) {
-  meta_entry_t *e;
+  meta_value_t v;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  e = md_entry_alloc(key);
-  if (e == NULL)
-    return -ENOMEM;
-
-  e->value.mv_string = md_strdup(value);
-  if (e->value.mv_string == NULL) {
+  v.mv_string = md_strdup(value);
+  if (v.mv_string == NULL) {
     ERROR("meta_data_add_string: md_strdup failed.");
-    md_entry_free(e);
     return -ENOMEM;
   }
-  e->type = MD_TYPE_STRING;
 
-  return md_entry_insert(md, e);
+  int status = md_entry_set(md, key, MD_TYPE_STRING, v);
+  if (status != 0)
+    free(v.mv_string);
+
+  return status;
 } /* }}} int meta_data_add_string */
 
 int meta_data_add_signed_int(meta_data_t *md, /* {{{ */
                              const char *key, int64_t value) {
-  meta_entry_t *e;
-
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  e = md_entry_alloc(key);
-  if (e == NULL)
-    return -ENOMEM;
-
-  e->value.mv_signed_int = value;
-  e->type = MD_TYPE_SIGNED_INT;
-
-  return md_entry_insert(md, e);
+  return md_entry_set(md, key, MD_TYPE_SIGNED_INT,
+                      (meta_value_t){.mv_signed_int = value});
 } /* }}} int meta_data_add_signed_int */
 
 int meta_data_add_unsigned_int(meta_data_t *md, /* {{{ */
                                const char *key, uint64_t value) {
-  meta_entry_t *e;
-
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  e = md_entry_alloc(key);
-  if (e == NULL)
-    return -ENOMEM;
-
-  e->value.mv_unsigned_int = value;
-  e->type = MD_TYPE_UNSIGNED_INT;
-
-  return md_entry_insert(md, e);
+  return md_entry_set(md, key, MD_TYPE_UNSIGNED_INT,
+                      (meta_value_t){.mv_unsigned_int = value});
 } /* }}} int meta_data_add_unsigned_int */
 
 int meta_data_add_double(meta_data_t *md, /* {{{ */
                          const char *key, double value) {
-  meta_entry_t *e;
-
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  e = md_entry_alloc(key);
-  if (e == NULL)
-    return -ENOMEM;
-
-  e->value.mv_double = value;
-  e->type = MD_TYPE_DOUBLE;
-
-  return md_entry_insert(md, e);
+  return md_entry_set(md, key, MD_TYPE_DOUBLE,
+                      (meta_value_t){.mv_double = value});
 } /* }}} int meta_data_add_double */
 
 int meta_data_add_boolean(meta_data_t *md, /* {{{ */
                           const char *key, bool value) {
-  meta_entry_t *e;
-
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  e = md_entry_alloc(key);
-  if (e == NULL)
-    return -ENOMEM;
-
-  e->value.mv_boolean = value;
-  e->type = MD_TYPE_BOOLEAN;
-
-  return md_entry_insert(md, e);
+  return md_entry_set(md, key, MD_TYPE_BOOLEAN,
+                      (meta_value_t){.mv_boolean = value});
 } /* }}} int meta_data_add_boolean */
 
 /*
@@ -551,29 +661,21 @@ int meta_data_get_string(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   if (e->type != MD_TYPE_STRING) {
     ERROR("meta_data_get_string: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
     return -ENOENT;
   }
 
   temp = md_strdup(e->value.mv_string);
   if (temp == NULL) {
-    pthread_mutex_unlock(&md->lock);
     ERROR("meta_data_get_string: md_strdup failed.");
     return -ENOMEM;
   }
 
-  pthread_mutex_unlock(&md->lock);
-
   *value = temp;
 
   return 0;
@@ -586,23 +688,17 @@ int meta_data_get_signed_int(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   if (e->type != MD_TYPE_SIGNED_INT) {
     ERROR("meta_data_get_signed_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
     return -ENOENT;
   }
 
   *value = e->value.mv_signed_int;
 
-  pthread_mutex_unlock(&md->lock);
   return 0;
 } /* }}} int meta_data_get_signed_int */
 
@@ -613,23 +709,17 @@ int meta_data_get_unsigned_int(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   if (e->type != MD_TYPE_UNSIGNED_INT) {
     ERROR("meta_data_get_unsigned_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
     return -ENOENT;
   }
 
   *value = e->value.mv_unsigned_int;
 
-  pthread_mutex_unlock(&md->lock);
   return 0;
 } /* }}} int meta_data_get_unsigned_int */
 
@@ -640,23 +730,17 @@ int meta_data_get_double(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   if (e->type != MD_TYPE_DOUBLE) {
     ERROR("meta_data_get_double: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
     return -ENOENT;
   }
 
   *value = e->value.mv_double;
 
-  pthread_mutex_unlock(&md->lock);
   return 0;
 } /* }}} int meta_data_get_double */
 
@@ -667,23 +751,17 @@ int meta_data_get_boolean(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   if (e->type != MD_TYPE_BOOLEAN) {
     ERROR("meta_data_get_boolean: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
     return -ENOENT;
   }
 
   *value = e->value.mv_boolean;
 
-  pthread_mutex_unlock(&md->lock);
   return 0;
 } /* }}} int meta_data_get_boolean */
 
@@ -698,13 +776,9 @@ int meta_data_as_string(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   type = e->type;
 
@@ -728,13 +802,10 @@ int meta_data_as_string(meta_data_t *md, /* {{{ */
     actual = e->value.mv_boolean ? "true" : "false";
     break;
   default:
-    pthread_mutex_unlock(&md->lock);
     ERROR("meta_data_as_string: unknown type %d for key `%s'", type, key);
     return -ENOENT;
   }
 
-  pthread_mutex_unlock(&md->lock);
-
   temp = md_strdup(actual);
   if (temp == NULL) {
     ERROR("meta_data_as_string: md_strdup failed for key `%s'.", key);
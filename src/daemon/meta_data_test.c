@@ -30,6 +30,7 @@
 
 #include "meta_data.h"
 #include "testing.h"
+#include "utils_memstats.h"
 
 DEF_TEST(base) {
   meta_data_t *m;
@@ -110,8 +111,113 @@ DEF_TEST(base) {
   return 0;
 }
 
+DEF_TEST(clone) {
+  meta_data_t *orig;
+  meta_data_t *copy;
+  meta_data_t *merged = NULL;
+  char key[32];
+  int64_t si;
+  char *s;
+
+  CHECK_NOT_NULL(orig = meta_data_create());
+  CHECK_ZERO(meta_data_add_string(orig, "string", "foobar"));
+  CHECK_ZERO(meta_data_add_signed_int(orig, "signed_int", 42));
+
+  CHECK_NOT_NULL(copy = meta_data_clone(orig));
+
+  /* modifying the copy leaves the original alone */
+  CHECK_ZERO(meta_data_add_signed_int(copy, "signed_int", 23));
+  CHECK_ZERO(meta_data_delete(copy, "string"));
+  CHECK_ZERO(meta_data_get_signed_int(orig, "signed_int", &si));
+  EXPECT_EQ_INT(42, (int)si);
+  CHECK_ZERO(meta_data_get_string(orig, "string", &s));
+  EXPECT_EQ_STR("foobar", s);
+  sfree(s);
+
+  CHECK_ZERO(meta_data_get_signed_int(copy, "signed_int", &si));
+  EXPECT_EQ_INT(23, (int)si);
+  OK(!meta_data_exists(copy, "string"));
+
+  /* grow beyond the inline entries */
+  for (int i = 0; i < 16; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    CHECK_ZERO(meta_data_add_signed_int(copy, key, i));
+  }
+  for (int i = 0; i < 16; i++) {
+    snprintf(key, sizeof(key), "KEY%d", i);
+    CHECK_ZERO(meta_data_get_signed_int(copy, key, &si));
+    EXPECT_EQ_INT(i, (int)si);
+  }
+
+  /* merging */
+  CHECK_ZERO(meta_data_clone_merge(&merged, orig));
+  CHECK_ZERO(meta_data_clone_merge(&merged, copy));
+  CHECK_ZERO(meta_data_get_signed_int(merged, "signed_int", &si));
+  EXPECT_EQ_INT(23, (int)si);
+  CHECK_ZERO(meta_data_get_string(merged, "string", &s));
+  EXPECT_EQ_STR("foobar", s);
+  sfree(s);
+  OK(meta_data_exists(merged, "key15"));
+  OK(!meta_data_exists(orig, "key15"));
+
+  meta_data_destroy(orig);
+  meta_data_destroy(copy);
+  meta_data_destroy(merged);
+  return 0;
+}
+
+static int memstat_find(char const *name, int64_t bytes, /* {{{ */
+                        int64_t objects, void *user_data) {
+  int64_t *ret = user_data;
+  if (strcmp("meta_data", name) != 0)
+    return 0;
+  ret[0] = bytes;
+  ret[1] = objects;
+  return 0;
+} /* }}} int memstat_find */
+
+static void memstats_exercise(void) {
+  meta_data_t *orig = meta_data_create();
+  meta_data_t *copy;
+  meta_data_t *merged = NULL;
+  char key[32];
+
+  meta_data_add_string(orig, "string", "foobar");
+  meta_data_add_string(orig, "string", "foobarbaz");
+  copy = meta_data_clone(orig);
+  for (int i = 0; i < 16; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    meta_data_add_string(copy, key, key);
+  }
+  meta_data_delete(copy, "string");
+  meta_data_clone_merge(&merged, orig);
+  meta_data_clone_merge(&merged, copy);
+
+  meta_data_destroy(orig);
+  meta_data_destroy(copy);
+  meta_data_destroy(merged);
+}
+
+DEF_TEST(memstats) {
+  int64_t before[2] = {0};
+  int64_t after[2] = {0};
+
+  /* The first run interns the keys, which are never freed. */
+  memstats_exercise();
+  memstat_foreach(memstat_find, before);
+  memstats_exercise();
+  memstat_foreach(memstat_find, after);
+
+  OK(before[0] > 0);
+  EXPECT_EQ_UINT64(before[0], after[0]);
+  EXPECT_EQ_UINT64(before[1], after[1]);
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(base);
+  RUN_TEST(clone);
+  RUN_TEST(memstats);
 
   END_TEST;
 }
@@ -34,13 +34,23 @@
 #include "configfile.h"
 #include "filter_chain.h"
 #include "plugin.h"
+#include "utils_atomic.h"
 #include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_cache_shm.h"
 #include "utils_complain.h"
+#include "utils_config_cores.h"
 #include "utils_heap.h"
+#include "utils_latency.h"
 #include "utils_llist.h"
+#include "utils_memstats.h"
+#include "utils_probe.h"
 #include "utils_random.h"
+#include "utils_ring.h"
+#include "utils_spool.h"
+#include "utils_stats_http.h"
 #include "utils_time.h"
+#include "utils_vl_ident.h"
 
 #if HAVE_PTHREAD_NP_H
 #include <pthread_np.h> /* for pthread_set_name_np(3) */
@@ -48,23 +58,88 @@
 
 #include <dlfcn.h>
 
+#if HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+#endif
+
+/* On Linux, the read threads sleep on a CLOCK_MONOTONIC timerfd and are woken
+ * up through an eventfd. Elsewhere they use a condition variable. */
+#if HAVE_SYS_TIMERFD_H && HAVE_SYS_EVENTFD_H && HAVE_POLL_H
+#define READ_WORKER_TIMERFD 1
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#else
+#define READ_WORKER_TIMERFD 0
+#endif
+
+/* The event loop, which watches file descriptors and timers registered by
+ * plugins, is built on epoll(7). */
+#if READ_WORKER_TIMERFD && HAVE_SYS_EPOLL_H
+#define PLUGIN_EVENT_LOOP 1
+#include <sys/epoll.h>
+#else
+#define PLUGIN_EVENT_LOOP 0
+#endif
+
 /*
  * Private structures
  */
+struct writer_queue_s;
+typedef struct writer_queue_s writer_queue_t;
+struct flush_entry_s;
+typedef struct flush_entry_s flush_entry_t;
+
 struct callback_func_s {
   void *cf_callback;
   user_data_t cf_udata;
   plugin_ctx_t cf_ctx;
+  plugin_latency_t *cf_latency;
+  writer_queue_t *cf_queue; /* write callbacks only; may be NULL */
+  /* The "FlushInterval" schedule of the plugin's flush callback; write
+   * callbacks only, may be NULL. */
+  flush_entry_t *cf_flush;
 };
 typedef struct callback_func_s callback_func_t;
 
+/* Immutable snapshot of a callback list, used by the dispatch paths instead
+ * of walking the list. `entries' holds the callbacks in registration order,
+ * `by_name' the same callbacks sorted by name (case-insensitive) for
+ * lookups. A new snapshot is built under `register_lock' whenever the list
+ * changes and published with a release store. Threads only use snapshots
+ * between callback_reader_enter() and callback_reader_leave(). Replaced
+ * snapshots are freed by callback_array_reclaim() once all threads which may
+ * have seen them have left, along with the callback removed from the list
+ * when they were replaced, if any: a thread iterating the old snapshot may
+ * still call it. */
+typedef struct {
+  const char *name;
+  callback_func_t *cf;
+} callback_entry_t;
+
+struct callback_array_s {
+  struct callback_array_s *retired_next;
+  callback_func_t *removed_cf;
+  char *removed_key;
+  size_t num;
+  callback_entry_t *by_name;
+  callback_entry_t entries[];
+};
+typedef struct callback_array_s callback_array_t;
+
 #define RF_SIMPLE 0
 #define RF_COMPLEX 1
 #define RF_REMOVE 65535
+
+/* ReadPhaseMode */
+#define READ_PHASE_NONE 0
+#define READ_PHASE_SPREAD 1
+#define READ_PHASE_ALIGNED 2
 struct read_func_s {
 /* `read_func_t' "inherits" from `callback_func_t'.
  * The `rf_super' member MUST be the first one in this structure! */
 #define rf_callback rf_super.cf_callback
+#define rf_latency rf_super.cf_latency
 #define rf_udata rf_super.cf_udata
 #define rf_ctx rf_super.cf_ctx
   callback_func_t rf_super;
@@ -74,22 +149,187 @@ struct read_func_s {
   cdtime_t rf_interval;
   cdtime_t rf_effective_interval;
   cdtime_t rf_next_read;
+  /* Totals since registration, see plugin_internal_stats_foreach(). */
+  uint64_t rf_calls;
+  uint64_t rf_failures;
+  cdtime_t rf_time;
 };
 typedef struct read_func_s read_func_t;
 
+/* Every read thread owns a heap of read functions, ordered by the time they
+ * are due next, and sleeps until the first of them is due. While a thread is
+ * busy running a read callback, it can't take care of its other read
+ * functions, so idle threads steal overdue read functions from busy ones.
+ * Stolen read functions stay with the thief, which balances the load over
+ * time. */
+struct read_worker_s {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#if READ_WORKER_TIMERFD
+  int timer_fd; /* -1 if the condition variable is used */
+  int event_fd;
+#endif
+  c_heap_t *heap;
+  bool busy;         /* running a read callback */
+  unsigned wakeups;  /* incremented whenever the worker is signaled */
+};
+typedef struct read_worker_s read_worker_t;
+
+#if PLUGIN_EVENT_LOOP
+/* A file descriptor or timer watched by the event loop. Like `read_func_t',
+ * this "inherits" from `callback_func_t'. */
+struct event_source_s {
+#define es_callback es_super.cf_callback
+#define es_udata es_super.cf_udata
+#define es_ctx es_super.cf_ctx
+  callback_func_t es_super;
+  char *es_name;
+  int es_fd;
+  bool es_timer;   /* `es_fd' is a timerfd owned by the event source */
+  bool es_removed; /* unregistered, waiting in the graveyard */
+  struct event_source_s *es_next;
+};
+typedef struct event_source_s event_source_t;
+#endif
+
+/* Most value lists have only a handful of values. These are stored inside the
+ * queue entry itself, saving an allocation per value list. */
+#ifndef WRITE_QUEUE_INLINE_VALUES
+#define WRITE_QUEUE_INLINE_VALUES 4
+#endif
+
+/* Queued value list. The identifier is kept in its compact form and only
+ * converted back to a value_list_t, see write_queue_entry_expand(), when the
+ * entry is handed to the filter chains and writers. */
 struct write_queue_s;
 typedef struct write_queue_s write_queue_t;
 struct write_queue_s {
-  value_list_t *vl;
+  vl_ident_t *ident;
+  value_t *values;
+  size_t values_len;
+  cdtime_t time;
+  cdtime_t interval;
+  meta_data_t *meta;
+  value_t values_inline[WRITE_QUEUE_INLINE_VALUES];
   plugin_ctx_t ctx;
+  const data_set_t *ds; /* resolved when enqueueing; may be NULL */
   write_queue_t *next;
+  bool in_slab;
 };
 
-struct flush_callback_s {
+/* A flush callback with a "FlushInterval". Once a write callback of the same
+ * name has been handed data, the entry is put into `flush_heap' with a
+ * deadline of one interval later, and the flush thread calls the flush
+ * callback when the deadline has passed. Writers which received no data since
+ * their last flush are not flushed at all. Flush callbacks without a matching
+ * write callback ("unbound") are flushed every interval. */
+struct flush_entry_s {
   char *name;
+  cdtime_t interval;
   cdtime_t timeout;
+
+  /* The following members are protected by `flush_lock'. */
+  cdtime_t deadline;
+  size_t heap_index;
+  bool queued;  /* in `flush_heap'; also read without the lock */
+  bool removed; /* unregistered; freed by plugin_shutdown_all() */
+  int writers;  /* number of bound write callbacks */
+  derive_t flushes;
+  derive_t values_flushed;
+  flush_entry_t *next;
+
+  /* Value lists handed to the bound writers since the last flush. */
+  uint64_t values_pending;
+};
+
+/* Value lists destined for batch writers, collected while a write thread
+ * processes the entries it dequeued in one go. */
+struct write_batch_entry_s {
+  callback_func_t *cf;
+  const data_set_t *ds;
+  write_queue_t *q;
+};
+typedef struct write_batch_entry_s write_batch_entry_t;
+
+struct write_batch_s {
+  write_batch_entry_t *entries;
+  size_t entries_num;
+  size_t entries_size;
+
+  /* scratch space used when calling the batch writers */
+  plugin_write_entry_t *args;
+  value_list_t *vls;
+  size_t args_size;
+
+  /* Identifier of the value list being dispatched. Copies of it made for the
+   * batch and writer queues share the identifier if the filter chain did not
+   * change it. */
+  vl_ident_t *ident;
+};
+typedef struct write_batch_s write_batch_t;
+
+/* Number of value lists a writer queue hands to a batch writer at once. */
+#define WRITER_QUEUE_BATCH_MAX 64
+
+/* Dedicated queue and thread of a write callback, so a slow writer only
+ * delays its own values instead of holding the shared write threads. */
+struct writer_queue_s {
+  callback_func_t *cf;
+  char *name;
+  bool batch; /* `cf' is a plugin_write_batch_cb */
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  write_queue_t *head;
+  write_queue_t *tail;
+  long length;
+  long limit_high; /* zero: unbounded */
+  long limit_low;
+  derive_t dropped;
+
+  /* Owned by the writer's thread: the value lists handed to the callback. */
+  value_list_t *vls;
+
+  /* Values the queue can't take or the writer fails to write are appended
+   * to the spool, if configured, and replayed at up to `replay_rate' value
+   * lists per second while the queue is empty. */
+  spool_t *spool;
+  long replay_rate; /* zero: unlimited */
+  cdtime_t replay_last;
+  double replay_budget;
+  bool failing; /* the last write failed; owned by the writer's thread */
+  derive_t spooled;
+  derive_t replayed;
+
+  pthread_t thread;
+  bool thread_running;
+  bool loop;
 };
-typedef struct flush_callback_s flush_callback_t;
+
+/* Read-only index of the registered data sets: a perfect hash over the type
+ * names built with the "hash and displace" method. The type's hash selects a
+ * bucket, and the bucket's displacement is mixed into the hash again to find
+ * the slot. The displacements are chosen so that no two types share a slot.
+ * Indices are never modified once built. When the set of data sets changes,
+ * the current index is retired (and freed on shutdown) and lookups fall back
+ * to the AVL tree until the index has been rebuilt. */
+struct data_set_index_s;
+typedef struct data_set_index_s data_set_index_t;
+struct data_set_index_s {
+  uint32_t *displacements;
+  size_t buckets_num; /* power of two */
+  data_set_t **slots;
+  size_t slots_num; /* power of two */
+  data_set_index_t *next_retired;
+};
+
+/* Each thread remembers the last data set it looked up. The entry is only
+ * valid as long as the index it was found in is current. */
+struct data_set_cache_s {
+  data_set_index_t const *index;
+  const data_set_t *ds;
+};
+typedef struct data_set_cache_s data_set_cache_t;
 
 /*
  * Private variables
@@ -98,39 +338,203 @@ static c_avl_tree_t *plugins_loaded;
 
 static llist_t *list_init;
 static llist_t *list_write;
+static llist_t *list_write_batch;
 static llist_t *list_flush;
 static llist_t *list_missing;
 static llist_t *list_shutdown;
+static llist_t *list_reconfigure;
 static llist_t *list_log;
 static llist_t *list_notification;
 
+/* Snapshots of the lists above which are walked on the hot path. NULL if the
+ * corresponding list is empty. */
+static callback_array_t *array_write;
+static callback_array_t *array_write_batch;
+static callback_array_t *array_flush;
+static callback_array_t *array_log;
+static callback_array_t *array_notification;
+static callback_array_t *arrays_retired;
+
+/* Readers of the snapshots are counted in one of two slots, selected by the
+ * lowest bit of `callback_epoch'. New readers go to the current slot, so the
+ * other one drains, which is how callback_array_reclaim() waits for a grace
+ * period. `reclaim_lock' serializes the waiting threads. The key holds the
+ * nesting depth of the calling thread, times two, plus one if it deferred a
+ * reclaim. */
+static uint64_t callback_epoch;
+static uint64_t callback_readers[2];
+#define CALLBACK_READER_NESTED 2
+static pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t callback_reader_key;
+
+/* The init callbacks may run in parallel (see "InitThreads") and register
+ * callbacks from several threads at once. `register_lock' serializes changes
+ * of the callback lists. */
+static pthread_mutex_t register_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Ordering of the init callbacks, from the "InitAfter" option of the
+ * <LoadPlugin> blocks: the init callback of `plugin' is called after the one
+ * of `after' has returned. */
+struct init_dependency_s {
+  char *plugin;
+  char *after;
+};
+typedef struct init_dependency_s init_dependency_t;
+static init_dependency_t *init_deps;
+static size_t init_deps_num;
+
+/* Time spent loading plugins and in their init callbacks, reported once the
+ * daemon has been initialized. */
+struct startup_timing_s {
+  char const *kind;
+  char name[DATA_MAX_NAME_LEN];
+  cdtime_t duration;
+};
+typedef struct startup_timing_s startup_timing_t;
+static startup_timing_t *startup_timings;
+static size_t startup_timings_num;
+static pthread_mutex_t startup_timing_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Replaced when the configuration is reloaded; see plugin_set_chains(). */
 static fc_chain_t *pre_cache_chain;
 static fc_chain_t *post_cache_chain;
 
+static volatile sig_atomic_t reload_requested;
+
 static c_avl_tree_t *data_sets;
+/* Data sets are not freed when they're replaced or unregistered, because
+ * plugins and queued values may still hold pointers to them. */
+static data_set_t **data_sets_retired;
+static size_t data_sets_retired_num;
+static data_set_index_t *data_set_index;
+static data_set_index_t *data_set_index_retired;
+static pthread_mutex_t data_set_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t data_set_cache_key;
 
 static char *plugindir;
 
 #ifndef DEFAULT_MAX_READ_INTERVAL
 #define DEFAULT_MAX_READ_INTERVAL TIME_T_TO_CDTIME_T_STATIC(86400)
 #endif
+/* Read functions registered before the read threads are started are kept in
+ * `read_heap' and distributed over the `read_workers' when the threads
+ * start. `read_lock' protects `read_list', `read_heap' and the assignment of
+ * new read functions to workers. */
 static c_heap_t *read_heap;
 static llist_t *read_list;
 static int read_loop = 1;
 static pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t read_cond = PTHREAD_COND_INITIALIZER;
+#if PLUGIN_EVENT_LOOP
+/* Event sources are only freed by the event loop once it is done with the
+ * batch of events which may refer to them. `event_loop_generation' counts the
+ * batches, so that unregistering can wait for the current one to finish. */
+static pthread_mutex_t event_loop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_loop_cond = PTHREAD_COND_INITIALIZER;
+static event_source_t *event_sources;
+static event_source_t *event_graveyard;
+static int event_loop_epoll_fd = -1;
+static int event_loop_wakeup_fd = -1;
+static pthread_t event_loop_tid;
+static bool event_loop_running;
+static bool event_loop_joinable;
+static bool event_loop_stopping;
+static uint64_t event_loop_generation;
+#endif
+
 static pthread_t *read_threads;
 static size_t read_threads_num;
+static read_worker_t *read_workers;
+static size_t read_workers_num;
+static size_t read_workers_active;
+static size_t read_workers_next;
+static int read_phase_mode = READ_PHASE_NONE;
 static cdtime_t max_read_interval = DEFAULT_MAX_READ_INTERVAL;
 
-static write_queue_t *write_queue_head;
-static write_queue_t *write_queue_tail;
+/* The write queue consists of one lane per priority class of the dispatching
+ * plugin. Each lane is a lock-free ring buffer. If the ring is full (or has
+ * not been created yet), entries are appended to the mutex protected
+ * "overflow" list so the queue remains unbounded unless limited by
+ * WriteQueueLimitHigh. Entries are taken from the overflow list only once the
+ * ring is empty, so new entries are appended to the list, too, until it has
+ * been drained. Otherwise they would overtake the entries waiting there.
+ * `write_lock' and `write_cond' are only used to put idle write threads to
+ * sleep and wake them up again. */
+#ifndef WRITE_RING_SIZE
+#define WRITE_RING_SIZE 65536
+#endif
+struct write_lane_s {
+  const char *name;
+  size_t ring_size;
+  c_ring_t *ring;
+  write_queue_t *head;
+  write_queue_t *tail;
+  long overflow_length;
+  pthread_mutex_t overflow_lock;
+  long length;
+  derive_t dropped;
+};
+typedef struct write_lane_s write_lane_t;
+
+static write_lane_t write_lanes[] = {
+    [PLUGIN_PRIORITY_NORMAL] = {.name = "normal",
+                                .ring_size = WRITE_RING_SIZE,
+                                .overflow_lock = PTHREAD_MUTEX_INITIALIZER},
+    [PLUGIN_PRIORITY_LOW] = {.name = "low",
+                             .ring_size = WRITE_RING_SIZE,
+                             .overflow_lock = PTHREAD_MUTEX_INITIALIZER},
+    [PLUGIN_PRIORITY_CRITICAL] = {.name = "critical",
+                                  .ring_size = WRITE_RING_SIZE / 16,
+                                  .overflow_lock = PTHREAD_MUTEX_INITIALIZER},
+};
+/* Weighted round robin: of every seven entries, the write threads take four
+ * from the critical lane, two from the normal lane and one from the low
+ * priority lane. Lanes without entries are skipped, see
+ * plugin_write_queue_pop(). */
+static const int write_lane_schedule[] = {
+    PLUGIN_PRIORITY_CRITICAL, PLUGIN_PRIORITY_NORMAL,
+    PLUGIN_PRIORITY_CRITICAL, PLUGIN_PRIORITY_LOW,
+    PLUGIN_PRIORITY_CRITICAL, PLUGIN_PRIORITY_NORMAL,
+    PLUGIN_PRIORITY_CRITICAL,
+};
+static const int write_lane_order[] = {
+    PLUGIN_PRIORITY_CRITICAL, PLUGIN_PRIORITY_NORMAL, PLUGIN_PRIORITY_LOW};
+static unsigned long write_lane_turn;
 static long write_queue_length;
+static long write_waiters;
 static bool write_loop = true;
 static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t write_cond = PTHREAD_COND_INITIALIZER;
+
+/* Queue entries are allocated in slabs of WRITE_SLAB_ENTRIES and recycled
+ * through a lock-free free list. Once WRITE_SLAB_MAX slabs have been
+ * allocated, additional entries are malloc'ed and free'd individually. */
+#ifndef WRITE_SLAB_ENTRIES
+#define WRITE_SLAB_ENTRIES 256
+#endif
+#ifndef WRITE_SLAB_MAX
+#define WRITE_SLAB_MAX 64
+#endif
+static c_ring_t *write_slab_free;
+static write_queue_t *write_slabs[WRITE_SLAB_MAX];
+static size_t write_slabs_num;
+static pthread_mutex_t write_slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static long write_slab_used;
+static derive_t write_slab_misses;
+/* Memory of the slabs, the entries allocated outside of them and the values
+ * that don't fit into an entry. Counts the entries in use as objects. */
+static memstat_t *write_queue_memstat;
 static pthread_t *write_threads;
 static size_t write_threads_num;
+static long write_batch_size;
+static pthread_key_t write_batch_key;
+
+/* Value lists returned by plugin_dispatch_values_reserve(). One is kept per
+ * thread for reuse. */
+typedef struct {
+  value_list_t vl;
+  value_t values[WRITE_QUEUE_INLINE_VALUES];
+} write_reserved_t;
+static pthread_key_t write_reserved_key;
 
 static pthread_key_t plugin_ctx_key;
 static bool plugin_ctx_key_initialized;
@@ -138,13 +542,93 @@ static bool plugin_ctx_key_initialized;
 static long write_limit_high;
 static long write_limit_low;
 
+/* Load shedding ("LoadShedding"): once per second, `shed_level' is raised
+ * while the write queue is above WriteQueueLimitHigh and lowered while it is
+ * below WriteQueueLimitLow. The read intervals of low priority callbacks are
+ * multiplied by 2^min(level, SHED_SHIFT_MAX); those of normal priority
+ * callbacks by 2^(level - SHED_SHIFT_MAX) once the former are stretched as far
+ * as they go. Values are only dropped at the highest level. */
+#define SHED_SHIFT_MAX 3
+#define SHED_LEVEL_MAX (2 * SHED_SHIFT_MAX)
+static bool load_shedding;
+static int shed_level;
+static cdtime_t shed_last_update;
+static pthread_mutex_t shed_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static derive_t stats_values_dropped;
 static bool record_statistics;
 
+/* Number of value lists enqueued while plugin_read_all_bench() runs. */
+static bool bench_running;
+static uint64_t bench_values;
+
+/* If set, values dispatched outside of a read callback are timestamped with
+ * cdtime_coarse() rather than cdtime(). */
+static bool coarse_timestamps;
+
+/* Notifications are handed to the notification callbacks by
+ * "NotificationThreads" worker threads if that option is positive. Queued
+ * notifications for the same identifier and severity are coalesced: a newer
+ * one replaces the one still waiting in the queue, and with a positive
+ * "NotificationCoalesceWindow" notifications arriving within the window after
+ * the last one are dropped. The coalescing state is kept in
+ * "notification_keys", keyed by severity and identifier. */
+typedef struct notification_key_s notification_key_t;
+typedef struct notification_queue_s notification_queue_t;
+
+struct notification_key_s {
+  char *name;
+  cdtime_t last;                 /* time the last notification was queued */
+  notification_queue_t *queued;  /* notification waiting in the queue */
+  notification_key_t *prune_next;
+};
+
+struct notification_queue_s {
+  notification_t n;
+  notification_key_t *key; /* NULL if the notification is never coalesced */
+  notification_queue_t *next;
+};
+
+static pthread_mutex_t notification_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notification_cond = PTHREAD_COND_INITIALIZER;
+static notification_queue_t *notification_queue_head;
+static notification_queue_t *notification_queue_tail;
+static long notification_queue_length;
+static long notification_queue_limit;
+static cdtime_t notification_coalesce_window;
+static cdtime_t notification_last_prune;
+static c_avl_tree_t *notification_keys;
+static pthread_t *notification_threads;
+static size_t notification_threads_num;
+static bool notification_loop;
+
+static derive_t stats_notifications_dropped;
+static derive_t stats_notifications_coalesced;
+
+/* With "LogRateLimit", each call site of plugin_log() may log that many
+ * messages per second. Call sites are identified by their return address and
+ * hashed into a fixed number of slots; call sites sharing a slot take turns. */
+#define LOG_RATELIMIT_SLOTS 1024
+static struct {
+  const void *site;
+  c_ratelimit_t rl;
+} log_ratelimit[LOG_RATELIMIT_SLOTS];
+static pthread_mutex_t log_ratelimit_lock = PTHREAD_MUTEX_INITIALIZER;
+static long log_rate_limit;
+
 /*
  * Static functions
  */
-static int plugin_dispatch_values_internal(value_list_t *vl);
+static int plugin_dispatch_values_internal(value_list_t *vl,
+                                           const data_set_t *ds);
+static writer_queue_t *writer_queue_create(callback_func_t *cf,
+                                           const char *name, bool batch);
+static void writer_queue_destroy(writer_queue_t *wq);
+static int plugin_notification_deliver(const notification_t *notif);
+static int writer_queue_start(writer_queue_t *wq);
+static const data_set_t *plugin_lookup_ds(const char *type);
+static void plugin_flush_mark(callback_func_t *cf, size_t values_num);
+static void flush_entries_dispatch(value_list_t *vl);
 
 static const char *plugin_get_dir(void) {
   if (plugindir == NULL)
@@ -153,8 +637,156 @@ static const char *plugin_get_dir(void) {
     return plugindir;
 }
 
+struct plugin_latency_s {
+  char name[DATA_MAX_NAME_LEN]; /* "<kind>-<name>", used as plugin instance */
+  pthread_mutex_t lock;
+  latency_counter_t *counter;
+  llentry_t *le;
+};
+
+/* All latency histograms, protected by `latency_list_lock'. */
+static llist_t *latency_list;
+static pthread_mutex_t latency_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+plugin_latency_t *plugin_latency_register(const char *kind, /* {{{ */
+                                          const char *name) {
+  plugin_latency_t *pl = calloc(1, sizeof(*pl));
+  if (pl == NULL) {
+    ERROR("plugin_latency_register: calloc failed.");
+    return NULL;
+  }
+
+  snprintf(pl->name, sizeof(pl->name), "%s-%s", kind, name);
+  pl->counter = latency_counter_create();
+  pl->le = llentry_create(pl->name, pl);
+  if ((pl->counter == NULL) || (pl->le == NULL)) {
+    ERROR("plugin_latency_register: Creating the histogram for \"%s\" "
+          "failed.",
+          pl->name);
+    latency_counter_destroy(pl->counter);
+    llentry_destroy(pl->le);
+    sfree(pl);
+    return NULL;
+  }
+  pthread_mutex_init(&pl->lock, /* attr = */ NULL);
+
+  pthread_mutex_lock(&latency_list_lock);
+  if (latency_list == NULL)
+    latency_list = llist_create();
+  if (latency_list == NULL) {
+    pthread_mutex_unlock(&latency_list_lock);
+    ERROR("plugin_latency_register: llist_create failed.");
+    pthread_mutex_destroy(&pl->lock);
+    latency_counter_destroy(pl->counter);
+    llentry_destroy(pl->le);
+    sfree(pl);
+    return NULL;
+  }
+  llist_append(latency_list, pl->le);
+  pthread_mutex_unlock(&latency_list_lock);
+
+  return pl;
+} /* }}} plugin_latency_t *plugin_latency_register */
+
+void plugin_latency_unregister(plugin_latency_t *pl) /* {{{ */
+{
+  if (pl == NULL)
+    return;
+
+  pthread_mutex_lock(&latency_list_lock);
+  llist_remove(latency_list, pl->le);
+  pthread_mutex_unlock(&latency_list_lock);
+
+  llentry_destroy(pl->le);
+  latency_counter_destroy(pl->counter);
+  pthread_mutex_destroy(&pl->lock);
+  sfree(pl);
+} /* }}} void plugin_latency_unregister */
+
+cdtime_t plugin_latency_start(void) /* {{{ */
+{
+  return record_statistics ? cdtime() : 0;
+} /* }}} cdtime_t plugin_latency_start */
+
+void plugin_latency_stop(plugin_latency_t *pl, cdtime_t start) /* {{{ */
+{
+  if ((pl == NULL) || (start == 0))
+    return;
+
+  cdtime_t latency = cdtime() - start;
+
+  pthread_mutex_lock(&pl->lock);
+  latency_counter_add(pl->counter, latency);
+  pthread_mutex_unlock(&pl->lock);
+} /* }}} void plugin_latency_stop */
+
+/* Dispatches and resets all latency histograms which recorded at least one
+ * call since the last interval. */
+static void plugin_latency_dispatch(value_list_t *vl) /* {{{ */
+{
+  sstrncpy(vl->type, "latency", sizeof(vl->type));
+
+  pthread_mutex_lock(&latency_list_lock);
+  for (llentry_t *le = llist_head(latency_list); le != NULL; le = le->next) {
+    plugin_latency_t *pl = le->value;
+    gauge_t average, upper, p50, p99;
+
+    pthread_mutex_lock(&pl->lock);
+    if (latency_counter_get_num(pl->counter) == 0) {
+      pthread_mutex_unlock(&pl->lock);
+      continue;
+    }
+    average = CDTIME_T_TO_DOUBLE(latency_counter_get_average(pl->counter));
+    upper = CDTIME_T_TO_DOUBLE(latency_counter_get_max(pl->counter));
+    p50 = CDTIME_T_TO_DOUBLE(
+        latency_counter_get_percentile(pl->counter, /* percent = */ 50.0));
+    p99 = CDTIME_T_TO_DOUBLE(
+        latency_counter_get_percentile(pl->counter, /* percent = */ 99.0));
+    latency_counter_reset(pl->counter);
+    pthread_mutex_unlock(&pl->lock);
+
+    sstrncpy(vl->plugin_instance, pl->name, sizeof(vl->plugin_instance));
+    vl->values_len = 1;
+
+    vl->values = &(value_t){.gauge = average};
+    sstrncpy(vl->type_instance, "average", sizeof(vl->type_instance));
+    plugin_dispatch_values(vl);
+
+    vl->values = &(value_t){.gauge = upper};
+    sstrncpy(vl->type_instance, "upper", sizeof(vl->type_instance));
+    plugin_dispatch_values(vl);
+
+    vl->values = &(value_t){.gauge = p50};
+    sstrncpy(vl->type_instance, "percentile-50", sizeof(vl->type_instance));
+    plugin_dispatch_values(vl);
+
+    vl->values = &(value_t){.gauge = p99};
+    sstrncpy(vl->type_instance, "percentile-99", sizeof(vl->type_instance));
+    plugin_dispatch_values(vl);
+  }
+  pthread_mutex_unlock(&latency_list_lock);
+} /* }}} void plugin_latency_dispatch */
+
+static int plugin_dispatch_memstat(char const *name, int64_t bytes, /* {{{ */
+                                   int64_t objects, void *user_data) {
+  value_list_t *vl = user_data;
+
+  sstrncpy(vl->type_instance, name, sizeof(vl->type_instance));
+
+  vl->values = &(value_t){.gauge = (gauge_t)bytes};
+  vl->values_len = 1;
+  sstrncpy(vl->type, "memory", sizeof(vl->type));
+  plugin_dispatch_values(vl);
+
+  vl->values = &(value_t){.gauge = (gauge_t)objects};
+  sstrncpy(vl->type, "objects", sizeof(vl->type));
+  plugin_dispatch_values(vl);
+
+  return 0;
+} /* }}} int plugin_dispatch_memstat */
+
 static int plugin_update_internal_statistics(void) { /* {{{ */
-  gauge_t copy_write_queue_length = (gauge_t)write_queue_length;
+  gauge_t copy_write_queue_length = (gauge_t)C_ATOMIC_LOAD(&write_queue_length);
 
   /* Initialize `vl' */
   value_list_t vl = VALUE_LIST_INIT;
@@ -178,6 +810,55 @@ static int plugin_update_internal_statistics(void) { /* {{{ */
   sstrncpy(vl.type_instance, "dropped", sizeof(vl.type_instance));
   plugin_dispatch_values(&vl);
 
+  /* Write queue : per lane */
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(write_lanes); i++) {
+    write_lane_t *lane = &write_lanes[i];
+    long length = C_ATOMIC_LOAD(&lane->length);
+
+    vl.values = &(value_t){.gauge = (length > 0) ? (gauge_t)length : 0.0};
+    sstrncpy(vl.type, "queue_length", sizeof(vl.type));
+    sstrncpy(vl.type_instance, lane->name, sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+
+    vl.values = &(value_t){.derive = C_ATOMIC_LOAD(&lane->dropped)};
+    sstrncpy(vl.type, "derive", sizeof(vl.type));
+    snprintf(vl.type_instance, sizeof(vl.type_instance), "dropped-%s",
+             lane->name);
+    plugin_dispatch_values(&vl);
+  }
+
+  /* Write queue slabs */
+  long slab_used = C_ATOMIC_LOAD(&write_slab_used);
+  long slab_total;
+  pthread_mutex_lock(&write_slab_lock);
+  slab_total = (long)(write_slabs_num * WRITE_SLAB_ENTRIES);
+  pthread_mutex_unlock(&write_slab_lock);
+
+  sstrncpy(vl.plugin_instance, "write_slab", sizeof(vl.plugin_instance));
+
+  /* Write queue slabs : entries in use and available on the free list */
+  vl.values = &(value_t){.gauge = (gauge_t)slab_used};
+  vl.values_len = 1;
+  sstrncpy(vl.type, "objects", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "used", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.gauge = (gauge_t)(slab_total - slab_used)};
+  sstrncpy(vl.type_instance, "free", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  /* Write queue slabs : memory allocated for slabs */
+  vl.values = &(value_t){.gauge = (gauge_t)slab_total * sizeof(write_queue_t)};
+  sstrncpy(vl.type, "memory", sizeof(vl.type));
+  vl.type_instance[0] = 0;
+  plugin_dispatch_values(&vl);
+
+  /* Write queue slabs : entries allocated outside of the slabs */
+  vl.values = &(value_t){.derive = C_ATOMIC_LOAD(&write_slab_misses)};
+  sstrncpy(vl.type, "derive", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "misses", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
   /* Cache */
   sstrncpy(vl.plugin_instance, "cache", sizeof(vl.plugin_instance));
 
@@ -188,9 +869,290 @@ static int plugin_update_internal_statistics(void) { /* {{{ */
   vl.type_instance[0] = 0;
   plugin_dispatch_values(&vl);
 
+  /* Memory accounted by the subsystems */
+  sstrncpy(vl.plugin_instance, "memory", sizeof(vl.plugin_instance));
+  memstat_foreach(plugin_dispatch_memstat, &vl);
+
+  /* Dedicated write queues */
+  llist_t *lists[] = {list_write, list_write_batch};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(lists); i++) {
+    for (llentry_t *le = llist_head(lists[i]); le != NULL; le = le->next) {
+      writer_queue_t *wq = ((callback_func_t *)le->value)->cf_queue;
+      if (wq == NULL)
+        continue;
+
+      pthread_mutex_lock(&wq->lock);
+      gauge_t length = (gauge_t)wq->length;
+      derive_t dropped = wq->dropped;
+      derive_t spooled = wq->spooled;
+      derive_t replayed = wq->replayed;
+      pthread_mutex_unlock(&wq->lock);
+
+      snprintf(vl.plugin_instance, sizeof(vl.plugin_instance),
+               "write_queue-%s", wq->name);
+
+      vl.values = &(value_t){.gauge = length};
+      vl.values_len = 1;
+      sstrncpy(vl.type, "queue_length", sizeof(vl.type));
+      vl.type_instance[0] = 0;
+      plugin_dispatch_values(&vl);
+
+      vl.values = &(value_t){.derive = dropped};
+      sstrncpy(vl.type, "derive", sizeof(vl.type));
+      sstrncpy(vl.type_instance, "dropped", sizeof(vl.type_instance));
+      plugin_dispatch_values(&vl);
+
+      if (wq->spool == NULL)
+        continue;
+
+      vl.values = &(value_t){.derive = spooled};
+      sstrncpy(vl.type_instance, "spooled", sizeof(vl.type_instance));
+      plugin_dispatch_values(&vl);
+
+      vl.values = &(value_t){.derive = replayed};
+      sstrncpy(vl.type_instance, "replayed", sizeof(vl.type_instance));
+      plugin_dispatch_values(&vl);
+
+      vl.values = &(value_t){.gauge = (gauge_t)spool_size(wq->spool)};
+      sstrncpy(vl.type, "bytes", sizeof(vl.type));
+      sstrncpy(vl.type_instance, "spool", sizeof(vl.type_instance));
+      plugin_dispatch_values(&vl);
+    }
+  }
+
+  /* Notification queue */
+  if (notification_threads_num > 0) {
+    pthread_mutex_lock(&notification_lock);
+    gauge_t length = (gauge_t)notification_queue_length;
+    derive_t dropped = stats_notifications_dropped;
+    derive_t coalesced = stats_notifications_coalesced;
+    pthread_mutex_unlock(&notification_lock);
+
+    sstrncpy(vl.plugin_instance, "notification_queue",
+             sizeof(vl.plugin_instance));
+
+    vl.values = &(value_t){.gauge = length};
+    vl.values_len = 1;
+    sstrncpy(vl.type, "queue_length", sizeof(vl.type));
+    vl.type_instance[0] = 0;
+    plugin_dispatch_values(&vl);
+
+    vl.values = &(value_t){.derive = dropped};
+    sstrncpy(vl.type, "derive", sizeof(vl.type));
+    sstrncpy(vl.type_instance, "dropped", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+
+    vl.values = &(value_t){.derive = coalesced};
+    sstrncpy(vl.type_instance, "coalesced", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+  }
+
+  /* Effective read intervals. Copied first, so that `read_lock' is not held
+   * while dispatching. */
+  pthread_mutex_lock(&read_lock);
+  size_t intervals_num = 0;
+  struct {
+    char name[DATA_MAX_NAME_LEN];
+    cdtime_t interval;
+  } *intervals = calloc((size_t)llist_size(read_list) + 1, sizeof(*intervals));
+  for (llentry_t *le = (intervals != NULL) ? llist_head(read_list) : NULL;
+       le != NULL; le = le->next) {
+    read_func_t *rf = le->value;
+    snprintf(intervals[intervals_num].name, sizeof(intervals->name), "read-%s",
+             rf->rf_name);
+    intervals[intervals_num].interval =
+        C_ATOMIC_LOAD(&rf->rf_effective_interval);
+    intervals_num++;
+  }
+  pthread_mutex_unlock(&read_lock);
+
+  for (size_t i = 0; i < intervals_num; i++) {
+    sstrncpy(vl.plugin_instance, intervals[i].name, sizeof(vl.plugin_instance));
+    vl.values = &(value_t){.gauge = CDTIME_T_TO_DOUBLE(intervals[i].interval)};
+    vl.values_len = 1;
+    sstrncpy(vl.type, "duration", sizeof(vl.type));
+    sstrncpy(vl.type_instance, "interval", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+  }
+  sfree(intervals);
+
+  if (load_shedding) {
+    sstrncpy(vl.plugin_instance, "load_shedding", sizeof(vl.plugin_instance));
+    vl.values = &(value_t){.gauge = (gauge_t)C_ATOMIC_LOAD(&shed_level)};
+    vl.values_len = 1;
+    sstrncpy(vl.type, "count", sizeof(vl.type));
+    sstrncpy(vl.type_instance, "level", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+  }
+
+  /* Deadline-driven flushes */
+  flush_entries_dispatch(&vl);
+
+  /* Callback latencies */
+  plugin_latency_dispatch(&vl);
+
   return 0;
 } /* }}} int plugin_update_internal_statistics */
 
+static int plugin_internal_stats_memstat(char const *name, /* {{{ */
+                                         int64_t bytes, int64_t objects,
+                                         void *user_data) {
+  struct {
+    plugin_internal_stat_cb callback;
+    void *user_data;
+    bool objects;
+  } *ctx = user_data;
+
+  if (ctx->objects)
+    ctx->callback("collectd_memory_objects",
+                  "Objects accounted by the subsystem.", false, "subsystem",
+                  name, (double)objects, ctx->user_data);
+  else
+    ctx->callback("collectd_memory_bytes", "Memory accounted by the subsystem.",
+                  false, "subsystem", name, (double)bytes, ctx->user_data);
+  return 0;
+} /* }}} int plugin_internal_stats_memstat */
+
+int plugin_internal_stats_foreach(plugin_internal_stat_cb cb, /* {{{ */
+                                  void *ud) {
+  if (cb == NULL)
+    return EINVAL;
+
+  /* Write queue */
+  cb("collectd_write_queue_length", "Value lists in the write queue.", false,
+     NULL, NULL, (double)C_ATOMIC_LOAD(&write_queue_length), ud);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(write_lanes); i++) {
+    long length = C_ATOMIC_LOAD(&write_lanes[i].length);
+    cb("collectd_write_lane_length", "Value lists in the write queue lane.",
+       false, "lane", write_lanes[i].name, (length > 0) ? (double)length : 0.0,
+       ud);
+  }
+  cb("collectd_write_queue_dropped_total",
+     "Value lists dropped because the write queue was full.", true, NULL, NULL,
+     (double)C_ATOMIC_LOAD(&stats_values_dropped), ud);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(write_lanes); i++)
+    cb("collectd_write_lane_dropped_total",
+       "Value lists dropped from the write queue lane.", true, "lane",
+       write_lanes[i].name, (double)C_ATOMIC_LOAD(&write_lanes[i].dropped),
+       ud);
+
+  /* Dedicated write queues. The list is only modified while the daemon is
+   * being configured or shut down. */
+  llist_t *lists[] = {list_write, list_write_batch};
+  const char *fields[] = {"length", "dropped"};
+  for (size_t f = 0; f < STATIC_ARRAY_SIZE(fields); f++) {
+    for (size_t i = 0; i < STATIC_ARRAY_SIZE(lists); i++) {
+      for (llentry_t *le = llist_head(lists[i]); le != NULL; le = le->next) {
+        writer_queue_t *wq = ((callback_func_t *)le->value)->cf_queue;
+        if (wq == NULL)
+          continue;
+
+        pthread_mutex_lock(&wq->lock);
+        double length = (double)wq->length;
+        double dropped = (double)wq->dropped;
+        pthread_mutex_unlock(&wq->lock);
+
+        if (f == 0)
+          cb("collectd_writer_queue_length",
+             "Value lists in the dedicated queue of the writer.", false,
+             "writer", wq->name, length, ud);
+        else
+          cb("collectd_writer_queue_dropped_total",
+             "Value lists dropped from the dedicated queue of the writer.",
+             true, "writer", wq->name, dropped, ud);
+      }
+    }
+  }
+
+  /* Notification queue */
+  if (notification_threads_num > 0) {
+    pthread_mutex_lock(&notification_lock);
+    double length = (double)notification_queue_length;
+    double dropped = (double)stats_notifications_dropped;
+    double coalesced = (double)stats_notifications_coalesced;
+    pthread_mutex_unlock(&notification_lock);
+
+    cb("collectd_notification_queue_length",
+       "Notifications waiting to be delivered.", false, NULL, NULL, length, ud);
+    cb("collectd_notification_queue_dropped_total",
+       "Notifications dropped because the queue was full.", true, NULL, NULL,
+       dropped, ud);
+    cb("collectd_notification_queue_coalesced_total",
+       "Notifications replaced by a newer one.", true, NULL, NULL, coalesced,
+       ud);
+  }
+
+  /* Cache */
+  cb("collectd_cache_entries", "Entries in the value cache.", false, NULL,
+     NULL, (double)uc_get_size(), ud);
+
+  /* Memory accounted by the subsystems, one metric at a time */
+  struct {
+    plugin_internal_stat_cb callback;
+    void *user_data;
+    bool objects;
+  } memstat_ctx = {cb, ud, false};
+  memstat_foreach(plugin_internal_stats_memstat, &memstat_ctx);
+  memstat_ctx.objects = true;
+  memstat_foreach(plugin_internal_stats_memstat, &memstat_ctx);
+
+  /* Threads */
+  size_t read_busy = 0;
+  size_t read_num = C_ATOMIC_LOAD(&read_workers_active);
+  for (size_t i = 0; i < read_num; i++)
+    if (C_ATOMIC_LOAD(&read_workers[i].busy))
+      read_busy++;
+  long write_idle = C_ATOMIC_LOAD(&write_waiters);
+
+  cb("collectd_threads", "Threads of the daemon.", false, "kind", "read",
+     (double)read_num, ud);
+  cb("collectd_threads", NULL, false, "kind", "write",
+     (double)write_threads_num, ud);
+  cb("collectd_threads", NULL, false, "kind", "notification",
+     (double)notification_threads_num, ud);
+  cb("collectd_threads_busy",
+     "Threads running a read callback or writing values.", false, "kind",
+     "read", (double)read_busy, ud);
+  cb("collectd_threads_busy", NULL, false, "kind", "write",
+     (write_idle < (long)write_threads_num)
+         ? (double)((long)write_threads_num - write_idle)
+         : 0.0,
+     ud);
+
+  if (load_shedding)
+    cb("collectd_load_shedding_level", "Current load shedding level.", false,
+       NULL, NULL, (double)C_ATOMIC_LOAD(&shed_level), ud);
+
+  /* Read callbacks */
+  const char *read_fields[] = {"calls", "failures", "seconds", "interval"};
+  pthread_mutex_lock(&read_lock);
+  for (size_t f = 0; f < STATIC_ARRAY_SIZE(read_fields); f++) {
+    for (llentry_t *le = llist_head(read_list); le != NULL; le = le->next) {
+      read_func_t *rf = le->value;
+
+      if (f == 0)
+        cb("collectd_read_calls_total", "Calls of the read callback.", true,
+           "callback", rf->rf_name, (double)C_ATOMIC_LOAD(&rf->rf_calls), ud);
+      else if (f == 1)
+        cb("collectd_read_failures_total",
+           "Calls of the read callback which failed.", true, "callback",
+           rf->rf_name, (double)C_ATOMIC_LOAD(&rf->rf_failures), ud);
+      else if (f == 2)
+        cb("collectd_read_seconds_total",
+           "Time spent in the read callback.", true, "callback", rf->rf_name,
+           CDTIME_T_TO_DOUBLE(C_ATOMIC_LOAD(&rf->rf_time)), ud);
+      else
+        cb("collectd_read_interval_seconds",
+           "Effective interval of the read callback.", false, "callback",
+           rf->rf_name,
+           CDTIME_T_TO_DOUBLE(C_ATOMIC_LOAD(&rf->rf_effective_interval)), ud);
+    }
+  }
+  pthread_mutex_unlock(&read_lock);
+
+  return 0;
+} /* }}} int plugin_internal_stats_foreach */
+
 static void free_userdata(user_data_t const *ud) /* {{{ */
 {
   if (ud == NULL)
@@ -201,14 +1163,329 @@ static void free_userdata(user_data_t const *ud) /* {{{ */
   }
 } /* }}} void free_userdata */
 
+/*
+ * Flush scheduling ("FlushInterval")
+ */
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+/* Entries which are due, ordered by deadline. */
+static c_heap_t *flush_heap;
+/* All entries, including the unregistered ones. */
+static flush_entry_t *flush_entries;
+static pthread_t flush_thread;
+static bool flush_thread_running;
+static bool flush_loop;
+
+static int flush_entry_compare(const void *a, const void *b) /* {{{ */
+{
+  const flush_entry_t *fe0 = a;
+  const flush_entry_t *fe1 = b;
+
+  if (fe0->deadline < fe1->deadline)
+    return -1;
+  else if (fe0->deadline > fe1->deadline)
+    return 1;
+  return 0;
+} /* }}} int flush_entry_compare */
+
+/* Schedules "fe" to be flushed at "deadline" unless it is already scheduled.
+ * Must be called with `flush_lock' held. */
+static void flush_entry_queue(flush_entry_t *fe, cdtime_t deadline) /* {{{ */
+{
+  if (fe->queued || fe->removed)
+    return;
+
+  fe->deadline = deadline;
+  if (c_heap_insert(flush_heap, fe) != 0) {
+    ERROR("plugin: Scheduling the flush of `%s' failed.", fe->name);
+    return;
+  }
+  C_ATOMIC_STORE(&fe->queued, true);
+
+  if (c_heap_peek_root(flush_heap) == fe)
+    pthread_cond_signal(&flush_cond);
+} /* }}} void flush_entry_queue */
+
+/* Called after "values_num" value lists have been handed to the write
+ * callback "cf". */
+static void plugin_flush_mark(callback_func_t *cf, size_t values_num) /* {{{ */
+{
+  flush_entry_t *fe = C_ATOMIC_LOAD_ACQ(&cf->cf_flush);
+  if (fe == NULL)
+    return;
+
+  C_ATOMIC_ADD(&fe->values_pending, (uint64_t)values_num);
+
+  /* Only the first write after a flush takes the lock. */
+  if (C_ATOMIC_LOAD(&fe->queued))
+    return;
+
+  pthread_mutex_lock(&flush_lock);
+  flush_entry_queue(fe, cdtime() + fe->interval);
+  pthread_mutex_unlock(&flush_lock);
+} /* }}} void plugin_flush_mark */
+
+/* Binds a new write callback to the flush entry of the same name, if any. */
+static void flush_entry_bind(callback_func_t *cf, const char *name) /* {{{ */
+{
+  pthread_mutex_lock(&flush_lock);
+  for (flush_entry_t *fe = flush_entries; fe != NULL; fe = fe->next) {
+    if (fe->removed || (strcmp(name, fe->name) != 0))
+      continue;
+    fe->writers++;
+    C_ATOMIC_STORE_REL(&cf->cf_flush, fe);
+    break;
+  }
+  pthread_mutex_unlock(&flush_lock);
+} /* }}} void flush_entry_bind */
+
+static void flush_entry_unbind(callback_func_t *cf) /* {{{ */
+{
+  flush_entry_t *fe = cf->cf_flush;
+  if (fe == NULL)
+    return;
+
+  pthread_mutex_lock(&flush_lock);
+  fe->writers--;
+  /* Without a writer, nobody marks the entry; fall back to flushing it
+   * periodically. */
+  if ((fe->writers == 0) && (flush_heap != NULL))
+    flush_entry_queue(fe, cdtime() + fe->interval);
+  pthread_mutex_unlock(&flush_lock);
+  cf->cf_flush = NULL;
+} /* }}} void flush_entry_unbind */
+
 static void destroy_callback(callback_func_t *cf) /* {{{ */
 {
   if (cf == NULL)
     return;
+  flush_entry_unbind(cf);
+  writer_queue_destroy(cf->cf_queue);
   free_userdata(&cf->cf_udata);
+  plugin_latency_unregister(cf->cf_latency);
   sfree(cf);
 } /* }}} void destroy_callback */
 
+/* Returns the snapshot belonging to "list" or NULL if the list has none. */
+static callback_array_t **callback_array_of(llist_t **list) /* {{{ */
+{
+  if (list == &list_write)
+    return &array_write;
+  else if (list == &list_write_batch)
+    return &array_write_batch;
+  else if (list == &list_flush)
+    return &array_flush;
+  else if (list == &list_log)
+    return &array_log;
+  else if (list == &list_notification)
+    return &array_notification;
+  return NULL;
+} /* }}} callback_array_t **callback_array_of */
+
+static int callback_entry_compare(const void *a, const void *b) /* {{{ */
+{
+  return strcasecmp(((const callback_entry_t *)a)->name,
+                    ((const callback_entry_t *)b)->name);
+} /* }}} int callback_entry_compare */
+
+/* Builds a snapshot of "list", leaving out "skip" if it is not NULL. An empty
+ * list results in a NULL snapshot. */
+static int callback_array_build(llist_t *list, /* {{{ */
+                                llentry_t const *skip,
+                                callback_array_t **ret) {
+  size_t num = 0;
+  for (llentry_t *le = llist_head(list); le != NULL; le = le->next)
+    if (le != skip)
+      num++;
+
+  *ret = NULL;
+  if (num == 0)
+    return 0;
+
+  callback_array_t *a =
+      calloc(1, sizeof(*a) + 2 * num * sizeof(a->entries[0]));
+  if (a == NULL) {
+    ERROR("plugin: callback_array_build: calloc failed.");
+    return ENOMEM;
+  }
+  a->num = num;
+  a->by_name = a->entries + num;
+
+  size_t i = 0;
+  for (llentry_t *le = llist_head(list); le != NULL; le = le->next) {
+    if (le == skip)
+      continue;
+    a->entries[i] = (callback_entry_t){.name = le->key, .cf = le->value};
+    i++;
+  }
+  memcpy(a->by_name, a->entries, num * sizeof(a->entries[0]));
+  qsort(a->by_name, num, sizeof(a->by_name[0]), callback_entry_compare);
+
+  *ret = a;
+  return 0;
+} /* }}} int callback_array_build */
+
+/* Replaces the snapshot "*array" with "a". The caller must hold
+ * `register_lock'. */
+static void callback_array_publish(callback_array_t **array, /* {{{ */
+                                   callback_array_t *a) {
+  callback_array_t *old = *array;
+
+  C_ATOMIC_STORE_REL(array, a);
+  if (old != NULL) {
+    old->retired_next = arrays_retired;
+    arrays_retired = old;
+  }
+} /* }}} void callback_array_publish */
+
+/* Rebuilds the snapshot of "list", if it has one. The caller must hold
+ * `register_lock'. */
+static int callback_array_update(llist_t **list, /* {{{ */
+                                 llentry_t const *skip) {
+  callback_array_t **array = callback_array_of(list);
+  if (array == NULL)
+    return 0;
+
+  callback_array_t *a = NULL;
+  int status = callback_array_build(*list, skip, &a);
+  if (status != 0)
+    return status;
+
+  callback_array_publish(array, a);
+  return 0;
+} /* }}} int callback_array_update */
+
+/* Hands "cf" and "key", which the caller has just removed from "list" or
+ * replaced in it, to the snapshot retired by the preceding
+ * callback_array_update(), which still refers to them. Returns false if
+ * "list" has no snapshots, in which case the caller frees them after
+ * releasing `register_lock'. The caller must hold `register_lock'. */
+static bool callback_array_retire(llist_t **list, /* {{{ */
+                                  callback_func_t *cf, char *key) {
+  if ((callback_array_of(list) == NULL) || (arrays_retired == NULL))
+    return false;
+
+  assert(arrays_retired->removed_cf == NULL);
+  arrays_retired->removed_cf = cf;
+  arrays_retired->removed_key = key;
+  return true;
+} /* }}} bool callback_array_retire */
+
+/* Returns the slot to pass to callback_reader_leave(). Nested sections are
+ * not counted: the outermost one holds up the grace period on its own. */
+static size_t callback_reader_enter(void) /* {{{ */
+{
+  if (plugin_ctx_key_initialized) {
+    uintptr_t state = (uintptr_t)pthread_getspecific(callback_reader_key);
+    pthread_setspecific(callback_reader_key, (void *)(state + 2));
+    if (state >= 2)
+      return CALLBACK_READER_NESTED;
+  }
+
+  size_t slot = (size_t)(C_ATOMIC_LOAD(&callback_epoch) & 1);
+  C_ATOMIC_ADD(&callback_readers[slot], 1);
+  return slot;
+} /* }}} size_t callback_reader_enter */
+
+static void callback_array_reclaim(void);
+
+static void callback_reader_leave(size_t slot) /* {{{ */
+{
+  if (slot != CALLBACK_READER_NESTED)
+    C_ATOMIC_SUB(&callback_readers[slot], 1);
+
+  if (!plugin_ctx_key_initialized)
+    return;
+
+  uintptr_t state = (uintptr_t)pthread_getspecific(callback_reader_key) - 2;
+  if (state == 1) {
+    /* Leaving the outermost section: catch up on the reclaim deferred by
+     * callback_array_reclaim(). */
+    pthread_setspecific(callback_reader_key, NULL);
+    callback_array_reclaim();
+    return;
+  }
+  pthread_setspecific(callback_reader_key, (void *)state);
+} /* }}} void callback_reader_leave */
+
+/* Waits until every thread which was using a snapshot when this function was
+ * called has left. The two slots are flipped twice: a reader may have read
+ * the epoch just before the first flip and only incremented its slot after
+ * it has been checked. */
+static void callback_readers_wait(void) /* {{{ */
+{
+  pthread_mutex_lock(&reclaim_lock);
+  C_ATOMIC_FENCE();
+  for (int i = 0; i < 2; i++) {
+    uint64_t epoch = C_ATOMIC_LOAD(&callback_epoch);
+    C_ATOMIC_STORE(&callback_epoch, epoch + 1);
+    while (C_ATOMIC_LOAD(&callback_readers[epoch & 1]) != 0)
+      nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+  }
+  pthread_mutex_unlock(&reclaim_lock);
+} /* }}} void callback_readers_wait */
+
+/* Frees the retired snapshots and the callbacks removed with them after a
+ * grace period. Called after each change of the lists, without holding
+ * `register_lock'. A thread inside a callback can't wait for itself, so it
+ * defers the reclaim until it leaves the outermost section. */
+static void callback_array_reclaim(void) /* {{{ */
+{
+  if (plugin_ctx_key_initialized) {
+    uintptr_t state = (uintptr_t)pthread_getspecific(callback_reader_key);
+    if (state >= 2) {
+      pthread_setspecific(callback_reader_key, (void *)(state | 1));
+      return;
+    }
+  }
+
+  pthread_mutex_lock(&register_lock);
+  callback_array_t *a = arrays_retired;
+  arrays_retired = NULL;
+  pthread_mutex_unlock(&register_lock);
+
+  if (a == NULL)
+    return;
+
+  /* The snapshots have been replaced before they were taken off the list,
+   * so threads entering from now on don't see them. */
+  callback_readers_wait();
+
+  /* Free callbacks may unregister other callbacks, so they are called
+   * without holding `register_lock'. */
+  while (a != NULL) {
+    callback_array_t *next = a->retired_next;
+    if (a->removed_cf != NULL)
+      destroy_callback(a->removed_cf);
+    sfree(a->removed_key);
+    sfree(a);
+    a = next;
+  }
+} /* }}} void callback_array_reclaim */
+
+/* Returns the callback called "name" (case-insensitive) or NULL. */
+static callback_entry_t const *
+callback_array_find(callback_array_t const *a, const char *name) /* {{{ */
+{
+  if (a == NULL)
+    return NULL;
+
+  size_t lo = 0;
+  size_t hi = a->num;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcasecmp(name, a->by_name[mid].name);
+    if (cmp == 0)
+      return a->by_name + mid;
+    else if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return NULL;
+} /* }}} callback_entry_t const *callback_array_find */
+
 static void destroy_all_callbacks(llist_t **list) /* {{{ */
 {
   llentry_t *le;
@@ -216,6 +1493,14 @@ static void destroy_all_callbacks(llist_t **list) /* {{{ */
   if (*list == NULL)
     return;
 
+  callback_array_t **array = callback_array_of(list);
+  if (array != NULL) {
+    pthread_mutex_lock(&register_lock);
+    callback_array_publish(array, NULL);
+    pthread_mutex_unlock(&register_lock);
+    callback_array_reclaim();
+  }
+
   le = llist_head(*list);
   while (le != NULL) {
     llentry_t *le_next;
@@ -257,9 +1542,11 @@ static int register_callback(llist_t **list, /* {{{ */
   llentry_t *le;
   char *key;
 
+  pthread_mutex_lock(&register_lock);
   if (*list == NULL) {
     *list = llist_create();
     if (*list == NULL) {
+      pthread_mutex_unlock(&register_lock);
       ERROR("plugin: register_callback: "
             "llist_create failed.");
       destroy_callback(cf);
@@ -269,6 +1556,7 @@ static int register_callback(llist_t **list, /* {{{ */
 
   key = strdup(name);
   if (key == NULL) {
+    pthread_mutex_unlock(&register_lock);
     ERROR("plugin: register_callback: strdup failed.");
     destroy_callback(cf);
     return -1;
@@ -278,6 +1566,7 @@ static int register_callback(llist_t **list, /* {{{ */
   if (le == NULL) {
     le = llentry_create(key, cf);
     if (le == NULL) {
+      pthread_mutex_unlock(&register_lock);
       ERROR("plugin: register_callback: "
             "llentry_create failed.");
       sfree(key);
@@ -286,19 +1575,41 @@ static int register_callback(llist_t **list, /* {{{ */
     }
 
     llist_append(*list, le);
+    if (callback_array_update(list, /* skip = */ NULL) != 0) {
+      llist_remove(*list, le);
+      pthread_mutex_unlock(&register_lock);
+      llentry_destroy(le);
+      sfree(key);
+      destroy_callback(cf);
+      return ENOMEM;
+    }
+    pthread_mutex_unlock(&register_lock);
+    callback_array_reclaim();
   } else {
     callback_func_t *old_cf;
 
     old_cf = le->value;
     le->value = cf;
+    if (callback_array_update(list, /* skip = */ NULL) != 0) {
+      le->value = old_cf;
+      pthread_mutex_unlock(&register_lock);
+      sfree(key);
+      destroy_callback(cf);
+      return ENOMEM;
+    }
+    /* The entry keeps its key. */
+    bool retired = callback_array_retire(list, old_cf, /* key = */ NULL);
+    pthread_mutex_unlock(&register_lock);
 
     P_WARNING("register_callback: "
               "a callback named `%s' already exists - "
               "overwriting the old entry!",
               name);
 
-    destroy_callback(old_cf);
+    if (!retired)
+      destroy_callback(old_cf);
     sfree(key);
+    callback_array_reclaim();
   }
 
   return 0;
@@ -367,27 +1678,58 @@ static int create_register_callback(llist_t **list, /* {{{ */
   }
 
   cf->cf_ctx = plugin_get_ctx();
+  /* Only valid during the current read callback. */
+  cf->cf_ctx.aligned_time = 0;
+
+  if ((list == &list_write) || (list == &list_write_batch)) {
+    cf->cf_latency = plugin_latency_register("write", name);
+    flush_entry_bind(cf, name);
+
+    if (cf->cf_ctx.write_queue) {
+      cf->cf_queue = writer_queue_create(cf, name, list == &list_write_batch);
+      if (cf->cf_queue == NULL) {
+        destroy_callback(cf);
+        return ENOMEM;
+      }
+      /* Registered after the write threads were started. */
+      if (write_threads != NULL)
+        writer_queue_start(cf->cf_queue);
+    }
+  } else if (list == &list_flush)
+    cf->cf_latency = plugin_latency_register("flush", name);
 
   return register_callback(list, name, cf);
 } /* }}} int create_register_callback */
 
-static int plugin_unregister(llist_t *list, const char *name) /* {{{ */
+static int plugin_unregister(llist_t **list, const char *name) /* {{{ */
 {
   llentry_t *e;
 
-  if (list == NULL)
+  if (*list == NULL)
     return -1;
 
-  e = llist_search(list, name);
-  if (e == NULL)
+  pthread_mutex_lock(&register_lock);
+  e = llist_search(*list, name);
+  if (e == NULL) {
+    pthread_mutex_unlock(&register_lock);
     return -1;
+  }
 
-  llist_remove(list, e);
+  if (callback_array_update(list, /* skip = */ e) != 0) {
+    pthread_mutex_unlock(&register_lock);
+    return -1;
+  }
+  llist_remove(*list, e);
+  bool retired = callback_array_retire(list, e->value, e->key);
+  pthread_mutex_unlock(&register_lock);
 
-  sfree(e->key);
-  destroy_callback(e->value);
+  if (!retired) {
+    sfree(e->key);
+    destroy_callback(e->value);
+  }
 
   llentry_destroy(e);
+  callback_array_reclaim();
 
   return 0;
 } /* }}} int plugin_unregister */
@@ -433,29 +1775,363 @@ static int plugin_load_file(char const *file, bool global) {
   return 0;
 }
 
-static void *plugin_read_thread(void __attribute__((unused)) * args) {
-  while (read_loop != 0) {
-    read_func_t *rf;
-    plugin_ctx_t old_ctx;
-    cdtime_t start;
-    cdtime_t now;
-    cdtime_t elapsed;
-    int status;
-    int rf_type;
-    int rc;
-
-    /* Get the read function that needs to be read next.
-     * We don't need to hold "read_lock" for the heap, but we need
-     * to call c_heap_get_root() and pthread_cond_wait() in the
-     * same protected block. */
-    pthread_mutex_lock(&read_lock);
-    rf = c_heap_get_root(read_heap);
-    if (rf == NULL) {
-      pthread_cond_wait(&read_cond, &read_lock);
-      pthread_mutex_unlock(&read_lock);
+static int plugin_compare_read_func(const void *arg0, const void *arg1) {
+  const read_func_t *rf0;
+  const read_func_t *rf1;
+
+  rf0 = arg0;
+  rf1 = arg1;
+
+  if (rf0->rf_next_read < rf1->rf_next_read)
+    return -1;
+  else if (rf0->rf_next_read > rf1->rf_next_read)
+    return 1;
+  else
+    return 0;
+} /* int plugin_compare_read_func */
+
+/* Returns the first point in time not before `t' which is in the phase of
+ * `rf', i.e. at which the read function should be called according to the
+ * "ReadPhaseMode" option. The phase is derived from the read function's name,
+ * so it remains the same across restarts. */
+static cdtime_t read_func_phase_next(read_func_t const *rf, cdtime_t t) {
+  cdtime_t interval = rf->rf_interval;
+
+  if ((read_phase_mode == READ_PHASE_NONE) || (interval == 0))
+    return t;
+
+  cdtime_t phase = 0;
+  if (read_phase_mode == READ_PHASE_SPREAD) {
+    /* Spread the 32 bit hash over the full range of 64 bit values. */
+    uint64_t h = (uint64_t)identifier_hash(rf->rf_name);
+    phase = (cdtime_t)((h * UINT64_C(0x9E3779B97F4A7C15)) % interval);
+  }
+
+  cdtime_t offset = (t + interval - phase) % interval;
+  if (offset == 0)
+    return t;
+  return t + (interval - offset);
+} /* cdtime_t read_func_phase_next */
+
+/* Returns the time of the monotonic clock, which doesn't jump when the system
+ * time is changed. The read threads sleep on this clock. */
+static cdtime_t read_clock_monotonic(void) {
+#if HAVE_CLOCK_GETTIME
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return TIMESPEC_TO_CDTIME_T(&ts);
+#endif
+  return cdtime();
+} /* cdtime_t read_clock_monotonic */
+
+static void read_worker_init(read_worker_t *w) {
+  pthread_mutex_init(&w->lock, /* attr = */ NULL);
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+#if HAVE_PTHREAD_CONDATTR_SETCLOCK && HAVE_CLOCK_GETTIME
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+  pthread_cond_init(&w->cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+#if READ_WORKER_TIMERFD
+  w->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  w->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if ((w->timer_fd < 0) || (w->event_fd < 0)) {
+    WARNING("plugin: Creating the timer of a read thread failed: %s. "
+            "Falling back to pthread_cond_timedwait(3).",
+            STRERRNO);
+    if (w->timer_fd >= 0)
+      close(w->timer_fd);
+    if (w->event_fd >= 0)
+      close(w->event_fd);
+    w->timer_fd = w->event_fd = -1;
+  }
+#endif
+} /* void read_worker_init */
+
+static void read_worker_destroy(read_worker_t *w) {
+#if READ_WORKER_TIMERFD
+  if (w->timer_fd >= 0) {
+    close(w->timer_fd);
+    close(w->event_fd);
+  }
+#endif
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->lock);
+} /* void read_worker_destroy */
+
+/* Must be called with `w->lock' held. */
+static void read_worker_signal(read_worker_t *w) {
+  w->wakeups++;
+#if READ_WORKER_TIMERFD
+  if (w->timer_fd >= 0) {
+    uint64_t one = 1;
+    /* EAGAIN means the counter is about to overflow, i.e. a wakeup is pending
+     * anyway. */
+    if ((write(w->event_fd, &one, sizeof(one)) < 0) && (errno != EAGAIN))
+      ERROR("plugin: Waking up a read thread failed: %s", STRERRNO);
+    return;
+  }
+#endif
+  pthread_cond_signal(&w->cond);
+} /* void read_worker_signal */
+
+#if READ_WORKER_TIMERFD
+static void read_worker_wait_fd(read_worker_t *w, cdtime_t timeout) {
+  struct itimerspec its = {{0, 0}, {0, 0}};
+  if (timeout != 0)
+    its.it_value = CDTIME_T_TO_TIMESPEC(read_clock_monotonic() + timeout);
+  timerfd_settime(w->timer_fd, TFD_TIMER_ABSTIME, &its, /* old = */ NULL);
+
+  struct pollfd fds[] = {
+      {.fd = w->event_fd, .events = POLLIN},
+      {.fd = w->timer_fd, .events = POLLIN},
+  };
+  /* A signal sent while the lock is released is kept by the eventfd, so it
+   * can't get lost. */
+  pthread_mutex_unlock(&w->lock);
+  int status = poll(fds, STATIC_ARRAY_SIZE(fds), /* timeout = */ -1);
+  pthread_mutex_lock(&w->lock);
+
+  if ((status > 0) && (fds[0].revents & POLLIN)) {
+    uint64_t tmp;
+    if ((read(w->event_fd, &tmp, sizeof(tmp)) < 0) && (errno != EAGAIN))
+      ERROR("plugin: Reading the eventfd of a read thread failed: %s",
+            STRERRNO);
+  }
+} /* void read_worker_wait_fd */
+#endif
+
+/* Blocks until the worker is signaled or `deadline' has passed, whichever
+ * comes first. A `deadline' of zero waits for a signal only. Spurious
+ * wakeups are possible, so callers must re-evaluate their condition. Must be
+ * called with `w->lock' held.
+ *
+ * Deadlines are given in system time (see cdtime()), but the wait itself uses
+ * the monotonic clock, so that a change of the system time doesn't delay or
+ * hurry the wakeup. */
+static void read_worker_wait(read_worker_t *w, cdtime_t deadline) {
+  cdtime_t timeout = 0;
+  if (deadline != 0) {
+    cdtime_t now = cdtime();
+    if (deadline <= now)
+      return;
+    timeout = deadline - now;
+  }
+
+#if READ_WORKER_TIMERFD
+  if (w->timer_fd >= 0) {
+    read_worker_wait_fd(w, timeout);
+    return;
+  }
+#endif
+
+  if (timeout == 0) {
+    pthread_cond_wait(&w->cond, &w->lock);
+    return;
+  }
+
+#if HAVE_PTHREAD_CONDATTR_SETCLOCK && HAVE_CLOCK_GETTIME
+  cdtime_t abs_time = read_clock_monotonic() + timeout;
+#else
+  cdtime_t abs_time = deadline;
+#endif
+  pthread_cond_timedwait(&w->cond, &w->lock, &CDTIME_T_TO_TIMESPEC(abs_time));
+} /* void read_worker_wait */
+
+/* Wakes up one idle worker so it takes the read functions of the (now busy)
+ * worker `self' into account. */
+static void read_worker_poke(read_worker_t *self) {
+  size_t num = C_ATOMIC_LOAD(&read_workers_active);
+  size_t id = (size_t)(self - read_workers);
+
+  for (size_t i = 1; i < num; i++) {
+    read_worker_t *w = read_workers + ((id + i) % num);
+
+    if (pthread_mutex_trylock(&w->lock) != 0)
+      continue;
+
+    if (!w->busy) {
+      read_worker_signal(w);
+      pthread_mutex_unlock(&w->lock);
+      return;
+    }
+    pthread_mutex_unlock(&w->lock);
+  }
+} /* void read_worker_poke */
+
+/* Looks for an overdue read function of a busy worker and removes it from
+ * that worker's heap. If none is found, `deadline' is lowered to the time the
+ * next read function of a busy worker is due. */
+static read_func_t *read_worker_steal(read_worker_t *self, cdtime_t now,
+                                      cdtime_t *deadline) {
+  size_t num = C_ATOMIC_LOAD(&read_workers_active);
+  size_t id = (size_t)(self - read_workers);
+
+  for (size_t i = 1; i < num; i++) {
+    read_worker_t *w = read_workers + ((id + i) % num);
+
+    /* Don't wait for workers which are busy rescheduling; we'll check again
+     * soon enough. */
+    if (pthread_mutex_trylock(&w->lock) != 0)
       continue;
+
+    read_func_t *rf = w->busy ? c_heap_peek_root(w->heap) : NULL;
+    if ((rf != NULL) && (rf->rf_next_read <= now)) {
+      c_heap_get_root(w->heap);
+      pthread_mutex_unlock(&w->lock);
+      DEBUG("plugin_read_thread: Stole `%s' from a busy read thread.",
+            rf->rf_name);
+      return rf;
     }
-    pthread_mutex_unlock(&read_lock);
+
+    if ((rf != NULL) && ((*deadline == 0) || (rf->rf_next_read < *deadline)))
+      *deadline = rf->rf_next_read;
+    pthread_mutex_unlock(&w->lock);
+  }
+
+  return NULL;
+} /* read_func_t *read_worker_steal */
+
+/* Blocks until one of the worker's own read functions is due or an overdue
+ * read function can be stolen. Marks the worker as busy and returns the read
+ * function. Returns NULL when the read threads are being stopped. */
+static read_func_t *read_worker_next(read_worker_t *self) {
+  read_func_t *rf = NULL;
+
+  pthread_mutex_lock(&self->lock);
+  while (read_loop != 0) {
+    cdtime_t now = cdtime();
+
+    rf = c_heap_peek_root(self->heap);
+    if ((rf != NULL) && (rf->rf_next_read <= now)) {
+      c_heap_get_root(self->heap);
+      break;
+    }
+
+    /* Read functions are never scheduled more than two intervals ahead (one
+     * interval plus the phase), so the system time has been set back. Lowering
+     * the root's key keeps the heap ordered. */
+    if ((rf != NULL) &&
+        ((rf->rf_next_read - now) > 2 * rf->rf_effective_interval)) {
+      NOTICE("plugin: The system time has been set back, rescheduling the "
+             "read function of the `%s' plugin.",
+             rf->rf_name);
+      rf->rf_next_read = read_func_phase_next(rf, now);
+      continue;
+    }
+
+    cdtime_t deadline = (rf != NULL) ? rf->rf_next_read : 0;
+    unsigned wakeups = self->wakeups;
+
+    pthread_mutex_unlock(&self->lock);
+    rf = read_worker_steal(self, now, &deadline);
+    pthread_mutex_lock(&self->lock);
+
+    if (rf != NULL)
+      break;
+
+    /* Somebody signaled us while we were looking at the other workers. */
+    if (wakeups != self->wakeups)
+      continue;
+
+    /* Spurious wakeups are possible, thus we re-evaluate the condition
+     * every time this returns. */
+    read_worker_wait(self, deadline);
+  }
+
+  if (read_loop == 0)
+    rf = NULL;
+
+  bool poke = false;
+  if (rf != NULL) {
+    self->busy = true;
+    poke = (c_heap_peek_root(self->heap) != NULL);
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  if (poke)
+    read_worker_poke(self);
+
+  return rf;
+} /* read_func_t *read_worker_next */
+
+/* Puts `rf' (back) into the worker's heap and marks the worker as idle. */
+static void read_worker_done(read_worker_t *self, read_func_t *rf) {
+  pthread_mutex_lock(&self->lock);
+  self->busy = false;
+  if (rf != NULL)
+    c_heap_insert(self->heap, rf);
+  pthread_mutex_unlock(&self->lock);
+} /* void read_worker_done */
+
+/* Adjusts `shed_level' to the write queue length, at most once per second. */
+static void load_shed_update(cdtime_t now) /* {{{ */
+{
+  if (!load_shedding || (pthread_mutex_trylock(&shed_lock) != 0))
+    return;
+
+  if ((now - shed_last_update) < TIME_T_TO_CDTIME_T(1)) {
+    pthread_mutex_unlock(&shed_lock);
+    return;
+  }
+  shed_last_update = now;
+
+  long wql = C_ATOMIC_LOAD(&write_queue_length);
+  int level = shed_level;
+  if ((wql >= write_limit_high) && (level < SHED_LEVEL_MAX))
+    level++;
+  else if ((wql < write_limit_low) && (level > 0))
+    level--;
+
+  if (level != shed_level) {
+    if (level > shed_level)
+      NOTICE("plugin: The write queue holds %ld values. Raising the load "
+             "shedding level to %d.",
+             wql, level);
+    else
+      INFO("plugin: The write queue holds %ld values. Lowering the load "
+           "shedding level to %d.",
+           wql, level);
+    C_ATOMIC_STORE(&shed_level, level);
+  }
+  pthread_mutex_unlock(&shed_lock);
+} /* }}} void load_shed_update */
+
+/* Returns the read interval of "rf" at the current load shedding level. */
+static cdtime_t load_shed_interval(read_func_t const *rf) /* {{{ */
+{
+  int level = C_ATOMIC_LOAD(&shed_level);
+  int shift = 0;
+
+  if (rf->rf_ctx.priority == PLUGIN_PRIORITY_LOW)
+    shift = (level < SHED_SHIFT_MAX) ? level : SHED_SHIFT_MAX;
+  else if (rf->rf_ctx.priority == PLUGIN_PRIORITY_NORMAL)
+    shift = (level > SHED_SHIFT_MAX) ? level - SHED_SHIFT_MAX : 0;
+
+  if (shift == 0)
+    return rf->rf_interval;
+
+  cdtime_t interval = rf->rf_interval << shift;
+  if (interval > max_read_interval)
+    interval = (rf->rf_interval > max_read_interval) ? rf->rf_interval
+                                                     : max_read_interval;
+  return interval;
+} /* }}} cdtime_t load_shed_interval */
+
+static void *plugin_read_thread(void *args) {
+  read_worker_t *self = args;
+  read_func_t *rf;
+
+  while ((rf = read_worker_next(self)) != NULL) {
+    plugin_ctx_t old_ctx;
+    cdtime_t start;
+    cdtime_t now;
+    cdtime_t elapsed;
+    int status;
+    int rf_type;
 
     if (rf->rf_interval == 0) {
       /* this should not happen, because the interval is set
@@ -467,30 +2143,8 @@ static void *plugin_read_thread(void __attribute__((unused)) * args) {
       rf->rf_next_read = cdtime();
     }
 
-    /* sleep until this entry is due,
-     * using pthread_cond_timedwait */
-    pthread_mutex_lock(&read_lock);
-    /* In pthread_cond_timedwait, spurious wakeups are possible
-     * (and really happen, at least on NetBSD with > 1 CPU), thus
-     * we need to re-evaluate the condition every time
-     * pthread_cond_timedwait returns. */
-    rc = 0;
-    while ((read_loop != 0) && (cdtime() < rf->rf_next_read) && rc == 0) {
-      rc = pthread_cond_timedwait(&read_cond, &read_lock,
-                                  &CDTIME_T_TO_TIMESPEC(rf->rf_next_read));
-    }
-
-    /* Must hold `read_lock' when accessing `rf->rf_type'. */
-    rf_type = rf->rf_type;
-    pthread_mutex_unlock(&read_lock);
-
-    /* Check if we're supposed to stop.. This may have interrupted
-     * the sleep, too. */
-    if (read_loop == 0) {
-      /* Insert `rf' again, so it can be free'd correctly */
-      c_heap_insert(read_heap, rf);
-      break;
-    }
+    /* `rf_type' is changed by `plugin_unregister_read' concurrently. */
+    rf_type = C_ATOMIC_LOAD(&rf->rf_type);
 
     /* The entry has been marked for deletion. The linked list
      * entry has already been removed by `plugin_unregister_read'.
@@ -502,7 +2156,7 @@ static void *plugin_read_thread(void __attribute__((unused)) * args) {
             rf->rf_name);
       sfree(rf->rf_name);
       destroy_callback((callback_func_t *)rf);
-      rf = NULL;
+      read_worker_done(self, NULL);
       continue;
     }
 
@@ -510,8 +2164,21 @@ static void *plugin_read_thread(void __attribute__((unused)) * args) {
 
     start = cdtime();
 
-    old_ctx = plugin_set_ctx(rf->rf_ctx);
+    plugin_ctx_t ctx = rf->rf_ctx;
+    if (read_phase_mode != READ_PHASE_NONE) {
+      /* Timestamp values with the start of the interval, independent of the
+       * read function's phase. */
+      ctx.aligned_time = start - (start % rf->rf_interval);
+    } else if ((start >= rf->rf_next_read) &&
+               ((start - rf->rf_next_read) < rf->rf_interval)) {
+      /* Timestamp values with the time the read was due, so that the times of
+       * consecutive reads are exactly one interval apart, regardless of how
+       * late the thread woke up. */
+      ctx.aligned_time = rf->rf_next_read;
+    }
+    old_ctx = plugin_set_ctx(ctx);
 
+    C_PROBE1(read__start, rf->rf_name);
     if (rf_type == RF_SIMPLE) {
       int (*callback)(void);
 
@@ -525,30 +2192,42 @@ static void *plugin_read_thread(void __attribute__((unused)) * args) {
       callback = rf->rf_callback;
       status = (*callback)(&rf->rf_udata);
     }
+    C_PROBE2(read__done, rf->rf_name, status);
 
     plugin_set_ctx(old_ctx);
 
+    if (record_statistics)
+      plugin_latency_stop(rf->rf_latency, start);
+
+    /* update the ``next read due'' field */
+    now = cdtime();
+    load_shed_update(now);
+
     /* If the function signals failure, we will increase the
      * intervals in which it will be called. */
     if (status != 0) {
-      rf->rf_effective_interval *= 2;
-      if (rf->rf_effective_interval > max_read_interval)
-        rf->rf_effective_interval = max_read_interval;
+      cdtime_t interval = rf->rf_effective_interval * 2;
+      if (interval > max_read_interval)
+        interval = max_read_interval;
+      C_ATOMIC_STORE(&rf->rf_effective_interval, interval);
 
       NOTICE("read-function of plugin `%s' failed. "
              "Will suspend it for %.3f seconds.",
              rf->rf_name, CDTIME_T_TO_DOUBLE(rf->rf_effective_interval));
     } else {
-      /* Success: Restore the interval, if it was changed. */
-      rf->rf_effective_interval = rf->rf_interval;
+      /* Success: Restore the interval, if it was changed, unless the write
+       * queue is overloaded. */
+      C_ATOMIC_STORE(&rf->rf_effective_interval, load_shed_interval(rf));
     }
 
-    /* update the ``next read due'' field */
-    now = cdtime();
-
     /* calculate the time spent in the read function */
     elapsed = (now - start);
 
+    C_ATOMIC_ADD(&rf->rf_calls, 1);
+    if (status != 0)
+      C_ATOMIC_ADD(&rf->rf_failures, 1);
+    C_ATOMIC_ADD(&rf->rf_time, elapsed);
+
     if (elapsed > rf->rf_effective_interval)
       WARNING(
           "plugin_read_thread: read-function of the `%s' plugin took %.3f "
@@ -577,12 +2256,15 @@ static void *plugin_read_thread(void __attribute__((unused)) * args) {
       rf->rf_next_read = now;
     }
 
+    /* Keep the read function in its phase, e.g. after it was late. */
+    rf->rf_next_read = read_func_phase_next(rf, rf->rf_next_read);
+
     DEBUG("plugin_read_thread: Next read of the `%s' plugin at %.3f.",
           rf->rf_name, CDTIME_T_TO_DOUBLE(rf->rf_next_read));
 
-    /* Re-insert this read function into the heap again. */
-    c_heap_insert(read_heap, rf);
-  } /* while (read_loop) */
+    /* Re-insert this read function into our heap again. */
+    read_worker_done(self, rf);
+  } /* while (read_worker_next) */
 
   pthread_exit(NULL);
   return (void *)0;
@@ -616,35 +2298,136 @@ static void set_thread_name(pthread_t tid, char const *name) {
 #endif
 }
 
+/* CPUs the read and write threads are bound to, see the "ReadThreadsCPUs" and
+ * "WriteThreadsCPUs" options. The n-th thread of a pool is bound to the n-th
+ * core group, in turn, so "0-3" lets all threads use CPUs 0 to 3, while
+ * "[0-3]" binds each thread to one of them. */
+static core_groups_list_t read_threads_cpus;
+static core_groups_list_t write_threads_cpus;
+static size_t writer_queues_started;
+
+static void thread_cpus_configure(char const *option, /* {{{ */
+                                  core_groups_list_t *cgl) {
+  config_cores_cleanup(cgl);
+
+  char const *value = global_option_get(option);
+  if ((value == NULL) || (value[0] == 0))
+    return;
+
+  oconfig_value_t v = {.type = OCONFIG_TYPE_STRING};
+  v.value.string = (char *)value;
+  oconfig_item_t ci = {.key = (char *)option, .values = &v, .values_num = 1};
+
+  if (config_cores_parse(&ci, cgl) != 0)
+    ERROR("plugin: Parsing the CPUs of \"%s\" failed. The threads will not "
+          "be bound to CPUs.",
+          option);
+} /* }}} void thread_cpus_configure */
+
+/* Binds a thread to its core group. Threads block waiting for work right after
+ * having been started, so the memory they allocate per thread is first touched
+ * on, and thereby allocated local to, the CPUs they are bound to. */
+static void thread_cpus_apply(pthread_t tid, /* {{{ */
+                              core_groups_list_t const *cgl, size_t index) {
+  if (cgl->num_cgroups == 0)
+    return;
+
+#if HAVE_PTHREAD_SETAFFINITY_NP
+  core_group_t const *cg = cgl->cgroups + (index % cgl->num_cgroups);
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < cg->num_cores; i++) {
+    if (cg->cores[i] >= CPU_SETSIZE) {
+      WARNING("plugin: CPU %u is out of range.", cg->cores[i]);
+      continue;
+    }
+    CPU_SET(cg->cores[i], &set);
+  }
+
+  int status = pthread_setaffinity_np(tid, sizeof(set), &set);
+  if (status != 0)
+    WARNING("plugin: Binding a thread to the CPUs \"%s\" failed: %s",
+            cg->desc, STRERROR(status));
+#else
+  static bool warned;
+  if (!warned) {
+    WARNING("plugin: Binding threads to CPUs is not supported on this "
+            "system.");
+    warned = true;
+  }
+#endif
+} /* }}} void thread_cpus_apply */
+
 static void start_read_threads(size_t num) /* {{{ */
 {
   if (read_threads != NULL)
     return;
 
   read_threads = (pthread_t *)calloc(num, sizeof(pthread_t));
-  if (read_threads == NULL) {
+  read_workers = calloc(num, sizeof(*read_workers));
+  if ((read_threads == NULL) || (read_workers == NULL)) {
     ERROR("plugin: start_read_threads: calloc failed.");
+    sfree(read_threads);
+    sfree(read_workers);
     return;
   }
 
+  for (size_t i = 0; i < num; i++) {
+    read_worker_t *w = read_workers + i;
+
+    read_worker_init(w);
+    /* The heap is protected by the worker's lock. */
+    w->heap = c_heap_create_ex(plugin_compare_read_func, C_HEAP_UNLOCKED,
+                               /* index_offset = */ 0);
+    if (w->heap == NULL) {
+      ERROR("plugin: start_read_threads: c_heap_create_ex failed.");
+      num = i;
+      break;
+    }
+  }
+  read_workers_num = num;
+
   read_threads_num = 0;
   for (size_t i = 0; i < num; i++) {
     int status = pthread_create(read_threads + read_threads_num,
                                 /* attr = */ NULL, plugin_read_thread,
-                                /* arg = */ NULL);
+                                /* arg = */ read_workers + read_threads_num);
     if (status != 0) {
       ERROR("plugin: start_read_threads: pthread_create failed with status %i "
             "(%s).",
             status, STRERROR(status));
-      return;
+      break;
     }
 
     char name[THREAD_NAME_MAX];
     snprintf(name, sizeof(name), "reader#%" PRIsz, read_threads_num);
     set_thread_name(read_threads[read_threads_num], name);
+    thread_cpus_apply(read_threads[read_threads_num], &read_threads_cpus,
+                      read_threads_num);
 
     read_threads_num++;
   } /* for (i) */
+
+  /* Distribute the read functions registered so far over the threads. */
+  pthread_mutex_lock(&read_lock);
+  C_ATOMIC_STORE(&read_workers_active, read_threads_num);
+  if (read_threads_num > 0) {
+    read_func_t *rf;
+    while ((rf = c_heap_get_root(read_heap)) != NULL) {
+      /* "ReadPhaseMode" is only known now. */
+      rf->rf_next_read = read_func_phase_next(rf, rf->rf_next_read);
+
+      read_worker_t *w = read_workers + (read_workers_next % read_threads_num);
+      read_workers_next++;
+
+      pthread_mutex_lock(&w->lock);
+      c_heap_insert(w->heap, rf);
+      read_worker_signal(w);
+      pthread_mutex_unlock(&w->lock);
+    }
+  }
+  pthread_mutex_unlock(&read_lock);
 } /* }}} void start_read_threads */
 
 static void stop_read_threads(void) {
@@ -653,11 +2436,15 @@ static void stop_read_threads(void) {
 
   INFO("collectd: Stopping %" PRIsz " read threads.", read_threads_num);
 
-  pthread_mutex_lock(&read_lock);
   read_loop = 0;
-  DEBUG("plugin: stop_read_threads: Signalling `read_cond'");
-  pthread_cond_broadcast(&read_cond);
-  pthread_mutex_unlock(&read_lock);
+  for (size_t i = 0; i < read_threads_num; i++) {
+    read_worker_t *w = read_workers + i;
+
+    DEBUG("plugin: stop_read_threads: Signalling read thread #%" PRIsz, i);
+    pthread_mutex_lock(&w->lock);
+    read_worker_signal(w);
+    pthread_mutex_unlock(&w->lock);
+  }
 
   for (size_t i = 0; i < read_threads_num; i++) {
     if (pthread_join(read_threads[i], NULL) != 0) {
@@ -666,9 +2453,486 @@ static void stop_read_threads(void) {
     read_threads[i] = (pthread_t)0;
   }
   sfree(read_threads);
+
+  /* Move the read functions back to `read_heap', so `destroy_read_heap' can
+   * free them. */
+  pthread_mutex_lock(&read_lock);
+  C_ATOMIC_STORE(&read_workers_active, 0);
+  for (size_t i = 0; i < read_workers_num; i++) {
+    read_worker_t *w = read_workers + i;
+    read_func_t *rf;
+
+    while ((rf = c_heap_get_root(w->heap)) != NULL)
+      c_heap_insert(read_heap, rf);
+
+    c_heap_destroy(w->heap);
+    w->heap = NULL;
+    read_worker_destroy(w);
+  }
+  sfree(read_workers);
+  read_workers_num = 0;
+  pthread_mutex_unlock(&read_lock);
+
   read_threads_num = 0;
 } /* void stop_read_threads */
 
+#if PLUGIN_EVENT_LOOP
+/* Must be called with `event_loop_lock' held. */
+static void event_loop_wakeup(void) {
+  uint64_t one = 1;
+  if ((write(event_loop_wakeup_fd, &one, sizeof(one)) < 0) &&
+      (errno != EAGAIN))
+    ERROR("plugin: Waking up the event loop failed: %s", STRERRNO);
+} /* void event_loop_wakeup */
+
+static void event_source_free(event_source_t *es) {
+  if (es == NULL)
+    return;
+  if (es->es_timer)
+    close(es->es_fd);
+  sfree(es->es_name);
+  destroy_callback((callback_func_t *)es);
+} /* void event_source_free */
+
+static void event_source_free_all(event_source_t *es) {
+  while (es != NULL) {
+    event_source_t *next = es->es_next;
+    event_source_free(es);
+    es = next;
+  }
+} /* void event_source_free_all */
+
+/* Returns the result of the callback, or zero if there was nothing to do.
+ * Called with `event_loop_lock' held, which is released while the callback
+ * runs. */
+static int event_source_dispatch(event_source_t *es, uint32_t events) {
+  if (es->es_timer) {
+    uint64_t expirations;
+    if (read(es->es_fd, &expirations, sizeof(expirations)) < 0)
+      return 0;
+  }
+
+  int revents = 0;
+  if (events & EPOLLIN)
+    revents |= POLLIN;
+  if (events & EPOLLPRI)
+    revents |= POLLPRI;
+  if (events & EPOLLOUT)
+    revents |= POLLOUT;
+  if (events & EPOLLERR)
+    revents |= POLLERR;
+  if (events & EPOLLHUP)
+    revents |= POLLHUP;
+
+  pthread_mutex_unlock(&event_loop_lock);
+  plugin_ctx_t old_ctx = plugin_set_ctx(es->es_ctx);
+  int status;
+  if (es->es_timer) {
+    plugin_timer_cb callback = es->es_callback;
+    status = (*callback)(&es->es_udata);
+  } else {
+    plugin_fd_cb callback = es->es_callback;
+    status = (*callback)(es->es_fd, revents, &es->es_udata);
+  }
+  plugin_set_ctx(old_ctx);
+  pthread_mutex_lock(&event_loop_lock);
+
+  return status;
+} /* int event_source_dispatch */
+
+/* Must be called with `event_loop_lock' held. Unlinks `es' and stops watching
+ * its file descriptor. If the loop is running, `es' is moved to the graveyard
+ * because the current batch of events may still refer to it; otherwise it is
+ * freed right away. */
+static void event_source_remove(event_source_t *es) {
+  for (event_source_t **p = &event_sources; *p != NULL; p = &(*p)->es_next) {
+    if (*p == es) {
+      *p = es->es_next;
+      break;
+    }
+  }
+
+  epoll_ctl(event_loop_epoll_fd, EPOLL_CTL_DEL, es->es_fd, NULL);
+  es->es_removed = true;
+
+  if (event_loop_running) {
+    es->es_next = event_graveyard;
+    event_graveyard = es;
+  } else {
+    event_source_free(es);
+  }
+} /* void event_source_remove */
+
+static void *event_loop_thread(__attribute__((unused)) void *arg) {
+  struct epoll_event events[32];
+
+  pthread_mutex_lock(&event_loop_lock);
+  while (!event_loop_stopping) {
+    pthread_mutex_unlock(&event_loop_lock);
+    int n = epoll_wait(event_loop_epoll_fd, events, STATIC_ARRAY_SIZE(events),
+                       /* timeout = */ -1);
+    int err = errno;
+    pthread_mutex_lock(&event_loop_lock);
+
+    if ((n < 0) && (err != EINTR)) {
+      ERROR("plugin: epoll_wait failed: %s", STRERROR(err));
+      break;
+    }
+
+    for (int i = 0; (i < n) && !event_loop_stopping; i++) {
+      event_source_t *es = events[i].data.ptr;
+
+      if (es == NULL) {
+        uint64_t tmp;
+        if ((read(event_loop_wakeup_fd, &tmp, sizeof(tmp)) < 0) &&
+            (errno != EAGAIN))
+          ERROR("plugin: Reading the eventfd of the event loop failed: %s",
+                STRERRNO);
+        continue;
+      }
+      if (es->es_removed)
+        continue;
+
+      int status = event_source_dispatch(es, events[i].events);
+      if ((status != 0) && !es->es_removed) {
+        DEBUG("plugin: Event source \"%s\" returned %d and is removed.",
+              es->es_name, status);
+        event_source_remove(es);
+      }
+    }
+
+    /* No event returned by epoll_wait refers to the graveyard any longer. */
+    event_source_t *graveyard = event_graveyard;
+    event_graveyard = NULL;
+    event_loop_generation++;
+    pthread_cond_broadcast(&event_loop_cond);
+
+    if (graveyard != NULL) {
+      pthread_mutex_unlock(&event_loop_lock);
+      event_source_free_all(graveyard);
+      pthread_mutex_lock(&event_loop_lock);
+    }
+  }
+
+  event_loop_running = false;
+  pthread_cond_broadcast(&event_loop_cond);
+  pthread_mutex_unlock(&event_loop_lock);
+  return NULL;
+} /* void *event_loop_thread */
+
+/* Must be called with `event_loop_lock' held. */
+static int event_loop_start(void) {
+  if (event_loop_running)
+    return 0;
+
+  if (event_loop_epoll_fd < 0) {
+    event_loop_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (event_loop_epoll_fd < 0) {
+      int status = errno;
+      ERROR("plugin: epoll_create1 failed: %s", STRERROR(status));
+      return status;
+    }
+
+    event_loop_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    if ((event_loop_wakeup_fd < 0) ||
+        (epoll_ctl(event_loop_epoll_fd, EPOLL_CTL_ADD, event_loop_wakeup_fd,
+                   &ev) != 0)) {
+      int status = errno;
+      ERROR("plugin: Creating the eventfd of the event loop failed: %s",
+            STRERROR(status));
+      if (event_loop_wakeup_fd >= 0)
+        close(event_loop_wakeup_fd);
+      close(event_loop_epoll_fd);
+      event_loop_wakeup_fd = event_loop_epoll_fd = -1;
+      return status;
+    }
+  }
+
+  /* The thread may have quit after an error. */
+  if (event_loop_joinable) {
+    pthread_join(event_loop_tid, NULL);
+    event_loop_joinable = false;
+  }
+
+  event_loop_stopping = false;
+  int status = pthread_create(&event_loop_tid, /* attr = */ NULL,
+                              event_loop_thread, /* arg = */ NULL);
+  if (status != 0) {
+    ERROR("plugin: Starting the event loop failed: %s", STRERROR(status));
+    return status;
+  }
+  set_thread_name(event_loop_tid, "event loop");
+  event_loop_running = true;
+  event_loop_joinable = true;
+
+  return 0;
+} /* int event_loop_start */
+
+/* Stops the event loop thread. Event sources stay registered, but their
+ * callbacks aren't called any longer. */
+static void stop_event_loop(void) {
+  pthread_mutex_lock(&event_loop_lock);
+  if (!event_loop_joinable) {
+    pthread_mutex_unlock(&event_loop_lock);
+    return;
+  }
+  event_loop_stopping = true;
+  if (event_loop_running)
+    event_loop_wakeup();
+  pthread_mutex_unlock(&event_loop_lock);
+
+  if (pthread_join(event_loop_tid, NULL) != 0)
+    ERROR("plugin: stop_event_loop: pthread_join failed.");
+
+  pthread_mutex_lock(&event_loop_lock);
+  event_loop_joinable = false;
+  event_source_t *graveyard = event_graveyard;
+  event_graveyard = NULL;
+  pthread_mutex_unlock(&event_loop_lock);
+  event_source_free_all(graveyard);
+} /* void stop_event_loop */
+
+static void destroy_event_loop(void) {
+  stop_event_loop();
+
+  pthread_mutex_lock(&event_loop_lock);
+  event_source_t *sources = event_sources;
+  event_sources = NULL;
+  if (event_loop_epoll_fd >= 0) {
+    close(event_loop_wakeup_fd);
+    close(event_loop_epoll_fd);
+    event_loop_wakeup_fd = event_loop_epoll_fd = -1;
+  }
+  pthread_mutex_unlock(&event_loop_lock);
+
+  event_source_free_all(sources);
+} /* void destroy_event_loop */
+
+/* Must be called with `event_loop_lock' held. */
+static event_source_t *event_source_find(const char *name) {
+  for (event_source_t *es = event_sources; es != NULL; es = es->es_next)
+    if (strcmp(name, es->es_name) == 0)
+      return es;
+  return NULL;
+} /* event_source_t *event_source_find */
+
+static int event_source_add(const char *name, int fd, bool timer,
+                            uint32_t events, void *callback,
+                            user_data_t const *ud) {
+  event_source_t *es = calloc(1, sizeof(*es));
+  if (es == NULL)
+    return ENOMEM;
+
+  es->es_name = strdup(name);
+  if (es->es_name == NULL) {
+    sfree(es);
+    return ENOMEM;
+  }
+  es->es_callback = callback;
+  if (ud != NULL)
+    es->es_udata = *ud;
+  es->es_ctx = plugin_get_ctx();
+  /* The source may outlive the read callback which registered it. */
+  es->es_ctx.aligned_time = 0;
+  es->es_fd = fd;
+  es->es_timer = timer;
+
+  pthread_mutex_lock(&event_loop_lock);
+  int status = 0;
+  if (event_source_find(name) != NULL) {
+    ERROR("plugin: An event source named \"%s\" is already registered.",
+          name);
+    status = EEXIST;
+  }
+  if (status == 0)
+    status = event_loop_start();
+  if (status == 0) {
+    struct epoll_event ev = {.events = events, .data.ptr = es};
+    if (epoll_ctl(event_loop_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      status = errno;
+      ERROR("plugin: Watching the file descriptor of \"%s\" failed: %s", name,
+            STRERROR(status));
+    }
+  }
+  if (status != 0) {
+    pthread_mutex_unlock(&event_loop_lock);
+    /* The caller keeps ownership of the user data on failure. */
+    es->es_udata.free_func = NULL;
+    es->es_timer = false;
+    event_source_free(es);
+    return status;
+  }
+
+  es->es_next = event_sources;
+  event_sources = es;
+  pthread_mutex_unlock(&event_loop_lock);
+
+  return 0;
+} /* int event_source_add */
+
+static int event_source_unregister(const char *name, bool timer) {
+  if (name == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&event_loop_lock);
+  event_source_t *es = event_source_find(name);
+  if ((es == NULL) || (es->es_timer != timer)) {
+    pthread_mutex_unlock(&event_loop_lock);
+    return ENOENT;
+  }
+
+  event_source_remove(es);
+
+  /* Unless called from a callback of the loop, wait for the current batch of
+   * events to finish, so that the callback isn't running any longer when this
+   * function returns. */
+  if (event_loop_running && !pthread_equal(pthread_self(), event_loop_tid)) {
+    uint64_t generation = event_loop_generation;
+    event_loop_wakeup();
+    while (event_loop_running && (event_loop_generation == generation))
+      pthread_cond_wait(&event_loop_cond, &event_loop_lock);
+  }
+  pthread_mutex_unlock(&event_loop_lock);
+
+  return 0;
+} /* int event_source_unregister */
+#endif /* PLUGIN_EVENT_LOOP */
+
+int plugin_register_fd(const char *name, int fd, int events,
+                       plugin_fd_cb callback, user_data_t const *ud) {
+  if ((name == NULL) || (fd < 0) || (callback == NULL))
+    return EINVAL;
+
+#if PLUGIN_EVENT_LOOP
+  uint32_t ep_events = 0;
+  if (events & POLLIN)
+    ep_events |= EPOLLIN;
+  if (events & POLLPRI)
+    ep_events |= EPOLLPRI;
+  if (events & POLLOUT)
+    ep_events |= EPOLLOUT;
+
+  return event_source_add(name, fd, /* timer = */ false, ep_events,
+                          (void *)callback, ud);
+#else
+  (void)events;
+  (void)ud;
+  return ENOTSUP;
+#endif
+} /* int plugin_register_fd */
+
+int plugin_unregister_fd(const char *name) {
+#if PLUGIN_EVENT_LOOP
+  return event_source_unregister(name, /* timer = */ false);
+#else
+  (void)name;
+  return ENOTSUP;
+#endif
+} /* int plugin_unregister_fd */
+
+int plugin_register_timer(const char *name, cdtime_t interval,
+                          plugin_timer_cb callback, user_data_t const *ud) {
+  if ((name == NULL) || (callback == NULL))
+    return EINVAL;
+
+#if PLUGIN_EVENT_LOOP
+  if (interval == 0)
+    interval = plugin_get_interval();
+
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (fd < 0) {
+    int status = errno;
+    ERROR("plugin: Creating the timer \"%s\" failed: %s", name,
+          STRERROR(status));
+    return status;
+  }
+
+  struct itimerspec its = {
+      .it_interval = CDTIME_T_TO_TIMESPEC(interval),
+      .it_value = CDTIME_T_TO_TIMESPEC(interval),
+  };
+  if (timerfd_settime(fd, /* flags = */ 0, &its, /* old = */ NULL) != 0) {
+    int status = errno;
+    ERROR("plugin: Arming the timer \"%s\" failed: %s", name,
+          STRERROR(status));
+    close(fd);
+    return status;
+  }
+
+  int status = event_source_add(name, fd, /* timer = */ true, EPOLLIN,
+                                (void *)callback, ud);
+  if (status != 0)
+    close(fd);
+  return status;
+#else
+  (void)interval;
+  (void)ud;
+  return ENOTSUP;
+#endif
+} /* int plugin_register_timer */
+
+int plugin_unregister_timer(const char *name) {
+#if PLUGIN_EVENT_LOOP
+  return event_source_unregister(name, /* timer = */ true);
+#else
+  (void)name;
+  return ENOTSUP;
+#endif
+} /* int plugin_unregister_timer */
+
+/* Returns the time to use for a value list without a timestamp: the aligned
+ * time of the read callback, if any, the current time otherwise. */
+static cdtime_t plugin_value_time(void) {
+  cdtime_t aligned_time = plugin_get_ctx().aligned_time;
+  if (aligned_time != 0)
+    return aligned_time;
+
+  return coarse_timestamps ? cdtime_coarse() : cdtime();
+} /* cdtime_t plugin_value_time */
+
+/* Copies `src' to `dst', using `values' for the values if it is large enough
+ * and allocating memory otherwise. Fills in the host, time and interval
+ * fields if they are unset. */
+static int plugin_value_list_copy(value_list_t *dst, /* {{{ */
+                                  value_t *values, size_t values_size,
+                                  value_list_t const *src) {
+  memcpy(dst, src, sizeof(*dst));
+
+  /* The source may have been copied from another value list and modified
+   * afterwards. The identifier is computed again when dispatching. */
+  dst->identifier.hash = 0;
+
+  if (dst->host[0] == 0)
+    sstrncpy(dst->host, hostname_g, sizeof(dst->host));
+
+  if (src->values_len <= values_size) {
+    dst->values = values;
+  } else {
+    dst->values = calloc(src->values_len, sizeof(*dst->values));
+    if (dst->values == NULL)
+      return ENOMEM;
+  }
+  memcpy(dst->values, src->values, src->values_len * sizeof(*dst->values));
+
+  dst->meta = meta_data_clone(src->meta);
+  if ((src->meta != NULL) && (dst->meta == NULL)) {
+    if (dst->values != values)
+      sfree(dst->values);
+    return ENOMEM;
+  }
+
+  if (dst->time == 0) {
+    dst->time = plugin_value_time();
+  }
+
+  /* Fill in the interval from the thread context, if it is zero. */
+  if (dst->interval == 0)
+    dst->interval = plugin_get_interval();
+
+  return 0;
+} /* }}} int plugin_value_list_copy */
+
 static void plugin_value_list_free(value_list_t *vl) /* {{{ */
 {
   if (vl == NULL)
@@ -690,117 +2954,923 @@ plugin_value_list_clone(value_list_t const *vl_orig) /* {{{ */
   vl = malloc(sizeof(*vl));
   if (vl == NULL)
     return NULL;
-  memcpy(vl, vl_orig, sizeof(*vl));
 
-  if (vl->host[0] == 0)
-    sstrncpy(vl->host, hostname_g, sizeof(vl->host));
+  if (plugin_value_list_copy(vl, /* values = */ NULL, /* values_size = */ 0,
+                             vl_orig) != 0) {
+    sfree(vl);
+    return NULL;
+  }
+
+  return vl;
+} /* }}} value_list_t *plugin_value_list_clone */
 
-  vl->values = calloc(vl_orig->values_len, sizeof(*vl->values));
-  if (vl->values == NULL) {
-    plugin_value_list_free(vl);
+/* Allocates a new slab, keeps its first entry for the caller and puts the
+ * remaining entries on the free list. */
+static write_queue_t *write_slab_grow(void) /* {{{ */
+{
+  write_queue_t *slab;
+
+  pthread_mutex_lock(&write_slab_lock);
+  if ((write_slab_free == NULL) || (write_slabs_num >= WRITE_SLAB_MAX)) {
+    pthread_mutex_unlock(&write_slab_lock);
     return NULL;
   }
-  memcpy(vl->values, vl_orig->values,
-         vl_orig->values_len * sizeof(*vl->values));
 
-  vl->meta = meta_data_clone(vl->meta);
-  if ((vl_orig->meta != NULL) && (vl->meta == NULL)) {
-    plugin_value_list_free(vl);
+  slab = calloc(WRITE_SLAB_ENTRIES, sizeof(*slab));
+  if (slab == NULL) {
+    pthread_mutex_unlock(&write_slab_lock);
     return NULL;
   }
+  write_slabs[write_slabs_num] = slab;
+  write_slabs_num++;
+  memstat_add(memstat_lazy(&write_queue_memstat, "write_queue"),
+              (int64_t)(WRITE_SLAB_ENTRIES * sizeof(*slab)), 0);
+
+  for (size_t i = 0; i < WRITE_SLAB_ENTRIES; i++) {
+    slab[i].in_slab = true;
+    /* The free list is large enough to hold all slab entries. */
+    if (i > 0)
+      c_ring_push(write_slab_free, slab + i);
+  }
+  pthread_mutex_unlock(&write_slab_lock);
+
+  return slab;
+} /* }}} write_queue_t *write_slab_grow */
+
+static void write_slab_destroy(void) /* {{{ */
+{
+  pthread_mutex_lock(&write_slab_lock);
+  c_ring_destroy(write_slab_free);
+  write_slab_free = NULL;
+
+  for (size_t i = 0; i < write_slabs_num; i++)
+    sfree(write_slabs[i]);
+  memstat_add(write_queue_memstat,
+              -(int64_t)(write_slabs_num * WRITE_SLAB_ENTRIES *
+                         sizeof(**write_slabs)),
+              0);
+  write_slabs_num = 0;
+  pthread_mutex_unlock(&write_slab_lock);
+} /* }}} void write_slab_destroy */
+
+static void write_queue_entry_destroy(write_queue_t *q) /* {{{ */
+{
+  if (q == NULL)
+    return;
+
+  int64_t bytes = 0;
+  meta_data_destroy(q->meta);
+  q->meta = NULL;
+  if (q->values != q->values_inline) {
+    bytes += (int64_t)(q->values_len * sizeof(*q->values));
+    sfree(q->values);
+  }
+  q->values = q->values_inline;
+  vl_ident_unref(q->ident);
+  q->ident = NULL;
+
+  if (!q->in_slab) {
+    memstat_add(write_queue_memstat, -bytes - (int64_t)sizeof(*q), -1);
+    sfree(q);
+    return;
+  }
+  memstat_add(write_queue_memstat, -bytes, -1);
 
-  if (vl->time == 0)
-    vl->time = cdtime();
+  C_ATOMIC_SUB(&write_slab_used, 1);
+  /* The free list can hold every slab entry, so this only fails after
+   * write_slab_destroy(), in which case the memory is released anyway. */
+  c_ring_push(write_slab_free, q);
+} /* }}} void write_queue_entry_destroy */
+
+/* Returns an empty entry, preferably from a slab. */
+static write_queue_t *write_queue_entry_alloc(void) /* {{{ */
+{
+  write_queue_t *q = c_ring_pop(write_slab_free);
+
+  if (q == NULL)
+    q = write_slab_grow();
+
+  if (q == NULL) {
+    q = malloc(sizeof(*q));
+    if (q == NULL)
+      return NULL;
+    q->in_slab = false;
+    C_ATOMIC_ADD(&write_slab_misses, 1);
+    memstat_add(memstat_lazy(&write_queue_memstat, "write_queue"),
+                (int64_t)sizeof(*q), 1);
+  } else {
+    C_ATOMIC_ADD(&write_slab_used, 1);
+    memstat_add(memstat_lazy(&write_queue_memstat, "write_queue"), 0, 1);
+  }
+  q->ident = NULL;
+  q->values = q->values_inline;
+  q->values_len = 0;
+  q->meta = NULL;
+  q->next = NULL;
+
+  return q;
+} /* }}} write_queue_t *write_queue_entry_alloc */
+
+/* Sets the identifier of "q" from the fields of "vl", filling in the host and
+ * the type like plugin_value_list_copy() does. If "hint" has the same fields,
+ * it is shared instead of allocating another one. */
+static int write_queue_entry_set_ident(write_queue_t *q, /* {{{ */
+                                       value_list_t const *vl,
+                                       const data_set_t *ds, vl_ident_t *hint,
+                                       value_list_identifier_t const *id) {
+  const char *host = vl->host;
+  const char *type = vl->type;
+
+  if (host[0] == 0)
+    host = hostname_g;
+  if ((type[0] == 0) && (ds != NULL))
+    type = ds->type;
+
+  if ((hint != NULL) && (host == vl->host) && (type == vl->type) &&
+      vl_ident_matches(hint, vl))
+    q->ident = vl_ident_ref(hint);
+  else
+    q->ident = vl_ident_create(host, vl->plugin, vl->plugin_instance, type,
+                               vl->type_instance, id);
+
+  return (q->ident == NULL) ? ENOMEM : 0;
+} /* }}} int write_queue_entry_set_ident */
+
+/* Queues a copy of "vl". The identifier of "vl" is not kept, since the source
+ * may have been copied from another value list and modified afterwards. */
+static write_queue_t *write_queue_entry_create(value_list_t const *vl, /* {{{ */
+                                               const data_set_t *ds,
+                                               vl_ident_t *hint) {
+  write_queue_t *q = write_queue_entry_alloc();
+  if (q == NULL)
+    return NULL;
+
+  if (write_queue_entry_set_ident(q, vl, ds, hint, /* id = */ NULL) != 0) {
+    write_queue_entry_destroy(q);
+    return NULL;
+  }
 
+  if (vl->values_len > STATIC_ARRAY_SIZE(q->values_inline)) {
+    q->values = calloc(vl->values_len, sizeof(*q->values));
+    if (q->values == NULL) {
+      write_queue_entry_destroy(q);
+      return NULL;
+    }
+    memstat_add(write_queue_memstat,
+                (int64_t)(vl->values_len * sizeof(*q->values)), 0);
+  }
+  memcpy(q->values, vl->values, vl->values_len * sizeof(*q->values));
+  q->values_len = vl->values_len;
+
+  q->meta = meta_data_clone(vl->meta);
+  if ((vl->meta != NULL) && (q->meta == NULL)) {
+    write_queue_entry_destroy(q);
+    return NULL;
+  }
+
+  q->time = (vl->time != 0) ? vl->time : plugin_value_time();
   /* Fill in the interval from the thread context, if it is zero. */
-  if (vl->interval == 0)
-    vl->interval = plugin_get_interval();
+  q->interval = (vl->interval != 0) ? vl->interval : plugin_get_interval();
+
+  return q;
+} /* }}} write_queue_t *write_queue_entry_create */
+
+/* Fills in "vl" from "q" for the filter chains and writers. The values and
+ * the meta data still belong to "q". */
+static void write_queue_entry_expand(write_queue_t const *q, /* {{{ */
+                                     value_list_t *vl) {
+  vl_ident_to_value_list(q->ident, vl);
+  vl->values = q->values;
+  vl->values_len = q->values_len;
+  vl->time = q->time;
+  vl->interval = q->interval;
+  vl->meta = q->meta;
+} /* }}} void write_queue_entry_expand */
+
+static write_lane_t *write_lane_get(int priority) /* {{{ */
+{
+  if ((priority < 0) || ((size_t)priority >= STATIC_ARRAY_SIZE(write_lanes)))
+    priority = PLUGIN_PRIORITY_NORMAL;
+  return &write_lanes[priority];
+} /* }}} write_lane_t *write_lane_get */
 
-  return vl;
-} /* }}} value_list_t *plugin_value_list_clone */
+static void plugin_write_queue_push(write_queue_t *q) /* {{{ */
+{
+  write_lane_t *lane = write_lane_get(q->ctx.priority);
+
+  /* Counted first, so that a thread seeing an empty lane can skip it. */
+  C_ATOMIC_ADD(&lane->length, 1);
+  if ((lane->ring == NULL) || (C_ATOMIC_LOAD(&lane->overflow_length) > 0) ||
+      (c_ring_push(lane->ring, q) != 0)) {
+    pthread_mutex_lock(&lane->overflow_lock);
+    if (lane->tail == NULL) {
+      lane->head = q;
+      lane->tail = q;
+    } else {
+      lane->tail->next = q;
+      lane->tail = q;
+    }
+    C_ATOMIC_ADD(&lane->overflow_length, 1);
+    pthread_mutex_unlock(&lane->overflow_lock);
+  }
+
+  C_ATOMIC_ADD(&write_queue_length, 1);
+} /* }}} void plugin_write_queue_push */
 
-static int plugin_write_enqueue(value_list_t const *vl) /* {{{ */
+static write_queue_t *write_lane_pop(write_lane_t *lane) /* {{{ */
 {
-  write_queue_t *q;
+  if (C_ATOMIC_LOAD(&lane->length) <= 0)
+    return NULL;
+
+  write_queue_t *q = c_ring_pop(lane->ring);
+
+  if ((q == NULL) && (C_ATOMIC_LOAD(&lane->overflow_length) > 0)) {
+    pthread_mutex_lock(&lane->overflow_lock);
+    q = lane->head;
+    if (q != NULL) {
+      lane->head = q->next;
+      if (lane->head == NULL)
+        lane->tail = NULL;
+      C_ATOMIC_SUB(&lane->overflow_length, 1);
+    }
+    pthread_mutex_unlock(&lane->overflow_lock);
+  }
+
+  if (q != NULL)
+    C_ATOMIC_SUB(&lane->length, 1);
+
+  return q;
+} /* }}} write_queue_t *write_lane_pop */
+
+static write_queue_t *plugin_write_queue_pop(void) /* {{{ */
+{
+  unsigned long turn = C_ATOMIC_ADD(&write_lane_turn, 1);
+  int first =
+      write_lane_schedule[turn % STATIC_ARRAY_SIZE(write_lane_schedule)];
+  write_queue_t *q = write_lane_pop(&write_lanes[first]);
+
+  /* The lane whose turn it is is empty: take the next entry by priority, so
+   * that no write thread idles while entries are waiting. */
+  for (size_t i = 0; (q == NULL) && (i < STATIC_ARRAY_SIZE(write_lane_order));
+       i++) {
+    if (write_lane_order[i] != first)
+      q = write_lane_pop(&write_lanes[write_lane_order[i]]);
+  }
+
+  if (q != NULL)
+    C_ATOMIC_SUB(&write_queue_length, 1);
+
+  return q;
+} /* }}} write_queue_t *plugin_write_queue_pop */
+
+/* Appends "q" to the write queue and wakes up a write thread. */
+static void plugin_write_enqueue_entry(write_queue_t *q, /* {{{ */
+                                       const data_set_t *ds) {
+  /* Resolve the data set here: read threads tend to dispatch the same types
+   * over and over, so the lookup usually hits the thread's cache. */
+  if (ds == NULL)
+    ds = plugin_lookup_ds(vl_ident_get(q->ident, VL_IDENT_TYPE));
+  q->ds = ds;
 
-  q = malloc(sizeof(*q));
+  if (bench_running)
+    C_ATOMIC_ADD(&bench_values, 1);
+
+  /* Store context of caller (read plugin); otherwise, it would not be
+   * available to the write plugins when actually dispatching the
+   * value-list later on. */
+  q->ctx = plugin_get_ctx();
+
+  C_PROBE3(write__enqueue, vl_ident_get(q->ident, VL_IDENT_HOST),
+           vl_ident_get(q->ident, VL_IDENT_PLUGIN),
+           vl_ident_get(q->ident, VL_IDENT_TYPE));
+  plugin_write_queue_push(q);
+
+  /* Only take the lock if a write thread is (about to go) asleep. The fence
+   * pairs with the one in plugin_write_dequeue(): either we see the waiter or
+   * the waiter sees our element. */
+  C_ATOMIC_FENCE();
+  if (C_ATOMIC_LOAD(&write_waiters) > 0) {
+    pthread_mutex_lock(&write_lock);
+    pthread_cond_signal(&write_cond);
+    pthread_mutex_unlock(&write_lock);
+  }
+} /* }}} void plugin_write_enqueue_entry */
+
+static int plugin_write_enqueue(value_list_t const *vl, /* {{{ */
+                                const data_set_t *ds) {
+  write_queue_t *q = write_queue_entry_create(vl, ds, /* hint = */ NULL);
   if (q == NULL)
     return ENOMEM;
-  q->next = NULL;
 
-  q->vl = plugin_value_list_clone(vl);
-  if (q->vl == NULL) {
-    sfree(q);
+  plugin_write_enqueue_entry(q, ds);
+  return 0;
+} /* }}} int plugin_write_enqueue */
+
+/* Returns the next entry from the write queue. If `wait' is true, blocks
+ * until an entry becomes available or the write threads are stopped. The
+ * returned entry must be released with write_queue_entry_destroy(). */
+static write_queue_t *plugin_write_dequeue(bool wait) /* {{{ */
+{
+  write_queue_t *q;
+
+  q = plugin_write_queue_pop();
+  if ((q == NULL) && !wait)
+    return NULL;
+
+  if (q == NULL) {
+    pthread_mutex_lock(&write_lock);
+    C_ATOMIC_ADD(&write_waiters, 1);
+    C_ATOMIC_FENCE();
+
+    while (write_loop && ((q = plugin_write_queue_pop()) == NULL))
+      pthread_cond_wait(&write_cond, &write_lock);
+
+    C_ATOMIC_SUB(&write_waiters, 1);
+    pthread_mutex_unlock(&write_lock);
+
+    if (q == NULL)
+      return NULL;
+  }
+
+  (void)plugin_set_ctx(q->ctx);
+
+  C_PROBE3(write__dequeue, vl_ident_get(q->ident, VL_IDENT_HOST),
+           vl_ident_get(q->ident, VL_IDENT_PLUGIN),
+           vl_ident_get(q->ident, VL_IDENT_TYPE));
+  return q;
+} /* }}} write_queue_t *plugin_write_dequeue */
+
+static int plugin_write_batch_append(write_batch_t *b, /* {{{ */
+                                     callback_func_t *cf, const data_set_t *ds,
+                                     value_list_t const *vl) {
+  if (b->entries_num >= b->entries_size) {
+    size_t new_size = (b->entries_size == 0) ? 64 : 2 * b->entries_size;
+    write_batch_entry_t *tmp =
+        realloc(b->entries, new_size * sizeof(*b->entries));
+    if (tmp == NULL)
+      return ENOMEM;
+    b->entries = tmp;
+    b->entries_size = new_size;
+  }
+
+  /* Targets may modify `vl' after handing it to us, so keep a copy. */
+  write_queue_t *copy = write_queue_entry_create(vl, ds, b->ident);
+  if (copy == NULL)
     return ENOMEM;
+
+  b->entries[b->entries_num] = (write_batch_entry_t){
+      .cf = cf, .ds = ds, .q = copy,
+  };
+  b->entries_num++;
+
+  return 0;
+} /* }}} int plugin_write_batch_append */
+
+/* Calls every batch writer with the entries destined for it and releases the
+ * value lists afterwards. */
+static void plugin_write_batch_flush(write_batch_t *b) /* {{{ */
+{
+  static c_complain_t batch_complaint = C_COMPLAIN_INIT_STATIC;
+
+  if (b->entries_num == 0)
+    return;
+
+  if (b->args_size < b->entries_num) {
+    plugin_write_entry_t *tmp =
+        realloc(b->args, b->entries_num * sizeof(*b->args));
+    value_list_t *vls = (tmp == NULL)
+                            ? NULL
+                            : realloc(b->vls, b->entries_num * sizeof(*b->vls));
+    if (tmp != NULL)
+      b->args = tmp;
+    if ((tmp == NULL) || (vls == NULL)) {
+      ERROR("plugin_write_batch_flush: realloc failed. Dropping %" PRIsz
+            " value lists.",
+            b->entries_num);
+      goto release;
+    }
+    b->vls = vls;
+    b->args_size = b->entries_num;
+  }
+
+  callback_array_t const *batch_writers =
+      C_ATOMIC_LOAD_ACQ(&array_write_batch);
+  for (size_t j = 0; (batch_writers != NULL) && (j < batch_writers->num);
+       j++) {
+    const char *name = batch_writers->entries[j].name;
+    callback_func_t *cf = batch_writers->entries[j].cf;
+    size_t args_num = 0;
+
+    for (size_t i = 0; i < b->entries_num; i++) {
+      if (b->entries[i].cf != cf)
+        continue;
+      write_queue_entry_expand(b->entries[i].q, &b->vls[args_num]);
+      b->args[args_num] = (plugin_write_entry_t){
+          .ds = b->entries[i].ds, .vl = &b->vls[args_num],
+      };
+      args_num++;
+    }
+
+    if (args_num == 0)
+      continue;
+
+    plugin_ctx_t old_ctx = plugin_get_ctx();
+    plugin_ctx_t ctx = old_ctx;
+    ctx.name = cf->cf_ctx.name;
+    plugin_set_ctx(ctx);
+
+    plugin_write_batch_cb callback = cf->cf_callback;
+    cdtime_t start = plugin_latency_start();
+    C_PROBE2(write__start, name, args_num);
+    int status = (*callback)(b->args, args_num, &cf->cf_udata);
+    C_PROBE2(write__done, name, status);
+    plugin_latency_stop(cf->cf_latency, start);
+    if (status == 0)
+      plugin_flush_mark(cf, args_num);
+
+    plugin_set_ctx(old_ctx);
+
+    if (status != 0)
+      c_complain(LOG_INFO, &batch_complaint,
+                 "plugin_write_batch_flush: Batch write callback `%s' failed "
+                 "with status %i.",
+                 name, status);
+    else
+      c_release(LOG_INFO, &batch_complaint,
+                "plugin_write_batch_flush: Batch write callback `%s' "
+                "succeeded.",
+                name);
+  }
+
+release:
+  for (size_t i = 0; i < b->entries_num; i++)
+    write_queue_entry_destroy(b->entries[i].q);
+  b->entries_num = 0;
+} /* }}} void plugin_write_batch_flush */
+
+static writer_queue_t *writer_queue_create(callback_func_t *cf, /* {{{ */
+                                           const char *name, bool batch) {
+  writer_queue_t *wq = calloc(1, sizeof(*wq));
+  if (wq == NULL) {
+    ERROR("plugin: writer_queue_create: calloc failed.");
+    return NULL;
+  }
+
+  wq->name = strdup(name);
+  wq->vls = calloc(WRITER_QUEUE_BATCH_MAX, sizeof(*wq->vls));
+  if ((wq->name == NULL) || (wq->vls == NULL)) {
+    ERROR("plugin: writer_queue_create: strdup or calloc failed.");
+    sfree(wq->name);
+    sfree(wq->vls);
+    sfree(wq);
+    return NULL;
+  }
+
+  wq->cf = cf;
+  wq->batch = batch;
+  wq->limit_high = (long)cf->cf_ctx.write_queue_limit_high;
+  wq->limit_low = (long)cf->cf_ctx.write_queue_limit_low;
+  pthread_mutex_init(&wq->lock, /* attr = */ NULL);
+  pthread_cond_init(&wq->cond, /* attr = */ NULL);
+
+  if (cf->cf_ctx.spool_directory != NULL) {
+    uint64_t limit = (uint64_t)cf->cf_ctx.spool_limit * 1024 * 1024;
+    wq->spool = spool_open(cf->cf_ctx.spool_directory, name, limit);
+    if (wq->spool == NULL)
+      ERROR("plugin: Opening the spool of `%s' in \"%s\" failed. Values "
+            "will be dropped instead of spooled.",
+            name, cf->cf_ctx.spool_directory);
+    wq->replay_rate = (long)cf->cf_ctx.spool_replay_rate;
+  }
+
+  return wq;
+} /* }}} writer_queue_t *writer_queue_create */
+
+/* Stops the writer's thread after it has written all queued value lists. */
+static void writer_queue_stop(writer_queue_t *wq) /* {{{ */
+{
+  if ((wq == NULL) || !wq->thread_running)
+    return;
+
+  pthread_mutex_lock(&wq->lock);
+  wq->loop = false;
+  pthread_cond_signal(&wq->cond);
+  pthread_mutex_unlock(&wq->lock);
+
+  if (pthread_join(wq->thread, NULL) != 0)
+    ERROR("plugin: writer_queue_stop: pthread_join failed.");
+  wq->thread_running = false;
+} /* }}} void writer_queue_stop */
+
+static void writer_queue_destroy(writer_queue_t *wq) /* {{{ */
+{
+  if (wq == NULL)
+    return;
+
+  writer_queue_stop(wq);
+
+  while (wq->head != NULL) {
+    write_queue_t *q = wq->head;
+    wq->head = q->next;
+    write_queue_entry_destroy(q);
+  }
+
+  spool_close(wq->spool);
+  pthread_cond_destroy(&wq->cond);
+  pthread_mutex_destroy(&wq->lock);
+  sfree(wq->name);
+  sfree(wq->vls);
+  sfree(wq);
+} /* }}} void writer_queue_destroy */
+
+/* Drops values with a probability rising linearly from zero at the low
+ * watermark to one at the high watermark, like check_drop_value(). Must be
+ * called with `wq->lock' held. */
+static bool writer_queue_check_drop(writer_queue_t *wq) /* {{{ */
+{
+  if ((wq->limit_high == 0) || (wq->length < wq->limit_low))
+    return false;
+  if (wq->length >= wq->limit_high)
+    return true;
+
+  double p = (double)(1 + wq->length - wq->limit_low) /
+             (double)(1 + wq->limit_high - wq->limit_low);
+  return cdrand_d() < p;
+} /* }}} bool writer_queue_check_drop */
+
+/* Appends "vl" to the writer's spool. Returns false if the writer has no
+ * spool or appending failed. */
+static bool writer_queue_spool(writer_queue_t *wq, /* {{{ */
+                               const data_set_t *ds, value_list_t const *vl) {
+  static c_complain_t spool_complaint = C_COMPLAIN_INIT_STATIC;
+
+  if (wq->spool == NULL)
+    return false;
+
+  if (ds == NULL)
+    ds = plugin_get_ds(vl->type);
+
+  int status = spool_append(wq->spool, ds, vl);
+  if (status != 0) {
+    c_complain(LOG_WARNING, &spool_complaint,
+               "plugin: Spooling a value list for `%s' failed: %s", wq->name,
+               STRERROR(status));
+    return false;
+  }
+  c_release(LOG_INFO, &spool_complaint,
+            "plugin: Spooling value lists for `%s' works again.", wq->name);
+
+  pthread_mutex_lock(&wq->lock);
+  wq->spooled++;
+  pthread_mutex_unlock(&wq->lock);
+  return true;
+} /* }}} bool writer_queue_spool */
+
+static int writer_queue_enqueue(writer_queue_t *wq, /* {{{ */
+                                const data_set_t *ds, value_list_t const *vl) {
+  static c_complain_t drop_complaint = C_COMPLAIN_INIT_STATIC;
+
+  pthread_mutex_lock(&wq->lock);
+  if (writer_queue_check_drop(wq)) {
+    pthread_mutex_unlock(&wq->lock);
+    if (writer_queue_spool(wq, ds, vl))
+      return 0;
+
+    pthread_mutex_lock(&wq->lock);
+    wq->dropped++;
+    pthread_mutex_unlock(&wq->lock);
+    c_complain(LOG_WARNING, &drop_complaint,
+               "plugin: The write queue of `%s' reached its low water mark. "
+               "Dropping metrics.",
+               wq->name);
+    return 0;
+  }
+  pthread_mutex_unlock(&wq->lock);
+
+  /* Targets may modify `vl' after handing it to us, so keep a copy. */
+  write_batch_t *b = pthread_getspecific(write_batch_key);
+  write_queue_t *q =
+      write_queue_entry_create(vl, ds, (b != NULL) ? b->ident : NULL);
+  if (q == NULL)
+    return ENOMEM;
+  q->ds = ds;
+  q->ctx = plugin_get_ctx();
+
+  pthread_mutex_lock(&wq->lock);
+  if (wq->tail == NULL)
+    wq->head = q;
+  else
+    wq->tail->next = q;
+  wq->tail = q;
+  wq->length++;
+  pthread_cond_signal(&wq->cond);
+  pthread_mutex_unlock(&wq->lock);
+
+  return 0;
+} /* }}} int writer_queue_enqueue */
+
+/* Calls the writer for the value lists in `head', at most `write_batch_size'
+ * at a time for batch writers, and releases them. */
+static void writer_queue_write(writer_queue_t *wq, write_queue_t *head) /* {{{ */
+{
+  callback_func_t *cf = wq->cf;
+  plugin_write_entry_t args[WRITER_QUEUE_BATCH_MAX];
+
+  while (head != NULL) {
+    size_t args_num = 0;
+    write_queue_t *end = head;
+
+    plugin_ctx_t ctx = head->ctx;
+    ctx.name = cf->cf_ctx.name;
+    plugin_set_ctx(ctx);
+
+    if (wq->batch) {
+      size_t max = STATIC_ARRAY_SIZE(args);
+      if ((size_t)write_batch_size < max)
+        max = (size_t)write_batch_size;
+
+      for (; (end != NULL) && (args_num < max); end = end->next) {
+        write_queue_entry_expand(end, &wq->vls[args_num]);
+        args[args_num] =
+            (plugin_write_entry_t){.ds = end->ds, .vl = &wq->vls[args_num]};
+        args_num++;
+      }
+
+      plugin_write_batch_cb callback = cf->cf_callback;
+      cdtime_t start = plugin_latency_start();
+      C_PROBE2(write__start, wq->name, args_num);
+      int status = (*callback)(args, args_num, &cf->cf_udata);
+      C_PROBE2(write__done, wq->name, status);
+      plugin_latency_stop(cf->cf_latency, start);
+      if (status == 0)
+        plugin_flush_mark(cf, args_num);
+
+      wq->failing = (status != 0);
+      if (wq->failing)
+        for (size_t i = 0; i < args_num; i++)
+          writer_queue_spool(wq, args[i].ds, args[i].vl);
+    } else {
+      plugin_write_cb callback = cf->cf_callback;
+      const data_set_t *ds = head->ds;
+
+      if (ds == NULL)
+        ds = plugin_get_ds(vl_ident_get(head->ident, VL_IDENT_TYPE));
+      if (ds != NULL) {
+        write_queue_entry_expand(head, &wq->vls[0]);
+        cdtime_t start = plugin_latency_start();
+        C_PROBE2(write__start, wq->name, 1);
+        int status = (*callback)(ds, &wq->vls[0], &cf->cf_udata);
+        C_PROBE2(write__done, wq->name, status);
+        plugin_latency_stop(cf->cf_latency, start);
+        if (status == 0)
+          plugin_flush_mark(cf, 1);
+
+        wq->failing = (status != 0);
+        if (wq->failing)
+          writer_queue_spool(wq, ds, &wq->vls[0]);
+      }
+      end = head->next;
+    }
+
+    while (head != end) {
+      write_queue_t *q = head;
+      head = q->next;
+      write_queue_entry_destroy(q);
+    }
+  }
+} /* }}} void writer_queue_write */
+
+/* Hands value lists from the spool to the writer, as many as the replay rate
+ * allows since the last call. While the writer is failing, only one value
+ * list is tried per call. */
+static void writer_queue_replay(writer_queue_t *wq) /* {{{ */
+{
+  callback_func_t *cf = wq->cf;
+  plugin_write_entry_t args[WRITER_QUEUE_BATCH_MAX];
+  size_t max = wq->batch ? STATIC_ARRAY_SIZE(args) : 1;
+  cdtime_t now = cdtime();
+
+  if (wq->replay_rate > 0) {
+    if (wq->replay_last != 0)
+      wq->replay_budget +=
+          (double)wq->replay_rate * CDTIME_T_TO_DOUBLE(now - wq->replay_last);
+    /* Don't save up for more than a second. */
+    if (wq->replay_budget > (double)wq->replay_rate)
+      wq->replay_budget = (double)wq->replay_rate;
+    wq->replay_last = now;
+
+    if (wq->replay_budget < 1.0)
+      return;
+    if ((double)max > wq->replay_budget)
+      max = (size_t)wq->replay_budget;
+  }
+  if (wq->failing)
+    max = 1;
+
+  size_t args_num = 0;
+  while (args_num < max) {
+    value_list_t *vl = &wq->vls[args_num];
+    if (spool_read(wq->spool, vl) != 0)
+      break;
+
+    /* Types may have been removed from the types.db since. */
+    const data_set_t *ds = plugin_get_ds(vl->type);
+    if ((ds == NULL) || (ds->ds_num != vl->values_len)) {
+      sfree(vl->values);
+      continue;
+    }
+    args[args_num] = (plugin_write_entry_t){.ds = ds, .vl = vl};
+    args_num++;
+  }
+  if (args_num == 0) {
+    /* The end of a segment has been reached. */
+    spool_commit(wq->spool);
+    return;
   }
 
-  /* Store context of caller (read plugin); otherwise, it would not be
-   * available to the write plugins when actually dispatching the
-   * value-list later on. */
-  q->ctx = plugin_get_ctx();
+  plugin_ctx_t ctx = plugin_get_ctx();
+  ctx.name = cf->cf_ctx.name;
+  plugin_set_ctx(ctx);
+
+  int status = 0;
+  cdtime_t start = plugin_latency_start();
+  C_PROBE2(write__start, wq->name, args_num);
+  if (wq->batch) {
+    plugin_write_batch_cb callback = cf->cf_callback;
+    status = (*callback)(args, args_num, &cf->cf_udata);
+  } else {
+    plugin_write_cb callback = cf->cf_callback;
+    status = (*callback)(args[0].ds, args[0].vl, &cf->cf_udata);
+  }
+  C_PROBE2(write__done, wq->name, status);
+  plugin_latency_stop(cf->cf_latency, start);
+  if (status == 0)
+    plugin_flush_mark(cf, args_num);
 
-  pthread_mutex_lock(&write_lock);
+  for (size_t i = 0; i < args_num; i++)
+    sfree(wq->vls[i].values);
 
-  if (write_queue_tail == NULL) {
-    write_queue_head = q;
-    write_queue_tail = q;
-    write_queue_length = 1;
-  } else {
-    write_queue_tail->next = q;
-    write_queue_tail = q;
-    write_queue_length += 1;
+  wq->failing = (status != 0);
+  if (wq->failing) {
+    spool_rewind(wq->spool);
+    return;
   }
 
-  pthread_cond_signal(&write_cond);
-  pthread_mutex_unlock(&write_lock);
+  spool_commit(wq->spool);
+  wq->replay_budget -= (double)args_num;
 
-  return 0;
-} /* }}} int plugin_write_enqueue */
+  pthread_mutex_lock(&wq->lock);
+  wq->replayed += (derive_t)args_num;
+  pthread_mutex_unlock(&wq->lock);
+} /* }}} void writer_queue_replay */
 
-static value_list_t *plugin_write_dequeue(void) /* {{{ */
+/* Value lists are replayed from the spool in steps of this length. */
+#define WRITER_QUEUE_REPLAY_STEP MS_TO_CDTIME_T(100)
+
+static void *writer_queue_thread(void *arg) /* {{{ */
 {
-  write_queue_t *q;
-  value_list_t *vl;
+  writer_queue_t *wq = arg;
+
+  pthread_mutex_lock(&wq->lock);
+  while (wq->loop || (wq->head != NULL)) {
+    if ((wq->head == NULL) && wq->loop && (wq->spool != NULL) &&
+        (spool_size(wq->spool) > 0)) {
+      pthread_mutex_unlock(&wq->lock);
+      writer_queue_replay(wq);
+      pthread_mutex_lock(&wq->lock);
+
+      if ((wq->head == NULL) && wq->loop) {
+        /* Retry a failing writer once per second. */
+        cdtime_t wait = wq->failing ? TIME_T_TO_CDTIME_T(1)
+                                    : WRITER_QUEUE_REPLAY_STEP;
+        struct timespec ts = CDTIME_T_TO_TIMESPEC(cdtime() + wait);
+        pthread_cond_timedwait(&wq->cond, &wq->lock, &ts);
+      }
+      continue;
+    }
 
-  pthread_mutex_lock(&write_lock);
+    if (wq->head == NULL) {
+      pthread_cond_wait(&wq->cond, &wq->lock);
+      continue;
+    }
 
-  while (write_loop && (write_queue_head == NULL))
-    pthread_cond_wait(&write_cond, &write_lock);
+    /* Take the whole queue, so writing doesn't block enqueueing. */
+    write_queue_t *head = wq->head;
+    wq->head = NULL;
+    wq->tail = NULL;
+    wq->length = 0;
+    pthread_mutex_unlock(&wq->lock);
 
-  if (write_queue_head == NULL) {
-    pthread_mutex_unlock(&write_lock);
-    return NULL;
-  }
+    writer_queue_write(wq, head);
 
-  q = write_queue_head;
-  write_queue_head = q->next;
-  write_queue_length -= 1;
-  if (write_queue_head == NULL) {
-    write_queue_tail = NULL;
-    assert(0 == write_queue_length);
+    pthread_mutex_lock(&wq->lock);
   }
+  pthread_mutex_unlock(&wq->lock);
 
-  pthread_mutex_unlock(&write_lock);
+  return (void *)0;
+} /* }}} void *writer_queue_thread */
 
-  (void)plugin_set_ctx(q->ctx);
+static int writer_queue_start(writer_queue_t *wq) /* {{{ */
+{
+  if ((wq == NULL) || wq->thread_running)
+    return 0;
 
-  vl = q->vl;
-  sfree(q);
-  return vl;
-} /* }}} value_list_t *plugin_write_dequeue */
+  wq->loop = true;
+  int status = pthread_create(&wq->thread, /* attr = */ NULL,
+                              writer_queue_thread, /* arg = */ wq);
+  if (status != 0) {
+    ERROR("plugin: writer_queue_start: pthread_create failed with status %i "
+          "(%s).",
+          status, STRERROR(status));
+    wq->loop = false;
+    return status;
+  }
+  wq->thread_running = true;
+
+  char name[THREAD_NAME_MAX];
+  snprintf(name, sizeof(name), "wqueue#%.8s", wq->name);
+  set_thread_name(wq->thread, name);
+  /* Dedicated queues continue where the write threads left off. */
+  thread_cpus_apply(wq->thread, &write_threads_cpus,
+                    write_threads_num + writer_queues_started++);
+
+  return 0;
+} /* }}} int writer_queue_start */
+
+/* Hands `vl' to the batch writer `cf'. Inside a write thread the value list is
+ * queued until the current batch is flushed, elsewhere the callback is invoked
+ * right away. */
+static int plugin_write_batch_one(char const *name, /* {{{ */
+                                  callback_func_t *cf, const data_set_t *ds,
+                                  value_list_t const *vl) {
+  if (cf->cf_queue != NULL)
+    return writer_queue_enqueue(cf->cf_queue, ds, vl);
+
+  write_batch_t *b = pthread_getspecific(write_batch_key);
+
+  if (b != NULL)
+    return plugin_write_batch_append(b, cf, ds, vl);
+
+  plugin_ctx_t old_ctx = plugin_get_ctx();
+  plugin_ctx_t ctx = old_ctx;
+  ctx.name = cf->cf_ctx.name;
+  plugin_set_ctx(ctx);
+
+  plugin_write_batch_cb callback = cf->cf_callback;
+  cdtime_t start = plugin_latency_start();
+  C_PROBE2(write__start, name, 1);
+  int status = (*callback)(&(plugin_write_entry_t){.ds = ds, .vl = vl}, 1,
+                           &cf->cf_udata);
+  C_PROBE2(write__done, name, status);
+  plugin_latency_stop(cf->cf_latency, start);
+  if (status == 0)
+    plugin_flush_mark(cf, 1);
+
+  plugin_set_ctx(old_ctx);
+  return status;
+} /* }}} int plugin_write_batch_one */
 
 static void *plugin_write_thread(void __attribute__((unused)) * args) /* {{{ */
 {
+  write_batch_t batch = {0};
+  value_list_t vl;
+
+  pthread_setspecific(write_batch_key, &batch);
+
   while (write_loop) {
-    value_list_t *vl = plugin_write_dequeue();
-    if (vl == NULL)
+    write_queue_t *q = plugin_write_dequeue(/* wait = */ true);
+    if (q == NULL)
       continue;
 
-    plugin_dispatch_values_internal(vl);
-
-    plugin_value_list_free(vl);
+    /* Drain whatever is available, up to `write_batch_size' value lists, so
+     * batch writers see them all at once. This never waits for new values.
+     * The batch refers to the callbacks until it has been flushed. */
+    size_t slot = callback_reader_enter();
+    long n = 0;
+    do {
+      write_queue_entry_expand(q, &vl);
+      batch.ident = q->ident;
+      plugin_dispatch_values_internal(&vl, q->ds);
+      batch.ident = NULL;
+
+      /* Targets may have replaced the meta data. */
+      q->values = vl.values;
+      q->values_len = vl.values_len;
+      q->meta = vl.meta;
+      write_queue_entry_destroy(q);
+      n++;
+    } while ((n < write_batch_size) &&
+             ((q = plugin_write_dequeue(/* wait = */ false)) != NULL));
+
+    plugin_write_batch_flush(&batch);
+    callback_reader_leave(slot);
   }
 
+  pthread_setspecific(write_batch_key, NULL);
+  sfree(batch.entries);
+  sfree(batch.args);
+  sfree(batch.vls);
+
   pthread_exit(NULL);
   return (void *)0;
 } /* }}} void *plugin_write_thread */
@@ -810,6 +3880,22 @@ static void start_write_threads(size_t num) /* {{{ */
   if (write_threads != NULL)
     return;
 
+  pthread_mutex_lock(&write_slab_lock);
+  if (write_slab_free == NULL)
+    write_slab_free = c_ring_create(WRITE_SLAB_ENTRIES * WRITE_SLAB_MAX);
+  pthread_mutex_unlock(&write_slab_lock);
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(write_lanes); i++) {
+    write_lane_t *lane = &write_lanes[i];
+    if (lane->ring != NULL)
+      continue;
+    lane->ring = c_ring_create(lane->ring_size);
+    if (lane->ring == NULL)
+      WARNING("plugin: start_write_threads: c_ring_create failed. "
+              "Falling back to the locked write queue for the %s lane.",
+              lane->name);
+  }
+
   write_threads = (pthread_t *)calloc(num, sizeof(pthread_t));
   if (write_threads == NULL) {
     ERROR("plugin: start_write_threads: calloc failed.");
@@ -831,9 +3917,17 @@ static void start_write_threads(size_t num) /* {{{ */
     char name[THREAD_NAME_MAX];
     snprintf(name, sizeof(name), "writer#%" PRIsz, write_threads_num);
     set_thread_name(write_threads[write_threads_num], name);
+    thread_cpus_apply(write_threads[write_threads_num], &write_threads_cpus,
+                      write_threads_num);
 
     write_threads_num++;
   } /* for (i) */
+
+  /* Writers with a dedicated queue. */
+  for (llentry_t *le = llist_head(list_write); le != NULL; le = le->next)
+    writer_queue_start(((callback_func_t *)le->value)->cf_queue);
+  for (llentry_t *le = llist_head(list_write_batch); le != NULL; le = le->next)
+    writer_queue_start(((callback_func_t *)le->value)->cf_queue);
 } /* }}} void start_write_threads */
 
 static void stop_write_threads(void) /* {{{ */
@@ -861,19 +3955,24 @@ static void stop_write_threads(void) /* {{{ */
   sfree(write_threads);
   write_threads_num = 0;
 
-  pthread_mutex_lock(&write_lock);
+  /* The shared write threads feed the dedicated queues, so stop those last.
+   * They write out all queued values before exiting. */
+  for (llentry_t *le = llist_head(list_write); le != NULL; le = le->next)
+    writer_queue_stop(((callback_func_t *)le->value)->cf_queue);
+  for (llentry_t *le = llist_head(list_write_batch); le != NULL; le = le->next)
+    writer_queue_stop(((callback_func_t *)le->value)->cf_queue);
+
   i = 0;
-  for (q = write_queue_head; q != NULL;) {
-    write_queue_t *q1 = q;
-    plugin_value_list_free(q->vl);
-    q = q->next;
-    sfree(q1);
+  while ((q = plugin_write_queue_pop()) != NULL) {
+    write_queue_entry_destroy(q);
     i++;
   }
-  write_queue_head = NULL;
-  write_queue_tail = NULL;
-  write_queue_length = 0;
-  pthread_mutex_unlock(&write_lock);
+  assert(C_ATOMIC_LOAD(&write_queue_length) == 0);
+
+  for (size_t j = 0; j < STATIC_ARRAY_SIZE(write_lanes); j++) {
+    c_ring_destroy(write_lanes[j].ring);
+    write_lanes[j].ring = NULL;
+  }
 
   if (i > 0) {
     WARNING("plugin: %" PRIsz " value list%s left after shutting down "
@@ -882,6 +3981,165 @@ static void stop_write_threads(void) /* {{{ */
   }
 } /* }}} void stop_write_threads */
 
+/* Must be called with "notification_lock" held. */
+static void notification_key_release(notification_key_t *key) /* {{{ */
+{
+  c_avl_remove(notification_keys, key->name, NULL, NULL);
+  sfree(key->name);
+  sfree(key);
+} /* }}} void notification_key_release */
+
+/* Removes the coalescing state of keys whose window has passed. Must be
+ * called with "notification_lock" held. */
+static void notification_keys_prune(cdtime_t now) /* {{{ */
+{
+  notification_key_t *prune = NULL;
+  c_avl_iterator_t *iter = c_avl_get_iterator(notification_keys);
+  notification_key_t *key;
+
+  if (iter == NULL)
+    return;
+
+  while (c_avl_iterator_next(iter, NULL, (void *)&key) == 0) {
+    if ((key->queued != NULL) ||
+        ((now - key->last) < notification_coalesce_window))
+      continue;
+    key->prune_next = prune;
+    prune = key;
+  }
+  c_avl_iterator_destroy(iter);
+
+  while (prune != NULL) {
+    key = prune;
+    prune = key->prune_next;
+    notification_key_release(key);
+  }
+
+  notification_last_prune = now;
+} /* }}} void notification_keys_prune */
+
+static void *plugin_notification_thread(void __attribute__((unused)) *
+                                        args) /* {{{ */
+{
+  pthread_mutex_lock(&notification_lock);
+  while (true) {
+    while (notification_loop && (notification_queue_head == NULL))
+      pthread_cond_wait(&notification_cond, &notification_lock);
+
+    /* Pending notifications are delivered before exiting. */
+    notification_queue_t *q = notification_queue_head;
+    if (q == NULL)
+      break;
+
+    notification_queue_head = q->next;
+    if (notification_queue_head == NULL)
+      notification_queue_tail = NULL;
+    notification_queue_length--;
+
+    if (q->key != NULL) {
+      q->key->queued = NULL;
+      if (notification_coalesce_window == 0)
+        notification_key_release(q->key);
+      q->key = NULL;
+    }
+
+    cdtime_t now = cdtime();
+    if ((notification_coalesce_window > 0) &&
+        ((now - notification_last_prune) >= notification_coalesce_window))
+      notification_keys_prune(now);
+    pthread_mutex_unlock(&notification_lock);
+
+    plugin_notification_deliver(&q->n);
+
+    if (q->n.meta != NULL)
+      plugin_notification_meta_free(q->n.meta);
+    sfree(q);
+
+    pthread_mutex_lock(&notification_lock);
+  }
+  pthread_mutex_unlock(&notification_lock);
+
+  return (void *)0;
+} /* }}} void *plugin_notification_thread */
+
+static void start_notification_threads(size_t num) /* {{{ */
+{
+  if ((num == 0) || (notification_threads != NULL))
+    return;
+
+  notification_keys = c_avl_create((int (*)(const void *, const void *))strcmp);
+  notification_threads = calloc(num, sizeof(*notification_threads));
+  if ((notification_keys == NULL) || (notification_threads == NULL)) {
+    ERROR("plugin: start_notification_threads: Out of memory.");
+    if (notification_keys != NULL)
+      c_avl_destroy(notification_keys);
+    notification_keys = NULL;
+    sfree(notification_threads);
+    return;
+  }
+
+  pthread_mutex_lock(&notification_lock);
+  notification_loop = true;
+  pthread_mutex_unlock(&notification_lock);
+
+  notification_threads_num = 0;
+  for (size_t i = 0; i < num; i++) {
+    int status = pthread_create(notification_threads + notification_threads_num,
+                                /* attr = */ NULL, plugin_notification_thread,
+                                /* arg = */ NULL);
+    if (status != 0) {
+      ERROR("plugin: start_notification_threads: pthread_create failed with "
+            "status %i (%s).",
+            status, STRERROR(status));
+      break;
+    }
+
+    char name[THREAD_NAME_MAX];
+    snprintf(name, sizeof(name), "notify#%" PRIsz, notification_threads_num);
+    set_thread_name(notification_threads[notification_threads_num], name);
+
+    notification_threads_num++;
+  }
+
+  /* Deliver notifications synchronously if no thread could be started. */
+  if (notification_threads_num == 0) {
+    pthread_mutex_lock(&notification_lock);
+    notification_loop = false;
+    pthread_mutex_unlock(&notification_lock);
+  }
+} /* }}} void start_notification_threads */
+
+static void stop_notification_threads(void) /* {{{ */
+{
+  if (notification_threads == NULL)
+    return;
+
+  INFO("collectd: Stopping %" PRIsz " notification threads.",
+       notification_threads_num);
+
+  /* Notifications dispatched from now on are delivered synchronously. */
+  pthread_mutex_lock(&notification_lock);
+  notification_loop = false;
+  pthread_cond_broadcast(&notification_cond);
+  pthread_mutex_unlock(&notification_lock);
+
+  for (size_t i = 0; i < notification_threads_num; i++) {
+    if (pthread_join(notification_threads[i], NULL) != 0)
+      ERROR("plugin: stop_notification_threads: pthread_join failed.");
+  }
+  sfree(notification_threads);
+  notification_threads_num = 0;
+
+  void *name;
+  void *key;
+  while (c_avl_pick(notification_keys, &name, &key) == 0) {
+    sfree(name);
+    sfree(key);
+  }
+  c_avl_destroy(notification_keys);
+  notification_keys = NULL;
+} /* }}} void stop_notification_threads */
+
 /*
  * Public functions
  */
@@ -940,6 +4198,47 @@ static void plugin_free_loaded(void) {
 }
 
 #define BUFSIZE 512
+static void startup_timing_add(char const *kind, char const *name,
+                               cdtime_t duration) {
+  pthread_mutex_lock(&startup_timing_lock);
+  startup_timing_t *tmp =
+      realloc(startup_timings,
+              (startup_timings_num + 1) * sizeof(*startup_timings));
+  if (tmp != NULL) {
+    startup_timings = tmp;
+    startup_timings[startup_timings_num] = (startup_timing_t){
+        .kind = kind, .duration = duration,
+    };
+    sstrncpy(startup_timings[startup_timings_num].name, name,
+             sizeof(startup_timings[startup_timings_num].name));
+    startup_timings_num++;
+  }
+  pthread_mutex_unlock(&startup_timing_lock);
+} /* void startup_timing_add */
+
+static int startup_timing_compare(void const *a, void const *b) {
+  cdtime_t da = ((startup_timing_t const *)a)->duration;
+  cdtime_t db = ((startup_timing_t const *)b)->duration;
+
+  /* slowest first */
+  return (da > db) ? -1 : (da < db) ? 1 : 0;
+} /* int startup_timing_compare */
+
+/* Logs the time spent loading each plugin and in each init callback, slowest
+ * first, and frees the collected timings. */
+static void startup_timing_report(void) {
+  pthread_mutex_lock(&startup_timing_lock);
+  qsort(startup_timings, startup_timings_num, sizeof(*startup_timings),
+        startup_timing_compare);
+  for (size_t i = 0; i < startup_timings_num; i++)
+    INFO("plugin: Startup timing: %s `%s' took %.3f seconds.",
+         startup_timings[i].kind, startup_timings[i].name,
+         CDTIME_T_TO_DOUBLE(startup_timings[i].duration));
+  sfree(startup_timings);
+  startup_timings_num = 0;
+  pthread_mutex_unlock(&startup_timing_lock);
+} /* void startup_timing_report */
+
 int plugin_load(char const *plugin_name, bool global) {
   DIR *dh;
   const char *dir;
@@ -1008,7 +4307,9 @@ int plugin_load(char const *plugin_name, bool global) {
       continue;
     }
 
+    cdtime_t start = cdtime();
     status = plugin_load_file(filename, global);
+    startup_timing_add("loading", plugin_name, cdtime() - start);
     if (status == 0) {
       /* success */
       plugin_mark_loaded(plugin_name);
@@ -1049,20 +4350,6 @@ int plugin_register_init(const char *name, int (*callback)(void)) {
   return create_register_callback(&list_init, name, (void *)callback, NULL);
 } /* plugin_register_init */
 
-static int plugin_compare_read_func(const void *arg0, const void *arg1) {
-  const read_func_t *rf0;
-  const read_func_t *rf1;
-
-  rf0 = arg0;
-  rf1 = arg1;
-
-  if (rf0->rf_next_read < rf1->rf_next_read)
-    return -1;
-  else if (rf0->rf_next_read > rf1->rf_next_read)
-    return 1;
-  else
-    return 0;
-} /* int plugin_compare_read_func */
 
 /* Add a read function to both, the heap and a linked list. The linked list if
  * used to look-up read functions, especially for the remove function. The heap
@@ -1071,7 +4358,7 @@ static int plugin_insert_read(read_func_t *rf) {
   int status;
   llentry_t *le;
 
-  rf->rf_next_read = cdtime();
+  rf->rf_next_read = read_func_phase_next(rf, cdtime());
   rf->rf_effective_interval = rf->rf_interval;
 
   pthread_mutex_lock(&read_lock);
@@ -1110,7 +4397,20 @@ static int plugin_insert_read(read_func_t *rf) {
     return -1;
   }
 
-  status = c_heap_insert(read_heap, rf);
+  size_t workers_num = C_ATOMIC_LOAD(&read_workers_active);
+  if (workers_num > 0) {
+    /* The read threads are running: hand the function to one of them. */
+    read_worker_t *w = read_workers + (read_workers_next % workers_num);
+    read_workers_next++;
+
+    pthread_mutex_lock(&w->lock);
+    status = c_heap_insert(w->heap, rf);
+    if (status == 0)
+      read_worker_signal(w);
+    pthread_mutex_unlock(&w->lock);
+  } else {
+    status = c_heap_insert(read_heap, rf);
+  }
   if (status != 0) {
     pthread_mutex_unlock(&read_lock);
     ERROR("plugin_insert_read: c_heap_insert failed.");
@@ -1121,8 +4421,6 @@ static int plugin_insert_read(read_func_t *rf) {
   /* This does not fail. */
   llist_append(read_list, le);
 
-  /* Wake up all the read threads. */
-  pthread_cond_broadcast(&read_cond);
   pthread_mutex_unlock(&read_lock);
   return 0;
 } /* int plugin_insert_read */
@@ -1143,12 +4441,14 @@ int plugin_register_read(const char *name, int (*callback)(void)) {
   rf->rf_ctx = plugin_get_ctx();
   rf->rf_group[0] = '\0';
   rf->rf_name = strdup(name);
+  rf->rf_latency = plugin_latency_register("read", name);
   rf->rf_type = RF_SIMPLE;
   rf->rf_interval = plugin_get_interval();
   rf->rf_ctx.interval = rf->rf_interval;
 
   status = plugin_insert_read(rf);
   if (status != 0) {
+    plugin_latency_unregister(rf->rf_latency);
     sfree(rf->rf_name);
     sfree(rf);
   }
@@ -1162,149 +4462,541 @@ int plugin_register_complex_read(const char *group, const char *name,
   read_func_t *rf;
   int status;
 
-  rf = calloc(1, sizeof(*rf));
-  if (rf == NULL) {
-    free_userdata(user_data);
-    ERROR("plugin_register_complex_read: calloc failed.");
-    return ENOMEM;
-  }
+  rf = calloc(1, sizeof(*rf));
+  if (rf == NULL) {
+    free_userdata(user_data);
+    ERROR("plugin_register_complex_read: calloc failed.");
+    return ENOMEM;
+  }
+
+  rf->rf_callback = (void *)callback;
+  if (group != NULL)
+    sstrncpy(rf->rf_group, group, sizeof(rf->rf_group));
+  else
+    rf->rf_group[0] = '\0';
+  rf->rf_name = strdup(name);
+  rf->rf_latency = plugin_latency_register("read", name);
+  rf->rf_type = RF_COMPLEX;
+  rf->rf_interval = (interval != 0) ? interval : plugin_get_interval();
+
+  /* Set user data */
+  if (user_data == NULL) {
+    rf->rf_udata.data = NULL;
+    rf->rf_udata.free_func = NULL;
+  } else {
+    rf->rf_udata = *user_data;
+  }
+
+  rf->rf_ctx = plugin_get_ctx();
+  rf->rf_ctx.interval = rf->rf_interval;
+
+  status = plugin_insert_read(rf);
+  if (status != 0) {
+    plugin_latency_unregister(rf->rf_latency);
+    free_userdata(&rf->rf_udata);
+    sfree(rf->rf_name);
+    sfree(rf);
+  }
+
+  return status;
+} /* int plugin_register_complex_read */
+
+int plugin_register_write(const char *name, plugin_write_cb callback,
+                          user_data_t const *ud) {
+  return create_register_callback(&list_write, name, (void *)callback, ud);
+} /* int plugin_register_write */
+
+int plugin_register_write_batch(const char *name,
+                                plugin_write_batch_cb callback,
+                                user_data_t const *ud) {
+  return create_register_callback(&list_write_batch, name, (void *)callback,
+                                  ud);
+} /* int plugin_register_write_batch */
+
+static void *plugin_flush_thread(void __attribute__((unused)) * args) /* {{{ */
+{
+  pthread_mutex_lock(&flush_lock);
+  while (flush_loop) {
+    flush_entry_t *fe = c_heap_peek_root(flush_heap);
+    if (fe == NULL) {
+      pthread_cond_wait(&flush_cond, &flush_lock);
+      continue;
+    }
+
+    cdtime_t now = cdtime();
+    if (fe->deadline > now) {
+      pthread_cond_timedwait(&flush_cond, &flush_lock,
+                             &CDTIME_T_TO_TIMESPEC(fe->deadline));
+      continue;
+    }
+
+    /* Clear the mark before flushing, so that values written while the
+     * callback runs schedule the next flush. */
+    c_heap_get_root(flush_heap);
+    C_ATOMIC_STORE(&fe->queued, false);
+    uint64_t values = C_ATOMIC_LOAD(&fe->values_pending);
+    C_ATOMIC_SUB(&fe->values_pending, values);
+    pthread_mutex_unlock(&flush_lock);
+
+    plugin_flush(fe->name, fe->timeout, /* identifier = */ NULL);
+
+    pthread_mutex_lock(&flush_lock);
+    fe->flushes++;
+    fe->values_flushed += (derive_t)values;
+    if (fe->writers == 0) {
+      cdtime_t next = fe->deadline + fe->interval;
+      flush_entry_queue(fe, (next > now) ? next : now + fe->interval);
+    }
+  }
+  pthread_mutex_unlock(&flush_lock);
+
+  return NULL;
+} /* }}} void *plugin_flush_thread */
+
+static void start_flush_thread(void) /* {{{ */
+{
+  pthread_mutex_lock(&flush_lock);
+  if (flush_thread_running || (flush_entries == NULL)) {
+    pthread_mutex_unlock(&flush_lock);
+    return;
+  }
+  flush_loop = true;
+  pthread_mutex_unlock(&flush_lock);
+
+  int status = pthread_create(&flush_thread, /* attr = */ NULL,
+                              plugin_flush_thread, /* arg = */ NULL);
+  if (status != 0) {
+    ERROR("plugin: start_flush_thread: pthread_create failed with status %i "
+          "(%s).",
+          status, STRERROR(status));
+    return;
+  }
+  set_thread_name(flush_thread, "flush");
+  flush_thread_running = true;
+} /* }}} void start_flush_thread */
+
+static void stop_flush_thread(void) /* {{{ */
+{
+  if (!flush_thread_running)
+    return;
+
+  pthread_mutex_lock(&flush_lock);
+  flush_loop = false;
+  pthread_cond_broadcast(&flush_cond);
+  pthread_mutex_unlock(&flush_lock);
+
+  if (pthread_join(flush_thread, NULL) != 0)
+    ERROR("plugin: stop_flush_thread: pthread_join failed.");
+  flush_thread_running = false;
+} /* }}} void stop_flush_thread */
+
+static void flush_entries_free(void) /* {{{ */
+{
+  pthread_mutex_lock(&flush_lock);
+  while (flush_entries != NULL) {
+    flush_entry_t *fe = flush_entries;
+    flush_entries = fe->next;
+    sfree(fe->name);
+    sfree(fe);
+  }
+  c_heap_destroy(flush_heap);
+  flush_heap = NULL;
+  pthread_mutex_unlock(&flush_lock);
+} /* }}} void flush_entries_free */
+
+static int flush_entry_add(const char *name, cdtime_t interval, /* {{{ */
+                           cdtime_t timeout) {
+  flush_entry_t *fe = calloc(1, sizeof(*fe));
+  if (fe == NULL) {
+    ERROR("plugin_register_flush: calloc failed.");
+    return ENOMEM;
+  }
+  fe->name = strdup(name);
+  if (fe->name == NULL) {
+    ERROR("plugin_register_flush: strdup failed.");
+    sfree(fe);
+    return ENOMEM;
+  }
+  fe->interval = interval;
+  fe->timeout = timeout;
+
+  pthread_mutex_lock(&register_lock);
+  pthread_mutex_lock(&flush_lock);
+  if (flush_heap == NULL)
+    flush_heap = c_heap_create_ex(flush_entry_compare,
+                                  C_HEAP_UNLOCKED | C_HEAP_INDEXED,
+                                  offsetof(flush_entry_t, heap_index));
+  if (flush_heap == NULL) {
+    pthread_mutex_unlock(&flush_lock);
+    pthread_mutex_unlock(&register_lock);
+    ERROR("plugin_register_flush: c_heap_create_ex failed.");
+    sfree(fe->name);
+    sfree(fe);
+    return ENOMEM;
+  }
+
+  /* Bind the write callbacks which have been registered already. */
+  llist_t *lists[] = {list_write, list_write_batch};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(lists); i++) {
+    llentry_t *le = llist_search(lists[i], name);
+    if (le == NULL)
+      continue;
+    callback_func_t *cf = le->value;
+    if (cf->cf_flush != NULL)
+      cf->cf_flush->writers--;
+    C_ATOMIC_STORE_REL(&cf->cf_flush, fe);
+    fe->writers++;
+  }
+
+  fe->next = flush_entries;
+  flush_entries = fe;
+  if (fe->writers == 0)
+    flush_entry_queue(fe, cdtime() + interval);
+  pthread_mutex_unlock(&flush_lock);
+  pthread_mutex_unlock(&register_lock);
+
+  /* Registered after the daemon has been initialized. */
+  if (write_threads != NULL)
+    start_flush_thread();
+
+  return 0;
+} /* }}} int flush_entry_add */
+
+static void flush_entry_remove(const char *name) /* {{{ */
+{
+  pthread_mutex_lock(&flush_lock);
+  for (flush_entry_t *fe = flush_entries; fe != NULL; fe = fe->next) {
+    if (fe->removed || (strcmp(name, fe->name) != 0))
+      continue;
+
+    /* Write callbacks may still point to the entry, so it is only freed on
+     * shutdown. */
+    if (fe->queued)
+      c_heap_remove(flush_heap, fe);
+    C_ATOMIC_STORE(&fe->queued, false);
+    fe->removed = true;
+    break;
+  }
+  pthread_mutex_unlock(&flush_lock);
+} /* }}} void flush_entry_remove */
+
+/* Dispatches the flush statistics of every writer with a "FlushInterval". */
+static void flush_entries_dispatch(value_list_t *vl) /* {{{ */
+{
+  pthread_mutex_lock(&flush_lock);
+  for (flush_entry_t *fe = flush_entries; fe != NULL; fe = fe->next) {
+    if (fe->removed)
+      continue;
+
+    /* Entries are only freed on shutdown, so "fe" remains valid while the
+     * lock is released. The lock must not be held while dispatching: the
+     * write callbacks take it in plugin_flush_mark(). */
+    gauge_t pending = (gauge_t)C_ATOMIC_LOAD(&fe->values_pending);
+    derive_t flushes = fe->flushes;
+    derive_t values = fe->values_flushed;
+    pthread_mutex_unlock(&flush_lock);
+
+    snprintf(vl->plugin_instance, sizeof(vl->plugin_instance), "flush-%s",
+             fe->name);
+    vl->values_len = 1;
+
+    vl->values = &(value_t){.gauge = pending};
+    sstrncpy(vl->type, "queue_length", sizeof(vl->type));
+    vl->type_instance[0] = 0;
+    plugin_dispatch_values(vl);
+
+    vl->values = &(value_t){.derive = flushes};
+    sstrncpy(vl->type, "derive", sizeof(vl->type));
+    sstrncpy(vl->type_instance, "flushes", sizeof(vl->type_instance));
+    plugin_dispatch_values(vl);
+
+    vl->values = &(value_t){.derive = values};
+    sstrncpy(vl->type_instance, "values", sizeof(vl->type_instance));
+    plugin_dispatch_values(vl);
+
+    pthread_mutex_lock(&flush_lock);
+  }
+  pthread_mutex_unlock(&flush_lock);
+} /* }}} void flush_entries_dispatch */
+
+int plugin_register_flush(const char *name, plugin_flush_cb callback,
+                          user_data_t const *ud) {
+  int status;
+  plugin_ctx_t ctx = plugin_get_ctx();
+
+  status = create_register_callback(&list_flush, name, (void *)callback, ud);
+  if (status != 0)
+    return status;
+
+  if (ctx.flush_interval != 0)
+    return flush_entry_add(name, ctx.flush_interval, ctx.flush_timeout);
+
+  return 0;
+} /* int plugin_register_flush */
+
+int plugin_register_missing(const char *name, plugin_missing_cb callback,
+                            user_data_t const *ud) {
+  return create_register_callback(&list_missing, name, (void *)callback, ud);
+} /* int plugin_register_missing */
+
+int plugin_register_shutdown(const char *name, int (*callback)(void)) {
+  return create_register_callback(&list_shutdown, name, (void *)callback, NULL);
+} /* int plugin_register_shutdown */
+
+int plugin_register_reconfigure(const char *name,
+                                plugin_reconfigure_cb callback) {
+  return create_register_callback(&list_reconfigure, name, (void *)callback,
+                                  NULL);
+} /* int plugin_register_reconfigure */
+
+static uint32_t data_set_index_slot(uint32_t hash, uint32_t displacement) {
+  /* Finalizer from MurmurHash3 */
+  hash ^= displacement * 0x9e3779b9u;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+} /* uint32_t data_set_index_slot */
+
+static void data_set_index_free(data_set_index_t *idx) {
+  if (idx == NULL)
+    return;
+
+  sfree(idx->displacements);
+  sfree(idx->slots);
+  sfree(idx);
+} /* void data_set_index_free */
 
-  rf->rf_callback = (void *)callback;
-  if (group != NULL)
-    sstrncpy(rf->rf_group, group, sizeof(rf->rf_group));
-  else
-    rf->rf_group[0] = '\0';
-  rf->rf_name = strdup(name);
-  rf->rf_type = RF_COMPLEX;
-  rf->rf_interval = (interval != 0) ? interval : plugin_get_interval();
+struct data_set_index_item_s {
+  uint32_t hash;
+  size_t bucket;
+  size_t bucket_size;
+  data_set_t *ds;
+};
+typedef struct data_set_index_item_s data_set_index_item_t;
 
-  /* Set user data */
-  if (user_data == NULL) {
-    rf->rf_udata.data = NULL;
-    rf->rf_udata.free_func = NULL;
-  } else {
-    rf->rf_udata = *user_data;
-  }
+/* Sorts items by bucket, largest buckets first. */
+static int data_set_index_item_compare(void const *a, void const *b) {
+  data_set_index_item_t const *i_a = a;
+  data_set_index_item_t const *i_b = b;
 
-  rf->rf_ctx = plugin_get_ctx();
-  rf->rf_ctx.interval = rf->rf_interval;
+  if (i_a->bucket_size != i_b->bucket_size)
+    return (i_a->bucket_size > i_b->bucket_size) ? -1 : 1;
+  else if (i_a->bucket != i_b->bucket)
+    return (i_a->bucket < i_b->bucket) ? -1 : 1;
+  return 0;
+} /* int data_set_index_item_compare */
+
+/* Finds a displacement for the "items_num" items of one bucket. Returns zero
+ * on success. */
+static int data_set_index_place(data_set_index_t *idx,
+                                data_set_index_item_t *items,
+                                size_t items_num) {
+  for (uint32_t d = 0; d < 65536; d++) {
+    size_t placed = 0;
+
+    for (; placed < items_num; placed++) {
+      size_t slot = data_set_index_slot(items[placed].hash, d) &
+                    (idx->slots_num - 1);
+      if (idx->slots[slot] != NULL)
+        break;
+      idx->slots[slot] = items[placed].ds;
+    }
 
-  status = plugin_insert_read(rf);
-  if (status != 0) {
-    free_userdata(&rf->rf_udata);
-    sfree(rf->rf_name);
-    sfree(rf);
+    if (placed == items_num) {
+      idx->displacements[items[0].bucket] = d;
+      return 0;
+    }
+
+    /* Undo the partial placement */
+    for (size_t i = 0; i < placed; i++) {
+      size_t slot =
+          data_set_index_slot(items[i].hash, d) & (idx->slots_num - 1);
+      idx->slots[slot] = NULL;
+    }
   }
 
-  return status;
-} /* int plugin_register_complex_read */
+  return -1;
+} /* int data_set_index_place */
 
-int plugin_register_write(const char *name, plugin_write_cb callback,
-                          user_data_t const *ud) {
-  return create_register_callback(&list_write, name, (void *)callback, ud);
-} /* int plugin_register_write */
+/* Must be called with data_set_lock held. */
+static data_set_index_t *data_set_index_build(void) {
+  data_set_index_t *idx = NULL;
+  data_set_index_item_t *items = NULL;
+  size_t items_num;
+
+  if ((data_sets == NULL) || ((items_num = c_avl_size(data_sets)) == 0))
+    return NULL;
 
-static int plugin_flush_timeout_callback(user_data_t *ud) {
-  flush_callback_t *cb = ud->data;
+  idx = calloc(1, sizeof(*idx));
+  items = calloc(items_num, sizeof(*items));
+  if ((idx == NULL) || (items == NULL)) {
+    sfree(idx);
+    sfree(items);
+    return NULL;
+  }
 
-  return plugin_flush(cb->name, cb->timeout, NULL);
-} /* static int plugin_flush_callback */
+  /* About four types per bucket, and at least twice as many slots as types.
+   * With this load, displacements are found after a few tries. */
+  idx->buckets_num = 1;
+  while (4 * idx->buckets_num < items_num)
+    idx->buckets_num *= 2;
+  idx->slots_num = 2;
+  while (idx->slots_num < 2 * items_num)
+    idx->slots_num *= 2;
+
+  size_t *bucket_sizes = calloc(idx->buckets_num, sizeof(*bucket_sizes));
+  idx->displacements = calloc(idx->buckets_num, sizeof(*idx->displacements));
+  idx->slots = calloc(idx->slots_num, sizeof(*idx->slots));
+  if ((idx->displacements == NULL) || (idx->slots == NULL) ||
+      (bucket_sizes == NULL)) {
+    sfree(bucket_sizes);
+    sfree(items);
+    data_set_index_free(idx);
+    return NULL;
+  }
 
-static void plugin_flush_timeout_callback_free(void *data) {
-  flush_callback_t *cb = data;
+  c_avl_iterator_t *iter = c_avl_get_iterator(data_sets);
+  char *key = NULL;
+  data_set_t *ds = NULL;
+  size_t n = 0;
+  while ((n < items_num) &&
+         (c_avl_iterator_next(iter, (void *)&key, (void *)&ds) == 0)) {
+    items[n].hash = identifier_hash(ds->type);
+    items[n].bucket = items[n].hash & (idx->buckets_num - 1);
+    items[n].ds = ds;
+    bucket_sizes[items[n].bucket]++;
+    n++;
+  }
+  c_avl_iterator_destroy(iter);
 
-  if (cb == NULL)
-    return;
+  for (size_t i = 0; i < n; i++)
+    items[i].bucket_size = bucket_sizes[items[i].bucket];
+  sfree(bucket_sizes);
 
-  sfree(cb->name);
-  sfree(cb);
-} /* static void plugin_flush_callback_free */
+  qsort(items, n, sizeof(*items), data_set_index_item_compare);
 
-static char *plugin_flush_callback_name(const char *name) {
-  const char *flush_prefix = "flush/";
-  size_t prefix_size;
-  char *flush_name;
-  size_t name_size;
+  int status = 0;
+  for (size_t i = 0; (i < n) && (status == 0);) {
+    size_t j = i + 1;
+    while ((j < n) && (items[j].bucket == items[i].bucket))
+      j++;
 
-  prefix_size = strlen(flush_prefix);
-  name_size = strlen(name);
+    status = data_set_index_place(idx, items + i, j - i);
+    i = j;
+  }
+  sfree(items);
 
-  flush_name = malloc(name_size + prefix_size + 1);
-  if (flush_name == NULL) {
-    ERROR("plugin_flush_callback_name: malloc failed.");
+  if (status != 0) {
+    /* Only happens if two types have the same hash. */
+    WARNING("plugin: Building the data set index failed. "
+            "Falling back to the slower lookup.");
+    data_set_index_free(idx);
     return NULL;
   }
 
-  sstrncpy(flush_name, flush_prefix, prefix_size + 1);
-  sstrncpy(flush_name + prefix_size, name, name_size + 1);
-
-  return flush_name;
-} /* static char *plugin_flush_callback_name */
+  return idx;
+} /* data_set_index_t *data_set_index_build */
 
-int plugin_register_flush(const char *name, plugin_flush_cb callback,
-                          user_data_t const *ud) {
-  int status;
-  plugin_ctx_t ctx = plugin_get_ctx();
+static data_set_t *data_set_index_get(data_set_index_t const *idx,
+                                      const char *type) {
+  uint32_t hash = identifier_hash(type);
+  uint32_t d = idx->displacements[hash & (idx->buckets_num - 1)];
+  data_set_t *ds =
+      idx->slots[data_set_index_slot(hash, d) & (idx->slots_num - 1)];
 
-  status = create_register_callback(&list_flush, name, (void *)callback, ud);
-  if (status != 0)
-    return status;
+  if ((ds == NULL) || (strcmp(ds->type, type) != 0))
+    return NULL;
 
-  if (ctx.flush_interval != 0) {
-    char *flush_name;
-    flush_callback_t *cb;
+  return ds;
+} /* data_set_t *data_set_index_get */
 
-    flush_name = plugin_flush_callback_name(name);
-    if (flush_name == NULL)
-      return -1;
+/* Must be called with data_set_lock held. */
+static void data_set_index_retire(void) {
+  data_set_index_t *idx = data_set_index;
 
-    cb = malloc(sizeof(*cb));
-    if (cb == NULL) {
-      ERROR("plugin_register_flush: malloc failed.");
-      sfree(flush_name);
-      return -1;
-    }
+  if (idx == NULL)
+    return;
 
-    cb->name = strdup(name);
-    if (cb->name == NULL) {
-      ERROR("plugin_register_flush: strdup failed.");
-      sfree(cb);
-      sfree(flush_name);
-      return -1;
-    }
-    cb->timeout = ctx.flush_timeout;
+  C_ATOMIC_STORE_REL(&data_set_index, NULL);
+  idx->next_retired = data_set_index_retired;
+  data_set_index_retired = idx;
+} /* void data_set_index_retire */
+
+int plugin_build_data_set_index(void) {
+  pthread_mutex_lock(&data_set_lock);
+  data_set_index_retire();
+  data_set_index_t *idx = data_set_index_build();
+  C_ATOMIC_STORE_REL(&data_set_index, idx);
+  pthread_mutex_unlock(&data_set_lock);
+
+  return (idx != NULL) ? 0 : -1;
+} /* int plugin_build_data_set_index */
+
+/* Looks up a data set, trying the calling thread's last hit, the index and
+ * the AVL tree, in that order. */
+static const data_set_t *plugin_lookup_ds(const char *type) {
+  data_set_index_t const *idx = C_ATOMIC_LOAD_ACQ(&data_set_index);
+  data_set_cache_t *cache = NULL;
+  data_set_t *ds = NULL;
 
-    status = plugin_register_complex_read(
-        /* group     = */ "flush",
-        /* name      = */ flush_name,
-        /* callback  = */ plugin_flush_timeout_callback,
-        /* interval  = */ ctx.flush_interval,
-        /* user data = */ &(user_data_t){
-            .data = cb, .free_func = plugin_flush_timeout_callback_free,
-        });
+  if (idx != NULL) {
+    cache = pthread_getspecific(data_set_cache_key);
+    if ((cache != NULL) && (cache->index == idx) &&
+        (strcmp(cache->ds->type, type) == 0))
+      return cache->ds;
 
-    sfree(flush_name);
-    return status;
+    ds = data_set_index_get(idx, type);
+  } else {
+    /* No index, e.g. because data sets are being registered. */
+    pthread_mutex_lock(&data_set_lock);
+    if ((data_sets == NULL) || (c_avl_get(data_sets, type, (void *)&ds) != 0))
+      ds = NULL;
+    pthread_mutex_unlock(&data_set_lock);
   }
 
-  return 0;
-} /* int plugin_register_flush */
+  if ((ds == NULL) || (idx == NULL))
+    return ds;
 
-int plugin_register_missing(const char *name, plugin_missing_cb callback,
-                            user_data_t const *ud) {
-  return create_register_callback(&list_missing, name, (void *)callback, ud);
-} /* int plugin_register_missing */
+  if (cache == NULL) {
+    cache = malloc(sizeof(*cache));
+    if ((cache == NULL) ||
+        (pthread_setspecific(data_set_cache_key, cache) != 0)) {
+      sfree(cache);
+      return ds;
+    }
+  }
+  cache->index = idx;
+  cache->ds = ds;
 
-int plugin_register_shutdown(const char *name, int (*callback)(void)) {
-  return create_register_callback(&list_shutdown, name, (void *)callback, NULL);
-} /* int plugin_register_shutdown */
+  return ds;
+} /* const data_set_t *plugin_lookup_ds */
 
 static void plugin_free_data_sets(void) {
   void *key;
   void *value;
 
-  if (data_sets == NULL)
+  pthread_mutex_lock(&data_set_lock);
+  data_set_index_retire();
+  while (data_set_index_retired != NULL) {
+    data_set_index_t *next = data_set_index_retired->next_retired;
+    data_set_index_free(data_set_index_retired);
+    data_set_index_retired = next;
+  }
+
+  for (size_t i = 0; i < data_sets_retired_num; i++) {
+    sfree(data_sets_retired[i]->ds);
+    sfree(data_sets_retired[i]);
+  }
+  sfree(data_sets_retired);
+  data_sets_retired_num = 0;
+
+  if (data_sets == NULL) {
+    pthread_mutex_unlock(&data_set_lock);
     return;
+  }
 
   while (c_avl_pick(data_sets, &key, &value) == 0) {
     data_set_t *ds = value;
@@ -1316,14 +5008,38 @@ static void plugin_free_data_sets(void) {
 
   c_avl_destroy(data_sets);
   data_sets = NULL;
+  pthread_mutex_unlock(&data_set_lock);
 } /* void plugin_free_data_sets */
 
-int plugin_register_data_set(const data_set_t *ds) {
+/* Must be called with data_set_lock held. */
+static int plugin_unregister_data_set_locked(const char *name) {
+  data_set_t *ds;
+
+  if (data_sets == NULL)
+    return -1;
+
+  data_set_t **tmp = realloc(data_sets_retired, (data_sets_retired_num + 1) *
+                                                    sizeof(*data_sets_retired));
+  if (tmp == NULL)
+    return -1;
+  data_sets_retired = tmp;
+
+  if (c_avl_remove(data_sets, name, NULL, (void *)&ds) != 0)
+    return -1;
+
+  data_set_index_retire();
+  data_sets_retired[data_sets_retired_num] = ds;
+  data_sets_retired_num++;
+
+  return 0;
+} /* int plugin_unregister_data_set_locked */
+
+static int plugin_register_data_set_locked(const data_set_t *ds) {
   data_set_t *ds_copy;
 
   if ((data_sets != NULL) && (c_avl_get(data_sets, ds->type, NULL) == 0)) {
     NOTICE("Replacing DS `%s' with another version.", ds->type);
-    plugin_unregister_data_set(ds->type);
+    plugin_unregister_data_set_locked(ds->type);
   } else if (data_sets == NULL) {
     data_sets = c_avl_create((int (*)(const void *, const void *))strcmp);
     if (data_sets == NULL)
@@ -1345,8 +5061,24 @@ int plugin_register_data_set(const data_set_t *ds) {
     memcpy(ds_copy->ds + i, ds->ds + i, sizeof(data_source_t));
 
   return c_avl_insert(data_sets, (void *)ds_copy->type, (void *)ds_copy);
+} /* int plugin_register_data_set_locked */
+
+int plugin_register_data_set(const data_set_t *ds) {
+  return plugin_register_data_sets(ds, 1);
 } /* int plugin_register_data_set */
 
+int plugin_register_data_sets(const data_set_t *ds, size_t ds_num) {
+  int status = 0;
+
+  pthread_mutex_lock(&data_set_lock);
+  data_set_index_retire();
+  for (size_t i = 0; (i < ds_num) && (status == 0); i++)
+    status = plugin_register_data_set_locked(ds + i);
+  pthread_mutex_unlock(&data_set_lock);
+
+  return status;
+} /* int plugin_register_data_sets */
+
 int plugin_register_log(const char *name, plugin_log_cb callback,
                         user_data_t const *ud) {
   return create_register_callback(&list_log, name, (void *)callback, ud);
@@ -1370,7 +5102,7 @@ int plugin_unregister_complex_config(const char *name) {
 } /* int plugin_unregister_complex_config */
 
 int plugin_unregister_init(const char *name) {
-  return plugin_unregister(list_init, name);
+  return plugin_unregister(&list_init, name);
 }
 
 int plugin_unregister_read(const char *name) /* {{{ */
@@ -1399,7 +5131,7 @@ int plugin_unregister_read(const char *name) /* {{{ */
 
   rf = le->value;
   assert(rf != NULL);
-  rf->rf_type = RF_REMOVE;
+  C_ATOMIC_STORE(&rf->rf_type, RF_REMOVE);
 
   pthread_mutex_unlock(&read_lock);
 
@@ -1412,6 +5144,8 @@ int plugin_unregister_read(const char *name) /* {{{ */
 
 void plugin_log_available_writers(void) {
   log_list_callbacks(&list_write, "Available write targets:");
+  if (list_write_batch != NULL)
+    log_list_callbacks(&list_write_batch, "Available batch write targets:");
 }
 
 static int compare_read_func_group(llentry_t *e, void *ud) /* {{{ */
@@ -1422,21 +5156,19 @@ static int compare_read_func_group(llentry_t *e, void *ud) /* {{{ */
   return strcmp(rf->rf_group, (const char *)group);
 } /* }}} int compare_read_func_group */
 
-int plugin_unregister_read_group(const char *group) /* {{{ */
+/* Returns the number of read functions marked for removal. */
+static int unregister_read_group(const char *group) /* {{{ */
 {
   llentry_t *le;
   read_func_t *rf;
 
   int found = 0;
 
-  if (group == NULL)
-    return -ENOENT;
-
   pthread_mutex_lock(&read_lock);
 
   if (read_list == NULL) {
     pthread_mutex_unlock(&read_lock);
-    return -ENOENT;
+    return 0;
   }
 
   while (42) {
@@ -1451,7 +5183,7 @@ int plugin_unregister_read_group(const char *group) /* {{{ */
 
     rf = le->value;
     assert(rf != NULL);
-    rf->rf_type = RF_REMOVE;
+    C_ATOMIC_STORE(&rf->rf_type, RF_REMOVE);
 
     llentry_destroy(le);
 
@@ -1462,7 +5194,15 @@ int plugin_unregister_read_group(const char *group) /* {{{ */
 
   pthread_mutex_unlock(&read_lock);
 
-  if (found == 0) {
+  return found;
+} /* }}} int unregister_read_group */
+
+int plugin_unregister_read_group(const char *group) /* {{{ */
+{
+  if (group == NULL)
+    return -ENOENT;
+
+  if (unregister_read_group(group) == 0) {
     WARNING("plugin_unregister_read_group: No such "
             "group of read function: %s",
             group);
@@ -1473,75 +5213,307 @@ int plugin_unregister_read_group(const char *group) /* {{{ */
 } /* }}} int plugin_unregister_read_group */
 
 int plugin_unregister_write(const char *name) {
-  return plugin_unregister(list_write, name);
+  if (plugin_unregister(&list_write, name) == 0)
+    return 0;
+  return plugin_unregister(&list_write_batch, name);
 }
 
 int plugin_unregister_flush(const char *name) {
   plugin_ctx_t ctx = plugin_get_ctx();
 
-  if (ctx.flush_interval != 0) {
-    char *flush_name;
-
-    flush_name = plugin_flush_callback_name(name);
-    if (flush_name != NULL) {
-      plugin_unregister_read(flush_name);
-      sfree(flush_name);
-    }
-  }
+  if (ctx.flush_interval != 0)
+    flush_entry_remove(name);
 
-  return plugin_unregister(list_flush, name);
+  return plugin_unregister(&list_flush, name);
 }
 
 int plugin_unregister_missing(const char *name) {
-  return plugin_unregister(list_missing, name);
+  return plugin_unregister(&list_missing, name);
 }
 
 int plugin_unregister_shutdown(const char *name) {
-  return plugin_unregister(list_shutdown, name);
+  return plugin_unregister(&list_shutdown, name);
 }
 
-int plugin_unregister_data_set(const char *name) {
-  data_set_t *ds;
-
-  if (data_sets == NULL)
-    return -1;
-
-  if (c_avl_remove(data_sets, name, NULL, (void *)&ds) != 0)
-    return -1;
+int plugin_unregister_reconfigure(const char *name) {
+  return plugin_unregister(&list_reconfigure, name);
+}
 
-  sfree(ds->ds);
-  sfree(ds);
+int plugin_unregister_data_set(const char *name) {
+  pthread_mutex_lock(&data_set_lock);
+  int status = plugin_unregister_data_set_locked(name);
+  pthread_mutex_unlock(&data_set_lock);
 
-  return 0;
+  return status;
 } /* int plugin_unregister_data_set */
 
 int plugin_unregister_log(const char *name) {
-  return plugin_unregister(list_log, name);
+  return plugin_unregister(&list_log, name);
 }
 
 int plugin_unregister_notification(const char *name) {
-  return plugin_unregister(list_notification, name);
+  return plugin_unregister(&list_notification, name);
 }
 
-int plugin_init_all(void) {
-  char const *chain_name;
+int plugin_init_after(char const *plugin, char const *after) {
+  if ((plugin == NULL) || (after == NULL))
+    return EINVAL;
+
+  init_dependency_t *tmp =
+      realloc(init_deps, (init_deps_num + 1) * sizeof(*init_deps));
+  if (tmp == NULL)
+    return ENOMEM;
+  init_deps = tmp;
+
+  init_dependency_t *d = init_deps + init_deps_num;
+  d->plugin = strdup(plugin);
+  d->after = strdup(after);
+  if ((d->plugin == NULL) || (d->after == NULL)) {
+    sfree(d->plugin);
+    sfree(d->after);
+    return ENOMEM;
+  }
+  init_deps_num++;
+
+  return 0;
+} /* int plugin_init_after */
+
+static void init_deps_free(void) {
+  for (size_t i = 0; i < init_deps_num; i++) {
+    sfree(init_deps[i].plugin);
+    sfree(init_deps[i].after);
+  }
+  sfree(init_deps);
+  init_deps_num = 0;
+} /* void init_deps_free */
+
+/* An init callback and the init callbacks it has to wait for. */
+struct init_task_s {
   llentry_t *le;
+  size_t *deps; /* indices into init_state_t.tasks */
+  size_t deps_num;
+  bool started;
+  bool done;
+  int status;
+};
+typedef struct init_task_s init_task_t;
+
+struct init_state_s {
+  init_task_t *tasks;
+  size_t tasks_num;
+  size_t running;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+typedef struct init_state_s init_state_t;
+
+static int init_state_create(init_state_t *st) {
+  *st = (init_state_t){.tasks_num = (size_t)llist_size(list_init)};
+  if (st->tasks_num == 0)
+    return 0;
+
+  st->tasks = calloc(st->tasks_num, sizeof(*st->tasks));
+  if (st->tasks == NULL)
+    return ENOMEM;
+  pthread_mutex_init(&st->lock, /* attr = */ NULL);
+  pthread_cond_init(&st->cond, /* attr = */ NULL);
+
+  size_t n = 0;
+  for (llentry_t *le = llist_head(list_init); le != NULL; le = le->next)
+    st->tasks[n++].le = le;
+
+  for (size_t i = 0; i < init_deps_num; i++) {
+    init_dependency_t *d = init_deps + i;
+    init_task_t *task = NULL;
+    size_t after = st->tasks_num;
+
+    for (size_t j = 0; j < st->tasks_num; j++) {
+      if (strcasecmp(d->plugin, st->tasks[j].le->key) == 0)
+        task = st->tasks + j;
+      if (strcasecmp(d->after, st->tasks[j].le->key) == 0)
+        after = j;
+    }
+
+    /* Plugins without init callbacks don't need to wait or be waited for. */
+    if ((task == NULL) || (after == st->tasks_num)) {
+      DEBUG("plugin_init_all: Ignoring the dependency of `%s' on `%s'.",
+            d->plugin, d->after);
+      continue;
+    }
+
+    size_t *tmp =
+        realloc(task->deps, (task->deps_num + 1) * sizeof(*task->deps));
+    if (tmp == NULL)
+      return ENOMEM;
+    task->deps = tmp;
+    task->deps[task->deps_num++] = after;
+  }
+
+  return 0;
+} /* int init_state_create */
+
+static void init_state_destroy(init_state_t *st) {
+  if (st->tasks == NULL)
+    return;
+
+  for (size_t i = 0; i < st->tasks_num; i++)
+    sfree(st->tasks[i].deps);
+  sfree(st->tasks);
+  pthread_cond_destroy(&st->cond);
+  pthread_mutex_destroy(&st->lock);
+} /* void init_state_destroy */
+
+static bool init_task_ready(init_state_t const *st, init_task_t const *task) {
+  for (size_t i = 0; i < task->deps_num; i++)
+    if (!st->tasks[task->deps[i]].done)
+      return false;
+  return true;
+} /* bool init_task_ready */
+
+/* Returns the next init callback whose dependencies have all returned,
+ * blocking while none is ready. Returns NULL once all have been started. */
+static init_task_t *init_task_next(init_state_t *st) {
+  init_task_t *task = NULL;
+
+  pthread_mutex_lock(&st->lock);
+  while (task == NULL) {
+    init_task_t *first = NULL;
+
+    for (size_t i = 0; i < st->tasks_num; i++) {
+      init_task_t *t = st->tasks + i;
+      if (t->started)
+        continue;
+      if (first == NULL)
+        first = t;
+      if (init_task_ready(st, t)) {
+        task = t;
+        break;
+      }
+    }
+
+    if (first == NULL)
+      break;
+
+    if ((task == NULL) && (st->running == 0)) {
+      /* Nothing is running which could satisfy the dependencies. */
+      WARNING("plugin_init_all: The \"InitAfter\" dependencies of `%s' "
+              "form a cycle, ignoring them.",
+              first->le->key);
+      task = first;
+    }
+
+    if (task == NULL)
+      pthread_cond_wait(&st->cond, &st->lock);
+  }
+
+  if (task != NULL) {
+    task->started = true;
+    st->running++;
+  }
+  pthread_mutex_unlock(&st->lock);
+
+  return task;
+} /* init_task_t *init_task_next */
+
+static void *init_thread(void *arg) {
+  init_state_t *st = arg;
+  init_task_t *task;
+
+  while ((task = init_task_next(st)) != NULL) {
+    callback_func_t *cf = task->le->value;
+    plugin_init_cb callback = cf->cf_callback;
+
+    plugin_ctx_t old_ctx = plugin_set_ctx(cf->cf_ctx);
+    cdtime_t start = cdtime();
+    int status = (*callback)();
+    startup_timing_add("init callback of", task->le->key, cdtime() - start);
+    plugin_set_ctx(old_ctx);
+
+    pthread_mutex_lock(&st->lock);
+    task->status = status;
+    task->done = true;
+    st->running--;
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->lock);
+  }
+
+  return NULL;
+} /* void *init_thread */
+
+/* Calls all init callbacks, using up to `threads_num' threads, and waits for
+ * all of them to return. */
+static int init_run(init_state_t *st, size_t threads_num) {
+  if (threads_num > st->tasks_num)
+    threads_num = st->tasks_num;
+
+  pthread_t *threads = NULL;
+  size_t started = 0;
+  if (threads_num > 1) {
+    threads = calloc(threads_num - 1, sizeof(*threads));
+    if (threads == NULL)
+      return ENOMEM;
+  }
+
+  /* The calling thread is one of the init threads. */
+  for (size_t i = 0; i + 1 < threads_num; i++) {
+    int status = pthread_create(threads + started, /* attr = */ NULL,
+                                init_thread, st);
+    if (status != 0) {
+      ERROR("plugin_init_all: pthread_create failed: %s", STRERROR(status));
+      break;
+    }
+
+    char name[THREAD_NAME_MAX];
+    snprintf(name, sizeof(name), "init#%u", (unsigned)started);
+    set_thread_name(threads[started], name);
+    started++;
+  }
+
+  init_thread(st);
+
+  for (size_t i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  sfree(threads);
+
+  return 0;
+} /* int init_run */
+
+/* Dispatch threads may still use the previous chains, which is fine: the
+ * filter chain code never frees chains that have been replaced. */
+static void plugin_set_chains(void) {
+  char const *chain_name;
+
+  chain_name = global_option_get("PreCacheChain");
+  C_ATOMIC_STORE_REL(&pre_cache_chain, fc_chain_get_by_name(chain_name));
+
+  chain_name = global_option_get("PostCacheChain");
+  C_ATOMIC_STORE_REL(&post_cache_chain, fc_chain_get_by_name(chain_name));
+} /* void plugin_set_chains */
+
+int plugin_init_all(void) {
   int status;
   int ret = 0;
 
   /* Init the value cache */
   uc_init();
 
+  coarse_timestamps = IS_TRUE(global_option_get("CoarseTimestamps"));
+
   if (IS_TRUE(global_option_get("CollectInternalStats"))) {
     record_statistics = true;
+    /* The internal statistics go through the critical write lane. */
+    plugin_ctx_t ctx = plugin_get_ctx();
+    ctx.priority = PLUGIN_PRIORITY_CRITICAL;
+    plugin_ctx_t old_ctx = plugin_set_ctx(ctx);
     plugin_register_read("collectd", plugin_update_internal_statistics);
+    plugin_set_ctx(old_ctx);
   }
 
-  chain_name = global_option_get("PreCacheChain");
-  pre_cache_chain = fc_chain_get_by_name(chain_name);
+  plugin_set_chains();
 
-  chain_name = global_option_get("PostCacheChain");
-  post_cache_chain = fc_chain_get_by_name(chain_name);
+  /* All chains are known now, so jump targets can be resolved. */
+  if (fc_compile() != 0)
+    ERROR("plugin_init_all: Compiling the filter chains failed.");
 
   write_limit_high = global_option_get_long("WriteQueueLimitHigh",
                                             /* default = */ 0);
@@ -1562,6 +5534,19 @@ int plugin_init_all(void) {
     write_limit_low = write_limit_high;
   }
 
+  load_shedding = IS_TRUE(global_option_get("LoadShedding"));
+  if (load_shedding && (write_limit_high == 0)) {
+    ERROR("LoadShedding requires WriteQueueLimitHigh to be set.");
+    load_shedding = false;
+  }
+
+  write_batch_size = global_option_get_long("WriteBatchSize",
+                                            /* default = */ 64);
+  if (write_batch_size < 1) {
+    ERROR("WriteBatchSize must be positive.");
+    write_batch_size = 64;
+  }
+
   write_threads_num = global_option_get_long("WriteThreads",
                                              /* default = */ 5);
   if (write_threads_num < 1) {
@@ -1569,45 +5554,104 @@ int plugin_init_all(void) {
     write_threads_num = 5;
   }
 
+  const char *stats_listen = global_option_get("InternalStatsListen");
+  if ((stats_listen != NULL) && (stats_listen[0] != 0) &&
+      (stats_http_start(stats_listen) != 0))
+    ERROR("plugin_init_all: Starting the internal statistics endpoint "
+          "failed.");
+
   if ((list_init == NULL) && (read_heap == NULL))
     return ret;
 
+  long init_threads_num = global_option_get_long("InitThreads",
+                                                 /* default = */ 1);
+  if (init_threads_num < 1) {
+    ERROR("InitThreads must be positive.");
+    init_threads_num = 1;
+  }
+
   /* Calling all init callbacks before checking if read callbacks
    * are available allows the init callbacks to register the read
    * callback. */
-  le = llist_head(list_init);
-  while (le != NULL) {
-    callback_func_t *cf;
-    plugin_init_cb callback;
-    plugin_ctx_t old_ctx;
+  init_state_t st;
+  cdtime_t init_start = cdtime();
+  status = init_state_create(&st);
+  if (status == 0)
+    status = init_run(&st, (size_t)init_threads_num);
+  if (status != 0) {
+    ERROR("plugin_init_all: Running the init callbacks failed: %s",
+          STRERROR(status));
+    init_state_destroy(&st);
+    return -1;
+  }
 
-    cf = le->value;
-    old_ctx = plugin_set_ctx(cf->cf_ctx);
-    callback = cf->cf_callback;
-    status = (*callback)();
-    plugin_set_ctx(old_ctx);
+  for (size_t i = 0; i < st.tasks_num; i++) {
+    init_task_t *task = st.tasks + i;
 
-    if (status != 0) {
+    if (task->status != 0) {
       ERROR("Initialization of plugin `%s' "
             "failed with status %i. "
             "Plugin will be unloaded.",
-            le->key, status);
+            task->le->key, task->status);
       /* Plugins that register read callbacks from the init
        * callback should take care of appropriate error
        * handling themselves. */
       /* FIXME: Unload _all_ functions */
-      plugin_unregister_read(le->key);
+      plugin_unregister_read(task->le->key);
       ret = -1;
     }
-
-    le = le->next;
   }
 
+  INFO("plugin_init_all: Calling %" PRIsz " init callbacks using %ld "
+       "thread(s) took %.3f seconds.",
+       st.tasks_num, init_threads_num,
+       CDTIME_T_TO_DOUBLE(cdtime() - init_start));
+  init_state_destroy(&st);
+  init_deps_free();
+  startup_timing_report();
+
+  /* Init callbacks may have registered additional data sets. */
+  plugin_build_data_set_index();
+
+  thread_cpus_configure("ReadThreadsCPUs", &read_threads_cpus);
+  thread_cpus_configure("WriteThreadsCPUs", &write_threads_cpus);
+
   start_write_threads((size_t)write_threads_num);
+  start_flush_thread();
+
+  log_rate_limit = global_option_get_long("LogRateLimit", /* default = */ 0);
+  if (log_rate_limit < 0) {
+    ERROR("LogRateLimit must not be negative.");
+    log_rate_limit = 0;
+  }
+
+  long notification_threads_opt =
+      global_option_get_long("NotificationThreads", /* default = */ 0);
+  if (notification_threads_opt < 0) {
+    ERROR("NotificationThreads must not be negative.");
+    notification_threads_opt = 0;
+  }
+  notification_queue_limit =
+      global_option_get_long("NotificationQueueLimit", /* default = */ 1000);
+  notification_coalesce_window = global_option_get_time(
+      "NotificationCoalesceWindow", /* default = */ 0);
+  start_notification_threads((size_t)notification_threads_opt);
 
   max_read_interval =
       global_option_get_time("MaxReadInterval", DEFAULT_MAX_READ_INTERVAL);
 
+  const char *phase_mode = global_option_get("ReadPhaseMode");
+  if (phase_mode == NULL)
+    read_phase_mode = READ_PHASE_NONE;
+  else if (strcasecmp("Spread", phase_mode) == 0)
+    read_phase_mode = READ_PHASE_SPREAD;
+  else if (strcasecmp("Aligned", phase_mode) == 0)
+    read_phase_mode = READ_PHASE_ALIGNED;
+  else
+    WARNING("plugin_init_all: Invalid ReadPhaseMode \"%s\". Valid values "
+            "are \"Spread\" and \"Aligned\".",
+            phase_mode);
+
   /* Start read-threads */
   if (read_heap != NULL) {
     const char *rt;
@@ -1621,9 +5665,52 @@ int plugin_init_all(void) {
   return ret;
 } /* void plugin_init_all */
 
+int plugin_reconfigure(const char *name) {
+  llentry_t *le = NULL;
+
+  pthread_mutex_lock(&register_lock);
+  if (list_reconfigure != NULL)
+    le = llist_search(list_reconfigure, name);
+  callback_func_t *cf = (le != NULL) ? le->value : NULL;
+  pthread_mutex_unlock(&register_lock);
+
+  if (cf == NULL)
+    return ENOTSUP;
+
+  /* Running read callbacks finish before their user data is freed. */
+  unregister_read_group(name);
+
+  plugin_reconfigure_cb callback = cf->cf_callback;
+  plugin_ctx_t old_ctx = plugin_set_ctx(cf->cf_ctx);
+  int status = (*callback)();
+  plugin_set_ctx(old_ctx);
+
+  return status;
+} /* int plugin_reconfigure */
+
+int plugin_reconfigure_chains(const oconfig_item_t *root) {
+  int status = fc_reconfigure(root);
+  if (status != 0)
+    return status;
+
+  plugin_set_chains();
+  return 0;
+} /* int plugin_reconfigure_chains */
+
+void plugin_request_reload(void) { reload_requested = 1; }
+
+bool plugin_reload_pending(void) {
+  if (reload_requested == 0)
+    return false;
+
+  reload_requested = 0;
+  return true;
+} /* bool plugin_reload_pending */
+
 /* TODO: Rename this function. */
 void plugin_read_all(void) {
   uc_check_timeout();
+  uc_shm_publish();
 
   return;
 } /* void plugin_read_all */
@@ -1674,15 +5761,220 @@ int plugin_read_all_once(void) {
   return return_status;
 } /* int plugin_read_all_once */
 
-int plugin_write(const char *plugin, /* {{{ */
-                 const data_set_t *ds, const value_list_t *vl) {
-  llentry_t *le;
-  int status;
+struct read_bench_s {
+  read_func_t *rf;
+  latency_counter_t *latency;
+  uint64_t calls;
+  uint64_t failed;
+  uint64_t values;
+};
+typedef struct read_bench_s read_bench_t;
 
-  if (vl == NULL)
-    return EINVAL;
+struct memstat_snapshot_s {
+  char **names;
+  int64_t *bytes;
+  int64_t *objects;
+  size_t num;
+};
+typedef struct memstat_snapshot_s memstat_snapshot_t;
+
+static int memstat_snapshot_add(char const *name, int64_t bytes, /* {{{ */
+                                int64_t objects, void *user_data) {
+  memstat_snapshot_t *s = user_data;
+
+  char **names = realloc(s->names, (s->num + 1) * sizeof(*names));
+  if (names != NULL)
+    s->names = names;
+  int64_t *b = realloc(s->bytes, (s->num + 1) * sizeof(*b));
+  if (b != NULL)
+    s->bytes = b;
+  int64_t *o = realloc(s->objects, (s->num + 1) * sizeof(*o));
+  if (o != NULL)
+    s->objects = o;
+  if ((names == NULL) || (b == NULL) || (o == NULL))
+    return ENOMEM;
+
+  s->names[s->num] = strdup(name);
+  if (s->names[s->num] == NULL)
+    return ENOMEM;
+  s->bytes[s->num] = bytes;
+  s->objects[s->num] = objects;
+  s->num++;
+  return 0;
+} /* }}} int memstat_snapshot_add */
+
+static int memstat_snapshot_print(char const *name, int64_t bytes, /* {{{ */
+                                  int64_t objects, void *user_data) {
+  memstat_snapshot_t *before = user_data;
+
+  for (size_t i = 0; i < before->num; i++) {
+    if (strcmp(before->names[i], name) != 0)
+      continue;
+    bytes -= before->bytes[i];
+    objects -= before->objects[i];
+    break;
+  }
+
+  if ((bytes != 0) || (objects != 0))
+    printf("  %-32s %+14" PRIi64 " %+12" PRIi64 "\n", name, bytes, objects);
+  return 0;
+} /* }}} int memstat_snapshot_print */
+
+static void memstat_snapshot_free(memstat_snapshot_t *s) /* {{{ */
+{
+  for (size_t i = 0; i < s->num; i++)
+    sfree(s->names[i]);
+  sfree(s->names);
+  sfree(s->bytes);
+  sfree(s->objects);
+} /* }}} void memstat_snapshot_free */
+
+static int read_bench_compare(void const *a, void const *b) /* {{{ */
+{
+  return strcmp(((read_bench_t const *)a)->rf->rf_name,
+                ((read_bench_t const *)b)->rf->rf_name);
+} /* }}} int read_bench_compare */
+
+/* Read function called when the `-b' command line argument is given. Calls
+ * the read callbacks back-to-back for `duration', hands the values to the
+ * filter chain and the write threads as usual and prints for each callback
+ * the number of calls, the values dispatched per second and the latency
+ * distribution. The values dispatched by other threads while a callback runs
+ * are counted for that callback. */
+int plugin_read_all_bench(cdtime_t duration) /* {{{ */
+{
+  read_bench_t *benches = NULL;
+  size_t benches_num = 0;
+  int return_status = 0;
+
+  if (read_heap == NULL) {
+    NOTICE("No read-functions are registered.");
+    return 0;
+  }
+
+  read_func_t *rf;
+  while ((rf = c_heap_get_root(read_heap)) != NULL) {
+    read_bench_t *tmp = realloc(benches, (benches_num + 1) * sizeof(*tmp));
+    if (tmp == NULL) {
+      ERROR("plugin_read_all_bench: realloc failed.");
+      c_heap_insert(read_heap, rf);
+      return_status = ENOMEM;
+      goto out;
+    }
+    benches = tmp;
+    benches[benches_num] = (read_bench_t){
+        .rf = rf, .latency = latency_counter_create_sketch(0.01),
+    };
+    benches_num++;
+  }
+  qsort(benches, benches_num, sizeof(*benches), read_bench_compare);
+
+  memstat_snapshot_t memstats = {0};
+  memstat_foreach(memstat_snapshot_add, &memstats);
+
+  C_ATOMIC_STORE(&bench_running, true);
+  cdtime_t start = cdtime();
+  cdtime_t end = start + duration;
+  cdtime_t now = start;
+
+  while (now < end) {
+    for (size_t i = 0; i < benches_num; i++) {
+      read_bench_t *b = benches + i;
+      if ((C_ATOMIC_LOAD(&b->rf->rf_type) == RF_REMOVE) ||
+          (b->latency == NULL))
+        continue;
+
+      uint64_t values = C_ATOMIC_LOAD(&bench_values);
+      plugin_ctx_t old_ctx = plugin_set_ctx(b->rf->rf_ctx);
+      cdtime_t call_start = cdtime();
+
+      int status;
+      if (b->rf->rf_type == RF_SIMPLE) {
+        int (*callback)(void) = b->rf->rf_callback;
+        status = (*callback)();
+      } else {
+        plugin_read_cb callback = b->rf->rf_callback;
+        status = (*callback)(&b->rf->rf_udata);
+      }
+
+      now = cdtime();
+      plugin_set_ctx(old_ctx);
+
+      latency_counter_add(b->latency, now - call_start);
+      b->values += C_ATOMIC_LOAD(&bench_values) - values;
+      b->calls++;
+      if (status != 0)
+        b->failed++;
+    }
 
-  if (list_write == NULL)
+    /* Without any callback left, stop rather than spin. */
+    if (now == start)
+      break;
+  }
+  C_ATOMIC_STORE(&bench_running, false);
+
+  cdtime_t elapsed = now - start;
+  double seconds = CDTIME_T_TO_DOUBLE(elapsed);
+  uint64_t values_total = 0;
+
+  printf("Benchmark of %" PRIsz " read callbacks over %.3f seconds:\n\n",
+         benches_num, seconds);
+  printf("  %-32s %8s %6s %12s %9s %9s %9s %9s\n", "callback", "calls",
+         "failed", "values/s", "avg [us]", "p50 [us]", "p99 [us]", "max [us]");
+  for (size_t i = 0; i < benches_num; i++) {
+    read_bench_t *b = benches + i;
+    if (b->calls == 0)
+      continue;
+
+    values_total += b->values;
+    printf("  %-32s %8" PRIu64 " %6" PRIu64 " %12.1f %9.1f %9.1f %9.1f "
+           "%9.1f\n",
+           b->rf->rf_name, b->calls, b->failed,
+           (seconds > 0) ? (double)b->values / seconds : 0.0,
+           1e6 * CDTIME_T_TO_DOUBLE(latency_counter_get_average(b->latency)),
+           1e6 * CDTIME_T_TO_DOUBLE(
+                     latency_counter_get_percentile(b->latency, 50.0)),
+           1e6 * CDTIME_T_TO_DOUBLE(
+                     latency_counter_get_percentile(b->latency, 99.0)),
+           1e6 * CDTIME_T_TO_DOUBLE(latency_counter_get_max(b->latency)));
+    if (b->failed != 0)
+      return_status = -1;
+  }
+  printf("\n  %" PRIu64 " value lists, %.1f per second.\n", values_total,
+         (seconds > 0) ? (double)values_total / seconds : 0.0);
+
+  /* The write threads may still be busy with the last values. */
+  cdtime_t drain_start = cdtime();
+  while ((C_ATOMIC_LOAD(&write_queue_length) > 0) &&
+         ((cdtime() - drain_start) < duration))
+    nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+  printf("  Write queue drained after %.3f seconds, %ld value lists left.\n",
+         CDTIME_T_TO_DOUBLE(cdtime() - drain_start),
+         C_ATOMIC_LOAD(&write_queue_length));
+
+  printf("\nMemory accounting changes (bytes, objects):\n");
+  memstat_foreach(memstat_snapshot_print, &memstats);
+  memstat_snapshot_free(&memstats);
+  fflush(stdout);
+
+out:
+  for (size_t i = 0; i < benches_num; i++) {
+    c_heap_insert(read_heap, benches[i].rf);
+    latency_counter_destroy(benches[i].latency);
+  }
+  sfree(benches);
+
+  return return_status;
+} /* }}} int plugin_read_all_bench */
+
+static int plugin_write_section(const char *plugin, /* {{{ */
+                                const data_set_t *ds, const value_list_t *vl) {
+  int status;
+
+  callback_array_t const *writers = C_ATOMIC_LOAD_ACQ(&array_write);
+  callback_array_t const *batch_writers =
+      C_ATOMIC_LOAD_ACQ(&array_write_batch);
+  if ((writers == NULL) && (batch_writers == NULL))
     return ENOENT;
 
   if (ds == NULL) {
@@ -1697,9 +5989,9 @@ int plugin_write(const char *plugin, /* {{{ */
     int success = 0;
     int failure = 0;
 
-    le = llist_head(list_write);
-    while (le != NULL) {
-      callback_func_t *cf = le->value;
+    for (size_t i = 0; (writers != NULL) && (i < writers->num); i++) {
+      callback_entry_t const *e = writers->entries + i;
+      callback_func_t *cf = e->cf;
       plugin_write_cb callback;
 
       /* Keep the read plugin's interval and flush information but update the
@@ -1709,16 +6001,38 @@ int plugin_write(const char *plugin, /* {{{ */
       ctx.name = cf->cf_ctx.name;
       plugin_set_ctx(ctx);
 
-      DEBUG("plugin: plugin_write: Writing values via %s.", le->key);
-      callback = cf->cf_callback;
-      status = (*callback)(ds, vl, &cf->cf_udata);
+      DEBUG("plugin: plugin_write: Writing values via %s.", e->name);
+      if (cf->cf_queue != NULL) {
+        status = writer_queue_enqueue(cf->cf_queue, ds, vl);
+      } else {
+        callback = cf->cf_callback;
+        cdtime_t start = plugin_latency_start();
+        C_PROBE2(write__start, e->name, 1);
+        status = (*callback)(ds, vl, &cf->cf_udata);
+        C_PROBE2(write__done, e->name, status);
+        plugin_latency_stop(cf->cf_latency, start);
+        if (status == 0)
+          plugin_flush_mark(cf, 1);
+      }
       if (status != 0)
         failure++;
       else
         success++;
 
       plugin_set_ctx(old_ctx);
-      le = le->next;
+    }
+
+    for (size_t i = 0; (batch_writers != NULL) && (i < batch_writers->num);
+         i++) {
+      callback_entry_t const *e = batch_writers->entries + i;
+
+      DEBUG("plugin: plugin_write: Writing values via batch writer %s.",
+            e->name);
+      status = plugin_write_batch_one(e->name, e->cf, ds, vl);
+      if (status != 0)
+        failure++;
+      else
+        success++;
     }
 
     if ((success == 0) && (failure != 0))
@@ -1730,57 +6044,77 @@ int plugin_write(const char *plugin, /* {{{ */
     callback_func_t *cf;
     plugin_write_cb callback;
 
-    le = llist_head(list_write);
-    while (le != NULL) {
-      if (strcasecmp(plugin, le->key) == 0)
-        break;
+    callback_entry_t const *e = callback_array_find(writers, plugin);
+    if (e == NULL) {
+      e = callback_array_find(batch_writers, plugin);
+      if (e == NULL)
+        return ENOENT;
 
-      le = le->next;
+      DEBUG("plugin: plugin_write: Writing values via batch writer %s.",
+            e->name);
+      return plugin_write_batch_one(e->name, e->cf, ds, vl);
     }
 
-    if (le == NULL)
-      return ENOENT;
-
-    cf = le->value;
+    cf = e->cf;
 
     /* do not switch plugin context; rather keep the context (interval)
      * information of the calling read plugin */
 
-    DEBUG("plugin: plugin_write: Writing values via %s.", le->key);
+    DEBUG("plugin: plugin_write: Writing values via %s.", e->name);
+    if (cf->cf_queue != NULL)
+      return writer_queue_enqueue(cf->cf_queue, ds, vl);
+
     callback = cf->cf_callback;
+    cdtime_t start = plugin_latency_start();
+    C_PROBE2(write__start, e->name, 1);
     status = (*callback)(ds, vl, &cf->cf_udata);
+    C_PROBE2(write__done, e->name, status);
+    plugin_latency_stop(cf->cf_latency, start);
+    if (status == 0)
+      plugin_flush_mark(cf, 1);
   }
 
   return status;
-} /* }}} int plugin_write */
+} /* }}} int plugin_write_section */
 
-int plugin_flush(const char *plugin, cdtime_t timeout, const char *identifier) {
-  llentry_t *le;
-
-  if (list_flush == NULL)
-    return 0;
+int plugin_write(const char *plugin, /* {{{ */
+                 const data_set_t *ds, const value_list_t *vl) {
+  if (vl == NULL)
+    return EINVAL;
 
-  le = llist_head(list_flush);
-  while (le != NULL) {
-    callback_func_t *cf;
-    plugin_flush_cb callback;
-    plugin_ctx_t old_ctx;
+  size_t slot = callback_reader_enter();
+  int status = plugin_write_section(plugin, ds, vl);
+  callback_reader_leave(slot);
 
-    if ((plugin != NULL) && (strcmp(plugin, le->key) != 0)) {
-      le = le->next;
-      continue;
-    }
+  return status;
+} /* }}} int plugin_write */
 
-    cf = le->value;
-    old_ctx = plugin_set_ctx(cf->cf_ctx);
-    callback = cf->cf_callback;
+static void plugin_flush_one(callback_func_t *cf, cdtime_t timeout,
+                             const char *identifier) {
+  plugin_flush_cb callback = cf->cf_callback;
+  plugin_ctx_t old_ctx = plugin_set_ctx(cf->cf_ctx);
 
-    (*callback)(timeout, identifier, &cf->cf_udata);
+  cdtime_t start = plugin_latency_start();
+  (*callback)(timeout, identifier, &cf->cf_udata);
+  plugin_latency_stop(cf->cf_latency, start);
 
-    plugin_set_ctx(old_ctx);
+  plugin_set_ctx(old_ctx);
+} /* void plugin_flush_one */
 
-    le = le->next;
+int plugin_flush(const char *plugin, cdtime_t timeout, const char *identifier) {
+  size_t slot = callback_reader_enter();
+  callback_array_t const *flushers = C_ATOMIC_LOAD_ACQ(&array_flush);
+
+  if ((flushers != NULL) && (plugin != NULL)) {
+    callback_entry_t const *e = callback_array_find(flushers, plugin);
+    if ((e != NULL) && (strcmp(plugin, e->name) == 0))
+      plugin_flush_one(e->cf, timeout, identifier);
+  } else if (flushers != NULL) {
+    for (size_t i = 0; i < flushers->num; i++)
+      plugin_flush_one(flushers->entries[i].cf, timeout, identifier);
   }
+
+  callback_reader_leave(slot);
   return 0;
 } /* int plugin_flush */
 
@@ -1790,7 +6124,12 @@ int plugin_shutdown_all(void) {
 
   destroy_all_callbacks(&list_init);
 
+  /* The endpoint reads the state of the read threads. */
+  stats_http_stop();
   stop_read_threads();
+#if PLUGIN_EVENT_LOOP
+  stop_event_loop();
+#endif
 
   pthread_mutex_lock(&read_lock);
   llist_destroy(read_list);
@@ -1801,12 +6140,20 @@ int plugin_shutdown_all(void) {
 
   /* blocks until all write threads have shut down. */
   stop_write_threads();
+  stop_flush_thread();
 
   /* ask all plugins to write out the state they kept. */
   plugin_flush(/* plugin = */ NULL,
                /* timeout = */ 0,
                /* identifier = */ NULL);
 
+  /* blocks until all queued notifications have been delivered. */
+  stop_notification_threads();
+
+  config_cores_cleanup(&read_threads_cpus);
+  config_cores_cleanup(&write_threads_cpus);
+  writer_queues_started = 0;
+
   le = NULL;
   if (list_shutdown != NULL)
     le = llist_head(list_shutdown);
@@ -1832,6 +6179,12 @@ int plugin_shutdown_all(void) {
     plugin_set_ctx(old_ctx);
   }
 
+#if PLUGIN_EVENT_LOOP
+  /* Frees the event sources which haven't been unregistered by the shutdown
+   * callbacks. */
+  destroy_event_loop();
+#endif
+
   /* Write plugins which use the `user_data' pointer usually need the
    * same data available to the flush callback. If this is the case, set
    * the free_function to NULL when registering the flush callback and to
@@ -1840,10 +6193,18 @@ int plugin_shutdown_all(void) {
   destroy_all_callbacks(&list_flush);
   destroy_all_callbacks(&list_missing);
   destroy_all_callbacks(&list_write);
+  destroy_all_callbacks(&list_write_batch);
 
   destroy_all_callbacks(&list_notification);
   destroy_all_callbacks(&list_shutdown);
+  destroy_all_callbacks(&list_reconfigure);
   destroy_all_callbacks(&list_log);
+  callback_array_reclaim();
+  flush_entries_free();
+
+  /* Done last: other threads may still dispatch values while being shut
+   * down above. */
+  write_slab_destroy();
 
   plugin_free_loaded();
   plugin_free_data_sets();
@@ -1879,7 +6240,8 @@ int plugin_dispatch_missing(const value_list_t *vl) /* {{{ */
   return 0;
 } /* int }}} plugin_dispatch_missing */
 
-static int plugin_dispatch_values_internal(value_list_t *vl) {
+static int plugin_dispatch_values_internal(value_list_t *vl,
+                                           const data_set_t *ds) {
   int status;
   static c_complain_t no_write_complaint = C_COMPLAIN_INIT_STATIC;
 
@@ -1887,7 +6249,7 @@ static int plugin_dispatch_values_internal(value_list_t *vl) {
 
   assert(vl != NULL);
 
-  /* These fields are initialized by plugin_value_list_clone() if needed: */
+  /* These fields are initialized by plugin_value_list_copy() if needed: */
   assert(vl->host[0] != 0);
   assert(vl->time != 0); /* The time is determined at _enqueue_ time. */
   assert(vl->interval != 0);
@@ -1905,21 +6267,22 @@ static int plugin_dispatch_values_internal(value_list_t *vl) {
   if (vl->meta == NULL)
     free_meta_data = true;
 
-  if (list_write == NULL)
+  if ((C_ATOMIC_LOAD_ACQ(&array_write) == NULL) &&
+      (C_ATOMIC_LOAD_ACQ(&array_write_batch) == NULL))
     c_complain_once(LOG_WARNING, &no_write_complaint,
                     "plugin_dispatch_values: No write callback has been "
                     "registered. Please load at least one output plugin, "
                     "if you want the collected data to be stored.");
 
-  if (data_sets == NULL) {
+  if (ds == NULL)
+    ds = plugin_lookup_ds(vl->type);
+
+  if ((ds == NULL) && (data_sets == NULL)) {
     ERROR("plugin_dispatch_values: No data sets registered. "
           "Could the types database be read? Check "
           "your `TypesDB' setting!");
     return -1;
-  }
-
-  data_set_t *ds = NULL;
-  if (c_avl_get(data_sets, vl->type, (void *)&ds) != 0) {
+  } else if (ds == NULL) {
     char ident[6 * DATA_MAX_NAME_LEN];
 
     FORMAT_VL(ident, sizeof(ident), vl);
@@ -1936,12 +6299,10 @@ static int plugin_dispatch_values_internal(value_list_t *vl) {
         CDTIME_T_TO_DOUBLE(vl->time), CDTIME_T_TO_DOUBLE(vl->interval),
         vl->host, vl->plugin, vl->plugin_instance, vl->type, vl->type_instance);
 
+  /* The data set has either been looked up by type or checked in
+   * plugin_dispatch_values_ds(). */
 #if COLLECT_DEBUG
   assert(0 == strcmp(ds->type, vl->type));
-#else
-  if (0 != strcmp(ds->type, vl->type))
-    WARNING("plugin_dispatch_values: (ds->type = %s) != (vl->type = %s)",
-            ds->type, vl->type);
 #endif
 
 #if COLLECT_DEBUG
@@ -1956,14 +6317,33 @@ static int plugin_dispatch_values_internal(value_list_t *vl) {
   }
 #endif
 
-  escape_slashes(vl->host, sizeof(vl->host));
-  escape_slashes(vl->plugin, sizeof(vl->plugin));
-  escape_slashes(vl->plugin_instance, sizeof(vl->plugin_instance));
-  escape_slashes(vl->type, sizeof(vl->type));
-  escape_slashes(vl->type_instance, sizeof(vl->type_instance));
+  /* An identifier set by the producer (see plugin_dispatch_values_reserve())
+   * is kept if escaping would not change the fields: without slashes in the
+   * fields, the name contains exactly two. */
+  size_t slashes = 0;
+  if (vl->identifier.hash != 0)
+    for (char const *c = vl->identifier.name; *c != 0; c++)
+      slashes += (*c == '/');
+
+  if (slashes != 2) {
+    escape_slashes(vl->host, sizeof(vl->host));
+    escape_slashes(vl->plugin, sizeof(vl->plugin));
+    escape_slashes(vl->plugin_instance, sizeof(vl->plugin_instance));
+    escape_slashes(vl->type, sizeof(vl->type));
+    escape_slashes(vl->type_instance, sizeof(vl->type_instance));
+
+    /* Compute the identifier once, so the cache, the filter chain and the
+     * writers can use it without formatting the name again. */
+    if (identifier_update(vl) != 0) {
+      ERROR("plugin_dispatch_values: identifier_update failed "
+            "for a value list from plugin %s.",
+            vl->plugin);
+    }
+  }
 
-  if (pre_cache_chain != NULL) {
-    status = fc_process_chain(ds, vl, pre_cache_chain);
+  fc_chain_t *pre_chain = C_ATOMIC_LOAD_ACQ(&pre_cache_chain);
+  if (pre_chain != NULL) {
+    status = fc_process_chain(ds, vl, pre_chain);
     if (status < 0) {
       WARNING("plugin_dispatch_values: Running the "
               "pre-cache chain failed with "
@@ -1976,8 +6356,9 @@ static int plugin_dispatch_values_internal(value_list_t *vl) {
   /* Update the value cache */
   uc_update(ds, vl);
 
-  if (post_cache_chain != NULL) {
-    status = fc_process_chain(ds, vl, post_cache_chain);
+  fc_chain_t *post_chain = C_ATOMIC_LOAD_ACQ(&post_cache_chain);
+  if (post_chain != NULL) {
+    status = fc_process_chain(ds, vl, post_chain);
     if (status < 0) {
       WARNING("plugin_dispatch_values: Running the "
               "post-cache chain failed with "
@@ -1995,23 +6376,34 @@ static int plugin_dispatch_values_internal(value_list_t *vl) {
   return 0;
 } /* int plugin_dispatch_values_internal */
 
-static double get_drop_probability(void) /* {{{ */
+/* Drop policy of the write lanes: values of low priority plugins are dropped
+ * at half the limits, those of critical plugins only once the queue holds
+ * twice WriteQueueLimitHigh values, so that memory stays bounded. */
+static double get_drop_probability(int priority) /* {{{ */
 {
   long pos;
   long size;
   long wql;
+  long limit_low = write_limit_low;
+  long limit_high = write_limit_high;
+
+  if (priority == PLUGIN_PRIORITY_CRITICAL) {
+    limit_low = 2 * write_limit_high;
+    limit_high = 2 * write_limit_high;
+  } else if (priority == PLUGIN_PRIORITY_LOW) {
+    limit_low /= 2;
+    limit_high /= 2;
+  }
 
-  pthread_mutex_lock(&write_lock);
-  wql = write_queue_length;
-  pthread_mutex_unlock(&write_lock);
+  wql = C_ATOMIC_LOAD(&write_queue_length);
 
-  if (wql < write_limit_low)
+  if (wql < limit_low)
     return 0.0;
-  if (wql >= write_limit_high)
+  if (wql >= limit_high)
     return 1.0;
 
-  pos = 1 + wql - write_limit_low;
-  size = 1 + write_limit_high - write_limit_low;
+  pos = 1 + wql - limit_low;
+  size = 1 + limit_high - limit_low;
 
   return (double)pos / (double)size;
 } /* }}} double get_drop_probability */
@@ -2028,7 +6420,12 @@ static bool check_drop_value(void) /* {{{ */
   if (write_limit_high == 0)
     return false;
 
-  p = get_drop_probability();
+  /* Stretching the read intervals comes first. */
+  if (load_shedding && (C_ATOMIC_LOAD(&shed_level) < SHED_LEVEL_MAX))
+    return false;
+
+  int priority = plugin_get_ctx().priority;
+  p = get_drop_probability(priority);
   if (p == 0.0)
     return false;
 
@@ -2046,30 +6443,25 @@ static bool check_drop_value(void) /* {{{ */
     pthread_mutex_unlock(&last_message_lock);
   }
 
-  if (p == 1.0)
-    return true;
-
   q = cdrand_d();
-  if (q > p)
+  if ((p == 1.0) || (q > p)) {
+    C_ATOMIC_ADD(&write_lane_get(priority)->dropped, 1);
     return true;
-  else
-    return false;
+  }
+  return false;
 } /* }}} bool check_drop_value */
 
-int plugin_dispatch_values(value_list_t const *vl) {
+static int plugin_dispatch_values_enqueue(value_list_t const *vl, /* {{{ */
+                                          const data_set_t *ds) {
   int status;
-  static pthread_mutex_t statistics_lock = PTHREAD_MUTEX_INITIALIZER;
 
   if (check_drop_value()) {
-    if (record_statistics) {
-      pthread_mutex_lock(&statistics_lock);
-      stats_values_dropped++;
-      pthread_mutex_unlock(&statistics_lock);
-    }
+    if (record_statistics)
+      C_ATOMIC_ADD(&stats_values_dropped, 1);
     return 0;
   }
 
-  status = plugin_write_enqueue(vl);
+  status = plugin_write_enqueue(vl, ds);
   if (status != 0) {
     ERROR("plugin_dispatch_values: plugin_write_enqueue failed with status %i "
           "(%s).",
@@ -2078,8 +6470,132 @@ int plugin_dispatch_values(value_list_t const *vl) {
   }
 
   return 0;
+} /* }}} int plugin_dispatch_values_enqueue */
+
+int plugin_dispatch_values(value_list_t const *vl) {
+  return plugin_dispatch_values_enqueue(vl, /* ds = */ NULL);
 }
 
+int plugin_dispatch_values_ds(const data_set_t *ds, /* {{{ */
+                              value_list_t const *vl) {
+  if ((ds != NULL) && (vl->type[0] != 0) && (strcmp(ds->type, vl->type) != 0)) {
+    ERROR("plugin_dispatch_values_ds: Data set \"%s\" does not match "
+          "the value list's type \"%s\".",
+          ds->type, vl->type);
+    return EINVAL;
+  }
+
+  return plugin_dispatch_values_enqueue(vl, ds);
+} /* }}} int plugin_dispatch_values_ds */
+
+static void write_reserved_release(write_reserved_t *r) /* {{{ */
+{
+  if (r->vl.values != r->values)
+    sfree(r->vl.values);
+
+  if ((pthread_getspecific(write_reserved_key) != NULL) ||
+      (pthread_setspecific(write_reserved_key, r) != 0))
+    free(r);
+} /* }}} void write_reserved_release */
+
+value_list_t *plugin_dispatch_values_reserve(size_t values_num) /* {{{ */
+{
+  write_reserved_t *r = pthread_getspecific(write_reserved_key);
+  if (r != NULL)
+    pthread_setspecific(write_reserved_key, NULL);
+  else if ((r = malloc(sizeof(*r))) == NULL)
+    return NULL;
+
+  value_list_t *vl = &r->vl;
+  /* Only the first bytes of the strings need to be cleared. */
+  vl->values = r->values;
+  vl->values_len = values_num;
+  vl->time = 0;
+  vl->interval = 0;
+  vl->host[0] = 0;
+  vl->plugin[0] = 0;
+  vl->plugin_instance[0] = 0;
+  vl->type[0] = 0;
+  vl->type_instance[0] = 0;
+  vl->meta = NULL;
+  vl->identifier.hash = 0;
+
+  if (values_num > STATIC_ARRAY_SIZE(r->values)) {
+    vl->values = calloc(values_num, sizeof(*vl->values));
+    if (vl->values == NULL) {
+      vl->values = r->values;
+      write_reserved_release(r);
+      return NULL;
+    }
+  }
+
+  return vl;
+} /* }}} value_list_t *plugin_dispatch_values_reserve */
+
+int plugin_dispatch_values_commit(value_list_t *vl, /* {{{ */
+                                  const data_set_t *ds) {
+  /* "vl" is the first member of the reservation. */
+  write_reserved_t *r = (write_reserved_t *)vl;
+
+  if ((ds != NULL) && (vl->type[0] != 0) && (strcmp(ds->type, vl->type) != 0)) {
+    ERROR("plugin_dispatch_values_commit: Data set \"%s\" does not match "
+          "the value list's type \"%s\".",
+          ds->type, vl->type);
+    plugin_dispatch_values_cancel(vl);
+    return EINVAL;
+  }
+
+  if (check_drop_value()) {
+    if (record_statistics)
+      C_ATOMIC_ADD(&stats_values_dropped, 1);
+    plugin_dispatch_values_cancel(vl);
+    return 0;
+  }
+
+  write_queue_t *q = write_queue_entry_alloc();
+  if (q == NULL) {
+    plugin_dispatch_values_cancel(vl);
+    return ENOMEM;
+  }
+
+  /* Same defaults as write_queue_entry_create(), but the identifier set by
+   * the producer is kept unless the host is filled in. */
+  value_list_identifier_t const *id =
+      (vl->host[0] != 0) ? &vl->identifier : NULL;
+  if (write_queue_entry_set_ident(q, vl, ds, /* hint = */ NULL, id) != 0) {
+    write_queue_entry_destroy(q);
+    plugin_dispatch_values_cancel(vl);
+    return ENOMEM;
+  }
+
+  /* Take over the values and the meta data instead of copying them. */
+  if (vl->values == r->values) {
+    memcpy(q->values_inline, r->values, vl->values_len * sizeof(*r->values));
+  } else {
+    q->values = vl->values;
+    vl->values = r->values;
+    memstat_add(write_queue_memstat,
+                (int64_t)(vl->values_len * sizeof(*q->values)), 0);
+  }
+  q->values_len = vl->values_len;
+  q->meta = vl->meta;
+  vl->meta = NULL;
+
+  q->time = (vl->time != 0) ? vl->time : plugin_value_time();
+  q->interval = (vl->interval != 0) ? vl->interval : plugin_get_interval();
+
+  write_reserved_release(r);
+  plugin_write_enqueue_entry(q, ds);
+  return 0;
+} /* }}} int plugin_dispatch_values_commit */
+
+void plugin_dispatch_values_cancel(value_list_t *vl) /* {{{ */
+{
+  meta_data_destroy(vl->meta);
+  vl->meta = NULL;
+  write_reserved_release((write_reserved_t *)vl);
+} /* }}} void plugin_dispatch_values_cancel */
+
 __attribute__((sentinel)) int
 plugin_dispatch_multivalue(value_list_t const *template, /* {{{ */
                            bool store_percentage, int store_type, ...) {
@@ -2145,7 +6661,7 @@ plugin_dispatch_multivalue(value_list_t const *template, /* {{{ */
       failed++;
     }
 
-    status = plugin_write_enqueue(vl);
+    status = plugin_write_enqueue(vl, /* ds = */ NULL);
     if (status != 0)
       failed++;
   }
@@ -2155,8 +6671,39 @@ plugin_dispatch_multivalue(value_list_t const *template, /* {{{ */
   return failed;
 } /* }}} int plugin_dispatch_multivalue */
 
+/* Calls all notification callbacks with "notif". */
+static int plugin_notification_deliver(const notification_t *notif) {
+  size_t slot = callback_reader_enter();
+  callback_array_t const *a = C_ATOMIC_LOAD_ACQ(&array_notification);
+
+  /* Nobody cares for notifications */
+  if (a == NULL) {
+    callback_reader_leave(slot);
+    return -1;
+  }
+
+  for (size_t i = 0; i < a->num; i++) {
+    callback_func_t *cf = a->entries[i].cf;
+    plugin_notification_cb callback = cf->cf_callback;
+
+    /* do not switch plugin context; rather keep the context
+     * (interval) information of the calling plugin */
+
+    int status = (*callback)(notif, &cf->cf_udata);
+    if (status != 0) {
+      WARNING("plugin_dispatch_notification: Notification "
+              "callback %s returned %i.",
+              a->entries[i].name, status);
+    }
+  }
+
+  callback_reader_leave(slot);
+  return 0;
+} /* int plugin_notification_deliver */
+
 int plugin_dispatch_notification(const notification_t *notif) {
-  llentry_t *le;
+  char name[6 * DATA_MAX_NAME_LEN + 8];
+  notification_key_t *key = NULL;
   /* Possible TODO: Add flap detection here */
 
   DEBUG("plugin_dispatch_notification: severity = %i; message = %s; "
@@ -2165,72 +6712,175 @@ int plugin_dispatch_notification(const notification_t *notif) {
         notif->host);
 
   /* Nobody cares for notifications */
-  if (list_notification == NULL)
+  if (C_ATOMIC_LOAD_ACQ(&array_notification) == NULL)
     return -1;
 
-  le = llist_head(list_notification);
-  while (le != NULL) {
-    callback_func_t *cf;
-    plugin_notification_cb callback;
-    int status;
+  pthread_mutex_lock(&notification_lock);
+  if (!notification_loop) {
+    pthread_mutex_unlock(&notification_lock);
+    return plugin_notification_deliver(notif);
+  }
 
-    /* do not switch plugin context; rather keep the context
-     * (interval) information of the calling plugin */
+  /* Notifications which don't refer to a value are never coalesced. */
+  if ((notif->plugin[0] != 0) || (notif->type[0] != 0)) {
+    int offset = snprintf(name, sizeof(name), "%d/", notif->severity);
+    format_name(name + offset, sizeof(name) - offset, notif->host,
+                notif->plugin, notif->plugin_instance, notif->type,
+                notif->type_instance);
+
+    if (c_avl_get(notification_keys, name, (void *)&key) == 0) {
+      cdtime_t now = cdtime();
+
+      if (key->queued != NULL) {
+        /* Replace the queued notification with the newer one. */
+        notification_t *n = &key->queued->n;
+        if (n->meta != NULL)
+          plugin_notification_meta_free(n->meta);
+        *n = *notif;
+        n->meta = NULL;
+        plugin_notification_meta_copy(n, notif);
+        key->last = now;
+        stats_notifications_coalesced++;
+        pthread_mutex_unlock(&notification_lock);
+        return 0;
+      }
 
-    cf = le->value;
-    callback = cf->cf_callback;
-    status = (*callback)(notif, &cf->cf_udata);
-    if (status != 0) {
-      WARNING("plugin_dispatch_notification: Notification "
-              "callback %s returned %i.",
-              le->key, status);
+      if ((now - key->last) < notification_coalesce_window) {
+        stats_notifications_coalesced++;
+        pthread_mutex_unlock(&notification_lock);
+        return 0;
+      }
     }
+  }
 
-    le = le->next;
+  if ((notification_queue_limit > 0) &&
+      (notification_queue_length >= notification_queue_limit)) {
+    stats_notifications_dropped++;
+    pthread_mutex_unlock(&notification_lock);
+    return -1;
+  }
+
+  notification_queue_t *q = calloc(1, sizeof(*q));
+  if (q == NULL) {
+    pthread_mutex_unlock(&notification_lock);
+    ERROR("plugin_dispatch_notification: calloc failed.");
+    return ENOMEM;
+  }
+  q->n = *notif;
+  q->n.meta = NULL;
+  plugin_notification_meta_copy(&q->n, notif);
+
+  if ((key == NULL) && ((notif->plugin[0] != 0) || (notif->type[0] != 0))) {
+    key = calloc(1, sizeof(*key));
+    if (key != NULL)
+      key->name = strdup(name);
+    if ((key == NULL) || (key->name == NULL) ||
+        (c_avl_insert(notification_keys, key->name, key) != 0)) {
+      if (key != NULL)
+        sfree(key->name);
+      sfree(key);
+    }
+  }
+
+  if (key != NULL) {
+    key->last = cdtime();
+    key->queued = q;
+    q->key = key;
   }
 
+  if (notification_queue_tail == NULL)
+    notification_queue_head = q;
+  else
+    notification_queue_tail->next = q;
+  notification_queue_tail = q;
+  notification_queue_length++;
+
+  pthread_cond_signal(&notification_cond);
+  pthread_mutex_unlock(&notification_lock);
   return 0;
 } /* int plugin_dispatch_notification */
 
+static void plugin_log_deliver(int level, const char *msg) {
+  size_t slot = callback_reader_enter();
+  callback_array_t const *a = C_ATOMIC_LOAD_ACQ(&array_log);
+
+  if (a == NULL)
+    fprintf(stderr, "%s\n", msg);
+
+  for (size_t i = 0; (a != NULL) && (i < a->num); i++) {
+    callback_func_t *cf = a->entries[i].cf;
+    plugin_log_cb callback = cf->cf_callback;
+
+    /* do not switch plugin context; rather keep the context
+     * (interval) information of the calling plugin */
+
+    (*callback)(level, msg, &cf->cf_udata);
+  }
+
+  callback_reader_leave(slot);
+} /* void plugin_log_deliver */
+
+/* Returns false if the message logged from "site" is to be suppressed. */
+static bool plugin_log_ratelimit(int level, const void *site) {
+  size_t slot = (size_t)(((uintptr_t)site >> 2) * 2654435761u) &
+                (LOG_RATELIMIT_SLOTS - 1);
+  int suppressed = 0;
+  bool ok;
+
+  pthread_mutex_lock(&log_ratelimit_lock);
+  if (log_ratelimit[slot].site != site) {
+    log_ratelimit[slot].site = site;
+    log_ratelimit[slot].rl = (c_ratelimit_t)C_RATELIMIT_INIT_STATIC;
+  }
+  ok = c_ratelimit(&log_ratelimit[slot].rl, (int)log_rate_limit,
+                   TIME_T_TO_CDTIME_T(1), cdtime(), &suppressed);
+  pthread_mutex_unlock(&log_ratelimit_lock);
+
+  if (suppressed > 0) {
+    char msg[128];
+    snprintf(msg, sizeof(msg),
+             "plugin_log: %d messages like the following one have been "
+             "suppressed.",
+             suppressed);
+    plugin_log_deliver(level, msg);
+  }
+
+  return ok;
+} /* bool plugin_log_ratelimit */
+
 void plugin_log(int level, const char *format, ...) {
   char msg[1024];
   va_list ap;
-  llentry_t *le;
 
 #if !COLLECT_DEBUG
   if (level >= LOG_DEBUG)
     return;
 #endif
 
+  if ((log_rate_limit > 0) &&
+      !plugin_log_ratelimit(level, __builtin_return_address(0)))
+    return;
+
   va_start(ap, format);
   vsnprintf(msg, sizeof(msg), format, ap);
   msg[sizeof(msg) - 1] = '\0';
   va_end(ap);
 
-  if (list_log == NULL) {
-    fprintf(stderr, "%s\n", msg);
-    return;
-  }
-
-  le = llist_head(list_log);
-  while (le != NULL) {
-    callback_func_t *cf;
-    plugin_log_cb callback;
-
-    cf = le->value;
-    callback = cf->cf_callback;
-
-    /* do not switch plugin context; rather keep the context
-     * (interval) information of the calling plugin */
-
-    (*callback)(level, msg, &cf->cf_udata);
-
-    le = le->next;
-  }
+  plugin_log_deliver(level, msg);
 } /* void plugin_log */
 
 void daemon_log(int level, const char *format, ...) {
   char msg[1024] = ""; // Size inherits from plugin_log()
+  char full_msg[1024];
+
+#if !COLLECT_DEBUG
+  if (level >= LOG_DEBUG)
+    return;
+#endif
+
+  if ((log_rate_limit > 0) &&
+      !plugin_log_ratelimit(level, __builtin_return_address(0)))
+    return;
 
   char const *name = plugin_get_ctx().name;
   if (name == NULL)
@@ -2241,7 +6891,8 @@ void daemon_log(int level, const char *format, ...) {
   vsnprintf(msg, sizeof(msg), format, ap);
   va_end(ap);
 
-  plugin_log(level, "%s plugin: %s", name, msg);
+  snprintf(full_msg, sizeof(full_msg), "%s plugin: %s", name, msg);
+  plugin_log_deliver(level, full_msg);
 } /* void daemon_log */
 
 int parse_log_severity(const char *severity) {
@@ -2280,14 +6931,14 @@ int parse_notif_severity(const char *severity) {
 } /* int parse_notif_severity */
 
 const data_set_t *plugin_get_ds(const char *name) {
-  data_set_t *ds;
+  const data_set_t *ds = plugin_lookup_ds(name);
 
-  if (data_sets == NULL) {
+  if ((ds == NULL) && (data_sets == NULL)) {
     P_ERROR("plugin_get_ds: No data sets are defined yet.");
     return NULL;
   }
 
-  if (c_avl_get(data_sets, name, (void *)&ds) != 0) {
+  if (ds == NULL) {
     DEBUG("No such dataset registered: %s", name);
     return NULL;
   }
@@ -2469,6 +7120,11 @@ static plugin_ctx_t *plugin_ctx_create(void) {
 void plugin_init_ctx(void) {
   pthread_key_create(&plugin_ctx_key, plugin_ctx_destructor);
   plugin_ctx_key_initialized = true;
+
+  pthread_key_create(&write_batch_key, /* destructor = */ NULL);
+  pthread_key_create(&write_reserved_key, /* destructor = */ free);
+  pthread_key_create(&data_set_cache_key, /* destructor = */ free);
+  pthread_key_create(&callback_reader_key, /* destructor = */ NULL);
 } /* void plugin_init_ctx */
 
 plugin_ctx_t plugin_get_ctx(void) {
@@ -2548,6 +7204,8 @@ int plugin_thread_create(pthread_t *thread, const pthread_attr_t *attr,
     return ENOMEM;
 
   plugin_thread->ctx = plugin_get_ctx();
+  /* The thread may outlive the read callback which started it. */
+  plugin_thread->ctx.aligned_time = 0;
   plugin_thread->start_routine = start_routine;
   plugin_thread->arg = arg;
 
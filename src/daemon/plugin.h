@@ -99,6 +99,19 @@ union value_u {
 };
 typedef union value_u value_t;
 
+/* Interned identifier of a value list: the canonical
+ * "host/plugin-instance/type-instance" name and its hash. It is computed once
+ * when the daemon dispatches a value list, so that the cache, the filter chain
+ * and the writers don't have to format and hash the name again. "hash" is zero
+ * if the identifier has not been computed. Code that changes the host, plugin
+ * or type fields of a value list it did not create must reset or update it,
+ * see identifier_update(). */
+struct value_list_identifier_s {
+  uint32_t hash;
+  char name[6 * DATA_MAX_NAME_LEN];
+};
+typedef struct value_list_identifier_s value_list_identifier_t;
+
 struct value_list_s {
   value_t *values;
   size_t values_len;
@@ -110,6 +123,7 @@ struct value_list_s {
   char type[DATA_MAX_NAME_LEN];
   char type_instance[DATA_MAX_NAME_LEN];
   meta_data_t *meta;
+  value_list_identifier_t identifier;
 };
 typedef struct value_list_s value_list_t;
 
@@ -170,11 +184,44 @@ struct user_data_s {
 };
 typedef struct user_data_s user_data_t;
 
+/* Element of the array passed to batch write callbacks, see
+ * plugin_register_write_batch(). */
+struct plugin_write_entry_s {
+  const data_set_t *ds;
+  const value_list_t *vl;
+};
+typedef struct plugin_write_entry_s plugin_write_entry_t;
+
+/* Priority classes ("Priority" in the <LoadPlugin> block). With
+ * "LoadShedding", the read intervals of low priority plugins are stretched
+ * first when the write queue fills up, those of normal priority plugins
+ * second. Critical plugins are never slowed down and their values are never
+ * dropped. */
+#define PLUGIN_PRIORITY_NORMAL 0
+#define PLUGIN_PRIORITY_LOW 1
+#define PLUGIN_PRIORITY_CRITICAL 2
+
 struct plugin_ctx_s {
   char *name;
   cdtime_t interval;
+  int priority;
   cdtime_t flush_interval;
   cdtime_t flush_timeout;
+  /* Time used for value lists dispatched without a time. Set by the read
+   * threads to the time the read was due or, when "ReadPhaseMode" is used, to
+   * the start of the interval. Zero outside of read callbacks. */
+  cdtime_t aligned_time;
+  /* Dedicated write queue for the plugin's write callbacks, configured in the
+   * <LoadPlugin> block. The limits are zero for an unbounded queue. */
+  bool write_queue;
+  int write_queue_limit_high;
+  int write_queue_limit_low;
+  /* Directory in which values the dedicated write queue can't take are
+   * spooled, or NULL. The limit is in MiB, the replay rate in value lists per
+   * second; both are zero for no limit. */
+  char *spool_directory;
+  int spool_limit;
+  int spool_replay_rate;
 };
 typedef struct plugin_ctx_s plugin_ctx_t;
 
@@ -185,6 +232,8 @@ typedef int (*plugin_init_cb)(void);
 typedef int (*plugin_read_cb)(user_data_t *);
 typedef int (*plugin_write_cb)(const data_set_t *, const value_list_t *,
                                user_data_t *);
+typedef int (*plugin_write_batch_cb)(const plugin_write_entry_t *entries,
+                                     size_t entries_num, user_data_t *);
 typedef int (*plugin_flush_cb)(cdtime_t timeout, const char *identifier,
                                user_data_t *);
 /* "missing" callback. Returns less than zero on failure, zero if other
@@ -193,7 +242,12 @@ typedef int (*plugin_flush_cb)(cdtime_t timeout, const char *identifier,
 typedef int (*plugin_missing_cb)(const value_list_t *, user_data_t *);
 typedef void (*plugin_log_cb)(int severity, const char *message, user_data_t *);
 typedef int (*plugin_shutdown_cb)(void);
+typedef int (*plugin_reconfigure_cb)(void);
 typedef int (*plugin_notification_cb)(const notification_t *, user_data_t *);
+/* Event loop callbacks. "revents" holds the POLLIN, POLLPRI, POLLOUT, POLLERR
+ * and POLLHUP flags of poll(2). */
+typedef int (*plugin_fd_cb)(int fd, int revents, user_data_t *);
+typedef int (*plugin_timer_cb)(user_data_t *);
 /*
  * NAME
  *  plugin_set_dir
@@ -233,9 +287,25 @@ void plugin_set_dir(const char *dir);
  */
 int plugin_load(const char *name, bool global);
 
+/*
+ * NAME
+ *  plugin_init_after
+ *
+ * DESCRIPTION
+ *  Makes plugin_init_all() call the init callback of `plugin' only after the
+ *  init callback of `after' has returned. Only relevant if the init callbacks
+ *  run in parallel, see the "InitThreads" option. Dependencies on plugins
+ *  without init callbacks are ignored.
+ *
+ * RETURN VALUE
+ *  Zero upon success, an errno value otherwise.
+ */
+int plugin_init_after(char const *plugin, char const *after);
+
 int plugin_init_all(void);
 void plugin_read_all(void);
 int plugin_read_all_once(void);
+int plugin_read_all_bench(cdtime_t duration);
 int plugin_shutdown_all(void);
 
 /*
@@ -289,17 +359,54 @@ int plugin_register_complex_read(const char *group, const char *name,
                                  user_data_t const *user_data);
 int plugin_register_write(const char *name, plugin_write_cb callback,
                           user_data_t const *user_data);
+/* Like "plugin_register_write", but the callback receives all value lists a
+ * write thread dequeued in one go (up to "WriteBatchSize"). The value lists
+ * are only valid for the duration of the callback. Outside of the write
+ * threads, e.g. when "plugin_write" is called by other plugins, the callback
+ * is invoked with a single entry. Batch writers are unregistered with
+ * "plugin_unregister_write". */
+int plugin_register_write_batch(const char *name,
+                                plugin_write_batch_cb callback,
+                                user_data_t const *user_data);
 int plugin_register_flush(const char *name, plugin_flush_cb callback,
                           user_data_t const *user_data);
 int plugin_register_missing(const char *name, plugin_missing_cb callback,
                             user_data_t const *user_data);
 int plugin_register_shutdown(const char *name, plugin_shutdown_cb callback);
+/* Registers a callback which discards the plugin's configuration, so that a
+ * changed <Plugin> block can be applied when the configuration is reloaded.
+ * Before the callback is called, the read callbacks of the group "name" are
+ * unregistered. Read callbacks still running at that point finish normally,
+ * so state they use must not be freed by the callback, except through the
+ * read callback's "free_func". Afterwards the new <Plugin> blocks are passed
+ * to the config callback, which registers the read callbacks again. */
+int plugin_register_reconfigure(const char *name,
+                                plugin_reconfigure_cb callback);
 int plugin_register_data_set(const data_set_t *ds);
+/* Registers "ds_num" data sets while holding the data set lock only once, e.g.
+ * when loading a types.db file. Stops at the first error. */
+int plugin_register_data_sets(const data_set_t *ds, size_t ds_num);
 int plugin_register_log(const char *name, plugin_log_cb callback,
                         user_data_t const *user_data);
 int plugin_register_notification(const char *name,
                                  plugin_notification_cb callback,
                                  user_data_t const *user_data);
+/* Watches the file descriptor "fd" for the poll(2) "events" POLLIN, POLLPRI
+ * and POLLOUT. POLLERR and POLLHUP are always reported. Instead of running a
+ * thread per plugin, all file descriptors and timers are served by one event
+ * loop thread, which is started by the first registration, so these functions
+ * must not be called before the init callbacks run. Callbacks must not block.
+ * If a callback returns non-zero, it is unregistered. The file descriptor is
+ * not closed by the daemon. "user_data" is freed when the callback is
+ * unregistered, unless registering fails. Returns ENOTSUP on systems without
+ * epoll(7). */
+int plugin_register_fd(const char *name, int fd, int events,
+                       plugin_fd_cb callback, user_data_t const *user_data);
+/* Calls "callback" from the event loop every "interval", the plugin's
+ * interval if zero. The first call happens one interval after registering. */
+int plugin_register_timer(const char *name, cdtime_t interval,
+                          plugin_timer_cb callback,
+                          user_data_t const *user_data);
 
 int plugin_unregister_config(const char *name);
 int plugin_unregister_complex_config(const char *name);
@@ -310,9 +417,53 @@ int plugin_unregister_write(const char *name);
 int plugin_unregister_flush(const char *name);
 int plugin_unregister_missing(const char *name);
 int plugin_unregister_shutdown(const char *name);
+int plugin_unregister_reconfigure(const char *name);
 int plugin_unregister_data_set(const char *name);
 int plugin_unregister_log(const char *name);
 int plugin_unregister_notification(const char *name);
+/* Once these return, the callback isn't running and won't be called again,
+ * unless they are called from an event loop callback. Hence the caller must not
+ * hold a lock which the callback takes. */
+int plugin_unregister_fd(const char *name);
+int plugin_unregister_timer(const char *name);
+
+/*
+ * NAME
+ *  plugin_reconfigure
+ *
+ * DESCRIPTION
+ *  Prepares the plugin `name' for a new configuration: unregisters the read
+ *  callbacks of the group `name' and calls the callback registered with
+ *  `plugin_register_reconfigure'.
+ *
+ * RETURN VALUE
+ *  Zero upon success, ENOTSUP if the plugin can't be reconfigured at runtime
+ *  and the status of the callback otherwise.
+ */
+int plugin_reconfigure(const char *name);
+
+/*
+ * NAME
+ *  plugin_reconfigure_chains
+ *
+ * DESCRIPTION
+ *  Replaces the filter chains with the <Chain> blocks below `root' and looks
+ *  up the "PreCacheChain" and "PostCacheChain" again. If a chain can't be
+ *  configured, the current chains remain in place.
+ */
+int plugin_reconfigure_chains(const oconfig_item_t *root);
+
+/*
+ * NAME
+ *  plugin_request_reload
+ *
+ * DESCRIPTION
+ *  Asks the daemon to re-read its configuration before the next read cycle.
+ *  Safe to call from a signal handler. `plugin_reload_pending' returns and
+ *  clears the request.
+ */
+void plugin_request_reload(void);
+bool plugin_reload_pending(void);
 
 /*
  * NAME
@@ -342,6 +493,75 @@ void plugin_log_available_writers(void);
  */
 int plugin_dispatch_values(value_list_t const *vl);
 
+/*
+ * NAME
+ *  plugin_dispatch_values_ds
+ *
+ * DESCRIPTION
+ *  Like `plugin_dispatch_values', but uses a data set the caller has looked
+ *  up before, e.g. with `plugin_get_ds' in its init callback, instead of
+ *  looking it up by type. Data sets returned by `plugin_get_ds' remain valid
+ *  until shutdown, even if they are replaced or unregistered.
+ *
+ * ARGUMENTS
+ *  `ds'        Data set of the values. If NULL, this function behaves like
+ *              `plugin_dispatch_values'.
+ *  `vl'        Value list of the values that have been read by a `read'
+ *              function. If its type is empty, the type of `ds' is used.
+ *
+ * RETURN VALUE
+ *  Zero on success, EINVAL if the type of `vl' doesn't match `ds'.
+ */
+int plugin_dispatch_values_ds(const data_set_t *ds, value_list_t const *vl);
+
+/*
+ * NAME
+ *  plugin_dispatch_values_reserve
+ *
+ * DESCRIPTION
+ *  Returns a value list from a per-thread buffer, so that a caller that has
+ *  to build the value list anyway, e.g. from a network packet, can do so
+ *  without `plugin_dispatch_values' copying the values and meta data again.
+ *  The returned value list has room for `values_num' values in `values',
+ *  empty strings and zero times; all other fields are zero, too.
+ *
+ *  The value list must be passed to either `plugin_dispatch_values_commit'
+ *  or `plugin_dispatch_values_cancel'. If the caller sets `identifier', it
+ *  must match the value list's fields.
+ *
+ * RETURN VALUE
+ *  The value list or NULL if allocating memory failed.
+ */
+value_list_t *plugin_dispatch_values_reserve(size_t values_num);
+
+/*
+ * NAME
+ *  plugin_dispatch_values_commit
+ *
+ * DESCRIPTION
+ *  Dispatches a value list returned by `plugin_dispatch_values_reserve'
+ *  like `plugin_dispatch_values_ds' does and takes ownership of it,
+ *  including its meta data, even if it fails.
+ *
+ * ARGUMENTS
+ *  `vl'        Value list returned by `plugin_dispatch_values_reserve'.
+ *  `ds'        Data set of the values or NULL.
+ *
+ * RETURN VALUE
+ *  Zero on success, EINVAL if the type of `vl' doesn't match `ds'.
+ */
+int plugin_dispatch_values_commit(value_list_t *vl, const data_set_t *ds);
+
+/*
+ * NAME
+ *  plugin_dispatch_values_cancel
+ *
+ * DESCRIPTION
+ *  Releases a value list returned by `plugin_dispatch_values_reserve'
+ *  without dispatching it, including its meta data.
+ */
+void plugin_dispatch_values_cancel(value_list_t *vl);
+
 /*
  * NAME
  *  plugin_dispatch_multivalue
@@ -410,6 +630,12 @@ void daemon_log(int level, const char *format, ...)
 
 const data_set_t *plugin_get_ds(const char *name);
 
+/* (Re-)builds the index used to look up data sets by type. Registering or
+ * unregistering a data set invalidates the index; lookups are slower until it
+ * has been rebuilt. Called by the daemon after reading the types database and
+ * after the init callbacks ran. */
+int plugin_build_data_set_index(void);
+
 int plugin_notification_meta_add_string(notification_t *n, const char *name,
                                         const char *value);
 int plugin_notification_meta_add_signed_int(notification_t *n, const char *name,
@@ -446,6 +672,64 @@ plugin_ctx_t plugin_set_ctx(plugin_ctx_t ctx);
  */
 cdtime_t plugin_get_interval(void);
 
+/*
+ * Callback latency statistics.
+ */
+
+struct plugin_latency_s;
+typedef struct plugin_latency_s plugin_latency_t;
+
+/*
+ * NAME
+ *  plugin_latency_register
+ *
+ * DESCRIPTION
+ *  Creates a latency histogram for a callback. The histogram is dispatched
+ *  as internal statistics (plugin "collectd", plugin instance
+ *  "<kind>-<name>", type "latency") when "CollectInternalStats" is enabled,
+ *  and reset afterwards.
+ *
+ * RETURN VALUE
+ *  Returns the new histogram or NULL on failure. Measurements for a NULL
+ *  histogram are ignored.
+ */
+plugin_latency_t *plugin_latency_register(const char *kind, const char *name);
+void plugin_latency_unregister(plugin_latency_t *pl);
+
+/*
+ * NAME
+ *  plugin_latency_start, plugin_latency_stop
+ *
+ * DESCRIPTION
+ *  Call plugin_latency_start() before and plugin_latency_stop() after the
+ *  callback to record its execution time. plugin_latency_start() returns
+ *  zero without querying the clock when internal statistics are disabled.
+ */
+cdtime_t plugin_latency_start(void);
+void plugin_latency_stop(plugin_latency_t *pl, cdtime_t start);
+
+/*
+ * NAME
+ *  plugin_internal_stats_foreach
+ *
+ * DESCRIPTION
+ *  Calls "callback" for each of the daemon's internal counters: queue
+ *  lengths, drop counts, the cache size, memory usage, thread states and the
+ *  run times of the read callbacks. Unlike the values dispatched with
+ *  "CollectInternalStats", these are read directly from the counters and never
+ *  pass through the write queue. All samples of a metric are reported one
+ *  after the other; "help" is only set for the first one. "label_name" and
+ *  "label_value" are NULL for metrics without a label, "counter" is true for
+ *  monotonically increasing values. The callback may be called with internal
+ *  locks held and must not call into the daemon.
+ */
+typedef void (*plugin_internal_stat_cb)(const char *name, const char *help,
+                                        bool counter, const char *label_name,
+                                        const char *label_value, double value,
+                                        void *user_data);
+int plugin_internal_stats_foreach(plugin_internal_stat_cb callback,
+                                  void *user_data);
+
 /*
  * Context-aware thread management.
  */
@@ -0,0 +1,96 @@
+/**
+ * collectd - src/daemon/plugin_bench.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin_bench.h"
+#include "utils_atomic.h"
+#include "utils_time.h"
+
+#include <sched.h>
+
+/* plugin_bench_wait() gives up if no value has been written for this long,
+ * e.g. because the benchmark dispatched invalid values. */
+#define BENCH_WAIT_TIMEOUT TIME_T_TO_CDTIME_T(10)
+
+static uint64_t bench_written;
+
+static data_source_t bench_ds_sources[] = {
+    {"rx", DS_TYPE_DERIVE, 0, NAN}, {"tx", DS_TYPE_DERIVE, 0, NAN},
+};
+static data_set_t bench_ds = {"bench", STATIC_ARRAY_SIZE(bench_ds_sources),
+                              bench_ds_sources};
+
+static int bench_write(__attribute__((unused)) data_set_t const *ds,
+                       __attribute__((unused)) value_list_t const *vl,
+                       __attribute__((unused)) user_data_t *ud) {
+  C_ATOMIC_ADD(&bench_written, 1);
+  return 0;
+}
+
+/* plugin_init_all() only starts the write threads if at least one init or
+ * read callback has been registered. */
+static int bench_init(void) { return 0; }
+
+int plugin_bench_init(void) {
+  plugin_init_ctx();
+
+  hostname_set("bench.example.com");
+  interval_g = TIME_T_TO_CDTIME_T(10);
+
+  int status = plugin_register_data_set(&bench_ds);
+  if (status != 0)
+    return status;
+
+  plugin_register_init("bench", bench_init);
+  plugin_register_write("bench", bench_write, /* user data = */ NULL);
+
+  return plugin_init_all();
+}
+
+uint64_t plugin_bench_written(void) { return C_ATOMIC_LOAD(&bench_written); }
+
+int plugin_bench_wait(uint64_t dispatched, uint64_t pending) {
+  uint64_t written = plugin_bench_written();
+  cdtime_t last_progress = cdtime();
+
+  while (written + pending < dispatched) {
+    sched_yield();
+
+    uint64_t tmp = plugin_bench_written();
+    if (tmp != written) {
+      written = tmp;
+      last_progress = cdtime();
+    } else if ((cdtime() - last_progress) > BENCH_WAIT_TIMEOUT) {
+      ERROR("plugin_bench_wait: %" PRIu64 " of %" PRIu64
+            " value lists have been written, giving up.",
+            written, dispatched);
+      return ETIMEDOUT;
+    }
+  }
+
+  return 0;
+}
+
+void plugin_bench_shutdown(void) { plugin_shutdown_all(); }
@@ -0,0 +1,84 @@
+/**
+ * collectd - src/daemon/plugin_bench.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef PLUGIN_BENCH_H
+#define PLUGIN_BENCH_H 1
+
+/*
+ * Helpers for benchmarks which run against the real plugin infrastructure,
+ * i.e. the write queue, the write threads, the value cache and the filter
+ * chains, instead of plugin_mock.c.
+ */
+
+#include "collectd.h"
+
+#include "plugin.h"
+
+/*
+ * NAME
+ *   plugin_bench_init
+ *
+ * DESCRIPTION
+ *   Sets up the global variables, registers the data set "bench" (two DERIVE
+ *   data sources), a write callback which only counts the value lists it
+ *   receives and starts the write threads.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise.
+ */
+int plugin_bench_init(void);
+
+/*
+ * NAME
+ *   plugin_bench_written
+ *
+ * DESCRIPTION
+ *   Returns the number of value lists the write callback has received so far.
+ */
+uint64_t plugin_bench_written(void);
+
+/*
+ * NAME
+ *   plugin_bench_wait
+ *
+ * DESCRIPTION
+ *   Blocks until at most `pending' of the `dispatched' value lists are still
+ *   in the write queue. Benchmarks use this to bound the size of the queue and
+ *   (with `pending' set to zero) to wait for all values to be written.
+ *
+ * RETURN VALUE
+ *   Zero upon success, ETIMEDOUT if no value list has been written for ten
+ *   seconds.
+ */
+int plugin_bench_wait(uint64_t dispatched, uint64_t pending);
+
+/*
+ * NAME
+ *   plugin_bench_shutdown
+ *
+ * DESCRIPTION
+ *   Stops the write threads and calls the shutdown callbacks.
+ */
+void plugin_bench_shutdown(void);
+
+#endif /* PLUGIN_BENCH_H */
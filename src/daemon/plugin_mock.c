@@ -41,6 +41,10 @@ void plugin_set_dir(const char *dir) { /* nop */
 
 int plugin_load(const char *name, bool global) { return ENOTSUP; }
 
+int plugin_init_after(char const *plugin, char const *after) {
+  return ENOTSUP;
+}
+
 int plugin_register_config(const char *name,
                            int (*callback)(const char *key, const char *val),
                            const char **keys, int keys_num) {
@@ -67,6 +71,19 @@ int plugin_register_write(__attribute__((unused)) const char *name,
   return ENOTSUP;
 }
 
+int plugin_register_write_batch(__attribute__((unused)) const char *name,
+                                __attribute__((unused))
+                                plugin_write_batch_cb callback,
+                                __attribute__((unused)) user_data_t const *ud) {
+  return ENOTSUP;
+}
+
+int plugin_register_flush(__attribute__((unused)) const char *name,
+                          __attribute__((unused)) plugin_flush_cb callback,
+                          __attribute__((unused)) user_data_t const *ud) {
+  return ENOTSUP;
+}
+
 int plugin_register_missing(const char *name, plugin_missing_cb callback,
                             user_data_t const *ud) {
   return ENOTSUP;
@@ -83,10 +100,42 @@ int plugin_register_shutdown(const char *name, int (*callback)(void)) {
   return ENOTSUP;
 }
 
+int plugin_register_reconfigure(const char *name,
+                                plugin_reconfigure_cb callback) {
+  return ENOTSUP;
+}
+
+int plugin_register_fd(const char *name, int fd, int events,
+                       plugin_fd_cb callback, user_data_t const *user_data) {
+  return ENOTSUP;
+}
+
+int plugin_unregister_fd(const char *name) { return ENOTSUP; }
+
+int plugin_register_timer(const char *name, cdtime_t interval,
+                          plugin_timer_cb callback,
+                          user_data_t const *user_data) {
+  return ENOTSUP;
+}
+
+int plugin_unregister_timer(const char *name) { return ENOTSUP; }
+
+int plugin_reconfigure(const char *name) { return ENOTSUP; }
+
+int plugin_reconfigure_chains(const oconfig_item_t *root) { return ENOTSUP; }
+
 int plugin_register_data_set(const data_set_t *ds) { return ENOTSUP; }
 
+int plugin_register_data_sets(const data_set_t *ds, size_t ds_num) {
+  return ENOTSUP;
+}
+
 int plugin_dispatch_values(value_list_t const *vl) { return ENOTSUP; }
 
+int plugin_dispatch_values_ds(const data_set_t *ds, value_list_t const *vl) {
+  return ENOTSUP;
+}
+
 int plugin_dispatch_notification(__attribute__((unused))
                                  const notification_t *notif) {
   return ENOTSUP;
@@ -159,6 +208,14 @@ const data_set_t *plugin_get_ds(const char *name) {
   return &magic;
 }
 
+int plugin_build_data_set_index(void) { return ENOTSUP; }
+
+int plugin_thread_create(pthread_t *thread, const pthread_attr_t *attr,
+                         void *(*start_routine)(void *), void *arg,
+                         __attribute__((unused)) char const *name) {
+  return pthread_create(thread, attr, start_routine, arg);
+}
+
 void plugin_log(int level, char const *format, ...) {
   char buffer[1024];
   va_list ap;
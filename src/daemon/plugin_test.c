@@ -0,0 +1,199 @@
+/**
+ * collectd - src/daemon/plugin_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "testing.h"
+
+#include "collectd.h"
+
+#include "common.h"
+#include "configfile.h"
+#include "plugin.h"
+#include "utils_time.h"
+
+/* The test is built with a write ring of 64 entries, see Makefile.am. */
+#define TEST_VALUES 512
+
+static pthread_mutex_t test_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t test_cond = PTHREAD_COND_INITIALIZER;
+static size_t test_allowed;
+static gauge_t test_written[TEST_VALUES];
+static size_t test_written_num;
+
+static data_source_t test_ds_sources[] = {
+    {"value", DS_TYPE_GAUGE, 0, NAN},
+};
+static data_set_t test_ds = {"test", STATIC_ARRAY_SIZE(test_ds_sources),
+                             test_ds_sources};
+
+static cdtime_t test_time;
+
+/* Blocks the write thread once "test_allowed" values have been written. */
+static int test_write(__attribute__((unused)) data_set_t const *ds,
+                      value_list_t const *vl,
+                      __attribute__((unused)) user_data_t *ud) {
+  pthread_mutex_lock(&test_lock);
+  while (test_written_num >= test_allowed)
+    pthread_cond_wait(&test_cond, &test_lock);
+  if (test_written_num < TEST_VALUES)
+    test_written[test_written_num] = vl->values[0].gauge;
+  test_written_num++;
+  pthread_cond_broadcast(&test_cond);
+  pthread_mutex_unlock(&test_lock);
+
+  return 0;
+}
+
+static void test_allow(size_t num) {
+  pthread_mutex_lock(&test_lock);
+  test_allowed = num;
+  pthread_cond_broadcast(&test_cond);
+  pthread_mutex_unlock(&test_lock);
+}
+
+/* Waits for up to ten seconds until "num" values have been written. */
+static size_t test_wait(size_t num) {
+  cdtime_t deadline = cdtime() + TIME_T_TO_CDTIME_T(10);
+  struct timespec ts = CDTIME_T_TO_TIMESPEC(deadline);
+
+  pthread_mutex_lock(&test_lock);
+  while (test_written_num < num) {
+    if (pthread_cond_timedwait(&test_cond, &test_lock, &ts) == ETIMEDOUT)
+      break;
+  }
+  size_t written = test_written_num;
+  pthread_mutex_unlock(&test_lock);
+
+  return written;
+}
+
+static int test_dispatch(size_t i) {
+  value_list_t vl = {
+      .values = &(value_t){.gauge = (gauge_t)i},
+      .values_len = 1,
+      .time = test_time + MS_TO_CDTIME_T(i),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "test",
+  };
+
+  return plugin_dispatch_values(&vl);
+}
+
+static int test_freed;
+
+static void test_free(void *data) { test_freed += *(int *)data; }
+
+static int test_write_once(__attribute__((unused)) data_set_t const *ds,
+                           __attribute__((unused)) value_list_t const *vl,
+                           __attribute__((unused)) user_data_t *ud) {
+  return plugin_unregister_write("once");
+}
+
+DEF_TEST(unregister) {
+  int one = 1;
+  user_data_t ud = {.data = &one, .free_func = test_free};
+  value_list_t vl = {
+      .values = &(value_t){.gauge = 42},
+      .values_len = 1,
+      .host = "example.com",
+      .plugin = "test",
+      .type = "test",
+  };
+
+  /* The free function runs when the callback is unregistered, not when the
+   * daemon shuts down. */
+  test_freed = 0;
+  CHECK_ZERO(plugin_register_write("test", test_write, &ud));
+  CHECK_ZERO(plugin_unregister_write("test"));
+  EXPECT_EQ_INT(1, test_freed);
+
+  /* Same for a callback replaced by one of the same name. */
+  CHECK_ZERO(plugin_register_write("test", test_write, &ud));
+  CHECK_ZERO(plugin_register_write("test", test_write, &ud));
+  EXPECT_EQ_INT(2, test_freed);
+  CHECK_ZERO(plugin_unregister_write("test"));
+  EXPECT_EQ_INT(3, test_freed);
+
+  /* A callback unregistering itself is freed once it has returned. */
+  CHECK_ZERO(plugin_register_write("once", test_write_once, &ud));
+  CHECK_ZERO(plugin_write(/* plugin = */ NULL, &test_ds, &vl));
+  EXPECT_EQ_INT(4, test_freed);
+  EXPECT_EQ_INT(ENOENT, plugin_write(/* plugin = */ NULL, &test_ds, &vl));
+
+  return 0;
+}
+
+/* plugin_init_all() only starts the write threads if at least one init or
+ * read callback has been registered. */
+static int test_init(void) { return 0; }
+
+DEF_TEST(write_queue_order) {
+  /* Values of one identifier are only written in order by a single thread.
+   * It takes one value at a time from the queue. */
+  CHECK_ZERO(global_option_set("WriteThreads", "1", /* from_cli = */ true));
+  CHECK_ZERO(global_option_set("WriteBatchSize", "1", /* from_cli = */ true));
+  CHECK_ZERO(plugin_register_data_set(&test_ds));
+  CHECK_ZERO(plugin_register_init("test", test_init));
+  CHECK_ZERO(plugin_register_write("test", test_write, /* user data = */ NULL));
+  CHECK_ZERO(plugin_init_all());
+
+  test_time = cdtime();
+
+  /* The ring fills up while the write thread is blocked, the remaining
+   * values go to the overflow list. */
+  int status = 0;
+  for (size_t i = 0; i < TEST_VALUES / 2; i++)
+    status |= test_dispatch(i);
+
+  /* Make room in the ring. The values dispatched next must not overtake the
+   * older ones in the overflow list. */
+  test_allow(16);
+  EXPECT_EQ_UINT64(16, test_wait(16));
+  for (size_t i = TEST_VALUES / 2; i < TEST_VALUES; i++)
+    status |= test_dispatch(i);
+  EXPECT_EQ_INT(0, status);
+
+  test_allow(TEST_VALUES);
+
+  EXPECT_EQ_UINT64(TEST_VALUES, test_wait(TEST_VALUES));
+  size_t in_order = 0;
+  while ((in_order < TEST_VALUES) &&
+         (test_written[in_order] == (gauge_t)in_order))
+    in_order++;
+  EXPECT_EQ_UINT64(TEST_VALUES, in_order);
+
+  plugin_shutdown_all();
+  return 0;
+}
+
+int main(void) {
+  plugin_init_ctx();
+  hostname_set("example.com");
+  interval_g = TIME_T_TO_CDTIME_T(10);
+
+  RUN_TEST(unregister);
+  RUN_TEST(write_queue_order);
+
+  END_TEST;
+}
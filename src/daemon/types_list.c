@@ -32,6 +32,8 @@
 #include "plugin.h"
 #include "types_list.h"
 
+#include <sys/mman.h>
+
 static int parse_ds(data_source_t *dsrc, char *buf, size_t buf_len) {
   char *dummy;
   char *saveptr;
@@ -93,10 +95,24 @@ static int parse_ds(data_source_t *dsrc, char *buf, size_t buf_len) {
   return 0;
 } /* int parse_ds */
 
-static void parse_line(char *buf) {
+/* A file's data sets, collected by parse_file() so that they can be
+ * registered in one go and written to the cache. */
+typedef struct {
+  data_set_t *sets;
+  size_t sets_num;
+} types_list_t;
+
+static void types_list_free(types_list_t *tl) {
+  for (size_t i = 0; i < tl->sets_num; i++)
+    sfree(tl->sets[i].ds);
+  sfree(tl->sets);
+  tl->sets_num = 0;
+} /* void types_list_free */
+
+static void parse_line(types_list_t *tl, char *buf) {
   char *fields[64];
   size_t fields_num;
-  data_set_t *ds;
+  data_set_t ds = {{0}};
 
   fields_num = strsplit(buf, fields, 64);
   if (fields_num < 2)
@@ -106,36 +122,32 @@ static void parse_line(char *buf) {
   if (fields[0][0] == '#')
     return;
 
-  ds = calloc(1, sizeof(*ds));
-  if (ds == NULL)
-    return;
-
-  sstrncpy(ds->type, fields[0], sizeof(ds->type));
+  sstrncpy(ds.type, fields[0], sizeof(ds.type));
 
-  ds->ds_num = fields_num - 1;
-  ds->ds = (data_source_t *)calloc(ds->ds_num, sizeof(data_source_t));
-  if (ds->ds == NULL) {
-    sfree(ds);
+  ds.ds_num = fields_num - 1;
+  ds.ds = (data_source_t *)calloc(ds.ds_num, sizeof(data_source_t));
+  if (ds.ds == NULL)
     return;
-  }
 
-  for (size_t i = 0; i < ds->ds_num; i++)
-    if (parse_ds(ds->ds + i, fields[i + 1], strlen(fields[i + 1])) != 0) {
+  for (size_t i = 0; i < ds.ds_num; i++)
+    if (parse_ds(ds.ds + i, fields[i + 1], strlen(fields[i + 1])) != 0) {
       ERROR("types_list: parse_line: Cannot parse data source #%" PRIsz
             " of data set %s",
-            i, ds->type);
-      sfree(ds->ds);
-      sfree(ds);
+            i, ds.type);
+      sfree(ds.ds);
       return;
     }
 
-  plugin_register_data_set(ds);
-
-  sfree(ds->ds);
-  sfree(ds);
+  data_set_t *tmp = realloc(tl->sets, (tl->sets_num + 1) * sizeof(*tl->sets));
+  if (tmp == NULL) {
+    sfree(ds.ds);
+    return;
+  }
+  tl->sets = tmp;
+  tl->sets[tl->sets_num++] = ds;
 } /* void parse_line */
 
-static void parse_file(FILE *fh) {
+static void parse_file(types_list_t *tl, FILE *fh) {
   char buf[4096];
   size_t buf_len;
 
@@ -162,12 +174,271 @@ static void parse_file(FILE *fh) {
     if (buf_len == 0)
       continue;
 
-    parse_line(buf);
+    parse_line(tl, buf);
   } /* while (fgets) */
 } /* void parse_file */
 
+/*
+ * Precompiled types cache
+ *
+ * If "TypesDBCache" is set, the data sets of each types.db file are written
+ * to "<dir>/types-<hash of the path>.cache" after parsing the file. The next
+ * time the file is read, the data sets are registered straight from the
+ * mmap(2)ed cache, as long as the file's size, inode and modification time
+ * are unchanged. The cache uses the host's byte order and structure layout;
+ * the header records enough of both to reject caches from other builds.
+ */
+#define TYPES_CACHE_MAGIC "collectd-types"
+#define TYPES_CACHE_VERSION 1
+
+typedef struct {
+  char magic[16];
+  uint32_t version;
+  uint32_t name_size;   /* DATA_MAX_NAME_LEN */
+  uint32_t source_size; /* sizeof(data_source_t) */
+  uint32_t sets_num;
+  uint64_t path_hash;
+  uint64_t file_size;
+  uint64_t file_ino;
+  int64_t file_mtime;
+  uint64_t payload_size;
+  uint64_t payload_hash;
+} types_cache_header_t;
+
+/* Each data set is stored as a types_cache_set_t followed by "ds_num"
+ * data_source_t. Both sizes are multiples of eight, so the data sources are
+ * suitably aligned in the mapping and are passed to
+ * plugin_register_data_sets() as-is. */
+typedef struct {
+  char type[DATA_MAX_NAME_LEN];
+  uint64_t ds_num;
+} types_cache_set_t;
+
+static char *types_cache_dir;
+
+/* FNV-1a, 64 bit */
+static uint64_t types_cache_hash(void const *data, size_t size) {
+  unsigned char const *c = data;
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (uint64_t)c[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+} /* uint64_t types_cache_hash */
+
+static int types_cache_path(char *buffer, size_t buffer_size,
+                            char const *file) {
+  int status = snprintf(buffer, buffer_size, "%s/types-%016" PRIx64 ".cache",
+                        types_cache_dir,
+                        types_cache_hash(file, strlen(file)));
+  if ((status < 0) || ((size_t)status >= buffer_size))
+    return ENAMETOOLONG;
+  return 0;
+} /* int types_cache_path */
+
+static void types_cache_header_init(types_cache_header_t *h, char const *file,
+                                    struct stat const *st) {
+  memset(h, 0, sizeof(*h));
+  sstrncpy(h->magic, TYPES_CACHE_MAGIC, sizeof(h->magic));
+  h->version = TYPES_CACHE_VERSION;
+  h->name_size = DATA_MAX_NAME_LEN;
+  h->source_size = (uint32_t)sizeof(data_source_t);
+  h->path_hash = types_cache_hash(file, strlen(file));
+  h->file_size = (uint64_t)st->st_size;
+  h->file_ino = (uint64_t)st->st_ino;
+  h->file_mtime = (int64_t)st->st_mtime;
+} /* void types_cache_header_init */
+
+/* Checks that the "payload_size" bytes at "payload" are a sequence of
+ * "sets_num" well-formed data sets and fills "sets". */
+static int types_cache_parse(data_set_t *sets, uint32_t sets_num,
+                             char const *payload, uint64_t payload_size) {
+  uint64_t offset = 0;
+
+  for (uint32_t i = 0; i < sets_num; i++) {
+    types_cache_set_t const *cs;
+
+    if ((payload_size - offset) < sizeof(*cs))
+      return EINVAL;
+    cs = (types_cache_set_t const *)(payload + offset);
+    offset += sizeof(*cs);
+
+    if ((cs->ds_num == 0) ||
+        (cs->ds_num > (payload_size - offset) / sizeof(data_source_t)) ||
+        (memchr(cs->type, 0, sizeof(cs->type)) == NULL))
+      return EINVAL;
+
+    sets[i] = (data_set_t){
+        .ds_num = (size_t)cs->ds_num,
+        .ds = (data_source_t *)(payload + offset),
+    };
+    memcpy(sets[i].type, cs->type, sizeof(sets[i].type));
+    offset += cs->ds_num * sizeof(data_source_t);
+
+    for (size_t j = 0; j < sets[i].ds_num; j++)
+      if (memchr(sets[i].ds[j].name, 0, sizeof(sets[i].ds[j].name)) == NULL)
+        return EINVAL;
+  }
+
+  return (offset == payload_size) ? 0 : EINVAL;
+} /* int types_cache_parse */
+
+/* Registers the data sets of "file" from the cache. Returns ENOENT if there
+ * is no cache and ESTALE if the cache doesn't match "file". */
+static int types_cache_load(char const *file, struct stat const *st) {
+  char path[PATH_MAX];
+  int status = types_cache_path(path, sizeof(path), file);
+  if (status != 0)
+    return status;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return errno;
+
+  struct stat cache_st;
+  if ((fstat(fd, &cache_st) != 0) ||
+      ((size_t)cache_st.st_size < sizeof(types_cache_header_t))) {
+    close(fd);
+    return ESTALE;
+  }
+
+  size_t size = (size_t)cache_st.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return errno;
+
+  types_cache_header_t const *h = map;
+  types_cache_header_t expected;
+  types_cache_header_init(&expected, file, st);
+
+  char const *payload = (char const *)map + sizeof(*h);
+  if ((memcmp(h, &expected, offsetof(types_cache_header_t, sets_num)) != 0) ||
+      (h->path_hash != expected.path_hash) ||
+      (h->file_size != expected.file_size) ||
+      (h->file_ino != expected.file_ino) ||
+      (h->file_mtime != expected.file_mtime) ||
+      (h->payload_size != size - sizeof(*h)) ||
+      (h->payload_hash != types_cache_hash(payload, h->payload_size))) {
+    munmap(map, size);
+    return ESTALE;
+  }
+
+  data_set_t *sets = calloc(h->sets_num, sizeof(*sets));
+  if ((sets == NULL) && (h->sets_num != 0)) {
+    munmap(map, size);
+    return ENOMEM;
+  }
+
+  status = types_cache_parse(sets, h->sets_num, payload, h->payload_size);
+  if (status == 0)
+    status = plugin_register_data_sets(sets, h->sets_num);
+  if (status == 0)
+    DEBUG("types_list: Registered %" PRIu32 " data sets of `%s' from the "
+          "cache `%s'.",
+          h->sets_num, file, path);
+
+  sfree(sets);
+  munmap(map, size);
+  return (status == EINVAL) ? ESTALE : status;
+} /* int types_cache_load */
+
+static int types_cache_write(char const *file, struct stat const *st,
+                             types_list_t const *tl) {
+  char path[PATH_MAX];
+  char tmp[PATH_MAX];
+  int status = types_cache_path(path, sizeof(path), file);
+  if (status != 0)
+    return status;
+  status = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+  if ((status < 0) || ((size_t)status >= sizeof(tmp)))
+    return ENAMETOOLONG;
+
+  types_cache_header_t h;
+  types_cache_header_init(&h, file, st);
+  h.sets_num = (uint32_t)tl->sets_num;
+
+  /* Serialize the payload first; the header holds its hash. */
+  size_t payload_size = 0;
+  for (size_t i = 0; i < tl->sets_num; i++)
+    payload_size += sizeof(types_cache_set_t) +
+                    tl->sets[i].ds_num * sizeof(data_source_t);
+
+  char *payload = calloc(1, payload_size + 1);
+  if (payload == NULL)
+    return ENOMEM;
+
+  size_t offset = 0;
+  for (size_t i = 0; i < tl->sets_num; i++) {
+    types_cache_set_t cs = {.ds_num = (uint64_t)tl->sets[i].ds_num};
+    sstrncpy(cs.type, tl->sets[i].type, sizeof(cs.type));
+    memcpy(payload + offset, &cs, sizeof(cs));
+    offset += sizeof(cs);
+
+    /* Copy field by field so that padding bytes are zero and the hash is
+     * reproducible. */
+    for (size_t j = 0; j < tl->sets[i].ds_num; j++) {
+      data_source_t *dst = (data_source_t *)(payload + offset);
+      data_source_t const *src = tl->sets[i].ds + j;
+
+      sstrncpy(dst->name, src->name, sizeof(dst->name));
+      dst->type = src->type;
+      dst->min = src->min;
+      dst->max = src->max;
+      offset += sizeof(*dst);
+    }
+  }
+  h.payload_size = (uint64_t)payload_size;
+  h.payload_hash = types_cache_hash(payload, payload_size);
+
+  int fd = mkstemp(tmp);
+  if (fd < 0) {
+    status = errno;
+    sfree(payload);
+    return status;
+  }
+
+  status = 0;
+  if ((swrite(fd, &h, sizeof(h)) != 0) ||
+      (swrite(fd, payload, payload_size) != 0))
+    status = errno ? errno : EIO;
+  sfree(payload);
+
+  if ((close(fd) != 0) && (status == 0))
+    status = errno;
+  if ((status == 0) && (chmod(tmp, 0644) != 0))
+    status = errno;
+  /* rename(2) replaces the old cache atomically, so readers never see a
+   * partially written file. */
+  if ((status == 0) && (rename(tmp, path) != 0))
+    status = errno;
+  if (status != 0)
+    unlink(tmp);
+
+  return status;
+} /* int types_cache_write */
+
+int types_list_set_cache_dir(const char *dir) {
+  char *tmp = NULL;
+
+  if ((dir != NULL) && (dir[0] != 0)) {
+    tmp = strdup(dir);
+    if (tmp == NULL)
+      return ENOMEM;
+  }
+
+  sfree(types_cache_dir);
+  types_cache_dir = tmp;
+  return 0;
+} /* int types_list_set_cache_dir */
+
 int read_types_list(const char *file) {
   FILE *fh;
+  struct stat st;
+  types_list_t tl = {0};
 
   if (file == NULL)
     return -1;
@@ -180,12 +451,40 @@ int read_types_list(const char *file) {
     return -1;
   }
 
-  parse_file(fh);
+  bool use_cache = (types_cache_dir != NULL) && (fstat(fileno(fh), &st) == 0);
+  if (use_cache) {
+    int status = types_cache_load(file, &st);
+    if (status == 0) {
+      fclose(fh);
+      plugin_build_data_set_index();
+      return 0;
+    } else if ((status != ENOENT) && (status != ESTALE)) {
+      WARNING("types_list: Loading the cached data sets of `%s' from `%s' "
+              "failed: %s",
+              file, types_cache_dir, STRERROR(status));
+    }
+  }
+
+  parse_file(&tl, fh);
 
   fclose(fh);
   fh = NULL;
 
   DEBUG("Done parsing `%s'", file);
 
+  plugin_register_data_sets(tl.sets, tl.sets_num);
+
+  if (use_cache) {
+    int status = types_cache_write(file, &st, &tl);
+    if (status != 0)
+      WARNING("types_list: Writing the cached data sets of `%s' to `%s' "
+              "failed: %s",
+              file, types_cache_dir, STRERROR(status));
+  }
+
+  types_list_free(&tl);
+
+  plugin_build_data_set_index();
+
   return 0;
 } /* int read_types_list */
@@ -29,4 +29,8 @@
 
 int read_types_list(const char *file);
 
+/* Sets the directory in which read_types_list() caches the parsed data sets.
+ * NULL or an empty string disable the cache, which is the default. */
+int types_list_set_cache_dir(const char *dir);
+
 #endif /* TYPES_LIST_H */
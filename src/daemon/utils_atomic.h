@@ -0,0 +1,69 @@
+/**
+ * collectd - src/daemon/utils_atomic.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_ATOMIC_H
+#define UTILS_ATOMIC_H 1
+
+/*
+ * Thin wrappers around the compiler's atomic builtins. The C11 style
+ * "__atomic" builtins are used if available, the older "__sync" builtins
+ * otherwise. All operations are sequentially consistent unless the name says
+ * otherwise (_ACQ / _REL).
+ */
+#if HAVE_ATOMIC_BUILTINS
+#define C_ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define C_ATOMIC_LOAD_ACQ(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define C_ATOMIC_STORE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+#define C_ATOMIC_STORE_REL(ptr, val)                                           \
+  __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define C_ATOMIC_ADD(ptr, val) __atomic_add_fetch((ptr), (val), __ATOMIC_SEQ_CST)
+#define C_ATOMIC_SUB(ptr, val) __atomic_sub_fetch((ptr), (val), __ATOMIC_SEQ_CST)
+#define C_ATOMIC_CAS(ptr, expected, desired)                                   \
+  __atomic_compare_exchange_n((ptr), &(expected), (desired), /* weak = */ 0,   \
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define C_ATOMIC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define C_ATOMIC_LOAD(ptr) __sync_fetch_and_add((ptr), 0)
+#define C_ATOMIC_LOAD_ACQ(ptr) __sync_fetch_and_add((ptr), 0)
+#define C_ATOMIC_STORE(ptr, val)                                               \
+  do {                                                                         \
+    __sync_synchronize();                                                      \
+    *(ptr) = (val);                                                            \
+    __sync_synchronize();                                                      \
+  } while (0)
+#define C_ATOMIC_STORE_REL(ptr, val) C_ATOMIC_STORE(ptr, val)
+#define C_ATOMIC_ADD(ptr, val) __sync_add_and_fetch((ptr), (val))
+#define C_ATOMIC_SUB(ptr, val) __sync_sub_and_fetch((ptr), (val))
+/* Updates "expected" on failure, like the __atomic variant does. */
+#define C_ATOMIC_CAS(ptr, expected, desired)                                   \
+  ({                                                                           \
+    __typeof__(expected) prev__ =                                              \
+        __sync_val_compare_and_swap((ptr), (expected), (desired));             \
+    int ok__ = (prev__ == (expected));                                         \
+    (expected) = prev__;                                                       \
+    ok__;                                                                      \
+  })
+#define C_ATOMIC_FENCE() __sync_synchronize()
+#endif
+
+#endif /* UTILS_ATOMIC_H */
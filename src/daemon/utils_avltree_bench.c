@@ -0,0 +1,126 @@
+/**
+ * collectd - src/daemon/utils_avltree_bench.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Micro-benchmark for the c_avl_* ordered map. It is linked against both the
+ * AVL tree and the B+tree implementation:
+ *
+ *   make bench_utils_avltree bench_utils_btree
+ *   ./bench_utils_avltree [<number of keys>]
+ *   ./bench_utils_btree [<number of keys>]
+ *
+ * The keys look like value list identifiers, i.e. they share long prefixes.
+ * BENCH_SCALE scales the default number of keys, see benchmark.h.
+ */
+
+#include "collectd.h"
+
+#include "benchmark.h"
+#include "utils_avltree.h"
+
+/* Prefix of the reported benchmark names, to tell the implementations apart. */
+#ifndef BENCH_MAP
+#define BENCH_MAP "avltree"
+#endif
+
+static void bench_shuffle(char **keys, size_t num) {
+  for (size_t i = num - 1; i > 0; i--) {
+    size_t j = (size_t)rand() % (i + 1);
+    char *tmp = keys[i];
+    keys[i] = keys[j];
+    keys[j] = tmp;
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t num = (size_t)bench_iterations(1000000);
+  if (argc > 1)
+    num = (size_t)strtoull(argv[1], NULL, 10);
+  if (num == 0) {
+    fprintf(stderr, "Usage: %s [<number of keys>]\n", argv[0]);
+    return 1;
+  }
+
+  char **keys = calloc(num, sizeof(*keys));
+  if (keys == NULL)
+    return 1;
+
+  /* 1000 hosts with num/1000 metrics each. */
+  for (size_t i = 0; i < num; i++) {
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer),
+             "host%04zu.example.com/plugin%02zu-instance%zu/type%02zu-%zu",
+             i % 1000, (i / 1000) % 50, (i / 50000) % 8, (i / 1000) % 30,
+             i / 1000);
+    keys[i] = strdup(buffer);
+    if (keys[i] == NULL)
+      return 1;
+  }
+
+  srand(1);
+  bench_shuffle(keys, num);
+
+  c_avl_tree_t *t = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (t == NULL)
+    return 1;
+
+  uint64_t start = bench_now();
+  for (size_t i = 0; i < num; i++)
+    c_avl_insert(t, keys[i], keys[i]);
+  bench_report(BENCH_MAP "/insert", num, bench_now() - start);
+
+  bench_shuffle(keys, num);
+  start = bench_now();
+  size_t found = 0;
+  for (size_t i = 0; i < num; i++) {
+    void *value;
+    if (c_avl_get(t, keys[i], &value) == 0)
+      found++;
+  }
+  bench_report(BENCH_MAP "/get", num, bench_now() - start);
+  if (found != num)
+    fprintf(stderr, "Only %zu of %zu keys found!\n", found, num);
+
+  start = bench_now();
+  c_avl_iterator_t *iter = c_avl_get_iterator(t);
+  void *key;
+  void *value;
+  size_t iterated = 0;
+  while (c_avl_iterator_next(iter, &key, &value) == 0)
+    iterated++;
+  c_avl_iterator_destroy(iter);
+  bench_report(BENCH_MAP "/iterate", iterated, bench_now() - start);
+
+  bench_shuffle(keys, num);
+  start = bench_now();
+  for (size_t i = 0; i < num; i++)
+    c_avl_remove(t, keys[i], NULL, NULL);
+  bench_report(BENCH_MAP "/remove", num, bench_now() - start);
+
+  c_avl_destroy(t);
+  for (size_t i = 0; i < num; i++)
+    free(keys[i]);
+  free(keys);
+
+  return 0;
+}
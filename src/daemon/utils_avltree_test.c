@@ -131,8 +131,105 @@ DEF_TEST(success) {
   return 0;
 }
 
+static int compare_strings(void const *a, void const *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Enough entries to require several levels of inner nodes in the B+tree
+ * implementation. Runs with strcmp() and with a custom comparison function,
+ * which are handled differently by the B+tree. */
+static int check_many(int (*compare)(const void *, const void *)) {
+  size_t num = 20000;
+  char **keys;
+  char **sorted;
+  c_avl_tree_t *t;
+
+  CHECK_NOT_NULL(keys = calloc(num, sizeof(*keys)));
+  CHECK_NOT_NULL(sorted = calloc(num, sizeof(*sorted)));
+  CHECK_NOT_NULL(t = c_avl_create(compare));
+
+  srand(42);
+  for (size_t i = 0; i < num; i++) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "host%zu/cpu-%zu/cpu-%d", i % 97, i,
+             rand());
+    keys[i] = sorted[i] = strdup(buffer);
+    if (keys[i] == NULL)
+      CHECK_NOT_NULL(keys[i]);
+
+    /* Only report failures, there are too many successes. */
+    int status = c_avl_insert(t, keys[i], keys[i]);
+    if (status != 0)
+      CHECK_ZERO(status);
+  }
+  EXPECT_EQ_INT((int)num, c_avl_size(t));
+  qsort(sorted, num, sizeof(*sorted), compare_strings);
+
+  /* iterate forward and backward */
+  c_avl_iterator_t *iter;
+  char *key;
+  char *value;
+  size_t n = 0;
+
+  CHECK_NOT_NULL(iter = c_avl_get_iterator(t));
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&value) == 0) {
+    if (sorted[n] != key)
+      EXPECT_EQ_STR(sorted[n], key);
+    n++;
+  }
+  EXPECT_EQ_INT((int)num, (int)n);
+  c_avl_iterator_destroy(iter);
+
+  CHECK_NOT_NULL(iter = c_avl_get_iterator(t));
+  while (c_avl_iterator_prev(iter, (void *)&key, (void *)&value) == 0) {
+    n--;
+    if (sorted[n] != key)
+      EXPECT_EQ_STR(sorted[n], key);
+  }
+  EXPECT_EQ_INT(0, (int)n);
+  c_avl_iterator_destroy(iter);
+
+  /* remove every other key, keys are freed right away */
+  for (size_t i = 0; i < num; i += 2) {
+    int status = c_avl_remove(t, keys[i], (void *)&key, (void *)&value);
+    if (status != 0)
+      CHECK_ZERO(status);
+    if (key != keys[i])
+      OK(key == keys[i]);
+    free(key);
+    keys[i] = NULL;
+  }
+  EXPECT_EQ_INT((int)(num / 2), c_avl_size(t));
+
+  for (size_t i = 1; i < num; i += 2) {
+    value = NULL;
+    int status = c_avl_get(t, keys[i], (void *)&value);
+    if (status != 0)
+      CHECK_ZERO(status);
+    if (value != keys[i])
+      OK(value == keys[i]);
+  }
+
+  /* pick the rest */
+  while (c_avl_pick(t, (void *)&key, (void *)&value) == 0)
+    free(key);
+  EXPECT_EQ_INT(0, c_avl_size(t));
+
+  c_avl_destroy(t);
+  free(sorted);
+  free(keys);
+  return 0;
+}
+
+DEF_TEST(many) {
+  CHECK_ZERO(check_many((int (*)(const void *, const void *))strcmp));
+  CHECK_ZERO(check_many(compare_callback));
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(success);
+  RUN_TEST(many);
 
   END_TEST;
 }
@@ -0,0 +1,748 @@
+/**
+ * collectd - src/daemon/utils_btree.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * B+tree implementation of the c_avl_* interface, selected with
+ * "--enable-btree". Nodes hold up to BT_MAX keys in contiguous arrays, so a
+ * lookup touches a handful of nodes instead of one node per comparison.
+ *
+ * Trees created with strcmp() as comparison function additionally keep, per
+ * node, the length of the prefix shared by all keys of the node and the next
+ * eight bytes of every key after that prefix ("abbreviated keys"). Most
+ * comparisons are then decided by comparing two integers, without touching
+ * the key strings at all.
+ *
+ * Inner nodes don't own copies of keys: a separator points to the smallest key
+ * of the subtree to its right. When that key is removed, the separator is
+ * replaced, so separators never point to memory the caller may have freed.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils_avltree.h"
+
+#define BT_MAX 32
+#define BT_MIN (BT_MAX / 2)
+#define BT_MAX_HEIGHT 32
+
+/*
+ * private data types
+ */
+struct bt_node_s;
+typedef struct bt_node_s bt_node_t;
+struct bt_node_s {
+  bool leaf;
+  int num; /* number of keys */
+
+  size_t prefix_len;
+  /* One more than BT_MAX, so that a node can overflow before it's split. */
+  uint64_t abbrev[BT_MAX + 1];
+  void *keys[BT_MAX + 1];
+  union {
+    void *values[BT_MAX + 1];      /* leaf nodes */
+    bt_node_t *children[BT_MAX + 2]; /* inner nodes */
+  } u;
+
+  /* leaf nodes only */
+  bt_node_t *prev;
+  bt_node_t *next;
+};
+
+struct c_avl_tree_s {
+  bt_node_t *root;
+  int (*compare)(const void *, const void *);
+  bool is_strcmp;
+  int size;
+  unsigned long generation; /* incremented on each modification */
+};
+
+struct c_avl_iterator_s {
+  c_avl_tree_t *tree;
+  bt_node_t *node;
+  int index;
+  void *key; /* key returned last, NULL before the first call */
+  unsigned long generation;
+};
+
+/* Path from the root to a leaf, as recorded during a descent. */
+struct bt_path_s {
+  bt_node_t *node[BT_MAX_HEIGHT];
+  int index[BT_MAX_HEIGHT]; /* child index taken in node[i] */
+  int depth;
+};
+typedef struct bt_path_s bt_path_t;
+
+/*
+ * private functions
+ */
+/* Packs the first eight bytes of s into an integer, so that comparing two
+ * integers orders like comparing the strings with strcmp(). */
+static uint64_t bt_abbrev(const char *s) {
+  uint64_t v = 0;
+
+  for (int i = 0; i < 8; i++) {
+    unsigned char c = (unsigned char)s[i];
+    if (c == 0)
+      break;
+    v |= ((uint64_t)c) << (56 - 8 * i);
+  }
+
+  return v;
+} /* uint64_t bt_abbrev */
+
+static size_t bt_node_prefix_len(bt_node_t *n) {
+  /* The keys are sorted: the prefix shared by the first and the last key is
+   * shared by all keys. */
+  const char *first = n->keys[0];
+  const char *last = n->keys[n->num - 1];
+  size_t len = 0;
+
+  while ((first[len] != 0) && (first[len] == last[len]))
+    len++;
+
+  return len;
+} /* size_t bt_node_prefix_len */
+
+/* Recomputes the prefix and abbreviated keys of n. Must be called whenever the
+ * keys of a node change. */
+static void bt_node_refresh(c_avl_tree_t *t, bt_node_t *n) {
+  if (!t->is_strcmp || (n->num == 0))
+    return;
+
+  size_t len = bt_node_prefix_len(n);
+  n->prefix_len = len;
+
+  for (int i = 0; i < n->num; i++)
+    n->abbrev[i] = bt_abbrev((const char *)n->keys[i] + len);
+} /* void bt_node_refresh */
+
+/* Like bt_node_refresh(), after a single key has been inserted at idx. Only
+ * the new abbreviated key is computed, unless the prefix changed. */
+static void bt_node_inserted(c_avl_tree_t *t, bt_node_t *n, int idx) {
+  if (!t->is_strcmp)
+    return;
+
+  if ((n->num < 2) || (bt_node_prefix_len(n) != n->prefix_len)) {
+    bt_node_refresh(t, n);
+    return;
+  }
+
+  memmove(n->abbrev + idx + 1, n->abbrev + idx,
+          (n->num - idx - 1) * sizeof(*n->abbrev));
+  n->abbrev[idx] = bt_abbrev((const char *)n->keys[idx] + n->prefix_len);
+} /* void bt_node_inserted */
+
+/* Like bt_node_refresh(), after the key at idx has been removed. */
+static void bt_node_removed(c_avl_tree_t *t, bt_node_t *n, int idx) {
+  if (!t->is_strcmp || (n->num == 0))
+    return;
+
+  if (bt_node_prefix_len(n) != n->prefix_len) {
+    bt_node_refresh(t, n);
+    return;
+  }
+
+  memmove(n->abbrev + idx, n->abbrev + idx + 1,
+          (n->num - idx) * sizeof(*n->abbrev));
+} /* void bt_node_removed */
+
+/* Returns the index of the first key in n which is greater than or equal to
+ * key. "exact" is set if that key is equal to key. */
+static int bt_node_search(c_avl_tree_t *t, bt_node_t *n, const void *key,
+                          bool *exact) {
+  int lo = 0;
+  int hi = n->num;
+
+  *exact = false;
+
+  if (t->is_strcmp && (n->num > 0)) {
+    const char *k = key;
+    size_t len = n->prefix_len;
+
+    if (len > 0) {
+      int cmp = strncmp(k, n->keys[0], len);
+      if (cmp < 0)
+        return 0;
+      else if (cmp > 0)
+        return n->num;
+    }
+
+    uint64_t a = bt_abbrev(k + len);
+    while (lo < hi) {
+      int mid = lo + (hi - lo) / 2;
+      int cmp;
+
+      if (a < n->abbrev[mid])
+        cmp = -1;
+      else if (a > n->abbrev[mid])
+        cmp = 1;
+      else
+        cmp = strcmp(k + len, (const char *)n->keys[mid] + len);
+
+      if (cmp == 0) {
+        *exact = true;
+        return mid;
+      } else if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+    return lo;
+  }
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    int cmp = t->compare(key, n->keys[mid]);
+
+    if (cmp == 0) {
+      *exact = true;
+      return mid;
+    } else if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return lo;
+} /* int bt_node_search */
+
+/* Descends from the root to the leaf which contains, or would contain, key.
+ * Returns the position within the leaf. */
+static int bt_descend(c_avl_tree_t *t, const void *key, bt_path_t *path,
+                      bool *exact) {
+  bt_node_t *n = t->root;
+
+  path->depth = 0;
+  while (!n->leaf) {
+    bool eq;
+    int idx = bt_node_search(t, n, key, &eq);
+    if (eq)
+      idx++;
+
+    assert(path->depth < BT_MAX_HEIGHT);
+    path->node[path->depth] = n;
+    path->index[path->depth] = idx;
+    path->depth++;
+
+    n = n->u.children[idx];
+  }
+
+  path->node[path->depth] = n;
+  return bt_node_search(t, n, key, exact);
+} /* int bt_descend */
+
+static bt_node_t *bt_node_alloc(bool leaf) {
+  bt_node_t *n = calloc(1, sizeof(*n));
+  if (n == NULL)
+    return NULL;
+
+  n->leaf = leaf;
+  return n;
+} /* bt_node_t *bt_node_alloc */
+
+static void bt_node_free(bt_node_t *n) {
+  if (n == NULL)
+    return;
+
+  if (!n->leaf)
+    for (int i = 0; i <= n->num; i++)
+      bt_node_free(n->u.children[i]);
+
+  free(n);
+} /* void bt_node_free */
+
+static bt_node_t *bt_leftmost(bt_node_t *n) {
+  while (!n->leaf)
+    n = n->u.children[0];
+  return n;
+} /* bt_node_t *bt_leftmost */
+
+static bt_node_t *bt_rightmost(bt_node_t *n) {
+  while (!n->leaf)
+    n = n->u.children[n->num];
+  return n;
+} /* bt_node_t *bt_rightmost */
+
+/* Inserts key and child into inner node n, the child right of the key. */
+static void bt_inner_insert(bt_node_t *n, int idx, void *key,
+                            bt_node_t *child) {
+  memmove(n->keys + idx + 1, n->keys + idx, (n->num - idx) * sizeof(*n->keys));
+  memmove(n->u.children + idx + 2, n->u.children + idx + 1,
+          (n->num - idx) * sizeof(*n->u.children));
+  n->keys[idx] = key;
+  n->u.children[idx + 1] = child;
+  n->num++;
+} /* void bt_inner_insert */
+
+/* Splits the overflowing node n. The new right sibling is returned in
+ * "right", the key separating both in "sep". */
+static int bt_split(c_avl_tree_t *t, bt_node_t *n, bt_node_t **right,
+                    void **sep) {
+  bt_node_t *r = bt_node_alloc(n->leaf);
+  if (r == NULL)
+    return -1;
+
+  int mid = n->num / 2;
+
+  if (n->leaf) {
+    r->num = n->num - mid;
+    memcpy(r->keys, n->keys + mid, r->num * sizeof(*r->keys));
+    memcpy(r->u.values, n->u.values + mid, r->num * sizeof(*r->u.values));
+    n->num = mid;
+
+    r->next = n->next;
+    r->prev = n;
+    if (n->next != NULL)
+      n->next->prev = r;
+    n->next = r;
+
+    *sep = r->keys[0];
+  } else {
+    /* keys[mid] moves up */
+    r->num = n->num - mid - 1;
+    memcpy(r->keys, n->keys + mid + 1, r->num * sizeof(*r->keys));
+    memcpy(r->u.children, n->u.children + mid + 1,
+           (r->num + 1) * sizeof(*r->u.children));
+    *sep = n->keys[mid];
+    n->num = mid;
+  }
+
+  bt_node_refresh(t, n);
+  bt_node_refresh(t, r);
+
+  *right = r;
+  return 0;
+} /* int bt_split */
+
+/* Fixes the underflowing node path->node[level] by borrowing from or merging
+ * with a sibling. */
+static void bt_rebalance(c_avl_tree_t *t, bt_path_t *path, int level) {
+  bt_node_t *n = path->node[level];
+  bt_node_t *p = path->node[level - 1];
+  int c = path->index[level - 1];
+
+  bt_node_t *left = (c > 0) ? p->u.children[c - 1] : NULL;
+  bt_node_t *right = (c < p->num) ? p->u.children[c + 1] : NULL;
+
+  if ((left != NULL) && (left->num > BT_MIN)) {
+    /* borrow the last entry of the left sibling */
+    memmove(n->keys + 1, n->keys, n->num * sizeof(*n->keys));
+    if (n->leaf) {
+      memmove(n->u.values + 1, n->u.values, n->num * sizeof(*n->u.values));
+      n->keys[0] = left->keys[left->num - 1];
+      n->u.values[0] = left->u.values[left->num - 1];
+      p->keys[c - 1] = n->keys[0];
+    } else {
+      memmove(n->u.children + 1, n->u.children,
+              (n->num + 1) * sizeof(*n->u.children));
+      n->keys[0] = p->keys[c - 1];
+      n->u.children[0] = left->u.children[left->num];
+      p->keys[c - 1] = left->keys[left->num - 1];
+    }
+    n->num++;
+    left->num--;
+    bt_node_refresh(t, left);
+  } else if ((right != NULL) && (right->num > BT_MIN)) {
+    /* borrow the first entry of the right sibling */
+    if (n->leaf) {
+      n->keys[n->num] = right->keys[0];
+      n->u.values[n->num] = right->u.values[0];
+      memmove(right->keys, right->keys + 1,
+              (right->num - 1) * sizeof(*right->keys));
+      memmove(right->u.values, right->u.values + 1,
+              (right->num - 1) * sizeof(*right->u.values));
+      right->num--;
+      p->keys[c] = right->keys[0];
+    } else {
+      n->keys[n->num] = p->keys[c];
+      n->u.children[n->num + 1] = right->u.children[0];
+      p->keys[c] = right->keys[0];
+      memmove(right->keys, right->keys + 1,
+              (right->num - 1) * sizeof(*right->keys));
+      memmove(right->u.children, right->u.children + 1,
+              right->num * sizeof(*right->u.children));
+      right->num--;
+    }
+    n->num++;
+    bt_node_refresh(t, right);
+  } else {
+    /* merge "b" into "a" and remove p->keys[sep] and "b" from the parent */
+    bt_node_t *a = (left != NULL) ? left : n;
+    bt_node_t *b = (left != NULL) ? n : right;
+    int sep = (left != NULL) ? c - 1 : c;
+
+    assert(b != NULL);
+
+    if (a->leaf) {
+      memcpy(a->keys + a->num, b->keys, b->num * sizeof(*b->keys));
+      memcpy(a->u.values + a->num, b->u.values, b->num * sizeof(*b->u.values));
+      a->num += b->num;
+
+      a->next = b->next;
+      if (b->next != NULL)
+        b->next->prev = a;
+    } else {
+      a->keys[a->num] = p->keys[sep];
+      memcpy(a->keys + a->num + 1, b->keys, b->num * sizeof(*b->keys));
+      memcpy(a->u.children + a->num + 1, b->u.children,
+             (b->num + 1) * sizeof(*b->u.children));
+      a->num += b->num + 1;
+    }
+    free(b);
+
+    memmove(p->keys + sep, p->keys + sep + 1,
+            (p->num - sep - 1) * sizeof(*p->keys));
+    memmove(p->u.children + sep + 1, p->u.children + sep + 2,
+            (p->num - sep - 1) * sizeof(*p->u.children));
+    p->num--;
+
+    n = a;
+  }
+
+  bt_node_refresh(t, n);
+  bt_node_refresh(t, p);
+} /* void bt_rebalance */
+
+/* Replaces the separator pointing to key, if any, by the smallest key of the
+ * subtree to its right. */
+static void bt_replace_separator(c_avl_tree_t *t, const void *key) {
+  bt_node_t *n = t->root;
+
+  while ((n != NULL) && !n->leaf) {
+    bool eq;
+    int idx = bt_node_search(t, n, key, &eq);
+    if (eq) {
+      n->keys[idx] = bt_leftmost(n->u.children[idx + 1])->keys[0];
+      bt_node_refresh(t, n);
+      return;
+    }
+    n = n->u.children[idx];
+  }
+} /* void bt_replace_separator */
+
+static int bt_remove(c_avl_tree_t *t, const void *key, void **rkey,
+                     void **rvalue) {
+  bt_path_t path;
+  bool exact;
+
+  if (t->root == NULL)
+    return -1;
+
+  int idx = bt_descend(t, key, &path, &exact);
+  if (!exact)
+    return -1;
+
+  bt_node_t *leaf = path.node[path.depth];
+  void *stored_key = leaf->keys[idx];
+
+  if (rkey != NULL)
+    *rkey = stored_key;
+  if (rvalue != NULL)
+    *rvalue = leaf->u.values[idx];
+
+  memmove(leaf->keys + idx, leaf->keys + idx + 1,
+          (leaf->num - idx - 1) * sizeof(*leaf->keys));
+  memmove(leaf->u.values + idx, leaf->u.values + idx + 1,
+          (leaf->num - idx - 1) * sizeof(*leaf->u.values));
+  leaf->num--;
+  bt_node_removed(t, leaf, idx);
+
+  for (int level = path.depth; level > 0; level--) {
+    if (path.node[level]->num >= BT_MIN)
+      break;
+    bt_rebalance(t, &path, level);
+  }
+
+  bt_node_t *root = t->root;
+  if (root->leaf && (root->num == 0)) {
+    free(root);
+    t->root = NULL;
+  } else if (!root->leaf && (root->num == 0)) {
+    t->root = root->u.children[0];
+    free(root);
+  }
+
+  /* Only the smallest key of a leaf can be a separator. */
+  if ((idx == 0) && (t->root != NULL))
+    bt_replace_separator(t, stored_key);
+
+  --t->size;
+  ++t->generation;
+  return 0;
+} /* int bt_remove */
+
+/* Positions the iterator on the first key greater than (forward) or less than
+ * (!forward) iter->key. Used after the tree has been modified. */
+static void bt_iterator_seek(c_avl_iterator_t *iter, bool forward) {
+  c_avl_tree_t *t = iter->tree;
+  bt_path_t path;
+  bool exact;
+
+  if (t->root == NULL) {
+    iter->node = NULL;
+    return;
+  }
+
+  int idx = bt_descend(t, iter->key, &path, &exact);
+  bt_node_t *n = path.node[path.depth];
+
+  if (forward) {
+    /* idx points to the first key >= iter->key */
+    if (exact)
+      idx++;
+  } else {
+    /* the key before idx is the last key < iter->key */
+    idx--;
+  }
+
+  /* the entry found before the last advance */
+  iter->node = n;
+  iter->index = forward ? idx - 1 : idx + 1;
+  iter->generation = t->generation;
+} /* void bt_iterator_seek */
+
+/*
+ * public functions
+ */
+c_avl_tree_t *c_avl_create(int (*compare)(const void *, const void *)) {
+  c_avl_tree_t *t;
+
+  if (compare == NULL)
+    return NULL;
+
+  if ((t = calloc(1, sizeof(*t))) == NULL)
+    return NULL;
+
+  t->root = NULL;
+  t->compare = compare;
+  t->is_strcmp = (compare == (int (*)(const void *, const void *))strcmp);
+  t->size = 0;
+
+  return t;
+}
+
+void c_avl_destroy(c_avl_tree_t *t) {
+  if (t == NULL)
+    return;
+  bt_node_free(t->root);
+  free(t);
+}
+
+int c_avl_insert(c_avl_tree_t *t, void *key, void *value) {
+  bt_path_t path;
+  bool exact;
+
+  assert(t != NULL);
+
+  if (t->root == NULL) {
+    bt_node_t *n = bt_node_alloc(/* leaf = */ true);
+    if (n == NULL)
+      return -1;
+
+    n->keys[0] = key;
+    n->u.values[0] = value;
+    n->num = 1;
+    bt_node_refresh(t, n);
+
+    t->root = n;
+    t->size = 1;
+    ++t->generation;
+    return 0;
+  }
+
+  int idx = bt_descend(t, key, &path, &exact);
+  if (exact)
+    return 1;
+
+  bt_node_t *n = path.node[path.depth];
+  memmove(n->keys + idx + 1, n->keys + idx, (n->num - idx) * sizeof(*n->keys));
+  memmove(n->u.values + idx + 1, n->u.values + idx,
+          (n->num - idx) * sizeof(*n->u.values));
+  n->keys[idx] = key;
+  n->u.values[idx] = value;
+  n->num++;
+  bt_node_inserted(t, n, idx);
+
+  /* Split overflowing nodes bottom up. */
+  for (int level = path.depth; n->num > BT_MAX; level--) {
+    bt_node_t *right;
+    void *sep;
+
+    if (bt_split(t, n, &right, &sep) != 0)
+      return -1;
+
+    if (level == 0) {
+      bt_node_t *root = bt_node_alloc(/* leaf = */ false);
+      if (root == NULL)
+        return -1;
+
+      root->keys[0] = sep;
+      root->u.children[0] = n;
+      root->u.children[1] = right;
+      root->num = 1;
+      bt_node_refresh(t, root);
+
+      t->root = root;
+      break;
+    }
+
+    bt_node_t *p = path.node[level - 1];
+    bt_inner_insert(p, path.index[level - 1], sep, right);
+    bt_node_inserted(t, p, path.index[level - 1]);
+    n = p;
+  }
+
+  ++t->size;
+  ++t->generation;
+  return 0;
+} /* int c_avl_insert */
+
+int c_avl_remove(c_avl_tree_t *t, const void *key, void **rkey, void **rvalue) {
+  assert(t != NULL);
+
+  return bt_remove(t, key, rkey, rvalue);
+} /* int c_avl_remove */
+
+int c_avl_get(c_avl_tree_t *t, const void *key, void **value) {
+  bt_path_t path;
+  bool exact;
+
+  assert(t != NULL);
+
+  if (t->root == NULL)
+    return -1;
+
+  int idx = bt_descend(t, key, &path, &exact);
+  if (!exact)
+    return -1;
+
+  if (value != NULL)
+    *value = path.node[path.depth]->u.values[idx];
+
+  return 0;
+} /* int c_avl_get */
+
+int c_avl_pick(c_avl_tree_t *t, void **key, void **value) {
+  assert(t != NULL);
+
+  if ((key == NULL) || (value == NULL))
+    return -1;
+  if (t->root == NULL)
+    return -1;
+
+  /* The last entry is the cheapest one to remove. */
+  bt_node_t *n = bt_rightmost(t->root);
+  return bt_remove(t, n->keys[n->num - 1], key, value);
+} /* int c_avl_pick */
+
+c_avl_iterator_t *c_avl_get_iterator(c_avl_tree_t *t) {
+  c_avl_iterator_t *iter;
+
+  if (t == NULL)
+    return NULL;
+
+  iter = calloc(1, sizeof(*iter));
+  if (iter == NULL)
+    return NULL;
+  iter->tree = t;
+
+  return iter;
+} /* c_avl_iterator_t *c_avl_get_iterator */
+
+int c_avl_iterator_next(c_avl_iterator_t *iter, void **key, void **value) {
+  if ((iter == NULL) || (key == NULL) || (value == NULL))
+    return -1;
+
+  if (iter->key == NULL) {
+    if (iter->tree->root == NULL)
+      return -1;
+    iter->node = bt_leftmost(iter->tree->root);
+    iter->index = 0;
+    iter->generation = iter->tree->generation;
+  } else {
+    if (iter->generation != iter->tree->generation)
+      bt_iterator_seek(iter, /* forward = */ true);
+    if (iter->node == NULL)
+      return -1;
+    iter->index++;
+  }
+
+  while ((iter->node != NULL) && (iter->index >= iter->node->num)) {
+    iter->node = iter->node->next;
+    iter->index = 0;
+  }
+  if (iter->node == NULL)
+    return -1;
+
+  iter->key = iter->node->keys[iter->index];
+  *key = iter->key;
+  *value = iter->node->u.values[iter->index];
+
+  return 0;
+} /* int c_avl_iterator_next */
+
+int c_avl_iterator_prev(c_avl_iterator_t *iter, void **key, void **value) {
+  if ((iter == NULL) || (key == NULL) || (value == NULL))
+    return -1;
+
+  if (iter->key == NULL) {
+    if (iter->tree->root == NULL)
+      return -1;
+    iter->node = bt_rightmost(iter->tree->root);
+    iter->index = iter->node->num - 1;
+    iter->generation = iter->tree->generation;
+  } else {
+    if (iter->generation != iter->tree->generation)
+      bt_iterator_seek(iter, /* forward = */ false);
+    if (iter->node == NULL)
+      return -1;
+    iter->index--;
+  }
+
+  while ((iter->node != NULL) && (iter->index < 0)) {
+    iter->node = iter->node->prev;
+    if (iter->node != NULL)
+      iter->index = iter->node->num - 1;
+  }
+  if (iter->node == NULL)
+    return -1;
+
+  iter->key = iter->node->keys[iter->index];
+  *key = iter->key;
+  *value = iter->node->u.values[iter->index];
+
+  return 0;
+} /* int c_avl_iterator_prev */
+
+void c_avl_iterator_destroy(c_avl_iterator_t *iter) { free(iter); }
+
+int c_avl_size(c_avl_tree_t *t) {
+  if (t == NULL)
+    return 0;
+  return t->size;
+}
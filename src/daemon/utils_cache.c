@@ -31,14 +31,66 @@
 #include "common.h"
 #include "meta_data.h"
 #include "plugin.h"
-#include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_gorilla.h"
+#include "utils_memstats.h"
+#include "utils_probe.h"
 
 #include <assert.h>
 
+/* The cache is split into CACHE_SHARDS independent hash tables, each protected
+ * by its own read/write lock. An entry's shard is determined by the hash of
+ * its name, so updates of different metrics rarely contend on the same
+ * lock. */
+#ifndef CACHE_SHARDS
+#define CACHE_SHARDS 64
+#endif
+#define CACHE_SHARD_BITS 6 /* log2 (CACHE_SHARDS) */
+#define CACHE_BUCKETS_INITIAL 64
+
+/* Besides by name, each shard indexes its entries by host and by plugin, so
+ * that queries for one host or plugin only visit the matching entries. The
+ * index hash tables have as many buckets as the shard's main table. */
+enum {
+  CACHE_INDEX_HOST = 0,
+  CACHE_INDEX_PLUGIN = 1,
+  CACHE_INDEX_NUM = 2,
+};
+
+/* Each shard keeps its entries in a timing wheel, sorted by the time at which
+ * they expire, so that uc_check_timeout() only has to look at the slots that
+ * have passed since its last run. A slot covers 2^CACHE_WHEEL_SHIFT cdtime_t
+ * units (about one second). Entries which expire more than CACHE_WHEEL_SLOTS
+ * slots in the future share a slot with earlier ones and are skipped until
+ * their time has come. */
+#define CACHE_WHEEL_SLOTS 256 /* must be a power of two */
+#define CACHE_WHEEL_SHIFT 30
+
+/* How uc_update() computes the rates of an entry. Chosen once per entry from
+ * the entry's data set: entries whose data sources all have the same type use
+ * a loop without per-value branches, which the compiler can vectorize. */
+typedef enum {
+  CACHE_LAYOUT_MIXED = 0,
+  CACHE_LAYOUT_GAUGE,
+  CACHE_LAYOUT_DERIVE,
+} cache_layout_t;
+
 typedef struct cache_entry_s {
-  char name[6 * DATA_MAX_NAME_LEN];
+  struct cache_entry_s *next; /* next entry in the same hash bucket */
+  uint32_t hash;
+  /* Links and hashes of the host and plugin indexes. */
+  struct cache_entry_s *index_next[CACHE_INDEX_NUM];
+  struct cache_entry_s **index_prev[CACHE_INDEX_NUM];
+  uint32_t index_hash[CACHE_INDEX_NUM];
+  /* Links of the timing wheel and the time the entry expires at. */
+  struct cache_entry_s *wheel_next;
+  struct cache_entry_s **wheel_prev;
+  cdtime_t deadline;
   size_t values_num;
+  cache_layout_t layout;
+  /* False if no data source has a finite minimum or maximum, in which case
+   * uc_check_range() has nothing to do. */
+  bool check_range;
   gauge_t *values_gauge;
   value_t *values_raw;
   /* Time contained in the package
@@ -53,6 +105,11 @@ typedef struct cache_entry_s {
   int state;
   int hits;
 
+  /* Threshold configuration resolved for this entry by utils_threshold and
+   * the threshold generation it is valid for; zero if not resolved yet. */
+  void *threshold;
+  uint64_t threshold_generation;
+
   /*
    * +-----+-----+-----+-----+-----+-----+-----+-----+-----+----
    * !  0  !  1  !  2  !  3  !  4  !  5  !  6  !  7  !  8  ! ...
@@ -66,34 +123,457 @@ typedef struct cache_entry_s {
   size_t history_index; /* points to the next position to write to. */
   size_t history_length;
 
+  /* Compressed copy of the gauge values of the last "history_retention"
+   * seconds. NULL if disabled. */
+  gorilla_t *series;
+
   meta_data_t *meta;
+
+  /* Allocated to fit: typical names are a fraction of the maximum size. */
+  char name[];
 } cache_entry_t;
 
+typedef struct cache_shard_s {
+  pthread_rwlock_t lock;
+  cache_entry_t **buckets;
+  cache_entry_t **index[CACHE_INDEX_NUM];
+  size_t buckets_num; /* always a power of two */
+  size_t entries_num;
+  cache_entry_t *wheel[CACHE_WHEEL_SLOTS];
+  cdtime_t wheel_time; /* time of the last uc_check_timeout() run */
+} cache_shard_t;
+
 struct uc_iter_s {
-  c_avl_iterator_t *iter;
+  cache_entry_t **entries;
+  size_t entries_num;
+  size_t index; /* index of the next entry */
 
   char *name;
   cache_entry_t *entry;
 };
 
-static c_avl_tree_t *cache_tree;
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+/* The rates most recently computed by uc_update() in this thread. The write
+ * callbacks usually run in the thread that dispatched the value list, so
+ * uc_get_rate() can answer from here without taking the shard lock. */
+typedef struct {
+  uint32_t hash; /* zero if the memo is empty */
+  char name[6 * DATA_MAX_NAME_LEN];
+  cdtime_t time;
+  size_t values_num;
+  gauge_t *values;
+  size_t values_size;
+} rate_memo_t;
 
-static int cache_compare(const cache_entry_t *a, const cache_entry_t *b) {
-#if COLLECT_DEBUG
-  assert((a != NULL) && (b != NULL));
-#endif
-  return strcmp(a->name, b->name);
-} /* int cache_compare */
+static cache_shard_t cache_shards[CACHE_SHARDS];
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t rate_memo_key;
+static bool rate_memo_key_initialized;
+
+static cdtime_t history_retention;
+
+/* Memory of the entries and hash tables, and of the entries' history. */
+static memstat_t *cache_memstat;
+static memstat_t *history_memstat;
+
+static void rate_memo_free(void *arg) {
+  rate_memo_t *memo = arg;
+
+  if (memo == NULL)
+    return;
+
+  sfree(memo->values);
+  sfree(memo);
+} /* void rate_memo_free */
+
+static void cache_init_once(void) {
+  cache_memstat = memstat_get("cache");
+  history_memstat = memstat_get("cache_history");
+
+  for (size_t i = 0; i < CACHE_SHARDS; i++) {
+    pthread_rwlock_init(&cache_shards[i].lock, /* attr = */ NULL);
+    cache_shards[i].buckets = NULL;
+    cache_shards[i].buckets_num = 0;
+    cache_shards[i].entries_num = 0;
+  }
+
+  rate_memo_key_initialized =
+      (pthread_key_create(&rate_memo_key, rate_memo_free) == 0);
+} /* void cache_init_once */
+
+/* Remembers the rates of "ce" for this thread. Must be called with the shard
+ * lock held. */
+static void rate_memo_set(cache_entry_t const *ce, cdtime_t time) {
+  if (!rate_memo_key_initialized)
+    return;
+
+  rate_memo_t *memo = pthread_getspecific(rate_memo_key);
+  if (memo == NULL) {
+    memo = calloc(1, sizeof(*memo));
+    if (memo == NULL)
+      return;
+    if (pthread_setspecific(rate_memo_key, memo) != 0) {
+      sfree(memo);
+      return;
+    }
+  }
+
+  memo->hash = 0;
+  if (ce->state == STATE_MISSING)
+    return;
+
+  if (memo->values_size < ce->values_num) {
+    gauge_t *tmp = realloc(memo->values, ce->values_num * sizeof(*tmp));
+    if (tmp == NULL)
+      return;
+    memo->values = tmp;
+    memo->values_size = ce->values_num;
+  }
+
+  memcpy(memo->values, ce->values_gauge, ce->values_num * sizeof(gauge_t));
+  memo->values_num = ce->values_num;
+  memo->time = time;
+  sstrncpy(memo->name, ce->name, sizeof(memo->name));
+  memo->hash = ce->hash;
+} /* void rate_memo_set */
+
+/* Returns a copy of the memoized rates if they belong to this name and time,
+ * NULL otherwise. */
+static gauge_t *rate_memo_get(uint32_t hash, const char *name, cdtime_t time,
+                              size_t values_num) {
+  if (!rate_memo_key_initialized)
+    return NULL;
+
+  rate_memo_t *memo = pthread_getspecific(rate_memo_key);
+  if ((memo == NULL) || (memo->hash != hash) || (memo->time != time) ||
+      (memo->values_num != values_num) || (strcmp(memo->name, name) != 0))
+    return NULL;
+
+  gauge_t *ret = malloc(values_num * sizeof(*ret));
+  if (ret == NULL)
+    return NULL;
+  memcpy(ret, memo->values, values_num * sizeof(*ret));
+  return ret;
+} /* gauge_t *rate_memo_get */
+
+/* Returns the cache key of "vl" and (optionally) its hash. The interned
+ * identifier of the value list is used if it has been computed, otherwise the
+ * name is formatted into "buffer". Returns NULL on error. */
+static const char *uc_key(const value_list_t *vl, char *buffer,
+                          size_t buffer_size, uint32_t *ret_hash) {
+  if (vl->identifier.hash != 0) {
+    if (ret_hash != NULL)
+      *ret_hash = vl->identifier.hash;
+    return vl->identifier.name;
+  }
+
+  if (FORMAT_VL(buffer, buffer_size, vl) != 0)
+    return NULL;
+
+  if (ret_hash != NULL)
+    *ret_hash = identifier_hash(buffer);
+  return buffer;
+} /* const char *uc_key */
+
+static cache_shard_t *cache_shard(uint32_t hash) {
+  pthread_once(&cache_once, cache_init_once);
+  return cache_shards + (hash & (CACHE_SHARDS - 1));
+} /* cache_shard_t *cache_shard */
+
+/* The lowest CACHE_SHARD_BITS bits select the shard, so don't use them to
+ * select the bucket, too. */
+static size_t cache_bucket(cache_shard_t const *shard, uint32_t hash) {
+  return (size_t)(hash >> CACHE_SHARD_BITS) & (shard->buckets_num - 1);
+} /* size_t cache_bucket */
+
+/* Must be called with the shard's lock held. */
+static cache_entry_t *cache_lookup(cache_shard_t const *shard, uint32_t hash,
+                                   const char *name) {
+  if (shard->buckets == NULL)
+    return NULL;
+
+  for (cache_entry_t *ce = shard->buckets[cache_bucket(shard, hash)];
+       ce != NULL; ce = ce->next) {
+    if ((ce->hash == hash) && (strcmp(ce->name, name) == 0))
+      return ce;
+  }
+
+  return NULL;
+} /* cache_entry_t *cache_lookup */
+
+/* Returns the host ("which" is CACHE_INDEX_HOST) or plugin name of the
+ * entry called "name" in "ret_key", which is not null-terminated, and its
+ * length. */
+static size_t cache_index_key(const char *name, int which,
+                              const char **ret_key) {
+  size_t host_len = strcspn(name, "/");
+  if (which == CACHE_INDEX_HOST) {
+    *ret_key = name;
+    return host_len;
+  }
+
+  const char *plugin = name + host_len;
+  if (*plugin == '/')
+    plugin++;
+  *ret_key = plugin;
+  return strcspn(plugin, "-/");
+} /* size_t cache_index_key */
+
+static uint32_t cache_index_hash(const char *key, size_t key_len) {
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < key_len; i++) {
+    hash ^= (uint32_t)(unsigned char)key[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+} /* uint32_t cache_index_hash */
+
+/* Returns true if "ce" belongs to "host" and "plugin". NULL matches any. */
+static bool cache_index_matches(cache_entry_t const *ce, const char *host,
+                                const char *plugin) {
+  const char *filter[CACHE_INDEX_NUM] = {host, plugin};
+
+  for (int i = 0; i < CACHE_INDEX_NUM; i++) {
+    if (filter[i] == NULL)
+      continue;
+
+    const char *key;
+    size_t key_len = cache_index_key(ce->name, i, &key);
+    if ((strlen(filter[i]) != key_len) ||
+        (strncmp(filter[i], key, key_len) != 0))
+      return false;
+  }
+
+  return true;
+} /* bool cache_index_matches */
+
+/* Must be called with the shard's write lock held. */
+static void cache_index_link(cache_shard_t *shard, cache_entry_t *ce) {
+  for (int i = 0; i < CACHE_INDEX_NUM; i++) {
+    cache_entry_t **head =
+        shard->index[i] + (ce->index_hash[i] & (shard->buckets_num - 1));
+
+    ce->index_next[i] = *head;
+    ce->index_prev[i] = head;
+    if (*head != NULL)
+      (*head)->index_prev[i] = &ce->index_next[i];
+    *head = ce;
+  }
+} /* void cache_index_link */
+
+/* Must be called with the shard's write lock held. */
+static void cache_index_unlink(cache_entry_t *ce) {
+  for (int i = 0; i < CACHE_INDEX_NUM; i++) {
+    *ce->index_prev[i] = ce->index_next[i];
+    if (ce->index_next[i] != NULL)
+      ce->index_next[i]->index_prev[i] = ce->index_prev[i];
+    ce->index_next[i] = NULL;
+    ce->index_prev[i] = NULL;
+  }
+} /* void cache_index_unlink */
+
+static size_t cache_wheel_slot(cdtime_t t) {
+  return (size_t)(t >> CACHE_WHEEL_SHIFT) & (CACHE_WHEEL_SLOTS - 1);
+} /* size_t cache_wheel_slot */
+
+/* Must be called with the shard's write lock held. */
+static void cache_wheel_unlink(cache_entry_t *ce) {
+  if (ce->wheel_prev == NULL)
+    return;
+
+  *ce->wheel_prev = ce->wheel_next;
+  if (ce->wheel_next != NULL)
+    ce->wheel_next->wheel_prev = ce->wheel_prev;
+  ce->wheel_next = NULL;
+  ce->wheel_prev = NULL;
+} /* void cache_wheel_unlink */
+
+/* Recomputes the deadline of "ce" from "last_update" and "interval" and moves
+ * it to the matching slot. Must be called with the shard's write lock held. */
+static void cache_wheel_update(cache_shard_t *shard, cache_entry_t *ce) {
+  cdtime_t deadline = ce->last_update + ce->interval * timeout_g;
+
+  if ((ce->wheel_prev != NULL) &&
+      (cache_wheel_slot(deadline) == cache_wheel_slot(ce->deadline))) {
+    ce->deadline = deadline;
+    return;
+  }
+
+  cache_wheel_unlink(ce);
+
+  cache_entry_t **head = shard->wheel + cache_wheel_slot(deadline);
+  ce->deadline = deadline;
+  ce->wheel_next = *head;
+  ce->wheel_prev = head;
+  if (*head != NULL)
+    (*head)->wheel_prev = &ce->wheel_next;
+  *head = ce;
+} /* void cache_wheel_update */
+
+/* Must be called with the shard's write lock held. */
+static int cache_shard_grow(cache_shard_t *shard) {
+  size_t new_num = (shard->buckets_num == 0) ? CACHE_BUCKETS_INITIAL
+                                             : 2 * shard->buckets_num;
+  cache_entry_t **new_buckets = calloc(new_num, sizeof(*new_buckets));
+  cache_entry_t **new_index[CACHE_INDEX_NUM];
+  bool failed = (new_buckets == NULL);
+  for (int i = 0; i < CACHE_INDEX_NUM; i++) {
+    new_index[i] = calloc(new_num, sizeof(*new_index[i]));
+    if (new_index[i] == NULL)
+      failed = true;
+  }
+  if (failed) {
+    free(new_buckets);
+    for (int i = 0; i < CACHE_INDEX_NUM; i++)
+      free(new_index[i]);
+    return ENOMEM;
+  }
+
+  cache_entry_t **old_buckets = shard->buckets;
+  size_t old_num = shard->buckets_num;
+
+  shard->buckets = new_buckets;
+  shard->buckets_num = new_num;
+  for (int i = 0; i < CACHE_INDEX_NUM; i++) {
+    free(shard->index[i]);
+    shard->index[i] = new_index[i];
+  }
+
+  for (size_t i = 0; i < old_num; i++) {
+    cache_entry_t *ce = old_buckets[i];
+    while (ce != NULL) {
+      cache_entry_t *next = ce->next;
+      size_t b = cache_bucket(shard, ce->hash);
+
+      ce->next = new_buckets[b];
+      new_buckets[b] = ce;
+      cache_index_link(shard, ce);
+      ce = next;
+    }
+  }
+
+  free(old_buckets);
+  memstat_add(cache_memstat,
+              (int64_t)((new_num - old_num) * sizeof(*new_buckets) *
+                        (1 + CACHE_INDEX_NUM)),
+              0);
+  return 0;
+} /* int cache_shard_grow */
+
+/* Must be called with the shard's write lock held. */
+static int cache_shard_insert(cache_shard_t *shard, cache_entry_t *ce) {
+  /* Keep the average chain length below two. */
+  if ((shard->buckets == NULL) ||
+      (shard->entries_num >= 2 * shard->buckets_num)) {
+    if ((cache_shard_grow(shard) != 0) && (shard->buckets == NULL))
+      return ENOMEM;
+  }
+
+  size_t b = cache_bucket(shard, ce->hash);
+  ce->next = shard->buckets[b];
+  shard->buckets[b] = ce;
+  shard->entries_num++;
+
+  for (int i = 0; i < CACHE_INDEX_NUM; i++) {
+    const char *key;
+    size_t key_len = cache_index_key(ce->name, i, &key);
+    ce->index_hash[i] = cache_index_hash(key, key_len);
+  }
+  cache_index_link(shard, ce);
+  cache_wheel_update(shard, ce);
+
+  return 0;
+} /* int cache_shard_insert */
+
+/* Must be called with the shard's write lock held. */
+static cache_entry_t *cache_shard_remove(cache_shard_t *shard, uint32_t hash,
+                                         const char *name) {
+  if (shard->buckets == NULL)
+    return NULL;
 
-static cache_entry_t *cache_alloc(size_t values_num) {
+  cache_entry_t **prev = shard->buckets + cache_bucket(shard, hash);
+  for (cache_entry_t *ce = *prev; ce != NULL; prev = &ce->next, ce = *prev) {
+    if ((ce->hash != hash) || (strcmp(ce->name, name) != 0))
+      continue;
+
+    *prev = ce->next;
+    ce->next = NULL;
+    cache_index_unlink(ce);
+    cache_wheel_unlink(ce);
+    shard->entries_num--;
+    return ce;
+  }
+
+  return NULL;
+} /* cache_entry_t *cache_shard_remove */
+
+/* Calls "callback" for each entry of "shard" which belongs to "host" and
+ * "plugin" (NULL matches any) and is not missing. Uses the host or plugin
+ * index if possible. Must be called with the shard's lock held. */
+static int cache_shard_walk(cache_shard_t const *shard, const char *host,
+                            const char *plugin,
+                            int (*callback)(cache_entry_t const *ce,
+                                            void *user_data),
+                            void *user_data) {
+  if (shard->buckets == NULL)
+    return 0;
+
+  int which = (host != NULL) ? CACHE_INDEX_HOST
+                             : (plugin != NULL) ? CACHE_INDEX_PLUGIN : -1;
+  if (which < 0) {
+    for (size_t b = 0; b < shard->buckets_num; b++) {
+      for (cache_entry_t *ce = shard->buckets[b]; ce != NULL; ce = ce->next) {
+        if (ce->state == STATE_MISSING)
+          continue;
+        int status = callback(ce, user_data);
+        if (status != 0)
+          return status;
+      }
+    }
+    return 0;
+  }
+
+  const char *key = (which == CACHE_INDEX_HOST) ? host : plugin;
+  uint32_t hash = cache_index_hash(key, strlen(key));
+  for (cache_entry_t *ce =
+           shard->index[which][hash & (shard->buckets_num - 1)];
+       ce != NULL; ce = ce->index_next[which]) {
+    if ((ce->index_hash[which] != hash) || (ce->state == STATE_MISSING) ||
+        !cache_index_matches(ce, host, plugin))
+      continue;
+    int status = callback(ce, user_data);
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+} /* int cache_shard_walk */
+
+static int cache_entry_compare(const void *a, const void *b) {
+  cache_entry_t const *ce_a = *((cache_entry_t *const *)a);
+  cache_entry_t const *ce_b = *((cache_entry_t *const *)b);
+
+  return strcmp(ce_a->name, ce_b->name);
+} /* int cache_entry_compare */
+
+/* The memory of the entry itself, without its history and meta data. */
+static int64_t cache_entry_bytes(cache_entry_t const *ce) {
+  return (int64_t)(sizeof(*ce) + strlen(ce->name) + 1 +
+                   ce->values_num *
+                       (sizeof(*ce->values_gauge) + sizeof(*ce->values_raw)));
+} /* int64_t cache_entry_bytes */
+
+static cache_entry_t *cache_alloc(const char *name, size_t values_num) {
   cache_entry_t *ce;
+  size_t name_size = strlen(name) + 1;
 
-  ce = calloc(1, sizeof(*ce));
+  ce = calloc(1, sizeof(*ce) + name_size);
   if (ce == NULL) {
     ERROR("utils_cache: cache_alloc: calloc failed.");
     return NULL;
   }
+  memcpy(ce->name, name, name_size);
   ce->values_num = values_num;
 
   ce->values_gauge = calloc(values_num, sizeof(*ce->values_gauge));
@@ -110,6 +590,7 @@ static cache_entry_t *cache_alloc(size_t values_num) {
   ce->history_length = 0;
   ce->meta = NULL;
 
+  memstat_add(cache_memstat, cache_entry_bytes(ce), 1);
   return ce;
 } /* cache_entry_t *cache_alloc */
 
@@ -117,9 +598,17 @@ static void cache_free(cache_entry_t *ce) {
   if (ce == NULL)
     return;
 
+  memstat_add(cache_memstat, -cache_entry_bytes(ce), -1);
+  memstat_add(history_memstat,
+              -(int64_t)(ce->history_length * ce->values_num *
+                         sizeof(*ce->history)) -
+                  (int64_t)gorilla_bytes(ce->series),
+              0);
+
   sfree(ce->values_gauge);
   sfree(ce->values_raw);
   sfree(ce->history);
+  gorilla_destroy(ce->series);
   if (ce->meta != NULL) {
     meta_data_destroy(ce->meta);
     ce->meta = NULL;
@@ -128,6 +617,9 @@ static void cache_free(cache_entry_t *ce) {
 } /* void cache_free */
 
 static void uc_check_range(const data_set_t *ds, cache_entry_t *ce) {
+  if (!ce->check_range)
+    return;
+
   for (size_t i = 0; i < ds->ds_num; i++) {
     if (isnan(ce->values_gauge[i]))
       continue;
@@ -138,27 +630,98 @@ static void uc_check_range(const data_set_t *ds, cache_entry_t *ce) {
   }
 } /* void uc_check_range */
 
-static int uc_insert(const data_set_t *ds, const value_list_t *vl,
-                     const char *key) {
-  char *key_copy;
-  cache_entry_t *ce;
+static void cache_layout_init(cache_entry_t *ce, const data_set_t *ds) {
+  bool all_gauge = true;
+  bool all_derive = true;
 
-  /* `cache_lock' has been locked by `uc_update' */
+  ce->check_range = false;
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    all_gauge = all_gauge && (ds->ds[i].type == DS_TYPE_GAUGE);
+    all_derive = all_derive && (ds->ds[i].type == DS_TYPE_DERIVE);
+    /* Comparisons with NAN are false, so NAN limits never prune. */
+    if ((ds->ds[i].min > -INFINITY) || (ds->ds[i].max < INFINITY))
+      ce->check_range = true;
+  }
 
-  key_copy = strdup(key);
-  if (key_copy == NULL) {
-    ERROR("uc_insert: strdup failed.");
-    return -1;
+  if (all_gauge)
+    ce->layout = CACHE_LAYOUT_GAUGE;
+  else if (all_derive)
+    ce->layout = CACHE_LAYOUT_DERIVE;
+  else
+    ce->layout = CACHE_LAYOUT_MIXED;
+} /* void cache_layout_init */
+
+static void uc_update_gauge(size_t n, gauge_t *restrict rates,
+                            value_t *restrict raw,
+                            value_t const *restrict values) {
+  for (size_t i = 0; i < n; i++) {
+    raw[i].gauge = values[i].gauge;
+    rates[i] = values[i].gauge;
+  }
+} /* void uc_update_gauge */
+
+static void uc_update_derive(size_t n, gauge_t *restrict rates,
+                             value_t *restrict raw,
+                             value_t const *restrict values,
+                             double interval) {
+  for (size_t i = 0; i < n; i++) {
+    rates[i] = ((double)(values[i].derive - raw[i].derive)) / interval;
+    raw[i].derive = values[i].derive;
   }
+} /* void uc_update_derive */
+
+static int uc_update_mixed(const data_set_t *ds, cache_entry_t *ce,
+                           const value_list_t *vl, double interval) {
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    switch (ds->ds[i].type) {
+    case DS_TYPE_COUNTER: {
+      counter_t diff =
+          counter_diff(ce->values_raw[i].counter, vl->values[i].counter);
+      ce->values_gauge[i] = ((double)diff) / interval;
+      ce->values_raw[i].counter = vl->values[i].counter;
+    } break;
 
-  ce = cache_alloc(ds->ds_num);
+    case DS_TYPE_GAUGE:
+      ce->values_raw[i].gauge = vl->values[i].gauge;
+      ce->values_gauge[i] = vl->values[i].gauge;
+      break;
+
+    case DS_TYPE_DERIVE: {
+      derive_t diff = vl->values[i].derive - ce->values_raw[i].derive;
+
+      ce->values_gauge[i] = ((double)diff) / interval;
+      ce->values_raw[i].derive = vl->values[i].derive;
+    } break;
+
+    case DS_TYPE_ABSOLUTE:
+      ce->values_gauge[i] = ((double)vl->values[i].absolute) / interval;
+      ce->values_raw[i].absolute = vl->values[i].absolute;
+      break;
+
+    default:
+      /* This shouldn't happen. */
+      ERROR("uc_update: Don't know how to handle data source type %i.",
+            ds->ds[i].type);
+      return -1;
+    } /* switch (ds->ds[i].type) */
+  }   /* for (i) */
+
+  return 0;
+} /* int uc_update_mixed */
+
+static int uc_insert(cache_shard_t *shard, const data_set_t *ds,
+                     const value_list_t *vl, const char *key, uint32_t hash) {
+  cache_entry_t *ce;
+
+  /* The shard's write lock has been acquired by `uc_update' */
+
+  ce = cache_alloc(key, ds->ds_num);
   if (ce == NULL) {
-    sfree(key_copy);
     ERROR("uc_insert: cache_alloc (%" PRIsz ") failed.", ds->ds_num);
     return -1;
   }
-
-  sstrncpy(ce->name, key, sizeof(ce->name));
+  ce->hash = hash;
+  cache_layout_init(ce, ds);
 
   for (size_t i = 0; i < ds->ds_num; i++) {
     switch (ds->ds[i].type) {
@@ -189,7 +752,6 @@ static int uc_insert(const data_set_t *ds, const value_list_t *vl,
       /* This shouldn't happen. */
       ERROR("uc_insert: Don't know how to handle data source type %i.",
             ds->ds[i].type);
-      sfree(key_copy);
       cache_free(ce);
       return -1;
     } /* switch (ds->ds[i].type) */
@@ -203,20 +765,28 @@ static int uc_insert(const data_set_t *ds, const value_list_t *vl,
   ce->interval = vl->interval;
   ce->state = STATE_OKAY;
 
-  if (c_avl_insert(cache_tree, key_copy, ce) != 0) {
-    sfree(key_copy);
-    ERROR("uc_insert: c_avl_insert failed.");
+  if (history_retention > 0) {
+    ce->series = gorilla_create(ce->values_num);
+    if (ce->series == NULL)
+      ERROR("uc_insert: gorilla_create failed.");
+    else
+      gorilla_append(ce->series, vl->time, ce->values_gauge);
+    memstat_add(history_memstat, (int64_t)gorilla_bytes(ce->series), 0);
+  }
+
+  if (cache_shard_insert(shard, ce) != 0) {
+    cache_free(ce);
+    ERROR("uc_insert: cache_shard_insert failed.");
     return -1;
   }
+  rate_memo_set(ce, vl->time);
 
   DEBUG("uc_insert: Added %s to the cache.", key);
   return 0;
 } /* int uc_insert */
 
 int uc_init(void) {
-  if (cache_tree == NULL)
-    cache_tree =
-        c_avl_create((int (*)(const void *, const void *))cache_compare);
+  pthread_once(&cache_once, cache_init_once);
 
   return 0;
 } /* int uc_init */
@@ -229,39 +799,61 @@ int uc_check_timeout(void) {
   } *expired = NULL;
   size_t expired_num = 0;
 
-  pthread_mutex_lock(&cache_lock);
+  size_t expired_size = 0;
+
+  pthread_once(&cache_once, cache_init_once);
   cdtime_t now = cdtime();
 
-  /* Build a list of entries to be flushed */
-  c_avl_iterator_t *iter = c_avl_get_iterator(cache_tree);
-  char *key = NULL;
-  cache_entry_t *ce = NULL;
-  while (c_avl_iterator_next(iter, (void *)&key, (void *)&ce) == 0) {
-    /* If the entry is fresh enough, continue. */
-    if ((now - ce->last_update) < (ce->interval * timeout_g))
-      continue;
+  /* Build a list of entries to be flushed. Only the wheel slots which have
+   * passed since the last run need to be looked at. */
+  for (size_t s = 0; s < CACHE_SHARDS; s++) {
+    cache_shard_t *shard = cache_shards + s;
 
-    void *tmp = realloc(expired, (expired_num + 1) * sizeof(*expired));
-    if (tmp == NULL) {
-      ERROR("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    expired = tmp;
-
-    expired[expired_num].key = strdup(key);
-    expired[expired_num].time = ce->last_time;
-    expired[expired_num].interval = ce->interval;
+    pthread_rwlock_wrlock(&shard->lock);
 
-    if (expired[expired_num].key == NULL) {
-      ERROR("uc_check_timeout: strdup failed.");
-      continue;
+    size_t first = cache_wheel_slot(shard->wheel_time);
+    size_t slots_num = CACHE_WHEEL_SLOTS;
+    if ((shard->wheel_time != 0) && (shard->wheel_time <= now)) {
+      cdtime_t passed =
+          (now >> CACHE_WHEEL_SHIFT) - (shard->wheel_time >> CACHE_WHEEL_SHIFT);
+      if (passed < CACHE_WHEEL_SLOTS)
+        slots_num = (size_t)passed + 1;
     }
-
-    expired_num++;
-  } /* while (c_avl_iterator_next) */
-
-  c_avl_iterator_destroy(iter);
-  pthread_mutex_unlock(&cache_lock);
+    shard->wheel_time = now;
+
+    for (size_t n = 0; n < slots_num; n++) {
+      size_t slot = (first + n) & (CACHE_WHEEL_SLOTS - 1);
+      for (cache_entry_t *ce = shard->wheel[slot]; ce != NULL;
+           ce = ce->wheel_next) {
+        /* If the entry is fresh enough, continue. */
+        if (ce->deadline > now)
+          continue;
+
+        if (expired_num >= expired_size) {
+          size_t new_size = (expired_size == 0) ? 16 : 2 * expired_size;
+          void *tmp = realloc(expired, new_size * sizeof(*expired));
+          if (tmp == NULL) {
+            ERROR("uc_check_timeout: realloc failed.");
+            continue;
+          }
+          expired = tmp;
+          expired_size = new_size;
+        }
+
+        expired[expired_num].key = strdup(ce->name);
+        expired[expired_num].time = ce->last_time;
+        expired[expired_num].interval = ce->interval;
+
+        if (expired[expired_num].key == NULL) {
+          ERROR("uc_check_timeout: strdup failed.");
+          continue;
+        }
+
+        expired_num++;
+      }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+  } /* for (s = 0; s < CACHE_SHARDS; s++) */
 
   if (expired_num == 0) {
     sfree(expired);
@@ -287,48 +879,59 @@ int uc_check_timeout(void) {
     plugin_dispatch_missing(&vl);
   } /* for (i = 0; i < expired_num; i++) */
 
-  /* Now actually remove all the values from the cache. We don't re-evaluate
-   * the timestamp again, so in theory it is possible we remove a value after
-   * it is updated here. */
-  pthread_mutex_lock(&cache_lock);
+  /* Now actually remove all the values from the cache. Entries which have
+   * been updated in the meantime are kept. */
   for (size_t i = 0; i < expired_num; i++) {
-    char *key = NULL;
-    cache_entry_t *value = NULL;
+    uint32_t hash = identifier_hash(expired[i].key);
+    cache_shard_t *shard = cache_shard(hash);
 
-    if (c_avl_remove(cache_tree, expired[i].key, (void *)&key,
-                     (void *)&value) != 0) {
-      ERROR("uc_check_timeout: c_avl_remove (\"%s\") failed.", expired[i].key);
+    pthread_rwlock_wrlock(&shard->lock);
+    cache_entry_t *ce = cache_lookup(shard, hash, expired[i].key);
+    if ((ce != NULL) && (ce->deadline > now)) {
+      pthread_rwlock_unlock(&shard->lock);
       sfree(expired[i].key);
       continue;
     }
-    sfree(key);
-    cache_free(value);
+    ce = cache_shard_remove(shard, hash, expired[i].key);
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (ce == NULL) {
+      ERROR("uc_check_timeout: cache_shard_remove (\"%s\") failed.",
+            expired[i].key);
+      sfree(expired[i].key);
+      continue;
+    }
+    cache_free(ce);
 
     sfree(expired[i].key);
   } /* for (i = 0; i < expired_num; i++) */
-  pthread_mutex_unlock(&cache_lock);
 
   sfree(expired);
   return 0;
 } /* int uc_check_timeout */
 
 int uc_update(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
   int status;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL) {
     ERROR("uc_update: FORMAT_VL failed.");
     return -1;
   }
+  C_PROBE1(cache__update, name);
+
+  cache_shard_t *shard = cache_shard(hash);
 
-  pthread_mutex_lock(&cache_lock);
+  pthread_rwlock_wrlock(&shard->lock);
 
-  status = c_avl_get(cache_tree, name, (void *)&ce);
-  if (status != 0) /* entry does not yet exist */
+  ce = cache_lookup(shard, hash, name);
+  if (ce == NULL) /* entry does not yet exist */
   {
-    status = uc_insert(ds, vl, name);
-    pthread_mutex_unlock(&cache_lock);
+    status = uc_insert(shard, ds, vl, name, hash);
+    pthread_rwlock_unlock(&shard->lock);
     return status;
   }
 
@@ -336,7 +939,7 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
   assert(ce->values_num == ds->ds_num);
 
   if (ce->last_time >= vl->time) {
-    pthread_mutex_unlock(&cache_lock);
+    pthread_rwlock_unlock(&shard->lock);
     NOTICE("uc_update: Value too old: name = %s; value time = %.3f; "
            "last cache update = %.3f;",
            name, CDTIME_T_TO_DOUBLE(vl->time),
@@ -344,45 +947,26 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
     return -1;
   }
 
-  for (size_t i = 0; i < ds->ds_num; i++) {
-    switch (ds->ds[i].type) {
-    case DS_TYPE_COUNTER: {
-      counter_t diff =
-          counter_diff(ce->values_raw[i].counter, vl->values[i].counter);
-      ce->values_gauge[i] =
-          ((double)diff) / (CDTIME_T_TO_DOUBLE(vl->time - ce->last_time));
-      ce->values_raw[i].counter = vl->values[i].counter;
-    } break;
-
-    case DS_TYPE_GAUGE:
-      ce->values_raw[i].gauge = vl->values[i].gauge;
-      ce->values_gauge[i] = vl->values[i].gauge;
-      break;
-
-    case DS_TYPE_DERIVE: {
-      derive_t diff = vl->values[i].derive - ce->values_raw[i].derive;
-
-      ce->values_gauge[i] =
-          ((double)diff) / (CDTIME_T_TO_DOUBLE(vl->time - ce->last_time));
-      ce->values_raw[i].derive = vl->values[i].derive;
-    } break;
-
-    case DS_TYPE_ABSOLUTE:
-      ce->values_gauge[i] = ((double)vl->values[i].absolute) /
-                            (CDTIME_T_TO_DOUBLE(vl->time - ce->last_time));
-      ce->values_raw[i].absolute = vl->values[i].absolute;
-      break;
-
-    default:
-      /* This shouldn't happen. */
-      pthread_mutex_unlock(&cache_lock);
-      ERROR("uc_update: Don't know how to handle data source type %i.",
-            ds->ds[i].type);
+  double interval = CDTIME_T_TO_DOUBLE(vl->time - ce->last_time);
+  switch (ce->layout) {
+  case CACHE_LAYOUT_GAUGE:
+    uc_update_gauge(ce->values_num, ce->values_gauge, ce->values_raw,
+                    vl->values);
+    break;
+  case CACHE_LAYOUT_DERIVE:
+    uc_update_derive(ce->values_num, ce->values_gauge, ce->values_raw,
+                     vl->values, interval);
+    break;
+  case CACHE_LAYOUT_MIXED:
+    if (uc_update_mixed(ds, ce, vl, interval) != 0) {
+      pthread_rwlock_unlock(&shard->lock);
       return -1;
-    } /* switch (ds->ds[i].type) */
+    }
+    break;
+  }
 
+  for (size_t i = 0; i < ds->ds_num; i++)
     DEBUG("uc_update: %s: ds[%" PRIsz "] = %lf", name, i, ce->values_gauge[i]);
-  } /* for (i) */
 
   /* Update the history if it exists. */
   if (ce->history != NULL) {
@@ -399,11 +983,23 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
   /* Prune invalid gauge data */
   uc_check_range(ds, ce);
 
+  if (ce->series != NULL) {
+    size_t bytes = gorilla_bytes(ce->series);
+    gorilla_append(ce->series, vl->time, ce->values_gauge);
+    if (vl->time > history_retention)
+      gorilla_expire(ce->series, vl->time - history_retention);
+    if (gorilla_bytes(ce->series) != bytes)
+      memstat_add(history_memstat,
+                  (int64_t)gorilla_bytes(ce->series) - (int64_t)bytes, 0);
+  }
+
   ce->last_time = vl->time;
   ce->last_update = cdtime();
   ce->interval = vl->interval;
+  cache_wheel_update(shard, ce);
 
-  pthread_mutex_unlock(&cache_lock);
+  rate_memo_set(ce, vl->time);
+  pthread_rwlock_unlock(&shard->lock);
 
   return 0;
 } /* int uc_update */
@@ -415,11 +1011,12 @@ int uc_get_rate_by_name(const char *name, gauge_t **ret_values,
   cache_entry_t *ce = NULL;
   int status = 0;
 
-  pthread_mutex_lock(&cache_lock);
+  uint32_t hash = identifier_hash(name);
+  cache_shard_t *shard = cache_shard(hash);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  pthread_rwlock_rdlock(&shard->lock);
 
+  if ((ce = cache_lookup(shard, hash, name)) != NULL) {
     /* remove missing values from getval */
     if (ce->state == STATE_MISSING) {
       DEBUG("utils_cache: uc_get_rate_by_name: requested metric \"%s\" is in "
@@ -441,7 +1038,7 @@ int uc_get_rate_by_name(const char *name, gauge_t **ret_values,
     status = -1;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_rwlock_unlock(&shard->lock);
 
   if (status == 0) {
     *ret_values = ret;
@@ -452,16 +1049,24 @@ int uc_get_rate_by_name(const char *name, gauge_t **ret_values,
 } /* gauge_t *uc_get_rate_by_name */
 
 gauge_t *uc_get_rate(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
   gauge_t *ret = NULL;
   size_t ret_num = 0;
   int status;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL) {
     ERROR("utils_cache: uc_get_rate: FORMAT_VL failed.");
     return NULL;
   }
 
+  /* Usually the rates have just been computed by uc_update() in this
+   * thread. */
+  ret = rate_memo_get(hash, name, vl->time, ds->ds_num);
+  if (ret != NULL)
+    return ret;
+
   status = uc_get_rate_by_name(name, &ret, &ret_num);
   if (status != 0)
     return NULL;
@@ -486,11 +1091,12 @@ int uc_get_value_by_name(const char *name, value_t **ret_values,
   cache_entry_t *ce = NULL;
   int status = 0;
 
-  pthread_mutex_lock(&cache_lock);
+  uint32_t hash = identifier_hash(name);
+  cache_shard_t *shard = cache_shard(hash);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  pthread_rwlock_rdlock(&shard->lock);
 
+  if ((ce = cache_lookup(shard, hash, name)) != NULL) {
     /* remove missing values from getval */
     if (ce->state == STATE_MISSING) {
       status = -1;
@@ -509,7 +1115,7 @@ int uc_get_value_by_name(const char *name, value_t **ret_values,
     status = -1;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_rwlock_unlock(&shard->lock);
 
   if (status == 0) {
     *ret_values = ret;
@@ -520,12 +1126,13 @@ int uc_get_value_by_name(const char *name, value_t **ret_values,
 } /* int uc_get_value_by_name */
 
 value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
   value_t *ret = NULL;
   size_t ret_num = 0;
   int status;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+  const char *name = uc_key(vl, buffer, sizeof(buffer), NULL);
+  if (name == NULL) {
     ERROR("utils_cache: uc_get_value: FORMAT_VL failed.");
     return (NULL);
   }
@@ -547,137 +1154,340 @@ value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl) {
   return (ret);
 } /* value_t *uc_get_value */
 
+bool uc_exists(const value_list_t *vl) {
+  char buffer[6 * DATA_MAX_NAME_LEN];
+
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL)
+    return false;
+
+  cache_shard_t *shard = cache_shard(hash);
+
+  pthread_rwlock_rdlock(&shard->lock);
+  bool found = (cache_lookup(shard, hash, name) != NULL);
+  pthread_rwlock_unlock(&shard->lock);
+
+  return found;
+} /* bool uc_exists */
+
 size_t uc_get_size(void) {
   size_t size_arrays = 0;
 
-  pthread_mutex_lock(&cache_lock);
-  size_arrays = (size_t)c_avl_size(cache_tree);
-  pthread_mutex_unlock(&cache_lock);
+  pthread_once(&cache_once, cache_init_once);
+
+  for (size_t i = 0; i < CACHE_SHARDS; i++) {
+    pthread_rwlock_rdlock(&cache_shards[i].lock);
+    size_arrays += cache_shards[i].entries_num;
+    pthread_rwlock_unlock(&cache_shards[i].lock);
+  }
 
   return size_arrays;
 }
 
-int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
-  c_avl_iterator_t *iter;
-  char *key;
-  cache_entry_t *value;
+/* Acquires the read locks of all shards and returns all entries, sorted by
+ * name. The locks are held until cache_unlock_all() is called. The locks are
+ * always acquired in the same order, and all other functions hold at most
+ * one shard lock at a time, so this cannot deadlock. */
+static int cache_lock_all(cache_entry_t ***ret_entries, size_t *ret_num) {
+  cache_entry_t **entries = NULL;
+  size_t entries_num = 0;
 
-  char **names = NULL;
-  cdtime_t *times = NULL;
-  size_t number = 0;
-  size_t size_arrays = 0;
+  pthread_once(&cache_once, cache_init_once);
 
-  int status = 0;
+  for (size_t i = 0; i < CACHE_SHARDS; i++) {
+    pthread_rwlock_rdlock(&cache_shards[i].lock);
+    entries_num += cache_shards[i].entries_num;
+  }
 
-  if ((ret_names == NULL) || (ret_number == NULL))
-    return -1;
+  if (entries_num > 0) {
+    entries = calloc(entries_num, sizeof(*entries));
+    if (entries == NULL) {
+      for (size_t i = 0; i < CACHE_SHARDS; i++)
+        pthread_rwlock_unlock(&cache_shards[i].lock);
+      return ENOMEM;
+    }
+  }
 
-  pthread_mutex_lock(&cache_lock);
+  size_t n = 0;
+  for (size_t s = 0; s < CACHE_SHARDS; s++) {
+    cache_shard_t *shard = cache_shards + s;
+    for (size_t b = 0; b < shard->buckets_num; b++)
+      for (cache_entry_t *ce = shard->buckets[b]; ce != NULL; ce = ce->next)
+        entries[n++] = ce;
+  }
+  assert(n == entries_num);
 
-  size_arrays = (size_t)c_avl_size(cache_tree);
-  if (size_arrays < 1) {
-    /* Handle the "no values" case here, to avoid the error message when
-     * calloc() returns NULL. */
-    pthread_mutex_unlock(&cache_lock);
-    return 0;
+  if (entries_num > 1)
+    qsort(entries, entries_num, sizeof(*entries), cache_entry_compare);
+
+  *ret_entries = entries;
+  *ret_num = entries_num;
+  return 0;
+} /* int cache_lock_all */
+
+static void cache_unlock_all(cache_entry_t **entries) {
+  for (size_t i = CACHE_SHARDS; i > 0; i--)
+    pthread_rwlock_unlock(&cache_shards[i - 1].lock);
+
+  free(entries);
+} /* void cache_unlock_all */
+
+typedef struct {
+  char *name;
+  cdtime_t time;
+} cache_name_t;
+
+typedef struct {
+  cache_name_t *names;
+  size_t num;
+  size_t size;
+} cache_names_t;
+
+static int cache_names_add(cache_entry_t const *ce, void *user_data) {
+  cache_names_t *n = user_data;
+
+  if (n->num >= n->size) {
+    size_t new_size = (n->size == 0) ? 64 : 2 * n->size;
+    cache_name_t *tmp = realloc(n->names, new_size * sizeof(*n->names));
+    if (tmp == NULL)
+      return ENOMEM;
+    n->names = tmp;
+    n->size = new_size;
   }
 
-  names = calloc(size_arrays, sizeof(*names));
-  times = calloc(size_arrays, sizeof(*times));
-  if ((names == NULL) || (times == NULL)) {
-    ERROR("uc_get_names: calloc failed.");
-    sfree(names);
-    sfree(times);
-    pthread_mutex_unlock(&cache_lock);
+  n->names[n->num].name = strdup(ce->name);
+  if (n->names[n->num].name == NULL)
     return ENOMEM;
-  }
+  n->names[n->num].time = ce->last_time;
+  n->num++;
 
-  iter = c_avl_get_iterator(cache_tree);
-  while (c_avl_iterator_next(iter, (void *)&key, (void *)&value) == 0) {
-    /* remove missing values when list values */
-    if (value->state == STATE_MISSING)
-      continue;
+  return 0;
+} /* int cache_names_add */
 
-    /* c_avl_size does not return a number smaller than the number of elements
-     * returned by c_avl_iterator_next. */
-    assert(number < size_arrays);
+static int cache_name_compare(const void *a, const void *b) {
+  return strcmp(((cache_name_t const *)a)->name,
+                ((cache_name_t const *)b)->name);
+} /* int cache_name_compare */
 
-    if (ret_times != NULL)
-      times[number] = value->last_time;
+int uc_get_names_filtered(const char *host, const char *plugin,
+                          char ***ret_names, cdtime_t **ret_times,
+                          size_t *ret_number) {
+  cache_names_t n = {0};
+  int status = 0;
 
-    names[number] = strdup(key);
-    if (names[number] == NULL) {
-      status = -1;
-      break;
-    }
+  if ((ret_names == NULL) || (ret_number == NULL))
+    return -1;
 
-    number++;
-  } /* while (c_avl_iterator_next) */
+  pthread_once(&cache_once, cache_init_once);
+
+  /* Only one shard is locked at a time, so updates of the other shards can
+   * proceed while the names are copied. */
+  for (size_t s = 0; s < CACHE_SHARDS; s++) {
+    cache_shard_t *shard = cache_shards + s;
+
+    pthread_rwlock_rdlock(&shard->lock);
+    status = cache_shard_walk(shard, host, plugin, cache_names_add, &n);
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (status != 0)
+      break;
+  }
 
-  c_avl_iterator_destroy(iter);
-  pthread_mutex_unlock(&cache_lock);
+  char **names = NULL;
+  cdtime_t *times = NULL;
+  if ((status == 0) && (n.num > 0)) {
+    names = calloc(n.num, sizeof(*names));
+    if (ret_times != NULL)
+      times = calloc(n.num, sizeof(*times));
+    if ((names == NULL) || ((ret_times != NULL) && (times == NULL)))
+      status = ENOMEM;
+  }
 
   if (status != 0) {
-    for (size_t i = 0; i < number; i++) {
-      sfree(names[i]);
-    }
+    ERROR("uc_get_names: Copying the names failed.");
+    for (size_t i = 0; i < n.num; i++)
+      sfree(n.names[i].name);
+    sfree(n.names);
     sfree(names);
     sfree(times);
-
     return -1;
   }
 
+  /* Handle the "no values" case here, to avoid the error message when
+   * calloc() returns NULL. */
+  if (n.num == 0)
+    return 0;
+
+  qsort(n.names, n.num, sizeof(*n.names), cache_name_compare);
+  for (size_t i = 0; i < n.num; i++) {
+    names[i] = n.names[i].name;
+    if (times != NULL)
+      times[i] = n.names[i].time;
+  }
+  sfree(n.names);
+
   *ret_names = names;
   if (ret_times != NULL)
     *ret_times = times;
-  else
-    sfree(times);
-  *ret_number = number;
+  *ret_number = n.num;
 
   return 0;
+} /* int uc_get_names_filtered */
+
+int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
+  return uc_get_names_filtered(NULL, NULL, ret_names, ret_times, ret_number);
 } /* int uc_get_names */
 
+typedef struct {
+  uc_query_t const *query;
+  uc_snapshot_t *snapshots;
+  size_t num;
+  size_t size;
+} cache_query_t;
+
+static void cache_snapshot_clear(uc_snapshot_t *snap) {
+  sfree(snap->name);
+  sfree(snap->values);
+  sfree(snap->rates);
+  meta_data_destroy(snap->meta);
+  snap->meta = NULL;
+} /* void cache_snapshot_clear */
+
+static int cache_query_add(cache_entry_t const *ce, void *user_data) {
+  cache_query_t *q = user_data;
+
+  if ((q->query->match != NULL) &&
+      !q->query->match(ce->name, q->query->user_data))
+    return 0;
+
+  if (q->num >= q->size) {
+    size_t new_size = (q->size == 0) ? 64 : 2 * q->size;
+    uc_snapshot_t *tmp = realloc(q->snapshots, new_size * sizeof(*tmp));
+    if (tmp == NULL)
+      return ENOMEM;
+    q->snapshots = tmp;
+    q->size = new_size;
+  }
+
+  uc_snapshot_t *snap = q->snapshots + q->num;
+  *snap = (uc_snapshot_t){
+      .name = strdup(ce->name),
+      .time = ce->last_time,
+      .interval = ce->interval,
+      .values_num = ce->values_num,
+      .values = calloc(ce->values_num, sizeof(*snap->values)),
+      .rates = calloc(ce->values_num, sizeof(*snap->rates)),
+  };
+  if (q->query->with_meta && (ce->meta != NULL))
+    snap->meta = meta_data_clone(ce->meta);
+
+  if ((snap->name == NULL) || (snap->values == NULL) || (snap->rates == NULL) ||
+      ((ce->meta != NULL) && q->query->with_meta && (snap->meta == NULL))) {
+    cache_snapshot_clear(snap);
+    return ENOMEM;
+  }
+
+  memcpy(snap->values, ce->values_raw, ce->values_num * sizeof(*snap->values));
+  memcpy(snap->rates, ce->values_gauge, ce->values_num * sizeof(*snap->rates));
+  q->num++;
+
+  return 0;
+} /* int cache_query_add */
+
+static int cache_snapshot_compare(const void *a, const void *b) {
+  return strcmp(((uc_snapshot_t const *)a)->name,
+                ((uc_snapshot_t const *)b)->name);
+} /* int cache_snapshot_compare */
+
+int uc_query(uc_query_t const *query, uc_snapshot_t **ret_snapshots,
+             size_t *ret_num) {
+  if ((query == NULL) || (ret_snapshots == NULL) || (ret_num == NULL))
+    return EINVAL;
+
+  pthread_once(&cache_once, cache_init_once);
+
+  cache_query_t q = {.query = query};
+  int status = 0;
+  for (size_t s = 0; s < CACHE_SHARDS; s++) {
+    cache_shard_t *shard = cache_shards + s;
+
+    pthread_rwlock_rdlock(&shard->lock);
+    status = cache_shard_walk(shard, query->host, query->plugin,
+                              cache_query_add, &q);
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (status != 0) {
+      ERROR("uc_query: Copying the cache entries failed.");
+      uc_snapshots_free(q.snapshots, q.num);
+      return status;
+    }
+  }
+
+  if (q.num > 1)
+    qsort(q.snapshots, q.num, sizeof(*q.snapshots), cache_snapshot_compare);
+
+  *ret_snapshots = q.snapshots;
+  *ret_num = q.num;
+  return 0;
+} /* int uc_query */
+
+void uc_snapshots_free(uc_snapshot_t *snapshots, size_t num) {
+  if (snapshots == NULL)
+    return;
+
+  for (size_t i = 0; i < num; i++)
+    cache_snapshot_clear(snapshots + i);
+  free(snapshots);
+} /* void uc_snapshots_free */
+
 int uc_get_state(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL) {
     ERROR("uc_get_state: FORMAT_VL failed.");
     return STATE_ERROR;
   }
 
-  pthread_mutex_lock(&cache_lock);
+  cache_shard_t *shard = cache_shard(hash);
+
+  pthread_rwlock_rdlock(&shard->lock);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  if ((ce = cache_lookup(shard, hash, name)) != NULL) {
     ret = ce->state;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_rwlock_unlock(&shard->lock);
 
   return ret;
 } /* int uc_get_state */
 
 int uc_set_state(const data_set_t *ds, const value_list_t *vl, int state) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL) {
     ERROR("uc_set_state: FORMAT_VL failed.");
     return STATE_ERROR;
   }
 
-  pthread_mutex_lock(&cache_lock);
+  cache_shard_t *shard = cache_shard(hash);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  pthread_rwlock_wrlock(&shard->lock);
+
+  if ((ce = cache_lookup(shard, hash, name)) != NULL) {
     ret = ce->state;
     ce->state = state;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_rwlock_unlock(&shard->lock);
 
   return ret;
 } /* int uc_set_state */
@@ -685,18 +1495,21 @@ int uc_set_state(const data_set_t *ds, const value_list_t *vl, int state) {
 int uc_get_history_by_name(const char *name, gauge_t *ret_history,
                            size_t num_steps, size_t num_ds) {
   cache_entry_t *ce = NULL;
-  int status = 0;
 
-  pthread_mutex_lock(&cache_lock);
+  uint32_t hash = identifier_hash(name);
+  cache_shard_t *shard = cache_shard(hash);
 
-  status = c_avl_get(cache_tree, name, (void *)&ce);
-  if (status != 0) {
-    pthread_mutex_unlock(&cache_lock);
+  /* May resize the history buffer, so acquire the write lock. */
+  pthread_rwlock_wrlock(&shard->lock);
+
+  ce = cache_lookup(shard, hash, name);
+  if (ce == NULL) {
+    pthread_rwlock_unlock(&shard->lock);
     return -ENOENT;
   }
 
   if (((size_t)ce->values_num) != num_ds) {
-    pthread_mutex_unlock(&cache_lock);
+    pthread_rwlock_unlock(&shard->lock);
     return -EINVAL;
   }
 
@@ -708,13 +1521,17 @@ int uc_get_history_by_name(const char *name, gauge_t *ret_history,
     tmp =
         realloc(ce->history, sizeof(*ce->history) * num_steps * ce->values_num);
     if (tmp == NULL) {
-      pthread_mutex_unlock(&cache_lock);
+      pthread_rwlock_unlock(&shard->lock);
       return -ENOMEM;
     }
 
     for (size_t i = ce->history_length * ce->values_num;
          i < (num_steps * ce->values_num); i++)
       tmp[i] = NAN;
+    memstat_add(history_memstat,
+                (int64_t)((num_steps - ce->history_length) * ce->values_num *
+                          sizeof(*tmp)),
+                0);
 
     ce->history = tmp;
     ce->history_length = num_steps;
@@ -737,16 +1554,57 @@ int uc_get_history_by_name(const char *name, gauge_t *ret_history,
            sizeof(*ret_history) * num_ds);
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_rwlock_unlock(&shard->lock);
 
   return 0;
 } /* int uc_get_history_by_name */
 
+int uc_set_history_retention(cdtime_t retention) {
+  history_retention = retention;
+  return 0;
+} /* int uc_set_history_retention */
+
+int uc_get_history_range_by_name(const char *name, cdtime_t start,
+                                 cdtime_t end, cdtime_t **ret_times,
+                                 gauge_t **ret_values, size_t *ret_num,
+                                 size_t *ret_values_num) {
+  cache_entry_t *ce = NULL;
+  int status;
+
+  if ((name == NULL) || (ret_times == NULL) || (ret_values == NULL) ||
+      (ret_num == NULL) || (ret_values_num == NULL))
+    return EINVAL;
+
+  uint32_t hash = identifier_hash(name);
+  cache_shard_t *shard = cache_shard(hash);
+
+  pthread_rwlock_rdlock(&shard->lock);
+
+  if ((ce = cache_lookup(shard, hash, name)) == NULL) {
+    pthread_rwlock_unlock(&shard->lock);
+    return ENOENT;
+  }
+
+  if (ce->series == NULL) {
+    pthread_rwlock_unlock(&shard->lock);
+    return ENOTSUP;
+  }
+
+  status =
+      gorilla_range(ce->series, start, end, ret_times, ret_values, ret_num);
+  if (status == 0)
+    *ret_values_num = ce->values_num;
+
+  pthread_rwlock_unlock(&shard->lock);
+  return status;
+} /* int uc_get_history_range_by_name */
+
 int uc_get_history(const data_set_t *ds, const value_list_t *vl,
                    gauge_t *ret_history, size_t num_steps, size_t num_ds) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+  const char *name = uc_key(vl, buffer, sizeof(buffer), NULL);
+  if (name == NULL) {
     ERROR("utils_cache: uc_get_history: FORMAT_VL failed.");
     return -1;
   }
@@ -755,73 +1613,138 @@ int uc_get_history(const data_set_t *ds, const value_list_t *vl,
 } /* int uc_get_history */
 
 int uc_get_hits(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL) {
     ERROR("uc_get_hits: FORMAT_VL failed.");
     return STATE_ERROR;
   }
 
-  pthread_mutex_lock(&cache_lock);
+  cache_shard_t *shard = cache_shard(hash);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  pthread_rwlock_rdlock(&shard->lock);
+
+  if ((ce = cache_lookup(shard, hash, name)) != NULL) {
     ret = ce->hits;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_rwlock_unlock(&shard->lock);
 
   return ret;
 } /* int uc_get_hits */
 
 int uc_set_hits(const data_set_t *ds, const value_list_t *vl, int hits) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL) {
     ERROR("uc_set_hits: FORMAT_VL failed.");
     return STATE_ERROR;
   }
 
-  pthread_mutex_lock(&cache_lock);
+  cache_shard_t *shard = cache_shard(hash);
+
+  pthread_rwlock_wrlock(&shard->lock);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  if ((ce = cache_lookup(shard, hash, name)) != NULL) {
     ret = ce->hits;
     ce->hits = hits;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_rwlock_unlock(&shard->lock);
 
   return ret;
 } /* int uc_set_hits */
 
 int uc_inc_hits(const data_set_t *ds, const value_list_t *vl, int step) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL) {
     ERROR("uc_inc_hits: FORMAT_VL failed.");
     return STATE_ERROR;
   }
 
-  pthread_mutex_lock(&cache_lock);
+  cache_shard_t *shard = cache_shard(hash);
+
+  pthread_rwlock_wrlock(&shard->lock);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  if ((ce = cache_lookup(shard, hash, name)) != NULL) {
     ret = ce->hits;
     ce->hits = ret + step;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_rwlock_unlock(&shard->lock);
 
   return ret;
 } /* int uc_inc_hits */
 
+int uc_get_threshold(const value_list_t *vl, uint64_t generation,
+                     void **ret_threshold) {
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_entry_t *ce = NULL;
+  int ret = ENOENT;
+
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL) {
+    ERROR("uc_get_threshold: FORMAT_VL failed.");
+    return -1;
+  }
+
+  cache_shard_t *shard = cache_shard(hash);
+
+  pthread_rwlock_rdlock(&shard->lock);
+
+  if (((ce = cache_lookup(shard, hash, name)) != NULL) &&
+      (ce->threshold_generation == generation)) {
+    *ret_threshold = ce->threshold;
+    ret = 0;
+  }
+
+  pthread_rwlock_unlock(&shard->lock);
+
+  return ret;
+} /* int uc_get_threshold */
+
+int uc_set_threshold(const value_list_t *vl, uint64_t generation,
+                     void *threshold) {
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_entry_t *ce = NULL;
+  int ret = ENOENT;
+
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL) {
+    ERROR("uc_set_threshold: FORMAT_VL failed.");
+    return -1;
+  }
+
+  cache_shard_t *shard = cache_shard(hash);
+
+  pthread_rwlock_wrlock(&shard->lock);
+
+  if ((ce = cache_lookup(shard, hash, name)) != NULL) {
+    ce->threshold = threshold;
+    ce->threshold_generation = generation;
+    ret = 0;
+  }
+
+  pthread_rwlock_unlock(&shard->lock);
+
+  return ret;
+} /* int uc_set_threshold */
+
 /*
  * Iterator interface
  */
@@ -832,10 +1755,7 @@ uc_iter_t *uc_get_iterator(void) {
   if (iter == NULL)
     return NULL;
 
-  pthread_mutex_lock(&cache_lock);
-
-  iter->iter = c_avl_get_iterator(cache_tree);
-  if (iter->iter == NULL) {
+  if (cache_lock_all(&iter->entries, &iter->entries_num) != 0) {
     free(iter);
     return NULL;
   }
@@ -849,11 +1769,16 @@ int uc_iterator_next(uc_iter_t *iter, char **ret_name) {
   if (iter == NULL)
     return -1;
 
-  while ((status = c_avl_iterator_next(iter->iter, (void *)&iter->name,
-                                       (void *)&iter->entry)) == 0) {
+  status = -1;
+  while (iter->index < iter->entries_num) {
+    iter->entry = iter->entries[iter->index];
+    iter->name = iter->entry->name;
+    iter->index++;
+
     if (iter->entry->state == STATE_MISSING)
       continue;
 
+    status = 0;
     break;
   }
   if (status != 0) {
@@ -872,8 +1797,7 @@ void uc_iterator_destroy(uc_iter_t *iter) {
   if (iter == NULL)
     return;
 
-  c_avl_iterator_destroy(iter->iter);
-  pthread_mutex_unlock(&cache_lock);
+  cache_unlock_all(iter->entries);
 
   free(iter);
 } /* void uc_iterator_destroy */
@@ -924,34 +1848,37 @@ int uc_iterator_get_meta(uc_iter_t *iter, meta_data_t **ret_meta) {
 /*
  * Meta data interface
  */
-/* XXX: This function will acquire `cache_lock' but will not free it! */
-static meta_data_t *uc_get_meta(const value_list_t *vl) /* {{{ */
-{
-  char name[6 * DATA_MAX_NAME_LEN];
+/* XXX: This function will acquire the write lock of the entry's shard but will
+ * not free it! The shard is returned in `ret_shard'. */
+static meta_data_t *uc_get_meta(const value_list_t *vl, /* {{{ */
+                                cache_shard_t **ret_shard) {
+  char buffer[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
-  int status;
 
-  status = FORMAT_VL(name, sizeof(name), vl);
-  if (status != 0) {
+  uint32_t hash;
+  const char *name = uc_key(vl, buffer, sizeof(buffer), &hash);
+  if (name == NULL) {
     ERROR("utils_cache: uc_get_meta: FORMAT_VL failed.");
     return NULL;
   }
 
-  pthread_mutex_lock(&cache_lock);
+  cache_shard_t *shard = cache_shard(hash);
 
-  status = c_avl_get(cache_tree, name, (void *)&ce);
-  if (status != 0) {
-    pthread_mutex_unlock(&cache_lock);
+  pthread_rwlock_wrlock(&shard->lock);
+
+  ce = cache_lookup(shard, hash, name);
+  if (ce == NULL) {
+    pthread_rwlock_unlock(&shard->lock);
     return NULL;
   }
-  assert(ce != NULL);
 
   if (ce->meta == NULL)
     ce->meta = meta_data_create();
 
   if (ce->meta == NULL)
-    pthread_mutex_unlock(&cache_lock);
+    pthread_rwlock_unlock(&shard->lock);
 
+  *ret_shard = shard;
   return ce->meta;
 } /* }}} meta_data_t *uc_get_meta */
 
@@ -960,12 +1887,13 @@ static meta_data_t *uc_get_meta(const value_list_t *vl) /* {{{ */
 #define UC_WRAP(wrap_function)                                                 \
   {                                                                            \
     meta_data_t *meta;                                                         \
+    cache_shard_t *shard = NULL;                                               \
     int status;                                                                \
-    meta = uc_get_meta(vl);                                                    \
+    meta = uc_get_meta(vl, &shard);                                            \
     if (meta == NULL)                                                          \
       return -1;                                                               \
     status = wrap_function(meta, key);                                         \
-    pthread_mutex_unlock(&cache_lock);                                         \
+    pthread_rwlock_unlock(&shard->lock);                                       \
     return status;                                                             \
   }
 int uc_meta_data_exists(const value_list_t *vl,
@@ -980,12 +1908,13 @@ int uc_meta_data_exists(const value_list_t *vl,
 #define UC_WRAP(wrap_function)                                                 \
   {                                                                            \
     meta_data_t *meta;                                                         \
+    cache_shard_t *shard = NULL;                                               \
     int status;                                                                \
-    meta = uc_get_meta(vl);                                                    \
+    meta = uc_get_meta(vl, &shard);                                            \
     if (meta == NULL)                                                          \
       return -1;                                                               \
     status = wrap_function(meta, key, value);                                  \
-    pthread_mutex_unlock(&cache_lock);                                         \
+    pthread_rwlock_unlock(&shard->lock);                                       \
     return status;                                                             \
   }
         int uc_meta_data_add_string(const value_list_t *vl, const char *key,
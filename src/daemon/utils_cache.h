@@ -45,21 +45,131 @@ gauge_t *uc_get_rate(const data_set_t *ds, const value_list_t *vl);
 int uc_get_value_by_name(const char *name, value_t **ret_values,
                          size_t *ret_values_num);
 value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl);
+/* Returns true if the cache has an entry for the value list's identifier. */
+bool uc_exists(const value_list_t *vl);
 
 size_t uc_get_size(void);
 int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
 
+/*
+ * NAME
+ *   uc_get_names_filtered
+ *
+ * DESCRIPTION
+ *   Like uc_get_names(), but only returns the entries of "host" and
+ *   "plugin". Either may be NULL to match any. The cache keeps an index of
+ *   the hosts and plugins, so this only visits the matching entries.
+ */
+int uc_get_names_filtered(const char *host, const char *plugin,
+                          char ***ret_names, cdtime_t **ret_times,
+                          size_t *ret_number);
+
+/*
+ * Query interface
+ */
+typedef struct {
+  /* Exact host and plugin name or NULL to match any. Used to look up the
+   * entries in the cache's indexes. */
+  const char *host;
+  const char *plugin;
+  /* Optional filter, called with the name of each entry found. It's called
+   * while a cache lock is held, so it must not use the cache itself. */
+  bool (*match)(const char *name, void *user_data);
+  void *user_data;
+  /* Whether to copy the entries' meta data, too. */
+  bool with_meta;
+} uc_query_t;
+
+/* A copy of a cache entry as returned by uc_query(). */
+typedef struct {
+  char *name;
+  cdtime_t time;
+  cdtime_t interval;
+  size_t values_num;
+  value_t *values; /* raw values */
+  gauge_t *rates;
+  meta_data_t *meta; /* NULL unless requested */
+} uc_snapshot_t;
+
+/*
+ * NAME
+ *   uc_query
+ *
+ * DESCRIPTION
+ *   Copies the values, rates and (optionally) meta data of the entries
+ *   matching "query", sorted by name. Unlike the iterator interface, only
+ *   one of the cache's shards is locked at a time, so the copy is consistent
+ *   for each entry but not across entries. The array must be freed with
+ *   uc_snapshots_free().
+ *
+ * RETURN VALUE
+ *   Zero on success, ENOMEM if allocating memory failed.
+ */
+int uc_query(uc_query_t const *query, uc_snapshot_t **ret_snapshots,
+             size_t *ret_num);
+void uc_snapshots_free(uc_snapshot_t *snapshots, size_t num);
+
 int uc_get_state(const data_set_t *ds, const value_list_t *vl);
 int uc_set_state(const data_set_t *ds, const value_list_t *vl, int state);
 int uc_get_hits(const data_set_t *ds, const value_list_t *vl);
 int uc_set_hits(const data_set_t *ds, const value_list_t *vl, int hits);
 int uc_inc_hits(const data_set_t *ds, const value_list_t *vl, int step);
 
+/*
+ * NAME
+ *   uc_get_threshold, uc_set_threshold
+ *
+ * DESCRIPTION
+ *   Get and set an opaque pointer to the threshold configuration which
+ *   applies to "vl", so that it doesn't have to be searched for every value.
+ *   "generation" identifies the threshold configuration the pointer belongs
+ *   to; uc_get_threshold() only returns pointers stored with the same
+ *   generation. Generation zero is never stored.
+ *
+ * RETURN VALUE
+ *   Zero on success (the stored pointer may be NULL), ENOENT if "vl" is not
+ *   in the cache or no pointer has been stored for "generation".
+ */
+int uc_get_threshold(const value_list_t *vl, uint64_t generation,
+                     void **ret_threshold);
+int uc_set_threshold(const value_list_t *vl, uint64_t generation,
+                     void *threshold);
+
 int uc_get_history(const data_set_t *ds, const value_list_t *vl,
                    gauge_t *ret_history, size_t num_steps, size_t num_ds);
 int uc_get_history_by_name(const char *name, gauge_t *ret_history,
                            size_t num_steps, size_t num_ds);
 
+/*
+ * NAME
+ *   uc_set_history_retention
+ *
+ * DESCRIPTION
+ *   Enables the compressed history of every cache entry, keeping at least
+ *   the given amount of time. Must be called before the first update; zero
+ *   disables the history.
+ */
+int uc_set_history_retention(cdtime_t retention);
+
+/*
+ * NAME
+ *   uc_get_history_range_by_name
+ *
+ * DESCRIPTION
+ *   Returns the (rate converted) values stored for "name" between "start"
+ *   and "end". Timestamps are returned in "ret_times", values in
+ *   "ret_values", "ret_values_num" values per sample. Both arrays must be
+ *   freed by the caller.
+ *
+ * RETURN VALUE
+ *   Zero on success, ENOENT if the entry does not exist, ENOTSUP if the
+ *   history is disabled.
+ */
+int uc_get_history_range_by_name(const char *name, cdtime_t start,
+                                 cdtime_t end, cdtime_t **ret_times,
+                                 gauge_t **ret_values, size_t *ret_num,
+                                 size_t *ret_values_num);
+
 /*
  * Iterator interface
  */
@@ -71,8 +181,8 @@ typedef struct uc_iter_s uc_iter_t;
  *   uc_get_iterator
  *
  * DESCRIPTION
- *   Create an iterator for the cache. It will hold the cache lock until it's
- *   destroyed.
+ *   Create an iterator for the cache. It will hold the read locks of all cache
+ *   shards until it's destroyed. Entries are returned sorted by name.
  *
  * RETURN VALUE
  *   An iterator object on success or NULL else.
@@ -42,7 +42,27 @@ int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
   return ENOTSUP;
 }
 
+int uc_get_names_filtered(const char *host, const char *plugin,
+                          char ***ret_names, cdtime_t **ret_times,
+                          size_t *ret_number) {
+  return ENOTSUP;
+}
+
 int uc_get_value_by_name(const char *name, value_t **ret_values,
                          size_t *ret_values_num) {
   return ENOTSUP;
 }
+
+int uc_get_history_range_by_name(const char *name, cdtime_t start,
+                                 cdtime_t end, cdtime_t **ret_times,
+                                 gauge_t **ret_values, size_t *ret_num,
+                                 size_t *ret_values_num) {
+  return ENOTSUP;
+}
+
+int uc_query(uc_query_t const *query, uc_snapshot_t **ret_snapshots,
+             size_t *ret_num) {
+  return ENOTSUP;
+}
+
+void uc_snapshots_free(uc_snapshot_t *snapshots, size_t num) {}
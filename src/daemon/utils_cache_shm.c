@@ -0,0 +1,275 @@
+/**
+ * collectd - src/daemon/utils_cache_shm.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "utils_atomic.h"
+#include "utils_cache.h"
+#include "utils_cache_shm.h"
+#include "utils_complain.h"
+
+#include <sys/mman.h>
+
+/* The snapshot is only written by the main loop, so there's no locking. */
+static char *shm_file;
+static int shm_fd = -1;
+static void *shm_map;
+static size_t shm_map_size;
+static uint64_t shm_sequence;
+
+static c_complain_t shm_complaint = C_COMPLAIN_INIT_STATIC;
+
+static void shm_close(bool unlink_file) {
+  if (shm_map != NULL)
+    munmap(shm_map, shm_map_size);
+  shm_map = NULL;
+  shm_map_size = 0;
+
+  if (shm_fd >= 0) {
+    close(shm_fd);
+    if (unlink_file)
+      unlink(shm_file);
+  }
+  shm_fd = -1;
+} /* void shm_close */
+
+/* Replaces any existing file rather than truncating it, so that readers
+ * which still have the old file mapped don't crash. */
+static int shm_open_file(void) {
+  if ((unlink(shm_file) != 0) && (errno != ENOENT)) {
+    int status = errno;
+    c_complain(LOG_ERR, &shm_complaint,
+               "uc_shm_publish: unlink(\"%s\") failed: %s", shm_file,
+               STRERRNO);
+    return status;
+  }
+
+  shm_fd = open(shm_file, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (shm_fd < 0) {
+    int status = errno;
+    c_complain(LOG_ERR, &shm_complaint,
+               "uc_shm_publish: open(\"%s\") failed: %s", shm_file,
+               STRERRNO);
+    return status;
+  }
+
+  shm_sequence = 0;
+  return 0;
+} /* int shm_open_file */
+
+/* Grows the file and the mapping to at least "size" bytes. */
+static int shm_reserve(size_t size) {
+  if (size <= shm_map_size)
+    return 0;
+
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (page_size <= 0)
+    page_size = 4096;
+
+  /* Grow geometrically to avoid remapping every time a few entries are
+   * added. */
+  size_t new_size = (shm_map_size < 65536) ? 65536 : 2 * shm_map_size;
+  while (new_size < size)
+    new_size *= 2;
+  new_size = ((new_size + page_size - 1) / page_size) * page_size;
+
+  if (ftruncate(shm_fd, (off_t)new_size) != 0) {
+    int status = errno;
+    c_complain(LOG_ERR, &shm_complaint,
+               "uc_shm_publish: ftruncate(\"%s\") failed: %s", shm_file,
+               STRERRNO);
+    return status;
+  }
+
+  void *map =
+      mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  if (map == MAP_FAILED) {
+    int status = errno;
+    c_complain(LOG_ERR, &shm_complaint,
+               "uc_shm_publish: mmap(\"%s\") failed: %s", shm_file,
+               STRERRNO);
+    return status;
+  }
+
+  if (shm_map != NULL)
+    munmap(shm_map, shm_map_size);
+  shm_map = map;
+  shm_map_size = new_size;
+
+  uc_shm_header_t *hdr = shm_map;
+  if (hdr->version == 0) {
+    memcpy(hdr->magic, UC_SHM_MAGIC, sizeof(UC_SHM_MAGIC));
+    hdr->version = UC_SHM_VERSION;
+    hdr->header_size = sizeof(uc_shm_header_t);
+    hdr->record_size = sizeof(uc_shm_record_t);
+    hdr->value_size = sizeof(uc_shm_value_t);
+  }
+
+  return 0;
+} /* int shm_reserve */
+
+/* Looks up the data source types of the cache entry "name", which has the
+ * form "host/plugin[-instance]/type[-instance]". */
+static const data_set_t *shm_data_set(const char *name, size_t values_num) {
+  const char *type = strchr(name, '/');
+  if (type != NULL)
+    type = strchr(type + 1, '/');
+  if (type == NULL)
+    return NULL;
+  type++;
+
+  char buffer[DATA_MAX_NAME_LEN];
+  size_t len = strcspn(type, "-");
+  if (len >= sizeof(buffer))
+    return NULL;
+  memcpy(buffer, type, len);
+  buffer[len] = 0;
+
+  const data_set_t *ds = plugin_get_ds(buffer);
+  if ((ds == NULL) || (ds->ds_num != values_num))
+    return NULL;
+  return ds;
+} /* const data_set_t *shm_data_set */
+
+static void shm_write(uc_snapshot_t const *snaps, size_t snaps_num,
+                      size_t values_num, size_t strings_size) {
+  uc_shm_header_t *hdr = shm_map;
+  char *base = shm_map;
+
+  size_t records_offset = sizeof(*hdr);
+  size_t values_offset = records_offset + snaps_num * sizeof(uc_shm_record_t);
+  size_t strings_offset = values_offset + values_num * sizeof(uc_shm_value_t);
+
+  /* An odd sequence number tells readers that a write is in progress. */
+  C_ATOMIC_STORE(&hdr->sequence, ++shm_sequence);
+  C_ATOMIC_FENCE();
+
+  hdr->size = shm_map_size;
+  hdr->time = cdtime();
+  hdr->records_offset = records_offset;
+  hdr->records_num = snaps_num;
+  hdr->values_offset = values_offset;
+  hdr->values_num = values_num;
+  hdr->strings_offset = strings_offset;
+  hdr->strings_size = strings_size;
+
+  uc_shm_record_t *records = (uc_shm_record_t *)(base + records_offset);
+  uc_shm_value_t *values = (uc_shm_value_t *)(base + values_offset);
+  char *strings = base + strings_offset;
+
+  size_t value_index = 0;
+  size_t string_offset = 0;
+  for (size_t i = 0; i < snaps_num; i++) {
+    uc_snapshot_t const *snap = snaps + i;
+    size_t name_len = strlen(snap->name);
+
+    records[i] = (uc_shm_record_t){
+        .time = snap->time,
+        .interval = snap->interval,
+        .name_offset = (uint32_t)string_offset,
+        .name_len = (uint32_t)name_len,
+        .values_index = (uint32_t)value_index,
+        .values_num = (uint32_t)snap->values_num,
+    };
+    memcpy(strings + string_offset, snap->name, name_len + 1);
+    string_offset += name_len + 1;
+
+    const data_set_t *ds = shm_data_set(snap->name, snap->values_num);
+    for (size_t j = 0; j < snap->values_num; j++) {
+      values[value_index + j] = (uc_shm_value_t){
+          .ds_type = (ds != NULL) ? ds->ds[j].type : -1,
+          .value = snap->values[j],
+          .rate = snap->rates[j],
+      };
+    }
+    value_index += snap->values_num;
+  }
+
+  C_ATOMIC_STORE_REL(&hdr->sequence, ++shm_sequence);
+} /* void shm_write */
+
+int uc_shm_set_file(const char *file) {
+  if ((file != NULL) && (shm_file != NULL) && (strcmp(file, shm_file) == 0))
+    return 0;
+
+  if (shm_file != NULL) {
+    shm_close(/* unlink_file = */ true);
+    sfree(shm_file);
+  }
+
+  if (file == NULL)
+    return 0;
+
+  shm_file = strdup(file);
+  if (shm_file == NULL)
+    return ENOMEM;
+
+  return 0;
+} /* int uc_shm_set_file */
+
+int uc_shm_publish(void) {
+  if (shm_file == NULL)
+    return 0;
+
+  uc_snapshot_t *snaps = NULL;
+  size_t snaps_num = 0;
+  int status = uc_query(&(uc_query_t){0}, &snaps, &snaps_num);
+  if (status != 0)
+    return status;
+
+  size_t values_num = 0;
+  size_t strings_size = 0;
+  for (size_t i = 0; i < snaps_num; i++) {
+    values_num += snaps[i].values_num;
+    strings_size += strlen(snaps[i].name) + 1;
+  }
+
+  size_t size = sizeof(uc_shm_header_t) + snaps_num * sizeof(uc_shm_record_t) +
+                values_num * sizeof(uc_shm_value_t) + strings_size;
+  if (size > UINT32_MAX) {
+    uc_snapshots_free(snaps, snaps_num);
+    c_complain(LOG_ERR, &shm_complaint,
+               "uc_shm_publish: The snapshot is too large (%" PRIsz " bytes).",
+               size);
+    return EFBIG;
+  }
+
+  if (shm_fd < 0)
+    status = shm_open_file();
+  if (status == 0)
+    status = shm_reserve(size);
+
+  if (status != 0) {
+    uc_snapshots_free(snaps, snaps_num);
+    /* Start over with a new file next time. */
+    shm_close(/* unlink_file = */ false);
+    return status;
+  }
+
+  shm_write(snaps, snaps_num, values_num, strings_size);
+  uc_snapshots_free(snaps, snaps_num);
+  c_release(LOG_INFO, &shm_complaint,
+            "uc_shm_publish: Writing snapshots works again.");
+  return 0;
+} /* int uc_shm_publish */
@@ -0,0 +1,118 @@
+/**
+ * collectd - src/daemon/utils_cache_shm.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_CACHE_SHM_H
+#define UTILS_CACHE_SHM_H 1
+
+#include "plugin.h"
+
+/*
+ * Shared memory snapshot of the value cache
+ *
+ * If "CacheSnapshotFile" is set, a copy of all cache entries is written to
+ * that file once per interval. Local processes can mmap(2) the file
+ * read-only and look up current values without talking to the daemon, and
+ * without the daemon taking any lock on their behalf.
+ *
+ * The file starts with a uc_shm_header_t, followed by three arrays at the
+ * offsets given in the header:
+ *
+ *   records  one uc_shm_record_t per cache entry, sorted by name
+ *   values   one uc_shm_value_t per data source of each entry
+ *   strings  the null-terminated names of the entries
+ *
+ * All fields are in host byte order. The header is protected by a sequence
+ * lock: "sequence" is odd while the daemon writes a snapshot and is
+ * incremented again once it's done. Readers must
+ *
+ *   1. load "sequence" and start over if it's odd,
+ *   2. remap the file if "size" is larger than the mapping,
+ *   3. copy what they need,
+ *   4. load "sequence" again and start over if it has changed.
+ *
+ * The file only ever grows while the daemon runs. It's replaced by a new
+ * file when the daemon starts and removed when it shuts down, so readers
+ * should reopen it if the daemon has been restarted.
+ */
+
+#define UC_SHM_MAGIC "cdcache"
+#define UC_SHM_VERSION 1
+
+typedef struct {
+  char magic[8];        /* UC_SHM_MAGIC, including the null byte */
+  uint32_t version;     /* UC_SHM_VERSION */
+  uint32_t header_size; /* sizeof(uc_shm_header_t) */
+  uint64_t sequence;
+  uint64_t size; /* size of the file */
+  uint64_t time; /* cdtime_t of the snapshot */
+  uint64_t records_offset;
+  uint64_t records_num;
+  uint64_t values_offset;
+  uint64_t values_num;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  uint32_t record_size; /* sizeof(uc_shm_record_t) */
+  uint32_t value_size;  /* sizeof(uc_shm_value_t) */
+} uc_shm_header_t;
+
+typedef struct {
+  uint64_t time;     /* cdtime_t of the last update */
+  uint64_t interval; /* cdtime_t */
+  uint32_t name_offset; /* relative to strings_offset */
+  uint32_t name_len;    /* excluding the null byte */
+  uint32_t values_index; /* first value in the values array */
+  uint32_t values_num;
+} uc_shm_record_t;
+
+typedef struct {
+  int32_t ds_type; /* DS_TYPE_*, or -1 if the type is not known */
+  uint32_t reserved;
+  value_t value; /* raw value */
+  gauge_t rate;  /* as returned by uc_get_rate() */
+} uc_shm_value_t;
+
+/*
+ * NAME
+ *   uc_shm_set_file
+ *
+ * DESCRIPTION
+ *   Sets the file the snapshots are written to. NULL disables snapshots and
+ *   removes a previously written file. The file is (re)created by the next
+ *   uc_shm_publish() call.
+ */
+int uc_shm_set_file(const char *file);
+
+/*
+ * NAME
+ *   uc_shm_publish
+ *
+ * DESCRIPTION
+ *   Writes a snapshot of the value cache. Does nothing unless a file has been
+ *   set with uc_shm_set_file().
+ *
+ * RETURN VALUE
+ *   Zero on success, an errno value otherwise.
+ */
+int uc_shm_publish(void);
+
+#endif /* UTILS_CACHE_SHM_H */
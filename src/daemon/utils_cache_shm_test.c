@@ -0,0 +1,189 @@
+/**
+ * collectd - src/daemon/utils_cache_shm_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "testing.h"
+
+#include "collectd.h"
+
+#include "common.h"
+#include "utils_cache.h"
+#include "utils_cache_shm.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int timeout_g = 2;
+
+int plugin_dispatch_missing(const value_list_t *vl) { return 0; }
+
+static data_source_t dsrc_derive = {"value", DS_TYPE_DERIVE, 0.0, NAN};
+static data_set_t ds_derive = {"MAGIC", 1, &dsrc_derive};
+
+static char dir[] = "/tmp/utils_cache_shm_test.XXXXXX";
+static char file[64];
+
+static int update(const char *plugin, const char *type_instance, derive_t d) {
+  value_t v = {.derive = d};
+  value_list_t vl = {
+      .values = &v,
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T(1000),
+      .interval = TIME_T_TO_CDTIME_T(10),
+  };
+  sstrncpy(vl.host, "example.com", sizeof(vl.host));
+  sstrncpy(vl.plugin, plugin, sizeof(vl.plugin));
+  sstrncpy(vl.type, "MAGIC", sizeof(vl.type));
+  sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+  return uc_update(&ds_derive, &vl);
+}
+
+/* Maps the snapshot like an external reader would. Returns the mapping,
+ * whose size is stored in "ret_size". */
+static char *map_snapshot(size_t *ret_size) {
+  int fd = open(file, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  char *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  *ret_size = (size_t)st.st_size;
+  return map;
+}
+
+DEF_TEST(publish) {
+  CHECK_ZERO(uc_init());
+  OK(mkdtemp(dir) != NULL);
+  snprintf(file, sizeof(file), "%s/snapshot", dir);
+
+  /* Nothing is written without a file. */
+  CHECK_ZERO(uc_shm_publish());
+
+  CHECK_ZERO(uc_shm_set_file(file));
+  CHECK_ZERO(uc_shm_publish());
+
+  size_t size = 0;
+  char *map = map_snapshot(&size);
+  CHECK_NOT_NULL(map);
+  uc_shm_header_t const *hdr = (void *)map;
+  EXPECT_EQ_STR(UC_SHM_MAGIC, hdr->magic);
+  EXPECT_EQ_INT(UC_SHM_VERSION, (int)hdr->version);
+  EXPECT_EQ_UINT64(sizeof(uc_shm_record_t), hdr->record_size);
+  EXPECT_EQ_UINT64(2, hdr->sequence);
+  EXPECT_EQ_UINT64(0, hdr->records_num);
+  EXPECT_EQ_UINT64(size, hdr->size);
+  munmap(map, size);
+
+  CHECK_ZERO(update("shm", "", 42));
+  CHECK_ZERO(uc_shm_publish());
+
+  map = map_snapshot(&size);
+  CHECK_NOT_NULL(map);
+  hdr = (void *)map;
+  EXPECT_EQ_UINT64(4, hdr->sequence);
+  EXPECT_EQ_UINT64(1, hdr->records_num);
+  EXPECT_EQ_UINT64(1, hdr->values_num);
+
+  uc_shm_record_t const *rec = (void *)(map + hdr->records_offset);
+  uc_shm_value_t const *val = (void *)(map + hdr->values_offset);
+  char const *name = map + hdr->strings_offset + rec->name_offset;
+  EXPECT_EQ_STR("example.com/shm/MAGIC", name);
+  EXPECT_EQ_UINT64(strlen(name), rec->name_len);
+  EXPECT_EQ_UINT64(TIME_T_TO_CDTIME_T(1000), rec->time);
+  EXPECT_EQ_UINT64(TIME_T_TO_CDTIME_T(10), rec->interval);
+  EXPECT_EQ_INT(DS_TYPE_DERIVE, val[rec->values_index].ds_type);
+  EXPECT_EQ_UINT64(42, (uint64_t)val[rec->values_index].value.derive);
+  munmap(map, size);
+
+  return 0;
+}
+
+/* Adding more entries than fit grows the file, readers see the new size in
+ * the header of their old mapping. */
+DEF_TEST(grow) {
+  size_t old_size = 0;
+  char *old_map = map_snapshot(&old_size);
+  CHECK_NOT_NULL(old_map);
+
+  int failed = 0;
+  for (int i = 0; i < 5000; i++) {
+    char type_instance[16];
+    snprintf(type_instance, sizeof(type_instance), "%04d", i);
+    if (update("grow", type_instance, i) != 0)
+      failed++;
+  }
+  EXPECT_EQ_INT(0, failed);
+  CHECK_ZERO(uc_shm_publish());
+
+  uc_shm_header_t const *old_hdr = (void *)old_map;
+  OK(old_hdr->size > old_size);
+  EXPECT_EQ_UINT64(5001, old_hdr->records_num);
+  munmap(old_map, old_size);
+
+  size_t size = 0;
+  char *map = map_snapshot(&size);
+  CHECK_NOT_NULL(map);
+  uc_shm_header_t const *hdr = (void *)map;
+  EXPECT_EQ_UINT64(size, hdr->size);
+  OK((hdr->sequence % 2) == 0);
+
+  uc_shm_record_t const *rec = (void *)(map + hdr->records_offset);
+  uc_shm_value_t const *val = (void *)(map + hdr->values_offset);
+  char const *strings = map + hdr->strings_offset;
+
+  /* Records are sorted by name, so that readers can search them. */
+  size_t bad = 0;
+  for (size_t i = 0; i < hdr->records_num; i++) {
+    char const *name = strings + rec[i].name_offset;
+    if ((i > 0) && (strcmp(strings + rec[i - 1].name_offset, name) >= 0))
+      bad++;
+    if (strncmp(name, "example.com/grow/MAGIC-", 23) == 0) {
+      if (val[rec[i].values_index].value.derive != atoi(name + 23))
+        bad++;
+    }
+  }
+  EXPECT_EQ_UINT64(0, bad);
+  munmap(map, size);
+
+  /* Disabling snapshots removes the file. */
+  CHECK_ZERO(uc_shm_set_file(NULL));
+  OK(access(file, F_OK) != 0);
+  rmdir(dir);
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(publish);
+  RUN_TEST(grow);
+
+  END_TEST;
+}
@@ -0,0 +1,419 @@
+/**
+ * collectd - src/daemon/utils_cache_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "testing.h"
+
+#include "collectd.h"
+
+#include "common.h"
+#include "utils_cache.h"
+
+int timeout_g = 2;
+
+static int missing_num = 0;
+
+int plugin_dispatch_missing(const value_list_t *vl) {
+  missing_num++;
+  return 0;
+}
+
+static data_source_t dsrc_derive = {"value", DS_TYPE_DERIVE, 0.0, NAN};
+static data_set_t ds_derive = {"derive", 1, &dsrc_derive};
+
+static void make_vl(value_list_t *vl, value_t *v, char const *plugin,
+                    derive_t d, cdtime_t t) {
+  *vl = (value_list_t){
+      .values = v,
+      .values_len = 1,
+      .time = t,
+      .interval = TIME_T_TO_CDTIME_T(10),
+  };
+  v->derive = d;
+  sstrncpy(vl->host, "example.com", sizeof(vl->host));
+  sstrncpy(vl->plugin, plugin, sizeof(vl->plugin));
+  sstrncpy(vl->type, "derive", sizeof(vl->type));
+}
+
+DEF_TEST(update_and_rate) {
+  value_list_t vl;
+  value_t v;
+
+  CHECK_ZERO(uc_init());
+
+  make_vl(&vl, &v, "rate", 100, TIME_T_TO_CDTIME_T(1000));
+  CHECK_ZERO(uc_update(&ds_derive, &vl));
+
+  /* Updates with the same or an older time are rejected. */
+  OK(uc_update(&ds_derive, &vl) != 0);
+
+  make_vl(&vl, &v, "rate", 200, TIME_T_TO_CDTIME_T(1010));
+  CHECK_ZERO(uc_update(&ds_derive, &vl));
+
+  gauge_t *rates = uc_get_rate(&ds_derive, &vl);
+  CHECK_NOT_NULL(rates);
+  EXPECT_EQ_DOUBLE(10.0, rates[0]);
+  sfree(rates);
+
+  size_t rates_num = 0;
+  CHECK_ZERO(uc_get_rate_by_name("example.com/rate/derive", &rates, &rates_num));
+  EXPECT_EQ_UINT64(1, rates_num);
+  EXPECT_EQ_DOUBLE(10.0, rates[0]);
+  sfree(rates);
+
+  OK(uc_get_rate_by_name("example.com/nonexistent/derive", &rates,
+                         &rates_num) != 0);
+
+  return 0;
+}
+
+/* uc_get_rate() answers from the rates uc_update() has just computed, but only
+ * for the same identifier and time. */
+DEF_TEST(rate_memo) {
+  value_list_t a, b;
+  value_t va, vb;
+
+  CHECK_ZERO(uc_init());
+
+  make_vl(&a, &va, "memo_a", 0, TIME_T_TO_CDTIME_T(1000));
+  CHECK_ZERO(uc_update(&ds_derive, &a));
+  make_vl(&a, &va, "memo_a", 100, TIME_T_TO_CDTIME_T(1010));
+  CHECK_ZERO(uc_update(&ds_derive, &a));
+
+  make_vl(&b, &vb, "memo_b", 0, TIME_T_TO_CDTIME_T(1000));
+  CHECK_ZERO(uc_update(&ds_derive, &b));
+  make_vl(&b, &vb, "memo_b", 500, TIME_T_TO_CDTIME_T(1010));
+  CHECK_ZERO(uc_update(&ds_derive, &b));
+
+  gauge_t *rates = uc_get_rate(&ds_derive, &b);
+  CHECK_NOT_NULL(rates);
+  EXPECT_EQ_DOUBLE(50.0, rates[0]);
+  sfree(rates);
+
+  rates = uc_get_rate(&ds_derive, &a);
+  CHECK_NOT_NULL(rates);
+  EXPECT_EQ_DOUBLE(10.0, rates[0]);
+  sfree(rates);
+
+  /* A rejected update leaves the memo alone. */
+  make_vl(&a, &va, "memo_a", 50, TIME_T_TO_CDTIME_T(1005));
+  OK(uc_update(&ds_derive, &a) != 0);
+  rates = uc_get_rate(&ds_derive, &b);
+  CHECK_NOT_NULL(rates);
+  EXPECT_EQ_DOUBLE(50.0, rates[0]);
+  sfree(rates);
+
+  return 0;
+}
+
+/* Entries whose data sources all have the same type take a specialized path
+ * in uc_update(); the results must not differ from the generic one. */
+DEF_TEST(layouts) {
+  data_source_t dsrc_gauge2[] = {
+      {"rx", DS_TYPE_GAUGE, NAN, NAN}, {"tx", DS_TYPE_GAUGE, NAN, NAN},
+  };
+  data_source_t dsrc_derive2[] = {
+      {"rx", DS_TYPE_DERIVE, 0.0, NAN}, {"tx", DS_TYPE_DERIVE, 0.0, NAN},
+  };
+  data_source_t dsrc_mixed[] = {
+      {"gauge", DS_TYPE_GAUGE, 0.0, 10.0},
+      {"counter", DS_TYPE_COUNTER, 0.0, NAN},
+      {"derive", DS_TYPE_DERIVE, NAN, NAN},
+      {"absolute", DS_TYPE_ABSOLUTE, 0.0, NAN},
+  };
+  struct {
+    data_set_t ds;
+    value_t first[4];
+    value_t second[4];
+    gauge_t want[4];
+  } cases[] = {
+      {{"gauge2", 2, dsrc_gauge2},
+       {{.gauge = 1.0}, {.gauge = 2.0}},
+       {{.gauge = -3.0}, {.gauge = 4.5}},
+       {-3.0, 4.5}},
+      /* Negative rates are pruned by the minimum of zero. */
+      {{"derive2", 2, dsrc_derive2},
+       {{.derive = 100}, {.derive = 500}},
+       {{.derive = 300}, {.derive = 400}},
+       {20.0, NAN}},
+      {{"mixed", 4, dsrc_mixed},
+       {{.gauge = 5.0}, {.counter = 4294967290U}, {.derive = 10},
+        {.absolute = 7}},
+       {{.gauge = 11.0}, {.counter = 4}, {.derive = -10}, {.absolute = 50}},
+       {NAN, 1.0, -2.0, 5.0}},
+  };
+
+  CHECK_ZERO(uc_init());
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    value_list_t vl = {
+        .values = cases[i].first,
+        .values_len = cases[i].ds.ds_num,
+        .time = TIME_T_TO_CDTIME_T(1000),
+        .interval = TIME_T_TO_CDTIME_T(10),
+    };
+    sstrncpy(vl.host, "example.com", sizeof(vl.host));
+    sstrncpy(vl.plugin, "layouts", sizeof(vl.plugin));
+    sstrncpy(vl.type, cases[i].ds.type, sizeof(vl.type));
+    CHECK_ZERO(uc_update(&cases[i].ds, &vl));
+
+    vl.values = cases[i].second;
+    vl.time = TIME_T_TO_CDTIME_T(1010);
+    CHECK_ZERO(uc_update(&cases[i].ds, &vl));
+
+    gauge_t *rates = uc_get_rate(&cases[i].ds, &vl);
+    CHECK_NOT_NULL(rates);
+    for (size_t j = 0; j < cases[i].ds.ds_num; j++)
+      EXPECT_EQ_DOUBLE(cases[i].want[j], rates[j]);
+    sfree(rates);
+  }
+
+  return 0;
+}
+
+DEF_TEST(names_and_iterator) {
+  char plugin[DATA_MAX_NAME_LEN];
+  value_list_t vl;
+  value_t v;
+
+  CHECK_ZERO(uc_init());
+
+  /* Insert enough entries to make all shards grow their hash tables. */
+  size_t before = uc_get_size();
+  int failed = 0;
+  for (int i = 0; i < 10000; i++) {
+    snprintf(plugin, sizeof(plugin), "names%05d", 9999 - i);
+    make_vl(&vl, &v, plugin, i, TIME_T_TO_CDTIME_T(1000));
+    if (uc_update(&ds_derive, &vl) != 0)
+      failed++;
+  }
+  EXPECT_EQ_INT(0, failed);
+  EXPECT_EQ_UINT64(before + 10000, uc_get_size());
+
+  char **names = NULL;
+  cdtime_t *times = NULL;
+  size_t names_num = 0;
+  CHECK_ZERO(uc_get_names(&names, &times, &names_num));
+  EXPECT_EQ_UINT64(before + 10000, names_num);
+  size_t unordered = 0;
+  for (size_t i = 1; i < names_num; i++) {
+    if (strcmp(names[i - 1], names[i]) >= 0)
+      unordered++;
+  }
+  EXPECT_EQ_UINT64(0, unordered);
+  for (size_t i = 0; i < names_num; i++)
+    sfree(names[i]);
+  sfree(names);
+  sfree(times);
+
+  uc_iter_t *iter = uc_get_iterator();
+  CHECK_NOT_NULL(iter);
+  char *name = NULL;
+  char *prev = NULL;
+  size_t iter_num = 0;
+  unordered = 0;
+  while (uc_iterator_next(iter, &name) == 0) {
+    if ((prev != NULL) && (strcmp(prev, name) >= 0))
+      unordered++;
+    prev = name;
+    iter_num++;
+  }
+  cdtime_t t = 0;
+  OK(uc_iterator_get_time(iter, &t) != 0);
+  uc_iterator_destroy(iter);
+  EXPECT_EQ_UINT64(0, unordered);
+  EXPECT_EQ_UINT64(before + 10000, iter_num);
+
+  return 0;
+}
+
+static bool match_odd(const char *name, void *user_data) {
+  size_t len = strlen(name);
+  (void)user_data;
+
+  /* Names end in "derive-<index>". */
+  return (len > 0) && (((name[len - 1] - '0') % 2) == 1);
+}
+
+DEF_TEST(query) {
+  value_list_t vl;
+  value_t v;
+
+  CHECK_ZERO(uc_init());
+
+  /* Three hosts with two plugins each, and enough entries to make the shards
+   * grow their indexes. */
+  int failed = 0;
+  for (int i = 0; i < 3000; i++) {
+    make_vl(&vl, &v, (i % 2) ? "qb" : "qa", i, TIME_T_TO_CDTIME_T(1000));
+    snprintf(vl.host, sizeof(vl.host), "q%d", i % 3);
+    snprintf(vl.type_instance, sizeof(vl.type_instance), "%d", i);
+    if (uc_update(&ds_derive, &vl) != 0)
+      failed++;
+  }
+  EXPECT_EQ_INT(0, failed);
+
+  struct {
+    char const *host;
+    char const *plugin;
+    size_t want;
+  } cases[] = {
+      {"q1", NULL, 1000}, {"q1", "qa", 500}, {NULL, "qb", 1500},
+      {"q", NULL, 0},     {NULL, "q", 0},    {"q2", "qc", 0},
+  };
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    char **names = NULL;
+    size_t names_num = 0;
+    CHECK_ZERO(uc_get_names_filtered(cases[i].host, cases[i].plugin, &names,
+                                     NULL, &names_num));
+    EXPECT_EQ_UINT64(cases[i].want, names_num);
+
+    size_t bad = 0;
+    for (size_t j = 0; j < names_num; j++) {
+      if ((j > 0) && (strcmp(names[j - 1], names[j]) >= 0))
+        bad++;
+      if ((cases[i].host != NULL) &&
+          (strncmp(names[j], cases[i].host, strlen(cases[i].host)) != 0))
+        bad++;
+    }
+    for (size_t j = 0; j < names_num; j++)
+      sfree(names[j]);
+    sfree(names);
+    EXPECT_EQ_UINT64(0, bad);
+  }
+
+  uc_snapshot_t *snaps = NULL;
+  size_t snaps_num = 0;
+  uc_query_t q = {.host = "q0", .match = match_odd};
+  CHECK_ZERO(uc_query(&q, &snaps, &snaps_num));
+  EXPECT_EQ_UINT64(500, snaps_num);
+  size_t bad = 0;
+  for (size_t i = 0; i < snaps_num; i++) {
+    int index = atoi(strrchr(snaps[i].name, '-') + 1);
+    if ((snaps[i].values_num != 1) || (snaps[i].values[0].derive != index) ||
+        ((index % 3) != 0) || ((index % 2) != 1) || (snaps[i].meta != NULL))
+      bad++;
+  }
+  EXPECT_EQ_UINT64(0, bad);
+  uc_snapshots_free(snaps, snaps_num);
+
+  return 0;
+}
+
+DEF_TEST(timeout) {
+  value_list_t vl;
+  value_t v;
+
+  CHECK_ZERO(uc_init());
+
+  cdtime_mock = TIME_T_TO_CDTIME_T(2000);
+  make_vl(&vl, &v, "timeout", 1, TIME_T_TO_CDTIME_T(2000));
+  CHECK_ZERO(uc_update(&ds_derive, &vl));
+
+  value_t *values = NULL;
+  size_t values_num = 0;
+  CHECK_ZERO(uc_get_value_by_name("example.com/timeout/derive", &values,
+                                  &values_num));
+  EXPECT_EQ_UINT64(1, values_num);
+  sfree(values);
+  OK(uc_exists(&vl));
+
+  /* Everything is older than interval * timeout_g now. */
+  cdtime_mock = TIME_T_TO_CDTIME_T(3000);
+  missing_num = 0;
+  size_t before = uc_get_size();
+  CHECK_ZERO(uc_check_timeout());
+  EXPECT_EQ_INT((int)before, missing_num);
+  EXPECT_EQ_UINT64(0, uc_get_size());
+
+  OK(uc_get_value_by_name("example.com/timeout/derive", &values,
+                          &values_num) != 0);
+  OK(!uc_exists(&vl));
+
+  /* The removed entries are gone from the indexes, too. */
+  char **names = NULL;
+  size_t names_num = 0;
+  CHECK_ZERO(uc_get_names_filtered("q1", NULL, &names, NULL, &names_num));
+  EXPECT_EQ_UINT64(0, names_num);
+
+  /* Entries are only removed once interval * timeout_g has passed since their
+   * last update. */
+  make_vl(&vl, &v, "timeout", 2, TIME_T_TO_CDTIME_T(3000));
+  CHECK_ZERO(uc_update(&ds_derive, &vl));
+
+  cdtime_mock = TIME_T_TO_CDTIME_T(3015);
+  make_vl(&vl, &v, "timeout", 3, TIME_T_TO_CDTIME_T(3015));
+  CHECK_ZERO(uc_update(&ds_derive, &vl));
+
+  cdtime_mock = TIME_T_TO_CDTIME_T(3030);
+  missing_num = 0;
+  CHECK_ZERO(uc_check_timeout());
+  EXPECT_EQ_INT(0, missing_num);
+  EXPECT_EQ_UINT64(1, uc_get_size());
+
+  cdtime_mock = TIME_T_TO_CDTIME_T(3035);
+  CHECK_ZERO(uc_check_timeout());
+  EXPECT_EQ_INT(1, missing_num);
+  EXPECT_EQ_UINT64(0, uc_get_size());
+
+  return 0;
+}
+
+DEF_TEST(threshold) {
+  value_list_t vl;
+  value_t v;
+  int th = 42;
+  void *ret = NULL;
+
+  CHECK_ZERO(uc_init());
+
+  make_vl(&vl, &v, "threshold", 1, TIME_T_TO_CDTIME_T(1000));
+  EXPECT_EQ_INT(ENOENT, uc_set_threshold(&vl, 1, &th));
+  CHECK_ZERO(uc_update(&ds_derive, &vl));
+
+  EXPECT_EQ_INT(ENOENT, uc_get_threshold(&vl, 1, &ret));
+  CHECK_ZERO(uc_set_threshold(&vl, 1, &th));
+  CHECK_ZERO(uc_get_threshold(&vl, 1, &ret));
+  OK(ret == &th);
+
+  /* A stale generation is not returned. */
+  EXPECT_EQ_INT(ENOENT, uc_get_threshold(&vl, 2, &ret));
+
+  /* "No threshold" is cached, too. */
+  CHECK_ZERO(uc_set_threshold(&vl, 2, NULL));
+  CHECK_ZERO(uc_get_threshold(&vl, 2, &ret));
+  OK(ret == NULL);
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(update_and_rate);
+  RUN_TEST(rate_memo);
+  RUN_TEST(layouts);
+  RUN_TEST(names_and_iterator);
+  RUN_TEST(query);
+  RUN_TEST(timeout);
+  RUN_TEST(threshold);
+
+  END_TEST;
+}
@@ -97,3 +97,23 @@ void c_do_release(int level, c_complain_t *c, const char *format, ...) {
 
   plugin_log(level, "%s", message);
 } /* c_release */
+
+bool c_ratelimit(c_ratelimit_t *rl, int limit, cdtime_t window, cdtime_t now,
+                 int *ret_suppressed) {
+  *ret_suppressed = 0;
+
+  if ((now < rl->start) || ((now - rl->start) >= window)) {
+    *ret_suppressed = rl->suppressed;
+    rl->start = now;
+    rl->count = 0;
+    rl->suppressed = 0;
+  }
+
+  if (rl->count >= limit) {
+    rl->suppressed++;
+    return false;
+  }
+
+  rl->count++;
+  return true;
+} /* c_ratelimit */
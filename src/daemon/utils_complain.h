@@ -112,4 +112,39 @@ c_do_release(int level, c_complain_t *c, const char *format, ...);
       c_do_release(level, c, __VA_ARGS__);                                     \
   } while (0)
 
+typedef struct {
+  /* start of the current window */
+  cdtime_t start;
+
+  /* events let through and suppressed in the current window */
+  int count;
+  int suppressed;
+} c_ratelimit_t;
+
+#define C_RATELIMIT_INIT_STATIC                                                \
+  { 0, 0, 0 }
+
+/*
+ * NAME
+ *   c_ratelimit
+ *
+ * DESCRIPTION
+ *   Rate limits an event, e.g. a log message, to `limit' occurrences per
+ *   `window'. Unlike `c_complain', this does not report anything itself and
+ *   is not thread-safe; callers have to serialize access to `rl'.
+ *
+ * PARAMETERS
+ *   `rl'             State of the rate limit.
+ *   `limit'          Number of events let through per window.
+ *   `window'         Length of a window.
+ *   `now'            Current time.
+ *   `ret_suppressed' Set to the number of events suppressed in the previous
+ *                    window when a new window begins, and to zero otherwise.
+ *
+ * RETURN VALUE
+ *   True if the event should be reported, false if it should be suppressed.
+ */
+bool c_ratelimit(c_ratelimit_t *rl, int limit, cdtime_t window, cdtime_t now,
+                 int *ret_suppressed);
+
 #endif /* UTILS_COMPLAIN_H */
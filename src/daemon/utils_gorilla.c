@@ -0,0 +1,503 @@
+/**
+ * collectd - src/daemon/utils_gorilla.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "utils_gorilla.h"
+
+/* Number of samples per chunk. Each chunk starts with an uncompressed sample,
+ * so larger chunks compress better but are dropped less precisely. */
+#ifndef GORILLA_CHUNK_SAMPLES
+#define GORILLA_CHUNK_SAMPLES 120
+#endif
+
+/* Marks the encoder state of a value as "no previous XOR window". */
+#define GORILLA_NO_WINDOW 0xff
+
+typedef struct gorilla_chunk_s {
+  struct gorilla_chunk_s *next;
+  uint64_t first_ms;
+  uint64_t last_ms;
+  size_t samples;
+
+  uint8_t *data;
+  size_t size; /* bytes allocated */
+  size_t bits; /* bits used */
+} gorilla_chunk_t;
+
+/* State shared by the encoder and the decoder. */
+typedef struct {
+  uint64_t ms;
+  int64_t delta;
+  uint64_t *values;
+  uint8_t *leading;
+  uint8_t *trailing;
+} gorilla_state_t;
+
+struct gorilla_s {
+  size_t values_num;
+
+  gorilla_chunk_t *head; /* oldest chunk */
+  gorilla_chunk_t *tail; /* newest chunk, the one being appended to */
+  size_t samples;
+  size_t bytes;
+
+  gorilla_state_t state; /* encoder state of "tail" */
+  bool sealed;           /* if true, "tail" must not be appended to */
+};
+
+typedef struct {
+  gorilla_chunk_t const *chunk;
+  size_t pos;
+  bool error;
+} gorilla_reader_t;
+
+static unsigned gorilla_clz(uint64_t v) /* {{{ */
+{
+#if defined(__GNUC__)
+  return (v == 0) ? 64 : (unsigned)__builtin_clzll(v);
+#else
+  unsigned n = 0;
+  for (uint64_t mask = UINT64_C(1) << 63; (mask != 0) && !(v & mask);
+       mask >>= 1)
+    n++;
+  return n;
+#endif
+} /* }}} unsigned gorilla_clz */
+
+static unsigned gorilla_ctz(uint64_t v) /* {{{ */
+{
+#if defined(__GNUC__)
+  return (v == 0) ? 64 : (unsigned)__builtin_ctzll(v);
+#else
+  unsigned n = 0;
+  for (uint64_t mask = 1; (mask != 0) && !(v & mask); mask <<= 1)
+    n++;
+  return n;
+#endif
+} /* }}} unsigned gorilla_ctz */
+
+static uint64_t gorilla_double_bits(gauge_t v) /* {{{ */
+{
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return bits;
+} /* }}} uint64_t gorilla_double_bits */
+
+static gauge_t gorilla_bits_double(uint64_t bits) /* {{{ */
+{
+  gauge_t v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+} /* }}} gauge_t gorilla_bits_double */
+
+static int gorilla_state_init(gorilla_state_t *s, size_t values_num) /* {{{ */
+{
+  s->values = calloc(values_num, sizeof(*s->values));
+  s->leading = calloc(values_num, sizeof(*s->leading));
+  s->trailing = calloc(values_num, sizeof(*s->trailing));
+  if ((s->values == NULL) || (s->leading == NULL) || (s->trailing == NULL)) {
+    sfree(s->values);
+    sfree(s->leading);
+    sfree(s->trailing);
+    return ENOMEM;
+  }
+  return 0;
+} /* }}} int gorilla_state_init */
+
+static void gorilla_state_free(gorilla_state_t *s) /* {{{ */
+{
+  sfree(s->values);
+  sfree(s->leading);
+  sfree(s->trailing);
+} /* }}} void gorilla_state_free */
+
+/*
+ * Bit stream
+ */
+static int gorilla_put(gorilla_chunk_t *c, uint64_t v, unsigned n) /* {{{ */
+{
+  size_t need = (c->bits + n + 7) / 8;
+
+  if (need > c->size) {
+    size_t size = (c->size > 0) ? 2 * c->size : 64;
+    while (size < need)
+      size *= 2;
+
+    uint8_t *tmp = realloc(c->data, size);
+    if (tmp == NULL)
+      return ENOMEM;
+    memset(tmp + c->size, 0, size - c->size);
+    c->data = tmp;
+    c->size = size;
+  }
+
+  for (unsigned i = n; i > 0; i--) {
+    if ((v >> (i - 1)) & 1)
+      c->data[c->bits / 8] |= (uint8_t)(0x80 >> (c->bits % 8));
+    c->bits++;
+  }
+
+  return 0;
+} /* }}} int gorilla_put */
+
+static uint64_t gorilla_get(gorilla_reader_t *r, unsigned n) /* {{{ */
+{
+  uint64_t v = 0;
+
+  if ((r->pos + n) > r->chunk->bits) {
+    r->error = true;
+    return 0;
+  }
+
+  for (unsigned i = 0; i < n; i++) {
+    v = (v << 1) | ((r->chunk->data[r->pos / 8] >> (7 - (r->pos % 8))) & 1);
+    r->pos++;
+  }
+
+  return v;
+} /* }}} uint64_t gorilla_get */
+
+/*
+ * Encoder
+ */
+static int gorilla_put_dod(gorilla_chunk_t *c, int64_t dod) /* {{{ */
+{
+  if (dod == 0)
+    return gorilla_put(c, 0, 1);
+  if ((dod >= -63) && (dod <= 64))
+    return gorilla_put(c, (0x2 << 7) | (uint64_t)(dod + 63), 2 + 7);
+  if ((dod >= -255) && (dod <= 256))
+    return gorilla_put(c, (0x6 << 9) | (uint64_t)(dod + 255), 3 + 9);
+  if ((dod >= -2047) && (dod <= 2048))
+    return gorilla_put(c, (0xe << 12) | (uint64_t)(dod + 2047), 4 + 12);
+
+  int status = gorilla_put(c, 0xf, 4);
+  if (status == 0)
+    status = gorilla_put(c, (uint64_t)dod, 64);
+  return status;
+} /* }}} int gorilla_put_dod */
+
+static int gorilla_put_value(gorilla_chunk_t *c, gorilla_state_t *s, /* {{{ */
+                             size_t i, uint64_t bits) {
+  uint64_t xor = bits ^ s->values[i];
+  int status;
+
+  s->values[i] = bits;
+  if (xor == 0)
+    return gorilla_put(c, 0, 1);
+
+  unsigned leading = gorilla_clz(xor);
+  unsigned trailing = gorilla_ctz(xor);
+  if (leading > 31)
+    leading = 31;
+
+  /* Re-use the previous window if the meaningful bits fit into it. */
+  if ((s->leading[i] != GORILLA_NO_WINDOW) && (leading >= s->leading[i]) &&
+      (trailing >= s->trailing[i])) {
+    unsigned len = 64 - s->leading[i] - s->trailing[i];
+    status = gorilla_put(c, 0x2, 2);
+    if (status == 0)
+      status = gorilla_put(c, xor >> s->trailing[i], len);
+    return status;
+  }
+
+  unsigned len = 64 - leading - trailing;
+  status = gorilla_put(c, 0x3, 2);
+  if (status == 0)
+    status = gorilla_put(c, leading, 5);
+  if (status == 0)
+    status = gorilla_put(c, len & 0x3f, 6); /* 64 is stored as zero */
+  if (status == 0)
+    status = gorilla_put(c, xor >> trailing, len);
+
+  s->leading[i] = (uint8_t)leading;
+  s->trailing[i] = (uint8_t)trailing;
+  return status;
+} /* }}} int gorilla_put_value */
+
+static void gorilla_chunk_free(gorilla_chunk_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return;
+  sfree(c->data);
+  sfree(c);
+} /* }}} void gorilla_chunk_free */
+
+/* Releases the unused space of a full chunk. */
+static void gorilla_chunk_close(gorilla_t *g, gorilla_chunk_t *c) /* {{{ */
+{
+  size_t size = (c->bits + 7) / 8;
+  uint8_t *tmp;
+
+  if ((size == 0) || (size >= c->size))
+    return;
+
+  tmp = realloc(c->data, size);
+  if (tmp == NULL)
+    return;
+
+  g->bytes -= c->size - size;
+  c->data = tmp;
+  c->size = size;
+} /* }}} void gorilla_chunk_close */
+
+gorilla_t *gorilla_create(size_t values_num) /* {{{ */
+{
+  gorilla_t *g = calloc(1, sizeof(*g));
+  if (g == NULL)
+    return NULL;
+
+  g->values_num = values_num;
+  if (gorilla_state_init(&g->state, values_num) != 0) {
+    sfree(g);
+    return NULL;
+  }
+
+  return g;
+} /* }}} gorilla_t *gorilla_create */
+
+void gorilla_destroy(gorilla_t *g) /* {{{ */
+{
+  if (g == NULL)
+    return;
+
+  while (g->head != NULL) {
+    gorilla_chunk_t *next = g->head->next;
+    gorilla_chunk_free(g->head);
+    g->head = next;
+  }
+  gorilla_state_free(&g->state);
+  sfree(g);
+} /* }}} void gorilla_destroy */
+
+int gorilla_append(gorilla_t *g, cdtime_t t, gauge_t const *values) /* {{{ */
+{
+  uint64_t ms = CDTIME_T_TO_MS(t);
+  gorilla_state_t *s = &g->state;
+  gorilla_chunk_t *c = g->tail;
+  int status = 0;
+
+  if ((c != NULL) && (ms <= s->ms))
+    return EINVAL;
+
+  if ((c == NULL) || g->sealed || (c->samples >= GORILLA_CHUNK_SAMPLES)) {
+    gorilla_chunk_t *n = calloc(1, sizeof(*n));
+    if (n == NULL)
+      return ENOMEM;
+
+    if (c != NULL) {
+      gorilla_chunk_close(g, c);
+      c->next = n;
+    } else {
+      g->head = n;
+    }
+    g->tail = c = n;
+    g->sealed = false;
+  }
+
+  size_t size = c->size;
+  size_t bits = c->bits;
+  if (c->samples == 0) {
+    /* The first sample of a chunk is stored uncompressed. */
+    status = gorilla_put(c, ms, 64);
+    for (size_t i = 0; (status == 0) && (i < g->values_num); i++) {
+      s->values[i] = gorilla_double_bits(values[i]);
+      s->leading[i] = GORILLA_NO_WINDOW;
+      s->trailing[i] = 0;
+      status = gorilla_put(c, s->values[i], 64);
+    }
+    s->delta = 0;
+  } else {
+    int64_t delta = (int64_t)(ms - s->ms);
+    status = gorilla_put_dod(c, delta - s->delta);
+    for (size_t i = 0; (status == 0) && (i < g->values_num); i++)
+      status = gorilla_put_value(c, s, i, gorilla_double_bits(values[i]));
+    s->delta = delta;
+  }
+  g->bytes += c->size - size;
+
+  if (status != 0) {
+    /* Cut off the partially written sample. The encoder state has been
+     * modified already, so later samples go to a new chunk. */
+    c->bits = bits;
+    g->sealed = true;
+    return status;
+  }
+
+  if (c->samples == 0)
+    c->first_ms = ms;
+  s->ms = ms;
+  c->last_ms = ms;
+  c->samples++;
+  g->samples++;
+
+  return 0;
+} /* }}} int gorilla_append */
+
+void gorilla_expire(gorilla_t *g, cdtime_t oldest) /* {{{ */
+{
+  uint64_t oldest_ms = CDTIME_T_TO_MS(oldest);
+
+  while ((g->head != NULL) && (g->head != g->tail) &&
+         (g->head->last_ms < oldest_ms)) {
+    gorilla_chunk_t *c = g->head;
+
+    g->head = c->next;
+    g->samples -= c->samples;
+    g->bytes -= c->size;
+    gorilla_chunk_free(c);
+  }
+} /* }}} void gorilla_expire */
+
+/*
+ * Decoder
+ */
+static int64_t gorilla_get_dod(gorilla_reader_t *r) /* {{{ */
+{
+  if (gorilla_get(r, 1) == 0)
+    return 0;
+  if (gorilla_get(r, 1) == 0)
+    return (int64_t)gorilla_get(r, 7) - 63;
+  if (gorilla_get(r, 1) == 0)
+    return (int64_t)gorilla_get(r, 9) - 255;
+  if (gorilla_get(r, 1) == 0)
+    return (int64_t)gorilla_get(r, 12) - 2047;
+  return (int64_t)gorilla_get(r, 64);
+} /* }}} int64_t gorilla_get_dod */
+
+static uint64_t gorilla_get_value(gorilla_reader_t *r, /* {{{ */
+                                  gorilla_state_t *s, size_t i) {
+  if (gorilla_get(r, 1) == 0)
+    return s->values[i];
+
+  if (gorilla_get(r, 1) != 0) {
+    s->leading[i] = (uint8_t)gorilla_get(r, 5);
+    unsigned len = (unsigned)gorilla_get(r, 6);
+    if (len == 0)
+      len = 64;
+    if ((s->leading[i] + len) > 64) {
+      r->error = true;
+      return 0;
+    }
+    s->trailing[i] = (uint8_t)(64 - s->leading[i] - len);
+  }
+
+  unsigned len = 64 - s->leading[i] - s->trailing[i];
+  s->values[i] ^= gorilla_get(r, len) << s->trailing[i];
+  return s->values[i];
+} /* }}} uint64_t gorilla_get_value */
+
+int gorilla_range(gorilla_t const *g, cdtime_t start, /* {{{ */
+                  cdtime_t end, cdtime_t **ret_times, gauge_t **ret_values,
+                  size_t *ret_num) {
+  uint64_t start_ms = CDTIME_T_TO_MS(start);
+  uint64_t end_ms = CDTIME_T_TO_MS(end);
+  cdtime_t *times = NULL;
+  gauge_t *values = NULL;
+  size_t num = 0;
+  size_t size = 0;
+  gorilla_state_t s = {0};
+  int status = 0;
+
+  if ((g == NULL) || (ret_times == NULL) || (ret_values == NULL) ||
+      (ret_num == NULL))
+    return EINVAL;
+
+  if (gorilla_state_init(&s, g->values_num) != 0)
+    return ENOMEM;
+
+  for (gorilla_chunk_t const *c = g->head; c != NULL; c = c->next) {
+    if ((c->last_ms < start_ms) || (c->first_ms > end_ms))
+      continue;
+
+    gorilla_reader_t r = {.chunk = c};
+    for (size_t n = 0; n < c->samples; n++) {
+      if (n == 0) {
+        s.ms = gorilla_get(&r, 64);
+        for (size_t i = 0; i < g->values_num; i++)
+          s.values[i] = gorilla_get(&r, 64);
+        s.delta = 0;
+      } else {
+        s.delta += gorilla_get_dod(&r);
+        s.ms += (uint64_t)s.delta;
+        for (size_t i = 0; i < g->values_num; i++)
+          gorilla_get_value(&r, &s, i);
+      }
+      if (r.error || (s.ms > end_ms))
+        break;
+      if (s.ms < start_ms)
+        continue;
+
+      if (num >= size) {
+        size_t new_size = (size > 0) ? 2 * size : 64;
+        cdtime_t *t = realloc(times, new_size * sizeof(*times));
+        if (t == NULL) {
+          status = ENOMEM;
+          break;
+        }
+        times = t;
+
+        gauge_t *v =
+            realloc(values, new_size * g->values_num * sizeof(*values));
+        if ((v == NULL) && (g->values_num > 0)) {
+          status = ENOMEM;
+          break;
+        }
+        values = v;
+        size = new_size;
+      }
+
+      times[num] = MS_TO_CDTIME_T(s.ms);
+      for (size_t i = 0; i < g->values_num; i++)
+        values[num * g->values_num + i] = gorilla_bits_double(s.values[i]);
+      num++;
+    }
+
+    if (status != 0)
+      break;
+  }
+  gorilla_state_free(&s);
+
+  if (status != 0) {
+    sfree(times);
+    sfree(values);
+    return status;
+  }
+
+  *ret_times = times;
+  *ret_values = values;
+  *ret_num = num;
+  return 0;
+} /* }}} int gorilla_range */
+
+size_t gorilla_samples(gorilla_t const *g) /* {{{ */
+{
+  return (g != NULL) ? g->samples : 0;
+} /* }}} size_t gorilla_samples */
+
+size_t gorilla_bytes(gorilla_t const *g) /* {{{ */
+{
+  return (g != NULL) ? g->bytes : 0;
+} /* }}} size_t gorilla_bytes */
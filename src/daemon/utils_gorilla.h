@@ -0,0 +1,105 @@
+/**
+ * collectd - src/daemon/utils_gorilla.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_GORILLA_H
+#define UTILS_GORILLA_H 1
+
+#include "collectd.h"
+
+#include "plugin.h"
+
+/*
+ * A compressed in-memory time series, using the encoding described in
+ * "Gorilla: A Fast, Scalable, In-Memory Time Series Database" (Pelkonen et
+ * al., 2015): timestamps are stored as delta-of-deltas, values as the XOR
+ * with the previous value. Samples are kept in chunks of a fixed number of
+ * samples, so old data can be dropped a chunk at a time.
+ *
+ * Each sample consists of one timestamp and a fixed number of values.
+ * Timestamps are stored with millisecond resolution.
+ */
+struct gorilla_s;
+typedef struct gorilla_s gorilla_t;
+
+/*
+ * NAME
+ *   gorilla_create
+ *
+ * DESCRIPTION
+ *   Allocates a new, empty time series holding "values_num" values per
+ *   sample.
+ *
+ * RETURN VALUE
+ *   A gorilla_t-pointer upon success or NULL upon failure.
+ */
+gorilla_t *gorilla_create(size_t values_num);
+
+void gorilla_destroy(gorilla_t *g);
+
+/*
+ * NAME
+ *   gorilla_append
+ *
+ * DESCRIPTION
+ *   Appends a sample to the time series. "values" must point to as many
+ *   values as have been passed to gorilla_create().
+ *
+ * RETURN VALUE
+ *   Zero upon success, EINVAL if "t" (rounded to milliseconds) is not newer
+ *   than the last sample, ENOMEM if allocating memory failed.
+ */
+int gorilla_append(gorilla_t *g, cdtime_t t, gauge_t const *values);
+
+/*
+ * NAME
+ *   gorilla_expire
+ *
+ * DESCRIPTION
+ *   Drops the chunks which only contain samples older than "oldest". The
+ *   chunk currently being appended to is never dropped.
+ */
+void gorilla_expire(gorilla_t *g, cdtime_t oldest);
+
+/*
+ * NAME
+ *   gorilla_range
+ *
+ * DESCRIPTION
+ *   Decodes all samples with a timestamp in the closed interval
+ *   ["start", "end"]. The timestamps are returned in "ret_times", the values
+ *   in "ret_values", sample after sample. Both arrays must be freed by the
+ *   caller. If no sample matches, both are set to NULL.
+ *
+ * RETURN VALUE
+ *   Zero upon success, ENOMEM if allocating memory failed.
+ */
+int gorilla_range(gorilla_t const *g, cdtime_t start, cdtime_t end,
+                  cdtime_t **ret_times, gauge_t **ret_values, size_t *ret_num);
+
+/* Returns the number of samples stored. */
+size_t gorilla_samples(gorilla_t const *g);
+
+/* Returns the number of bytes used by the encoded samples. */
+size_t gorilla_bytes(gorilla_t const *g);
+
+#endif /* UTILS_GORILLA_H */
@@ -0,0 +1,141 @@
+/**
+ * collectd - src/daemon/utils_gorilla_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "testing.h"
+#include "utils_gorilla.h"
+
+/* Generates a sample at a roughly regular interval, with values that change
+ * a little from one sample to the next. */
+static void make_sample(int n, cdtime_t *t, gauge_t values[3]) {
+  *t = TIME_T_TO_CDTIME_T(1500000000) + n * MS_TO_CDTIME_T(10000) +
+       MS_TO_CDTIME_T(n % 3);
+  values[0] = 42.0;
+  values[1] = (double)(n % 17) * 0.25;
+  values[2] = (n % 50 == 0) ? NAN : 1000.0 + (double)n;
+}
+
+DEF_TEST(round_trip) {
+  gorilla_t *g;
+  cdtime_t t;
+  gauge_t values[3];
+  int samples = 1000;
+
+  CHECK_NOT_NULL(g = gorilla_create(STATIC_ARRAY_SIZE(values)));
+  for (int n = 0; n < samples; n++) {
+    make_sample(n, &t, values);
+    CHECK_ZERO(gorilla_append(g, t, values));
+  }
+  EXPECT_EQ_UINT64(samples, gorilla_samples(g));
+
+  /* Samples must be newer than the last one. */
+  EXPECT_EQ_INT(EINVAL, gorilla_append(g, t, values));
+
+  /* Three values per sample: well below the 24 bytes of raw doubles. */
+  OK(gorilla_bytes(g) < (size_t)samples * 8);
+
+  cdtime_t *times = NULL;
+  gauge_t *ret = NULL;
+  size_t num = 0;
+  CHECK_ZERO(gorilla_range(g, 0, t, &times, &ret, &num));
+  EXPECT_EQ_UINT64(samples, num);
+
+  /* Values must be reproduced bit by bit, NaNs included. */
+  int mismatches = 0;
+  for (int n = 0; n < samples; n++) {
+    make_sample(n, &t, values);
+    if (CDTIME_T_TO_MS(t) != CDTIME_T_TO_MS(times[n]))
+      mismatches++;
+    if (memcmp(values, ret + 3 * n, sizeof(values)) != 0)
+      mismatches++;
+  }
+  EXPECT_EQ_INT(0, mismatches);
+  sfree(times);
+  sfree(ret);
+
+  gorilla_destroy(g);
+  return 0;
+}
+
+DEF_TEST(range_and_expire) {
+  gorilla_t *g;
+  cdtime_t t;
+  gauge_t values[3];
+  cdtime_t first, last;
+
+  CHECK_NOT_NULL(g = gorilla_create(STATIC_ARRAY_SIZE(values)));
+  for (int n = 0; n < 1000; n++) {
+    make_sample(n, &t, values);
+    CHECK_ZERO(gorilla_append(g, t, values));
+  }
+
+  make_sample(100, &first, values);
+  make_sample(199, &last, values);
+
+  cdtime_t *times = NULL;
+  gauge_t *ret = NULL;
+  size_t num = 0;
+  CHECK_ZERO(gorilla_range(g, first, last, &times, &ret, &num));
+  EXPECT_EQ_UINT64(100, num);
+  EXPECT_EQ_UINT64(CDTIME_T_TO_MS(first), CDTIME_T_TO_MS(times[0]));
+  EXPECT_EQ_UINT64(CDTIME_T_TO_MS(last), CDTIME_T_TO_MS(times[num - 1]));
+  EXPECT_EQ_DOUBLE(1101.0, ret[3 + 2]);
+  sfree(times);
+  sfree(ret);
+
+  /* Expiring drops whole chunks only: nothing at or after "first" is lost. */
+  size_t bytes = gorilla_bytes(g);
+  gorilla_expire(g, last);
+  OK(gorilla_samples(g) < 1000);
+  OK(gorilla_samples(g) >= 1000 - 199);
+  OK(gorilla_bytes(g) < bytes);
+
+  CHECK_ZERO(gorilla_range(g, 0, last, &times, &ret, &num));
+  OK(num > 0);
+  EXPECT_EQ_UINT64(CDTIME_T_TO_MS(last), CDTIME_T_TO_MS(times[num - 1]));
+  sfree(times);
+  sfree(ret);
+
+  /* The chunk being appended to is kept. */
+  gorilla_expire(g, t + TIME_T_TO_CDTIME_T(3600));
+  OK(gorilla_samples(g) > 0);
+  make_sample(1000, &t, values);
+  CHECK_ZERO(gorilla_append(g, t, values));
+
+  /* An empty range returns no samples. */
+  CHECK_ZERO(gorilla_range(g, 0, TIME_T_TO_CDTIME_T(1), &times, &ret, &num));
+  EXPECT_EQ_UINT64(0, num);
+  OK(times == NULL);
+
+  gorilla_destroy(g);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(round_trip);
+  RUN_TEST(range_and_expire);
+
+  END_TEST;
+}
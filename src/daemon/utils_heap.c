@@ -27,75 +27,155 @@
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 #include "utils_heap.h"
 
+/* Number of children per node. A 4-ary heap is half as deep as a binary one
+ * and the children of a node share a cache line, which makes sifting down
+ * cheaper. */
+#define C_HEAP_ARITY 4
+#define C_HEAP_MIN_SIZE 16
+
 struct c_heap_s {
   pthread_mutex_t lock;
+  bool use_lock;
   int (*compare)(const void *, const void *);
 
+  /* If set, each element keeps its position in "list" in the size_t at
+   * "index_offset". */
+  bool indexed;
+  size_t index_offset;
+
   void **list;
   size_t list_len;  /* # entries used */
   size_t list_size; /* # entries allocated */
 };
 
-enum reheap_direction { DIR_UP, DIR_DOWN };
+static void heap_lock(c_heap_t *h) {
+  if (h->use_lock)
+    pthread_mutex_lock(&h->lock);
+}
 
-static void reheap(c_heap_t *h, size_t root, enum reheap_direction dir) {
-  size_t left;
-  size_t right;
-  size_t min;
-  int status;
+static void heap_unlock(c_heap_t *h) {
+  if (h->use_lock)
+    pthread_mutex_unlock(&h->lock);
+}
 
-  /* Calculate the positions of the children */
-  left = (2 * root) + 1;
-  if (left >= h->list_len)
-    left = 0;
+static size_t *heap_index_ptr(c_heap_t const *h, void *ptr) {
+  return (size_t *)((char *)ptr + h->index_offset);
+}
 
-  right = (2 * root) + 2;
-  if (right >= h->list_len)
-    right = 0;
+static void heap_set(c_heap_t *h, size_t index, void *ptr) {
+  h->list[index] = ptr;
+  if (h->indexed)
+    *heap_index_ptr(h, ptr) = index;
+}
+
+/* Returns the position of "ptr" or h->list_len if it is not in the heap. */
+static size_t heap_find(c_heap_t const *h, void *ptr) {
+  size_t index = *heap_index_ptr(h, ptr);
+  if ((index < h->list_len) && (h->list[index] == ptr))
+    return index;
+  return h->list_len;
+}
+
+/* Moves the element at "index" towards the root while it is smaller than its
+ * parent. Returns the element's new position. */
+static size_t sift_up(c_heap_t *h, size_t index) {
+  void *ptr = h->list[index];
+
+  while (index > 0) {
+    size_t parent = (index - 1) / C_HEAP_ARITY;
+    if (h->compare(h->list[parent], ptr) <= 0)
+      break;
+    heap_set(h, index, h->list[parent]);
+    index = parent;
+  }
 
-  /* Check which one of the children is smaller. */
-  if ((left == 0) && (right == 0))
-    return;
-  else if (left == 0)
-    min = right;
-  else if (right == 0)
-    min = left;
-  else {
-    status = h->compare(h->list[left], h->list[right]);
-    if (status > 0)
-      min = right;
-    else
-      min = left;
+  heap_set(h, index, ptr);
+  return index;
+} /* size_t sift_up */
+
+/* Moves the element at "index" towards the leaves while it is bigger than its
+ * smallest child. */
+static void sift_down(c_heap_t *h, size_t index) {
+  void *ptr = h->list[index];
+
+  while (42) {
+    size_t first = (C_HEAP_ARITY * index) + 1;
+    if (first >= h->list_len)
+      break;
+
+    size_t last = first + C_HEAP_ARITY;
+    if (last > h->list_len)
+      last = h->list_len;
+
+    size_t min = first;
+    for (size_t i = first + 1; i < last; i++)
+      if (h->compare(h->list[i], h->list[min]) < 0)
+        min = i;
+
+    if (h->compare(ptr, h->list[min]) <= 0)
+      break;
+    heap_set(h, index, h->list[min]);
+    index = min;
   }
 
-  status = h->compare(h->list[root], h->list[min]);
-  if (status <= 0) {
-    /* We didn't need to change anything, so the rest of the tree should be
-     * okay now. */
-    return;
-  } else /* if (status > 0) */
-  {
-    void *tmp;
+  heap_set(h, index, ptr);
+} /* void sift_down */
+
+/* Restores the heap order after the key of the element at "index" changed. */
+static void heap_fix(c_heap_t *h, size_t index) {
+  if (sift_up(h, index) == index)
+    sift_down(h, index);
+}
+
+/* Makes room for at least "num" elements. */
+static int heap_reserve(c_heap_t *h, size_t num) {
+  if (num <= h->list_size)
+    return 0;
 
-    tmp = h->list[root];
-    h->list[root] = h->list[min];
-    h->list[min] = tmp;
+  size_t size = (h->list_size < C_HEAP_MIN_SIZE) ? C_HEAP_MIN_SIZE
+                                                 : h->list_size;
+  while (size < num)
+    size *= 2;
+
+  void **tmp = realloc(h->list, size * sizeof(*h->list));
+  if (tmp == NULL)
+    return -ENOMEM;
+
+  h->list = tmp;
+  h->list_size = size;
+  return 0;
+} /* int heap_reserve */
+
+/* Removes the element at "index" and returns it. */
+static void *heap_remove_at(c_heap_t *h, size_t index) {
+  void *ret = h->list[index];
+
+  h->list_len--;
+  if (index != h->list_len) {
+    heap_set(h, index, h->list[h->list_len]);
+    heap_fix(h, index);
   }
+  h->list[h->list_len] = NULL;
 
-  if ((dir == DIR_UP) && (root == 0))
-    return;
+  /* free some memory */
+  if ((h->list_size > C_HEAP_MIN_SIZE) && (h->list_len < h->list_size / 4)) {
+    void **tmp = realloc(h->list, (h->list_size / 2) * sizeof(*h->list));
+    if (tmp != NULL) {
+      h->list = tmp;
+      h->list_size /= 2;
+    }
+  }
 
-  if (dir == DIR_UP)
-    reheap(h, (root - 1) / 2, dir);
-  else if (dir == DIR_DOWN)
-    reheap(h, min, dir);
-} /* void reheap */
+  return ret;
+} /* void *heap_remove_at */
 
-c_heap_t *c_heap_create(int (*compare)(const void *, const void *)) {
+c_heap_t *c_heap_create_ex(int (*compare)(const void *, const void *),
+                           int flags, size_t index_offset) {
   c_heap_t *h;
 
   if (compare == NULL)
@@ -105,14 +185,23 @@ c_heap_t *c_heap_create(int (*compare)(const void *, const void *)) {
   if (h == NULL)
     return NULL;
 
-  pthread_mutex_init(&h->lock, /* attr = */ NULL);
+  h->use_lock = !(flags & C_HEAP_UNLOCKED);
+  if (h->use_lock)
+    pthread_mutex_init(&h->lock, /* attr = */ NULL);
   h->compare = compare;
 
+  h->indexed = (flags & C_HEAP_INDEXED) != 0;
+  h->index_offset = index_offset;
+
   h->list = NULL;
   h->list_len = 0;
   h->list_size = 0;
 
   return h;
+} /* c_heap_t *c_heap_create_ex */
+
+c_heap_t *c_heap_create(int (*compare)(const void *, const void *)) {
+  return c_heap_create_ex(compare, /* flags = */ 0, /* index_offset = */ 0);
 } /* c_heap_t *c_heap_create */
 
 void c_heap_destroy(c_heap_t *h) {
@@ -124,82 +213,143 @@ void c_heap_destroy(c_heap_t *h) {
   free(h->list);
   h->list = NULL;
 
-  pthread_mutex_destroy(&h->lock);
+  if (h->use_lock)
+    pthread_mutex_destroy(&h->lock);
 
   free(h);
 } /* void c_heap_destroy */
 
 int c_heap_insert(c_heap_t *h, void *ptr) {
-  size_t index;
-
   if ((h == NULL) || (ptr == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&h->lock);
+  heap_lock(h);
 
   assert(h->list_len <= h->list_size);
-  if (h->list_len == h->list_size) {
-    void **tmp;
-
-    tmp = realloc(h->list, (h->list_size + 16) * sizeof(*h->list));
-    if (tmp == NULL) {
-      pthread_mutex_unlock(&h->lock);
-      return -ENOMEM;
-    }
-
-    h->list = tmp;
-    h->list_size += 16;
+  if (heap_reserve(h, h->list_len + 1) != 0) {
+    heap_unlock(h);
+    return -ENOMEM;
   }
 
-  /* Insert the new node as a leaf. */
-  index = h->list_len;
-  h->list[index] = ptr;
+  /* Insert the new node as a leaf and reorganize the heap from bottom up. */
+  heap_set(h, h->list_len, ptr);
   h->list_len++;
+  sift_up(h, h->list_len - 1);
 
-  /* Reorganize the heap from bottom up. */
-  reheap(h, /* parent of this node = */ (index - 1) / 2, DIR_UP);
-
-  pthread_mutex_unlock(&h->lock);
+  heap_unlock(h);
   return 0;
 } /* int c_heap_insert */
 
+int c_heap_insert_bulk(c_heap_t *h, void **ptrs, size_t ptrs_num) {
+  if ((h == NULL) || ((ptrs == NULL) && (ptrs_num > 0)))
+    return -EINVAL;
+  for (size_t i = 0; i < ptrs_num; i++)
+    if (ptrs[i] == NULL)
+      return -EINVAL;
+
+  heap_lock(h);
+
+  if (heap_reserve(h, h->list_len + ptrs_num) != 0) {
+    heap_unlock(h);
+    return -ENOMEM;
+  }
+
+  size_t old_len = h->list_len;
+  for (size_t i = 0; i < ptrs_num; i++)
+    heap_set(h, old_len + i, ptrs[i]);
+  h->list_len += ptrs_num;
+
+  if (ptrs_num <= old_len) {
+    for (size_t i = old_len; i < h->list_len; i++)
+      sift_up(h, i);
+  } else if (h->list_len > 1) {
+    /* Adding more elements than there are is cheaper by rebuilding the heap
+     * bottom up, which takes linear time. */
+    for (size_t i = (h->list_len - 2) / C_HEAP_ARITY + 1; i > 0; i--)
+      sift_down(h, i - 1);
+  }
+
+  heap_unlock(h);
+  return 0;
+} /* int c_heap_insert_bulk */
+
 void *c_heap_get_root(c_heap_t *h) {
   void *ret = NULL;
 
   if (h == NULL)
     return NULL;
 
-  pthread_mutex_lock(&h->lock);
+  heap_lock(h);
+  if (h->list_len > 0)
+    ret = heap_remove_at(h, 0);
+  heap_unlock(h);
 
-  if (h->list_len == 0) {
-    pthread_mutex_unlock(&h->lock);
+  return ret;
+} /* void *c_heap_get_root */
+
+void *c_heap_peek_root(c_heap_t *h) {
+  void *ret = NULL;
+
+  if (h == NULL)
     return NULL;
-  } else if (h->list_len == 1) {
-    ret = h->list[0];
-    h->list[0] = NULL;
-    h->list_len = 0;
-  } else /* if (h->list_len > 1) */
-  {
+
+  heap_lock(h);
+  if (h->list_len > 0)
     ret = h->list[0];
-    h->list[0] = h->list[h->list_len - 1];
-    h->list[h->list_len - 1] = NULL;
-    h->list_len--;
+  heap_unlock(h);
+
+  return ret;
+} /* void *c_heap_peek_root */
+
+void c_heap_update_root(c_heap_t *h) {
+  if (h == NULL)
+    return;
+
+  heap_lock(h);
+  if (h->list_len > 0)
+    sift_down(h, 0);
+  heap_unlock(h);
+} /* void c_heap_update_root */
+
+int c_heap_update(c_heap_t *h, void *ptr) {
+  if ((h == NULL) || (ptr == NULL) || !h->indexed)
+    return -EINVAL;
 
-    reheap(h, /* root = */ 0, DIR_DOWN);
+  heap_lock(h);
+  size_t index = heap_find(h, ptr);
+  if (index == h->list_len) {
+    heap_unlock(h);
+    return -ENOENT;
   }
+  heap_fix(h, index);
+  heap_unlock(h);
 
-  /* free some memory */
-  if ((h->list_len + 32) < h->list_size) {
-    void **tmp;
+  return 0;
+} /* int c_heap_update */
 
-    tmp = realloc(h->list, (h->list_len + 16) * sizeof(*h->list));
-    if (tmp != NULL) {
-      h->list = tmp;
-      h->list_size = h->list_len + 16;
-    }
+int c_heap_remove(c_heap_t *h, void *ptr) {
+  if ((h == NULL) || (ptr == NULL) || !h->indexed)
+    return -EINVAL;
+
+  heap_lock(h);
+  size_t index = heap_find(h, ptr);
+  if (index == h->list_len) {
+    heap_unlock(h);
+    return -ENOENT;
   }
+  heap_remove_at(h, index);
+  heap_unlock(h);
+
+  return 0;
+} /* int c_heap_remove */
+
+size_t c_heap_size(c_heap_t *h) {
+  if (h == NULL)
+    return 0;
 
-  pthread_mutex_unlock(&h->lock);
+  heap_lock(h);
+  size_t ret = h->list_len;
+  heap_unlock(h);
 
   return ret;
-} /* void *c_heap_get_root */
+} /* size_t c_heap_size */
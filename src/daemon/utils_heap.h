@@ -27,9 +27,19 @@
 #ifndef UTILS_HEAP_H
 #define UTILS_HEAP_H 1
 
+#include <stddef.h>
+
 struct c_heap_s;
 typedef struct c_heap_s c_heap_t;
 
+/* Flags for c_heap_create_ex */
+/* The heap is not protected by a mutex. Use this if the heap has a single
+ * owner or is protected by a lock of the caller anyway. */
+#define C_HEAP_UNLOCKED 0x01
+/* Every element keeps its position in the heap in a size_t member, which
+ * enables c_heap_update and c_heap_remove. */
+#define C_HEAP_INDEXED 0x02
+
 /*
  * NAME
  *   c_heap_create
@@ -50,6 +60,26 @@ typedef struct c_heap_s c_heap_t;
  */
 c_heap_t *c_heap_create(int (*compare)(const void *, const void *));
 
+/*
+ * NAME
+ *   c_heap_create_ex
+ *
+ * DESCRIPTION
+ *   Allocates a new heap, like `c_heap_create', with additional options.
+ *
+ * PARAMETERS
+ *   `compare'       See `c_heap_create'.
+ *   `flags'         Bitwise or of C_HEAP_UNLOCKED and C_HEAP_INDEXED.
+ *   `index_offset'  With C_HEAP_INDEXED, the offset of a size_t member of the
+ *                   stored data structures (use `offsetof'). The heap updates
+ *                   it whenever the element moves. Ignored otherwise.
+ *
+ * RETURN VALUE
+ *   A c_heap_t-pointer upon success or NULL upon failure.
+ */
+c_heap_t *c_heap_create_ex(int (*compare)(const void *, const void *),
+                           int flags, size_t index_offset);
+
 /*
  * NAME
  *   c_heap_destroy
@@ -80,6 +110,21 @@ void c_heap_destroy(c_heap_t *h);
  */
 int c_heap_insert(c_heap_t *h, void *ptr);
 
+/*
+ * NAME
+ *   c_heap_insert_bulk
+ *
+ * DESCRIPTION
+ *   Stores `ptrs_num' pointers from `ptrs' in the heap. If this at least
+ *   doubles the size of the heap, the heap is rebuilt in linear time instead
+ *   of inserting the pointers one by one.
+ *
+ * RETURN VALUE
+ *   Zero upon success, less than zero otherwise. Nothing is inserted upon
+ *   failure.
+ */
+int c_heap_insert_bulk(c_heap_t *h, void **ptrs, size_t ptrs_num);
+
 /*
  * NAME
  *   c_heap_get_root
@@ -96,4 +141,68 @@ int c_heap_insert(c_heap_t *h, void *ptr);
  */
 void *c_heap_get_root(c_heap_t *h);
 
+/*
+ * NAME
+ *   c_heap_peek_root
+ *
+ * DESCRIPTION
+ *   Returns the value at the root of the heap without removing it. The caller
+ *   has to make sure the value isn't removed by another thread while it is
+ *   being used.
+ *
+ * PARAMETERS
+ *   `h'           Heap to look at.
+ *
+ * RETURN VALUE
+ *   The pointer passed to `c_heap_insert' or NULL if the heap is empty.
+ */
+void *c_heap_peek_root(c_heap_t *h);
+
+/*
+ * NAME
+ *   c_heap_update_root
+ *
+ * DESCRIPTION
+ *   Restores the heap order after the key of the root element has been
+ *   changed in place. Rescheduling the root this way is cheaper than removing
+ *   and re-inserting it.
+ */
+void c_heap_update_root(c_heap_t *h);
+
+/*
+ * NAME
+ *   c_heap_update
+ *
+ * DESCRIPTION
+ *   Restores the heap order after the key of `ptr' has been changed in place.
+ *   Requires a heap created with C_HEAP_INDEXED.
+ *
+ * RETURN VALUE
+ *   Zero upon success, -ENOENT if `ptr' is not in the heap and -EINVAL if the
+ *   heap is not indexed.
+ */
+int c_heap_update(c_heap_t *h, void *ptr);
+
+/*
+ * NAME
+ *   c_heap_remove
+ *
+ * DESCRIPTION
+ *   Removes `ptr' from the heap. Requires a heap created with C_HEAP_INDEXED.
+ *
+ * RETURN VALUE
+ *   Zero upon success, -ENOENT if `ptr' is not in the heap and -EINVAL if the
+ *   heap is not indexed.
+ */
+int c_heap_remove(c_heap_t *h, void *ptr);
+
+/*
+ * NAME
+ *   c_heap_size
+ *
+ * DESCRIPTION
+ *   Returns the number of elements in the heap.
+ */
+size_t c_heap_size(c_heap_t *h);
+
 #endif /* UTILS_HEAP_H */
@@ -26,9 +26,49 @@
 
 #include "collectd.h"
 
+#include "common.h" /* for STATIC_ARRAY_SIZE and sfree */
 #include "testing.h"
 #include "utils_heap.h"
 
+typedef struct {
+  uint64_t key;
+  size_t index;
+} item_t;
+
+static int item_compare(void const *v0, void const *v1) {
+  item_t const *i0 = v0;
+  item_t const *i1 = v1;
+
+  if (i0->key < i1->key)
+    return -1;
+  else if (i0->key > i1->key)
+    return 1;
+  else
+    return 0;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (1000.0 * (double)ts.tv_sec) + ((double)ts.tv_nsec / 1000000.0);
+}
+
+/* Pops all elements and checks that they come out sorted. */
+static int drain_sorted(c_heap_t *h, size_t want_num) {
+  item_t *prev = NULL;
+  item_t *it;
+  size_t num = 0;
+
+  while ((it = c_heap_get_root(h)) != NULL) {
+    if ((prev != NULL) && (prev->key > it->key))
+      return -1;
+    prev = it;
+    num++;
+  }
+
+  return (num == want_num) ? 0 : -1;
+}
+
 static int compare(void const *v0, void const *v1) {
   int const *i0 = v0;
   int const *i1 = v1;
@@ -51,8 +91,9 @@ DEF_TEST(simple) {
 
   for (int i = 0; i < 5; i++) {
     int *ret = NULL;
-    CHECK_NOT_NULL(ret = c_heap_get_root(h));
+    CHECK_NOT_NULL(ret = c_heap_peek_root(h));
     OK(*ret == i);
+    EXPECT_EQ_PTR(ret, c_heap_get_root(h));
   }
 
   CHECK_ZERO(c_heap_insert(h, &values[6] /* = 0 */));
@@ -67,12 +108,157 @@ DEF_TEST(simple) {
     OK(*ret == i);
   }
 
+  OK(c_heap_peek_root(h) == NULL);
+  OK(c_heap_get_root(h) == NULL);
+
   c_heap_destroy(h);
   return 0;
 }
 
+DEF_TEST(indexed) {
+  item_t items[100];
+  c_heap_t *h;
+
+  CHECK_NOT_NULL(h = c_heap_create_ex(item_compare, C_HEAP_INDEXED,
+                                      offsetof(item_t, index)));
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(items); i++) {
+    items[i].key = (i * 37) % 100;
+    CHECK_ZERO(c_heap_insert(h, items + i));
+  }
+  EXPECT_EQ_UINT64(100, c_heap_size(h));
+
+  /* Decrease a key to below the root. */
+  items[50].key = 0;
+  CHECK_ZERO(c_heap_update(h, items + 50));
+  item_t *root = c_heap_peek_root(h);
+  CHECK_NOT_NULL(root);
+  EXPECT_EQ_UINT64(0, root->key);
+
+  /* Increase the root's key. */
+  root->key = 1000;
+  c_heap_update_root(h);
+  OK(c_heap_peek_root(h) != root);
+
+  /* Remove an element from the middle. */
+  CHECK_ZERO(c_heap_remove(h, items + 10));
+  EXPECT_EQ_INT(-ENOENT, c_heap_remove(h, items + 10));
+  EXPECT_EQ_INT(-ENOENT, c_heap_update(h, items + 10));
+  EXPECT_EQ_UINT64(99, c_heap_size(h));
+
+  CHECK_ZERO(drain_sorted(h, 99));
+  c_heap_destroy(h);
+
+  /* Updates need the index. */
+  CHECK_NOT_NULL(h = c_heap_create(item_compare));
+  CHECK_ZERO(c_heap_insert(h, items));
+  EXPECT_EQ_INT(-EINVAL, c_heap_update(h, items));
+  EXPECT_EQ_INT(-EINVAL, c_heap_remove(h, items));
+  c_heap_destroy(h);
+
+  return 0;
+}
+
+DEF_TEST(bulk) {
+  item_t items[1000];
+  void *ptrs[STATIC_ARRAY_SIZE(items)];
+  c_heap_t *h;
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(items); i++) {
+    items[i].key = (i * 7919) % 1000;
+    ptrs[i] = items + i;
+  }
+
+  CHECK_NOT_NULL(h = c_heap_create_ex(item_compare, C_HEAP_UNLOCKED,
+                                      /* index_offset = */ 0));
+  /* Rebuilds the (empty) heap, then inserts one by one. */
+  CHECK_ZERO(c_heap_insert_bulk(h, ptrs, 900));
+  CHECK_ZERO(c_heap_insert_bulk(h, ptrs + 900, 100));
+  CHECK_ZERO(c_heap_insert_bulk(h, NULL, 0));
+  EXPECT_EQ_UINT64(1000, c_heap_size(h));
+  CHECK_ZERO(drain_sorted(h, 1000));
+
+  ptrs[10] = NULL;
+  EXPECT_EQ_INT(-EINVAL, c_heap_insert_bulk(h, ptrs, 20));
+  EXPECT_EQ_UINT64(0, c_heap_size(h));
+
+  c_heap_destroy(h);
+  return 0;
+}
+
+/* Reschedules the root of a heap with 100k entries, the way the read
+ * scheduler does, and prints the time per operation. */
+DEF_TEST(benchmark) {
+  enum { NUM = 100000, OPS = 1000000 };
+  struct {
+    char const *name;
+    int flags;
+    bool pop_insert;
+  } cases[] = {
+      {"locked, pop + insert", 0, true},
+      {"unlocked, pop + insert", C_HEAP_UNLOCKED, true},
+      {"unlocked, update root", C_HEAP_UNLOCKED, false},
+      {"unlocked, update random", C_HEAP_UNLOCKED | C_HEAP_INDEXED, false},
+  };
+
+  item_t *items = calloc(NUM, sizeof(*items));
+  void **ptrs = calloc(NUM, sizeof(*ptrs));
+  CHECK_NOT_NULL(items);
+  CHECK_NOT_NULL(ptrs);
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    unsigned short state[3] = {1, 2, 3};
+    c_heap_t *h;
+
+    for (size_t j = 0; j < NUM; j++) {
+      items[j].key = (uint64_t)nrand48(state);
+      ptrs[j] = items + j;
+    }
+    CHECK_NOT_NULL(h = c_heap_create_ex(item_compare, cases[i].flags,
+                                        offsetof(item_t, index)));
+
+    double start = now_ms();
+    CHECK_ZERO(c_heap_insert_bulk(h, ptrs, NUM));
+    double build = now_ms() - start;
+
+    start = now_ms();
+    uint64_t now = 0;
+    for (int j = 0; j < OPS; j++) {
+      item_t *it;
+      if (cases[i].flags & C_HEAP_INDEXED) {
+        it = items + (nrand48(state) % NUM);
+        it->key += (uint64_t)nrand48(state);
+        c_heap_update(h, it);
+      } else if (cases[i].pop_insert) {
+        it = c_heap_get_root(h);
+        now = it->key;
+        it->key = now + (uint64_t)nrand48(state);
+        c_heap_insert(h, it);
+      } else {
+        it = c_heap_peek_root(h);
+        now = it->key;
+        it->key = now + (uint64_t)nrand48(state);
+        c_heap_update_root(h);
+      }
+    }
+    double ops = now_ms() - start;
+
+    printf("# %-24s build %6.2f ms, %6.1f ns/op\n", cases[i].name, build,
+           1e6 * ops / OPS);
+
+    CHECK_ZERO(drain_sorted(h, NUM));
+    c_heap_destroy(h);
+  }
+
+  sfree(items);
+  sfree(ptrs);
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(simple);
+  RUN_TEST(indexed);
+  RUN_TEST(bulk);
+  RUN_TEST(benchmark);
 
   END_TEST;
 }
@@ -0,0 +1,110 @@
+/**
+ * collectd - src/daemon/utils_memstats.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "utils_atomic.h"
+#include "utils_memstats.h"
+
+#include <pthread.h>
+
+struct memstat_s {
+  memstat_t *next;
+  int64_t bytes;
+  int64_t objects;
+  char name[];
+};
+
+/* Sorted by name. Counters are only ever inserted, with memstat_lock held, and
+ * are published with a release store after having been initialized, so the
+ * list can be walked without the lock. */
+static memstat_t *memstat_head;
+static pthread_mutex_t memstat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+memstat_t *memstat_get(char const *name) /* {{{ */
+{
+  if (name == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&memstat_lock);
+
+  memstat_t **prev = &memstat_head;
+  while ((*prev != NULL) && (strcmp((*prev)->name, name) < 0))
+    prev = &(*prev)->next;
+
+  if ((*prev != NULL) && (strcmp((*prev)->name, name) == 0)) {
+    memstat_t *ms = *prev;
+    pthread_mutex_unlock(&memstat_lock);
+    return ms;
+  }
+
+  size_t name_size = strlen(name) + 1;
+  memstat_t *ms = calloc(1, sizeof(*ms) + name_size);
+  if (ms == NULL) {
+    pthread_mutex_unlock(&memstat_lock);
+    return NULL;
+  }
+  memcpy(ms->name, name, name_size);
+  ms->next = *prev;
+  C_ATOMIC_STORE_REL(prev, ms);
+
+  pthread_mutex_unlock(&memstat_lock);
+  return ms;
+} /* }}} memstat_t *memstat_get */
+
+memstat_t *memstat_lazy(memstat_t **ms, char const *name) /* {{{ */
+{
+  memstat_t *ret = C_ATOMIC_LOAD_ACQ(ms);
+  if (ret != NULL)
+    return ret;
+
+  /* Racing callers get the same counter, so the order of the stores doesn't
+   * matter. */
+  ret = memstat_get(name);
+  C_ATOMIC_STORE_REL(ms, ret);
+  return ret;
+} /* }}} memstat_t *memstat_lazy */
+
+void memstat_add(memstat_t *ms, int64_t bytes, int64_t objects) /* {{{ */
+{
+  if (ms == NULL)
+    return;
+
+  if (bytes != 0)
+    C_ATOMIC_ADD(&ms->bytes, bytes);
+  if (objects != 0)
+    C_ATOMIC_ADD(&ms->objects, objects);
+} /* }}} void memstat_add */
+
+int memstat_foreach(memstat_callback_t callback, void *user_data) /* {{{ */
+{
+  for (memstat_t *ms = C_ATOMIC_LOAD_ACQ(&memstat_head); ms != NULL;
+       ms = C_ATOMIC_LOAD_ACQ(&ms->next)) {
+    int status = callback(ms->name, C_ATOMIC_LOAD(&ms->bytes),
+                          C_ATOMIC_LOAD(&ms->objects), user_data);
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+} /* }}} int memstat_foreach */
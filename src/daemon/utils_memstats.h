@@ -0,0 +1,76 @@
+/**
+ * collectd - src/daemon/utils_memstats.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_MEMSTATS_H
+#define UTILS_MEMSTATS_H 1
+
+#include <stdint.h>
+
+/* Memory accounting of the major data structures. Each subsystem owns a named
+ * counter of the bytes and objects it has allocated and updates it with
+ * memstat_add() as it allocates and frees memory. Updates are single atomic
+ * additions, so they may be done on hot paths and by any thread. The byte
+ * counts only include the memory requested from malloc(3), not the
+ * allocator's overhead. Counters are never freed. */
+struct memstat_s;
+typedef struct memstat_s memstat_t;
+
+/*
+ * NAME
+ *   memstat_get
+ *
+ * DESCRIPTION
+ *   Returns the counter called `name', creating it if it doesn't exist yet.
+ *   Subsystems using the same name share a counter.
+ *
+ * RETURN VALUE
+ *   The counter or NULL if allocating it failed.
+ */
+memstat_t *memstat_get(char const *name);
+
+/* Like memstat_get(), but keeps the counter in `*ms', so that it can be called
+ * on every update without having to look up the counter during
+ * initialization. */
+memstat_t *memstat_lazy(memstat_t **ms, char const *name);
+
+/* Adds `bytes' and `objects', which may be negative, to the counter. Accepts
+ * NULL, so that a failed memstat_get() only disables the accounting. */
+void memstat_add(memstat_t *ms, int64_t bytes, int64_t objects);
+
+typedef int (*memstat_callback_t)(char const *name, int64_t bytes,
+                                  int64_t objects, void *user_data);
+
+/*
+ * NAME
+ *   memstat_foreach
+ *
+ * DESCRIPTION
+ *   Calls `callback' for each counter, sorted by name. Stops at the first
+ *   callback returning non-zero.
+ *
+ * RETURN VALUE
+ *   Zero or the status of the callback that stopped the iteration.
+ */
+int memstat_foreach(memstat_callback_t callback, void *user_data);
+
+#endif /* UTILS_MEMSTATS_H */
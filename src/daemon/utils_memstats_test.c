@@ -0,0 +1,83 @@
+/**
+ * collectd - src/daemon/utils_memstats_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "testing.h"
+#include "utils_memstats.h"
+
+typedef struct {
+  char names[4][16];
+  int64_t bytes[4];
+  int64_t objects[4];
+  size_t num;
+} collected_t;
+
+static int collect(char const *name, int64_t bytes, int64_t objects,
+                   void *user_data) {
+  collected_t *c = user_data;
+  if (c->num >= STATIC_ARRAY_SIZE(c->names))
+    return -1;
+
+  sstrncpy(c->names[c->num], name, sizeof(c->names[c->num]));
+  c->bytes[c->num] = bytes;
+  c->objects[c->num] = objects;
+  c->num++;
+  return 0;
+}
+
+DEF_TEST(counters) {
+  memstat_t *b;
+  memstat_t *a;
+  memstat_t *lazy = NULL;
+
+  CHECK_NOT_NULL(b = memstat_get("bravo"));
+  CHECK_NOT_NULL(a = memstat_get("alpha"));
+  EXPECT_EQ_PTR(b, memstat_get("bravo"));
+  EXPECT_EQ_PTR(a, memstat_lazy(&lazy, "alpha"));
+  EXPECT_EQ_PTR(a, lazy);
+
+  memstat_add(a, 100, 2);
+  memstat_add(a, -40, -1);
+  memstat_add(b, 7, 1);
+  memstat_add(NULL, 1, 1);
+
+  collected_t c = {.num = 0};
+  CHECK_ZERO(memstat_foreach(collect, &c));
+  EXPECT_EQ_UINT64(2, c.num);
+  EXPECT_EQ_STR("alpha", c.names[0]);
+  EXPECT_EQ_UINT64(60, c.bytes[0]);
+  EXPECT_EQ_UINT64(1, c.objects[0]);
+  EXPECT_EQ_STR("bravo", c.names[1]);
+  EXPECT_EQ_UINT64(7, c.bytes[1]);
+  EXPECT_EQ_UINT64(1, c.objects[1]);
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(counters);
+
+  END_TEST;
+}
@@ -0,0 +1,66 @@
+/**
+ * collectd - src/daemon/utils_probe.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_PROBE_H
+#define UTILS_PROBE_H 1
+
+/*
+ * Static tracepoints (USDT) of the "collectd" provider, for tracing the
+ * daemon with bpftrace, perf or SystemTap without a debug build. A probe
+ * compiles to a single "nop" and a note in the ELF file, so arguments should
+ * be cheap to evaluate: names and pointers that are at hand anyway. Without
+ * --enable-usdt the macros expand to nothing. List the probes with:
+ *
+ *   bpftrace -l 'usdt:/path/to/collectd:collectd:*'
+ *
+ * Probes and arguments (names are NUL-terminated strings):
+ *
+ *   read__start(callback name)
+ *   read__done(callback name, status)
+ *   write__enqueue(host, plugin, type)
+ *   write__dequeue(host, plugin, type)
+ *   write__start(writer name, number of value lists)
+ *   write__done(writer name, status)
+ *   cache__update(identifier)
+ *   filter__match(chain name, rule name, matches)
+ *   filter__target(chain name, target name, status)
+ *   network__parse__start(packet size, flags)
+ *   network__parse__done(status)
+ */
+#if COLLECT_USDT
+#include <sys/sdt.h>
+
+#define C_PROBE0(name) DTRACE_PROBE(collectd, name)
+#define C_PROBE1(name, a) DTRACE_PROBE1(collectd, name, a)
+#define C_PROBE2(name, a, b) DTRACE_PROBE2(collectd, name, a, b)
+#define C_PROBE3(name, a, b, c) DTRACE_PROBE3(collectd, name, a, b, c)
+#else
+#define C_PROBE0(name)                                                         \
+  do {                                                                         \
+  } while (0)
+#define C_PROBE1(name, a) C_PROBE0(name)
+#define C_PROBE2(name, a, b) C_PROBE0(name)
+#define C_PROBE3(name, a, b, c) C_PROBE0(name)
+#endif
+
+#endif /* UTILS_PROBE_H */
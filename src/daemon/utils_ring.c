@@ -0,0 +1,164 @@
+/**
+ * collectd - src/daemon/utils_ring.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "utils_atomic.h"
+#include "utils_ring.h"
+
+/* Bounded MPMC queue as described by Dmitry Vyukov: every cell carries a
+ * sequence number which tells producers and consumers whether the cell is
+ * free for the current "lap" around the ring. Producers and consumers only
+ * contend on their respective position counter, which live on separate cache
+ * lines. */
+#define RING_CACHE_LINE 64
+
+struct ring_cell_s {
+  size_t seq;
+  void *ptr;
+};
+typedef struct ring_cell_s ring_cell_t;
+
+struct c_ring_s {
+  ring_cell_t *cells;
+  size_t mask;
+
+  char pad0[RING_CACHE_LINE];
+  size_t head; /* next position to pop */
+  char pad1[RING_CACHE_LINE];
+  size_t tail; /* next position to push */
+  char pad2[RING_CACHE_LINE];
+};
+
+c_ring_t *c_ring_create(size_t size) {
+  c_ring_t *r;
+  size_t n = 2;
+
+  if (size == 0)
+    return NULL;
+
+  while (n < size) {
+    if (n > (SIZE_MAX / 2))
+      return NULL;
+    n *= 2;
+  }
+
+  r = calloc(1, sizeof(*r));
+  if (r == NULL)
+    return NULL;
+
+  r->cells = calloc(n, sizeof(*r->cells));
+  if (r->cells == NULL) {
+    free(r);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < n; i++)
+    r->cells[i].seq = i;
+
+  r->mask = n - 1;
+  r->head = 0;
+  r->tail = 0;
+
+  return r;
+} /* c_ring_t *c_ring_create */
+
+void c_ring_destroy(c_ring_t *r) {
+  if (r == NULL)
+    return;
+
+  free(r->cells);
+  free(r);
+} /* void c_ring_destroy */
+
+int c_ring_push(c_ring_t *r, void *ptr) {
+  ring_cell_t *cell;
+  size_t pos;
+
+  if ((r == NULL) || (ptr == NULL))
+    return EINVAL;
+
+  pos = C_ATOMIC_LOAD(&r->tail);
+  while (42) {
+    cell = r->cells + (pos & r->mask);
+
+    size_t seq = C_ATOMIC_LOAD_ACQ(&cell->seq);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if (diff == 0) {
+      /* Cell is free; try to claim it. On failure `pos' is updated. */
+      if (C_ATOMIC_CAS(&r->tail, pos, pos + 1))
+        break;
+    } else if (diff < 0) {
+      /* Cell still holds an element from the previous lap: ring is full. */
+      return EAGAIN;
+    } else {
+      pos = C_ATOMIC_LOAD(&r->tail);
+    }
+  }
+
+  cell->ptr = ptr;
+  C_ATOMIC_STORE_REL(&cell->seq, pos + 1);
+
+  return 0;
+} /* int c_ring_push */
+
+void *c_ring_pop(c_ring_t *r) {
+  ring_cell_t *cell;
+  size_t pos;
+  void *ptr;
+
+  if (r == NULL)
+    return NULL;
+
+  pos = C_ATOMIC_LOAD(&r->head);
+  while (42) {
+    cell = r->cells + (pos & r->mask);
+
+    size_t seq = C_ATOMIC_LOAD_ACQ(&cell->seq);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+    if (diff == 0) {
+      if (C_ATOMIC_CAS(&r->head, pos, pos + 1))
+        break;
+    } else if (diff < 0) {
+      /* Cell has not been written in this lap: ring is empty. */
+      return NULL;
+    } else {
+      pos = C_ATOMIC_LOAD(&r->head);
+    }
+  }
+
+  ptr = cell->ptr;
+  cell->ptr = NULL;
+  C_ATOMIC_STORE_REL(&cell->seq, pos + r->mask + 1);
+
+  return ptr;
+} /* void *c_ring_pop */
+
+size_t c_ring_size(c_ring_t const *r) {
+  if (r == NULL)
+    return 0;
+
+  return r->mask + 1;
+} /* size_t c_ring_size */
@@ -0,0 +1,95 @@
+/**
+ * collectd - src/daemon/utils_ring.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_RING_H
+#define UTILS_RING_H 1
+
+#include <stddef.h>
+
+struct c_ring_s;
+typedef struct c_ring_s c_ring_t;
+
+/*
+ * NAME
+ *   c_ring_create
+ *
+ * DESCRIPTION
+ *   Allocates a new bounded, lock-free multi-producer / multi-consumer ring
+ *   buffer of pointers.
+ *
+ * PARAMETERS
+ *   `size'     Minimum number of elements the ring can hold. The size is
+ *              rounded up to the next power of two.
+ *
+ * RETURN VALUE
+ *   A c_ring_t-pointer upon success or NULL upon failure.
+ */
+c_ring_t *c_ring_create(size_t size);
+
+/*
+ * NAME
+ *   c_ring_destroy
+ *
+ * DESCRIPTION
+ *   Deallocates a ring. Pointers still stored in the ring are lost, but of
+ *   course not freed. The ring must not be used by any other thread anymore.
+ */
+void c_ring_destroy(c_ring_t *r);
+
+/*
+ * NAME
+ *   c_ring_push
+ *
+ * DESCRIPTION
+ *   Appends `ptr' to the ring. May be called by any number of threads
+ *   concurrently.
+ *
+ * RETURN VALUE
+ *   Zero upon success, EAGAIN if the ring is full and EINVAL if `r' or `ptr'
+ *   is NULL.
+ */
+int c_ring_push(c_ring_t *r, void *ptr);
+
+/*
+ * NAME
+ *   c_ring_pop
+ *
+ * DESCRIPTION
+ *   Removes the oldest pointer from the ring. May be called by any number of
+ *   threads concurrently.
+ *
+ * RETURN VALUE
+ *   The pointer passed to `c_ring_push' or NULL if the ring is empty.
+ */
+void *c_ring_pop(c_ring_t *r);
+
+/*
+ * NAME
+ *   c_ring_size
+ *
+ * RETURN VALUE
+ *   The number of elements the ring can hold.
+ */
+size_t c_ring_size(c_ring_t const *r);
+
+#endif /* UTILS_RING_H */
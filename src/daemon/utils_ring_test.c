@@ -0,0 +1,132 @@
+/**
+ * collectd - src/daemon/utils_ring_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils_ring.h"
+
+DEF_TEST(simple) {
+  int values[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  c_ring_t *r;
+
+  CHECK_NOT_NULL(r = c_ring_create(5));
+  EXPECT_EQ_INT(8, c_ring_size(r));
+  EXPECT_EQ_PTR(NULL, c_ring_pop(r));
+
+  for (int i = 0; i < 8; i++)
+    CHECK_ZERO(c_ring_push(r, &values[i]));
+  EXPECT_EQ_INT(EAGAIN, c_ring_push(r, &values[8]));
+
+  for (int i = 0; i < 4; i++) {
+    int *ret = NULL;
+    CHECK_NOT_NULL(ret = c_ring_pop(r));
+    EXPECT_EQ_INT(i, *ret);
+  }
+
+  /* wrap around */
+  for (int i = 8; i < 10; i++)
+    CHECK_ZERO(c_ring_push(r, &values[i]));
+
+  for (int i = 4; i < 10; i++) {
+    int *ret = NULL;
+    CHECK_NOT_NULL(ret = c_ring_pop(r));
+    EXPECT_EQ_INT(i, *ret);
+  }
+  EXPECT_EQ_PTR(NULL, c_ring_pop(r));
+
+  EXPECT_EQ_INT(EINVAL, c_ring_push(r, NULL));
+
+  c_ring_destroy(r);
+  return 0;
+}
+
+#define THREADS_NUM 4
+#define ITEMS_NUM 100000
+
+static c_ring_t *concurrent_ring;
+
+static void *producer(void *arg) {
+  size_t *items = arg;
+
+  for (size_t i = 0; i < ITEMS_NUM; i++) {
+    while (c_ring_push(concurrent_ring, &items[i]) != 0)
+      sched_yield();
+  }
+
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  uint64_t *sum = arg;
+
+  for (size_t i = 0; i < ITEMS_NUM; i++) {
+    size_t *ptr;
+    while ((ptr = c_ring_pop(concurrent_ring)) == NULL)
+      sched_yield();
+    *sum += *ptr;
+  }
+
+  return NULL;
+}
+
+DEF_TEST(concurrent) {
+  static size_t items[ITEMS_NUM];
+  pthread_t producers[THREADS_NUM];
+  pthread_t consumers[THREADS_NUM];
+  uint64_t sums[THREADS_NUM] = {0};
+  uint64_t want = 0;
+  uint64_t got = 0;
+
+  for (size_t i = 0; i < ITEMS_NUM; i++) {
+    items[i] = i;
+    want += THREADS_NUM * i;
+  }
+
+  CHECK_NOT_NULL(concurrent_ring = c_ring_create(128));
+
+  for (size_t i = 0; i < THREADS_NUM; i++) {
+    CHECK_ZERO(pthread_create(&producers[i], NULL, producer, items));
+    CHECK_ZERO(pthread_create(&consumers[i], NULL, consumer, &sums[i]));
+  }
+
+  for (size_t i = 0; i < THREADS_NUM; i++) {
+    pthread_join(producers[i], NULL);
+    pthread_join(consumers[i], NULL);
+    got += sums[i];
+  }
+
+  EXPECT_EQ_UINT64(want, got);
+  EXPECT_EQ_PTR(NULL, c_ring_pop(concurrent_ring));
+
+  c_ring_destroy(concurrent_ring);
+  concurrent_ring = NULL;
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(simple);
+  RUN_TEST(concurrent);
+
+  END_TEST;
+}
@@ -0,0 +1,701 @@
+/**
+ * collectd - src/daemon/utils_spool.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_spool.h"
+
+#include <arpa/inet.h>
+#include <sys/mman.h>
+
+/* Part types of the binary network protocol, see src/network.h. */
+#define SPOOL_PART_HOST 0x0000
+#define SPOOL_PART_PLUGIN 0x0002
+#define SPOOL_PART_PLUGIN_INSTANCE 0x0003
+#define SPOOL_PART_TYPE 0x0004
+#define SPOOL_PART_TYPE_INSTANCE 0x0005
+#define SPOOL_PART_VALUES 0x0006
+#define SPOOL_PART_TIME_HR 0x0008
+#define SPOOL_PART_INTERVAL_HR 0x0009
+
+/* Segments start with this magic. Each record is a 32 bit length in network
+ * byte order followed by the parts of one value list. */
+#define SPOOL_MAGIC "CDSPOOL1"
+#define SPOOL_MAGIC_SIZE 8
+
+#ifndef SPOOL_SEGMENT_SIZE
+#define SPOOL_SEGMENT_SIZE (4 * 1024 * 1024)
+#endif
+
+typedef struct {
+  uint64_t seq;
+  uint64_t size; /* bytes of records not committed yet */
+  uint64_t end;  /* length of the file, up to the last complete record */
+} spool_segment_t;
+
+struct spool_s {
+  char *directory;
+  char *name;
+  uint64_t size_limit;
+  uint64_t segment_size;
+
+  pthread_mutex_t lock;
+  /* Oldest first. The last segment is written to if "write_fd" is valid. */
+  spool_segment_t *segments;
+  size_t segments_num;
+  uint64_t size;
+  uint64_t next_seq;
+  int write_fd;
+
+  /* The mapping of the first segment, owned by the reading thread. */
+  bool mapped;
+  uint64_t map_seq;
+  char *map;
+  size_t map_size;
+  size_t read_offset;
+  size_t commit_offset;
+};
+
+static void spool_segment_path(spool_t const *s, uint64_t seq, char *buffer,
+                               size_t buffer_size) {
+  snprintf(buffer, buffer_size, "%s/%s-%020" PRIu64 ".spool", s->directory,
+           s->name, seq);
+} /* void spool_segment_path */
+
+static int spool_scan_cb(const char *dirname, const char *filename,
+                         void *user_data) {
+  spool_t *s = user_data;
+  size_t name_len = strlen(s->name);
+
+  if ((strncmp(filename, s->name, name_len) != 0) ||
+      (filename[name_len] != '-'))
+    return 0;
+
+  char *end = NULL;
+  errno = 0;
+  uint64_t seq = (uint64_t)strtoull(filename + name_len + 1, &end, 10);
+  if ((errno != 0) || (end == filename + name_len + 1) ||
+      (strcmp(end, ".spool") != 0))
+    return 0;
+
+  char path[PATH_MAX];
+  struct stat st;
+  spool_segment_path(s, seq, path, sizeof(path));
+  if ((stat(path, &st) != 0) || !S_ISREG(st.st_mode))
+    return 0;
+
+  spool_segment_t *tmp =
+      realloc(s->segments, (s->segments_num + 1) * sizeof(*s->segments));
+  if (tmp == NULL)
+    return ENOMEM;
+  s->segments = tmp;
+
+  uint64_t size = ((uint64_t)st.st_size > SPOOL_MAGIC_SIZE)
+                      ? (uint64_t)st.st_size - SPOOL_MAGIC_SIZE
+                      : 0;
+  s->segments[s->segments_num] = (spool_segment_t){
+      .seq = seq, .size = size, .end = (uint64_t)st.st_size,
+  };
+  s->segments_num++;
+  s->size += size;
+  if (seq >= s->next_seq)
+    s->next_seq = seq + 1;
+
+  return 0;
+} /* int spool_scan_cb */
+
+static int spool_segment_compare(void const *a, void const *b) {
+  uint64_t seq_a = ((spool_segment_t const *)a)->seq;
+  uint64_t seq_b = ((spool_segment_t const *)b)->seq;
+  return (seq_a > seq_b) - (seq_a < seq_b);
+} /* int spool_segment_compare */
+
+spool_t *spool_open(const char *directory, const char *name,
+                    uint64_t size_limit) {
+  char path[PATH_MAX];
+
+  snprintf(path, sizeof(path), "%s/", directory);
+  if (check_create_dir(path) != 0) {
+    ERROR("spool_open: Creating the directory \"%s\" failed.", directory);
+    return NULL;
+  }
+
+  spool_t *s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+  pthread_mutex_init(&s->lock, /* attr = */ NULL);
+  s->write_fd = -1;
+
+  s->directory = strdup(directory);
+  s->name = strdup(name);
+  if ((s->directory == NULL) || (s->name == NULL)) {
+    spool_close(s);
+    return NULL;
+  }
+  escape_slashes(s->name, strlen(s->name) + 1);
+
+  s->size_limit = size_limit;
+  s->segment_size = SPOOL_SEGMENT_SIZE;
+  /* Keep a few segments below the limit, so that removing the oldest one
+   * doesn't throw away most of the spool. */
+  if ((size_limit != 0) && (s->segment_size > size_limit / 4))
+    s->segment_size = size_limit / 4;
+
+  if (walk_directory(directory, spool_scan_cb, s, /* hidden = */ 0) != 0) {
+    ERROR("spool_open: Reading the directory \"%s\" failed.", directory);
+    spool_close(s);
+    return NULL;
+  }
+
+  if (s->segments_num > 0) {
+    qsort(s->segments, s->segments_num, sizeof(*s->segments),
+          spool_segment_compare);
+    INFO("spool_open: Found %" PRIsz " segments with %" PRIu64
+         " bytes in spool \"%s\".",
+         s->segments_num, s->size, s->name);
+  }
+
+  return s;
+} /* spool_t *spool_open */
+
+static void spool_unmap(spool_t *s) {
+  if (s->map != NULL)
+    munmap(s->map, s->map_size);
+  s->mapped = false;
+  s->map = NULL;
+  s->map_size = 0;
+  s->read_offset = 0;
+  s->commit_offset = 0;
+} /* void spool_unmap */
+
+void spool_close(spool_t *s) {
+  if (s == NULL)
+    return;
+
+  spool_unmap(s);
+  if (s->write_fd >= 0)
+    close(s->write_fd);
+  pthread_mutex_destroy(&s->lock);
+
+  sfree(s->segments);
+  sfree(s->directory);
+  sfree(s->name);
+  sfree(s);
+} /* void spool_close */
+
+/* Removes the oldest segment. Must be called with the lock held. */
+static void spool_remove_oldest(spool_t *s) {
+  char path[PATH_MAX];
+
+  if (s->segments_num == 0)
+    return;
+
+  spool_segment_t *seg = s->segments;
+  spool_segment_path(s, seg->seq, path, sizeof(path));
+  if ((unlink(path) != 0) && (errno != ENOENT))
+    WARNING("spool: unlink (%s) failed: %s", path, STRERRNO);
+
+  if (s->segments_num == 1) {
+    if (s->write_fd >= 0)
+      close(s->write_fd);
+    s->write_fd = -1;
+  }
+
+  s->size -= seg->size;
+  s->segments_num--;
+  memmove(s->segments, s->segments + 1, s->segments_num * sizeof(*s->segments));
+} /* void spool_remove_oldest */
+
+/* Starts a new segment. Must be called with the lock held. */
+static int spool_start_segment(spool_t *s) {
+  char path[PATH_MAX];
+
+  spool_segment_t *tmp =
+      realloc(s->segments, (s->segments_num + 1) * sizeof(*s->segments));
+  if (tmp == NULL)
+    return ENOMEM;
+  s->segments = tmp;
+
+  if (s->write_fd >= 0)
+    close(s->write_fd);
+
+  uint64_t seq = s->next_seq;
+  spool_segment_path(s, seq, path, sizeof(path));
+  s->write_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+  if (s->write_fd < 0) {
+    int status = errno;
+    ERROR("spool: open (%s) failed: %s", path, STRERRNO);
+    return status;
+  }
+
+  if (swrite(s->write_fd, SPOOL_MAGIC, SPOOL_MAGIC_SIZE) != 0) {
+    int status = errno;
+    ERROR("spool: write (%s) failed: %s", path, STRERRNO);
+    close(s->write_fd);
+    s->write_fd = -1;
+    unlink(path);
+    return status;
+  }
+
+  s->next_seq++;
+  s->segments[s->segments_num] = (spool_segment_t){
+      .seq = seq, .size = 0, .end = SPOOL_MAGIC_SIZE,
+  };
+  s->segments_num++;
+  return 0;
+} /* int spool_start_segment */
+
+static int spool_put_string(char *buffer, size_t buffer_size, size_t *offset,
+                            uint16_t type, const char *str) {
+  size_t str_len = strlen(str) + 1;
+  size_t part_len = 4 + str_len;
+
+  if ((part_len > UINT16_MAX) || (*offset + part_len > buffer_size))
+    return ENOBUFS;
+
+  uint16_t header[2] = {htons(type), htons((uint16_t)part_len)};
+  memcpy(buffer + *offset, header, sizeof(header));
+  memcpy(buffer + *offset + 4, str, str_len);
+  *offset += part_len;
+  return 0;
+} /* int spool_put_string */
+
+static int spool_put_number(char *buffer, size_t buffer_size, size_t *offset,
+                            uint16_t type, uint64_t value) {
+  if (*offset + 12 > buffer_size)
+    return ENOBUFS;
+
+  uint16_t header[2] = {htons(type), htons(12)};
+  uint64_t tmp = htonll(value);
+  memcpy(buffer + *offset, header, sizeof(header));
+  memcpy(buffer + *offset + 4, &tmp, sizeof(tmp));
+  *offset += 12;
+  return 0;
+} /* int spool_put_number */
+
+static int spool_put_values(char *buffer, size_t buffer_size, size_t *offset,
+                            const data_set_t *ds, value_list_t const *vl) {
+  size_t num = vl->values_len;
+  size_t part_len = 6 + 9 * num;
+
+  if ((part_len > UINT16_MAX) || (*offset + part_len > buffer_size))
+    return ENOBUFS;
+
+  uint16_t header[3] = {htons(SPOOL_PART_VALUES), htons((uint16_t)part_len),
+                        htons((uint16_t)num)};
+  char *ptr = buffer + *offset;
+  memcpy(ptr, header, sizeof(header));
+  ptr += sizeof(header);
+
+  for (size_t i = 0; i < num; i++)
+    ptr[i] = (char)ds->ds[i].type;
+  ptr += num;
+
+  for (size_t i = 0; i < num; i++) {
+    value_t v = vl->values[i];
+    switch (ds->ds[i].type) {
+    case DS_TYPE_COUNTER:
+      v.counter = htonll(v.counter);
+      break;
+    case DS_TYPE_GAUGE:
+      v.gauge = htond(v.gauge);
+      break;
+    case DS_TYPE_DERIVE:
+      v.derive = (derive_t)htonll((uint64_t)v.derive);
+      break;
+    case DS_TYPE_ABSOLUTE:
+      v.absolute = htonll(v.absolute);
+      break;
+    }
+    memcpy(ptr + 8 * i, &v, sizeof(v));
+  }
+
+  *offset += part_len;
+  return 0;
+} /* int spool_put_values */
+
+/* Encodes "vl" as a record, i.e. prefixed with its length. */
+static int spool_encode(char *buffer, size_t buffer_size, size_t *ret_size,
+                        const data_set_t *ds, value_list_t const *vl) {
+  size_t offset = 4;
+  int status = 0;
+
+  status |= spool_put_string(buffer, buffer_size, &offset, SPOOL_PART_HOST,
+                             vl->host);
+  status |= spool_put_number(buffer, buffer_size, &offset, SPOOL_PART_TIME_HR,
+                             vl->time);
+  status |= spool_put_number(buffer, buffer_size, &offset,
+                             SPOOL_PART_INTERVAL_HR, vl->interval);
+  status |= spool_put_string(buffer, buffer_size, &offset, SPOOL_PART_PLUGIN,
+                             vl->plugin);
+  status |= spool_put_string(buffer, buffer_size, &offset,
+                             SPOOL_PART_PLUGIN_INSTANCE, vl->plugin_instance);
+  status |= spool_put_string(buffer, buffer_size, &offset, SPOOL_PART_TYPE,
+                             vl->type);
+  status |= spool_put_string(buffer, buffer_size, &offset,
+                             SPOOL_PART_TYPE_INSTANCE, vl->type_instance);
+  status |= spool_put_values(buffer, buffer_size, &offset, ds, vl);
+  if (status != 0)
+    return ENOBUFS;
+
+  uint32_t len = htonl((uint32_t)(offset - 4));
+  memcpy(buffer, &len, sizeof(len));
+  *ret_size = offset;
+  return 0;
+} /* int spool_encode */
+
+int spool_append(spool_t *s, const data_set_t *ds, value_list_t const *vl) {
+  char buffer[4096];
+  size_t size = 0;
+
+  if ((ds == NULL) || (ds->ds_num != vl->values_len))
+    return EINVAL;
+
+  int status = spool_encode(buffer, sizeof(buffer), &size, ds, vl);
+  if (status != 0)
+    return status;
+
+  pthread_mutex_lock(&s->lock);
+
+  if (s->size_limit != 0) {
+    /* Never remove the segment being written to. */
+    while ((s->size + size > s->size_limit) &&
+           (s->segments_num > ((s->write_fd >= 0) ? 1 : 0)))
+      spool_remove_oldest(s);
+
+    if (s->size + size > s->size_limit) {
+      pthread_mutex_unlock(&s->lock);
+      return ENOSPC;
+    }
+  }
+
+  if ((s->write_fd < 0) ||
+      (s->segments[s->segments_num - 1].size + size > s->segment_size)) {
+    status = spool_start_segment(s);
+    if (status != 0) {
+      pthread_mutex_unlock(&s->lock);
+      return status;
+    }
+  }
+
+  if (swrite(s->write_fd, buffer, size) != 0) {
+    status = errno;
+    ERROR("spool: Writing to spool \"%s\" failed: %s", s->name, STRERRNO);
+    /* The segment may end in a partial record, which the reader skips.
+     * Continue in a new segment. */
+    close(s->write_fd);
+    s->write_fd = -1;
+    pthread_mutex_unlock(&s->lock);
+    return status;
+  }
+
+  s->segments[s->segments_num - 1].size += size;
+  s->segments[s->segments_num - 1].end += size;
+  s->size += size;
+  pthread_mutex_unlock(&s->lock);
+  return 0;
+} /* int spool_append */
+
+/* Maps the first "size" bytes of segment "seq" for reading. */
+static int spool_map(spool_t *s, uint64_t seq, size_t size) {
+  char path[PATH_MAX];
+
+  spool_segment_path(s, seq, path, sizeof(path));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    int status = errno;
+    ERROR("spool: open (%s) failed: %s", path, STRERRNO);
+    return status;
+  }
+
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    int status = errno;
+    ERROR("spool: mmap (%s) failed: %s", path, STRERRNO);
+    return status;
+  }
+
+  if (s->map != NULL)
+    munmap(s->map, s->map_size);
+  s->map = map;
+  s->map_size = size;
+  s->map_seq = seq;
+  return 0;
+} /* int spool_map */
+
+/* Maps the oldest segment for reading. Returns ENOENT if the spool is
+ * empty. */
+static int spool_map_oldest(spool_t *s) {
+  pthread_mutex_lock(&s->lock);
+  if (s->segments_num == 0) {
+    pthread_mutex_unlock(&s->lock);
+    return ENOENT;
+  }
+  uint64_t seq = s->segments[0].seq;
+  size_t size = (size_t)s->segments[0].end;
+  pthread_mutex_unlock(&s->lock);
+
+  s->mapped = true;
+  s->map_seq = seq;
+  if (size == 0) {
+    s->read_offset = s->commit_offset = 0;
+    return 0;
+  }
+
+  int status = spool_map(s, seq, size);
+  if (status != 0) {
+    s->mapped = false;
+    /* Forget about segments removed behind our back. */
+    if (status == ENOENT) {
+      pthread_mutex_lock(&s->lock);
+      if ((s->segments_num > 0) && (s->segments[0].seq == seq))
+        spool_remove_oldest(s);
+      pthread_mutex_unlock(&s->lock);
+    }
+    return status;
+  }
+
+  if ((s->map_size < SPOOL_MAGIC_SIZE) ||
+      (memcmp(s->map, SPOOL_MAGIC, SPOOL_MAGIC_SIZE) != 0)) {
+    WARNING("spool: Segment %" PRIu64 " of spool \"%s\" has no valid "
+            "header. Skipping it.",
+            seq, s->name);
+    s->read_offset = s->map_size;
+  } else {
+    s->read_offset = SPOOL_MAGIC_SIZE;
+  }
+  s->commit_offset = s->read_offset;
+  return 0;
+} /* int spool_map_oldest */
+
+/* Called at the end of the mapped segment once everything has been committed.
+ * Removes the segment, unless value lists have been appended to it since it
+ * was mapped, in which case false is returned. */
+static bool spool_finish_segment(spool_t *s) {
+  pthread_mutex_lock(&s->lock);
+  if ((s->segments_num > 0) && (s->segments[0].seq == s->map_seq)) {
+    if (s->segments[0].end > s->map_size) {
+      pthread_mutex_unlock(&s->lock);
+      return false;
+    }
+    /* Also closes the segment if it is still being written to. */
+    spool_remove_oldest(s);
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  spool_unmap(s);
+  return true;
+} /* bool spool_finish_segment */
+
+static int spool_decode(char const *data, size_t size, value_list_t *vl) {
+  size_t offset = 0;
+  bool have_values = false;
+
+  while (offset + 4 <= size) {
+    uint16_t header[2];
+    memcpy(header, data + offset, sizeof(header));
+    uint16_t type = ntohs(header[0]);
+    size_t part_len = ntohs(header[1]);
+    if ((part_len < 4) || (offset + part_len > size))
+      return EINVAL;
+
+    char const *payload = data + offset + 4;
+    size_t payload_len = part_len - 4;
+    char *str = NULL;
+    uint64_t num;
+
+    switch (type) {
+    case SPOOL_PART_HOST:
+      str = vl->host;
+      break;
+    case SPOOL_PART_PLUGIN:
+      str = vl->plugin;
+      break;
+    case SPOOL_PART_PLUGIN_INSTANCE:
+      str = vl->plugin_instance;
+      break;
+    case SPOOL_PART_TYPE:
+      str = vl->type;
+      break;
+    case SPOOL_PART_TYPE_INSTANCE:
+      str = vl->type_instance;
+      break;
+    case SPOOL_PART_TIME_HR:
+    case SPOOL_PART_INTERVAL_HR:
+      if (payload_len != sizeof(num))
+        return EINVAL;
+      memcpy(&num, payload, sizeof(num));
+      if (type == SPOOL_PART_TIME_HR)
+        vl->time = (cdtime_t)ntohll(num);
+      else
+        vl->interval = (cdtime_t)ntohll(num);
+      break;
+    case SPOOL_PART_VALUES: {
+      uint16_t tmp;
+      if (payload_len < 2)
+        return EINVAL;
+      memcpy(&tmp, payload, sizeof(tmp));
+      size_t values_num = ntohs(tmp);
+      if ((values_num == 0) || (payload_len != 2 + 9 * values_num) ||
+          have_values)
+        return EINVAL;
+
+      vl->values = calloc(values_num, sizeof(*vl->values));
+      if (vl->values == NULL)
+        return ENOMEM;
+      vl->values_len = values_num;
+      have_values = true;
+
+      char const *types = payload + 2;
+      char const *values = types + values_num;
+      for (size_t i = 0; i < values_num; i++) {
+        value_t v;
+        memcpy(&v, values + 8 * i, sizeof(v));
+        switch (types[i]) {
+        case DS_TYPE_COUNTER:
+          v.counter = ntohll(v.counter);
+          break;
+        case DS_TYPE_GAUGE:
+          v.gauge = ntohd(v.gauge);
+          break;
+        case DS_TYPE_DERIVE:
+          v.derive = (derive_t)ntohll((uint64_t)v.derive);
+          break;
+        case DS_TYPE_ABSOLUTE:
+          v.absolute = ntohll(v.absolute);
+          break;
+        default:
+          sfree(vl->values);
+          return EINVAL;
+        }
+        vl->values[i] = v;
+      }
+      break;
+    }
+    default:
+      /* Unknown parts are skipped. */
+      break;
+    }
+
+    if (str != NULL) {
+      if ((payload_len == 0) || (payload_len > DATA_MAX_NAME_LEN) ||
+          (payload[payload_len - 1] != 0)) {
+        if (have_values)
+          sfree(vl->values);
+        return EINVAL;
+      }
+      memcpy(str, payload, payload_len);
+    }
+
+    offset += part_len;
+  }
+
+  if (!have_values)
+    return EINVAL;
+  return 0;
+} /* int spool_decode */
+
+int spool_read(spool_t *s, value_list_t *vl) {
+  while (true) {
+    if (!s->mapped && (spool_map_oldest(s) != 0))
+      return ENOENT;
+
+    if (s->read_offset + 4 <= s->map_size) {
+      uint32_t len;
+      memcpy(&len, s->map + s->read_offset, sizeof(len));
+      len = ntohl(len);
+
+      if (s->read_offset + 4 + len <= s->map_size) {
+        char const *data = s->map + s->read_offset + 4;
+        *vl = (value_list_t)VALUE_LIST_INIT;
+        int status = spool_decode(data, len, vl);
+        s->read_offset += 4 + len;
+        if (status == 0)
+          return 0;
+        WARNING("spool: Skipping a malformed record in spool \"%s\".",
+                s->name);
+        continue;
+      }
+    }
+
+    /* The segment may still be written to: map what has been appended since
+     * it was mapped. */
+    pthread_mutex_lock(&s->lock);
+    uint64_t end = 0;
+    if ((s->segments_num > 0) && (s->segments[0].seq == s->map_seq))
+      end = s->segments[0].end;
+    pthread_mutex_unlock(&s->lock);
+
+    if ((end > s->map_size) && (s->map != NULL)) {
+      if (spool_map(s, s->map_seq, (size_t)end) != 0)
+        return ENOENT;
+      continue;
+    }
+
+    if (s->read_offset < s->map_size) {
+      /* A record cut short, e.g. by a full disk or a crash. */
+      WARNING("spool: Spool \"%s\" ends in a partial record.", s->name);
+      s->read_offset = s->map_size;
+    }
+
+    /* Don't read on before the value lists read so far have been committed,
+     * so they can still be rewound. */
+    if (s->commit_offset != s->read_offset)
+      return ENOENT;
+
+    spool_finish_segment(s);
+  }
+} /* int spool_read */
+
+void spool_commit(spool_t *s) {
+  if (s->commit_offset == s->read_offset)
+    return;
+
+  pthread_mutex_lock(&s->lock);
+  if ((s->segments_num > 0) && (s->segments[0].seq == s->map_seq)) {
+    uint64_t committed = (uint64_t)(s->read_offset - s->commit_offset);
+    if (committed > s->segments[0].size)
+      committed = s->segments[0].size;
+    s->segments[0].size -= committed;
+    s->size -= committed;
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  s->commit_offset = s->read_offset;
+  if (s->read_offset >= s->map_size)
+    spool_finish_segment(s);
+} /* void spool_commit */
+
+void spool_rewind(spool_t *s) {
+  s->read_offset = s->commit_offset;
+} /* void spool_rewind */
+
+uint64_t spool_size(spool_t *s) {
+  pthread_mutex_lock(&s->lock);
+  uint64_t size = s->size;
+  pthread_mutex_unlock(&s->lock);
+  return size;
+} /* uint64_t spool_size */
@@ -0,0 +1,99 @@
+/**
+ * collectd - src/daemon/utils_spool.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_SPOOL_H
+#define UTILS_SPOOL_H 1
+
+#include "plugin.h"
+
+/* Disk-backed buffer of value lists. Value lists are appended to segment files
+ * named "<name>-<sequence>.spool" in a directory, encoded in collectd's binary
+ * network format, and read back in order from the oldest segment, which is
+ * mmap'ed for reading. Segments are removed once all their value lists have
+ * been read and committed. Meta data is not stored.
+ *
+ * Appending may be done by any thread; reading and committing must be done by
+ * a single thread. */
+struct spool_s;
+typedef struct spool_s spool_t;
+
+/*
+ * NAME
+ *   spool_open
+ *
+ * DESCRIPTION
+ *   Opens the spool called `name' in `directory', creating the directory if
+ *   needed. Segments left over from an earlier run are picked up and read
+ *   first. If `size_limit' is not zero, the oldest segments are removed to
+ *   keep the size of the spool below that many bytes.
+ *
+ * RETURN VALUE
+ *   The spool or NULL on error.
+ */
+spool_t *spool_open(const char *directory, const char *name,
+                    uint64_t size_limit);
+
+/* Closes the spool. The segments are kept on disk. Accepts NULL. */
+void spool_close(spool_t *s);
+
+/*
+ * NAME
+ *   spool_append
+ *
+ * DESCRIPTION
+ *   Appends `vl' to the newest segment, starting a new one if it is full.
+ *
+ * RETURN VALUE
+ *   Zero on success, ENOSPC if the size limit would be exceeded even after
+ *   removing all other segments, and an errno value on other errors.
+ */
+int spool_append(spool_t *s, const data_set_t *ds, value_list_t const *vl);
+
+/*
+ * NAME
+ *   spool_read
+ *
+ * DESCRIPTION
+ *   Reads the next value list into `vl'. The value list's `values' are
+ *   allocated and must be freed by the caller. Value lists that have been read
+ *   are skipped until `spool_rewind' is called and removed when
+ *   `spool_commit' is called. To make sure all value lists that have been read
+ *   can be committed or rewound together, a read never continues in the next
+ *   segment before the previous value lists have been committed.
+ *
+ * RETURN VALUE
+ *   Zero on success, ENOENT if there is nothing more to read until the value
+ *   lists read so far have been committed, or if the spool is empty.
+ */
+int spool_read(spool_t *s, value_list_t *vl);
+
+/* Removes the value lists read so far from the spool. */
+void spool_commit(spool_t *s);
+
+/* Makes the value lists read but not committed so far available again. */
+void spool_rewind(spool_t *s);
+
+/* Returns the number of bytes the value lists in the spool take up. */
+uint64_t spool_size(spool_t *s);
+
+#endif /* UTILS_SPOOL_H */
@@ -0,0 +1,150 @@
+/**
+ * collectd - src/daemon/utils_spool_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "testing.h"
+#include "utils_spool.h"
+
+static data_source_t dsrc[] = {
+    {"rx", DS_TYPE_DERIVE, 0.0, NAN}, {"tx", DS_TYPE_GAUGE, 0.0, NAN},
+};
+static data_set_t ds = {"if_octets", STATIC_ARRAY_SIZE(dsrc), dsrc};
+
+static char spool_dir[] = "/tmp/collectd-spool-test-XXXXXX";
+
+static int append(spool_t *s, int i) {
+  value_t values[] = {{.derive = i}, {.gauge = 0.5 * i}};
+  value_list_t vl = {
+      .values = values,
+      .values_len = STATIC_ARRAY_SIZE(values),
+      .time = TIME_T_TO_CDTIME_T(1000 + i),
+      .interval = TIME_T_TO_CDTIME_T(10),
+  };
+  sstrncpy(vl.host, "example.com", sizeof(vl.host));
+  sstrncpy(vl.plugin, "interface", sizeof(vl.plugin));
+  snprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "eth%d", i);
+  sstrncpy(vl.type, "if_octets", sizeof(vl.type));
+
+  return spool_append(s, &ds, &vl);
+}
+
+static int check_read(spool_t *s, int i) {
+  value_list_t vl;
+  char want[DATA_MAX_NAME_LEN];
+
+  CHECK_ZERO(spool_read(s, &vl));
+  snprintf(want, sizeof(want), "eth%d", i);
+  EXPECT_EQ_STR("example.com", vl.host);
+  EXPECT_EQ_STR(want, vl.plugin_instance);
+  EXPECT_EQ_STR("if_octets", vl.type);
+  EXPECT_EQ_STR("", vl.type_instance);
+  EXPECT_EQ_UINT64(TIME_T_TO_CDTIME_T(1000 + i), vl.time);
+  EXPECT_EQ_UINT64(TIME_T_TO_CDTIME_T(10), vl.interval);
+  EXPECT_EQ_INT(2, (int)vl.values_len);
+  EXPECT_EQ_INT(i, (int)vl.values[0].derive);
+  EXPECT_EQ_DOUBLE(0.5 * i, vl.values[1].gauge);
+  sfree(vl.values);
+  return 0;
+}
+
+DEF_TEST(append_and_read) {
+  spool_t *s;
+  value_list_t vl;
+
+  CHECK_NOT_NULL(s = spool_open(spool_dir, "write_http/node", 0));
+  EXPECT_EQ_INT(ENOENT, spool_read(s, &vl));
+
+  for (int i = 0; i < 3; i++)
+    CHECK_ZERO(append(s, i));
+  OK(spool_size(s) > 0);
+
+  /* Rewound value lists are read again. */
+  for (int i = 0; i < 2; i++)
+    CHECK_ZERO(check_read(s, i));
+  spool_rewind(s);
+  for (int i = 0; i < 2; i++)
+    CHECK_ZERO(check_read(s, i));
+  spool_commit(s);
+
+  /* Value lists appended while reading can be read right away. */
+  CHECK_ZERO(append(s, 3));
+  CHECK_ZERO(check_read(s, 2));
+  CHECK_ZERO(check_read(s, 3));
+  EXPECT_EQ_INT(ENOENT, spool_read(s, &vl));
+  spool_commit(s);
+
+  EXPECT_EQ_INT(ENOENT, spool_read(s, &vl));
+  EXPECT_EQ_UINT64(0, spool_size(s));
+
+  /* Segments are kept on disk when the spool is closed. */
+  CHECK_ZERO(append(s, 4));
+  spool_close(s);
+  CHECK_NOT_NULL(s = spool_open(spool_dir, "write_http/node", 0));
+  CHECK_ZERO(check_read(s, 4));
+  spool_commit(s);
+  EXPECT_EQ_INT(ENOENT, spool_read(s, &vl));
+
+  spool_close(s);
+  return 0;
+}
+
+DEF_TEST(size_limit) {
+  spool_t *s;
+  value_list_t vl;
+
+  /* Room for about ten records, in segments of about two. */
+  CHECK_NOT_NULL(s = spool_open(spool_dir, "limited", 1100));
+  for (int i = 0; i < 100; i++)
+    CHECK_ZERO(append(s, i));
+  OK(spool_size(s) <= 1100);
+
+  /* The oldest value lists have been removed. */
+  CHECK_ZERO(spool_read(s, &vl));
+  OK(vl.values[0].derive > 80);
+  sfree(vl.values);
+
+  spool_close(s);
+  return 0;
+}
+
+static int remove_file(const char *dir, const char *file, void *ud) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, file);
+  return unlink(path);
+}
+
+int main(void) {
+  if (mkdtemp(spool_dir) == NULL) {
+    printf("mkdtemp failed: %s\n", STRERRNO);
+    return 1;
+  }
+
+  RUN_TEST(append_and_read);
+  RUN_TEST(size_limit);
+
+  walk_directory(spool_dir, remove_file, NULL, /* hidden = */ 1);
+  rmdir(spool_dir);
+  END_TEST;
+}
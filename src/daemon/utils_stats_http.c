@@ -0,0 +1,535 @@
+/**
+ * collectd - src/daemon/utils_stats_http.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_stats_http.h"
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define STATS_HTTP_NAME "internal_stats"
+#define STATS_HTTP_REQUEST_MAX 2048
+#define STATS_HTTP_CLIENTS_MAX 16
+#define STATS_HTTP_TIMEOUT TIME_T_TO_CDTIME_T(10)
+
+struct stats_buf_s {
+  char *data;
+  size_t len;
+  size_t size;
+  bool failed; /* an allocation failed, "data" is incomplete */
+};
+typedef struct stats_buf_s stats_buf_t;
+
+/* A connection is watched for POLLIN until the request has been read. If the
+ * response doesn't fit into the socket buffer, a duplicate of the descriptor
+ * is watched for POLLOUT until the rest has been sent. */
+struct stats_client_s {
+  int fd;
+  int out_fd; /* -1 until the response is handed over */
+  char name[DATA_MAX_NAME_LEN];
+  char request[STATS_HTTP_REQUEST_MAX];
+  size_t request_len;
+  stats_buf_t response;
+  size_t response_off;
+  cdtime_t last_active;
+  struct stats_client_s *next;
+};
+typedef struct stats_client_s stats_client_t;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_client_t *stats_clients;
+static size_t stats_clients_num;
+static unsigned int stats_clients_seq;
+
+static int stats_listen_fd = -1;
+static char *stats_socket_path;
+
+static void stats_buf_printf(stats_buf_t *buf, const char *format, ...) {
+  if (buf->failed)
+    return;
+
+  while (true) {
+    size_t avail = buf->size - buf->len;
+    va_list ap;
+    va_start(ap, format);
+    int status = vsnprintf(buf->data + buf->len, avail, format, ap);
+    va_end(ap);
+
+    if (status < 0) {
+      buf->failed = true;
+      return;
+    }
+    if ((size_t)status < avail) {
+      buf->len += (size_t)status;
+      return;
+    }
+
+    size_t size = (buf->size > 0) ? 2 * buf->size : 4096;
+    while (size - buf->len <= (size_t)status)
+      size *= 2;
+    char *tmp = realloc(buf->data, size);
+    if (tmp == NULL) {
+      buf->failed = true;
+      return;
+    }
+    buf->data = tmp;
+    buf->size = size;
+  }
+} /* void stats_buf_printf */
+
+/* Appends "s", escaping backslashes and newlines, and double quotes if
+ * "quotes" is true. */
+static void stats_buf_escape(stats_buf_t *buf, const char *s, bool quotes) {
+  for (; *s != 0; s++) {
+    if (*s == '\\')
+      stats_buf_printf(buf, "\\\\");
+    else if (*s == '\n')
+      stats_buf_printf(buf, "\\n");
+    else if (quotes && (*s == '"'))
+      stats_buf_printf(buf, "\\\"");
+    else
+      stats_buf_printf(buf, "%c", *s);
+  }
+} /* void stats_buf_escape */
+
+struct stats_format_s {
+  stats_buf_t *buf;
+  char last_name[DATA_MAX_NAME_LEN];
+};
+typedef struct stats_format_s stats_format_t;
+
+static void stats_format_sample(const char *name, const char *help,
+                                bool counter, const char *label_name,
+                                const char *label_value, double value,
+                                void *user_data) {
+  stats_format_t *fmt = user_data;
+  stats_buf_t *buf = fmt->buf;
+
+  if (strcmp(name, fmt->last_name) != 0) {
+    if (help != NULL) {
+      stats_buf_printf(buf, "# HELP %s ", name);
+      stats_buf_escape(buf, help, /* quotes = */ false);
+      stats_buf_printf(buf, "\n");
+    }
+    stats_buf_printf(buf, "# TYPE %s %s\n", name,
+                     counter ? "counter" : "gauge");
+    sstrncpy(fmt->last_name, name, sizeof(fmt->last_name));
+  }
+
+  stats_buf_printf(buf, "%s", name);
+  if ((label_name != NULL) && (label_value != NULL)) {
+    stats_buf_printf(buf, "{%s=\"", label_name);
+    stats_buf_escape(buf, label_value, /* quotes = */ true);
+    stats_buf_printf(buf, "\"}");
+  }
+  stats_buf_printf(buf, " %.15g\n", value);
+} /* void stats_format_sample */
+
+/* Parses the request line and fills in the complete response. */
+static void stats_client_respond(stats_client_t *client) {
+  char *line = client->request;
+  line[strcspn(line, "\r\n")] = 0;
+
+  char *fields[3] = {NULL};
+  char *saveptr = NULL;
+  size_t fields_num = 0;
+  for (char *f = strtok_r(line, " ", &saveptr);
+       (f != NULL) && (fields_num < STATIC_ARRAY_SIZE(fields));
+       f = strtok_r(NULL, " ", &saveptr))
+    fields[fields_num++] = f;
+
+  const char *status = "200 OK";
+  stats_buf_t body = {0};
+
+  if ((fields_num != 3) || (strncmp(fields[2], "HTTP/", 5) != 0))
+    status = "400 Bad Request";
+  else if (strcmp(fields[0], "GET") != 0)
+    status = "405 Method Not Allowed";
+  else {
+    fields[1][strcspn(fields[1], "?")] = 0;
+    if ((strcmp(fields[1], "/metrics") != 0) && (strcmp(fields[1], "/") != 0))
+      status = "404 Not Found";
+  }
+
+  if (strcmp(status, "200 OK") == 0) {
+    stats_format_t fmt = {.buf = &body};
+    plugin_internal_stats_foreach(stats_format_sample, &fmt);
+    if (body.failed) {
+      status = "500 Internal Server Error";
+      sfree(body.data);
+      body = (stats_buf_t){0};
+    }
+  }
+  if (strcmp(status, "200 OK") != 0)
+    stats_buf_printf(&body, "%s\n", status);
+
+  stats_buf_printf(&client->response,
+                   "HTTP/1.1 %s\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: %zu\r\n"
+                   "%s"
+                   "Connection: close\r\n"
+                   "\r\n"
+                   "%.*s",
+                   status, body.len,
+                   (strncmp(status, "405", 3) == 0) ? "Allow: GET\r\n" : "",
+                   (int)body.len, (body.data != NULL) ? body.data : "");
+  sfree(body.data);
+} /* void stats_client_respond */
+
+static void stats_client_free(void *arg) {
+  stats_client_t *client = arg;
+
+  pthread_mutex_lock(&stats_lock);
+  for (stats_client_t **c = &stats_clients; *c != NULL; c = &(*c)->next) {
+    if (*c == client) {
+      *c = client->next;
+      stats_clients_num--;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&stats_lock);
+
+  close(client->fd);
+  if (client->out_fd >= 0)
+    close(client->out_fd);
+  sfree(client->response.data);
+  sfree(client);
+} /* void stats_client_free */
+
+/* Returns zero if the rest of the response has to wait for POLLOUT. */
+static int stats_client_send(stats_client_t *client, int fd) {
+  while (client->response_off < client->response.len) {
+    ssize_t status =
+        send(fd, client->response.data + client->response_off,
+             client->response.len - client->response_off, MSG_NOSIGNAL);
+    if (status < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return 0;
+      if (errno == EINTR)
+        continue;
+      DEBUG("stats_http: send failed: %s", STRERRNO);
+      return -1;
+    }
+    client->response_off += (size_t)status;
+  }
+
+  /* Done, the connection is closed. */
+  return 1;
+} /* int stats_client_send */
+
+static int stats_client_write_cb(int fd, __attribute__((unused)) int revents,
+                                 user_data_t *ud) {
+  stats_client_t *client = ud->data;
+  client->last_active = cdtime();
+
+  return (stats_client_send(client, fd) == 0) ? 0 : -1;
+} /* int stats_client_write_cb */
+
+static int stats_client_read_cb(int fd, __attribute__((unused)) int revents,
+                                user_data_t *ud) {
+  stats_client_t *client = ud->data;
+  client->last_active = cdtime();
+
+  while (true) {
+    size_t avail = sizeof(client->request) - client->request_len - 1;
+    if (avail == 0)
+      break;
+
+    ssize_t status = recv(fd, client->request + client->request_len, avail, 0);
+    if (status < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+      if (errno == EINTR)
+        continue;
+      DEBUG("stats_http: recv failed: %s", STRERRNO);
+      return -1;
+    }
+    if (status == 0)
+      return -1;
+    client->request_len += (size_t)status;
+  }
+  client->request[client->request_len] = 0;
+
+  /* Wait for the end of the headers, unless the buffer is full. */
+  if ((strstr(client->request, "\r\n\r\n") == NULL) &&
+      (strstr(client->request, "\n\n") == NULL) &&
+      (client->request_len < sizeof(client->request) - 1))
+    return 0;
+
+  stats_client_respond(client);
+  if (client->response.failed)
+    return -1;
+
+  int status = stats_client_send(client, fd);
+  if (status != 0)
+    return -1;
+
+  /* The descriptor is still watched for POLLIN until this callback returns,
+   * so the rest of the response is sent from a duplicate. */
+  int out_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (out_fd < 0) {
+    ERROR("stats_http: Duplicating the file descriptor failed: %s", STRERRNO);
+    return -1;
+  }
+
+  pthread_mutex_lock(&stats_lock);
+  client->out_fd = out_fd;
+  sstrncpy(client->name + strlen(client->name), "-w",
+           sizeof(client->name) - strlen(client->name));
+  pthread_mutex_unlock(&stats_lock);
+
+  user_data_t out_ud = {.data = client, .free_func = stats_client_free};
+  if (plugin_register_fd(client->name, out_fd, POLLOUT, stats_client_write_cb,
+                         &out_ud) != 0)
+    return -1;
+
+  /* The client is owned by the POLLOUT event source now. */
+  ud->free_func = NULL;
+  return -1;
+} /* int stats_client_read_cb */
+
+static int stats_accept_cb(int fd, __attribute__((unused)) int revents,
+                           __attribute__((unused)) user_data_t *ud) {
+  while (true) {
+    int client_fd = accept(fd, NULL, NULL);
+    if (client_fd < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+        WARNING("stats_http: accept failed: %s", STRERRNO);
+      return 0;
+    }
+    if ((fcntl(client_fd, F_SETFL, O_NONBLOCK) != 0) ||
+        (fcntl(client_fd, F_SETFD, FD_CLOEXEC) != 0)) {
+      WARNING("stats_http: fcntl failed: %s", STRERRNO);
+      close(client_fd);
+      continue;
+    }
+
+    stats_client_t *client = calloc(1, sizeof(*client));
+    if (client == NULL) {
+      close(client_fd);
+      continue;
+    }
+    client->fd = client_fd;
+    client->out_fd = -1;
+    client->last_active = cdtime();
+
+    pthread_mutex_lock(&stats_lock);
+    if (stats_clients_num >= STATS_HTTP_CLIENTS_MAX) {
+      pthread_mutex_unlock(&stats_lock);
+      DEBUG("stats_http: Too many connections, closing the new one.");
+      close(client_fd);
+      sfree(client);
+      continue;
+    }
+    snprintf(client->name, sizeof(client->name), STATS_HTTP_NAME "-client-%u",
+             stats_clients_seq++);
+    client->next = stats_clients;
+    stats_clients = client;
+    stats_clients_num++;
+    pthread_mutex_unlock(&stats_lock);
+
+    user_data_t client_ud = {.data = client, .free_func = stats_client_free};
+    if (plugin_register_fd(client->name, client_fd, POLLIN,
+                           stats_client_read_cb, &client_ud) != 0)
+      stats_client_free(client);
+  }
+} /* int stats_accept_cb */
+
+/* Copies the names of the connections idle for longer than "timeout", or of
+ * all connections if "timeout" is zero. */
+static size_t stats_clients_names(char names[][DATA_MAX_NAME_LEN],
+                                  size_t names_size, cdtime_t timeout) {
+  cdtime_t now = cdtime();
+  size_t num = 0;
+
+  pthread_mutex_lock(&stats_lock);
+  for (stats_client_t *c = stats_clients; (c != NULL) && (num < names_size);
+       c = c->next) {
+    if ((timeout != 0) && (now - c->last_active < timeout))
+      continue;
+    sstrncpy(names[num++], c->name, DATA_MAX_NAME_LEN);
+  }
+  pthread_mutex_unlock(&stats_lock);
+
+  return num;
+} /* size_t stats_clients_names */
+
+static int stats_timeout_cb(__attribute__((unused)) user_data_t *ud) {
+  char names[STATS_HTTP_CLIENTS_MAX][DATA_MAX_NAME_LEN];
+  size_t num = stats_clients_names(names, STATIC_ARRAY_SIZE(names),
+                                   STATS_HTTP_TIMEOUT);
+
+  for (size_t i = 0; i < num; i++) {
+    DEBUG("stats_http: Closing idle connection \"%s\".", names[i]);
+    plugin_unregister_fd(names[i]);
+  }
+  return 0;
+} /* int stats_timeout_cb */
+
+static int stats_listen_unix(const char *path) {
+  struct sockaddr_un sa = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(sa.sun_path)) {
+    ERROR("stats_http: The socket path \"%s\" is too long.", path);
+    return -1;
+  }
+  sstrncpy(sa.sun_path, path, sizeof(sa.sun_path));
+
+  /* Remove a stale socket, but nothing else. */
+  struct stat st;
+  if ((lstat(path, &st) == 0) && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    ERROR("stats_http: socket failed: %s", STRERRNO);
+    return -1;
+  }
+
+  if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+      (listen(fd, STATS_HTTP_CLIENTS_MAX) != 0)) {
+    ERROR("stats_http: Listening on \"%s\" failed: %s", path, STRERRNO);
+    close(fd);
+    return -1;
+  }
+
+  stats_socket_path = strdup(path);
+  return fd;
+} /* int stats_listen_unix */
+
+static int stats_listen_inet(const char *address) {
+  char host[NI_MAXHOST];
+  sstrncpy(host, address, sizeof(host));
+
+  char *port = strrchr(host, ':');
+  if ((port == NULL) || (port[1] == 0)) {
+    ERROR("stats_http: \"%s\" is neither a socket path nor \"host:port\".",
+          address);
+    return -1;
+  }
+  *port++ = 0;
+
+  char *node = host;
+  size_t node_len = strlen(node);
+  if ((node_len >= 2) && (node[0] == '[') && (node[node_len - 1] == ']')) {
+    node[node_len - 1] = 0;
+    node++;
+  }
+  if ((node[0] == 0) || (strcmp(node, "*") == 0))
+    node = NULL;
+
+  struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                           .ai_socktype = SOCK_STREAM,
+                           .ai_flags = AI_PASSIVE | AI_ADDRCONFIG};
+  struct addrinfo *ai_list = NULL;
+  int status = getaddrinfo(node, port, &hints, &ai_list);
+  if (status != 0) {
+    ERROR("stats_http: getaddrinfo (%s) failed: %s", address,
+          gai_strerror(status));
+    return -1;
+  }
+
+  int fd = -1;
+  for (struct addrinfo *ai = ai_list; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                ai->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if ((bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) &&
+        (listen(fd, STATS_HTTP_CLIENTS_MAX) == 0))
+      break;
+
+    ERROR("stats_http: Listening on \"%s\" failed: %s", address, STRERRNO);
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(ai_list);
+
+  return fd;
+} /* int stats_listen_inet */
+
+int stats_http_start(const char *address) {
+  if ((address == NULL) || (address[0] == 0))
+    return EINVAL;
+  if (stats_listen_fd >= 0)
+    return EALREADY;
+
+  int fd = (address[0] == '/') ? stats_listen_unix(address)
+                               : stats_listen_inet(address);
+  if (fd < 0)
+    return -1;
+
+  int status = plugin_register_fd(STATS_HTTP_NAME, fd, POLLIN, stats_accept_cb,
+                                  /* user data = */ NULL);
+  if (status != 0) {
+    ERROR("stats_http: Serving the internal statistics requires the event "
+          "loop: %s",
+          STRERROR(status));
+    close(fd);
+    if (stats_socket_path != NULL) {
+      unlink(stats_socket_path);
+      sfree(stats_socket_path);
+    }
+    return status;
+  }
+  stats_listen_fd = fd;
+
+  plugin_register_timer(STATS_HTTP_NAME "-timeout", STATS_HTTP_TIMEOUT / 2,
+                        stats_timeout_cb, /* user data = */ NULL);
+
+  INFO("stats_http: Serving the internal statistics on \"%s\".", address);
+  return 0;
+} /* int stats_http_start */
+
+void stats_http_stop(void) {
+  if (stats_listen_fd < 0)
+    return;
+
+  plugin_unregister_timer(STATS_HTTP_NAME "-timeout");
+  plugin_unregister_fd(STATS_HTTP_NAME);
+  close(stats_listen_fd);
+  stats_listen_fd = -1;
+
+  if (stats_socket_path != NULL) {
+    unlink(stats_socket_path);
+    sfree(stats_socket_path);
+  }
+
+  /* No new connections are accepted now. */
+  char names[STATS_HTTP_CLIENTS_MAX][DATA_MAX_NAME_LEN];
+  size_t num =
+      stats_clients_names(names, STATIC_ARRAY_SIZE(names), /* timeout = */ 0);
+  for (size_t i = 0; i < num; i++)
+    plugin_unregister_fd(names[i]);
+} /* void stats_http_stop */
@@ -0,0 +1,41 @@
+/**
+ * collectd - src/daemon/utils_stats_http.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_STATS_HTTP_H
+#define UTILS_STATS_HTTP_H 1
+
+/* Minimal HTTP endpoint serving the daemon's internal counters, see
+ * plugin_internal_stats_foreach(), in the Prometheus text format on
+ * "GET /metrics". The counters are rendered when the request arrives, so the
+ * endpoint keeps working when the write queue is congested or no write plugin
+ * is loaded.
+ *
+ * "address" is either the path of a UNIX socket, starting with a slash, or
+ * "host:port"; IPv6 addresses may be enclosed in brackets. Connections are
+ * served from the event loop of the daemon. */
+int stats_http_start(const char *address);
+
+/* Closes the listening socket and all connections. */
+void stats_http_stop(void);
+
+#endif /* UTILS_STATS_HTTP_H */
@@ -28,6 +28,7 @@
 
 #include "common.h"
 #include "utils_avltree.h"
+#include "utils_cache.h"
 #include "utils_threshold.h"
 
 #include <pthread.h>
@@ -37,6 +38,7 @@
  * {{{ */
 c_avl_tree_t *threshold_tree = NULL;
 pthread_mutex_t threshold_lock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t threshold_generation = 1;
 /* }}} */
 
 /*
@@ -64,21 +66,26 @@ threshold_t *threshold_get(const char *hostname, const char *plugin,
 } /* }}} threshold_t *threshold_get */
 
 /*
- * threshold_t *threshold_search
+ * threshold_t *threshold_resolve
  *
  * Searches for a threshold configuration using all the possible variations of
  * "Host", "Plugin" and "Type" blocks. Returns NULL if no threshold could be
  * found.
- * XXX: This is likely the least efficient function in collectd.
  */
-threshold_t *threshold_search(const value_list_t *vl) { /* {{{ */
+static threshold_t *threshold_resolve(const value_list_t *vl) { /* {{{ */
   threshold_t *th;
 
-  if ((th = threshold_get(vl->host, vl->plugin, vl->plugin_instance, vl->type,
-                          vl->type_instance)) != NULL)
+  /* The most specific variation is the value list's own identifier. Use the
+   * interned one if it is available. */
+  if (vl->identifier.hash != 0) {
+    if (c_avl_get(threshold_tree, vl->identifier.name, (void *)&th) == 0)
+      return th;
+  } else if ((th = threshold_get(vl->host, vl->plugin, vl->plugin_instance,
+                                 vl->type, vl->type_instance)) != NULL)
     return th;
-  else if ((th = threshold_get(vl->host, vl->plugin, vl->plugin_instance,
-                               vl->type, NULL)) != NULL)
+
+  if ((th = threshold_get(vl->host, vl->plugin, vl->plugin_instance, vl->type,
+                          NULL)) != NULL)
     return th;
   else if ((th = threshold_get(vl->host, vl->plugin, NULL, vl->type,
                                vl->type_instance)) != NULL)
@@ -109,6 +116,25 @@ threshold_t *threshold_search(const value_list_t *vl) { /* {{{ */
     return th;
 
   return NULL;
+} /* }}} threshold_t *threshold_resolve */
+
+/*
+ * threshold_t *threshold_search
+ *
+ * Returns the threshold configuration applying to "vl" or NULL if there is
+ * none. The result is remembered in the value cache, so the search in
+ * "threshold_resolve" only runs once per identifier and generation.
+ */
+threshold_t *threshold_search(const value_list_t *vl) { /* {{{ */
+  uint64_t generation = threshold_generation;
+  void *th;
+
+  if (uc_get_threshold(vl, generation, &th) == 0)
+    return th;
+
+  th = threshold_resolve(vl);
+  uc_set_threshold(vl, generation, th);
+  return th;
 } /* }}} threshold_t *threshold_search */
 
 int ut_search_threshold(const value_list_t *vl, /* {{{ */
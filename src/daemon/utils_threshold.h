@@ -51,6 +51,9 @@ typedef struct threshold_s {
 
 extern c_avl_tree_t *threshold_tree;
 extern pthread_mutex_t threshold_lock;
+/* Incremented whenever thresholds are added, which invalidates the results
+ * of "threshold_search" cached in the value cache. */
+extern uint64_t threshold_generation;
 
 threshold_t *threshold_get(const char *hostname, const char *plugin,
                            const char *plugin_instance, const char *type,
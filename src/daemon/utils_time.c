@@ -38,6 +38,8 @@
 cdtime_t cdtime_mock = (cdtime_t)MOCK_TIME;
 
 cdtime_t cdtime(void) { return cdtime_mock; }
+
+cdtime_t cdtime_coarse(void) { return cdtime_mock; }
 #else /* !MOCK_TIME */
 #if HAVE_CLOCK_GETTIME
 cdtime_t cdtime(void) /* {{{ */
@@ -53,6 +55,21 @@ cdtime_t cdtime(void) /* {{{ */
 
   return TIMESPEC_TO_CDTIME_T(&ts);
 } /* }}} cdtime_t cdtime */
+
+#ifdef CLOCK_REALTIME_COARSE
+cdtime_t cdtime_coarse(void) /* {{{ */
+{
+  struct timespec ts = {0, 0};
+
+  /* Not available with all kernels, even if the constant is defined. */
+  if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) != 0)
+    return cdtime();
+
+  return TIMESPEC_TO_CDTIME_T(&ts);
+} /* }}} cdtime_t cdtime_coarse */
+#else
+cdtime_t cdtime_coarse(void) { return cdtime(); }
+#endif
 #else /* !HAVE_CLOCK_GETTIME */
 /* Work around for Mac OS X which doesn't have clock_gettime(2). *sigh* */
 cdtime_t cdtime(void) /* {{{ */
@@ -68,6 +85,8 @@ cdtime_t cdtime(void) /* {{{ */
 
   return TIMEVAL_TO_CDTIME_T(&tv);
 } /* }}} cdtime_t cdtime */
+
+cdtime_t cdtime_coarse(void) { return cdtime(); }
 #endif
 #endif
 
@@ -111,6 +130,50 @@ static int get_local_time(cdtime_t t, struct tm *t_tm, long *nsec) /* {{{ */
 
 static const char zulu_zone[] = "Z";
 
+/* Formatting the date and time of day with gmtime_r() and strftime() is
+ * comparatively expensive, and most callers format many times within the
+ * same second. Each thread therefore caches the formatted seconds of the last
+ * time it formatted, one entry for UTC and one for local time. */
+typedef struct {
+  bool valid;
+  time_t sec;
+  size_t date_len;
+  char date[32]; /* 2006-01-02T15:04:05 */
+  char zone[7];  /* +00:00 */
+} rfc3339_cache_entry_t;
+
+typedef struct {
+  rfc3339_cache_entry_t utc;
+  rfc3339_cache_entry_t local;
+} rfc3339_cache_t;
+
+static pthread_key_t rfc3339_cache_key;
+static pthread_once_t rfc3339_cache_once = PTHREAD_ONCE_INIT;
+
+static void rfc3339_cache_key_create(void) /* {{{ */
+{
+  pthread_key_create(&rfc3339_cache_key, free);
+} /* }}} void rfc3339_cache_key_create */
+
+static rfc3339_cache_t *rfc3339_cache_get(void) /* {{{ */
+{
+  pthread_once(&rfc3339_cache_once, rfc3339_cache_key_create);
+
+  rfc3339_cache_t *c = pthread_getspecific(rfc3339_cache_key);
+  if (c != NULL)
+    return c;
+
+  c = calloc(1, sizeof(*c));
+  if (c == NULL)
+    return NULL;
+
+  if (pthread_setspecific(rfc3339_cache_key, c) != 0) {
+    free(c);
+    return NULL;
+  }
+  return c;
+} /* }}} rfc3339_cache_t *rfc3339_cache_get */
+
 /* format_zone reads time zone information from "extern long timezone", exported
  * by <time.h>, and formats it according to RFC 3339. This differs from
  * strftime()'s "%z" format by including a colon between hour and minute. */
@@ -166,6 +229,70 @@ int format_rfc3339(char *buffer, size_t buffer_size, struct tm const *t_tm,
   return 0;
 } /* }}} int format_rfc3339 */
 
+/* format_rfc3339_cached formats "t" like format_rfc3339(), taking the date
+ * and time of day from the calling thread's cache. Returns ENOTSUP if the
+ * cache is not available. */
+static int format_rfc3339_cached(char *buffer, size_t buffer_size, cdtime_t t,
+                                 bool print_nano, bool local) /* {{{ */
+{
+  rfc3339_cache_t *c = rfc3339_cache_get();
+  if (c == NULL)
+    return ENOTSUP;
+
+  struct timespec t_spec = CDTIME_T_TO_TIMESPEC(t);
+  NORMALIZE_TIMESPEC(t_spec);
+
+  rfc3339_cache_entry_t *e = local ? &c->local : &c->utc;
+  if (!e->valid || (e->sec != t_spec.tv_sec)) {
+    struct tm t_tm;
+    long nsec;
+    int status;
+
+    e->valid = false;
+    status = local ? get_local_time(t, &t_tm, &nsec)
+                   : get_utc_time(t, &t_tm, &nsec);
+    if (status != 0)
+      return status;
+
+    e->date_len =
+        strftime(e->date, sizeof(e->date), "%Y-%m-%dT%H:%M:%S", &t_tm);
+    if (e->date_len == 0)
+      return ENOMEM;
+
+    if (local) {
+      if ((status = format_zone(e->zone, sizeof(e->zone), &t_tm)) != 0)
+        return status;
+    } else {
+      sstrncpy(e->zone, zulu_zone, sizeof(e->zone));
+    }
+
+    e->sec = t_spec.tv_sec;
+    e->valid = true;
+  }
+
+  size_t zone_len = strlen(e->zone);
+  if ((e->date_len + (print_nano ? 10 : 0) + zone_len + 1) > buffer_size)
+    return ENOMEM;
+
+  char *pos = buffer;
+  memcpy(pos, e->date, e->date_len);
+  pos += e->date_len;
+
+  if (print_nano) {
+    long nsec = t_spec.tv_nsec;
+
+    *pos = '.';
+    for (int i = 9; i > 0; i--) {
+      pos[i] = (char)('0' + (nsec % 10));
+      nsec /= 10;
+    }
+    pos += 10;
+  }
+
+  memcpy(pos, e->zone, zone_len + 1);
+  return 0;
+} /* }}} int format_rfc3339_cached */
+
 int format_rfc3339_utc(char *buffer, size_t buffer_size, cdtime_t t,
                        bool print_nano) /* {{{ */
 {
@@ -173,6 +300,11 @@ int format_rfc3339_utc(char *buffer, size_t buffer_size, cdtime_t t,
   long nsec = 0;
   int status;
 
+  status = format_rfc3339_cached(buffer, buffer_size, t, print_nano,
+                                 /* local = */ false);
+  if (status != ENOTSUP)
+    return status;
+
   if ((status = get_utc_time(t, &t_tm, &nsec)) != 0)
     return status; /* The error should have already be reported. */
 
@@ -188,6 +320,11 @@ int format_rfc3339_local(char *buffer, size_t buffer_size, cdtime_t t,
   int status;
   char zone[7]; /* +00:00 */
 
+  status = format_rfc3339_cached(buffer, buffer_size, t, print_nano,
+                                 /* local = */ true);
+  if (status != ENOTSUP)
+    return status;
+
   if ((status = get_local_time(t, &t_tm, &nsec)) != 0)
     return status; /* The error should have already be reported. */
 
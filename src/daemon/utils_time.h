@@ -110,6 +110,13 @@ extern cdtime_t cdtime_mock;
 
 cdtime_t cdtime(void);
 
+/* cdtime_coarse returns the current time from a clock that is cheaper to read
+ * than the one used by cdtime(), at the cost of resolution. On Linux this is
+ * CLOCK_REALTIME_COARSE, which typically advances once per timer tick, i.e.
+ * every one to ten milliseconds. Falls back to cdtime() where no such clock
+ * is available. */
+cdtime_t cdtime_coarse(void);
+
 #define RFC3339_SIZE 26     /* 2006-01-02T15:04:05+00:00 */
 #define RFC3339NANO_SIZE 36 /* 2006-01-02T15:04:05.999999999+00:00 */
 
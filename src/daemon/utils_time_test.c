@@ -161,9 +161,53 @@ DEF_TEST(ns_to_cdtime) {
   return 0;
 }
 
+DEF_TEST(rfc3339) {
+  struct {
+    cdtime_t t;
+    char const *want;
+    char const *want_nano;
+  } cases[] = {
+      {1542908535540740522ULL, "2015-07-15T07:32:29Z",
+       "2015-07-15T07:32:29.716000000Z"},
+      /* Same second: the cached date must be reused with a new fraction. */
+      {1542908535648114704ULL, "2015-07-15T07:32:29Z",
+       "2015-07-15T07:32:29.816000000Z"},
+      {1531246021365054752ULL, "2015-03-11T14:26:26Z",
+       "2015-03-11T14:26:26.987410814Z"},
+      {1546167635576736987ULL, "2015-08-19T10:40:23Z",
+       "2015-08-19T10:40:23.152453627Z"},
+      {0, "1970-01-01T00:00:00Z", "1970-01-01T00:00:00.000000000Z"},
+  };
+
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  for (size_t i = 0; i < (sizeof(cases) / sizeof(cases[0])); i++) {
+    char buffer[RFC3339NANO_SIZE];
+    char want_local[RFC3339NANO_SIZE];
+
+    EXPECT_EQ_INT(0, rfc3339(buffer, sizeof(buffer), cases[i].t));
+    EXPECT_EQ_STR(cases[i].want, buffer);
+
+    EXPECT_EQ_INT(0, rfc3339nano(buffer, sizeof(buffer), cases[i].t));
+    EXPECT_EQ_STR(cases[i].want_nano, buffer);
+
+    snprintf(want_local, sizeof(want_local), "%.*s+00:00",
+             (int)(strlen(cases[i].want_nano) - 1), cases[i].want_nano);
+    EXPECT_EQ_INT(0, rfc3339nano_local(buffer, sizeof(buffer), cases[i].t));
+    EXPECT_EQ_STR(want_local, buffer);
+  }
+
+  char small[RFC3339_SIZE - 1];
+  EXPECT_EQ_INT(ENOMEM, rfc3339(small, sizeof(small), 0));
+
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(conversion);
   RUN_TEST(ns_to_cdtime);
+  RUN_TEST(rfc3339);
 
   END_TEST;
 }
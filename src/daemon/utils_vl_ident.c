@@ -0,0 +1,145 @@
+/**
+ * collectd - src/daemon/utils_vl_ident.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "utils_atomic.h"
+#include "utils_vl_ident.h"
+
+struct vl_ident_s {
+  uint32_t refs;
+  uint32_t hash; /* zero if the canonical name is not stored */
+  /* Start of each field in "data"; the last one is the start of the
+   * canonical name or the end of the data. */
+  uint16_t offsets[VL_IDENT_FIELDS_NUM + 1];
+  uint16_t size;
+  char data[];
+};
+
+vl_ident_t *vl_ident_create(const char *host, const char *plugin,
+                            const char *plugin_instance, const char *type,
+                            const char *type_instance,
+                            value_list_identifier_t const *identifier) {
+  const char *fields[VL_IDENT_FIELDS_NUM] = {
+      host, plugin, plugin_instance, type, type_instance,
+  };
+  size_t lengths[VL_IDENT_FIELDS_NUM];
+  size_t name_len = 0;
+  size_t size = 0;
+
+  for (size_t i = 0; i < VL_IDENT_FIELDS_NUM; i++) {
+    lengths[i] =
+        (fields[i] == NULL) ? 0 : strnlen(fields[i], DATA_MAX_NAME_LEN - 1);
+    size += lengths[i] + 1;
+  }
+
+  bool with_name = (identifier != NULL) && (identifier->hash != 0);
+  if (with_name) {
+    name_len = strnlen(identifier->name, sizeof(identifier->name) - 1);
+    size += name_len + 1;
+  }
+
+  vl_ident_t *id = malloc(sizeof(*id) + size);
+  if (id == NULL)
+    return NULL;
+
+  id->refs = 1;
+  id->hash = with_name ? identifier->hash : 0;
+  id->size = (uint16_t)size;
+
+  size_t offset = 0;
+  for (size_t i = 0; i < VL_IDENT_FIELDS_NUM; i++) {
+    id->offsets[i] = (uint16_t)offset;
+    if (lengths[i] > 0)
+      memcpy(id->data + offset, fields[i], lengths[i]);
+    id->data[offset + lengths[i]] = 0;
+    offset += lengths[i] + 1;
+  }
+  id->offsets[VL_IDENT_FIELDS_NUM] = (uint16_t)offset;
+
+  if (with_name) {
+    memcpy(id->data + offset, identifier->name, name_len);
+    id->data[offset + name_len] = 0;
+  }
+
+  return id;
+} /* vl_ident_t *vl_ident_create */
+
+vl_ident_t *vl_ident_create_vl(value_list_t const *vl) {
+  return vl_ident_create(vl->host, vl->plugin, vl->plugin_instance, vl->type,
+                         vl->type_instance, &vl->identifier);
+} /* vl_ident_t *vl_ident_create_vl */
+
+vl_ident_t *vl_ident_ref(vl_ident_t *id) {
+  C_ATOMIC_ADD(&id->refs, 1);
+  return id;
+} /* vl_ident_t *vl_ident_ref */
+
+void vl_ident_unref(vl_ident_t *id) {
+  if (id == NULL)
+    return;
+
+  if (C_ATOMIC_SUB(&id->refs, 1) == 0)
+    free(id);
+} /* void vl_ident_unref */
+
+const char *vl_ident_get(vl_ident_t const *id, vl_ident_field_t field) {
+  return id->data + id->offsets[field];
+} /* const char *vl_ident_get */
+
+bool vl_ident_matches(vl_ident_t const *id, value_list_t const *vl) {
+  /* The type instance differs most often, so it's compared first. */
+  return (strcmp(vl_ident_get(id, VL_IDENT_TYPE_INSTANCE),
+                 vl->type_instance) == 0) &&
+         (strcmp(vl_ident_get(id, VL_IDENT_PLUGIN_INSTANCE),
+                 vl->plugin_instance) == 0) &&
+         (strcmp(vl_ident_get(id, VL_IDENT_TYPE), vl->type) == 0) &&
+         (strcmp(vl_ident_get(id, VL_IDENT_PLUGIN), vl->plugin) == 0) &&
+         (strcmp(vl_ident_get(id, VL_IDENT_HOST), vl->host) == 0);
+} /* bool vl_ident_matches */
+
+size_t vl_ident_size(vl_ident_t const *id) {
+  return sizeof(*id) + id->size;
+} /* size_t vl_ident_size */
+
+/* Copies a field including its terminating null byte. Unlike sstrncpy(), the
+ * rest of the destination is not cleared. */
+static void vl_ident_copy_field(char *dest, vl_ident_t const *id,
+                                vl_ident_field_t field) {
+  size_t start = id->offsets[field];
+  memcpy(dest, id->data + start, id->offsets[field + 1] - start);
+} /* void vl_ident_copy_field */
+
+void vl_ident_to_value_list(vl_ident_t const *id, value_list_t *vl) {
+  vl_ident_copy_field(vl->host, id, VL_IDENT_HOST);
+  vl_ident_copy_field(vl->plugin, id, VL_IDENT_PLUGIN);
+  vl_ident_copy_field(vl->plugin_instance, id, VL_IDENT_PLUGIN_INSTANCE);
+  vl_ident_copy_field(vl->type, id, VL_IDENT_TYPE);
+  vl_ident_copy_field(vl->type_instance, id, VL_IDENT_TYPE_INSTANCE);
+
+  vl->identifier.hash = id->hash;
+  if (id->hash != 0) {
+    size_t start = id->offsets[VL_IDENT_FIELDS_NUM];
+    memcpy(vl->identifier.name, id->data + start, id->size - start);
+  }
+} /* void vl_ident_to_value_list */
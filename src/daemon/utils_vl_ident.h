@@ -0,0 +1,104 @@
+/**
+ * collectd - src/daemon/utils_vl_ident.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_VL_IDENT_H
+#define UTILS_VL_IDENT_H 1
+
+#include "plugin.h"
+
+/* Compact, reference counted copy of the identifier of a value list: the host,
+ * plugin, plugin instance, type and type instance stored back to back in one
+ * allocation, optionally followed by the canonical name. Used where value
+ * lists are queued or retained, so that the five DATA_MAX_NAME_LEN sized
+ * fields of value_list_t are neither copied nor stored in full. An identifier
+ * is immutable once created and may be shared by any number of threads. */
+struct vl_ident_s;
+typedef struct vl_ident_s vl_ident_t;
+
+enum vl_ident_field_e {
+  VL_IDENT_HOST = 0,
+  VL_IDENT_PLUGIN,
+  VL_IDENT_PLUGIN_INSTANCE,
+  VL_IDENT_TYPE,
+  VL_IDENT_TYPE_INSTANCE,
+  VL_IDENT_FIELDS_NUM,
+};
+typedef enum vl_ident_field_e vl_ident_field_t;
+
+/*
+ * NAME
+ *   vl_ident_create
+ *
+ * DESCRIPTION
+ *   Allocates an identifier with a reference count of one from the given
+ *   fields, which are truncated to DATA_MAX_NAME_LEN - 1 bytes like the
+ *   fields of value_list_t. If `identifier' is not NULL and its hash is not
+ *   zero, the canonical name is stored, too.
+ *
+ * RETURN VALUE
+ *   The identifier or NULL if allocating memory failed.
+ */
+vl_ident_t *vl_ident_create(const char *host, const char *plugin,
+                            const char *plugin_instance, const char *type,
+                            const char *type_instance,
+                            value_list_identifier_t const *identifier);
+
+/*
+ * NAME
+ *   vl_ident_create_vl
+ *
+ * DESCRIPTION
+ *   Shorthand for `vl_ident_create' with the fields of `vl'.
+ */
+vl_ident_t *vl_ident_create_vl(value_list_t const *vl);
+
+/* Increments the reference count and returns `id'. */
+vl_ident_t *vl_ident_ref(vl_ident_t *id);
+
+/* Decrements the reference count and frees `id' when it drops to zero.
+ * Accepts NULL. */
+void vl_ident_unref(vl_ident_t *id);
+
+/* Returns one of the fields of `id'. Never returns NULL. */
+const char *vl_ident_get(vl_ident_t const *id, vl_ident_field_t field);
+
+/* Returns true if the fields of `id' equal those of `vl'. The canonical name
+ * is not compared. */
+bool vl_ident_matches(vl_ident_t const *id, value_list_t const *vl);
+
+/* Returns the number of bytes allocated for `id'. */
+size_t vl_ident_size(vl_ident_t const *id);
+
+/*
+ * NAME
+ *   vl_ident_to_value_list
+ *
+ * DESCRIPTION
+ *   Copies the fields of `id' into `vl', the conversion for code that works
+ *   on value_list_t. The other members of `vl' are left alone. The
+ *   identifier of `vl' is set from the canonical name if one is stored and
+ *   reset otherwise.
+ */
+void vl_ident_to_value_list(vl_ident_t const *id, value_list_t *vl);
+
+#endif /* UTILS_VL_IDENT_H */
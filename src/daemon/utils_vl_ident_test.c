@@ -0,0 +1,110 @@
+/**
+ * collectd - src/daemon/utils_vl_ident_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "testing.h"
+#include "utils_vl_ident.h"
+
+DEF_TEST(create) {
+  value_list_t vl = VALUE_LIST_INIT;
+  vl_ident_t *id;
+
+  sstrncpy(vl.host, "example.com", sizeof(vl.host));
+  sstrncpy(vl.plugin, "interface", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, "eth0", sizeof(vl.plugin_instance));
+  sstrncpy(vl.type, "if_octets", sizeof(vl.type));
+
+  CHECK_NOT_NULL(id = vl_ident_create_vl(&vl));
+  EXPECT_EQ_STR("example.com", vl_ident_get(id, VL_IDENT_HOST));
+  EXPECT_EQ_STR("interface", vl_ident_get(id, VL_IDENT_PLUGIN));
+  EXPECT_EQ_STR("eth0", vl_ident_get(id, VL_IDENT_PLUGIN_INSTANCE));
+  EXPECT_EQ_STR("if_octets", vl_ident_get(id, VL_IDENT_TYPE));
+  EXPECT_EQ_STR("", vl_ident_get(id, VL_IDENT_TYPE_INSTANCE));
+  OK(vl_ident_matches(id, &vl));
+  OK(vl_ident_size(id) < sizeof(vl.host));
+
+  sstrncpy(vl.type_instance, "rx", sizeof(vl.type_instance));
+  OK(!vl_ident_matches(id, &vl));
+
+  /* Fields are truncated like sstrncpy() would. */
+  char long_name[2 * DATA_MAX_NAME_LEN];
+  memset(long_name, 'x', sizeof(long_name) - 1);
+  long_name[sizeof(long_name) - 1] = 0;
+  vl_ident_t *truncated;
+  CHECK_NOT_NULL(truncated = vl_ident_create(long_name, "p", NULL, "t", NULL,
+                                             /* identifier = */ NULL));
+  EXPECT_EQ_INT(DATA_MAX_NAME_LEN - 1,
+                strlen(vl_ident_get(truncated, VL_IDENT_HOST)));
+  EXPECT_EQ_STR("", vl_ident_get(truncated, VL_IDENT_PLUGIN_INSTANCE));
+
+  vl_ident_unref(truncated);
+  vl_ident_unref(id);
+  return 0;
+}
+
+DEF_TEST(to_value_list) {
+  value_list_t vl = VALUE_LIST_INIT;
+  value_list_t got = VALUE_LIST_INIT;
+  vl_ident_t *id;
+
+  sstrncpy(vl.host, "example.com", sizeof(vl.host));
+  sstrncpy(vl.plugin, "cpu", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, "0", sizeof(vl.plugin_instance));
+  sstrncpy(vl.type, "cpu", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "idle", sizeof(vl.type_instance));
+  CHECK_ZERO(identifier_update(&vl));
+
+  CHECK_NOT_NULL(id = vl_ident_create_vl(&vl));
+  EXPECT_EQ_PTR(id, vl_ident_ref(id));
+  vl_ident_unref(id);
+
+  got.identifier.hash = 1;
+  vl_ident_to_value_list(id, &got);
+  EXPECT_EQ_STR(vl.host, got.host);
+  EXPECT_EQ_STR(vl.plugin, got.plugin);
+  EXPECT_EQ_STR(vl.plugin_instance, got.plugin_instance);
+  EXPECT_EQ_STR(vl.type, got.type);
+  EXPECT_EQ_STR(vl.type_instance, got.type_instance);
+  EXPECT_EQ_INT(vl.identifier.hash, got.identifier.hash);
+  EXPECT_EQ_STR("example.com/cpu-0/cpu-idle", got.identifier.name);
+  vl_ident_unref(id);
+
+  /* Without a hash, the name isn't stored and the identifier is reset. */
+  vl.identifier.hash = 0;
+  CHECK_NOT_NULL(id = vl_ident_create_vl(&vl));
+  vl_ident_to_value_list(id, &got);
+  EXPECT_EQ_INT(0, got.identifier.hash);
+  vl_ident_unref(id);
+
+  vl_ident_unref(NULL);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(create);
+  RUN_TEST(to_value_list);
+
+  END_TEST;
+}
@@ -28,6 +28,8 @@
 #include "utils_ignorelist.h"
 #include "utils_mount.h"
 
+#include <poll.h>
+
 #if HAVE_STATVFS
 #if HAVE_SYS_STATVFS_H
 #include <sys/statvfs.h>
@@ -46,9 +48,16 @@
 #error "No applicable input method."
 #endif
 
+#if HAVE_STATVFS
+typedef struct statvfs df_statbuf_t;
+#elif HAVE_STATFS
+typedef struct statfs df_statbuf_t;
+#endif
+
 static const char *config_keys[] = {
-    "Device",         "MountPoint",   "FSType",         "IgnoreSelected",
-    "ReportByDevice", "ReportInodes", "ValuesAbsolute", "ValuesPercentage"};
+    "Device",           "MountPoint",  "FSType",        "IgnoreSelected",
+    "ReportByDevice",   "ReportInodes", "ValuesAbsolute",
+    "ValuesPercentage", "ReadThreads", "Timeout"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static ignorelist_t *il_device;
@@ -60,6 +69,46 @@ static bool report_inodes;
 static bool values_absolute = true;
 static bool values_percentage;
 
+/* Cached mount list. On Linux, it's refreshed only if /proc/self/mounts
+ * signals a change of the mount table, elsewhere on every read. */
+static cu_mount_t *df_mnt_list;
+static int df_mounts_fd = -1;
+
+/*
+ * STATANYFS() is called from a pool of worker threads, so a hung file system
+ * (e.g. an unreachable NFS server) doesn't block the read of the other ones.
+ * A call which doesn't return within `df_timeout' is abandoned: the job
+ * stays on the `df_hung' list until the call returns and the mount point is
+ * skipped until then.
+ */
+#define DF_JOB_QUEUED 0
+#define DF_JOB_RUNNING 1
+#define DF_JOB_DONE 2
+
+typedef struct df_job_s {
+  char *dir;
+  df_statbuf_t statbuf;
+  int status; /* errno of failed STATANYFS() call or zero */
+  int state;
+  cdtime_t started;
+  bool abandoned;
+  struct df_job_s *next;
+} df_job_t;
+
+static size_t df_threads_num = 4;
+static cdtime_t df_timeout;
+
+static pthread_t *df_threads;
+static size_t df_threads_started;
+static pthread_mutex_t df_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t df_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t df_done_cond = PTHREAD_COND_INITIALIZER;
+static df_job_t *df_queue_head;
+static df_job_t *df_queue_tail;
+static df_job_t *df_hung;
+static size_t df_hung_num;
+static bool df_threads_exit;
+
 static int df_init(void) {
   if (il_device == NULL)
     il_device = ignorelist_create(1);
@@ -123,6 +172,22 @@ static int df_config(const char *key, const char *value) {
       values_percentage = false;
 
     return 0;
+  } else if (strcasecmp(key, "ReadThreads") == 0) {
+    int n = atoi(value);
+    if ((n < 0) || (n > 64)) {
+      ERROR("df plugin: ReadThreads must be between 0 and 64.");
+      return 1;
+    }
+    df_threads_num = (size_t)n;
+    return 0;
+  } else if (strcasecmp(key, "Timeout") == 0) {
+    double t = atof(value);
+    if (t <= 0.0) {
+      ERROR("df plugin: Timeout must be a positive number.");
+      return 1;
+    }
+    df_timeout = DOUBLE_TO_CDTIME_T(t);
+    return 0;
   }
 
   return -1;
@@ -146,30 +211,360 @@ __attribute__((nonnull(2))) static void df_submit_one(char *plugin_instance,
   plugin_dispatch_values(&vl);
 } /* void df_submit_one */
 
-static int df_read(void) {
+
+/* Returns the cached mount list, re-reading it if the mount table has
+ * changed since the last call. */
+static cu_mount_t *df_mount_list(void) {
+  bool refresh = (df_mnt_list == NULL);
+
+#if KERNEL_LINUX
+  if (df_mounts_fd < 0) {
+    df_mounts_fd = open("/proc/self/mounts", O_RDONLY | O_CLOEXEC);
+    if (df_mounts_fd < 0) {
+      DEBUG("df plugin: open (/proc/self/mounts) failed: %s", STRERRNO);
+    }
+    refresh = true;
+  }
+#endif
+
+  if ((df_mounts_fd >= 0) && !refresh) {
+    /* The kernel reports a change of the mount table with POLLERR|POLLPRI
+     * once per file description. */
+    struct pollfd pfd = {.fd = df_mounts_fd, .events = POLLPRI};
+    if (poll(&pfd, 1, /* timeout = */ 0) < 0)
+      refresh = true;
+    else if (pfd.revents & (POLLERR | POLLPRI))
+      refresh = true;
+  } else if (df_mounts_fd < 0)
+    refresh = true;
+
+  if (refresh) {
+    cu_mount_t *mnt_list = NULL;
+    if (cu_mount_getlist(&mnt_list) == NULL) {
+      ERROR("df plugin: cu_mount_getlist failed.");
+      return NULL;
+    }
+    cu_mount_freelist(df_mnt_list);
+    df_mnt_list = mnt_list;
+  }
+
+  return df_mnt_list;
+} /* cu_mount_t *df_mount_list */
+
+static void df_job_free(df_job_t *job) {
+  if (job == NULL)
+    return;
+  sfree(job->dir);
+  sfree(job);
+} /* void df_job_free */
+
+static void *df_worker(__attribute__((unused)) void *arg) {
+  pthread_mutex_lock(&df_lock);
+  while (!df_threads_exit) {
+    df_job_t *job = df_queue_head;
+    if (job == NULL) {
+      pthread_cond_wait(&df_work_cond, &df_lock);
+      continue;
+    }
+
+    df_queue_head = job->next;
+    if (df_queue_head == NULL)
+      df_queue_tail = NULL;
+    job->next = NULL;
+    job->state = DF_JOB_RUNNING;
+    job->started = cdtime();
+    pthread_cond_broadcast(&df_done_cond);
+    pthread_mutex_unlock(&df_lock);
+
+    int status = 0;
+    if (STATANYFS(job->dir, &job->statbuf) < 0)
+      status = errno;
+
+    pthread_mutex_lock(&df_lock);
+    job->status = status;
+    job->state = DF_JOB_DONE;
+    if (job->abandoned) {
+      /* the reader has given up on this job, take it off the hung list */
+      df_job_t *prev = NULL;
+      for (df_job_t *j = df_hung; j != NULL; prev = j, j = j->next) {
+        if (j != job)
+          continue;
+        if (prev == NULL)
+          df_hung = j->next;
+        else
+          prev->next = j->next;
+        break;
+      }
+      df_hung_num--;
+      INFO("df plugin: " STATANYFS_STR "(%s) returned after it timed out.",
+           job->dir);
+      df_job_free(job);
+    } else
+      pthread_cond_broadcast(&df_done_cond);
+  }
+  pthread_mutex_unlock(&df_lock);
+
+  return NULL;
+} /* void *df_worker */
+
+static int df_start_threads(void) {
+  if (df_threads != NULL)
+    return 0;
+
+  df_threads = calloc(df_threads_num, sizeof(*df_threads));
+  if (df_threads == NULL) {
+    ERROR("df plugin: calloc failed.");
+    return -1;
+  }
+
+  for (size_t i = 0; i < df_threads_num; i++) {
+    int status = plugin_thread_create(&df_threads[i], NULL, df_worker, NULL,
+                                      "df statfs");
+    if (status != 0) {
+      ERROR("df plugin: Starting worker thread failed: %s", STRERROR(status));
+      break;
+    }
+    /* a worker stuck in STATANYFS() can't be joined */
+    pthread_detach(df_threads[i]);
+    df_threads_started++;
+  }
+
+  return (df_threads_started > 0) ? 0 : -1;
+} /* int df_start_threads */
+
+/* Must be called with df_lock held */
+static bool df_is_hung(char const *dir) {
+  for (df_job_t *job = df_hung; job != NULL; job = job->next)
+    if (strcmp(job->dir, dir) == 0)
+      return true;
+  return false;
+} /* bool df_is_hung */
+
+/* Must be called with df_lock held */
+static void df_dequeue(df_job_t *job) {
+  df_job_t *prev = NULL;
+
+  for (df_job_t *j = df_queue_head; j != NULL; prev = j, j = j->next) {
+    if (j != job)
+      continue;
+    if (prev == NULL)
+      df_queue_head = j->next;
+    else
+      prev->next = j->next;
+    if (df_queue_tail == j)
+      df_queue_tail = prev;
+    j->next = NULL;
+    break;
+  }
+} /* void df_dequeue */
+
+/* Call STATANYFS() for all `jobs_num' jobs on the worker threads. When this
+ * function returns, jobs[i] is either done or NULL if it has timed out. */
+static void df_stat_all(df_job_t **jobs, size_t jobs_num) {
+  cdtime_t timeout = (df_timeout > 0) ? df_timeout : plugin_get_interval();
+
+  pthread_mutex_lock(&df_lock);
+  for (size_t i = 0; i < jobs_num; i++) {
+    if (df_queue_tail == NULL)
+      df_queue_head = jobs[i];
+    else
+      df_queue_tail->next = jobs[i];
+    df_queue_tail = jobs[i];
+  }
+  pthread_cond_broadcast(&df_work_cond);
+
+  while (42) {
+    cdtime_t now = cdtime();
+    cdtime_t wakeup = now + timeout;
+    size_t pending = 0;
+
+    for (size_t i = 0; i < jobs_num; i++) {
+      df_job_t *job = jobs[i];
+      if ((job == NULL) || (job->state == DF_JOB_DONE))
+        continue;
+
+      if ((job->state == DF_JOB_RUNNING) && (now >= job->started + timeout)) {
+        WARNING("df plugin: " STATANYFS_STR "(%s) timed out. The mount "
+                "point is skipped until the call returns.",
+                job->dir);
+        job->abandoned = true;
+        job->next = df_hung;
+        df_hung = job;
+        df_hung_num++;
+        jobs[i] = NULL;
+        continue;
+      }
+
+      if ((job->state == DF_JOB_QUEUED) &&
+          (df_hung_num >= df_threads_started)) {
+        /* all workers are stuck */
+        df_dequeue(job);
+        df_job_free(job);
+        jobs[i] = NULL;
+        continue;
+      }
+
+      if ((job->state == DF_JOB_RUNNING) &&
+          (job->started + timeout < wakeup))
+        wakeup = job->started + timeout;
+      pending++;
+    }
+
+    if (pending == 0)
+      break;
+
+    struct timespec ts = CDTIME_T_TO_TIMESPEC(wakeup);
+    pthread_cond_timedwait(&df_done_cond, &df_lock, &ts);
+  }
+  pthread_mutex_unlock(&df_lock);
+} /* void df_stat_all */
+
+static int df_submit_mount(cu_mount_t *mnt_ptr, df_statbuf_t *statbuf_ptr) {
+  df_statbuf_t statbuf = *statbuf_ptr;
+  unsigned long long blocksize;
+  char disk_name[256];
+  uint64_t blk_free;
+  uint64_t blk_reserved;
+  uint64_t blk_used;
+
+  char const *dev =
+      (mnt_ptr->spec_device != NULL) ? mnt_ptr->spec_device : mnt_ptr->device;
+
+  if (!statbuf.f_blocks)
+    return 0;
+
+  if (by_device) {
+    /* eg, /dev/hda1  -- strip off the "/dev/" */
+    if (strncmp(dev, "/dev/", strlen("/dev/")) == 0)
+      sstrncpy(disk_name, dev + strlen("/dev/"), sizeof(disk_name));
+    else
+      sstrncpy(disk_name, dev, sizeof(disk_name));
+
+    if (strlen(disk_name) < 1) {
+      DEBUG("df: no device name for mountpoint %s, skipping", mnt_ptr->dir);
+      return 0;
+    }
+  } else {
+    if (strcmp(mnt_ptr->dir, "/") == 0)
+      sstrncpy(disk_name, "root", sizeof(disk_name));
+    else {
+      sstrncpy(disk_name, mnt_ptr->dir + 1, sizeof(disk_name));
+      size_t len = strlen(disk_name);
+
+      for (size_t i = 0; i < len; i++)
+        if (disk_name[i] == '/')
+          disk_name[i] = '-';
+    }
+  }
+
+  blocksize = BLOCKSIZE(statbuf);
+
+/*
+ * Sanity-check for the values in the struct
+ */
+/* Check for negative "available" byes. For example UFS can
+ * report negative free space for user. Notice. blk_reserved
+ * will start to diminish after this. */
 #if HAVE_STATVFS
-  struct statvfs statbuf;
+  /* Cast and temporary variable are needed to avoid
+   * compiler warnings.
+   * ((struct statvfs).f_bavail is unsigned (POSIX)) */
+  int64_t signed_bavail = (int64_t)statbuf.f_bavail;
+  if (signed_bavail < 0)
+    statbuf.f_bavail = 0;
 #elif HAVE_STATFS
-  struct statfs statbuf;
+  if (statbuf.f_bavail < 0)
+    statbuf.f_bavail = 0;
 #endif
+  /* Make sure that f_blocks >= f_bfree >= f_bavail */
+  if (statbuf.f_bfree < statbuf.f_bavail)
+    statbuf.f_bfree = statbuf.f_bavail;
+  if (statbuf.f_blocks < statbuf.f_bfree)
+    statbuf.f_blocks = statbuf.f_bfree;
+
+  blk_free = (uint64_t)statbuf.f_bavail;
+  blk_reserved = (uint64_t)(statbuf.f_bfree - statbuf.f_bavail);
+  blk_used = (uint64_t)(statbuf.f_blocks - statbuf.f_bfree);
+
+  if (values_absolute) {
+    df_submit_one(disk_name, "df_complex", "free",
+                  (gauge_t)(blk_free * blocksize));
+    df_submit_one(disk_name, "df_complex", "reserved",
+                  (gauge_t)(blk_reserved * blocksize));
+    df_submit_one(disk_name, "df_complex", "used",
+                  (gauge_t)(blk_used * blocksize));
+  }
+
+  if (values_percentage) {
+    if (statbuf.f_blocks > 0) {
+      df_submit_one(disk_name, "percent_bytes", "free",
+                    (gauge_t)((float_t)(blk_free) / statbuf.f_blocks * 100));
+      df_submit_one(
+          disk_name, "percent_bytes", "reserved",
+          (gauge_t)((float_t)(blk_reserved) / statbuf.f_blocks * 100));
+      df_submit_one(disk_name, "percent_bytes", "used",
+                    (gauge_t)((float_t)(blk_used) / statbuf.f_blocks * 100));
+    } else
+      return -1;
+  }
+
+  /* inode handling */
+  if (report_inodes && statbuf.f_files != 0 && statbuf.f_ffree != 0) {
+    uint64_t inode_free;
+    uint64_t inode_reserved;
+    uint64_t inode_used;
+
+    /* Sanity-check for the values in the struct */
+    if (statbuf.f_ffree < statbuf.f_favail)
+      statbuf.f_ffree = statbuf.f_favail;
+    if (statbuf.f_files < statbuf.f_ffree)
+      statbuf.f_files = statbuf.f_ffree;
+
+    inode_free = (uint64_t)statbuf.f_favail;
+    inode_reserved = (uint64_t)(statbuf.f_ffree - statbuf.f_favail);
+    inode_used = (uint64_t)(statbuf.f_files - statbuf.f_ffree);
+
+    if (values_percentage) {
+      if (statbuf.f_files > 0) {
+        df_submit_one(disk_name, "percent_inodes", "free",
+                      (gauge_t)((float_t)(inode_free) / statbuf.f_files * 100));
+        df_submit_one(
+            disk_name, "percent_inodes", "reserved",
+            (gauge_t)((float_t)(inode_reserved) / statbuf.f_files * 100));
+        df_submit_one(disk_name, "percent_inodes", "used",
+                      (gauge_t)((float_t)(inode_used) / statbuf.f_files * 100));
+      } else
+        return -1;
+    }
+    if (values_absolute) {
+      df_submit_one(disk_name, "df_inodes", "free", (gauge_t)inode_free);
+      df_submit_one(disk_name, "df_inodes", "reserved",
+                    (gauge_t)inode_reserved);
+      df_submit_one(disk_name, "df_inodes", "used", (gauge_t)inode_used);
+    }
+  }
+
+  return 0;
+} /* int df_submit_mount */
+
+static int df_read(void) {
   int retval = 0;
-  /* struct STATANYFS statbuf; */
   cu_mount_t *mnt_list;
+  cu_mount_t **mnt_sel = NULL;
+  size_t mnt_sel_num = 0;
 
-  mnt_list = NULL;
-  if (cu_mount_getlist(&mnt_list) == NULL) {
-    ERROR("df plugin: cu_mount_getlist failed.");
+  mnt_list = df_mount_list();
+  if (mnt_list == NULL)
+    return -1;
+
+  if ((df_threads_num > 0) && (df_start_threads() != 0)) {
+    ERROR("df plugin: No worker threads are running.");
     return -1;
   }
 
   for (cu_mount_t *mnt_ptr = mnt_list; mnt_ptr != NULL;
        mnt_ptr = mnt_ptr->next) {
-    unsigned long long blocksize;
-    char disk_name[256];
     cu_mount_t *dup_ptr;
-    uint64_t blk_free;
-    uint64_t blk_reserved;
-    uint64_t blk_used;
 
     char const *dev =
         (mnt_ptr->spec_device != NULL) ? mnt_ptr->spec_device : mnt_ptr->device;
@@ -202,139 +597,102 @@ static int df_read(void) {
     if (dup_ptr != NULL)
       continue;
 
-    if (STATANYFS(mnt_ptr->dir, &statbuf) < 0) {
-      ERROR(STATANYFS_STR "(%s) failed: %s", mnt_ptr->dir, STRERRNO);
-      continue;
-    }
+    if (df_threads_num == 0) {
+      df_statbuf_t statbuf;
 
-    if (!statbuf.f_blocks)
-      continue;
-
-    if (by_device) {
-      /* eg, /dev/hda1  -- strip off the "/dev/" */
-      if (strncmp(dev, "/dev/", strlen("/dev/")) == 0)
-        sstrncpy(disk_name, dev + strlen("/dev/"), sizeof(disk_name));
-      else
-        sstrncpy(disk_name, dev, sizeof(disk_name));
-
-      if (strlen(disk_name) < 1) {
-        DEBUG("df: no device name for mountpoint %s, skipping", mnt_ptr->dir);
+      if (STATANYFS(mnt_ptr->dir, &statbuf) < 0) {
+        ERROR(STATANYFS_STR "(%s) failed: %s", mnt_ptr->dir, STRERRNO);
         continue;
       }
-    } else {
-      if (strcmp(mnt_ptr->dir, "/") == 0)
-        sstrncpy(disk_name, "root", sizeof(disk_name));
-      else {
-        sstrncpy(disk_name, mnt_ptr->dir + 1, sizeof(disk_name));
-        size_t len = strlen(disk_name);
-
-        for (size_t i = 0; i < len; i++)
-          if (disk_name[i] == '/')
-            disk_name[i] = '-';
+      if (df_submit_mount(mnt_ptr, &statbuf) != 0) {
+        retval = -1;
+        break;
       }
+      continue;
     }
 
-    blocksize = BLOCKSIZE(statbuf);
-
-/*
- * Sanity-check for the values in the struct
- */
-/* Check for negative "available" byes. For example UFS can
- * report negative free space for user. Notice. blk_reserved
- * will start to diminish after this. */
-#if HAVE_STATVFS
-    /* Cast and temporary variable are needed to avoid
-     * compiler warnings.
-     * ((struct statvfs).f_bavail is unsigned (POSIX)) */
-    int64_t signed_bavail = (int64_t)statbuf.f_bavail;
-    if (signed_bavail < 0)
-      statbuf.f_bavail = 0;
-#elif HAVE_STATFS
-    if (statbuf.f_bavail < 0)
-      statbuf.f_bavail = 0;
-#endif
-    /* Make sure that f_blocks >= f_bfree >= f_bavail */
-    if (statbuf.f_bfree < statbuf.f_bavail)
-      statbuf.f_bfree = statbuf.f_bavail;
-    if (statbuf.f_blocks < statbuf.f_bfree)
-      statbuf.f_blocks = statbuf.f_bfree;
+    cu_mount_t **tmp = realloc(mnt_sel, (mnt_sel_num + 1) * sizeof(*mnt_sel));
+    if (tmp == NULL) {
+      ERROR("df plugin: realloc failed.");
+      retval = -1;
+      break;
+    }
+    mnt_sel = tmp;
+    mnt_sel[mnt_sel_num++] = mnt_ptr;
+  }
 
-    blk_free = (uint64_t)statbuf.f_bavail;
-    blk_reserved = (uint64_t)(statbuf.f_bfree - statbuf.f_bavail);
-    blk_used = (uint64_t)(statbuf.f_blocks - statbuf.f_bfree);
+  if (mnt_sel_num == 0) {
+    sfree(mnt_sel);
+    return retval;
+  }
 
-    if (values_absolute) {
-      df_submit_one(disk_name, "df_complex", "free",
-                    (gauge_t)(blk_free * blocksize));
-      df_submit_one(disk_name, "df_complex", "reserved",
-                    (gauge_t)(blk_reserved * blocksize));
-      df_submit_one(disk_name, "df_complex", "used",
-                    (gauge_t)(blk_used * blocksize));
-    }
+  df_job_t **jobs = calloc(mnt_sel_num, sizeof(*jobs));
+  if (jobs == NULL) {
+    ERROR("df plugin: calloc failed.");
+    sfree(mnt_sel);
+    return -1;
+  }
 
-    if (values_percentage) {
-      if (statbuf.f_blocks > 0) {
-        df_submit_one(disk_name, "percent_bytes", "free",
-                      (gauge_t)((float_t)(blk_free) / statbuf.f_blocks * 100));
-        df_submit_one(
-            disk_name, "percent_bytes", "reserved",
-            (gauge_t)((float_t)(blk_reserved) / statbuf.f_blocks * 100));
-        df_submit_one(disk_name, "percent_bytes", "used",
-                      (gauge_t)((float_t)(blk_used) / statbuf.f_blocks * 100));
-      } else {
-        retval = -1;
-        break;
-      }
+  /* don't queue mount points which are still hung from previous reads */
+  pthread_mutex_lock(&df_lock);
+  size_t jobs_num = 0;
+  for (size_t i = 0; i < mnt_sel_num; i++) {
+    if (df_is_hung(mnt_sel[i]->dir)) {
+      DEBUG("df plugin: Skipping hung mount point %s", mnt_sel[i]->dir);
+      mnt_sel[i] = NULL;
+      continue;
     }
-
-    /* inode handling */
-    if (report_inodes && statbuf.f_files != 0 && statbuf.f_ffree != 0) {
-      uint64_t inode_free;
-      uint64_t inode_reserved;
-      uint64_t inode_used;
-
-      /* Sanity-check for the values in the struct */
-      if (statbuf.f_ffree < statbuf.f_favail)
-        statbuf.f_ffree = statbuf.f_favail;
-      if (statbuf.f_files < statbuf.f_ffree)
-        statbuf.f_files = statbuf.f_ffree;
-
-      inode_free = (uint64_t)statbuf.f_favail;
-      inode_reserved = (uint64_t)(statbuf.f_ffree - statbuf.f_favail);
-      inode_used = (uint64_t)(statbuf.f_files - statbuf.f_ffree);
-
-      if (values_percentage) {
-        if (statbuf.f_files > 0) {
-          df_submit_one(
-              disk_name, "percent_inodes", "free",
-              (gauge_t)((float_t)(inode_free) / statbuf.f_files * 100));
-          df_submit_one(
-              disk_name, "percent_inodes", "reserved",
-              (gauge_t)((float_t)(inode_reserved) / statbuf.f_files * 100));
-          df_submit_one(
-              disk_name, "percent_inodes", "used",
-              (gauge_t)((float_t)(inode_used) / statbuf.f_files * 100));
-        } else {
-          retval = -1;
-          break;
-        }
-      }
-      if (values_absolute) {
-        df_submit_one(disk_name, "df_inodes", "free", (gauge_t)inode_free);
-        df_submit_one(disk_name, "df_inodes", "reserved",
-                      (gauge_t)inode_reserved);
-        df_submit_one(disk_name, "df_inodes", "used", (gauge_t)inode_used);
-      }
+    df_job_t *job = calloc(1, sizeof(*job));
+    if (job == NULL || (job->dir = strdup(mnt_sel[i]->dir)) == NULL) {
+      sfree(job);
+      mnt_sel[i] = NULL;
+      continue;
     }
+    mnt_sel[jobs_num] = mnt_sel[i];
+    jobs[jobs_num++] = job;
   }
+  pthread_mutex_unlock(&df_lock);
 
-  cu_mount_freelist(mnt_list);
+  df_stat_all(jobs, jobs_num);
 
+  for (size_t i = 0; i < jobs_num; i++) {
+    df_job_t *job = jobs[i];
+    if (job == NULL)
+      continue;
+
+    if (job->status != 0)
+      ERROR(STATANYFS_STR "(%s) failed: %s", job->dir, STRERROR(job->status));
+    else if ((retval == 0) && (df_submit_mount(mnt_sel[i], &job->statbuf) != 0))
+      retval = -1;
+    df_job_free(job);
+  }
+
+  sfree(jobs);
+  sfree(mnt_sel);
   return retval;
 } /* int df_read */
 
+static int df_shutdown(void) {
+  pthread_mutex_lock(&df_lock);
+  df_threads_exit = true;
+  pthread_cond_broadcast(&df_work_cond);
+  pthread_mutex_unlock(&df_lock);
+  /* The workers are detached, ones stuck in STATANYFS() exit whenever the
+   * call returns. */
+  sfree(df_threads);
+
+  cu_mount_freelist(df_mnt_list);
+  df_mnt_list = NULL;
+  if (df_mounts_fd >= 0)
+    close(df_mounts_fd);
+  df_mounts_fd = -1;
+
+  return 0;
+} /* int df_shutdown */
+
 void module_register(void) {
   plugin_register_config("df", df_config, config_keys, config_keys_num);
   plugin_register_init("df", df_init);
   plugin_register_read("df", df_read);
+  plugin_register_shutdown("df", df_shutdown);
 } /* void module_register */
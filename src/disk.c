@@ -25,6 +25,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_ignorelist.h"
 
 #if HAVE_MACH_MACH_TYPES_H
@@ -89,6 +90,14 @@ static bool use_bsd_name;
 typedef struct diskstats {
   char *name;
 
+  /* Name the disk is reported as: the value of the udev attribute, if one is
+   * configured and set, or `name'. Resolved once and again after a udev
+   * event for the disk; lines of ignored disks are skipped without parsing
+   * them. */
+  char *output_name;
+  bool resolved;
+  bool ignored;
+
   /* This overflows in roughly 1361 years */
   unsigned int poll_count;
 
@@ -109,11 +118,10 @@ typedef struct diskstats {
   bool has_merged;
   bool has_in_progress;
   bool has_io_time;
-
-  struct diskstats *next;
 } diskstats_t;
 
-static diskstats_t *disklist;
+/* diskstats_t, keyed by name */
+static c_avl_tree_t *disklist;
 /* #endif KERNEL_LINUX */
 #elif KERNEL_FREEBSD
 static struct gmesh geom_tree;
@@ -144,9 +152,13 @@ static int pnumdisk;
 
 #if HAVE_LIBUDEV_H
 #include <libudev.h>
+#include <poll.h>
 
 static char *conf_udev_name_attr;
 static struct udev *handle_udev;
+#if KERNEL_LINUX
+static struct udev_monitor *handle_udev_monitor;
+#endif
 #endif
 
 static const char *config_keys[] = {"Disk", "UseBSDName", "IgnoreSelected",
@@ -219,8 +231,28 @@ static int disk_init(void) {
       ERROR("disk plugin: udev_new() failed!");
       return -1;
     }
+
+    /* Names are cached and looked up again when udev reports a change. */
+    handle_udev_monitor = udev_monitor_new_from_netlink(handle_udev, "udev");
+    if ((handle_udev_monitor != NULL) &&
+        ((udev_monitor_filter_add_match_subsystem_devtype(
+              handle_udev_monitor, "block", NULL) != 0) ||
+         (udev_monitor_enable_receiving(handle_udev_monitor) != 0))) {
+      udev_monitor_unref(handle_udev_monitor);
+      handle_udev_monitor = NULL;
+    }
+    if (handle_udev_monitor == NULL)
+      WARNING("disk plugin: Monitoring udev events failed. The \"UdevNameAttr\" "
+              "will be looked up on every read.");
   }
 #endif /* HAVE_LIBUDEV_H */
+  if (disklist == NULL) {
+    disklist = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (disklist == NULL) {
+      ERROR("disk plugin: c_avl_create failed.");
+      return -1;
+    }
+  }
 /* #endif KERNEL_LINUX */
 
 #elif KERNEL_FREEBSD
@@ -261,12 +293,35 @@ static int disk_init(void) {
   return 0;
 } /* int disk_init */
 
+#if KERNEL_LINUX
+static void disk_free(diskstats_t *ds) {
+  if (ds == NULL)
+    return;
+  if (ds->output_name != ds->name)
+    sfree(ds->output_name);
+  sfree(ds->name);
+  sfree(ds);
+} /* void disk_free */
+#endif /* KERNEL_LINUX */
+
 static int disk_shutdown(void) {
 #if KERNEL_LINUX
 #if HAVE_LIBUDEV_H
+  if (handle_udev_monitor != NULL)
+    udev_monitor_unref(handle_udev_monitor);
+  handle_udev_monitor = NULL;
   if (handle_udev != NULL)
     udev_unref(handle_udev);
+  handle_udev = NULL;
 #endif /* HAVE_LIBUDEV_H */
+  if (disklist != NULL) {
+    char *name;
+    diskstats_t *ds;
+    while (c_avl_pick(disklist, (void *)&name, (void *)&ds) == 0)
+      disk_free(ds);
+    c_avl_destroy(disklist);
+    disklist = NULL;
+  }
 #endif /* KERNEL_LINUX */
   return 0;
 } /* int disk_shutdown */
@@ -353,6 +408,38 @@ static char *disk_udev_attr_name(struct udev *udev, char *disk_name,
   }
   return output;
 }
+
+#if KERNEL_LINUX
+/* Processes pending udev events: disks which have changed have their name
+ * looked up again, removed disks are forgotten. */
+static void disk_udev_poll(void) {
+  if (handle_udev_monitor == NULL)
+    return;
+
+  struct pollfd pfd = {
+      .fd = udev_monitor_get_fd(handle_udev_monitor), .events = POLLIN,
+  };
+  while (poll(&pfd, 1, /* timeout = */ 0) > 0) {
+    struct udev_device *dev = udev_monitor_receive_device(handle_udev_monitor);
+    if (dev == NULL)
+      break;
+
+    const char *action = udev_device_get_action(dev);
+    const char *sysname = udev_device_get_sysname(dev);
+    diskstats_t *ds = NULL;
+    if ((sysname != NULL) && (c_avl_get(disklist, sysname, (void *)&ds) == 0)) {
+      DEBUG("disk plugin: udev event \"%s\" for %s", action, sysname);
+      if ((action != NULL) && (strcmp("remove", action) == 0)) {
+        c_avl_remove(disklist, sysname, NULL, NULL);
+        disk_free(ds);
+      } else {
+        ds->resolved = false;
+      }
+    }
+    udev_device_unref(dev);
+  }
+} /* void disk_udev_poll */
+#endif /* KERNEL_LINUX */
 #endif
 
 #if HAVE_IOKIT_IOKITLIB_H
@@ -388,6 +475,89 @@ static signed long long dict_get_value(CFDictionaryRef dict, const char *key) {
 }
 #endif /* HAVE_IOKIT_IOKITLIB_H */
 
+#if KERNEL_LINUX
+/* Copies the "index"th whitespace separated field of "line" to "buffer",
+ * without modifying "line". */
+static int disk_line_field(const char *line, int index, char *buffer,
+                           size_t buffer_size) {
+  const char *ptr = line;
+
+  for (int i = 0;; i++) {
+    while ((*ptr == ' ') || (*ptr == '\t'))
+      ptr++;
+    if (*ptr == 0)
+      return ENOENT;
+
+    size_t len = strcspn(ptr, " \t");
+    if (i == index) {
+      if (len >= buffer_size)
+        len = buffer_size - 1;
+      memcpy(buffer, ptr, len);
+      buffer[len] = 0;
+      return 0;
+    }
+    ptr += len;
+  }
+} /* int disk_line_field */
+
+static diskstats_t *disk_get(const char *name) {
+  diskstats_t *ds = NULL;
+
+  if (c_avl_get(disklist, name, (void *)&ds) == 0)
+    return ds;
+
+  if ((ds = calloc(1, sizeof(*ds))) == NULL)
+    return NULL;
+  if ((ds->name = strdup(name)) == NULL) {
+    free(ds);
+    return NULL;
+  }
+  if (c_avl_insert(disklist, ds->name, ds) != 0) {
+    disk_free(ds);
+    return NULL;
+  }
+  return ds;
+} /* diskstats_t *disk_get */
+
+/* Determines the name "ds" is reported as and whether it is ignored. */
+static void disk_resolve(diskstats_t *ds) {
+#if HAVE_LIBUDEV_H
+  /* Without the udev monitor, changes are not noticed: look the name up on
+   * every read. */
+  if (ds->resolved && ((conf_udev_name_attr == NULL) ||
+                       (handle_udev_monitor != NULL)))
+    return;
+
+  if (ds->output_name != ds->name)
+    sfree(ds->output_name);
+  ds->output_name = NULL;
+  if (conf_udev_name_attr != NULL)
+    ds->output_name =
+        disk_udev_attr_name(handle_udev, ds->name, conf_udev_name_attr);
+  if (ds->output_name == NULL)
+    ds->output_name = ds->name;
+#else
+  if (ds->resolved)
+    return;
+  ds->output_name = ds->name;
+#endif
+
+  bool was_ignored = ds->resolved && ds->ignored;
+  ds->ignored = (ignorelist_match(ignorelist, ds->output_name) != 0);
+  ds->resolved = true;
+
+  /* The counters have not been updated while the disk was ignored. */
+  if (was_ignored && !ds->ignored) {
+    char *name = ds->name;
+    char *output_name = ds->output_name;
+    memset(ds, 0, sizeof(*ds));
+    ds->name = name;
+    ds->output_name = output_name;
+    ds->resolved = true;
+  }
+} /* void disk_resolve */
+#endif /* KERNEL_LINUX */
+
 static int disk_read(void) {
 #if HAVE_IOKIT_IOKITLIB_H
   io_registry_entry_t disk;
@@ -655,12 +825,13 @@ static int disk_read(void) {
   geom_stats_snapshot_free(snap);
 
 #elif KERNEL_LINUX
-  FILE *fh;
-  char buffer[1024];
+  static proc_file_t *pf;
+  static int fieldshift = 0;
+  char *buffer;
+  char *line;
 
   char *fields[32];
   int numfields;
-  int fieldshift = 0;
 
   int minor = 0;
 
@@ -678,51 +849,51 @@ static int disk_read(void) {
   derive_t weighted_time = 0;
   int is_disk = 0;
 
-  diskstats_t *ds, *pre_ds;
+  diskstats_t *ds;
 
-  if ((fh = fopen("/proc/diskstats", "r")) == NULL) {
-    fh = fopen("/proc/partitions", "r");
-    if (fh == NULL) {
-      ERROR("disk plugin: fopen (/proc/{diskstats,partitions}) failed.");
-      return -1;
-    }
+  if (pf == NULL) {
+    if ((pf = proc_file_open("/proc/diskstats")) == NULL) {
+      pf = proc_file_open("/proc/partitions");
+      if (pf == NULL) {
+        ERROR("disk plugin: open (/proc/{diskstats,partitions}) failed.");
+        return -1;
+      }
 
-    /* Kernel is 2.4.* */
-    fieldshift = 1;
+      /* Kernel is 2.4.* */
+      fieldshift = 1;
+    }
   }
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
-    char *disk_name;
-    char *output_name;
-
-    numfields = strsplit(buffer, fields, 32);
+  if (proc_file_read(pf, &buffer) < 0)
+    return -1;
 
-    if ((numfields != (14 + fieldshift)) && (numfields != 7))
-      continue;
+#if HAVE_LIBUDEV_H
+  disk_udev_poll();
+#endif
 
-    minor = atoll(fields[1]);
+  for (char *ptr = buffer; (line = proc_file_line(&ptr)) != NULL;) {
+    char disk_name[DATA_MAX_NAME_LEN];
+    char *output_name;
 
-    disk_name = fields[2 + fieldshift];
+    /* Look at the disk's name first, so that the lines of ignored disks are
+     * not split into fields. */
+    if (disk_line_field(line, 2 + fieldshift, disk_name, sizeof(disk_name)) !=
+        0)
+      continue;
 
-    for (ds = disklist, pre_ds = disklist; ds != NULL;
-         pre_ds = ds, ds = ds->next)
-      if (strcmp(disk_name, ds->name) == 0)
-        break;
+    ds = disk_get(disk_name);
+    if (ds == NULL)
+      continue;
+    disk_resolve(ds);
+    if (ds->ignored)
+      continue;
 
-    if (ds == NULL) {
-      if ((ds = (diskstats_t *)calloc(1, sizeof(diskstats_t))) == NULL)
-        continue;
+    numfields = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
 
-      if ((ds->name = strdup(disk_name)) == NULL) {
-        free(ds);
-        continue;
-      }
+    if ((numfields != (14 + fieldshift)) && (numfields != 7))
+      continue;
 
-      if (pre_ds == NULL)
-        disklist = ds;
-      else
-        pre_ds->next = ds;
-    }
+    minor = atoll(fields[1]);
 
     is_disk = 0;
     if (numfields == 7) {
@@ -842,25 +1013,7 @@ static int disk_read(void) {
       continue;
     }
 
-    output_name = disk_name;
-
-#if HAVE_LIBUDEV_H
-    char *alt_name = NULL;
-    if (conf_udev_name_attr != NULL) {
-      alt_name =
-          disk_udev_attr_name(handle_udev, disk_name, conf_udev_name_attr);
-      if (alt_name != NULL)
-        output_name = alt_name;
-    }
-#endif
-
-    if (ignorelist_match(ignorelist, output_name) != 0) {
-#if HAVE_LIBUDEV_H
-      /* release udev-based alternate name, if allocated */
-      sfree(alt_name);
-#endif
-      continue;
-    }
+    output_name = ds->output_name;
 
     if ((ds->read_bytes != 0) || (ds->write_bytes != 0))
       disk_submit(output_name, "disk_octets", ds->read_bytes, ds->write_bytes);
@@ -880,14 +1033,7 @@ static int disk_read(void) {
       if (ds->has_io_time)
         submit_io_time(output_name, io_time, weighted_time);
     } /* if (is_disk) */
-
-#if HAVE_LIBUDEV_H
-    /* release udev-based alternate name, if allocated */
-    sfree(alt_name);
-#endif
-  } /* while (fgets (buffer, sizeof (buffer), fh) != NULL) */
-
-  fclose(fh);
+  } /* for (line) */
 /* #endif defined(KERNEL_LINUX) */
 
 #elif HAVE_LIBKSTAT
@@ -38,95 +38,96 @@
 #include <sys/capability.h>
 #endif
 
+#if KERNEL_LINUX
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+/* TP_STATUS_BLK_TMO was introduced together with TPACKET_V3. */
+#if defined(TP_STATUS_BLK_TMO) && defined(PACKET_FANOUT)
+#define DNS_HAVE_RING 1
+#endif
+#endif /* KERNEL_LINUX */
+
 /*
  * Private data types
  */
-struct counter_list_s {
-  unsigned int key;
-  unsigned int value;
-  struct counter_list_s *next;
+/* Counters are kept per capture thread, so that packets can be counted
+ * without synchronizing with other capture threads. dns_read() sums up the
+ * counters of all threads. */
+struct dns_counters_s {
+  derive_t tr_queries;
+  derive_t tr_responses;
+  derive_t qtype[T_MAX];
+  derive_t opcode[16];
+  derive_t rcode[16];
+};
+typedef struct dns_counters_s dns_counters_t;
+
+struct dns_stats_s {
+  /* Held by the capture thread while it processes a packet (libpcap) or a
+   * block of packets (ring), and by dns_read() while it copies counters. */
+  pthread_mutex_t lock;
+  dns_counters_t counters;
+};
+typedef struct dns_stats_s dns_stats_t;
+
+#if DNS_HAVE_RING
+struct dns_ring_s {
+  int fd;
+  uint8_t *map;
+  size_t map_size;
+  struct tpacket_req3 req;
+  dns_stats_t *stats;
+  pthread_t thread;
+  bool thread_started;
 };
-typedef struct counter_list_s counter_list_t;
+typedef struct dns_ring_s dns_ring_t;
+#endif
 
 /*
  * Private variables
  */
 static const char *config_keys[] = {"Interface", "IgnoreSource",
-                                    "SelectNumericQueryTypes"};
+                                    "SelectNumericQueryTypes", "PacketRing",
+                                    "CaptureThreads"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 static int select_numeric_qtype = 1;
+static bool packet_ring;
+static int capture_threads = 1;
 
 #define PCAP_SNAPLEN 1460
 static char *pcap_device;
 
-static derive_t tr_queries;
-static derive_t tr_responses;
-static counter_list_t *qtype_list;
-static counter_list_t *opcode_list;
-static counter_list_t *rcode_list;
+static pthread_key_t dns_stats_key;
+static dns_stats_t **dns_stats;
+static size_t dns_stats_num;
+static dns_counters_t *dns_totals;
 
 static pthread_t listen_thread;
 static int listen_thread_init;
-/* The `traffic' mutex if for `tr_queries' and `tr_responses' */
-static pthread_mutex_t traffic_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t qtype_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t opcode_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t rcode_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#if DNS_HAVE_RING
+/* 256 KiB blocks; a block is handed to the capture thread when it is full or
+ * after DNS_RING_BLOCK_TIMEOUT milliseconds. */
+#define DNS_RING_BLOCK_SIZE (1 << 18)
+#define DNS_RING_BLOCK_NUM 16
+#define DNS_RING_FRAME_SIZE 2048
+#define DNS_RING_BLOCK_TIMEOUT 50
+
+static dns_ring_t *dns_rings;
+static size_t dns_rings_num;
+static int dns_ring_lo_ifindex;
+static bool dns_rings_shutdown;
+#endif
 
 /*
  * Private functions
  */
-static counter_list_t *counter_list_search(counter_list_t **list,
-                                           unsigned int key) {
-  counter_list_t *entry;
-
-  for (entry = *list; entry != NULL; entry = entry->next)
-    if (entry->key == key)
-      break;
-
-  return entry;
-}
-
-static counter_list_t *counter_list_create(counter_list_t **list,
-                                           unsigned int key,
-                                           unsigned int value) {
-  counter_list_t *entry;
-
-  entry = calloc(1, sizeof(*entry));
-  if (entry == NULL)
-    return NULL;
-
-  entry->key = key;
-  entry->value = value;
-
-  if (*list == NULL) {
-    *list = entry;
-  } else {
-    counter_list_t *last;
-
-    last = *list;
-    while (last->next != NULL)
-      last = last->next;
-
-    last->next = entry;
-  }
-
-  return entry;
-}
-
-static void counter_list_add(counter_list_t **list, unsigned int key,
-                             unsigned int increment) {
-  counter_list_t *entry;
-
-  entry = counter_list_search(list, key);
-
-  if (entry != NULL) {
-    entry->value += increment;
-  } else {
-    counter_list_create(list, key, increment);
-  }
-}
-
 static int dns_config(const char *key, const char *value) {
   if (strcasecmp(key, "Interface") == 0) {
     if (pcap_device != NULL)
@@ -141,6 +142,21 @@ static int dns_config(const char *key, const char *value) {
       select_numeric_qtype = 0;
     else
       select_numeric_qtype = 1;
+  } else if (strcasecmp(key, "PacketRing") == 0) {
+#if DNS_HAVE_RING
+    packet_ring = IS_TRUE(value);
+#else
+    if (IS_TRUE(value))
+      WARNING("dns plugin: The \"PacketRing\" option is not supported on "
+              "this system. Falling back to libpcap.");
+#endif
+  } else if (strcasecmp(key, "CaptureThreads") == 0) {
+    int tmp = atoi(value);
+    if (tmp < 1) {
+      ERROR("dns plugin: \"CaptureThreads\" must be at least 1.");
+      return 1;
+    }
+    capture_threads = tmp;
   } else {
     return -1;
   }
@@ -149,41 +165,36 @@ static int dns_config(const char *key, const char *value) {
 }
 
 static void dns_child_callback(const rfc1035_header_t *dns) {
-  if (dns->qr == 0) {
-    /* This is a query */
-    int skip = 0;
-    if (!select_numeric_qtype) {
-      const char *str = qtype_str(dns->qtype);
-      if ((str == NULL) || (str[0] == '#'))
-        skip = 1;
-    }
+  dns_counters_t *c = pthread_getspecific(dns_stats_key);
+  if (c == NULL)
+    return;
 
-    pthread_mutex_lock(&traffic_mutex);
-    tr_queries += dns->length;
-    pthread_mutex_unlock(&traffic_mutex);
-
-    if (skip == 0) {
-      pthread_mutex_lock(&qtype_mutex);
-      counter_list_add(&qtype_list, dns->qtype, 1);
-      pthread_mutex_unlock(&qtype_mutex);
-    }
+  if (dns->qr == 0) {
+    /* This is a query. Numeric query types are filtered in dns_read(), so
+     * qtype_str() is not called from several threads at once. */
+    c->tr_queries += dns->length;
+    c->qtype[dns->qtype]++;
   } else {
     /* This is a reply */
-    pthread_mutex_lock(&traffic_mutex);
-    tr_responses += dns->length;
-    pthread_mutex_unlock(&traffic_mutex);
-
-    pthread_mutex_lock(&rcode_mutex);
-    counter_list_add(&rcode_list, dns->rcode, 1);
-    pthread_mutex_unlock(&rcode_mutex);
+    c->tr_responses += dns->length;
+    c->rcode[dns->rcode]++;
   }
 
   /* FIXME: Are queries, replies or both interesting? */
-  pthread_mutex_lock(&opcode_mutex);
-  counter_list_add(&opcode_list, dns->opcode, 1);
-  pthread_mutex_unlock(&opcode_mutex);
+  c->opcode[dns->opcode]++;
 }
 
+/* Wraps handle_pcap() so the counters are updated under the lock of the
+ * (only) libpcap capture thread. */
+static void dns_handle_pcap(u_char *udata, const struct pcap_pkthdr *hdr,
+                            const u_char *pkt) {
+  dns_stats_t *stats = (dns_stats_t *)udata;
+
+  pthread_mutex_lock(&stats->lock);
+  handle_pcap(NULL, hdr, pkt);
+  pthread_mutex_unlock(&stats->lock);
+} /* void dns_handle_pcap */
+
 static int dns_run_pcap_loop(void) {
   pcap_t *pcap_obj;
   char pcap_error[PCAP_ERRBUF_SIZE];
@@ -226,10 +237,10 @@ static int dns_run_pcap_loop(void) {
   DEBUG("dns plugin: PCAP object created.");
 
   dnstop_set_pcap_obj(pcap_obj);
-  dnstop_set_callback(dns_child_callback);
 
   status = pcap_loop(pcap_obj, -1 /* loop forever */,
-                     handle_pcap /* callback */, NULL /* user data */);
+                     dns_handle_pcap /* callback */,
+                     (u_char *)dns_stats[0] /* user data */);
   INFO("dns plugin: pcap_loop exited with status %i.", status);
   /* We need to handle "PCAP_ERROR" specially because libpcap currently
    * doesn't return PCAP_ERROR_IFACE_NOT_UP for compatibility reasons. */
@@ -257,6 +268,8 @@ static void *dns_child_loop(__attribute__((unused)) void *dummy) /* {{{ */
 {
   int status;
 
+  pthread_setspecific(dns_stats_key, &dns_stats[0]->counters);
+
   while (42) {
     status = dns_run_pcap_loop();
     if (status != PCAP_ERROR_IFACE_NOT_UP)
@@ -272,26 +285,305 @@ static void *dns_child_loop(__attribute__((unused)) void *dummy) /* {{{ */
   return NULL;
 } /* }}} void *dns_child_loop */
 
+#if DNS_HAVE_RING
+static int dns_ring_compile_filter(struct bpf_program *fp) /* {{{ */
+{
+  /* SOCK_DGRAM packet sockets pass packets to the filter starting at the
+   * network header, which is what DLT_RAW filters expect. */
+  pcap_t *pcap_obj = pcap_open_dead(DLT_RAW, PCAP_SNAPLEN);
+  if (pcap_obj == NULL) {
+    ERROR("dns plugin: pcap_open_dead failed.");
+    return -1;
+  }
+
+  int status = pcap_compile(pcap_obj, fp, "udp port 53", 1, 0);
+  if (status < 0)
+    ERROR("dns plugin: pcap_compile failed: %s", pcap_geterr(pcap_obj));
+
+  pcap_close(pcap_obj);
+  return (status < 0) ? -1 : 0;
+} /* }}} int dns_ring_compile_filter */
+
+static int dns_ring_open(dns_ring_t *r, int ifindex, int fanout_id,
+                         struct bpf_program *fp) /* {{{ */
+{
+  /* Protocol zero: don't receive anything before the socket is bound. */
+  r->fd = socket(AF_PACKET, SOCK_DGRAM, 0);
+  if (r->fd < 0) {
+    ERROR("dns plugin: socket(AF_PACKET) failed: %s", STRERRNO);
+    return -1;
+  }
+
+  int version = TPACKET_V3;
+  if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &version,
+                 sizeof(version)) != 0) {
+    ERROR("dns plugin: Setting TPACKET_V3 failed: %s", STRERRNO);
+    return -1;
+  }
+
+  struct sock_fprog prog = {
+      .len = (unsigned short)fp->bf_len,
+      .filter = (struct sock_filter *)fp->bf_insns,
+  };
+  if (setsockopt(r->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) !=
+      0) {
+    ERROR("dns plugin: Attaching the packet filter failed: %s", STRERRNO);
+    return -1;
+  }
+
+  r->req = (struct tpacket_req3){
+      .tp_block_size = DNS_RING_BLOCK_SIZE,
+      .tp_block_nr = DNS_RING_BLOCK_NUM,
+      .tp_frame_size = DNS_RING_FRAME_SIZE,
+      .tp_frame_nr =
+          (DNS_RING_BLOCK_SIZE / DNS_RING_FRAME_SIZE) * DNS_RING_BLOCK_NUM,
+      .tp_retire_blk_tov = DNS_RING_BLOCK_TIMEOUT,
+  };
+  if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &r->req, sizeof(r->req)) !=
+      0) {
+    ERROR("dns plugin: Setting up the packet ring failed: %s", STRERRNO);
+    return -1;
+  }
+
+  r->map_size = (size_t)r->req.tp_block_size * r->req.tp_block_nr;
+  r->map =
+      mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+  if (r->map == MAP_FAILED) {
+    ERROR("dns plugin: Mapping the packet ring failed: %s", STRERRNO);
+    r->map = NULL;
+    return -1;
+  }
+
+  struct sockaddr_ll sll = {
+      .sll_family = AF_PACKET,
+      .sll_protocol = htons(ETH_P_ALL),
+      .sll_ifindex = ifindex,
+  };
+  if (bind(r->fd, (struct sockaddr *)&sll, sizeof(sll)) != 0) {
+    ERROR("dns plugin: Binding the packet socket failed: %s", STRERRNO);
+    return -1;
+  }
+
+  if (fanout_id >= 0) {
+    uint32_t arg = (uint32_t)fanout_id |
+                   ((uint32_t)(PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG)
+                    << 16);
+    if (setsockopt(r->fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) !=
+        0) {
+      ERROR("dns plugin: Joining the packet fanout group failed: %s",
+            STRERRNO);
+      return -1;
+    }
+  }
+
+  return 0;
+} /* }}} int dns_ring_open */
+
+static void dns_ring_close(dns_ring_t *r) /* {{{ */
+{
+  if (r->map != NULL)
+    munmap(r->map, r->map_size);
+  r->map = NULL;
+
+  if (r->fd >= 0)
+    close(r->fd);
+  r->fd = -1;
+} /* }}} void dns_ring_close */
+
+static void dns_ring_handle_block(struct tpacket_block_desc *bd) /* {{{ */
+{
+  uint8_t *ptr = (uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt;
+
+  for (uint32_t i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+    struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)ptr;
+    struct sockaddr_ll *sll =
+        (struct sockaddr_ll *)(ptr + TPACKET_ALIGN(sizeof(*hdr)));
+
+    /* Like libpcap, skip the outgoing copy of packets sent over the loopback
+     * device, it is received again as an incoming packet. */
+    if ((sll->sll_pkttype != PACKET_OUTGOING) ||
+        (sll->sll_ifindex != dns_ring_lo_ifindex))
+      handle_ip_packet(ptr + hdr->tp_net, (int)hdr->tp_snaplen);
+
+    ptr += hdr->tp_next_offset;
+  }
+} /* }}} void dns_ring_handle_block */
+
+static void *dns_ring_loop(void *arg) /* {{{ */
+{
+  dns_ring_t *r = arg;
+  int timeout = (int)CDTIME_T_TO_MS(plugin_get_interval() / 2);
+  unsigned int block = 0;
+
+  pthread_setspecific(dns_stats_key, &r->stats->counters);
+
+  while (!dns_rings_shutdown) {
+    struct tpacket_block_desc *bd =
+        (void *)(r->map + (size_t)block * r->req.tp_block_size);
+
+    if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+      struct pollfd pfd = {.fd = r->fd, .events = POLLIN | POLLERR};
+      if ((poll(&pfd, 1, timeout) < 0) && (errno != EINTR)) {
+        ERROR("dns plugin: poll failed: %s", STRERRNO);
+        break;
+      }
+      continue;
+    }
+    __sync_synchronize();
+
+    pthread_mutex_lock(&r->stats->lock);
+    dns_ring_handle_block(bd);
+    pthread_mutex_unlock(&r->stats->lock);
+
+    /* Hand the block back to the kernel. */
+    __sync_synchronize();
+    bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+    block = (block + 1) % r->req.tp_block_nr;
+  }
+
+  return NULL;
+} /* }}} void *dns_ring_loop */
+
+static int dns_ring_start(void) /* {{{ */
+{
+  int ifindex = 0;
+  if ((pcap_device != NULL) && (strcmp(pcap_device, "any") != 0)) {
+    ifindex = (int)if_nametoindex(pcap_device);
+    if (ifindex == 0) {
+      ERROR("dns plugin: Unknown interface `%s'.", pcap_device);
+      return -1;
+    }
+  }
+
+  dns_ring_lo_ifindex = (int)if_nametoindex("lo");
+
+  struct bpf_program fp = {0};
+  if (dns_ring_compile_filter(&fp) != 0)
+    return -1;
+
+  dns_rings = calloc(dns_stats_num, sizeof(*dns_rings));
+  if (dns_rings == NULL) {
+    ERROR("dns plugin: calloc failed.");
+    pcap_freecode(&fp);
+    return -1;
+  }
+  dns_rings_num = dns_stats_num;
+
+  /* Only one socket: no need for a fanout group. */
+  int fanout_id = (dns_rings_num > 1) ? (int)(getpid() & 0xffff) : -1;
+
+  int status = 0;
+  for (size_t i = 0; i < dns_rings_num; i++) {
+    dns_ring_t *r = dns_rings + i;
+
+    r->fd = -1;
+    r->stats = dns_stats[i];
+
+    status = dns_ring_open(r, ifindex, fanout_id, &fp);
+    if (status != 0)
+      break;
+  }
+  pcap_freecode(&fp);
+
+  for (size_t i = 0; (status == 0) && (i < dns_rings_num); i++) {
+    dns_ring_t *r = dns_rings + i;
+
+    status = plugin_thread_create(&r->thread, NULL, dns_ring_loop, r,
+                                  "dns capture");
+    if (status != 0) {
+      ERROR("dns plugin: pthread_create failed: %s", STRERROR(status));
+      break;
+    }
+    r->thread_started = true;
+  }
+
+  if (status != 0)
+    return -1;
+
+  INFO("dns plugin: Capturing on `%s' with %" PRIsz " packet ring(s).",
+       (pcap_device != NULL) ? pcap_device : "any", dns_rings_num);
+  listen_thread_init = 1;
+  return 0;
+} /* }}} int dns_ring_start */
+
+static void dns_ring_stop(void) /* {{{ */
+{
+  dns_rings_shutdown = true;
+
+  for (size_t i = 0; i < dns_rings_num; i++) {
+    dns_ring_t *r = dns_rings + i;
+
+    if (r->thread_started)
+      pthread_join(r->thread, NULL);
+    r->thread_started = false;
+
+    dns_ring_close(r);
+  }
+
+  sfree(dns_rings);
+  dns_rings_num = 0;
+} /* }}} void dns_ring_stop */
+#endif /* DNS_HAVE_RING */
+
 static int dns_init(void) {
   /* clean up an old thread */
   int status;
 
-  pthread_mutex_lock(&traffic_mutex);
-  tr_queries = 0;
-  tr_responses = 0;
-  pthread_mutex_unlock(&traffic_mutex);
-
   if (listen_thread_init != 0)
     return -1;
 
-  status = plugin_thread_create(&listen_thread, NULL, dns_child_loop, (void *)0,
-                                "dns listen");
-  if (status != 0) {
-    ERROR("dns plugin: pthread_create failed: %s", STRERRNO);
-    return -1;
+  if (!packet_ring && (capture_threads > 1))
+    WARNING("dns plugin: \"CaptureThreads\" requires \"PacketRing\" to be "
+            "enabled. Using one libpcap capture thread.");
+
+  if (dns_stats == NULL) {
+    size_t num = packet_ring ? (size_t)capture_threads : 1;
+
+    dns_totals = calloc(1, sizeof(*dns_totals));
+    dns_stats = calloc(num, sizeof(*dns_stats));
+    if ((dns_totals == NULL) || (dns_stats == NULL)) {
+      ERROR("dns plugin: calloc failed.");
+      return -1;
+    }
+
+    for (size_t i = 0; i < num; i++) {
+      dns_stats[i] = calloc(1, sizeof(*dns_stats[i]));
+      if (dns_stats[i] == NULL) {
+        ERROR("dns plugin: calloc failed.");
+        return -1;
+      }
+      pthread_mutex_init(&dns_stats[i]->lock, NULL);
+      dns_stats_num++;
+    }
+
+    status = pthread_key_create(&dns_stats_key, /* destructor = */ NULL);
+    if (status != 0) {
+      ERROR("dns plugin: pthread_key_create failed: %s", STRERROR(status));
+      return -1;
+    }
   }
 
-  listen_thread_init = 1;
+  dnstop_set_callback(dns_child_callback);
+
+#if DNS_HAVE_RING
+  if (packet_ring) {
+    if (dns_ring_start() != 0) {
+      dns_ring_stop();
+      return -1;
+    }
+  } else
+#endif
+  {
+    status = plugin_thread_create(&listen_thread, NULL, dns_child_loop,
+                                  (void *)0, "dns listen");
+    if (status != 0) {
+      ERROR("dns plugin: pthread_create failed: %s", STRERRNO);
+      return -1;
+    }
+
+    listen_thread_init = 1;
+  }
 
 #if defined(HAVE_SYS_CAPABILITY_H) && defined(CAP_NET_RAW)
   if (check_capability(CAP_NET_RAW) != 0) {
@@ -336,65 +628,81 @@ static void submit_octets(derive_t queries, derive_t responses) {
   plugin_dispatch_values(&vl);
 } /* void submit_octets */
 
-static int dns_read(void) {
-  unsigned int keys[T_MAX];
-  unsigned int values[T_MAX];
-  int len;
-
-  counter_list_t *ptr;
+static void dns_counters_add(dns_counters_t *dst,
+                             const dns_counters_t *src) {
+  dst->tr_queries += src->tr_queries;
+  dst->tr_responses += src->tr_responses;
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(dst->qtype); i++)
+    dst->qtype[i] += src->qtype[i];
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(dst->opcode); i++)
+    dst->opcode[i] += src->opcode[i];
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(dst->rcode); i++)
+    dst->rcode[i] += src->rcode[i];
+} /* void dns_counters_add */
 
-  pthread_mutex_lock(&traffic_mutex);
-  values[0] = tr_queries;
-  values[1] = tr_responses;
-  pthread_mutex_unlock(&traffic_mutex);
+static int dns_read(void) {
+  dns_counters_t *c = dns_totals;
 
-  if ((values[0] != 0) || (values[1] != 0))
-    submit_octets(values[0], values[1]);
+  if (c == NULL)
+    return -1;
 
-  pthread_mutex_lock(&qtype_mutex);
-  for (ptr = qtype_list, len = 0; (ptr != NULL) && (len < T_MAX);
-       ptr = ptr->next, len++) {
-    keys[len] = ptr->key;
-    values[len] = ptr->value;
+  memset(c, 0, sizeof(*c));
+  for (size_t i = 0; i < dns_stats_num; i++) {
+    pthread_mutex_lock(&dns_stats[i]->lock);
+    dns_counters_add(c, &dns_stats[i]->counters);
+    pthread_mutex_unlock(&dns_stats[i]->lock);
   }
-  pthread_mutex_unlock(&qtype_mutex);
 
-  for (int i = 0; i < len; i++) {
-    DEBUG("dns plugin: qtype = %u; counter = %u;", keys[i], values[i]);
-    submit_derive("dns_qtype", qtype_str(keys[i]), values[i]);
-  }
+  if ((c->tr_queries != 0) || (c->tr_responses != 0))
+    submit_octets(c->tr_queries, c->tr_responses);
 
-  pthread_mutex_lock(&opcode_mutex);
-  for (ptr = opcode_list, len = 0; (ptr != NULL) && (len < T_MAX);
-       ptr = ptr->next, len++) {
-    keys[len] = ptr->key;
-    values[len] = ptr->value;
-  }
-  pthread_mutex_unlock(&opcode_mutex);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(c->qtype); i++) {
+    if (c->qtype[i] == 0)
+      continue;
 
-  for (int i = 0; i < len; i++) {
-    DEBUG("dns plugin: opcode = %u; counter = %u;", keys[i], values[i]);
-    submit_derive("dns_opcode", opcode_str(keys[i]), values[i]);
+    const char *str = qtype_str((int)i);
+    if (!select_numeric_qtype && ((str == NULL) || (str[0] == '#')))
+      continue;
+
+    DEBUG("dns plugin: qtype = %" PRIsz "; counter = %" PRIi64 ";", i,
+          c->qtype[i]);
+    submit_derive("dns_qtype", str, c->qtype[i]);
   }
 
-  pthread_mutex_lock(&rcode_mutex);
-  for (ptr = rcode_list, len = 0; (ptr != NULL) && (len < T_MAX);
-       ptr = ptr->next, len++) {
-    keys[len] = ptr->key;
-    values[len] = ptr->value;
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(c->opcode); i++) {
+    if (c->opcode[i] == 0)
+      continue;
+    DEBUG("dns plugin: opcode = %" PRIsz "; counter = %" PRIi64 ";", i,
+          c->opcode[i]);
+    submit_derive("dns_opcode", opcode_str((int)i), c->opcode[i]);
   }
-  pthread_mutex_unlock(&rcode_mutex);
 
-  for (int i = 0; i < len; i++) {
-    DEBUG("dns plugin: rcode = %u; counter = %u;", keys[i], values[i]);
-    submit_derive("dns_rcode", rcode_str(keys[i]), values[i]);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(c->rcode); i++) {
+    if (c->rcode[i] == 0)
+      continue;
+    DEBUG("dns plugin: rcode = %" PRIsz "; counter = %" PRIi64 ";", i,
+          c->rcode[i]);
+    submit_derive("dns_rcode", rcode_str((int)i), c->rcode[i]);
   }
 
   return 0;
 } /* int dns_read */
 
+static int dns_shutdown(void) {
+#if DNS_HAVE_RING
+  if (packet_ring) {
+    dns_ring_stop();
+    listen_thread_init = 0;
+  }
+#endif
+  /* The libpcap thread may still be blocked in pcap_loop(), so the counters
+   * are only released along with the process. */
+  return 0;
+} /* int dns_shutdown */
+
 void module_register(void) {
   plugin_register_config("dns", dns_config, config_keys, config_keys_num);
   plugin_register_init("dns", dns_init);
   plugin_register_read("dns", dns_read);
+  plugin_register_shutdown("dns", dns_shutdown);
 } /* void module_register */
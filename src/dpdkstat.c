@@ -33,6 +33,7 @@
 #include "collectd.h"
 
 #include "common.h"
+#include "utils_atomic.h"
 #include "utils_dpdk.h"
 
 #include <rte_config.h>
@@ -53,25 +54,32 @@ typedef struct dpdk_stats_config_s dpdk_stats_config_t;
 
 #define RTE_VERSION_16_07 RTE_VERSION_NUM(16, 7, 0, 16)
 
+/*
+ * The values are double buffered (see dpdk_stats_snapshot_read()), names are
+ * stored once. Before 16.07 names are part of each value.
+ */
 #if RTE_VERSION < RTE_VERSION_16_07
-#define DPDK_STATS_XSTAT_GET_VALUE(ctx, index) ctx->xstats[index].value
-#define DPDK_STATS_XSTAT_GET_NAME(ctx, index) ctx->xstats[index].name
-#define DPDK_STATS_CTX_GET_XSTAT_SIZE sizeof(struct rte_eth_xstats)
+typedef struct rte_eth_xstats dpdk_xstat_t;
+#define DPDK_STATS_XSTAT_GET_VALUE(values, index) values[index].value
+#define DPDK_STATS_XSTAT_GET_NAME(ctx, values, index) values[index].name
+#define DPDK_STATS_CTX_GET_XSTAT_SIZE (2 * sizeof(struct rte_eth_xstats))
 #define DPDK_STATS_CTX_INIT(ctx)                                               \
   do {                                                                         \
-    ctx->xstats = (struct rte_eth_xstats *)&ctx->raw_data[0];                  \
+    ctx->xstats[0] = (dpdk_xstat_t *)&ctx->raw_data[0];                        \
+    ctx->xstats[1] = ctx->xstats[0] + ctx->stats_count;                        \
   } while (0)
 #else
-#define DPDK_STATS_XSTAT_GET_VALUE(ctx, index) ctx->xstats[index].value
-#define DPDK_STATS_XSTAT_GET_NAME(ctx, index) ctx->xnames[index].name
+typedef struct rte_eth_xstat dpdk_xstat_t;
+#define DPDK_STATS_XSTAT_GET_VALUE(values, index) values[index].value
+#define DPDK_STATS_XSTAT_GET_NAME(ctx, values, index) ctx->xnames[index].name
 #define DPDK_STATS_CTX_GET_XSTAT_SIZE                                          \
-  (sizeof(struct rte_eth_xstat) + sizeof(struct rte_eth_xstat_name))
+  (2 * sizeof(struct rte_eth_xstat) + sizeof(struct rte_eth_xstat_name))
 #define DPDK_STATS_CTX_INIT(ctx)                                               \
   do {                                                                         \
-    ctx->xstats = (struct rte_eth_xstat *)&ctx->raw_data[0];                   \
+    ctx->xstats[0] = (dpdk_xstat_t *)&ctx->raw_data[0];                        \
+    ctx->xstats[1] = ctx->xstats[0] + ctx->stats_count;                        \
     ctx->xnames =                                                              \
-        (struct rte_eth_xstat_name *)&ctx                                      \
-            ->raw_data[ctx->stats_count * sizeof(struct rte_eth_xstat)];       \
+        (struct rte_eth_xstat_name *)(ctx->xstats[1] + ctx->stats_count);      \
   } while (0)
 #endif
 
@@ -79,12 +87,18 @@ struct dpdk_stats_ctx_s {
   dpdk_stats_config_t config;
   uint32_t stats_count;
   uint32_t ports_count;
-  cdtime_t port_read_time[RTE_MAX_ETHPORTS];
   uint32_t port_stats_count[RTE_MAX_ETHPORTS];
-#if RTE_VERSION < RTE_VERSION_16_07
-  struct rte_eth_xstats *xstats;
-#else
-  struct rte_eth_xstat *xstats;
+
+  /* Snapshot published by the helper. "snapshot_seq" is incremented after a
+   * buffer was written and its lowest bit selects that buffer; the next
+   * update goes to the other one. Names and the per port counts are only
+   * written while collectd waits for a DPDK_CMD_GET_STATS command. */
+  uint32_t snapshot_seq;
+  bool snapshot_valid;
+  cdtime_t snapshot_time[2];
+  cdtime_t port_read_time[2][RTE_MAX_ETHPORTS];
+  dpdk_xstat_t *xstats[2];
+#if RTE_VERSION >= RTE_VERSION_16_07
   struct rte_eth_xstat_name *xnames;
 #endif
   char raw_data[];
@@ -102,6 +116,12 @@ dpdk_helper_ctx_t *g_hc = NULL;
 static char g_shm_name[DATA_MAX_NAME_LEN] = DPDK_STATS_NAME;
 static dpdk_stat_cfg_status g_state = DPDK_STAT_STATE_OKAY;
 
+/* collectd side copy of the last snapshot */
+static dpdk_xstat_t *g_values = NULL;
+static uint32_t g_values_size = 0;
+static cdtime_t g_port_read_time[RTE_MAX_ETHPORTS];
+static uint32_t g_last_seq = 0;
+
 static int dpdk_stats_reinit_helper();
 static void dpdk_stats_default_config(void) {
   dpdk_stats_ctx_t *ec = DPDK_STATS_CTX_GET(g_hc);
@@ -131,6 +151,7 @@ static int dpdk_stats_preinit(void) {
   }
 
   dpdk_stats_default_config();
+  dpdk_helper_refresh_set(g_hc, DPDK_STATS_CTX_GET(g_hc)->config.interval / 2);
   return ret;
 }
 
@@ -199,22 +220,34 @@ static int dpdk_stats_config(oconfig_item_t *ci) {
   return 0;
 }
 
+static void dpdk_helper_snapshot_publish(dpdk_stats_ctx_t *ctx) {
+  uint32_t seq = ctx->snapshot_seq + 1;
+
+  ctx->snapshot_time[seq & 1] = cdtime();
+  ctx->snapshot_valid = true;
+  C_ATOMIC_STORE_REL(&ctx->snapshot_seq, seq);
+}
+
 static int dpdk_helper_stats_get(dpdk_helper_ctx_t *phc) {
   int len = 0;
   int ret = 0;
   int stats = 0;
   dpdk_stats_ctx_t *ctx = DPDK_STATS_CTX_GET(phc);
+  int buf = (ctx->snapshot_seq + 1) & 1;
+  dpdk_xstat_t *xstats = ctx->xstats[buf];
+
+  ctx->snapshot_valid = false;
 
   /* get stats from DPDK */
   for (uint8_t i = 0; i < ctx->ports_count; i++) {
     if (!(ctx->config.enabled_port_mask & (1 << i)))
       continue;
 
-    ctx->port_read_time[i] = cdtime();
+    ctx->port_read_time[buf][i] = cdtime();
     /* Store available stats array length for port */
     len = ctx->port_stats_count[i];
 
-    ret = rte_eth_xstats_get(i, &ctx->xstats[stats], len);
+    ret = rte_eth_xstats_get(i, &xstats[stats], len);
     if (ret < 0 || ret > len) {
       DPDK_CHILD_LOG(DPDK_STATS_PLUGIN
                      ": Error reading stats (port=%d; len=%d, ret=%d)\n",
@@ -237,6 +270,43 @@ static int dpdk_helper_stats_get(dpdk_helper_ctx_t *phc) {
   }
 
   assert(stats <= ctx->stats_count);
+  dpdk_helper_snapshot_publish(ctx);
+  return 0;
+}
+
+/*
+ * Periodic update of the values only, reusing the names and layout of the
+ * last DPDK_CMD_GET_STATS. If the layout changed, publishing stops until the
+ * next command.
+ */
+static int dpdk_helper_stats_refresh(dpdk_helper_ctx_t *phc) {
+  dpdk_stats_ctx_t *ctx = DPDK_STATS_CTX_GET(phc);
+  int buf = (ctx->snapshot_seq + 1) & 1;
+  dpdk_xstat_t *xstats = ctx->xstats[buf];
+  int stats = 0;
+
+  if (!ctx->snapshot_valid)
+    return 0;
+
+  for (uint8_t i = 0; i < ctx->ports_count; i++) {
+    if (!(ctx->config.enabled_port_mask & (1 << i)))
+      continue;
+
+    int len = ctx->port_stats_count[i];
+
+    ctx->port_read_time[buf][i] = cdtime();
+    int ret = rte_eth_xstats_get(i, &xstats[stats], len);
+    if (ret != len) {
+      DPDK_CHILD_LOG(DPDK_STATS_PLUGIN
+                     ": Stats layout changed (port=%d; len=%d, ret=%d)\n",
+                     i, len, ret);
+      ctx->snapshot_valid = false;
+      return -1;
+    }
+    stats += len;
+  }
+
+  dpdk_helper_snapshot_publish(ctx);
   return 0;
 }
 
@@ -284,6 +354,9 @@ int dpdk_helper_command_handler(dpdk_helper_ctx_t *phc, enum DPDK_CMD cmd) {
     return -EINVAL;
   }
 
+  if (cmd == DPDK_CMD_REFRESH)
+    return dpdk_helper_stats_refresh(phc);
+
   if (cmd != DPDK_CMD_GET_STATS) {
     DPDK_CHILD_LOG("%s: Unknown command (cmd=%d)\n", DPDK_STATS_PLUGIN, cmd);
     return -EINVAL;
@@ -291,6 +364,7 @@ int dpdk_helper_command_handler(dpdk_helper_ctx_t *phc, enum DPDK_CMD cmd) {
 
   int stats_count = dpdk_helper_stats_count_get(phc);
   if (stats_count < 0) {
+    DPDK_STATS_CTX_GET(phc)->snapshot_valid = false;
     return stats_count;
   }
 
@@ -298,6 +372,7 @@ int dpdk_helper_command_handler(dpdk_helper_ctx_t *phc, enum DPDK_CMD cmd) {
   int stats_size = stats_count * DPDK_STATS_CTX_GET_XSTAT_SIZE;
 
   if (dpdk_stats_get_size(phc) < stats_size) {
+    DPDK_STATS_CTX_GET(phc)->snapshot_valid = false;
     DPDK_CHILD_LOG(
         DPDK_STATS_PLUGIN
         ":%s:%d not enough space for stats (available=%d, needed=%d)\n",
@@ -379,6 +454,49 @@ static void dpdk_stats_counter_submit(const char *plugin_instance,
   plugin_dispatch_values(&vl);
 }
 
+/*
+ * Copies the last published snapshot to g_values. Returns 0 on success, -1 if
+ * no new consistent snapshot is available.
+ */
+static int dpdk_stats_snapshot_read(dpdk_stats_ctx_t *ctx) {
+  if (!ctx->snapshot_valid || ctx->stats_count == 0)
+    return -1;
+
+  if (g_values_size < ctx->stats_count) {
+    dpdk_xstat_t *tmp =
+        realloc(g_values, ctx->stats_count * sizeof(*g_values));
+    if (tmp == NULL) {
+      ERROR(DPDK_STATS_PLUGIN ": realloc failed");
+      return -1;
+    }
+    g_values = tmp;
+    g_values_size = ctx->stats_count;
+  }
+
+  /* The helper writes the buffer not selected by the sequence number. Once it
+   * has published the next one it may start overwriting ours, so the copy is
+   * only good if the sequence number did not move in the meantime. */
+  for (int retry = 0; retry < 3; retry++) {
+    uint32_t seq = C_ATOMIC_LOAD_ACQ(&ctx->snapshot_seq);
+    int buf = seq & 1;
+
+    if (seq == g_last_seq)
+      return -1;
+
+    memcpy(g_values, ctx->xstats[buf], ctx->stats_count * sizeof(*g_values));
+    memcpy(g_port_read_time, ctx->port_read_time[buf],
+           sizeof(g_port_read_time));
+    C_ATOMIC_FENCE();
+
+    if (C_ATOMIC_LOAD(&ctx->snapshot_seq) == seq) {
+      g_last_seq = seq;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
 static int dpdk_stats_counters_dispatch(dpdk_helper_ctx_t *phc) {
   dpdk_stats_ctx_t *ctx = DPDK_STATS_CTX_GET(phc);
 
@@ -404,14 +522,15 @@ static int dpdk_stats_counters_dispatch(dpdk_helper_ctx_t *phc) {
           dev_name, ctx->port_stats_count[i]);
 
     for (int j = 0; j < ctx->port_stats_count[i]; j++) {
-      const char *cnt_name = DPDK_STATS_XSTAT_GET_NAME(ctx, stats_count);
+      const char *cnt_name =
+          DPDK_STATS_XSTAT_GET_NAME(ctx, g_values, stats_count);
       if (cnt_name == NULL)
         WARNING("dpdkstat: Invalid counter name");
       else
         dpdk_stats_counter_submit(
             dev_name, cnt_name,
-            (derive_t)DPDK_STATS_XSTAT_GET_VALUE(ctx, stats_count),
-            ctx->port_read_time[i]);
+            (derive_t)DPDK_STATS_XSTAT_GET_VALUE(g_values, stats_count),
+            g_port_read_time[i]);
       stats_count++;
 
       assert(stats_count <= ctx->stats_count);
@@ -452,8 +571,10 @@ static int dpdk_stats_reinit_helper() {
 
   ctx = DPDK_STATS_CTX_GET(g_hc);
   memcpy(ctx, &tmp_ctx, sizeof(dpdk_stats_ctx_t));
+  ctx->snapshot_valid = false;
   DPDK_STATS_CTX_INIT(ctx);
   dpdk_helper_eal_config_set(g_hc, &tmp_eal);
+  dpdk_helper_refresh_set(g_hc, ctx->config.interval / 2);
 
   return ret;
 }
@@ -470,6 +591,20 @@ static int dpdk_stats_read(user_data_t *ud) {
 
   dpdk_stats_ctx_t *ctx = DPDK_STATS_CTX_GET(g_hc);
 
+  /* Use the helper's latest snapshot if it is recent enough; only ask the
+   * helper explicitly when there is none, e.g. after a layout change. */
+  ret = dpdk_helper_poll(g_hc);
+  if (ret < 0)
+    return 0;
+
+  if (ret == 0 &&
+      cdtime() - ctx->snapshot_time[ctx->snapshot_seq & 1] <
+          ctx->config.interval &&
+      dpdk_stats_snapshot_read(ctx) == 0) {
+    dpdk_stats_counters_dispatch(g_hc);
+    return 0;
+  }
+
   int result = 0;
   ret = dpdk_helper_command(g_hc, DPDK_CMD_GET_STATS, &result,
                             ctx->config.interval);
@@ -482,7 +617,8 @@ static int dpdk_stats_read(user_data_t *ud) {
   } else if (result == -ENODEV) {
     dpdk_helper_shutdown(g_hc);
   } else if (result == 0) {
-    dpdk_stats_counters_dispatch(g_hc);
+    if (dpdk_stats_snapshot_read(ctx) == 0)
+      dpdk_stats_counters_dispatch(g_hc);
   }
 
   return 0;
@@ -494,6 +630,9 @@ static int dpdk_stats_shutdown(void) {
   dpdk_helper_shutdown(g_hc);
   g_hc = NULL;
 
+  sfree(g_values);
+  g_values_size = 0;
+
   return 0;
 }
 
@@ -0,0 +1,816 @@
+/**
+ * collectd - src/ebpf.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <sys/resource.h>
+
+/* The kernel reports unsupported map operations with its internal ENOTSUPP
+ * code, which is not part of the userspace errno.h. */
+#ifndef ENOTSUPP
+#define ENOTSUPP 524
+#endif
+
+/* Upper bound for the number of entries fetched by a single
+ * bpf_map_lookup_batch() call. */
+#define EBPF_BATCH_MAX 256
+
+typedef enum {
+  KEY_NUMBER = 0,
+  KEY_LOG2,
+  KEY_STRING,
+  KEY_HEX,
+} ebpf_key_format_t;
+
+struct ebpf_map_s;
+typedef struct ebpf_map_s ebpf_map_t;
+struct ebpf_map_s {
+  char *name;
+  char *type;
+  char *plugin_instance;
+  char *type_instance_prefix;
+  ebpf_key_format_t key_format;
+
+  /* Set up by ebpf_map_init() once the object has been loaded. */
+  int fd;
+  int ds_type;
+  uint32_t key_size;
+  uint32_t value_size;
+  uint32_t value_stride;
+  int values_num;
+  uint32_t batch_size;
+  bool no_batch;
+  void *keys;
+  void *values;
+  void *token_in;
+  void *token_out;
+
+  ebpf_map_t *next;
+};
+
+struct ebpf_attach_s;
+typedef struct ebpf_attach_s ebpf_attach_t;
+struct ebpf_attach_s {
+  char *program;
+  char *target;
+
+  ebpf_attach_t *next;
+};
+
+struct ebpf_object_s;
+typedef struct ebpf_object_s ebpf_object_t;
+struct ebpf_object_s {
+  char *file;
+  char *name;
+  cdtime_t interval;
+  ebpf_attach_t *attach;
+  ebpf_map_t *maps;
+
+  struct bpf_object *obj;
+  struct bpf_link **links;
+  size_t links_num;
+
+  ebpf_object_t *next;
+};
+
+/* Objects which have been configured but not yet loaded. Ownership is passed
+ * to the read callbacks in ebpf_init(). */
+static ebpf_object_t *objects_g;
+
+static void ebpf_map_free(ebpf_map_t *m) {
+  while (m != NULL) {
+    ebpf_map_t *next = m->next;
+
+    sfree(m->name);
+    sfree(m->type);
+    sfree(m->plugin_instance);
+    sfree(m->type_instance_prefix);
+    sfree(m->keys);
+    sfree(m->values);
+    sfree(m->token_in);
+    sfree(m->token_out);
+    sfree(m);
+
+    m = next;
+  }
+}
+
+static void ebpf_attach_free(ebpf_attach_t *a) {
+  while (a != NULL) {
+    ebpf_attach_t *next = a->next;
+
+    sfree(a->program);
+    sfree(a->target);
+    sfree(a);
+
+    a = next;
+  }
+}
+
+static void ebpf_object_free(void *arg) {
+  ebpf_object_t *o = arg;
+
+  if (o == NULL)
+    return;
+
+  for (size_t i = 0; i < o->links_num; i++)
+    bpf_link__destroy(o->links[i]);
+  sfree(o->links);
+
+  if (o->obj != NULL)
+    bpf_object__close(o->obj);
+
+  ebpf_attach_free(o->attach);
+  ebpf_map_free(o->maps);
+  sfree(o->file);
+  sfree(o->name);
+  sfree(o);
+}
+
+static int ebpf_libbpf_print(enum libbpf_print_level level, const char *format,
+                             va_list ap) {
+  char msg[1024];
+
+  vsnprintf(msg, sizeof(msg), format, ap);
+  size_t len = strlen(msg);
+  while ((len > 0) && (msg[len - 1] == '\n'))
+    msg[--len] = 0;
+
+  if (level == LIBBPF_WARN)
+    WARNING("ebpf plugin: libbpf: %s", msg);
+  else if (level == LIBBPF_INFO)
+    INFO("ebpf plugin: libbpf: %s", msg);
+  else
+    DEBUG("ebpf plugin: libbpf: %s", msg);
+
+  return 0;
+}
+
+/*
+ * Configuration
+ */
+static int ebpf_config_key_format(oconfig_item_t *ci,
+                                  ebpf_key_format_t *ret) {
+  char *str = NULL;
+  int status = cf_util_get_string(ci, &str);
+  if (status != 0)
+    return status;
+
+  if (strcasecmp("Number", str) == 0)
+    *ret = KEY_NUMBER;
+  else if (strcasecmp("Log2", str) == 0)
+    *ret = KEY_LOG2;
+  else if (strcasecmp("String", str) == 0)
+    *ret = KEY_STRING;
+  else if (strcasecmp("Hex", str) == 0)
+    *ret = KEY_HEX;
+  else {
+    ERROR("ebpf plugin: Invalid KeyFormat \"%s\". Valid formats are "
+          "\"Number\", \"Log2\", \"String\" and \"Hex\".",
+          str);
+    status = EINVAL;
+  }
+
+  sfree(str);
+  return status;
+}
+
+static int ebpf_config_map(ebpf_object_t *o, oconfig_item_t *ci) {
+  ebpf_map_t *m = calloc(1, sizeof(*m));
+  if (m == NULL) {
+    ERROR("ebpf plugin: calloc failed.");
+    return ENOMEM;
+  }
+  m->fd = -1;
+
+  int status = cf_util_get_string(ci, &m->name);
+  if (status != 0) {
+    ERROR("ebpf plugin: The `Map' block needs exactly one string argument.");
+    sfree(m);
+    return status;
+  }
+
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Type", child->key) == 0)
+      status = cf_util_get_string(child, &m->type);
+    else if (strcasecmp("PluginInstance", child->key) == 0)
+      status = cf_util_get_string(child, &m->plugin_instance);
+    else if (strcasecmp("TypeInstancePrefix", child->key) == 0)
+      status = cf_util_get_string(child, &m->type_instance_prefix);
+    else if (strcasecmp("KeyFormat", child->key) == 0)
+      status = ebpf_config_key_format(child, &m->key_format);
+    else {
+      ERROR("ebpf plugin: Option `%s' not allowed in `Map' blocks.",
+            child->key);
+      status = EINVAL;
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  if ((status == 0) && (m->type == NULL)) {
+    m->type = strdup("derive");
+    if (m->type == NULL)
+      status = ENOMEM;
+  }
+
+  if (status != 0) {
+    ebpf_map_free(m);
+    return status;
+  }
+
+  m->next = o->maps;
+  o->maps = m;
+  return 0;
+}
+
+static int ebpf_config_attach(ebpf_object_t *o, oconfig_item_t *ci) {
+  if ((ci->values_num != 2) || (ci->values[0].type != OCONFIG_TYPE_STRING) ||
+      (ci->values[1].type != OCONFIG_TYPE_STRING)) {
+    ERROR("ebpf plugin: The `Attach' option needs exactly two string "
+          "arguments: the program name and the attach point.");
+    return EINVAL;
+  }
+
+  ebpf_attach_t *a = calloc(1, sizeof(*a));
+  if (a == NULL) {
+    ERROR("ebpf plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  a->program = strdup(ci->values[0].value.string);
+  a->target = strdup(ci->values[1].value.string);
+  if ((a->program == NULL) || (a->target == NULL)) {
+    ERROR("ebpf plugin: strdup failed.");
+    ebpf_attach_free(a);
+    return ENOMEM;
+  }
+
+  a->next = o->attach;
+  o->attach = a;
+  return 0;
+}
+
+/* Derives the object's name from the file name, e.g. "/path/biolat.bpf.o"
+ * becomes "biolat". */
+static char *ebpf_object_name(char const *file) {
+  char const *base = strrchr(file, '/');
+  base = (base != NULL) ? base + 1 : file;
+
+  size_t len = strcspn(base, ".");
+  if (len == 0)
+    len = strlen(base);
+
+  return strndup(base, len);
+}
+
+static int ebpf_config_object(oconfig_item_t *ci) {
+  ebpf_object_t *o = calloc(1, sizeof(*o));
+  if (o == NULL) {
+    ERROR("ebpf plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  int status = cf_util_get_string(ci, &o->file);
+  if (status != 0) {
+    ERROR("ebpf plugin: The `Object' block needs exactly one string "
+          "argument.");
+    sfree(o);
+    return status;
+  }
+
+  o->name = ebpf_object_name(o->file);
+  if (o->name == NULL) {
+    ERROR("ebpf plugin: strndup failed.");
+    ebpf_object_free(o);
+    return ENOMEM;
+  }
+
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Attach", child->key) == 0)
+      status = ebpf_config_attach(o, child);
+    else if (strcasecmp("Map", child->key) == 0)
+      status = ebpf_config_map(o, child);
+    else if (strcasecmp("Interval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &o->interval);
+    else {
+      ERROR("ebpf plugin: Option `%s' not allowed in `Object' blocks.",
+            child->key);
+      status = EINVAL;
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  if ((status == 0) && (o->maps == NULL)) {
+    ERROR("ebpf plugin: Object \"%s\" has no `Map' blocks.", o->file);
+    status = EINVAL;
+  }
+
+  if (status != 0) {
+    ebpf_object_free(o);
+    return status;
+  }
+
+  o->next = objects_g;
+  objects_g = o;
+  return 0;
+}
+
+static int ebpf_config(oconfig_item_t *ci) {
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Object", child->key) == 0)
+      ebpf_config_object(child);
+    else
+      WARNING("ebpf plugin: Ignoring unknown config option \"%s\".",
+              child->key);
+  }
+
+  return 0;
+}
+
+/*
+ * Loading and attaching
+ */
+static int ebpf_link_add(ebpf_object_t *o, struct bpf_link *link,
+                         char const *program) {
+  long err = libbpf_get_error(link);
+  if (err != 0) {
+    ERROR("ebpf plugin: Attaching program \"%s\" of \"%s\" failed: %s",
+          program, o->file, STRERROR((int)-err));
+    return (int)-err;
+  }
+
+  struct bpf_link **tmp =
+      realloc(o->links, (o->links_num + 1) * sizeof(*o->links));
+  if (tmp == NULL) {
+    ERROR("ebpf plugin: realloc failed.");
+    bpf_link__destroy(link);
+    return ENOMEM;
+  }
+  o->links = tmp;
+  o->links[o->links_num] = link;
+  o->links_num++;
+
+  return 0;
+}
+
+/* Attaches a program to an explicitly configured attach point:
+ * "kprobe:<function>", "kretprobe:<function>",
+ * "tracepoint:<category>:<name>" or "raw_tracepoint:<name>". */
+static int ebpf_attach_one(ebpf_object_t *o, ebpf_attach_t *a) {
+  struct bpf_program *prog =
+      bpf_object__find_program_by_name(o->obj, a->program);
+  if (prog == NULL) {
+    ERROR("ebpf plugin: Program \"%s\" not found in \"%s\".", a->program,
+          o->file);
+    return ENOENT;
+  }
+
+  char target[strlen(a->target) + 1];
+  sstrncpy(target, a->target, sizeof(target));
+
+  char *kind = target;
+  char *arg = strchr(target, ':');
+  if (arg == NULL) {
+    ERROR("ebpf plugin: Invalid attach point \"%s\".", a->target);
+    return EINVAL;
+  }
+  *arg++ = 0;
+
+  struct bpf_link *link = NULL;
+  if (strcasecmp("kprobe", kind) == 0)
+    link = bpf_program__attach_kprobe(prog, /* retprobe = */ false, arg);
+  else if (strcasecmp("kretprobe", kind) == 0)
+    link = bpf_program__attach_kprobe(prog, /* retprobe = */ true, arg);
+  else if (strcasecmp("raw_tracepoint", kind) == 0)
+    link = bpf_program__attach_raw_tracepoint(prog, arg);
+  else if (strcasecmp("tracepoint", kind) == 0) {
+    char *name = strchr(arg, ':');
+    if (name == NULL) {
+      ERROR("ebpf plugin: Tracepoints must be given as "
+            "\"tracepoint:<category>:<name>\", got \"%s\".",
+            a->target);
+      return EINVAL;
+    }
+    *name++ = 0;
+    link = bpf_program__attach_tracepoint(prog, arg, name);
+  } else {
+    ERROR("ebpf plugin: Unknown attach type \"%s\" in \"%s\".", kind,
+          a->target);
+    return EINVAL;
+  }
+
+  return ebpf_link_add(o, link, a->program);
+}
+
+static int ebpf_attach_all(ebpf_object_t *o) {
+  if (o->attach != NULL) {
+    for (ebpf_attach_t *a = o->attach; a != NULL; a = a->next) {
+      int status = ebpf_attach_one(o, a);
+      if (status != 0)
+        return status;
+    }
+    return 0;
+  }
+
+  /* Without explicit attach points, rely on the programs' section names, e.g.
+   * SEC("tracepoint/block/block_rq_issue"). */
+  struct bpf_program *prog;
+  bpf_object__for_each_program(prog, o->obj) {
+    int status =
+        ebpf_link_add(o, bpf_program__attach(prog), bpf_program__name(prog));
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+}
+
+static bool ebpf_map_is_percpu(enum bpf_map_type type) {
+  return (type == BPF_MAP_TYPE_PERCPU_HASH) ||
+         (type == BPF_MAP_TYPE_PERCPU_ARRAY) ||
+         (type == BPF_MAP_TYPE_LRU_PERCPU_HASH);
+}
+
+static int ebpf_map_init(ebpf_object_t *o, ebpf_map_t *m) {
+  struct bpf_map *map = bpf_object__find_map_by_name(o->obj, m->name);
+  if (map == NULL) {
+    ERROR("ebpf plugin: Map \"%s\" not found in \"%s\".", m->name, o->file);
+    return ENOENT;
+  }
+
+  const data_set_t *ds = plugin_get_ds(m->type);
+  if (ds == NULL) {
+    ERROR("ebpf plugin: Unknown type \"%s\" for map \"%s\".", m->type,
+          m->name);
+    return ENOENT;
+  }
+  if (ds->ds_num != 1) {
+    ERROR("ebpf plugin: Type \"%s\" has %" PRIsz " data sources, "
+          "but only types with one data source are supported.",
+          m->type, ds->ds_num);
+    return EINVAL;
+  }
+  m->ds_type = ds->ds[0].type;
+
+  m->fd = bpf_map__fd(map);
+  m->key_size = bpf_map__key_size(map);
+  m->value_size = bpf_map__value_size(map);
+
+  if ((m->value_size != sizeof(uint32_t)) &&
+      (m->value_size != sizeof(uint64_t))) {
+    ERROR("ebpf plugin: Map \"%s\" has %" PRIu32 " byte values, but only "
+          "32 and 64 bit integers are supported.",
+          m->name, m->value_size);
+    return EINVAL;
+  }
+  if (((m->key_format == KEY_NUMBER) || (m->key_format == KEY_LOG2)) &&
+      (m->key_size != 1) && (m->key_size != 2) && (m->key_size != 4) &&
+      (m->key_size != 8)) {
+    ERROR("ebpf plugin: Map \"%s\" has %" PRIu32 " byte keys, which can not "
+          "be formatted as a number. Use KeyFormat \"Hex\" instead.",
+          m->name, m->key_size);
+    return EINVAL;
+  }
+
+  /* Per-CPU maps return one value per possible CPU, each padded to eight
+   * bytes. */
+  m->values_num = 1;
+  m->value_stride = m->value_size;
+  if (ebpf_map_is_percpu(bpf_map__type(map))) {
+    m->values_num = libbpf_num_possible_cpus();
+    if (m->values_num <= 0) {
+      ERROR("ebpf plugin: libbpf_num_possible_cpus failed.");
+      return EINVAL;
+    }
+    m->value_stride = (m->value_size + 7) & ~7u;
+  }
+
+  m->batch_size = bpf_map__max_entries(map);
+  if ((m->batch_size == 0) || (m->batch_size > EBPF_BATCH_MAX))
+    m->batch_size = EBPF_BATCH_MAX;
+
+  size_t token_size = (m->key_size > 8) ? m->key_size : 8;
+  m->keys = calloc(m->batch_size, m->key_size);
+  m->values =
+      calloc(m->batch_size, (size_t)m->values_num * m->value_stride);
+  m->token_in = calloc(1, token_size);
+  m->token_out = calloc(1, token_size);
+  if ((m->keys == NULL) || (m->values == NULL) || (m->token_in == NULL) ||
+      (m->token_out == NULL)) {
+    ERROR("ebpf plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  if (m->plugin_instance == NULL) {
+    m->plugin_instance = strdup(o->name);
+    if (m->plugin_instance == NULL)
+      return ENOMEM;
+  }
+
+  return 0;
+}
+
+static int ebpf_object_load(ebpf_object_t *o) {
+  struct bpf_object *obj = bpf_object__open_file(o->file, NULL);
+  long err = libbpf_get_error(obj);
+  if (err != 0) {
+    ERROR("ebpf plugin: Opening \"%s\" failed: %s", o->file,
+          STRERROR((int)-err));
+    return (int)-err;
+  }
+  o->obj = obj;
+
+  int status = bpf_object__load(o->obj);
+  if (status != 0) {
+    status = (status < 0) ? -status : errno;
+    ERROR("ebpf plugin: Loading \"%s\" failed: %s", o->file,
+          STRERROR(status));
+    return status;
+  }
+
+  status = ebpf_attach_all(o);
+  if (status != 0)
+    return status;
+
+  for (ebpf_map_t *m = o->maps; m != NULL; m = m->next) {
+    status = ebpf_map_init(o, m);
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+}
+
+/*
+ * Reading
+ */
+static uint64_t ebpf_key_number(ebpf_map_t const *m, void const *key) {
+  switch (m->key_size) {
+  case 1:
+    return *(uint8_t const *)key;
+  case 2: {
+    uint16_t v;
+    memcpy(&v, key, sizeof(v));
+    return v;
+  }
+  case 4: {
+    uint32_t v;
+    memcpy(&v, key, sizeof(v));
+    return v;
+  }
+  default: {
+    uint64_t v;
+    memcpy(&v, key, sizeof(v));
+    return v;
+  }
+  }
+}
+
+static void ebpf_format_key(ebpf_map_t const *m, void const *key,
+                            char *buffer, size_t buffer_size) {
+  size_t offset = 0;
+  if (m->type_instance_prefix != NULL) {
+    sstrncpy(buffer, m->type_instance_prefix, buffer_size);
+    offset = strlen(buffer);
+  }
+
+  switch (m->key_format) {
+  case KEY_NUMBER:
+    snprintf(buffer + offset, buffer_size - offset, "%" PRIu64,
+             ebpf_key_number(m, key));
+    break;
+  case KEY_LOG2: {
+    /* Slot n counts values in [2^(n-1), 2^n); slot 0 counts zeros. Report
+     * the bucket's lower bound. */
+    uint64_t slot = ebpf_key_number(m, key);
+    uint64_t bound = 0;
+    if ((slot > 0) && (slot <= 64))
+      bound = ((uint64_t)1) << (slot - 1);
+    snprintf(buffer + offset, buffer_size - offset, "%" PRIu64, bound);
+    break;
+  }
+  case KEY_STRING: {
+    size_t len = strnlen(key, m->key_size);
+    if (len > buffer_size - offset - 1)
+      len = buffer_size - offset - 1;
+    memcpy(buffer + offset, key, len);
+    buffer[offset + len] = 0;
+    break;
+  }
+  case KEY_HEX:
+    for (uint32_t i = 0; (i < m->key_size) && (offset + 3 <= buffer_size);
+         i++)
+      offset += snprintf(buffer + offset, buffer_size - offset, "%02x",
+                         ((uint8_t const *)key)[i]);
+    break;
+  }
+}
+
+static uint64_t ebpf_value_sum(ebpf_map_t const *m, uint8_t const *value) {
+  uint64_t sum = 0;
+
+  for (int i = 0; i < m->values_num; i++) {
+    uint8_t const *v = value + (size_t)i * m->value_stride;
+    if (m->value_size == sizeof(uint32_t)) {
+      uint32_t tmp;
+      memcpy(&tmp, v, sizeof(tmp));
+      sum += tmp;
+    } else {
+      uint64_t tmp;
+      memcpy(&tmp, v, sizeof(tmp));
+      sum += tmp;
+    }
+  }
+
+  return sum;
+}
+
+static void ebpf_submit(ebpf_map_t const *m, void const *key,
+                        uint8_t const *value) {
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t v;
+  uint64_t sum = ebpf_value_sum(m, value);
+
+  switch (m->ds_type) {
+  case DS_TYPE_COUNTER:
+    v.counter = (counter_t)sum;
+    break;
+  case DS_TYPE_DERIVE:
+    v.derive = (derive_t)sum;
+    break;
+  case DS_TYPE_ABSOLUTE:
+    v.absolute = (absolute_t)sum;
+    break;
+  default:
+    v.gauge = (gauge_t)sum;
+    break;
+  }
+  vl.values = &v;
+  vl.values_len = 1;
+
+  sstrncpy(vl.plugin, "ebpf", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, m->plugin_instance,
+           sizeof(vl.plugin_instance));
+  sstrncpy(vl.type, m->type, sizeof(vl.type));
+  ebpf_format_key(m, key, vl.type_instance, sizeof(vl.type_instance));
+
+  plugin_dispatch_values(&vl);
+}
+
+/* Walks the map one key at a time. Used with kernels and map types that do
+ * not support BPF_MAP_LOOKUP_BATCH. */
+static int ebpf_read_map_iter(ebpf_map_t *m) {
+  void *prev = NULL;
+
+  while (bpf_map_get_next_key(m->fd, prev, m->keys) == 0) {
+    if (bpf_map_lookup_elem(m->fd, m->keys, m->values) == 0)
+      ebpf_submit(m, m->keys, m->values);
+
+    memcpy(m->token_in, m->keys, m->key_size);
+    prev = m->token_in;
+  }
+
+  if (errno != ENOENT) {
+    ERROR("ebpf plugin: Iterating map \"%s\" failed: %s", m->name, STRERRNO);
+    return errno;
+  }
+
+  return 0;
+}
+
+static int ebpf_read_map(ebpf_map_t *m) {
+  if (m->no_batch)
+    return ebpf_read_map_iter(m);
+
+  size_t value_size = (size_t)m->values_num * m->value_stride;
+  void *in = NULL;
+
+  while (true) {
+    uint32_t count = m->batch_size;
+    int status = bpf_map_lookup_batch(m->fd, in, m->token_out, m->keys,
+                                      m->values, &count, NULL);
+    int err = (status != 0) ? errno : 0;
+
+    if ((err != 0) && (err != ENOENT)) {
+      if ((in == NULL) && ((err == EINVAL) || (err == ENOTSUPP) ||
+                           (err == ENOTSUP) || (err == ENOSYS))) {
+        INFO("ebpf plugin: Batch lookups are not supported for map \"%s\", "
+             "falling back to iterating over keys.",
+             m->name);
+        m->no_batch = true;
+        return ebpf_read_map_iter(m);
+      }
+      ERROR("ebpf plugin: bpf_map_lookup_batch(\"%s\") failed: %s", m->name,
+            STRERROR(err));
+      return err;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+      ebpf_submit(m, (uint8_t *)m->keys + (size_t)i * m->key_size,
+                  (uint8_t *)m->values + (size_t)i * value_size);
+
+    /* ENOENT signals that the last batch has been returned. */
+    if (err == ENOENT)
+      return 0;
+
+    void *tmp = m->token_in;
+    m->token_in = m->token_out;
+    m->token_out = tmp;
+    in = m->token_in;
+  }
+}
+
+static int ebpf_read(user_data_t *ud) {
+  ebpf_object_t *o = ud->data;
+  int errors = 0;
+
+  for (ebpf_map_t *m = o->maps; m != NULL; m = m->next)
+    if (ebpf_read_map(m) != 0)
+      errors++;
+
+  return (errors == 0) ? 0 : -1;
+}
+
+static int ebpf_init(void) {
+  libbpf_set_print(ebpf_libbpf_print);
+
+  /* Kernels before 5.11 account BPF memory against RLIMIT_MEMLOCK. */
+  struct rlimit rl = {.rlim_cur = RLIM_INFINITY, .rlim_max = RLIM_INFINITY};
+  if (setrlimit(RLIMIT_MEMLOCK, &rl) != 0)
+    WARNING("ebpf plugin: Raising RLIMIT_MEMLOCK failed: %s", STRERRNO);
+
+  while (objects_g != NULL) {
+    ebpf_object_t *o = objects_g;
+    objects_g = o->next;
+    o->next = NULL;
+
+    if (ebpf_object_load(o) != 0) {
+      ebpf_object_free(o);
+      continue;
+    }
+
+    char cb_name[DATA_MAX_NAME_LEN];
+    snprintf(cb_name, sizeof(cb_name), "ebpf/%s", o->name);
+
+    int status = plugin_register_complex_read(
+        /* group = */ "ebpf", cb_name, ebpf_read, o->interval,
+        &(user_data_t){
+            .data = o, .free_func = ebpf_object_free,
+        });
+    if (status != 0)
+      ERROR("ebpf plugin: Registering read callback \"%s\" failed.", cb_name);
+  }
+
+  return 0;
+}
+
+static int ebpf_shutdown(void) {
+  while (objects_g != NULL) {
+    ebpf_object_t *o = objects_g;
+    objects_g = o->next;
+    ebpf_object_free(o);
+  }
+
+  return 0;
+}
+
+void module_register(void) {
+  plugin_register_complex_config("ebpf", ebpf_config);
+  plugin_register_init("ebpf", ebpf_init);
+  plugin_register_shutdown("ebpf", ebpf_shutdown);
+}
@@ -43,11 +43,18 @@
 #include "common.h"
 #include "plugin.h"
 
+#include "utils_atomic.h"
+
 #include <stddef.h>
 
-#include <sys/select.h>
 #include <sys/un.h>
 
+#if HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
 /* some systems (e.g. Darwin) seem to not define UNIX_PATH_MAX at all */
 #ifndef UNIX_PATH_MAX
 #define UNIX_PATH_MAX sizeof(((struct sockaddr_un *)0)->sun_path)
@@ -60,6 +67,9 @@
 #define SOCK_PATH LOCALSTATEDIR "/run/" PACKAGE_NAME "-email"
 #define MAX_CONNS 5
 #define MAX_CONNS_LIMIT 16384
+#define THREADS 1
+#define THREADS_LIMIT 64
+#define MAX_EVENTS 32
 
 #define log_debug(...) DEBUG("email: "__VA_ARGS__)
 #define log_err(...) ERROR("email: "__VA_ARGS__)
@@ -80,34 +90,61 @@ typedef struct {
   type_t *tail;
 } type_list_t;
 
-/* collector thread control information */
-typedef struct collector {
-  pthread_t thread;
+/* a connection served by one of the workers */
+typedef struct conn {
+  int fd;
 
-  /* socket descriptor of the current/last connection */
-  FILE *socket;
-} collector_t;
+  /* position in the worker's list of connections */
+  size_t index;
 
-/* linked list of pending connections */
-typedef struct conn {
-  /* socket to read data from */
-  FILE *socket;
+  /* partial line read from the socket so far;
+   * 256 bytes ought to be enough for anybody ;-) */
+  char buffer[256 + 1]; /* line + '\0' */
+  size_t buffer_fill;
 
-  /* linked list of connections */
-  struct conn *next;
+  /* set while skipping the remainder of an overlong line */
+  bool discard;
 } conn_t;
 
+/* Counters updated by a single worker. Only email_read() takes the lock in
+ * addition to the owning worker, so updates are practically uncontended. */
 typedef struct {
-  conn_t *head;
-  conn_t *tail;
-} conn_list_t;
+  pthread_mutex_t lock;
+
+  type_list_t count;
+  type_list_t size;
+  type_list_t check;
+
+  double score_sum;
+  int score_count;
+} shard_t;
+
+/* worker thread control information */
+typedef struct {
+  pthread_t thread;
+  bool thread_running;
+
+#if HAVE_SYS_EPOLL_H
+  int epoll_fd;
+#else
+  struct pollfd *pollfds;
+  size_t pollfds_size;
+#endif
+  /* whether the listening socket is part of the watched descriptors */
+  bool listening;
+
+  conn_t **conns;
+  size_t conns_num;
+
+  shard_t shard;
+} worker_t;
 
 /*
  * Private variables
  */
 /* valid configuration file keys */
 static const char *config_keys[] = {"SocketFile", "SocketGroup", "SocketPerms",
-                                    "MaxConns"};
+                                    "MaxConns", "Threads"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 /* socket configuration */
@@ -115,45 +152,28 @@ static char *sock_file;
 static char *sock_group;
 static int sock_perms = S_IRWXU | S_IRWXG;
 static int max_conns = MAX_CONNS;
+static int threads_num = THREADS;
 
 /* state of the plugin */
 static int disabled;
+static int worker_loop;
 
-/* thread managing "client" connections */
-static pthread_t connector = (pthread_t)0;
 static int connector_socket = -1;
 
-/* tell the collector threads that a new connection is available */
-static pthread_cond_t conn_available = PTHREAD_COND_INITIALIZER;
+/* written to on shutdown; the read end is watched by all workers */
+static int wake_pipe[2] = {-1, -1};
 
-/* connections that are waiting to be processed */
-static pthread_mutex_t conns_mutex = PTHREAD_MUTEX_INITIALIZER;
-static conn_list_t conns;
+/* worker threads */
+static worker_t *workers;
+static int workers_num;
 
-/* tell the connector thread that a collector is available */
-static pthread_cond_t collector_available = PTHREAD_COND_INITIALIZER;
+/* number of currently open connections, bounded by max_conns */
+static int conns_open;
 
-/* collector threads */
-static collector_t **collectors;
-
-static pthread_mutex_t available_mutex = PTHREAD_MUTEX_INITIALIZER;
-static int available_collectors;
-
-static pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* sums of all shards, submitted by email_read() */
 static type_list_t list_count;
-static type_list_t list_count_copy;
-
-static pthread_mutex_t size_mutex = PTHREAD_MUTEX_INITIALIZER;
 static type_list_t list_size;
-static type_list_t list_size_copy;
-
-static pthread_mutex_t score_mutex = PTHREAD_MUTEX_INITIALIZER;
-static double score;
-static int score_count;
-
-static pthread_mutex_t check_mutex = PTHREAD_MUTEX_INITIALIZER;
 static type_list_t list_check;
-static type_list_t list_check_copy;
 
 /*
  * Private functions
@@ -192,6 +212,17 @@ static int email_config(const char *key, const char *value) {
     } else {
       max_conns = (int)tmp;
     }
+  } else if (strcasecmp(key, "Threads") == 0) {
+    long int tmp = strtol(value, NULL, 0);
+
+    if ((tmp < 1) || (tmp > THREADS_LIMIT)) {
+      ERROR("email plugin: `Threads' must be between 1 and %i, "
+            "will use default %i.",
+            THREADS_LIMIT, THREADS);
+      threads_num = THREADS;
+    } else {
+      threads_num = (int)tmp;
+    }
   } else {
     return -1;
   }
@@ -230,142 +261,314 @@ static void type_list_incr(type_list_t *list, char *name, int incr) {
   return;
 } /* static void type_list_incr (type_list_t *, char *) */
 
-static void *collect(void *arg) {
-  collector_t *this = (collector_t *)arg;
+/* Handle a single line of the protocol. Called with the shard locked. */
+static void handle_line(shard_t *shard, char *line, size_t len) {
+  if (len < 2) { /* [a-z] ':' */
+    return;
+  }
+
+  log_debug("collect: line = '%s'", line);
+
+  if (line[1] != ':') {
+    log_err("collect: syntax error in line '%s'", line);
+    return;
+  }
+
+  if (line[0] == 'e') { /* e:<type>:<bytes> */
+    char *type = line + 2;
+    char *bytes_str = strchr(type, ':');
+    if (bytes_str == NULL) {
+      log_err("collect: syntax error in line '%s'", line);
+      return;
+    }
 
-  while (1) {
-    conn_t *connection;
+    *bytes_str = 0;
+    bytes_str++;
 
-    pthread_mutex_lock(&conns_mutex);
+    type_list_incr(&shard->count, type, /* increment = */ 1);
 
-    while (conns.head == NULL) {
-      pthread_cond_wait(&conn_available, &conns_mutex);
+    int bytes = atoi(bytes_str);
+    if (bytes > 0) {
+      type_list_incr(&shard->size, type, /* increment = */ bytes);
+    }
+  } else if (line[0] == 's') { /* s:<value> */
+    shard->score_sum += atof(line + 2);
+    ++shard->score_count;
+  } else if (line[0] == 'c') { /* c:<type1>[,<type2>,...] */
+    char *dummy = line + 2;
+    char *endptr = NULL;
+    char *type;
+
+    while ((type = strtok_r(dummy, ",", &endptr)) != NULL) {
+      dummy = NULL;
+      type_list_incr(&shard->check, type, /* increment = */ 1);
+    }
+  } else {
+    log_err("collect: unknown type '%c'", line[0]);
+  }
+} /* static void handle_line (shard_t *, char *, size_t) */
+
+/* Split the data read from a connection into lines. Incomplete lines are
+ * kept in the connection's buffer until the rest arrives. */
+static void conn_feed(shard_t *shard, conn_t *c, const char *data,
+                      size_t data_len) {
+  for (size_t i = 0; i < data_len; i++) {
+    if ((data[i] == '\n') || (data[i] == '\r')) {
+      if (!c->discard) {
+        c->buffer[c->buffer_fill] = 0;
+        handle_line(shard, c->buffer, c->buffer_fill);
+      }
+      c->buffer_fill = 0;
+      c->discard = false;
+      continue;
     }
 
-    connection = conns.head;
-    conns.head = conns.head->next;
+    if (c->discard)
+      continue;
 
-    if (conns.head == NULL) {
-      conns.tail = NULL;
+    /* leave room for the line terminator, as fgets(3) used to */
+    if (c->buffer_fill >= sizeof(c->buffer) - 2) {
+      c->buffer[c->buffer_fill] = 0;
+      log_warn("collect: line too long (> %" PRIsz " characters): "
+               "'%s' (truncated)",
+               sizeof(c->buffer) - 1, c->buffer);
+      c->buffer_fill = 0;
+      c->discard = true;
+      continue;
     }
 
-    pthread_mutex_unlock(&conns_mutex);
+    c->buffer[c->buffer_fill] = data[i];
+    c->buffer_fill++;
+  }
+} /* static void conn_feed */
 
-    /* make the socket available to the global
-     * thread and connection management */
-    this->socket = connection->socket;
+/* Returns zero if the connection is to be kept open. */
+static int conn_read(worker_t *w, conn_t *c) {
+  char buffer[4096];
+  ssize_t status;
 
-    log_debug("collect: handling connection on fd #%i", fileno(this->socket));
+  do {
+    status = read(c->fd, buffer, sizeof(buffer));
+  } while ((status < 0) && (errno == EINTR));
 
-    while (42) {
-      /* 256 bytes ought to be enough for anybody ;-) */
-      char line[256 + 1]; /* line + '\0' */
+  if (status < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      return 0;
 
-      errno = 0;
-      if (fgets(line, sizeof(line), this->socket) == NULL) {
-        if (errno != 0) {
-          log_err("collect: reading from socket (fd #%i) "
-                  "failed: %s",
-                  fileno(this->socket), STRERRNO);
-        }
-        break;
-      }
+    log_err("collect: reading from socket (fd #%i) failed: %s", c->fd,
+            STRERRNO);
+    return -1;
+  } else if (status == 0) {
+    return -1;
+  }
 
-      size_t len = strlen(line);
-      if ((line[len - 1] != '\n') && (line[len - 1] != '\r')) {
-        log_warn("collect: line too long (> %" PRIsz " characters): "
-                 "'%s' (truncated)",
-                 sizeof(line) - 1, line);
+  pthread_mutex_lock(&w->shard.lock);
+  conn_feed(&w->shard, c, buffer, (size_t)status);
+  pthread_mutex_unlock(&w->shard.lock);
 
-        while (fgets(line, sizeof(line), this->socket) != NULL)
-          if ((line[len - 1] == '\n') || (line[len - 1] == '\r'))
-            break;
-        continue;
-      }
-      if (len < 3) { /* [a-z] ':' '\n' */
-        continue;
-      }
+  return 0;
+} /* static int conn_read */
+
+static int conn_add(worker_t *w, int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if ((flags == -1) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)) {
+    log_err("fcntl() failed: %s", STRERRNO);
+    return -1;
+  }
 
-      line[len - 1] = '\0';
+  conn_t **tmp = realloc(w->conns, (w->conns_num + 1) * sizeof(*w->conns));
+  if (tmp == NULL)
+    return ENOMEM;
+  w->conns = tmp;
 
-      log_debug("collect: line = '%s'", line);
+  conn_t *c = calloc(1, sizeof(*c));
+  if (c == NULL)
+    return ENOMEM;
+  c->fd = fd;
+  c->index = w->conns_num;
 
-      if (line[1] != ':') {
-        log_err("collect: syntax error in line '%s'", line);
+#if HAVE_SYS_EPOLL_H
+  struct epoll_event ev = {
+      .events = EPOLLIN, .data.ptr = c,
+  };
+  if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    log_err("epoll_ctl() failed: %s", STRERRNO);
+    sfree(c);
+    return -1;
+  }
+#endif
+
+  w->conns[w->conns_num] = c;
+  w->conns_num++;
+
+  log_debug("collect: handling connection on fd #%i", fd);
+  return 0;
+} /* static int conn_add */
+
+static void conn_remove(worker_t *w, conn_t *c) {
+  log_debug("Shutting down connection on fd #%i", c->fd);
+
+  /* closing the descriptor removes it from the epoll set, too */
+  close(c->fd);
+
+  w->conns_num--;
+  if (c->index != w->conns_num) {
+    w->conns[c->index] = w->conns[w->conns_num];
+    w->conns[c->index]->index = c->index;
+  }
+  sfree(c);
+
+  C_ATOMIC_SUB(&conns_open, 1);
+} /* static void conn_remove */
+
+/* Accept all pending connections as long as the limit permits. */
+static void conn_accept(worker_t *w) {
+  while (42) {
+    if (C_ATOMIC_ADD(&conns_open, 1) > max_conns) {
+      C_ATOMIC_SUB(&conns_open, 1);
+      return;
+    }
+
+    int remote = accept(connector_socket, NULL, NULL);
+    if (remote == -1) {
+      C_ATOMIC_SUB(&conns_open, 1);
+      if (errno == EINTR)
         continue;
-      }
+      /* another worker was faster or the client went away */
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+          (errno == ECONNABORTED))
+        return;
+
+      C_ATOMIC_STORE(&disabled, 1);
+      log_err("accept() failed: %s", STRERRNO);
+      return;
+    }
 
-      if (line[0] == 'e') { /* e:<type>:<bytes> */
-        char *type = line + 2;
-        char *bytes_str = strchr(type, ':');
-        if (bytes_str == NULL) {
-          log_err("collect: syntax error in line '%s'", line);
-          continue;
-        }
-
-        *bytes_str = 0;
-        bytes_str++;
-
-        pthread_mutex_lock(&count_mutex);
-        type_list_incr(&list_count, type, /* increment = */ 1);
-        pthread_mutex_unlock(&count_mutex);
-
-        int bytes = atoi(bytes_str);
-        if (bytes > 0) {
-          pthread_mutex_lock(&size_mutex);
-          type_list_incr(&list_size, type, /* increment = */ bytes);
-          pthread_mutex_unlock(&size_mutex);
-        }
-      } else if (line[0] == 's') { /* s:<value> */
-        pthread_mutex_lock(&score_mutex);
-        score = (score * (double)score_count + atof(line + 2)) /
-                (double)(score_count + 1);
-        ++score_count;
-        pthread_mutex_unlock(&score_mutex);
-      } else if (line[0] == 'c') { /* c:<type1>[,<type2>,...] */
-        char *dummy = line + 2;
-        char *endptr = NULL;
-        char *type;
-
-        pthread_mutex_lock(&check_mutex);
-        while ((type = strtok_r(dummy, ",", &endptr)) != NULL) {
-          dummy = NULL;
-          type_list_incr(&list_check, type, /* increment = */ 1);
-        }
-        pthread_mutex_unlock(&check_mutex);
-      } else {
-        log_err("collect: unknown type '%c'", line[0]);
-      }
-    } /* while (42) */
+    if (conn_add(w, remote) != 0) {
+      close(remote);
+      C_ATOMIC_SUB(&conns_open, 1);
+    }
+  }
+} /* static void conn_accept */
 
-    log_debug("Shutting down connection on fd #%i", fileno(this->socket));
+/* Stop watching the listening socket while the connection limit is reached,
+ * so pending connections wait in the backlog. */
+static bool worker_accepting(void) {
+  return !C_ATOMIC_LOAD(&disabled) &&
+         (C_ATOMIC_LOAD(&conns_open) < max_conns);
+}
 
-    fclose(connection->socket);
-    free(connection);
+#if HAVE_SYS_EPOLL_H
+static int worker_wait(worker_t *w) {
+  bool accepting = worker_accepting();
+  if (accepting != w->listening) {
+    struct epoll_event ev = {
+        .events = EPOLLIN, .data.ptr = NULL,
+    };
+#ifdef EPOLLEXCLUSIVE
+    /* only wake one of the workers for a new connection */
+    ev.events |= EPOLLEXCLUSIVE;
+#endif
+    if (epoll_ctl(w->epoll_fd, accepting ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                  connector_socket, &ev) == 0)
+      w->listening = accepting;
+  }
 
-    this->socket = NULL;
+  struct epoll_event events[MAX_EVENTS];
+  int num = epoll_wait(w->epoll_fd, events, STATIC_ARRAY_SIZE(events), -1);
+  if (num < 0) {
+    if (errno == EINTR)
+      return 0;
+    log_err("epoll_wait() failed: %s", STRERRNO);
+    return -1;
+  }
 
-    pthread_mutex_lock(&available_mutex);
-    ++available_collectors;
-    pthread_mutex_unlock(&available_mutex);
+  bool pending = false;
+  for (int i = 0; i < num; i++) {
+    conn_t *c = events[i].data.ptr;
 
-    pthread_cond_signal(&collector_available);
-  } /* while (1) */
+    if (c == (void *)wake_pipe)
+      continue;
+    if (c == NULL) {
+      pending = true;
+      continue;
+    }
+
+    if (conn_read(w, c) != 0)
+      conn_remove(w, c);
+  }
+
+  if (pending)
+    conn_accept(w);
+  return 0;
+} /* static int worker_wait */
+#else  /* !HAVE_SYS_EPOLL_H */
+static int worker_wait(worker_t *w) {
+  size_t num = w->conns_num;
+
+  if (w->pollfds_size < num + 2) {
+    struct pollfd *tmp = realloc(w->pollfds, (num + 2) * sizeof(*tmp));
+    if (tmp == NULL) {
+      log_err("realloc() failed.");
+      return -1;
+    }
+    w->pollfds = tmp;
+    w->pollfds_size = num + 2;
+  }
+
+  w->pollfds[0] = (struct pollfd){.fd = wake_pipe[0], .events = POLLIN};
+  w->listening = worker_accepting();
+  w->pollfds[1] = (struct pollfd){
+      .fd = w->listening ? connector_socket : -1, .events = POLLIN,
+  };
+  for (size_t i = 0; i < num; i++)
+    w->pollfds[i + 2] = (struct pollfd){.fd = w->conns[i]->fd,
+                                        .events = POLLIN};
+
+  if (poll(w->pollfds, num + 2, -1) < 0) {
+    if (errno == EINTR)
+      return 0;
+    log_err("poll() failed: %s", STRERRNO);
+    return -1;
+  }
+
+  /* Walk backwards: removing a connection moves the last one into its
+   * place, which has already been handled then. */
+  for (size_t i = num; i > 0; i--) {
+    if (w->pollfds[i + 1].revents == 0)
+      continue;
+
+    conn_t *c = w->conns[i - 1];
+    if (conn_read(w, c) != 0)
+      conn_remove(w, c);
+  }
+
+  if (w->pollfds[1].revents != 0)
+    conn_accept(w);
+  return 0;
+} /* static int worker_wait */
+#endif /* HAVE_SYS_EPOLL_H */
+
+static void *worker_thread(void *arg) {
+  worker_t *w = arg;
+
+  while (C_ATOMIC_LOAD(&worker_loop)) {
+    if (worker_wait(w) != 0)
+      break;
+  }
 
-  pthread_exit((void *)0);
   return (void *)0;
-} /* static void *collect (void *) */
+} /* static void *worker_thread (void *) */
 
-static void *open_connection(void __attribute__((unused)) * arg) {
+static int open_connection(void) {
   const char *path = (NULL == sock_file) ? SOCK_PATH : sock_file;
   const char *group = (NULL == sock_group) ? COLLECTD_GRP_NAME : sock_group;
 
   /* create UNIX socket */
   errno = 0;
   if ((connector_socket = socket(PF_UNIX, SOCK_STREAM, 0)) == -1) {
-    disabled = 1;
     log_err("socket() failed: %s", STRERRNO);
-    pthread_exit((void *)1);
+    return -1;
   }
 
   struct sockaddr_un addr = {
@@ -377,20 +580,28 @@ static void *open_connection(void __attribute__((unused)) * arg) {
   if (bind(connector_socket, (struct sockaddr *)&addr,
            offsetof(struct sockaddr_un, sun_path) + strlen(addr.sun_path)) ==
       -1) {
-    disabled = 1;
     close(connector_socket);
     connector_socket = -1;
     log_err("bind() failed: %s", STRERRNO);
-    pthread_exit((void *)1);
+    return -1;
   }
 
   errno = 0;
   if (listen(connector_socket, 5) == -1) {
-    disabled = 1;
     close(connector_socket);
     connector_socket = -1;
     log_err("listen() failed: %s", STRERRNO);
-    pthread_exit((void *)1);
+    return -1;
+  }
+
+  /* all workers may be woken up for the same connection */
+  int flags = fcntl(connector_socket, F_GETFL);
+  if ((flags == -1) ||
+      (fcntl(connector_socket, F_SETFL, flags | O_NONBLOCK) != 0)) {
+    close(connector_socket);
+    connector_socket = -1;
+    log_err("fcntl() failed: %s", STRERRNO);
+    return -1;
   }
 
   {
@@ -425,106 +636,71 @@ static void *open_connection(void __attribute__((unused)) * arg) {
     log_warn("chmod() failed: %s", STRERRNO);
   }
 
-  { /* initialize collector threads */
-    pthread_attr_t ptattr;
-
-    conns.head = NULL;
-    conns.tail = NULL;
-
-    pthread_attr_init(&ptattr);
-    pthread_attr_setdetachstate(&ptattr, PTHREAD_CREATE_DETACHED);
-
-    available_collectors = max_conns;
-
-    collectors = smalloc(max_conns * sizeof(*collectors));
-
-    for (int i = 0; i < max_conns; ++i) {
-      collectors[i] = smalloc(sizeof(*collectors[i]));
-      collectors[i]->socket = NULL;
+  return 0;
+} /* static int open_connection (void) */
 
-      if (plugin_thread_create(&collectors[i]->thread, &ptattr, collect,
-                               collectors[i], "email collector") != 0) {
-        log_err("plugin_thread_create() failed: %s", STRERRNO);
-        collectors[i]->thread = (pthread_t)0;
-      }
-    }
+static int worker_start(worker_t *w) {
+  pthread_mutex_init(&w->shard.lock, /* attr = */ NULL);
 
-    pthread_attr_destroy(&ptattr);
+#if HAVE_SYS_EPOLL_H
+  w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (w->epoll_fd < 0) {
+    log_err("epoll_create1() failed: %s", STRERRNO);
+    return -1;
   }
 
-  while (1) {
-    int remote = 0;
-
-    conn_t *connection;
-
-    pthread_mutex_lock(&available_mutex);
-
-    while (available_collectors == 0) {
-      pthread_cond_wait(&collector_available, &available_mutex);
-    }
+  /* the pipe is never read from, so it stays readable after shutdown */
+  struct epoll_event ev = {
+      .events = EPOLLIN, .data.ptr = (void *)wake_pipe,
+  };
+  if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, wake_pipe[0], &ev) != 0) {
+    log_err("epoll_ctl() failed: %s", STRERRNO);
+    return -1;
+  }
+#endif
 
-    --available_collectors;
+  if (plugin_thread_create(&w->thread, /* attr = */ NULL, worker_thread, w,
+                           "email worker") != 0) {
+    log_err("plugin_thread_create() failed: %s", STRERRNO);
+    return -1;
+  }
+  w->thread_running = true;
 
-    pthread_mutex_unlock(&available_mutex);
+  return 0;
+} /* static int worker_start */
 
-    while (42) {
-      errno = 0;
+static int email_init(void) {
+  if (open_connection() != 0) {
+    disabled = 1;
+    return -1;
+  }
 
-      remote = accept(connector_socket, NULL, NULL);
-      if (remote == -1) {
-        if (errno == EINTR)
-          continue;
+  if (pipe(wake_pipe) != 0) {
+    disabled = 1;
+    log_err("pipe() failed: %s", STRERRNO);
+    return -1;
+  }
 
-        disabled = 1;
-        close(connector_socket);
-        connector_socket = -1;
-        log_err("accept() failed: %s", STRERRNO);
-        pthread_exit((void *)1);
-      }
+  workers = calloc(threads_num, sizeof(*workers));
+  if (workers == NULL) {
+    disabled = 1;
+    log_err("calloc() failed.");
+    return -1;
+  }
 
-      /* access() succeeded. */
+  worker_loop = 1;
+  for (workers_num = 0; workers_num < threads_num; workers_num++) {
+#if HAVE_SYS_EPOLL_H
+    workers[workers_num].epoll_fd = -1;
+#endif
+    if (worker_start(workers + workers_num) != 0) {
+      workers_num++;
       break;
     }
-
-    connection = calloc(1, sizeof(*connection));
-    if (connection == NULL) {
-      close(remote);
-      continue;
-    }
-
-    connection->socket = fdopen(remote, "r");
-    connection->next = NULL;
-
-    if (connection->socket == NULL) {
-      close(remote);
-      sfree(connection);
-      continue;
-    }
-
-    pthread_mutex_lock(&conns_mutex);
-
-    if (conns.head == NULL) {
-      conns.head = connection;
-      conns.tail = connection;
-    } else {
-      conns.tail->next = connection;
-      conns.tail = conns.tail->next;
-    }
-
-    pthread_mutex_unlock(&conns_mutex);
-
-    pthread_cond_signal(&conn_available);
   }
 
-  pthread_exit((void *)0);
-  return (void *)0;
-} /* static void *open_connection (void *) */
-
-static int email_init(void) {
-  if (plugin_thread_create(&connector, NULL, open_connection, NULL,
-                           "email listener") != 0) {
+  if (!workers[0].thread_running) {
     disabled = 1;
-    log_err("plugin_thread_create() failed: %s", STRERRNO);
     return -1;
   }
 
@@ -549,49 +725,55 @@ static void type_list_free(type_list_t *t) {
 }
 
 static int email_shutdown(void) {
-  if (connector != ((pthread_t)0)) {
-    pthread_kill(connector, SIGTERM);
-    connector = (pthread_t)0;
-  }
+  C_ATOMIC_STORE(&worker_loop, 0);
 
-  if (connector_socket >= 0) {
-    close(connector_socket);
-    connector_socket = -1;
+  if (wake_pipe[1] >= 0) {
+    if (write(wake_pipe[1], "x", 1) != 1)
+      log_warn("write() failed: %s", STRERRNO);
   }
 
-  /* don't allow any more connections to be processed */
-  pthread_mutex_lock(&conns_mutex);
+  for (int i = 0; i < workers_num; i++) {
+    worker_t *w = workers + i;
 
-  available_collectors = 0;
-
-  if (collectors != NULL) {
-    for (int i = 0; i < max_conns; ++i) {
-      if (collectors[i] == NULL)
-        continue;
-
-      if (collectors[i]->thread != ((pthread_t)0)) {
-        pthread_kill(collectors[i]->thread, SIGTERM);
-        collectors[i]->thread = (pthread_t)0;
-      }
+    if (w->thread_running) {
+      pthread_join(w->thread, /* retval = */ NULL);
+      w->thread_running = false;
+    }
 
-      if (collectors[i]->socket != NULL) {
-        fclose(collectors[i]->socket);
-        collectors[i]->socket = NULL;
-      }
+    while (w->conns_num > 0)
+      conn_remove(w, w->conns[w->conns_num - 1]);
+    sfree(w->conns);
+
+#if HAVE_SYS_EPOLL_H
+    if (w->epoll_fd >= 0)
+      close(w->epoll_fd);
+#else
+    sfree(w->pollfds);
+#endif
+
+    type_list_free(&w->shard.count);
+    type_list_free(&w->shard.size);
+    type_list_free(&w->shard.check);
+    pthread_mutex_destroy(&w->shard.lock);
+  }
+  sfree(workers);
+  workers_num = 0;
 
-      sfree(collectors[i]);
+  for (int i = 0; i < 2; i++) {
+    if (wake_pipe[i] >= 0) {
+      close(wake_pipe[i]);
+      wake_pipe[i] = -1;
     }
-    sfree(collectors);
-  } /* if (collectors != NULL) */
+  }
 
-  pthread_mutex_unlock(&conns_mutex);
+  if (connector_socket >= 0) {
+    close(connector_socket);
+    connector_socket = -1;
+  }
 
   type_list_free(&list_count);
-  type_list_free(&list_count_copy);
   type_list_free(&list_size);
-  type_list_free(&list_size_copy);
   type_list_free(&list_check);
-  type_list_free(&list_check_copy);
 
   unlink((sock_file == NULL) ? SOCK_PATH : sock_file);
 
@@ -613,89 +795,65 @@ static void email_submit(const char *type, const char *type_instance,
   plugin_dispatch_values(&vl);
 } /* void email_submit */
 
-/* Copy list l1 to list l2. l2 may partly exist already, but it is assumed
- * that neither the order nor the name of any element of either list is
- * changed and no elements are deleted. The values of l1 are reset to zero
- * after they have been copied to l2. */
-static void copy_type_list(type_list_t *l1, type_list_t *l2) {
-  type_t *last = NULL;
-
-  for (type_t *ptr1 = l1->head, *ptr2 = l2->head; ptr1 != NULL;
-       ptr1 = ptr1->next, last = ptr2, ptr2 = ptr2->next) {
-    if (ptr2 == NULL) {
-      ptr2 = smalloc(sizeof(*ptr2));
-      ptr2->name = NULL;
-      ptr2->next = NULL;
-
-      if (last == NULL) {
-        l2->head = ptr2;
-      } else {
-        last->next = ptr2;
-      }
-
-      l2->tail = ptr2;
-    }
-
-    if (ptr2->name == NULL) {
-      ptr2->name = sstrdup(ptr1->name);
-    }
-
-    ptr2->value = ptr1->value;
-    ptr1->value = 0;
+/* Add the values of list l1 to list l2, creating missing elements. The
+ * values of l1 are reset to zero after they have been added to l2. */
+static void merge_type_list(type_list_t *l1, type_list_t *l2) {
+  for (type_t *ptr = l1->head; ptr != NULL; ptr = ptr->next) {
+    type_list_incr(l2, ptr->name, ptr->value);
+    ptr->value = 0;
   }
-  return;
+}
+
+static void reset_type_list(type_list_t *l) {
+  for (type_t *ptr = l->head; ptr != NULL; ptr = ptr->next)
+    ptr->value = 0;
 }
 
 static int email_read(void) {
-  double score_old;
-  int score_count_old;
+  double score_sum = 0.0;
+  int score_count = 0;
 
-  if (disabled)
+  if (C_ATOMIC_LOAD(&disabled))
     return -1;
 
-  /* email count */
-  pthread_mutex_lock(&count_mutex);
+  reset_type_list(&list_count);
+  reset_type_list(&list_size);
+  reset_type_list(&list_check);
 
-  copy_type_list(&list_count, &list_count_copy);
+  /* sum up the shards of all workers */
+  for (int i = 0; i < workers_num; i++) {
+    shard_t *shard = &workers[i].shard;
 
-  pthread_mutex_unlock(&count_mutex);
+    pthread_mutex_lock(&shard->lock);
 
-  for (type_t *ptr = list_count_copy.head; ptr != NULL; ptr = ptr->next) {
-    email_submit("email_count", ptr->name, ptr->value);
-  }
+    merge_type_list(&shard->count, &list_count);
+    merge_type_list(&shard->size, &list_size);
+    merge_type_list(&shard->check, &list_check);
 
-  /* email size */
-  pthread_mutex_lock(&size_mutex);
+    score_sum += shard->score_sum;
+    score_count += shard->score_count;
+    shard->score_sum = 0.0;
+    shard->score_count = 0;
 
-  copy_type_list(&list_size, &list_size_copy);
+    pthread_mutex_unlock(&shard->lock);
+  }
 
-  pthread_mutex_unlock(&size_mutex);
+  /* email count */
+  for (type_t *ptr = list_count.head; ptr != NULL; ptr = ptr->next) {
+    email_submit("email_count", ptr->name, ptr->value);
+  }
 
-  for (type_t *ptr = list_size_copy.head; ptr != NULL; ptr = ptr->next) {
+  /* email size */
+  for (type_t *ptr = list_size.head; ptr != NULL; ptr = ptr->next) {
     email_submit("email_size", ptr->name, ptr->value);
   }
 
   /* spam score */
-  pthread_mutex_lock(&score_mutex);
-
-  score_old = score;
-  score_count_old = score_count;
-  score = 0.0;
-  score_count = 0;
-
-  pthread_mutex_unlock(&score_mutex);
-
-  if (score_count_old > 0)
-    email_submit("spam_score", "", score_old);
+  if (score_count > 0)
+    email_submit("spam_score", "", score_sum / (double)score_count);
 
   /* spam checks */
-  pthread_mutex_lock(&check_mutex);
-
-  copy_type_list(&list_check, &list_check_copy);
-
-  pthread_mutex_unlock(&check_mutex);
-
-  for (type_t *ptr = list_check_copy.head; ptr != NULL; ptr = ptr->next)
+  for (type_t *ptr = list_check.head; ptr != NULL; ptr = ptr->next)
     email_submit("spam_check", ptr->name, ptr->value);
 
   return 0;
@@ -48,31 +48,55 @@ struct value_map_s {
 };
 typedef struct value_map_s value_map_t;
 
-static char **interfaces;
+/* A statistic of an interface, with its name resolved against the map. */
+struct ethstat_stat_s {
+  char name[ETH_GSTRING_LEN + 1];
+  value_map_t const *map;
+  bool ignore;
+};
+typedef struct ethstat_stat_s ethstat_stat_t;
+
+/* The names of an interface's statistics only change along with its driver,
+ * so they are fetched and resolved once and kept along with the buffer for
+ * the values. */
+struct ethstat_interface_s {
+  char *name;
+
+  struct ethtool_drvinfo drvinfo;
+  struct ethtool_stats *stats;
+  ethstat_stat_t *stat_map;
+  size_t n_stats;
+};
+typedef struct ethstat_interface_s ethstat_interface_t;
+
+static ethstat_interface_t *interfaces;
 static size_t interfaces_num;
 
+/* Control socket for the ioctl(2)s, shared by all interfaces */
+static int ethstat_fd = -1;
+
 static c_avl_tree_t *value_map;
 
 static bool collect_mapped_only;
 
 static int ethstat_add_interface(const oconfig_item_t *ci) /* {{{ */
 {
-  char **tmp;
+  ethstat_interface_t *tmp;
   int status;
 
   tmp = realloc(interfaces, sizeof(*interfaces) * (interfaces_num + 1));
   if (tmp == NULL)
     return -1;
   interfaces = tmp;
-  interfaces[interfaces_num] = NULL;
+  memset(interfaces + interfaces_num, 0, sizeof(*interfaces));
 
-  status = cf_util_get_string(ci, interfaces + interfaces_num);
+  status = cf_util_get_string(ci, &interfaces[interfaces_num].name);
   if (status != 0)
     return status;
 
   interfaces_num++;
   INFO("ethstat plugin: Registered interface %s",
-       interfaces[interfaces_num - 1]);
+       interfaces[interfaces_num - 1].name);
 
   return 0;
 } /* }}} int ethstat_add_interface */
@@ -157,141 +181,189 @@ static int ethstat_config(oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} */
 
-static void ethstat_submit_value(const char *device, const char *type_instance,
-                                 derive_t value) {
-  static c_complain_t complain_no_map = C_COMPLAIN_INIT_STATIC;
-
+static void ethstat_submit_value(const char *device,
+                                 ethstat_stat_t const *stat, derive_t value) {
   value_list_t vl = VALUE_LIST_INIT;
-  value_map_t *map = NULL;
-
-  if (value_map != NULL)
-    c_avl_get(value_map, type_instance, (void *)&map);
-
-  /* If the "MappedOnly" option is specified, ignore unmapped values. */
-  if (collect_mapped_only && (map == NULL)) {
-    if (value_map == NULL)
-      c_complain(
-          LOG_WARNING, &complain_no_map,
-          "ethstat plugin: The \"MappedOnly\" option has been set to true, "
-          "but no mapping has been configured. All values will be ignored!");
-    return;
-  }
 
   vl.values = &(value_t){.derive = value};
   vl.values_len = 1;
 
   sstrncpy(vl.plugin, "ethstat", sizeof(vl.plugin));
   sstrncpy(vl.plugin_instance, device, sizeof(vl.plugin_instance));
-  if (map != NULL) {
-    sstrncpy(vl.type, map->type, sizeof(vl.type));
-    sstrncpy(vl.type_instance, map->type_instance, sizeof(vl.type_instance));
+  if (stat->map != NULL) {
+    sstrncpy(vl.type, stat->map->type, sizeof(vl.type));
+    sstrncpy(vl.type_instance, stat->map->type_instance,
+             sizeof(vl.type_instance));
   } else {
     sstrncpy(vl.type, "derive", sizeof(vl.type));
-    sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+    sstrncpy(vl.type_instance, stat->name, sizeof(vl.type_instance));
   }
 
   plugin_dispatch_values(&vl);
 }
 
-static int ethstat_read_interface(char *device) {
-  int fd;
-  struct ethtool_gstrings *strings;
-  struct ethtool_stats *stats;
-  size_t n_stats;
-  size_t strings_size;
-  size_t stats_size;
-  int status;
-
-  fd = socket(AF_INET, SOCK_DGRAM, /* protocol = */ 0);
-  if (fd < 0) {
-    ERROR("ethstat plugin: Failed to open control socket: %s", STRERRNO);
-    return 1;
-  }
-
-  struct ethtool_drvinfo drvinfo = {.cmd = ETHTOOL_GDRVINFO};
-
-  struct ifreq req = {.ifr_data = (void *)&drvinfo};
-
-  sstrncpy(req.ifr_name, device, sizeof(req.ifr_name));
+static void ethstat_interface_clear(ethstat_interface_t *iface) /* {{{ */
+{
+  sfree(iface->stats);
+  sfree(iface->stat_map);
+  iface->n_stats = 0;
+  memset(&iface->drvinfo, 0, sizeof(iface->drvinfo));
+} /* }}} void ethstat_interface_clear */
+
+/* Fetches the names of the statistics and resolves them against the map. */
+static int ethstat_interface_setup(ethstat_interface_t *iface, /* {{{ */
+                                   struct ifreq *req,
+                                   struct ethtool_drvinfo const *drvinfo) {
+  static c_complain_t complain_no_map = C_COMPLAIN_INIT_STATIC;
 
-  status = ioctl(fd, SIOCETHTOOL, &req);
-  if (status < 0) {
-    close(fd);
-    ERROR("ethstat plugin: Failed to get driver information "
-          "from %s: %s",
-          device, STRERRNO);
-    return -1;
-  }
+  ethstat_interface_clear(iface);
 
-  n_stats = (size_t)drvinfo.n_stats;
+  size_t n_stats = (size_t)drvinfo->n_stats;
   if (n_stats < 1) {
-    close(fd);
-    ERROR("ethstat plugin: No stats available for %s", device);
+    ERROR("ethstat plugin: No stats available for %s", iface->name);
     return -1;
   }
 
-  strings_size = sizeof(struct ethtool_gstrings) + (n_stats * ETH_GSTRING_LEN);
-  stats_size = sizeof(struct ethtool_stats) + (n_stats * sizeof(uint64_t));
-
-  strings = malloc(strings_size);
-  stats = malloc(stats_size);
-  if ((strings == NULL) || (stats == NULL)) {
-    close(fd);
-    sfree(strings);
-    sfree(stats);
+  struct ethtool_gstrings *strings =
+      malloc(sizeof(struct ethtool_gstrings) + (n_stats * ETH_GSTRING_LEN));
+  iface->stats =
+      malloc(sizeof(struct ethtool_stats) + (n_stats * sizeof(uint64_t)));
+  iface->stat_map = calloc(n_stats, sizeof(*iface->stat_map));
+  if ((strings == NULL) || (iface->stats == NULL) ||
+      (iface->stat_map == NULL)) {
     ERROR("ethstat plugin: malloc failed.");
+    sfree(strings);
+    ethstat_interface_clear(iface);
     return -1;
   }
 
   strings->cmd = ETHTOOL_GSTRINGS;
   strings->string_set = ETH_SS_STATS;
   strings->len = n_stats;
-  req.ifr_data = (void *)strings;
-  status = ioctl(fd, SIOCETHTOOL, &req);
+  req->ifr_data = (void *)strings;
+  if (ioctl(ethstat_fd, SIOCETHTOOL, req) < 0) {
+    ERROR("ethstat plugin: Cannot get strings from %s: %s", iface->name,
+          STRERRNO);
+    sfree(strings);
+    ethstat_interface_clear(iface);
+    return -1;
+  }
+
+  if (collect_mapped_only && (value_map == NULL))
+    c_complain(
+        LOG_WARNING, &complain_no_map,
+        "ethstat plugin: The \"MappedOnly\" option has been set to true, "
+        "but no mapping has been configured. All values will be ignored!");
+
+  for (size_t i = 0; i < n_stats; i++) {
+    ethstat_stat_t *stat = iface->stat_map + i;
+    char const *stat_name = (void *)&strings->data[i * ETH_GSTRING_LEN];
+    size_t len = ETH_GSTRING_LEN;
+
+    /* Remove leading spaces in key name */
+    while ((len > 0) && isspace((int)*stat_name)) {
+      stat_name++;
+      len--;
+    }
+    /* The names aren't null terminated if they fill the whole field. */
+    memcpy(stat->name, stat_name, len);
+    stat->name[len] = 0;
+
+    void *map = NULL;
+    if (value_map != NULL)
+      c_avl_get(value_map, stat->name, &map);
+    stat->map = map;
+
+    /* If the "MappedOnly" option is specified, ignore unmapped values. */
+    stat->ignore = collect_mapped_only && (map == NULL);
+  }
+
+  sfree(strings);
+  iface->drvinfo = *drvinfo;
+  iface->n_stats = n_stats;
+  return 0;
+} /* }}} int ethstat_interface_setup */
+
+/* Compares the identifying fields of the driver information, i.e. not the
+ * sizes of the register dump, EEPROM etc. */
+static bool ethstat_drvinfo_equal(struct ethtool_drvinfo const *a, /* {{{ */
+                                  struct ethtool_drvinfo const *b) {
+  return (a->n_stats == b->n_stats) &&
+         (strncmp(a->driver, b->driver, sizeof(a->driver)) == 0) &&
+         (strncmp(a->version, b->version, sizeof(a->version)) == 0) &&
+         (strncmp(a->fw_version, b->fw_version, sizeof(a->fw_version)) == 0) &&
+         (strncmp(a->bus_info, b->bus_info, sizeof(a->bus_info)) == 0);
+} /* }}} bool ethstat_drvinfo_equal */
+
+static int ethstat_read_interface(ethstat_interface_t *iface) /* {{{ */
+{
+  struct ethtool_drvinfo drvinfo = {.cmd = ETHTOOL_GDRVINFO};
+  struct ifreq req = {.ifr_data = (void *)&drvinfo};
+  int status;
+
+  sstrncpy(req.ifr_name, iface->name, sizeof(req.ifr_name));
+
+  status = ioctl(ethstat_fd, SIOCETHTOOL, &req);
   if (status < 0) {
-    close(fd);
-    free(strings);
-    free(stats);
-    ERROR("ethstat plugin: Cannot get strings from %s: %s", device, STRERRNO);
+    ERROR("ethstat plugin: Failed to get driver information "
+          "from %s: %s",
+          iface->name, STRERRNO);
     return -1;
   }
 
-  stats->cmd = ETHTOOL_GSTATS;
-  stats->n_stats = n_stats;
-  req.ifr_data = (void *)stats;
-  status = ioctl(fd, SIOCETHTOOL, &req);
+  /* The set of statistics changes when the driver is replaced or its
+   * configuration, e.g. the number of queues, is. */
+  if ((iface->n_stats == 0) || !ethstat_drvinfo_equal(&iface->drvinfo,
+                                                      &drvinfo)) {
+    status = ethstat_interface_setup(iface, &req, &drvinfo);
+    if (status != 0)
+      return status;
+  }
+
+  iface->stats->cmd = ETHTOOL_GSTATS;
+  iface->stats->n_stats = iface->n_stats;
+  req.ifr_data = (void *)iface->stats;
+  status = ioctl(ethstat_fd, SIOCETHTOOL, &req);
   if (status < 0) {
-    close(fd);
-    free(strings);
-    free(stats);
-    ERROR("ethstat plugin: Reading statistics from %s failed: %s", device,
+    ERROR("ethstat plugin: Reading statistics from %s failed: %s", iface->name,
           STRERRNO);
     return -1;
   }
 
+  /* The kernel reports fewer values if the set shrank in the meantime. Fetch
+   * the names again on the next read. */
+  size_t n_stats = iface->n_stats;
+  if (iface->stats->n_stats < n_stats) {
+    n_stats = iface->stats->n_stats;
+    iface->drvinfo.n_stats = 0;
+  }
+
   for (size_t i = 0; i < n_stats; i++) {
-    char *stat_name;
+    ethstat_stat_t const *stat = iface->stat_map + i;
 
-    stat_name = (void *)&strings->data[i * ETH_GSTRING_LEN];
-    /* Remove leading spaces in key name */
-    while (isspace((int)*stat_name))
-      stat_name++;
+    if (stat->ignore)
+      continue;
 
-    DEBUG("ethstat plugin: device = \"%s\": %s = %" PRIu64, device, stat_name,
-          (uint64_t)stats->data[i]);
-    ethstat_submit_value(device, stat_name, (derive_t)stats->data[i]);
+    DEBUG("ethstat plugin: device = \"%s\": %s = %" PRIu64, iface->name,
+          stat->name, (uint64_t)iface->stats->data[i]);
+    ethstat_submit_value(iface->name, stat, (derive_t)iface->stats->data[i]);
   }
 
-  close(fd);
-  sfree(strings);
-  sfree(stats);
-
   return 0;
 } /* }}} ethstat_read_interface */
 
 static int ethstat_read(void) {
+  if (ethstat_fd < 0) {
+    ethstat_fd =
+        socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, /* protocol = */ 0);
+    if (ethstat_fd < 0) {
+      ERROR("ethstat plugin: Failed to open control socket: %s", STRERRNO);
+      return 1;
+    }
+  }
+
   for (size_t i = 0; i < interfaces_num; i++)
-    ethstat_read_interface(interfaces[i]);
+    ethstat_read_interface(interfaces + i);
 
   return 0;
 }
@@ -300,6 +372,18 @@ static int ethstat_shutdown(void) {
   void *key = NULL;
   void *value = NULL;
 
+  for (size_t i = 0; i < interfaces_num; i++) {
+    ethstat_interface_clear(interfaces + i);
+    sfree(interfaces[i].name);
+  }
+  sfree(interfaces);
+  interfaces_num = 0;
+
+  if (ethstat_fd >= 0) {
+    close(ethstat_fd);
+    ethstat_fd = -1;
+  }
+
   if (value_map == NULL)
     return 0;
 
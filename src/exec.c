@@ -31,10 +31,15 @@
 #include "common.h"
 #include "plugin.h"
 
+#include "network.h"
 #include "utils_cmd_putnotif.h"
 #include "utils_cmd_putval.h"
 
+#if HAVE_ARPA_INET_H
+#include <arpa/inet.h> /* ntohs/ntohl */
+#endif
 #include <grp.h>
+#include <poll.h>
 #include <pwd.h>
 #include <signal.h>
 #include <sys/types.h>
@@ -45,6 +50,7 @@
 
 #define PL_NORMAL 0x01
 #define PL_NOTIF_ACTION 0x02
+#define PL_BINARY 0x04
 
 #define PL_RUNNING 0x10
 
@@ -58,6 +64,10 @@
  * The `pid' and `status' fields are thus unused if the `PL_NOTIF_ACTION' flag
  * is set.
  * The `PL_RUNNING' flag is set in `exec_read' and unset in `exec_read_one'.
+ *
+ * Notification programs with the `PL_BINARY' flag are persistent: they are
+ * forked on the first notification and keep running. Their `pid' and `fd_in'
+ * fields are protected by `pl_lock'.
  */
 struct program_list_s;
 typedef struct program_list_s program_list_t;
@@ -69,6 +79,7 @@ struct program_list_s {
   int pid;
   int status;
   int flags;
+  int fd_in;
   program_list_t *next;
 };
 
@@ -77,6 +88,17 @@ typedef struct program_list_and_notification_s {
   notification_t n;
 } program_list_and_notification_t;
 
+/*
+ * The binary protocol: programs write, and persistent notification programs
+ * read, frames of a 32 bit length in network byte order followed by that many
+ * bytes of a packet in the format used by the network plugin, without
+ * signature or encryption.
+ */
+#define EXEC_FRAME_MAX (1024 * 1024)
+
+/* Time a persistent notification program has to accept a notification. */
+#define EXEC_NOTIF_TIMEOUT_MS 1000
+
 /*
  * Private variables
  */
@@ -132,8 +154,13 @@ static int exec_config_exec(oconfig_item_t *ci) /* {{{ */
 
   if (strcasecmp("NotificationExec", ci->key) == 0)
     pl->flags |= PL_NOTIF_ACTION;
+  else if (strcasecmp("BinaryNotificationExec", ci->key) == 0)
+    pl->flags |= PL_NOTIF_ACTION | PL_BINARY;
+  else if (strcasecmp("BinaryExec", ci->key) == 0)
+    pl->flags |= PL_NORMAL | PL_BINARY;
   else
     pl->flags |= PL_NORMAL;
+  pl->fd_in = -1;
 
   pl->user = strdup(ci->values[0].value.string);
   if (pl->user == NULL) {
@@ -230,7 +257,9 @@ static int exec_config(oconfig_item_t *ci) /* {{{ */
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
     if ((strcasecmp("Exec", child->key) == 0) ||
-        (strcasecmp("NotificationExec", child->key) == 0))
+        (strcasecmp("NotificationExec", child->key) == 0) ||
+        (strcasecmp("BinaryExec", child->key) == 0) ||
+        (strcasecmp("BinaryNotificationExec", child->key) == 0))
       exec_config_exec(child);
     else {
       WARNING("exec plugin: Unknown config option `%s'.", child->key);
@@ -513,6 +542,211 @@ static int parse_line(char *buffer) /* {{{ */
   }
 } /* int parse_line }}} */
 
+static int parse_part_string(char const *payload, size_t payload_len,
+                             char *ret, size_t ret_size) /* {{{ */
+{
+  /* The string must be null-terminated and fit into "ret". */
+  if ((payload_len == 0) || (payload[payload_len - 1] != 0) ||
+      (payload_len > ret_size))
+    return -1;
+
+  memcpy(ret, payload, payload_len);
+  return 0;
+} /* }}} int parse_part_string */
+
+static int parse_part_number(char const *payload, size_t payload_len,
+                             uint64_t *ret) /* {{{ */
+{
+  if (payload_len != sizeof(*ret))
+    return -1;
+
+  memcpy(ret, payload, sizeof(*ret));
+  *ret = ntohll(*ret);
+  return 0;
+} /* }}} int parse_part_number */
+
+/* Dispatches the values part "payload" with the fields of "vl". */
+static int dispatch_part_values(value_list_t const *vl, char const *payload,
+                                size_t payload_len) /* {{{ */
+{
+  uint16_t values_num;
+
+  if (payload_len < sizeof(values_num))
+    return -1;
+  memcpy(&values_num, payload, sizeof(values_num));
+  values_num = ntohs(values_num);
+
+  uint8_t const *types = (uint8_t const *)payload + sizeof(values_num);
+  char const *values = (char const *)(types + values_num);
+  if ((values_num == 0) ||
+      (payload_len != sizeof(values_num) +
+                          values_num * (sizeof(uint8_t) + sizeof(uint64_t))))
+    return -1;
+
+  if ((vl->plugin[0] == 0) || (vl->type[0] == 0)) {
+    ERROR("exec plugin: Values without plugin or type name received.");
+    return -1;
+  }
+
+  value_list_t *e = plugin_dispatch_values_reserve(values_num);
+  if (e == NULL) {
+    ERROR("exec plugin: plugin_dispatch_values_reserve failed.");
+    return -1;
+  }
+
+  for (size_t i = 0; i < values_num; i++) {
+    uint64_t tmp;
+    memcpy(&tmp, values + i * sizeof(tmp), sizeof(tmp));
+
+    switch (types[i]) {
+    case DS_TYPE_COUNTER:
+      e->values[i].counter = (counter_t)ntohll(tmp);
+      break;
+    case DS_TYPE_GAUGE:
+      memcpy(&e->values[i].gauge, &tmp, sizeof(tmp));
+      e->values[i].gauge = (gauge_t)ntohd(e->values[i].gauge);
+      break;
+    case DS_TYPE_DERIVE:
+      e->values[i].derive = (derive_t)ntohll(tmp);
+      break;
+    case DS_TYPE_ABSOLUTE:
+      e->values[i].absolute = (absolute_t)ntohll(tmp);
+      break;
+    default:
+      ERROR("exec plugin: Unknown data source type %" PRIu8 " received.",
+            types[i]);
+      plugin_dispatch_values_cancel(e);
+      return -1;
+    }
+  }
+
+  e->time = vl->time;
+  e->interval = vl->interval;
+  sstrncpy(e->host, (vl->host[0] != 0) ? vl->host : hostname_g,
+           sizeof(e->host));
+  sstrncpy(e->plugin, vl->plugin, sizeof(e->plugin));
+  sstrncpy(e->plugin_instance, vl->plugin_instance,
+           sizeof(e->plugin_instance));
+  sstrncpy(e->type, vl->type, sizeof(e->type));
+  sstrncpy(e->type_instance, vl->type_instance, sizeof(e->type_instance));
+
+  return plugin_dispatch_values_commit(e, /* ds = */ NULL);
+} /* }}} int dispatch_part_values */
+
+/*
+ * Parses one packet of the binary protocol and dispatches its value lists.
+ * Like with the network plugin, each part sets one field for the following
+ * values parts. Unknown parts are ignored.
+ */
+static int parse_packet(char const *buffer, size_t buffer_len) /* {{{ */
+{
+  value_list_t vl = VALUE_LIST_INIT;
+
+  while (buffer_len > 0) {
+    uint16_t part_type;
+    uint16_t part_len;
+
+    if (buffer_len < 2 * sizeof(uint16_t))
+      return -1;
+    memcpy(&part_type, buffer, sizeof(part_type));
+    memcpy(&part_len, buffer + sizeof(part_type), sizeof(part_len));
+    part_type = ntohs(part_type);
+    part_len = ntohs(part_len);
+    if ((part_len < 2 * sizeof(uint16_t)) || (part_len > buffer_len))
+      return -1;
+
+    char const *payload = buffer + 2 * sizeof(uint16_t);
+    size_t payload_len = part_len - 2 * sizeof(uint16_t);
+    uint64_t tmp = 0;
+    int status = 0;
+
+    switch (part_type) {
+    case TYPE_VALUES:
+      status = dispatch_part_values(&vl, payload, payload_len);
+      break;
+    case TYPE_TIME:
+      status = parse_part_number(payload, payload_len, &tmp);
+      vl.time = TIME_T_TO_CDTIME_T(tmp);
+      break;
+    case TYPE_TIME_HR:
+      status = parse_part_number(payload, payload_len, &tmp);
+      vl.time = (cdtime_t)tmp;
+      break;
+    case TYPE_INTERVAL:
+      status = parse_part_number(payload, payload_len, &tmp);
+      vl.interval = TIME_T_TO_CDTIME_T(tmp);
+      break;
+    case TYPE_INTERVAL_HR:
+      status = parse_part_number(payload, payload_len, &tmp);
+      vl.interval = (cdtime_t)tmp;
+      break;
+    case TYPE_HOST:
+      status = parse_part_string(payload, payload_len, vl.host,
+                                 sizeof(vl.host));
+      break;
+    case TYPE_PLUGIN:
+      status = parse_part_string(payload, payload_len, vl.plugin,
+                                 sizeof(vl.plugin));
+      break;
+    case TYPE_PLUGIN_INSTANCE:
+      status = parse_part_string(payload, payload_len, vl.plugin_instance,
+                                 sizeof(vl.plugin_instance));
+      break;
+    case TYPE_TYPE:
+      status = parse_part_string(payload, payload_len, vl.type,
+                                 sizeof(vl.type));
+      break;
+    case TYPE_TYPE_INSTANCE:
+      status = parse_part_string(payload, payload_len, vl.type_instance,
+                                 sizeof(vl.type_instance));
+      break;
+    default:
+      DEBUG("exec plugin: Ignoring part of type %#" PRIx16 ".", part_type);
+      break;
+    }
+
+    if (status != 0)
+      return status;
+
+    buffer += part_len;
+    buffer_len -= part_len;
+  }
+
+  return 0;
+} /* }}} int parse_packet */
+
+/*
+ * Parses the complete frames in "buffer". Returns the number of bytes
+ * consumed or -1 if a malformed frame was received.
+ */
+static ssize_t parse_frames(program_list_t *pl, char const *buffer,
+                            size_t buffer_len) /* {{{ */
+{
+  size_t consumed = 0;
+
+  while ((buffer_len - consumed) >= sizeof(uint32_t)) {
+    uint32_t frame_len;
+    memcpy(&frame_len, buffer + consumed, sizeof(frame_len));
+    frame_len = ntohl(frame_len);
+
+    if (frame_len > EXEC_FRAME_MAX) {
+      ERROR("exec plugin: Program `%s' sent a frame of %" PRIu32 " bytes; "
+            "the limit is %d bytes.",
+            pl->exec, frame_len, EXEC_FRAME_MAX);
+      return -1;
+    }
+    if ((buffer_len - consumed - sizeof(frame_len)) < frame_len)
+      break;
+
+    /* The framing is intact, so only this packet is lost. */
+    if (parse_packet(buffer + consumed + sizeof(frame_len), frame_len) != 0)
+      ERROR("exec plugin: Program `%s' sent a malformed packet.", pl->exec);
+    consumed += sizeof(frame_len) + frame_len;
+  }
+
+  return (ssize_t)consumed;
+} /* }}} ssize_t parse_frames */
+
 static void *exec_read_one(void *arg) /* {{{ */
 {
   program_list_t *pl = (program_list_t *)arg;
@@ -523,6 +757,20 @@ static void *exec_read_one(void *arg) /* {{{ */
   char buffer_err[1024];
   char *pbuffer = buffer;
   char *pbuffer_err = buffer_err;
+  /* Frames of the binary protocol; see EXEC_FRAME_MAX. */
+  char *frames = NULL;
+  size_t frames_len = 0;
+
+  if (pl->flags & PL_BINARY) {
+    frames = malloc(sizeof(uint32_t) + EXEC_FRAME_MAX);
+    if (frames == NULL) {
+      ERROR("exec plugin: malloc failed.");
+      pthread_mutex_lock(&pl_lock);
+      pl->flags &= ~PL_RUNNING;
+      pthread_mutex_unlock(&pl_lock);
+      pthread_exit((void *)1);
+    }
+  }
 
   status = fork_child(pl, NULL, &fd, &fd_err);
   if (status < 0) {
@@ -530,6 +778,7 @@ static void *exec_read_one(void *arg) /* {{{ */
     pthread_mutex_lock(&pl_lock);
     pl->flags &= ~PL_RUNNING;
     pthread_mutex_unlock(&pl_lock);
+    sfree(frames);
     pthread_exit((void *)1);
   }
   pl->pid = status;
@@ -556,7 +805,26 @@ static void *exec_read_one(void *arg) /* {{{ */
       break;
     }
 
-    if (FD_ISSET(fd, &copy)) {
+    if (FD_ISSET(fd, &copy) && (frames != NULL)) {
+      len = read(fd, frames + frames_len,
+                 sizeof(uint32_t) + EXEC_FRAME_MAX - frames_len);
+      if (len < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+          continue;
+        break;
+      } else if (len == 0)
+        break; /* We've reached EOF */
+      frames_len += (size_t)len;
+
+      ssize_t consumed = parse_frames(pl, frames, frames_len);
+      if (consumed < 0) {
+        /* The stream can not be resynchronized. */
+        kill(pl->pid, SIGTERM);
+        break;
+      }
+      frames_len -= (size_t)consumed;
+      memmove(frames, frames + consumed, frames_len);
+    } else if (FD_ISSET(fd, &copy)) {
       char *pnl;
 
       len = read(fd, pbuffer, sizeof(buffer) - 1 - (pbuffer - buffer));
@@ -656,6 +924,7 @@ static void *exec_read_one(void *arg) /* {{{ */
   close(fd);
   if (fd_err >= 0)
     close(fd_err);
+  sfree(frames);
 
   pthread_exit((void *)0);
   return NULL;
@@ -741,6 +1010,135 @@ static void *exec_notification_one(void *arg) /* {{{ */
   return NULL;
 } /* void *exec_notification_one }}} */
 
+static int put_part(char **buffer, size_t *buffer_free, uint16_t type,
+                    void const *data, size_t data_len) /* {{{ */
+{
+  size_t part_len = 2 * sizeof(uint16_t) + data_len;
+  if ((part_len > UINT16_MAX) || (part_len > *buffer_free))
+    return -1;
+
+  uint16_t tmp = htons(type);
+  memcpy(*buffer, &tmp, sizeof(tmp));
+  tmp = htons((uint16_t)part_len);
+  memcpy(*buffer + sizeof(tmp), &tmp, sizeof(tmp));
+  memcpy(*buffer + 2 * sizeof(tmp), data, data_len);
+
+  *buffer += part_len;
+  *buffer_free -= part_len;
+  return 0;
+} /* }}} int put_part */
+
+static int put_part_string(char **buffer, size_t *buffer_free, uint16_t type,
+                           char const *str) /* {{{ */
+{
+  if (str[0] == 0)
+    return 0;
+  return put_part(buffer, buffer_free, type, str, strlen(str) + 1);
+} /* }}} int put_part_string */
+
+static int put_part_number(char **buffer, size_t *buffer_free, uint16_t type,
+                           uint64_t value) /* {{{ */
+{
+  value = htonll(value);
+  return put_part(buffer, buffer_free, type, &value, sizeof(value));
+} /* }}} int put_part_number */
+
+/* Writes all of "buffer" to the non-blocking "fd", waiting at most
+ * EXEC_NOTIF_TIMEOUT_MS in total. */
+static int write_frame(int fd, char const *buffer, size_t buffer_len) /* {{{ */
+{
+  cdtime_t deadline = cdtime() + MS_TO_CDTIME_T(EXEC_NOTIF_TIMEOUT_MS);
+
+  while (buffer_len > 0) {
+    ssize_t status = write(fd, buffer, buffer_len);
+    if (status > 0) {
+      buffer += status;
+      buffer_len -= (size_t)status;
+      continue;
+    }
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    if ((status < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+      return errno;
+
+    cdtime_t now = cdtime();
+    if (now >= deadline)
+      return ETIMEDOUT;
+
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    poll(&pfd, 1, (int)CDTIME_T_TO_MS(deadline - now) + 1);
+  }
+
+  return 0;
+} /* }}} int write_frame */
+
+/*
+ * Passes the notification to the persistent program "pl", forking it if it is
+ * not running. The notification is encoded as one frame of the binary
+ * protocol.
+ */
+static int exec_notification_binary(program_list_t *pl,
+                                    notification_t const *n) /* {{{ */
+{
+  char frame[4096];
+  char *ptr = frame + sizeof(uint32_t);
+  size_t frame_free = sizeof(frame) - sizeof(uint32_t);
+  int status = 0;
+
+  status |= put_part_number(&ptr, &frame_free, TYPE_TIME_HR, (uint64_t)n->time);
+  status |=
+      put_part_number(&ptr, &frame_free, TYPE_SEVERITY, (uint64_t)n->severity);
+  status |= put_part_string(&ptr, &frame_free, TYPE_HOST, n->host);
+  status |= put_part_string(&ptr, &frame_free, TYPE_PLUGIN, n->plugin);
+  status |= put_part_string(&ptr, &frame_free, TYPE_PLUGIN_INSTANCE,
+                            n->plugin_instance);
+  status |= put_part_string(&ptr, &frame_free, TYPE_TYPE, n->type);
+  status |=
+      put_part_string(&ptr, &frame_free, TYPE_TYPE_INSTANCE, n->type_instance);
+  status |= put_part_string(&ptr, &frame_free, TYPE_MESSAGE, n->message);
+  if (status != 0) {
+    ERROR("exec plugin: Encoding the notification failed.");
+    return -1;
+  }
+
+  size_t frame_len = (size_t)(ptr - frame);
+  uint32_t tmp = htonl((uint32_t)(frame_len - sizeof(uint32_t)));
+  memcpy(frame, &tmp, sizeof(tmp));
+
+  pthread_mutex_lock(&pl_lock);
+
+  if (pl->fd_in < 0) {
+    int fd = -1;
+    pl->pid = 0;
+    int pid = fork_child(pl, &fd, NULL, NULL);
+    if (pid < 0) {
+      pthread_mutex_unlock(&pl_lock);
+      return -1;
+    }
+    pl->pid = pid;
+    pl->fd_in = fd;
+
+    int flags = fcntl(fd, F_GETFL);
+    if ((flags == -1) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0))
+      WARNING("exec plugin: Making the pipe to `%s' non-blocking failed: %s",
+              pl->exec, STRERRNO);
+  }
+
+  status = write_frame(pl->fd_in, frame, frame_len);
+  if (status != 0) {
+    /* A partially written frame can not be completed later, so the program
+     * is restarted with the next notification. */
+    ERROR("exec plugin: Passing a notification to `%s' failed: %s", pl->exec,
+          STRERROR(status));
+    close(pl->fd_in);
+    pl->fd_in = -1;
+    kill(pl->pid, SIGTERM);
+  }
+
+  pthread_mutex_unlock(&pl_lock);
+  return status;
+} /* }}} int exec_notification_binary */
+
 static int exec_init(void) /* {{{ */
 {
   struct sigaction sa = {.sa_handler = sigchld_handler};
@@ -811,6 +1209,11 @@ static int exec_notification(const notification_t *n, /* {{{ */
     if ((pl->flags & PL_NOTIF_ACTION) == 0)
       continue;
 
+    if (pl->flags & PL_BINARY) {
+      exec_notification_binary(pl, n);
+      continue;
+    }
+
     /* Skip if a child is already running. */
     if (pl->pid != 0)
       continue;
@@ -851,6 +1254,9 @@ static int exec_shutdown(void) /* {{{ */
   while (pl != NULL) {
     next = pl->next;
 
+    if (pl->fd_in >= 0)
+      close(pl->fd_in);
+
     if (pl->pid > 0) {
       kill(pl->pid, SIGTERM);
       INFO("exec plugin: Sent SIGTERM to %hu", (unsigned short int)pl->pid);
@@ -25,6 +25,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 
 #include <dirent.h>
 #include <fcntl.h>
@@ -32,10 +33,42 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#if HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
 #define FC_RECURSIVE 1
 #define FC_HIDDEN 2
 #define FC_REGULAR 4
 
+/* Entry types, as far as the selectors are concerned. */
+#define FC_TYPE_UNKNOWN 0
+#define FC_TYPE_DIRECTORY 1
+#define FC_TYPE_REGULAR 2
+#define FC_TYPE_OTHER 3
+
+typedef struct {
+  uint64_t files_num;
+  uint64_t files_size;
+} fc_count_t;
+
+/* With "Incremental", the directories below the configured one are kept in a
+ * tree along with the counts of their own entries. Each directory is watched
+ * with inotify and only directories which had events since the last read are
+ * scanned again. */
+typedef struct fc_node_s fc_node_t;
+struct fc_node_s {
+  char *path;
+  char const *name; /* last component of the path */
+  int wd;           /* inotify watch descriptor or -1 */
+  bool dirty;
+  bool queued; /* scanned in full by a job */
+  fc_count_t count;
+
+  fc_node_t **children;
+  size_t children_num;
+};
+
 struct fc_directory_conf_s {
   char *path;
   char *plugin_name;
@@ -45,6 +78,7 @@ struct fc_directory_conf_s {
   char *type_instance;
 
   int options;
+  bool incremental;
 
   /* Data counters */
   uint64_t files_num;
@@ -57,13 +91,48 @@ struct fc_directory_conf_s {
 
   /* Helper for the recursive functions */
   time_t now;
+
+  /* Incremental mode */
+  int inotify_fd;
+  fc_node_t *root;
+  c_avl_tree_t *watches; /* &wd -> fc_node_t */
+  bool rescan;
 };
 typedef struct fc_directory_conf_s fc_directory_conf_t;
 
 static fc_directory_conf_t **directories;
 static size_t directories_num;
 
+/* Number of threads scanning the subdirectories of a directory. */
+static int fc_threads = 1;
+
+/* Frees a node and its subtree and removes their watches. */
+static void fc_node_free(fc_directory_conf_t *dir, fc_node_t *node) {
+  if (node == NULL)
+    return;
+
+  for (size_t i = 0; i < node->children_num; i++)
+    fc_node_free(dir, node->children[i]);
+  sfree(node->children);
+
+  if (node->wd >= 0) {
+    c_avl_remove(dir->watches, &node->wd, NULL, NULL);
+#if HAVE_SYS_INOTIFY_H
+    inotify_rm_watch(dir->inotify_fd, node->wd);
+#endif
+  }
+
+  sfree(node->path);
+  sfree(node);
+} /* void fc_node_free */
+
 static void fc_free_dir(fc_directory_conf_t *dir) {
+  fc_node_free(dir, dir->root);
+  if (dir->watches != NULL)
+    c_avl_destroy(dir->watches);
+  if (dir->inotify_fd >= 0)
+    close(dir->inotify_fd);
+
   sfree(dir->path);
   sfree(dir->plugin_name);
   sfree(dir->instance);
@@ -322,6 +391,7 @@ static int fc_config_add_dir(oconfig_item_t *ci) {
   }
 
   dir->options = FC_RECURSIVE | FC_REGULAR;
+  dir->inotify_fd = -1;
 
   dir->name = NULL;
   dir->plugin_name = strdup("filecount");
@@ -366,6 +436,8 @@ static int fc_config_add_dir(oconfig_item_t *ci) {
       status = cf_util_get_string(option, &dir->files_num_type);
     else if (strcasecmp("TypeInstance", option->key) == 0)
       status = cf_util_get_string(option, &dir->type_instance);
+    else if (strcasecmp("Incremental", option->key) == 0)
+      status = cf_util_get_boolean(option, &dir->incremental);
     else {
       WARNING("filecount plugin: fc_config_add_dir: "
               "Option `%s' not allowed here.",
@@ -410,6 +482,23 @@ static int fc_config_add_dir(oconfig_item_t *ci) {
     return -1;
   }
 
+#if HAVE_SYS_INOTIFY_H
+  /* Files age without any events, so the counts of unchanged directories
+   * can't be reused. */
+  if (dir->incremental && (dir->mtime != 0)) {
+    WARNING("filecount plugin: `Incremental' can't be used with `MTime' and "
+            "is disabled for '%s'.",
+            dir->path);
+    dir->incremental = false;
+  }
+#else
+  if (dir->incremental) {
+    WARNING("filecount plugin: `Incremental' requires inotify, which is not "
+            "available on this system.");
+    dir->incremental = false;
+  }
+#endif
+
   /* Ready to add it to list */
   fc_directory_conf_t **temp =
       realloc(directories, sizeof(*directories) * (directories_num + 1));
@@ -431,7 +520,12 @@ static int fc_config(oconfig_item_t *ci) {
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp("Directory", child->key) == 0)
       fc_config_add_dir(child);
-    else {
+    else if (strcasecmp("Threads", child->key) == 0) {
+      if ((cf_util_get_int(child, &fc_threads) != 0) || (fc_threads < 1)) {
+        WARNING("filecount plugin: `Threads' must be a positive number.");
+        fc_threads = 1;
+      }
+    } else {
       WARNING("filecount plugin: Ignoring unknown config option `%s'.",
               child->key);
     }
@@ -449,41 +543,90 @@ static int fc_init(void) {
   return 0;
 } /* int fc_init */
 
-static int fc_read_dir_callback(const char *dirname, const char *filename,
-                                void *user_data) {
-  fc_directory_conf_t *dir = user_data;
-  char abs_path[PATH_MAX];
-  struct stat statbuf;
-
-  if (dir == NULL)
-    return -1;
-
-  snprintf(abs_path, sizeof(abs_path), "%s/%s", dirname, filename);
+/*
+ * Scanning
+ *
+ * The directories are distributed over a pool of "Threads" workers: each
+ * worker reads one directory at a time, calling fstatat(2) relative to the
+ * open directory only for the entries whose type or size is needed, and queues
+ * the subdirectories it finds for any worker to pick up.
+ */
+typedef struct fc_job_s fc_job_t;
+struct fc_job_s {
+  char *path;
+  fc_node_t *node; /* incremental mode only */
+  bool root;
+  fc_job_t *next;
+};
 
-  int status = lstat(abs_path, &statbuf);
-  if (status != 0) {
-    ERROR("filecount plugin: stat (%s) failed.", abs_path);
-    return -1;
+typedef struct {
+  fc_directory_conf_t *dir;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  fc_job_t *jobs;
+  size_t busy;
+
+  fc_count_t count; /* of the directories scanned without a node */
+  bool root_failed;
+  int watch_errno;
+} fc_scan_t;
+
+/* Called for each subdirectory found with "Recursive". */
+typedef void (*fc_subdir_cb)(fc_scan_t *scan, void *user_data,
+                             char const *path, char const *name);
+
+/* Regular files only need to be stat'ed for their size and mtime. */
+static bool fc_need_stat(fc_directory_conf_t const *dir) {
+  return (dir->files_size_type != NULL) || (dir->mtime != 0) ||
+         (dir->size != 0);
+} /* bool fc_need_stat */
+
+static int fc_dirent_type(struct dirent const *ent) {
+#ifdef DT_UNKNOWN
+  switch (ent->d_type) {
+  case DT_UNKNOWN:
+    return FC_TYPE_UNKNOWN;
+  case DT_DIR:
+    return FC_TYPE_DIRECTORY;
+  case DT_REG:
+    return FC_TYPE_REGULAR;
+  default:
+    return FC_TYPE_OTHER;
   }
-
-  if (S_ISDIR(statbuf.st_mode) && (dir->options & FC_RECURSIVE)) {
-    status = walk_directory(
-        abs_path, fc_read_dir_callback, dir,
-        /* include hidden = */ (dir->options & FC_HIDDEN) ? 1 : 0);
-    return status;
-  } else if ((dir->options & FC_REGULAR) && !S_ISREG(statbuf.st_mode)) {
-    return 0;
+#else
+  return FC_TYPE_UNKNOWN;
+#endif
+} /* int fc_dirent_type */
+
+static int fc_join_path(char *buffer, size_t buffer_size, char const *path,
+                        char const *name) {
+  int status = snprintf(buffer, buffer_size, "%s/%s", path, name);
+  if ((status < 0) || ((size_t)status >= buffer_size)) {
+    ERROR("filecount plugin: The path of \"%s\" in \"%s\" is too long.", name,
+          path);
+    return ENAMETOOLONG;
   }
+  return 0;
+} /* int fc_join_path */
+
+/* Applies the selectors to an entry which is not a directory to recurse
+ * into. "statbuf" is only set for regular files if fc_need_stat() is true. */
+static void fc_count_entry(fc_directory_conf_t const *dir, fc_count_t *count,
+                           char const *name, int type,
+                           struct stat const *statbuf) {
+  if ((dir->options & FC_REGULAR) && (type != FC_TYPE_REGULAR))
+    return;
 
   if (dir->name != NULL) {
-    status = fnmatch(dir->name, filename, /* flags = */ 0);
+    int status = fnmatch(dir->name, name, /* flags = */ 0);
     if (status != 0)
-      return 0;
+      return;
   }
 
-  if (!S_ISREG(statbuf.st_mode)) {
-    dir->files_num++;
-    return 0;
+  if (type != FC_TYPE_REGULAR) {
+    count->files_num++;
+    return;
   }
 
   if (dir->mtime != 0) {
@@ -494,12 +637,9 @@ static int fc_read_dir_callback(const char *dirname, const char *filename,
     else
       mtime -= dir->mtime;
 
-    DEBUG("filecount plugin: Only collecting files that were touched %s %u.",
-          (dir->mtime < 0) ? "after" : "before", (unsigned int)mtime);
-
-    if (((dir->mtime < 0) && (statbuf.st_mtime < mtime)) ||
-        ((dir->mtime > 0) && (statbuf.st_mtime > mtime)))
-      return 0;
+    if (((dir->mtime < 0) && (statbuf->st_mtime < mtime)) ||
+        ((dir->mtime > 0) && (statbuf->st_mtime > mtime)))
+      return;
   }
 
   if (dir->size != 0) {
@@ -510,32 +650,584 @@ static int fc_read_dir_callback(const char *dirname, const char *filename,
     else
       size = (off_t)dir->size;
 
-    if (((dir->size < 0) && (statbuf.st_size > size)) ||
-        ((dir->size > 0) && (statbuf.st_size < size)))
+    if (((dir->size < 0) && (statbuf->st_size > size)) ||
+        ((dir->size > 0) && (statbuf->st_size < size)))
+      return;
+  }
+
+  count->files_num++;
+  if (statbuf != NULL)
+    count->files_size += (uint64_t)statbuf->st_size;
+} /* void fc_count_entry */
+
+/* Counts the entries of the directory "path" into "count". Subdirectories are
+ * passed to "callback" instead if the directory is scanned recursively. */
+static int fc_scan_dir(fc_scan_t *scan, char const *path, bool root,
+                       fc_count_t *count, fc_subdir_cb callback,
+                       void *user_data) {
+  fc_directory_conf_t const *dir = scan->dir;
+  bool need_stat = fc_need_stat(dir);
+
+  /* Symlinks are not followed below the configured directory. */
+  int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+  if (!root)
+    flags |= O_NOFOLLOW;
+
+  int fd = open(path, flags);
+  if (fd < 0) {
+    /* Subdirectories may be removed while being scanned. */
+    if (!root && (errno == ENOENT))
       return 0;
+    ERROR("filecount plugin: Cannot open \"%s\": %s", path, STRERRNO);
+    return -1;
+  }
+
+  DIR *dh = fdopendir(fd);
+  if (dh == NULL) {
+    ERROR("filecount plugin: fdopendir (%s) failed: %s", path, STRERRNO);
+    close(fd);
+    return -1;
+  }
+
+  struct dirent *ent;
+  while ((ent = readdir(dh)) != NULL) {
+    char const *name = ent->d_name;
+
+    if (dir->options & FC_HIDDEN) {
+      if ((strcmp(".", name) == 0) || (strcmp("..", name) == 0))
+        continue;
+    } else if (name[0] == '.') {
+      continue;
+    }
+
+    int type = fc_dirent_type(ent);
+    struct stat statbuf;
+    bool have_stat = false;
+
+    if ((type == FC_TYPE_UNKNOWN) || ((type == FC_TYPE_REGULAR) && need_stat)) {
+      if (fstatat(fd, name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) {
+        /* Not an error: files come and go, e.g. in mail queues. */
+        if (errno != ENOENT)
+          ERROR("filecount plugin: stat (%s/%s) failed: %s", path, name,
+                STRERRNO);
+        continue;
+      }
+      have_stat = true;
+
+      if (S_ISDIR(statbuf.st_mode))
+        type = FC_TYPE_DIRECTORY;
+      else if (S_ISREG(statbuf.st_mode))
+        type = FC_TYPE_REGULAR;
+      else
+        type = FC_TYPE_OTHER;
+    }
+
+    if ((type == FC_TYPE_DIRECTORY) && (dir->options & FC_RECURSIVE)) {
+      (*callback)(scan, user_data, path, name);
+      continue;
+    }
+
+    fc_count_entry(dir, count, name, type, have_stat ? &statbuf : NULL);
+  }
+
+  closedir(dh);
+  return 0;
+} /* int fc_scan_dir */
+
+static int fc_scan_push(fc_scan_t *scan, char const *path, fc_node_t *node,
+                        bool root) {
+  fc_job_t *job = calloc(1, sizeof(*job));
+  if (job == NULL) {
+    ERROR("filecount plugin: calloc failed.");
+    return ENOMEM;
+  }
+  job->path = strdup(path);
+  if (job->path == NULL) {
+    ERROR("filecount plugin: strdup failed.");
+    sfree(job);
+    return ENOMEM;
+  }
+  job->node = node;
+  job->root = root;
+
+  pthread_mutex_lock(&scan->lock);
+  job->next = scan->jobs;
+  scan->jobs = job;
+  pthread_cond_signal(&scan->cond);
+  pthread_mutex_unlock(&scan->lock);
+
+  return 0;
+} /* int fc_scan_push */
+
+static void fc_push_subdir(fc_scan_t *scan,
+                           void __attribute__((unused)) * user_data,
+                           char const *path, char const *name) {
+  char subdir[PATH_MAX];
+
+  if (fc_join_path(subdir, sizeof(subdir), path, name) == 0)
+    fc_scan_push(scan, subdir, NULL, /* root = */ false);
+} /* void fc_push_subdir */
+
+#if HAVE_SYS_INOTIFY_H
+static void fc_add_child(fc_scan_t *scan, void *user_data, char const *path,
+                         char const *name);
+#endif
+
+static void fc_scan_job(fc_scan_t *scan, fc_job_t *job, fc_count_t *count) {
+  int status;
+
+#if HAVE_SYS_INOTIFY_H
+  if (job->node != NULL) {
+    fc_count_t node_count = {0};
+
+    /* The node is only accessed by this job until the scan is done. */
+    status = fc_scan_dir(scan, job->path, job->root, &node_count, fc_add_child,
+                         job->node);
+    job->node->count = node_count;
+  } else
+#endif
+  {
+    status = fc_scan_dir(scan, job->path, job->root, count, fc_push_subdir,
+                         NULL);
+  }
+
+  if ((status != 0) && job->root) {
+    pthread_mutex_lock(&scan->lock);
+    scan->root_failed = true;
+    pthread_mutex_unlock(&scan->lock);
+  }
+} /* void fc_scan_job */
+
+static void *fc_worker(void *arg) {
+  fc_scan_t *scan = arg;
+  fc_count_t count = {0};
+
+  pthread_mutex_lock(&scan->lock);
+  while (true) {
+    fc_job_t *job = scan->jobs;
+    if (job == NULL) {
+      if (scan->busy == 0)
+        break;
+      pthread_cond_wait(&scan->cond, &scan->lock);
+      continue;
+    }
+    scan->jobs = job->next;
+    scan->busy++;
+    pthread_mutex_unlock(&scan->lock);
+
+    fc_scan_job(scan, job, &count);
+    sfree(job->path);
+    sfree(job);
+
+    pthread_mutex_lock(&scan->lock);
+    scan->busy--;
+    /* Wake up the idle workers to let them exit. */
+    if ((scan->busy == 0) && (scan->jobs == NULL))
+      pthread_cond_broadcast(&scan->cond);
   }
 
-  dir->files_num++;
-  dir->files_size += (uint64_t)statbuf.st_size;
+  scan->count.files_num += count.files_num;
+  scan->count.files_size += count.files_size;
+  pthread_mutex_unlock(&scan->lock);
+
+  return NULL;
+} /* void *fc_worker */
+
+/* Runs the queued jobs and all jobs they queue. The read thread is one of the
+ * workers. */
+static void fc_scan_run(fc_scan_t *scan) {
+  size_t threads_num = (size_t)fc_threads - 1;
+  pthread_t threads[threads_num + 1];
+  size_t started = 0;
+
+  while (started < threads_num) {
+    int status = plugin_thread_create(threads + started, /* attr = */ NULL,
+                                      fc_worker, scan, "filecount");
+    if (status != 0) {
+      ERROR("filecount plugin: Starting a worker thread failed: %s",
+            STRERROR(status));
+      break;
+    }
+    started++;
+  }
+
+  fc_worker(scan);
 
+  for (size_t i = 0; i < started; i++)
+    pthread_join(threads[i], /* retval = */ NULL);
+} /* void fc_scan_run */
+
+static int fc_read_full(fc_scan_t *scan, fc_count_t *ret_count) {
+  int status = fc_scan_push(scan, scan->dir->path, NULL, /* root = */ true);
+  if (status != 0)
+    return status;
+
+  fc_scan_run(scan);
+  if (scan->root_failed)
+    return -1;
+
+  *ret_count = scan->count;
   return 0;
-} /* int fc_read_dir_callback */
+} /* int fc_read_full */
+
+/*
+ * Incremental mode
+ */
+#if HAVE_SYS_INOTIFY_H
+static int fc_wd_compare(void const *a, void const *b) {
+  int wd_a = *(int const *)a;
+  int wd_b = *(int const *)b;
+  return (wd_a > wd_b) - (wd_a < wd_b);
+} /* int fc_wd_compare */
+
+static void fc_node_watch(fc_scan_t *scan, fc_node_t *node, bool root) {
+  fc_directory_conf_t *dir = scan->dir;
+
+  uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                  IN_ONLYDIR | IN_EXCL_UNLINK;
+  /* Writes change the sizes of files, but not their number. */
+  if (fc_need_stat(dir))
+    mask |= IN_MODIFY;
+  if (root)
+    mask |= IN_DELETE_SELF | IN_MOVE_SELF;
+  else
+    mask |= IN_DONT_FOLLOW;
+
+  int wd = inotify_add_watch(dir->inotify_fd, node->path, mask);
+  if (wd < 0) {
+    /* The directory has been removed: its parent has an event, too. */
+    if ((errno == ENOENT) || (errno == ENOTDIR))
+      return;
+
+    pthread_mutex_lock(&scan->lock);
+    scan->watch_errno = errno;
+    pthread_mutex_unlock(&scan->lock);
+    return;
+  }
+
+  pthread_mutex_lock(&scan->lock);
+  node->wd = wd;
+  /* Fails if the directory is watched already, e.g. via a bind mount. Without
+   * a watch of its own, the node is scanned on every read. */
+  if (c_avl_insert(dir->watches, &node->wd, node) != 0)
+    node->wd = -1;
+  pthread_mutex_unlock(&scan->lock);
+} /* void fc_node_watch */
+
+static fc_node_t *fc_node_create(fc_scan_t *scan, char const *path,
+                                 bool root) {
+  fc_node_t *node = calloc(1, sizeof(*node));
+  if (node == NULL) {
+    ERROR("filecount plugin: calloc failed.");
+    return NULL;
+  }
+  node->path = strdup(path);
+  if (node->path == NULL) {
+    ERROR("filecount plugin: strdup failed.");
+    sfree(node);
+    return NULL;
+  }
+  char const *slash = strrchr(node->path, '/');
+  node->name = (slash != NULL) ? slash + 1 : node->path;
+  node->wd = -1;
+
+  /* Watch before scanning, so that no change is missed. */
+  fc_node_watch(scan, node, root);
+  return node;
+} /* fc_node_t *fc_node_create */
+
+static void fc_node_queue(fc_scan_t *scan, fc_node_t *node, bool root) {
+  node->queued = true;
+  if (fc_scan_push(scan, node->path, node, root) != 0) {
+    node->queued = false;
+    node->dirty = true;
+  }
+} /* void fc_node_queue */
+
+static void fc_add_child(fc_scan_t *scan, void *user_data, char const *path,
+                         char const *name) {
+  fc_node_t *parent = user_data;
+  char subdir[PATH_MAX];
+
+  if (fc_join_path(subdir, sizeof(subdir), path, name) != 0)
+    return;
+
+  fc_node_t *child = fc_node_create(scan, subdir, /* root = */ false);
+  if (child == NULL)
+    return;
+
+  fc_node_t **tmp = realloc(parent->children,
+                            (parent->children_num + 1) * sizeof(*tmp));
+  if (tmp == NULL) {
+    ERROR("filecount plugin: realloc failed.");
+    fc_node_free(scan->dir, child);
+    return;
+  }
+  parent->children = tmp;
+  parent->children[parent->children_num] = child;
+  parent->children_num++;
+
+  fc_node_queue(scan, child, /* root = */ false);
+} /* void fc_add_child */
+
+typedef struct {
+  char **names;
+  size_t names_num;
+} fc_names_t;
+
+static void fc_collect_subdir(fc_scan_t __attribute__((unused)) * scan,
+                              void *user_data,
+                              char const __attribute__((unused)) * path,
+                              char const *name) {
+  fc_names_t *subdirs = user_data;
+  strarray_add(&subdirs->names, &subdirs->names_num, name);
+} /* void fc_collect_subdir */
+
+static int fc_name_compare(void const *a, void const *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+} /* int fc_name_compare */
+
+static int fc_child_compare(void const *a, void const *b) {
+  fc_node_t const *child_a = *(fc_node_t *const *)a;
+  fc_node_t const *child_b = *(fc_node_t *const *)b;
+  return strcmp(child_a->name, child_b->name);
+} /* int fc_child_compare */
+
+/* Rescans a directory which has changed and updates its children: removed
+ * subdirectories are freed, new ones are queued to be scanned in full. */
+static void fc_node_rescan(fc_scan_t *scan, fc_node_t *node, bool root) {
+  fc_names_t subdirs = {0};
+  fc_count_t count = {0};
+
+  if (node->wd < 0)
+    fc_node_watch(scan, node, root);
+  node->dirty = false;
+
+  int status = fc_scan_dir(scan, node->path, root, &count, fc_collect_subdir,
+                           &subdirs);
+  if (status != 0) {
+    if (root)
+      scan->root_failed = true;
+    node->dirty = true;
+    strarray_free(subdirs.names, subdirs.names_num);
+    return;
+  }
+  node->count = count;
+
+  fc_node_t **children = NULL;
+  if (subdirs.names_num > 0) {
+    children = calloc(subdirs.names_num, sizeof(*children));
+    if (children == NULL) {
+      ERROR("filecount plugin: calloc failed.");
+      node->dirty = true;
+      strarray_free(subdirs.names, subdirs.names_num);
+      return;
+    }
+  }
+
+  qsort(subdirs.names, subdirs.names_num, sizeof(*subdirs.names),
+        fc_name_compare);
+  if (node->children_num > 0)
+    qsort(node->children, node->children_num, sizeof(*node->children),
+          fc_child_compare);
+
+  size_t children_num = 0;
+  size_t i = 0;
+  size_t j = 0;
+  while ((i < node->children_num) || (j < subdirs.names_num)) {
+    int cmp;
+    if (i >= node->children_num)
+      cmp = 1;
+    else if (j >= subdirs.names_num)
+      cmp = -1;
+    else
+      cmp = strcmp(node->children[i]->name, subdirs.names[j]);
+
+    if (cmp == 0) {
+      children[children_num++] = node->children[i];
+      i++;
+      j++;
+    } else if (cmp < 0) {
+      fc_node_free(scan->dir, node->children[i]);
+      i++;
+    } else {
+      char subdir[PATH_MAX];
+      fc_node_t *child = NULL;
+
+      if (fc_join_path(subdir, sizeof(subdir), node->path, subdirs.names[j]) ==
+          0)
+        child = fc_node_create(scan, subdir, /* root = */ false);
+      if (child != NULL) {
+        children[children_num++] = child;
+        fc_node_queue(scan, child, /* root = */ false);
+      }
+      j++;
+    }
+  }
+
+  sfree(node->children);
+  node->children = children;
+  node->children_num = children_num;
+  strarray_free(subdirs.names, subdirs.names_num);
+} /* void fc_node_rescan */
+
+static void fc_tree_update(fc_scan_t *scan, fc_node_t *node, bool root) {
+  /* Queued nodes are new and will be scanned in full. */
+  if (node->queued)
+    return;
+
+  /* Without a watch, changes can't be told from the events. */
+  if (node->dirty || (node->wd < 0))
+    fc_node_rescan(scan, node, root);
+
+  for (size_t i = 0; i < node->children_num; i++)
+    fc_tree_update(scan, node->children[i], /* root = */ false);
+} /* void fc_tree_update */
+
+static void fc_tree_sum(fc_node_t *node, fc_count_t *count) {
+  node->queued = false;
+  count->files_num += node->count.files_num;
+  count->files_size += node->count.files_size;
+
+  for (size_t i = 0; i < node->children_num; i++)
+    fc_tree_sum(node->children[i], count);
+} /* void fc_tree_sum */
+
+/* Marks the directories which have changed since the last read. */
+static void fc_handle_events(fc_directory_conf_t *dir) {
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  while ((len = read(dir->inotify_fd, buffer, sizeof(buffer))) > 0) {
+    char *ptr = buffer;
+    while (ptr < buffer + len) {
+      struct inotify_event const *event = (struct inotify_event const *)ptr;
+      ptr += sizeof(*event) + event->len;
+
+      /* Events have been lost. */
+      if (event->mask & IN_Q_OVERFLOW) {
+        dir->rescan = true;
+        continue;
+      }
+
+      fc_node_t *node = NULL;
+      if (c_avl_get(dir->watches, &event->wd, (void *)&node) != 0)
+        continue;
+
+      node->dirty = true;
+      if (event->mask & IN_IGNORED) {
+        c_avl_remove(dir->watches, &node->wd, NULL, NULL);
+        node->wd = -1;
+      }
+      if ((node == dir->root) &&
+          (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)))
+        dir->rescan = true;
+    }
+  }
+} /* void fc_handle_events */
+
+static void fc_incremental_disable(fc_directory_conf_t *dir) {
+  fc_node_free(dir, dir->root);
+  dir->root = NULL;
+  if (dir->watches != NULL)
+    c_avl_destroy(dir->watches);
+  dir->watches = NULL;
+  if (dir->inotify_fd >= 0)
+    close(dir->inotify_fd);
+  dir->inotify_fd = -1;
+  dir->incremental = false;
+} /* void fc_incremental_disable */
+
+static int fc_incremental_init(fc_directory_conf_t *dir) {
+  if (dir->inotify_fd >= 0)
+    return 0;
+
+  dir->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (dir->inotify_fd < 0) {
+    WARNING("filecount plugin: inotify_init1 failed: %s. Scanning \"%s\" in "
+            "full from now on.",
+            STRERRNO, dir->path);
+    dir->incremental = false;
+    return -1;
+  }
+
+  dir->watches = c_avl_create(fc_wd_compare);
+  if (dir->watches == NULL) {
+    ERROR("filecount plugin: c_avl_create failed.");
+    fc_incremental_disable(dir);
+    return -1;
+  }
+
+  dir->rescan = true;
+  return 0;
+} /* int fc_incremental_init */
+
+static int fc_read_incremental(fc_scan_t *scan, fc_count_t *ret_count) {
+  fc_directory_conf_t *dir = scan->dir;
+
+  fc_handle_events(dir);
+
+  if (dir->rescan || (dir->root == NULL)) {
+    fc_node_free(dir, dir->root);
+    dir->root = fc_node_create(scan, dir->path, /* root = */ true);
+    if (dir->root == NULL)
+      return -1;
+    dir->rescan = false;
+    fc_node_queue(scan, dir->root, /* root = */ true);
+  } else {
+    fc_tree_update(scan, dir->root, /* root = */ true);
+  }
+
+  if (scan->jobs != NULL)
+    fc_scan_run(scan);
+
+  if (scan->root_failed) {
+    dir->rescan = true;
+    return -1;
+  }
+
+  fc_tree_sum(dir->root, ret_count);
+
+  if (scan->watch_errno != 0) {
+    WARNING("filecount plugin: Watching the subdirectories of \"%s\" failed: "
+            "%s. Scanning it in full from now on.",
+            dir->path, STRERROR(scan->watch_errno));
+    fc_incremental_disable(dir);
+  }
+
+  return 0;
+} /* int fc_read_incremental */
+#endif /* HAVE_SYS_INOTIFY_H */
 
 static int fc_read_dir(fc_directory_conf_t *dir) {
-  dir->files_num = 0;
-  dir->files_size = 0;
+  fc_scan_t scan = {.dir = dir};
+  fc_count_t count = {0};
+  int status;
 
   if (dir->mtime != 0)
     dir->now = time(NULL);
 
-  int status =
-      walk_directory(dir->path, fc_read_dir_callback, dir,
-                     /* include hidden */ (dir->options & FC_HIDDEN) ? 1 : 0);
+  pthread_mutex_init(&scan.lock, /* attr = */ NULL);
+  pthread_cond_init(&scan.cond, /* attr = */ NULL);
+
+#if HAVE_SYS_INOTIFY_H
+  if (dir->incremental && (fc_incremental_init(dir) == 0))
+    status = fc_read_incremental(&scan, &count);
+  else
+#endif
+    status = fc_read_full(&scan, &count);
+
+  pthread_cond_destroy(&scan.cond);
+  pthread_mutex_destroy(&scan.lock);
+
   if (status != 0) {
-    WARNING("filecount plugin: walk_directory (%s) failed.", dir->path);
+    WARNING("filecount plugin: Reading \"%s\" failed.", dir->path);
     return -1;
   }
 
+  dir->files_num = count.files_num;
+  dir->files_size = count.files_size;
   fc_submit_dir(dir);
 
   return 0;
@@ -24,6 +24,8 @@
  *   Florian octo Forster <octo at collectd.org>
  **/
 
+#define _GNU_SOURCE /* For recvmmsg(2) */
+
 #include "collectd.h"
 
 #include "common.h"
@@ -59,13 +61,32 @@
 #define BUFF_SIZE 1400
 #endif
 
+/* Number of datagrams a receive thread reads with one recvmmsg(2) call. */
+#define RECEIVE_BATCH_SIZE 32
+
 struct socket_entry_s {
   int fd;
   struct sockaddr_storage addr;
   socklen_t addrlen;
+  bool multicast;
 };
 typedef struct socket_entry_s socket_entry_t;
 
+/* With "ReceiveThreads", each thread has its own SO_REUSEPORT socket per
+ * unicast address, so the kernel distributes the senders over the threads.
+ * Every socket that joined a multicast group would receive a copy of each
+ * packet, so the first thread's multicast sockets are polled by all threads
+ * and each datagram is read by one of them. */
+struct mc_receiver_s {
+  pthread_t id;
+  bool running;
+  socket_entry_t *sockets; /* sockets opened for this thread */
+  size_t sockets_num;
+  struct pollfd *pollfd; /* own and shared sockets */
+  size_t pollfd_num;
+};
+typedef struct mc_receiver_s mc_receiver_t;
+
 struct staging_entry_s {
   char key[2 * DATA_MAX_NAME_LEN];
   value_list_t vl;
@@ -73,6 +94,15 @@ struct staging_entry_s {
 };
 typedef struct staging_entry_s staging_entry_t;
 
+/* The staging entries are spread over one tree per receive thread by host
+ * name, so the threads rarely wait for each other. All values of one host
+ * end up in the same tree, no matter which thread receives them. */
+struct staging_shard_s {
+  c_avl_tree_t *tree;
+  pthread_mutex_t lock;
+};
+typedef struct staging_shard_s staging_shard_t;
+
 struct metric_map_s {
   char *ganglia_name;
   char *type;
@@ -88,16 +118,15 @@ static char *mc_receive_group;
 #define MC_RECEIVE_PORT_DEFAULT "8649"
 static char *mc_receive_port;
 
-static struct pollfd *mc_receive_sockets;
-static size_t mc_receive_sockets_num;
+static size_t mc_receive_threads = 1;
 
 static socket_entry_t *mc_send_sockets;
 static size_t mc_send_sockets_num;
 static pthread_mutex_t mc_send_sockets_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int mc_receive_thread_loop;
-static int mc_receive_thread_running;
-static pthread_t mc_receive_thread_id;
+static mc_receiver_t *mc_receivers;
+static size_t mc_receivers_num;
 
 static metric_map_t metric_map_default[] =
     {/*---------------+-------------+-----------+-------------+------+-----*
@@ -125,8 +154,8 @@ static size_t metric_map_len_default = STATIC_ARRAY_SIZE(metric_map_default);
 static metric_map_t *metric_map;
 static size_t metric_map_len;
 
-static c_avl_tree_t *staging_tree;
-static pthread_mutex_t staging_lock = PTHREAD_MUTEX_INITIALIZER;
+static staging_shard_t *staging_shards;
+static size_t staging_shards_num;
 
 static metric_map_t *metric_lookup(const char *key) /* {{{ */
 {
@@ -196,9 +225,25 @@ static metric_map_t *metric_lookup(const char *key) /* {{{ */
   return map + i;
 } /* }}} metric_map_t *metric_lookup */
 
+static bool addr_is_multicast(struct addrinfo const *ai) /* {{{ */
+{
+  if (ai->ai_family == AF_INET) {
+    struct sockaddr_in const *addr = (struct sockaddr_in const *)ai->ai_addr;
+    return IN_MULTICAST(ntohl(addr->sin_addr.s_addr));
+  } else if (ai->ai_family == AF_INET6) {
+    struct sockaddr_in6 const *addr =
+        (struct sockaddr_in6 const *)ai->ai_addr;
+    return IN6_IS_ADDR_MULTICAST(&addr->sin6_addr);
+  }
+  return false;
+} /* }}} bool addr_is_multicast */
+
+/* With `reuse_port', listening unicast sockets are opened with SO_REUSEPORT.
+ * Without `multicast', multicast addresses are skipped. See mc_receiver_t. */
 static int create_sockets(socket_entry_t **ret_sockets, /* {{{ */
                           size_t *ret_sockets_num, const char *node,
-                          const char *service, int listen) {
+                          const char *service, int listen, bool reuse_port,
+                          bool multicast) {
   struct addrinfo *ai_list;
   int ai_return;
 
@@ -229,6 +274,9 @@ static int create_sockets(socket_entry_t **ret_sockets, /* {{{ */
   {
     socket_entry_t *tmp;
 
+    if (!multicast && addr_is_multicast(ai_ptr))
+      continue;
+
     tmp = realloc(sockets, (sockets_num + 1) * sizeof(*sockets));
     if (tmp == NULL) {
       ERROR("gmond plugin: realloc failed.");
@@ -246,6 +294,7 @@ static int create_sockets(socket_entry_t **ret_sockets, /* {{{ */
     assert(sizeof(sockets[sockets_num].addr) >= ai_ptr->ai_addrlen);
     memcpy(&sockets[sockets_num].addr, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
     sockets[sockets_num].addrlen = ai_ptr->ai_addrlen;
+    sockets[sockets_num].multicast = addr_is_multicast(ai_ptr);
 
     /* Sending socket: Open only one socket and don't bind it. */
     if (listen == 0) {
@@ -259,6 +308,19 @@ static int create_sockets(socket_entry_t **ret_sockets, /* {{{ */
       if (status != 0) {
         WARNING("gmond plugin: setsockopt(2) failed: %s", STRERRNO);
       }
+
+#ifdef SO_REUSEPORT
+      if (reuse_port && !sockets[sockets_num].multicast) {
+        status = setsockopt(sockets[sockets_num].fd, SOL_SOCKET, SO_REUSEPORT,
+                            (void *)&yes, sizeof(yes));
+        if (status != 0) {
+          ERROR("gmond plugin: setsockopt(SO_REUSEPORT) failed: %s",
+                STRERRNO);
+          close(sockets[sockets_num].fd);
+          continue;
+        }
+      }
+#endif
     }
 
     status = bind(sockets[sockets_num].fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
@@ -388,22 +450,37 @@ static int request_meta_data(const char *host, const char *name) /* {{{ */
   return 0;
 } /* }}} int request_meta_data */
 
-static staging_entry_t *staging_entry_get(const char *host, /* {{{ */
-                                          const char *name, const char *type,
+static staging_shard_t *staging_shard_get(const char *host) /* {{{ */
+{
+  if (staging_shards_num == 0)
+    return NULL;
+
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+  for (const char *c = host; *c != 0; c++)
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+
+  return staging_shards + (hash % staging_shards_num);
+} /* }}} staging_shard_t *staging_shard_get */
+
+/* Must be called with the shard's lock held. */
+static staging_entry_t *staging_entry_get(staging_shard_t *shard, /* {{{ */
+                                          const char *host, const char *name,
+                                          const char *type,
                                           const char *type_instance,
                                           int values_len) {
   char key[2 * DATA_MAX_NAME_LEN];
   staging_entry_t *se;
   int status;
 
-  if (staging_tree == NULL)
+  if (shard == NULL)
     return NULL;
 
   snprintf(key, sizeof(key), "%s/%s/%s", host, type,
            (type_instance != NULL) ? type_instance : "");
 
   se = NULL;
-  status = c_avl_get(staging_tree, key, (void *)&se);
+  status = c_avl_get(shard->tree, key, (void *)&se);
   if (status == 0)
     return se;
 
@@ -430,7 +507,7 @@ static staging_entry_t *staging_entry_get(const char *host, /* {{{ */
   if (type_instance != NULL)
     sstrncpy(se->vl.type_instance, type_instance, sizeof(se->vl.type_instance));
 
-  status = c_avl_insert(staging_tree, se->key, se);
+  status = c_avl_insert(shard->tree, se->key, se);
   if (status != 0) {
     ERROR("gmond plugin: c_avl_insert failed.");
     sfree(se->vl.values);
@@ -460,16 +537,20 @@ static int staging_entry_update(const char *host, const char *name, /* {{{ */
     return -1;
   }
 
-  pthread_mutex_lock(&staging_lock);
+  staging_shard_t *shard = staging_shard_get(host);
+  if (shard == NULL)
+    return -1;
+
+  pthread_mutex_lock(&shard->lock);
 
-  se = staging_entry_get(host, name, type, type_instance, ds->ds_num);
+  se = staging_entry_get(shard, host, name, type, type_instance, ds->ds_num);
   if (se == NULL) {
-    pthread_mutex_unlock(&staging_lock);
+    pthread_mutex_unlock(&shard->lock);
     ERROR("gmond plugin: staging_entry_get failed.");
     return -1;
   }
   if (se->vl.values_len != ds->ds_num) {
-    pthread_mutex_unlock(&staging_lock);
+    pthread_mutex_unlock(&shard->lock);
     return -1;
   }
 
@@ -488,7 +569,7 @@ static int staging_entry_update(const char *host, const char *name, /* {{{ */
 
   /* Check if all data sources have been set. If not, return here. */
   if (se->flags != ((0x01 << se->vl.values_len) - 1)) {
-    pthread_mutex_unlock(&staging_lock);
+    pthread_mutex_unlock(&shard->lock);
     return 0;
   }
 
@@ -497,7 +578,7 @@ static int staging_entry_update(const char *host, const char *name, /* {{{ */
   if (se->vl.interval == 0) {
     /* No meta data has been received for this metric yet. */
     se->flags = 0;
-    pthread_mutex_unlock(&staging_lock);
+    pthread_mutex_unlock(&shard->lock);
 
     request_meta_data(host, name);
     return 0;
@@ -506,7 +587,7 @@ static int staging_entry_update(const char *host, const char *name, /* {{{ */
   plugin_dispatch_values(&se->vl);
 
   se->flags = 0;
-  pthread_mutex_unlock(&staging_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return 0;
 } /* }}} int staging_entry_update */
@@ -646,12 +727,17 @@ static int mc_handle_metadata_msg(Ganglia_metadata_msg *msg) /* {{{ */
     DEBUG("gmond plugin: Received meta data for %s/%s.",
           msg_meta.metric_id.host, msg_meta.metric_id.name);
 
-    pthread_mutex_lock(&staging_lock);
-    se = staging_entry_get(msg_meta.metric_id.host, msg_meta.metric_id.name,
-                           map->type, map->type_instance, ds->ds_num);
+    staging_shard_t *shard = staging_shard_get(msg_meta.metric_id.host);
+    if (shard == NULL)
+      return -1;
+
+    pthread_mutex_lock(&shard->lock);
+    se = staging_entry_get(shard, msg_meta.metric_id.host,
+                           msg_meta.metric_id.name, map->type,
+                           map->type_instance, ds->ds_num);
     if (se != NULL)
       se->vl.interval = TIME_T_TO_CDTIME_T(msg_meta.metric.tmax);
-    pthread_mutex_unlock(&staging_lock);
+    pthread_mutex_unlock(&shard->lock);
 
     if (se == NULL) {
       ERROR("gmond plugin: staging_entry_get failed.");
@@ -708,115 +794,221 @@ static int mc_handle_metric(void *buffer, size_t buffer_size) /* {{{ */
   return 0;
 } /* }}} int mc_handle_metric */
 
-static int mc_handle_socket(struct pollfd *p) /* {{{ */
+/* Reads up to RECEIVE_BATCH_SIZE datagrams into `buffers', which must hold
+ * RECEIVE_BATCH_SIZE * BUFF_SIZE bytes. Returns the number of datagrams or -1
+ * on error. */
+static int mc_receive(int fd, char *buffers, size_t *sizes) /* {{{ */
 {
-  char buffer[BUFF_SIZE];
-  ssize_t buffer_size;
+#if HAVE_RECVMMSG
+  struct mmsghdr msgs[RECEIVE_BATCH_SIZE] = {{{0}}};
+  struct iovec iovs[RECEIVE_BATCH_SIZE];
+
+  for (size_t i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+    iovs[i].iov_base = buffers + i * BUFF_SIZE;
+    iovs[i].iov_len = BUFF_SIZE;
+    msgs[i].msg_hdr.msg_iov = iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int status = recvmmsg(fd, msgs, RECEIVE_BATCH_SIZE, MSG_DONTWAIT,
+                        /* timeout = */ NULL);
+  for (int i = 0; i < status; i++)
+    sizes[i] = (size_t)msgs[i].msg_len;
+  return status;
+#else
+  ssize_t status = recv(fd, buffers, BUFF_SIZE, MSG_DONTWAIT);
+  if (status < 0)
+    return -1;
+  sizes[0] = (size_t)status;
+  return 1;
+#endif
+} /* }}} int mc_receive */
+
+static int mc_handle_socket(struct pollfd *p, char *buffers) /* {{{ */
+{
+  size_t sizes[RECEIVE_BATCH_SIZE];
 
   if ((p->revents & (POLLIN | POLLPRI)) == 0) {
     p->revents = 0;
     return -1;
   }
 
-  buffer_size = recv(p->fd, buffer, sizeof(buffer), /* flags = */ 0);
-  if (buffer_size <= 0) {
-    ERROR("gmond plugin: recv failed: %s", STRERRNO);
+  int num = mc_receive(p->fd, buffers, sizes);
+  if (num < 0) {
+    /* Another thread may have read the datagram from a shared socket. */
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+      ERROR("gmond plugin: recv failed: %s", STRERRNO);
     p->revents = 0;
     return -1;
   }
 
-  mc_handle_metric(buffer, (size_t)buffer_size);
+  for (int i = 0; i < num; i++)
+    if (sizes[i] > 0)
+      mc_handle_metric(buffers + i * BUFF_SIZE, sizes[i]);
   return 0;
 } /* }}} int mc_handle_socket */
 
 static void *mc_receive_thread(void *arg) /* {{{ */
 {
-  socket_entry_t *mc_receive_socket_entries;
+  mc_receiver_t *r = arg;
   int status;
 
-  mc_receive_socket_entries = NULL;
-  status = create_sockets(
-      &mc_receive_socket_entries, &mc_receive_sockets_num,
-      (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
-      (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
-      /* listen = */ 1);
-  if (status != 0) {
-    ERROR("gmond plugin: create_sockets failed.");
+  char *buffers = malloc(RECEIVE_BATCH_SIZE * BUFF_SIZE);
+  if (buffers == NULL) {
+    ERROR("gmond plugin: malloc failed.");
     return (void *)-1;
   }
 
-  mc_receive_sockets = (struct pollfd *)calloc(mc_receive_sockets_num,
-                                               sizeof(*mc_receive_sockets));
-  if (mc_receive_sockets == NULL) {
-    ERROR("gmond plugin: calloc failed.");
-    for (size_t i = 0; i < mc_receive_sockets_num; i++)
-      close(mc_receive_socket_entries[i].fd);
-    free(mc_receive_socket_entries);
-    mc_receive_socket_entries = NULL;
-    mc_receive_sockets_num = 0;
-    return (void *)-1;
-  }
-
-  for (size_t i = 0; i < mc_receive_sockets_num; i++) {
-    mc_receive_sockets[i].fd = mc_receive_socket_entries[i].fd;
-    mc_receive_sockets[i].events = POLLIN | POLLPRI;
-    mc_receive_sockets[i].revents = 0;
-  }
-
   while (mc_receive_thread_loop != 0) {
-    status = poll(mc_receive_sockets, mc_receive_sockets_num, -1);
-    if (status <= 0) {
+    /* The timeout makes sure the thread notices `mc_receive_thread_loop' even
+     * if the signal sent by mc_receive_thread_stop() arrives before poll(2)
+     * is called. */
+    status = poll(r->pollfd, r->pollfd_num, /* timeout = */ 1000);
+    if (status < 0) {
       if (errno == EINTR)
         continue;
       ERROR("gmond plugin: poll failed: %s", STRERRNO);
       break;
     }
 
-    for (size_t i = 0; i < mc_receive_sockets_num; i++) {
-      if (mc_receive_sockets[i].revents != 0)
-        mc_handle_socket(mc_receive_sockets + i);
+    for (size_t i = 0; i < r->pollfd_num; i++) {
+      if (r->pollfd[i].revents != 0)
+        mc_handle_socket(r->pollfd + i, buffers);
     }
   } /* while (mc_receive_thread_loop != 0) */
 
-  free(mc_receive_socket_entries);
+  sfree(buffers);
   return (void *)0;
 } /* }}} void *mc_receive_thread */
 
+static void mc_receivers_free(void) /* {{{ */
+{
+  for (size_t i = 0; i < mc_receivers_num; i++) {
+    mc_receiver_t *r = mc_receivers + i;
+
+    for (size_t j = 0; j < r->sockets_num; j++)
+      close(r->sockets[j].fd);
+    sfree(r->sockets);
+    sfree(r->pollfd);
+  }
+  sfree(mc_receivers);
+  mc_receivers_num = 0;
+} /* }}} void mc_receivers_free */
+
+static int mc_receivers_create(void) /* {{{ */
+{
+  bool reuse_port = (mc_receive_threads > 1);
+
+  mc_receivers = calloc(mc_receive_threads, sizeof(*mc_receivers));
+  if (mc_receivers == NULL) {
+    ERROR("gmond plugin: calloc failed.");
+    return -1;
+  }
+  mc_receivers_num = mc_receive_threads;
+
+  /* Only the first thread opens the multicast sockets. */
+  for (size_t i = 0; i < mc_receivers_num; i++) {
+    mc_receiver_t *r = mc_receivers + i;
+
+    int status = create_sockets(
+        &r->sockets, &r->sockets_num,
+        (mc_receive_group != NULL) ? mc_receive_group
+                                   : MC_RECEIVE_GROUP_DEFAULT,
+        (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
+        /* listen = */ 1, reuse_port, /* multicast = */ i == 0);
+    if ((status != 0) && (i == 0)) {
+      ERROR("gmond plugin: create_sockets failed.");
+      mc_receivers_free();
+      return -1;
+    }
+  }
+
+  mc_receiver_t const *first = mc_receivers;
+  size_t shared_num = 0;
+  for (size_t i = 0; i < first->sockets_num; i++)
+    if (first->sockets[i].multicast)
+      shared_num++;
+
+  for (size_t i = 0; i < mc_receivers_num; i++) {
+    mc_receiver_t *r = mc_receivers + i;
+    size_t pollfd_num = r->sockets_num + ((i > 0) ? shared_num : 0);
+
+    r->pollfd = calloc(pollfd_num, sizeof(*r->pollfd));
+    if (r->pollfd == NULL) {
+      ERROR("gmond plugin: calloc failed.");
+      mc_receivers_free();
+      return -1;
+    }
+
+    for (size_t j = 0; j < r->sockets_num; j++)
+      r->pollfd[r->pollfd_num++].fd = r->sockets[j].fd;
+    for (size_t j = 0; (i > 0) && (j < first->sockets_num); j++)
+      if (first->sockets[j].multicast)
+        r->pollfd[r->pollfd_num++].fd = first->sockets[j].fd;
+
+    for (size_t j = 0; j < r->pollfd_num; j++)
+      r->pollfd[j].events = POLLIN | POLLPRI;
+  }
+
+  return 0;
+} /* }}} int mc_receivers_create */
+
 static int mc_receive_thread_start(void) /* {{{ */
 {
-  int status;
+  if (mc_receivers != NULL)
+    return -1;
 
-  if (mc_receive_thread_running != 0)
+  if (mc_receivers_create() != 0)
     return -1;
 
   mc_receive_thread_loop = 1;
 
-  status =
-      plugin_thread_create(&mc_receive_thread_id, /* attr = */ NULL,
-                           mc_receive_thread, /* args = */ NULL, "gmond recv");
-  if (status != 0) {
-    ERROR("gmond plugin: Starting receive thread failed.");
+  size_t running = 0;
+  for (size_t i = 0; i < mc_receivers_num; i++) {
+    mc_receiver_t *r = mc_receivers + i;
+
+    /* Threads without sockets have nothing to do. */
+    if (r->pollfd_num == 0)
+      continue;
+
+    int status = plugin_thread_create(&r->id, /* attr = */ NULL,
+                                      mc_receive_thread, r, "gmond recv");
+    if (status != 0) {
+      ERROR("gmond plugin: Starting receive thread failed.");
+      continue;
+    }
+    r->running = true;
+    running++;
+  }
+
+  if (running == 0) {
     mc_receive_thread_loop = 0;
+    mc_receivers_free();
     return -1;
   }
 
-  mc_receive_thread_running = 1;
   return 0;
 } /* }}} int start_receive_thread */
 
 static int mc_receive_thread_stop(void) /* {{{ */
 {
-  if (mc_receive_thread_running == 0)
+  if (mc_receivers == NULL)
     return -1;
 
   mc_receive_thread_loop = 0;
 
   INFO("gmond plugin: Stopping receive thread.");
-  pthread_kill(mc_receive_thread_id, SIGTERM);
-  pthread_join(mc_receive_thread_id, /* return value = */ NULL);
-  memset(&mc_receive_thread_id, 0, sizeof(mc_receive_thread_id));
+  for (size_t i = 0; i < mc_receivers_num; i++) {
+    mc_receiver_t *r = mc_receivers + i;
+    if (!r->running)
+      continue;
 
-  mc_receive_thread_running = 0;
+    pthread_kill(r->id, SIGTERM);
+    pthread_join(r->id, /* return value = */ NULL);
+    r->running = false;
+  }
+
+  mc_receivers_free();
 
   return 0;
 } /* }}} int mc_receive_thread_stop */
@@ -826,6 +1018,7 @@ static int mc_receive_thread_stop(void) /* {{{ */
  *
  * <Plugin gmond>
  *   MCReceiveFrom "239.2.11.71" "8649"
+ *   ReceiveThreads 4
  *   <Metric "load_one">
  *     Type "load"
  *     [TypeInstance "foo"]
@@ -930,12 +1123,37 @@ static int gmond_config_set_address(oconfig_item_t *ci, /* {{{ */
   return 0;
 } /* }}} int gmond_config_set_address */
 
+static int gmond_config_set_receive_threads(oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+
+  if (cf_util_get_int(ci, &tmp) != 0)
+    return -1;
+  else if ((tmp < 1) || (tmp > 256)) {
+    WARNING("gmond plugin: The `ReceiveThreads' must be between 1 and 256.");
+    return -1;
+  }
+
+#ifndef SO_REUSEPORT
+  if (tmp > 1) {
+    WARNING("gmond plugin: SO_REUSEPORT is not available on this system, "
+            "using a single receive thread.");
+    tmp = 1;
+  }
+#endif
+
+  mc_receive_threads = (size_t)tmp;
+  return 0;
+} /* }}} int gmond_config_set_receive_threads */
+
 static int gmond_config(oconfig_item_t *ci) /* {{{ */
 {
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp("MCReceiveFrom", child->key) == 0)
       gmond_config_set_address(child, &mc_receive_group, &mc_receive_port);
+    else if (strcasecmp("ReceiveThreads", child->key) == 0)
+      gmond_config_set_receive_threads(child);
     else if (strcasecmp("Metric", child->key) == 0)
       gmond_config_add_metric(child);
     else {
@@ -953,13 +1171,23 @@ static int gmond_init(void) /* {{{ */
       &mc_send_sockets, &mc_send_sockets_num,
       (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
       (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
-      /* listen = */ 0);
+      /* listen = */ 0, /* reuse_port = */ false, /* multicast = */ true);
 
-  staging_tree = c_avl_create((int (*)(const void *, const void *))strcmp);
-  if (staging_tree == NULL) {
-    ERROR("gmond plugin: c_avl_create failed.");
+  staging_shards = calloc(mc_receive_threads, sizeof(*staging_shards));
+  if (staging_shards == NULL) {
+    ERROR("gmond plugin: calloc failed.");
     return -1;
   }
+  for (size_t i = 0; i < mc_receive_threads; i++) {
+    staging_shards[i].tree =
+        c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (staging_shards[i].tree == NULL) {
+      ERROR("gmond plugin: c_avl_create failed.");
+      return -1;
+    }
+    pthread_mutex_init(&staging_shards[i].lock, /* attr = */ NULL);
+    staging_shards_num++;
+  }
 
   mc_receive_thread_start();
 
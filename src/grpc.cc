@@ -27,11 +27,15 @@
  **/
 
 #include <google/protobuf/util/time_util.h>
+#include <grpc++/alarm.h>
 #include <grpc++/grpc++.h>
 
+#include <atomic>
 #include <fstream>
 #include <iostream>
-#include <queue>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "collectd.grpc.pb.h"
@@ -53,6 +57,8 @@ using collectd::PutValuesRequest;
 using collectd::PutValuesResponse;
 using collectd::QueryValuesRequest;
 using collectd::QueryValuesResponse;
+using collectd::SubscribeValuesRequest;
+using collectd::SubscribeValuesResponse;
 
 using google::protobuf::util::TimeUtil;
 
@@ -71,6 +77,8 @@ struct Listener {
 };
 static std::vector<Listener> listeners;
 static grpc::string default_addr("0.0.0.0:50051");
+static size_t worker_threads = 2;
+static size_t subscription_queue_limit = 1000;
 
 /*
  * helper functions
@@ -329,8 +337,12 @@ static grpc::Status marshal_value_list(const value_list_t *vl,
   return grpc::Status::OK;
 } /* marshal_value_list */
 
+/* Fills in "vl", which must have room for as many values as "msg" contains,
+ * as returned by plugin_dispatch_values_reserve(). */
 static grpc::Status unmarshal_value_list(const collectd::types::ValueList &msg,
                                          value_list_t *vl) {
+  assert(vl->values_len == (size_t)msg.values_size());
+
   vl->time = NS_TO_CDTIME_T(TimeUtil::TimestampToNanoseconds(msg.time()));
   vl->interval =
       NS_TO_CDTIME_T(TimeUtil::DurationToNanoseconds(msg.interval()));
@@ -343,22 +355,9 @@ static grpc::Status unmarshal_value_list(const collectd::types::ValueList &msg,
   if (!status.ok())
     return status;
 
-  value_t *values = NULL;
-  size_t values_len = 0;
-
-  status = grpc::Status::OK;
+  size_t i = 0;
   for (auto v : msg.values()) {
-    value_t *val =
-        (value_t *)realloc(values, (values_len + 1) * sizeof(*values));
-    if (!val) {
-      status = grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
-                            grpc::string("failed to allocate values array"));
-      break;
-    }
-
-    values = val;
-    val = values + values_len;
-    values_len++;
+    value_t *val = vl->values + i++;
 
     switch (v.value_case()) {
     case collectd::types::Value::ValueCase::kCounter:
@@ -374,159 +373,524 @@ static grpc::Status unmarshal_value_list(const collectd::types::ValueList &msg,
       val->absolute = absolute_t(v.absolute());
       break;
     default:
-      status = grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
-                            grpc::string("unknown value type"));
-      break;
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                          grpc::string("unknown value type"));
     }
+  }
 
-    if (!status.ok())
-      break;
+  return grpc::Status::OK;
+} /* unmarshal_value_list() */
+
+/* Unmarshals "msg" straight into an entry of the write queue, saving the
+ * copy plugin_dispatch_values() would make, and dispatches it. */
+static grpc::Status dispatch_value_list(const collectd::types::ValueList &msg) {
+  if (msg.values_size() < 1)
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        grpc::string("missing values"));
+
+  value_list_t *vl = plugin_dispatch_values_reserve(msg.values_size());
+  if (vl == NULL)
+    return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                        grpc::string("failed to allocate value list"));
+
+  auto status = unmarshal_value_list(msg, vl);
+  if (!status.ok()) {
+    plugin_dispatch_values_cancel(vl);
+    return status;
   }
-  if (status.ok()) {
-    vl->values = values;
-    vl->values_len = values_len;
-  } else {
-    meta_data_destroy(vl->meta);
-    free(values);
+
+  auto ds = plugin_get_ds(vl->type);
+  if (ds == NULL) {
+    plugin_dispatch_values_cancel(vl);
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        grpc::string("unknown type"));
+  }
+  if (ds->ds_num != vl->values_len) {
+    plugin_dispatch_values_cancel(vl);
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        grpc::string("number of values does not match type"));
   }
 
-  return status;
-} /* unmarshal_value_list() */
+  if (plugin_dispatch_values_commit(vl, ds) != 0)
+    return grpc::Status(grpc::StatusCode::INTERNAL,
+                        grpc::string("failed to enqueue values for writing"));
+
+  return grpc::Status::OK;
+} /* dispatch_value_list() */
+
+static bool has_wildcard(grpc::string const &pattern) {
+  return pattern.find_first_of("*?[") != grpc::string::npos;
+} /* has_wildcard() */
+
+/* uc_query() filter applying the patterns of a QueryValues request. */
+static bool query_values_match(const char *name, void *user_data) {
+  value_list_t vl;
+  if (parse_identifier_vl(name, &vl) != 0)
+    return false;
+
+  return ident_matches(&vl, static_cast<value_list_t const *>(user_data));
+} /* query_values_match() */
 
 /*
  * Collectd service
+ *
+ * The service uses the asynchronous API: each call is an object driven by
+ * the events of a completion queue, which issues the call's next operation
+ * with itself as the tag. That way a few threads serve any number of
+ * streams instead of one gRPC thread being tied up per stream.
  */
-class CollectdImpl : public collectd::Collectd::Service {
+static std::atomic<bool> shutting_down(false);
+
+class Call {
 public:
-  grpc::Status
-  QueryValues(grpc::ServerContext *ctx, QueryValuesRequest const *req,
-              grpc::ServerWriter<QueryValuesResponse> *writer) override {
-    value_list_t match;
-    auto status = unmarshal_ident(req->identifier(), &match, false);
-    if (!status.ok()) {
-      return status;
-    }
+  virtual ~Call() {}
 
-    std::queue<value_list_t> value_lists;
-    status = this->queryValuesRead(&match, &value_lists);
-    if (status.ok()) {
-      status = this->queryValuesWrite(ctx, writer, &value_lists);
-    }
+  /* Handles the completion of the call's pending operation. */
+  virtual void Proceed(bool ok) = 0;
+};
+
+class PutValuesCall final : public Call {
+public:
+  PutValuesCall(collectd::Collectd::AsyncService *service,
+                grpc::ServerCompletionQueue *cq)
+      : service_(service), cq_(cq), reader_(&ctx_), state_(REQUEST) {
+    service_->RequestPutValues(&ctx_, &reader_, cq_, cq_, this);
+  }
 
-    while (!value_lists.empty()) {
-      auto vl = value_lists.front();
-      value_lists.pop();
-      sfree(vl.values);
-      meta_data_destroy(vl.meta);
+  void Proceed(bool ok) override {
+    switch (state_) {
+    case REQUEST:
+      if (!ok) {
+        delete this;
+        return;
+      }
+      if (!shutting_down)
+        new PutValuesCall(service_, cq_);
+      state_ = READ;
+      reader_.Read(&req_, this);
+      return;
+
+    case READ:
+      if (!ok) {
+        /* The client is done writing (or the server is shutting down). */
+        if (shutting_down) {
+          delete this;
+          return;
+        }
+        state_ = FINISH;
+        res_.Clear();
+        reader_.Finish(res_, grpc::Status::OK, this);
+        return;
+      }
+      {
+        auto status = dispatch_value_list(req_.value_list());
+        if (!status.ok()) {
+          state_ = FINISH;
+          reader_.FinishWithError(status, this);
+          return;
+        }
+      }
+      /* Only one read is pending per stream, so the stream's flow control
+       * keeps a client from sending faster than its values are dispatched. */
+      reader_.Read(&req_, this);
+      return;
+
+    case FINISH:
+      delete this;
+      return;
     }
+  }
 
-    return status;
+private:
+  enum State { REQUEST, READ, FINISH };
+
+  collectd::Collectd::AsyncService *service_;
+  grpc::ServerCompletionQueue *cq_;
+  grpc::ServerContext ctx_;
+  grpc::ServerAsyncReader<PutValuesResponse, PutValuesRequest> reader_;
+  PutValuesRequest req_;
+  PutValuesResponse res_;
+  State state_;
+}; /* class PutValuesCall */
+
+class QueryValuesCall final : public Call {
+public:
+  QueryValuesCall(collectd::Collectd::AsyncService *service,
+                  grpc::ServerCompletionQueue *cq)
+      : service_(service), cq_(cq), writer_(&ctx_), snapshots_(nullptr),
+        snapshots_num_(0), snapshots_index_(0), state_(REQUEST) {
+    service_->RequestQueryValues(&ctx_, &req_, &writer_, cq_, cq_, this);
   }
 
-  grpc::Status PutValues(grpc::ServerContext *ctx,
-                         grpc::ServerReader<PutValuesRequest> *reader,
-                         PutValuesResponse *res) override {
-    PutValuesRequest req;
+  ~QueryValuesCall() { uc_snapshots_free(snapshots_, snapshots_num_); }
 
-    while (reader->Read(&req)) {
-      value_list_t vl = {0};
-      auto status = unmarshal_value_list(req.value_list(), &vl);
-      if (!status.ok())
-        return status;
+  void Proceed(bool ok) override {
+    switch (state_) {
+    case REQUEST: {
+      if (!ok) {
+        delete this;
+        return;
+      }
+      if (!shutting_down)
+        new QueryValuesCall(service_, cq_);
 
-      if (plugin_dispatch_values(&vl))
-        return grpc::Status(
-            grpc::StatusCode::INTERNAL,
-            grpc::string("failed to enqueue values for writing"));
+      auto status = unmarshal_ident(req_.identifier(), &match_, false);
+      if (status.ok())
+        status = Query();
+      if (!status.ok()) {
+        state_ = FINISH;
+        writer_.Finish(status, this);
+        return;
+      }
+      WriteNext();
+      return;
     }
 
-    res->Clear();
-    return grpc::Status::OK;
+    case WRITE:
+      if (!ok) {
+        /* The client went away (or the server is shutting down). */
+        delete this;
+        return;
+      }
+      WriteNext();
+      return;
+
+    case FINISH:
+      delete this;
+      return;
+    }
   }
 
 private:
-  grpc::Status queryValuesRead(value_list_t const *match,
-                               std::queue<value_list_t> *value_lists) {
-    uc_iter_t *iter;
-    if ((iter = uc_get_iterator()) == NULL) {
-      return grpc::Status(
-          grpc::StatusCode::INTERNAL,
-          grpc::string("failed to query values: cannot create iterator"));
+  enum State { REQUEST, WRITE, FINISH };
+
+  /* Copies the matching cache entries. Patterns without wildcards for the
+   * host or plugin are looked up in the cache's indexes. */
+  grpc::Status Query() {
+    auto const &ident = req_.identifier();
+    uc_query_t query = {
+        .host = has_wildcard(ident.host()) ? NULL : match_.host,
+        .plugin = has_wildcard(ident.plugin()) ? NULL : match_.plugin,
+        .match = query_values_match,
+        .user_data = &match_,
+        .with_meta = true,
+    };
+
+    if (uc_query(&query, &snapshots_, &snapshots_num_) != 0)
+      return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                          grpc::string("failed to query values"));
+    return grpc::Status::OK;
+  }
+
+  /* Writes the next value list or finishes the call if none is left. */
+  void WriteNext() {
+    if (snapshots_index_ >= snapshots_num_) {
+      state_ = FINISH;
+      writer_.Finish(grpc::Status::OK, this);
+      return;
     }
 
+    uc_snapshot_t const *snap = snapshots_ + snapshots_index_++;
+    value_list_t vl = VALUE_LIST_INIT;
     grpc::Status status = grpc::Status::OK;
-    char *name = NULL;
-    while (uc_iterator_next(iter, &name) == 0) {
-      value_list_t vl;
-      if (parse_identifier_vl(name, &vl) != 0) {
-        status = grpc::Status(grpc::StatusCode::INTERNAL,
-                              grpc::string("failed to parse identifier"));
-        break;
-      }
+    if (parse_identifier_vl(snap->name, &vl) != 0)
+      status = grpc::Status(grpc::StatusCode::INTERNAL,
+                            grpc::string("failed to parse identifier"));
+
+    if (status.ok()) {
+      vl.time = snap->time;
+      vl.interval = snap->interval;
+      vl.values = snap->values;
+      vl.values_len = snap->values_num;
+      vl.meta = snap->meta;
+
+      res_.Clear();
+      status = marshal_value_list(&vl, res_.mutable_value_list());
+    }
+    if (!status.ok()) {
+      state_ = FINISH;
+      writer_.Finish(status, this);
+      return;
+    }
+
+    state_ = WRITE;
+    writer_.Write(res_, this);
+  }
+
+  collectd::Collectd::AsyncService *service_;
+  grpc::ServerCompletionQueue *cq_;
+  grpc::ServerContext ctx_;
+  grpc::ServerAsyncWriter<QueryValuesResponse> writer_;
+  QueryValuesRequest req_;
+  QueryValuesResponse res_;
+  value_list_t match_;
+  uc_snapshot_t *snapshots_;
+  size_t snapshots_num_;
+  size_t snapshots_index_;
+  State state_;
+}; /* class QueryValuesCall */
 
-      if (!ident_matches(&vl, match))
-        continue;
-      if (uc_iterator_get_time(iter, &vl.time) < 0) {
-        status =
-            grpc::Status(grpc::StatusCode::INTERNAL,
-                         grpc::string("failed to retrieve value timestamp"));
-        break;
+/*
+ * Subscriptions
+ *
+ * Active SubscribeValues calls are registered here and offered each value
+ * list by the "grpc/subscriptions" write callback. Updates are queued per
+ * call and written by the completion queue threads, which are woken up with
+ * an alarm.
+ */
+class SubscribeValuesCall;
+
+static std::mutex subscriptions_lock;
+static std::list<SubscribeValuesCall *> subscriptions;
+static std::atomic<size_t> subscriptions_num(0);
+static bool subscriptions_closed = false;
+
+static void subscription_add(SubscribeValuesCall *call) {
+  std::lock_guard<std::mutex> lock(subscriptions_lock);
+  if (subscriptions_closed)
+    return;
+  subscriptions.push_back(call);
+  subscriptions_num = subscriptions.size();
+} /* subscription_add() */
+
+static void subscription_remove(SubscribeValuesCall *call) {
+  std::lock_guard<std::mutex> lock(subscriptions_lock);
+  subscriptions.remove(call);
+  subscriptions_num = subscriptions.size();
+} /* subscription_remove() */
+
+/* Completes the gRPC "done" notification of a call, which is delivered
+ * separately from the call's operations. */
+class DoneTag final : public Call {
+public:
+  explicit DoneTag(SubscribeValuesCall *call) : call_(call) {}
+  void Proceed(bool ok) override;
+
+private:
+  SubscribeValuesCall *call_;
+};
+
+class SubscribeValuesCall final : public Call {
+public:
+  SubscribeValuesCall(collectd::Collectd::AsyncService *service,
+                      grpc::ServerCompletionQueue *cq)
+      : service_(service), cq_(cq), writer_(&ctx_), done_tag_(this) {
+    ctx_.AsyncNotifyWhenDone(&done_tag_);
+    service_->RequestSubscribeValues(&ctx_, &req_, &writer_, cq_, cq_, this);
+  }
+
+  /* Handles the completion of the request, an alarm or a write. */
+  void Proceed(bool ok) override {
+    std::unique_lock<std::mutex> lock(lock_);
+
+    if (!started_) {
+      if (!ok) {
+        /* The server is shutting down; the done tag is only delivered for
+         * calls which have started. */
+        lock.unlock();
+        delete this;
+        return;
       }
-      if (uc_iterator_get_interval(iter, &vl.interval) < 0) {
-        status =
-            grpc::Status(grpc::StatusCode::INTERNAL,
-                         grpc::string("failed to retrieve value interval"));
-        break;
+      started_ = true;
+      done_pending_ = true;
+      if (!shutting_down)
+        new SubscribeValuesCall(service_, cq_);
+
+      auto status = unmarshal_ident(req_.identifier(), &match_, false);
+      if (!status.ok()) {
+        finished_ = true;
+        writer_.Finish(status, this);
+        return;
       }
-      if (uc_iterator_get_values(iter, &vl.values, &vl.values_len) < 0) {
-        status = grpc::Status(grpc::StatusCode::INTERNAL,
-                              grpc::string("failed to retrieve values"));
-        break;
+
+      lock.unlock();
+      subscription_add(this);
+      lock.lock();
+      op_pending_ = false;
+      if (finished_) {
+        /* The client went away while the call was being registered. */
+        lock.unlock();
+        subscription_remove(this);
+        lock.lock();
+        MaybeDelete(lock);
+        return;
       }
-      if (uc_iterator_get_meta(iter, &vl.meta) < 0) {
-        status =
-            grpc::Status(grpc::StatusCode::INTERNAL,
-                         grpc::string("failed to retrieve value metadata"));
+    } else {
+      op_pending_ = false;
+      if (!ok || finished_) {
+        /* The client went away, the write failed or Finish() completed. */
+        finished_ = true;
+        pending_.clear();
+        pending_index_.clear();
+        MaybeDelete(lock);
+        return;
       }
+    }
 
-      value_lists->push(vl);
-    } // while (uc_iterator_next(iter, &name) == 0)
+    if (shutting_down) {
+      /* Subscriptions never end on their own, so end them here rather than
+       * having the server wait for them. */
+      finished_ = true;
+      pending_.clear();
+      pending_index_.clear();
+      op_pending_ = true;
+      writer_.Finish(grpc::Status(grpc::StatusCode::UNAVAILABLE,
+                                  "server is shutting down"),
+                     this);
+      return;
+    }
 
-    uc_iterator_destroy(iter);
-    return status;
+    WriteNextLocked();
   }
 
-  grpc::Status queryValuesWrite(grpc::ServerContext *ctx,
-                                grpc::ServerWriter<QueryValuesResponse> *writer,
-                                std::queue<value_list_t> *value_lists) {
-    while (!value_lists->empty()) {
-      auto vl = value_lists->front();
-      QueryValuesResponse res;
-      res.Clear();
+  /* Wakes up the call so it notices the server shutting down. Called with
+   * subscriptions_lock held. */
+  void Close() {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (op_pending_ || finished_)
+      return;
+    op_pending_ = true;
+    alarm_.Set(cq_, gpr_now(GPR_CLOCK_MONOTONIC), this);
+  }
 
-      auto status = marshal_value_list(&vl, res.mutable_value_list());
-      if (!status.ok()) {
-        return status;
-      }
+  /* Called by the done tag once the call is over. */
+  void Done() {
+    subscription_remove(this);
 
-      if (!writer->Write(res)) {
-        return grpc::Status::CANCELLED;
+    std::unique_lock<std::mutex> lock(lock_);
+    finished_ = true;
+    done_pending_ = false;
+    pending_.clear();
+    pending_index_.clear();
+    MaybeDelete(lock);
+  }
+
+  /* Queues "vl" if it matches the subscription. Called by the write threads
+   * with subscriptions_lock held. */
+  void Offer(value_list_t const *vl) {
+    if (!ident_matches(vl, &match_))
+      return;
+
+    char name[6 * DATA_MAX_NAME_LEN];
+    if (FORMAT_VL(name, sizeof(name), vl) != 0)
+      return;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (finished_)
+      return;
+
+    /* Coalesce: replace an update of the same value list which has not been
+     * written yet. */
+    SubscribeValuesResponse *res;
+    auto it = pending_index_.find(name);
+    if (it != pending_index_.end()) {
+      res = &it->second->second;
+    } else if (pending_.size() >= subscription_queue_limit) {
+      dropped_++;
+      return;
+    } else {
+      pending_.emplace_back(grpc::string(name), SubscribeValuesResponse());
+      pending_index_[name] = std::prev(pending_.end());
+      res = &pending_.back().second;
+    }
+
+    res->Clear();
+    if (!marshal_value_list(vl, res->mutable_value_list()).ok()) {
+      pending_index_.erase(name);
+      for (auto p = pending_.begin(); p != pending_.end(); ++p) {
+        if (p->first == name) {
+          pending_.erase(p);
+          break;
+        }
       }
+      return;
+    }
 
-      value_lists->pop();
-      sfree(vl.values);
+    if (!op_pending_) {
+      /* Wake up a completion queue thread to write the update. */
+      op_pending_ = true;
+      alarm_.Set(cq_, gpr_now(GPR_CLOCK_MONOTONIC), this);
     }
+  }
 
-    return grpc::Status::OK;
+private:
+  /* Writes the first pending update, if any. Must be called with lock_
+   * held and no operation pending. */
+  void WriteNextLocked() {
+    if (pending_.empty())
+      return;
+
+    res_ = std::move(pending_.front().second);
+    pending_index_.erase(pending_.front().first);
+    pending_.pop_front();
+
+    res_.set_dropped(dropped_);
+    dropped_ = 0;
+
+    op_pending_ = true;
+    writer_.Write(res_, this);
+  }
+
+  /* Deletes the call once neither an operation nor the done notification is
+   * outstanding. Releases "lock". */
+  void MaybeDelete(std::unique_lock<std::mutex> &lock) {
+    bool can_delete = !op_pending_ && !done_pending_;
+    lock.unlock();
+    if (can_delete)
+      delete this;
   }
-};
+
+  collectd::Collectd::AsyncService *service_;
+  grpc::ServerCompletionQueue *cq_;
+  grpc::ServerContext ctx_;
+  grpc::ServerAsyncWriter<SubscribeValuesResponse> writer_;
+  grpc::Alarm alarm_;
+  DoneTag done_tag_;
+  SubscribeValuesRequest req_;
+  SubscribeValuesResponse res_;
+  value_list_t match_;
+
+  std::mutex lock_;
+  bool started_ = false;
+  bool finished_ = false;
+  bool op_pending_ = true; /* the request itself */
+  bool done_pending_ = false;
+  uint64_t dropped_ = 0;
+  std::list<std::pair<grpc::string, SubscribeValuesResponse>> pending_;
+  std::unordered_map<grpc::string, decltype(pending_)::iterator>
+      pending_index_;
+}; /* class SubscribeValuesCall */
+
+void DoneTag::Proceed(__attribute__((unused)) bool ok) { call_->Done(); }
+
+static int subscriptions_write(__attribute__((unused)) data_set_t const *ds,
+                               value_list_t const *vl,
+                               __attribute__((unused)) user_data_t *ud) {
+  if (subscriptions_num == 0)
+    return 0;
+
+  std::lock_guard<std::mutex> lock(subscriptions_lock);
+  for (auto call : subscriptions)
+    call->Offer(vl);
+  return 0;
+} /* subscriptions_write() */
+
+/* Stops offering value lists to the subscriptions. */
+static void subscriptions_close(void) {
+  std::lock_guard<std::mutex> lock(subscriptions_lock);
+  subscriptions_closed = true;
+  for (auto call : subscriptions)
+    call->Close();
+  subscriptions.clear();
+  subscriptions_num = 0;
+} /* subscriptions_close() */
 
 /*
  * gRPC server implementation
  */
 class CollectdServer final {
 public:
-  void Start() {
+  int Start(size_t threads_num) {
     auto auth = grpc::InsecureServerCredentials();
 
     grpc::ServerBuilder builder;
@@ -552,15 +916,78 @@ public:
 
     builder.RegisterService(&collectd_service_);
 
+    /* One completion queue per thread, so the threads do not contend for a
+     * single queue. */
+    for (size_t i = 0; i < threads_num; i++)
+      cqs_.push_back(builder.AddCompletionQueue());
+
     server_ = builder.BuildAndStart();
+    if (!server_) {
+      ERROR("grpc: Failed to start server");
+      cqs_.clear();
+      return -1;
+    }
+
+    shutting_down = false;
+    subscriptions_closed = false;
+    for (auto &cq : cqs_) {
+      new PutValuesCall(&collectd_service_, cq.get());
+      new QueryValuesCall(&collectd_service_, cq.get());
+      new SubscribeValuesCall(&collectd_service_, cq.get());
+
+      pthread_t thread;
+      int status = plugin_thread_create(&thread, NULL, Serve, cq.get(),
+                                        "grpc server");
+      if (status != 0) {
+        char errbuf[256];
+        ERROR("grpc: Creating server thread failed: %s",
+              sstrerror(status, errbuf, sizeof(errbuf)));
+        Shutdown();
+        return -1;
+      }
+      threads_.push_back(thread);
+    }
+
+    return 0;
   } /* Start() */
 
-  void Shutdown() { server_->Shutdown(); } /* Shutdown() */
+  void Shutdown() {
+    shutting_down = true;
+    /* No alarms must be set once the queues are shut down. */
+    subscriptions_close();
+    if (server_)
+      server_->Shutdown();
+
+    /* The threads exit once their queues are drained, which deletes the
+     * remaining calls. Queues without a thread are drained here. */
+    for (auto &cq : cqs_)
+      cq->Shutdown();
+    for (auto thread : threads_)
+      pthread_join(thread, NULL);
+    for (size_t i = threads_.size(); i < cqs_.size(); i++)
+      Serve(cqs_[i].get());
+
+    threads_.clear();
+    cqs_.clear();
+  } /* Shutdown() */
 
 private:
-  CollectdImpl collectd_service_;
+  static void *Serve(void *arg) {
+    auto cq = static_cast<grpc::ServerCompletionQueue *>(arg);
+    void *tag;
+    bool ok;
+
+    while (cq->Next(&tag, &ok))
+      static_cast<Call *>(tag)->Proceed(ok);
+
+    return NULL;
+  } /* Serve() */
+
+  collectd::Collectd::AsyncService collectd_service_;
 
   std::unique_ptr<grpc::Server> server_;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+  std::vector<pthread_t> threads_;
 }; /* class CollectdServer */
 
 class CollectdClient final {
@@ -766,6 +1193,24 @@ static int c_grpc_config(oconfig_item_t *ci) {
     } else if (!strcasecmp("Server", child->key)) {
       if (c_grpc_config_server(child))
         return -1;
+    } else if (!strcasecmp("WorkerThreads", child->key)) {
+      int tmp = 0;
+      if (cf_util_get_int(child, &tmp) != 0)
+        return -1;
+      if ((tmp < 1) || (tmp > 64)) {
+        ERROR("grpc: `%s` must be between 1 and 64.", child->key);
+        return -1;
+      }
+      worker_threads = (size_t)tmp;
+    } else if (!strcasecmp("SubscriptionQueueLimit", child->key)) {
+      int tmp = 0;
+      if (cf_util_get_int(child, &tmp) != 0)
+        return -1;
+      if (tmp < 1) {
+        ERROR("grpc: `%s` must be positive.", child->key);
+        return -1;
+      }
+      subscription_queue_limit = (size_t)tmp;
     }
 
     else {
@@ -783,7 +1228,13 @@ static int c_grpc_init(void) {
     return -1;
   }
 
-  server->Start();
+  if (server->Start(worker_threads) != 0) {
+    delete server;
+    server = nullptr;
+    return -1;
+  }
+
+  plugin_register_write("grpc/subscriptions", subscriptions_write, NULL);
   return 0;
 } /* c_grpc_init() */
 
@@ -791,6 +1242,7 @@ static int c_grpc_shutdown(void) {
   if (!server)
     return 0;
 
+  plugin_unregister_write("grpc/subscriptions");
   server->Shutdown();
 
   delete server;
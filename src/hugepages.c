@@ -42,22 +42,42 @@ static bool g_values_pages = true;
 static bool g_values_bytes;
 static bool g_values_percent;
 
-#define HP_HAVE_NR 0x01
-#define HP_HAVE_SURPLUS 0x02
-#define HP_HAVE_FREE 0x04
-#define HP_HAVE_ALL 0x07
+static const char sys_mm_hugepages[] = "/sys/kernel/mm/hugepages";
+static const char sys_node[] = "/sys/devices/system/node";
 
 struct entry_info {
-  char *d_name;
   const char *node;
   size_t page_size_kb;
 
   gauge_t nr;
   gauge_t surplus;
   gauge_t free;
-  uint8_t flags;
 };
 
+/*
+ * The "hugepages-XXXXXkB" directories are discovered once. Their counter
+ * files are kept open and re-read with pread(2), which makes sysfs render
+ * the current value again. The list is rebuilt after a read error, e.g.
+ * when a node has been removed.
+ */
+enum { HP_NR, HP_SURPLUS, HP_FREE, HP_FILE_MAX };
+
+static char const *const hp_file_names[HP_FILE_MAX] = {
+        [HP_NR] = "nr_hugepages",
+        [HP_SURPLUS] = "surplus_hugepages",
+        [HP_FREE] = "free_hugepages",
+};
+
+typedef struct {
+  char node[DATA_MAX_NAME_LEN];
+  size_t page_size_kb;
+  int fds[HP_FILE_MAX];
+} hp_entry_t;
+
+static hp_entry_t *g_entries;
+static size_t g_entries_num;
+static bool g_discovered;
+
 static int hp_config(oconfig_item_t *ci) {
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
@@ -119,62 +139,65 @@ static void submit_hp(const struct entry_info *info) {
   }
 }
 
-static int read_hugepage_entry(const char *path, const char *entry,
-                               void *e_info) {
-  char path2[PATH_MAX];
-  struct entry_info *info = e_info;
-  double value;
+static void hp_entries_free(void) {
+  for (size_t i = 0; i < g_entries_num; i++)
+    for (int j = 0; j < HP_FILE_MAX; j++)
+      if (g_entries[i].fds[j] >= 0)
+        close(g_entries[i].fds[j]);
 
-  snprintf(path2, sizeof(path2), "%s/%s", path, entry);
-
-  FILE *fh = fopen(path2, "rt");
-  if (fh == NULL) {
-    ERROR("%s: cannot open %s", g_plugin_name, path2);
-    return -1;
-  }
+  sfree(g_entries);
+  g_entries_num = 0;
+  g_discovered = false;
+}
 
-  if (fscanf(fh, "%lf", &value) != 1) {
-    ERROR("%s: cannot parse file %s", g_plugin_name, path2);
-    fclose(fh);
-    return -1;
-  }
-  fclose(fh);
-
-  if (strcmp(entry, "nr_hugepages") == 0) {
-    info->nr = value;
-    info->flags |= HP_HAVE_NR;
-  } else if (strcmp(entry, "surplus_hugepages") == 0) {
-    info->surplus = value;
-    info->flags |= HP_HAVE_SURPLUS;
-  } else if (strcmp(entry, "free_hugepages") == 0) {
-    info->free = value;
-    info->flags |= HP_HAVE_FREE;
+/* Opens the counter files below "dir_fd", a "hugepages-XXXXXkB" directory,
+ * and appends them to the entries. */
+static int hp_entry_add(int dir_fd, const char *node, size_t page_size_kb,
+                        const char *path) {
+  hp_entry_t *tmp =
+      realloc(g_entries, (g_entries_num + 1) * sizeof(*g_entries));
+  if (tmp == NULL) {
+    ERROR("%s: realloc failed", g_plugin_name);
+    return ENOMEM;
   }
-
-  if (info->flags != HP_HAVE_ALL) {
-    return 0;
+  g_entries = tmp;
+
+  hp_entry_t *e = g_entries + g_entries_num;
+  sstrncpy(e->node, node, sizeof(e->node));
+  e->page_size_kb = page_size_kb;
+
+  for (int i = 0; i < HP_FILE_MAX; i++) {
+    e->fds[i] = openat(dir_fd, hp_file_names[i], O_RDONLY | O_CLOEXEC);
+    if (e->fds[i] < 0) {
+      int status = errno;
+      ERROR("%s: cannot open %s/%s: %s", g_plugin_name, path,
+            hp_file_names[i], STRERRNO);
+      for (int j = 0; j < i; j++)
+        close(e->fds[j]);
+      return status;
+    }
   }
 
-  submit_hp(info);
-
-  /* Reset flags so subsequent calls don't submit again. */
-  info->flags = 0;
+  g_entries_num++;
   return 0;
 }
 
-static int read_syshugepages(const char *path, const char *node) {
+static int read_syshugepages(int parent_fd, const char *path,
+                             const char *node) {
   static const char hugepages_dir[] = "hugepages-";
   DIR *dir;
   struct dirent *result;
-  char path2[PATH_MAX];
 
-  dir = opendir(path);
-  if (dir == NULL) {
+  int fd = openat(parent_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if ((fd < 0) || ((dir = fdopendir(fd)) == NULL)) {
     ERROR("%s: cannot open directory %s", g_plugin_name, path);
+    if (fd >= 0)
+      close(fd);
     return -1;
   }
 
   /* read "hugepages-XXXXXkB" entries */
+  errno = 0;
   while ((result = readdir(dir)) != NULL) {
     if (strncmp(result->d_name, hugepages_dir, sizeof(hugepages_dir) - 1)) {
       /* not node dir */
@@ -182,24 +205,28 @@ static int read_syshugepages(const char *path, const char *node) {
       continue;
     }
 
-    long page_size = strtol(result->d_name + strlen(hugepages_dir),
-                            /* endptr = */ NULL, /* base = */ 10);
-    if (errno != 0) {
-      ERROR("%s: failed to determine page size from directory name \"%s\": %s",
-            g_plugin_name, result->d_name, STRERRNO);
+    char *endptr = NULL;
+    unsigned long page_size =
+        strtoul(result->d_name + strlen(hugepages_dir), &endptr,
+                /* base = */ 10);
+    if ((endptr == result->d_name + strlen(hugepages_dir)) ||
+        (strcmp(endptr, "kB") != 0)) {
+      ERROR("%s: failed to determine page size from directory name \"%s\"",
+            g_plugin_name, result->d_name);
+      errno = 0;
       continue;
     }
 
-    /* /sys/devices/system/node/node?/hugepages/ */
-    snprintf(path2, sizeof(path2), "%s/%s", path, result->d_name);
-
-    walk_directory(path2, read_hugepage_entry,
-                   &(struct entry_info){
-                       .d_name = result->d_name,
-                       .node = node,
-                       .page_size_kb = (size_t)page_size,
-                   },
-                   /* hidden = */ 0);
+    /* /sys/devices/system/node/node?/hugepages/hugepages-XXXXXkB */
+    int page_fd =
+        openat(dirfd(dir), result->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (page_fd < 0) {
+      ERROR("%s: cannot open directory %s/%s: %s", g_plugin_name, path,
+            result->d_name, STRERRNO);
+    } else {
+      hp_entry_add(page_fd, node, (size_t)page_size, path);
+      close(page_fd);
+    }
     errno = 0;
   }
 
@@ -215,10 +242,7 @@ static int read_syshugepages(const char *path, const char *node) {
 }
 
 static int read_nodes(void) {
-  static const char sys_node[] = "/sys/devices/system/node";
   static const char node_string[] = "node";
-  static const char sys_node_hugepages[] =
-      "/sys/devices/system/node/%s/hugepages";
   DIR *dir;
   struct dirent *result;
   char path[PATH_MAX];
@@ -229,6 +253,7 @@ static int read_nodes(void) {
     return -1;
   }
 
+  errno = 0;
   while ((result = readdir(dir)) != NULL) {
     if (strncmp(result->d_name, node_string, sizeof(node_string) - 1)) {
       /* not node dir */
@@ -236,8 +261,8 @@ static int read_nodes(void) {
       continue;
     }
 
-    snprintf(path, sizeof(path), sys_node_hugepages, result->d_name);
-    read_syshugepages(path, result->d_name);
+    snprintf(path, sizeof(path), "%s/hugepages", result->d_name);
+    read_syshugepages(dirfd(dir), path, result->d_name);
     errno = 0;
   }
 
@@ -252,11 +277,9 @@ static int read_nodes(void) {
   return 0;
 }
 
-static int huge_read(void) {
-  static const char sys_mm_hugepages[] = "/sys/kernel/mm/hugepages";
-
+static int hp_discover(void) {
   if (g_flag_rpt_mm) {
-    if (read_syshugepages(sys_mm_hugepages, "mm") != 0) {
+    if (read_syshugepages(AT_FDCWD, sys_mm_hugepages, "mm") != 0) {
       return -1;
     }
   }
@@ -266,10 +289,75 @@ static int huge_read(void) {
     }
   }
 
+  g_discovered = true;
+  return 0;
+}
+
+static int hp_read_value(int fd, gauge_t *ret_value) {
+  char buffer[32];
+
+  ssize_t len = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (len <= 0)
+    return -1;
+  buffer[len] = 0;
+
+  char *endptr = NULL;
+  double value = strtod(buffer, &endptr);
+  if (endptr == buffer)
+    return -1;
+
+  *ret_value = (gauge_t)value;
+  return 0;
+}
+
+static int huge_read(void) {
+  if (!g_discovered) {
+    if (hp_discover() != 0) {
+      hp_entries_free();
+      return -1;
+    }
+  }
+
+  bool failed = false;
+  for (size_t i = 0; i < g_entries_num; i++) {
+    hp_entry_t *e = g_entries + i;
+    gauge_t values[HP_FILE_MAX];
+    int j;
+
+    for (j = 0; j < HP_FILE_MAX; j++)
+      if (hp_read_value(e->fds[j], values + j) != 0)
+        break;
+
+    if (j < HP_FILE_MAX) {
+      ERROR("%s: cannot read %s of %s-%zuKb", g_plugin_name, hp_file_names[j],
+            e->node, e->page_size_kb);
+      failed = true;
+      continue;
+    }
+
+    submit_hp(&(struct entry_info){
+        .node = e->node,
+        .page_size_kb = e->page_size_kb,
+        .nr = values[HP_NR],
+        .surplus = values[HP_SURPLUS],
+        .free = values[HP_FREE],
+    });
+  }
+
+  /* Rediscover the directories on the next read. */
+  if (failed)
+    hp_entries_free();
+
+  return 0;
+}
+
+static int huge_shutdown(void) {
+  hp_entries_free();
   return 0;
 }
 
 void module_register(void) {
   plugin_register_complex_config(g_plugin_name, hp_config);
   plugin_register_read(g_plugin_name, huge_read);
+  plugin_register_shutdown(g_plugin_name, huge_shutdown);
 }
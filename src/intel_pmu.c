@@ -409,14 +409,61 @@ static void pmu_dispatch_data(void) {
   }
 }
 
+/* Reads all members of the group led by "leader" on "core" with a single
+ * read(). The leader was opened with PERF_FORMAT_GROUP, so the kernel returns
+ * the shared enabled/running times followed by one value per member, in the
+ * order the members were attached. Members which failed to open on this core
+ * are not part of the group. */
+static int pmu_read_group(struct event *leader, int core) {
+  size_t num = 0;
+
+  for (struct event *e = leader; e; e = e->next) {
+    if (e->efd[core].fd >= 0)
+      num++;
+    if (e->end_group)
+      break;
+  }
+
+  uint64_t buf[3 + num];
+  ssize_t len = read(leader->efd[core].fd, buf, sizeof(buf));
+  if (len < (ssize_t)(3 * sizeof(buf[0]))) {
+    ERROR(PMU_PLUGIN ": Failed to read group of %s/%d event: %s",
+          leader->event, core, len < 0 ? STRERRNO : "short read");
+    return -1;
+  }
+
+  if (buf[0] != num || len != (ssize_t)sizeof(buf)) {
+    ERROR(PMU_PLUGIN ": Group of %s/%d event returned %" PRIu64
+                     " values, expected %" PRIsz ".",
+          leader->event, core, buf[0], num);
+    return -1;
+  }
+
+  size_t idx = 3;
+  for (struct event *e = leader; e; e = e->next) {
+    if (e->efd[core].fd >= 0) {
+      e->efd[core].val[0] = buf[idx++];
+      e->efd[core].val[1] = buf[1];
+      e->efd[core].val[2] = buf[2];
+    }
+    if (e->end_group)
+      break;
+  }
+
+  return 0;
+}
+
 static int pmu_read(__attribute__((unused)) user_data_t *ud) {
   int ret;
-  struct event *e;
+  struct event *e, *leader = NULL;
 
   DEBUG(PMU_PLUGIN ": %s:%d", __FUNCTION__, __LINE__);
 
   /* read all events only for configured cores */
   for (e = g_ctx.event_list->eventlist; e; e = e->next) {
+    if (e->group_leader && (e->attr.read_format & PERF_FORMAT_GROUP))
+      leader = e;
+
     for (size_t i = 0; i < g_ctx.cores.num_cgroups; i++) {
       core_group_t *cgroup = g_ctx.cores.cgroups + i;
       for (size_t j = 0; j < cgroup->num_cores; j++) {
@@ -424,6 +471,17 @@ static int pmu_read(__attribute__((unused)) user_data_t *ud) {
         if (e->efd[core].fd < 0)
           continue;
 
+        /* Group members are read together with their leader. If the leader
+         * is not available on this core, members were opened standalone. */
+        if (leader != NULL && leader->efd[core].fd >= 0) {
+          if (e != leader)
+            continue;
+          ret = pmu_read_group(leader, core);
+          if (ret != 0)
+            return ret;
+          continue;
+        }
+
         ret = read_event(e, core);
         if (ret != 0) {
           ERROR(PMU_PLUGIN ": Failed to read value of %s/%d event.", e->event,
@@ -432,6 +490,9 @@ static int pmu_read(__attribute__((unused)) user_data_t *ud) {
         }
       }
     }
+
+    if (e->end_group)
+      leader = NULL;
   }
 
   pmu_dispatch_data();
@@ -439,8 +500,10 @@ static int pmu_read(__attribute__((unused)) user_data_t *ud) {
   return 0;
 }
 
+/* If "grouped" is set, the events are added as one perf group so that they are
+ * scheduled together and can be read with a single read() per core. */
 static int pmu_add_events(struct eventlist *el, uint32_t type,
-                          event_info_t *events, size_t count) {
+                          event_info_t *events, size_t count, bool grouped) {
 
   for (size_t i = 0; i < count; i++) {
     /* Allocate memory for event struct that contains array of efd structs
@@ -461,6 +524,11 @@ static int pmu_add_events(struct eventlist *el, uint32_t type,
       el->eventlist_last->next = e;
     el->eventlist_last = e;
     e->event = strdup(events[i].name);
+
+    if (grouped && count > 1) {
+      e->group_leader = (i == 0);
+      e->end_group = (i == count - 1);
+    }
   }
 
   return 0;
@@ -547,17 +615,35 @@ static int pmu_setup_events(struct eventlist *el, bool measure_all,
 
   for (e = el->eventlist; e; e = e->next) {
 
+    /* whole group is read through the leader, see pmu_read_group() */
+    bool group_opened = false;
+    if (e->group_leader)
+      e->attr.read_format |= PERF_FORMAT_GROUP;
+
     for (size_t i = 0; i < g_ctx.cores.num_cgroups; i++) {
       core_group_t *cgroup = g_ctx.cores.cgroups + i;
       for (size_t j = 0; j < cgroup->num_cores; j++) {
         int core = (int)cgroup->cores[j];
+        int status = setup_event(e, core, leader, measure_all, measure_pid);
+
+        /* Older kernels refuse PERF_FORMAT_GROUP on inherited events. Fall
+         * back to reading the members one by one in that case. */
+        if (status < 0 && !group_opened &&
+            (e->attr.read_format & PERF_FORMAT_GROUP)) {
+          INFO(PMU_PLUGIN ": group reads are not supported for '%s'.",
+               e->event);
+          e->attr.read_format &= ~PERF_FORMAT_GROUP;
+          status = setup_event(e, core, leader, measure_all, measure_pid);
+        }
 
-        if (setup_event(e, core, leader, measure_all, measure_pid) < 0) {
+        if (status < 0) {
           WARNING(PMU_PLUGIN ": perf event '%s' is not available (cpu=%d).",
                   e->event, core);
         } else {
           /* success if at least one event was set */
           ret = 0;
+          if (e->attr.read_format & PERF_FORMAT_GROUP)
+            group_opened = true;
         }
       }
     }
@@ -603,7 +689,7 @@ static int pmu_init(void) {
   if (g_ctx.hw_cache_events) {
     ret =
         pmu_add_events(g_ctx.event_list, PERF_TYPE_HW_CACHE, g_hw_cache_events,
-                       STATIC_ARRAY_SIZE(g_hw_cache_events));
+                       STATIC_ARRAY_SIZE(g_hw_cache_events), false);
     if (ret != 0) {
       ERROR(PMU_PLUGIN ": Failed to add hw cache events.");
       goto init_error;
@@ -613,7 +699,7 @@ static int pmu_init(void) {
   if (g_ctx.kernel_pmu_events) {
     ret = pmu_add_events(g_ctx.event_list, PERF_TYPE_HARDWARE,
                          g_kernel_pmu_events,
-                         STATIC_ARRAY_SIZE(g_kernel_pmu_events));
+                         STATIC_ARRAY_SIZE(g_kernel_pmu_events), false);
     if (ret != 0) {
       ERROR(PMU_PLUGIN ": Failed to add kernel PMU events.");
       goto init_error;
@@ -639,8 +725,10 @@ static int pmu_init(void) {
   }
 
   if (g_ctx.sw_events) {
+    /* Software events are not limited by hardware counters, so grouping
+     * them never prevents scheduling. */
     ret = pmu_add_events(g_ctx.event_list, PERF_TYPE_SOFTWARE, g_sw_events,
-                         STATIC_ARRAY_SIZE(g_sw_events));
+                         STATIC_ARRAY_SIZE(g_sw_events), true);
     if (ret != 0) {
       ERROR(PMU_PLUGIN ": Failed to add software events.");
       goto init_error;
@@ -26,7 +26,9 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_ignorelist.h"
+#include "utils_summary.h"
 
 #if HAVE_SYS_TYPES_H
 #include <sys/types.h>
@@ -42,6 +44,13 @@
 #if HAVE_LINUX_NETDEVICE_H
 #include <linux/netdevice.h>
 #endif
+#if KERNEL_LINUX && HAVE_RTNL_LINK_STATS64
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#define IF_HAVE_NETLINK 1
+#else
+#define IF_HAVE_NETLINK 0
+#endif
 #if HAVE_IFADDRS_H
 #include <ifaddrs.h>
 #endif
@@ -82,7 +91,8 @@ static int pnif;
  * (Module-)Global variables
  */
 static const char *config_keys[] = {
-    "Interface", "IgnoreSelected", "ReportInactive",
+    "Interface",      "IgnoreSelected", "ReportInactive",
+    "SampleInterval", "UseNetlink",
 };
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
@@ -90,6 +100,34 @@ static ignorelist_t *ignorelist;
 
 static bool report_inactive = true;
 
+/* High-resolution mode: when sample_interval is non-zero, the read callback
+ * runs every sample_interval and if_submit() only records the rates. Once per
+ * dispatch_interval, the counters are dispatched together with the minimum,
+ * maximum and 99th percentile of the rates. */
+struct if_sample_s {
+  derive_t rx;
+  derive_t tx;
+  value_to_rate_state_t rx_conv;
+  value_to_rate_state_t tx_conv;
+  summary_t rx_summary;
+  summary_t tx_summary;
+  bool updated;
+};
+typedef struct if_sample_s if_sample_t;
+
+static cdtime_t sample_interval;
+static cdtime_t dispatch_interval;
+static cdtime_t next_dispatch;
+static c_avl_tree_t *samples; /* "<device>/<type>" -> if_sample_t */
+
+#if IF_HAVE_NETLINK
+/* Reads the counters with a RTM_GETLINK dump instead of parsing
+ * /proc/net/dev. The socket is kept open between reads. */
+static bool use_netlink;
+static int nl_fd = -1;
+static uint32_t nl_seq;
+#endif
+
 #ifdef HAVE_LIBKSTAT
 #if HAVE_KSTAT_H
 #include <kstat.h>
@@ -114,6 +152,21 @@ static int interface_config(const char *key, const char *value) {
     ignorelist_set_invert(ignorelist, invert);
   } else if (strcasecmp(key, "ReportInactive") == 0)
     report_inactive = IS_TRUE(value);
+  else if (strcasecmp(key, "SampleInterval") == 0) {
+    double tmp = atof(value);
+    if (tmp < 0.0) {
+      WARNING("interface plugin: SampleInterval must not be negative.");
+      return -1;
+    }
+    sample_interval = DOUBLE_TO_CDTIME_T(tmp);
+  } else if (strcasecmp(key, "UseNetlink") == 0) {
+#if IF_HAVE_NETLINK
+    use_netlink = IS_TRUE(value);
+#else
+    WARNING("interface plugin: the \"UseNetlink\" option is only valid on "
+            "Linux.");
+#endif
+  }
   else if (strcasecmp(key, "UniqueName") == 0) {
 #ifdef HAVE_LIBKSTAT
     if (IS_TRUE(value))
@@ -130,7 +183,7 @@ static int interface_config(const char *key, const char *value) {
 }
 
 #if HAVE_LIBKSTAT
-static int interface_init(void) {
+static int interface_init_kstat(void) {
   kstat_t *ksp_chain;
 
   numif = 0;
@@ -153,29 +206,247 @@ static int interface_init(void) {
   }
 
   return 0;
-} /* int interface_init */
+} /* int interface_init_kstat */
 #endif /* HAVE_LIBKSTAT */
 
-static void if_submit(const char *dev, const char *type, derive_t rx,
-                      derive_t tx) {
+static void if_dispatch(const char *dev, const char *type, value_t *values,
+                        size_t values_num) {
   value_list_t vl = VALUE_LIST_INIT;
-  value_t values[] = {
-      {.derive = rx}, {.derive = tx},
-  };
-
-  if (ignorelist_match(ignorelist, dev) != 0)
-    return;
 
   vl.values = values;
-  vl.values_len = STATIC_ARRAY_SIZE(values);
+  vl.values_len = values_num;
+  /* The read callback runs every SampleInterval in high-resolution mode. */
+  if (sample_interval != 0)
+    vl.interval = dispatch_interval;
   sstrncpy(vl.plugin, "interface", sizeof(vl.plugin));
   sstrncpy(vl.plugin_instance, dev, sizeof(vl.plugin_instance));
   sstrncpy(vl.type, type, sizeof(vl.type));
 
   plugin_dispatch_values(&vl);
+} /* void if_dispatch */
+
+static void if_sample_free(if_sample_t *is) {
+  if (is == NULL)
+    return;
+
+  summary_destroy(&is->rx_summary);
+  summary_destroy(&is->tx_summary);
+  sfree(is);
+} /* void if_sample_free */
+
+/* Records the counters and their rates in high-resolution mode. */
+static void if_sample(const char *dev, const char *type, derive_t rx,
+                      derive_t tx) {
+  char key[2 * DATA_MAX_NAME_LEN];
+  if_sample_t *is = NULL;
+  cdtime_t now = cdtime();
+
+  snprintf(key, sizeof(key), "%s/%s", dev, type);
+  if (c_avl_get(samples, key, (void *)&is) != 0) {
+    char *key_copy = strdup(key);
+    is = calloc(1, sizeof(*is));
+    if ((key_copy == NULL) || (is == NULL) ||
+        (c_avl_insert(samples, key_copy, is) != 0)) {
+      ERROR("interface plugin: Adding \"%s\" failed.", key);
+      sfree(key_copy);
+      sfree(is);
+      return;
+    }
+  }
+
+  is->rx = rx;
+  is->tx = tx;
+  is->updated = true;
+
+  gauge_t rate;
+  if (value_to_rate(&rate, (value_t){.derive = rx}, DS_TYPE_DERIVE, now,
+                    &is->rx_conv) == 0)
+    summary_add(&is->rx_summary, rate);
+  if (value_to_rate(&rate, (value_t){.derive = tx}, DS_TYPE_DERIVE, now,
+                    &is->tx_conv) == 0)
+    summary_add(&is->tx_summary, rate);
+} /* void if_sample */
+
+/* Dispatches the counters and rate summaries recorded since the last call in
+ * high-resolution mode. Interfaces which have disappeared are forgotten. */
+static void if_commit_samples(void) {
+  c_avl_iterator_t *iter = c_avl_get_iterator(samples);
+  char **stale = NULL;
+  size_t stale_num = 0;
+  char *key;
+  if_sample_t *is;
+
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&is) == 0) {
+    if (!is->updated) {
+      strarray_add(&stale, &stale_num, key);
+      continue;
+    }
+    is->updated = false;
+
+    /* Split "<device>/<type>"; the device name may not contain a slash. */
+    char dev[2 * DATA_MAX_NAME_LEN];
+    sstrncpy(dev, key, sizeof(dev));
+    char *type = strrchr(dev, '/');
+    if (type == NULL)
+      continue;
+    *type = 0;
+    type++;
+
+    if_dispatch(dev, type,
+                (value_t[]){{.derive = is->rx}, {.derive = is->tx}}, 2);
+
+    if ((summary_num(&is->rx_summary) != 0) ||
+        (summary_num(&is->tx_summary) != 0)) {
+      value_t values[] = {
+          {.gauge = summary_min(&is->rx_summary)},
+          {.gauge = summary_max(&is->rx_summary)},
+          {.gauge = summary_percentile(&is->rx_summary, 99.0)},
+          {.gauge = summary_min(&is->tx_summary)},
+          {.gauge = summary_max(&is->tx_summary)},
+          {.gauge = summary_percentile(&is->tx_summary, 99.0)},
+      };
+      value_list_t vl = VALUE_LIST_INIT;
+
+      vl.values = values;
+      vl.values_len = STATIC_ARRAY_SIZE(values);
+      vl.interval = dispatch_interval;
+      sstrncpy(vl.plugin, "interface", sizeof(vl.plugin));
+      sstrncpy(vl.plugin_instance, dev, sizeof(vl.plugin_instance));
+      sstrncpy(vl.type, "if_rate_summary", sizeof(vl.type));
+      /* "if_octets" -> "octets" */
+      if (strncmp(type, "if_", strlen("if_")) == 0)
+        type += strlen("if_");
+      sstrncpy(vl.type_instance, type, sizeof(vl.type_instance));
+
+      plugin_dispatch_values(&vl);
+    }
+
+    summary_reset(&is->rx_summary);
+    summary_reset(&is->tx_summary);
+  }
+  c_avl_iterator_destroy(iter);
+
+  for (size_t i = 0; i < stale_num; i++) {
+    if (c_avl_remove(samples, stale[i], (void *)&key, (void *)&is) == 0) {
+      sfree(key);
+      if_sample_free(is);
+    }
+  }
+  strarray_free(stale, stale_num);
+} /* void if_commit_samples */
+
+static void if_submit(const char *dev, const char *type, derive_t rx,
+                      derive_t tx) {
+  if (ignorelist_match(ignorelist, dev) != 0)
+    return;
+
+  if (sample_interval != 0) {
+    if_sample(dev, type, rx, tx);
+    return;
+  }
+
+  if_dispatch(dev, type, (value_t[]){{.derive = rx}, {.derive = tx}}, 2);
 } /* void if_submit */
 
-static int interface_read(void) {
+#if IF_HAVE_NETLINK
+/* Handles one RTM_NEWLINK message of the dump. */
+static void if_netlink_link(struct nlmsghdr *nlh) {
+  struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+  int len = (int)nlh->nlmsg_len - (int)NLMSG_LENGTH(sizeof(*ifi));
+  char const *dev = NULL;
+  struct rtnl_link_stats64 stats;
+  bool have_stats = false;
+
+  for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+       rta = RTA_NEXT(rta, len)) {
+    if (rta->rta_type == IFLA_IFNAME) {
+      dev = RTA_DATA(rta);
+      /* The ignorelist is applied as soon as the name is known, so that the
+       * attributes of ignored interfaces are not looked at. */
+      if (ignorelist_match(ignorelist, dev) != 0)
+        return;
+    } else if ((rta->rta_type == IFLA_STATS64) &&
+               (RTA_PAYLOAD(rta) >= sizeof(stats))) {
+      /* The attribute payload is only 4-byte aligned. */
+      memcpy(&stats, RTA_DATA(rta), sizeof(stats));
+      have_stats = true;
+    }
+  }
+
+  if ((dev == NULL) || !have_stats)
+    return;
+
+  if (!report_inactive && (stats.rx_packets == 0) && (stats.tx_packets == 0))
+    return;
+
+  if_submit(dev, "if_packets", (derive_t)stats.rx_packets,
+            (derive_t)stats.tx_packets);
+  if_submit(dev, "if_octets", (derive_t)stats.rx_bytes,
+            (derive_t)stats.tx_bytes);
+  if_submit(dev, "if_errors", (derive_t)stats.rx_errors,
+            (derive_t)stats.tx_errors);
+  if_submit(dev, "if_dropped", (derive_t)stats.rx_dropped,
+            (derive_t)stats.tx_dropped);
+} /* void if_netlink_link */
+
+static int if_read_netlink(void) {
+  /* Kernels send dump messages of up to 32 KiB. */
+  static char buffer[32768];
+  struct {
+    struct nlmsghdr nlh;
+    struct ifinfomsg ifi;
+  } req = {
+      .nlh =
+          {
+              .nlmsg_len = sizeof(req),
+              .nlmsg_type = RTM_GETLINK,
+              .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+              .nlmsg_seq = ++nl_seq,
+          },
+      .ifi = {.ifi_family = AF_UNSPEC},
+  };
+
+  if (send(nl_fd, &req, sizeof(req), 0) < 0) {
+    ERROR("interface plugin: Sending the RTM_GETLINK request failed: %s",
+          STRERRNO);
+    return -1;
+  }
+
+  while (42) {
+    ssize_t status = recv(nl_fd, buffer, sizeof(buffer), 0);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("interface plugin: Receiving the RTM_GETLINK dump failed: %s",
+            STRERRNO);
+      return -1;
+    }
+
+    int len = (int)status;
+    for (struct nlmsghdr *nlh = (struct nlmsghdr *)buffer; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      /* Skip the remains of an earlier, aborted dump. */
+      if (nlh->nlmsg_seq != nl_seq)
+        continue;
+
+      if (nlh->nlmsg_type == NLMSG_DONE)
+        return 0;
+
+      if (nlh->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr *err = NLMSG_DATA(nlh);
+        ERROR("interface plugin: RTM_GETLINK failed: %s",
+              STRERROR(-err->error));
+        return -1;
+      }
+
+      if (nlh->nlmsg_type == RTM_NEWLINK)
+        if_netlink_link(nlh);
+    }
+  }
+} /* int if_read_netlink */
+#endif /* IF_HAVE_NETLINK */
+
+static int interface_read_counters(void) {
 #if HAVE_GETIFADDRS
   struct ifaddrs *if_list;
 
@@ -229,59 +500,62 @@ static int interface_read(void) {
 /* #endif HAVE_GETIFADDRS */
 
 #elif KERNEL_LINUX
-  FILE *fh;
-  char buffer[1024];
+  static proc_file_t *pf;
+  char *buffer;
+  char *line;
   derive_t incoming, outgoing;
   char *device;
 
   char *dummy;
-  char *fields[16];
-  int numfields;
+  uint64_t fields[16];
+  size_t numfields;
 
-  if ((fh = fopen("/proc/net/dev", "r")) == NULL) {
-    WARNING("interface plugin: fopen: %s", STRERRNO);
+  if ((pf == NULL) && ((pf = proc_file_open("/proc/net/dev")) == NULL)) {
+    WARNING("interface plugin: open: %s", STRERRNO);
     return -1;
   }
 
-  while (fgets(buffer, 1024, fh) != NULL) {
-    if (!(dummy = strchr(buffer, ':')))
+  if (proc_file_read(pf, &buffer) < 0)
+    return -1;
+
+  for (char *ptr = buffer; (line = proc_file_line(&ptr)) != NULL;) {
+    if (!(dummy = strchr(line, ':')))
       continue;
     dummy[0] = '\0';
     dummy++;
 
-    device = buffer;
+    device = line;
     while (device[0] == ' ')
       device++;
 
     if (device[0] == '\0')
       continue;
 
-    numfields = strsplit(dummy, fields, 16);
+    numfields = parse_uint64_fields(dummy, fields,
+                                    STATIC_ARRAY_SIZE(fields), NULL);
 
-    if (numfields < 11)
+    if (numfields < 12)
       continue;
 
-    incoming = atoll(fields[1]);
-    outgoing = atoll(fields[9]);
+    incoming = (derive_t)fields[1];
+    outgoing = (derive_t)fields[9];
     if (!report_inactive && incoming == 0 && outgoing == 0)
       continue;
 
     if_submit(device, "if_packets", incoming, outgoing);
 
-    incoming = atoll(fields[0]);
-    outgoing = atoll(fields[8]);
+    incoming = (derive_t)fields[0];
+    outgoing = (derive_t)fields[8];
     if_submit(device, "if_octets", incoming, outgoing);
 
-    incoming = atoll(fields[2]);
-    outgoing = atoll(fields[10]);
+    incoming = (derive_t)fields[2];
+    outgoing = (derive_t)fields[10];
     if_submit(device, "if_errors", incoming, outgoing);
 
-    incoming = atoll(fields[3]);
-    outgoing = atoll(fields[11]);
+    incoming = (derive_t)fields[3];
+    outgoing = (derive_t)fields[11];
     if_submit(device, "if_dropped", incoming, outgoing);
   }
-
-  fclose(fh);
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -383,14 +657,81 @@ static int interface_read(void) {
   }
 #endif /* HAVE_PERFSTAT */
 
+  return 0;
+} /* int interface_read_counters */
+
+static int interface_read(__attribute__((unused)) user_data_t *ud) {
+  int status;
+
+#if IF_HAVE_NETLINK
+  if (use_netlink)
+    status = if_read_netlink();
+  else
+#endif
+    status = interface_read_counters();
+  if (status != 0)
+    return status;
+
+  if (sample_interval != 0) {
+    cdtime_t now = cdtime();
+    if (now >= next_dispatch) {
+      if_commit_samples();
+      next_dispatch += dispatch_interval;
+      if (next_dispatch <= now)
+        next_dispatch = now + dispatch_interval;
+    }
+  }
+
   return 0;
 } /* int interface_read */
 
+static int interface_init(void) {
+  if (sample_interval != 0) {
+    dispatch_interval = plugin_get_interval();
+    if (sample_interval >= dispatch_interval) {
+      WARNING("interface plugin: SampleInterval (%.3f) is not smaller than "
+              "the interval (%.3f); disabling high-resolution mode.",
+              CDTIME_T_TO_DOUBLE(sample_interval),
+              CDTIME_T_TO_DOUBLE(dispatch_interval));
+      sample_interval = 0;
+    } else {
+      samples = c_avl_create((int (*)(const void *, const void *))strcmp);
+      if (samples == NULL) {
+        ERROR("interface plugin: c_avl_create failed.");
+        return -1;
+      }
+      next_dispatch = cdtime() + dispatch_interval;
+    }
+  }
+
+#if IF_HAVE_NETLINK
+  if (use_netlink) {
+    nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl_fd < 0) {
+      WARNING("interface plugin: Opening the netlink socket failed: %s. "
+              "Falling back to /proc/net/dev.",
+              STRERRNO);
+      use_netlink = false;
+    }
+  }
+#endif
+
+  /* An interval of zero uses the plugin's interval. */
+  int status = plugin_register_complex_read(/* group = */ NULL, "interface",
+                                            interface_read, sample_interval,
+                                            /* user data = */ NULL);
+  if (status != 0)
+    return status;
+
+#if HAVE_LIBKSTAT
+  return interface_init_kstat();
+#else
+  return 0;
+#endif
+} /* int interface_init */
+
 void module_register(void) {
   plugin_register_config("interface", interface_config, config_keys,
                          config_keys_num);
-#if HAVE_LIBKSTAT
   plugin_register_init("interface", interface_init);
-#endif
-  plugin_register_read("interface", interface_read);
 } /* void module_register */
@@ -62,11 +62,17 @@ struct c_ipmi_instance_s {
   char *username;
   char *password;
   unsigned int authtype;
+  char *sdr_cache_file;
+  cdtime_t stable_interval;
+  unsigned int max_outstanding; /* zero: unlimited */
 
   bool connected;
   ipmi_con_t *connection;
   pthread_mutex_t sensor_list_lock;
   c_ipmi_sensor_list_t *sensor_list;
+  unsigned int outstanding; /* readings requested, but not received yet */
+  unsigned int stable_cycles_max;
+  bool requesting; /* a thread is in sensor_list_read_pending() */
 
   bool active;
   pthread_t thread_id;
@@ -85,6 +91,16 @@ struct c_ipmi_sensor_list_s {
   c_ipmi_sensor_list_t *next;
   c_ipmi_instance_t *instance;
   unsigned int use;
+
+  /* Sensors which are neither temperature nor power sensors are read less
+   * often while their reading doesn't change. In the cycles in between, the
+   * last value is dispatched again. */
+  bool fast;
+  bool pending; /* reading is due, waiting for a free request slot */
+  bool have_value;
+  double value;
+  unsigned int stable_cycles; /* cycles to skip after an unchanged reading */
+  unsigned int skip_cycles;   /* cycles left to skip */
 };
 
 struct c_ipmi_db_type_map_s {
@@ -172,18 +188,54 @@ static notification_t c_ipmi_notification_init(c_ipmi_instance_t const *st,
  */
 /* Prototype for sensor_list_remove, so sensor_read_handler can call it. */
 static int sensor_list_remove(c_ipmi_instance_t *st, ipmi_sensor_t *sensor);
+static void sensor_list_read_pending(c_ipmi_instance_t *st);
 
-static void sensor_read_handler(ipmi_sensor_t *sensor, int err,
-                                enum ipmi_value_present_e value_present,
-                                unsigned int __attribute__((unused)) raw_value,
-                                double value, ipmi_states_t *states,
-                                void *user_data) {
+static void sensor_submit(c_ipmi_instance_t *st,
+                          c_ipmi_sensor_list_t *list_item, double value) {
   value_list_t vl = VALUE_LIST_INIT;
 
-  c_ipmi_sensor_list_t *list_item = user_data;
-  c_ipmi_instance_t *st = list_item->instance;
+  vl.values = &(value_t){.gauge = value};
+  vl.values_len = 1;
 
-  list_item->use--;
+  if (st->host != NULL)
+    sstrncpy(vl.host, st->host, sizeof(vl.host));
+  sstrncpy(vl.plugin, "ipmi", sizeof(vl.plugin));
+  sstrncpy(vl.type, list_item->sensor_type, sizeof(vl.type));
+  sstrncpy(vl.type_instance, list_item->type_instance,
+           sizeof(vl.type_instance));
+
+  plugin_dispatch_values(&vl);
+} /* void sensor_submit */
+
+/* Doubles the number of cycles the sensor is skipped while its reading
+ * doesn't change, starting over once it does. Must be called with
+ * `sensor_list_lock' held. */
+static void sensor_update_interval(c_ipmi_instance_t *st,
+                                   c_ipmi_sensor_list_t *list_item,
+                                   double value) {
+  if (list_item->fast || (st->stable_cycles_max == 0)) {
+    list_item->stable_cycles = 0;
+  } else if (list_item->have_value && (list_item->value == value)) {
+    if (list_item->stable_cycles == 0)
+      list_item->stable_cycles = 1;
+    else if (2 * list_item->stable_cycles <= st->stable_cycles_max)
+      list_item->stable_cycles *= 2;
+    else
+      list_item->stable_cycles = st->stable_cycles_max;
+  } else {
+    list_item->stable_cycles = 0;
+  }
+
+  list_item->skip_cycles = list_item->stable_cycles;
+  list_item->have_value = true;
+  list_item->value = value;
+} /* void sensor_update_interval */
+
+static void sensor_read_result(ipmi_sensor_t *sensor, int err,
+                               enum ipmi_value_present_e value_present,
+                               double value, ipmi_states_t *states,
+                               c_ipmi_sensor_list_t *list_item) {
+  c_ipmi_instance_t *st = list_item->instance;
 
   if (err != 0) {
     if (IPMI_IS_IPMI_ERR(err) &&
@@ -286,17 +338,31 @@ static void sensor_read_handler(ipmi_sensor_t *sensor, int err,
     return;
   }
 
-  vl.values = &(value_t){.gauge = value};
-  vl.values_len = 1;
+  pthread_mutex_lock(&st->sensor_list_lock);
+  sensor_update_interval(st, list_item, value);
+  pthread_mutex_unlock(&st->sensor_list_lock);
 
-  if (st->host != NULL)
-    sstrncpy(vl.host, st->host, sizeof(vl.host));
-  sstrncpy(vl.plugin, "ipmi", sizeof(vl.plugin));
-  sstrncpy(vl.type, list_item->sensor_type, sizeof(vl.type));
-  sstrncpy(vl.type_instance, list_item->type_instance,
-           sizeof(vl.type_instance));
+  sensor_submit(st, list_item, value);
+} /* void sensor_read_result */
 
-  plugin_dispatch_values(&vl);
+static void sensor_read_handler(ipmi_sensor_t *sensor, int err,
+                                enum ipmi_value_present_e value_present,
+                                unsigned int __attribute__((unused)) raw_value,
+                                double value, ipmi_states_t *states,
+                                void *user_data) {
+  c_ipmi_sensor_list_t *list_item = user_data;
+  c_ipmi_instance_t *st = list_item->instance;
+
+  pthread_mutex_lock(&st->sensor_list_lock);
+  list_item->use--;
+  st->outstanding--;
+  pthread_mutex_unlock(&st->sensor_list_lock);
+
+  /* `list_item' may be removed and freed by this. */
+  sensor_read_result(sensor, err, value_present, value, states, list_item);
+
+  /* A request slot has become available. */
+  sensor_list_read_pending(st);
 } /* void sensor_read_handler */
 
 static void sensor_get_name(ipmi_sensor_t *sensor, char *buffer, int buf_len) {
@@ -505,6 +571,8 @@ static int sensor_list_add(c_ipmi_instance_t *st, ipmi_sensor_t *sensor) {
   sstrncpy(list_item->sensor_name, sensor_name_ptr,
            sizeof(list_item->sensor_name));
   sstrncpy(list_item->sensor_type, type, sizeof(list_item->sensor_type));
+  list_item->fast =
+      (strcmp("temperature", type) == 0) || (strcmp("power", type) == 0);
 
   pthread_mutex_unlock(&st->sensor_list_lock);
 
@@ -571,7 +639,56 @@ static int sensor_list_remove(c_ipmi_instance_t *st, ipmi_sensor_t *sensor) {
   return 0;
 } /* int sensor_list_remove */
 
+/* Requests the readings of pending sensors, keeping at most
+ * `max_outstanding' requests in flight. The lock is not held while a reading
+ * is requested, because OpenIPMI may call the handler right away on errors.
+ * Only one thread issues requests at a time, a handler freeing a slot
+ * meanwhile leaves it to that thread. */
+static void sensor_list_read_pending(c_ipmi_instance_t *st) {
+  pthread_mutex_lock(&st->sensor_list_lock);
+
+  if (st->requesting) {
+    pthread_mutex_unlock(&st->sensor_list_lock);
+    return;
+  }
+  st->requesting = true;
+
+  while ((st->max_outstanding == 0) ||
+         (st->outstanding < st->max_outstanding)) {
+    c_ipmi_sensor_list_t *list_item = st->sensor_list;
+    while ((list_item != NULL) && !list_item->pending)
+      list_item = list_item->next;
+    if (list_item == NULL)
+      break;
+
+    list_item->pending = false;
+    list_item->use++;
+    st->outstanding++;
+    ipmi_sensor_id_t sensor_id = list_item->sensor_id;
+
+    pthread_mutex_unlock(&st->sensor_list_lock);
+    int status = ipmi_sensor_id_get_reading(sensor_id, sensor_read_handler,
+                                            /* user data = */ list_item);
+    pthread_mutex_lock(&st->sensor_list_lock);
+
+    if (status != 0) {
+      /* The sensor may have been removed in the meantime. */
+      for (c_ipmi_sensor_list_t *item = st->sensor_list; item != NULL;
+           item = item->next)
+        if (item == list_item)
+          item->use--;
+      st->outstanding--;
+    }
+  }
+
+  st->requesting = false;
+  pthread_mutex_unlock(&st->sensor_list_lock);
+} /* void sensor_list_read_pending */
+
 static int sensor_list_read_all(c_ipmi_instance_t *st) {
+  c_ipmi_sensor_list_t *stable = NULL;
+  size_t stable_num = 0;
+
   pthread_mutex_lock(&st->sensor_list_lock);
 
   for (c_ipmi_sensor_list_t *list_item = st->sensor_list; list_item != NULL;
@@ -580,16 +697,40 @@ static int sensor_list_read_all(c_ipmi_instance_t *st) {
           list_item->sensor_name, st->name, list_item->use);
 
     /* Reading already initiated */
-    if (list_item->use)
+    if (list_item->use || list_item->pending)
       continue;
 
-    list_item->use++;
-    ipmi_sensor_id_get_reading(list_item->sensor_id, sensor_read_handler,
-                               /* user data = */ (void *)list_item);
+    if (list_item->skip_cycles > 0) {
+      list_item->skip_cycles--;
+      stable_num++;
+      continue;
+    }
+
+    list_item->pending = true;
   } /* for (list_item) */
 
+  /* Copy the values of the skipped sensors, so they can be dispatched without
+   * holding the lock. */
+  if (stable_num > 0)
+    stable = calloc(stable_num, sizeof(*stable));
+  if (stable != NULL) {
+    size_t i = 0;
+    for (c_ipmi_sensor_list_t *list_item = st->sensor_list;
+         (list_item != NULL) && (i < stable_num); list_item = list_item->next)
+      if (!list_item->use && !list_item->pending && list_item->have_value &&
+          (list_item->skip_cycles < list_item->stable_cycles))
+        stable[i++] = *list_item;
+    stable_num = i;
+  }
+
   pthread_mutex_unlock(&st->sensor_list_lock);
 
+  sensor_list_read_pending(st);
+
+  for (size_t i = 0; (stable != NULL) && (i < stable_num); i++)
+    sensor_submit(st, stable + i, stable[i].value);
+  sfree(stable);
+
   return 0;
 } /* int sensor_list_read_all */
 
@@ -947,8 +1088,11 @@ static int c_ipmi_thread_init(c_ipmi_instance_t *st) {
   ipmi_open_option_t opts[] = {
       {.option = IPMI_OPEN_OPTION_ALL, {.ival = 1}},
 #ifdef IPMI_OPEN_OPTION_USE_CACHE
-      /* OpenIPMI-2.0.17 and later: Disable SDR cache in local file */
-      {.option = IPMI_OPEN_OPTION_USE_CACHE, {.ival = 0}},
+      /* OpenIPMI-2.0.17 and later: Keep the SDRs in a local file only if
+       * requested. OpenIPMI checks the cached copy against the BMC's SDR
+       * repository timestamps and fetches the SDRs again if it is stale. */
+      {.option = IPMI_OPEN_OPTION_USE_CACHE,
+       {.ival = (st->sdr_cache_file != NULL) ? 1 : 0}},
 #endif
   };
 
@@ -1044,6 +1188,7 @@ static void c_ipmi_free_instance(c_ipmi_instance_t *st) {
   sfree(st->connaddr);
   sfree(st->username);
   sfree(st->password);
+  sfree(st->sdr_cache_file);
 
   ignorelist_free(st->sel_ignorelist);
   ignorelist_free(st->ignorelist);
@@ -1142,6 +1287,19 @@ static int c_ipmi_config_add_instance(oconfig_item_t *ci) {
         WARNING("ipmi plugin: The value \"%s\" is not valid for the "
                 "\"AuthType\" option.",
                 tmp);
+    } else if (strcasecmp("SDRCacheFile", child->key) == 0)
+      status = cf_util_get_string(child, &st->sdr_cache_file);
+    else if (strcasecmp("StableSensorInterval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &st->stable_interval);
+    else if (strcasecmp("MaxOutstandingRequests", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < 0)) {
+        WARNING("ipmi plugin: The \"MaxOutstandingRequests\" option must not "
+                "be negative.");
+        status = -1;
+      }
+      st->max_outstanding = (unsigned int)tmp;
     } else {
       WARNING("ipmi plugin: Option `%s' not allowed here.", child->key);
       status = -1;
@@ -1236,6 +1394,30 @@ static int c_ipmi_init(void) {
     return -1;
   };
 
+#ifdef IPMI_OPEN_OPTION_USE_CACHE
+  /* The SDR cache file is shared by all domains, each domain's SDRs are
+   * stored under its own key. */
+  char *sdr_cache_file = NULL;
+  for (st = instances; st != NULL; st = st->next) {
+    if (st->sdr_cache_file == NULL)
+      continue;
+    if (sdr_cache_file == NULL)
+      sdr_cache_file = st->sdr_cache_file;
+    else if (strcmp(sdr_cache_file, st->sdr_cache_file) != 0)
+      WARNING("ipmi plugin: Instance `%s': All instances share one SDR "
+              "cache file, ignoring \"%s\" in favor of \"%s\".",
+              st->name, st->sdr_cache_file, sdr_cache_file);
+  }
+
+  if ((sdr_cache_file != NULL) && (os_handler->database_set_filename != NULL)) {
+    int status =
+        os_handler->database_set_filename(os_handler, sdr_cache_file);
+    if (status != 0)
+      ERROR("ipmi plugin: Setting the SDR cache file to \"%s\" failed: %s",
+            sdr_cache_file, STRERROR(status));
+  }
+#endif
+
   if (instances == NULL) {
     /* No instances were configured, let's start a default instance. */
     st = c_ipmi_init_instance();
@@ -1273,6 +1455,8 @@ static int c_ipmi_init(void) {
 
     st->init_in_progress = cycles;
     st->active = true;
+    st->stable_cycles_max =
+        (unsigned int)(st->stable_interval / plugin_get_interval());
 
     status = plugin_thread_create(&st->thread_id, /* attr = */ NULL,
                                   c_ipmi_thread_main,
@@ -36,6 +36,15 @@
 #include <sys/capability.h>
 #endif
 
+#if HAVE_LINUX_NETFILTER_NF_TABLES_H
+#include <endian.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nf_tables_compat.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netlink.h>
+#endif
+
 /*
  * iptc_handle_t was available before libiptc was officially available as a
  * shared library. Note, that when the shared lib was introduced, the API and
@@ -63,7 +72,7 @@ typedef struct ip6tc_handle ip6tc_handle_t;
  * Config format should be `Chain table chainname',
  * e. g. `Chain mangle incoming'
  */
-static const char *config_keys[] = {"Chain", "Chain6"};
+static const char *config_keys[] = {"Chain", "Chain6", "Backend"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 enum protocol_version_e { IPV4, IPV6 };
 typedef enum protocol_version_e protocol_version_t;
@@ -89,11 +98,31 @@ typedef struct {
 static ip_chain_t **chain_list;
 static int chain_num;
 
+/*
+ * With the "nftables" backend, the rules of each configured chain are
+ * dumped via nfnetlink, as maintained by iptables-nft. Unlike iptc_init(),
+ * which copies the whole table, only the rules of the chain are transferred.
+ */
+static enum { BACKEND_LIBIPTC, BACKEND_NFTABLES } backend = BACKEND_LIBIPTC;
+
 static int iptables_config(const char *key, const char *value) {
   /* int ip_value; */
   protocol_version_t ip_version = 0;
 
-  if (strcasecmp(key, "Chain") == 0)
+  if (strcasecmp(key, "Backend") == 0) {
+    if (strcasecmp(value, "libiptc") == 0) {
+      backend = BACKEND_LIBIPTC;
+      return 0;
+    }
+#if HAVE_LINUX_NETFILTER_NF_TABLES_H
+    if (strcasecmp(value, "nftables") == 0) {
+      backend = BACKEND_NFTABLES;
+      return 0;
+    }
+#endif
+    ERROR("iptables plugin: Unsupported backend: \"%s\"", value);
+    return 1;
+  } else if (strcasecmp(key, "Chain") == 0)
     ip_version = IPV4;
   else if (strcasecmp(key, "Chain6") == 0)
     ip_version = IPV6;
@@ -201,30 +230,18 @@ static int iptables_config(const char *key, const char *value) {
   return 0;
 } /* int iptables_config */
 
-static int submit6_match(const struct ip6t_entry_match *match,
-                         const struct ip6t_entry *entry,
-                         const ip_chain_t *chain, int rule_num) {
+static void submit_counters(const ip_chain_t *chain, const char *comment,
+                            uint64_t bytes, uint64_t packets) {
   int status;
   value_list_t vl = VALUE_LIST_INIT;
 
-  /* Select the rules to collect */
-  if (chain->rule_type == RTYPE_NUM) {
-    if (chain->rule.num != rule_num)
-      return 0;
-  } else {
-    if (strcmp(match->u.user.name, "comment") != 0)
-      return 0;
-    if ((chain->rule_type == RTYPE_COMMENT) &&
-        (strcmp(chain->rule.comment, (char *)match->data) != 0))
-      return 0;
-  }
-
-  sstrncpy(vl.plugin, "ip6tables", sizeof(vl.plugin));
+  sstrncpy(vl.plugin, (chain->ip_version == IPV6) ? "ip6tables" : "iptables",
+           sizeof(vl.plugin));
 
   status = snprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "%s-%s",
                     chain->table, chain->chain);
   if ((status < 1) || ((unsigned int)status >= sizeof(vl.plugin_instance)))
-    return 0;
+    return;
 
   if (chain->name[0] != '\0') {
     sstrncpy(vl.type_instance, chain->name, sizeof(vl.type_instance));
@@ -233,18 +250,45 @@ static int submit6_match(const struct ip6t_entry_match *match,
       snprintf(vl.type_instance, sizeof(vl.type_instance), "%i",
                chain->rule.num);
     else
-      sstrncpy(vl.type_instance, (char *)match->data, sizeof(vl.type_instance));
+      sstrncpy(vl.type_instance, comment, sizeof(vl.type_instance));
   }
 
   sstrncpy(vl.type, "ipt_bytes", sizeof(vl.type));
-  vl.values = &(value_t){.derive = (derive_t)entry->counters.bcnt};
+  vl.values = &(value_t){.derive = (derive_t)bytes};
   vl.values_len = 1;
   plugin_dispatch_values(&vl);
 
   sstrncpy(vl.type, "ipt_packets", sizeof(vl.type));
-  vl.values = &(value_t){.derive = (derive_t)entry->counters.pcnt};
+  vl.values = &(value_t){.derive = (derive_t)packets};
   plugin_dispatch_values(&vl);
+} /* void submit_counters */
+
+/* Returns true if the rule with the given number and comment, which may be
+ * NULL, is to be collected. */
+static bool rule_selected(const ip_chain_t *chain, int rule_num,
+                          const char *comment) {
+  if (chain->rule_type == RTYPE_NUM)
+    return chain->rule.num == rule_num;
+  if (comment == NULL)
+    return false;
+  if (chain->rule_type == RTYPE_COMMENT)
+    return strcmp(chain->rule.comment, comment) == 0;
+  return true;
+} /* bool rule_selected */
+
+static int submit6_match(const struct ip6t_entry_match *match,
+                         const struct ip6t_entry *entry,
+                         const ip_chain_t *chain, int rule_num) {
+  const char *comment = NULL;
+
+  if ((match != NULL) && (strcmp(match->u.user.name, "comment") == 0))
+    comment = (const char *)match->data;
+
+  /* Select the rules to collect */
+  if (!rule_selected(chain, rule_num, comment))
+    return 0;
 
+  submit_counters(chain, comment, entry->counters.bcnt, entry->counters.pcnt);
   return 0;
 } /* int submit6_match */
 
@@ -252,47 +296,16 @@ static int submit6_match(const struct ip6t_entry_match *match,
 static int submit_match(const struct ipt_entry_match *match,
                         const struct ipt_entry *entry, const ip_chain_t *chain,
                         int rule_num) {
-  int status;
-  value_list_t vl = VALUE_LIST_INIT;
-
-  /* Select the rules to collect */
-  if (chain->rule_type == RTYPE_NUM) {
-    if (chain->rule.num != rule_num)
-      return 0;
-  } else {
-    if (strcmp(match->u.user.name, "comment") != 0)
-      return 0;
-    if ((chain->rule_type == RTYPE_COMMENT) &&
-        (strcmp(chain->rule.comment, (char *)match->data) != 0))
-      return 0;
-  }
+  const char *comment = NULL;
 
-  sstrncpy(vl.plugin, "iptables", sizeof(vl.plugin));
+  if ((match != NULL) && (strcmp(match->u.user.name, "comment") == 0))
+    comment = (const char *)match->data;
 
-  status = snprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "%s-%s",
-                    chain->table, chain->chain);
-  if ((status < 1) || ((unsigned int)status >= sizeof(vl.plugin_instance)))
+  /* Select the rules to collect */
+  if (!rule_selected(chain, rule_num, comment))
     return 0;
 
-  if (chain->name[0] != '\0') {
-    sstrncpy(vl.type_instance, chain->name, sizeof(vl.type_instance));
-  } else {
-    if (chain->rule_type == RTYPE_NUM)
-      snprintf(vl.type_instance, sizeof(vl.type_instance), "%i",
-               chain->rule.num);
-    else
-      sstrncpy(vl.type_instance, (char *)match->data, sizeof(vl.type_instance));
-  }
-
-  sstrncpy(vl.type, "ipt_bytes", sizeof(vl.type));
-  vl.values = &(value_t){.derive = (derive_t)entry->counters.bcnt};
-  vl.values_len = 1;
-  plugin_dispatch_values(&vl);
-
-  sstrncpy(vl.type, "ipt_packets", sizeof(vl.type));
-  vl.values = &(value_t){.derive = (derive_t)entry->counters.pcnt};
-  plugin_dispatch_values(&vl);
-
+  submit_counters(chain, comment, entry->counters.bcnt, entry->counters.pcnt);
   return 0;
 } /* int submit_match */
 
@@ -346,11 +359,316 @@ static void submit_chain(iptc_handle_t *handle, ip_chain_t *chain) {
   } /* while (entry) */
 }
 
+static bool chain_same(const ip_chain_t *a, const ip_chain_t *b,
+                       bool same_chain) {
+  return (a->ip_version == b->ip_version) &&
+         (strcmp(a->table, b->table) == 0) &&
+         (!same_chain || (strcmp(a->chain, b->chain) == 0));
+} /* bool chain_same */
+
+/* Returns true if an earlier entry of chain_list refers to the same table
+ * and, if "same_chain" is set, chain as entry "idx". */
+static bool chain_seen(int idx, bool same_chain) {
+  for (int i = 0; i < idx; i++)
+    if (chain_same(chain_list[i], chain_list[idx], same_chain))
+      return true;
+
+  return false;
+} /* bool chain_seen */
+
+#if HAVE_LINUX_NETFILTER_NF_TABLES_H
+static int nft_fd = -1;
+static uint32_t nft_seq;
+
+/* Stores the attributes in [data, data + len) by type in "tb", which has
+ * room for "max" + 1 entries. */
+static void nft_parse_attrs(const void *data, int len,
+                            const struct nlattr **tb, int max) {
+  const struct nlattr *attr = data;
+
+  memset(tb, 0, sizeof(*tb) * (max + 1));
+  while ((len >= (int)sizeof(*attr)) && (attr->nla_len >= sizeof(*attr)) &&
+         (attr->nla_len <= len)) {
+    int type = attr->nla_type & NLA_TYPE_MASK;
+    if (type <= max)
+      tb[type] = attr;
+
+    len -= NLA_ALIGN(attr->nla_len);
+    attr = (const void *)((const char *)attr + NLA_ALIGN(attr->nla_len));
+  }
+} /* void nft_parse_attrs */
+
+static const void *nft_attr_data(const struct nlattr *attr) {
+  return (const char *)attr + NLA_HDRLEN;
+}
+
+static int nft_attr_len(const struct nlattr *attr) {
+  return (int)attr->nla_len - NLA_HDRLEN;
+}
+
+/* Compares a string attribute to "str". */
+static bool nft_attr_streq(const struct nlattr *attr, const char *str) {
+  return (attr != NULL) &&
+         (strncmp(nft_attr_data(attr), str, (size_t)nft_attr_len(attr)) ==
+          0) &&
+         (strlen(str) < (size_t)nft_attr_len(attr));
+}
+
+static uint64_t nft_attr_u64(const struct nlattr *attr) {
+  uint64_t value = 0;
+
+  if ((attr != NULL) && (nft_attr_len(attr) >= (int)sizeof(value)))
+    memcpy(&value, nft_attr_data(attr), sizeof(value));
+  return be64toh(value);
+}
+
+/* Copies the comment of a rule into "buffer". iptables-nft stores comments
+ * either in the rule's user data or as an xtables "comment" match. */
+static const char *nft_rule_comment(const struct nlattr **rule, char *buffer,
+                                    size_t buffer_size) {
+  if (rule[NFTA_RULE_USERDATA] != NULL) {
+    const uint8_t *udata = nft_attr_data(rule[NFTA_RULE_USERDATA]);
+    int len = nft_attr_len(rule[NFTA_RULE_USERDATA]);
+
+    /* Type-length-value entries with one byte each for type and length. */
+    while (len >= 2) {
+      int entry_len = udata[1];
+      if (entry_len + 2 > len)
+        break;
+      /* NFTNL_UDATA_RULE_COMMENT */
+      if ((udata[0] == 0) && (entry_len > 0)) {
+        size_t n = ((size_t)entry_len < buffer_size) ? (size_t)entry_len
+                                                     : buffer_size - 1;
+        memcpy(buffer, udata + 2, n);
+        buffer[n] = 0;
+        return buffer;
+      }
+      udata += entry_len + 2;
+      len -= entry_len + 2;
+    }
+  }
+
+  if (rule[NFTA_RULE_EXPRESSIONS] == NULL)
+    return NULL;
+
+  const struct nlattr *list = rule[NFTA_RULE_EXPRESSIONS];
+  const struct nlattr *elem = nft_attr_data(list);
+  int len = nft_attr_len(list);
+
+  while ((len >= (int)sizeof(*elem)) && (elem->nla_len >= sizeof(*elem)) &&
+         (elem->nla_len <= len)) {
+    const struct nlattr *expr[NFTA_EXPR_MAX + 1];
+    const struct nlattr *match[NFTA_MATCH_MAX + 1];
+
+    nft_parse_attrs(nft_attr_data(elem), nft_attr_len(elem), expr,
+                    NFTA_EXPR_MAX);
+    if (nft_attr_streq(expr[NFTA_EXPR_NAME], "match") &&
+        (expr[NFTA_EXPR_DATA] != NULL)) {
+      nft_parse_attrs(nft_attr_data(expr[NFTA_EXPR_DATA]),
+                      nft_attr_len(expr[NFTA_EXPR_DATA]), match,
+                      NFTA_MATCH_MAX);
+      if (nft_attr_streq(match[NFTA_MATCH_NAME], "comment") &&
+          (match[NFTA_MATCH_INFO] != NULL)) {
+        int info_len = nft_attr_len(match[NFTA_MATCH_INFO]);
+        size_t n = ((size_t)info_len < buffer_size) ? (size_t)info_len
+                                                    : buffer_size - 1;
+        memcpy(buffer, nft_attr_data(match[NFTA_MATCH_INFO]), n);
+        buffer[n] = 0;
+        return buffer;
+      }
+    }
+
+    len -= NLA_ALIGN(elem->nla_len);
+    elem = (const void *)((const char *)elem + NLA_ALIGN(elem->nla_len));
+  }
+
+  return NULL;
+} /* const char *nft_rule_comment */
+
+/* Finds the rule's "counter" expression. Returns zero if there is one. */
+static int nft_rule_counters(const struct nlattr **rule, uint64_t *bytes,
+                             uint64_t *packets) {
+  if (rule[NFTA_RULE_EXPRESSIONS] == NULL)
+    return -1;
+
+  const struct nlattr *list = rule[NFTA_RULE_EXPRESSIONS];
+  const struct nlattr *elem = nft_attr_data(list);
+  int len = nft_attr_len(list);
+
+  while ((len >= (int)sizeof(*elem)) && (elem->nla_len >= sizeof(*elem)) &&
+         (elem->nla_len <= len)) {
+    const struct nlattr *expr[NFTA_EXPR_MAX + 1];
+    const struct nlattr *counter[NFTA_COUNTER_MAX + 1];
+
+    nft_parse_attrs(nft_attr_data(elem), nft_attr_len(elem), expr,
+                    NFTA_EXPR_MAX);
+    if (nft_attr_streq(expr[NFTA_EXPR_NAME], "counter") &&
+        (expr[NFTA_EXPR_DATA] != NULL)) {
+      nft_parse_attrs(nft_attr_data(expr[NFTA_EXPR_DATA]),
+                      nft_attr_len(expr[NFTA_EXPR_DATA]), counter,
+                      NFTA_COUNTER_MAX);
+      *bytes = nft_attr_u64(counter[NFTA_COUNTER_BYTES]);
+      *packets = nft_attr_u64(counter[NFTA_COUNTER_PACKETS]);
+      return 0;
+    }
+
+    len -= NLA_ALIGN(elem->nla_len);
+    elem = (const void *)((const char *)elem + NLA_ALIGN(elem->nla_len));
+  }
+
+  return -1;
+} /* int nft_rule_counters */
+
+static size_t nft_put_string(char *buffer, size_t pos, uint16_t type,
+                             const char *str) {
+  struct nlattr *attr = (struct nlattr *)(buffer + pos);
+  size_t len = strlen(str) + 1;
+
+  attr->nla_type = type;
+  attr->nla_len = (uint16_t)(NLA_HDRLEN + len);
+  memcpy(buffer + pos + NLA_HDRLEN, str, len);
+  memset(buffer + pos + NLA_HDRLEN + len, 0,
+         NLA_ALIGN(attr->nla_len) - attr->nla_len);
+  return pos + NLA_ALIGN(attr->nla_len);
+} /* size_t nft_put_string */
+
+/* Dumps the rules of chain_list[idx]'s chain and submits the counters of
+ * all configured rules of that chain. */
+static int nft_read_chain(int idx) {
+  static char buffer[65536];
+  ip_chain_t *chain = chain_list[idx];
+
+  if (nft_fd < 0) {
+    nft_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+    if (nft_fd < 0) {
+      ERROR("iptables plugin: socket(AF_NETLINK) failed: %s", STRERRNO);
+      return -1;
+    }
+  }
+
+  /* The table and chain attributes make the kernel skip the rules of all
+   * other chains. */
+  char req[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
+           NLMSG_ALIGN(sizeof(struct nfgenmsg)) +
+           2 * NLA_ALIGN(NLA_HDRLEN + XT_TABLE_MAXNAMELEN)] = {0};
+  struct nlmsghdr *nlh = (struct nlmsghdr *)req;
+  struct nfgenmsg *nfg = NLMSG_DATA(nlh);
+  size_t pos = NLMSG_LENGTH(NLMSG_ALIGN(sizeof(*nfg)));
+
+  pos = nft_put_string(req, pos, NFTA_RULE_TABLE, chain->table);
+  pos = nft_put_string(req, pos, NFTA_RULE_CHAIN, chain->chain);
+
+  nlh->nlmsg_len = (uint32_t)pos;
+  nlh->nlmsg_type = (NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_GETRULE;
+  nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  nlh->nlmsg_seq = ++nft_seq;
+  nfg->nfgen_family = (chain->ip_version == IPV6) ? NFPROTO_IPV6 : NFPROTO_IPV4;
+  nfg->version = NFNETLINK_V0;
+
+  struct sockaddr_nl nladdr = {.nl_family = AF_NETLINK};
+  if (sendto(nft_fd, req, pos, 0, (struct sockaddr *)&nladdr,
+             sizeof(nladdr)) < 0) {
+    ERROR("iptables plugin: sendto failed: %s", STRERRNO);
+    close(nft_fd);
+    nft_fd = -1;
+    return -1;
+  }
+
+  int rule_num = 0;
+  while (42) {
+    ssize_t len = recv(nft_fd, buffer, sizeof(buffer), 0);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("iptables plugin: recv failed: %s", STRERRNO);
+      close(nft_fd);
+      nft_fd = -1;
+      return -1;
+    }
+
+    for (struct nlmsghdr *h = (struct nlmsghdr *)buffer; NLMSG_OK(h, len);
+         h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_seq != nft_seq)
+        continue;
+
+      if (h->nlmsg_type == NLMSG_DONE)
+        return 0;
+
+      if (h->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr *err = NLMSG_DATA(h);
+        ERROR("iptables plugin: Dumping chain %s of table %s failed: %s",
+              chain->chain, chain->table, STRERROR(-err->error));
+        return -1;
+      }
+
+      if (h->nlmsg_type != ((NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_NEWRULE))
+        continue;
+
+      const struct nlattr *rule[NFTA_RULE_MAX + 1];
+      nft_parse_attrs((char *)NLMSG_DATA(h) +
+                          NLMSG_ALIGN(sizeof(struct nfgenmsg)),
+                      (int)h->nlmsg_len -
+                          NLMSG_LENGTH(NLMSG_ALIGN(sizeof(struct nfgenmsg))),
+                      rule, NFTA_RULE_MAX);
+
+      /* Older kernels ignore the filter attributes. */
+      if (!nft_attr_streq(rule[NFTA_RULE_TABLE], chain->table) ||
+          !nft_attr_streq(rule[NFTA_RULE_CHAIN], chain->chain))
+        continue;
+      rule_num++;
+
+      char buffer_comment[256];
+      const char *comment =
+          nft_rule_comment(rule, buffer_comment, sizeof(buffer_comment));
+      uint64_t bytes = 0;
+      uint64_t packets = 0;
+      bool have_counters = (nft_rule_counters(rule, &bytes, &packets) == 0);
+
+      for (int i = idx; i < chain_num; i++) {
+        if (!chain_same(chain, chain_list[i], /* same_chain = */ true) ||
+            !rule_selected(chain_list[i], rule_num, comment))
+          continue;
+
+        if (have_counters) {
+          submit_counters(chain_list[i], comment, bytes, packets);
+        } else {
+          DEBUG("iptables plugin: Rule %i of chain %s has no counter.",
+                rule_num, chain->chain);
+        }
+      }
+    }
+  }
+} /* int nft_read_chain */
+
+static int iptables_read_nftables(void) {
+  int num_failures = 0;
+
+  for (int i = 0; i < chain_num; i++) {
+    if (chain_seen(i, /* same_chain = */ true))
+      continue;
+
+    if (nft_read_chain(i) != 0) {
+      for (int j = i; j < chain_num; j++)
+        if (chain_same(chain_list[i], chain_list[j], /* same_chain = */ true))
+          num_failures++;
+    }
+  }
+
+  return (num_failures < chain_num) ? 0 : -1;
+} /* int iptables_read_nftables */
+#endif /* HAVE_LINUX_NETFILTER_NF_TABLES_H */
+
 static int iptables_read(void) {
   int num_failures = 0;
   ip_chain_t *chain;
 
-  /* Init the iptc handle structure and query the correct table */
+#if HAVE_LINUX_NETFILTER_NF_TABLES_H
+  if (backend == BACKEND_NFTABLES)
+    return iptables_read_nftables();
+#endif
+
+  /* Init the iptc handle structure and query the correct table. Each table
+   * is only copied once, even if several of its chains are configured. */
   for (int i = 0; i < chain_num; i++) {
     chain = chain_list[i];
 
@@ -359,6 +677,14 @@ static int iptables_read(void) {
       continue;
     }
 
+    if (chain_seen(i, /* same_chain = */ false))
+      continue;
+
+    int chains_in_table = 0;
+    for (int j = i; j < chain_num; j++)
+      if (chain_same(chain, chain_list[j], /* same_chain = */ false))
+        chains_in_table++;
+
     if (chain->ip_version == IPV4) {
 #ifdef HAVE_IPTC_HANDLE_T
       iptc_handle_t _handle;
@@ -373,11 +699,13 @@ static int iptables_read(void) {
       if (!handle) {
         ERROR("iptables plugin: iptc_init (%s) failed: %s", chain->table,
               iptc_strerror(errno));
-        num_failures++;
+        num_failures += chains_in_table;
         continue;
       }
 
-      submit_chain(handle, chain);
+      for (int j = i; j < chain_num; j++)
+        if (chain_same(chain, chain_list[j], /* same_chain = */ false))
+          submit_chain(handle, chain_list[j]);
       iptc_free(handle);
     } else if (chain->ip_version == IPV6) {
 #ifdef HAVE_IP6TC_HANDLE_T
@@ -392,14 +720,16 @@ static int iptables_read(void) {
       if (!handle) {
         ERROR("iptables plugin: ip6tc_init (%s) failed: %s", chain->table,
               ip6tc_strerror(errno));
-        num_failures++;
+        num_failures += chains_in_table;
         continue;
       }
 
-      submit6_chain(handle, chain);
+      for (int j = i; j < chain_num; j++)
+        if (chain_same(chain, chain_list[j], /* same_chain = */ false))
+          submit6_chain(handle, chain_list[j]);
       ip6tc_free(handle);
     } else
-      num_failures++;
+      num_failures += chains_in_table;
   } /* for (i = 0 .. chain_num) */
 
   return (num_failures < chain_num) ? 0 : -1;
@@ -413,6 +743,12 @@ static int iptables_shutdown(void) {
   }
   sfree(chain_list);
 
+#if HAVE_LINUX_NETFILTER_NF_TABLES_H
+  if (nft_fd >= 0)
+    close(nft_fd);
+  nft_fd = -1;
+#endif
+
   return 0;
 } /* int iptables_shutdown */
 
@@ -76,10 +76,12 @@ static void irq_submit(const char *irq_name, derive_t value) {
 } /* void irq_submit */
 
 static int irq_read(void) {
-  FILE *fh;
-  char buffer[1024];
+  static proc_file_t *pf;
+  char *buffer;
+  char *line;
   int cpu_count;
   char *fields[256];
+  uint64_t values[STATIC_ARRAY_SIZE(fields)];
 
   /*
    * Example content:
@@ -88,44 +90,33 @@ static int irq_read(void) {
    * 1:     102553     158669     218062      70587   IO-APIC-edge      i8042
    * 8:          0          0          0          1   IO-APIC-edge      rtc0
    */
-  fh = fopen("/proc/interrupts", "r");
-  if (fh == NULL) {
-    ERROR("irq plugin: fopen (/proc/interrupts): %s", STRERRNO);
+  if ((pf == NULL) && ((pf = proc_file_open("/proc/interrupts")) == NULL)) {
+    ERROR("irq plugin: open (/proc/interrupts): %s", STRERRNO);
     return -1;
   }
 
+  if (proc_file_read(pf, &buffer) < 0)
+    return -1;
+
   /* Get CPU count from the first line */
-  if (fgets(buffer, sizeof(buffer), fh) != NULL) {
-    cpu_count = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
+  char *ptr = buffer;
+  if ((line = proc_file_line(&ptr)) != NULL) {
+    cpu_count = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
   } else {
     ERROR("irq plugin: unable to get CPU count from first line "
           "of /proc/interrupts");
-    fclose(fh);
     return -1;
   }
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
+  while ((line = proc_file_line(&ptr)) != NULL) {
     char *irq_name;
     size_t irq_name_len;
     derive_t irq_value;
-    int i;
-    int fields_num;
-    int irq_values_to_parse;
-
-    fields_num = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
-    if (fields_num < 2)
-      continue;
-
-    /* Parse this many numeric fields, skip the rest
-     * (+1 because first there is a name of irq in each line) */
-    if (fields_num >= cpu_count + 1)
-      irq_values_to_parse = cpu_count;
-    else
-      irq_values_to_parse = fields_num - 1;
+    size_t values_num;
 
     /* First field is irq name and colon */
-    irq_name = fields[0];
-    irq_name_len = strlen(irq_name);
+    irq_name = line + strspn(line, " \t");
+    irq_name_len = strcspn(irq_name, " \t");
     if (irq_name_len < 2)
       continue;
 
@@ -138,31 +129,24 @@ static int irq_read(void) {
     if (irq_name_len == 4 && (strncmp(irq_name, "FIQ:", 4) == 0))
       continue;
 
+    /* Parse up to one numeric field per CPU, skip the rest. */
+    values_num = parse_uint64_fields(irq_name + irq_name_len, values,
+                                     (size_t)cpu_count, NULL);
+
     irq_name[irq_name_len - 1] = 0;
     irq_name_len--;
 
-    irq_value = 0;
-    for (i = 1; i <= irq_values_to_parse; i++) {
-      /* Per-CPU value */
-      value_t v;
-      int status;
-
-      status = parse_value(fields[i], &v, DS_TYPE_DERIVE);
-      if (status != 0)
-        break;
-
-      irq_value += v.derive;
-    } /* for (i) */
-
     /* No valid fields -> do not submit anything. */
-    if (i <= 1)
+    if (values_num == 0)
       continue;
 
+    irq_value = 0;
+    for (size_t i = 0; i < values_num; i++)
+      irq_value += (derive_t)values[i];
+
     irq_submit(irq_name, irq_value);
   }
 
-  fclose(fh);
-
   return 0;
 } /* int irq_read */
 
@@ -26,6 +26,7 @@
 #include "common.h"
 #include "filter_chain.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 
 #include <jni.h>
 
@@ -74,6 +75,40 @@ struct cjni_callback_info_s /* {{{ */
 typedef struct cjni_callback_info_s cjni_callback_info_t;
 /* }}} */
 
+/* Classes and methods needed to pass a value list to Java. They are looked up
+ * once when the JVM is created, since doing so for every value is expensive.
+ * The classes are held as global references. */
+struct cjni_value_list_api_s /* {{{ */
+{
+  jclass c_valuelist;
+  jmethodID m_constructor;
+  jmethodID m_set_data_set;
+  jmethodID m_add_value;
+  jmethodID m_set_host;
+  jmethodID m_set_plugin;
+  jmethodID m_set_plugin_instance;
+  jmethodID m_set_type;
+  jmethodID m_set_type_instance;
+  jmethodID m_set_time;
+  jmethodID m_set_interval;
+
+  jclass c_long;
+  jmethodID m_long_value_of;
+  jclass c_double;
+  jmethodID m_double_value_of;
+};
+typedef struct cjni_value_list_api_s cjni_value_list_api_t;
+/* }}} */
+
+/* A org/collectd/api/DataSet object shared by all value lists of one type. */
+struct cjni_data_set_s /* {{{ */
+{
+  const data_set_t *ds;
+  jobject object; /* global reference */
+};
+typedef struct cjni_data_set_s cjni_data_set_t;
+/* }}} */
+
 /*
  * Global variables
  */
@@ -95,6 +130,12 @@ static pthread_mutex_t java_callbacks_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static oconfig_item_t *config_block;
 
+static cjni_value_list_api_t vl_api;
+
+/* DataSet objects passed to write callbacks, keyed by type. */
+static c_avl_tree_t *java_data_sets;
+static pthread_mutex_t java_data_sets_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Prototypes
  *
@@ -230,51 +271,15 @@ static int ctoj_double(JNIEnv *jvm_env, /* {{{ */
 /* Convert a jlong to a java.lang.Number */
 static jobject ctoj_jlong_to_number(JNIEnv *jvm_env, jlong value) /* {{{ */
 {
-  jclass c_long;
-  jmethodID m_long_constructor;
-
-  /* Look up the java.lang.Long class */
-  c_long = (*jvm_env)->FindClass(jvm_env, "java/lang/Long");
-  if (c_long == NULL) {
-    ERROR("java plugin: ctoj_jlong_to_number: Looking up the "
-          "java.lang.Long class failed.");
-    return NULL;
-  }
-
-  m_long_constructor =
-      (*jvm_env)->GetMethodID(jvm_env, c_long, "<init>", "(J)V");
-  if (m_long_constructor == NULL) {
-    ERROR("java plugin: ctoj_jlong_to_number: Looking up the "
-          "`Long (long)' constructor failed.");
-    return NULL;
-  }
-
-  return (*jvm_env)->NewObject(jvm_env, c_long, m_long_constructor, value);
+  return (*jvm_env)->CallStaticObjectMethod(jvm_env, vl_api.c_long,
+                                            vl_api.m_long_value_of, value);
 } /* }}} jobject ctoj_jlong_to_number */
 
 /* Convert a jdouble to a java.lang.Number */
 static jobject ctoj_jdouble_to_number(JNIEnv *jvm_env, jdouble value) /* {{{ */
 {
-  jclass c_double;
-  jmethodID m_double_constructor;
-
-  /* Look up the java.lang.Long class */
-  c_double = (*jvm_env)->FindClass(jvm_env, "java/lang/Double");
-  if (c_double == NULL) {
-    ERROR("java plugin: ctoj_jdouble_to_number: Looking up the "
-          "java.lang.Double class failed.");
-    return NULL;
-  }
-
-  m_double_constructor =
-      (*jvm_env)->GetMethodID(jvm_env, c_double, "<init>", "(D)V");
-  if (m_double_constructor == NULL) {
-    ERROR("java plugin: ctoj_jdouble_to_number: Looking up the "
-          "`Double (double)' constructor failed.");
-    return NULL;
-  }
-
-  return (*jvm_env)->NewObject(jvm_env, c_double, m_double_constructor, value);
+  return (*jvm_env)->CallStaticObjectMethod(jvm_env, vl_api.c_double,
+                                            vl_api.m_double_value_of, value);
 } /* }}} jobject ctoj_jdouble_to_number */
 
 /* Convert a value_t to a java.lang.Number */
@@ -627,18 +632,9 @@ static jobject ctoj_data_set(JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
 
 static int ctoj_value_list_add_value(JNIEnv *jvm_env, /* {{{ */
                                      value_t value, int ds_type,
-                                     jclass class_ptr, jobject object_ptr) {
-  jmethodID m_addvalue;
+                                     jobject object_ptr) {
   jobject o_number;
 
-  m_addvalue = (*jvm_env)->GetMethodID(jvm_env, class_ptr, "addValue",
-                                       "(Ljava/lang/Number;)V");
-  if (m_addvalue == NULL) {
-    ERROR("java plugin: ctoj_value_list_add_value: "
-          "Cannot find method `void addValue (Number)'.");
-    return -1;
-  }
-
   o_number = ctoj_value_to_number(jvm_env, value, ds_type);
   if (o_number == NULL) {
     ERROR("java plugin: ctoj_value_list_add_value: "
@@ -646,130 +642,174 @@ static int ctoj_value_list_add_value(JNIEnv *jvm_env, /* {{{ */
     return -1;
   }
 
-  (*jvm_env)->CallVoidMethod(jvm_env, object_ptr, m_addvalue, o_number);
+  (*jvm_env)->CallVoidMethod(jvm_env, object_ptr, vl_api.m_add_value,
+                             o_number);
 
   (*jvm_env)->DeleteLocalRef(jvm_env, o_number);
 
   return 0;
 } /* }}} int ctoj_value_list_add_value */
 
-static int ctoj_value_list_add_data_set(JNIEnv *jvm_env, /* {{{ */
-                                        jclass c_valuelist, jobject o_valuelist,
-                                        const data_set_t *ds) {
-  jmethodID m_setdataset;
+/* Return the DataSet object for `ds', creating it on first use. The returned
+ * reference is global and must not be deleted by the caller. */
+static jobject ctoj_data_set_shared(JNIEnv *jvm_env, /* {{{ */
+                                    const data_set_t *ds) {
+  cjni_data_set_t *entry = NULL;
   jobject o_dataset;
 
-  /* Look for the `void setDataSource (List<DataSource> ds)' method. */
-  m_setdataset = (*jvm_env)->GetMethodID(jvm_env, c_valuelist, "setDataSet",
-                                         "(Lorg/collectd/api/DataSet;)V");
-  if (m_setdataset == NULL) {
-    ERROR("java plugin: ctoj_value_list_add_data_set: "
-          "Cannot find the `void setDataSet (DataSet)' method.");
-    return -1;
+  pthread_mutex_lock(&java_data_sets_lock);
+
+  if (java_data_sets == NULL) {
+    java_data_sets =
+        c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (java_data_sets == NULL) {
+      pthread_mutex_unlock(&java_data_sets_lock);
+      ERROR("java plugin: ctoj_data_set_shared: c_avl_create failed.");
+      return NULL;
+    }
+  }
+
+  if ((c_avl_get(java_data_sets, ds->type, (void *)&entry) == 0) &&
+      (entry->ds == ds)) {
+    pthread_mutex_unlock(&java_data_sets_lock);
+    return entry->object;
   }
 
-  /* Create a DataSet object. */
   o_dataset = ctoj_data_set(jvm_env, ds);
   if (o_dataset == NULL) {
-    ERROR("java plugin: ctoj_value_list_add_data_set: "
-          "ctoj_data_set (%s) failed.",
+    pthread_mutex_unlock(&java_data_sets_lock);
+    ERROR("java plugin: ctoj_data_set_shared: ctoj_data_set (%s) failed.",
           ds->type);
-    return -1;
+    return NULL;
   }
 
-  /* Actually call the method. */
-  (*jvm_env)->CallVoidMethod(jvm_env, o_valuelist, m_setdataset, o_dataset);
+  if (entry == NULL) {
+    char *key;
 
-  /* Decrease reference counter on the List<DataSource> object. */
+    key = strdup(ds->type);
+    entry = calloc(1, sizeof(*entry));
+    if ((key == NULL) || (entry == NULL) ||
+        (c_avl_insert(java_data_sets, key, entry) != 0)) {
+      pthread_mutex_unlock(&java_data_sets_lock);
+      ERROR("java plugin: ctoj_data_set_shared: Adding %s to the cache "
+            "failed.",
+            ds->type);
+      sfree(key);
+      sfree(entry);
+      (*jvm_env)->DeleteLocalRef(jvm_env, o_dataset);
+      return NULL;
+    }
+  } else {
+    /* The data set has been registered again since it was cached. */
+    (*jvm_env)->DeleteGlobalRef(jvm_env, entry->object);
+  }
+
+  entry->ds = ds;
+  entry->object = (*jvm_env)->NewGlobalRef(jvm_env, o_dataset);
   (*jvm_env)->DeleteLocalRef(jvm_env, o_dataset);
 
+  o_dataset = entry->object;
+  pthread_mutex_unlock(&java_data_sets_lock);
+
+  return o_dataset;
+} /* }}} jobject ctoj_data_set_shared */
+
+/* Release all cached DataSet objects. */
+static void ctoj_data_set_shared_destroy(JNIEnv *jvm_env) /* {{{ */
+{
+  char *key;
+  cjni_data_set_t *entry;
+
+  pthread_mutex_lock(&java_data_sets_lock);
+  if (java_data_sets != NULL) {
+    while (c_avl_pick(java_data_sets, (void *)&key, (void *)&entry) == 0) {
+      if (entry->object != NULL)
+        (*jvm_env)->DeleteGlobalRef(jvm_env, entry->object);
+      sfree(entry);
+      sfree(key);
+    }
+    c_avl_destroy(java_data_sets);
+    java_data_sets = NULL;
+  }
+  pthread_mutex_unlock(&java_data_sets_lock);
+} /* }}} void ctoj_data_set_shared_destroy */
+
+static int ctoj_value_list_set_string(JNIEnv *jvm_env, /* {{{ */
+                                      jobject o_valuelist, jmethodID m_set,
+                                      const char *string) {
+  jstring o_string;
+
+  o_string = (*jvm_env)->NewStringUTF(jvm_env, string);
+  if (o_string == NULL) {
+    ERROR("java plugin: ctoj_value_list_set_string: NewStringUTF failed.");
+    return -1;
+  }
+
+  (*jvm_env)->CallVoidMethod(jvm_env, o_valuelist, m_set, o_string);
+
+  (*jvm_env)->DeleteLocalRef(jvm_env, o_string);
   return 0;
-} /* }}} int ctoj_value_list_add_data_set */
+} /* }}} int ctoj_value_list_set_string */
 
 /* Convert a value_list_t (and data_set_t) to a org/collectd/api/ValueList */
 static jobject ctoj_value_list(JNIEnv *jvm_env, /* {{{ */
                                const data_set_t *ds, const value_list_t *vl) {
-  jclass c_valuelist;
-  jmethodID m_valuelist_constructor;
   jobject o_valuelist;
+  jobject o_dataset;
   int status;
 
-  /* First, create a new ValueList instance..
-   * Look up the class.. */
-  c_valuelist = (*jvm_env)->FindClass(jvm_env, "org/collectd/api/ValueList");
-  if (c_valuelist == NULL) {
-    ERROR("java plugin: ctoj_value_list: "
-          "FindClass (org/collectd/api/ValueList) failed.");
-    return NULL;
-  }
-
-  /* Lookup the `ValueList ()' constructor. */
-  m_valuelist_constructor =
-      (*jvm_env)->GetMethodID(jvm_env, c_valuelist, "<init>", "()V");
-  if (m_valuelist_constructor == NULL) {
-    ERROR("java plugin: ctoj_value_list: Cannot find the "
-          "`ValueList ()' constructor.");
-    return NULL;
-  }
-
-  /* Create a new instance. */
-  o_valuelist =
-      (*jvm_env)->NewObject(jvm_env, c_valuelist, m_valuelist_constructor);
+  /* First, create a new ValueList instance.. */
+  o_valuelist = (*jvm_env)->NewObject(jvm_env, vl_api.c_valuelist,
+                                      vl_api.m_constructor);
   if (o_valuelist == NULL) {
     ERROR("java plugin: ctoj_value_list: Creating a new ValueList instance "
           "failed.");
     return NULL;
   }
 
-  status = ctoj_value_list_add_data_set(jvm_env, c_valuelist, o_valuelist, ds);
-  if (status != 0) {
+  /* The DataSet object is shared between all value lists of this type. */
+  o_dataset = ctoj_data_set_shared(jvm_env, ds);
+  if (o_dataset == NULL) {
     ERROR("java plugin: ctoj_value_list: "
-          "ctoj_value_list_add_data_set failed.");
+          "ctoj_data_set_shared failed.");
     (*jvm_env)->DeleteLocalRef(jvm_env, o_valuelist);
     return NULL;
   }
+  (*jvm_env)->CallVoidMethod(jvm_env, o_valuelist, vl_api.m_set_data_set,
+                             o_dataset);
 
 /* Set the strings.. */
-#define SET_STRING(str, method_name)                                           \
+#define SET_STRING(str, method)                                                \
   do {                                                                         \
-    status = ctoj_string(jvm_env, str, c_valuelist, o_valuelist, method_name); \
+    status =                                                                   \
+        ctoj_value_list_set_string(jvm_env, o_valuelist, vl_api.method, str);  \
     if (status != 0) {                                                         \
-      ERROR("java plugin: ctoj_value_list: ctoj_string (%s) failed.",          \
-            method_name);                                                      \
+      ERROR("java plugin: ctoj_value_list: "                                   \
+            "ctoj_value_list_set_string (%s) failed.",                         \
+            #method);                                                          \
       (*jvm_env)->DeleteLocalRef(jvm_env, o_valuelist);                        \
       return NULL;                                                             \
     }                                                                          \
   } while (0)
 
-  SET_STRING(vl->host, "setHost");
-  SET_STRING(vl->plugin, "setPlugin");
-  SET_STRING(vl->plugin_instance, "setPluginInstance");
-  SET_STRING(vl->type, "setType");
-  SET_STRING(vl->type_instance, "setTypeInstance");
+  SET_STRING(vl->host, m_set_host);
+  SET_STRING(vl->plugin, m_set_plugin);
+  SET_STRING(vl->plugin_instance, m_set_plugin_instance);
+  SET_STRING(vl->type, m_set_type);
+  SET_STRING(vl->type_instance, m_set_type_instance);
 
 #undef SET_STRING
 
-  /* Set the `time' member. Java stores time in milliseconds. */
-  status = ctoj_long(jvm_env, (jlong)CDTIME_T_TO_MS(vl->time), c_valuelist,
-                     o_valuelist, "setTime");
-  if (status != 0) {
-    ERROR("java plugin: ctoj_value_list: ctoj_long (setTime) failed.");
-    (*jvm_env)->DeleteLocalRef(jvm_env, o_valuelist);
-    return NULL;
-  }
-
-  /* Set the `interval' member.. */
-  status = ctoj_long(jvm_env, (jlong)CDTIME_T_TO_MS(vl->interval), c_valuelist,
-                     o_valuelist, "setInterval");
-  if (status != 0) {
-    ERROR("java plugin: ctoj_value_list: ctoj_long (setInterval) failed.");
-    (*jvm_env)->DeleteLocalRef(jvm_env, o_valuelist);
-    return NULL;
-  }
+  /* Set the `time' and `interval' members. Java stores time in
+   * milliseconds. */
+  (*jvm_env)->CallVoidMethod(jvm_env, o_valuelist, vl_api.m_set_time,
+                             (jlong)CDTIME_T_TO_MS(vl->time));
+  (*jvm_env)->CallVoidMethod(jvm_env, o_valuelist, vl_api.m_set_interval,
+                             (jlong)CDTIME_T_TO_MS(vl->interval));
 
   for (size_t i = 0; i < vl->values_len; i++) {
     status = ctoj_value_list_add_value(jvm_env, vl->values[i], ds->ds[i].type,
-                                       c_valuelist, o_valuelist);
+                                       o_valuelist);
     if (status != 0) {
       ERROR("java plugin: ctoj_value_list: "
             "ctoj_value_list_add_value failed.");
@@ -1235,6 +1275,179 @@ static jint JNICALL cjni_api_dispatch_values(JNIEnv *jvm_env, /* {{{ */
   return status;
 } /* }}} jint cjni_api_dispatch_values */
 
+/* Cursor over the records written by org/collectd/api/ValueListBuffer. All
+ * numbers are in the platform's byte order. */
+struct cjni_buffer_s /* {{{ */
+{
+  const uint8_t *data;
+  size_t size;
+};
+typedef struct cjni_buffer_s cjni_buffer_t;
+/* }}} */
+
+static int cjni_buffer_read(cjni_buffer_t *b, void *dst, /* {{{ */
+                            size_t size) {
+  if (b->size < size)
+    return EINVAL;
+  memcpy(dst, b->data, size);
+  b->data += size;
+  b->size -= size;
+  return 0;
+} /* }}} int cjni_buffer_read */
+
+static int cjni_buffer_read_string(cjni_buffer_t *b, /* {{{ */
+                                   char *buffer, size_t buffer_size) {
+  uint16_t len;
+  size_t copy_len;
+
+  if ((cjni_buffer_read(b, &len, sizeof(len)) != 0) || (b->size < len))
+    return EINVAL;
+
+  /* Too long strings are truncated, just like by `jtoc_string'. */
+  copy_len = (len < buffer_size) ? len : buffer_size - 1;
+  memcpy(buffer, b->data, copy_len);
+  buffer[copy_len] = 0;
+  b->data += len;
+  b->size -= len;
+  return 0;
+} /* }}} int cjni_buffer_read_string */
+
+/* Parse and dispatch one record:
+ *
+ *   int32   size of the record in bytes, including this field
+ *   int64   time in milliseconds
+ *   int64   interval in milliseconds
+ *   5 x     int16 length + UTF-8 bytes: host, plugin, plugin instance,
+ *           type and type instance
+ *   int16   number of values
+ *   n x     int8 kind (0 = long, 1 = double) + 64 bit value
+ */
+static int cjni_buffer_dispatch_record(cjni_buffer_t *b) /* {{{ */
+{
+  value_list_t vl = VALUE_LIST_INIT;
+  const data_set_t *ds;
+  int64_t tmp;
+  uint16_t values_num;
+  int status;
+
+  status = cjni_buffer_read(b, &tmp, sizeof(tmp));
+  if (status == 0)
+    vl.time = MS_TO_CDTIME_T(tmp);
+  if (status == 0)
+    status = cjni_buffer_read(b, &tmp, sizeof(tmp));
+  if (status == 0)
+    vl.interval = MS_TO_CDTIME_T(tmp);
+  if (status == 0)
+    status = cjni_buffer_read_string(b, vl.host, sizeof(vl.host));
+  if (status == 0)
+    status = cjni_buffer_read_string(b, vl.plugin, sizeof(vl.plugin));
+  if (status == 0)
+    status = cjni_buffer_read_string(b, vl.plugin_instance,
+                                     sizeof(vl.plugin_instance));
+  if (status == 0)
+    status = cjni_buffer_read_string(b, vl.type, sizeof(vl.type));
+  if (status == 0)
+    status = cjni_buffer_read_string(b, vl.type_instance,
+                                     sizeof(vl.type_instance));
+  if (status == 0)
+    status = cjni_buffer_read(b, &values_num, sizeof(values_num));
+  if (status != 0)
+    return status;
+
+  ds = plugin_get_ds(vl.type);
+  if (ds == NULL) {
+    ERROR("java plugin: cjni_buffer_dispatch_record: Data-set `%s' is not "
+          "defined. Please consult the types.db(5) manpage for more "
+          "information.",
+          vl.type);
+    return ENOENT;
+  }
+  if (ds->ds_num != values_num) {
+    ERROR("java plugin: cjni_buffer_dispatch_record: Data-set `%s' has "
+          "%" PRIsz " data sources, but %" PRIu16 " values were given.",
+          vl.type, ds->ds_num, values_num);
+    return EINVAL;
+  }
+
+  value_t values[values_num];
+  for (size_t i = 0; i < values_num; i++) {
+    uint8_t kind;
+    int64_t l = 0;
+    double d = NAN;
+
+    status = cjni_buffer_read(b, &kind, sizeof(kind));
+    if (status != 0)
+      return status;
+
+    /* Convert according to the data source type, as `jtoc_value' does. */
+    if (kind == 1) {
+      status = cjni_buffer_read(b, &d, sizeof(d));
+      if (!isnan(d))
+        l = (int64_t)d;
+    } else {
+      status = cjni_buffer_read(b, &l, sizeof(l));
+      d = (double)l;
+    }
+    if (status != 0)
+      return status;
+
+    if (ds->ds[i].type == DS_TYPE_GAUGE)
+      values[i].gauge = (gauge_t)d;
+    else if (ds->ds[i].type == DS_TYPE_DERIVE)
+      values[i].derive = (derive_t)l;
+    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+      values[i].absolute = (absolute_t)l;
+    else
+      values[i].counter = (counter_t)l;
+  }
+
+  vl.values = values;
+  vl.values_len = values_num;
+
+  return plugin_dispatch_values(&vl);
+} /* }}} int cjni_buffer_dispatch_record */
+
+/* Dispatch the value lists encoded in the first `length' bytes of a direct
+ * java.nio.ByteBuffer. Returns the number of value lists that could not be
+ * dispatched, or -1 if the buffer could not be parsed. */
+static jint JNICALL cjni_api_dispatch_buffer(JNIEnv *jvm_env, /* {{{ */
+                                             jobject this, jobject o_buffer,
+                                             jint length) {
+  cjni_buffer_t b;
+  jint failed = 0;
+  jlong capacity;
+
+  b.data = (*jvm_env)->GetDirectBufferAddress(jvm_env, o_buffer);
+  capacity = (*jvm_env)->GetDirectBufferCapacity(jvm_env, o_buffer);
+  if ((b.data == NULL) || (length < 0) || ((jlong)length > capacity)) {
+    ERROR("java plugin: cjni_api_dispatch_buffer: Invalid buffer.");
+    return -1;
+  }
+  b.size = (size_t)length;
+
+  while (b.size > 0) {
+    cjni_buffer_t record;
+    int32_t record_size;
+
+    if ((cjni_buffer_read(&b, &record_size, sizeof(record_size)) != 0) ||
+        (record_size < (int32_t)sizeof(record_size)) ||
+        ((size_t)record_size - sizeof(record_size) > b.size)) {
+      ERROR("java plugin: cjni_api_dispatch_buffer: Truncated record.");
+      return -1;
+    }
+
+    record.data = b.data;
+    record.size = (size_t)record_size - sizeof(record_size);
+    b.data += record.size;
+    b.size -= record.size;
+
+    if (cjni_buffer_dispatch_record(&record) != 0)
+      failed++;
+  }
+
+  return failed;
+} /* }}} jint cjni_api_dispatch_buffer */
+
 static jint JNICALL cjni_api_dispatch_notification(JNIEnv *jvm_env, /* {{{ */
                                                    jobject this,
                                                    jobject o_notification) {
@@ -1509,6 +1722,9 @@ static JNINativeMethod jni_api_functions[] = /* {{{ */
         {"dispatchValues", "(Lorg/collectd/api/ValueList;)I",
          cjni_api_dispatch_values},
 
+        {"dispatchBuffer", "(Ljava/nio/ByteBuffer;I)I",
+         cjni_api_dispatch_buffer},
+
         {"dispatchNotification", "(Lorg/collectd/api/Notification;)I",
          cjni_api_dispatch_notification},
 
@@ -1760,8 +1976,9 @@ static int cjni_callback_register(JNIEnv *jvm_env, /* {{{ */
   return 0;
 } /* }}} int cjni_callback_register */
 
-/* Callback for `pthread_key_create'. It frees the data contained in
- * `jvm_env_key' and prints a warning if the reference counter is not zero. */
+/* Callback for `pthread_key_create'. It detaches the exiting thread from the
+ * JVM, frees the data contained in `jvm_env_key' and prints a warning if the
+ * reference counter is not zero. */
 static void cjni_jvm_env_destroy(void *args) /* {{{ */
 {
   cjni_jvm_env_t *cjni_env;
@@ -1777,15 +1994,102 @@ static void cjni_jvm_env_destroy(void *args) /* {{{ */
           cjni_env->reference_counter);
   }
 
-  if (cjni_env->jvm_env != NULL) {
-    ERROR("java plugin: cjni_jvm_env_destroy: cjni_env->jvm_env = %p;",
-          (void *)cjni_env->jvm_env);
+  /* Threads stay attached between calls, see `cjni_thread_attach'. */
+  if ((jvm != NULL) && (cjni_env->jvm_env != NULL)) {
+    int status = (*jvm)->DetachCurrentThread(jvm);
+    if (status != 0)
+      ERROR("java plugin: cjni_jvm_env_destroy: DetachCurrentThread failed "
+            "with status %i.",
+            status);
   }
 
   /* The pointer is allocated in `cjni_thread_attach' */
   free(cjni_env);
 } /* }}} void cjni_jvm_env_destroy */
 
+static jclass cjni_find_class_global(JNIEnv *jvm_env, /* {{{ */
+                                     const char *name) {
+  jclass c_local;
+  jclass c_global;
+
+  c_local = (*jvm_env)->FindClass(jvm_env, name);
+  if (c_local == NULL) {
+    ERROR("java plugin: cjni_find_class_global: FindClass (%s) failed.", name);
+    return NULL;
+  }
+
+  c_global = (*jvm_env)->NewGlobalRef(jvm_env, c_local);
+  (*jvm_env)->DeleteLocalRef(jvm_env, c_local);
+  if (c_global == NULL)
+    ERROR("java plugin: cjni_find_class_global: NewGlobalRef (%s) failed.",
+          name);
+  return c_global;
+} /* }}} jclass cjni_find_class_global */
+
+/* Look up the classes and methods in `vl_api'. */
+static int cjni_init_value_list_api(JNIEnv *jvm_env) /* {{{ */
+{
+  vl_api.c_valuelist =
+      cjni_find_class_global(jvm_env, "org/collectd/api/ValueList");
+  vl_api.c_long = cjni_find_class_global(jvm_env, "java/lang/Long");
+  vl_api.c_double = cjni_find_class_global(jvm_env, "java/lang/Double");
+  if ((vl_api.c_valuelist == NULL) || (vl_api.c_long == NULL) ||
+      (vl_api.c_double == NULL))
+    return -1;
+
+#define GET_METHOD(member, class, name, signature)                             \
+  do {                                                                         \
+    vl_api.member =                                                            \
+        (*jvm_env)->GetMethodID(jvm_env, vl_api.class, name, signature);       \
+    if (vl_api.member == NULL) {                                               \
+      ERROR("java plugin: cjni_init_value_list_api: Cannot find the `%s' "     \
+            "method with signature `%s'.",                                     \
+            name, signature);                                                  \
+      return -1;                                                               \
+    }                                                                          \
+  } while (0)
+
+  GET_METHOD(m_constructor, c_valuelist, "<init>", "()V");
+  GET_METHOD(m_set_data_set, c_valuelist, "setDataSet",
+             "(Lorg/collectd/api/DataSet;)V");
+  GET_METHOD(m_add_value, c_valuelist, "addValue", "(Ljava/lang/Number;)V");
+  GET_METHOD(m_set_host, c_valuelist, "setHost", "(Ljava/lang/String;)V");
+  GET_METHOD(m_set_plugin, c_valuelist, "setPlugin", "(Ljava/lang/String;)V");
+  GET_METHOD(m_set_plugin_instance, c_valuelist, "setPluginInstance",
+             "(Ljava/lang/String;)V");
+  GET_METHOD(m_set_type, c_valuelist, "setType", "(Ljava/lang/String;)V");
+  GET_METHOD(m_set_type_instance, c_valuelist, "setTypeInstance",
+             "(Ljava/lang/String;)V");
+  GET_METHOD(m_set_time, c_valuelist, "setTime", "(J)V");
+  GET_METHOD(m_set_interval, c_valuelist, "setInterval", "(J)V");
+
+#undef GET_METHOD
+
+  vl_api.m_long_value_of = (*jvm_env)->GetStaticMethodID(
+      jvm_env, vl_api.c_long, "valueOf", "(J)Ljava/lang/Long;");
+  vl_api.m_double_value_of = (*jvm_env)->GetStaticMethodID(
+      jvm_env, vl_api.c_double, "valueOf", "(D)Ljava/lang/Double;");
+  if ((vl_api.m_long_value_of == NULL) || (vl_api.m_double_value_of == NULL)) {
+    ERROR("java plugin: cjni_init_value_list_api: Cannot find the "
+          "`valueOf' methods of java.lang.Long and java.lang.Double.");
+    return -1;
+  }
+
+  return 0;
+} /* }}} int cjni_init_value_list_api */
+
+/* Release the global references held by `vl_api'. */
+static void cjni_destroy_value_list_api(JNIEnv *jvm_env) /* {{{ */
+{
+  if (vl_api.c_valuelist != NULL)
+    (*jvm_env)->DeleteGlobalRef(jvm_env, vl_api.c_valuelist);
+  if (vl_api.c_long != NULL)
+    (*jvm_env)->DeleteGlobalRef(jvm_env, vl_api.c_long);
+  if (vl_api.c_double != NULL)
+    (*jvm_env)->DeleteGlobalRef(jvm_env, vl_api.c_double);
+  memset(&vl_api, 0, sizeof(vl_api));
+} /* }}} void cjni_destroy_value_list_api */
+
 /* Register ``native'' functions with the JVM. Native functions are C-functions
  * that can be called by Java code. */
 static int cjni_init_native(JNIEnv *jvm_env) /* {{{ */
@@ -1808,6 +2112,12 @@ static int cjni_init_native(JNIEnv *jvm_env) /* {{{ */
     return -1;
   }
 
+  status = cjni_init_value_list_api(jvm_env);
+  if (status != 0) {
+    ERROR("cjni_init_native: cjni_init_value_list_api failed.");
+    return -1;
+  }
+
   return 0;
 } /* }}} int cjni_init_native */
 
@@ -1866,7 +2176,12 @@ static int cjni_create_jvm(void) /* {{{ */
 } /* }}} int cjni_create_jvm */
 
 /* Increase the reference counter to the JVM for this thread. If it was zero,
- * attach the JVM first. */
+ * push a new local reference frame, attaching the thread to the JVM first if
+ * this is its first call. Threads are attached only once and stay attached
+ * until they exit, because attaching is expensive and the daemon's read and
+ * write threads call into Java all the time. Where available, they are
+ * attached as daemon threads so they don't prevent the JVM from shutting
+ * down. */
 static JNIEnv *cjni_thread_attach(void) /* {{{ */
 {
   cjni_jvm_env_t *cjni_env;
@@ -1904,22 +2219,41 @@ static JNIEnv *cjni_thread_attach(void) /* {{{ */
     jvm_env = cjni_env->jvm_env;
   } else {
     int status;
-    JavaVMAttachArgs args = {0};
 
-    assert(cjni_env->jvm_env == NULL);
+    if (cjni_env->jvm_env == NULL) {
+      JavaVMAttachArgs args = {0};
 
-    args.version = JNI_VERSION_1_2;
+      args.version = JNI_VERSION_1_2;
 
-    status = (*jvm)->AttachCurrentThread(jvm, (void *)&jvm_env, (void *)&args);
+#ifdef JNI_VERSION_1_4
+      status = (*jvm)->AttachCurrentThreadAsDaemon(jvm, (void *)&jvm_env,
+                                                   (void *)&args);
+#else
+      status =
+          (*jvm)->AttachCurrentThread(jvm, (void *)&jvm_env, (void *)&args);
+#endif
+      if (status != 0) {
+        ERROR("java plugin: cjni_thread_attach: AttachCurrentThread failed "
+              "with status %i.",
+              status);
+        return NULL;
+      }
+
+      cjni_env->jvm_env = jvm_env;
+    }
+    jvm_env = cjni_env->jvm_env;
+
+    /* Local references created by this call are released in
+     * `cjni_thread_detach', just like detaching the thread used to. */
+    status = (*jvm_env)->PushLocalFrame(jvm_env, 64);
     if (status != 0) {
-      ERROR("java plugin: cjni_thread_attach: AttachCurrentThread failed "
+      ERROR("java plugin: cjni_thread_attach: PushLocalFrame failed "
             "with status %i.",
             status);
       return NULL;
     }
 
     cjni_env->reference_counter = 1;
-    cjni_env->jvm_env = jvm_env;
   }
 
   DEBUG("java plugin: cjni_thread_attach: cjni_env->reference_counter = %i",
@@ -1928,12 +2262,12 @@ static JNIEnv *cjni_thread_attach(void) /* {{{ */
   return jvm_env;
 } /* }}} JNIEnv *cjni_thread_attach */
 
-/* Decrease the reference counter of this thread. If it reaches zero, detach
- * from the JVM. */
+/* Decrease the reference counter of this thread. If it reaches zero, pop the
+ * local reference frame pushed by `cjni_thread_attach'. The thread stays
+ * attached to the JVM. */
 static int cjni_thread_detach(void) /* {{{ */
 {
   cjni_jvm_env_t *cjni_env;
-  int status;
 
   cjni_env = pthread_getspecific(jvm_env_key);
   if (cjni_env == NULL) {
@@ -1951,15 +2285,8 @@ static int cjni_thread_detach(void) /* {{{ */
   if (cjni_env->reference_counter > 0)
     return 0;
 
-  status = (*jvm)->DetachCurrentThread(jvm);
-  if (status != 0) {
-    ERROR("java plugin: cjni_thread_detach: DetachCurrentThread failed "
-          "with status %i.",
-          status);
-  }
-
+  (*cjni_env->jvm_env)->PopLocalFrame(cjni_env->jvm_env, NULL);
   cjni_env->reference_counter = 0;
-  cjni_env->jvm_env = NULL;
 
   return 0;
 } /* }}} int cjni_thread_detach */
@@ -2786,12 +3113,24 @@ static int cjni_shutdown(void) /* {{{ */
   java_classes_list_len = 0;
   sfree(java_classes_list);
 
+  /* Release the cached DataSet objects and class references. */
+  ctoj_data_set_shared_destroy(jvm_env);
+  cjni_destroy_value_list_api(jvm_env);
+
   /* Destroy the JVM */
   DEBUG("java plugin: Destroying the JVM.");
   (*jvm)->DestroyJavaVM(jvm);
   jvm = NULL;
   jvm_env = NULL;
 
+  /* DestroyJavaVM has detached this thread; don't let the TLS destructor try
+   * again. */
+  cjni_jvm_env_t *cjni_env = pthread_getspecific(jvm_env_key);
+  if (cjni_env != NULL) {
+    pthread_setspecific(jvm_env_key, NULL);
+    free(cjni_env);
+  }
+
   pthread_key_delete(jvm_env_key);
 
   /* Free the JVM argument list */
@@ -36,6 +36,7 @@
 #include <errno.h>
 #include <math.h>
 #include <netdb.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -87,6 +88,22 @@
     SSTRCAT((d), _b);                                                          \
   } while (0)
 
+/* Maximum number of value lists sent with one PUTVALS command. */
+#define LCC_PUTVALS_CHUNK 1000
+
+/* Once this many bytes of asynchronous commands are queued, the queue is
+ * written to the socket right away. Beyond LCC_ASYNC_OUT_MAX bytes, new
+ * asynchronous commands are refused with EAGAIN. */
+#define LCC_ASYNC_OUT_FLUSH 65536
+#define LCC_ASYNC_OUT_MAX (16 * LCC_ASYNC_OUT_FLUSH)
+
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 #define LCC_SET_ERRSTR(c, ...)                                                 \
   do {                                                                         \
     snprintf((c)->errbuf, sizeof((c)->errbuf), __VA_ARGS__);                   \
@@ -95,9 +112,40 @@
 /*
  * Types
  */
+typedef struct {
+  lcc_putval_callback_t putval_cb;
+  lcc_getval_callback_t getval_cb;
+  void *user_data;
+} lcc_async_request_t;
+
 struct lcc_connection_s {
   FILE *fh;
   char errbuf[2048];
+
+  /* Asynchronous commands which have not been written to the socket yet,
+   * starting at "out_pos". */
+  char *out;
+  size_t out_pos;
+  size_t out_len;
+  size_t out_size;
+
+  /* Received data which does not form a complete response yet, starting at
+   * "in_pos". */
+  char *in;
+  size_t in_pos;
+  size_t in_len;
+  size_t in_size;
+
+  /* Ring buffer of asynchronous commands waiting for a response, in the
+   * order they have been sent. */
+  lcc_async_request_t *pending;
+  size_t pending_head;
+  size_t pending_num;
+  size_t pending_size;
+
+  /* Set while callbacks are being called, so that commands queued by a
+   * callback don't trigger I/O which would modify "in". */
+  int dispatching;
 };
 
 struct lcc_response_s {
@@ -344,6 +392,345 @@ static int lcc_receive(lcc_connection_t *c, /* {{{ */
   return 0;
 } /* }}} int lcc_receive */
 
+/*
+ * Asynchronous commands
+ *
+ * Commands are appended to "c->out" and their callbacks to "c->pending".
+ * The daemon answers commands in order, so each complete response in
+ * "c->in" belongs to the oldest pending request. The socket is accessed with
+ * non-blocking send(2)/recv(2) calls, bypassing "c->fh". This is safe,
+ * because the synchronous functions wait for all asynchronous commands to
+ * finish before using "c->fh".
+ */
+static int lcc_async_busy(lcc_connection_t *c) /* {{{ */
+{
+  return (c->pending_num > 0) || (c->out_pos < c->out_len);
+} /* }}} int lcc_async_busy */
+
+static int lcc_async_enqueue(lcc_connection_t *c, /* {{{ */
+                             const char *command,
+                             lcc_async_request_t const *req) {
+  size_t len = strlen(command);
+
+  lcc_tracef("send:    --> %s\n", command);
+
+  if (c->out_pos == c->out_len) {
+    c->out_pos = 0;
+    c->out_len = 0;
+  }
+
+  if (c->out_size - c->out_len < len + 2) {
+    /* Reclaim the space of commands which have already been written. */
+    if (c->out_pos > 0) {
+      memmove(c->out, c->out + c->out_pos, c->out_len - c->out_pos);
+      c->out_len -= c->out_pos;
+      c->out_pos = 0;
+    }
+  }
+
+  if (c->out_size - c->out_len < len + 2) {
+    size_t new_size = (c->out_size == 0) ? 4096 : 2 * c->out_size;
+    while (new_size - c->out_len < len + 2)
+      new_size *= 2;
+
+    char *tmp = realloc(c->out, new_size);
+    if (tmp == NULL) {
+      lcc_set_errno(c, ENOMEM);
+      return ENOMEM;
+    }
+    c->out = tmp;
+    c->out_size = new_size;
+  }
+
+  if (c->pending_num == c->pending_size) {
+    size_t new_size = (c->pending_size == 0) ? 64 : 2 * c->pending_size;
+    lcc_async_request_t *tmp = malloc(new_size * sizeof(*tmp));
+    if (tmp == NULL) {
+      lcc_set_errno(c, ENOMEM);
+      return ENOMEM;
+    }
+
+    /* Unwrap the ring buffer while copying. */
+    for (size_t i = 0; i < c->pending_num; i++)
+      tmp[i] = c->pending[(c->pending_head + i) % c->pending_size];
+    free(c->pending);
+    c->pending = tmp;
+    c->pending_head = 0;
+    c->pending_size = new_size;
+  }
+
+  memcpy(c->out + c->out_len, command, len);
+  memcpy(c->out + c->out_len + len, "\r\n", 2);
+  c->out_len += len + 2;
+
+  c->pending[(c->pending_head + c->pending_num) % c->pending_size] = *req;
+  c->pending_num++;
+
+  return 0;
+} /* }}} int lcc_async_enqueue */
+
+static void lcc_async_complete(lcc_connection_t *c, /* {{{ */
+                               lcc_response_t *res) {
+  lcc_async_request_t req;
+
+  assert(c->pending_num > 0);
+  req = c->pending[c->pending_head];
+  c->pending_head = (c->pending_head + 1) % c->pending_size;
+  c->pending_num--;
+
+  if (req.putval_cb != NULL) {
+    req.putval_cb(c, res->status, res->message, req.user_data);
+    return;
+  }
+
+  if (req.getval_cb == NULL)
+    return;
+
+  if (res->status != 0) {
+    req.getval_cb(c, res->status, res->message, 0, NULL, NULL, req.user_data);
+    return;
+  }
+
+  gauge_t *values = calloc(res->lines_num + 1, sizeof(*values));
+  char **values_names = calloc(res->lines_num + 1, sizeof(*values_names));
+  int status = 0;
+  if ((values == NULL) || (values_names == NULL))
+    status = -1;
+
+  for (size_t i = 0; (status == 0) && (i < res->lines_num); i++) {
+    char *value = strchr(res->lines[i], '=');
+    char *endptr = NULL;
+
+    if (value == NULL) {
+      status = -1;
+      break;
+    }
+    *value = 0;
+    value++;
+
+    errno = 0;
+    values[i] = strtod(value, &endptr);
+    if ((endptr == value) || (errno != 0))
+      status = -1;
+    values_names[i] = res->lines[i];
+  }
+
+  if (status == 0)
+    req.getval_cb(c, 0, res->message, res->lines_num, values, values_names,
+                  req.user_data);
+  else
+    req.getval_cb(c, -1, "Malformed GETVAL response", 0, NULL, NULL,
+                  req.user_data);
+
+  free(values);
+  free(values_names);
+} /* }}} void lcc_async_complete */
+
+/* Handles all complete responses in the input buffer. The lines of a
+ * response are terminated in place and passed to the callbacks without
+ * copying them. */
+static int lcc_async_parse(lcc_connection_t *c) /* {{{ */
+{
+  while (c->pending_num > 0) {
+    char *begin = c->in + c->in_pos;
+    char *end = c->in + c->in_len;
+    char *eol;
+    char *ptr;
+    lcc_response_t res = {0};
+    char *lines[64];
+    char **lines_ptr = lines;
+
+    eol = memchr(begin, '\n', (size_t)(end - begin));
+    if (eol == NULL)
+      return 0;
+
+    errno = 0;
+    res.status = (int)strtol(begin, &ptr, 0);
+    if ((errno != 0) || (ptr == begin)) {
+      LCC_SET_ERRSTR(c, "Malformed response from the daemon");
+      return -1;
+    }
+
+    /* Make sure all lines of the response have been received before
+     * touching anything. */
+    size_t lines_num = (res.status > 0) ? (size_t)res.status : 0;
+    char *next = eol + 1;
+    for (size_t i = 0; i < lines_num; i++) {
+      char *line_end = memchr(next, '\n', (size_t)(end - next));
+      if (line_end == NULL)
+        return 0;
+      next = line_end + 1;
+    }
+
+    *eol = 0;
+    lcc_chomp(begin);
+    lcc_tracef("receive: <-- %s\n", begin);
+
+    while ((*ptr == ' ') || (*ptr == '\t'))
+      ptr++;
+    snprintf(res.message, sizeof(res.message), "%s", ptr);
+
+    if (lines_num > (sizeof(lines) / sizeof(lines[0]))) {
+      lines_ptr = calloc(lines_num, sizeof(*lines_ptr));
+      if (lines_ptr == NULL) {
+        lcc_set_errno(c, ENOMEM);
+        return -1;
+      }
+    }
+
+    ptr = eol + 1;
+    for (size_t i = 0; i < lines_num; i++) {
+      char *line_end = memchr(ptr, '\n', (size_t)(end - ptr));
+      *line_end = 0;
+      lcc_chomp(ptr);
+      lcc_tracef("receive: <-- %s\n", ptr);
+      lines_ptr[i] = ptr;
+      ptr = line_end + 1;
+    }
+
+    if (res.status > 0)
+      res.status = 0;
+    res.lines = lines_ptr;
+    res.lines_num = lines_num;
+
+    c->in_pos = (size_t)(next - c->in);
+    c->dispatching = 1;
+    lcc_async_complete(c, &res);
+    c->dispatching = 0;
+
+    if (lines_ptr != lines)
+      free(lines_ptr);
+  }
+
+  return 0;
+} /* }}} int lcc_async_parse */
+
+/* Calls the callbacks of all pending requests with an error and discards
+ * queued commands. Used when the connection failed. */
+static void lcc_async_fail(lcc_connection_t *c) /* {{{ */
+{
+  char message[sizeof(((lcc_response_t *)0)->message)];
+
+  strncpy(message, c->errbuf, sizeof(message));
+  message[sizeof(message) - 1] = 0;
+
+  c->out_pos = 0;
+  c->out_len = 0;
+  c->in_pos = 0;
+  c->in_len = 0;
+
+  /* Commands queued by the callbacks are kept; they will fail or succeed on
+   * their own. */
+  size_t num = c->pending_num;
+  c->dispatching = 1;
+  for (size_t i = 0; i < num; i++) {
+    lcc_response_t res = {.status = -1};
+
+    snprintf(res.message, sizeof(res.message), "%s", message);
+    lcc_async_complete(c, &res);
+  }
+  c->dispatching = 0;
+} /* }}} void lcc_async_fail */
+
+/* Writes as much of the queued commands and reads as many responses as
+ * possible without blocking. */
+static int lcc_async_io(lcc_connection_t *c) /* {{{ */
+{
+  int fd;
+
+  if (c->fh == NULL) {
+    lcc_set_errno(c, EBADF);
+    lcc_async_fail(c);
+    return -1;
+  }
+  fd = fileno(c->fh);
+
+  while (c->out_pos < c->out_len) {
+    ssize_t status = send(fd, c->out + c->out_pos, c->out_len - c->out_pos,
+                          MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+      lcc_set_errno(c, errno);
+      lcc_async_fail(c);
+      return -1;
+    }
+    c->out_pos += (size_t)status;
+  }
+
+  while (c->pending_num > 0) {
+    if (c->in_pos == c->in_len) {
+      c->in_pos = 0;
+      c->in_len = 0;
+    } else if (c->in_pos > 0) {
+      memmove(c->in, c->in + c->in_pos, c->in_len - c->in_pos);
+      c->in_len -= c->in_pos;
+      c->in_pos = 0;
+    }
+
+    if (c->in_size - c->in_len < 4096) {
+      size_t new_size = (c->in_size == 0) ? 65536 : 2 * c->in_size;
+      char *tmp = realloc(c->in, new_size);
+      if (tmp == NULL) {
+        lcc_set_errno(c, ENOMEM);
+        lcc_async_fail(c);
+        return -1;
+      }
+      c->in = tmp;
+      c->in_size = new_size;
+    }
+
+    ssize_t status =
+        recv(fd, c->in + c->in_len, c->in_size - c->in_len, MSG_DONTWAIT);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+      lcc_set_errno(c, errno);
+      lcc_async_fail(c);
+      return -1;
+    } else if (status == 0) {
+      LCC_SET_ERRSTR(c, "Connection closed by the daemon");
+      lcc_async_fail(c);
+      return -1;
+    }
+    c->in_len += (size_t)status;
+
+    if (lcc_async_parse(c) != 0) {
+      lcc_async_fail(c);
+      return -1;
+    }
+  }
+
+  return 0;
+} /* }}} int lcc_async_io */
+
+/* Blocks until all asynchronous commands have been answered. */
+static int lcc_async_wait(lcc_connection_t *c) /* {{{ */
+{
+  while (lcc_async_busy(c)) {
+    struct pollfd pfd = {
+        .fd = fileno(c->fh), .events = POLLIN,
+    };
+    if (c->out_pos < c->out_len)
+      pfd.events |= POLLOUT;
+
+    if ((poll(&pfd, 1, /* timeout = */ -1) < 0) && (errno != EINTR)) {
+      lcc_set_errno(c, errno);
+      lcc_async_fail(c);
+      return -1;
+    }
+
+    if (lcc_async_io(c) != 0)
+      return -1;
+  }
+
+  return 0;
+} /* }}} int lcc_async_wait */
+
 static int lcc_sendreceive(lcc_connection_t *c, /* {{{ */
                            const char *command, lcc_response_t *ret_res) {
   lcc_response_t res = {0};
@@ -354,6 +741,9 @@ static int lcc_sendreceive(lcc_connection_t *c, /* {{{ */
     return -1;
   }
 
+  if (lcc_async_busy(c) && (lcc_async_wait(c) != 0))
+    return -1;
+
   status = lcc_send(c, command);
   if (status != 0)
     return status;
@@ -568,11 +958,22 @@ int lcc_disconnect(lcc_connection_t *c) /* {{{ */
   if (c == NULL)
     return -1;
 
+  /* Give pending callbacks a chance to learn about their fate. */
+  if (lcc_async_busy(c)) {
+    if (c->fh != NULL)
+      lcc_async_wait(c);
+    else
+      lcc_async_fail(c);
+  }
+
   if (c->fh != NULL) {
     fclose(c->fh);
     c->fh = NULL;
   }
 
+  free(c->out);
+  free(c->in);
+  free(c->pending);
   free(c);
   return 0;
 } /* }}} int lcc_disconnect */
@@ -698,16 +1099,17 @@ int lcc_getval(lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   return 0;
 } /* }}} int lcc_getval */
 
-int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
-{
+/* Formats the PUTVAL command for "vl" into "ret". */
+static int lcc_format_putval(lcc_connection_t *c, /* {{{ */
+                             const lcc_value_list_t *vl, char *ret,
+                             size_t ret_size) {
   char ident_str[6 * LCC_NAME_LEN];
   char ident_esc[12 * LCC_NAME_LEN];
   char command[1024] = "";
-  lcc_response_t res;
   int status;
 
-  if ((c == NULL) || (vl == NULL) || (vl->values_len < 1) ||
-      (vl->values == NULL) || (vl->values_types == NULL)) {
+  if ((vl == NULL) || (vl->values_len < 1) || (vl->values == NULL) ||
+      (vl->values_types == NULL)) {
     lcc_set_errno(c, EINVAL);
     return -1;
   }
@@ -743,6 +1145,25 @@ int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
 
   } /* for (i = 0; i < vl->values_len; i++) */
 
+  snprintf(ret, ret_size, "%s", command);
+  return 0;
+} /* }}} int lcc_format_putval */
+
+int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+{
+  char command[1024] = "";
+  lcc_response_t res;
+  int status;
+
+  if (c == NULL) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  status = lcc_format_putval(c, vl, command, sizeof(command));
+  if (status != 0)
+    return status;
+
   status = lcc_sendreceive(c, command, &res);
   if (status != 0)
     return status;
@@ -757,6 +1178,227 @@ int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
   return 0;
 } /* }}} int lcc_putval */
 
+/* Sends up to LCC_PUTVALS_CHUNK value lists with one PUTVALS command. The
+ * block is formatted completely before anything is sent, so that a value
+ * list which cannot be formatted does not leave the server waiting for
+ * announced lines. */
+static int lcc_putvals_chunk(lcc_connection_t *c, /* {{{ */
+                             const lcc_value_list_t *vls, size_t vls_num) {
+  char *block = NULL;
+  size_t block_len = 0;
+  size_t block_size = 0;
+  lcc_response_t res;
+  int status;
+
+  for (size_t i = 0; i < vls_num; i++) {
+    char command[1024];
+
+    status = lcc_format_putval(c, vls + i, command, sizeof(command));
+    if (status != 0) {
+      free(block);
+      return status;
+    }
+
+    size_t len = strlen(command);
+    if (block_size - block_len < len + 2) {
+      size_t new_size = (block_size == 0) ? 4096 : 2 * block_size;
+      while (new_size - block_len < len + 2)
+        new_size *= 2;
+      char *tmp = realloc(block, new_size);
+      if (tmp == NULL) {
+        free(block);
+        lcc_set_errno(c, ENOMEM);
+        return -1;
+      }
+      block = tmp;
+      block_size = new_size;
+    }
+    memcpy(block + block_len, command, len);
+    memcpy(block + block_len + len, "\r\n", 2);
+    block_len += len + 2;
+  }
+
+  if (lcc_async_busy(c) && (lcc_async_wait(c) != 0)) {
+    free(block);
+    return -1;
+  }
+
+  lcc_tracef("send:    --> PUTVALS %zu\n", vls_num);
+  if ((fprintf(c->fh, "PUTVALS %zu\r\n", vls_num) < 0) ||
+      (fwrite(block, 1, block_len, c->fh) != block_len) ||
+      (fflush(c->fh) != 0)) {
+    lcc_set_errno(c, errno);
+    free(block);
+    return -1;
+  }
+  free(block);
+
+  status = lcc_receive(c, &res);
+  if (status != 0)
+    return status;
+
+  if (res.status != 0) {
+    LCC_SET_ERRSTR(c, "Server error: %s", res.message);
+    lcc_response_free(&res);
+    return -1;
+  }
+
+  lcc_response_free(&res);
+  return 0;
+} /* }}} int lcc_putvals_chunk */
+
+int lcc_putval_bulk(lcc_connection_t *c, /* {{{ */
+                    const lcc_value_list_t *vls, size_t vls_num) {
+  if ((c == NULL) || (vls == NULL) || (vls_num < 1)) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  if (c->fh == NULL) {
+    lcc_set_errno(c, EBADF);
+    return -1;
+  }
+
+  for (size_t i = 0; i < vls_num; i += LCC_PUTVALS_CHUNK) {
+    size_t num = vls_num - i;
+    if (num > LCC_PUTVALS_CHUNK)
+      num = LCC_PUTVALS_CHUNK;
+
+    int status = lcc_putvals_chunk(c, vls + i, num);
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+} /* }}} int lcc_putval_bulk */
+
+/* Queues "command" and writes the queue to the socket once enough has
+ * piled up. */
+static int lcc_async_submit(lcc_connection_t *c, /* {{{ */
+                            const char *command,
+                            lcc_async_request_t const *req) {
+  int status;
+
+  if ((c->out_len - c->out_pos) >= LCC_ASYNC_OUT_MAX) {
+    if (!c->dispatching && (lcc_async_io(c) != 0))
+      return -1;
+    if ((c->out_len - c->out_pos) >= LCC_ASYNC_OUT_MAX) {
+      lcc_set_errno(c, EAGAIN);
+      return EAGAIN;
+    }
+  }
+
+  status = lcc_async_enqueue(c, command, req);
+  if (status != 0)
+    return status;
+
+  if (!c->dispatching && ((c->out_len - c->out_pos) >= LCC_ASYNC_OUT_FLUSH))
+    return lcc_async_io(c);
+
+  return 0;
+} /* }}} int lcc_async_submit */
+
+int lcc_putval_async(lcc_connection_t *c, /* {{{ */
+                     const lcc_value_list_t *vl, lcc_putval_callback_t cb,
+                     void *user_data) {
+  char command[1024] = "";
+  int status;
+
+  if (c == NULL)
+    return -1;
+
+  if (c->fh == NULL) {
+    lcc_set_errno(c, EBADF);
+    return -1;
+  }
+
+  status = lcc_format_putval(c, vl, command, sizeof(command));
+  if (status != 0)
+    return status;
+
+  return lcc_async_submit(
+      c, command,
+      &(lcc_async_request_t){.putval_cb = cb, .user_data = user_data});
+} /* }}} int lcc_putval_async */
+
+int lcc_getval_async(lcc_connection_t *c, /* {{{ */
+                     const lcc_identifier_t *ident, lcc_getval_callback_t cb,
+                     void *user_data) {
+  char ident_str[6 * LCC_NAME_LEN];
+  char ident_esc[12 * LCC_NAME_LEN];
+  char command[14 * LCC_NAME_LEN];
+  int status;
+
+  if (c == NULL)
+    return -1;
+
+  if ((ident == NULL) || (cb == NULL)) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  if (c->fh == NULL) {
+    lcc_set_errno(c, EBADF);
+    return -1;
+  }
+
+  status = lcc_identifier_to_string(c, ident_str, sizeof(ident_str), ident);
+  if (status != 0)
+    return status;
+
+  snprintf(command, sizeof(command), "GETVAL %s",
+           lcc_strescape(ident_esc, ident_str, sizeof(ident_esc)));
+
+  return lcc_async_submit(
+      c, command,
+      &(lcc_async_request_t){.getval_cb = cb, .user_data = user_data});
+} /* }}} int lcc_getval_async */
+
+int lcc_async_process(lcc_connection_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return -1;
+
+  return lcc_async_io(c);
+} /* }}} int lcc_async_process */
+
+int lcc_async_flush(lcc_connection_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return -1;
+
+  if (c->fh == NULL) {
+    lcc_set_errno(c, EBADF);
+    return -1;
+  }
+
+  return lcc_async_wait(c);
+} /* }}} int lcc_async_flush */
+
+int lcc_async_fd(lcc_connection_t *c) /* {{{ */
+{
+  if ((c == NULL) || (c->fh == NULL))
+    return -1;
+
+  return fileno(c->fh);
+} /* }}} int lcc_async_fd */
+
+size_t lcc_async_pending(lcc_connection_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return 0;
+
+  return c->pending_num;
+} /* }}} size_t lcc_async_pending */
+
+int lcc_async_want_write(lcc_connection_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return 0;
+
+  return c->out_pos < c->out_len;
+} /* }}} int lcc_async_want_write */
+
 int lcc_flush(lcc_connection_t *c, const char *plugin, /* {{{ */
               lcc_identifier_t *ident, int timeout) {
   char command[1024] = "";
@@ -881,6 +1523,141 @@ int lcc_listval(lcc_connection_t *c, /* {{{ */
   return 0;
 } /* }}} int lcc_listval */
 
+/* Parses one line of a GETVALS response:
+ *   <time> <identifier> <name>=<value>[,<name>=<value>...]
+ * The identifier may contain spaces, the list of values can't. */
+static int lcc_parse_getvals_line(lcc_connection_t *c, /* {{{ */
+                                  char *line, lcc_getvals_result_t *ret) {
+  char *endptr = NULL;
+  char *ident_str;
+  char *values_str;
+
+  errno = 0;
+  ret->time = strtod(line, &endptr);
+  if ((errno != 0) || (endptr == line) || (*endptr != ' '))
+    goto malformed;
+  ident_str = endptr + 1;
+
+  values_str = strrchr(ident_str, ' ');
+  if ((values_str == NULL) || (values_str == ident_str))
+    goto malformed;
+  *values_str = 0;
+  values_str++;
+
+  if (lcc_string_to_identifier(c, &ret->identifier, ident_str) != 0)
+    return -1;
+
+  size_t num = 1;
+  for (char *ptr = values_str; *ptr != 0; ptr++)
+    if (*ptr == ',')
+      num++;
+
+  ret->values = calloc(num, sizeof(*ret->values));
+  ret->values_names = calloc(num, sizeof(*ret->values_names));
+  if ((ret->values == NULL) || (ret->values_names == NULL)) {
+    lcc_set_errno(c, ENOMEM);
+    return -1;
+  }
+
+  char *saveptr = NULL;
+  for (char *pair = strtok_r(values_str, ",", &saveptr); pair != NULL;
+       pair = strtok_r(NULL, ",", &saveptr)) {
+    char *value = strchr(pair, '=');
+    if ((value == NULL) || (ret->values_num >= num))
+      goto malformed;
+    *value = 0;
+    value++;
+
+    errno = 0;
+    endptr = NULL;
+    ret->values[ret->values_num] = strtod(value, &endptr);
+    if ((errno != 0) || (endptr == value) || (*endptr != 0))
+      goto malformed;
+
+    ret->values_names[ret->values_num] = strdup(pair);
+    if (ret->values_names[ret->values_num] == NULL) {
+      lcc_set_errno(c, ENOMEM);
+      return -1;
+    }
+    ret->values_num++;
+  }
+
+  return 0;
+
+malformed:
+  LCC_SET_ERRSTR(c, "Malformed GETVALS response line");
+  return -1;
+} /* }}} int lcc_parse_getvals_line */
+
+int lcc_getvals(lcc_connection_t *c, const char *pattern, /* {{{ */
+                lcc_getvals_result_t **ret_results, size_t *ret_results_num) {
+  char pattern_esc[12 * LCC_NAME_LEN];
+  char command[14 * LCC_NAME_LEN];
+  lcc_response_t res;
+  lcc_getvals_result_t *results;
+  int status;
+
+  if (c == NULL)
+    return -1;
+
+  if ((pattern == NULL) || (ret_results == NULL) ||
+      (ret_results_num == NULL)) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  snprintf(command, sizeof(command), "GETVALS %s",
+           lcc_strescape(pattern_esc, pattern, sizeof(pattern_esc)));
+
+  status = lcc_sendreceive(c, command, &res);
+  if (status != 0)
+    return status;
+
+  if (res.status != 0) {
+    LCC_SET_ERRSTR(c, "Server error: %s", res.message);
+    lcc_response_free(&res);
+    return -1;
+  }
+
+  results = calloc(res.lines_num + 1, sizeof(*results));
+  if (results == NULL) {
+    lcc_response_free(&res);
+    lcc_set_errno(c, ENOMEM);
+    return -1;
+  }
+
+  for (size_t i = 0; i < res.lines_num; i++) {
+    status = lcc_parse_getvals_line(c, res.lines[i], results + i);
+    if (status != 0) {
+      lcc_getvals_free(results, i + 1);
+      lcc_response_free(&res);
+      return -1;
+    }
+  }
+
+  *ret_results = results;
+  *ret_results_num = res.lines_num;
+
+  lcc_response_free(&res);
+  return 0;
+} /* }}} int lcc_getvals */
+
+void lcc_getvals_free(lcc_getvals_result_t *results, /* {{{ */
+                      size_t results_num) {
+  if (results == NULL)
+    return;
+
+  for (size_t i = 0; i < results_num; i++) {
+    if (results[i].values_names != NULL) {
+      for (size_t j = 0; j < results[i].values_num; j++)
+        free(results[i].values_names[j]);
+    }
+    free(results[i].values_names);
+    free(results[i].values);
+  }
+  free(results);
+} /* }}} void lcc_getvals_free */
+
 const char *lcc_strerror(lcc_connection_t *c) /* {{{ */
 {
   if (c == NULL)
@@ -66,12 +66,77 @@ int lcc_getval(lcc_connection_t *c, lcc_identifier_t *ident,
 
 int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl);
 
+/* Sends "vls_num" value lists using the PUTVALS command, which is only
+ * acknowledged once per block instead of once per value list. Requires a
+ * daemon which knows the PUTVALS command. */
+int lcc_putval_bulk(lcc_connection_t *c, const lcc_value_list_t *vls,
+                    size_t vls_num);
+
 int lcc_flush(lcc_connection_t *c, const char *plugin, lcc_identifier_t *ident,
               int timeout);
 
+/*
+ * Asynchronous interface
+ *
+ * The *_async() functions queue a command and return without waiting for the
+ * daemon's response, so many commands can be in flight on one connection.
+ * Queued commands are written and responses are read by
+ * lcc_async_process(), which never blocks; call it whenever lcc_async_fd()
+ * becomes readable, or writable if lcc_async_want_write() returns true.
+ * lcc_async_flush() blocks until all commands have been answered. The
+ * synchronous functions do the same before sending their own command.
+ *
+ * Callbacks are called from lcc_async_process(), lcc_async_flush(),
+ * lcc_disconnect() or a synchronous function, in the order the commands were
+ * queued. "status" is zero upon success and negative if the daemon reported
+ * an error or the connection failed; "message" describes the result. All
+ * pointers passed to a callback are only valid until it returns. Callbacks
+ * may queue further asynchronous commands, but must not call any of the
+ * other functions operating on the connection.
+ *
+ * The *_async() functions return zero upon success and EAGAIN if too much
+ * data is queued because the daemon does not keep up; wait for the socket to
+ * become writable and call lcc_async_process() before trying again.
+ */
+typedef void (*lcc_putval_callback_t)(lcc_connection_t *c, int status,
+                                      const char *message, void *user_data);
+typedef void (*lcc_getval_callback_t)(lcc_connection_t *c, int status,
+                                      const char *message, size_t values_num,
+                                      gauge_t *values, char **values_names,
+                                      void *user_data);
+
+/* "cb" may be NULL if the result is of no interest. */
+int lcc_putval_async(lcc_connection_t *c, const lcc_value_list_t *vl,
+                     lcc_putval_callback_t cb, void *user_data);
+int lcc_getval_async(lcc_connection_t *c, const lcc_identifier_t *ident,
+                     lcc_getval_callback_t cb, void *user_data);
+
+int lcc_async_process(lcc_connection_t *c);
+int lcc_async_flush(lcc_connection_t *c);
+int lcc_async_fd(lcc_connection_t *c);
+size_t lcc_async_pending(lcc_connection_t *c);
+int lcc_async_want_write(lcc_connection_t *c);
+
 int lcc_listval(lcc_connection_t *c, lcc_identifier_t **ret_ident,
                 size_t *ret_ident_num);
 
+/* One value list returned by lcc_getvals(). */
+typedef struct {
+  lcc_identifier_t identifier;
+  double time;
+  size_t values_num;
+  gauge_t *values;
+  char **values_names;
+} lcc_getvals_result_t;
+
+/* Fetches the values of all identifiers matching the shell wildcard
+ * "pattern", e.g. "myhost/cpu-*", with a single GETVALS command.
+ * Requires a daemon which knows the GETVALS command. The results must be
+ * freed with lcc_getvals_free(). */
+int lcc_getvals(lcc_connection_t *c, const char *pattern,
+                lcc_getvals_result_t **ret_results, size_t *ret_results_num);
+void lcc_getvals_free(lcc_getvals_result_t *results, size_t results_num);
+
 /* TODO: putnotif */
 
 const char *lcc_strerror(lcc_connection_t *c);
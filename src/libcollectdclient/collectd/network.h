@@ -68,6 +68,18 @@ int lcc_server_set_security_level(lcc_server_t *srv, lcc_security_level_t level,
  * Send data
  */
 int lcc_network_values_send(lcc_network_t *net, const lcc_value_list_t *vl);
+
+/* Adds "vls_num" value lists to the buffers of all servers. Buffers which
+ * fill up are sent in batches, using one sendmmsg(2) call for several
+ * packets where available. As with lcc_network_values_send(), the last,
+ * partially filled buffer is kept until more values arrive or
+ * lcc_network_flush() is called. Returns zero upon success or an errno
+ * value if sending to one of the servers failed. */
+int lcc_network_values_send_many(lcc_network_t *net,
+                                 const lcc_value_list_t *vls, size_t vls_num);
+
+/* Sends the partially filled buffers of all servers right away. */
+int lcc_network_flush(lcc_network_t *net);
 #if 0
 int lcc_network_notification_send (lcc_network_t *net,
     const lcc_notification_t *notif);
@@ -26,6 +26,8 @@
  *   Max Henkel <henkel at gmx.at>
  **/
 
+#define _GNU_SOURCE /* For sendmmsg(2) */
+
 #include "collectd.h"
 
 #include <assert.h>
@@ -50,6 +52,10 @@
 #include "collectd/network.h"
 #include "collectd/network_buffer.h"
 
+/* Maximum number of packets sent with one sendmmsg(2) call by
+ * lcc_network_values_send_many(). */
+#define LCC_NETWORK_SEND_BATCH 16
+
 /*
  * Private data types
  */
@@ -71,6 +77,8 @@ struct lcc_server_s {
   socklen_t sa_len;
 
   lcc_network_buffer_t *buffer;
+  /* Number of value lists in "buffer". */
+  size_t buffered;
 
   lcc_server_t *next;
 };
@@ -142,7 +150,11 @@ static int server_open_socket(lcc_server_t *srv) /* {{{ */
     if (srv->fd < 0)
       continue;
 
-    if (ai_ptr->ai_family == AF_INET) {
+    /* A TTL of zero means "not configured": use the system's default. */
+    status = 0;
+    if (srv->ttl == 0) {
+      /* nothing to do */
+    } else if (ai_ptr->ai_family == AF_INET) {
       struct sockaddr_in *addr = (struct sockaddr_in *)ai_ptr->ai_addr;
       int optname;
 
@@ -238,16 +250,146 @@ static int server_send_buffer(lcc_server_t *srv) /* {{{ */
   return 0;
 } /* }}} int server_send_buffer */
 
+/* Moves the content of the server's buffer to "packet" and re-initializes
+ * the buffer. */
+static int server_take_buffer(lcc_server_t *srv, char *packet, /* {{{ */
+                              size_t *packet_size) {
+  int status;
+
+  status = lcc_network_buffer_finalize(srv->buffer);
+  if (status != 0) {
+    lcc_network_buffer_initialize(srv->buffer);
+    return status;
+  }
+
+  status = lcc_network_buffer_get(srv->buffer, packet, packet_size);
+  lcc_network_buffer_initialize(srv->buffer);
+  srv->buffered = 0;
+  if (status != 0)
+    return status;
+
+  if (*packet_size > LCC_NETWORK_BUFFER_SIZE_DEFAULT)
+    *packet_size = LCC_NETWORK_BUFFER_SIZE_DEFAULT;
+  return 0;
+} /* }}} int server_take_buffer */
+
+/* Sends "packets_num" packets of LCC_NETWORK_BUFFER_SIZE_DEFAULT bytes each,
+ * with up to LCC_NETWORK_SEND_BATCH packets per system call where
+ * sendmmsg(2) is available. */
+static int server_send_packets(lcc_server_t *srv, /* {{{ */
+                               char packets[][LCC_NETWORK_BUFFER_SIZE_DEFAULT],
+                               size_t const *packets_size,
+                               size_t packets_num) {
+  size_t sent = 0;
+
+  if (srv->fd < 0) {
+    int status = server_open_socket(srv);
+    if (status != 0)
+      return status;
+  }
+
+#if HAVE_SENDMMSG
+  struct mmsghdr msgs[LCC_NETWORK_SEND_BATCH];
+  struct iovec iov[LCC_NETWORK_SEND_BATCH];
+
+  assert(packets_num <= LCC_NETWORK_SEND_BATCH);
+  memset(msgs, 0, sizeof(msgs));
+  for (size_t i = 0; i < packets_num; i++) {
+    iov[i].iov_base = packets[i];
+    iov[i].iov_len = packets_size[i];
+    msgs[i].msg_hdr.msg_name = srv->sa;
+    msgs[i].msg_hdr.msg_namelen = srv->sa_len;
+    msgs[i].msg_hdr.msg_iov = iov + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (sent < packets_num) {
+    int status = sendmmsg(srv->fd, msgs + sent,
+                          (unsigned int)(packets_num - sent), /* flags = */ 0);
+    if ((status < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+      continue;
+    if (status < 0)
+      return errno;
+    sent += (size_t)status;
+  }
+#else
+  for (; sent < packets_num; sent++) {
+    ssize_t status;
+
+    do {
+      status = sendto(srv->fd, packets[sent], packets_size[sent],
+                      /* flags = */ 0, srv->sa, srv->sa_len);
+    } while ((status < 0) && ((errno == EINTR) || (errno == EAGAIN)));
+
+    if (status < 0)
+      return errno;
+  }
+#endif
+
+  return 0;
+} /* }}} int server_send_packets */
+
+static int server_values_add_many(lcc_server_t *srv, /* {{{ */
+                                  const lcc_value_list_t *vls,
+                                  size_t vls_num) {
+  char packets[LCC_NETWORK_SEND_BATCH][LCC_NETWORK_BUFFER_SIZE_DEFAULT];
+  size_t packets_size[LCC_NETWORK_SEND_BATCH];
+  size_t packets_num = 0;
+  int ret = 0;
+
+  for (size_t i = 0; i < vls_num; i++) {
+    int status = lcc_network_buffer_add_value(srv->buffer, vls + i);
+    if (status == 0) {
+      srv->buffered++;
+      continue;
+    }
+
+    /* The buffer is full: queue it and retry with an empty one. */
+    packets_size[packets_num] = sizeof(packets[packets_num]);
+    if (server_take_buffer(srv, packets[packets_num],
+                           packets_size + packets_num) == 0)
+      packets_num++;
+
+    if (packets_num == LCC_NETWORK_SEND_BATCH) {
+      status = server_send_packets(srv, packets, packets_size, packets_num);
+      if (status != 0)
+        ret = status;
+      packets_num = 0;
+    }
+
+    status = lcc_network_buffer_add_value(srv->buffer, vls + i);
+    if (status == 0)
+      srv->buffered++;
+    else
+      ret = status;
+  }
+
+  if (packets_num > 0) {
+    int status = server_send_packets(srv, packets, packets_size, packets_num);
+    if (status != 0)
+      ret = status;
+  }
+
+  return ret;
+} /* }}} int server_values_add_many */
+
 static int server_value_add(lcc_server_t *srv, /* {{{ */
                             const lcc_value_list_t *vl) {
   int status;
 
   status = lcc_network_buffer_add_value(srv->buffer, vl);
-  if (status == 0)
+  if (status == 0) {
+    srv->buffered++;
     return 0;
+  }
 
   server_send_buffer(srv);
-  return lcc_network_buffer_add_value(srv->buffer, vl);
+  srv->buffered = 0;
+
+  status = lcc_network_buffer_add_value(srv->buffer, vl);
+  if (status == 0)
+    srv->buffered++;
+  return status;
 } /* }}} int server_value_add */
 
 /*
@@ -446,3 +588,43 @@ int lcc_network_values_send(lcc_network_t *net, /* {{{ */
 
   return 0;
 } /* }}} int lcc_network_values_send */
+
+int lcc_network_values_send_many(lcc_network_t *net, /* {{{ */
+                                 const lcc_value_list_t *vls, size_t vls_num) {
+  int ret = 0;
+
+  if ((net == NULL) || ((vls == NULL) && (vls_num > 0)))
+    return EINVAL;
+
+  for (lcc_server_t *srv = net->servers; srv != NULL; srv = srv->next) {
+    int status = server_values_add_many(srv, vls, vls_num);
+    if (status != 0)
+      ret = status;
+  }
+
+  return ret;
+} /* }}} int lcc_network_values_send_many */
+
+int lcc_network_flush(lcc_network_t *net) /* {{{ */
+{
+  int ret = 0;
+
+  if (net == NULL)
+    return EINVAL;
+
+  for (lcc_server_t *srv = net->servers; srv != NULL; srv = srv->next) {
+    char packet[1][LCC_NETWORK_BUFFER_SIZE_DEFAULT];
+    size_t packet_size = sizeof(packet[0]);
+
+    if (srv->buffered == 0)
+      continue;
+    if (server_take_buffer(srv, packet[0], &packet_size) != 0)
+      continue;
+
+    int status = server_send_packets(srv, packet, &packet_size, 1);
+    if (status != 0)
+      ret = status;
+  }
+
+  return ret;
+} /* }}} int lcc_network_flush */
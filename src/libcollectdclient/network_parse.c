@@ -54,6 +54,10 @@
 #include <gcrypt.h>
 #endif
 
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 #include <stdio.h>
 #define DEBUG(...) printf(__VA_ARGS__)
 
@@ -63,9 +67,11 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 #endif
 #endif
 
-/* forward declaration because parse_sign_sha256()/parse_encrypt_aes256() and
- * network_parse() need to call each other. */
+/* forward declaration because parse_sign_sha256()/parse_encrypt_aes256()/
+ * parse_compr_zlib() and network_parse() need to call each other.
+ * "compressed" is true when parsing the content of a compressed part. */
 static int network_parse(void *data, size_t data_size, lcc_security_level_t sl,
+                         bool compressed,
                          lcc_network_parse_options_t const *opts);
 
 #if HAVE_GCRYPT_H
@@ -138,6 +144,10 @@ static int buffer_uint16(buffer_t *b, uint16_t *out) {
 #define TYPE_INTERVAL_HR 0x0009
 #define TYPE_SIGN_SHA256 0x0200
 #define TYPE_ENCR_AES256 0x0210
+#define TYPE_COMPR_ZLIB 0x0220
+
+/* Upper limit for the uncompressed size of a compressed part. */
+#define COMPRESS_MAX_SIZE 65536
 
 static int parse_int(void *payload, size_t payload_size, uint64_t *out) {
   uint64_t tmp;
@@ -392,11 +402,12 @@ static int verify_sha256(void *payload, size_t payload_size,
 
 static int parse_sign_sha256(void *signature, size_t signature_len,
                              void *payload, size_t payload_size,
+                             bool compressed,
                              lcc_network_parse_options_t const *opts) {
   if (opts->password_lookup == NULL) {
     /* The sender signed the packet but we can't verify it. Handle it as if it
      * were unsigned, i.e. security level NONE. */
-    return network_parse(payload, payload_size, NONE, opts);
+    return network_parse(payload, payload_size, NONE, compressed, opts);
   }
 
   buffer_t *b = &(buffer_t){
@@ -415,13 +426,13 @@ static int parse_sign_sha256(void *signature, size_t signature_len,
 
   char const *password = opts->password_lookup(username);
   if (!password)
-    return network_parse(payload, payload_size, NONE, opts);
+    return network_parse(payload, payload_size, NONE, compressed, opts);
 
   int status = verify_sha256(payload, payload_size, username, password, hash);
   if (status != 0)
     return status;
 
-  return network_parse(payload, payload_size, SIGN, opts);
+  return network_parse(payload, payload_size, SIGN, compressed, opts);
 }
 
 #if HAVE_GCRYPT_H
@@ -449,7 +460,7 @@ static int decrypt_aes256(buffer_t *b, void *iv, size_t iv_size,
   return 0;
 }
 
-static int parse_encrypt_aes256(void *data, size_t data_size,
+static int parse_encrypt_aes256(void *data, size_t data_size, bool compressed,
                                 lcc_network_parse_options_t const *opts) {
   if (opts->password_lookup == NULL) {
     /* Without a password source it's (hopefully) impossible to decrypt the
@@ -495,16 +506,60 @@ static int parse_encrypt_aes256(void *data, size_t data_size,
     return -1;
   }
 
-  return network_parse(b->data, b->len, ENCRYPT, opts);
+  return network_parse(b->data, b->len, ENCRYPT, compressed, opts);
 }
 #else /* !HAVE_GCRYPT_H */
-static int parse_encrypt_aes256(void *data, size_t data_size,
+static int parse_encrypt_aes256(void *data, size_t data_size, bool compressed,
                                 lcc_network_parse_options_t const *opts) {
   return ENOTSUP;
 }
 #endif
 
+#if HAVE_LIBZ
+static int parse_compr_zlib(void *data, size_t data_size,
+                            lcc_security_level_t sl, bool compressed,
+                            lcc_network_parse_options_t const *opts) {
+  /* A compressed part inside a compressed part could expand to many times
+   * COMPRESS_MAX_SIZE. */
+  if (compressed)
+    return EINVAL;
+
+  buffer_t *b = &(buffer_t){
+      .data = data, .len = data_size,
+  };
+
+  uint32_t raw_size;
+  if (buffer_next(b, &raw_size, sizeof(raw_size)))
+    return EINVAL;
+  raw_size = be32toh(raw_size);
+  if ((raw_size == 0) || (raw_size > COMPRESS_MAX_SIZE))
+    return EINVAL;
+
+  uint8_t *raw = malloc(raw_size);
+  if (raw == NULL)
+    return ENOMEM;
+
+  uLongf raw_len = (uLongf)raw_size;
+  if ((uncompress(raw, &raw_len, b->data, (uLong)b->len) != Z_OK) ||
+      (raw_len != (uLongf)raw_size)) {
+    free(raw);
+    return EINVAL;
+  }
+
+  int status = network_parse(raw, (size_t)raw_len, sl, true, opts);
+  free(raw);
+  return status;
+}
+#else /* !HAVE_LIBZ */
+static int parse_compr_zlib(void *data, size_t data_size,
+                            lcc_security_level_t sl, bool compressed,
+                            lcc_network_parse_options_t const *opts) {
+  return ENOTSUP;
+}
+#endif
+
 static int network_parse(void *data, size_t data_size, lcc_security_level_t sl,
+                         bool compressed,
                          lcc_network_parse_options_t const *opts) {
   buffer_t *b = &(buffer_t){
       .data = data, .len = data_size,
@@ -580,7 +635,8 @@ static int network_parse(void *data, size_t data_size, lcc_security_level_t sl,
 
     case TYPE_SIGN_SHA256: {
       int status =
-          parse_sign_sha256(payload, sizeof(payload), b->data, b->len, opts);
+          parse_sign_sha256(payload, sizeof(payload), b->data, b->len,
+                            compressed, opts);
       if (status != 0) {
         DEBUG("lcc_network_parse(): parse_sign_sha256() = %d\n", status);
         return -1;
@@ -592,7 +648,8 @@ static int network_parse(void *data, size_t data_size, lcc_security_level_t sl,
     }
 
     case TYPE_ENCR_AES256: {
-      int status = parse_encrypt_aes256(payload, sizeof(payload), opts);
+      int status =
+          parse_encrypt_aes256(payload, sizeof(payload), compressed, opts);
       if (status != 0) {
         DEBUG("lcc_network_parse(): parse_encrypt_aes256() = %d\n", status);
         return -1;
@@ -600,6 +657,16 @@ static int network_parse(void *data, size_t data_size, lcc_security_level_t sl,
       break;
     }
 
+    case TYPE_COMPR_ZLIB: {
+      int status =
+          parse_compr_zlib(payload, sizeof(payload), sl, compressed, opts);
+      if (status != 0) {
+        DEBUG("lcc_network_parse(): parse_compr_zlib() = %d\n", status);
+        return -1;
+      }
+      break;
+    }
+
     default: {
       DEBUG("lcc_network_parse(): ignoring unknown type %" PRIu16 "\n", type);
       return EINVAL;
@@ -623,5 +690,5 @@ int lcc_network_parse(void *data, size_t data_size,
 #endif
   }
 
-  return network_parse(data, data_size, NONE, &opts);
+  return network_parse(data, data_size, NONE, /* compressed = */ false, &opts);
 }
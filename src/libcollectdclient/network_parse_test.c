@@ -486,6 +486,87 @@ static int test_decrypt_aes256() {
 }
 #endif
 
+#if HAVE_LIBZ
+static int value_lists_num;
+
+static int counting_writer(lcc_value_list_t const *vl) {
+  value_lists_num++;
+  return nop_writer(vl);
+}
+
+/* Wraps "in" into a compressed part at the beginning of "out". */
+static size_t compress_part(uint8_t *out, size_t out_size, uint8_t const *in,
+                            size_t in_size) {
+  uLongf compressed_size = (uLongf)(out_size - 8);
+  if (compress(out + 8, &compressed_size, in, (uLong)in_size) != Z_OK)
+    return 0;
+
+  size_t size = 8 + (size_t)compressed_size;
+  uint16_t type = htobe16(TYPE_COMPR_ZLIB);
+  uint16_t length = htobe16((uint16_t)size);
+  uint32_t raw_size = htobe32((uint32_t)in_size);
+  memcpy(out, &type, sizeof(type));
+  memcpy(out + 2, &length, sizeof(length));
+  memcpy(out + 4, &raw_size, sizeof(raw_size));
+  return size;
+}
+
+static int test_parse_compr_zlib() {
+  uint8_t raw[LCC_NETWORK_BUFFER_SIZE_DEFAULT];
+  size_t raw_size = sizeof(raw);
+  if (decode_string(raw_packet_data[0], raw, &raw_size)) {
+    fprintf(stderr, "test_parse_compr_zlib: decoding string failed\n");
+    return -1;
+  }
+
+  lcc_network_parse_options_t opts = {.writer = counting_writer};
+
+  value_lists_num = 0;
+  int status = lcc_network_parse(raw, raw_size, opts);
+  int want = value_lists_num;
+  if ((status != 0) || (want == 0)) {
+    fprintf(stderr, "lcc_network_parse(raw) = %d\n", status);
+    return -1;
+  }
+
+  uint8_t compressed[LCC_NETWORK_BUFFER_SIZE_DEFAULT];
+  size_t compressed_size =
+      compress_part(compressed, sizeof(compressed), raw, raw_size);
+  if ((compressed_size == 0) || (compressed_size >= raw_size)) {
+    fprintf(stderr, "test_parse_compr_zlib: compressing failed\n");
+    return -1;
+  }
+
+  value_lists_num = 0;
+  status = lcc_network_parse(compressed, compressed_size, opts);
+  if ((status != 0) || (value_lists_num != want)) {
+    fprintf(stderr,
+            "lcc_network_parse(compressed) = %d, got %d value lists, want %d\n",
+            status, value_lists_num, want);
+    return -1;
+  }
+  printf("ok - lcc_network_parse(compressed)\n");
+
+  /* Compressed parts inside compressed parts are rejected. */
+  uint8_t nested[LCC_NETWORK_BUFFER_SIZE_DEFAULT];
+  size_t nested_size =
+      compress_part(nested, sizeof(nested), compressed, compressed_size);
+  if (nested_size == 0) {
+    fprintf(stderr, "test_parse_compr_zlib: compressing failed\n");
+    return -1;
+  }
+
+  status = lcc_network_parse(nested, nested_size, opts);
+  if (status == 0) {
+    fprintf(stderr, "lcc_network_parse(nested) = 0, want non-zero\n");
+    return -1;
+  }
+  printf("ok - lcc_network_parse(nested)\n");
+
+  return 0;
+}
+#endif
+
 int main(void) {
   int ret = 0;
 
@@ -502,6 +583,11 @@ int main(void) {
   if ((status = test_parse_values())) {
     ret = status;
   }
+#if HAVE_LIBZ
+  if ((status = test_parse_compr_zlib())) {
+    ret = status;
+  }
+#endif
 
 #if HAVE_GCRYPT_H
   if ((status = test_verify_sha256())) {
@@ -26,6 +26,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -196,3 +197,177 @@ void oconfig_free(oconfig_item_t *ci) {
   oconfig_free_all(ci);
   free(ci);
 }
+
+/*
+ * Binary representation
+ *
+ * Items are written depth first: the key, the values and the children. All
+ * integers are written in host byte order, so the format is only suitable
+ * for caching a tree on the same host. A NULL key (the root item) is written
+ * with a length of UINT32_MAX.
+ */
+static int oconfig_write_u32(FILE *fh, uint32_t u) {
+  return (fwrite(&u, sizeof(u), 1, fh) == 1) ? 0 : -1;
+}
+
+static int oconfig_write_string(FILE *fh, const char *str) {
+  if (str == NULL)
+    return oconfig_write_u32(fh, UINT32_MAX);
+
+  size_t len = strlen(str);
+  if (len >= UINT32_MAX)
+    return -1;
+  if (oconfig_write_u32(fh, (uint32_t)len) != 0)
+    return -1;
+  return (fwrite(str, 1, len, fh) == len) ? 0 : -1;
+}
+
+int oconfig_write_binary(FILE *fh, const oconfig_item_t *ci) {
+  if (oconfig_write_string(fh, ci->key) != 0)
+    return -1;
+
+  if (oconfig_write_u32(fh, (uint32_t)ci->values_num) != 0)
+    return -1;
+  for (int i = 0; i < ci->values_num; i++) {
+    const oconfig_value_t *v = ci->values + i;
+    uint8_t type = (uint8_t)v->type;
+    int status;
+
+    if (fwrite(&type, sizeof(type), 1, fh) != 1)
+      return -1;
+
+    if (v->type == OCONFIG_TYPE_STRING)
+      status = oconfig_write_string(fh, v->value.string);
+    else if (v->type == OCONFIG_TYPE_NUMBER)
+      status = (fwrite(&v->value.number, sizeof(v->value.number), 1, fh) == 1)
+                   ? 0
+                   : -1;
+    else
+      status = oconfig_write_u32(fh, (uint32_t)v->value.boolean);
+    if (status != 0)
+      return -1;
+  }
+
+  if (oconfig_write_u32(fh, (uint32_t)ci->children_num) != 0)
+    return -1;
+  for (int i = 0; i < ci->children_num; i++)
+    if (oconfig_write_binary(fh, ci->children + i) != 0)
+      return -1;
+
+  return 0;
+} /* int oconfig_write_binary */
+
+static int oconfig_read_u32(FILE *fh, uint32_t *ret) {
+  return (fread(ret, sizeof(*ret), 1, fh) == 1) ? 0 : -1;
+}
+
+/* Reads a count and makes sure it is representable as an int. */
+static int oconfig_read_num(FILE *fh, int *ret) {
+  uint32_t u;
+
+  if ((oconfig_read_u32(fh, &u) != 0) || (u > INT32_MAX))
+    return -1;
+  *ret = (int)u;
+  return 0;
+}
+
+static int oconfig_read_string(FILE *fh, char **ret) {
+  uint32_t len;
+
+  if (oconfig_read_u32(fh, &len) != 0)
+    return -1;
+  if (len == UINT32_MAX) {
+    *ret = NULL;
+    return 0;
+  }
+
+  char *str = malloc((size_t)len + 1);
+  if (str == NULL)
+    return -1;
+  if (fread(str, 1, len, fh) != len) {
+    free(str);
+    return -1;
+  }
+  str[len] = 0;
+
+  *ret = str;
+  return 0;
+}
+
+/* Fills in "ci", which has been zeroed by the caller. On error, "ci" may be
+ * partially filled in and has to be freed with oconfig_free_all(). */
+static int oconfig_read_item(FILE *fh, oconfig_item_t *ci, int depth) {
+  int num;
+
+  /* Don't recurse without bound on corrupt input. */
+  if (depth > 1000)
+    return -1;
+
+  if (oconfig_read_string(fh, &ci->key) != 0)
+    return -1;
+
+  if (oconfig_read_num(fh, &num) != 0)
+    return -1;
+  if (num > 0) {
+    ci->values = calloc((size_t)num, sizeof(*ci->values));
+    if (ci->values == NULL)
+      return -1;
+  }
+  for (int i = 0; i < num; i++) {
+    oconfig_value_t *v = ci->values + i;
+    uint8_t type;
+    uint32_t u;
+
+    if (fread(&type, sizeof(type), 1, fh) != 1)
+      return -1;
+
+    if (type == OCONFIG_TYPE_STRING) {
+      char *str;
+      if ((oconfig_read_string(fh, &str) != 0) || (str == NULL)) {
+        free(str);
+        return -1;
+      }
+      v->value.string = str;
+    } else if (type == OCONFIG_TYPE_NUMBER) {
+      if (fread(&v->value.number, sizeof(v->value.number), 1, fh) != 1)
+        return -1;
+    } else if (type == OCONFIG_TYPE_BOOLEAN) {
+      if (oconfig_read_u32(fh, &u) != 0)
+        return -1;
+      v->value.boolean = (int)u;
+    } else {
+      return -1;
+    }
+    v->type = type;
+    ci->values_num = i + 1;
+  }
+
+  if (oconfig_read_num(fh, &num) != 0)
+    return -1;
+  if (num > 0) {
+    ci->children = calloc((size_t)num, sizeof(*ci->children));
+    if (ci->children == NULL)
+      return -1;
+  }
+  for (int i = 0; i < num; i++) {
+    ci->children_num = i + 1;
+    ci->children[i].parent = ci;
+    if (oconfig_read_item(fh, ci->children + i, depth + 1) != 0)
+      return -1;
+  }
+
+  return 0;
+} /* int oconfig_read_item */
+
+oconfig_item_t *oconfig_read_binary(FILE *fh) {
+  oconfig_item_t *ci = calloc(1, sizeof(*ci));
+  if (ci == NULL)
+    return NULL;
+
+  if (oconfig_read_item(fh, ci, /* depth = */ 0) != 0) {
+    oconfig_free(ci);
+    return NULL;
+  }
+
+  return ci;
+} /* oconfig_item_t *oconfig_read_binary */
@@ -67,4 +67,10 @@ oconfig_item_t *oconfig_clone(const oconfig_item_t *ci);
 
 void oconfig_free(oconfig_item_t *ci);
 
+/* Writes "ci" and all its children to "fh" in a compact binary format, which
+ * oconfig_read_binary() reads back. The format depends on the host's byte
+ * order and type sizes. Return zero on success. */
+int oconfig_write_binary(FILE *fh, const oconfig_item_t *ci);
+oconfig_item_t *oconfig_read_binary(FILE *fh);
+
 #endif /* OCONFIG_H */
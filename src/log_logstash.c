@@ -30,6 +30,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_log_writer.h"
 
 #include <sys/types.h>
 #include <yajl/yajl_common.h>
@@ -47,11 +48,21 @@ static int log_level = LOG_DEBUG;
 static int log_level = LOG_INFO;
 #endif /* COLLECT_DEBUG */
 
-static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_writer_t *log_writer;
+static int buffer_size = 4096;
 
-static char *log_file;
+/* Each thread keeps its own JSON generator and the timestamp string of the
+ * last second it logged in, so that neither has to be recreated for every
+ * message. yajl 1 can't reset a generator and allocates one per message. */
+typedef struct {
+  yajl_gen g;
+  time_t timestamp_time;
+  char timestamp_str[64];
+} log_logstash_thread_t;
 
-static const char *config_keys[] = {"LogLevel", "File"};
+static pthread_key_t thread_key;
+
+static const char *config_keys[] = {"LogLevel", "File", "BufferSize"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int log_logstash_config(const char *key, const char *value) {
@@ -64,20 +75,81 @@ static int log_logstash_config(const char *key, const char *value) {
       return 1;
     }
   } else if (0 == strcasecmp(key, "File")) {
-    sfree(log_file);
-    log_file = strdup(value);
+    if (log_writer_set_file(log_writer, value) != 0)
+      return 1;
+  } else if (0 == strcasecmp(key, "BufferSize")) {
+    buffer_size = atoi(value);
+    if (buffer_size < 0) {
+      ERROR("log_logstash: BufferSize must not be negative.");
+      buffer_size = 4096;
+      return 1;
+    }
   } else {
     return -1;
   }
   return 0;
 } /* int log_logstash_config (const char *, const char *) */
 
-static void log_logstash_print(yajl_gen g, int severity,
+static void log_logstash_thread_free(void *arg) {
+  log_logstash_thread_t *t = arg;
+
+  if (t->g != NULL)
+    yajl_gen_free(t->g);
+  free(t);
+} /* void log_logstash_thread_free */
+
+/* Returns the calling thread's state with a generator that is ready to
+ * start a new JSON object, or NULL on error. */
+static log_logstash_thread_t *log_logstash_thread_get(void) {
+  log_logstash_thread_t *t = pthread_getspecific(thread_key);
+  if (t == NULL) {
+    t = calloc(1, sizeof(*t));
+    if (t == NULL)
+      return NULL;
+    t->timestamp_time = (time_t)-1;
+    pthread_setspecific(thread_key, t);
+  }
+
+#if HAVE_YAJL_V2
+  if (t->g != NULL) {
+    yajl_gen_clear(t->g);
+    yajl_gen_reset(t->g, /* sep = */ NULL);
+    return t;
+  }
+  t->g = yajl_gen_alloc(NULL);
+#else
+  yajl_gen_config conf = {};
+
+  conf.beautify = 0;
+  t->g = yajl_gen_alloc(&conf, NULL);
+#endif
+
+  if (t->g == NULL) {
+    fprintf(stderr, "Could not allocate JSON generator.\n");
+    return NULL;
+  }
+  return t;
+} /* log_logstash_thread_t *log_logstash_thread_get */
+
+/* Releases the generator after a message has been generated. */
+static void log_logstash_thread_put(log_logstash_thread_t *t) {
+#if !HAVE_YAJL_V2
+  yajl_gen_free(t->g);
+  t->g = NULL;
+#endif
+} /* void log_logstash_thread_put */
+
+static void log_logstash_format(FILE *fh, int __attribute__((unused))
+                                              severity,
+                                cdtime_t __attribute__((unused)) time,
+                                const char *msg) {
+  fprintf(fh, "%s\n", msg);
+} /* void log_logstash_format */
+
+static void log_logstash_print(log_logstash_thread_t *t, int severity,
                                cdtime_t timestamp_time) {
-  FILE *fh;
-  bool do_close = false;
-  struct tm timestamp_tm;
-  char timestamp_str[64];
+  yajl_gen g = t->g;
+  time_t tt = CDTIME_T_TO_TIME_T(timestamp_time);
   const unsigned char *buf;
 #if HAVE_YAJL_V2
   size_t len;
@@ -126,17 +198,21 @@ static void log_logstash_print(yajl_gen g, int severity,
       yajl_gen_status_ok)
     goto err;
 
-  gmtime_r(&CDTIME_T_TO_TIME_T(timestamp_time), &timestamp_tm);
-
-  /*
-   * format time as a UTC ISO 8601 compliant string
-   */
-  strftime(timestamp_str, sizeof(timestamp_str), "%Y-%m-%dT%H:%M:%SZ",
-           &timestamp_tm);
-  timestamp_str[sizeof(timestamp_str) - 1] = '\0';
+  if (tt != t->timestamp_time) {
+    struct tm timestamp_tm;
+    gmtime_r(&tt, &timestamp_tm);
+
+    /*
+     * format time as a UTC ISO 8601 compliant string
+     */
+    strftime(t->timestamp_str, sizeof(t->timestamp_str),
+             "%Y-%m-%dT%H:%M:%SZ", &timestamp_tm);
+    t->timestamp_str[sizeof(t->timestamp_str) - 1] = '\0';
+    t->timestamp_time = tt;
+  }
 
-  if (yajl_gen_string(g, (u_char *)timestamp_str, strlen(timestamp_str)) !=
-      yajl_gen_status_ok)
+  if (yajl_gen_string(g, (u_char *)t->timestamp_str,
+                      strlen(t->timestamp_str)) != yajl_gen_status_ok)
     goto err;
 
   if (yajl_gen_map_close(g) != yajl_gen_status_ok)
@@ -144,64 +220,26 @@ static void log_logstash_print(yajl_gen g, int severity,
 
   if (yajl_gen_get_buf(g, &buf, &len) != yajl_gen_status_ok)
     goto err;
-  pthread_mutex_lock(&file_lock);
-
-  if (log_file == NULL) {
-    fh = stderr;
-  } else if (strcasecmp(log_file, "stdout") == 0) {
-    fh = stdout;
-    do_close = false;
-  } else if (strcasecmp(log_file, "stderr") == 0) {
-    fh = stderr;
-    do_close = false;
-  } else {
-    fh = fopen(log_file, "a");
-    do_close = true;
-  }
 
-  if (fh == NULL) {
-    fprintf(stderr, "log_logstash plugin: fopen (%s) failed: %s\n", log_file,
-            STRERRNO);
-  } else {
-    fprintf(fh, "%s\n", buf);
-    if (do_close) {
-      fclose(fh);
-    } else {
-      fflush(fh);
-    }
-  }
-  pthread_mutex_unlock(&file_lock);
-  yajl_gen_free(g);
+  log_writer_write(log_writer, severity, timestamp_time, (const char *)buf);
+  log_logstash_thread_put(t);
   return;
 
 err:
-  yajl_gen_free(g);
+  log_logstash_thread_put(t);
   fprintf(stderr, "Could not correctly generate JSON message\n");
   return;
 } /* void log_logstash_print */
 
 static void log_logstash_log(int severity, const char *msg,
                              user_data_t __attribute__((unused)) * user_data) {
-  yajl_gen g;
-#if !defined(HAVE_YAJL_V2)
-  yajl_gen_config conf = {};
-
-  conf.beautify = 0;
-#endif
-
   if (severity > log_level)
     return;
 
-#if HAVE_YAJL_V2
-  g = yajl_gen_alloc(NULL);
-#else
-  g = yajl_gen_alloc(&conf, NULL);
-#endif
-
-  if (g == NULL) {
-    fprintf(stderr, "Could not allocate JSON generator.\n");
+  log_logstash_thread_t *t = log_logstash_thread_get();
+  if (t == NULL)
     return;
-  }
+  yajl_gen g = t->g;
 
   if (yajl_gen_map_open(g) != yajl_gen_status_ok)
     goto err;
@@ -211,10 +249,10 @@ static void log_logstash_log(int severity, const char *msg,
   if (yajl_gen_string(g, (u_char *)msg, strlen(msg)) != yajl_gen_status_ok)
     goto err;
 
-  log_logstash_print(g, severity, cdtime());
+  log_logstash_print(t, severity, cdtime());
   return;
 err:
-  yajl_gen_free(g);
+  log_logstash_thread_put(t);
   fprintf(stderr, "Could not generate JSON message preamble\n");
   return;
 
@@ -223,20 +261,10 @@ err:
 static int log_logstash_notification(const notification_t *n,
                                      user_data_t __attribute__((unused)) *
                                          user_data) {
-  yajl_gen g;
-#if HAVE_YAJL_V2
-  g = yajl_gen_alloc(NULL);
-#else
-  yajl_gen_config conf = {};
-
-  conf.beautify = 0;
-  g = yajl_gen_alloc(&conf, NULL);
-#endif
-
-  if (g == NULL) {
-    fprintf(stderr, "Could not allocate JSON generator.\n");
+  log_logstash_thread_t *t = log_logstash_thread_get();
+  if (t == NULL)
     return 0;
-  }
+  yajl_gen g = t->g;
 
   if (yajl_gen_map_open(g) != yajl_gen_status_ok)
     goto err;
@@ -321,18 +349,36 @@ static int log_logstash_notification(const notification_t *n,
     break;
   }
 
-  log_logstash_print(g, LOG_INFO, (n->time != 0) ? n->time : cdtime());
+  log_logstash_print(t, LOG_INFO, (n->time != 0) ? n->time : cdtime());
   return 0;
 
 err:
-  yajl_gen_free(g);
+  log_logstash_thread_put(t);
   fprintf(stderr, "Could not correctly generate JSON notification\n");
   return 0;
 } /* int log_logstash_notification */
 
+static int log_logstash_init(void) {
+  return log_writer_start(log_writer, (size_t)buffer_size);
+} /* int log_logstash_init */
+
+static int log_logstash_shutdown(void) {
+  log_writer_stop(log_writer);
+  return 0;
+} /* int log_logstash_shutdown */
+
 void module_register(void) {
+  log_writer = log_writer_create("log_logstash", log_logstash_format);
+  if (log_writer == NULL) {
+    fprintf(stderr, "log_logstash plugin: log_writer_create failed.\n");
+    return;
+  }
+  pthread_key_create(&thread_key, log_logstash_thread_free);
+
   plugin_register_config("log_logstash", log_logstash_config, config_keys,
                          config_keys_num);
+  plugin_register_init("log_logstash", log_logstash_init);
+  plugin_register_shutdown("log_logstash", log_logstash_shutdown);
   plugin_register_log("log_logstash", log_logstash_log,
                       /* user_data = */ NULL);
   plugin_register_notification("log_logstash", log_logstash_notification,
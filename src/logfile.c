@@ -30,6 +30,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_log_writer.h"
 
 #if COLLECT_DEBUG
 static int log_level = LOG_DEBUG;
@@ -37,14 +38,14 @@ static int log_level = LOG_DEBUG;
 static int log_level = LOG_INFO;
 #endif /* COLLECT_DEBUG */
 
-static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_writer_t *log_writer;
 
-static char *log_file;
 static int print_timestamp = 1;
 static int print_severity;
+static int buffer_size = 4096;
 
 static const char *config_keys[] = {"LogLevel", "File", "Timestamp",
-                                    "PrintSeverity"};
+                                    "PrintSeverity", "BufferSize"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int logfile_config(const char *key, const char *value) {
@@ -56,8 +57,8 @@ static int logfile_config(const char *key, const char *value) {
       return 1;
     }
   } else if (0 == strcasecmp(key, "File")) {
-    sfree(log_file);
-    log_file = strdup(value);
+    if (log_writer_set_file(log_writer, value) != 0)
+      return 1;
   } else if (0 == strcasecmp(key, "Timestamp")) {
     if (IS_FALSE(value))
       print_timestamp = 0;
@@ -68,16 +69,21 @@ static int logfile_config(const char *key, const char *value) {
       print_severity = 0;
     else
       print_severity = 1;
+  } else if (0 == strcasecmp(key, "BufferSize")) {
+    buffer_size = atoi(value);
+    if (buffer_size < 0) {
+      ERROR("logfile: BufferSize must not be negative.");
+      buffer_size = 4096;
+      return 1;
+    }
   } else {
     return -1;
   }
   return 0;
 } /* int logfile_config (const char *, const char *) */
 
-static void logfile_print(const char *msg, int severity,
-                          cdtime_t timestamp_time) {
-  FILE *fh;
-  bool do_close = false;
+static void logfile_format(FILE *fh, int severity, cdtime_t timestamp_time,
+                           const char *msg) {
   char timestamp_str[64];
   char level_str[16] = "";
 
@@ -112,39 +118,25 @@ static void logfile_print(const char *msg, int severity,
     timestamp_str[sizeof(timestamp_str) - 1] = '\0';
   }
 
-  pthread_mutex_lock(&file_lock);
-
-  if (log_file == NULL) {
-    fh = stderr;
-  } else if (strcasecmp(log_file, "stderr") == 0)
-    fh = stderr;
-  else if (strcasecmp(log_file, "stdout") == 0)
-    fh = stdout;
-  else {
-    fh = fopen(log_file, "a");
-    do_close = true;
-  }
+  if (print_timestamp)
+    fprintf(fh, "[%s] %s%s\n", timestamp_str, level_str, msg);
+  else
+    fprintf(fh, "%s%s\n", level_str, msg);
+} /* void logfile_format */
 
-  if (fh == NULL) {
-    fprintf(stderr, "logfile plugin: fopen (%s) failed: %s\n", log_file,
-            STRERRNO);
-  } else {
-    if (print_timestamp)
-      fprintf(fh, "[%s] %s%s\n", timestamp_str, level_str, msg);
-    else
-      fprintf(fh, "%s%s\n", level_str, msg);
-
-    if (do_close) {
-      fclose(fh);
-    } else {
-      fflush(fh);
-    }
-  }
+static void logfile_print(const char *msg, int severity,
+                          cdtime_t timestamp_time) {
+  log_writer_write(log_writer, severity, timestamp_time, msg);
+} /* void logfile_print */
 
-  pthread_mutex_unlock(&file_lock);
+static int logfile_init(void) {
+  return log_writer_start(log_writer, (size_t)buffer_size);
+} /* int logfile_init */
 
-  return;
-} /* void logfile_print */
+static int logfile_shutdown(void) {
+  log_writer_stop(log_writer);
+  return 0;
+} /* int logfile_shutdown */
 
 static void logfile_log(int severity, const char *msg,
                         user_data_t __attribute__((unused)) * user_data) {
@@ -197,8 +189,16 @@ static int logfile_notification(const notification_t *n,
 } /* int logfile_notification */
 
 void module_register(void) {
+  log_writer = log_writer_create("logfile", logfile_format);
+  if (log_writer == NULL) {
+    fprintf(stderr, "logfile plugin: log_writer_create failed.\n");
+    return;
+  }
+
   plugin_register_config("logfile", logfile_config, config_keys,
                          config_keys_num);
+  plugin_register_init("logfile", logfile_init);
+  plugin_register_shutdown("logfile", logfile_shutdown);
   plugin_register_log("logfile", logfile_log, /* user_data = */ NULL);
   plugin_register_notification("logfile", logfile_notification,
                                /* user_data = */ NULL);
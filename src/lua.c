@@ -31,6 +31,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_atomic.h"
 #include "utils_lua.h"
 
 /* Include the Lua API header files. */
@@ -40,21 +41,69 @@
 
 #include <pthread.h>
 
-typedef struct lua_script_s {
-  char *script_path;
-  lua_State *lua_state;
-  struct lua_script_s *next;
-} lua_script_t;
+#define CLUA_CALLBACK_READ 0
+#define CLUA_CALLBACK_WRITE 1
+
+struct lua_script_s;
+typedef struct lua_script_s lua_script_t;
+
+struct clua_callback_data_s;
+typedef struct clua_callback_data_s clua_callback_data_t;
 
+/* One independent Lua state running a script. Only one thread at a time may
+ * use a state, including all Lua threads created within it. */
 typedef struct {
   lua_State *lua_state;
-  const char *lua_function_name;
   pthread_mutex_t lock;
+  lua_script_t *script;
+  size_t index;
+  /* Number of callbacks registered while the script was being executed. */
+  size_t callbacks_num;
+} clua_state_t;
+
+struct lua_script_s {
+  char *script_path;
+  /* `states_size' states are allocated, the first `states_num' of them have
+   * executed the script successfully. */
+  clua_state_t *states;
+  size_t states_size;
+  size_t states_num;
+  /* True once the script has been executed in all states. */
+  bool loaded;
+  /* Callbacks registered while the script was executed in the first state,
+   * in order of registration. The other states are expected to register the
+   * same callbacks in the same order. */
+  clua_callback_data_t **callbacks;
+  size_t callbacks_num;
+  struct lua_script_s *next;
+};
+
+/* The callback function and the Lua thread it runs in, for one state. */
+typedef struct {
+  lua_State *thread;
   int callback_id;
-} clua_callback_data_t;
+} clua_callback_state_t;
+
+struct clua_callback_data_s {
+  lua_script_t *script;
+  char *lua_function_name;
+  int type;
+  /* Index of the only state the callback exists in, or -1 if it was
+   * registered while loading the script and exists in every state. */
+  int state_index;
+  clua_callback_state_t *states;
+};
 
 static char base_path[PATH_MAX];
 static lua_script_t *scripts;
+static size_t states_per_script = 1;
+
+/* Threads prefer the state with their slot number, so that the same state
+ * keeps serving the same read or write thread. */
+static pthread_key_t clua_slot_key;
+static unsigned int clua_slot_next;
+
+#define CLUA_STATE_KEY "collectd.state"
 
 static int clua_store_callback(lua_State *L, int idx) /* {{{ */
 {
@@ -95,19 +144,64 @@ static int clua_store_thread(lua_State *L, int idx) /* {{{ */
   return 0;
 } /* }}} int clua_store_thread */
 
+/* Returns the state `L' belongs to. */
+static clua_state_t *clua_get_state(lua_State *L) /* {{{ */
+{
+  lua_getfield(L, LUA_REGISTRYINDEX, CLUA_STATE_KEY);
+  clua_state_t *st = lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return st;
+} /* }}} clua_state_t *clua_get_state */
+
+/* Locks a state the callback exists in and returns its index. The calling
+ * thread's own state is preferred; if it is busy, any idle state is used. If
+ * all states are busy, waits for the preferred one. */
+static size_t clua_acquire(clua_callback_data_t *cb) /* {{{ */
+{
+  lua_script_t *script = cb->script;
+
+  if (cb->state_index >= 0) {
+    pthread_mutex_lock(&script->states[cb->state_index].lock);
+    return (size_t)cb->state_index;
+  }
+
+  uintptr_t slot = (uintptr_t)pthread_getspecific(clua_slot_key);
+  if (slot == 0) {
+    slot = 1 + C_ATOMIC_ADD(&clua_slot_next, 1);
+    pthread_setspecific(clua_slot_key, (void *)slot);
+  }
+
+  /* `states_num' only grows while the script is loaded, before the read and
+   * write threads are started. */
+  size_t preferred = (size_t)(slot - 1) % script->states_num;
+  for (size_t i = 0; i < script->states_num; i++) {
+    size_t index = (preferred + i) % script->states_num;
+    if (pthread_mutex_trylock(&script->states[index].lock) == 0)
+      return index;
+  }
+
+  pthread_mutex_lock(&script->states[preferred].lock);
+  return preferred;
+} /* }}} size_t clua_acquire */
+
+static void clua_release(clua_callback_data_t *cb, size_t index) /* {{{ */
+{
+  pthread_mutex_unlock(&cb->script->states[index].lock);
+} /* }}} void clua_release */
+
 static int clua_read(user_data_t *ud) /* {{{ */
 {
   clua_callback_data_t *cb = ud->data;
 
-  pthread_mutex_lock(&cb->lock);
+  size_t index = clua_acquire(cb);
 
-  lua_State *L = cb->lua_state;
+  lua_State *L = cb->states[index].thread;
 
-  int status = clua_load_callback(L, cb->callback_id);
+  int status = clua_load_callback(L, cb->states[index].callback_id);
   if (status != 0) {
     ERROR("Lua plugin: Unable to load callback \"%s\" (id %i).",
-          cb->lua_function_name, cb->callback_id);
-    pthread_mutex_unlock(&cb->lock);
+          cb->lua_function_name, cb->states[index].callback_id);
+    clua_release(cb, index);
     return -1;
   }
   /* +1 = 1 */
@@ -121,14 +215,14 @@ static int clua_read(user_data_t *ud) /* {{{ */
     else
       ERROR("Lua plugin: Calling a read callback failed: %s", errmsg);
     lua_pop(L, 1);
-    pthread_mutex_unlock(&cb->lock);
+    clua_release(cb, index);
     return -1;
   }
 
   if (!lua_isnumber(L, -1)) {
     ERROR("Lua plugin: Read function \"%s\" (id %i) did not return a numeric "
           "status.",
-          cb->lua_function_name, cb->callback_id);
+          cb->lua_function_name, cb->states[index].callback_id);
     status = -1;
   } else {
     status = (int)lua_tointeger(L, -1);
@@ -137,7 +231,7 @@ static int clua_read(user_data_t *ud) /* {{{ */
   /* pop return value and function */
   lua_pop(L, 1); /* -1 = 0 */
 
-  pthread_mutex_unlock(&cb->lock);
+  clua_release(cb, index);
   return status;
 } /* }}} int clua_read */
 
@@ -145,15 +239,15 @@ static int clua_write(const data_set_t *ds, const value_list_t *vl, /* {{{ */
                       user_data_t *ud) {
   clua_callback_data_t *cb = ud->data;
 
-  pthread_mutex_lock(&cb->lock);
+  size_t index = clua_acquire(cb);
 
-  lua_State *L = cb->lua_state;
+  lua_State *L = cb->states[index].thread;
 
-  int status = clua_load_callback(L, cb->callback_id);
+  int status = clua_load_callback(L, cb->states[index].callback_id);
   if (status != 0) {
     ERROR("Lua plugin: Unable to load callback \"%s\" (id %i).",
-          cb->lua_function_name, cb->callback_id);
-    pthread_mutex_unlock(&cb->lock);
+          cb->lua_function_name, cb->states[index].callback_id);
+    clua_release(cb, index);
     return -1;
   }
   /* +1 = 1 */
@@ -161,7 +255,7 @@ static int clua_write(const data_set_t *ds, const value_list_t *vl, /* {{{ */
   status = luaC_pushvaluelist(L, ds, vl);
   if (status != 0) {
     lua_pop(L, 1); /* -1 = 0 */
-    pthread_mutex_unlock(&cb->lock);
+    clua_release(cb, index);
     ERROR("Lua plugin: luaC_pushvaluelist failed.");
     return -1;
   }
@@ -176,21 +270,21 @@ static int clua_write(const data_set_t *ds, const value_list_t *vl, /* {{{ */
     else
       ERROR("Lua plugin: Calling the write callback failed:\n%s", errmsg);
     lua_pop(L, 1); /* -1 = 0 */
-    pthread_mutex_unlock(&cb->lock);
+    clua_release(cb, index);
     return -1;
   }
 
   if (!lua_isnumber(L, -1)) {
     ERROR("Lua plugin: Write function \"%s\" (id %i) did not return a numeric "
           "value.",
-          cb->lua_function_name, cb->callback_id);
+          cb->lua_function_name, cb->states[index].callback_id);
     status = -1;
   } else {
     status = (int)lua_tointeger(L, -1);
   }
 
   lua_pop(L, 1); /* -1 = 0 */
-  pthread_mutex_unlock(&cb->lock);
+  clua_release(cb, index);
   return status;
 } /* }}} int clua_write */
 
@@ -233,18 +327,11 @@ static int lua_cb_log_warning(lua_State *L) /* {{{ */
   return 0;
 } /* }}} int lua_cb_log_warning */
 
-static int lua_cb_dispatch_values(lua_State *L) /* {{{ */
+static int clua_dispatch_valuelist(lua_State *L, int idx) /* {{{ */
 {
-  int nargs = lua_gettop(L);
-
-  if (nargs != 1)
-    return luaL_error(L, "Invalid number of arguments (%d != 1)", nargs);
-
-  luaL_checktype(L, 1, LUA_TTABLE);
-
-  value_list_t *vl = luaC_tovaluelist(L, -1);
+  value_list_t *vl = luaC_tovaluelist(L, idx);
   if (vl == NULL)
-    return luaL_error(L, "%s", "luaC_tovaluelist failed");
+    return -1;
 
 #if COLLECT_DEBUG
   char identifier[6 * DATA_MAX_NAME_LEN];
@@ -261,19 +348,71 @@ static int lua_cb_dispatch_values(lua_State *L) /* {{{ */
   sfree(vl->values);
   sfree(vl);
   return 0;
-} /* }}} lua_cb_dispatch_values */
+} /* }}} int clua_dispatch_valuelist */
 
-static int lua_cb_register_read(lua_State *L) /* {{{ */
+/* Accepts either one value list or an array of value lists. Dispatching many
+ * value lists with one call saves crossing the Lua / C boundary for each of
+ * them. */
+static int lua_cb_dispatch_values(lua_State *L) /* {{{ */
 {
   int nargs = lua_gettop(L);
 
   if (nargs != 1)
     return luaL_error(L, "Invalid number of arguments (%d != 1)", nargs);
 
-  luaL_checktype(L, 1, LUA_TFUNCTION);
+  luaL_checktype(L, 1, LUA_TTABLE);
 
-  char function_name[DATA_MAX_NAME_LEN];
-  snprintf(function_name, sizeof(function_name), "lua/%s", lua_tostring(L, 1));
+  lua_rawgeti(L, 1, 1);
+  bool is_array = lua_istable(L, -1);
+  lua_pop(L, 1);
+
+  if (!is_array) {
+    if (clua_dispatch_valuelist(L, 1) == -1)
+      return luaL_error(L, "%s", "luaC_tovaluelist failed");
+    return 0;
+  }
+
+#if LUA_VERSION_NUM < 502
+  size_t len = lua_objlen(L, 1);
+#else
+  size_t len = lua_rawlen(L, 1);
+#endif
+  int failed = 0;
+  for (size_t i = 0; i < len; i++) {
+    lua_rawgeti(L, 1, (int)i + 1);
+    if (!lua_istable(L, -1) || (clua_dispatch_valuelist(L, -1) == -1))
+      failed++;
+    lua_pop(L, 1);
+  }
+
+  if (failed > 0)
+    return luaL_error(L, "Converting %d of %d value lists failed", failed,
+                      (int)len);
+  return 0;
+} /* }}} lua_cb_dispatch_values */
+
+static void clua_callback_free(clua_callback_data_t *cb) /* {{{ */
+{
+  if (cb == NULL)
+    return;
+
+  sfree(cb->states);
+  sfree(cb->lua_function_name);
+  sfree(cb);
+} /* }}} void clua_callback_free */
+
+/* Stores the callback function at stack index 1 and a new Lua thread to run
+ * it in. If the daemon has to be told about the callback, a new callback is
+ * returned in "ret_cb". If it was registered by a state other than the first
+ * one while the script was being loaded, it is attached to the matching
+ * callback of the first state and "ret_cb" is set to NULL. */
+static int clua_callback_create(lua_State *L, int type, /* {{{ */
+                                const char *function_name,
+                                clua_callback_data_t **ret_cb) {
+  clua_state_t *st = clua_get_state(L);
+  if (st == NULL)
+    return luaL_error(L, "%s", "Unable to find the Lua state");
+  lua_script_t *script = st->script;
 
   int callback_id = clua_store_callback(L, 1);
   if (callback_id < 0)
@@ -285,14 +424,73 @@ static int lua_cb_register_read(lua_State *L) /* {{{ */
   clua_store_thread(L, -1);
   lua_pop(L, 1);
 
+  clua_callback_state_t cb_state = {
+      .thread = thread, .callback_id = callback_id,
+  };
+
+  if (!script->loaded && (st->index > 0)) {
+    size_t n = st->callbacks_num;
+    if ((n >= script->callbacks_num) || (script->callbacks[n]->type != type))
+      return luaL_error(L, "%s", "The script registered different callbacks "
+                                 "than in its first Lua state");
+
+    script->callbacks[n]->states[st->index] = cb_state;
+    st->callbacks_num++;
+    *ret_cb = NULL;
+    return 0;
+  }
+
   clua_callback_data_t *cb = calloc(1, sizeof(*cb));
   if (cb == NULL)
     return luaL_error(L, "%s", "calloc failed");
 
-  cb->lua_state = thread;
-  cb->callback_id = callback_id;
+  cb->states = calloc(script->states_size, sizeof(*cb->states));
   cb->lua_function_name = strdup(function_name);
-  pthread_mutex_init(&cb->lock, NULL);
+  if ((cb->states == NULL) || (cb->lua_function_name == NULL)) {
+    clua_callback_free(cb);
+    return luaL_error(L, "%s", "calloc failed");
+  }
+
+  if (!script->loaded) {
+    clua_callback_data_t **tmp =
+        realloc(script->callbacks,
+                (script->callbacks_num + 1) * sizeof(*script->callbacks));
+    if (tmp == NULL) {
+      clua_callback_free(cb);
+      return luaL_error(L, "%s", "realloc failed");
+    }
+    script->callbacks = tmp;
+    script->callbacks[script->callbacks_num] = cb;
+    script->callbacks_num++;
+    st->callbacks_num++;
+  }
+
+  cb->script = script;
+  cb->type = type;
+  /* Callbacks registered at run time only exist in one state. */
+  cb->state_index = script->loaded ? (int)st->index : -1;
+  cb->states[st->index] = cb_state;
+
+  *ret_cb = cb;
+  return 0;
+} /* }}} int clua_callback_create */
+
+static int lua_cb_register_read(lua_State *L) /* {{{ */
+{
+  int nargs = lua_gettop(L);
+
+  if (nargs != 1)
+    return luaL_error(L, "Invalid number of arguments (%d != 1)", nargs);
+
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+
+  char function_name[DATA_MAX_NAME_LEN];
+  snprintf(function_name, sizeof(function_name), "lua/%s", lua_tostring(L, 1));
+
+  clua_callback_data_t *cb = NULL;
+  clua_callback_create(L, CLUA_CALLBACK_READ, function_name, &cb);
+  if (cb == NULL)
+    return 0;
 
   int status = plugin_register_complex_read(/* group = */ "lua",
                                             /* name      = */ function_name,
@@ -319,24 +517,10 @@ static int lua_cb_register_write(lua_State *L) /* {{{ */
   char function_name[DATA_MAX_NAME_LEN] = "";
   snprintf(function_name, sizeof(function_name), "lua/%s", lua_tostring(L, 1));
 
-  int callback_id = clua_store_callback(L, 1);
-  if (callback_id < 0)
-    return luaL_error(L, "%s", "Storing callback function failed");
-
-  lua_State *thread = lua_newthread(L);
-  if (thread == NULL)
-    return luaL_error(L, "%s", "lua_newthread failed");
-  clua_store_thread(L, -1);
-  lua_pop(L, 1);
-
-  clua_callback_data_t *cb = calloc(1, sizeof(*cb));
+  clua_callback_data_t *cb = NULL;
+  clua_callback_create(L, CLUA_CALLBACK_WRITE, function_name, &cb);
   if (cb == NULL)
-    return luaL_error(L, "%s", "calloc failed");
-
-  cb->lua_state = thread;
-  cb->callback_id = callback_id;
-  cb->lua_function_name = strdup(function_name);
-  pthread_mutex_init(&cb->lock, NULL);
+    return 0;
 
   int status = plugin_register_write(/* name = */ function_name,
                                      /* callback  = */ clua_write,
@@ -370,6 +554,16 @@ static int open_collectd(lua_State *L) /* {{{ */
   return 1;
 } /* }}} */
 
+static void clua_state_destroy(clua_state_t *st) /* {{{ */
+{
+  if (st->lua_state == NULL)
+    return;
+
+  lua_close(st->lua_state);
+  st->lua_state = NULL;
+  pthread_mutex_destroy(&st->lock);
+} /* }}} void clua_state_destroy */
+
 static void lua_script_free(lua_script_t *script) /* {{{ */
 {
   if (script == NULL)
@@ -377,97 +571,92 @@ static void lua_script_free(lua_script_t *script) /* {{{ */
 
   lua_script_t *next = script->next;
 
-  if (script->lua_state != NULL) {
-    lua_close(script->lua_state);
-    script->lua_state = NULL;
-  }
+  for (size_t i = 0; i < script->states_size; i++)
+    clua_state_destroy(script->states + i);
+  sfree(script->states);
 
+  /* The callbacks themselves are owned by the daemon. */
+  sfree(script->callbacks);
   sfree(script->script_path);
   sfree(script);
 
   lua_script_free(next);
 } /* }}} void lua_script_free */
 
-static int lua_script_init(lua_script_t *script) /* {{{ */
+static int clua_state_init(clua_state_t *st) /* {{{ */
 {
-  memset(script, 0, sizeof(*script));
-
   /* initialize the lua context */
-  script->lua_state = luaL_newstate();
-  if (script->lua_state == NULL) {
+  st->lua_state = luaL_newstate();
+  if (st->lua_state == NULL) {
     ERROR("Lua plugin: luaL_newstate() failed.");
     return -1;
   }
+  pthread_mutex_init(&st->lock, NULL);
+
+  /* Remember which state this is, for the register functions. */
+  lua_pushlightuserdata(st->lua_state, st);
+  lua_setfield(st->lua_state, LUA_REGISTRYINDEX, CLUA_STATE_KEY);
 
   /* Open up all the standard Lua libraries. */
-  luaL_openlibs(script->lua_state);
+  luaL_openlibs(st->lua_state);
 
 /* Load the 'collectd' library */
 #if LUA_VERSION_NUM < 502
-  lua_pushcfunction(script->lua_state, open_collectd);
-  lua_pushstring(script->lua_state, "collectd");
-  lua_call(script->lua_state, 1, 0);
+  lua_pushcfunction(st->lua_state, open_collectd);
+  lua_pushstring(st->lua_state, "collectd");
+  lua_call(st->lua_state, 1, 0);
 #else
-  luaL_requiref(script->lua_state, "collectd", open_collectd, 1);
-  lua_pop(script->lua_state, 1);
+  luaL_requiref(st->lua_state, "collectd", open_collectd, 1);
+  lua_pop(st->lua_state, 1);
 #endif
 
   /* Prepend BasePath to package.path */
   if (base_path[0] != '\0') {
-    lua_getglobal(script->lua_state, "package");
-    lua_getfield(script->lua_state, -1, "path");
+    lua_getglobal(st->lua_state, "package");
+    lua_getfield(st->lua_state, -1, "path");
 
-    const char *cur_path = lua_tostring(script->lua_state, -1);
+    const char *cur_path = lua_tostring(st->lua_state, -1);
     char *new_path = ssnprintf_alloc("%s/?.lua;%s", base_path, cur_path);
 
-    lua_pop(script->lua_state, 1);
-    lua_pushstring(script->lua_state, new_path);
+    lua_pop(st->lua_state, 1);
+    lua_pushstring(st->lua_state, new_path);
 
     free(new_path);
 
-    lua_setfield(script->lua_state, -2, "path");
-    lua_pop(script->lua_state, 1);
+    lua_setfield(st->lua_state, -2, "path");
+    lua_pop(st->lua_state, 1);
   }
 
   return 0;
-} /* }}} int lua_script_init */
+} /* }}} int clua_state_init */
 
-static int lua_script_load(const char *script_path) /* {{{ */
+/* Creates the state with the given index and executes the script in it. */
+static int clua_state_load(lua_script_t *script, size_t index) /* {{{ */
 {
-  lua_script_t *script = malloc(sizeof(*script));
-  if (script == NULL) {
-    ERROR("Lua plugin: malloc failed.");
-    return -1;
-  }
+  clua_state_t *st = script->states + index;
 
-  int status = lua_script_init(script);
-  if (status != 0) {
-    lua_script_free(script);
-    return status;
-  }
+  st->script = script;
+  st->index = index;
 
-  script->script_path = strdup(script_path);
-  if (script->script_path == NULL) {
-    ERROR("Lua plugin: strdup failed.");
-    lua_script_free(script);
-    return -1;
-  }
+  int status = clua_state_init(st);
+  if (status != 0)
+    return status;
 
-  status = luaL_loadfile(script->lua_state, script->script_path);
+  status = luaL_loadfile(st->lua_state, script->script_path);
   if (status != 0) {
     ERROR("Lua plugin: luaL_loadfile failed: %s",
-          lua_tostring(script->lua_state, -1));
-    lua_pop(script->lua_state, 1);
-    lua_script_free(script);
+          lua_tostring(st->lua_state, -1));
+    lua_pop(st->lua_state, 1);
+    clua_state_destroy(st);
     return -1;
   }
 
-  status = lua_pcall(script->lua_state,
+  status = lua_pcall(st->lua_state,
                      /* nargs = */ 0,
                      /* nresults = */ LUA_MULTRET,
                      /* errfunc = */ 0);
   if (status != 0) {
-    const char *errmsg = lua_tostring(script->lua_state, -1);
+    const char *errmsg = lua_tostring(st->lua_state, -1);
 
     if (errmsg == NULL)
       ERROR("Lua plugin: lua_pcall failed with status %i. "
@@ -477,10 +666,60 @@ static int lua_script_load(const char *script_path) /* {{{ */
       ERROR("Lua plugin: Executing script \"%s\" failed:\n%s",
             script->script_path, errmsg);
 
+    clua_state_destroy(st);
+    return -1;
+  }
+
+  if ((index > 0) && (st->callbacks_num != script->callbacks_num)) {
+    ERROR("Lua plugin: Script \"%s\" registered %" PRIsz " callbacks in "
+          "Lua state %" PRIsz ", but %" PRIsz " in the first one.",
+          script->script_path, st->callbacks_num, index,
+          script->callbacks_num);
+    clua_state_destroy(st);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int clua_state_load */
+
+static int lua_script_load(const char *script_path) /* {{{ */
+{
+  lua_script_t *script = calloc(1, sizeof(*script));
+  if (script == NULL) {
+    ERROR("Lua plugin: calloc failed.");
+    return -1;
+  }
+
+  script->states_size = states_per_script;
+  script->states = calloc(script->states_size, sizeof(*script->states));
+  script->script_path = strdup(script_path);
+  if ((script->states == NULL) || (script->script_path == NULL)) {
+    ERROR("Lua plugin: calloc failed.");
     lua_script_free(script);
     return -1;
   }
 
+  int status = clua_state_load(script, 0);
+  if (status != 0) {
+    lua_script_free(script);
+    return status;
+  }
+  script->states_num = 1;
+
+  /* The other states run the same script independently. If one of them
+   * fails, the script keeps running with the states loaded so far, because
+   * the first state's callbacks have already been registered. */
+  for (size_t i = 1; i < script->states_size; i++) {
+    if (clua_state_load(script, i) != 0) {
+      WARNING("Lua plugin: Only %" PRIsz " of %" PRIsz " Lua states could "
+              "be created for script \"%s\".",
+              script->states_num, script->states_size, script->script_path);
+      break;
+    }
+    script->states_num++;
+  }
+  script->loaded = true;
+
   /* Append this script to the global list of scripts. */
   if (scripts) {
     lua_script_t *last = scripts;
@@ -538,9 +777,27 @@ static int lua_config_script(const oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int lua_config_script */
 
+static int lua_config_state_pool(const oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+
+  int status = cf_util_get_int(ci, &tmp);
+  if (status != 0)
+    return status;
+
+  if (tmp < 1) {
+    ERROR("Lua plugin: The `StatePool' option requires a positive integer.");
+    return -1;
+  }
+
+  states_per_script = (size_t)tmp;
+  return 0;
+} /* }}} int lua_config_state_pool */
+
 /*
  * <Plugin lua>
  *   BasePath "/"
+ *   StatePool 4
  *   Script "script1.lua"
  *   Script "script2.lua"
  * </Plugin>
@@ -553,6 +810,8 @@ static int lua_config(oconfig_item_t *ci) /* {{{ */
 
     if (strcasecmp("BasePath", child->key) == 0) {
       status = lua_config_base_path(child);
+    } else if (strcasecmp("StatePool", child->key) == 0) {
+      status = lua_config_state_pool(child);
     } else if (strcasecmp("Script", child->key) == 0) {
       status = lua_config_script(child);
     } else {
@@ -572,6 +831,8 @@ static int lua_shutdown(void) /* {{{ */
 } /* }}} int lua_shutdown */
 
 void module_register(void) {
+  pthread_key_create(&clua_slot_key, /* destructor = */ NULL);
+
   plugin_register_complex_config("lua", lua_config);
   plugin_register_shutdown("lua", lua_shutdown);
 }
@@ -158,11 +158,17 @@ static int mh_match(const data_set_t __attribute__((unused)) * ds, /* {{{ */
   return FC_MATCH_NO_MATCH;
 } /* }}} int mh_match */
 
+/* The hash only depends on the host name. */
+static bool mh_identifier_only(void __attribute__((unused)) * *user_data) {
+  return true;
+} /* bool mh_identifier_only */
+
 void module_register(void) {
   match_proc_t mproc = {0};
 
   mproc.create = mh_create;
   mproc.destroy = mh_destroy;
   mproc.match = mh_match;
+  mproc.identifier_only = mh_identifier_only;
   fc_register_match("hashed", mproc);
 } /* module_register */
@@ -36,6 +36,7 @@
 #include "common.h"
 #include "filter_chain.h"
 #include "meta_data.h"
+#include "utils_atomic.h"
 #include "utils_llist.h"
 
 #include <regex.h>
@@ -48,15 +49,88 @@
  * private data types
  */
 
+/* Identifier fields whose regular expressions can be shared by all matches
+ * using the "Combined" engine. */
+#define MR_FIELD_HOST 0
+#define MR_FIELD_PLUGIN 1
+#define MR_FIELD_PLUGIN_INSTANCE 2
+#define MR_FIELD_TYPE 3
+#define MR_FIELD_TYPE_INSTANCE 4
+#define MR_FIELDS_NUM 5
+#define MR_FIELD_NONE -1
+
 struct mr_regex_s;
 typedef struct mr_regex_s mr_regex_t;
 struct mr_regex_s {
   regex_t re;
   char *re_str;
 
+  /* Index of the pattern in `mr_fields[field]', or -1 if the regex is
+   * evaluated on its own. */
+  int field;
+  ssize_t id;
+
   mr_regex_t *next;
 };
 
+/* With the "Combined" engine, each distinct regular expression is compiled
+ * once per field and shared by all matches. All patterns of a field are also
+ * compiled into one alternation, "(re0)|(re1)|...", which tells with a single
+ * regexec() call if any of them matches. Since most values don't match most
+ * rules, this usually settles all patterns of a field at once. */
+struct mr_pattern_s;
+typedef struct mr_pattern_s mr_pattern_t;
+struct mr_pattern_s {
+  char *re_str;
+  regex_t re;
+};
+
+struct mr_combined_s;
+typedef struct mr_combined_s mr_combined_t;
+struct mr_combined_s {
+  regex_t re;
+  size_t patterns_num; /* patterns [0, patterns_num) are covered */
+};
+
+struct mr_field_s;
+typedef struct mr_field_s mr_field_t;
+struct mr_field_s {
+  mr_pattern_t *patterns;
+  size_t patterns_num;
+  size_t patterns_size;
+  /* Built when the field is first matched; NULL if there is nothing to
+   * combine or the alternation can't be compiled. */
+  mr_combined_t *combined;
+  int combined_done;
+};
+
+/* Per-thread results for the field values of the value list being processed,
+ * so each shared pattern is evaluated at most once per value list. */
+#define MR_STATE_UNKNOWN 0
+#define MR_STATE_MATCH 1
+#define MR_STATE_NO_MATCH 2
+
+struct mr_memo_field_s;
+typedef struct mr_memo_field_s mr_memo_field_t;
+struct mr_memo_field_s {
+  char value[DATA_MAX_NAME_LEN];
+  bool valid;
+  bool combined_done;
+  uint8_t *state; /* MR_STATE_* by pattern id */
+  size_t state_size;
+};
+
+struct mr_memo_s;
+typedef struct mr_memo_s mr_memo_t;
+struct mr_memo_s {
+  mr_memo_field_t fields[MR_FIELDS_NUM];
+};
+
+static mr_field_t mr_fields[MR_FIELDS_NUM];
+static pthread_mutex_t mr_fields_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t mr_memo_key;
+static pthread_once_t mr_memo_key_once = PTHREAD_ONCE_INIT;
+
 struct mr_match_s;
 typedef struct mr_match_s mr_match_t;
 struct mr_match_s {
@@ -67,6 +141,7 @@ struct mr_match_s {
   mr_regex_t *type_instance;
   llist_t *meta; /* Maps each meta key into mr_regex_t* */
   bool invert;
+  bool combined; /* Engine "Combined" */
 };
 
 /*
@@ -104,6 +179,189 @@ static void mr_free_match(mr_match_t *m) /* {{{ */
   sfree(m);
 } /* }}} void mr_free_match */
 
+static void mr_memo_free(void *arg) /* {{{ */
+{
+  mr_memo_t *memo = arg;
+
+  for (size_t i = 0; i < MR_FIELDS_NUM; i++)
+    sfree(memo->fields[i].state);
+  sfree(memo);
+} /* }}} void mr_memo_free */
+
+static void mr_memo_key_create(void) /* {{{ */
+{
+  pthread_key_create(&mr_memo_key, mr_memo_free);
+} /* }}} void mr_memo_key_create */
+
+/* Registers `re_str' as a shared pattern of `field' and returns its id, or -1
+ * on failure. Identical expressions share an id. */
+static ssize_t mr_pattern_register(int field, const char *re_str) /* {{{ */
+{
+  mr_field_t *f = mr_fields + field;
+  ssize_t id = -1;
+
+  pthread_mutex_lock(&mr_fields_lock);
+  for (size_t i = 0; i < f->patterns_num; i++) {
+    if (strcmp(f->patterns[i].re_str, re_str) == 0) {
+      pthread_mutex_unlock(&mr_fields_lock);
+      return (ssize_t)i;
+    }
+  }
+
+  /* `patterns' is only resized before the combined regex has been built,
+   * i.e. before matches are evaluated. Later patterns are not shared. */
+  if (f->combined_done)
+    goto out;
+
+  if (f->patterns_num >= f->patterns_size) {
+    size_t new_size = (f->patterns_size == 0) ? 16 : 2 * f->patterns_size;
+    mr_pattern_t *tmp = realloc(f->patterns, new_size * sizeof(*tmp));
+    if (tmp == NULL) {
+      log_err("mr_pattern_register: realloc failed.");
+      goto out;
+    }
+    f->patterns = tmp;
+    f->patterns_size = new_size;
+  }
+
+  mr_pattern_t *p = f->patterns + f->patterns_num;
+  p->re_str = strdup(re_str);
+  if (p->re_str == NULL)
+    goto out;
+  if (regcomp(&p->re, re_str, REG_EXTENDED | REG_NOSUB) != 0) {
+    sfree(p->re_str);
+    goto out;
+  }
+
+  id = (ssize_t)f->patterns_num;
+  f->patterns_num++;
+
+out:
+  pthread_mutex_unlock(&mr_fields_lock);
+  return id;
+} /* }}} ssize_t mr_pattern_register */
+
+/* Builds the alternation of all patterns of `f'. Back-references would refer
+ * to the wrong groups, so fields using them aren't combined. Must be called
+ * with `mr_fields_lock' held. */
+static mr_combined_t *mr_combined_build(mr_field_t const *f) /* {{{ */
+{
+  if (f->patterns_num < 2)
+    return NULL;
+
+  size_t len = 1;
+  for (size_t i = 0; i < f->patterns_num; i++) {
+    char const *re_str = f->patterns[i].re_str;
+    for (char const *c = re_str; *c != 0; c++)
+      if ((c[0] == '\\') && isdigit((unsigned char)c[1]))
+        return NULL;
+    len += strlen(re_str) + 3; /* "|(" ... ")" */
+  }
+
+  char *buffer = malloc(len);
+  mr_combined_t *combined = calloc(1, sizeof(*combined));
+  if ((buffer == NULL) || (combined == NULL)) {
+    sfree(buffer);
+    sfree(combined);
+    return NULL;
+  }
+
+  char *ptr = buffer;
+  for (size_t i = 0; i < f->patterns_num; i++)
+    ptr += sprintf(ptr, "%s(%s)", (i == 0) ? "" : "|", f->patterns[i].re_str);
+
+  int status = regcomp(&combined->re, buffer, REG_EXTENDED | REG_NOSUB);
+  sfree(buffer);
+  if (status != 0) {
+    log_warn("Combining %" PRIsz " regular expressions failed. They will be "
+             "evaluated one by one.",
+             f->patterns_num);
+    sfree(combined);
+    return NULL;
+  }
+
+  combined->patterns_num = f->patterns_num;
+  return combined;
+} /* }}} mr_combined_t *mr_combined_build */
+
+static mr_combined_t *mr_combined_get(mr_field_t *f) /* {{{ */
+{
+  if (C_ATOMIC_LOAD_ACQ(&f->combined_done))
+    return f->combined;
+
+  pthread_mutex_lock(&mr_fields_lock);
+  if (!f->combined_done) {
+    f->combined = mr_combined_build(f);
+    C_ATOMIC_STORE_REL(&f->combined_done, 1);
+  }
+  pthread_mutex_unlock(&mr_fields_lock);
+
+  return f->combined;
+} /* }}} mr_combined_t *mr_combined_get */
+
+static mr_memo_field_t *mr_memo_get(int field, const char *string) /* {{{ */
+{
+  pthread_once(&mr_memo_key_once, mr_memo_key_create);
+
+  mr_memo_t *memo = pthread_getspecific(mr_memo_key);
+  if (memo == NULL) {
+    memo = calloc(1, sizeof(*memo));
+    if (memo == NULL)
+      return NULL;
+    pthread_setspecific(mr_memo_key, memo);
+  }
+
+  mr_memo_field_t *mf = memo->fields + field;
+  size_t patterns_num = mr_fields[field].patterns_num;
+  if (mf->state_size < patterns_num) {
+    uint8_t *tmp = realloc(mf->state, patterns_num);
+    if (tmp == NULL)
+      return NULL;
+    mf->state = tmp;
+    mf->state_size = patterns_num;
+    mf->valid = false;
+  }
+
+  if (!mf->valid || (strcmp(mf->value, string) != 0)) {
+    sstrncpy(mf->value, string, sizeof(mf->value));
+    /* Longer values can't be remembered. */
+    mf->valid = (strlen(string) < sizeof(mf->value));
+    mf->combined_done = false;
+    memset(mf->state, MR_STATE_UNKNOWN, mf->state_size);
+  }
+
+  return mf;
+} /* }}} mr_memo_field_t *mr_memo_get */
+
+/* Returns zero if the shared pattern `re' matches `string', like regexec(). */
+static int mr_pattern_exec(mr_regex_t const *re, const char *string) /* {{{ */
+{
+  mr_field_t *f = mr_fields + re->field;
+  mr_combined_t *combined = mr_combined_get(f);
+  mr_memo_field_t *mf = mr_memo_get(re->field, string);
+
+  if ((mf == NULL) || !mf->valid)
+    return regexec(&f->patterns[re->id].re, string, /* nmatch = */ 0,
+                   /* pmatch = */ NULL, /* eflags = */ 0);
+
+  if ((mf->state[re->id] == MR_STATE_UNKNOWN) && (combined != NULL) &&
+      ((size_t)re->id < combined->patterns_num) && !mf->combined_done) {
+    mf->combined_done = true;
+    if (regexec(&combined->re, string, /* nmatch = */ 0,
+                /* pmatch = */ NULL, /* eflags = */ 0) != 0)
+      memset(mf->state, MR_STATE_NO_MATCH, combined->patterns_num);
+  }
+
+  if (mf->state[re->id] == MR_STATE_UNKNOWN) {
+    int status = regexec(&f->patterns[re->id].re, string,
+                         /* nmatch = */ 0, /* pmatch = */ NULL,
+                         /* eflags = */ 0);
+    mf->state[re->id] = (status == 0) ? MR_STATE_MATCH : MR_STATE_NO_MATCH;
+  }
+
+  return (mf->state[re->id] == MR_STATE_MATCH) ? 0 : REG_NOMATCH;
+} /* }}} int mr_pattern_exec */
+
 static int mr_match_regexen(mr_regex_t *re_head, /* {{{ */
                             const char *string) {
   if (re_head == NULL)
@@ -112,9 +370,12 @@ static int mr_match_regexen(mr_regex_t *re_head, /* {{{ */
   for (mr_regex_t *re = re_head; re != NULL; re = re->next) {
     int status;
 
-    status = regexec(&re->re, string,
-                     /* nmatch = */ 0, /* pmatch = */ NULL,
-                     /* eflags = */ 0);
+    if (re->id >= 0)
+      status = mr_pattern_exec(re, string);
+    else
+      status = regexec(&re->re, string,
+                       /* nmatch = */ 0, /* pmatch = */ NULL,
+                       /* eflags = */ 0);
     if (status == 0) {
       DEBUG("regex match: Regular expression `%s' matches `%s'.", re->re_str,
             string);
@@ -129,7 +390,7 @@ static int mr_match_regexen(mr_regex_t *re_head, /* {{{ */
 } /* }}} int mr_match_regexen */
 
 static int mr_add_regex(mr_regex_t **re_head, const char *re_str, /* {{{ */
-                        const char *option) {
+                        const char *option, int field) {
   mr_regex_t *re;
   int status;
 
@@ -159,6 +420,9 @@ static int mr_add_regex(mr_regex_t **re_head, const char *re_str, /* {{{ */
     return -1;
   }
 
+  re->field = field;
+  re->id = (field != MR_FIELD_NONE) ? mr_pattern_register(field, re_str) : -1;
+
   if (*re_head == NULL) {
     *re_head = re;
   } else {
@@ -175,13 +439,13 @@ static int mr_add_regex(mr_regex_t **re_head, const char *re_str, /* {{{ */
 } /* }}} int mr_add_regex */
 
 static int mr_config_add_regex(mr_regex_t **re_head, /* {{{ */
-                               oconfig_item_t *ci) {
+                               oconfig_item_t *ci, int field) {
   if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING)) {
     log_warn("`%s' needs exactly one string argument.", ci->key);
     return -1;
   }
 
-  return mr_add_regex(re_head, ci->values[0].value.string, ci->key);
+  return mr_add_regex(re_head, ci->values[0].value.string, ci->key, field);
 } /* }}} int mr_config_add_regex */
 
 static int mr_config_add_meta_regex(llist_t **meta, /* {{{ */
@@ -227,7 +491,8 @@ static int mr_config_add_meta_regex(llist_t **meta, /* {{{ */
   snprintf(buffer, sizeof(buffer), "%s `%s'", ci->key, meta_key);
   /* Can't pass &entry->value into mr_add_regex, so copy in/out. */
   re_head = entry->value;
-  status = mr_add_regex(&re_head, ci->values[1].value.string, buffer);
+  status = mr_add_regex(&re_head, ci->values[1].value.string, buffer,
+                        MR_FIELD_NONE);
   if (status == 0) {
     entry->value = re_head;
   }
@@ -247,34 +512,65 @@ static int mr_create(const oconfig_item_t *ci, void **user_data) /* {{{ */
 
   m->invert = false;
 
+  /* The engine has to be known before the regular expressions are added. */
   status = 0;
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
+    char *engine = NULL;
+
+    if (strcasecmp("Engine", child->key) != 0)
+      continue;
+
+    status = cf_util_get_string(child, &engine);
+    if (status != 0)
+      break;
+
+    if (strcasecmp("Combined", engine) == 0)
+      m->combined = true;
+    else if (strcasecmp("Individual", engine) == 0)
+      m->combined = false;
+    else {
+      log_err("Unknown engine `%s'. Valid engines are `Individual' and "
+              "`Combined'.",
+              engine);
+      status = -1;
+    }
+    sfree(engine);
+  }
+
+  for (int i = 0; (status == 0) && (i < ci->children_num); i++) {
+    oconfig_item_t *child = ci->children + i;
 
     if ((strcasecmp("Host", child->key) == 0) ||
         (strcasecmp("Hostname", child->key) == 0))
-      status = mr_config_add_regex(&m->host, child);
+      status = mr_config_add_regex(&m->host, child,
+                                   m->combined ? MR_FIELD_HOST : MR_FIELD_NONE);
     else if (strcasecmp("Plugin", child->key) == 0)
-      status = mr_config_add_regex(&m->plugin, child);
+      status = mr_config_add_regex(
+          &m->plugin, child, m->combined ? MR_FIELD_PLUGIN : MR_FIELD_NONE);
     else if (strcasecmp("PluginInstance", child->key) == 0)
-      status = mr_config_add_regex(&m->plugin_instance, child);
+      status = mr_config_add_regex(&m->plugin_instance, child,
+                                   m->combined ? MR_FIELD_PLUGIN_INSTANCE
+                                               : MR_FIELD_NONE);
     else if (strcasecmp("Type", child->key) == 0)
-      status = mr_config_add_regex(&m->type, child);
+      status = mr_config_add_regex(&m->type, child,
+                                   m->combined ? MR_FIELD_TYPE : MR_FIELD_NONE);
     else if (strcasecmp("TypeInstance", child->key) == 0)
-      status = mr_config_add_regex(&m->type_instance, child);
+      status = mr_config_add_regex(
+          &m->type_instance, child,
+          m->combined ? MR_FIELD_TYPE_INSTANCE : MR_FIELD_NONE);
     else if (strcasecmp("MetaData", child->key) == 0)
       status = mr_config_add_meta_regex(&m->meta, child);
     else if (strcasecmp("Invert", child->key) == 0)
       status = cf_util_get_boolean(child, &m->invert);
+    else if (strcasecmp("Engine", child->key) == 0)
+      continue;
     else {
       log_err("The `%s' configuration option is not understood and "
               "will be ignored.",
               child->key);
       status = 0;
     }
-
-    if (status != 0)
-      break;
   }
 
   /* Additional sanity-checking */
@@ -356,11 +652,42 @@ static int mr_match(const data_set_t __attribute__((unused)) * ds, /* {{{ */
   return match_value;
 } /* }}} int mr_match */
 
+/* Matches on meta data can't be cached by identifier. */
+static bool mr_identifier_only(void **user_data) /* {{{ */
+{
+  mr_match_t *m = *user_data;
+
+  return (m != NULL) && (m->meta == NULL);
+} /* }}} bool mr_identifier_only */
+
+static int mr_shutdown(void) /* {{{ */
+{
+  for (size_t i = 0; i < MR_FIELDS_NUM; i++) {
+    mr_field_t *f = mr_fields + i;
+
+    for (size_t j = 0; j < f->patterns_num; j++) {
+      regfree(&f->patterns[j].re);
+      sfree(f->patterns[j].re_str);
+    }
+    sfree(f->patterns);
+    f->patterns_num = 0;
+    f->patterns_size = 0;
+
+    if (f->combined != NULL)
+      regfree(&f->combined->re);
+    sfree(f->combined);
+  }
+
+  return 0;
+} /* }}} int mr_shutdown */
+
 void module_register(void) {
   match_proc_t mproc = {0};
 
   mproc.create = mr_create;
   mproc.destroy = mr_destroy;
   mproc.match = mr_match;
+  mproc.identifier_only = mr_identifier_only;
   fc_register_match("regex", mproc);
+  plugin_register_shutdown("match_regex", mr_shutdown);
 } /* module_register */
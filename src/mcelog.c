@@ -41,7 +41,8 @@
 
 #define MCELOG_PLUGIN "mcelog"
 #define MCELOG_BUFF_SIZE 1024
-#define MCELOG_POLL_TIMEOUT 1000 /* ms */
+#define MCELOG_RECONNECT_INTERVAL 1000 /* ms */
+#define MCELOG_RECONNECT_TIMER MCELOG_PLUGIN "/reconnect"
 #define MCELOG_SOCKET_STR "SOCKET"
 #define MCELOG_DIMM_NAME "DMI_NAME"
 #define MCELOG_CORRECTED_ERR "corrected memory errors"
@@ -53,7 +54,6 @@
 
 typedef struct mcelog_config_s {
   char logfile[PATH_MAX];     /* mcelog logfile */
-  pthread_t tid;              /* poll thread id */
   llist_t *dimms_list;        /* DIMMs list */
   pthread_mutex_t dimms_lock; /* lock for dimms cache */
   bool persist;
@@ -68,7 +68,7 @@ struct socket_adapter_s {
   /* function pointers for socket operations */
   int (*write)(socket_adapter_t *self, const char *msg, const size_t len);
   int (*reinit)(socket_adapter_t *self);
-  int (*receive)(socket_adapter_t *self, FILE **p_file);
+  int (*receive)(socket_adapter_t *self, int revents, FILE **p_file);
   int (*close)(socket_adapter_t *self);
 };
 
@@ -87,7 +87,8 @@ static int socket_close(socket_adapter_t *self);
 static int socket_write(socket_adapter_t *self, const char *msg,
                         const size_t len);
 static int socket_reinit(socket_adapter_t *self);
-static int socket_receive(socket_adapter_t *self, FILE **p_file);
+static int socket_receive(socket_adapter_t *self, int revents,
+                          FILE **p_file);
 
 static mcelog_config_t g_mcelog_config = {
     .logfile = "/var/log/mcelog", .persist = false,
@@ -106,7 +107,6 @@ static socket_adapter_t socket_adapter = {
     .receive = socket_receive,
 };
 
-static bool mcelog_thread_running;
 static bool mcelog_apply_defaults;
 
 static void mcelog_free_dimms_list_records(llist_t *dimms_list) {
@@ -511,33 +511,17 @@ static int parse_memory_info(FILE *p_file, mcelog_memory_rec_t *memory_record) {
   return 0;
 }
 
-static void poll_worker_cleanup(void *arg) {
-  mcelog_thread_running = 0;
-  FILE *p_file = *((FILE **)arg);
-  if (p_file != NULL)
-    fclose(p_file);
-  free(arg);
-}
-
-static int socket_receive(socket_adapter_t *self, FILE **pp_file) {
+/* Returns less than zero if the connection is broken, zero if there is nothing
+ * to read and greater than zero if "*pp_file" has been opened for reading. */
+static int socket_receive(socket_adapter_t *self, int revents,
+                          FILE **pp_file) {
   int res = -1;
   pthread_rwlock_rdlock(&self->lock);
-  struct pollfd poll_fd = {
-      .fd = self->sock_fd, .events = POLLIN | POLLPRI,
-  };
 
-  if ((res = poll(&poll_fd, 1, MCELOG_POLL_TIMEOUT)) <= 0) {
-    if (res != 0 && errno != EINTR) {
-      ERROR("mcelog: poll failed: %s", STRERRNO);
-    }
-    pthread_rwlock_unlock(&self->lock);
-    return res;
-  }
-
-  if (poll_fd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+  if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
     /* connection is broken */
     ERROR(MCELOG_PLUGIN ": Connection to socket is broken");
-    if (poll_fd.revents & (POLLERR | POLLHUP)) {
+    if (revents & (POLLERR | POLLHUP)) {
       mcelog_dispatch_notification(
           &(notification_t){.severity = NOTIF_FAILURE,
                             .time = cdtime(),
@@ -549,69 +533,74 @@ static int socket_receive(socket_adapter_t *self, FILE **pp_file) {
     return -1;
   }
 
-  if (!(poll_fd.revents & (POLLIN | POLLPRI))) {
+  if (!(revents & (POLLIN | POLLPRI))) {
     INFO(MCELOG_PLUGIN ": No data to read");
     pthread_rwlock_unlock(&self->lock);
     return 0;
   }
 
-  if ((*pp_file = fdopen(dup(self->sock_fd), "r")) == NULL)
-    res = -1;
+  if ((*pp_file = fdopen(dup(self->sock_fd), "r")) != NULL)
+    res = 1;
 
   pthread_rwlock_unlock(&self->lock);
   return res;
 }
 
-static void *poll_worker(__attribute__((unused)) void *arg) {
-  mcelog_thread_running = 1;
-  FILE **pp_file = calloc(1, sizeof(*pp_file));
-  if (pp_file == NULL) {
-    ERROR("mcelog: memory allocation failed: %s", STRERRNO);
-    pthread_exit((void *)1);
-  }
+static int mcelog_socket_read(int fd, int revents, user_data_t *ud);
 
-  pthread_cleanup_push(poll_worker_cleanup, pp_file);
+/* Called by the event loop until the mcelog server accepts the connection
+ * again. */
+static int mcelog_reconnect(__attribute__((unused)) user_data_t *ud) {
+  if (socket_adapter.reinit(&socket_adapter) != 0)
+    return 0;
 
-  while (1) {
-    /* blocking call */
-    int res = socket_adapter.receive(&socket_adapter, pp_file);
-    if (res < 0) {
-      socket_adapter.close(&socket_adapter);
-      while (socket_adapter.reinit(&socket_adapter) != 0) {
-        nanosleep(&CDTIME_T_TO_TIMESPEC(MS_TO_CDTIME_T(MCELOG_POLL_TIMEOUT)),
-                  NULL);
-      }
-      continue;
-    }
-    /* timeout or no data to read */
-    else if (res == 0)
-      continue;
+  if (plugin_register_fd(MCELOG_PLUGIN, socket_adapter.sock_fd,
+                         POLLIN | POLLPRI, mcelog_socket_read, NULL) != 0) {
+    ERROR(MCELOG_PLUGIN ": Watching the client socket failed.");
+    socket_adapter.close(&socket_adapter);
+    return 0;
+  }
 
-    if (*pp_file == NULL)
-      continue;
+  plugin_unregister_timer(MCELOG_RECONNECT_TIMER);
+  return 0;
+}
 
-    mcelog_memory_rec_t memory_record = {0};
-    while (parse_memory_info(*pp_file, &memory_record)) {
-      /* Check if location was successfully parsed */
-      if (memory_record.location[0] == '\0') {
-        memset(&memory_record, 0, sizeof(memory_record));
-        continue;
-      }
+static int mcelog_socket_read(__attribute__((unused)) int fd, int revents,
+                              __attribute__((unused)) user_data_t *ud) {
+  FILE *p_file = NULL;
+  int res = socket_adapter.receive(&socket_adapter, revents, &p_file);
+  if (res < 0) {
+    /* Stop watching the socket before closing it, so that its number can't be
+     * reused in the meantime. */
+    plugin_unregister_fd(MCELOG_PLUGIN);
+    socket_adapter.close(&socket_adapter);
+    if (plugin_register_timer(MCELOG_RECONNECT_TIMER,
+                              MS_TO_CDTIME_T(MCELOG_RECONNECT_INTERVAL),
+                              mcelog_reconnect, NULL) != 0)
+      ERROR(MCELOG_PLUGIN ": Scheduling the reconnect failed.");
+    return 0;
+  }
+  /* no data to read */
+  if (res == 0)
+    return 0;
 
-      if (mcelog_dispatch_mem_notifications(&memory_record) != 0)
-        ERROR(MCELOG_PLUGIN ": Failed to submit memory errors notification");
-      if (mcelog_submit(&memory_record) != 0)
-        ERROR(MCELOG_PLUGIN ": Failed to submit memory errors");
+  mcelog_memory_rec_t memory_record = {0};
+  while (parse_memory_info(p_file, &memory_record)) {
+    /* Check if location was successfully parsed */
+    if (memory_record.location[0] == '\0') {
       memset(&memory_record, 0, sizeof(memory_record));
+      continue;
     }
 
-    fclose(*pp_file);
-    *pp_file = NULL;
+    if (mcelog_dispatch_mem_notifications(&memory_record) != 0)
+      ERROR(MCELOG_PLUGIN ": Failed to submit memory errors notification");
+    if (mcelog_submit(&memory_record) != 0)
+      ERROR(MCELOG_PLUGIN ": Failed to submit memory errors");
+    memset(&memory_record, 0, sizeof(memory_record));
   }
 
-  mcelog_thread_running = 0;
-  pthread_cleanup_pop(1);
-  return NULL;
+  fclose(p_file);
+  return 0;
 }
 
 static int mcelog_init(void) {
@@ -633,9 +622,9 @@ static int mcelog_init(void) {
   }
 
   if (strlen(socket_adapter.unix_sock.sun_path)) {
-    if (plugin_thread_create(&g_mcelog_config.tid, NULL, poll_worker, NULL,
-                             NULL) != 0) {
-      ERROR(MCELOG_PLUGIN ": Error creating poll thread.");
+    if (plugin_register_fd(MCELOG_PLUGIN, socket_adapter.sock_fd,
+                           POLLIN | POLLPRI, mcelog_socket_read, NULL) != 0) {
+      ERROR(MCELOG_PLUGIN ": Watching the client socket failed.");
       return -1;
     }
   }
@@ -663,13 +652,8 @@ static int mcelog_read(__attribute__((unused)) user_data_t *ud) {
 
 static int mcelog_shutdown(void) {
   int ret = 0;
-  if (mcelog_thread_running) {
-    pthread_cancel(g_mcelog_config.tid);
-    if (pthread_join(g_mcelog_config.tid, NULL) != 0) {
-      ERROR(MCELOG_PLUGIN ": Stopping thread failed.");
-      ret = -1;
-    }
-  }
+  plugin_unregister_fd(MCELOG_PLUGIN);
+  plugin_unregister_timer(MCELOG_RECONNECT_TIMER);
   pthread_mutex_lock(&g_mcelog_config.dimms_lock);
   mcelog_free_dimms_list_records(g_mcelog_config.dimms_list);
   llist_destroy(g_mcelog_config.dimms_list);
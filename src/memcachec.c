@@ -25,6 +25,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_match.h"
 
 #include <libmemcached/memcached.h>
@@ -57,18 +58,42 @@ struct web_page_s /* {{{ */
   char *server;
   char *key;
 
-  memcached_st *memc;
-  char *buffer;
-
   web_match_t *matches;
 
+  /* Next page with the same server and key */
+  web_page_t *next_same_key;
+  bool found;
+
   web_page_t *next;
 }; /* }}} */
 
+/* The pages of a server are fetched with a single multi-get. */
+struct cmc_server_s;
+typedef struct cmc_server_s cmc_server_t;
+struct cmc_server_s /* {{{ */
+{
+  char *server;
+  memcached_st *memc;
+  memcached_result_st *result;
+
+  /* key -> web_page_t */
+  c_avl_tree_t *pages;
+  const char **keys;
+  size_t *keys_len;
+  size_t keys_num;
+
+  /* Null terminated copy of the current value */
+  char *buffer;
+  size_t buffer_size;
+
+  cmc_server_t *next;
+}; /* }}} */
+
 /*
  * Global variables;
  */
 static web_page_t *pages_g;
+static cmc_server_t *servers_g;
 
 /*
  * Private functions
@@ -91,37 +116,126 @@ static void cmc_web_page_free(web_page_t *wp) /* {{{ */
   if (wp == NULL)
     return;
 
-  if (wp->memc != NULL)
-    memcached_free(wp->memc);
-  wp->memc = NULL;
-
   sfree(wp->plugin_name);
   sfree(wp->instance);
   sfree(wp->server);
   sfree(wp->key);
-  sfree(wp->buffer);
 
   cmc_web_match_free(wp->matches);
   cmc_web_page_free(wp->next);
   sfree(wp);
 } /* }}} void cmc_web_page_free */
 
-static int cmc_page_init_memc(web_page_t *wp) /* {{{ */
+static void cmc_server_free(cmc_server_t *srv) /* {{{ */
+{
+  if (srv == NULL)
+    return;
+
+  if (srv->result != NULL)
+    memcached_result_free(srv->result);
+  if (srv->memc != NULL)
+    memcached_free(srv->memc);
+
+  /* The keys and pages are owned by pages_g. */
+  if (srv->pages != NULL)
+    c_avl_destroy(srv->pages);
+  sfree(srv->keys);
+  sfree(srv->keys_len);
+
+  sfree(srv->server);
+  sfree(srv->buffer);
+
+  cmc_server_free(srv->next);
+  sfree(srv);
+} /* }}} void cmc_server_free */
+
+static cmc_server_t *cmc_server_get(char const *server) /* {{{ */
 {
-  memcached_server_st *server;
+  cmc_server_t *srv;
+  memcached_server_st *list;
 
-  wp->memc = memcached_create(NULL);
-  if (wp->memc == NULL) {
+  for (srv = servers_g; srv != NULL; srv = srv->next)
+    if (strcmp(server, srv->server) == 0)
+      return srv;
+
+  srv = calloc(1, sizeof(*srv));
+  if (srv == NULL) {
+    ERROR("memcachec plugin: calloc failed.");
+    return NULL;
+  }
+
+  srv->server = strdup(server);
+  srv->pages = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if ((srv->server == NULL) || (srv->pages == NULL)) {
+    ERROR("memcachec plugin: strdup or c_avl_create failed.");
+    cmc_server_free(srv);
+    return NULL;
+  }
+
+  srv->memc = memcached_create(NULL);
+  if (srv->memc == NULL) {
     ERROR("memcachec plugin: memcached_create failed.");
+    cmc_server_free(srv);
+    return NULL;
+  }
+
+  list = memcached_servers_parse(srv->server);
+  memcached_server_push(srv->memc, list);
+  memcached_server_list_free(list);
+
+  srv->result = memcached_result_create(srv->memc, NULL);
+  if (srv->result == NULL) {
+    ERROR("memcachec plugin: memcached_result_create failed.");
+    cmc_server_free(srv);
+    return NULL;
+  }
+
+  srv->next = servers_g;
+  servers_g = srv;
+  return srv;
+} /* }}} cmc_server_t *cmc_server_get */
+
+static int cmc_server_add_page(web_page_t *wp) /* {{{ */
+{
+  cmc_server_t *srv = cmc_server_get(wp->server);
+  if (srv == NULL)
+    return -1;
+
+  /* Pages with the same key share the fetched value. */
+  web_page_t *prev = NULL;
+  if (c_avl_get(srv->pages, wp->key, (void *)&prev) == 0) {
+    while (prev->next_same_key != NULL)
+      prev = prev->next_same_key;
+    prev->next_same_key = wp;
+    return 0;
+  }
+
+  const char **keys =
+      realloc(srv->keys, (srv->keys_num + 1) * sizeof(*srv->keys));
+  if (keys == NULL) {
+    ERROR("memcachec plugin: realloc failed.");
     return -1;
   }
+  srv->keys = keys;
 
-  server = memcached_servers_parse(wp->server);
-  memcached_server_push(wp->memc, server);
-  memcached_server_list_free(server);
+  size_t *keys_len =
+      realloc(srv->keys_len, (srv->keys_num + 1) * sizeof(*srv->keys_len));
+  if (keys_len == NULL) {
+    ERROR("memcachec plugin: realloc failed.");
+    return -1;
+  }
+  srv->keys_len = keys_len;
 
+  if (c_avl_insert(srv->pages, wp->key, wp) != 0) {
+    ERROR("memcachec plugin: c_avl_insert failed.");
+    return -1;
+  }
+
+  srv->keys[srv->keys_num] = wp->key;
+  srv->keys_len[srv->keys_num] = strlen(wp->key);
+  srv->keys_num++;
   return 0;
-} /* }}} int cmc_page_init_memc */
+} /* }}} int cmc_server_add_page */
 
 static int cmc_config_add_match_dstype(int *dstype_ret, /* {{{ */
                                        oconfig_item_t *ci) {
@@ -322,9 +436,6 @@ static int cmc_config_add_page(oconfig_item_t *ci) /* {{{ */
       status = -1;
     }
 
-    if (status == 0)
-      status = cmc_page_init_memc(page);
-
     break;
   } /* while (status == 0) */
 
@@ -386,6 +497,11 @@ static int cmc_init(void) /* {{{ */
     INFO("memcachec plugin: No pages have been defined.");
     return -1;
   }
+
+  for (web_page_t *wp = pages_g; wp != NULL; wp = wp->next)
+    if (cmc_server_add_page(wp) != 0)
+      return -1;
+
   return 0;
 } /* }}} int cmc_init */
 
@@ -404,28 +520,14 @@ static void cmc_submit(const web_page_t *wp, const web_match_t *wm, /* {{{ */
   plugin_dispatch_values(&vl);
 } /* }}} void cmc_submit */
 
-static int cmc_read_page(web_page_t *wp) /* {{{ */
+static void cmc_read_page(web_page_t *wp, char const *buffer) /* {{{ */
 {
-  memcached_return rc;
-  size_t string_length;
-  uint32_t flags;
   int status;
 
-  if (wp->memc == NULL)
-    return -1;
-
-  wp->buffer = memcached_get(wp->memc, wp->key, strlen(wp->key), &string_length,
-                             &flags, &rc);
-  if (rc != MEMCACHED_SUCCESS) {
-    ERROR("memcachec plugin: memcached_get failed: %s",
-          memcached_strerror(wp->memc, rc));
-    return -1;
-  }
-
   for (web_match_t *wm = wp->matches; wm != NULL; wm = wm->next) {
     cu_match_value_t *mv;
 
-    status = match_apply(wm->match, wp->buffer);
+    status = match_apply(wm->match, buffer);
     if (status != 0) {
       WARNING("memcachec plugin: match_apply failed.");
       continue;
@@ -440,22 +542,102 @@ static int cmc_read_page(web_page_t *wp) /* {{{ */
     cmc_submit(wp, wm, mv->value);
     match_value_reset(mv);
   } /* for (wm = wp->matches; wm != NULL; wm = wm->next) */
+} /* }}} void cmc_read_page */
+
+/* Copies the value of a result into the server's buffer, null terminated. */
+static char const *cmc_result_value(cmc_server_t *srv, /* {{{ */
+                                    memcached_result_st *result) {
+  size_t len = memcached_result_length(result);
+
+  if (srv->buffer_size < len + 1) {
+    char *tmp = realloc(srv->buffer, len + 1);
+    if (tmp == NULL) {
+      ERROR("memcachec plugin: realloc failed.");
+      return NULL;
+    }
+    srv->buffer = tmp;
+    srv->buffer_size = len + 1;
+  }
+
+  memcpy(srv->buffer, memcached_result_value(result), len);
+  srv->buffer[len] = 0;
+  return srv->buffer;
+} /* }}} char const *cmc_result_value */
+
+static int cmc_read_server(cmc_server_t *srv) /* {{{ */
+{
+  memcached_return rc;
+  memcached_result_st *result;
 
-  sfree(wp->buffer);
+  for (size_t i = 0; i < srv->keys_num; i++) {
+    web_page_t *wp = NULL;
+    c_avl_get(srv->pages, srv->keys[i], (void *)&wp);
+    for (; wp != NULL; wp = wp->next_same_key)
+      wp->found = false;
+  }
+
+  rc = memcached_mget(srv->memc, srv->keys, srv->keys_len, srv->keys_num);
+  if (rc != MEMCACHED_SUCCESS) {
+    ERROR("memcachec plugin: memcached_mget (%s) failed: %s", srv->server,
+          memcached_strerror(srv->memc, rc));
+    return -1;
+  }
+
+  while ((result = memcached_fetch_result(srv->memc, srv->result, &rc)) !=
+         NULL) {
+    char key[MEMCACHED_MAX_KEY];
+    size_t key_len = memcached_result_key_length(result);
+    web_page_t *wp = NULL;
+
+    if (key_len >= sizeof(key))
+      continue;
+    memcpy(key, memcached_result_key_value(result), key_len);
+    key[key_len] = 0;
+
+    if (c_avl_get(srv->pages, key, (void *)&wp) != 0)
+      continue;
+
+    char const *buffer = cmc_result_value(srv, result);
+    if (buffer == NULL)
+      continue;
+
+    for (; wp != NULL; wp = wp->next_same_key) {
+      wp->found = true;
+      cmc_read_page(wp, buffer);
+    }
+  }
+
+  if ((rc != MEMCACHED_END) && (rc != MEMCACHED_SUCCESS)) {
+    ERROR("memcachec plugin: memcached_fetch_result (%s) failed: %s",
+          srv->server, memcached_strerror(srv->memc, rc));
+    return -1;
+  }
+
+  for (size_t i = 0; i < srv->keys_num; i++) {
+    web_page_t *wp = NULL;
+
+    if ((c_avl_get(srv->pages, srv->keys[i], (void *)&wp) == 0) &&
+        !wp->found)
+      ERROR("memcachec plugin: Key \"%s\" not found on %s.", srv->keys[i],
+            srv->server);
+  }
 
   return 0;
-} /* }}} int cmc_read_page */
+} /* }}} int cmc_read_server */
 
 static int cmc_read(void) /* {{{ */
 {
-  for (web_page_t *wp = pages_g; wp != NULL; wp = wp->next)
-    cmc_read_page(wp);
+  for (cmc_server_t *srv = servers_g; srv != NULL; srv = srv->next)
+    cmc_read_server(srv);
 
   return 0;
 } /* }}} int cmc_read */
 
 static int cmc_shutdown(void) /* {{{ */
 {
+  cmc_server_free(servers_g);
+  servers_g = NULL;
+
   cmc_web_page_free(pages_g);
   pages_g = NULL;
 
@@ -34,6 +34,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_conn_pool.h"
 
 #include <netdb.h>
 #include <netinet/in.h>
@@ -46,6 +47,7 @@
 #define MEMCACHED_DEF_PORT "11211"
 #define MEMCACHED_CONNECT_TIMEOUT 10000
 #define MEMCACHED_IO_TIMEOUT 5000
+#define MEMCACHED_CHECK_INTERVAL TIME_T_TO_CDTIME_T(30)
 
 struct prev_s {
   derive_t hits;
@@ -64,7 +66,7 @@ struct memcached_s {
   char *socket;
   char *connhost;
   char *connport;
-  int fd;
+  conn_pool_t *pool;
   prev_t prev;
 };
 typedef struct memcached_s memcached_t;
@@ -76,11 +78,7 @@ static void memcached_free(void *arg) {
   if (st == NULL)
     return;
 
-  if (st->fd >= 0) {
-    shutdown(st->fd, SHUT_RDWR);
-    close(st->fd);
-    st->fd = -1;
-  }
+  conn_pool_destroy(st->pool);
 
   sfree(st->name);
   sfree(st->host);
@@ -199,34 +197,69 @@ static int memcached_connect_inet(memcached_t *st) {
   return fd;
 } /* int memcached_connect_inet */
 
-static void memcached_connect(memcached_t *st) {
-  if (st->fd >= 0)
-    return;
+/* Connections of the pool are file descriptors in a malloc'ed int. */
+static void *memcached_pool_connect(void *arg) {
+  memcached_t *st = arg;
 
+  int fd;
   if (st->socket != NULL)
-    st->fd = memcached_connect_unix(st);
+    fd = memcached_connect_unix(st);
   else
-    st->fd = memcached_connect_inet(st);
+    fd = memcached_connect_inet(st);
 
-  if (st->fd >= 0)
-    INFO("memcached plugin: Instance \"%s\": connection established.",
-         st->name);
-}
+  if (fd < 0) {
+    ERROR("memcached plugin: Instance \"%s\" could not connect to daemon.",
+          st->name);
+    return NULL;
+  }
+
+  int *conn = malloc(sizeof(*conn));
+  if (conn == NULL) {
+    close(fd);
+    return NULL;
+  }
+  *conn = fd;
+
+  INFO("memcached plugin: Instance \"%s\": connection established.",
+       st->name);
+  return conn;
+} /* void *memcached_pool_connect */
+
+/* memcached never sends anything unsolicited, so an idle connection that is
+ * readable has been closed by the peer. */
+static int memcached_pool_check(void *conn, __attribute__((unused)) void *arg) {
+  struct pollfd pollfd = {
+      .fd = *((int *)conn), .events = POLLIN,
+  };
+
+  if (poll(&pollfd, 1, /* timeout = */ 0) != 0)
+    return -1;
+  return 0;
+} /* int memcached_pool_check */
+
+static void memcached_pool_close(void *conn,
+                                 __attribute__((unused)) void *arg) {
+  int fd = *((int *)conn);
+
+  shutdown(fd, SHUT_RDWR);
+  close(fd);
+  free(conn);
+} /* void memcached_pool_close */
+
+static conn_pool_ops_t const memcached_pool_ops = {
+    .connect = memcached_pool_connect,
+    .check = memcached_pool_check,
+    .close = memcached_pool_close,
+};
 
+/* Sets "broken" if "fd" must not be used again. */
 static int memcached_query_daemon(char *buffer, size_t buffer_size,
-                                  memcached_t *st) {
+                                  memcached_t *st, int fd, bool *broken) {
   int status;
   size_t buffer_fill;
 
-  memcached_connect(st);
-  if (st->fd < 0) {
-    ERROR("memcached plugin: Instance \"%s\" could not connect to daemon.",
-          st->name);
-    return -1;
-  }
-
   struct pollfd pollfd = {
-      .fd = st->fd, .events = POLLOUT,
+      .fd = fd, .events = POLLOUT,
   };
 
   do
@@ -235,18 +268,15 @@ static int memcached_query_daemon(char *buffer, size_t buffer_size,
 
   if (status <= 0) {
     ERROR("memcached plugin: poll() failed for write() call.");
-    close(st->fd);
-    st->fd = -1;
+    *broken = true;
     return -1;
   }
 
-  status = (int)swrite(st->fd, "stats\r\n", strlen("stats\r\n"));
+  status = (int)swrite(fd, "stats\r\n", strlen("stats\r\n"));
   if (status != 0) {
     ERROR("memcached plugin: Instance \"%s\": write(2) failed: %s", st->name,
           STRERRNO);
-    shutdown(st->fd, SHUT_RDWR);
-    close(st->fd);
-    st->fd = -1;
+    *broken = true;
     return -1;
   }
 
@@ -263,13 +293,12 @@ static int memcached_query_daemon(char *buffer, size_t buffer_size,
     if (status <= 0) {
       ERROR("memcached plugin: Instance \"%s\": Timeout reading from socket",
             st->name);
-      close(st->fd);
-      st->fd = -1;
+      *broken = true;
       return -1;
     }
 
     do
-      status = (int)recv(st->fd, buffer + buffer_fill,
+      status = (int)recv(fd, buffer + buffer_fill,
                          buffer_size - buffer_fill, /* flags = */ 0);
     while (status < 0 && errno == EINTR);
 
@@ -281,15 +310,12 @@ static int memcached_query_daemon(char *buffer, size_t buffer_size,
 
       ERROR("memcached plugin: Instance \"%s\": Error reading from socket: %s",
             st->name, STRERRNO);
-      shutdown(st->fd, SHUT_RDWR);
-      close(st->fd);
-      st->fd = -1;
+      *broken = true;
       return -1;
     } else if (status == 0) {
       ERROR("memcached plugin: Instance \"%s\": Connection closed by peer",
             st->name);
-      close(st->fd);
-      st->fd = -1;
+      *broken = true;
       return -1;
     }
 
@@ -298,9 +324,7 @@ static int memcached_query_daemon(char *buffer, size_t buffer_size,
       buffer_fill = buffer_size;
       WARNING("memcached plugin: Instance \"%s\": Message was truncated.",
               st->name);
-      shutdown(st->fd, SHUT_RDWR);
-      close(st->fd);
-      st->fd = -1;
+      *broken = true;
       break;
     }
 
@@ -459,8 +483,33 @@ static int memcached_read(user_data_t *user_data) {
   memcached_t *st = user_data->data;
   prev_t *prev = &st->prev;
 
+  /* The pool is created here rather than in the config callback, because its
+   * thread must not be started before the daemon forks. */
+  if (st->pool == NULL) {
+    char pool_name[3 * DATA_MAX_NAME_LEN];
+    snprintf(pool_name, sizeof(pool_name), "memcached/%s",
+             (st->name != NULL) ? st->name : "__legacy__");
+    st->pool = conn_pool_create(pool_name, &memcached_pool_ops, st,
+                                /* size = */ 1, MEMCACHED_CHECK_INTERVAL);
+    if (st->pool == NULL) {
+      ERROR("memcached plugin: Instance \"%s\": Creating the connection "
+            "pool failed.",
+            st->name);
+      return -1;
+    }
+  }
+
+  /* Connecting happens in the background: skip this read if the daemon is
+   * not reachable. */
+  int *conn = conn_pool_get(st->pool);
+  if (conn == NULL)
+    return -1;
+
   /* get data from daemon */
-  if (memcached_query_daemon(buf, sizeof(buf), st) < 0) {
+  bool broken = false;
+  int status = memcached_query_daemon(buf, sizeof(buf), st, *conn, &broken);
+  conn_pool_put(st->pool, conn, broken);
+  if (status < 0) {
     return -1;
   }
 
@@ -716,8 +765,6 @@ static int config_add_instance(oconfig_item_t *ci) {
   st->connhost = NULL;
   st->connport = NULL;
 
-  st->fd = -1;
-
   if (strcasecmp(ci->key, "Instance") == 0)
     status = cf_util_get_string(ci, &st->name);
 
@@ -793,8 +840,6 @@ static int memcached_init(void) {
   st->connhost = NULL;
   st->connport = NULL;
 
-  st->fd = -1;
-
   int status = memcached_add_read_callback(st);
   if (status == 0)
     memcached_have_instances = true;
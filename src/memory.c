@@ -262,11 +262,9 @@ static int memory_read_internal(value_list_t *vl) {
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-  FILE *fh;
-  char buffer[1024];
-
-  char *fields[8];
-  int numfields;
+  static proc_file_t *pf;
+  char *buffer;
+  char *line;
 
   bool detailed_slab_info = false;
 
@@ -279,42 +277,42 @@ static int memory_read_internal(value_list_t *vl) {
   gauge_t mem_slab_reclaimable = 0;
   gauge_t mem_slab_unreclaimable = 0;
 
-  if ((fh = fopen("/proc/meminfo", "r")) == NULL) {
-    WARNING("memory: fopen: %s", STRERRNO);
+  if ((pf == NULL) && ((pf = proc_file_open("/proc/meminfo")) == NULL)) {
+    WARNING("memory: open: %s", STRERRNO);
     return -1;
   }
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
+  if (proc_file_read(pf, &buffer) < 0)
+    return -1;
+
+  for (char *ptr = buffer; (line = proc_file_line(&ptr)) != NULL;) {
     gauge_t *val = NULL;
 
-    if (strncasecmp(buffer, "MemTotal:", 9) == 0)
+    if (strncasecmp(line, "MemTotal:", 9) == 0)
       val = &mem_total;
-    else if (strncasecmp(buffer, "MemFree:", 8) == 0)
+    else if (strncasecmp(line, "MemFree:", 8) == 0)
       val = &mem_free;
-    else if (strncasecmp(buffer, "Buffers:", 8) == 0)
+    else if (strncasecmp(line, "Buffers:", 8) == 0)
       val = &mem_buffered;
-    else if (strncasecmp(buffer, "Cached:", 7) == 0)
+    else if (strncasecmp(line, "Cached:", 7) == 0)
       val = &mem_cached;
-    else if (strncasecmp(buffer, "Slab:", 5) == 0)
+    else if (strncasecmp(line, "Slab:", 5) == 0)
       val = &mem_slab_total;
-    else if (strncasecmp(buffer, "SReclaimable:", 13) == 0) {
+    else if (strncasecmp(line, "SReclaimable:", 13) == 0) {
       val = &mem_slab_reclaimable;
       detailed_slab_info = true;
-    } else if (strncasecmp(buffer, "SUnreclaim:", 11) == 0) {
+    } else if (strncasecmp(line, "SUnreclaim:", 11) == 0) {
       val = &mem_slab_unreclaimable;
       detailed_slab_info = true;
     } else
       continue;
 
-    numfields = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
-    if (numfields < 2)
+    /* All keys matched above end in a colon. */
+    uint64_t value;
+    if (parse_uint64_fields(strchr(line, ':') + 1, &value, 1, NULL) != 1)
       continue;
 
-    *val = 1024.0 * atof(fields[1]);
-  }
-
-  if (fclose(fh)) {
-    WARNING("memory: fclose: %s", STRERRNO);
+    *val = 1024.0 * (gauge_t)value;
   }
 
   if (mem_total < (mem_free + mem_buffered + mem_cached + mem_slab_total))
@@ -37,6 +37,11 @@
 /* Assume version 2.9.2 */
 #endif
 
+/* The maximum number of registers a single read request may ask for. */
+#ifndef MODBUS_MAX_READ_REGISTERS
+#define MODBUS_MAX_READ_REGISTERS 125
+#endif
+
 #ifndef MODBUS_TCP_DEFAULT_PORT
 #ifdef MODBUS_TCP_PORT
 #define MODBUS_TCP_DEFAULT_PORT MODBUS_TCP_PORT
@@ -62,6 +67,7 @@
  *   # Baudrate 38400
  *   # (Assumes 8N1)
  *   Interval 60
+ *   MaxRegisterGap 0
  *
  *   <Slave 1>
  *     Instance "foobar" # optional
@@ -113,11 +119,28 @@ struct mb_data_s /* {{{ */
   mb_data_t *next;
 }; /* }}} */
 
+/* A range of registers which is read with one request. The data definitions
+ * are sliced out of the result. */
+struct mb_block_s /* {{{ */
+{
+  mb_mreg_type_t modbus_register_type;
+  int register_base;
+  int registers_num;
+
+  mb_data_t **data;
+  size_t data_num;
+}; /* }}} */
+typedef struct mb_block_s mb_block_t;
+
 struct mb_slave_s /* {{{ */
 {
   int id;
   char instance[DATA_MAX_NAME_LEN];
   mb_data_t *collect;
+
+  mb_block_t *blocks;
+  size_t blocks_num;
+  mb_data_t **blocks_data; /* "collect", sorted by register */
 }; /* }}} */
 typedef struct mb_slave_s mb_slave_t;
 
@@ -129,6 +152,7 @@ struct mb_host_s /* {{{ */
   int port;     /* for Modbus/TCP */
   int baudrate; /* for Modbus/RTU */
   mb_conntype_t conntype;
+  int max_register_gap; /* negative: don't merge reads */
 
   mb_slave_t *slaves;
   size_t slaves_num;
@@ -403,55 +427,27 @@ static int mb_init_connection(mb_host_t *host) /* {{{ */
       (vt).absolute = (((absolute_t)(raw)*scale) + shift);                     \
   } while (0)
 
-static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
-                        mb_data_t *data) {
-  uint16_t values[4] = {0};
-  int values_num;
-  const data_set_t *ds;
-  int status = 0;
-
-  if ((host == NULL) || (slave == NULL) || (data == NULL))
-    return EINVAL;
-
-  ds = plugin_get_ds(data->type);
-  if (ds == NULL) {
-    ERROR("Modbus plugin: Type \"%s\" is not defined.", data->type);
-    return -1;
-  }
-
-  if (ds->ds_num != 1) {
-    ERROR("Modbus plugin: The type \"%s\" has %" PRIsz " data sources. "
-          "I can only handle data sets with only one data source.",
-          data->type, ds->ds_num);
-    return -1;
-  }
-
-  if ((ds->ds[0].type != DS_TYPE_GAUGE) &&
-      (data->register_type != REG_TYPE_INT32) &&
-      (data->register_type != REG_TYPE_INT32_CDAB) &&
-      (data->register_type != REG_TYPE_UINT32) &&
-      (data->register_type != REG_TYPE_UINT32_CDAB) &&
-      (data->register_type != REG_TYPE_INT64) &&
-      (data->register_type != REG_TYPE_UINT64)) {
-    NOTICE(
-        "Modbus plugin: The data source of type \"%s\" is %s, not gauge. "
-        "This will most likely result in problems, because the register type "
-        "is not UINT32 or UINT64.",
-        data->type, DS_TYPE_TO_STRING(ds->ds[0].type));
-  }
-
+/* Returns the number of registers holding the value of "data". */
+static int mb_data_registers_num(const mb_data_t *data) /* {{{ */
+{
   if ((data->register_type == REG_TYPE_INT32) ||
       (data->register_type == REG_TYPE_INT32_CDAB) ||
       (data->register_type == REG_TYPE_UINT32) ||
       (data->register_type == REG_TYPE_UINT32_CDAB) ||
       (data->register_type == REG_TYPE_FLOAT) ||
       (data->register_type == REG_TYPE_FLOAT_CDAB))
-    values_num = 2;
+    return 2;
   else if ((data->register_type == REG_TYPE_INT64) ||
            (data->register_type == REG_TYPE_UINT64))
-    values_num = 4;
+    return 4;
   else
-    values_num = 1;
+    return 1;
+} /* }}} int mb_data_registers_num */
+
+/* Makes sure "host" is connected and talks to "slave". */
+static int mb_prepare_connection(mb_host_t *host, /* {{{ */
+                                 mb_slave_t *slave) {
+  int status = 0;
 
   if (host->connection == NULL) {
     status = EBADF;
@@ -480,14 +476,12 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
     modbus_close(host->connection);
     modbus_free(host->connection);
 #endif
+    /* Reconnect on the next read. */
+    host->connection = NULL;
+    return -1;
   }
 
-#if LEGACY_LIBMODBUS
-/* Version 2.0.3: Pass the connection struct as a pointer and pass the slave
- * id to each call of "read_holding_registers". */
-#define modbus_read_registers(ctx, addr, nb, dest)                             \
-  read_holding_registers(&(ctx), slave->id, (addr), (nb), (dest))
-#else /* if !LEGACY_LIBMODBUS */
+#if !LEGACY_LIBMODBUS
   /* Version 2.9.2: Set the slave id once before querying the registers. */
   status = modbus_set_slave(host->connection, slave->id);
   if (status != 0) {
@@ -496,41 +490,49 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
     return -1;
   }
 #endif
-  if (data->modbus_register_type == MREG_INPUT) {
-    status = modbus_read_input_registers(host->connection,
-                                         /* start_addr = */ data->register_base,
-                                         /* num_registers = */ values_num,
-                                         /* buffer = */ values);
-  } else {
-    status = modbus_read_registers(host->connection,
-                                   /* start_addr = */ data->register_base,
-                                   /* num_registers = */ values_num,
-                                   /* buffer = */ values);
+
+  return 0;
+} /* }}} int mb_prepare_connection */
+
+/* Decodes and dispatches the value of "data" from its registers in
+ * "values". */
+static int mb_submit_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
+                          mb_data_t *data, const uint16_t *values) {
+  const data_set_t *ds;
+
+  ds = plugin_get_ds(data->type);
+  if (ds == NULL) {
+    ERROR("Modbus plugin: Type \"%s\" is not defined.", data->type);
+    return -1;
   }
-  if (status != values_num) {
-    ERROR("Modbus plugin: modbus read function (%s/%s) failed. "
-          " status = %i, start_addr = %i, values_num = %i. Giving up.",
-          host->host, host->node, status, data->register_base, values_num);
-#if LEGACY_LIBMODBUS
-    modbus_close(&host->connection);
-#else
-    modbus_close(host->connection);
-    modbus_free(host->connection);
-#endif
-    host->connection = NULL;
+
+  if (ds->ds_num != 1) {
+    ERROR("Modbus plugin: The type \"%s\" has %" PRIsz " data sources. "
+          "I can only handle data sets with only one data source.",
+          data->type, ds->ds_num);
     return -1;
   }
 
-  DEBUG("Modbus plugin: mb_read_data: Success! "
-        "modbus_read_registers returned with status %i.",
-        status);
+  if ((ds->ds[0].type != DS_TYPE_GAUGE) &&
+      (data->register_type != REG_TYPE_INT32) &&
+      (data->register_type != REG_TYPE_INT32_CDAB) &&
+      (data->register_type != REG_TYPE_UINT32) &&
+      (data->register_type != REG_TYPE_UINT32_CDAB) &&
+      (data->register_type != REG_TYPE_INT64) &&
+      (data->register_type != REG_TYPE_UINT64)) {
+    NOTICE(
+        "Modbus plugin: The data source of type \"%s\" is %s, not gauge. "
+        "This will most likely result in problems, because the register type "
+        "is not UINT32 or UINT64.",
+        data->type, DS_TYPE_TO_STRING(ds->ds[0].type));
+  }
 
   if (data->register_type == REG_TYPE_FLOAT) {
     float float_value;
     value_t vt;
 
     float_value = mb_register_to_float(values[0], values[1]);
-    DEBUG("Modbus plugin: mb_read_data: "
+    DEBUG("Modbus plugin: mb_submit_data: "
           "Returned float value is %g",
           (double)float_value);
 
@@ -541,7 +543,7 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
     value_t vt;
 
     float_value = mb_register_to_float(values[1], values[0]);
-    DEBUG("Modbus plugin: mb_read_data: "
+    DEBUG("Modbus plugin: mb_submit_data: "
           "Returned float value is %g",
           (double)float_value);
 
@@ -555,7 +557,7 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
     value_t vt;
 
     v.u32 = (((uint32_t)values[0]) << 16) | ((uint32_t)values[1]);
-    DEBUG("Modbus plugin: mb_read_data: "
+    DEBUG("Modbus plugin: mb_submit_data: "
           "Returned int32 value is %" PRIi32,
           v.i32);
 
@@ -569,7 +571,7 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
     value_t vt;
 
     v.u32 = (((uint32_t)values[1]) << 16) | ((uint32_t)values[0]);
-    DEBUG("Modbus plugin: mb_read_data: "
+    DEBUG("Modbus plugin: mb_submit_data: "
           "Returned int32 value is %" PRIi32,
           v.i32);
 
@@ -584,7 +586,7 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
 
     v.u16 = values[0];
 
-    DEBUG("Modbus plugin: mb_read_data: "
+    DEBUG("Modbus plugin: mb_submit_data: "
           "Returned int16 value is %" PRIi16,
           v.i16);
 
@@ -595,7 +597,7 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
     value_t vt;
 
     v32 = (((uint32_t)values[0]) << 16) | ((uint32_t)values[1]);
-    DEBUG("Modbus plugin: mb_read_data: "
+    DEBUG("Modbus plugin: mb_submit_data: "
           "Returned uint32 value is %" PRIu32,
           v32);
 
@@ -606,7 +608,7 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
     value_t vt;
 
     v32 = (((uint32_t)values[1]) << 16) | ((uint32_t)values[0]);
-    DEBUG("Modbus plugin: mb_read_data: "
+    DEBUG("Modbus plugin: mb_submit_data: "
           "Returned uint32 value is %" PRIu32,
           v32);
 
@@ -618,7 +620,7 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
 
     v64 = (((uint64_t)values[0]) << 48) | (((uint64_t)values[1]) << 32) |
           (((uint64_t)values[2]) << 16) | (((uint64_t)values[3]));
-    DEBUG("Modbus plugin: mb_read_data: "
+    DEBUG("Modbus plugin: mb_submit_data: "
           "Returned uint64 value is %" PRIu64,
           v64);
 
@@ -633,7 +635,7 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
 
     v.u64 = (((uint64_t)values[0]) << 48) | (((uint64_t)values[1]) << 32) |
             (((uint64_t)values[2]) << 16) | ((uint64_t)values[3]);
-    DEBUG("Modbus plugin: mb_read_data: "
+    DEBUG("Modbus plugin: mb_submit_data: "
           "Returned uint64 value is %" PRIi64,
           v.i64);
 
@@ -643,7 +645,7 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
   {
     value_t vt;
 
-    DEBUG("Modbus plugin: mb_read_data: "
+    DEBUG("Modbus plugin: mb_submit_data: "
           "Returned uint16 value is %" PRIu16,
           values[0]);
 
@@ -652,7 +654,68 @@ static int mb_read_data(mb_host_t *host, mb_slave_t *slave, /* {{{ */
   }
 
   return 0;
-} /* }}} int mb_read_data */
+} /* }}} int mb_submit_data */
+
+#if LEGACY_LIBMODBUS
+/* Version 2.0.3: Pass the connection struct as a pointer and pass the slave
+ * id to each call of "read_holding_registers". */
+#define modbus_read_registers(ctx, addr, nb, dest)                             \
+  read_holding_registers(&(ctx), slave->id, (addr), (nb), (dest))
+#endif
+
+/* Reads the registers of "block" with one request and dispatches the values
+ * of all data definitions it covers. Returns the number of values
+ * dispatched, or -1 if the read failed. */
+static int mb_read_block(mb_host_t *host, mb_slave_t *slave, /* {{{ */
+                         mb_block_t *block) {
+  uint16_t values[MODBUS_MAX_READ_REGISTERS] = {0};
+  int status;
+
+  if (mb_prepare_connection(host, slave) != 0)
+    return -1;
+
+  if (block->modbus_register_type == MREG_INPUT) {
+    status = modbus_read_input_registers(
+        host->connection,
+        /* start_addr = */ block->register_base,
+        /* num_registers = */ block->registers_num,
+        /* buffer = */ values);
+  } else {
+    status = modbus_read_registers(host->connection,
+                                   /* start_addr = */ block->register_base,
+                                   /* num_registers = */ block->registers_num,
+                                   /* buffer = */ values);
+  }
+  if (status != block->registers_num) {
+    ERROR("Modbus plugin: modbus read function (%s/%s) failed. "
+          " status = %i, start_addr = %i, values_num = %i. Giving up.",
+          host->host, host->node, status, block->register_base,
+          block->registers_num);
+#if LEGACY_LIBMODBUS
+    modbus_close(&host->connection);
+#else
+    modbus_close(host->connection);
+    modbus_free(host->connection);
+#endif
+    host->connection = NULL;
+    return -1;
+  }
+
+  DEBUG("Modbus plugin: mb_read_block: Success! "
+        "modbus_read_registers returned with status %i.",
+        status);
+
+  int success = 0;
+  for (size_t i = 0; i < block->data_num; i++) {
+    mb_data_t *data = block->data[i];
+    if (mb_submit_data(host, slave, data,
+                       values + (data->register_base - block->register_base)) ==
+        0)
+      success++;
+  }
+
+  return success;
+} /* }}} int mb_read_block */
 
 static int mb_read_slave(mb_host_t *host, mb_slave_t *slave) /* {{{ */
 {
@@ -663,10 +726,10 @@ static int mb_read_slave(mb_host_t *host, mb_slave_t *slave) /* {{{ */
     return EINVAL;
 
   success = 0;
-  for (mb_data_t *data = slave->collect; data != NULL; data = data->next) {
-    status = mb_read_data(host, slave, data);
-    if (status == 0)
-      success++;
+  for (size_t i = 0; i < slave->blocks_num; i++) {
+    status = mb_read_block(host, slave, slave->blocks + i);
+    if (status > 0)
+      success += status;
   }
 
   if (success == 0)
@@ -728,8 +791,11 @@ static void slaves_free_all(mb_slave_t *slaves, size_t slaves_num) /* {{{ */
   if (slaves == NULL)
     return;
 
-  for (size_t i = 0; i < slaves_num; i++)
+  for (size_t i = 0; i < slaves_num; i++) {
     data_free_all(slaves[i].collect);
+    sfree(slaves[i].blocks);
+    sfree(slaves[i].blocks_data);
+  }
   sfree(slaves);
 } /* }}} void slaves_free_all */
 
@@ -945,6 +1011,83 @@ static int mb_config_add_slave(mb_host_t *host, oconfig_item_t *ci) /* {{{ */
   return status;
 } /* }}} int mb_config_add_slave */
 
+static int mb_data_compare(const void *a, const void *b) /* {{{ */
+{
+  const mb_data_t *d0 = *(mb_data_t *const *)a;
+  const mb_data_t *d1 = *(mb_data_t *const *)b;
+
+  if (d0->modbus_register_type != d1->modbus_register_type)
+    return (d0->modbus_register_type < d1->modbus_register_type) ? -1 : 1;
+  if (d0->register_base != d1->register_base)
+    return (d0->register_base < d1->register_base) ? -1 : 1;
+  return 0;
+} /* }}} int mb_data_compare */
+
+/* Merges the register ranges of the slave's data definitions into as few read
+ * requests as possible. Ranges which overlap, are adjacent or are at most
+ * "max_gap" registers apart are read together, as long as the request doesn't
+ * exceed MODBUS_MAX_READ_REGISTERS. A negative "max_gap" reads every data
+ * definition on its own. */
+static int mb_slave_plan_blocks(mb_slave_t *slave, int max_gap) /* {{{ */
+{
+  size_t data_num = 0;
+  for (mb_data_t *data = slave->collect; data != NULL; data = data->next)
+    data_num++;
+
+  mb_data_t **sorted = calloc(data_num, sizeof(*sorted));
+  mb_block_t *blocks = calloc(data_num, sizeof(*blocks));
+  if ((sorted == NULL) || (blocks == NULL)) {
+    sfree(sorted);
+    sfree(blocks);
+    return ENOMEM;
+  }
+
+  size_t i = 0;
+  for (mb_data_t *data = slave->collect; data != NULL; data = data->next)
+    sorted[i++] = data;
+  qsort(sorted, data_num, sizeof(*sorted), mb_data_compare);
+
+  size_t blocks_num = 0;
+  for (i = 0; i < data_num; i++) {
+    mb_data_t *data = sorted[i];
+    int data_end = data->register_base + mb_data_registers_num(data);
+    mb_block_t *b = (blocks_num > 0) ? blocks + blocks_num - 1 : NULL;
+
+    if ((b != NULL) && (max_gap >= 0) &&
+        (b->modbus_register_type == data->modbus_register_type)) {
+      int block_end = b->register_base + b->registers_num;
+      if (data_end < block_end)
+        data_end = block_end;
+
+      if ((data->register_base - block_end <= max_gap) &&
+          (data_end - b->register_base <= MODBUS_MAX_READ_REGISTERS)) {
+        b->registers_num = data_end - b->register_base;
+        b->data_num++;
+        continue;
+      }
+      data_end = data->register_base + mb_data_registers_num(data);
+    }
+
+    blocks[blocks_num] = (mb_block_t){
+        .modbus_register_type = data->modbus_register_type,
+        .register_base = data->register_base,
+        .registers_num = data_end - data->register_base,
+        .data = sorted + i,
+        .data_num = 1,
+    };
+    blocks_num++;
+  }
+
+  DEBUG("Modbus plugin: Slave %i: Reading %" PRIsz " data definitions with "
+        "%" PRIsz " requests.",
+        slave->id, data_num, blocks_num);
+
+  slave->blocks = blocks;
+  slave->blocks_num = blocks_num;
+  slave->blocks_data = sorted;
+  return 0;
+} /* }}} int mb_slave_plan_blocks */
+
 static int mb_config_add_host(oconfig_item_t *ci) /* {{{ */
 {
   cdtime_t interval = 0;
@@ -989,6 +1132,8 @@ static int mb_config_add_host(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_int(child, &host->baudrate);
     else if (strcasecmp("Interval", child->key) == 0)
       status = cf_util_get_cdtime(child, &interval);
+    else if (strcasecmp("MaxRegisterGap", child->key) == 0)
+      status = cf_util_get_int(child, &host->max_register_gap);
     else if (strcasecmp("Slave", child->key) == 0)
       /* Don't set status: Gracefully continue if a slave fails. */
       mb_config_add_slave(host, child);
@@ -1022,6 +1167,9 @@ static int mb_config_add_host(oconfig_item_t *ci) /* {{{ */
     status = -1;
   }
 
+  for (size_t i = 0; (status == 0) && (i < host->slaves_num); i++)
+    status = mb_slave_plan_blocks(host->slaves + i, host->max_register_gap);
+
   if (status == 0) {
     char name[1024];
 
@@ -82,6 +82,17 @@ struct mqtt_client_conf {
   bool loop;
   char *topic;
   bool clean_session;
+  int receive_maximum;
+  bool report_stats;
+
+  /* Subscriber statistics, protected by "stats_lock". */
+  pthread_mutex_t stats_lock;
+  derive_t stats_messages;
+  derive_t stats_values;
+  derive_t stats_errors;
+  cdtime_t stats_lag_sum;
+  cdtime_t stats_lag_max;
+  uint64_t stats_lag_num;
 
   c_complain_t complaint_cantpublish;
   pthread_mutex_t lock;
@@ -178,12 +189,19 @@ static void on_message(
 #else
     __attribute__((unused)) struct mosquitto *m,
 #endif
-    __attribute__((unused)) void *arg, const struct mosquitto_message *msg) {
+    void *arg, const struct mosquitto_message *msg) {
+  mqtt_client_conf_t *conf = arg;
   value_list_t vl = VALUE_LIST_INIT;
   data_set_t const *ds;
   char *topic;
   char *name;
   char *payload;
+  char *saveptr = NULL;
+  int values = 0;
+  int errors = 0;
+  cdtime_t lag_sum = 0;
+  cdtime_t lag_max = 0;
+  uint64_t lag_num = 0;
   int status;
 
   if (msg->payloadlen <= 0) {
@@ -225,17 +243,46 @@ static void on_message(
   payload[msg->payloadlen] = 0;
 
   DEBUG("mqtt plugin: payload = \"%s\"", payload);
-  status = parse_values(payload, &vl, ds);
-  if (status != 0) {
-    ERROR("mqtt plugin: Unable to parse payload \"%s\".", payload);
-    sfree(payload);
-    sfree(vl.values);
-    return;
+
+  /* The payload may hold several "time:value" lines for the same topic; they
+   * are dispatched one after the other. */
+  for (char *line = strtok_r(payload, "\r\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\r\n", &saveptr)) {
+    bool has_time = (strncmp("N:", line, 2) != 0);
+
+    status = parse_values(line, &vl, ds);
+    if (status != 0) {
+      ERROR("mqtt plugin: Unable to parse payload \"%s\".", line);
+      errors++;
+      continue;
+    }
+
+    if (has_time) {
+      cdtime_t now = cdtime();
+      cdtime_t lag = (now > vl.time) ? (now - vl.time) : 0;
+      lag_sum += lag;
+      if (lag_max < lag)
+        lag_max = lag;
+      lag_num++;
+    }
+
+    plugin_dispatch_values(&vl);
+    values++;
   }
   sfree(payload);
-
-  plugin_dispatch_values(&vl);
   sfree(vl.values);
+
+  if (conf->report_stats) {
+    pthread_mutex_lock(&conf->stats_lock);
+    conf->stats_messages++;
+    conf->stats_values += values;
+    conf->stats_errors += errors;
+    conf->stats_lag_sum += lag_sum;
+    conf->stats_lag_num += lag_num;
+    if (conf->stats_lag_max < lag_max)
+      conf->stats_lag_max = lag_max;
+    pthread_mutex_unlock(&conf->stats_lock);
+  }
 } /* void on_message */
 
 /* must hold conf->lock when calling. */
@@ -319,6 +366,24 @@ static int mqtt_connect(mqtt_client_conf_t *conf) {
   }
 #endif
 
+#ifdef MQTT_PROTOCOL_V5
+  if (!conf->publish && (conf->receive_maximum > 0)) {
+    /* "Receive Maximum" was introduced with MQTT 5. */
+    status = mosquitto_int_option(conf->mosq, MOSQ_OPT_PROTOCOL_VERSION,
+                                  MQTT_PROTOCOL_V5);
+    if (status == MOSQ_ERR_SUCCESS)
+      status = mosquitto_int_option(conf->mosq, MOSQ_OPT_RECEIVE_MAXIMUM,
+                                    conf->receive_maximum);
+    if (status != MOSQ_ERR_SUCCESS) {
+      ERROR("mqtt plugin: Setting the receive maximum failed: %s",
+            mosquitto_strerror(status));
+      mosquitto_destroy(conf->mosq);
+      conf->mosq = NULL;
+      return -1;
+    }
+  }
+#endif
+
   if (conf->username && conf->password) {
     status =
         mosquitto_username_pw_set(conf->mosq, conf->username, conf->password);
@@ -607,6 +672,56 @@ static int mqtt_config_publisher(oconfig_item_t *ci) {
   return 0;
 } /* mqtt_config_publisher */
 
+static int mqtt_stats_read(user_data_t *user_data) {
+  mqtt_client_conf_t *conf = user_data->data;
+  value_list_t vl = VALUE_LIST_INIT;
+  derive_t messages, values, errors;
+  gauge_t lag_avg = NAN, lag_max = NAN;
+
+  pthread_mutex_lock(&conf->stats_lock);
+  messages = conf->stats_messages;
+  values = conf->stats_values;
+  errors = conf->stats_errors;
+  if (conf->stats_lag_num > 0) {
+    lag_avg = CDTIME_T_TO_DOUBLE(conf->stats_lag_sum) /
+              (gauge_t)conf->stats_lag_num;
+    lag_max = CDTIME_T_TO_DOUBLE(conf->stats_lag_max);
+  }
+  conf->stats_lag_sum = 0;
+  conf->stats_lag_max = 0;
+  conf->stats_lag_num = 0;
+  pthread_mutex_unlock(&conf->stats_lock);
+
+  sstrncpy(vl.plugin, "mqtt", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, conf->name, sizeof(vl.plugin_instance));
+  vl.values_len = 1;
+
+  vl.values = &(value_t){.derive = messages};
+  sstrncpy(vl.type, "total_objects", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "messages", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.derive = values};
+  sstrncpy(vl.type, "total_values", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "values", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.derive = errors};
+  sstrncpy(vl.type_instance, "errors", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.gauge = lag_avg};
+  sstrncpy(vl.type, "delay", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "lag-average", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.gauge = lag_max};
+  sstrncpy(vl.type_instance, "lag-max", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  return 0;
+} /* mqtt_stats_read */
+
 /*
  * <Subscribe "name">
  *   Host "example.com"
@@ -615,6 +730,8 @@ static int mqtt_config_publisher(oconfig_item_t *ci) {
  *   User "guest"
  *   Password "secret"
  *   Topic "collectd/#"
+ *   ReceiveMaximum 100                   optional, MQTT 5 only
+ *   ReportStats false
  *   CACert "ca.pem"                      Enables TLS if set
  *   CertificateFile "client-cert.pem"	  optional
  *   CertificateKeyFile "client-key.pem"  optional
@@ -646,12 +763,15 @@ static int mqtt_config_subscriber(oconfig_item_t *ci) {
   conf->qos = 2;
   conf->topic = strdup(MQTT_DEFAULT_TOPIC);
   conf->clean_session = true;
+  conf->receive_maximum = 0;
+  conf->report_stats = false;
 
   status = pthread_mutex_init(&conf->lock, NULL);
   if (status != 0) {
     mqtt_free(conf);
     return status;
   }
+  pthread_mutex_init(&conf->stats_lock, NULL);
 
   C_COMPLAIN_INIT(&conf->complaint_cantpublish);
 
@@ -682,6 +802,20 @@ static int mqtt_config_subscriber(oconfig_item_t *ci) {
       cf_util_get_string(child, &conf->topic);
     else if (strcasecmp("CleanSession", child->key) == 0)
       cf_util_get_boolean(child, &conf->clean_session);
+    else if (strcasecmp("ReceiveMaximum", child->key) == 0) {
+      int receive_maximum = -1;
+      status = cf_util_get_int(child, &receive_maximum);
+      if ((status != 0) || (receive_maximum < 0) || (receive_maximum > 65535))
+        ERROR("mqtt plugin: Not a valid ReceiveMaximum setting.");
+      else
+        conf->receive_maximum = receive_maximum;
+#ifndef MQTT_PROTOCOL_V5
+      if (conf->receive_maximum > 0)
+        WARNING("mqtt plugin: The \"ReceiveMaximum\" option requires "
+                "libmosquitto 1.6 or later and will be ignored.");
+#endif
+    } else if (strcasecmp("ReportStats", child->key) == 0)
+      cf_util_get_boolean(child, &conf->report_stats);
     else if (strcasecmp("CACert", child->key) == 0)
       cf_util_get_string(child, &conf->cacertificatefile);
     else if (strcasecmp("CertificateFile", child->key) == 0)
@@ -706,6 +840,16 @@ static int mqtt_config_subscriber(oconfig_item_t *ci) {
   subscribers[subscribers_num] = conf;
   subscribers_num++;
 
+  if (conf->report_stats) {
+    char cb_name[1024];
+    snprintf(cb_name, sizeof(cb_name), "mqtt/%s", conf->name);
+    plugin_register_complex_read(/* group = */ NULL, cb_name, mqtt_stats_read,
+                                 /* interval = */ 0,
+                                 &(user_data_t){
+                                     .data = conf,
+                                 });
+  }
+
   return 0;
 } /* mqtt_config_subscriber */
 
@@ -31,6 +31,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_conn_pool.h"
 
 #ifdef HAVE_MYSQL_H
 #include <mysql.h>
@@ -67,8 +68,7 @@ struct mysql_database_s /* {{{ */
   bool slave_io_running;
   bool slave_sql_running;
 
-  MYSQL *con;
-  bool is_connected;
+  conn_pool_t *pool;
 };
 typedef struct mysql_database_s mysql_database_t; /* }}} */
 
@@ -85,8 +85,7 @@ static void mysql_database_free(void *arg) /* {{{ */
   if (db == NULL)
     return;
 
-  if (db->con != NULL)
-    mysql_close(db->con);
+  conn_pool_destroy(db->pool);
 
   sfree(db->alias);
   sfree(db->host);
@@ -143,7 +142,7 @@ static int mysql_config_database(oconfig_item_t *ci) /* {{{ */
   db->cipher = NULL;
 
   db->socket = NULL;
-  db->con = NULL;
+  db->pool = NULL;
   db->timeout = 0;
 
   /* trigger a notification, if it's not running */
@@ -255,59 +254,65 @@ static int mysql_config(oconfig_item_t *ci) /* {{{ */
 
 /* }}} End of configuration handling functions */
 
-static MYSQL *getconnection(mysql_database_t *db) {
+/* Connections are established and pinged by the thread of the pool, so
+ * that an unreachable server does not block the read thread. */
+static void *mysql_pool_connect(void *arg) {
+  mysql_database_t *db = arg;
   const char *cipher;
 
-  if (db->is_connected) {
-    int status;
-
-    status = mysql_ping(db->con);
-    if (status == 0)
-      return db->con;
-
-    WARNING("mysql plugin: Lost connection to instance \"%s\": %s",
-            db->instance, mysql_error(db->con));
-  }
-  db->is_connected = false;
-
-  /* Close the old connection before initializing a new one. */
-  if (db->con != NULL) {
-    mysql_close(db->con);
-    db->con = NULL;
-  }
-
-  db->con = mysql_init(NULL);
-  if (db->con == NULL) {
-    ERROR("mysql plugin: mysql_init failed: %s", mysql_error(db->con));
+  MYSQL *con = mysql_init(NULL);
+  if (con == NULL) {
+    ERROR("mysql plugin: mysql_init failed.");
     return NULL;
   }
 
   /* Configure TCP connect timeout (default: 0) */
-  db->con->options.connect_timeout = db->timeout;
+  con->options.connect_timeout = db->timeout;
 
-  mysql_ssl_set(db->con, db->key, db->cert, db->ca, db->capath, db->cipher);
+  mysql_ssl_set(con, db->key, db->cert, db->ca, db->capath, db->cipher);
 
-  if (mysql_real_connect(db->con, db->host, db->user, db->pass, db->database,
+  if (mysql_real_connect(con, db->host, db->user, db->pass, db->database,
                          db->port, db->socket, 0) == NULL) {
     ERROR("mysql plugin: Failed to connect to database %s "
           "at server %s: %s",
           (db->database != NULL) ? db->database : "<none>",
-          (db->host != NULL) ? db->host : "localhost", mysql_error(db->con));
+          (db->host != NULL) ? db->host : "localhost", mysql_error(con));
+    mysql_close(con);
     return NULL;
   }
 
-  cipher = mysql_get_ssl_cipher(db->con);
+  cipher = mysql_get_ssl_cipher(con);
 
   INFO("mysql plugin: Successfully connected to database %s "
        "at server %s with cipher %s "
        "(server version: %s, protocol version: %d) ",
        (db->database != NULL) ? db->database : "<none>",
-       mysql_get_host_info(db->con), (cipher != NULL) ? cipher : "<none>",
-       mysql_get_server_info(db->con), mysql_get_proto_info(db->con));
+       mysql_get_host_info(con), (cipher != NULL) ? cipher : "<none>",
+       mysql_get_server_info(con), mysql_get_proto_info(con));
+
+  return con;
+} /* void *mysql_pool_connect */
+
+static int mysql_pool_check(void *conn, void *arg) {
+  mysql_database_t *db = arg;
+
+  if (mysql_ping(conn) == 0)
+    return 0;
 
-  db->is_connected = true;
-  return db->con;
-} /* static MYSQL *getconnection (mysql_database_t *db) */
+  WARNING("mysql plugin: Lost connection to instance \"%s\": %s",
+          db->instance, mysql_error(conn));
+  return -1;
+} /* int mysql_pool_check */
+
+static void mysql_pool_close(void *conn, __attribute__((unused)) void *arg) {
+  mysql_close(conn);
+} /* void mysql_pool_close */
+
+static conn_pool_ops_t const mysql_pool_ops = {
+    .connect = mysql_pool_connect,
+    .check = mysql_pool_check,
+    .close = mysql_pool_close,
+};
 
 static void set_host(mysql_database_t *db, char *buf, size_t buflen) {
   if (db->alias)
@@ -742,8 +747,23 @@ static int mysql_read(user_data_t *ud) {
 
   db = (mysql_database_t *)ud->data;
 
-  /* An error message will have been printed in this case */
-  if ((con = getconnection(db)) == NULL)
+  /* Created here rather than in the config callback, because the thread of
+   * the pool must not be started before the daemon forks. */
+  if (db->pool == NULL) {
+    char pool_name[DATA_MAX_NAME_LEN];
+    snprintf(pool_name, sizeof(pool_name), "mysql-%s",
+             (db->instance != NULL) ? db->instance : "");
+    db->pool = conn_pool_create(pool_name, &mysql_pool_ops, db, /* size = */ 1,
+                                plugin_get_interval());
+    if (db->pool == NULL) {
+      ERROR("mysql plugin: Creating the connection pool failed.");
+      return -1;
+    }
+  }
+
+  /* Connecting happens in the background and an error message will have
+   * been printed if it failed. */
+  if ((con = conn_pool_get(db->pool)) == NULL)
     return -1;
 
   mysql_version = mysql_get_server_version(con);
@@ -753,8 +773,10 @@ static int mysql_read(user_data_t *ud) {
     query = "SHOW GLOBAL STATUS";
 
   res = exec_query(con, query);
-  if (res == NULL)
+  if (res == NULL) {
+    conn_pool_put(db->pool, con, /* broken = */ mysql_ping(con) != 0);
     return -1;
+  }
 
   while ((row = mysql_fetch_row(res))) {
     char *key;
@@ -942,6 +964,7 @@ static int mysql_read(user_data_t *ud) {
   if (db->wsrep_stats)
     mysql_read_wsrep_stats(db, con);
 
+  conn_pool_put(db->pool, con, /* broken = */ false);
   return 0;
 } /* int mysql_read */
 
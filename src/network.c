@@ -24,14 +24,18 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE /* For struct ip_mreq */
+#define _GNU_SOURCE /* For recvmmsg(2) */
 
 #include "collectd.h"
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_atomic.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
 #include "utils_fbhash.h"
+#include "utils_hll.h"
+#include "utils_probe.h"
 
 #include "network.h"
 
@@ -50,6 +54,15 @@
 #if HAVE_NET_IF_H
 #include <net/if.h>
 #endif
+#if HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+#if HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#if HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+#endif
 
 #if HAVE_GCRYPT_H
 #if defined __APPLE__
@@ -71,9 +84,16 @@
 #endif
 #if GCRYPT_VERSION_NUMBER < 0x010600
 GCRY_THREAD_OPTION_PTHREAD_IMPL;
+#else
+/* AES-GCM is available since libgcrypt 1.6.0. */
+#define HAVE_GCRYPT_GCM 1
 #endif
 #endif
 
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 #ifndef IPV6_ADD_MEMBERSHIP
 #ifdef IPV6_JOIN_GROUP
 #define IPV6_ADD_MEMBERSHIP IPV6_JOIN_GROUP
@@ -92,6 +112,22 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
  */
 #define BUFF_SIG_SIZE 106
 
+/* Upper limit for the uncompressed size of a compressed part. Limits the
+ * memory a single packet can make the receiver allocate. */
+#define NETWORK_COMPRESS_MAX_SIZE 65536
+
+/* With "Protocol TCP", each packet is sent as a frame: its size as a 32 bit
+ * integer in network byte order, followed by the packet. */
+#define NETWORK_STREAM_HEADER_SIZE 4
+#define NETWORK_STREAM_FRAME_MAX (65535 + BUFF_SIG_SIZE)
+/* Initial size of a connection's receive buffer. */
+#define NETWORK_STREAM_BUFFER_SIZE 4096
+/* Connecting and sending a batch of packets give up after this long: a
+ * stalled server blocks sending to all servers until then. */
+#define NETWORK_STREAM_TIMEOUT TIME_T_TO_CDTIME_T(5)
+/* Minimum time between attempts to connect to a server. */
+#define NETWORK_STREAM_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T(1)
+
 /*
  * Private data types
  */
@@ -99,6 +135,9 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 #if HAVE_GCRYPT_H
 #define SECURITY_LEVEL_SIGN 1
 #define SECURITY_LEVEL_ENCRYPT 2
+/* Clients only: servers treat the packets like those of SECURITY_LEVEL_ENCRYPT
+ * when checking the required level. */
+#define SECURITY_LEVEL_ENCRYPT_GCM 3
 #endif
 struct sockent_client {
   int fd;
@@ -109,21 +148,32 @@ struct sockent_client {
   char *username;
   char *password;
   gcry_cipher_hd_t cypher;
+  gcry_md_hd_t hmac;
   unsigned char password_hash[32];
+#if HAVE_GCRYPT_GCM
+  gcry_cipher_hd_t gcm;
+  /* A random prefix followed by a counter: a key must never be used with the
+   * same IV twice. */
+  unsigned char gcm_iv_prefix[4];
+  uint64_t gcm_counter;
+#endif
 #endif
   cdtime_t next_resolve_reconnect;
   cdtime_t resolve_interval;
+  cdtime_t next_connect; /* stream sockets only */
   struct sockaddr_storage *bind_addr;
 };
 
 struct sockent_server {
   int *fd;
   size_t fd_num;
+  /* With more than one "Interface", each gets its own sockets. */
+  int *interfaces;
+  size_t interfaces_num;
 #if HAVE_GCRYPT_H
   int security_level;
   char *auth_file;
   fbhash_t *userdb;
-  gcry_cipher_hd_t cypher;
 #endif
 };
 
@@ -135,6 +185,7 @@ typedef struct sockent {
   char *node;
   char *service;
   int interface;
+  int socktype; /* SOCK_DGRAM or SOCK_STREAM */
 
   union {
     struct sockent_client client;
@@ -251,57 +302,303 @@ struct part_encryption_aes256_s {
 };
 typedef struct part_encryption_aes256_s part_encryption_aes256_t;
 
+/*                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-------------------------------+-------------------------------+
+ * ! Type                          ! Length                        !
+ * +-------------------------------+-------------------------------+
+ * ! Username length               ! Username (variable)           :
+ * +-------------------------------+-------------------------------+
+ * ! IV (Bits   0 -  31)                                           !
+ * : :                                                             :
+ * ! IV (Bits  64 -  95)                                           !
+ * +---------------------------------------------------------------+
+ * ! Encrypted payload (variable)                                  :
+ * +---------------------------------------------------------------+
+ * ! Tag (Bits   0 -  31)                                          !
+ * : :                                                             :
+ * ! Tag (Bits  96 - 127)                                          !
+ * +---------------------------------------------------------------+
+ *
+ * The tag authenticates the payload and everything before the IV.
+ */
+/* Minimum size */
+#define PART_ENCRYPTION_AES256_GCM_SIZE 34
+#define PART_ENCRYPTION_AES256_GCM_IV_SIZE 12
+#define PART_ENCRYPTION_AES256_GCM_TAG_SIZE 16
+
 struct receive_list_entry_s {
   char *data;
   int data_len;
   int fd;
+  struct sockaddr_storage addr;
   struct receive_list_entry_s *next;
 };
 typedef struct receive_list_entry_s receive_list_entry_t;
 
+/* Number of datagrams a receive thread reads with one recvmmsg(2) call. */
+#define RECEIVE_BATCH_SIZE 32
+
+/* With "ReceiveThreads", each receive thread polls its own sockets and parses
+ * the packets it receives itself, i.e. without the dispatch thread. */
+struct receive_worker_s {
+  pthread_t id;
+  bool running;
+  struct pollfd *pollfd;
+  sockent_t **sockent; /* server socket entry of each pollfd */
+  size_t fd_num;
+};
+typedef struct receive_worker_s receive_worker_t;
+
+#if HAVE_SYS_EPOLL_H
+/* A "Protocol TCP" listening socket or a connection accepted from one.
+ * Received data is collected in "buffer" until a frame is complete. */
+struct stream_conn_s {
+  int fd;
+  bool listening;
+  sockent_t *se;
+  struct sockaddr_storage addr; /* the sender's address */
+  char *buffer;
+  size_t size;
+  size_t fill;
+  struct stream_conn_s *prev;
+  struct stream_conn_s *next;
+};
+typedef struct stream_conn_s stream_conn_t;
+
+/* Each stream thread waits for its listening sockets and the connections
+ * accepted from them with epoll(7) and parses the packets itself, like the
+ * "ReceiveThreads". Not reading from a connection while parsing makes slow
+ * receivers push back on the senders. */
+struct stream_worker_s {
+  pthread_t id;
+  bool running;
+  int epoll_fd;
+  stream_conn_t *conns;
+};
+typedef struct stream_worker_s stream_worker_t;
+
+/* Maximum number of events handled per epoll_wait(2) call. */
+#define STREAM_EVENTS_MAX 64
+#endif /* HAVE_SYS_EPOLL_H */
+
+/* A dispatch thread and its part of the receive list. The receive thread
+ * assigns packets by sender address, so that each sender's values are parsed
+ * in the order they were received. */
+struct dispatch_worker_s {
+  receive_list_entry_t *head;
+  receive_list_entry_t *tail;
+  uint64_t length;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  /* Packets the receive thread has not been able to append yet, because the
+   * lock was held. Only used by the receive thread. */
+  receive_list_entry_t *private_head;
+  receive_list_entry_t *private_tail;
+  uint64_t private_length;
+
+  pthread_t id;
+  bool running;
+  derive_t packets; /* only written by the dispatch thread */
+};
+typedef struct dispatch_worker_s dispatch_worker_t;
+
+/* Per-sender accounting ("SenderTopK"). The senders are spread over
+ * SENDER_SHARDS_NUM shards by address, each with its own lock and a fixed
+ * number of slots. A sender which does not have a slot takes the one with the
+ * lowest score ("Space-Saving"): the score counts packets, but is halved
+ * every SENDER_DECAY_INTERVAL, so that senders which became quiet give way to
+ * the current ones. Only the address is used, not the port. */
+#define SENDER_SHARDS_NUM 16
+#define SENDER_SHARD_SIZE_MAX 64
+#define SENDER_DECAY_INTERVAL TIME_T_TO_CDTIME_T(10)
+/* Sender table size used if only "SenderRateLimit" is configured. */
+#define SENDER_TOPK_DEFAULT 64
+
+struct sender_s {
+  int family; /* AF_INET or AF_INET6; zero if the slot is unused */
+  uint8_t addr[16];
+  uint64_t score;
+  derive_t packets;
+  derive_t octets;
+  derive_t values;
+  derive_t dropped;
+  /* Token bucket of "SenderRateLimit" */
+  double tokens;
+  cdtime_t last_refill;
+  c_hll_t identifiers;
+};
+typedef struct sender_s sender_t;
+
+struct sender_shard_s {
+  pthread_mutex_t lock;
+  sender_t *senders;
+  size_t senders_num;
+  cdtime_t last_decay;
+};
+typedef struct sender_shard_s sender_shard_t;
+
+/* Number of identifier hashes collected while parsing a packet before they
+ * are added to the sender's sketch. */
+#define SENDER_HASHES_MAX 64
+
+/* Collects a packet's values, so that the shard is locked once per packet
+ * rather than once per value. */
+struct sender_acc_s {
+  sender_shard_t *shard;
+  int family;
+  uint8_t addr[16];
+  derive_t values;
+  uint32_t hashes[SENDER_HASHES_MAX];
+  size_t hashes_num;
+};
+typedef struct sender_acc_s sender_acc_t;
+
+/* "Proxy" state of a received packet. The parts which pass the security
+ * checks are copied into "data" and queued for sending once it is full and
+ * at the end of the packet. The latest host, plugin, type, time, interval
+ * and severity parts are kept, so that each packet sent can start with
+ * them. */
+#define PROXY_STATE_HOST 0
+#define PROXY_STATE_PLUGIN 1
+#define PROXY_STATE_PLUGIN_INSTANCE 2
+#define PROXY_STATE_TYPE 3
+#define PROXY_STATE_TYPE_INSTANCE 4
+#define PROXY_STATE_TIME 5
+#define PROXY_STATE_INTERVAL 6
+#define PROXY_STATE_SEVERITY 7
+#define PROXY_STATE_NUM 8
+
+struct proxy_buffer_s {
+  char *data;
+  size_t size;
+  size_t fill;
+  size_t state_fill; /* "fill" after the state parts */
+  struct {
+    char data[sizeof(part_header_t) + DATA_MAX_NAME_LEN];
+    size_t size;
+  } state[PROXY_STATE_NUM];
+};
+typedef struct proxy_buffer_s proxy_buffer_t;
+
+/* Number of packets sent to a server with one sendmmsg(2) call. */
+#define SEND_BATCH_SIZE 32
+
+struct send_buffer_s {
+  char *data;
+  size_t fill;
+  cdtime_t last_update;
+  /* The buffer is merged with the others and sent once its values are half
+   * an interval old: buffers of threads which only handle few values would
+   * hold them back indefinitely otherwise, and the next value of the same
+   * identifier, which may end up in another thread's buffer, must not be sent
+   * first. */
+  cdtime_t deadline;
+  value_list_t vl; /* values of the previous parts */
+  pthread_mutex_t lock; /* only contended by network_flush() */
+  struct send_buffer_s *next;
+};
+typedef struct send_buffer_s send_buffer_t;
+
+struct send_packet_s {
+  size_t size;
+  struct send_packet_s *next;
+  char data[];
+};
+typedef struct send_packet_s send_packet_t;
+
 /*
  * Private variables
  */
 static int network_config_ttl;
 /* Ethernet - (IPv6 + UDP) = 1500 - (40 + 8) = 1452 */
 static size_t network_config_packet_size = 1452;
+/* Size of the receive buffers. Differs from the packet size only with
+ * "MaxPacketSize auto", because other hosts' path MTU may be larger. */
+static size_t network_config_receive_size = 1452;
+static bool network_config_packet_size_auto;
+#if HAVE_LIBZ
+static bool network_config_compress;
+#endif
 static bool network_config_forward;
+/* Send the received packets to the servers without dispatching them. */
+static bool network_config_proxy;
 static bool network_config_stats;
+/* Zero uses one receive thread which hands the packets to the dispatch
+ * thread. */
+static size_t network_config_receive_threads;
+/* CPUs the receive threads are pinned to, in turn. */
+static int *network_config_receive_cpus;
+static size_t network_config_receive_cpus_num;
+static size_t network_config_dispatch_threads = 1;
+/* Size of the sender table; zero disables the per-sender accounting. */
+static size_t network_config_sender_topk;
+/* Packets per second accepted from each sender; zero means unlimited. */
+static double network_config_sender_rate_limit;
 
 static sockent_t *sending_sockets;
 
-static receive_list_entry_t *receive_list_head;
-static receive_list_entry_t *receive_list_tail;
-static pthread_mutex_t receive_list_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t receive_list_cond = PTHREAD_COND_INITIALIZER;
-static uint64_t receive_list_length;
-
 static sockent_t *listen_sockets;
 static struct pollfd *listen_sockets_pollfd;
 static size_t listen_sockets_num;
 
+/* "Protocol TCP" listening sockets, handled by the stream threads. */
+static sockent_t *stream_listen_sockets;
+static size_t stream_listen_sockets_num;
+
 /* The receive and dispatch threads will run as long as `listen_loop' is set to
  * zero. */
 static int listen_loop;
 static int receive_thread_running;
 static pthread_t receive_thread_id;
-static int dispatch_thread_running;
-static pthread_t dispatch_thread_id;
+static dispatch_worker_t *dispatch_workers;
+static size_t dispatch_workers_num;
+static receive_worker_t *receive_workers;
+static size_t receive_workers_num;
+#if HAVE_SYS_EPOLL_H
+static stream_worker_t *stream_workers;
+static size_t stream_workers_num;
+#endif
 
-/* Buffer in which to-be-sent network packets are constructed. */
-static char *send_buffer;
-static char *send_buffer_ptr;
-static int send_buffer_fill;
-static cdtime_t send_buffer_last_update;
-static value_list_t send_buffer_vl = VALUE_LIST_INIT;
-static pthread_mutex_t send_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+static sender_shard_t *sender_shards;
+static size_t sender_shard_size;
+
+/* Buffers in which to-be-sent network packets are constructed. Each thread
+ * calling network_write() encodes into its own buffer, so encoding does not
+ * need a global lock. `send_buffers' links all buffers for network_flush(). */
+static pthread_key_t send_buffer_key;
+static send_buffer_t *send_buffers;
+static pthread_mutex_t send_buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+/* The earliest deadline of all buffers, or zero. Lowered with
+ * `send_buffers_lock' held and read without. */
+static cdtime_t send_buffers_deadline;
+
+/* Complete packets waiting to be sent. Whichever thread gets `send_lock' sends
+ * all queued packets to each server in batches; the others return right away.
+ * `send_lock' also protects the client sockets. */
+static send_packet_t *send_queue_head;
+static send_packet_t *send_queue_tail;
+static pthread_mutex_t send_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if HAVE_LIBZ
+/* State for compressing packets before they are sent, protected by
+ * `send_lock'. `send_compress_ratio' is the ratio achieved recently and
+ * determines how many packets are compressed together. */
+static z_stream send_zstream;
+static char *send_compress_buffer;
+static double send_compress_ratio = 2.0;
+#endif
 
 /* XXX: These counters are incremented from one place only. The spot in which
  * the values are incremented is either only reachable by one thread (the
- * dispatch thread, for example) or locked by some lock (send_buffer_lock for
+ * dispatch thread, for example) or locked by some lock (send_lock for
  * example). Only if neither is true, the stats_lock is acquired. The counters
  * are always read without holding a lock in the hope that writing 8 bytes to
- * memory is an atomic operation. */
+ * memory is an atomic operation. The receive counters are the exception: with
+ * "ReceiveThreads", they are updated by several threads and use atomic
+ * additions. */
 static derive_t stats_octets_rx;
 static derive_t stats_octets_tx;
 static derive_t stats_packets_rx;
@@ -310,6 +607,7 @@ static derive_t stats_values_dispatched;
 static derive_t stats_values_not_dispatched;
 static derive_t stats_values_sent;
 static derive_t stats_values_not_sent;
+static derive_t stats_packets_rate_limited;
 static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
@@ -391,83 +689,237 @@ static bool check_send_notify_okay(const notification_t *n) /* {{{ */
   return !received;
 } /* }}} bool check_send_notify_okay */
 
-static int network_dispatch_values(value_list_t *vl, /* {{{ */
-                                   const char *username) {
+static int network_dispatch_notification(notification_t *n) /* {{{ */
+{
   int status;
 
-  if ((vl->time == 0) || (strlen(vl->host) == 0) || (strlen(vl->plugin) == 0) ||
-      (strlen(vl->type) == 0))
-    return -EINVAL;
+  assert(n->meta == NULL);
 
-  if (!check_receive_okay(vl)) {
-#if COLLECT_DEBUG
-    char name[6 * DATA_MAX_NAME_LEN];
-    FORMAT_VL(name, sizeof(name), vl);
-    name[sizeof(name) - 1] = 0;
-    DEBUG("network plugin: network_dispatch_values: "
-          "NOT dispatching %s.",
-          name);
-#endif
-    stats_values_not_dispatched++;
-    return 0;
+  status = plugin_notification_meta_add_boolean(n, "network:received", 1);
+  if (status != 0) {
+    ERROR("network plugin: plugin_notification_meta_add_boolean failed.");
+    plugin_notification_meta_free(n->meta);
+    n->meta = NULL;
+    return status;
   }
 
-  assert(vl->meta == NULL);
+  status = plugin_dispatch_notification(n);
 
-  vl->meta = meta_data_create();
-  if (vl->meta == NULL) {
-    ERROR("network plugin: meta_data_create failed.");
-    return -ENOMEM;
+  plugin_notification_meta_free(n->meta);
+  n->meta = NULL;
+
+  return status;
+} /* }}} int network_dispatch_notification */
+
+/* Points "data" at the address in "addr", without the port, and returns its
+ * size. Returns zero for other address families. */
+static size_t network_addr_key(struct sockaddr_storage const *addr, /* {{{ */
+                               unsigned char const **data) {
+  if (addr->ss_family == AF_INET) {
+    struct sockaddr_in const *sa = (struct sockaddr_in const *)addr;
+    *data = (unsigned char const *)&sa->sin_addr;
+    return sizeof(sa->sin_addr);
+  } else if (addr->ss_family == AF_INET6) {
+    struct sockaddr_in6 const *sa = (struct sockaddr_in6 const *)addr;
+    *data = (unsigned char const *)&sa->sin6_addr;
+    return sizeof(sa->sin6_addr);
   }
 
-  status = meta_data_add_boolean(vl->meta, "network:received", 1);
-  if (status != 0) {
-    ERROR("network plugin: meta_data_add_boolean failed.");
-    meta_data_destroy(vl->meta);
-    vl->meta = NULL;
-    return status;
+  *data = NULL;
+  return 0;
+} /* }}} size_t network_addr_key */
+
+static uint32_t network_addr_hash(unsigned char const *data, /* {{{ */
+                                  size_t size) {
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (uint32_t)data[i];
+    hash *= 16777619u;
   }
+  return hash;
+} /* }}} uint32_t network_addr_hash */
 
-  if (username != NULL) {
-    status = meta_data_add_string(vl->meta, "network:username", username);
-    if (status != 0) {
-      ERROR("network plugin: meta_data_add_string failed.");
-      meta_data_destroy(vl->meta);
-      vl->meta = NULL;
-      return status;
-    }
+static int sender_shards_create(void) /* {{{ */
+{
+  sender_shard_size =
+      (network_config_sender_topk + SENDER_SHARDS_NUM - 1) / SENDER_SHARDS_NUM;
+
+  sender_shards = calloc(SENDER_SHARDS_NUM, sizeof(*sender_shards));
+  if (sender_shards == NULL) {
+    ERROR("network plugin: calloc failed.");
+    return ENOMEM;
   }
 
-  plugin_dispatch_values(vl);
-  stats_values_dispatched++;
+  for (size_t i = 0; i < SENDER_SHARDS_NUM; i++) {
+    sender_shard_t *sh = sender_shards + i;
 
-  meta_data_destroy(vl->meta);
-  vl->meta = NULL;
+    sh->senders = calloc(sender_shard_size, sizeof(*sh->senders));
+    if (sh->senders == NULL) {
+      ERROR("network plugin: calloc failed.");
+      for (size_t j = 0; j < i; j++) {
+        pthread_mutex_destroy(&sender_shards[j].lock);
+        sfree(sender_shards[j].senders);
+      }
+      sfree(sender_shards);
+      return ENOMEM;
+    }
+    pthread_mutex_init(&sh->lock, /* attr = */ NULL);
+  }
 
   return 0;
-} /* }}} int network_dispatch_values */
+} /* }}} int sender_shards_create */
 
-static int network_dispatch_notification(notification_t *n) /* {{{ */
+static void sender_shards_destroy(void) /* {{{ */
 {
-  int status;
+  if (sender_shards == NULL)
+    return;
 
-  assert(n->meta == NULL);
+  for (size_t i = 0; i < SENDER_SHARDS_NUM; i++) {
+    pthread_mutex_destroy(&sender_shards[i].lock);
+    sfree(sender_shards[i].senders);
+  }
+  sfree(sender_shards);
+} /* }}} void sender_shards_destroy */
+
+/* Returns the sender's slot or NULL. The shard's lock must be held. */
+static sender_t *sender_shard_find(sender_shard_t *sh, /* {{{ */
+                                   int family, uint8_t const addr[16]) {
+  for (size_t i = 0; i < sh->senders_num; i++) {
+    sender_t *s = sh->senders + i;
+    if ((s->family == family) && (memcmp(s->addr, addr, 16) == 0))
+      return s;
+  }
+  return NULL;
+} /* }}} sender_t *sender_shard_find */
+
+/* Like sender_shard_find(), but gives the sender a slot if it does not have
+ * one. The shard's lock must be held. */
+static sender_t *sender_shard_get(sender_shard_t *sh, /* {{{ */
+                                  int family, uint8_t const addr[16],
+                                  cdtime_t now) {
+  if ((now - sh->last_decay) >= SENDER_DECAY_INTERVAL) {
+    for (size_t i = 0; i < sh->senders_num; i++)
+      sh->senders[i].score /= 2;
+    sh->last_decay = now;
+  }
 
-  status = plugin_notification_meta_add_boolean(n, "network:received", 1);
-  if (status != 0) {
-    ERROR("network plugin: plugin_notification_meta_add_boolean failed.");
-    plugin_notification_meta_free(n->meta);
-    n->meta = NULL;
-    return status;
+  sender_t *s = sender_shard_find(sh, family, addr);
+  if (s != NULL)
+    return s;
+
+  uint64_t score = 0;
+  if (sh->senders_num < sender_shard_size) {
+    s = sh->senders + sh->senders_num;
+    sh->senders_num++;
+  } else {
+    /* Take over the slot with the lowest score, and its score: a sender
+     * which keeps sending will get ahead of the others, one which sent a
+     * single packet will be the next to go. */
+    s = sh->senders;
+    for (size_t i = 1; i < sh->senders_num; i++)
+      if (sh->senders[i].score < s->score)
+        s = sh->senders + i;
+    score = s->score;
   }
 
-  status = plugin_dispatch_notification(n);
+  memset(s, 0, sizeof(*s));
+  s->family = family;
+  memcpy(s->addr, addr, 16);
+  s->score = score;
+  s->tokens = network_config_sender_rate_limit;
+  s->last_refill = now;
+  return s;
+} /* }}} sender_t *sender_shard_get */
+
+/* Accounts a received packet of "size" bytes to its sender and prepares "acc"
+ * for its values. Returns false if the packet exceeds the sender's rate limit
+ * and has to be dropped. */
+static bool sender_packet_begin(sender_acc_t *acc, /* {{{ */
+                                struct sockaddr_storage const *addr,
+                                size_t size) {
+  unsigned char const *data = NULL;
+  size_t data_size = network_addr_key(addr, &data);
+
+  memset(acc, 0, sizeof(*acc));
+  if (data_size == 0)
+    return true;
+
+  acc->family = addr->ss_family;
+  memcpy(acc->addr, data, data_size);
+  acc->shard = sender_shards +
+               (network_addr_hash(data, data_size) % SENDER_SHARDS_NUM);
+
+  cdtime_t now = cdtime();
+  bool accept = true;
+
+  pthread_mutex_lock(&acc->shard->lock);
+  sender_t *s = sender_shard_get(acc->shard, acc->family, acc->addr, now);
+  s->score++;
+  s->packets++;
+  s->octets += (derive_t)size;
+
+  if (network_config_sender_rate_limit > 0.0) {
+    double const rate = network_config_sender_rate_limit;
+    if (now > s->last_refill) {
+      s->tokens += CDTIME_T_TO_DOUBLE(now - s->last_refill) * rate;
+      if (s->tokens > rate)
+        s->tokens = rate;
+      s->last_refill = now;
+    }
 
-  plugin_notification_meta_free(n->meta);
-  n->meta = NULL;
+    if (s->tokens >= 1.0) {
+      s->tokens -= 1.0;
+    } else {
+      s->dropped++;
+      accept = false;
+    }
+  }
+  pthread_mutex_unlock(&acc->shard->lock);
 
-  return status;
-} /* }}} int network_dispatch_notification */
+  if (!accept) {
+    C_ATOMIC_ADD(&stats_packets_rate_limited, 1);
+    acc->shard = NULL;
+  }
+  return accept;
+} /* }}} bool sender_packet_begin */
+
+/* Adds the values collected in "acc" to the sender. If the sender has lost
+ * its slot in the meantime, they are discarded. */
+static void sender_acc_flush(sender_acc_t *acc) /* {{{ */
+{
+  if ((acc->shard == NULL) || ((acc->values == 0) && (acc->hashes_num == 0)))
+    return;
+
+  pthread_mutex_lock(&acc->shard->lock);
+  sender_t *s = sender_shard_find(acc->shard, acc->family, acc->addr);
+  if (s != NULL) {
+    s->values += acc->values;
+    for (size_t i = 0; i < acc->hashes_num; i++)
+      c_hll_add(&s->identifiers, acc->hashes[i]);
+  }
+  pthread_mutex_unlock(&acc->shard->lock);
+
+  acc->values = 0;
+  acc->hashes_num = 0;
+} /* }}} void sender_acc_flush */
+
+static void sender_acc_add(sender_acc_t *acc, uint32_t hash) /* {{{ */
+{
+  if (acc->shard == NULL)
+    return;
+
+  acc->values++;
+  /* Consecutive value lists of a packet often share the identifier. */
+  if ((hash == 0) ||
+      ((acc->hashes_num > 0) && (acc->hashes[acc->hashes_num - 1] == hash)))
+    return;
+
+  if (acc->hashes_num == SENDER_HASHES_MAX)
+    sender_acc_flush(acc);
+  acc->hashes[acc->hashes_num] = hash;
+  acc->hashes_num++;
+} /* }}} void sender_acc_add */
 
 #if HAVE_GCRYPT_H
 static int network_init_gcrypt(void) /* {{{ */
@@ -509,68 +961,172 @@ static int network_init_gcrypt(void) /* {{{ */
   return 0;
 } /* }}} int network_init_gcrypt */
 
-static gcry_cipher_hd_t network_get_aes256_cypher(sockent_t *se, /* {{{ */
-                                                  const void *iv,
-                                                  size_t iv_size,
-                                                  const char *username) {
+/* Returns "*hd", an AES-256 handle in "mode" with the initialization vector
+ * set. The handle is opened and keyed on first use and only reset afterwards,
+ * because setting the key is comparatively expensive. */
+static gcry_cipher_hd_t network_cipher_get(gcry_cipher_hd_t *hd, /* {{{ */
+                                           int mode,
+                                           const unsigned char key[32],
+                                           const void *iv, size_t iv_size) {
   gcry_error_t err;
-  gcry_cipher_hd_t *cyper_ptr;
-  unsigned char password_hash[32];
-
-  if (se->type == SOCKENT_TYPE_CLIENT) {
-    cyper_ptr = &se->data.client.cypher;
-    memcpy(password_hash, se->data.client.password_hash, sizeof(password_hash));
-  } else {
-    char *secret;
-
-    cyper_ptr = &se->data.server.cypher;
 
-    if (username == NULL)
-      return NULL;
-
-    secret = fbh_get(se->data.server.userdb, username);
-    if (secret == NULL)
+  if (*hd == NULL) {
+    err = gcry_cipher_open(hd, GCRY_CIPHER_AES256, mode, /* flags = */ 0);
+    if (err != 0) {
+      ERROR("network plugin: gcry_cipher_open returned: %s",
+            gcry_strerror(err));
+      *hd = NULL;
       return NULL;
+    }
 
-    gcry_md_hash_buffer(GCRY_MD_SHA256, password_hash, secret, strlen(secret));
-
-    sfree(secret);
-  }
-
-  if (*cyper_ptr == NULL) {
-    err = gcry_cipher_open(cyper_ptr, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_OFB,
-                           /* flags = */ 0);
+    err = gcry_cipher_setkey(*hd, key, 32);
     if (err != 0) {
-      ERROR("network plugin: gcry_cipher_open returned: %s",
+      ERROR("network plugin: gcry_cipher_setkey returned: %s",
             gcry_strerror(err));
-      *cyper_ptr = NULL;
+      gcry_cipher_close(*hd);
+      *hd = NULL;
       return NULL;
     }
   } else {
-    gcry_cipher_reset(*cyper_ptr);
+    gcry_cipher_reset(*hd);
   }
-  assert(*cyper_ptr != NULL);
 
-  err = gcry_cipher_setkey(*cyper_ptr, password_hash, sizeof(password_hash));
+  err = gcry_cipher_setiv(*hd, iv, iv_size);
   if (err != 0) {
-    ERROR("network plugin: gcry_cipher_setkey returned: %s",
+    ERROR("network plugin: gcry_cipher_setiv returned: %s",
           gcry_strerror(err));
-    gcry_cipher_close(*cyper_ptr);
-    *cyper_ptr = NULL;
+    gcry_cipher_close(*hd);
+    *hd = NULL;
     return NULL;
   }
 
-  err = gcry_cipher_setiv(*cyper_ptr, iv, iv_size);
+  return *hd;
+} /* }}} gcry_cipher_hd_t network_cipher_get */
+
+/* Returns "*hd", an HMAC-SHA-256 handle keyed with "secret". Like with
+ * network_cipher_get(), the handle is only reset after its first use. */
+static gcry_md_hd_t network_hmac_get(gcry_md_hd_t *hd, /* {{{ */
+                                     const char *secret) {
+  if (*hd != NULL) {
+    gcry_md_reset(*hd);
+    return *hd;
+  }
+
+  gcry_error_t err = gcry_md_open(hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
   if (err != 0) {
-    ERROR("network plugin: gcry_cipher_setkey returned: %s",
+    ERROR("network plugin: Creating HMAC-SHA-256 object failed: %s",
           gcry_strerror(err));
-    gcry_cipher_close(*cyper_ptr);
-    *cyper_ptr = NULL;
+    *hd = NULL;
+    return NULL;
+  }
+
+  err = gcry_md_setkey(*hd, secret, strlen(secret));
+  if (err != 0) {
+    ERROR("network plugin: gcry_md_setkey failed: %s", gcry_strerror(err));
+    gcry_md_close(*hd);
+    *hd = NULL;
+    return NULL;
+  }
+
+  return *hd;
+} /* }}} gcry_md_hd_t network_hmac_get */
+
+/* Cryptographic state of a server socket for one user. Each thread receiving
+ * packets has its own list of these, so that the handles can be used without
+ * locking. The entries are re-created when the AuthFile changes. */
+struct network_peer_s {
+  const sockent_t *se;
+  char *username;
+  char *secret;
+  uint64_t generation;
+  unsigned char key[32]; /* SHA-256 of the secret */
+  gcry_cipher_hd_t cypher;
+#if HAVE_GCRYPT_GCM
+  gcry_cipher_hd_t gcm;
+#endif
+  gcry_md_hd_t hmac;
+  struct network_peer_s *next;
+};
+typedef struct network_peer_s network_peer_t;
+
+static pthread_key_t network_peers_key;
+static pthread_once_t network_peers_once = PTHREAD_ONCE_INIT;
+
+static void network_peer_free(network_peer_t *p) /* {{{ */
+{
+  if (p->cypher != NULL)
+    gcry_cipher_close(p->cypher);
+#if HAVE_GCRYPT_GCM
+  if (p->gcm != NULL)
+    gcry_cipher_close(p->gcm);
+#endif
+  if (p->hmac != NULL)
+    gcry_md_close(p->hmac);
+  sfree(p->username);
+  sfree(p->secret);
+  sfree(p);
+} /* }}} void network_peer_free */
+
+/* Destructor of network_peers_key, called when a receive thread exits. */
+static void network_peers_free(void *arg) /* {{{ */
+{
+  network_peer_t *p = arg;
+  while (p != NULL) {
+    network_peer_t *next = p->next;
+    network_peer_free(p);
+    p = next;
+  }
+} /* }}} void network_peers_free */
+
+static void network_peers_key_create(void) {
+  pthread_key_create(&network_peers_key, network_peers_free);
+}
+
+/* Returns the calling thread's state for "username" on server socket "se", or
+ * NULL if the user is unknown. */
+static network_peer_t *network_peer_get(const sockent_t *se, /* {{{ */
+                                        const char *username) {
+  if ((se->data.server.userdb == NULL) || (username == NULL))
+    return NULL;
+
+  pthread_once(&network_peers_once, network_peers_key_create);
+  network_peer_t *head = pthread_getspecific(network_peers_key);
+  uint64_t generation = fbh_generation(se->data.server.userdb);
+
+  for (network_peer_t **p = &head; *p != NULL; p = &(*p)->next) {
+    if (((*p)->se != se) || (strcmp((*p)->username, username) != 0))
+      continue;
+    if ((*p)->generation == generation)
+      return *p;
+
+    /* The AuthFile has changed: derive the key again. */
+    network_peer_t *stale = *p;
+    *p = stale->next;
+    network_peer_free(stale);
+    break;
+  }
+
+  network_peer_t *peer = calloc(1, sizeof(*peer));
+  if (peer == NULL) {
+    pthread_setspecific(network_peers_key, head);
+    return NULL;
+  }
+  peer->se = se;
+  peer->generation = generation;
+  peer->username = strdup(username);
+  peer->secret = fbh_get(se->data.server.userdb, username);
+  if ((peer->username == NULL) || (peer->secret == NULL)) {
+    network_peer_free(peer);
+    pthread_setspecific(network_peers_key, head);
     return NULL;
   }
+  gcry_md_hash_buffer(GCRY_MD_SHA256, peer->key, peer->secret,
+                      strlen(peer->secret));
 
-  return *cyper_ptr;
-} /* }}} int network_get_aes256_cypher */
+  peer->next = head;
+  pthread_setspecific(network_peers_key, peer);
+  return peer;
+} /* }}} network_peer_t *network_peer_get */
 #endif /* HAVE_GCRYPT_H */
 
 static int write_part_values(char **ret_buffer, size_t *ret_buffer_len,
@@ -737,43 +1293,25 @@ static int write_part_string(char **ret_buffer, size_t *ret_buffer_len,
   return 0;
 } /* int write_part_string */
 
-static int parse_part_values(void **ret_buffer, size_t *ret_buffer_len,
-                             value_t **ret_values, size_t *ret_num_values) {
-  char *buffer = *ret_buffer;
-  size_t buffer_len = *ret_buffer_len;
-
+/* Returns the number of values in the values part at the start of "buffer",
+ * or zero if the part is malformed. */
+static size_t parse_part_values_num(void const *buffer, /* {{{ */
+                                    size_t buffer_len) {
   uint16_t tmp16;
-  size_t exp_size;
-
-  uint16_t pkg_length;
-  uint16_t pkg_type;
-  size_t pkg_numval;
-
-  uint8_t *pkg_types;
-  value_t *pkg_values;
 
   if (buffer_len < 15) {
     NOTICE("network plugin: packet is too short: "
            "buffer_len = %" PRIsz,
            buffer_len);
-    return -1;
+    return 0;
   }
 
-  memcpy((void *)&tmp16, buffer, sizeof(tmp16));
-  buffer += sizeof(tmp16);
-  pkg_type = ntohs(tmp16);
-
-  memcpy((void *)&tmp16, buffer, sizeof(tmp16));
-  buffer += sizeof(tmp16);
-  pkg_length = ntohs(tmp16);
-
-  memcpy((void *)&tmp16, buffer, sizeof(tmp16));
-  buffer += sizeof(tmp16);
-  pkg_numval = (size_t)ntohs(tmp16);
-
-  assert(pkg_type == TYPE_VALUES);
+  memcpy(&tmp16, (char const *)buffer + sizeof(uint16_t), sizeof(tmp16));
+  size_t pkg_length = (size_t)ntohs(tmp16);
+  memcpy(&tmp16, (char const *)buffer + 2 * sizeof(uint16_t), sizeof(tmp16));
+  size_t pkg_numval = (size_t)ntohs(tmp16);
 
-  exp_size =
+  size_t exp_size =
       3 * sizeof(uint16_t) + pkg_numval * (sizeof(uint8_t) + sizeof(value_t));
   if (buffer_len < exp_size) {
     WARNING("network plugin: parse_part_values: "
@@ -781,7 +1319,7 @@ static int parse_part_values(void **ret_buffer, size_t *ret_buffer_len,
             "Chunk of size %" PRIsz " expected, "
             "but buffer has only %" PRIsz " bytes left.",
             exp_size, buffer_len);
-    return -1;
+    return 0;
   }
   assert(pkg_numval <= ((buffer_len - 6) / 9));
 
@@ -789,103 +1327,238 @@ static int parse_part_values(void **ret_buffer, size_t *ret_buffer_len,
     WARNING("network plugin: parse_part_values: "
             "Length and number of values "
             "in the packet don't match.");
-    return -1;
+    return 0;
   }
 
-  pkg_types = calloc(pkg_numval, sizeof(*pkg_types));
-  pkg_values = calloc(pkg_numval, sizeof(*pkg_values));
-  if ((pkg_types == NULL) || (pkg_values == NULL)) {
-    sfree(pkg_types);
-    sfree(pkg_values);
-    ERROR("network plugin: parse_part_values: calloc failed.");
-    return -1;
-  }
+  return pkg_numval;
+} /* }}} size_t parse_part_values_num */
+
+/* Decodes the values part at the start of the buffer into "values", which
+ * must hold the parse_part_values_num() values of the part. */
+static int parse_part_values(void **ret_buffer, size_t *ret_buffer_len,
+                             value_t *values, size_t values_num) {
+  char *buffer = *ret_buffer;
+  size_t buffer_len = *ret_buffer_len;
+  size_t pkg_length = 3 * sizeof(uint16_t) +
+                      values_num * (sizeof(uint8_t) + sizeof(value_t));
+
+  uint8_t const *pkg_types = (uint8_t const *)buffer + 3 * sizeof(uint16_t);
+  char const *pkg_values = (char const *)(pkg_types + values_num);
+
+  assert(pkg_length <= buffer_len);
 
-  memcpy(pkg_types, buffer, pkg_numval * sizeof(*pkg_types));
-  buffer += pkg_numval * sizeof(*pkg_types);
-  memcpy(pkg_values, buffer, pkg_numval * sizeof(*pkg_values));
-  buffer += pkg_numval * sizeof(*pkg_values);
+  for (size_t i = 0; i < values_num; i++) {
+    uint64_t tmp64;
+    memcpy(&tmp64, pkg_values + i * sizeof(tmp64), sizeof(tmp64));
 
-  for (size_t i = 0; i < pkg_numval; i++) {
     switch (pkg_types[i]) {
     case DS_TYPE_COUNTER:
-      pkg_values[i].counter = (counter_t)ntohll(pkg_values[i].counter);
+      values[i].counter = (counter_t)ntohll(tmp64);
       break;
 
     case DS_TYPE_GAUGE:
-      pkg_values[i].gauge = (gauge_t)ntohd(pkg_values[i].gauge);
+      memcpy(&values[i].gauge, &tmp64, sizeof(tmp64));
+      values[i].gauge = (gauge_t)ntohd(values[i].gauge);
       break;
 
     case DS_TYPE_DERIVE:
-      pkg_values[i].derive = (derive_t)ntohll(pkg_values[i].derive);
+      values[i].derive = (derive_t)ntohll(tmp64);
       break;
 
     case DS_TYPE_ABSOLUTE:
-      pkg_values[i].absolute = (absolute_t)ntohll(pkg_values[i].absolute);
+      values[i].absolute = (absolute_t)ntohll(tmp64);
       break;
 
     default:
       NOTICE("network plugin: parse_part_values: "
              "Don't know how to handle data source type %" PRIu8,
              pkg_types[i]);
-      sfree(pkg_types);
-      sfree(pkg_values);
       return -1;
     } /* switch (pkg_types[i]) */
   }
 
-  *ret_buffer = buffer;
+  *ret_buffer = buffer + pkg_length;
   *ret_buffer_len = buffer_len - pkg_length;
-  *ret_num_values = pkg_numval;
-  *ret_values = pkg_values;
-
-  sfree(pkg_types);
 
   return 0;
 } /* int parse_part_values */
 
-static int parse_part_number(void **ret_buffer, size_t *ret_buffer_len,
-                             uint64_t *value) {
-  char *buffer = *ret_buffer;
-  size_t buffer_len = *ret_buffer_len;
+/* Computes vl->identifier like identifier_update() does, but keeps the
+ * "host/plugin[-plugin_instance]/type" prefix, whose length is stored in
+ * "prefix_len": from one value list of a packet to the next, usually only the
+ * type instance changes. */
+static void network_identifier_update(value_list_t *vl, /* {{{ */
+                                      size_t *prefix_len) {
+  char *name = vl->identifier.name;
+  size_t const name_size = sizeof(vl->identifier.name);
+
+  if (*prefix_len == 0) {
+    if (format_name(name, (int)name_size, vl->host, vl->plugin,
+                    vl->plugin_instance, vl->type,
+                    /* type_instance = */ NULL) != 0)
+      return;
+    *prefix_len = strlen(name);
+  }
 
-  uint16_t tmp16;
-  uint64_t tmp64;
-  size_t exp_size = 2 * sizeof(uint16_t) + sizeof(uint64_t);
+  size_t len = *prefix_len;
+  if (vl->type_instance[0] != 0) {
+    size_t ti_len = strlen(vl->type_instance);
+    if ((len + 1 + ti_len) >= name_size)
+      return;
+    name[len] = '-';
+    memcpy(name + len + 1, vl->type_instance, ti_len);
+    len += 1 + ti_len;
+  }
+  name[len] = 0;
 
-  uint16_t pkg_length;
+  vl->identifier.hash = identifier_hash(name);
+} /* }}} void network_identifier_update */
 
-  if (buffer_len < exp_size) {
-    WARNING("network plugin: parse_part_number: "
-            "Packet too short: "
-            "Chunk of size %" PRIsz " expected, "
-            "but buffer has only %" PRIsz " bytes left.",
-            exp_size, buffer_len);
+/* Dispatches the values part at the start of the buffer with the fields of
+ * "vl", which holds the values of the previous parts. The value list is built
+ * in a write queue entry: the values are decoded into it and the other fields
+ * are copied once. "meta" is created on first use and shared by the packet's
+ * value lists. The values are accounted to the sender in "acc", if not NULL.
+ * Returns non-zero if the part is malformed. */
+static int network_dispatch_values(value_list_t *vl, /* {{{ */
+                                   size_t *prefix_len, meta_data_t **meta,
+                                   const char *username, sender_acc_t *acc,
+                                   void **ret_buffer, size_t *ret_buffer_len) {
+  size_t values_num = parse_part_values_num(*ret_buffer, *ret_buffer_len);
+  if (values_num == 0)
     return -1;
-  }
-
-  memcpy((void *)&tmp16, buffer, sizeof(tmp16));
-  buffer += sizeof(tmp16);
-  /* pkg_type = ntohs (tmp16); */
 
-  memcpy((void *)&tmp16, buffer, sizeof(tmp16));
-  buffer += sizeof(tmp16);
-  pkg_length = ntohs(tmp16);
+  size_t part_size =
+      3 * sizeof(uint16_t) + values_num * (sizeof(uint8_t) + sizeof(value_t));
+  bool skip = false;
 
-  memcpy((void *)&tmp64, buffer, sizeof(tmp64));
-  buffer += sizeof(tmp64);
-  *value = ntohll(tmp64);
+  if ((vl->time == 0) || (vl->host[0] == 0) || (vl->plugin[0] == 0) ||
+      (vl->type[0] == 0))
+    skip = true;
 
-  *ret_buffer = buffer;
-  *ret_buffer_len = buffer_len - pkg_length;
+  if (!skip && (vl->identifier.hash == 0))
+    network_identifier_update(vl, prefix_len);
 
-  return 0;
-} /* int parse_part_number */
+  if (!skip && (acc != NULL))
+    sender_acc_add(acc, vl->identifier.hash);
 
-static int parse_part_string(void **ret_buffer, size_t *ret_buffer_len,
-                             char *output, size_t const output_len) {
-  char *buffer = *ret_buffer;
-  size_t buffer_len = *ret_buffer_len;
+  if (!skip && !check_receive_okay(vl)) {
+#if COLLECT_DEBUG
+    char name[6 * DATA_MAX_NAME_LEN];
+    FORMAT_VL(name, sizeof(name), vl);
+    name[sizeof(name) - 1] = 0;
+    DEBUG("network plugin: network_dispatch_values: "
+          "NOT dispatching %s.",
+          name);
+#endif
+    C_ATOMIC_ADD(&stats_values_not_dispatched, 1);
+    skip = true;
+  }
+
+  if (!skip && (*meta == NULL)) {
+    *meta = meta_data_create();
+    if ((*meta == NULL) ||
+        (meta_data_add_boolean(*meta, "network:received", 1) != 0) ||
+        ((username != NULL) &&
+         (meta_data_add_string(*meta, "network:username", username) != 0))) {
+      ERROR("network plugin: Creating the meta data failed.");
+      meta_data_destroy(*meta);
+      *meta = NULL;
+      skip = true;
+    }
+  }
+
+  value_list_t *e = NULL;
+  if (!skip) {
+    e = plugin_dispatch_values_reserve(values_num);
+    if (e == NULL) {
+      ERROR("network plugin: plugin_dispatch_values_reserve failed.");
+      skip = true;
+    }
+  }
+
+  if (skip) {
+    *ret_buffer = ((char *)*ret_buffer) + part_size;
+    *ret_buffer_len -= part_size;
+    return 0;
+  }
+
+  int status = parse_part_values(ret_buffer, ret_buffer_len, e->values,
+                                 values_num);
+  if (status != 0) {
+    plugin_dispatch_values_cancel(e);
+    return status;
+  }
+
+  e->time = vl->time;
+  e->interval = vl->interval;
+  sstrncpy(e->host, vl->host, sizeof(e->host));
+  sstrncpy(e->plugin, vl->plugin, sizeof(e->plugin));
+  sstrncpy(e->plugin_instance, vl->plugin_instance,
+           sizeof(e->plugin_instance));
+  sstrncpy(e->type, vl->type, sizeof(e->type));
+  sstrncpy(e->type_instance, vl->type_instance, sizeof(e->type_instance));
+  if (vl->identifier.hash != 0) {
+    sstrncpy(e->identifier.name, vl->identifier.name,
+             sizeof(e->identifier.name));
+    e->identifier.hash = vl->identifier.hash;
+  }
+
+  e->meta = meta_data_clone(*meta);
+  if (e->meta == NULL) {
+    ERROR("network plugin: meta_data_clone failed.");
+    plugin_dispatch_values_cancel(e);
+    return 0;
+  }
+
+  plugin_dispatch_values_commit(e, /* ds = */ NULL);
+  C_ATOMIC_ADD(&stats_values_dispatched, 1);
+
+  return 0;
+} /* }}} int network_dispatch_values */
+
+static int parse_part_number(void **ret_buffer, size_t *ret_buffer_len,
+                             uint64_t *value) {
+  char *buffer = *ret_buffer;
+  size_t buffer_len = *ret_buffer_len;
+
+  uint16_t tmp16;
+  uint64_t tmp64;
+  size_t exp_size = 2 * sizeof(uint16_t) + sizeof(uint64_t);
+
+  uint16_t pkg_length;
+
+  if (buffer_len < exp_size) {
+    WARNING("network plugin: parse_part_number: "
+            "Packet too short: "
+            "Chunk of size %" PRIsz " expected, "
+            "but buffer has only %" PRIsz " bytes left.",
+            exp_size, buffer_len);
+    return -1;
+  }
+
+  memcpy((void *)&tmp16, buffer, sizeof(tmp16));
+  buffer += sizeof(tmp16);
+  /* pkg_type = ntohs (tmp16); */
+
+  memcpy((void *)&tmp16, buffer, sizeof(tmp16));
+  buffer += sizeof(tmp16);
+  pkg_length = ntohs(tmp16);
+
+  memcpy((void *)&tmp64, buffer, sizeof(tmp64));
+  buffer += sizeof(tmp64);
+  *value = ntohll(tmp64);
+
+  *ret_buffer = buffer;
+  *ret_buffer_len = buffer_len - pkg_length;
+
+  return 0;
+} /* int parse_part_number */
+
+static int parse_part_string(void **ret_buffer, size_t *ret_buffer_len,
+                             char *output, size_t const output_len) {
+  char *buffer = *ret_buffer;
+  size_t buffer_len = *ret_buffer_len;
 
   uint16_t tmp16;
   size_t const header_size = 2 * sizeof(uint16_t);
@@ -966,12 +1639,20 @@ static int parse_part_string(void **ret_buffer, size_t *ret_buffer_len,
   return 0;
 } /* int parse_part_string */
 
-/* Forward declaration: parse_part_sign_sha256 and parse_part_encr_aes256 call
- * parse_packet and vice versa. */
+/* Forward declaration: parse_part_sign_sha256, parse_part_encr_aes256 and
+ * parse_part_compr_zlib call parse_packet and vice versa. */
 #define PP_SIGNED 0x01
 #define PP_ENCRYPTED 0x02
+#define PP_COMPRESSED 0x04
 static int parse_packet(sockent_t *se, void *buffer, size_t buffer_size,
-                        int flags, const char *username);
+                        int flags, const char *username, sender_acc_t *acc,
+                        proxy_buffer_t *proxy);
+/* With "Proxy", parse_packet() hands the parts to proxy_buffer_add() instead
+ * of dispatching them, and proxy_buffer_send() sends the rest at the end of
+ * the packet. */
+static int proxy_buffer_add(proxy_buffer_t *p, uint16_t type,
+                            void const *part, size_t part_size);
+static void proxy_buffer_send(proxy_buffer_t *p);
 
 #define BUFFER_READ(p, s)                                                      \
   do {                                                                         \
@@ -982,7 +1663,8 @@ static int parse_packet(sockent_t *se, void *buffer, size_t buffer_size,
 #if HAVE_GCRYPT_H
 static int parse_part_sign_sha256(sockent_t *se, /* {{{ */
                                   void **ret_buffer, size_t *ret_buffer_len,
-                                  int flags) {
+                                  int flags, sender_acc_t *acc,
+                                  proxy_buffer_t *proxy) {
   static c_complain_t complain_no_users = C_COMPLAIN_INIT_STATIC;
 
   char *buffer;
@@ -990,14 +1672,12 @@ static int parse_part_sign_sha256(sockent_t *se, /* {{{ */
   size_t buffer_offset;
 
   size_t username_len;
-  char *secret;
 
   part_signature_sha256_t pss;
   uint16_t pss_head_length;
   char hash[sizeof(pss.hash)];
 
   gcry_md_hd_t hd;
-  gcry_error_t err;
   unsigned char *hash_ptr;
 
   buffer = *ret_buffer;
@@ -1047,30 +1727,16 @@ static int parse_part_sign_sha256(sockent_t *se, /* {{{ */
 
   assert(buffer_offset == pss_head_length);
 
-  /* Query the password */
-  secret = fbh_get(se->data.server.userdb, pss.username);
-  if (secret == NULL) {
+  /* Look up the password and the HMAC handle keyed with it */
+  network_peer_t *peer = network_peer_get(se, pss.username);
+  if (peer == NULL) {
     ERROR("network plugin: Unknown user: %s", pss.username);
     sfree(pss.username);
     return -ENOENT;
   }
 
-  /* Create a hash device and check the HMAC */
-  hd = NULL;
-  err = gcry_md_open(&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
-  if (err != 0) {
-    ERROR("network plugin: Creating HMAC-SHA-256 object failed: %s",
-          gcry_strerror(err));
-    sfree(secret);
-    sfree(pss.username);
-    return -1;
-  }
-
-  err = gcry_md_setkey(hd, secret, strlen(secret));
-  if (err != 0) {
-    ERROR("network plugin: gcry_md_setkey failed: %s", gcry_strerror(err));
-    gcry_md_close(hd);
-    sfree(secret);
+  hd = network_hmac_get(&peer->hmac, peer->secret);
+  if (hd == NULL) {
     sfree(pss.username);
     return -1;
   }
@@ -1080,27 +1746,20 @@ static int parse_part_sign_sha256(sockent_t *se, /* {{{ */
   hash_ptr = gcry_md_read(hd, GCRY_MD_SHA256);
   if (hash_ptr == NULL) {
     ERROR("network plugin: gcry_md_read failed.");
-    gcry_md_close(hd);
-    sfree(secret);
     sfree(pss.username);
     return -1;
   }
   memcpy(hash, hash_ptr, sizeof(hash));
 
-  /* Clean up */
-  gcry_md_close(hd);
-  hd = NULL;
-
   if (memcmp(pss.hash, hash, sizeof(pss.hash)) != 0) {
     WARNING("network plugin: Verifying HMAC-SHA-256 signature failed: "
             "Hash mismatch. Username: %s",
             pss.username);
   } else {
     parse_packet(se, buffer + buffer_offset, buffer_len - buffer_offset,
-                 flags | PP_SIGNED, pss.username);
+                 flags | PP_SIGNED, pss.username, acc, proxy);
   }
 
-  sfree(secret);
   sfree(pss.username);
 
   *ret_buffer = buffer + buffer_len;
@@ -1113,7 +1772,8 @@ static int parse_part_sign_sha256(sockent_t *se, /* {{{ */
 #else  /* if !HAVE_GCRYPT_H */
 static int parse_part_sign_sha256(sockent_t *se, /* {{{ */
                                   void **ret_buffer, size_t *ret_buffer_size,
-                                  int flags) {
+                                  int flags, sender_acc_t *acc,
+                                  proxy_buffer_t *proxy) {
   static int warning_has_been_printed;
 
   char *buffer;
@@ -1145,7 +1805,7 @@ static int parse_part_sign_sha256(sockent_t *se, /* {{{ */
   }
 
   parse_packet(se, buffer + part_len, buffer_size - part_len, flags,
-               /* username = */ NULL);
+               /* username = */ NULL, acc, proxy);
 
   *ret_buffer = buffer + buffer_size;
   *ret_buffer_size = 0;
@@ -1157,7 +1817,8 @@ static int parse_part_sign_sha256(sockent_t *se, /* {{{ */
 #if HAVE_GCRYPT_H
 static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
                                   void **ret_buffer, size_t *ret_buffer_len,
-                                  int flags) {
+                                  int flags, sender_acc_t *acc,
+                                  proxy_buffer_t *proxy) {
   char *buffer = *ret_buffer;
   size_t buffer_len = *ret_buffer_len;
   size_t payload_len;
@@ -1216,7 +1877,11 @@ static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
   assert(buffer_offset ==
          (username_len + PART_ENCRYPTION_AES256_SIZE - sizeof(pea.hash)));
 
-  cypher = network_get_aes256_cypher(se, pea.iv, sizeof(pea.iv), pea.username);
+  network_peer_t *peer = network_peer_get(se, pea.username);
+  cypher = (peer == NULL) ? NULL
+                          : network_cipher_get(&peer->cypher,
+                                               GCRY_CIPHER_MODE_OFB, peer->key,
+                                               pea.iv, sizeof(pea.iv));
   if (cypher == NULL) {
     ERROR("network plugin: Failed to get cypher. Username: %s", pea.username);
     sfree(pea.username);
@@ -1253,7 +1918,7 @@ static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
   }
 
   parse_packet(se, buffer + buffer_offset, payload_len, flags | PP_ENCRYPTED,
-               pea.username);
+               pea.username, acc, proxy);
 
   /* Update return values */
   *ret_buffer = buffer + part_size;
@@ -1263,12 +1928,91 @@ static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
 
   return 0;
 } /* }}} int parse_part_encr_aes256 */
+
+#if HAVE_GCRYPT_GCM
+static int parse_part_encr_aes256_gcm(sockent_t *se, /* {{{ */
+                                      void **ret_buffer, size_t *ret_buffer_len,
+                                      int flags, sender_acc_t *acc,
+                                      proxy_buffer_t *proxy) {
+  char *buffer = *ret_buffer;
+  size_t buffer_len = *ret_buffer_len;
+  part_header_t ph;
+  uint16_t username_len;
+
+  if (buffer_len <= PART_ENCRYPTION_AES256_GCM_SIZE) {
+    NOTICE("network plugin: parse_part_encr_aes256_gcm: "
+           "Discarding short packet.");
+    return -1;
+  }
+
+  memcpy(&ph, buffer, sizeof(ph));
+  size_t part_size = ntohs(ph.length);
+  memcpy(&username_len, buffer + sizeof(ph), sizeof(username_len));
+  username_len = ntohs(username_len);
+
+  if ((part_size <= PART_ENCRYPTION_AES256_GCM_SIZE) ||
+      (part_size > buffer_len) || (username_len == 0) ||
+      (username_len >= (part_size - PART_ENCRYPTION_AES256_GCM_SIZE))) {
+    NOTICE("network plugin: parse_part_encr_aes256_gcm: "
+           "Discarding part with invalid size.");
+    return -1;
+  }
+
+  /* Everything up to the IV is authenticated, but not encrypted. */
+  size_t aad_size = sizeof(ph) + sizeof(username_len) + username_len;
+  char *iv = buffer + aad_size;
+  char *payload = iv + PART_ENCRYPTION_AES256_GCM_IV_SIZE;
+  size_t payload_len = part_size - (PART_ENCRYPTION_AES256_GCM_SIZE +
+                                    (size_t)username_len);
+  char *tag = payload + payload_len;
+
+  char username[username_len + 1];
+  memcpy(username, buffer + sizeof(ph) + sizeof(username_len), username_len);
+  username[username_len] = 0;
+
+  network_peer_t *peer = network_peer_get(se, username);
+  gcry_cipher_hd_t cypher =
+      (peer == NULL)
+          ? NULL
+          : network_cipher_get(&peer->gcm, GCRY_CIPHER_MODE_GCM, peer->key, iv,
+                               PART_ENCRYPTION_AES256_GCM_IV_SIZE);
+  if (cypher == NULL) {
+    ERROR("network plugin: Failed to get cypher. Username: %s", username);
+    return -1;
+  }
+
+  gcry_error_t err = gcry_cipher_authenticate(cypher, buffer, aad_size);
+  if (err == 0)
+    err = gcry_cipher_decrypt(cypher, payload, payload_len,
+                              /* in = */ NULL, /* in len = */ 0);
+  if (err == 0)
+    err = gcry_cipher_checktag(cypher, tag,
+                               PART_ENCRYPTION_AES256_GCM_TAG_SIZE);
+  if (err != 0) {
+    ERROR("network plugin: Decrypting AES-256-GCM part failed: %s. "
+          "Username: %s",
+          gcry_strerror(err), username);
+    return -1;
+  }
+
+  parse_packet(se, payload, payload_len, flags | PP_ENCRYPTED, username, acc,
+               proxy);
+
+  *ret_buffer = buffer + part_size;
+  *ret_buffer_len = buffer_len - part_size;
+
+  return 0;
+} /* }}} int parse_part_encr_aes256_gcm */
+#endif /* HAVE_GCRYPT_GCM */
 /* #endif HAVE_GCRYPT_H */
 
 #else  /* if !HAVE_GCRYPT_H */
 static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
                                   void **ret_buffer, size_t *ret_buffer_size,
-                                  int flags) {
+                                  int flags,
+                                  sender_acc_t __attribute__((unused)) * acc,
+                                  proxy_buffer_t __attribute__((unused)) *
+                                      proxy) {
   static int warning_has_been_printed;
 
   char *buffer;
@@ -1311,12 +2055,65 @@ static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
 
 #undef BUFFER_READ
 
+#if HAVE_LIBZ
+static int parse_part_compr_zlib(sockent_t *se, /* {{{ */
+                                 void **ret_buffer, size_t *ret_buffer_size,
+                                 int flags, const char *username,
+                                 sender_acc_t *acc, proxy_buffer_t *proxy) {
+  char *buffer = *ret_buffer;
+  part_header_t ph;
+  uint32_t raw_size;
+  size_t const header_size = sizeof(ph) + sizeof(raw_size);
+
+  memcpy(&ph, buffer, sizeof(ph));
+  size_t part_len = (size_t)ntohs(ph.length);
+  if ((part_len <= header_size) || (part_len > *ret_buffer_size))
+    return EINVAL;
+
+  memcpy(&raw_size, buffer + sizeof(ph), sizeof(raw_size));
+  raw_size = ntohl(raw_size);
+
+  *ret_buffer = buffer + part_len;
+  *ret_buffer_size -= part_len;
+
+  /* A compressed part inside a compressed part could be made to expand to
+   * many times NETWORK_COMPRESS_MAX_SIZE. Senders never do this. */
+  if ((flags & PP_COMPRESSED) || (raw_size == 0) ||
+      (raw_size > NETWORK_COMPRESS_MAX_SIZE))
+    return EINVAL;
+
+  char *raw = malloc(raw_size);
+  if (raw == NULL) {
+    ERROR("network plugin: malloc failed.");
+    return ENOMEM;
+  }
+
+  uLongf raw_len = (uLongf)raw_size;
+  int status = uncompress((Bytef *)raw, &raw_len,
+                          (Bytef const *)(buffer + header_size),
+                          (uLong)(part_len - header_size));
+  if ((status != Z_OK) || (raw_len != (uLongf)raw_size)) {
+    sfree(raw);
+    return EINVAL;
+  }
+
+  parse_packet(se, raw, (size_t)raw_len, flags | PP_COMPRESSED, username,
+               acc, proxy);
+
+  sfree(raw);
+  return 0;
+} /* }}} int parse_part_compr_zlib */
+#endif /* HAVE_LIBZ */
+
 static int parse_packet(sockent_t *se, /* {{{ */
                         void *buffer, size_t buffer_size, int flags,
-                        const char *username) {
+                        const char *username, sender_acc_t *acc,
+                        proxy_buffer_t *proxy) {
   int status;
 
   value_list_t vl = VALUE_LIST_INIT;
+  size_t ident_prefix_len = 0;
+  meta_data_t *meta = NULL;
   notification_t n = {0};
 
 #if HAVE_GCRYPT_H
@@ -1328,6 +2125,7 @@ static int parse_packet(sockent_t *se, /* {{{ */
   memset(&vl, '\0', sizeof(vl));
   status = 0;
 
+  C_PROBE2(network__parse__start, buffer_size, flags);
   while ((status == 0) && (0 < buffer_size) &&
          ((unsigned int)buffer_size > sizeof(part_header_t))) {
     uint16_t pkg_length;
@@ -1347,7 +2145,8 @@ static int parse_packet(sockent_t *se, /* {{{ */
       break;
 
     if (pkg_type == TYPE_ENCR_AES256) {
-      status = parse_part_encr_aes256(se, &buffer, &buffer_size, flags);
+      status = parse_part_encr_aes256(se, &buffer, &buffer_size, flags, acc,
+                                      proxy);
       if (status != 0) {
         ERROR("network plugin: Decrypting AES256 "
               "part failed "
@@ -1355,6 +2154,24 @@ static int parse_packet(sockent_t *se, /* {{{ */
               status);
         break;
       }
+    } else if (pkg_type == TYPE_ENCR_AES256_GCM) {
+#if HAVE_GCRYPT_GCM
+      status = parse_part_encr_aes256_gcm(se, &buffer, &buffer_size, flags,
+                                          acc, proxy);
+      if (status != 0) {
+        ERROR("network plugin: Decrypting AES-256-GCM part failed "
+              "with status %i.",
+              status);
+        break;
+      }
+#else
+      static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+      c_complain(LOG_NOTICE, &complaint,
+                 "network plugin: Ignoring AES-256-GCM encrypted part: "
+                 "libgcrypt 1.6.0 or later is required to decrypt it.");
+      buffer = ((char *)buffer) + pkg_length;
+      buffer_size -= (size_t)pkg_length;
+#endif
     }
 #if HAVE_GCRYPT_H
     else if ((se->data.server.security_level == SECURITY_LEVEL_ENCRYPT) &&
@@ -1370,7 +2187,8 @@ static int parse_packet(sockent_t *se, /* {{{ */
     }
 #endif /* HAVE_GCRYPT_H */
     else if (pkg_type == TYPE_SIGN_SHA256) {
-      status = parse_part_sign_sha256(se, &buffer, &buffer_size, flags);
+      status = parse_part_sign_sha256(se, &buffer, &buffer_size, flags, acc,
+                                      proxy);
       if (status != 0) {
         ERROR("network plugin: Verifying HMAC-SHA-256 "
               "signature failed "
@@ -1392,15 +2210,35 @@ static int parse_packet(sockent_t *se, /* {{{ */
       continue;
     }
 #endif /* HAVE_GCRYPT_H */
-    else if (pkg_type == TYPE_VALUES) {
-      status =
-          parse_part_values(&buffer, &buffer_size, &vl.values, &vl.values_len);
+    else if (pkg_type == TYPE_COMPR_ZLIB) {
+#if HAVE_LIBZ
+      status = parse_part_compr_zlib(se, &buffer, &buffer_size, flags,
+                                     username, acc, proxy);
+      if (status != 0) {
+        ERROR("network plugin: Decompressing zlib part failed "
+              "with status %i.",
+              status);
+        break;
+      }
+#else
+      static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+      c_complain(LOG_NOTICE, &complaint,
+                 "network plugin: Ignoring compressed part: "
+                 "zlib support has not been compiled in.");
+      buffer = ((char *)buffer) + pkg_length;
+      buffer_size -= (size_t)pkg_length;
+#endif
+    } else if (proxy != NULL) {
+      status = proxy_buffer_add(proxy, pkg_type, buffer, pkg_length);
+      if (status != 0)
+        break;
+      buffer = ((char *)buffer) + pkg_length;
+      buffer_size -= (size_t)pkg_length;
+    } else if (pkg_type == TYPE_VALUES) {
+      status = network_dispatch_values(&vl, &ident_prefix_len, &meta,
+                                       username, acc, &buffer, &buffer_size);
       if (status != 0)
         break;
-
-      network_dispatch_values(&vl, username);
-
-      sfree(vl.values);
     } else if (pkg_type == TYPE_TIME) {
       uint64_t tmp = 0;
       status = parse_part_number(&buffer, &buffer_size, &tmp);
@@ -1425,28 +2263,36 @@ static int parse_packet(sockent_t *se, /* {{{ */
       status = parse_part_number(&buffer, &buffer_size, &tmp);
       if (status == 0)
         vl.interval = (cdtime_t)tmp;
-    } else if (pkg_type == TYPE_HOST) {
-      status =
-          parse_part_string(&buffer, &buffer_size, vl.host, sizeof(vl.host));
-      if (status == 0)
-        sstrncpy(n.host, vl.host, sizeof(n.host));
-    } else if (pkg_type == TYPE_PLUGIN) {
-      status = parse_part_string(&buffer, &buffer_size, vl.plugin,
-                                 sizeof(vl.plugin));
-      if (status == 0)
-        sstrncpy(n.plugin, vl.plugin, sizeof(n.plugin));
-    } else if (pkg_type == TYPE_PLUGIN_INSTANCE) {
-      status = parse_part_string(&buffer, &buffer_size, vl.plugin_instance,
-                                 sizeof(vl.plugin_instance));
-      if (status == 0)
-        sstrncpy(n.plugin_instance, vl.plugin_instance,
-                 sizeof(n.plugin_instance));
-    } else if (pkg_type == TYPE_TYPE) {
-      status =
-          parse_part_string(&buffer, &buffer_size, vl.type, sizeof(vl.type));
-      if (status == 0)
-        sstrncpy(n.type, vl.type, sizeof(n.type));
+    } else if ((pkg_type == TYPE_HOST) || (pkg_type == TYPE_PLUGIN) ||
+               (pkg_type == TYPE_PLUGIN_INSTANCE) || (pkg_type == TYPE_TYPE)) {
+      /* The identifier's prefix has to be formatted again. */
+      vl.identifier.hash = 0;
+      ident_prefix_len = 0;
+
+      if (pkg_type == TYPE_HOST) {
+        status =
+            parse_part_string(&buffer, &buffer_size, vl.host, sizeof(vl.host));
+        if (status == 0)
+          sstrncpy(n.host, vl.host, sizeof(n.host));
+      } else if (pkg_type == TYPE_PLUGIN) {
+        status = parse_part_string(&buffer, &buffer_size, vl.plugin,
+                                   sizeof(vl.plugin));
+        if (status == 0)
+          sstrncpy(n.plugin, vl.plugin, sizeof(n.plugin));
+      } else if (pkg_type == TYPE_PLUGIN_INSTANCE) {
+        status = parse_part_string(&buffer, &buffer_size, vl.plugin_instance,
+                                   sizeof(vl.plugin_instance));
+        if (status == 0)
+          sstrncpy(n.plugin_instance, vl.plugin_instance,
+                   sizeof(n.plugin_instance));
+      } else /* if (pkg_type == TYPE_TYPE) */ {
+        status =
+            parse_part_string(&buffer, &buffer_size, vl.type, sizeof(vl.type));
+        if (status == 0)
+          sstrncpy(n.type, vl.type, sizeof(n.type));
+      }
     } else if (pkg_type == TYPE_TYPE_INSTANCE) {
+      vl.identifier.hash = 0;
       status = parse_part_string(&buffer, &buffer_size, vl.type_instance,
                                  sizeof(vl.type_instance));
       if (status == 0)
@@ -1488,10 +2334,13 @@ static int parse_packet(sockent_t *se, /* {{{ */
     }
   } /* while (buffer_size > sizeof (part_header_t)) */
 
+  meta_data_destroy(meta);
+
   if (status == 0 && buffer_size > 0)
     WARNING("network plugin: parse_packet: Received truncated "
             "packet, try increasing `MaxPacketSize'");
 
+  C_PROBE1(network__parse__done, status);
   return status;
 } /* }}} int parse_packet */
 
@@ -1508,6 +2357,12 @@ static void free_sockent_client(struct sockent_client *sec) /* {{{ */
   sfree(sec->password);
   if (sec->cypher != NULL)
     gcry_cipher_close(sec->cypher);
+  if (sec->hmac != NULL)
+    gcry_md_close(sec->hmac);
+#if HAVE_GCRYPT_GCM
+  if (sec->gcm != NULL)
+    gcry_cipher_close(sec->gcm);
+#endif
 #endif
 } /* }}} void free_sockent_client */
 
@@ -1521,11 +2376,10 @@ static void free_sockent_server(struct sockent_server *ses) /* {{{ */
   }
 
   sfree(ses->fd);
+  sfree(ses->interfaces);
 #if HAVE_GCRYPT_H
   sfree(ses->auth_file);
   fbh_destroy(ses->userdb);
-  if (ses->cypher != NULL)
-    gcry_cipher_close(ses->cypher);
 #endif
 } /* }}} void free_sockent_server */
 
@@ -1721,8 +2575,19 @@ static int network_bind_socket_to_addr(sockent_t *se,
   return 0;
 } /* int network_bind_socket_to_addr */
 
+static bool network_addr_is_multicast(const struct addrinfo *ai) {
+  if (ai->ai_family == AF_INET) {
+    struct sockaddr_in *addr = (struct sockaddr_in *)ai->ai_addr;
+    return IN_MULTICAST(ntohl(addr->sin_addr.s_addr));
+  } else if (ai->ai_family == AF_INET6) {
+    struct sockaddr_in6 *addr = (struct sockaddr_in6 *)ai->ai_addr;
+    return IN6_IS_ADDR_MULTICAST(&addr->sin6_addr);
+  }
+  return false;
+} /* bool network_addr_is_multicast */
+
 static int network_bind_socket(int fd, const struct addrinfo *ai,
-                               const int interface_idx) {
+                               const int interface_idx, bool reuse_port) {
 #if KERNEL_SOLARIS
   char loop = 0;
 #else
@@ -1736,6 +2601,18 @@ static int network_bind_socket(int fd, const struct addrinfo *ai,
     return -1;
   }
 
+#ifdef SO_REUSEPORT
+  /* let the kernel distribute the datagrams over the receive threads'
+   * sockets */
+  if (reuse_port &&
+      (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1)) {
+    ERROR("network plugin: setsockopt (reuseport): %s", STRERRNO);
+    return -1;
+  }
+#else
+  assert(!reuse_port);
+#endif
+
   DEBUG("fd = %i; calling `bind'", fd);
 
   if (bind(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
@@ -1777,6 +2654,15 @@ static int network_bind_socket(int fd, const struct addrinfo *ai,
         return -1;
       }
 
+#ifdef IP_MULTICAST_ALL
+      /* Linux delivers the packets of all groups joined by any socket on the
+       * host to every socket bound to the port. Only receive the group
+       * joined here, on the interface it was joined on. */
+      int no = 0;
+      if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &no, sizeof(no)) == -1)
+        WARNING("network plugin: setsockopt (multicast-all): %s", STRERRNO);
+#endif
+
       return 0;
     }
   } else if (ai->ai_family == AF_INET6) {
@@ -1813,6 +2699,15 @@ static int network_bind_socket(int fd, const struct addrinfo *ai,
         return -1;
       }
 
+#ifdef IPV6_MULTICAST_ALL
+      /* See IP_MULTICAST_ALL above. */
+      int no = 0;
+      if (setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &no, sizeof(no)) ==
+          -1)
+        WARNING("network plugin: setsockopt (ipv6-multicast-all): %s",
+                STRERRNO);
+#endif
+
       return 0;
     }
   }
@@ -1858,6 +2753,7 @@ static sockent_t *sockent_create(int type) /* {{{ */
   se->node = NULL;
   se->service = NULL;
   se->interface = 0;
+  se->socktype = SOCK_DGRAM;
   se->next = NULL;
 
   if (type == SOCKENT_TYPE_SERVER) {
@@ -1867,7 +2763,6 @@ static sockent_t *sockent_create(int type) /* {{{ */
     se->data.server.security_level = SECURITY_LEVEL_NONE;
     se->data.server.auth_file = NULL;
     se->data.server.userdb = NULL;
-    se->data.server.cypher = NULL;
 #endif
   } else {
     se->data.client.fd = -1;
@@ -1875,11 +2770,16 @@ static sockent_t *sockent_create(int type) /* {{{ */
     se->data.client.bind_addr = NULL;
     se->data.client.resolve_interval = 0;
     se->data.client.next_resolve_reconnect = 0;
+    se->data.client.next_connect = 0;
 #if HAVE_GCRYPT_H
     se->data.client.security_level = SECURITY_LEVEL_NONE;
     se->data.client.username = NULL;
     se->data.client.password = NULL;
     se->data.client.cypher = NULL;
+    se->data.client.hmac = NULL;
+#if HAVE_GCRYPT_GCM
+    se->data.client.gcm = NULL;
+#endif
 #endif
   }
 
@@ -1907,6 +2807,11 @@ static int sockent_init_crypto(sockent_t *se) /* {{{ */
       gcry_md_hash_buffer(GCRY_MD_SHA256, se->data.client.password_hash,
                           se->data.client.password,
                           strlen(se->data.client.password));
+#if HAVE_GCRYPT_GCM
+      gcry_create_nonce(se->data.client.gcm_iv_prefix,
+                        sizeof(se->data.client.gcm_iv_prefix));
+      se->data.client.gcm_counter = 0;
+#endif
     }
   } else /* (se->type == SOCKENT_TYPE_SERVER) */
   {
@@ -1956,9 +2861,58 @@ static int sockent_client_disconnect(sockent_t *se) /* {{{ */
   return 0;
 } /* }}} int sockent_client_disconnect */
 
+/* Connects the stream socket "fd" to "ai", waiting at most
+ * NETWORK_STREAM_TIMEOUT, and sets the same timeout for sending. Returns zero
+ * or an errno value. */
+static int network_stream_connect(int fd, const struct addrinfo *ai) /* {{{ */
+{
+  int flags = fcntl(fd, F_GETFL);
+  if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0))
+    return errno;
+
+  int status = connect(fd, ai->ai_addr, ai->ai_addrlen);
+  if ((status != 0) && (errno == EINPROGRESS)) {
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+
+    do
+      status = poll(&pfd, 1, (int)CDTIME_T_TO_MS(NETWORK_STREAM_TIMEOUT));
+    while ((status < 0) && (errno == EINTR));
+
+    if (status == 0)
+      return ETIMEDOUT;
+    else if (status < 0)
+      return errno;
+    else if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0)
+      return errno;
+    else if (err != 0)
+      return err;
+  } else if (status != 0) {
+    return errno;
+  }
+
+  if (fcntl(fd, F_SETFL, flags) != 0)
+    return errno;
+
+  struct timeval tv = CDTIME_T_TO_TIMEVAL(NETWORK_STREAM_TIMEOUT);
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0)
+    return errno;
+
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
+#ifdef TCP_NODELAY
+  /* Packets are written in batches, there is nothing to wait for. */
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+#endif
+
+  return 0;
+} /* }}} int network_stream_connect */
+
 static int sockent_client_connect(sockent_t *se) /* {{{ */
 {
   static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+  static c_complain_t connect_complaint = C_COMPLAIN_INIT_STATIC;
 
   struct sockent_client *client;
   struct addrinfo *ai_list;
@@ -1983,10 +2937,15 @@ static int sockent_client_connect(sockent_t *se) /* {{{ */
   if (client->fd >= 0 && !reconnect) /* already connected and not stale*/
     return 0;
 
+  bool stream = (se->socktype == SOCK_STREAM);
+  /* Don't try to connect to an unreachable server for each packet. */
+  if (stream && (client->fd < 0) && (now < client->next_connect))
+    return -1;
+
   struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
                               .ai_flags = AI_ADDRCONFIG,
-                              .ai_protocol = IPPROTO_UDP,
-                              .ai_socktype = SOCK_DGRAM};
+                              .ai_protocol = stream ? IPPROTO_TCP : IPPROTO_UDP,
+                              .ai_socktype = se->socktype};
 
   status = getaddrinfo(se->node,
                        (se->service != NULL) ? se->service : NET_DEFAULT_PORT,
@@ -2030,14 +2989,30 @@ static int sockent_client_connect(sockent_t *se) /* {{{ */
     network_set_interface(se, ai_ptr);
     network_bind_socket_to_addr(se, ai_ptr);
 
+    if (stream) {
+      status = network_stream_connect(client->fd, ai_ptr);
+      if (status != 0) {
+        c_complain(LOG_ERR, &connect_complaint,
+                   "network plugin: Connecting to \"%s\" failed: %s",
+                   se->node, STRERROR(status));
+        sockent_client_disconnect(se);
+        continue;
+      }
+      c_release(LOG_NOTICE, &connect_complaint,
+                "network plugin: Successfully connected to \"%s\".",
+                se->node);
+    }
+
     /* We don't open more than one write-socket per
      * node/service pair.. */
     break;
   }
 
   freeaddrinfo(ai_list);
-  if (client->fd < 0)
+  if (client->fd < 0) {
+    client->next_connect = now + NETWORK_STREAM_RECONNECT_INTERVAL;
     return -1;
+  }
 
   if (client->resolve_interval > 0)
     client->next_resolve_reconnect = now + client->resolve_interval;
@@ -2068,10 +3043,11 @@ static int sockent_server_listen(sockent_t *se) /* {{{ */
   DEBUG("network plugin: sockent_server_listen: node = %s; service = %s;", node,
         service);
 
+  bool stream = (se->socktype == SOCK_STREAM);
   struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
                               .ai_flags = AI_ADDRCONFIG | AI_PASSIVE,
-                              .ai_protocol = IPPROTO_UDP,
-                              .ai_socktype = SOCK_DGRAM};
+                              .ai_protocol = stream ? IPPROTO_TCP : IPPROTO_UDP,
+                              .ai_socktype = se->socktype};
 
   status = getaddrinfo(node, service, &ai_hints, &ai_list);
   if (status != 0) {
@@ -2083,32 +3059,70 @@ static int sockent_server_listen(sockent_t *se) /* {{{ */
 
   for (struct addrinfo *ai_ptr = ai_list; ai_ptr != NULL;
        ai_ptr = ai_ptr->ai_next) {
-    int *tmp;
-
-    tmp = realloc(se->data.server.fd,
-                  sizeof(*tmp) * (se->data.server.fd_num + 1));
-    if (tmp == NULL) {
-      ERROR("network plugin: realloc failed.");
+    if (stream && network_addr_is_multicast(ai_ptr)) {
+      ERROR("network plugin: Multicast addresses can't be used with "
+            "\"Protocol TCP\".");
       continue;
     }
-    se->data.server.fd = tmp;
-    tmp = se->data.server.fd + se->data.server.fd_num;
 
-    *tmp = socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
-    if (*tmp < 0) {
-      ERROR("network plugin: socket(2) failed: %s", STRERRNO);
-      continue;
-    }
+    /* With "ReceiveThreads", open one socket per thread. Every socket that
+     * joined a multicast group would receive a copy of each packet, so
+     * multicast addresses always get a single socket. For TCP, the kernel
+     * distributes the connections over the sockets. */
+    size_t sockets_num = 1;
+    if ((network_config_receive_threads > 1) &&
+        !network_addr_is_multicast(ai_ptr))
+      sockets_num = network_config_receive_threads;
+
+    /* With several interfaces, each gets its own sockets: a multicast socket
+     * joins the group on its interface only, a unicast socket is bound to
+     * it. The sockets of an interface are opened one after another, so that
+     * receive_workers_create() assigns them to different threads. */
+    size_t interfaces_num = se->data.server.interfaces_num;
+    if (interfaces_num == 0)
+      interfaces_num = 1;
+
+    for (size_t i = 0; i < interfaces_num * sockets_num; i++) {
+      int interface = se->interface;
+      if (se->data.server.interfaces_num > 0)
+        interface = se->data.server.interfaces[i / sockets_num];
+
+      int *tmp;
+
+      tmp = realloc(se->data.server.fd,
+                    sizeof(*tmp) * (se->data.server.fd_num + 1));
+      if (tmp == NULL) {
+        ERROR("network plugin: realloc failed.");
+        break;
+      }
+      se->data.server.fd = tmp;
+      tmp = se->data.server.fd + se->data.server.fd_num;
 
-    status = network_bind_socket(*tmp, ai_ptr, se->interface);
-    if (status != 0) {
-      close(*tmp);
-      *tmp = -1;
-      continue;
-    }
+      *tmp =
+          socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+      if (*tmp < 0) {
+        ERROR("network plugin: socket(2) failed: %s", STRERRNO);
+        break;
+      }
 
-    se->data.server.fd_num++;
-    continue;
+      status = network_bind_socket(*tmp, ai_ptr, interface,
+                                   /* reuse_port = */ sockets_num > 1);
+      if ((status == 0) && stream) {
+        int flags = fcntl(*tmp, F_GETFL);
+        if ((listen(*tmp, SOMAXCONN) != 0) || (flags < 0) ||
+            (fcntl(*tmp, F_SETFL, flags | O_NONBLOCK) != 0)) {
+          ERROR("network plugin: listen(2) failed: %s", STRERRNO);
+          status = -1;
+        }
+      }
+      if (status != 0) {
+        close(*tmp);
+        *tmp = -1;
+        break;
+      }
+
+      se->data.server.fd_num++;
+    }
   } /* for (ai_list) */
 
   freeaddrinfo(ai_list);
@@ -2126,7 +3140,14 @@ static int sockent_add(sockent_t *se) /* {{{ */
   if (se == NULL)
     return -1;
 
-  if (se->type == SOCKENT_TYPE_SERVER) {
+  if ((se->type == SOCKENT_TYPE_SERVER) && (se->socktype == SOCK_STREAM)) {
+    stream_listen_sockets_num += se->data.server.fd_num;
+    if (stream_listen_sockets == NULL) {
+      stream_listen_sockets = se;
+      return 0;
+    }
+    last_ptr = stream_listen_sockets;
+  } else if (se->type == SOCKENT_TYPE_SERVER) {
     struct pollfd *tmp;
 
     tmp = realloc(listen_sockets_pollfd,
@@ -2168,23 +3189,58 @@ static int sockent_add(sockent_t *se) /* {{{ */
   return 0;
 } /* }}} int sockent_add */
 
-static void *dispatch_thread(void __attribute__((unused)) * arg) /* {{{ */
+/* Parses a packet received from "addr", accounting it to the sender if
+ * "SenderTopK" is enabled. With "Proxy", the packet's parts are sent to the
+ * servers rather than dispatched. */
+static void network_receive_packet(sockent_t *se, /* {{{ */
+                                   struct sockaddr_storage const *addr,
+                                   void *buffer, size_t buffer_size) {
+  sender_acc_t acc;
+  sender_acc_t *acc_ptr = NULL;
+  if (sender_shards != NULL) {
+    if (!sender_packet_begin(&acc, addr, buffer_size))
+      return;
+    acc_ptr = &acc;
+  }
+
+  if (!network_config_proxy) {
+    parse_packet(se, buffer, buffer_size, /* flags = */ 0,
+                 /* username = */ NULL, acc_ptr, /* proxy = */ NULL);
+  } else {
+    /* Leave room for the signature or encryption of each server. */
+    size_t const proxy_size = network_config_packet_size - BUFF_SIG_SIZE;
+    char proxy_data[proxy_size];
+    proxy_buffer_t proxy = {.data = proxy_data, .size = proxy_size};
+
+    parse_packet(se, buffer, buffer_size, /* flags = */ 0,
+                 /* username = */ NULL, acc_ptr, &proxy);
+    proxy_buffer_send(&proxy);
+  }
+
+  if (acc_ptr != NULL)
+    sender_acc_flush(acc_ptr);
+} /* }}} void network_receive_packet */
+
+static void *dispatch_thread(void *arg) /* {{{ */
 {
+  dispatch_worker_t *w = arg;
+
   while (42) {
     receive_list_entry_t *ent;
     sockent_t *se;
 
     /* Lock and wait for more data to come in */
-    pthread_mutex_lock(&receive_list_lock);
-    while ((listen_loop == 0) && (receive_list_head == NULL))
-      pthread_cond_wait(&receive_list_cond, &receive_list_lock);
+    pthread_mutex_lock(&w->lock);
+    while ((listen_loop == 0) && (w->head == NULL))
+      pthread_cond_wait(&w->cond, &w->lock);
 
     /* Remove the head entry and unlock */
-    ent = receive_list_head;
-    if (ent != NULL)
-      receive_list_head = ent->next;
-    receive_list_length--;
-    pthread_mutex_unlock(&receive_list_lock);
+    ent = w->head;
+    if (ent != NULL) {
+      w->head = ent->next;
+      w->length--;
+    }
+    pthread_mutex_unlock(&w->lock);
 
     /* Check whether we are supposed to exit. We do NOT check `listen_loop'
      * because we dispatch all missing packets before shutting down. */
@@ -2215,8 +3271,8 @@ static void *dispatch_thread(void __attribute__((unused)) * arg) /* {{{ */
       continue;
     }
 
-    parse_packet(se, ent->data, ent->data_len, /* flags = */ 0,
-                 /* username = */ NULL);
+    network_receive_packet(se, &ent->addr, ent->data, (size_t)ent->data_len);
+    w->packets++;
     sfree(ent->data);
     sfree(ent);
   } /* while (42) */
@@ -2224,22 +3280,62 @@ static void *dispatch_thread(void __attribute__((unused)) * arg) /* {{{ */
   return NULL;
 } /* }}} void *dispatch_thread */
 
+/* Returns the dispatch worker responsible for packets from "addr". Only the
+ * address is used, not the port, so that all packets of a host are handled
+ * by the same thread. */
+static dispatch_worker_t *
+dispatch_worker_get(struct sockaddr_storage const *addr) /* {{{ */
+{
+  if (dispatch_workers_num == 1)
+    return dispatch_workers;
+
+  unsigned char const *data = NULL;
+  size_t size = network_addr_key(addr, &data);
+
+  return dispatch_workers +
+         (network_addr_hash(data, size) % dispatch_workers_num);
+} /* }}} dispatch_worker_t *dispatch_worker_get */
+
+/* Appends the receive thread's private list to the worker's receive list.
+ * Unless "block" is set, gives up if the lock is held by the dispatch
+ * thread. */
+static void dispatch_worker_flush(dispatch_worker_t *w, bool block) /* {{{ */
+{
+  if (w->private_head == NULL)
+    return;
+
+  if (block)
+    pthread_mutex_lock(&w->lock);
+  else if (pthread_mutex_trylock(&w->lock) != 0)
+    return;
+
+  assert(((w->head == NULL) && (w->length == 0)) ||
+         ((w->head != NULL) && (w->length != 0)));
+
+  if (w->head == NULL)
+    w->head = w->private_head;
+  else
+    w->tail->next = w->private_head;
+  w->tail = w->private_tail;
+  w->length += w->private_length;
+
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+
+  w->private_head = NULL;
+  w->private_tail = NULL;
+  w->private_length = 0;
+} /* }}} void dispatch_worker_flush */
+
 static int network_receive(void) /* {{{ */
 {
-  char buffer[network_config_packet_size];
+  char buffer[network_config_receive_size];
   int buffer_len;
 
   int status = 0;
 
-  receive_list_entry_t *private_list_head;
-  receive_list_entry_t *private_list_tail;
-  uint64_t private_list_length;
-
   assert(listen_sockets_num > 0);
-
-  private_list_head = NULL;
-  private_list_tail = NULL;
-  private_list_length = 0;
+  assert(dispatch_workers_num > 0);
 
   while (listen_loop == 0) {
     status = poll(listen_sockets_pollfd, listen_sockets_num, -1);
@@ -2252,21 +3348,24 @@ static int network_receive(void) /* {{{ */
 
     for (size_t i = 0; (i < listen_sockets_num) && (status > 0); i++) {
       receive_list_entry_t *ent;
+      struct sockaddr_storage addr = {0};
+      socklen_t addr_len = sizeof(addr);
 
       if ((listen_sockets_pollfd[i].revents & (POLLIN | POLLPRI)) == 0)
         continue;
       status--;
 
-      buffer_len = recv(listen_sockets_pollfd[i].fd, buffer, sizeof(buffer),
-                        0 /* no flags */);
+      buffer_len = recvfrom(listen_sockets_pollfd[i].fd, buffer, sizeof(buffer),
+                            0 /* no flags */, (struct sockaddr *)&addr,
+                            &addr_len);
       if (buffer_len < 0) {
         status = (errno != 0) ? errno : -1;
         ERROR("network plugin: recv(2) failed: %s", STRERRNO);
         break;
       }
 
-      stats_octets_rx += ((uint64_t)buffer_len);
-      stats_packets_rx++;
+      C_ATOMIC_ADD(&stats_octets_rx, (derive_t)buffer_len);
+      C_ATOMIC_ADD(&stats_packets_rx, 1);
 
       /* TODO: Possible performance enhancement: Do not free
        * these entries in the dispatch thread but put them in
@@ -2279,7 +3378,7 @@ static int network_receive(void) /* {{{ */
         break;
       }
 
-      ent->data = malloc(network_config_packet_size);
+      ent->data = malloc(buffer_len);
       if (ent->data == NULL) {
         sfree(ent);
         ERROR("network plugin: malloc failed.");
@@ -2287,38 +3386,23 @@ static int network_receive(void) /* {{{ */
         break;
       }
       ent->fd = listen_sockets_pollfd[i].fd;
+      ent->addr = addr;
       ent->next = NULL;
 
       memcpy(ent->data, buffer, buffer_len);
       ent->data_len = buffer_len;
 
-      if (private_list_head == NULL)
-        private_list_head = ent;
+      dispatch_worker_t *w = dispatch_worker_get(&addr);
+      if (w->private_head == NULL)
+        w->private_head = ent;
       else
-        private_list_tail->next = ent;
-      private_list_tail = ent;
-      private_list_length++;
+        w->private_tail->next = ent;
+      w->private_tail = ent;
+      w->private_length++;
 
       /* Do not block here. Blocking here has led to
        * insufficient performance in the past. */
-      if (pthread_mutex_trylock(&receive_list_lock) == 0) {
-        assert(((receive_list_head == NULL) && (receive_list_length == 0)) ||
-               ((receive_list_head != NULL) && (receive_list_length != 0)));
-
-        if (receive_list_head == NULL)
-          receive_list_head = private_list_head;
-        else
-          receive_list_tail->next = private_list_head;
-        receive_list_tail = private_list_tail;
-        receive_list_length += private_list_length;
-
-        pthread_cond_signal(&receive_list_cond);
-        pthread_mutex_unlock(&receive_list_lock);
-
-        private_list_head = NULL;
-        private_list_tail = NULL;
-        private_list_length = 0;
-      }
+      dispatch_worker_flush(w, /* block = */ false);
 
       status = 0;
     } /* for (listen_sockets_pollfd) */
@@ -2328,48 +3412,574 @@ static int network_receive(void) /* {{{ */
   } /* while (listen_loop == 0) */
 
   /* Make sure everything is dispatched before exiting. */
-  if (private_list_head != NULL) {
-    pthread_mutex_lock(&receive_list_lock);
-
-    if (receive_list_head == NULL)
-      receive_list_head = private_list_head;
-    else
-      receive_list_tail->next = private_list_head;
-    receive_list_tail = private_list_tail;
-    receive_list_length += private_list_length;
-
-    pthread_cond_signal(&receive_list_cond);
-    pthread_mutex_unlock(&receive_list_lock);
-  }
+  for (size_t i = 0; i < dispatch_workers_num; i++)
+    dispatch_worker_flush(dispatch_workers + i, /* block = */ true);
 
   return status;
 } /* }}} int network_receive */
 
-static void *receive_thread(void __attribute__((unused)) * arg) {
-  return network_receive() ? (void *)1 : (void *)0;
+static int dispatch_workers_create(void) /* {{{ */
+{
+  dispatch_workers =
+      calloc(network_config_dispatch_threads, sizeof(*dispatch_workers));
+  if (dispatch_workers == NULL)
+    return ENOMEM;
+  dispatch_workers_num = network_config_dispatch_threads;
+
+  for (size_t i = 0; i < dispatch_workers_num; i++) {
+    dispatch_worker_t *w = dispatch_workers + i;
+    char name[16];
+
+    pthread_mutex_init(&w->lock, /* attr = */ NULL);
+    pthread_cond_init(&w->cond, /* attr = */ NULL);
+
+    /* "DispatchThreads" is at most 256, so the name fits. */
+    if (dispatch_workers_num == 1)
+      sstrncpy(name, "network disp", sizeof(name));
+    else
+      snprintf(name, sizeof(name), "network disp%u", (unsigned int)i);
+
+    int status = plugin_thread_create(&w->id, /* attr = */ NULL,
+                                      dispatch_thread, w, name);
+    if (status != 0) {
+      ERROR("network: pthread_create failed: %s", STRERRNO);
+      continue;
+    }
+    w->running = true;
+  }
+
+  return 0;
+} /* }}} int dispatch_workers_create */
+
+static void dispatch_workers_destroy(void) /* {{{ */
+{
+  for (size_t i = 0; i < dispatch_workers_num; i++) {
+    dispatch_worker_t *w = dispatch_workers + i;
+
+    if (w->running) {
+      pthread_mutex_lock(&w->lock);
+      pthread_cond_broadcast(&w->cond);
+      pthread_mutex_unlock(&w->lock);
+      pthread_join(w->id, /* retval = */ NULL);
+      w->running = false;
+    }
+
+    /* Only left over if the dispatch thread could not be started. */
+    while (w->head != NULL) {
+      receive_list_entry_t *next = w->head->next;
+      sfree(w->head->data);
+      sfree(w->head);
+      w->head = next;
+    }
+
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+  }
+
+  sfree(dispatch_workers);
+  dispatch_workers_num = 0;
+} /* }}} void dispatch_workers_destroy */
+
+static void *receive_thread(void __attribute__((unused)) * arg) {
+  return network_receive() ? (void *)1 : (void *)0;
 } /* void *receive_thread */
 
-static void network_init_buffer(void) {
-  memset(send_buffer, 0, network_config_packet_size);
-  send_buffer_ptr = send_buffer;
-  send_buffer_fill = 0;
-  send_buffer_last_update = 0;
+/* Reads up to RECEIVE_BATCH_SIZE datagrams from "fd" into "buffers", each
+ * network_config_receive_size bytes long, and stores their sizes in "sizes"
+ * and their senders in "addrs". Returns the number of datagrams or -1 on
+ * error. */
+static int
+receive_worker_recv(int fd, char *buffers, size_t sizes[RECEIVE_BATCH_SIZE],
+                    struct sockaddr_storage addrs[RECEIVE_BATCH_SIZE]) /* {{{ */
+{
+#if HAVE_RECVMMSG
+  struct mmsghdr msgs[RECEIVE_BATCH_SIZE] = {{{0}}};
+  struct iovec iovs[RECEIVE_BATCH_SIZE];
+
+  for (size_t i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+    iovs[i].iov_base = buffers + i * network_config_receive_size;
+    iovs[i].iov_len = network_config_receive_size;
+    msgs[i].msg_hdr.msg_iov = iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = addrs + i;
+    msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+  }
 
-  memset(&send_buffer_vl, 0, sizeof(send_buffer_vl));
-} /* int network_init_buffer */
+  int status = recvmmsg(fd, msgs, RECEIVE_BATCH_SIZE, MSG_DONTWAIT,
+                        /* timeout = */ NULL);
+  for (int i = 0; i < status; i++)
+    sizes[i] = (size_t)msgs[i].msg_len;
+  return status;
+#else
+  socklen_t addr_len = sizeof(addrs[0]);
+  ssize_t status = recvfrom(fd, buffers, network_config_receive_size,
+                            MSG_DONTWAIT, (struct sockaddr *)&addrs[0],
+                            &addr_len);
+  if (status < 0)
+    return -1;
+  sizes[0] = (size_t)status;
+  return 1;
+#endif
+} /* }}} int receive_worker_recv */
 
-static void network_send_buffer_plain(sockent_t *se, /* {{{ */
-                                      const char *buffer, size_t buffer_size) {
-  int status;
+static void *receive_worker_thread(void *arg) /* {{{ */
+{
+  receive_worker_t *w = arg;
+  size_t sizes[RECEIVE_BATCH_SIZE];
+  struct sockaddr_storage addrs[RECEIVE_BATCH_SIZE];
 
-  while (42) {
-    status = sockent_client_connect(se);
+  char *buffers = malloc(RECEIVE_BATCH_SIZE * network_config_receive_size);
+  if (buffers == NULL) {
+    ERROR("network plugin: malloc failed.");
+    return (void *)1;
+  }
+
+  while (listen_loop == 0) {
+    /* The timeout makes sure the thread notices `listen_loop' even if the
+     * signal sent by network_shutdown() arrives before poll(2) is called. */
+    int status = poll(w->pollfd, w->fd_num, /* timeout = */ 1000);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("network plugin: poll(2) failed: %s", STRERRNO);
+      break;
+    }
+
+    for (size_t i = 0; (i < w->fd_num) && (status > 0); i++) {
+      if ((w->pollfd[i].revents & (POLLIN | POLLPRI)) == 0)
+        continue;
+      status--;
+
+      int num = receive_worker_recv(w->pollfd[i].fd, buffers, sizes, addrs);
+      if (num < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+          continue;
+        ERROR("network plugin: recvmmsg(2) failed: %s", STRERRNO);
+        continue;
+      }
+
+      for (int j = 0; j < num; j++) {
+        C_ATOMIC_ADD(&stats_octets_rx, (derive_t)sizes[j]);
+        C_ATOMIC_ADD(&stats_packets_rx, 1);
+
+        network_receive_packet(w->sockent[i],
+                               &addrs[j],
+                               buffers + j * network_config_receive_size,
+                               sizes[j]);
+      }
+    }
+  } /* while (listen_loop == 0) */
+
+  sfree(buffers);
+  return NULL;
+} /* }}} void *receive_worker_thread */
+
+/* Pins a receive thread to a CPU, e.g. the one handling the interrupts of the
+ * NIC queue its socket is fed by. */
+static void receive_worker_set_affinity(receive_worker_t *w, /* {{{ */
+                                        int cpu) {
+#if HAVE_PTHREAD_SETAFFINITY_NP
+  if (cpu >= CPU_SETSIZE) {
+    WARNING("network plugin: CPU %i is out of range.", cpu);
+    return;
+  }
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  int status = pthread_setaffinity_np(w->id, sizeof(set), &set);
+  if (status != 0)
+    WARNING("network plugin: Pinning a receive thread to CPU %i failed: %s",
+            cpu, STRERROR(status));
+#else
+  static bool warned;
+  if (!warned) {
+    WARNING("network plugin: The `ReceiveThreadCPUs' option is not supported "
+            "on this system.");
+    warned = true;
+  }
+#endif
+} /* }}} void receive_worker_set_affinity */
+
+/* Distributes the listening sockets over network_config_receive_threads
+ * workers. sockent_server_listen() opens the sockets bound to the same
+ * address one after another, so assigning them in turn gives each worker
+ * one socket of each group. */
+static int receive_workers_create(void) /* {{{ */
+{
+  size_t workers_num = network_config_receive_threads;
+
+  if (workers_num > listen_sockets_num)
+    workers_num = listen_sockets_num;
+
+  receive_workers = calloc(workers_num, sizeof(*receive_workers));
+  if (receive_workers == NULL)
+    return ENOMEM;
+  receive_workers_num = workers_num;
+
+  size_t n = 0;
+  for (sockent_t *se = listen_sockets; se != NULL; se = se->next) {
+    for (size_t i = 0; i < se->data.server.fd_num; i++, n++) {
+      receive_worker_t *w = receive_workers + (n % workers_num);
+
+      struct pollfd *pollfd =
+          realloc(w->pollfd, (w->fd_num + 1) * sizeof(*w->pollfd));
+      if (pollfd == NULL)
+        return ENOMEM;
+      w->pollfd = pollfd;
+
+      sockent_t **sockent =
+          realloc(w->sockent, (w->fd_num + 1) * sizeof(*w->sockent));
+      if (sockent == NULL)
+        return ENOMEM;
+      w->sockent = sockent;
+
+      w->pollfd[w->fd_num] = (struct pollfd){
+          .fd = se->data.server.fd[i], .events = POLLIN | POLLPRI,
+      };
+      w->sockent[w->fd_num] = se;
+      w->fd_num++;
+    }
+  }
+
+  for (size_t i = 0; i < receive_workers_num; i++) {
+    receive_worker_t *w = receive_workers + i;
+    char name[16];
+
+    /* "ReceiveThreads" is at most 256, so the name fits. */
+    snprintf(name, sizeof(name), "network recv%u", (unsigned int)i);
+    int status = plugin_thread_create(&w->id, /* attr = */ NULL,
+                                      receive_worker_thread, w, name);
+    if (status != 0) {
+      ERROR("network: pthread_create failed: %s", STRERRNO);
+      continue;
+    }
+    w->running = true;
+
+    if (network_config_receive_cpus_num > 0)
+      receive_worker_set_affinity(
+          w, network_config_receive_cpus[i % network_config_receive_cpus_num]);
+  }
+
+  return 0;
+} /* }}} int receive_workers_create */
+
+static void receive_workers_destroy(void) /* {{{ */
+{
+  for (size_t i = 0; i < receive_workers_num; i++) {
+    receive_worker_t *w = receive_workers + i;
+
+    if (w->running) {
+      pthread_kill(w->id, SIGTERM);
+      pthread_join(w->id, /* retval = */ NULL);
+      w->running = false;
+    }
+    sfree(w->pollfd);
+    sfree(w->sockent);
+  }
+
+  sfree(receive_workers);
+  receive_workers_num = 0;
+} /* }}} void receive_workers_destroy */
+
+#if HAVE_SYS_EPOLL_H
+static int stream_conn_add(stream_worker_t *w, int fd, /* {{{ */
+                           sockent_t *se, struct sockaddr_storage const *addr,
+                           bool listening) {
+  stream_conn_t *c = calloc(1, sizeof(*c));
+  if (c == NULL) {
+    ERROR("network plugin: calloc failed.");
+    return ENOMEM;
+  }
+  c->fd = fd;
+  c->listening = listening;
+  c->se = se;
+  if (addr != NULL)
+    c->addr = *addr;
+
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+  if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    int status = errno;
+    ERROR("network plugin: epoll_ctl(2) failed: %s", STRERROR(status));
+    sfree(c);
+    return status;
+  }
+
+  c->next = w->conns;
+  if (w->conns != NULL)
+    w->conns->prev = c;
+  w->conns = c;
+  return 0;
+} /* }}} int stream_conn_add */
+
+/* Closes and frees a connection. Listening sockets are owned by their sockent
+ * and only removed from the list. */
+static void stream_conn_close(stream_worker_t *w, stream_conn_t *c) /* {{{ */
+{
+  if (c->prev != NULL)
+    c->prev->next = c->next;
+  else
+    w->conns = c->next;
+  if (c->next != NULL)
+    c->next->prev = c->prev;
+
+  if (!c->listening)
+    close(c->fd);
+  sfree(c->buffer);
+  sfree(c);
+} /* }}} void stream_conn_close */
+
+static void stream_accept(stream_worker_t *w, stream_conn_t *l) /* {{{ */
+{
+  /* Listening sockets are non-blocking: accept until the backlog is empty,
+   * but let the connections have their turn now and then. */
+  for (int i = 0; i < STREAM_EVENTS_MAX; i++) {
+    struct sockaddr_storage addr = {0};
+    socklen_t addr_len = sizeof(addr);
+    int fd = accept(l->fd, (struct sockaddr *)&addr, &addr_len);
+    if (fd < 0) {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) &&
+          (errno != ECONNABORTED))
+        ERROR("network plugin: accept(2) failed: %s", STRERRNO);
+      return;
+    }
+
+    int flags = fcntl(fd, F_GETFL);
+    if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)) {
+      ERROR("network plugin: fcntl(2) failed: %s", STRERRNO);
+      close(fd);
+      continue;
+    }
+
+    /* Detects senders which went away without closing the connection. */
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
+
+    if (stream_conn_add(w, fd, l->se, &addr, /* listening = */ false) != 0)
+      close(fd);
+  }
+} /* }}} void stream_accept */
+
+/* Reads from a connection and parses the complete frames. Returns non-zero if
+ * the connection should be closed. */
+static int stream_conn_read(stream_conn_t *c) /* {{{ */
+{
+  if (c->buffer == NULL) {
+    c->buffer = malloc(NETWORK_STREAM_BUFFER_SIZE);
+    if (c->buffer == NULL) {
+      ERROR("network plugin: malloc failed.");
+      return ENOMEM;
+    }
+    c->size = NETWORK_STREAM_BUFFER_SIZE;
+  }
+
+  ssize_t status = recv(c->fd, c->buffer + c->fill, c->size - c->fill,
+                        /* flags = */ 0);
+  if (status < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+      return 0;
+    NOTICE("network plugin: recv(2) failed: %s. Closing the connection.",
+           STRERRNO);
+    return -1;
+  } else if (status == 0) { /* closed by the sender */
+    return -1;
+  }
+  c->fill += (size_t)status;
+  C_ATOMIC_ADD(&stats_octets_rx, (derive_t)status);
+
+  size_t offset = 0;
+  uint32_t frame_size = 0;
+  while ((c->fill - offset) >= NETWORK_STREAM_HEADER_SIZE) {
+    memcpy(&frame_size, c->buffer + offset, sizeof(frame_size));
+    frame_size = ntohl(frame_size);
+    if ((frame_size == 0) || (frame_size > NETWORK_STREAM_FRAME_MAX)) {
+      NOTICE("network plugin: Received a frame of %" PRIu32 " bytes. "
+             "Closing the connection.",
+             frame_size);
+      return -1;
+    }
+
+    if ((c->fill - offset) < (NETWORK_STREAM_HEADER_SIZE + frame_size))
+      break;
+
+    C_ATOMIC_ADD(&stats_packets_rx, 1);
+    network_receive_packet(c->se, &c->addr,
+                           c->buffer + offset + NETWORK_STREAM_HEADER_SIZE,
+                           frame_size);
+    offset += NETWORK_STREAM_HEADER_SIZE + frame_size;
+    frame_size = 0;
+  }
+
+  if (offset > 0) {
+    memmove(c->buffer, c->buffer + offset, c->fill - offset);
+    c->fill -= offset;
+  }
+
+  /* Make room for the incomplete frame. */
+  if ((NETWORK_STREAM_HEADER_SIZE + frame_size) > c->size) {
+    char *tmp = realloc(c->buffer, NETWORK_STREAM_HEADER_SIZE + frame_size);
+    if (tmp == NULL) {
+      ERROR("network plugin: realloc failed.");
+      return ENOMEM;
+    }
+    c->buffer = tmp;
+    c->size = NETWORK_STREAM_HEADER_SIZE + frame_size;
+  }
+
+  return 0;
+} /* }}} int stream_conn_read */
+
+static void *stream_worker_thread(void *arg) /* {{{ */
+{
+  stream_worker_t *w = arg;
+  struct epoll_event events[STREAM_EVENTS_MAX];
+
+  while (listen_loop == 0) {
+    /* See receive_worker_thread() for the timeout. */
+    int num = epoll_wait(w->epoll_fd, events, STREAM_EVENTS_MAX,
+                         /* timeout = */ 1000);
+    if (num < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("network plugin: epoll_wait(2) failed: %s", STRERRNO);
+      break;
+    }
+
+    for (int i = 0; i < num; i++) {
+      stream_conn_t *c = events[i].data.ptr;
+
+      if (c->listening)
+        stream_accept(w, c);
+      else if (stream_conn_read(c) != 0)
+        stream_conn_close(w, c);
+    }
+  } /* while (listen_loop == 0) */
+
+  return NULL;
+} /* }}} void *stream_worker_thread */
+
+/* Like receive_workers_create(): the sockets of each "Protocol TCP" listen
+ * address are assigned to the stream threads in turn. */
+static int stream_workers_create(void) /* {{{ */
+{
+  size_t workers_num = network_config_receive_threads;
+
+  if (workers_num == 0)
+    workers_num = 1;
+  if (workers_num > stream_listen_sockets_num)
+    workers_num = stream_listen_sockets_num;
+
+  stream_workers = calloc(workers_num, sizeof(*stream_workers));
+  if (stream_workers == NULL)
+    return ENOMEM;
+  stream_workers_num = workers_num;
+
+  for (size_t i = 0; i < stream_workers_num; i++)
+    stream_workers[i].epoll_fd = -1;
+  for (size_t i = 0; i < stream_workers_num; i++) {
+    stream_workers[i].epoll_fd = epoll_create(/* size = */ 1);
+    if (stream_workers[i].epoll_fd < 0) {
+      int status = errno;
+      ERROR("network plugin: epoll_create(2) failed: %s", STRERROR(status));
+      return status;
+    }
+  }
+
+  size_t n = 0;
+  for (sockent_t *se = stream_listen_sockets; se != NULL; se = se->next) {
+    for (size_t i = 0; i < se->data.server.fd_num; i++, n++) {
+      int status = stream_conn_add(stream_workers + (n % workers_num),
+                                   se->data.server.fd[i], se,
+                                   /* addr = */ NULL, /* listening = */ true);
+      if (status != 0)
+        return status;
+    }
+  }
+
+  for (size_t i = 0; i < stream_workers_num; i++) {
+    stream_worker_t *w = stream_workers + i;
+    char name[16];
+
+    if (stream_workers_num == 1)
+      sstrncpy(name, "network tcp", sizeof(name));
+    else
+      snprintf(name, sizeof(name), "network tcp%u", (unsigned int)i);
+
+    int status = plugin_thread_create(&w->id, /* attr = */ NULL,
+                                      stream_worker_thread, w, name);
+    if (status != 0) {
+      ERROR("network: pthread_create failed: %s", STRERRNO);
+      continue;
+    }
+    w->running = true;
+  }
+
+  return 0;
+} /* }}} int stream_workers_create */
+
+static void stream_workers_destroy(void) /* {{{ */
+{
+  for (size_t i = 0; i < stream_workers_num; i++) {
+    stream_worker_t *w = stream_workers + i;
+
+    if (w->running) {
+      pthread_kill(w->id, SIGTERM);
+      pthread_join(w->id, /* retval = */ NULL);
+      w->running = false;
+    }
+
+    while (w->conns != NULL)
+      stream_conn_close(w, w->conns);
+    if (w->epoll_fd >= 0)
+      close(w->epoll_fd);
+  }
+
+  sfree(stream_workers);
+  stream_workers_num = 0;
+} /* }}} void stream_workers_destroy */
+#endif /* HAVE_SYS_EPOLL_H */
+
+/* Sends "num" (at most SEND_BATCH_SIZE) packets to "se", using a single
+ * sendmmsg(2) call where possible. */
+static void network_send_buffers_plain(sockent_t *se, /* {{{ */
+                                       char *const *buffers,
+                                       size_t const *sizes, size_t num) {
+  size_t sent = 0;
+
+  assert(num <= SEND_BATCH_SIZE);
+
+  while (sent < num) {
+    int status = sockent_client_connect(se);
     if (status != 0)
       return;
 
-    status = sendto(se->data.client.fd, buffer, buffer_size,
-                    /* flags = */ 0, (struct sockaddr *)se->data.client.addr,
-                    se->data.client.addrlen);
+#if HAVE_SENDMMSG
+    struct mmsghdr msgs[SEND_BATCH_SIZE] = {{{0}}};
+    struct iovec iovs[SEND_BATCH_SIZE];
+
+    for (size_t i = sent; i < num; i++) {
+      iovs[i - sent] = (struct iovec){
+          .iov_base = buffers[i], .iov_len = sizes[i],
+      };
+      msgs[i - sent].msg_hdr = (struct msghdr){
+          .msg_name = se->data.client.addr,
+          .msg_namelen = se->data.client.addrlen,
+          .msg_iov = iovs + (i - sent),
+          .msg_iovlen = 1,
+      };
+    }
+
+    status = sendmmsg(se->data.client.fd, msgs, (unsigned int)(num - sent),
+                      /* flags = */ 0);
+#else
+    status = (int)sendto(se->data.client.fd, buffers[sent], sizes[sent],
+                         /* flags = */ 0,
+                         (struct sockaddr *)se->data.client.addr,
+                         se->data.client.addrlen);
+    if (status >= 0)
+      status = 1;
+#endif
     if (status < 0) {
       if ((errno == EINTR) || (errno == EAGAIN))
         continue;
@@ -2380,9 +3990,69 @@ static void network_send_buffer_plain(sockent_t *se, /* {{{ */
       return;
     }
 
-    break;
-  } /* while (42) */
-} /* }}} void network_send_buffer_plain */
+    sent += (size_t)status;
+  } /* while (sent < num) */
+} /* }}} void network_send_buffers_plain */
+
+/* Sends "num" (at most SEND_BATCH_SIZE) packets to "se" as frames on its
+ * stream connection, using a single sendmsg(2) call where possible. Packets
+ * are not acknowledged, so there is nothing to wait for between them. */
+static void network_send_buffers_stream(sockent_t *se, /* {{{ */
+                                        char *const *buffers,
+                                        size_t const *sizes, size_t num) {
+  uint32_t headers[SEND_BATCH_SIZE];
+  struct iovec iovs[2 * SEND_BATCH_SIZE];
+  size_t iovs_num = 0;
+  int flags = 0;
+
+  assert(num <= SEND_BATCH_SIZE);
+
+  if (sockent_client_connect(se) != 0)
+    return;
+
+  for (size_t i = 0; i < num; i++) {
+    headers[i] = htonl((uint32_t)sizes[i]);
+    iovs[iovs_num++] = (struct iovec){
+        .iov_base = headers + i, .iov_len = sizeof(headers[i]),
+    };
+    iovs[iovs_num++] = (struct iovec){
+        .iov_base = buffers[i], .iov_len = sizes[i],
+    };
+  }
+
+#ifdef MSG_NOSIGNAL
+  flags |= MSG_NOSIGNAL;
+#endif
+
+  struct iovec *iov = iovs;
+  while (iovs_num > 0) {
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovs_num};
+    ssize_t status = sendmsg(se->data.client.fd, &msg, flags);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+
+      /* Also reached when the send timeout expires. Part of a frame may have
+       * been sent, so the connection can't be used any more. */
+      ERROR("network plugin: Sending to \"%s\" failed: %s. Closing the "
+            "connection.",
+            se->node, STRERRNO);
+      sockent_client_disconnect(se);
+      return;
+    }
+
+    size_t sent = (size_t)status;
+    while ((iovs_num > 0) && (sent >= iov->iov_len)) {
+      sent -= iov->iov_len;
+      iov++;
+      iovs_num--;
+    }
+    if (sent > 0) {
+      iov->iov_base = (char *)iov->iov_base + sent;
+      iov->iov_len -= sent;
+    }
+  } /* while (iovs_num > 0) */
+} /* }}} void network_send_buffers_stream */
 
 #if HAVE_GCRYPT_H
 #define BUFFER_ADD(p, s)                                                       \
@@ -2391,39 +4061,28 @@ static void network_send_buffer_plain(sockent_t *se, /* {{{ */
     buffer_offset += (s);                                                      \
   } while (0)
 
-static void network_send_buffer_signed(sockent_t *se, /* {{{ */
-                                       const char *in_buffer,
-                                       size_t in_buffer_size) {
-  char buffer[BUFF_SIG_SIZE + in_buffer_size];
+/* Writes the signed packet to "buffer", which must hold at least
+ * BUFF_SIG_SIZE + in_buffer_size bytes. Returns the packet's size or zero on
+ * error. */
+static size_t network_sign_buffer(sockent_t *se, char *buffer, /* {{{ */
+                                  const char *in_buffer,
+                                  size_t in_buffer_size) {
   size_t buffer_offset;
   size_t username_len;
 
   gcry_md_hd_t hd;
-  gcry_error_t err;
   unsigned char *hash;
 
-  hd = NULL;
-  err = gcry_md_open(&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
-  if (err != 0) {
-    ERROR("network plugin: Creating HMAC object failed: %s",
-          gcry_strerror(err));
-    return;
-  }
-
-  err = gcry_md_setkey(hd, se->data.client.password,
-                       strlen(se->data.client.password));
-  if (err != 0) {
-    ERROR("network plugin: gcry_md_setkey failed: %s", gcry_strerror(err));
-    gcry_md_close(hd);
-    return;
-  }
-
   username_len = strlen(se->data.client.username);
   if (username_len > (BUFF_SIG_SIZE - PART_SIGNATURE_SHA256_SIZE)) {
     ERROR("network plugin: Username too long: %s", se->data.client.username);
-    return;
+    return 0;
   }
 
+  hd = network_hmac_get(&se->data.client.hmac, se->data.client.password);
+  if (hd == NULL)
+    return 0;
+
   memcpy(buffer + PART_SIGNATURE_SHA256_SIZE, se->data.client.username,
          username_len);
   memcpy(buffer + PART_SIGNATURE_SHA256_SIZE + username_len, in_buffer,
@@ -2440,8 +4099,7 @@ static void network_send_buffer_signed(sockent_t *se, /* {{{ */
   hash = gcry_md_read(hd, GCRY_MD_SHA256);
   if (hash == NULL) {
     ERROR("network plugin: gcry_md_read failed.");
-    gcry_md_close(hd);
-    return;
+    return 0;
   }
   memcpy(ps.hash, hash, sizeof(ps.hash));
 
@@ -2454,17 +4112,15 @@ static void network_send_buffer_signed(sockent_t *se, /* {{{ */
 
   assert(buffer_offset == PART_SIGNATURE_SHA256_SIZE);
 
-  gcry_md_close(hd);
-  hd = NULL;
-
-  buffer_offset = PART_SIGNATURE_SHA256_SIZE + username_len + in_buffer_size;
-  network_send_buffer_plain(se, buffer, buffer_offset);
-} /* }}} void network_send_buffer_signed */
+  return PART_SIGNATURE_SHA256_SIZE + username_len + in_buffer_size;
+} /* }}} size_t network_sign_buffer */
 
-static void network_send_buffer_encrypted(sockent_t *se, /* {{{ */
-                                          const char *in_buffer,
-                                          size_t in_buffer_size) {
-  char buffer[BUFF_SIG_SIZE + in_buffer_size];
+/* Writes the encrypted packet to "buffer", which must hold at least
+ * BUFF_SIG_SIZE + in_buffer_size bytes. Returns the packet's size or zero on
+ * error. */
+static size_t network_encrypt_buffer(sockent_t *se, char *buffer, /* {{{ */
+                                     const char *in_buffer,
+                                     size_t in_buffer_size) {
   size_t buffer_size;
   size_t buffer_offset;
   size_t header_size;
@@ -2479,79 +4135,692 @@ static void network_send_buffer_encrypted(sockent_t *se, /* {{{ */
   username_len = strlen(pea.username);
   if ((PART_ENCRYPTION_AES256_SIZE + username_len) > BUFF_SIG_SIZE) {
     ERROR("network plugin: Username too long: %s", pea.username);
-    return;
+    return 0;
   }
 
   buffer_size = PART_ENCRYPTION_AES256_SIZE + username_len + in_buffer_size;
   header_size = PART_ENCRYPTION_AES256_SIZE + username_len - sizeof(pea.hash);
 
-  assert(buffer_size <= sizeof(buffer));
-  DEBUG("network plugin: network_send_buffer_encrypted: "
+  assert(buffer_size <= BUFF_SIG_SIZE + in_buffer_size);
+  DEBUG("network plugin: network_encrypt_buffer: "
         "buffer_size = %" PRIsz ";",
         buffer_size);
 
-  pea.head.length = htons(
-      (uint16_t)(PART_ENCRYPTION_AES256_SIZE + username_len + in_buffer_size));
-  pea.username_length = htons((uint16_t)username_len);
+  pea.head.length = htons(
+      (uint16_t)(PART_ENCRYPTION_AES256_SIZE + username_len + in_buffer_size));
+  pea.username_length = htons((uint16_t)username_len);
+
+  /* Chose a random initialization vector. OFB only needs unique IVs, so
+   * nonces are good enough and much cheaper than strong random numbers. */
+  gcry_create_nonce(pea.iv, sizeof(pea.iv));
+
+  /* Create hash of the payload */
+  gcry_md_hash_buffer(GCRY_MD_SHA1, pea.hash, in_buffer, in_buffer_size);
+
+  /* Initialize the buffer */
+  buffer_offset = 0;
+  memset(buffer, 0, buffer_size);
+
+  BUFFER_ADD(&pea.head.type, sizeof(pea.head.type));
+  BUFFER_ADD(&pea.head.length, sizeof(pea.head.length));
+  BUFFER_ADD(&pea.username_length, sizeof(pea.username_length));
+  BUFFER_ADD(pea.username, username_len);
+  BUFFER_ADD(pea.iv, sizeof(pea.iv));
+  assert(buffer_offset == header_size);
+  BUFFER_ADD(pea.hash, sizeof(pea.hash));
+  BUFFER_ADD(in_buffer, in_buffer_size);
+
+  assert(buffer_offset == buffer_size);
+
+  cypher = network_cipher_get(&se->data.client.cypher, GCRY_CIPHER_MODE_OFB,
+                              se->data.client.password_hash, pea.iv,
+                              sizeof(pea.iv));
+  if (cypher == NULL)
+    return 0;
+
+  /* Encrypt the buffer in-place */
+  err = gcry_cipher_encrypt(cypher, buffer + header_size,
+                            buffer_size - header_size,
+                            /* in = */ NULL, /* in len = */ 0);
+  if (err != 0) {
+    ERROR("network plugin: gcry_cipher_encrypt returned: %s",
+          gcry_strerror(err));
+    return 0;
+  }
+
+  return buffer_size;
+} /* }}} size_t network_encrypt_buffer */
+
+#if HAVE_GCRYPT_GCM
+/* Writes the AES-256-GCM encrypted packet to "buffer", which must hold at
+ * least BUFF_SIG_SIZE + in_buffer_size bytes. Returns the packet's size or zero
+ * on error. Must be called with send_lock held. */
+static size_t network_encrypt_gcm_buffer(sockent_t *se, /* {{{ */
+                                         char *buffer, const char *in_buffer,
+                                         size_t in_buffer_size) {
+  struct sockent_client *client = &se->data.client;
+  size_t username_len = strlen(client->username);
+  if ((PART_ENCRYPTION_AES256_GCM_SIZE + username_len) > BUFF_SIG_SIZE) {
+    ERROR("network plugin: Username too long: %s", client->username);
+    return 0;
+  }
+
+  size_t aad_size = sizeof(part_header_t) + sizeof(uint16_t) + username_len;
+  size_t buffer_size =
+      PART_ENCRYPTION_AES256_GCM_SIZE + username_len + in_buffer_size;
+  assert(buffer_size <= BUFF_SIG_SIZE + in_buffer_size);
+
+  uint16_t tmp16 = htons(TYPE_ENCR_AES256_GCM);
+  memcpy(buffer, &tmp16, sizeof(tmp16));
+  tmp16 = htons((uint16_t)buffer_size);
+  memcpy(buffer + 2, &tmp16, sizeof(tmp16));
+  tmp16 = htons((uint16_t)username_len);
+  memcpy(buffer + 4, &tmp16, sizeof(tmp16));
+  memcpy(buffer + 6, client->username, username_len);
+
+  /* GCM must never reuse an IV with the same key: the IV is a random prefix,
+   * chosen when the socket is set up, followed by a packet counter. */
+  char *iv = buffer + aad_size;
+  uint64_t counter = htonll(client->gcm_counter++);
+  memcpy(iv, client->gcm_iv_prefix, sizeof(client->gcm_iv_prefix));
+  memcpy(iv + sizeof(client->gcm_iv_prefix), &counter, sizeof(counter));
+
+  char *payload = iv + PART_ENCRYPTION_AES256_GCM_IV_SIZE;
+  char *tag = payload + in_buffer_size;
+
+  gcry_cipher_hd_t cypher =
+      network_cipher_get(&client->gcm, GCRY_CIPHER_MODE_GCM,
+                         client->password_hash, iv,
+                         PART_ENCRYPTION_AES256_GCM_IV_SIZE);
+  if (cypher == NULL)
+    return 0;
+
+  gcry_error_t err = gcry_cipher_authenticate(cypher, buffer, aad_size);
+  if (err == 0)
+    err = gcry_cipher_encrypt(cypher, payload, in_buffer_size, in_buffer,
+                              in_buffer_size);
+  if (err == 0)
+    err = gcry_cipher_gettag(cypher, tag, PART_ENCRYPTION_AES256_GCM_TAG_SIZE);
+  if (err != 0) {
+    ERROR("network plugin: AES-256-GCM encryption failed: %s",
+          gcry_strerror(err));
+    return 0;
+  }
+
+  return buffer_size;
+} /* }}} size_t network_encrypt_gcm_buffer */
+#endif /* HAVE_GCRYPT_GCM */
+#undef BUFFER_ADD
+#endif /* HAVE_GCRYPT_H */
+
+/* Sends "num" (at most SEND_BATCH_SIZE) packets to "se", signing or
+ * encrypting them first if configured. */
+static void network_send_packets_to(sockent_t *se, /* {{{ */
+                                    send_packet_t *const *packets,
+                                    size_t num) {
+  char *buffers[SEND_BATCH_SIZE];
+  size_t sizes[SEND_BATCH_SIZE];
+  size_t buffers_num = 0;
+
+#if HAVE_GCRYPT_H
+  char *secured = NULL;
+  if (se->data.client.security_level > SECURITY_LEVEL_NONE) {
+    secured = malloc(num * (BUFF_SIG_SIZE + network_config_packet_size));
+    if (secured == NULL) {
+      ERROR("network plugin: malloc failed.");
+      return;
+    }
+  }
+#endif
+
+  for (size_t i = 0; i < num; i++) {
+    char *buffer = packets[i]->data;
+    size_t size = packets[i]->size;
+
+#if HAVE_GCRYPT_H
+    if (secured != NULL) {
+      buffer = secured +
+               buffers_num * (BUFF_SIG_SIZE + network_config_packet_size);
+      if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
+        size = network_encrypt_buffer(se, buffer, packets[i]->data,
+                                      packets[i]->size);
+#if HAVE_GCRYPT_GCM
+      else if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT_GCM)
+        size = network_encrypt_gcm_buffer(se, buffer, packets[i]->data,
+                                          packets[i]->size);
+#endif
+      else /* if (se->data.client.security_level == SECURITY_LEVEL_SIGN) */
+        size = network_sign_buffer(se, buffer, packets[i]->data,
+                                   packets[i]->size);
+      if (size == 0)
+        continue;
+    }
+#endif
+
+    buffers[buffers_num] = buffer;
+    sizes[buffers_num] = size;
+    buffers_num++;
+  }
+
+  if ((buffers_num > 0) && (se->socktype == SOCK_STREAM))
+    network_send_buffers_stream(se, buffers, sizes, buffers_num);
+  else if (buffers_num > 0)
+    network_send_buffers_plain(se, buffers, sizes, buffers_num);
+
+#if HAVE_GCRYPT_H
+  sfree(secured);
+#endif
+} /* }}} void network_send_packets_to */
+
+static send_packet_t *send_packet_create(void) /* {{{ */
+{
+  send_packet_t *p = malloc(sizeof(*p) + network_config_packet_size);
+  if (p == NULL) {
+    ERROR("network plugin: malloc failed.");
+    return NULL;
+  }
+  p->size = 0;
+  p->next = NULL;
+  return p;
+} /* }}} send_packet_t *send_packet_create */
+
+#if HAVE_LIBZ
+/* Compresses the first "num" packets of "list" into a new packet holding a
+ * single compressed part. Each packet is encoded starting from an empty value
+ * list, so parts clearing all fields are inserted between them. Returns NULL
+ * if the result does not fit into a packet. Must be called with send_lock
+ * held. */
+static send_packet_t *send_compress_run(send_packet_t const *list, /* {{{ */
+                                        size_t num, size_t *ret_raw_size) {
+  size_t const max_size = network_config_packet_size - BUFF_SIG_SIZE;
+  size_t const header_size = sizeof(part_header_t) + sizeof(uint32_t);
+
+  char *ptr = send_compress_buffer;
+  size_t buffer_free = NETWORK_COMPRESS_MAX_SIZE;
+  for (size_t i = 0; i < num; i++, list = list->next) {
+    if (i > 0) {
+      int status = 0;
+      status |= write_part_string(&ptr, &buffer_free, TYPE_HOST, "", 0);
+      status |= write_part_number(&ptr, &buffer_free, TYPE_TIME_HR, 0);
+      status |= write_part_number(&ptr, &buffer_free, TYPE_INTERVAL_HR, 0);
+      status |= write_part_string(&ptr, &buffer_free, TYPE_PLUGIN, "", 0);
+      status |=
+          write_part_string(&ptr, &buffer_free, TYPE_PLUGIN_INSTANCE, "", 0);
+      status |= write_part_string(&ptr, &buffer_free, TYPE_TYPE, "", 0);
+      status |= write_part_string(&ptr, &buffer_free, TYPE_TYPE_INSTANCE, "", 0);
+      if (status != 0)
+        return NULL;
+    }
+    if (list->size > buffer_free)
+      return NULL;
+    memcpy(ptr, list->data, list->size);
+    ptr += list->size;
+    buffer_free -= list->size;
+  }
+  size_t raw_size = NETWORK_COMPRESS_MAX_SIZE - buffer_free;
+
+  send_packet_t *p = send_packet_create();
+  if (p == NULL)
+    return NULL;
+
+  send_zstream.next_in = (Bytef *)send_compress_buffer;
+  send_zstream.avail_in = (uInt)raw_size;
+  send_zstream.next_out = (Bytef *)(p->data + header_size);
+  send_zstream.avail_out = (uInt)(max_size - header_size);
+  int status = deflate(&send_zstream, Z_FINISH);
+  size_t compressed_size = (size_t)send_zstream.total_out;
+  deflateReset(&send_zstream);
+  if (status != Z_STREAM_END) {
+    sfree(p);
+    return NULL;
+  }
+
+  p->size = header_size + compressed_size;
+  part_header_t ph = {.type = htons(TYPE_COMPR_ZLIB),
+                      .length = htons((uint16_t)p->size)};
+  uint32_t tmp = htonl((uint32_t)raw_size);
+  memcpy(p->data, &ph, sizeof(ph));
+  memcpy(p->data + sizeof(ph), &tmp, sizeof(tmp));
+
+  *ret_raw_size = raw_size;
+  return p;
+} /* }}} send_packet_t *send_compress_run */
+
+/* Replaces runs of packets in "list" by compressed packets, where this makes
+ * them smaller. The number of packets compressed together is estimated from
+ * the ratio achieved before and halved until the result fits. Must be called
+ * with send_lock held. */
+static send_packet_t *send_compress_packets(send_packet_t *list) /* {{{ */
+{
+  size_t const max_size = network_config_packet_size - BUFF_SIG_SIZE;
+
+  if (send_compress_buffer == NULL) {
+    send_compress_buffer = malloc(NETWORK_COMPRESS_MAX_SIZE);
+    if (send_compress_buffer == NULL)
+      return list;
+    if (deflateInit(&send_zstream, Z_BEST_SPEED) != Z_OK) {
+      ERROR("network plugin: deflateInit failed.");
+      sfree(send_compress_buffer);
+      return list;
+    }
+  }
+
+  send_packet_t *head = NULL;
+  send_packet_t **tail = &head;
+
+  while (list != NULL) {
+    /* Half of the buffer leaves room for the parts inserted between the
+     * packets. */
+    size_t target = (size_t)(send_compress_ratio * (double)max_size);
+    if (target > NETWORK_COMPRESS_MAX_SIZE / 2)
+      target = NETWORK_COMPRESS_MAX_SIZE / 2;
+
+    size_t num = 1;
+    size_t raw_size = list->size;
+    for (send_packet_t *p = list->next;
+         (p != NULL) && (raw_size + p->size <= target); p = p->next) {
+      raw_size += p->size;
+      num++;
+    }
+
+    send_packet_t *compressed = NULL;
+    while (42) {
+      compressed = send_compress_run(list, num, &raw_size);
+      if ((compressed != NULL) || (num == 1))
+        break;
+      num /= 2;
+      send_compress_ratio = (send_compress_ratio > 1.33)
+                                ? (0.75 * send_compress_ratio)
+                                : 1.0;
+    }
+
+    if ((compressed != NULL) && ((num > 1) || (compressed->size < list->size))) {
+      double ratio = 0.9 * (double)raw_size / (double)compressed->size;
+      send_compress_ratio = (send_compress_ratio + ratio) / 2.0;
+      if (send_compress_ratio < 1.0)
+        send_compress_ratio = 1.0;
+
+      for (size_t i = 0; i < num; i++) {
+        send_packet_t *next = list->next;
+        sfree(list);
+        list = next;
+      }
+    } else {
+      sfree(compressed);
+      compressed = list;
+      list = list->next;
+    }
+
+    compressed->next = NULL;
+    *tail = compressed;
+    tail = &compressed->next;
+  }
+
+  return head;
+} /* }}} send_packet_t *send_compress_packets */
+#endif /* HAVE_LIBZ */
+
+/* Sends and frees a list of packets. Must be called with send_lock held. */
+static void network_send_packets(send_packet_t *list) /* {{{ */
+{
+#if HAVE_LIBZ
+  if (network_config_compress)
+    list = send_compress_packets(list);
+#endif
+
+  while (list != NULL) {
+    send_packet_t *batch[SEND_BATCH_SIZE];
+    size_t num = 0;
+
+    while ((list != NULL) && (num < SEND_BATCH_SIZE)) {
+      batch[num++] = list;
+      list = list->next;
+    }
+
+    DEBUG("network plugin: network_send_packets: Sending %" PRIsz " packets",
+          num);
+
+    for (sockent_t *se = sending_sockets; se != NULL; se = se->next)
+      network_send_packets_to(se, batch, num);
+
+    for (size_t i = 0; i < num; i++) {
+      stats_octets_tx += ((uint64_t)batch[i]->size);
+      stats_packets_tx++;
+      sfree(batch[i]);
+    }
+  }
+} /* }}} void network_send_packets */
+
+static void send_queue_push(send_packet_t *p) /* {{{ */
+{
+  pthread_mutex_lock(&send_queue_lock);
+  if (send_queue_tail == NULL)
+    send_queue_head = p;
+  else
+    send_queue_tail->next = p;
+  send_queue_tail = p;
+  pthread_mutex_unlock(&send_queue_lock);
+} /* }}} void send_queue_push */
+
+/* Queues a copy of "buffer" for sending. */
+static int send_queue_push_buffer(char const *buffer, /* {{{ */
+                                  size_t buffer_size) {
+  assert(buffer_size <= network_config_packet_size);
+
+  send_packet_t *p = send_packet_create();
+  if (p == NULL)
+    return ENOMEM;
+
+  memcpy(p->data, buffer, buffer_size);
+  p->size = buffer_size;
+  send_queue_push(p);
+  return 0;
+} /* }}} int send_queue_push_buffer */
+
+static bool send_queue_empty(void) {
+  pthread_mutex_lock(&send_queue_lock);
+  bool empty = (send_queue_head == NULL);
+  pthread_mutex_unlock(&send_queue_lock);
+  return empty;
+} /* bool send_queue_empty */
+
+/* Sends the queued packets. Unless "block" is set, returns right away if
+ * another thread is sending already: that thread checks the queue again after
+ * releasing the lock, so the packets are not left behind. */
+static void send_queue_send(bool block) /* {{{ */
+{
+  do {
+    if (block)
+      pthread_mutex_lock(&send_lock);
+    else if (pthread_mutex_trylock(&send_lock) != 0)
+      return;
+
+    while (42) {
+      pthread_mutex_lock(&send_queue_lock);
+      send_packet_t *list = send_queue_head;
+      send_queue_head = NULL;
+      send_queue_tail = NULL;
+      pthread_mutex_unlock(&send_queue_lock);
+
+      if (list == NULL)
+        break;
+      network_send_packets(list);
+    }
+
+    pthread_mutex_unlock(&send_lock);
+  } while (!send_queue_empty());
+} /* }}} void send_queue_send */
+
+/* Queues the parts collected in "p" for sending, unless it only holds the
+ * state parts. */
+static void proxy_buffer_flush(proxy_buffer_t *p) /* {{{ */
+{
+  if (p->fill > p->state_fill)
+    send_queue_push_buffer(p->data, p->fill);
+  p->fill = 0;
+  p->state_fill = 0;
+} /* }}} void proxy_buffer_flush */
+
+/* Starts the next packet with the state parts. */
+static void proxy_buffer_restart(proxy_buffer_t *p) /* {{{ */
+{
+  proxy_buffer_flush(p);
+
+  for (size_t i = 0; i < PROXY_STATE_NUM; i++) {
+    if (p->state[i].size == 0)
+      continue;
+    memcpy(p->data + p->fill, p->state[i].data, p->state[i].size);
+    p->fill += p->state[i].size;
+  }
+  p->state_fill = p->fill;
+} /* }}} void proxy_buffer_restart */
+
+static int proxy_state_index(uint16_t type) /* {{{ */
+{
+  switch (type) {
+  case TYPE_HOST:
+    return PROXY_STATE_HOST;
+  case TYPE_PLUGIN:
+    return PROXY_STATE_PLUGIN;
+  case TYPE_PLUGIN_INSTANCE:
+    return PROXY_STATE_PLUGIN_INSTANCE;
+  case TYPE_TYPE:
+    return PROXY_STATE_TYPE;
+  case TYPE_TYPE_INSTANCE:
+    return PROXY_STATE_TYPE_INSTANCE;
+  case TYPE_TIME:
+  case TYPE_TIME_HR:
+    return PROXY_STATE_TIME;
+  case TYPE_INTERVAL:
+  case TYPE_INTERVAL_HR:
+    return PROXY_STATE_INTERVAL;
+  case TYPE_SEVERITY:
+    return PROXY_STATE_SEVERITY;
+  }
+  return -1;
+} /* }}} int proxy_state_index */
+
+/* Checks a part the way parse_packet() would, without decoding it, and copies
+ * it into the buffer. Returns non-zero if the part is malformed. */
+static int proxy_buffer_add(proxy_buffer_t *p, uint16_t type, /* {{{ */
+                            void const *part, size_t part_size) {
+  char const *data = part;
+  int state = proxy_state_index(type);
+
+  if (type == TYPE_VALUES) {
+    if (parse_part_values_num(part, part_size) == 0)
+      return -1;
+  } else if ((type == TYPE_TIME) || (type == TYPE_TIME_HR) ||
+             (type == TYPE_INTERVAL) || (type == TYPE_INTERVAL_HR) ||
+             (type == TYPE_SEVERITY)) {
+    if (part_size != sizeof(part_header_t) + sizeof(uint64_t)) {
+      WARNING("network plugin: proxy_buffer_add: Number part of %" PRIsz
+              " bytes.",
+              part_size);
+      return -1;
+    }
+  } else if ((state >= 0) || (type == TYPE_MESSAGE)) {
+    /* Strings must be null terminated. */
+    if ((part_size <= sizeof(part_header_t)) || (data[part_size - 1] != 0)) {
+      WARNING("network plugin: proxy_buffer_add: Malformed string part.");
+      return -1;
+    }
+  }
+
+  if ((state >= 0) && (part_size > sizeof(p->state[state].data))) {
+    WARNING("network plugin: proxy_buffer_add: String part of %" PRIsz
+            " bytes.",
+            part_size);
+    return -1;
+  }
+
+  if ((p->fill + part_size) > p->size) {
+    proxy_buffer_restart(p);
+    if ((p->fill + part_size) > p->size) {
+      static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+      c_complain(LOG_WARNING, &complaint,
+                 "network plugin: Not forwarding a part of %" PRIsz " bytes: "
+                 "it does not fit into a packet of `MaxPacketSize'.",
+                 part_size);
+      return 0;
+    }
+  }
+
+  if (state >= 0) {
+    memcpy(p->state[state].data, part, part_size);
+    p->state[state].size = part_size;
+  }
+
+  memcpy(p->data + p->fill, part, part_size);
+  p->fill += part_size;
+  return 0;
+} /* }}} int proxy_buffer_add */
+
+static void proxy_buffer_send(proxy_buffer_t *p) /* {{{ */
+{
+  proxy_buffer_flush(p);
+  send_queue_send(/* block = */ false);
+} /* }}} void proxy_buffer_send */
+
+static void send_buffer_reset(send_buffer_t *sb) /* {{{ */
+{
+  sb->fill = 0;
+  sb->last_update = 0;
+  sb->deadline = 0;
+  memset(&sb->vl, 0, sizeof(sb->vl));
+} /* }}} void send_buffer_reset */
+
+/* Returns the calling thread's encode buffer, creating it if necessary. */
+static send_buffer_t *send_buffer_get(void) /* {{{ */
+{
+  send_buffer_t *sb = pthread_getspecific(send_buffer_key);
+  if (sb != NULL)
+    return sb;
+
+  sb = calloc(1, sizeof(*sb));
+  if (sb == NULL)
+    return NULL;
+
+  sb->data = calloc(1, network_config_packet_size);
+  if (sb->data == NULL) {
+    sfree(sb);
+    return NULL;
+  }
+  pthread_mutex_init(&sb->lock, /* attr = */ NULL);
+
+  if (pthread_setspecific(send_buffer_key, sb) != 0) {
+    pthread_mutex_destroy(&sb->lock);
+    sfree(sb->data);
+    sfree(sb);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&send_buffers_lock);
+  sb->next = send_buffers;
+  send_buffers = sb;
+  pthread_mutex_unlock(&send_buffers_lock);
+
+  return sb;
+} /* }}} send_buffer_t *send_buffer_get */
 
-  /* Chose a random initialization vector. */
-  gcry_randomize((void *)&pea.iv, sizeof(pea.iv), GCRY_STRONG_RANDOM);
+/* Queues the buffer's content as a packet of its own and resets the buffer.
+ * Must be called with sb->lock held. */
+static void send_buffer_flush(send_buffer_t *sb) /* {{{ */
+{
+  DEBUG("network plugin: send_buffer_flush: fill = %" PRIsz, sb->fill);
 
-  /* Create hash of the payload */
-  gcry_md_hash_buffer(GCRY_MD_SHA1, pea.hash, in_buffer, in_buffer_size);
+  if (sb->fill > 0)
+    send_queue_push_buffer(sb->data, sb->fill);
 
-  /* Initialize the buffer */
-  buffer_offset = 0;
-  memset(buffer, 0, sizeof(buffer));
+  send_buffer_reset(sb);
+} /* }}} void send_buffer_flush */
 
-  BUFFER_ADD(&pea.head.type, sizeof(pea.head.type));
-  BUFFER_ADD(&pea.head.length, sizeof(pea.head.length));
-  BUFFER_ADD(&pea.username_length, sizeof(pea.username_length));
-  BUFFER_ADD(pea.username, username_len);
-  BUFFER_ADD(pea.iv, sizeof(pea.iv));
-  assert(buffer_offset == header_size);
-  BUFFER_ADD(pea.hash, sizeof(pea.hash));
-  BUFFER_ADD(in_buffer, in_buffer_size);
+/* A packet assembled from the contents of several send buffers. */
+typedef struct {
+  send_packet_t *packet;
+  value_list_t vl; /* values of the previous parts */
+} send_merge_t;
 
-  assert(buffer_offset == buffer_size);
+static void send_merge_finish(send_merge_t *m) /* {{{ */
+{
+  if (m->packet != NULL)
+    send_queue_push(m->packet);
+  m->packet = NULL;
+} /* }}} void send_merge_finish */
+
+/* Appends the content of "sb" to the packet. Each buffer is encoded starting
+ * from an empty value list, like a packet, so the fields set by the previous
+ * buffer's last parts are cleared first. Must be called with sb->lock
+ * held. */
+static void send_merge_add(send_merge_t *m, send_buffer_t *sb) /* {{{ */
+{
+  size_t const max_size = network_config_packet_size - BUFF_SIG_SIZE;
+
+  if (m->packet != NULL) {
+    value_list_t *vl = &m->vl;
+    char *ptr = m->packet->data + m->packet->size;
+    size_t buffer_free = max_size - m->packet->size;
+    int status = 0;
+
+    /* Strings are cleared with an empty string part, numbers with a zero. */
+    if (vl->host[0] != 0)
+      status |= write_part_string(&ptr, &buffer_free, TYPE_HOST, "", 0);
+    if (vl->time != 0)
+      status |= write_part_number(&ptr, &buffer_free, TYPE_TIME_HR, 0);
+    if (vl->interval != 0)
+      status |= write_part_number(&ptr, &buffer_free, TYPE_INTERVAL_HR, 0);
+    if (vl->plugin[0] != 0)
+      status |= write_part_string(&ptr, &buffer_free, TYPE_PLUGIN, "", 0);
+    if (vl->plugin_instance[0] != 0)
+      status |= write_part_string(&ptr, &buffer_free, TYPE_PLUGIN_INSTANCE, "", 0);
+    if (vl->type[0] != 0)
+      status |= write_part_string(&ptr, &buffer_free, TYPE_TYPE, "", 0);
+    if (vl->type_instance[0] != 0)
+      status |= write_part_string(&ptr, &buffer_free, TYPE_TYPE_INSTANCE, "", 0);
+
+    if ((status == 0) && (buffer_free >= sb->fill)) {
+      memcpy(ptr, sb->data, sb->fill);
+      m->packet->size = (size_t)(ptr - m->packet->data) + sb->fill;
+      memcpy(&m->vl, &sb->vl, sizeof(m->vl));
+      return;
+    }
 
-  cypher = network_get_aes256_cypher(se, pea.iv, sizeof(pea.iv),
-                                     se->data.client.password);
-  if (cypher == NULL)
-    return;
+    send_merge_finish(m);
+  }
 
-  /* Encrypt the buffer in-place */
-  err = gcry_cipher_encrypt(cypher, buffer + header_size,
-                            buffer_size - header_size,
-                            /* in = */ NULL, /* in len = */ 0);
-  if (err != 0) {
-    ERROR("network plugin: gcry_cipher_encrypt returned: %s",
-          gcry_strerror(err));
+  m->packet = send_packet_create();
+  if (m->packet == NULL)
     return;
+
+  memcpy(m->packet->data, sb->data, sb->fill);
+  m->packet->size = sb->fill;
+  memcpy(&m->vl, &sb->vl, sizeof(m->vl));
+} /* }}} void send_merge_add */
+
+/* Merges the content of the send buffers into as few packets as possible and
+ * queues them. With "stale_only", only buffers whose deadline has passed are
+ * merged. Otherwise, all buffers which have not been updated for "timeout"
+ * are merged, or all buffers if "timeout" is zero. Must not be called with a
+ * buffer's lock held. */
+static void send_buffers_merge(cdtime_t timeout, bool stale_only) /* {{{ */
+{
+  send_merge_t m = {0};
+  cdtime_t now = cdtime();
+  cdtime_t deadline = 0;
+
+  pthread_mutex_lock(&send_buffers_lock);
+  for (send_buffer_t *sb = send_buffers; sb != NULL; sb = sb->next) {
+    pthread_mutex_lock(&sb->lock);
+
+    bool merge = (sb->fill > 0) && (sb->deadline <= now);
+    if (!stale_only && (sb->fill > 0))
+      merge = merge || (timeout == 0) || ((sb->last_update + timeout) <= now);
+
+    if (merge) {
+      send_merge_add(&m, sb);
+      send_buffer_reset(sb);
+    } else if ((sb->fill > 0) && ((deadline == 0) || (sb->deadline < deadline)))
+      deadline = sb->deadline;
+    pthread_mutex_unlock(&sb->lock);
   }
+  C_ATOMIC_STORE(&send_buffers_deadline, deadline);
+  pthread_mutex_unlock(&send_buffers_lock);
 
-  /* Send it out without further modifications */
-  network_send_buffer_plain(se, buffer, buffer_size);
-} /* }}} void network_send_buffer_encrypted */
-#undef BUFFER_ADD
-#endif /* HAVE_GCRYPT_H */
+  send_merge_finish(&m);
+} /* }}} void send_buffers_merge */
 
-static void network_send_buffer(char *buffer, size_t buffer_len) /* {{{ */
+static void send_buffers_destroy(void) /* {{{ */
 {
-  DEBUG("network plugin: network_send_buffer: buffer_len = %" PRIsz,
-        buffer_len);
-
-  for (sockent_t *se = sending_sockets; se != NULL; se = se->next) {
-#if HAVE_GCRYPT_H
-    if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
-      network_send_buffer_encrypted(se, buffer, buffer_len);
-    else if (se->data.client.security_level == SECURITY_LEVEL_SIGN)
-      network_send_buffer_signed(se, buffer, buffer_len);
-    else /* if (se->data.client.security_level == SECURITY_LEVEL_NONE) */
-#endif   /* HAVE_GCRYPT_H */
-      network_send_buffer_plain(se, buffer, buffer_len);
-  } /* for (sending_sockets) */
-} /* }}} void network_send_buffer */
+  pthread_mutex_lock(&send_buffers_lock);
+  while (send_buffers != NULL) {
+    send_buffer_t *next = send_buffers->next;
+    pthread_mutex_destroy(&send_buffers->lock);
+    sfree(send_buffers->data);
+    sfree(send_buffers);
+    send_buffers = next;
+  }
+  pthread_mutex_unlock(&send_buffers_lock);
+} /* }}} void send_buffers_destroy */
 
 static int add_to_buffer(char *buffer, size_t buffer_size, /* {{{ */
                          value_list_t *vl_def, const data_set_t *ds,
@@ -2616,21 +4885,10 @@ static int add_to_buffer(char *buffer, size_t buffer_size, /* {{{ */
   return buffer - buffer_orig;
 } /* }}} int add_to_buffer */
 
-static void flush_buffer(void) {
-  DEBUG("network plugin: flush_buffer: send_buffer_fill = %i",
-        send_buffer_fill);
-
-  network_send_buffer(send_buffer, (size_t)send_buffer_fill);
-
-  stats_octets_tx += ((uint64_t)send_buffer_fill);
-  stats_packets_tx++;
-
-  network_init_buffer();
-}
-
 static int network_write(const data_set_t *ds, const value_list_t *vl,
                          user_data_t __attribute__((unused)) * user_data) {
   int status;
+  cdtime_t deadline = 0;
 
   /* listen_loop is set to non-zero in the shutdown callback, which is
    * guaranteed to be called *after* all the write threads have been shut
@@ -2654,45 +4912,70 @@ static int network_write(const data_set_t *ds, const value_list_t *vl,
     return 0;
   }
 
+  send_buffer_t *sb = send_buffer_get();
+  if (sb == NULL) {
+    ERROR("network plugin: Allocating the send buffer failed.");
+    return -1;
+  }
+
   uc_meta_data_add_unsigned_int(vl, "network:time_sent", (uint64_t)vl->time);
 
-  pthread_mutex_lock(&send_buffer_lock);
+  /* Send the values of stale buffers before adding to this one, so that an
+   * older value of this identifier is not sent after this one. */
+  cdtime_t now = cdtime();
+  cdtime_t earliest = C_ATOMIC_LOAD(&send_buffers_deadline);
+  if ((earliest != 0) && (earliest <= now))
+    send_buffers_merge(/* timeout = */ 0, /* stale_only = */ true);
 
-  status = add_to_buffer(send_buffer_ptr,
-                         network_config_packet_size -
-                             (send_buffer_fill + BUFF_SIG_SIZE),
-                         &send_buffer_vl, ds, vl);
-  if (status >= 0) {
-    /* status == bytes added to the buffer */
-    send_buffer_fill += status;
-    send_buffer_ptr += status;
-    send_buffer_last_update = cdtime();
+  pthread_mutex_lock(&sb->lock);
 
-    stats_values_sent++;
-  } else {
-    flush_buffer();
+  status = add_to_buffer(sb->data + sb->fill,
+                         network_config_packet_size -
+                             (sb->fill + BUFF_SIG_SIZE),
+                         &sb->vl, ds, vl);
+  if (status < 0) {
+    send_buffer_flush(sb);
 
-    status = add_to_buffer(send_buffer_ptr,
+    status = add_to_buffer(sb->data + sb->fill,
                            network_config_packet_size -
-                               (send_buffer_fill + BUFF_SIG_SIZE),
-                           &send_buffer_vl, ds, vl);
-
-    if (status >= 0) {
-      send_buffer_fill += status;
-      send_buffer_ptr += status;
-
-      stats_values_sent++;
-    }
+                               (sb->fill + BUFF_SIG_SIZE),
+                           &sb->vl, ds, vl);
   }
 
   if (status < 0) {
     ERROR("network plugin: Unable to append to the "
           "buffer for some weird reason");
-  } else if ((network_config_packet_size - send_buffer_fill) < 15) {
-    flush_buffer();
+  } else {
+    /* status == bytes added to the buffer */
+    sb->fill += (size_t)status;
+    sb->last_update = now;
+    if ((sb->deadline == 0) || (now + vl->interval / 2 < sb->deadline)) {
+      sb->deadline = now + vl->interval / 2;
+      deadline = sb->deadline;
+    }
+
+    C_ATOMIC_ADD(&stats_values_sent, 1);
+
+    if ((network_config_packet_size - sb->fill) < 15) {
+      send_buffer_flush(sb);
+      deadline = 0;
+    }
+  }
+
+  pthread_mutex_unlock(&sb->lock);
+
+  /* Lower the earliest deadline without holding sb->lock, which
+   * send_buffers_merge() acquires after send_buffers_lock. */
+  if (deadline != 0) {
+    pthread_mutex_lock(&send_buffers_lock);
+    cdtime_t tmp = C_ATOMIC_LOAD(&send_buffers_deadline);
+    if ((tmp == 0) || (deadline < tmp))
+      C_ATOMIC_STORE(&send_buffers_deadline, deadline);
+    pthread_mutex_unlock(&send_buffers_lock);
   }
 
-  pthread_mutex_unlock(&send_buffer_lock);
+  /* Send packets queued above, if any. */
+  send_queue_send(/* block = */ false);
 
   return (status < 0) ? -1 : 0;
 } /* int network_write */
@@ -2713,6 +4996,113 @@ static int network_config_set_ttl(const oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int network_config_set_ttl */
 
+static int
+network_config_set_receive_threads(const oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+
+  if (cf_util_get_int(ci, &tmp) != 0)
+    return -1;
+  else if ((tmp < 0) || (tmp > 256)) {
+    WARNING("network plugin: The `ReceiveThreads' must be between 0 and 256.");
+    return -1;
+  }
+
+#ifndef SO_REUSEPORT
+  if (tmp > 1) {
+    WARNING("network plugin: SO_REUSEPORT is not available on this system, "
+            "using a single receive thread.");
+    tmp = 1;
+  }
+#endif
+
+  network_config_receive_threads = (size_t)tmp;
+  return 0;
+} /* }}} int network_config_set_receive_threads */
+
+static int
+network_config_set_dispatch_threads(const oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+
+  if (cf_util_get_int(ci, &tmp) != 0)
+    return -1;
+  else if ((tmp < 1) || (tmp > 256)) {
+    WARNING("network plugin: The `DispatchThreads' must be between 1 and 256.");
+    return -1;
+  }
+
+  network_config_dispatch_threads = (size_t)tmp;
+  return 0;
+} /* }}} int network_config_set_dispatch_threads */
+
+static int network_config_set_receive_cpus(const oconfig_item_t *ci) /* {{{ */
+{
+  if (ci->values_num < 1) {
+    WARNING("network plugin: The `ReceiveThreadCPUs' option needs at least "
+            "one argument.");
+    return -1;
+  }
+
+  int *cpus = calloc(ci->values_num, sizeof(*cpus));
+  if (cpus == NULL) {
+    ERROR("network plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  for (int i = 0; i < ci->values_num; i++) {
+    if ((ci->values[i].type != OCONFIG_TYPE_NUMBER) ||
+        (ci->values[i].value.number < 0) ||
+        (ci->values[i].value.number > INT_MAX)) {
+      WARNING("network plugin: The arguments of the `ReceiveThreadCPUs' "
+              "option must be CPU numbers.");
+      sfree(cpus);
+      return -1;
+    }
+    cpus[i] = (int)ci->values[i].value.number;
+  }
+
+  sfree(network_config_receive_cpus);
+  network_config_receive_cpus = cpus;
+  network_config_receive_cpus_num = (size_t)ci->values_num;
+  return 0;
+} /* }}} int network_config_set_receive_cpus */
+
+static int network_config_set_sender_topk(const oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+  int max = SENDER_SHARDS_NUM * SENDER_SHARD_SIZE_MAX;
+
+  if (cf_util_get_int(ci, &tmp) != 0)
+    return -1;
+  else if ((tmp < 0) || (tmp > max)) {
+    WARNING("network plugin: The `SenderTopK' must be between 0 and %i.", max);
+    return -1;
+  }
+
+  network_config_sender_topk = (size_t)tmp;
+  return 0;
+} /* }}} int network_config_set_sender_topk */
+
+static int
+network_config_set_sender_rate_limit(const oconfig_item_t *ci) /* {{{ */
+{
+  double tmp = 0.0;
+
+  if (cf_util_get_double(ci, &tmp) != 0)
+    return -1;
+  else if (!(tmp >= 0.0)) {
+    WARNING("network plugin: The `SenderRateLimit' must not be negative.");
+    return -1;
+  } else if ((tmp > 0.0) && (tmp < 1.0)) {
+    /* A sender needs one full token per packet. */
+    tmp = 1.0;
+  }
+
+  network_config_sender_rate_limit = tmp;
+  return 0;
+} /* }}} int network_config_set_sender_rate_limit */
+
 static int network_config_set_interface(const oconfig_item_t *ci, /* {{{ */
                                         int *interface) {
   char if_name[256];
@@ -2779,11 +5169,20 @@ static int network_config_set_buffer_size(const oconfig_item_t *ci) /* {{{ */
 {
   int tmp = 0;
 
+  if ((ci->values_num == 1) && (ci->values[0].type == OCONFIG_TYPE_STRING) &&
+      (strcasecmp("auto", ci->values[0].value.string) == 0)) {
+    /* Determined by network_init(), once all servers are known. */
+    network_config_packet_size_auto = true;
+    return 0;
+  }
+
   if (cf_util_get_int(ci, &tmp) != 0)
     return -1;
-  else if ((tmp >= 1024) && (tmp <= 65535))
+  else if ((tmp >= 1024) && (tmp <= 65535)) {
     network_config_packet_size = tmp;
-  else {
+    network_config_receive_size = tmp;
+    network_config_packet_size_auto = false;
+  } else {
     WARNING(
         "network plugin: The `MaxPacketSize' must be between 1024 and 65535.");
     return -1;
@@ -2792,6 +5191,25 @@ static int network_config_set_buffer_size(const oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int network_config_set_buffer_size */
 
+static int network_config_set_protocol(const oconfig_item_t *ci, /* {{{ */
+                                       int *socktype) {
+  char buffer[8];
+
+  if (cf_util_get_string_buffer(ci, buffer, sizeof(buffer)) != 0)
+    return -1;
+
+  if (strcasecmp("UDP", buffer) == 0)
+    *socktype = SOCK_DGRAM;
+  else if (strcasecmp("TCP", buffer) == 0)
+    *socktype = SOCK_STREAM;
+  else {
+    WARNING("network plugin: Unknown protocol: %s.", buffer);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int network_config_set_protocol */
+
 #if HAVE_GCRYPT_H
 static int network_config_set_security_level(oconfig_item_t *ci, /* {{{ */
                                              int *retval) {
@@ -2805,7 +5223,15 @@ static int network_config_set_security_level(oconfig_item_t *ci, /* {{{ */
   str = ci->values[0].value.string;
   if (strcasecmp("Encrypt", str) == 0)
     *retval = SECURITY_LEVEL_ENCRYPT;
-  else if (strcasecmp("Sign", str) == 0)
+  else if (strcasecmp("EncryptGCM", str) == 0) {
+#if HAVE_GCRYPT_GCM
+    *retval = SECURITY_LEVEL_ENCRYPT_GCM;
+#else
+    WARNING("network plugin: The \"EncryptGCM\" security level requires "
+            "libgcrypt 1.6.0 or later.");
+    return -1;
+#endif
+  } else if (strcasecmp("Sign", str) == 0)
     *retval = SECURITY_LEVEL_SIGN;
   else if (strcasecmp("None", str) == 0)
     *retval = SECURITY_LEVEL_NONE;
@@ -2818,6 +5244,48 @@ static int network_config_set_security_level(oconfig_item_t *ci, /* {{{ */
 } /* }}} int network_config_set_security_level */
 #endif /* HAVE_GCRYPT_H */
 
+/* Adds the interfaces of an "Interface" option in a "Listen" block, which may
+ * name several and may be given more than once. */
+static int network_config_add_listen_interfaces(const oconfig_item_t *ci,
+                                                sockent_t *se) /* {{{ */
+{
+  if (ci->values_num < 1) {
+    ERROR("network plugin: The `Interface' option needs at least one "
+          "argument.");
+    return -1;
+  }
+
+  for (int i = 0; i < ci->values_num; i++) {
+    if (ci->values[i].type != OCONFIG_TYPE_STRING) {
+      ERROR("network plugin: The arguments of the `Interface' option must be "
+            "strings.");
+      return -1;
+    }
+  }
+
+  int *tmp = realloc(se->data.server.interfaces,
+                     (se->data.server.interfaces_num + ci->values_num) *
+                         sizeof(*tmp));
+  if (tmp == NULL) {
+    ERROR("network plugin: realloc failed.");
+    return ENOMEM;
+  }
+  se->data.server.interfaces = tmp;
+
+  for (int i = 0; i < ci->values_num; i++) {
+    int idx = if_nametoindex(ci->values[i].value.string);
+    if (idx == 0) {
+      ERROR("network plugin: Unknown interface \"%s\".",
+            ci->values[i].value.string);
+      continue;
+    }
+    se->data.server.interfaces[se->data.server.interfaces_num] = idx;
+    se->data.server.interfaces_num++;
+  }
+
+  return 0;
+} /* }}} int network_config_add_listen_interfaces */
+
 static int network_config_add_listen(const oconfig_item_t *ci) /* {{{ */
 {
   sockent_t *se;
@@ -2848,17 +5316,39 @@ static int network_config_add_listen(const oconfig_item_t *ci) /* {{{ */
 #if HAVE_GCRYPT_H
     if (strcasecmp("AuthFile", child->key) == 0)
       cf_util_get_string(child, &se->data.server.auth_file);
-    else if (strcasecmp("SecurityLevel", child->key) == 0)
+    else if (strcasecmp("SecurityLevel", child->key) == 0) {
       network_config_set_security_level(child, &se->data.server.security_level);
-    else
+#if HAVE_GCRYPT_GCM
+      if (se->data.server.security_level == SECURITY_LEVEL_ENCRYPT_GCM)
+        se->data.server.security_level = SECURITY_LEVEL_ENCRYPT;
+#endif
+    } else
 #endif /* HAVE_GCRYPT_H */
         if (strcasecmp("Interface", child->key) == 0)
-      network_config_set_interface(child, &se->interface);
+      network_config_add_listen_interfaces(child, se);
+    else if (strcasecmp("Protocol", child->key) == 0)
+      network_config_set_protocol(child, &se->socktype);
     else {
       WARNING("network plugin: Option `%s' is not allowed here.", child->key);
     }
   }
 
+  /* A single interface is handled like before. */
+  if (se->data.server.interfaces_num == 1) {
+    se->interface = se->data.server.interfaces[0];
+    sfree(se->data.server.interfaces);
+    se->data.server.interfaces_num = 0;
+  }
+
+#if !HAVE_SYS_EPOLL_H
+  if (se->socktype == SOCK_STREAM) {
+    ERROR("network plugin: \"Protocol TCP\" is not supported for Listen "
+          "blocks on this system, because epoll(7) is not available.");
+    sockent_destroy(se);
+    return -1;
+  }
+#endif
+
 #if HAVE_GCRYPT_H
   if ((se->data.server.security_level > SECURITY_LEVEL_NONE) &&
       (se->data.server.auth_file == NULL)) {
@@ -2938,6 +5428,8 @@ static int network_config_add_server(const oconfig_item_t *ci) /* {{{ */
       network_config_set_bind_address(child, &se->data.client.bind_addr);
     else if (strcasecmp("ResolveInterval", child->key) == 0)
       cf_util_get_cdtime(child, &se->data.client.resolve_interval);
+    else if (strcasecmp("Protocol", child->key) == 0)
+      network_config_set_protocol(child, &se->socktype);
     else {
       WARNING("network plugin: Option `%s' is not allowed here.", child->key);
     }
@@ -2964,7 +5456,7 @@ static int network_config_add_server(const oconfig_item_t *ci) /* {{{ */
   }
 
   /* No call to sockent_client_connect() here -- it is called from
-   * network_send_buffer_plain(). */
+   * network_send_buffers_plain(). */
 
   status = sockent_add(se);
   if (status != 0) {
@@ -2983,6 +5475,8 @@ static int network_config(oconfig_item_t *ci) /* {{{ */
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp("TimeToLive", child->key) == 0)
       network_config_set_ttl(child);
+    else if (strcasecmp("ReceiveThreads", child->key) == 0)
+      network_config_set_receive_threads(child);
   }
 
   for (int i = 0; i < ci->children_num; i++) {
@@ -2992,15 +5486,33 @@ static int network_config(oconfig_item_t *ci) /* {{{ */
       network_config_add_listen(child);
     else if (strcasecmp("Server", child->key) == 0)
       network_config_add_server(child);
-    else if (strcasecmp("TimeToLive", child->key) == 0) {
+    else if ((strcasecmp("TimeToLive", child->key) == 0) ||
+             (strcasecmp("ReceiveThreads", child->key) == 0)) {
       /* Handled earlier */
     } else if (strcasecmp("MaxPacketSize", child->key) == 0)
       network_config_set_buffer_size(child);
     else if (strcasecmp("Forward", child->key) == 0)
       cf_util_get_boolean(child, &network_config_forward);
+    else if (strcasecmp("Proxy", child->key) == 0)
+      cf_util_get_boolean(child, &network_config_proxy);
     else if (strcasecmp("ReportStats", child->key) == 0)
       cf_util_get_boolean(child, &network_config_stats);
-    else {
+    else if (strcasecmp("DispatchThreads", child->key) == 0)
+      network_config_set_dispatch_threads(child);
+    else if (strcasecmp("ReceiveThreadCPUs", child->key) == 0)
+      network_config_set_receive_cpus(child);
+    else if (strcasecmp("SenderTopK", child->key) == 0)
+      network_config_set_sender_topk(child);
+    else if (strcasecmp("SenderRateLimit", child->key) == 0)
+      network_config_set_sender_rate_limit(child);
+    else if (strcasecmp("Compress", child->key) == 0) {
+#if HAVE_LIBZ
+      cf_util_get_boolean(child, &network_config_compress);
+#else
+      WARNING("network plugin: The `Compress' option is not available: zlib "
+              "support has not been compiled in.");
+#endif
+    } else {
       WARNING("network plugin: Option `%s' is not allowed here.", child->key);
     }
   }
@@ -3071,7 +5583,9 @@ static int network_notification(const notification_t *n,
   if (status != 0)
     return -1;
 
-  network_send_buffer(buffer, sizeof(buffer) - buffer_free);
+  if (send_queue_push_buffer(buffer, sizeof(buffer) - buffer_free) != 0)
+    return -1;
+  send_queue_send(/* block = */ false);
 
   return 0;
 } /* int network_notification */
@@ -3088,22 +5602,46 @@ static int network_shutdown(void) {
     receive_thread_running = 0;
   }
 
-  /* Shutdown the dispatching thread */
-  if (dispatch_thread_running != 0) {
-    INFO("network plugin: Stopping dispatch thread.");
-    pthread_mutex_lock(&receive_list_lock);
-    pthread_cond_broadcast(&receive_list_cond);
-    pthread_mutex_unlock(&receive_list_lock);
-    pthread_join(dispatch_thread_id, /* ret = */ NULL);
-    dispatch_thread_running = 0;
+  if (receive_workers_num > 0) {
+    INFO("network plugin: Stopping %" PRIsz " receive threads.",
+         receive_workers_num);
+    receive_workers_destroy();
+  }
+
+#if HAVE_SYS_EPOLL_H
+  if (stream_workers_num > 0) {
+    INFO("network plugin: Stopping %" PRIsz " TCP receive thread(s).",
+         stream_workers_num);
+    stream_workers_destroy();
+  }
+#endif
+
+  /* Shutdown the dispatching threads */
+  if (dispatch_workers_num > 0) {
+    INFO("network plugin: Stopping %" PRIsz " dispatch thread(s).",
+         dispatch_workers_num);
+    dispatch_workers_destroy();
   }
 
   sockent_destroy(listen_sockets);
+  sockent_destroy(stream_listen_sockets);
+  sender_shards_destroy();
+  sfree(network_config_receive_cpus);
+  network_config_receive_cpus_num = 0;
 
-  if (send_buffer_fill > 0)
-    flush_buffer();
+  if (sending_sockets != NULL) {
+    send_buffers_merge(/* timeout = */ 0, /* stale_only = */ false);
+    send_queue_send(/* block = */ true);
+    send_buffers_destroy();
+    pthread_key_delete(send_buffer_key);
+  }
 
-  sfree(send_buffer);
+#if HAVE_LIBZ
+  if (send_compress_buffer != NULL) {
+    deflateEnd(&send_zstream);
+    sfree(send_compress_buffer);
+  }
+#endif
 
   for (sockent_t *se = sending_sockets; se != NULL; se = se->next)
     sockent_client_disconnect(se);
@@ -3117,6 +5655,78 @@ static int network_shutdown(void) {
   return 0;
 } /* int network_shutdown */
 
+/* Dispatches the counters of the senders in the sender table. "vl" has one
+ * value and the plugin set. */
+static void network_stats_read_senders(value_list_t *vl) /* {{{ */
+{
+  struct {
+    int family;
+    uint8_t addr[16];
+    derive_t packets;
+    derive_t octets;
+    derive_t values;
+    derive_t dropped;
+    gauge_t identifiers;
+  } copy[SENDER_SHARD_SIZE_MAX];
+
+  vl->plugin_instance[0] = 0;
+  vl->type_instance[0] = 0;
+  if (network_config_sender_rate_limit > 0.0) {
+    vl->values[0].derive = C_ATOMIC_LOAD(&stats_packets_rate_limited);
+    sstrncpy(vl->type, "if_rx_dropped", sizeof(vl->type));
+    plugin_dispatch_values(vl);
+  }
+
+  for (size_t i = 0; i < SENDER_SHARDS_NUM; i++) {
+    sender_shard_t *sh = sender_shards + i;
+    size_t copy_num;
+
+    pthread_mutex_lock(&sh->lock);
+    copy_num = sh->senders_num;
+    for (size_t j = 0; j < copy_num; j++) {
+      sender_t const *s = sh->senders + j;
+      copy[j].family = s->family;
+      memcpy(copy[j].addr, s->addr, sizeof(copy[j].addr));
+      copy[j].packets = s->packets;
+      copy[j].octets = s->octets;
+      copy[j].values = s->values;
+      copy[j].dropped = s->dropped;
+      copy[j].identifiers = (gauge_t)c_hll_count(&s->identifiers);
+    }
+    pthread_mutex_unlock(&sh->lock);
+
+    for (size_t j = 0; j < copy_num; j++) {
+      char addr[INET6_ADDRSTRLEN];
+      if (inet_ntop(copy[j].family, copy[j].addr, addr, sizeof(addr)) == NULL)
+        continue;
+      snprintf(vl->plugin_instance, sizeof(vl->plugin_instance), "sender-%s",
+               addr);
+
+      vl->values[0].derive = copy[j].packets;
+      sstrncpy(vl->type, "if_rx_packets", sizeof(vl->type));
+      plugin_dispatch_values(vl);
+
+      vl->values[0].derive = copy[j].octets;
+      sstrncpy(vl->type, "if_rx_octets", sizeof(vl->type));
+      plugin_dispatch_values(vl);
+
+      vl->values[0].derive = copy[j].dropped;
+      sstrncpy(vl->type, "if_rx_dropped", sizeof(vl->type));
+      plugin_dispatch_values(vl);
+
+      vl->values[0].derive = copy[j].values;
+      sstrncpy(vl->type, "total_values", sizeof(vl->type));
+      plugin_dispatch_values(vl);
+
+      vl->values[0].gauge = copy[j].identifiers;
+      sstrncpy(vl->type, "count", sizeof(vl->type));
+      sstrncpy(vl->type_instance, "identifiers", sizeof(vl->type_instance));
+      plugin_dispatch_values(vl);
+      vl->type_instance[0] = 0;
+    }
+  }
+} /* }}} void network_stats_read_senders */
+
 static int network_stats_read(void) /* {{{ */
 {
   derive_t copy_octets_rx;
@@ -3139,7 +5749,9 @@ static int network_stats_read(void) /* {{{ */
   copy_values_not_dispatched = stats_values_not_dispatched;
   copy_values_sent = stats_values_sent;
   copy_values_not_sent = stats_values_not_sent;
-  copy_receive_list_length = receive_list_length;
+  copy_receive_list_length = 0;
+  for (size_t i = 0; i < dispatch_workers_num; i++)
+    copy_receive_list_length += (derive_t)dispatch_workers[i].length;
 
   /* Initialize `vl' */
   vl.values = values;
@@ -3185,9 +5797,119 @@ static int network_stats_read(void) /* {{{ */
   vl.type_instance[0] = 0;
   plugin_dispatch_values(&vl);
 
+  /* Queue length and parsed packets of each dispatch thread */
+  for (size_t i = 0; (dispatch_workers_num > 1) && (i < dispatch_workers_num);
+       i++) {
+    dispatch_worker_t *w = dispatch_workers + i;
+
+    snprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "dispatch%" PRIsz,
+             i);
+
+    vl.values[0].gauge = (gauge_t)w->length;
+    sstrncpy(vl.type, "queue_length", sizeof(vl.type));
+    plugin_dispatch_values(&vl);
+
+    vl.values[0].derive = w->packets;
+    sstrncpy(vl.type, "packets", sizeof(vl.type));
+    plugin_dispatch_values(&vl);
+  }
+
+  if (sender_shards != NULL)
+    network_stats_read_senders(&vl);
+
   return 0;
 } /* }}} int network_stats_read */
 
+/* Returns the largest UDP payload which can be sent to the server without
+ * fragmentation, based on the MTU of the route to it, or zero if that is
+ * unknown. */
+static size_t network_server_payload_size(sockent_t const *se) /* {{{ */
+{
+#if defined(IP_MTU) && defined(IPV6_MTU)
+  struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
+                              .ai_flags = AI_ADDRCONFIG,
+                              .ai_protocol = IPPROTO_UDP,
+                              .ai_socktype = SOCK_DGRAM};
+  struct addrinfo *ai_list;
+
+  int status = getaddrinfo(
+      se->node, (se->service != NULL) ? se->service : NET_DEFAULT_PORT,
+      &ai_hints, &ai_list);
+  if (status != 0) {
+    WARNING("network plugin: getaddrinfo (%s) failed: %s", se->node,
+            gai_strerror(status));
+    return 0;
+  }
+
+  size_t size = 0;
+  for (struct addrinfo *ai = ai_list; ai != NULL; ai = ai->ai_next) {
+    int level = (ai->ai_family == AF_INET6) ? IPPROTO_IPV6 : IPPROTO_IP;
+    int optname = (ai->ai_family == AF_INET6) ? IPV6_MTU : IP_MTU;
+    /* UDP header and IPv4 or IPv6 header without options */
+    int header_size = (ai->ai_family == AF_INET6) ? (8 + 40) : (8 + 20);
+
+    /* Connecting a datagram socket only looks up the route. */
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    int mtu = 0;
+    socklen_t mtu_len = sizeof(mtu);
+    if ((connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) &&
+        (getsockopt(fd, level, optname, &mtu, &mtu_len) == 0) &&
+        (mtu > header_size))
+      size = (size_t)(mtu - header_size);
+    close(fd);
+
+    /* sockent_client_connect() uses the first address, too. */
+    if (size > 0)
+      break;
+  }
+
+  freeaddrinfo(ai_list);
+  return size;
+#else
+  return 0;
+#endif
+} /* }}} size_t network_server_payload_size */
+
+/* Handles "MaxPacketSize auto": packets are as large as the smallest path MTU
+ * to any of the servers allows. The packets other hosts send may be larger,
+ * so the receive buffers have the maximum size. */
+static void network_set_packet_size_auto(void) /* {{{ */
+{
+  size_t size = 0;
+
+  for (sockent_t *se = sending_sockets; se != NULL; se = se->next) {
+    /* TCP splits the packets into segments itself. */
+    size_t tmp = (se->socktype == SOCK_STREAM) ? 65507
+                                               : network_server_payload_size(se);
+    if (tmp == 0) {
+      WARNING("network plugin: Unable to determine the path MTU to \"%s\".",
+              se->node);
+      continue;
+    }
+    if ((size == 0) || (tmp < size))
+      size = tmp;
+  }
+
+  /* IPv4 limits the payload of a UDP datagram to 65507 bytes. */
+  if (size > 65507)
+    size = 65507;
+  else if ((size > 0) && (size < 1024))
+    size = 1024;
+
+  if (size > 0) {
+    network_config_packet_size = size;
+    INFO("network plugin: Using a packet size of %" PRIsz " bytes.", size);
+  } else if (sending_sockets != NULL) {
+    WARNING("network plugin: Using the default packet size of %" PRIsz
+            " bytes.",
+            network_config_packet_size);
+  }
+  network_config_receive_size = 65535;
+} /* }}} void network_set_packet_size_auto */
+
 static int network_init(void) {
   static bool have_init;
 
@@ -3197,40 +5919,82 @@ static int network_init(void) {
     return 0;
   have_init = true;
 
+  if (network_config_packet_size_auto)
+    network_set_packet_size_auto();
+
   if (network_config_stats)
     plugin_register_read("network", network_stats_read);
 
   plugin_register_shutdown("network", network_shutdown);
 
-  send_buffer = malloc(network_config_packet_size);
-  if (send_buffer == NULL) {
-    ERROR("network plugin: malloc failed.");
-    return -1;
+  if (network_config_proxy && (sending_sockets == NULL)) {
+    WARNING("network plugin: `Proxy' is enabled, but no `Server' is "
+            "configured. Dispatching the received values instead.");
+    network_config_proxy = false;
+  }
+
+  if ((network_config_receive_cpus_num > 0) &&
+      (network_config_receive_threads == 0))
+    WARNING("network plugin: The `ReceiveThreadCPUs' option has no effect "
+            "without `ReceiveThreads'.");
+
+  if ((network_config_sender_rate_limit > 0.0) &&
+      (network_config_sender_topk == 0))
+    network_config_sender_topk = SENDER_TOPK_DEFAULT;
+
+  if ((network_config_sender_topk > 0) &&
+      ((listen_sockets_num > 0) || (stream_listen_sockets_num > 0)) &&
+      (sender_shards == NULL)) {
+    int status = sender_shards_create();
+    if (status != 0)
+      return status;
   }
-  network_init_buffer();
 
   /* setup socket(s) and so on */
   if (sending_sockets != NULL) {
+    int status = pthread_key_create(&send_buffer_key, /* destructor = */ NULL);
+    if (status != 0) {
+      ERROR("network plugin: pthread_key_create failed: %s", STRERROR(status));
+      return -1;
+    }
+
     plugin_register_write("network", network_write,
                           /* user_data = */ NULL);
     plugin_register_notification("network", network_notification,
                                  /* user_data = */ NULL);
   }
 
+#if HAVE_SYS_EPOLL_H
+  if ((stream_listen_sockets_num > 0) && (stream_workers_num == 0)) {
+    int status = stream_workers_create();
+    if (status != 0) {
+      ERROR("network plugin: Creating the TCP receive threads failed: %s",
+            STRERROR(status));
+      return status;
+    }
+  }
+#endif
+
   /* If no threads need to be started, return here. */
   if ((listen_sockets_num == 0) ||
-      ((dispatch_thread_running != 0) && (receive_thread_running != 0)))
+      ((dispatch_workers_num != 0) && (receive_thread_running != 0)) ||
+      (receive_workers_num > 0))
     return 0;
 
-  if (dispatch_thread_running == 0) {
-    int status;
-    status = plugin_thread_create(&dispatch_thread_id, NULL /* no attributes */,
-                                  dispatch_thread, NULL /* no argument */,
-                                  "network disp");
+  if (network_config_receive_threads > 0) {
+    int status = receive_workers_create();
+    if (status != 0)
+      ERROR("network plugin: Creating the receive threads failed: %s",
+            STRERROR(status));
+    return status;
+  }
+
+  if (dispatch_workers_num == 0) {
+    int status = dispatch_workers_create();
     if (status != 0) {
-      ERROR("network: pthread_create failed: %s", STRERRNO);
-    } else {
-      dispatch_thread_running = 1;
+      ERROR("network plugin: Creating the dispatch threads failed: %s",
+            STRERROR(status));
+      return status;
     }
   }
 
@@ -3259,19 +6023,8 @@ static int network_init(void) {
 static int network_flush(cdtime_t timeout,
                          __attribute__((unused)) const char *identifier,
                          __attribute__((unused)) user_data_t *user_data) {
-  pthread_mutex_lock(&send_buffer_lock);
-
-  if (send_buffer_fill > 0) {
-    if (timeout > 0) {
-      cdtime_t now = cdtime();
-      if ((send_buffer_last_update + timeout) > now) {
-        pthread_mutex_unlock(&send_buffer_lock);
-        return 0;
-      }
-    }
-    flush_buffer();
-  }
-  pthread_mutex_unlock(&send_buffer_lock);
+  send_buffers_merge(timeout, /* stale_only = */ false);
+  send_queue_send(/* block = */ true);
 
   return 0;
 } /* int network_flush */
@@ -76,5 +76,11 @@
 
 #define TYPE_SIGN_SHA256 0x0200
 #define TYPE_ENCR_AES256 0x0210
+/* Username, IV, AES-256-GCM encrypted parts and the authentication tag. */
+#define TYPE_ENCR_AES256_GCM 0x0211
+
+/* The payload is a 32 bit uncompressed size followed by the zlib compressed
+ * parts. Parts fill the uncompressed data like a packet of their own. */
+#define TYPE_COMPR_ZLIB 0x0220
 
 #endif /* NETWORK_H */
@@ -0,0 +1,144 @@
+/**
+ * collectd - src/network_bench.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Benchmark for parse_packet(), including dispatching the received values
+ * to a write callback. Packets are unsigned and unencrypted.
+ */
+
+#include "network.c" /* sic */
+
+#include "benchmark.h"
+#include "plugin_bench.h"
+
+/* Number of value lists per packet. */
+#define BENCH_PACKET_VALUES 20
+
+/* Number of packets, each from a different host. The packets are parsed in
+ * turn, so that the write threads, which may reorder value lists, don't see
+ * two updates of the same identifier at the same time. */
+#define BENCH_PACKETS 100
+
+/* Maximum number of value lists in the write queue while dispatching. */
+#define BENCH_PENDING 1024
+
+typedef struct {
+  char data[1452];
+  size_t size;
+  size_t time_offset;
+} bench_packet_t;
+
+static bench_packet_t bench_packets[BENCH_PACKETS];
+static cdtime_t bench_time;
+
+/* Encodes BENCH_PACKET_VALUES value lists with the same host and time. The
+ * packet starts with the host part followed by the time part, which is
+ * updated for every parse: the value cache ignores values which are not newer
+ * than the cached ones. */
+static int bench_packet_init(bench_packet_t *p, char const *host) {
+  value_t values[2] = {{.derive = 1}, {.derive = 2}};
+  value_list_t vl = {
+      .values = values,
+      .values_len = STATIC_ARRAY_SIZE(values),
+      .time = bench_time,
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .plugin = "interface",
+      .type = "bench",
+  };
+  sstrncpy(vl.host, host, sizeof(vl.host));
+
+  value_list_t vl_def = {0};
+
+  data_set_t const *ds = plugin_get_ds(vl.type);
+  if (ds == NULL)
+    return -1;
+
+  p->time_offset = sizeof(part_header_t) + strlen(vl.host) + 1;
+  p->size = 0;
+  for (size_t i = 0; i < BENCH_PACKET_VALUES; i++) {
+    snprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "eth%zu", i);
+
+    int status = add_to_buffer(p->data + p->size, sizeof(p->data) - p->size,
+                               &vl_def, ds, &vl);
+    if (status < 0)
+      return -1;
+    p->size += (size_t)status;
+  }
+
+  return 0;
+}
+
+static void bench_packet_set_time(bench_packet_t *p, cdtime_t t) {
+  uint64_t tmp = htonll((uint64_t)t);
+  memcpy(p->data + p->time_offset + sizeof(part_header_t), &tmp, sizeof(tmp));
+}
+
+DEF_BENCH(parse_packet) {
+  sockent_t se = {.type = SOCKENT_TYPE_SERVER};
+  char buffer[sizeof(bench_packets[0].data)];
+  uint64_t start = plugin_bench_written();
+  uint64_t dispatched = 0;
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    bench_packet_t *p = bench_packets + (i % BENCH_PACKETS);
+
+    if ((i % BENCH_PACKETS) == 0)
+      bench_time += TIME_T_TO_CDTIME_T(10);
+    bench_packet_set_time(p, bench_time);
+
+    /* parse_packet() works on the receive buffer. */
+    memcpy(buffer, p->data, p->size);
+    parse_packet(&se, buffer, p->size, /* flags = */ 0, /* username = */ NULL,
+                 /* acc = */ NULL, /* proxy = */ NULL);
+
+    dispatched += BENCH_PACKET_VALUES;
+    if (plugin_bench_wait(start + dispatched, BENCH_PENDING) != 0)
+      exit(1);
+  }
+
+  if (plugin_bench_wait(start + dispatched, /* pending = */ 0) != 0)
+    exit(1);
+}
+
+int main(void) {
+  if (plugin_bench_init() != 0) {
+    fprintf(stderr, "plugin_bench_init failed\n");
+    return 1;
+  }
+
+  bench_time = cdtime();
+  for (size_t i = 0; i < BENCH_PACKETS; i++) {
+    char host[DATA_MAX_NAME_LEN];
+    snprintf(host, sizeof(host), "host%03zu.example.com", i);
+    if (bench_packet_init(bench_packets + i, host) != 0) {
+      fprintf(stderr, "Encoding the packets failed\n");
+      return 1;
+    }
+  }
+
+  RUN_BENCH(parse_packet, 50000);
+
+  plugin_bench_shutdown();
+
+  END_BENCH;
+}
@@ -30,141 +30,163 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_curl_engine.h"
 
 #include <curl/curl.h>
 
-static char *url;
-static char *user;
-static char *pass;
-static char *verify_peer;
-static char *verify_host;
-static char *cacert;
-static char *timeout;
+struct nginx_s {
+  char *name;
+  char *url;
+  char *user;
+  char *pass;
+  bool verify_peer;
+  bool verify_host;
+  char *cacert;
+  int timeout;
 
-static CURL *curl;
+  CURL *curl;
+  curl_engine_request_t request;
+  char curl_error[CURL_ERROR_SIZE];
 
-static char nginx_buffer[16384];
-static size_t nginx_buffer_len;
-static char nginx_curl_error[CURL_ERROR_SIZE];
+  char buffer[16384];
+  size_t buffer_len;
+};
+typedef struct nginx_s nginx_t;
 
-static const char *config_keys[] = {
-    "URL", "User", "Password", "VerifyPeer", "VerifyHost", "CACert", "Timeout"};
-static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
+static void nginx_done(curl_engine_request_t *req, CURLcode status);
 
 static size_t nginx_curl_callback(void *buf, size_t size, size_t nmemb,
-                                  void __attribute__((unused)) * stream) {
+                                  void *user_data) {
+  nginx_t *st = user_data;
   size_t len = size * nmemb;
 
   /* Check if the data fits into the memory. If not, truncate it. */
-  if ((nginx_buffer_len + len) >= sizeof(nginx_buffer)) {
-    assert(sizeof(nginx_buffer) > nginx_buffer_len);
-    len = (sizeof(nginx_buffer) - 1) - nginx_buffer_len;
+  if ((st->buffer_len + len) >= sizeof(st->buffer)) {
+    assert(sizeof(st->buffer) > st->buffer_len);
+    len = (sizeof(st->buffer) - 1) - st->buffer_len;
   }
 
   if (len == 0)
     return len;
 
-  memcpy(&nginx_buffer[nginx_buffer_len], buf, len);
-  nginx_buffer_len += len;
-  nginx_buffer[nginx_buffer_len] = 0;
+  memcpy(&st->buffer[st->buffer_len], buf, len);
+  st->buffer_len += len;
+  st->buffer[st->buffer_len] = 0;
 
   return len;
 }
 
-static int config_set(char **var, const char *value) {
-  if (*var != NULL) {
-    free(*var);
-    *var = NULL;
-  }
+static void nginx_free(void *arg) {
+  nginx_t *st = arg;
 
-  if ((*var = strdup(value)) == NULL)
-    return 1;
-  else
-    return 0;
-}
+  if (st == NULL)
+    return;
 
-static int config(const char *key, const char *value) {
-  if (strcasecmp(key, "url") == 0)
-    return config_set(&url, value);
-  else if (strcasecmp(key, "user") == 0)
-    return config_set(&user, value);
-  else if (strcasecmp(key, "password") == 0)
-    return config_set(&pass, value);
-  else if (strcasecmp(key, "verifypeer") == 0)
-    return config_set(&verify_peer, value);
-  else if (strcasecmp(key, "verifyhost") == 0)
-    return config_set(&verify_host, value);
-  else if (strcasecmp(key, "cacert") == 0)
-    return config_set(&cacert, value);
-  else if (strcasecmp(key, "timeout") == 0)
-    return config_set(&timeout, value);
-  else
-    return -1;
-} /* int config */
+  if (st->curl != NULL) {
+    curl_engine_cancel(&st->request);
+    curl_easy_cleanup(st->curl);
+  }
 
-static int init(void) {
-  if (curl != NULL)
-    curl_easy_cleanup(curl);
+  sfree(st->name);
+  sfree(st->url);
+  sfree(st->user);
+  sfree(st->pass);
+  sfree(st->cacert);
+  sfree(st);
+} /* void nginx_free */
+
+static nginx_t *nginx_alloc(void) {
+  nginx_t *st = calloc(1, sizeof(*st));
+  if (st == NULL) {
+    ERROR("nginx plugin: calloc failed.");
+    return NULL;
+  }
 
-  if ((curl = curl_easy_init()) == NULL) {
+  st->verify_peer = true;
+  st->verify_host = true;
+  st->timeout = -1;
+
+  return st;
+} /* nginx_t *nginx_alloc */
+
+static int nginx_config_option(nginx_t *st, oconfig_item_t *child) {
+  if (strcasecmp(child->key, "URL") == 0)
+    return cf_util_get_string(child, &st->url);
+  else if (strcasecmp(child->key, "User") == 0)
+    return cf_util_get_string(child, &st->user);
+  else if (strcasecmp(child->key, "Password") == 0)
+    return cf_util_get_string(child, &st->pass);
+  else if (strcasecmp(child->key, "VerifyPeer") == 0)
+    return cf_util_get_boolean(child, &st->verify_peer);
+  else if (strcasecmp(child->key, "VerifyHost") == 0)
+    return cf_util_get_boolean(child, &st->verify_host);
+  else if (strcasecmp(child->key, "CACert") == 0)
+    return cf_util_get_string(child, &st->cacert);
+  else if (strcasecmp(child->key, "Timeout") == 0)
+    return cf_util_get_int(child, &st->timeout);
+
+  ERROR("nginx plugin: Unknown config option: %s", child->key);
+  return -1;
+} /* int nginx_config_option */
+
+static int nginx_init_curl(nginx_t *st) {
+  if ((st->curl = curl_easy_init()) == NULL) {
     ERROR("nginx plugin: curl_easy_init failed.");
     return -1;
   }
 
-  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, nginx_curl_callback);
-  curl_easy_setopt(curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
-  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, nginx_curl_error);
+  curl_easy_setopt(st->curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(st->curl, CURLOPT_WRITEFUNCTION, nginx_curl_callback);
+  curl_easy_setopt(st->curl, CURLOPT_WRITEDATA, st);
+  curl_easy_setopt(st->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  curl_easy_setopt(st->curl, CURLOPT_ERRORBUFFER, st->curl_error);
+  curl_easy_setopt(st->curl, CURLOPT_URL, st->url);
+
+  st->request.curl = st->curl;
+  st->request.done = nginx_done;
+  st->request.user_data = st;
 
-  if (user != NULL) {
+  if (st->user != NULL) {
 #ifdef HAVE_CURLOPT_USERNAME
-    curl_easy_setopt(curl, CURLOPT_USERNAME, user);
-    curl_easy_setopt(curl, CURLOPT_PASSWORD, (pass == NULL) ? "" : pass);
+    curl_easy_setopt(st->curl, CURLOPT_USERNAME, st->user);
+    curl_easy_setopt(st->curl, CURLOPT_PASSWORD,
+                     (st->pass == NULL) ? "" : st->pass);
 #else
-    static char credentials[1024];
-    int status = snprintf(credentials, sizeof(credentials), "%s:%s", user,
-                          pass == NULL ? "" : pass);
+    char credentials[1024];
+    int status = snprintf(credentials, sizeof(credentials), "%s:%s", st->user,
+                          st->pass == NULL ? "" : st->pass);
     if ((status < 0) || ((size_t)status >= sizeof(credentials))) {
       ERROR("nginx plugin: Credentials would have been truncated.");
       return -1;
     }
 
-    curl_easy_setopt(curl, CURLOPT_USERPWD, credentials);
+    /* libcurl copies the string, so it may live on the stack. */
+    curl_easy_setopt(st->curl, CURLOPT_USERPWD, credentials);
 #endif
   }
 
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 50L);
-
-  if ((verify_peer == NULL) || IS_TRUE(verify_peer)) {
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-  } else {
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-  }
+  curl_easy_setopt(st->curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(st->curl, CURLOPT_MAXREDIRS, 50L);
+  curl_easy_setopt(st->curl, CURLOPT_SSL_VERIFYPEER, (long)st->verify_peer);
+  curl_easy_setopt(st->curl, CURLOPT_SSL_VERIFYHOST,
+                   st->verify_host ? 2L : 0L);
 
-  if ((verify_host == NULL) || IS_TRUE(verify_host)) {
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-  } else {
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-  }
-
-  if (cacert != NULL) {
-    curl_easy_setopt(curl, CURLOPT_CAINFO, cacert);
-  }
+  if (st->cacert != NULL)
+    curl_easy_setopt(st->curl, CURLOPT_CAINFO, st->cacert);
 
 #ifdef HAVE_CURLOPT_TIMEOUT_MS
-  if (timeout != NULL) {
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, atol(timeout));
-  } else {
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS,
+  if (st->timeout >= 0)
+    curl_easy_setopt(st->curl, CURLOPT_TIMEOUT_MS, (long)st->timeout);
+  else
+    curl_easy_setopt(st->curl, CURLOPT_TIMEOUT_MS,
                      (long)CDTIME_T_TO_MS(plugin_get_interval()));
-  }
 #endif
 
   return 0;
-} /* void init */
+} /* int nginx_init_curl */
 
-static void submit(const char *type, const char *inst, long long value) {
+static void submit(const nginx_t *st, const char *type, const char *inst,
+                   long long value) {
   value_t values[1];
   value_list_t vl = VALUE_LIST_INIT;
 
@@ -180,6 +202,8 @@ static void submit(const char *type, const char *inst, long long value) {
   vl.values = values;
   vl.values_len = STATIC_ARRAY_SIZE(values);
   sstrncpy(vl.plugin, "nginx", sizeof(vl.plugin));
+  if (st->name != NULL)
+    sstrncpy(vl.plugin_instance, st->name, sizeof(vl.plugin_instance));
   sstrncpy(vl.type, type, sizeof(vl.type));
 
   if (inst != NULL)
@@ -188,7 +212,10 @@ static void submit(const char *type, const char *inst, long long value) {
   plugin_dispatch_values(&vl);
 } /* void submit */
 
-static int nginx_read(void) {
+/* Called by the cURL engine once the transfer started by nginx_read() has
+ * finished. */
+static void nginx_done(curl_engine_request_t *req, CURLcode status) {
+  nginx_t *st = req->user_data;
   char *ptr;
   char *lines[16];
   int lines_num = 0;
@@ -197,21 +224,12 @@ static int nginx_read(void) {
   char *fields[16];
   int fields_num;
 
-  if (curl == NULL)
-    return -1;
-  if (url == NULL)
-    return -1;
-
-  nginx_buffer_len = 0;
-
-  curl_easy_setopt(curl, CURLOPT_URL, url);
-
-  if (curl_easy_perform(curl) != CURLE_OK) {
-    WARNING("nginx plugin: curl_easy_perform failed: %s", nginx_curl_error);
-    return -1;
+  if (status != CURLE_OK) {
+    WARNING("nginx plugin: curl_easy_perform failed: %s", st->curl_error);
+    return;
   }
 
-  ptr = nginx_buffer;
+  ptr = st->buffer;
   saveptr = NULL;
   while ((lines[lines_num] = strtok_r(ptr, "\n\r", &saveptr)) != NULL) {
     ptr = NULL;
@@ -234,35 +252,144 @@ static int nginx_read(void) {
     if (fields_num == 3) {
       if ((strcmp(fields[0], "Active") == 0) &&
           (strcmp(fields[1], "connections:") == 0)) {
-        submit("nginx_connections", "active", atoll(fields[2]));
+        submit(st, "nginx_connections", "active", atoll(fields[2]));
       } else if ((atoll(fields[0]) != 0) && (atoll(fields[1]) != 0) &&
                  (atoll(fields[2]) != 0)) {
-        submit("connections", "accepted", atoll(fields[0]));
+        submit(st, "connections", "accepted", atoll(fields[0]));
         /* TODO: The legacy metric "handled", which is the sum of "accepted" and
          * "failed", is reported for backwards compatibility only. Remove in the
          * next major version. */
-        submit("connections", "handled", atoll(fields[1]));
-        submit("connections", "failed", (atoll(fields[0]) - atoll(fields[1])));
-        submit("nginx_requests", NULL, atoll(fields[2]));
+        submit(st, "connections", "handled", atoll(fields[1]));
+        submit(st, "connections", "failed",
+               (atoll(fields[0]) - atoll(fields[1])));
+        submit(st, "nginx_requests", NULL, atoll(fields[2]));
       }
     } else if (fields_num == 6) {
       if ((strcmp(fields[0], "Reading:") == 0) &&
           (strcmp(fields[2], "Writing:") == 0) &&
           (strcmp(fields[4], "Waiting:") == 0)) {
-        submit("nginx_connections", "reading", atoll(fields[1]));
-        submit("nginx_connections", "writing", atoll(fields[3]));
-        submit("nginx_connections", "waiting", atoll(fields[5]));
+        submit(st, "nginx_connections", "reading", atoll(fields[1]));
+        submit(st, "nginx_connections", "writing", atoll(fields[3]));
+        submit(st, "nginx_connections", "waiting", atoll(fields[5]));
       }
     }
   }
 
-  nginx_buffer_len = 0;
+  st->buffer_len = 0;
+} /* void nginx_done */
+
+static int nginx_read(user_data_t *ud) {
+  nginx_t *st = ud->data;
+
+  /* The transfer is performed by the engine thread; results are dispatched
+   * from nginx_done(). */
+  if (curl_engine_busy(&st->request)) {
+    WARNING("nginx plugin: Request for \"%s\" is still in progress, "
+            "skipping this interval.",
+            st->url);
+    return 0;
+  }
+
+  st->buffer_len = 0;
+  st->buffer[0] = 0;
+
+  int status = curl_engine_submit(&st->request);
+  if (status != 0) {
+    ERROR("nginx plugin: Submitting request for \"%s\" failed: %s", st->url,
+          STRERROR(status));
+    return -1;
+  }
 
   return 0;
 } /* int nginx_read */
 
+static int nginx_register(nginx_t *st) {
+  if (st->url == NULL) {
+    ERROR("nginx plugin: Instance \"%s\": No URL has been configured.",
+          (st->name != NULL) ? st->name : "");
+    nginx_free(st);
+    return -1;
+  }
+
+  if (nginx_init_curl(st) != 0) {
+    nginx_free(st);
+    return -1;
+  }
+
+  char callback_name[3 * DATA_MAX_NAME_LEN];
+  snprintf(callback_name, sizeof(callback_name), "nginx/%s",
+           (st->name != NULL) ? st->name : "default");
+
+  return plugin_register_complex_read(/* group = */ NULL, callback_name,
+                                      nginx_read, /* interval = */ 0,
+                                      &(user_data_t){
+                                          .data = st, .free_func = nginx_free,
+                                      });
+} /* int nginx_register */
+
+static int nginx_config_instance(oconfig_item_t *ci) {
+  nginx_t *st = nginx_alloc();
+  if (st == NULL)
+    return -1;
+
+  int status = cf_util_get_string(ci, &st->name);
+  for (int i = 0; (status == 0) && (i < ci->children_num); i++)
+    status = nginx_config_option(st, ci->children + i);
+
+  if (status != 0) {
+    nginx_free(st);
+    return -1;
+  }
+
+  return nginx_register(st);
+} /* int nginx_config_instance */
+
+static int nginx_config(oconfig_item_t *ci) {
+  /* Options outside of <Instance /> blocks configure an unnamed instance, the
+   * only one supported by older versions. */
+  nginx_t *default_instance = NULL;
+  int status = 0;
+
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp(child->key, "Instance") == 0) {
+      status = nginx_config_instance(child);
+    } else {
+      if ((default_instance == NULL) &&
+          ((default_instance = nginx_alloc()) == NULL))
+        return -1;
+      status = nginx_config_option(default_instance, child);
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  if (status != 0) {
+    nginx_free(default_instance);
+    default_instance = NULL;
+    return status;
+  }
+
+  if (default_instance != NULL)
+    return nginx_register(default_instance);
+
+  return 0;
+} /* int nginx_config */
+
+static int nginx_init(void) {
+  curl_global_init(CURL_GLOBAL_SSL);
+  return 0;
+} /* int nginx_init */
+
+static int nginx_shutdown(void) {
+  curl_engine_shutdown();
+  return 0;
+} /* int nginx_shutdown */
+
 void module_register(void) {
-  plugin_register_config("nginx", config, config_keys, config_keys_num);
-  plugin_register_init("nginx", init);
-  plugin_register_read("nginx", nginx_read);
+  plugin_register_complex_config("nginx", nginx_config);
+  plugin_register_init("nginx", nginx_init);
+  plugin_register_shutdown("nginx", nginx_shutdown);
 } /* void module_register */
@@ -37,10 +37,27 @@
 #define NUMA_ROOT_DIR "/sys/devices/system/node"
 #endif
 
-static int max_node = -1;
+/*
+ * The nodes are discovered once in the init callback. Their "numastat" and
+ * "vmstat" files are kept open and re-read with pread(2), which makes sysfs
+ * render the current counters again.
+ */
+typedef struct {
+  int node;
+  int numastat_fd;
+  int vmstat_fd;
+} numa_node_t;
 
-static void numa_dispatch_value(int node, /* {{{ */
-                                const char *type_instance, value_t v) {
+static numa_node_t *nodes;
+static size_t nodes_num;
+
+static char *numa_buffer;
+static size_t numa_buffer_size;
+
+static bool report_vmstat;
+
+static void numa_dispatch(int node, const char *type, /* {{{ */
+                          const char *type_instance, value_t v) {
   value_list_t vl = VALUE_LIST_INIT;
 
   vl.values = &v;
@@ -48,39 +65,64 @@ static void numa_dispatch_value(int node, /* {{{ */
 
   sstrncpy(vl.plugin, "numa", sizeof(vl.plugin));
   snprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "node%i", node);
-  sstrncpy(vl.type, "vmpage_action", sizeof(vl.type));
+  sstrncpy(vl.type, type, sizeof(vl.type));
   sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
 
   plugin_dispatch_values(&vl);
-} /* }}} void numa_dispatch_value */
+} /* }}} void numa_dispatch */
+
+/* Reads the whole file into numa_buffer, growing it as needed. Returns the
+ * number of bytes read or -1 on error. */
+static ssize_t numa_read_file(int fd) /* {{{ */
+{
+  while (42) {
+    if (numa_buffer_size == 0) {
+      numa_buffer = malloc(4096);
+      if (numa_buffer == NULL)
+        return -1;
+      numa_buffer_size = 4096;
+    }
+
+    ssize_t len = pread(fd, numa_buffer, numa_buffer_size, 0);
+    if (len < 0)
+      return -1;
+
+    if ((size_t)len < numa_buffer_size) {
+      numa_buffer[len] = 0;
+      return len;
+    }
+
+    char *tmp = realloc(numa_buffer, 2 * numa_buffer_size);
+    if (tmp == NULL)
+      return -1;
+    numa_buffer = tmp;
+    numa_buffer_size *= 2;
+  }
+} /* }}} ssize_t numa_read_file */
 
-static int numa_read_node(int node) /* {{{ */
+static int numa_read_numastat(numa_node_t *n) /* {{{ */
 {
-  char path[PATH_MAX];
-  FILE *fh;
-  char buffer[128];
+  char *saveptr = NULL;
   int status;
   int success;
 
-  snprintf(path, sizeof(path), NUMA_ROOT_DIR "/node%i/numastat", node);
-
-  fh = fopen(path, "r");
-  if (fh == NULL) {
-    ERROR("numa plugin: Reading node %i failed: open(%s): %s", node, path,
+  if (numa_read_file(n->numastat_fd) < 0) {
+    ERROR("numa plugin: Reading node %i failed: read(numastat): %s", n->node,
           STRERRNO);
     return -1;
   }
 
   success = 0;
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
+  for (char *line = strtok_r(numa_buffer, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
     char *fields[4];
     value_t v;
 
-    status = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
+    status = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
     if (status != 2) {
       WARNING("numa plugin: Ignoring line with unexpected "
               "number of fields (node %i).",
-              node);
+              n->node);
       continue;
     }
 
@@ -89,63 +131,176 @@ static int numa_read_node(int node) /* {{{ */
     if (status != 0)
       continue;
 
-    numa_dispatch_value(node, fields[0], v);
+    numa_dispatch(n->node, "vmpage_action", fields[0], v);
     success++;
   }
 
-  fclose(fh);
   return success ? 0 : -1;
-} /* }}} int numa_read_node */
+} /* }}} int numa_read_numastat */
+
+/* Reports the per-node counterparts of /proc/vmstat, like the vmem plugin.
+ * The "numa_*" counters are skipped, they are duplicates of numastat. */
+static int numa_read_vmstat(numa_node_t *n) /* {{{ */
+{
+  char *saveptr = NULL;
+
+  if (numa_read_file(n->vmstat_fd) < 0) {
+    ERROR("numa plugin: Reading node %i failed: read(vmstat): %s", n->node,
+          STRERRNO);
+    return -1;
+  }
+
+  for (char *line = strtok_r(numa_buffer, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[4];
+    value_t v;
+
+    if (strsplit(line, fields, STATIC_ARRAY_SIZE(fields)) != 2)
+      continue;
+
+    char *key = fields[0];
+    if (strncmp("numa_", key, strlen("numa_")) == 0)
+      continue;
+
+    if ((strncmp("nr_", key, strlen("nr_")) == 0) &&
+        (strcmp(key, "nr_dirtied") != 0) && (strcmp(key, "nr_written") != 0)) {
+      if (parse_value(fields[1], &v, DS_TYPE_GAUGE) == 0)
+        numa_dispatch(n->node, "vmpage_number", key + strlen("nr_"), v);
+      continue;
+    }
+
+    if (strncmp("nr_", key, strlen("nr_")) == 0)
+      key += strlen("nr_");
+    if (parse_value(fields[1], &v, DS_TYPE_DERIVE) == 0)
+      numa_dispatch(n->node, "vmpage_action", key, v);
+  }
+
+  return 0;
+} /* }}} int numa_read_vmstat */
 
 static int numa_read(void) /* {{{ */
 {
-  int i;
-  int status;
   int success;
 
-  if (max_node < 0) {
+  if (nodes_num == 0) {
     WARNING("numa plugin: No NUMA nodes were detected.");
     return -1;
   }
 
   success = 0;
-  for (i = 0; i <= max_node; i++) {
-    status = numa_read_node(i);
-    if (status == 0)
+  for (size_t i = 0; i < nodes_num; i++) {
+    if (numa_read_numastat(nodes + i) == 0)
       success++;
+    if (nodes[i].vmstat_fd >= 0)
+      numa_read_vmstat(nodes + i);
   }
 
   return success ? 0 : -1;
 } /* }}} int numa_read */
 
+static int numa_config(oconfig_item_t *ci) /* {{{ */
+{
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("ReportVMStat", child->key) == 0)
+      cf_util_get_boolean(child, &report_vmstat);
+    else
+      WARNING("numa plugin: Ignoring unknown config option \"%s\".",
+              child->key);
+  }
+
+  return 0;
+} /* }}} int numa_config */
+
+static int numa_node_compare(const void *a, const void *b) /* {{{ */
+{
+  const numa_node_t *na = a;
+  const numa_node_t *nb = b;
+
+  return (na->node > nb->node) - (na->node < nb->node);
+} /* }}} int numa_node_compare */
+
+static int numa_shutdown(void) /* {{{ */
+{
+  for (size_t i = 0; i < nodes_num; i++) {
+    close(nodes[i].numastat_fd);
+    if (nodes[i].vmstat_fd >= 0)
+      close(nodes[i].vmstat_fd);
+  }
+  sfree(nodes);
+  nodes_num = 0;
+
+  sfree(numa_buffer);
+  numa_buffer_size = 0;
+
+  return 0;
+} /* }}} int numa_shutdown */
+
 static int numa_init(void) /* {{{ */
 {
-  /* Determine the number of nodes on this machine. */
-  while (42) {
+  DIR *dir;
+  struct dirent *ent;
+
+  /* Determine the nodes of this machine. Node numbers may have gaps. */
+  dir = opendir(NUMA_ROOT_DIR);
+  if (dir == NULL) {
+    ERROR("numa plugin: opendir(%s) failed: %s", NUMA_ROOT_DIR, STRERRNO);
+    return -1;
+  }
+
+  while ((ent = readdir(dir)) != NULL) {
+    numa_node_t n = {.numastat_fd = -1, .vmstat_fd = -1};
     char path[PATH_MAX];
-    struct stat statbuf = {0};
-    int status;
+    char *endptr = NULL;
 
-    snprintf(path, sizeof(path), NUMA_ROOT_DIR "/node%i", max_node + 1);
+    if (strncmp(ent->d_name, "node", strlen("node")) != 0)
+      continue;
+    n.node = (int)strtol(ent->d_name + strlen("node"), &endptr, 10);
+    if ((endptr == ent->d_name + strlen("node")) || (*endptr != 0))
+      continue;
 
-    status = stat(path, &statbuf);
-    if (status == 0) {
-      max_node++;
+    snprintf(path, sizeof(path), "%s/numastat", ent->d_name);
+    n.numastat_fd = openat(dirfd(dir), path, O_RDONLY | O_CLOEXEC);
+    if (n.numastat_fd < 0) {
+      ERROR("numa plugin: open(%s/%s) failed: %s", NUMA_ROOT_DIR, path,
+            STRERRNO);
       continue;
-    } else if (errno == ENOENT) {
-      break;
-    } else /* ((status != 0) && (errno != ENOENT)) */
-    {
-      ERROR("numa plugin: stat(%s) failed: %s", path, STRERRNO);
+    }
+
+    if (report_vmstat) {
+      snprintf(path, sizeof(path), "%s/vmstat", ent->d_name);
+      n.vmstat_fd = openat(dirfd(dir), path, O_RDONLY | O_CLOEXEC);
+      if (n.vmstat_fd < 0)
+        WARNING("numa plugin: open(%s/%s) failed: %s", NUMA_ROOT_DIR, path,
+                STRERRNO);
+    }
+
+    numa_node_t *tmp = realloc(nodes, (nodes_num + 1) * sizeof(*nodes));
+    if (tmp == NULL) {
+      ERROR("numa plugin: realloc failed.");
+      close(n.numastat_fd);
+      if (n.vmstat_fd >= 0)
+        close(n.vmstat_fd);
+      closedir(dir);
+      numa_shutdown();
       return -1;
     }
+    nodes = tmp;
+    nodes[nodes_num++] = n;
   }
+  closedir(dir);
+
+  if (nodes_num > 0)
+    qsort(nodes, nodes_num, sizeof(*nodes), numa_node_compare);
 
-  DEBUG("numa plugin: Found %i nodes.", max_node + 1);
+  DEBUG("numa plugin: Found %" PRIsz " nodes.", nodes_num);
   return 0;
 } /* }}} int numa_init */
 
 void module_register(void) {
+  plugin_register_complex_config("numa", numa_config);
   plugin_register_init("numa", numa_init);
   plugin_register_read("numa", numa_read);
+  plugin_register_shutdown("numa", numa_shutdown);
 } /* void module_register */
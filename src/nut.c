@@ -50,14 +50,16 @@ struct nut_ups_s {
   nut_ups_t *next;
 };
 
-static const char *config_keys[] = {"UPS", "FORCESSL", "VERIFYPEER", "CAPATH",
-                                    "CONNECTTIMEOUT"};
+static const char *config_keys[] = {
+    "UPS",    "FORCESSL",       "VERIFYPEER",
+    "CAPATH", "CONNECTTIMEOUT", "MEASURERESPONSETIME"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 static int force_ssl;   // Initialized to default of 0 (false)
 static int verify_peer; // Initialized to default of 0 (false)
 static int ssl_flags = UPSCLI_CONN_TRYSSL;
 static int connect_timeout = -1;
 static char *ca_path;
+static bool response_time;
 
 static int nut_read(user_data_t *user_data);
 
@@ -180,6 +182,10 @@ static int nut_config(const char *key, const char *value) {
     return nut_ca_path(value);
   else if (strcasecmp(key, "CONNECTTIMEOUT") == 0)
     return nut_set_connect_timeout(value);
+  else if (strcasecmp(key, "MEASURERESPONSETIME") == 0) {
+    response_time = IS_TRUE(value);
+    return 0;
+  }
   else
     return -1;
 } /* int nut_config */
@@ -206,7 +212,7 @@ static int nut_connect(nut_ups_t *ups) {
 #if HAVE_UPSCLI_TRYCONNECT
   struct timeval tv;
   tv.tv_sec = connect_timeout / 1000;
-  tv.tv_usec = connect_timeout % 1000;
+  tv.tv_usec = (connect_timeout % 1000) * 1000;
 
   status =
       upscli_tryconnect(ups->conn, ups->hostname, ups->port, ssl_flags, &tv);
@@ -243,88 +249,125 @@ static int nut_connect(nut_ups_t *ups) {
   return 0;
 }
 
-static int nut_read(user_data_t *user_data) {
-  nut_ups_t *ups = user_data->data;
+static void nut_submit_var(nut_ups_t *ups, const char *key, double value) {
+  if (strncmp("ambient.", key, 8) == 0) {
+    if (strcmp("ambient.humidity", key) == 0)
+      nut_submit(ups, "humidity", "ambient", value);
+    else if (strcmp("ambient.temperature", key) == 0)
+      nut_submit(ups, "temperature", "ambient", value);
+  } else if (strncmp("battery.", key, 8) == 0) {
+    if (strcmp("battery.charge", key) == 0)
+      nut_submit(ups, "percent", "charge", value);
+    else if (strcmp("battery.current", key) == 0)
+      nut_submit(ups, "current", "battery", value);
+    else if (strcmp("battery.runtime", key) == 0)
+      nut_submit(ups, "timeleft", "battery", value);
+    else if (strcmp("battery.temperature", key) == 0)
+      nut_submit(ups, "temperature", "battery", value);
+    else if (strcmp("battery.voltage", key) == 0)
+      nut_submit(ups, "voltage", "battery", value);
+  } else if (strncmp("input.", key, 6) == 0) {
+    if (strcmp("input.frequency", key) == 0)
+      nut_submit(ups, "frequency", "input", value);
+    else if (strcmp("input.voltage", key) == 0)
+      nut_submit(ups, "voltage", "input", value);
+  } else if (strncmp("output.", key, 7) == 0) {
+    if (strcmp("output.current", key) == 0)
+      nut_submit(ups, "current", "output", value);
+    else if (strcmp("output.frequency", key) == 0)
+      nut_submit(ups, "frequency", "output", value);
+    else if (strcmp("output.voltage", key) == 0)
+      nut_submit(ups, "voltage", "output", value);
+  } else if (strncmp("ups.", key, 4) == 0) {
+    if (strcmp("ups.load", key) == 0)
+      nut_submit(ups, "percent", "load", value);
+    else if (strcmp("ups.power", key) == 0)
+      nut_submit(ups, "power", "ups", value);
+    else if (strcmp("ups.temperature", key) == 0)
+      nut_submit(ups, "temperature", "ups", value);
+  }
+} /* void nut_submit_var */
+
+static void nut_disconnect(nut_ups_t *ups) {
+  upscli_disconnect(ups->conn);
+  sfree(ups->conn);
+} /* void nut_disconnect */
+
+/* Fetches all variables of the UPS with a single "LIST VAR" query. Returns
+ * ENOTCONN if the query could not be sent, i.e. before anything has been
+ * dispatched. */
+static int nut_list_vars(nut_ups_t *ups) {
   const char *query[3] = {"VAR", ups->upsname, NULL};
   unsigned int query_num = 2;
   char **answer;
   unsigned int answer_num;
   int status;
 
-  /* (Re-)Connect if we have no connection */
-  if (ups->conn == NULL) {
-    ups->conn = malloc(sizeof(*ups->conn));
-    if (ups->conn == NULL) {
-      ERROR("nut plugin: malloc failed.");
-      return -1;
-    }
-
-    status = nut_connect(ups);
-    if (status == -1)
-      return -1;
-
-  } /* if (ups->conn == NULL) */
-
   /* nut plugin: nut_read_one: upscli_list_start (adpos) failed: Protocol
    * error */
   status = upscli_list_start(ups->conn, query_num, query);
   if (status != 0) {
     ERROR("nut plugin: nut_read: upscli_list_start (%s) failed: %s",
           ups->upsname, upscli_strerror(ups->conn));
-    upscli_disconnect(ups->conn);
-    sfree(ups->conn);
-    return -1;
+    return ENOTCONN;
   }
 
   while ((status = upscli_list_next(ups->conn, query_num, query, &answer_num,
                                     &answer)) == 1) {
-    char *key;
-    double value;
-
     if (answer_num < 4)
       continue;
 
-    key = answer[2];
-    value = atof(answer[3]);
-
-    if (strncmp("ambient.", key, 8) == 0) {
-      if (strcmp("ambient.humidity", key) == 0)
-        nut_submit(ups, "humidity", "ambient", value);
-      else if (strcmp("ambient.temperature", key) == 0)
-        nut_submit(ups, "temperature", "ambient", value);
-    } else if (strncmp("battery.", key, 8) == 0) {
-      if (strcmp("battery.charge", key) == 0)
-        nut_submit(ups, "percent", "charge", value);
-      else if (strcmp("battery.current", key) == 0)
-        nut_submit(ups, "current", "battery", value);
-      else if (strcmp("battery.runtime", key) == 0)
-        nut_submit(ups, "timeleft", "battery", value);
-      else if (strcmp("battery.temperature", key) == 0)
-        nut_submit(ups, "temperature", "battery", value);
-      else if (strcmp("battery.voltage", key) == 0)
-        nut_submit(ups, "voltage", "battery", value);
-    } else if (strncmp("input.", key, 6) == 0) {
-      if (strcmp("input.frequency", key) == 0)
-        nut_submit(ups, "frequency", "input", value);
-      else if (strcmp("input.voltage", key) == 0)
-        nut_submit(ups, "voltage", "input", value);
-    } else if (strncmp("output.", key, 7) == 0) {
-      if (strcmp("output.current", key) == 0)
-        nut_submit(ups, "current", "output", value);
-      else if (strcmp("output.frequency", key) == 0)
-        nut_submit(ups, "frequency", "output", value);
-      else if (strcmp("output.voltage", key) == 0)
-        nut_submit(ups, "voltage", "output", value);
-    } else if (strncmp("ups.", key, 4) == 0) {
-      if (strcmp("ups.load", key) == 0)
-        nut_submit(ups, "percent", "load", value);
-      else if (strcmp("ups.power", key) == 0)
-        nut_submit(ups, "power", "ups", value);
-      else if (strcmp("ups.temperature", key) == 0)
-        nut_submit(ups, "temperature", "ups", value);
-    }
+    nut_submit_var(ups, answer[2], atof(answer[3]));
   } /* while (upscli_list_next) */
 
+  if (status < 0) {
+    ERROR("nut plugin: nut_read: upscli_list_next (%s) failed: %s",
+          ups->upsname, upscli_strerror(ups->conn));
+    return -1;
+  }
+
+  return 0;
+} /* int nut_list_vars */
+
+static int nut_read(user_data_t *user_data) {
+  nut_ups_t *ups = user_data->data;
+  bool reused = (ups->conn != NULL);
+  int status;
+
+  cdtime_t start = cdtime();
+
+  /* The connection is kept across reads. If upsd has closed it in the
+   * meantime, sending the query fails and it is retried once on a new
+   * connection. */
+  for (int attempt = 0; attempt < 2; attempt++) {
+    /* (Re-)Connect if we have no connection */
+    if (ups->conn == NULL) {
+      ups->conn = malloc(sizeof(*ups->conn));
+      if (ups->conn == NULL) {
+        ERROR("nut plugin: malloc failed.");
+        return -1;
+      }
+
+      status = nut_connect(ups);
+      if (status == -1)
+        return -1;
+
+      start = cdtime();
+    } /* if (ups->conn == NULL) */
+
+    status = nut_list_vars(ups);
+    if (status == 0)
+      break;
+
+    nut_disconnect(ups);
+    if ((status != ENOTCONN) || !reused)
+      return -1;
+    reused = false;
+  }
+
+  if (response_time)
+    nut_submit(ups, "response_time", "", CDTIME_T_TO_DOUBLE(cdtime() - start));
+
   return 0;
 } /* int nut_read */
 
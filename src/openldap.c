@@ -52,6 +52,7 @@ struct cldap_s /* {{{ */
   char *url;
   bool verifyhost;
   int version;
+  bool response_time;
 
   LDAP *ld;
 };
@@ -99,6 +100,8 @@ static int cldap_init_host(cldap_t *st) /* {{{ */
 
   ldap_set_option(st->ld, LDAP_OPT_TIMEOUT,
                   &(const struct timeval){st->timeout, 0});
+  ldap_set_option(st->ld, LDAP_OPT_NETWORK_TIMEOUT,
+                  &(const struct timeval){st->timeout, 0});
 
   ldap_set_option(st->ld, LDAP_OPT_RESTART, LDAP_OPT_ON);
 
@@ -178,6 +181,14 @@ static void cldap_submit_gauge(const char *type,
   cldap_submit_value(type, type_instance, (value_t){.gauge = g}, st);
 } /* }}} void cldap_submit_gauge */
 
+/* Fetches all monitored entries with a single search. */
+static int cldap_search(cldap_t *st, char **attrs, /* {{{ */
+                        LDAPMessage **result) {
+  return ldap_search_ext_s(st->ld, "cn=Monitor", LDAP_SCOPE_SUBTREE,
+                           "(|(!(cn=* *))(cn=Database*))", attrs, 0, NULL,
+                           NULL, NULL, 0, result);
+} /* }}} int cldap_search */
+
 static int cldap_read_host(user_data_t *ud) /* {{{ */
 {
   cldap_t *st;
@@ -198,13 +209,30 @@ static int cldap_read_host(user_data_t *ud) /* {{{ */
 
   st = (cldap_t *)ud->data;
 
+  /* The connection is kept open between reads. If the server has closed it
+   * in the meantime, the search is retried once on a new connection. */
+  bool reused = (st->ld != NULL);
+
   status = cldap_init_host(st);
   if (status != 0)
     return -1;
 
-  rc = ldap_search_ext_s(st->ld, "cn=Monitor", LDAP_SCOPE_SUBTREE,
-                         "(|(!(cn=* *))(cn=Database*))", attrs, 0, NULL, NULL,
-                         NULL, 0, &result);
+  cdtime_t start = cdtime();
+  rc = cldap_search(st, attrs, &result);
+
+  if (reused && ((rc == LDAP_SERVER_DOWN) || (rc == LDAP_CONNECT_ERROR))) {
+    INFO("openldap plugin: Connection to %s lost, reconnecting.", st->url);
+    ldap_msgfree(result);
+    ldap_unbind_ext_s(st->ld, NULL, NULL);
+    st->ld = NULL;
+
+    status = cldap_init_host(st);
+    if (status != 0)
+      return -1;
+
+    start = cdtime();
+    rc = cldap_search(st, attrs, &result);
+  }
 
   if (rc != LDAP_SUCCESS) {
     ERROR("openldap plugin: Failed to execute search: %s", ldap_err2string(rc));
@@ -214,6 +242,10 @@ static int cldap_read_host(user_data_t *ud) /* {{{ */
     return (-1);
   }
 
+  if (st->response_time)
+    cldap_submit_gauge("response_time", NULL,
+                       CDTIME_T_TO_DOUBLE(cdtime() - start), st);
+
   for (LDAPMessage *e = ldap_first_entry(st->ld, result); e != NULL;
        e = ldap_next_entry(st->ld, e)) {
     if ((dn = ldap_get_dn(st->ld, e)) != NULL) {
@@ -421,6 +453,8 @@ static int cldap_config_add(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_boolean(child, &st->verifyhost);
     else if (strcasecmp("Version", child->key) == 0)
       status = cf_util_get_int(child, &st->version);
+    else if (strcasecmp("MeasureResponseTime", child->key) == 0)
+      status = cf_util_get_boolean(child, &st->response_time);
     else {
       WARNING("openldap plugin: Option `%s' not allowed here.", child->key);
       status = -1;
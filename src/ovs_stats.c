@@ -30,6 +30,7 @@
 
 #include "common.h"
 
+#include "utils_avltree.h"
 #include "utils_ovs.h" /* OvS helpers */
 
 /* Plugin name */
@@ -139,6 +140,15 @@ static bridge_list_t *g_monitored_bridge_list_head;
 /* entry into the list of network bridges */
 static port_list_t *g_port_list_head;
 
+/* Port lookup indexes (Port table _uuid and port name), the keys point
+ * into the port entries */
+static c_avl_tree_t *g_port_uuid_index;
+static c_avl_tree_t *g_port_name_index;
+
+/* Interface table _uuid -> interface name of all known interfaces. Used to
+ * find the port of "modify" updates, which carry changed columns only */
+static c_avl_tree_t *g_iface_name_cache;
+
 /* lock for statistics cache */
 static pthread_mutex_t g_stats_lock;
 
@@ -220,25 +230,81 @@ static void ovs_stats_submit_two(const char *dev, const char *type,
 }
 
 static port_list_t *ovs_stats_get_port(const char *uuid) {
+  port_list_t *port = NULL;
+
   if (uuid == NULL)
     return NULL;
 
-  for (port_list_t *port = g_port_list_head; port != NULL; port = port->next) {
-    if (strncmp(port->port_uuid, uuid, strlen(port->port_uuid)) == 0)
-      return port;
-  }
-  return NULL;
+  if (c_avl_get(g_port_uuid_index, uuid, (void **)&port) != 0)
+    return NULL;
+  return port;
 }
 
 static port_list_t *ovs_stats_get_port_by_name(const char *name) {
+  port_list_t *port = NULL;
+
   if (name == NULL)
     return NULL;
 
-  for (port_list_t *port = g_port_list_head; port != NULL; port = port->next)
-    if ((strncmp(port->name, name, strlen(port->name)) == 0) &&
-        strlen(name) == strlen(port->name))
-      return port;
-  return NULL;
+  if (c_avl_get(g_port_name_index, name, (void **)&port) != 0)
+    return NULL;
+  return port;
+}
+
+/* Set port name and update the name index. Shall be called with
+ * g_stats_lock held */
+static void ovs_stats_set_port_name(port_list_t *port, const char *name) {
+  if (strcmp(port->name, name) == 0)
+    return;
+
+  if (strlen(port->name) > 0)
+    c_avl_remove(g_port_name_index, port->name, NULL, NULL);
+  sstrncpy(port->name, name, sizeof(port->name));
+  if (strlen(port->name) > 0 &&
+      c_avl_insert(g_port_name_index, port->name, port) != 0)
+    WARNING("%s: Duplicate port name \"%s\"", plugin_name, port->name);
+}
+
+/* Remember name of the interface referenced by Interface table `uuid' */
+static void ovs_stats_iface_name_set(const char *uuid, const char *name) {
+  char *key = NULL;
+  char *value = NULL;
+
+  if (c_avl_get(g_iface_name_cache, uuid, (void **)&value) == 0) {
+    if (strcmp(value, name) == 0)
+      return;
+    c_avl_remove(g_iface_name_cache, uuid, (void **)&key, (void **)&value);
+    sfree(key);
+    sfree(value);
+  }
+
+  key = strdup(uuid);
+  value = strdup(name);
+  if (key == NULL || value == NULL ||
+      c_avl_insert(g_iface_name_cache, key, value) != 0) {
+    ERROR("%s: Failed to cache interface name \"%s\"", plugin_name, name);
+    sfree(key);
+    sfree(value);
+  }
+}
+
+static const char *ovs_stats_iface_name_get(const char *uuid) {
+  char *name = NULL;
+
+  if (c_avl_get(g_iface_name_cache, uuid, (void **)&name) != 0)
+    return NULL;
+  return name;
+}
+
+static void ovs_stats_iface_name_del(const char *uuid) {
+  char *key = NULL;
+  char *value = NULL;
+
+  if (c_avl_remove(g_iface_name_cache, uuid, (void **)&key,
+                   (void **)&value) == 0) {
+    sfree(key);
+    sfree(value);
+  }
 }
 
 /* Create or get port by port uuid */
@@ -258,6 +324,12 @@ static port_list_t *ovs_stats_new_port(bridge_list_t *bridge,
     memset(port->stats, -1, sizeof(int64_t[IFACE_COUNTER_COUNT]));
     sstrncpy(port->port_uuid, uuid, sizeof(port->port_uuid));
     pthread_mutex_lock(&g_stats_lock);
+    if (c_avl_insert(g_port_uuid_index, port->port_uuid, port) != 0) {
+      pthread_mutex_unlock(&g_stats_lock);
+      ERROR("%s: Error indexing port %s", plugin_name, uuid);
+      sfree(port);
+      return NULL;
+    }
     port->next = g_port_list_head;
     g_port_list_head = port;
     pthread_mutex_unlock(&g_stats_lock);
@@ -469,8 +541,7 @@ static int ovs_stats_update_port(const char *uuid, yajl_val port) {
           portentry = ovs_stats_new_port(NULL, uuid);
         if (portentry) {
           pthread_mutex_lock(&g_stats_lock);
-          sstrncpy(portentry->name, YAJL_GET_STRING(port_name),
-                   sizeof(portentry->name));
+          ovs_stats_set_port_name(portentry, YAJL_GET_STRING(port_name));
           pthread_mutex_unlock(&g_stats_lock);
         }
       }
@@ -484,10 +555,18 @@ static int ovs_stats_update_port(const char *uuid, yajl_val port) {
 
 /* Delete port from global port list */
 static int ovs_stats_del_port(const char *uuid) {
+  port_list_t *del_port = ovs_stats_get_port(uuid);
+  if (del_port == NULL)
+    return 0;
+
+  c_avl_remove(g_port_uuid_index, del_port->port_uuid, NULL, NULL);
+  if (strlen(del_port->name) > 0)
+    c_avl_remove(g_port_name_index, del_port->name, NULL, NULL);
+
   port_list_t *prev_port = g_port_list_head;
   for (port_list_t *port = g_port_list_head; port != NULL;
        prev_port = port, port = port->next) {
-    if (strncmp(port->port_uuid, uuid, strlen(port->port_uuid)) == 0) {
+    if (port == del_port) {
       if (port == g_port_list_head)
         g_port_list_head = port->next;
       else
@@ -596,22 +675,48 @@ static int ovs_stats_update_iface_ext_ids(port_list_t *port, yajl_val ext_ids) {
   return 0;
 }
 
-/* Get interface statistic and external_ids */
-static int ovs_stats_update_iface(yajl_val iface) {
+/* Get interface statistic and external_ids. The `iface' row update is
+ * either <row-update> ("old" and "new" rows) of "monitor" method or
+ * <row-update2> ("initial", "insert", "delete" or "modify" row) of
+ * "monitor_cond" method. The "modify" row holds changed columns only and
+ * changed or removed key-value pairs of map columns, so counters which
+ * are not in the update keep their previous values. */
+static int ovs_stats_update_iface(const char *uuid, yajl_val iface) {
+  bool partial = false;
+  const char *name = NULL;
+
   if (!iface || !YAJL_IS_OBJECT(iface)) {
     ERROR("ovs_stats plugin: incorrect JSON port data");
     return -1;
   }
 
   yajl_val row = ovs_utils_get_value_by_key(iface, "new");
-  if (!row || !YAJL_IS_OBJECT(row))
+  if (row == NULL)
+    row = ovs_utils_get_value_by_key(iface, "initial");
+  if (row == NULL)
+    row = ovs_utils_get_value_by_key(iface, "insert");
+  if (row == NULL) {
+    row = ovs_utils_get_value_by_key(iface, "modify");
+    partial = true;
+  }
+  if (row == NULL) {
+    /* interface has been deleted */
+    ovs_stats_iface_name_del(uuid);
+    return 0;
+  }
+  if (!YAJL_IS_OBJECT(row))
     return 0;
 
   yajl_val iface_name = ovs_utils_get_value_by_key(row, "name");
-  if (!iface_name || !YAJL_IS_STRING(iface_name))
+  if (iface_name && YAJL_IS_STRING(iface_name)) {
+    name = YAJL_GET_STRING(iface_name);
+    ovs_stats_iface_name_set(uuid, name);
+  } else if (partial)
+    name = ovs_stats_iface_name_get(uuid);
+  if (name == NULL)
     return 0;
 
-  port_list_t *port = ovs_stats_get_port_by_name(YAJL_GET_STRING(iface_name));
+  port_list_t *port = ovs_stats_get_port_by_name(name);
   if (port == NULL)
     return 0;
 
@@ -649,6 +754,9 @@ static int ovs_stats_update_iface(yajl_val iface) {
     sstrncpy(port->iface_uuid,
              YAJL_GET_STRING(YAJL_GET_ARRAY(iface_uuid)->values[1]),
              sizeof(port->iface_uuid));
+  else if (partial)
+    /* _uuid never changes, so it's not in "modify" row */
+    sstrncpy(port->iface_uuid, uuid, sizeof(port->iface_uuid));
   else {
     ERROR("ovs_stats plugin: incorrect JSON interface data");
     return -1;
@@ -714,7 +822,8 @@ static void ovs_stats_interface_table_change_cb(yajl_val jupdates) {
   pthread_mutex_lock(&g_stats_lock);
   if (ports && YAJL_IS_OBJECT(ports))
     for (size_t i = 0; i < YAJL_GET_OBJECT(ports)->len; i++)
-      ovs_stats_update_iface(YAJL_GET_OBJECT(ports)->values[i]);
+      ovs_stats_update_iface(YAJL_GET_OBJECT(ports)->keys[i],
+                             YAJL_GET_OBJECT(ports)->values[i]);
   pthread_mutex_unlock(&g_stats_lock);
   return;
 }
@@ -757,11 +866,12 @@ static void ovs_stats_initialize(ovs_db_t *pdb) {
                            ovs_stats_port_table_delete_cb, NULL,
                            OVS_DB_TABLE_CB_FLAG_DELETE);
 
+  /* Interface table statistics change often, so subscribe for incremental
+   * "modify" updates, which carry changed counters only */
   ovs_db_table_cb_register(
       pdb, "Interface", interface_columns, ovs_stats_interface_table_change_cb,
       ovs_stats_interface_table_result_cb,
-      OVS_DB_TABLE_CB_FLAG_INITIAL | OVS_DB_TABLE_CB_FLAG_INSERT |
-          OVS_DB_TABLE_CB_FLAG_MODIFY);
+      OVS_DB_TABLE_CB_FLAG_ALL | OVS_DB_TABLE_CB_FLAG_UPDATE2);
 }
 
 /* Check if bridge is configured to be monitored in config file */
@@ -779,6 +889,21 @@ static int ovs_stats_is_monitored_bridge(const char *br_name) {
 
 /* Delete all ports from port list */
 static void ovs_stats_free_port_list(port_list_t *head) {
+  void *key;
+  void *value;
+
+  while (g_port_uuid_index != NULL &&
+         c_avl_pick(g_port_uuid_index, &key, &value) == 0)
+    ;
+  while (g_port_name_index != NULL &&
+         c_avl_pick(g_port_name_index, &key, &value) == 0)
+    ;
+  while (g_iface_name_cache != NULL &&
+         c_avl_pick(g_iface_name_cache, &key, &value) == 0) {
+    sfree(key);
+    sfree(value);
+  }
+
   for (port_list_t *i = head; i != NULL;) {
     port_list_t *del = i;
     i = i->next;
@@ -884,6 +1009,16 @@ static int ovs_stats_plugin_init(void) {
   ovs_db_callback_t cb = {.post_conn_init = ovs_stats_initialize,
                           .post_conn_terminate = ovs_stats_conn_terminate};
 
+  g_port_uuid_index = c_avl_create((int (*)(const void *, const void *))strcmp);
+  g_port_name_index = c_avl_create((int (*)(const void *, const void *))strcmp);
+  g_iface_name_cache =
+      c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (g_port_uuid_index == NULL || g_port_name_index == NULL ||
+      g_iface_name_cache == NULL) {
+    ERROR("%s: plugin: failed to create port indexes", plugin_name);
+    return -1;
+  }
+
   INFO("%s: Connecting to OVS DB using address=%s, service=%s, unix=%s",
        plugin_name, ovs_stats_cfg.ovs_db_node, ovs_stats_cfg.ovs_db_serv,
        ovs_stats_cfg.ovs_db_unix);
@@ -1001,6 +1136,9 @@ static int ovs_stats_plugin_shutdown(void) {
   ovs_stats_free_bridge_list(g_bridge_list_head);
   ovs_stats_free_bridge_list(g_monitored_bridge_list_head);
   ovs_stats_free_port_list(g_port_list_head);
+  c_avl_destroy(g_port_uuid_index);
+  c_avl_destroy(g_port_name_index);
+  c_avl_destroy(g_iface_name_cache);
   pthread_mutex_unlock(&g_stats_lock);
   pthread_mutex_destroy(&g_stats_lock);
   return 0;
@@ -51,6 +51,7 @@
 #include "plugin.h"
 
 #include "filter_chain.h"
+#include "utils_avltree.h"
 
 #if !defined(USE_ITHREADS)
 #error "Perl does not support ithreads!"
@@ -68,8 +69,9 @@
 #define PLUGIN_NOTIF 5
 #define PLUGIN_FLUSH 6
 #define PLUGIN_FLUSH_ALL 7 /* For collectd-5.6 only */
+#define PLUGIN_WRITE_BATCH 8
 
-#define PLUGIN_TYPES 8
+#define PLUGIN_TYPES 9
 
 #define PLUGIN_CONFIG 254
 #define PLUGIN_DATASET 255
@@ -95,6 +97,7 @@ void boot_DynaLoader(PerlInterpreter *, CV *);
 
 static XS(Collectd_plugin_register_read);
 static XS(Collectd_plugin_register_write);
+static XS(Collectd_plugin_register_write_batch);
 static XS(Collectd_plugin_register_log);
 static XS(Collectd_plugin_register_notification);
 static XS(Collectd_plugin_register_flush);
@@ -117,6 +120,8 @@ static XS(Collectd_call_by_name);
 static int perl_read(user_data_t *ud);
 static int perl_write(const data_set_t *ds, const value_list_t *vl,
                       user_data_t *user_data);
+static int perl_write_batch(const plugin_write_entry_t *entries,
+                            size_t entries_num, user_data_t *user_data);
 static void perl_log(int level, const char *msg, user_data_t *user_data);
 static int perl_notify(const notification_t *notif, user_data_t *user_data);
 static int perl_flush(cdtime_t timeout, const char *identifier,
@@ -126,6 +131,11 @@ static int perl_flush(cdtime_t timeout, const char *identifier,
  * private data types
  */
 
+typedef struct {
+  const data_set_t *ds;
+  AV *array;
+} c_ithread_ds_t;
+
 typedef struct c_ithread_s {
   /* the thread's Perl interpreter */
   PerlInterpreter *interp;
@@ -133,6 +143,11 @@ typedef struct c_ithread_s {
   bool shutdown;
   pthread_t pthread;
 
+  /* Per-interpreter structures reused by write callbacks, see
+   * pplugin_call(). */
+  c_avl_tree_t *data_sets; /* type name -> c_ithread_ds_t */
+  HV *value_list;
+
   /* double linked list of threads */
   struct c_ithread_s *prev;
   struct c_ithread_s *next;
@@ -183,6 +198,11 @@ static c_ithread_list_t *perl_threads;
 /* the key used to store each pthread's ithread */
 static pthread_key_t perl_thr_key;
 
+/* interpreters cloned by perl_init() which have not been claimed by a thread
+ * yet; a slot is claimed by swapping it to NULL */
+static c_ithread_t **perl_pool;
+static int perl_pool_size;
+
 static int perl_argc;
 static char **perl_argv;
 
@@ -194,6 +214,8 @@ static struct {
 } api[] = {
     {"Collectd::plugin_register_read", Collectd_plugin_register_read},
     {"Collectd::plugin_register_write", Collectd_plugin_register_write},
+    {"Collectd::plugin_register_write_batch",
+     Collectd_plugin_register_write_batch},
     {"Collectd::plugin_register_log", Collectd_plugin_register_log},
     {"Collectd::plugin_register_notification",
      Collectd_plugin_register_notification},
@@ -227,6 +249,7 @@ struct {
                  {"Collectd::TYPE_LOG", PLUGIN_LOG},
                  {"Collectd::TYPE_NOTIF", PLUGIN_NOTIF},
                  {"Collectd::TYPE_FLUSH", PLUGIN_FLUSH},
+                 {"Collectd::TYPE_WRITE_BATCH", PLUGIN_WRITE_BATCH},
                  {"Collectd::TYPE_CONFIG", PLUGIN_CONFIG},
                  {"Collectd::TYPE_DATASET", PLUGIN_DATASET},
                  {"Collectd::DS_TYPE_COUNTER", DS_TYPE_COUNTER},
@@ -695,6 +718,66 @@ static int value_list2hv(pTHX_ value_list_t *vl, data_set_t *ds, HV *hash) {
   return 0;
 } /* static int value2av (value_list_t *, data_set_t *, HV *) */
 
+/*
+ * Returns a new reference to the array representation of "ds". The array is
+ * built once per interpreter and shared between all write callbacks, so it is
+ * marked read-only.
+ */
+static AV *data_set2av_cached(pTHX_ c_ithread_t *t, const data_set_t *ds) {
+  c_ithread_ds_t *entry = NULL;
+  AV *array;
+
+  if ((NULL != t) && (NULL != t->data_sets) &&
+      (0 == c_avl_get(t->data_sets, ds->type, (void *)&entry)) &&
+      (entry->ds == ds))
+    return (AV *)SvREFCNT_inc((SV *)entry->array);
+
+  array = newAV();
+  if (-1 == data_set2av(aTHX_(data_set_t *) ds, array)) {
+    SvREFCNT_dec((SV *)array);
+    return NULL;
+  }
+
+  if (NULL == t)
+    return array;
+
+  for (SSize_t i = 0; i <= av_len(array); ++i) {
+    SV **source = av_fetch(array, i, 0);
+    HV *hash = (HV *)SvRV(*source);
+    HE *he;
+
+    hv_iterinit(hash);
+    while (NULL != (he = hv_iternext(hash)))
+      SvREADONLY_on(HeVAL(he));
+    SvREADONLY_on(*source);
+  }
+  SvREADONLY_on((SV *)array);
+
+  if (NULL == t->data_sets)
+    t->data_sets = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (NULL == t->data_sets)
+    return array;
+
+  if (NULL == entry) {
+    char *key = strdup(ds->type);
+
+    entry = calloc(1, sizeof(*entry));
+    if ((NULL == key) || (NULL == entry) ||
+        (0 != c_avl_insert(t->data_sets, key, entry))) {
+      sfree(key);
+      sfree(entry);
+      return array;
+    }
+  } else {
+    /* The data set has been registered again since it was cached. */
+    SvREFCNT_dec((SV *)entry->array);
+  }
+
+  entry->ds = ds;
+  entry->array = (AV *)SvREFCNT_inc((SV *)array);
+  return array;
+} /* static AV *data_set2av_cached (c_ithread_t *, const data_set_t *) */
+
 static int notification_meta2av(pTHX_ notification_meta_t *meta, AV *array) {
   int meta_num = 0;
   for (notification_meta_t *m = meta; m != NULL; m = m->next) {
@@ -1003,6 +1086,9 @@ static int pplugin_call(pTHX_ int type, ...) {
   int ret = 0;
   char *subname;
 
+  c_ithread_t *t = (c_ithread_t *)pthread_getspecific(perl_thr_key);
+  HV *pvl_keep = NULL;
+
   dSP;
 
   if ((type < 0) || (type >= PLUGIN_TYPES))
@@ -1021,8 +1107,8 @@ static int pplugin_call(pTHX_ int type, ...) {
     data_set_t *ds;
     value_list_t *vl;
 
-    AV *pds = newAV();
-    HV *pvl = newHV();
+    AV *pds;
+    HV *pvl;
 
     subname = va_arg(ap, char *);
     /*
@@ -1053,23 +1139,84 @@ static int pplugin_call(pTHX_ int type, ...) {
     ds = va_arg(ap, data_set_t *);
     vl = va_arg(ap, value_list_t *);
 
-    if (-1 == data_set2av(aTHX_ ds, pds)) {
-      av_clear(pds);
-      av_undef(pds);
+    pds = data_set2av_cached(aTHX_ t, ds);
+    if (NULL == pds) {
       pds = (AV *)&PL_sv_undef;
       ret = -1;
     }
 
+    /* Reuse the hash of the previous call if the callback didn't keep it. */
+    if ((NULL != t) && (NULL != t->value_list)) {
+      pvl = t->value_list;
+      t->value_list = NULL;
+    } else {
+      pvl = newHV();
+    }
+
     if (-1 == value_list2hv(aTHX_ vl, ds, pvl)) {
       hv_clear(pvl);
       hv_undef(pvl);
       pvl = (HV *)&PL_sv_undef;
       ret = -1;
+    } else if (NULL != t) {
+      pvl_keep = (HV *)SvREFCNT_inc((SV *)pvl);
     }
 
     XPUSHs(sv_2mortal(newSVpv(ds->type, 0)));
     XPUSHs(sv_2mortal(newRV_noinc((SV *)pds)));
     XPUSHs(sv_2mortal(newRV_noinc((SV *)pvl)));
+  } else if (PLUGIN_WRITE_BATCH == type) {
+    const plugin_write_entry_t *entries;
+    size_t entries_num;
+
+    AV *batch = newAV();
+
+    subname = va_arg(ap, char *);
+    /*
+     * $_[0] =
+     * [
+     *   [ $plugin_type, $data_set, $value_list ],
+     *   ...
+     * ];
+     *
+     * See PLUGIN_WRITE for the layout of $data_set and $value_list.
+     */
+    entries = va_arg(ap, const plugin_write_entry_t *);
+    entries_num = va_arg(ap, size_t);
+
+    if (0 < entries_num)
+      av_extend(batch, entries_num - 1);
+
+    for (size_t i = 0; i < entries_num; ++i) {
+      const data_set_t *ds = entries[i].ds;
+      AV *entry;
+      AV *pds;
+      HV *pvl;
+
+      pds = data_set2av_cached(aTHX_ t, ds);
+      if (NULL == pds) {
+        ret = -1;
+        continue;
+      }
+
+      pvl = newHV();
+      if (-1 == value_list2hv(aTHX_(value_list_t *) entries[i].vl,
+                              (data_set_t *)ds, pvl)) {
+        SvREFCNT_dec((SV *)pds);
+        SvREFCNT_dec((SV *)pvl);
+        ret = -1;
+        continue;
+      }
+
+      entry = newAV();
+      av_extend(entry, 2);
+      av_store(entry, 0, newSVpv(ds->type, 0));
+      av_store(entry, 1, newRV_noinc((SV *)pds));
+      av_store(entry, 2, newRV_noinc((SV *)pvl));
+      av_push(batch, newRV_noinc((SV *)entry));
+    }
+
+    XPUSHs(sv_2mortal(newRV_noinc((SV *)batch)));
   } else if (PLUGIN_LOG == type) {
     subname = va_arg(ap, char *);
     /*
@@ -1160,6 +1307,19 @@ static int pplugin_call(pTHX_ int type, ...) {
   FREETMPS;
   LEAVE;
 
+  /* If we hold the only reference left, the hash is cleared and kept for the
+   * next call. */
+  if (NULL != pvl_keep) {
+    if ((1 == SvREFCNT((SV *)pvl_keep)) && !SvOBJECT((SV *)pvl_keep) &&
+        !SvMAGICAL((SV *)pvl_keep) && !SvREADONLY((SV *)pvl_keep) &&
+        (NULL == t->value_list)) {
+      hv_clear(pvl_keep);
+      t->value_list = pvl_keep;
+    } else {
+      SvREFCNT_dec((SV *)pvl_keep);
+    }
+  }
+
   va_end(ap);
   return ret;
 } /* static int pplugin_call (int, ...) */
@@ -1183,6 +1343,24 @@ static void c_ithread_destroy(c_ithread_t *ithread) {
   ithread->running = true;
   log_debug("Shutting down Perl interpreter %p...", aTHX);
 
+  if (NULL != ithread->data_sets) {
+    char *key;
+    c_ithread_ds_t *entry;
+
+    while (0 == c_avl_pick(ithread->data_sets, (void *)&key, (void *)&entry)) {
+      SvREFCNT_dec((SV *)entry->array);
+      sfree(entry);
+      sfree(key);
+    }
+    c_avl_destroy(ithread->data_sets);
+    ithread->data_sets = NULL;
+  }
+
+  if (NULL != ithread->value_list) {
+    SvREFCNT_dec((SV *)ithread->value_list);
+    ithread->value_list = NULL;
+  }
+
 #if COLLECT_DEBUG
   sv_report_used();
 
@@ -1274,6 +1452,32 @@ static c_ithread_t *c_ithread_create(PerlInterpreter *base) {
   return t;
 } /* static c_ithread_t *c_ithread_create (PerlInterpreter *) */
 
+/*
+ * Binds an interpreter to a thread which doesn't have one yet. Interpreters
+ * cloned in advance by perl_init() are claimed without taking the mutex;
+ * the base interpreter is only cloned once the pool has been used up.
+ */
+static PerlInterpreter *c_ithread_acquire(void) {
+  c_ithread_t *t = NULL;
+
+  for (int i = 0; i < perl_pool_size; ++i) {
+    t = perl_pool[i];
+    if ((NULL == t) || !__sync_bool_compare_and_swap(&perl_pool[i], t, NULL))
+      continue;
+
+    t->pthread = pthread_self();
+    pthread_setspecific(perl_thr_key, (const void *)t);
+    PERL_SET_CONTEXT(t->interp);
+    return t->interp;
+  }
+
+  pthread_mutex_lock(&perl_threads->mutex);
+  t = c_ithread_create(perl_threads->head->interp);
+  pthread_mutex_unlock(&perl_threads->mutex);
+
+  return t->interp;
+} /* static PerlInterpreter *c_ithread_acquire (void) */
+
 /*
  * Filter chains implementation.
  */
@@ -1426,15 +1630,8 @@ static int fc_create(int type, const oconfig_item_t *ci, void **user_data) {
   if (NULL == perl_threads)
     return 0;
 
-  if (NULL == aTHX) {
-    c_ithread_t *t = NULL;
-
-    pthread_mutex_lock(&perl_threads->mutex);
-    t = c_ithread_create(perl_threads->head->interp);
-    pthread_mutex_unlock(&perl_threads->mutex);
-
-    aTHX = t->interp;
-  }
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
 
   log_debug("fc_create: c_ithread: interp = %p (active threads: %i)", aTHX,
             perl_threads->number_of_threads);
@@ -1468,15 +1665,8 @@ static int fc_destroy(int type, void **user_data) {
   if ((NULL == perl_threads) || (NULL == data))
     return 0;
 
-  if (NULL == aTHX) {
-    c_ithread_t *t = NULL;
-
-    pthread_mutex_lock(&perl_threads->mutex);
-    t = c_ithread_create(perl_threads->head->interp);
-    pthread_mutex_unlock(&perl_threads->mutex);
-
-    aTHX = t->interp;
-  }
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
 
   log_debug("fc_destroy: c_ithread: interp = %p (active threads: %i)", aTHX,
             perl_threads->number_of_threads);
@@ -1499,15 +1689,8 @@ static int fc_exec(int type, const data_set_t *ds, const value_list_t *vl,
 
   assert(NULL != data);
 
-  if (NULL == aTHX) {
-    c_ithread_t *t = NULL;
-
-    pthread_mutex_lock(&perl_threads->mutex);
-    t = c_ithread_create(perl_threads->head->interp);
-    pthread_mutex_unlock(&perl_threads->mutex);
-
-    aTHX = t->interp;
-  }
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
 
   log_debug("fc_exec: c_ithread: interp = %p (active threads: %i)", aTHX,
             perl_threads->number_of_threads);
@@ -1597,6 +1780,8 @@ static void _plugin_register_generic_userdata(pTHX, int type,
         &userdata);
   } else if (PLUGIN_WRITE == type) {
     ret = plugin_register_write(pluginname, perl_write, &userdata);
+  } else if (PLUGIN_WRITE_BATCH == type) {
+    ret = plugin_register_write_batch(pluginname, perl_write_batch, &userdata);
   } else if (PLUGIN_LOG == type) {
     ret = plugin_register_log(pluginname, perl_log, &userdata);
   } else if (PLUGIN_NOTIF == type) {
@@ -1640,6 +1825,10 @@ static XS(Collectd_plugin_register_write) {
   _plugin_register_generic_userdata(aTHX, PLUGIN_WRITE, "write");
 }
 
+static XS(Collectd_plugin_register_write_batch) {
+  _plugin_register_generic_userdata(aTHX, PLUGIN_WRITE_BATCH, "write_batch");
+}
+
 static XS(Collectd_plugin_register_log) {
   _plugin_register_generic_userdata(aTHX, PLUGIN_LOG, "log");
 }
@@ -2064,15 +2253,8 @@ static int perl_init(void) {
   if (NULL == perl_threads)
     return 0;
 
-  if (NULL == aTHX) {
-    c_ithread_t *t = NULL;
-
-    pthread_mutex_lock(&perl_threads->mutex);
-    t = c_ithread_create(perl_threads->head->interp);
-    pthread_mutex_unlock(&perl_threads->mutex);
-
-    aTHX = t->interp;
-  }
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
 
   log_debug("perl_init: c_ithread: interp = %p (active threads: %i)", aTHX,
             perl_threads->number_of_threads);
@@ -2086,6 +2268,27 @@ static int perl_init(void) {
 
   status = pplugin_call(aTHX_ PLUGIN_INIT);
 
+  /* Clone the interpreters for read and write threads up front, so they
+   * don't have to wait for the base interpreter when they first call into
+   * Perl. c_ithread_create() binds each clone to this thread, so the base
+   * interpreter is restored afterwards. */
+  if ((0 < perl_pool_size) && (NULL == perl_pool)) {
+    perl_pool = calloc(perl_pool_size, sizeof(*perl_pool));
+    if (NULL == perl_pool) {
+      log_err("perl_init: calloc failed.");
+      perl_pool_size = 0;
+    }
+
+    for (int i = 0; i < perl_pool_size; ++i)
+      perl_pool[i] = c_ithread_create(perl_threads->head->interp);
+
+    pthread_setspecific(perl_thr_key, (const void *)perl_threads->head);
+    PERL_SET_CONTEXT(perl_threads->head->interp);
+
+    log_debug("perl_init: cloned %i interpreters (active threads: %i)",
+              perl_pool_size, perl_threads->number_of_threads);
+  }
+
   pthread_mutex_unlock(&perl_threads->mutex);
 
   return status;
@@ -2097,15 +2300,8 @@ static int perl_read(user_data_t *user_data) {
   if (NULL == perl_threads)
     return 0;
 
-  if (NULL == aTHX) {
-    c_ithread_t *t = NULL;
-
-    pthread_mutex_lock(&perl_threads->mutex);
-    t = c_ithread_create(perl_threads->head->interp);
-    pthread_mutex_unlock(&perl_threads->mutex);
-
-    aTHX = t->interp;
-  }
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
 
   /* Assert that we're not running as the base thread. Otherwise, we might
    * run into concurrency issues with c_ithread_create(). See
@@ -2126,15 +2322,8 @@ static int perl_write(const data_set_t *ds, const value_list_t *vl,
   if (NULL == perl_threads)
     return 0;
 
-  if (NULL == aTHX) {
-    c_ithread_t *t = NULL;
-
-    pthread_mutex_lock(&perl_threads->mutex);
-    t = c_ithread_create(perl_threads->head->interp);
-    pthread_mutex_unlock(&perl_threads->mutex);
-
-    aTHX = t->interp;
-  }
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
 
   /* Lock the base thread if this is not called from one of the read threads
    * to avoid race conditions with c_ithread_create(). See
@@ -2152,21 +2341,40 @@ static int perl_write(const data_set_t *ds, const value_list_t *vl,
   return status;
 } /* static int perl_write (const data_set_t *, const value_list_t *) */
 
-static void perl_log(int level, const char *msg, user_data_t *user_data) {
+static int perl_write_batch(const plugin_write_entry_t *entries,
+                            size_t entries_num, user_data_t *user_data) {
+  int status;
   dTHX;
 
   if (NULL == perl_threads)
-    return;
+    return 0;
 
-  if (NULL == aTHX) {
-    c_ithread_t *t = NULL;
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
 
+  /* See perl_write(). */
+  if (aTHX == perl_threads->head->interp)
     pthread_mutex_lock(&perl_threads->mutex);
-    t = c_ithread_create(perl_threads->head->interp);
+
+  log_debug("perl_write_batch: c_ithread: interp = %p (active threads: %i)",
+            aTHX, perl_threads->number_of_threads);
+  status = pplugin_call(aTHX_ PLUGIN_WRITE_BATCH, user_data->data, entries,
+                        entries_num);
+
+  if (aTHX == perl_threads->head->interp)
     pthread_mutex_unlock(&perl_threads->mutex);
 
-    aTHX = t->interp;
-  }
+  return status;
+} /* static int perl_write_batch (const plugin_write_entry_t *, size_t) */
+
+static void perl_log(int level, const char *msg, user_data_t *user_data) {
+  dTHX;
+
+  if (NULL == perl_threads)
+    return;
+
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
 
   /* Lock the base thread if this is not called from one of the read threads
    * to avoid race conditions with c_ithread_create(). See
@@ -2190,15 +2398,8 @@ static int perl_notify(const notification_t *notif, user_data_t *user_data) {
   if (NULL == perl_threads)
     return 0;
 
-  if (NULL == aTHX) {
-    c_ithread_t *t = NULL;
-
-    pthread_mutex_lock(&perl_threads->mutex);
-    t = c_ithread_create(perl_threads->head->interp);
-    pthread_mutex_unlock(&perl_threads->mutex);
-
-    aTHX = t->interp;
-  }
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
   return pplugin_call(aTHX_ PLUGIN_NOTIF, user_data->data, notif);
 } /* static int perl_notify (const notification_t *) */
 
@@ -2209,15 +2410,8 @@ static int perl_flush(cdtime_t timeout, const char *identifier,
   if (NULL == perl_threads)
     return 0;
 
-  if (NULL == aTHX) {
-    c_ithread_t *t = NULL;
-
-    pthread_mutex_lock(&perl_threads->mutex);
-    t = c_ithread_create(perl_threads->head->interp);
-    pthread_mutex_unlock(&perl_threads->mutex);
-
-    aTHX = t->interp;
-  }
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
 
   /* For collectd-5.6 only, #1731 */
   if (user_data == NULL || user_data->data == NULL)
@@ -2238,13 +2432,8 @@ static int perl_shutdown(void) {
   if (NULL == perl_threads)
     return 0;
 
-  if (NULL == aTHX) {
-    pthread_mutex_lock(&perl_threads->mutex);
-    t = c_ithread_create(perl_threads->head->interp);
-    pthread_mutex_unlock(&perl_threads->mutex);
-
-    aTHX = t->interp;
-  }
+  if (NULL == aTHX)
+    aTHX = c_ithread_acquire();
 
   log_debug("perl_shutdown: c_ithread: interp = %p (active threads: %i)", aTHX,
             perl_threads->number_of_threads);
@@ -2255,6 +2444,13 @@ static int perl_shutdown(void) {
   ret = pplugin_call(aTHX_ PLUGIN_SHUTDOWN);
 
   pthread_mutex_lock(&perl_threads->mutex);
+
+  /* Unclaimed interpreters are destroyed along with all others below. */
+  for (int i = 0; i < perl_pool_size; ++i)
+    perl_pool[i] = NULL;
+  sfree(perl_pool);
+  perl_pool_size = 0;
+
   t = perl_threads->tail;
 
   while (NULL != t) {
@@ -2689,6 +2885,13 @@ static int perl_config(oconfig_item_t *ci) {
       current_status = perl_config_plugin(aTHX_ c);
     else if (0 == strcasecmp(c->key, "RegisterLegacyFlush"))
       cf_util_get_boolean(c, &register_legacy_flush);
+    else if (0 == strcasecmp(c->key, "InterpreterPool")) {
+      current_status = cf_util_get_int(c, &perl_pool_size);
+      if ((0 == current_status) && (0 > perl_pool_size)) {
+        log_warn("InterpreterPool must not be negative.");
+        perl_pool_size = 0;
+      }
+    }
     else {
       log_warn("Ignoring unknown config key \"%s\".", c->key);
       current_status = 0;
@@ -23,6 +23,8 @@
  *   Florian Forster <octo at collectd.org>
  **/
 
+#define _GNU_SOURCE /* For recvmmsg(2) */
+
 #include "collectd.h"
 
 #include "common.h"
@@ -57,6 +59,17 @@
 #define PINBA_MAX_SOCKETS 16
 #endif
 
+/* Number of datagrams a collector thread reads with one recvmmsg(2) call. */
+#ifndef PINBA_RECEIVE_BATCH_SIZE
+#define PINBA_RECEIVE_BATCH_SIZE 16
+#endif
+
+/* The fields of a request a view matches on, see pinba_statnode_s. */
+#define PINBA_MATCH_HOST 0x01
+#define PINBA_MATCH_SERVER 0x02
+#define PINBA_MATCH_SCRIPT 0x04
+#define PINBA_MATCH_NUM 8
+
 /*
  * Private data structures
  */
@@ -74,6 +87,18 @@ struct float_counter_s {
 };
 typedef struct float_counter_s float_counter_t;
 
+struct pinba_counters_s {
+  derive_t req_count;
+
+  float_counter_t req_time;
+  float_counter_t ru_utime;
+  float_counter_t ru_stime;
+
+  derive_t doc_size;
+  gauge_t mem_peak;
+};
+typedef struct pinba_counters_s pinba_counters_t;
+
 struct pinba_statnode_s {
   /* collector name, used as plugin instance */
   char *name;
@@ -83,16 +108,24 @@ struct pinba_statnode_s {
   char *server;
   char *script;
 
-  derive_t req_count;
-
-  float_counter_t req_time;
-  float_counter_t ru_utime;
-  float_counter_t ru_stime;
-
-  derive_t doc_size;
-  gauge_t mem_peak;
+  /* Views are looked up in `stat_index' by a hash of the fields they match
+   * on. Nodes with the same bucket are chained by `index_next'. */
+  int match;
+  uint32_t hash;
+  int index_next;
 };
 typedef struct pinba_statnode_s pinba_statnode_t;
+
+/* Each collector thread has its own socket(s) and accumulates the requests
+ * it receives in its own counters, one per stat node. They are summed up by
+ * plugin_read(), so the threads never wait for each other. */
+struct pinba_collector_s {
+  pthread_t id;
+  bool running;
+  pthread_mutex_t lock;
+  pinba_counters_t *counters;
+};
+typedef struct pinba_collector_s pinba_collector_t;
 /* }}} */
 
 /*
@@ -103,12 +136,17 @@ static pinba_statnode_t *stat_nodes;
 static unsigned int stat_nodes_num;
 static pthread_mutex_t stat_nodes_lock;
 
+static int *stat_index;
+static uint32_t stat_index_mask;
+static bool stat_index_match[PINBA_MATCH_NUM];
+
 static char *conf_node;
 static char *conf_service;
+static size_t conf_threads = 1;
 
-static bool collector_thread_running;
+static pinba_collector_t *collectors;
+static size_t collectors_num;
 static bool collector_thread_do_shutdown;
-static pthread_t collector_thread_id;
 /* }}} */
 
 /*
@@ -134,6 +172,17 @@ static void float_counter_add(float_counter_t *fc, float val) /* {{{ */
   }
 } /* }}} void float_counter_add */
 
+static void float_counter_merge(float_counter_t *dst, /* {{{ */
+                                const float_counter_t *src) {
+  dst->i += src->i;
+  dst->n += src->n;
+
+  if (dst->n >= 1000000000) {
+    dst->i += 1;
+    dst->n -= 1000000000;
+  }
+} /* }}} void float_counter_merge */
+
 static derive_t float_counter_get(const float_counter_t *fc, /* {{{ */
                                   uint64_t factor) {
   derive_t ret;
@@ -159,6 +208,25 @@ static void strset(char **str, const char *new) /* {{{ */
   *str = tmp;
 } /* }}} void strset */
 
+/* FNV-1a over the fields selected by "match", separated by zero bytes. */
+static uint32_t pinba_hash(int match, const char *host, /* {{{ */
+                           const char *server, const char *script) {
+  const char *fields[] = {(match & PINBA_MATCH_HOST) ? host : NULL,
+                          (match & PINBA_MATCH_SERVER) ? server : NULL,
+                          (match & PINBA_MATCH_SCRIPT) ? script : NULL};
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fields); i++) {
+    if (fields[i] == NULL)
+      continue;
+    for (const char *c = fields[i]; *c != 0; c++)
+      hash = (hash ^ (uint8_t)*c) * 16777619u;
+    hash = (hash ^ 0) * 16777619u;
+  }
+
+  return hash ^ (uint32_t)match;
+} /* }}} uint32_t pinba_hash */
+
 static void service_statnode_add(const char *name, /* {{{ */
                                  const char *host, const char *server,
                                  const char *script) {
@@ -180,84 +248,131 @@ static void service_statnode_add(const char *name, /* {{{ */
   node->server = NULL;
   node->script = NULL;
 
-  node->mem_peak = NAN;
-
   /* fill query data */
   strset(&node->name, name);
   strset(&node->host, host);
   strset(&node->server, server);
   strset(&node->script, script);
 
+  node->match = ((host != NULL) ? PINBA_MATCH_HOST : 0) |
+                ((server != NULL) ? PINBA_MATCH_SERVER : 0) |
+                ((script != NULL) ? PINBA_MATCH_SCRIPT : 0);
+  node->hash = pinba_hash(node->match, host, server, script);
+  node->index_next = -1;
+
   /* increment counter */
   stat_nodes_num++;
 } /* }}} void service_statnode_add */
 
-/* Copy the data from the global "stat_nodes" list into the buffer pointed to
- * by "res", doing the derivation in the process. Returns the next index or
- * zero if the end of the list has been reached. */
-static unsigned int service_statnode_collect(pinba_statnode_t *res, /* {{{ */
-                                             unsigned int index) {
-  pinba_statnode_t *node;
+/* Builds the hash table of the views. Called once the configuration has been
+ * read, the views don't change afterwards. */
+static int service_statnode_index(void) /* {{{ */
+{
+  uint32_t size = 16;
+  while (size < 2 * stat_nodes_num)
+    size *= 2;
+
+  sfree(stat_index);
+  stat_index = malloc(size * sizeof(*stat_index));
+  if (stat_index == NULL) {
+    ERROR("pinba plugin: malloc failed.");
+    return ENOMEM;
+  }
+  stat_index_mask = size - 1;
 
-  if (stat_nodes_num == 0)
-    return 0;
+  for (uint32_t i = 0; i < size; i++)
+    stat_index[i] = -1;
+  memset(stat_index_match, 0, sizeof(stat_index_match));
 
-  /* begin collecting */
-  if (index == 0)
-    pthread_mutex_lock(&stat_nodes_lock);
+  /* Insert in reverse, so that the chains keep the configured order. */
+  for (unsigned int i = stat_nodes_num; i > 0; i--) {
+    pinba_statnode_t *node = stat_nodes + (i - 1);
+    uint32_t bucket = node->hash & stat_index_mask;
 
-  /* end collecting */
-  if (index >= stat_nodes_num) {
-    pthread_mutex_unlock(&stat_nodes_lock);
-    return 0;
+    node->index_next = stat_index[bucket];
+    stat_index[bucket] = (int)(i - 1);
+    stat_index_match[node->match] = true;
   }
 
-  node = stat_nodes + index;
-  memcpy(res, node, sizeof(*res));
-
-  /* reset node */
-  node->mem_peak = NAN;
-
-  return index + 1;
-} /* }}} unsigned int service_statnode_collect */
+  return 0;
+} /* }}} int service_statnode_index */
+
+static bool service_statnode_matches(const pinba_statnode_t *node, /* {{{ */
+                                     const Pinba__Request *request) {
+  if ((node->host != NULL) && (strcmp(request->hostname, node->host) != 0))
+    return false;
+  if ((node->server != NULL) &&
+      (strcmp(request->server_name, node->server) != 0))
+    return false;
+  if ((node->script != NULL) &&
+      (strcmp(request->script_name, node->script) != 0))
+    return false;
+  return true;
+} /* }}} bool service_statnode_matches */
+
+/* Add the counters of all collector threads for the node at "index" and
+ * reset the peak memory usage. */
+static void service_statnode_collect(pinba_counters_t *res, /* {{{ */
+                                     unsigned int index) {
+  memset(res, 0, sizeof(*res));
+  res->mem_peak = NAN;
+
+  for (size_t i = 0; i < collectors_num; i++) {
+    pinba_collector_t *c = collectors + i;
+
+    pthread_mutex_lock(&c->lock);
+    pinba_counters_t *cnt = c->counters + index;
+
+    res->req_count += cnt->req_count;
+    float_counter_merge(&res->req_time, &cnt->req_time);
+    float_counter_merge(&res->ru_utime, &cnt->ru_utime);
+    float_counter_merge(&res->ru_stime, &cnt->ru_stime);
+    res->doc_size += cnt->doc_size;
+    if (isnan(res->mem_peak) || (res->mem_peak < cnt->mem_peak))
+      res->mem_peak = cnt->mem_peak;
+
+    /* reset node */
+    cnt->mem_peak = NAN;
+    pthread_mutex_unlock(&c->lock);
+  }
+} /* }}} void service_statnode_collect */
 
-static void service_statnode_process(pinba_statnode_t *node, /* {{{ */
+static void service_statnode_process(pinba_counters_t *cnt, /* {{{ */
                                      Pinba__Request *request) {
-  node->req_count++;
+  cnt->req_count++;
 
-  float_counter_add(&node->req_time, request->request_time);
-  float_counter_add(&node->ru_utime, request->ru_utime);
-  float_counter_add(&node->ru_stime, request->ru_stime);
+  float_counter_add(&cnt->req_time, request->request_time);
+  float_counter_add(&cnt->ru_utime, request->ru_utime);
+  float_counter_add(&cnt->ru_stime, request->ru_stime);
 
-  node->doc_size += request->document_size;
+  cnt->doc_size += request->document_size;
 
-  if (isnan(node->mem_peak) ||
-      (node->mem_peak < ((gauge_t)request->memory_peak)))
-    node->mem_peak = (gauge_t)request->memory_peak;
+  if (isnan(cnt->mem_peak) ||
+      (cnt->mem_peak < ((gauge_t)request->memory_peak)))
+    cnt->mem_peak = (gauge_t)request->memory_peak;
 
 } /* }}} void service_statnode_process */
 
-static void service_process_request(Pinba__Request *request) /* {{{ */
-{
-  pthread_mutex_lock(&stat_nodes_lock);
-
-  for (unsigned int i = 0; i < stat_nodes_num; i++) {
-    if ((stat_nodes[i].host != NULL) &&
-        (strcmp(request->hostname, stat_nodes[i].host) != 0))
+/* Must be called with the collector's lock held. */
+static void service_process_request(pinba_collector_t *c, /* {{{ */
+                                    Pinba__Request *request) {
+  for (int match = 0; match < PINBA_MATCH_NUM; match++) {
+    if (!stat_index_match[match])
       continue;
 
-    if ((stat_nodes[i].server != NULL) &&
-        (strcmp(request->server_name, stat_nodes[i].server) != 0))
-      continue;
+    uint32_t hash = pinba_hash(match, request->hostname, request->server_name,
+                               request->script_name);
+    for (int i = stat_index[hash & stat_index_mask]; i >= 0;
+         i = stat_nodes[i].index_next) {
+      pinba_statnode_t *node = stat_nodes + i;
 
-    if ((stat_nodes[i].script != NULL) &&
-        (strcmp(request->script_name, stat_nodes[i].script) != 0))
-      continue;
+      if ((node->match != match) || (node->hash != hash) ||
+          !service_statnode_matches(node, request))
+        continue;
 
-    service_statnode_process(&stat_nodes[i], request);
+      service_statnode_process(c->counters + i, request);
+    }
   }
-
-  pthread_mutex_unlock(&stat_nodes_lock);
 } /* }}} void service_process_request */
 
 static int pb_del_socket(pinba_socket_t *s, /* {{{ */
@@ -304,6 +419,19 @@ static int pb_add_socket(pinba_socket_t *s, /* {{{ */
     WARNING("pinba plugin: setsockopt(SO_REUSEADDR) failed: %s", STRERRNO);
   }
 
+#ifdef SO_REUSEPORT
+  /* let the kernel distribute the datagrams over the collector threads'
+   * sockets */
+  if (conf_threads > 1) {
+    status = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &tmp, sizeof(tmp));
+    if (status != 0) {
+      ERROR("pinba plugin: setsockopt(SO_REUSEPORT) failed: %s", STRERRNO);
+      close(fd);
+      return 0;
+    }
+  }
+#endif
+
   status = bind(fd, ai->ai_addr, ai->ai_addrlen);
   if (status != 0) {
     ERROR("pinba plugin: bind(2) failed: %s", STRERRNO);
@@ -382,7 +510,9 @@ static void pinba_socket_free(pinba_socket_t *socket) /* {{{ */
   sfree(socket);
 } /* }}} void pinba_socket_free */
 
-static int pinba_process_stats_packet(const uint8_t *buffer, /* {{{ */
+/* Must be called with the collector's lock held. */
+static int pinba_process_stats_packet(pinba_collector_t *c, /* {{{ */
+                                      const uint8_t *buffer,
                                       size_t buffer_size) {
   Pinba__Request *request;
 
@@ -391,56 +521,80 @@ static int pinba_process_stats_packet(const uint8_t *buffer, /* {{{ */
   if (!request)
     return -1;
 
-  service_process_request(request);
+  service_process_request(c, request);
   pinba__request__free_unpacked(request, NULL);
 
   return 0;
 } /* }}} int pinba_process_stats_packet */
 
-static int pinba_udp_read_callback_fn(int sock) /* {{{ */
-{
-  uint8_t buffer[PINBA_UDP_BUFFER_SIZE];
-  size_t buffer_size;
-  int status;
+/* Reads up to PINBA_RECEIVE_BATCH_SIZE datagrams into "buffers", which holds
+ * PINBA_RECEIVE_BATCH_SIZE * PINBA_UDP_BUFFER_SIZE bytes. Returns the number
+ * of datagrams or -1 on error. */
+static int pinba_udp_receive(int sock, uint8_t *buffers, /* {{{ */
+                             size_t *sizes) {
+#if HAVE_RECVMMSG
+  struct mmsghdr msgs[PINBA_RECEIVE_BATCH_SIZE] = {{{0}}};
+  struct iovec iovs[PINBA_RECEIVE_BATCH_SIZE];
+
+  for (size_t i = 0; i < PINBA_RECEIVE_BATCH_SIZE; i++) {
+    iovs[i].iov_base = buffers + i * PINBA_UDP_BUFFER_SIZE;
+    iovs[i].iov_len = PINBA_UDP_BUFFER_SIZE;
+    msgs[i].msg_hdr.msg_iov = iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
 
-  while (42) {
-    buffer_size = sizeof(buffer);
-    status = recvfrom(sock, buffer, buffer_size - 1, MSG_DONTWAIT,
-                      /* from = */ NULL, /* from len = */ 0);
-    if (status < 0) {
+  int status = recvmmsg(sock, msgs, PINBA_RECEIVE_BATCH_SIZE, MSG_DONTWAIT,
+                        /* timeout = */ NULL);
+  for (int i = 0; i < status; i++)
+    sizes[i] = (size_t)msgs[i].msg_len;
+  return status;
+#else
+  ssize_t status = recvfrom(sock, buffers, PINBA_UDP_BUFFER_SIZE, MSG_DONTWAIT,
+                            /* from = */ NULL, /* from len = */ 0);
+  if (status < 0)
+    return -1;
+  sizes[0] = (size_t)status;
+  return 1;
+#endif
+} /* }}} int pinba_udp_receive */
 
-      if ((errno == EINTR)
+static int pinba_udp_read_callback_fn(pinba_collector_t *c, /* {{{ */
+                                      int sock, uint8_t *buffers) {
+  size_t sizes[PINBA_RECEIVE_BATCH_SIZE];
+
+  int num = pinba_udp_receive(sock, buffers, sizes);
+  if (num < 0) {
+    if ((errno == EINTR)
 #ifdef EWOULDBLOCK
-          || (errno == EWOULDBLOCK)
+        || (errno == EWOULDBLOCK)
 #endif
-          || (errno == EAGAIN)) {
-        continue;
-      }
+        || (errno == EAGAIN)) {
+      return 0;
+    }
 
-      WARNING("pinba plugin: recvfrom(2) failed: %s", STRERRNO);
-      return -1;
-    } else if (status == 0) {
+    WARNING("pinba plugin: recvfrom(2) failed: %s", STRERRNO);
+    return -1;
+  }
+
+  /* Take the lock once for the whole batch. */
+  pthread_mutex_lock(&c->lock);
+  for (int i = 0; i < num; i++) {
+    if (sizes[i] == 0) {
       DEBUG("pinba plugin: recvfrom(2) returned unexpected status zero.");
-      return -1;
-    } else /* if (status > 0) */
-    {
-      assert(((size_t)status) < buffer_size);
-      buffer_size = (size_t)status;
-      buffer[buffer_size] = 0;
-
-      status = pinba_process_stats_packet(buffer, buffer_size);
-      if (status != 0)
-        DEBUG("pinba plugin: Parsing packet failed.");
-      return status;
+      continue;
     }
-  } /* while (42) */
 
-  /* not reached */
-  assert(23 == 42);
-  return -1;
+    int status = pinba_process_stats_packet(
+        c, buffers + i * PINBA_UDP_BUFFER_SIZE, sizes[i]);
+    if (status != 0)
+      DEBUG("pinba plugin: Parsing packet failed.");
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  return 0;
 } /* }}} void pinba_udp_read_callback_fn */
 
-static int receive_loop(void) /* {{{ */
+static int receive_loop(pinba_collector_t *c) /* {{{ */
 {
   pinba_socket_t *s;
 
@@ -450,6 +604,13 @@ static int receive_loop(void) /* {{{ */
     return -1;
   }
 
+  uint8_t *buffers = malloc(PINBA_RECEIVE_BATCH_SIZE * PINBA_UDP_BUFFER_SIZE);
+  if (buffers == NULL) {
+    ERROR("pinba plugin: malloc failed.");
+    pinba_socket_free(s);
+    return -1;
+  }
+
   while (!collector_thread_do_shutdown) {
     int status;
 
@@ -465,6 +626,7 @@ static int receive_loop(void) /* {{{ */
         continue;
 
       ERROR("pinba plugin: poll(2) failed: %s", STRERRNO);
+      sfree(buffers);
       pinba_socket_free(s);
       return -1;
     }
@@ -474,11 +636,12 @@ static int receive_loop(void) /* {{{ */
         pb_del_socket(s, i);
         i--;
       } else if (s->fd[i].revents & (POLLIN | POLLPRI)) {
-        pinba_udp_read_callback_fn(s->fd[i].fd);
+        pinba_udp_read_callback_fn(c, s->fd[i].fd, buffers);
       }
     } /* for (s->fd) */
   }   /* while (!collector_thread_do_shutdown) */
 
+  sfree(buffers);
   pinba_socket_free(s);
   s = NULL;
 
@@ -487,10 +650,8 @@ static int receive_loop(void) /* {{{ */
 
 static void *collector_thread(void *arg) /* {{{ */
 {
-  receive_loop();
+  receive_loop(arg);
 
-  memset(&collector_thread_id, 0, sizeof(collector_thread_id));
-  collector_thread_running = false;
   pthread_exit(NULL);
   return NULL;
 } /* }}} void *collector_thread */
@@ -539,6 +700,29 @@ static int pinba_config_view(const oconfig_item_t *ci) /* {{{ */
   return status;
 } /* }}} int pinba_config_view */
 
+static int pinba_config_threads(const oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+
+  if (cf_util_get_int(ci, &tmp) != 0)
+    return -1;
+  else if ((tmp < 1) || (tmp > 256)) {
+    WARNING("pinba plugin: The `ReceiveThreads' must be between 1 and 256.");
+    return -1;
+  }
+
+#ifndef SO_REUSEPORT
+  if (tmp > 1) {
+    WARNING("pinba plugin: SO_REUSEPORT is not available on this system, "
+            "using a single receive thread.");
+    tmp = 1;
+  }
+#endif
+
+  conf_threads = (size_t)tmp;
+  return 0;
+} /* }}} int pinba_config_threads */
+
 static int plugin_config(oconfig_item_t *ci) /* {{{ */
 {
   /* The lock should not be necessary in the config callback, but let's be
@@ -552,6 +736,8 @@ static int plugin_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_string(child, &conf_node);
     else if (strcasecmp("Port", child->key) == 0)
       cf_util_get_service(child, &conf_service);
+    else if (strcasecmp("ReceiveThreads", child->key) == 0)
+      pinba_config_threads(child);
     else if (strcasecmp("View", child->key) == 0)
       pinba_config_view(child);
     else
@@ -575,48 +761,80 @@ static int plugin_init(void) /* {{{ */
                          /* script = */ NULL);
   }
 
-  if (collector_thread_running)
+  if (collectors != NULL)
     return 0;
 
-  status = plugin_thread_create(&collector_thread_id,
-                                /* attrs = */ NULL, collector_thread,
-                                /* args = */ NULL, "pinba collector");
-  if (status != 0) {
-    ERROR("pinba plugin: pthread_create(3) failed: %s", STRERRNO);
+  if (service_statnode_index() != 0)
     return -1;
+
+  collectors = calloc(conf_threads, sizeof(*collectors));
+  if (collectors == NULL) {
+    ERROR("pinba plugin: calloc failed.");
+    return -1;
+  }
+
+  for (size_t i = 0; i < conf_threads; i++) {
+    pinba_collector_t *c = collectors + i;
+
+    c->counters = calloc(stat_nodes_num, sizeof(*c->counters));
+    if (c->counters == NULL) {
+      ERROR("pinba plugin: calloc failed.");
+      break;
+    }
+    for (unsigned int j = 0; j < stat_nodes_num; j++)
+      c->counters[j].mem_peak = NAN;
+    pthread_mutex_init(&c->lock, /* attr = */ NULL);
+    collectors_num++;
+
+    status = plugin_thread_create(&c->id,
+                                  /* attrs = */ NULL, collector_thread,
+                                  /* args = */ c, "pinba collector");
+    if (status != 0) {
+      ERROR("pinba plugin: pthread_create(3) failed: %s", STRERRNO);
+      break;
+    }
+    c->running = true;
   }
-  collector_thread_running = true;
+
+  if (!collectors[0].running)
+    return -1;
 
   return 0;
 } /* }}} */
 
 static int plugin_shutdown(void) /* {{{ */
 {
-  if (collector_thread_running) {
-    int status;
+  DEBUG("pinba plugin: Shutting down collector threads.");
+  collector_thread_do_shutdown = true;
 
-    DEBUG("pinba plugin: Shutting down collector thread.");
-    collector_thread_do_shutdown = true;
+  for (size_t i = 0; i < collectors_num; i++) {
+    pinba_collector_t *c = collectors + i;
 
-    status = pthread_join(collector_thread_id, /* retval = */ NULL);
-    if (status != 0) {
-      ERROR("pinba plugin: pthread_join(3) failed: %s", STRERROR(status));
+    if (c->running) {
+      int status = pthread_join(c->id, /* retval = */ NULL);
+      if (status != 0) {
+        ERROR("pinba plugin: pthread_join(3) failed: %s", STRERROR(status));
+      }
+      c->running = false;
     }
 
-    collector_thread_running = false;
-    collector_thread_do_shutdown = false;
-  } /* if (collector_thread_running) */
+    pthread_mutex_destroy(&c->lock);
+    sfree(c->counters);
+  }
+  sfree(collectors);
+  collectors_num = 0;
+  collector_thread_do_shutdown = false;
 
   return 0;
 } /* }}} int plugin_shutdown */
 
-static int plugin_submit(const pinba_statnode_t *res) /* {{{ */
-{
+static int plugin_submit(const char *name, /* {{{ */
+                         const pinba_counters_t *res) {
   value_list_t vl = VALUE_LIST_INIT;
 
   vl.values_len = 1;
   sstrncpy(vl.plugin, "pinba", sizeof(vl.plugin));
-  sstrncpy(vl.plugin_instance, res->name, sizeof(vl.plugin_instance));
+  sstrncpy(vl.plugin_instance, name, sizeof(vl.plugin_instance));
 
   vl.values = &(value_t){.derive = res->req_count};
   sstrncpy(vl.type, "total_requests", sizeof(vl.type));
@@ -653,11 +871,11 @@ static int plugin_submit(const pinba_statnode_t *res) /* {{{ */
 
 static int plugin_read(void) /* {{{ */
 {
-  unsigned int i = 0;
-  pinba_statnode_t data;
+  pinba_counters_t data;
 
-  while ((i = service_statnode_collect(&data, i)) != 0) {
-    plugin_submit(&data);
+  for (unsigned int i = 0; i < stat_nodes_num; i++) {
+    service_statnode_collect(&data, i);
+    plugin_submit(stat_nodes[i].name, &data);
   }
 
   return 0;
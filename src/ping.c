@@ -29,6 +29,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_complain.h"
+#include "utils_latency.h"
 
 #include <netinet/in.h>
 #if HAVE_NETDB_H
@@ -54,6 +55,8 @@
  */
 struct hostlist_s {
   char *host;
+  /* Ping interval for this host, zero to use the global interval. */
+  double interval;
 
   uint32_t pkg_sent;
   uint32_t pkg_recv;
@@ -62,14 +65,43 @@ struct hostlist_s {
   double latency_total;
   double latency_squared;
 
+  /* Jitter is the mean absolute difference between consecutive round trip
+   * times. latency_last is negative if the previous packet was lost. */
+  double latency_last;
+  double jitter_total;
+  uint32_t jitter_num;
+
+  /* Round trip time distribution; only allocated if percentiles have been
+   * configured. */
+  latency_counter_t *latency;
+
   struct hostlist_s *next;
 };
 typedef struct hostlist_s hostlist_t;
 
+/* Hosts with the same interval are split into up to ping_threads groups. Each
+ * group is pinged by its own thread with its own ping object, so a slow
+ * group does not delay the others. */
+struct ping_group_s {
+  double interval;
+  double timeout;
+
+  /* Sorted by name for ping_group_lookup(). */
+  hostlist_t **hosts;
+  size_t hosts_num;
+
+  pthread_t thread;
+  bool thread_started;
+
+  struct ping_group_s *next;
+};
+typedef struct ping_group_s ping_group_t;
+
 /*
  * Private variables
  */
 static hostlist_t *hostlist_head;
+static ping_group_t *ping_groups;
 
 static int ping_af = PING_DEF_AF;
 static char *ping_source;
@@ -81,19 +113,25 @@ static int ping_ttl = PING_DEF_TTL;
 static double ping_interval = 1.0;
 static double ping_timeout = 0.9;
 static int ping_max_missed = -1;
+static int ping_threads = 1;
+static double *ping_percentile;
+static size_t ping_percentile_num;
+static bool ping_report_jitter;
 
 static pthread_mutex_t ping_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t ping_cond = PTHREAD_COND_INITIALIZER;
 static int ping_thread_loop;
 static int ping_thread_error;
-static pthread_t ping_thread_id;
 
-static const char *config_keys[] = {"Host",    "SourceAddress", "AddressFamily",
+static const char *config_keys[] = {"Host",       "SourceAddress",
+                                    "AddressFamily",
 #ifdef HAVE_OPING_1_3
                                     "Device",
 #endif
-                                    "Size",    "TTL",           "Interval",
-                                    "Timeout", "MaxMissed"};
+                                    "Size",       "TTL",
+                                    "Interval",   "Timeout",
+                                    "MaxMissed",  "Threads",
+                                    "Percentile", "ReportJitter"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 /*
@@ -141,8 +179,26 @@ static void time_calc(struct timespec *ts_dest, /* {{{ */
   time_normalize(ts_dest);
 } /* }}} void time_calc */
 
-static int ping_dispatch_all(pingobj_t *pingobj) /* {{{ */
+static int ping_host_compare(const void *a, const void *b) /* {{{ */
 {
+  hostlist_t const *const *hl_a = a;
+  hostlist_t const *const *hl_b = b;
+
+  return strcmp((*hl_a)->host, (*hl_b)->host);
+} /* }}} int ping_host_compare */
+
+static hostlist_t *ping_group_lookup(ping_group_t *group, /* {{{ */
+                                     char const *host) {
+  hostlist_t key = {.host = (char *)host};
+  hostlist_t *key_ptr = &key;
+
+  hostlist_t **hl = bsearch(&key_ptr, group->hosts, group->hosts_num,
+                            sizeof(*group->hosts), ping_host_compare);
+  return (hl != NULL) ? *hl : NULL;
+} /* }}} hostlist_t *ping_group_lookup */
+
+static int ping_dispatch_all(ping_group_t *group, /* {{{ */
+                             pingobj_t *pingobj) {
   hostlist_t *hl;
   int status;
 
@@ -166,10 +222,7 @@ static int ping_dispatch_all(pingobj_t *pingobj) /* {{{ */
       continue;
     }
 
-    for (hl = hostlist_head; hl != NULL; hl = hl->next)
-      if (strcmp(userhost, hl->host) == 0)
-        break;
-
+    hl = ping_group_lookup(group, userhost);
     if (hl == NULL) {
       WARNING("ping plugin: Cannot find host %s.", userhost);
       continue;
@@ -190,10 +243,22 @@ static int ping_dispatch_all(pingobj_t *pingobj) /* {{{ */
       hl->latency_total += latency;
       hl->latency_squared += (latency * latency);
 
+      if (hl->latency_last >= 0.0) {
+        hl->jitter_total += fabs(latency - hl->latency_last);
+        hl->jitter_num++;
+      }
+      hl->latency_last = latency;
+
+      /* liboping reports the latency in milliseconds. */
+      if (hl->latency != NULL)
+        latency_counter_add(hl->latency, DOUBLE_TO_CDTIME_T(latency / 1000.0));
+
       /* reset missed packages counter */
       hl->pkg_missed = 0;
-    } else
+    } else {
       hl->pkg_missed++;
+      hl->latency_last = -1.0;
+    }
 
     /* if the host did not answer our last N packages, trigger a resolv. */
     if ((ping_max_missed >= 0) &&
@@ -225,6 +290,8 @@ static int ping_dispatch_all(pingobj_t *pingobj) /* {{{ */
 
 static void *ping_thread(void *arg) /* {{{ */
 {
+  ping_group_t *group = arg;
+
   struct timeval tv_begin;
   struct timeval tv_end;
   struct timespec ts_wait;
@@ -260,15 +327,16 @@ static void *ping_thread(void *arg) /* {{{ */
       ERROR("ping plugin: Failed to set device: %s", ping_get_error(pingobj));
 #endif
 
-  ping_setopt(pingobj, PING_OPT_TIMEOUT, (void *)&ping_timeout);
+  ping_setopt(pingobj, PING_OPT_TIMEOUT, (void *)&group->timeout);
   ping_setopt(pingobj, PING_OPT_TTL, (void *)&ping_ttl);
 
   if (ping_data != NULL)
     ping_setopt(pingobj, PING_OPT_DATA, (void *)ping_data);
 
-  /* Add all the hosts to the ping object. */
+  /* Add all the hosts of this group to the ping object. */
   count = 0;
-  for (hostlist_t *hl = hostlist_head; hl != NULL; hl = hl->next) {
+  for (size_t i = 0; i < group->hosts_num; i++) {
+    hostlist_t *hl = group->hosts[i];
     int tmp_status;
     tmp_status = ping_host_add(pingobj, hl->host);
     if (tmp_status != 0)
@@ -280,6 +348,7 @@ static void *ping_thread(void *arg) /* {{{ */
 
   if (count == 0) {
     ERROR("ping plugin: No host could be added to ping object. Giving up.");
+    ping_destroy(pingobj);
     pthread_mutex_lock(&ping_lock);
     ping_thread_error = 1;
     pthread_mutex_unlock(&ping_lock);
@@ -291,7 +360,7 @@ static void *ping_thread(void *arg) /* {{{ */
     double temp_sec;
     double temp_nsec;
 
-    temp_nsec = modf(ping_interval, &temp_sec);
+    temp_nsec = modf(group->interval, &temp_sec);
     ts_int.tv_sec = (time_t)temp_sec;
     ts_int.tv_nsec = (long)(temp_nsec * 1000000000L);
   }
@@ -323,7 +392,7 @@ static void *ping_thread(void *arg) /* {{{ */
       break;
 
     if (send_successful)
-      (void)ping_dispatch_all(pingobj);
+      (void)ping_dispatch_all(group, pingobj);
 
     if (gettimeofday(&tv_end, NULL) < 0) {
       ERROR("ping plugin: gettimeofday failed: %s", STRERRNO);
@@ -346,6 +415,92 @@ static void *ping_thread(void *arg) /* {{{ */
   return (void *)0;
 } /* }}} void *ping_thread */
 
+static void ping_groups_free(void) /* {{{ */
+{
+  while (ping_groups != NULL) {
+    ping_group_t *next = ping_groups->next;
+    sfree(ping_groups->hosts);
+    sfree(ping_groups);
+    ping_groups = next;
+  }
+} /* }}} void ping_groups_free */
+
+/* Distributes the configured hosts over ping groups: hosts are grouped by
+ * interval and each interval is split round-robin into up to ping_threads
+ * groups. */
+static int ping_groups_create(void) /* {{{ */
+{
+  size_t hosts_num = 0;
+  for (hostlist_t *hl = hostlist_head; hl != NULL; hl = hl->next)
+    hosts_num++;
+
+  bool done[hosts_num];
+  memset(done, 0, sizeof(done));
+
+  size_t first = 0;
+  for (hostlist_t *first_hl = hostlist_head; first_hl != NULL;
+       first_hl = first_hl->next, first++) {
+    if (done[first])
+      continue;
+
+    double interval =
+        (first_hl->interval > 0.0) ? first_hl->interval : ping_interval;
+
+    /* Collect all hosts sharing this interval. */
+    hostlist_t *members[hosts_num];
+    size_t members_num = 0;
+    size_t idx = first;
+    for (hostlist_t *hl = first_hl; hl != NULL; hl = hl->next, idx++) {
+      double hl_interval = (hl->interval > 0.0) ? hl->interval : ping_interval;
+      if (done[idx] || (hl_interval != interval))
+        continue;
+      done[idx] = true;
+      members[members_num++] = hl;
+    }
+
+    size_t groups_num = (size_t)ping_threads;
+    if (groups_num > members_num)
+      groups_num = members_num;
+
+    double timeout = ping_timeout;
+    if (timeout > interval) {
+      timeout = 0.9 * interval;
+      WARNING("ping plugin: Timeout is greater than the interval of %gs. "
+              "Will use a timeout of %gs for those hosts.",
+              interval, timeout);
+    }
+
+    for (size_t g = 0; g < groups_num; g++) {
+      ping_group_t *group = calloc(1, sizeof(*group));
+      if (group == NULL) {
+        ERROR("ping plugin: calloc failed.");
+        return ENOMEM;
+      }
+      group->next = ping_groups;
+      ping_groups = group;
+
+      group->interval = interval;
+      group->timeout = timeout;
+      group->hosts = calloc(members_num / groups_num + 1,
+                            sizeof(*group->hosts));
+      if (group->hosts == NULL) {
+        ERROR("ping plugin: calloc failed.");
+        return ENOMEM;
+      }
+
+      for (size_t i = g; i < members_num; i += groups_num)
+        group->hosts[group->hosts_num++] = members[i];
+
+      qsort(group->hosts, group->hosts_num, sizeof(*group->hosts),
+            ping_host_compare);
+    }
+  }
+
+  return 0;
+} /* }}} int ping_groups_create */
+
+static int stop_thread(void);
+
 static int start_thread(void) /* {{{ */
 {
   int status;
@@ -359,13 +514,18 @@ static int start_thread(void) /* {{{ */
 
   ping_thread_loop = 1;
   ping_thread_error = 0;
-  status = plugin_thread_create(&ping_thread_id, /* attr = */ NULL, ping_thread,
-                                /* arg = */ (void *)0, "ping");
-  if (status != 0) {
-    ping_thread_loop = 0;
-    ERROR("ping plugin: Starting thread failed.");
-    pthread_mutex_unlock(&ping_lock);
-    return -1;
+
+  for (ping_group_t *group = ping_groups; group != NULL;
+       group = group->next) {
+    status = plugin_thread_create(&group->thread, /* attr = */ NULL,
+                                  ping_thread, /* arg = */ group, "ping");
+    if (status != 0) {
+      ERROR("ping plugin: Starting thread failed.");
+      pthread_mutex_unlock(&ping_lock);
+      stop_thread();
+      return -1;
+    }
+    group->thread_started = true;
   }
 
   pthread_mutex_unlock(&ping_lock);
@@ -374,7 +534,7 @@ static int start_thread(void) /* {{{ */
 
 static int stop_thread(void) /* {{{ */
 {
-  int status;
+  int status = 0;
 
   pthread_mutex_lock(&ping_lock);
 
@@ -387,14 +547,20 @@ static int stop_thread(void) /* {{{ */
   pthread_cond_broadcast(&ping_cond);
   pthread_mutex_unlock(&ping_lock);
 
-  status = pthread_join(ping_thread_id, /* return = */ NULL);
-  if (status != 0) {
-    ERROR("ping plugin: Stopping thread failed.");
-    status = -1;
+  for (ping_group_t *group = ping_groups; group != NULL;
+       group = group->next) {
+    if (!group->thread_started)
+      continue;
+
+    if (pthread_join(group->thread, /* return = */ NULL) != 0) {
+      ERROR("ping plugin: Stopping thread failed.");
+      status = -1;
+    }
+    memset(&group->thread, 0, sizeof(group->thread));
+    group->thread_started = false;
   }
 
   pthread_mutex_lock(&ping_lock);
-  memset(&ping_thread_id, 0, sizeof(ping_thread_id));
   ping_thread_error = 0;
   pthread_mutex_unlock(&ping_lock);
 
@@ -408,11 +574,21 @@ static int ping_init(void) /* {{{ */
     return -1;
   }
 
-  if (ping_timeout > ping_interval) {
-    ping_timeout = 0.9 * ping_interval;
-    WARNING("ping plugin: Timeout is greater than interval. "
-            "Will use a timeout of %gs.",
-            ping_timeout);
+  if (ping_percentile_num > 0) {
+    for (hostlist_t *hl = hostlist_head; hl != NULL; hl = hl->next) {
+      if (hl->latency != NULL)
+        continue;
+      hl->latency = latency_counter_create();
+      if (hl->latency == NULL) {
+        ERROR("ping plugin: latency_counter_create failed.");
+        return -1;
+      }
+    }
+  }
+
+  if ((ping_groups == NULL) && (ping_groups_create() != 0)) {
+    ping_groups_free();
+    return -1;
   }
 
 #if defined(HAVE_SYS_CAPABILITY_H) && defined(CAP_NET_RAW)
@@ -467,12 +643,33 @@ static int ping_config(const char *key, const char *value) /* {{{ */
       return 1;
     }
 
+    /* "Host <name> [<interval>]" */
+    double interval = 0.0;
+    char *interval_str = strchr(host, ' ');
+    if (interval_str != NULL) {
+      *interval_str = 0;
+      interval_str++;
+
+      char *endptr = NULL;
+      interval = strtod(interval_str, &endptr);
+      if ((endptr == interval_str) || !(interval > 0.0)) {
+        WARNING("ping plugin: Ignoring invalid interval \"%s\" for host %s.",
+                interval_str, host);
+        interval = 0.0;
+      }
+    }
+
     hl->host = host;
+    hl->interval = interval;
     hl->pkg_sent = 0;
     hl->pkg_recv = 0;
     hl->pkg_missed = 0;
     hl->latency_total = 0.0;
     hl->latency_squared = 0.0;
+    hl->latency_last = -1.0;
+    hl->jitter_total = 0.0;
+    hl->jitter_num = 0;
+    hl->latency = NULL;
     hl->next = hostlist_head;
     hostlist_head = hl;
   } else if (strcasecmp(key, "AddressFamily") == 0) {
@@ -558,6 +755,30 @@ static int ping_config(const char *key, const char *value) /* {{{ */
     ping_max_missed = atoi(value);
     if (ping_max_missed < 0)
       INFO("ping plugin: MaxMissed < 0, disabled re-resolving of hosts");
+  } else if (strcasecmp(key, "Threads") == 0) {
+    int tmp = atoi(value);
+    if (tmp > 0)
+      ping_threads = tmp;
+    else
+      WARNING("ping plugin: Ignoring invalid number of threads %i.", tmp);
+  } else if (strcasecmp(key, "Percentile") == 0) {
+    double percent = atof(value);
+    if (!(percent > 0.0) || (percent > 100.0)) {
+      WARNING("ping plugin: Ignoring invalid percentile %g.", percent);
+      return 0;
+    }
+
+    double *tmp = realloc(ping_percentile,
+                          sizeof(*ping_percentile) * (ping_percentile_num + 1));
+    if (tmp == NULL) {
+      ERROR("ping plugin: realloc failed.");
+      return 1;
+    }
+    ping_percentile = tmp;
+    ping_percentile[ping_percentile_num] = percent;
+    ping_percentile_num++;
+  } else if (strcasecmp(key, "ReportJitter") == 0) {
+    ping_report_jitter = IS_TRUE(value);
   } else {
     return -1;
   }
@@ -590,6 +811,11 @@ static int ping_read(void) /* {{{ */
       hl->pkg_recv = 0;
       hl->latency_total = 0.0;
       hl->latency_squared = 0.0;
+      hl->latency_last = -1.0;
+      hl->jitter_total = 0.0;
+      hl->jitter_num = 0;
+      if (hl->latency != NULL)
+        latency_counter_reset(hl->latency);
     }
 
     start_thread();
@@ -603,6 +829,9 @@ static int ping_read(void) /* {{{ */
     uint32_t pkg_recv;
     double latency_total;
     double latency_squared;
+    double jitter_total;
+    uint32_t jitter_num;
+    gauge_t percentiles[ping_percentile_num + 1];
 
     double latency_average;
     double latency_stddev;
@@ -617,11 +846,27 @@ static int ping_read(void) /* {{{ */
     pkg_recv = hl->pkg_recv;
     latency_total = hl->latency_total;
     latency_squared = hl->latency_squared;
+    jitter_total = hl->jitter_total;
+    jitter_num = hl->jitter_num;
+
+    for (size_t i = 0; i < ping_percentile_num; i++) {
+      /* latency_counter_t tracks seconds, ping values are in milliseconds. */
+      if (pkg_recv == 0)
+        percentiles[i] = NAN;
+      else
+        percentiles[i] = 1000.0 * CDTIME_T_TO_DOUBLE(
+                                      latency_counter_get_percentile(
+                                          hl->latency, ping_percentile[i]));
+    }
 
     hl->pkg_sent = 0;
     hl->pkg_recv = 0;
     hl->latency_total = 0.0;
     hl->latency_squared = 0.0;
+    hl->jitter_total = 0.0;
+    hl->jitter_num = 0;
+    if (hl->latency != NULL)
+      latency_counter_reset(hl->latency);
 
     pthread_mutex_unlock(&ping_lock);
 
@@ -653,6 +898,16 @@ static int ping_read(void) /* {{{ */
     submit(hl->host, "ping", latency_average);
     submit(hl->host, "ping_stddev", latency_stddev);
     submit(hl->host, "ping_droprate", droprate);
+
+    if (ping_report_jitter)
+      submit(hl->host, "ping_jitter",
+             (jitter_num == 0) ? NAN : jitter_total / ((double)jitter_num));
+
+    for (size_t i = 0; i < ping_percentile_num; i++) {
+      char name[DATA_MAX_NAME_LEN];
+      snprintf(name, sizeof(name), "%.50s-%.5g", hl->host, ping_percentile[i]);
+      submit(name, "ping", percentiles[i]);
+    }
   } /* }}} for (hl = hostlist_head; hl != NULL; hl = hl->next) */
 
   return 0;
@@ -673,11 +928,17 @@ static int ping_shutdown(void) /* {{{ */
     hl_next = hl->next;
 
     sfree(hl->host);
+    latency_counter_destroy(hl->latency);
     sfree(hl);
 
     hl = hl_next;
   }
 
+  hostlist_head = NULL;
+  ping_groups_free();
+  sfree(ping_percentile);
+  ping_percentile_num = 0;
+
   if (ping_data != NULL) {
     free(ping_data);
     ping_data = NULL;
@@ -52,6 +52,9 @@
 #define C_PSQL_DEFAULT_CONF PKGDATADIR "/postgresql_default.conf"
 #endif
 
+/* Number of result rows passed to udb_query_handle_results() at once. */
+#define C_PSQL_BATCH_ROWS 64
+
 /* Appends the (parameter, value) pair to the string
  * pointed to by 'buf' suitable to be used as argument
  * for PQconnectdb(). If value equals NULL, the pair
@@ -114,7 +117,15 @@ typedef struct {
 
   int max_params_num;
 
+  /* one flag per query telling whether the statement has been prepared on
+   * the current connection; reset if the backend PID changes */
+  bool *prepared;
+  int prepared_pid;
+
   /* user configuration */
+  bool prepare;
+  int connections;
+
   udb_query_preparation_area_t **q_prep_areas;
   udb_query_t **queries;
   size_t queries_num;
@@ -226,6 +237,12 @@ static c_psql_database_t *c_psql_database_new(const char *name) {
 
   db->max_params_num = 0;
 
+  db->prepared = NULL;
+  db->prepared_pid = 0;
+
+  db->prepare = false;
+  db->connections = 1;
+
   db->q_prep_areas = NULL;
   db->queries = NULL;
   db->queries_num = 0;
@@ -281,6 +298,8 @@ static void c_psql_database_delete(void *data) {
       udb_query_delete_preparation_area(db->q_prep_areas[i]);
   free(db->q_prep_areas);
 
+  sfree(db->prepared);
+
   sfree(db->queries);
   db->queries_num = 0;
 
@@ -398,18 +417,53 @@ static int c_psql_check_connection(c_psql_database_t *db) {
   return 0;
 } /* c_psql_check_connection */
 
+/* Executes the statement of the query with index `idx'. If prepared
+ * statements have been enabled, the statement is prepared on first use and
+ * whenever the connection has been re-established. */
+static PGresult *c_psql_exec_statement(c_psql_database_t *db, udb_query_t *q,
+                                       size_t idx, int params_num,
+                                       const char *const *params) {
+  const char *statement = udb_query_get_statement(q);
+  char name[32];
+
+  if (!db->prepare || (3 > db->proto_version)) {
+    if (params_num == 0)
+      return PQexec(db->conn, statement);
+    return PQexecParams(db->conn, statement, params_num, NULL, params, NULL,
+                        NULL, 0);
+  }
+
+  if (db->prepared_pid != PQbackendPID(db->conn)) {
+    memset(db->prepared, 0, db->queries_num * sizeof(*db->prepared));
+    db->prepared_pid = PQbackendPID(db->conn);
+  }
+
+  snprintf(name, sizeof(name), "collectd_%" PRIsz, idx);
+
+  if (!db->prepared[idx]) {
+    PGresult *res = PQprepare(db->conn, name, statement, params_num, NULL);
+    if (PGRES_COMMAND_OK != PQresultStatus(res))
+      return res;
+    PQclear(res);
+    db->prepared[idx] = true;
+  }
+
+  return PQexecPrepared(db->conn, name, params_num, params, NULL, NULL, 0);
+} /* c_psql_exec_statement */
+
 static PGresult *c_psql_exec_query_noparams(c_psql_database_t *db,
-                                            udb_query_t *q) {
-  return PQexec(db->conn, udb_query_get_statement(q));
+                                            udb_query_t *q, size_t idx) {
+  return c_psql_exec_statement(db, q, idx, 0, NULL);
 } /* c_psql_exec_query_noparams */
 
 static PGresult *c_psql_exec_query_params(c_psql_database_t *db, udb_query_t *q,
+                                          size_t idx,
                                           c_psql_user_data_t *data) {
   const char *params[db->max_params_num];
   char interval[64];
 
   if ((data == NULL) || (data->params_num == 0))
-    return c_psql_exec_query_noparams(db, q);
+    return c_psql_exec_query_noparams(db, q, idx);
 
   assert(db->max_params_num >= data->params_num);
 
@@ -438,13 +492,14 @@ static PGresult *c_psql_exec_query_params(c_psql_database_t *db, udb_query_t *q,
     }
   }
 
-  return PQexecParams(db->conn, udb_query_get_statement(q), data->params_num,
-                      NULL, (const char *const *)params, NULL, NULL, 0);
+  return c_psql_exec_statement(db, q, idx, data->params_num,
+                               (const char *const *)params);
 } /* c_psql_exec_query_params */
 
 /* db->db_lock must be locked when calling this function */
-static int c_psql_exec_query(c_psql_database_t *db, udb_query_t *q,
-                             udb_query_preparation_area_t *prep_area) {
+static int c_psql_exec_query(c_psql_database_t *db, size_t idx) {
+  udb_query_t *q = db->queries[idx];
+  udb_query_preparation_area_t *prep_area = db->q_prep_areas[idx];
   PGresult *res;
 
   c_psql_user_data_t *data;
@@ -456,6 +511,7 @@ static int c_psql_exec_query(c_psql_database_t *db, udb_query_t *q,
   int column_num;
 
   int rows_num;
+  size_t batch_num;
   int status;
 
   /* The user data may hold parameter information, but may be NULL. */
@@ -463,9 +519,9 @@ static int c_psql_exec_query(c_psql_database_t *db, udb_query_t *q,
 
   /* Versions up to `3' don't know how to handle parameters. */
   if (3 <= db->proto_version)
-    res = c_psql_exec_query_params(db, q, data);
+    res = c_psql_exec_query_params(db, q, idx, data);
   else if ((NULL == data) || (0 == data->params_num))
-    res = c_psql_exec_query_noparams(db, q);
+    res = c_psql_exec_query_noparams(db, q, idx);
   else {
     log_err("Connection to database \"%s\" (%s) does not support "
             "parameters (protocol version %d) - "
@@ -489,7 +545,7 @@ static int c_psql_exec_query(c_psql_database_t *db, udb_query_t *q,
     if ((CONNECTION_OK != PQstatus(db->conn)) &&
         (0 == c_psql_check_connection(db))) {
       PQclear(res);
-      return c_psql_exec_query(db, q, prep_area);
+      return c_psql_exec_query(db, idx);
     }
 
     log_err("Failed to execute SQL query: %s", PQerrorMessage(db->conn));
@@ -517,7 +573,8 @@ static int c_psql_exec_query(c_psql_database_t *db, udb_query_t *q,
     BAIL_OUT(-1);
   }
 
-  column_values = (char **)calloc(column_num, sizeof(char *));
+  column_values =
+      (char **)calloc(column_num * C_PSQL_BATCH_ROWS, sizeof(char *));
   if (NULL == column_values) {
     log_err("calloc failed.");
     BAIL_OUT(-1);
@@ -550,13 +607,18 @@ static int c_psql_exec_query(c_psql_database_t *db, udb_query_t *q,
     BAIL_OUT(-1);
   }
 
+  /* Rows are collected in `column_values' and handed to utils_db_query in
+   * batches of up to C_PSQL_BATCH_ROWS rows. */
+  batch_num = 0;
   for (int row = 0; row < rows_num; ++row) {
+    char **row_values = column_values + batch_num * column_num;
     int col;
+
     for (col = 0; col < column_num; ++col) {
       /* Pointers returned by `PQgetvalue' are freed by `PQclear' via
        * `BAIL_OUT'. */
-      column_values[col] = PQgetvalue(res, row, col);
-      if (NULL == column_values[col]) {
+      row_values[col] = PQgetvalue(res, row, col);
+      if (NULL == row_values[col]) {
         log_err("Failed to get value at (row = %i, col = %i).", row, col);
         break;
       }
@@ -566,12 +628,24 @@ static int c_psql_exec_query(c_psql_database_t *db, udb_query_t *q,
     if (col < column_num)
       continue;
 
-    status = udb_query_handle_result(q, prep_area, column_values);
+    ++batch_num;
+    if (batch_num < C_PSQL_BATCH_ROWS)
+      continue;
+
+    status = udb_query_handle_results(q, prep_area, column_values, batch_num);
     if (status != 0) {
-      log_err("udb_query_handle_result failed with status %i.", status);
+      log_err("udb_query_handle_results failed with status %i.", status);
     }
+    batch_num = 0;
   } /* for (row = 0; row < rows_num; ++row) */
 
+  if (batch_num > 0) {
+    status = udb_query_handle_results(q, prep_area, column_values, batch_num);
+    if (status != 0) {
+      log_err("udb_query_handle_results failed with status %i.", status);
+    }
+  }
+
   udb_query_finish_result(q, prep_area);
 
   BAIL_OUT(0);
@@ -602,17 +676,13 @@ static int c_psql_read(user_data_t *ud) {
   }
 
   for (size_t i = 0; i < db->queries_num; ++i) {
-    udb_query_preparation_area_t *prep_area;
-    udb_query_t *q;
-
-    prep_area = db->q_prep_areas[i];
-    q = db->queries[i];
+    udb_query_t *q = db->queries[i];
 
     if ((0 != db->server_version) &&
         (udb_query_check_version(q, db->server_version) <= 0))
       continue;
 
-    if (0 == c_psql_exec_query(db, q, prep_area))
+    if (0 == c_psql_exec_query(db, i))
       success = 1;
   }
 
@@ -1115,6 +1185,80 @@ static int c_psql_config_writer(oconfig_item_t *ci) {
   return 0;
 } /* c_psql_config_writer */
 
+/* Allocates the per-query state of a database object. */
+static int c_psql_database_init_queries(c_psql_database_t *db) {
+  if (db->queries_num == 0)
+    return 0;
+
+  db->q_prep_areas = (udb_query_preparation_area_t **)calloc(
+      db->queries_num, sizeof(*db->q_prep_areas));
+  db->prepared = calloc(db->queries_num, sizeof(*db->prepared));
+
+  if ((db->q_prep_areas == NULL) || (db->prepared == NULL)) {
+    log_err("Out of memory.");
+    return -1;
+  }
+
+  for (size_t i = 0; i < db->queries_num; ++i) {
+    c_psql_user_data_t *data;
+    data = udb_query_get_user_data(db->queries[i]);
+    if ((data != NULL) && (data->params_num > db->max_params_num))
+      db->max_params_num = data->params_num;
+
+    db->q_prep_areas[i] = udb_query_allocate_preparation_area(db->queries[i]);
+
+    if (db->q_prep_areas[i] == NULL) {
+      log_err("Out of memory.");
+      return -1;
+    }
+  }
+  return 0;
+} /* c_psql_database_init_queries */
+
+/* Creates a second connection to the same database and moves every n-th
+ * query of `src', starting with `first', over to it. */
+static c_psql_database_t *c_psql_database_clone(c_psql_database_t *src,
+                                                size_t first, size_t n) {
+  c_psql_database_t *db;
+
+  db = c_psql_database_new(src->database);
+  if (db == NULL)
+    return NULL;
+
+  sfree(db->instance);
+  db->instance = sstrdup(src->instance);
+  db->host = sstrdup(src->host);
+  db->port = sstrdup(src->port);
+  db->user = sstrdup(src->user);
+  db->password = sstrdup(src->password);
+  db->plugin_name = sstrdup(src->plugin_name);
+  db->sslmode = sstrdup(src->sslmode);
+  db->krbsrvname = sstrdup(src->krbsrvname);
+  db->service = sstrdup(src->service);
+  db->prepare = src->prepare;
+
+  db->queries = calloc((src->queries_num - first + n - 1) / n,
+                       sizeof(*db->queries));
+  if (db->queries == NULL) {
+    log_err("Out of memory.");
+    c_psql_database_delete(db);
+    return NULL;
+  }
+
+  for (size_t i = first; i < src->queries_num; i += n)
+    db->queries[db->queries_num++] = src->queries[i];
+
+  if (c_psql_database_init_queries(db) != 0) {
+    c_psql_database_delete(db);
+    return NULL;
+  }
+
+  for (size_t i = first; i < src->queries_num; i += n)
+    src->queries[i] = NULL;
+
+  return db;
+} /* c_psql_database_clone */
+
 static int c_psql_config_database(oconfig_item_t *ci) {
   c_psql_database_t *db;
 
@@ -1164,6 +1308,10 @@ static int c_psql_config_database(oconfig_item_t *ci) {
       cf_util_get_cdtime(c, &db->commit_interval);
     else if (strcasecmp("ExpireDelay", c->key) == 0)
       cf_util_get_cdtime(c, &db->expire_delay);
+    else if (strcasecmp("PreparedStatements", c->key) == 0)
+      cf_util_get_boolean(c, &db->prepare);
+    else if (strcasecmp("Connections", c->key) == 0)
+      cf_util_get_int(c, &db->connections);
     else
       log_warn("Ignoring unknown config key \"%s\".", c->key);
   }
@@ -1175,30 +1323,44 @@ static int c_psql_config_database(oconfig_item_t *ci) {
                                        &db->queries, &db->queries_num);
   }
 
-  if (db->queries_num > 0) {
-    db->q_prep_areas = (udb_query_preparation_area_t **)calloc(
-        db->queries_num, sizeof(*db->q_prep_areas));
-
-    if (db->q_prep_areas == NULL) {
-      log_err("Out of memory.");
-      c_psql_database_delete(db);
-      return -1;
-    }
-  }
+  /* Distribute the queries over `Connections' connections which are read
+   * by separate read callbacks and may thus run in parallel. Writers always
+   * use the first connection. */
+  if ((db->connections > 1) && (db->queries_num > 1)) {
+    size_t conns = (size_t)db->connections;
+    size_t queries_num = 0;
+
+    if (conns > db->queries_num)
+      conns = db->queries_num;
+
+    for (size_t k = 1; k < conns; ++k) {
+      c_psql_database_t *clone = c_psql_database_clone(db, k, conns);
+      if (clone == NULL) {
+        log_err("Database '%s': Failed to create connection #%" PRIsz ". "
+                "Its queries will use the first connection.",
+                db->database, k + 1);
+        continue;
+      }
 
-  for (int i = 0; (size_t)i < db->queries_num; ++i) {
-    c_psql_user_data_t *data;
-    data = udb_query_get_user_data(db->queries[i]);
-    if ((data != NULL) && (data->params_num > db->max_params_num))
-      db->max_params_num = data->params_num;
+      snprintf(cb_name, sizeof(cb_name), "postgresql-%s-%" PRIsz,
+               clone->instance, k);
 
-    db->q_prep_areas[i] = udb_query_allocate_preparation_area(db->queries[i]);
+      user_data_t ud = {.data = clone, .free_func = c_psql_database_delete};
 
-    if (db->q_prep_areas[i] == NULL) {
-      log_err("Out of memory.");
-      c_psql_database_delete(db);
-      return -1;
+      ++clone->ref_cnt;
+      plugin_register_complex_read("postgresql", cb_name, c_psql_read,
+                                   interval, &ud);
     }
+
+    for (size_t i = 0; i < db->queries_num; ++i)
+      if (db->queries[i] != NULL)
+        db->queries[queries_num++] = db->queries[i];
+    db->queries_num = queries_num;
+  }
+
+  if (c_psql_database_init_queries(db) != 0) {
+    c_psql_database_delete(db);
+    return -1;
   }
 
   snprintf(cb_name, sizeof(cb_name), "postgresql-%s", db->instance);
@@ -99,6 +99,15 @@
 #ifndef CONFIG_HZ
 #define CONFIG_HZ 100
 #endif
+#include "utils_avltree.h"
+#if HAVE_LINUX_CN_PROC_H
+#include <arpa/inet.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -212,6 +221,14 @@ typedef struct process_entry_s {
   bool has_fd;
 
   bool has_maps;
+
+#if KERNEL_LINUX
+  /* Descriptor of the /proc/<pid> directory, used to open the files below
+   * it with openat(2). */
+  int dirfd;
+  unsigned long long starttime;
+  bool has_status;
+#endif
 } process_entry_t;
 
 typedef struct procstat_entry_s {
@@ -312,6 +329,33 @@ static mach_msg_type_number_t pset_list_len;
 #elif KERNEL_LINUX
 static long pagesize_g;
 static void ps_fill_details(const procstat_t *ps, process_entry_t *entry);
+static DIR *proc_dir;
+/* Set if a "ProcessMatch" needs the command line of processes. */
+static bool want_cmdline;
+
+/* State of the IncrementalScan mode: processes seen during previous reads,
+ * keyed by PID, together with the groups they belong to. */
+typedef struct {
+  long pid;
+  unsigned long long starttime;
+  char name[PROCSTAT_NAME_LEN];
+  /* Number of the read in which the process has last been seen. */
+  uint64_t generation;
+  /* Set when the process may have executed a new program. */
+  bool stale;
+  procstat_t **matches;
+  size_t matches_num;
+} ps_cache_entry_t;
+
+static bool incremental_scan;
+static c_avl_tree_t *ps_cache;
+static uint64_t ps_cache_generation;
+static size_t list_num_g;
+static int ps_cache_compare(const void *a, const void *b);
+#if HAVE_LINUX_CN_PROC_H
+static int proc_events_fd = -1;
+static int ps_proc_events_open(void);
+#endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -370,6 +414,9 @@ static procstat_t *ps_list_register(const char *name, const char *regexp) {
   if (regexp != NULL) {
     DEBUG("ProcessMatch: adding \"%s\" as criteria to process %s.", regexp,
           name);
+#if KERNEL_LINUX
+    want_cmdline = true;
+#endif
     new->re = malloc(sizeof(*new->re));
     if (new->re == NULL) {
       ERROR("processes plugin: ps_list_register: malloc failed.");
@@ -506,89 +553,94 @@ static void ps_update_delay(procstat_t *out, procstat_entry_t *prev,
 }
 #endif
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add(const char *name, const char *cmdline,
-                        process_entry_t *entry) {
+/* add process entry to the 'instances' of group 'ps' (or refresh it) */
+static void ps_list_add_entry(procstat_t *ps, process_entry_t *entry) {
   procstat_entry_t *pse;
 
-  if (entry->id == 0)
-    return;
-
-  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
-    if ((ps_list_match(name, cmdline, ps)) == 0)
-      continue;
-
 #if KERNEL_LINUX
-    ps_fill_details(ps, entry);
+  ps_fill_details(ps, entry);
 #endif
 
-    for (pse = ps->instances; pse != NULL; pse = pse->next)
-      if ((pse->id == entry->id) || (pse->next == NULL))
-        break;
+  for (pse = ps->instances; pse != NULL; pse = pse->next)
+    if ((pse->id == entry->id) || (pse->next == NULL))
+      break;
 
-    if ((pse == NULL) || (pse->id != entry->id)) {
-      procstat_entry_t *new;
+  if ((pse == NULL) || (pse->id != entry->id)) {
+    procstat_entry_t *new;
 
-      new = calloc(1, sizeof(*new));
-      if (new == NULL)
-        return;
-      new->id = entry->id;
+    new = calloc(1, sizeof(*new));
+    if (new == NULL)
+      return;
+    new->id = entry->id;
 
-      if (pse == NULL)
-        ps->instances = new;
-      else
-        pse->next = new;
+    if (pse == NULL)
+      ps->instances = new;
+    else
+      pse->next = new;
 
-      pse = new;
-    }
+    pse = new;
+  }
 
-    pse->age = 0;
-
-    ps->num_proc += entry->num_proc;
-    ps->num_lwp += entry->num_lwp;
-    ps->num_fd += entry->num_fd;
-    ps->num_maps += entry->num_maps;
-    ps->vmem_size += entry->vmem_size;
-    ps->vmem_rss += entry->vmem_rss;
-    ps->vmem_data += entry->vmem_data;
-    ps->vmem_code += entry->vmem_code;
-    ps->stack_size += entry->stack_size;
-
-    if ((entry->io_rchar != -1) && (entry->io_wchar != -1)) {
-      ps_update_counter(&ps->io_rchar, &pse->io_rchar, entry->io_rchar);
-      ps_update_counter(&ps->io_wchar, &pse->io_wchar, entry->io_wchar);
-    }
+  pse->age = 0;
+
+  ps->num_proc += entry->num_proc;
+  ps->num_lwp += entry->num_lwp;
+  ps->num_fd += entry->num_fd;
+  ps->num_maps += entry->num_maps;
+  ps->vmem_size += entry->vmem_size;
+  ps->vmem_rss += entry->vmem_rss;
+  ps->vmem_data += entry->vmem_data;
+  ps->vmem_code += entry->vmem_code;
+  ps->stack_size += entry->stack_size;
+
+  if ((entry->io_rchar != -1) && (entry->io_wchar != -1)) {
+    ps_update_counter(&ps->io_rchar, &pse->io_rchar, entry->io_rchar);
+    ps_update_counter(&ps->io_wchar, &pse->io_wchar, entry->io_wchar);
+  }
 
-    if ((entry->io_syscr != -1) && (entry->io_syscw != -1)) {
-      ps_update_counter(&ps->io_syscr, &pse->io_syscr, entry->io_syscr);
-      ps_update_counter(&ps->io_syscw, &pse->io_syscw, entry->io_syscw);
-    }
+  if ((entry->io_syscr != -1) && (entry->io_syscw != -1)) {
+    ps_update_counter(&ps->io_syscr, &pse->io_syscr, entry->io_syscr);
+    ps_update_counter(&ps->io_syscw, &pse->io_syscw, entry->io_syscw);
+  }
 
-    if ((entry->io_diskr != -1) && (entry->io_diskw != -1)) {
-      ps_update_counter(&ps->io_diskr, &pse->io_diskr, entry->io_diskr);
-      ps_update_counter(&ps->io_diskw, &pse->io_diskw, entry->io_diskw);
-    }
+  if ((entry->io_diskr != -1) && (entry->io_diskw != -1)) {
+    ps_update_counter(&ps->io_diskr, &pse->io_diskr, entry->io_diskr);
+    ps_update_counter(&ps->io_diskw, &pse->io_diskw, entry->io_diskw);
+  }
 
-    if ((entry->cswitch_vol != -1) && (entry->cswitch_invol != -1)) {
-      ps_update_counter(&ps->cswitch_vol, &pse->cswitch_vol,
-                        entry->cswitch_vol);
-      ps_update_counter(&ps->cswitch_invol, &pse->cswitch_invol,
-                        entry->cswitch_invol);
-    }
+  if ((entry->cswitch_vol != -1) && (entry->cswitch_invol != -1)) {
+    ps_update_counter(&ps->cswitch_vol, &pse->cswitch_vol,
+                      entry->cswitch_vol);
+    ps_update_counter(&ps->cswitch_invol, &pse->cswitch_invol,
+                      entry->cswitch_invol);
+  }
 
-    ps_update_counter(&ps->vmem_minflt_counter, &pse->vmem_minflt_counter,
-                      entry->vmem_minflt_counter);
-    ps_update_counter(&ps->vmem_majflt_counter, &pse->vmem_majflt_counter,
-                      entry->vmem_majflt_counter);
+  ps_update_counter(&ps->vmem_minflt_counter, &pse->vmem_minflt_counter,
+                    entry->vmem_minflt_counter);
+  ps_update_counter(&ps->vmem_majflt_counter, &pse->vmem_majflt_counter,
+                    entry->vmem_majflt_counter);
 
-    ps_update_counter(&ps->cpu_user_counter, &pse->cpu_user_counter,
-                      entry->cpu_user_counter);
-    ps_update_counter(&ps->cpu_system_counter, &pse->cpu_system_counter,
-                      entry->cpu_system_counter);
+  ps_update_counter(&ps->cpu_user_counter, &pse->cpu_user_counter,
+                    entry->cpu_user_counter);
+  ps_update_counter(&ps->cpu_system_counter, &pse->cpu_system_counter,
+                    entry->cpu_system_counter);
 
 #if HAVE_LIBTASKSTATS
-    ps_update_delay(ps, pse, entry);
+  ps_update_delay(ps, pse, entry);
 #endif
+} /* void ps_list_add_entry */
+
+/* add process entry to all groups matching 'name' or 'cmdline' */
+static void ps_list_add(const char *name, const char *cmdline,
+                        process_entry_t *entry) {
+  if (entry->id == 0)
+    return;
+
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
+    if ((ps_list_match(name, cmdline, ps)) == 0)
+      continue;
+
+    ps_list_add_entry(ps, entry);
   }
 }
 
@@ -717,6 +769,13 @@ static int ps_config(oconfig_item_t *ci) {
       cf_util_get_boolean(c, &report_fd_num);
     } else if (strcasecmp(c->key, "CollectMemoryMaps") == 0) {
       cf_util_get_boolean(c, &report_maps_num);
+    } else if (strcasecmp(c->key, "IncrementalScan") == 0) {
+#if KERNEL_LINUX
+      cf_util_get_boolean(c, &incremental_scan);
+#else
+      WARNING("processes plugin: The \"IncrementalScan\" option is only "
+              "supported on Linux.");
+#endif
     } else if (strcasecmp(c->key, "CollectDelayAccounting") == 0) {
 #if HAVE_LIBTASKSTATS
       cf_util_get_boolean(c, &report_delay);
@@ -762,6 +821,30 @@ static int ps_init(void) {
   pagesize_g = sysconf(_SC_PAGESIZE);
   DEBUG("pagesize_g = %li; CONFIG_HZ = %i;", pagesize_g, CONFIG_HZ);
 
+  if (incremental_scan && (ps_cache == NULL)) {
+    ps_cache = c_avl_create(ps_cache_compare);
+    if (ps_cache == NULL) {
+      ERROR("processes plugin: c_avl_create failed.");
+      return -1;
+    }
+
+    list_num_g = 0;
+    for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next)
+      list_num_g++;
+
+#if HAVE_LINUX_CN_PROC_H
+    proc_events_fd = ps_proc_events_open();
+#endif
+    if (want_cmdline) {
+#if HAVE_LINUX_CN_PROC_H
+      if (proc_events_fd < 0)
+#endif
+        INFO("processes plugin: Process events are not available. Processes "
+             "executing a program with the same name are not re-matched "
+             "against \"ProcessMatch\" expressions.");
+    }
+  }
+
 #if HAVE_LIBTASKSTATS
   if (taskstats_handle == NULL) {
     taskstats_handle = ts_create();
@@ -968,54 +1051,115 @@ static void ps_submit_fork_rate(derive_t value) {
 
 /* ------- additional functions for KERNEL_LINUX/HAVE_THREAD_INFO ------- */
 #if KERNEL_LINUX
+/* Reads the file "name" below the directory "dirfd" into "buffer". The buffer
+ * is always null-terminated. Returns the number of bytes read or -1 on
+ * failure. */
+static ssize_t ps_read_file_at(int dirfd, const char *name, char *buffer,
+                               size_t buffer_size) {
+  size_t buffer_len = 0;
+  int fd;
+
+  fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  while (buffer_len < (buffer_size - 1)) {
+    ssize_t status =
+        read(fd, buffer + buffer_len, (buffer_size - 1) - buffer_len);
+    if (status < 0) {
+      if ((errno == EAGAIN) || (errno == EINTR))
+        continue;
+      close(fd);
+      return -1;
+    } else if (status == 0) {
+      break;
+    }
+    buffer_len += (size_t)status;
+  }
+
+  close(fd);
+  buffer[buffer_len] = 0;
+  return (ssize_t)buffer_len;
+} /* ssize_t ps_read_file_at */
+
+/* Opens the directory "name" below the directory "dirfd". */
+static DIR *ps_opendir_at(int dirfd, const char *name) {
+  int fd;
+  DIR *dh;
+
+  fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  dh = fdopendir(fd);
+  if (dh == NULL)
+    close(fd);
+  return dh;
+} /* DIR *ps_opendir_at */
+
 static int ps_read_tasks_status(process_entry_t *ps) {
-  char dirname[64];
   DIR *dh;
   char filename[64];
-  FILE *fh;
   struct dirent *ent;
   derive_t cswitch_vol = 0;
   derive_t cswitch_invol = 0;
-  char buffer[1024];
+  char buffer[4096];
   char *fields[8];
   int numfields;
 
-  snprintf(dirname, sizeof(dirname), "/proc/%li/task", ps->id);
+#if HAVE_LIBTASKSTATS
+  /* Taskstats reports the sum over all threads with a single request, which
+   * is a lot cheaper than reading one file per thread. */
+  if (incremental_scan && (taskstats_handle != NULL)) {
+    ts_cswitch_t cswitch = {0};
+    if (ts_cswitch_by_tgid(taskstats_handle, (uint32_t)ps->id, &cswitch) ==
+        0) {
+      ps->cswitch_vol = (derive_t)cswitch.voluntary;
+      ps->cswitch_invol = (derive_t)cswitch.involuntary;
+      return 0;
+    }
+  }
+#endif
 
-  if ((dh = opendir(dirname)) == NULL) {
-    DEBUG("Failed to open directory `%s'", dirname);
+  if ((dh = ps_opendir_at(ps->dirfd, "task")) == NULL) {
+    DEBUG("Failed to open directory `/proc/%li/task'", ps->id);
     return -1;
   }
 
   while ((ent = readdir(dh)) != NULL) {
     char *tpid;
+    char *saveptr = NULL;
 
     if (!isdigit((int)ent->d_name[0]))
       continue;
 
     tpid = ent->d_name;
 
-    int r = snprintf(filename, sizeof(filename), "/proc/%li/task/%s/status",
-                     ps->id, tpid);
+    int r = snprintf(filename, sizeof(filename), "%s/status", tpid);
     if ((size_t)r >= sizeof(filename)) {
       DEBUG("Filename too long: `%s'", filename);
       continue;
     }
 
-    if ((fh = fopen(filename, "r")) == NULL) {
-      DEBUG("Failed to open file `%s'", filename);
+    if (ps_read_file_at(dirfd(dh), filename, buffer, sizeof(buffer)) < 0) {
+      DEBUG("Failed to read file `/proc/%li/task/%s'", ps->id, filename);
       continue;
     }
 
-    while (fgets(buffer, sizeof(buffer), fh) != NULL) {
+    for (char *line = strtok_r(buffer, "\n", &saveptr); line != NULL;
+         line = strtok_r(NULL, "\n", &saveptr)) {
       derive_t tmp;
       char *endptr;
+      bool voluntary;
 
-      if (strncmp(buffer, "voluntary_ctxt_switches", 23) != 0 &&
-          strncmp(buffer, "nonvoluntary_ctxt_switches", 26) != 0)
+      if (strncmp(line, "voluntary_ctxt_switches", 23) == 0)
+        voluntary = true;
+      else if (strncmp(line, "nonvoluntary_ctxt_switches", 26) == 0)
+        voluntary = false;
+      else
         continue;
 
-      numfields = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
+      numfields = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
 
       if (numfields < 2)
         continue;
@@ -1024,17 +1168,13 @@ static int ps_read_tasks_status(process_entry_t *ps) {
       endptr = NULL;
       tmp = (derive_t)strtoll(fields[1], &endptr, /* base = */ 10);
       if ((errno == 0) && (endptr != fields[1])) {
-        if (strncmp(buffer, "voluntary_ctxt_switches", 23) == 0) {
+        if (voluntary) {
           cswitch_vol += tmp;
-        } else if (strncmp(buffer, "nonvoluntary_ctxt_switches", 26) == 0) {
+        } else {
           cswitch_invol += tmp;
         }
       }
-    } /* while (fgets) */
-
-    if (fclose(fh)) {
-      WARNING("processes: fclose: %s", STRERRNO);
-    }
+    } /* for (line) */
   }
   closedir(dh);
 
@@ -1045,10 +1185,9 @@ static int ps_read_tasks_status(process_entry_t *ps) {
 } /* int *ps_read_tasks_status */
 
 /* Read data from /proc/pid/status */
-static int ps_read_status(long pid, process_entry_t *ps) {
-  FILE *fh;
-  char buffer[1024];
-  char filename[64];
+static int ps_read_status(process_entry_t *ps) {
+  char buffer[4096];
+  char *saveptr = NULL;
   unsigned long lib = 0;
   unsigned long exe = 0;
   unsigned long data = 0;
@@ -1056,18 +1195,18 @@ static int ps_read_status(long pid, process_entry_t *ps) {
   char *fields[8];
   int numfields;
 
-  snprintf(filename, sizeof(filename), "/proc/%li/status", pid);
-  if ((fh = fopen(filename, "r")) == NULL)
+  if (ps_read_file_at(ps->dirfd, "status", buffer, sizeof(buffer)) < 0)
     return -1;
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
+  for (char *line = strtok_r(buffer, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
     unsigned long tmp;
     char *endptr;
 
-    if (strncmp(buffer, "Vm", 2) != 0 && strncmp(buffer, "Threads", 7) != 0)
+    if (strncmp(line, "Vm", 2) != 0 && strncmp(line, "Threads", 7) != 0)
       continue;
 
-    numfields = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
+    numfields = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
 
     if (numfields < 2)
       continue;
@@ -1076,21 +1215,17 @@ static int ps_read_status(long pid, process_entry_t *ps) {
     endptr = NULL;
     tmp = strtoul(fields[1], &endptr, /* base = */ 10);
     if ((errno == 0) && (endptr != fields[1])) {
-      if (strncmp(buffer, "VmData", 6) == 0) {
+      if (strncmp(fields[0], "VmData", 6) == 0) {
         data = tmp;
-      } else if (strncmp(buffer, "VmLib", 5) == 0) {
+      } else if (strncmp(fields[0], "VmLib", 5) == 0) {
         lib = tmp;
-      } else if (strncmp(buffer, "VmExe", 5) == 0) {
+      } else if (strncmp(fields[0], "VmExe", 5) == 0) {
         exe = tmp;
-      } else if (strncmp(buffer, "Threads", 7) == 0) {
+      } else if (strncmp(fields[0], "Threads", 7) == 0) {
         threads = tmp;
       }
     }
-  } /* while (fgets) */
-
-  if (fclose(fh)) {
-    WARNING("processes: fclose: %s", STRERRNO);
-  }
+  } /* for (line) */
 
   ps->vmem_data = data * 1024;
   ps->vmem_code = (exe + lib) * 1024;
@@ -1101,40 +1236,39 @@ static int ps_read_status(long pid, process_entry_t *ps) {
 } /* int *ps_read_status */
 
 static int ps_read_io(process_entry_t *ps) {
-  FILE *fh;
   char buffer[1024];
-  char filename[64];
+  char *saveptr = NULL;
 
   char *fields[8];
   int numfields;
 
-  snprintf(filename, sizeof(filename), "/proc/%li/io", ps->id);
-  if ((fh = fopen(filename, "r")) == NULL) {
-    DEBUG("ps_read_io: Failed to open file `%s'", filename);
+  if (ps_read_file_at(ps->dirfd, "io", buffer, sizeof(buffer)) < 0) {
+    DEBUG("ps_read_io: Failed to read file `/proc/%li/io'", ps->id);
     return -1;
   }
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
+  for (char *line = strtok_r(buffer, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
     derive_t *val = NULL;
     long long tmp;
     char *endptr;
 
-    if (strncasecmp(buffer, "rchar:", 6) == 0)
+    if (strncasecmp(line, "rchar:", 6) == 0)
       val = &(ps->io_rchar);
-    else if (strncasecmp(buffer, "wchar:", 6) == 0)
+    else if (strncasecmp(line, "wchar:", 6) == 0)
       val = &(ps->io_wchar);
-    else if (strncasecmp(buffer, "syscr:", 6) == 0)
+    else if (strncasecmp(line, "syscr:", 6) == 0)
       val = &(ps->io_syscr);
-    else if (strncasecmp(buffer, "syscw:", 6) == 0)
+    else if (strncasecmp(line, "syscw:", 6) == 0)
       val = &(ps->io_syscw);
-    else if (strncasecmp(buffer, "read_bytes:", 11) == 0)
+    else if (strncasecmp(line, "read_bytes:", 11) == 0)
       val = &(ps->io_diskr);
-    else if (strncasecmp(buffer, "write_bytes:", 12) == 0)
+    else if (strncasecmp(line, "write_bytes:", 12) == 0)
       val = &(ps->io_diskw);
     else
       continue;
 
-    numfields = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
+    numfields = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
 
     if (numfields < 2)
       continue;
@@ -1146,48 +1280,49 @@ static int ps_read_io(process_entry_t *ps) {
       *val = -1;
     else
       *val = (derive_t)tmp;
-  } /* while (fgets) */
+  } /* for (line) */
 
-  if (fclose(fh)) {
-    WARNING("processes: fclose: %s", STRERRNO);
-  }
   return 0;
 } /* int ps_read_io (...) */
 
-static int ps_count_maps(pid_t pid) {
-  FILE *fh;
-  char buffer[1024];
-  char filename[64];
+static int ps_count_maps(process_entry_t *ps) {
+  char buffer[4096];
   int count = 0;
+  int fd;
 
-  snprintf(filename, sizeof(filename), "/proc/%d/maps", pid);
-  if ((fh = fopen(filename, "r")) == NULL) {
-    DEBUG("ps_count_maps: Failed to open file `%s'", filename);
+  fd = openat(ps->dirfd, "maps", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    DEBUG("ps_count_maps: Failed to open file `/proc/%li/maps'", ps->id);
     return -1;
   }
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
-    if (strchr(buffer, '\n')) {
-      count++;
+  while (42) {
+    ssize_t status = read(fd, buffer, sizeof(buffer));
+    if (status < 0) {
+      if ((errno == EAGAIN) || (errno == EINTR))
+        continue;
+      break;
+    } else if (status == 0) {
+      break;
     }
-  } /* while (fgets) */
 
-  if (fclose(fh)) {
-    WARNING("processes: fclose: %s", STRERRNO);
+    for (char *ptr = buffer;
+         (ptr = memchr(ptr, '\n', (size_t)(buffer + status - ptr))) != NULL;
+         ptr++)
+      count++;
   }
+
+  close(fd);
   return count;
 } /* int ps_count_maps (...) */
 
-static int ps_count_fd(int pid) {
-  char dirname[64];
+static int ps_count_fd(process_entry_t *ps) {
   DIR *dh;
   struct dirent *ent;
   int count = 0;
 
-  snprintf(dirname, sizeof(dirname), "/proc/%i/fd", pid);
-
-  if ((dh = opendir(dirname)) == NULL) {
-    DEBUG("Failed to open directory `%s'", dirname);
+  if ((dh = ps_opendir_at(ps->dirfd, "fd")) == NULL) {
+    DEBUG("Failed to open directory `/proc/%li/fd'", ps->id);
     return -1;
   }
   while ((ent = readdir(dh)) != NULL) {
@@ -1253,6 +1388,17 @@ static int ps_delay(process_entry_t *ps) {
 #endif
 
 static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
+  /* /proc/<pid>/status is only read for processes belonging to a group. */
+  if (entry->has_status == false) {
+    if ((entry->num_proc > 0) && (ps_read_status(entry) != 0)) {
+      /* No VMem data */
+      entry->vmem_data = -1;
+      entry->vmem_code = -1;
+      DEBUG("ps_fill_details: did not get vmem data for pid %lu", entry->id);
+    }
+    entry->has_status = true;
+  }
+
   if (entry->has_io == false) {
     ps_read_io(entry);
     entry->has_io = true;
@@ -1267,7 +1413,7 @@ static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
 
   if (ps->report_maps_num) {
     int num_maps;
-    if (entry->has_maps == false && (num_maps = ps_count_maps(entry->id)) > 0) {
+    if (entry->has_maps == false && (num_maps = ps_count_maps(entry)) > 0) {
       entry->num_maps = num_maps;
     }
     entry->has_maps = true;
@@ -1275,7 +1421,7 @@ static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
 
   if (ps->report_fd_num) {
     int num_fd;
-    if (entry->has_fd == false && (num_fd = ps_count_fd(entry->id)) > 0) {
+    if (entry->has_fd == false && (num_fd = ps_count_fd(entry)) > 0) {
       entry->num_fd = num_fd;
     }
     entry->has_fd = true;
@@ -1290,9 +1436,10 @@ static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
 #endif
 } /* void ps_fill_details (...) */
 
-/* ps_read_process reads process counters on Linux. */
+/* ps_read_process reads process counters on Linux. The process directory
+ * must have been opened as ps->dirfd. */
 static int ps_read_process(long pid, process_entry_t *ps, char *state) {
-  char filename[64];
+  const char *filename = "stat";
   char buffer[1024];
 
   char *fields[64];
@@ -1313,13 +1460,10 @@ static int ps_read_process(long pid, process_entry_t *ps, char *state) {
 
   ssize_t status;
 
-  snprintf(filename, sizeof(filename), "/proc/%li/stat", pid);
-
-  status = read_file_contents(filename, buffer, sizeof(buffer) - 1);
+  status = ps_read_file_at(ps->dirfd, filename, buffer, sizeof(buffer));
   if (status <= 0)
     return -1;
   buffer_len = (size_t)status;
-  buffer[buffer_len] = 0;
 
   /* The name of the process is enclosed in parens. Since the name can
    * contain parens itself, spaces, numbers and pretty much everything
@@ -1362,18 +1506,13 @@ static int ps_read_process(long pid, process_entry_t *ps, char *state) {
   }
 
   *state = fields[0][0];
+  ps->starttime = strtoull(fields[19], /* endptr = */ NULL, /* base = */ 10);
 
   if (*state == 'Z') {
     ps->num_lwp = 0;
     ps->num_proc = 0;
   } else {
     ps->num_lwp = strtoul(fields[17], /* endptr = */ NULL, /* base = */ 10);
-    if ((ps_read_status(pid, ps)) != 0) {
-      /* No VMem data */
-      ps->vmem_data = -1;
-      ps->vmem_code = -1;
-      DEBUG("ps_read_process: did not get vmem data for pid %li", pid);
-    }
     if (ps->num_lwp == 0)
       ps->num_lwp = 1;
     ps->num_proc = 1;
@@ -1428,11 +1567,12 @@ static int ps_read_process(long pid, process_entry_t *ps, char *state) {
   return 0;
 } /* int ps_read_process (...) */
 
-static char *ps_get_cmdline(long pid, char *name, char *buf, size_t buf_len) {
+static char *ps_get_cmdline(long pid, int dirfd, char *name, char *buf,
+                            size_t buf_len) {
   char *buf_ptr;
   size_t len;
 
-  char file[PATH_MAX];
+  char file[64];
   int fd;
 
   size_t n;
@@ -1443,7 +1583,7 @@ static char *ps_get_cmdline(long pid, char *name, char *buf, size_t buf_len) {
   snprintf(file, sizeof(file), "/proc/%li/cmdline", pid);
 
   errno = 0;
-  fd = open(file, O_RDONLY);
+  fd = openat(dirfd, "cmdline", O_RDONLY | O_CLOEXEC);
   if (fd < 0) {
     /* ENOENT means the process exited while we were handling it.
      * Don't complain about this, it only fills the logs. */
@@ -1518,6 +1658,244 @@ static char *ps_get_cmdline(long pid, char *name, char *buf, size_t buf_len) {
   return buf;
 } /* char *ps_get_cmdline (...) */
 
+static int ps_cache_compare(const void *a, const void *b) {
+  long pid_a = *(const long *)a;
+  long pid_b = *(const long *)b;
+
+  return (pid_a > pid_b) - (pid_a < pid_b);
+} /* int ps_cache_compare */
+
+static void ps_cache_entry_free(ps_cache_entry_t *ce) {
+  if (ce == NULL)
+    return;
+
+  sfree(ce->matches);
+  sfree(ce);
+} /* void ps_cache_entry_free */
+
+/* ps_cache_get returns the cache entry of the process "pse". The groups the
+ * process belongs to are only determined if the process is new or may have
+ * executed another program since the last read, i.e. the command line is
+ * not read for every process during every read. */
+static ps_cache_entry_t *ps_cache_get(process_entry_t *pse) {
+  long pid = (long)pse->id;
+  ps_cache_entry_t *ce = NULL;
+
+  if (c_avl_get(ps_cache, &pid, (void *)&ce) != 0) {
+    ce = calloc(1, sizeof(*ce));
+    if (ce == NULL) {
+      ERROR("processes plugin: calloc failed.");
+      return NULL;
+    }
+
+    ce->matches =
+        calloc((list_num_g > 0) ? list_num_g : 1, sizeof(*ce->matches));
+    if (ce->matches == NULL) {
+      ERROR("processes plugin: calloc failed.");
+      sfree(ce);
+      return NULL;
+    }
+
+    ce->pid = pid;
+    ce->stale = true;
+
+    if (c_avl_insert(ps_cache, &ce->pid, ce) != 0) {
+      ERROR("processes plugin: c_avl_insert failed.");
+      ps_cache_entry_free(ce);
+      return NULL;
+    }
+  }
+
+  /* The PID has been reused or the process executed another program. */
+  if ((ce->starttime != pse->starttime) || (strcmp(ce->name, pse->name) != 0))
+    ce->stale = true;
+
+  if (ce->stale) {
+    char buffer[CMDLINE_BUFFER_SIZE];
+    char *cmdline = NULL;
+
+    if (want_cmdline)
+      cmdline =
+          ps_get_cmdline(pid, pse->dirfd, pse->name, buffer, sizeof(buffer));
+
+    ce->matches_num = 0;
+    for (procstat_t *ps = list_head_g;
+         (ps != NULL) && (ce->matches_num < list_num_g); ps = ps->next)
+      if (ps_list_match(pse->name, cmdline, ps))
+        ce->matches[ce->matches_num++] = ps;
+
+    ce->starttime = pse->starttime;
+    sstrncpy(ce->name, pse->name, sizeof(ce->name));
+    ce->stale = false;
+  }
+
+  ce->generation = ps_cache_generation;
+  return ce;
+} /* ps_cache_entry_t *ps_cache_get */
+
+/* Removes the processes which have not been seen during the current read. */
+static void ps_cache_sweep(void) {
+  c_avl_iterator_t *iter;
+  long *pid;
+  ps_cache_entry_t *ce;
+  ps_cache_entry_t **gone = NULL;
+  size_t gone_num = 0;
+  size_t gone_size = 0;
+
+  iter = c_avl_get_iterator(ps_cache);
+  while (c_avl_iterator_next(iter, (void *)&pid, (void *)&ce) == 0) {
+    if (ce->generation == ps_cache_generation)
+      continue;
+
+    if (gone_num >= gone_size) {
+      size_t new_size = (gone_size > 0) ? 2 * gone_size : 64;
+      ps_cache_entry_t **tmp = realloc(gone, new_size * sizeof(*gone));
+      if (tmp == NULL) {
+        ERROR("processes plugin: realloc failed.");
+        break;
+      }
+      gone = tmp;
+      gone_size = new_size;
+    }
+    gone[gone_num++] = ce;
+  }
+  c_avl_iterator_destroy(iter);
+
+  for (size_t i = 0; i < gone_num; i++) {
+    c_avl_remove(ps_cache, &gone[i]->pid, NULL, NULL);
+    ps_cache_entry_free(gone[i]);
+  }
+  sfree(gone);
+} /* void ps_cache_sweep */
+
+#if HAVE_LINUX_CN_PROC_H
+static void ps_cache_mark_stale(void) {
+  c_avl_iterator_t *iter = c_avl_get_iterator(ps_cache);
+  long *pid;
+  ps_cache_entry_t *ce;
+
+  while (c_avl_iterator_next(iter, (void *)&pid, (void *)&ce) == 0)
+    ce->stale = true;
+  c_avl_iterator_destroy(iter);
+} /* void ps_cache_mark_stale */
+
+/* ps_proc_events_open subscribes to the process events connector of the
+ * kernel, which requires the CAP_NET_ADMIN capability. A socket filter drops
+ * all events but "exec" and "comm", which are the only ones that can change
+ * the group a process belongs to. Returns a non-blocking socket or -1. */
+static int ps_proc_events_open(void) {
+  struct sockaddr_nl addr = {
+      .nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC, .nl_pid = 0,
+  };
+  struct sock_filter filter[] = {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+               NLMSG_LENGTH(0) + offsetof(struct cn_msg, data) +
+                   offsetof(struct proc_event, what)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(PROC_EVENT_EXEC), 2, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(PROC_EVENT_COMM), 1, 0),
+      BPF_STMT(BPF_RET | BPF_K, 0),
+      BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+  };
+  struct sock_fprog fprog = {
+      .len = STATIC_ARRAY_SIZE(filter), .filter = filter,
+  };
+  char buffer[NLMSG_SPACE(sizeof(struct cn_msg) +
+                          sizeof(enum proc_cn_mcast_op))]
+      __attribute__((aligned(NLMSG_ALIGNTO))) = {0};
+  struct nlmsghdr *nlh = (void *)buffer;
+  struct cn_msg *cn = NLMSG_DATA(nlh);
+  enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+  int fd;
+
+  fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+              NETLINK_CONNECTOR);
+  if (fd < 0) {
+    INFO("processes plugin: Opening the process events connector failed: %s",
+         STRERRNO);
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    INFO("processes plugin: Subscribing to process events failed: %s",
+         STRERRNO);
+    close(fd);
+    return -1;
+  }
+
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) !=
+      0)
+    WARNING("processes plugin: Attaching the process events filter failed: "
+            "%s",
+            STRERRNO);
+
+  nlh->nlmsg_len =
+      NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+  nlh->nlmsg_type = NLMSG_DONE;
+  cn->id.idx = CN_IDX_PROC;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof(enum proc_cn_mcast_op);
+  memcpy(cn->data, &op, sizeof(op));
+
+  if (send(fd, nlh, nlh->nlmsg_len, 0) < 0) {
+    INFO("processes plugin: Subscribing to process events failed: %s",
+         STRERRNO);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+} /* int ps_proc_events_open */
+
+/* Reads the pending process events and marks the processes which executed a
+ * new program or changed their name, so that their groups are determined
+ * again during this read. */
+static void ps_proc_events_drain(void) {
+  char buffer[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+  while (42) {
+    ssize_t status = recv(proc_events_fd, buffer, sizeof(buffer), 0);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS) {
+        /* Events have been lost. Determine the groups of all processes. */
+        DEBUG("processes plugin: Process events have been lost.");
+        ps_cache_mark_stale();
+        continue;
+      }
+      break;
+    }
+
+    int len = (int)status;
+    for (struct nlmsghdr *nlh = (void *)buffer; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      struct cn_msg *cn;
+      struct proc_event *ev;
+      ps_cache_entry_t *ce;
+      long pid;
+
+      if ((nlh->nlmsg_type == NLMSG_ERROR) || (nlh->nlmsg_type == NLMSG_NOOP))
+        continue;
+
+      cn = NLMSG_DATA(nlh);
+      if ((cn->id.idx != CN_IDX_PROC) || (cn->id.val != CN_VAL_PROC))
+        continue;
+
+      ev = (void *)cn->data;
+      if (ev->what == PROC_EVENT_EXEC)
+        pid = (long)ev->event_data.exec.process_tgid;
+      else if (ev->what == PROC_EVENT_COMM)
+        pid = (long)ev->event_data.comm.process_tgid;
+      else
+        continue;
+
+      if (c_avl_get(ps_cache, &pid, (void *)&ce) == 0)
+        ce->stale = true;
+    }
+  }
+} /* void ps_proc_events_drain */
+#endif /* HAVE_LINUX_CN_PROC_H */
+
 static int read_fork_rate(void) {
   FILE *proc_stat;
   char buffer[1024];
@@ -2024,7 +2402,6 @@ static int ps_read(void) {
   int blocked = 0;
 
   struct dirent *ent;
-  DIR *proc;
   long pid;
 
   char cmdline[CMDLINE_BUFFER_SIZE];
@@ -2036,12 +2413,25 @@ static int ps_read(void) {
   running = sleeping = zombies = stopped = paging = blocked = 0;
   ps_list_reset();
 
-  if ((proc = opendir("/proc")) == NULL) {
-    ERROR("Cannot open `/proc': %s", STRERRNO);
-    return -1;
+  /* The /proc directory is kept open between reads. */
+  if (proc_dir == NULL) {
+    if ((proc_dir = opendir("/proc")) == NULL) {
+      ERROR("Cannot open `/proc': %s", STRERRNO);
+      return -1;
+    }
+  } else {
+    rewinddir(proc_dir);
   }
 
-  while ((ent = readdir(proc)) != NULL) {
+  if (incremental_scan) {
+#if HAVE_LINUX_CN_PROC_H
+    if (proc_events_fd >= 0)
+      ps_proc_events_drain();
+#endif
+    ps_cache_generation++;
+  }
+
+  while ((ent = readdir(proc_dir)) != NULL) {
     if (!isdigit(ent->d_name[0]))
       continue;
 
@@ -2051,9 +2441,17 @@ static int ps_read(void) {
     memset(&pse, 0, sizeof(pse));
     pse.id = pid;
 
+    pse.dirfd = openat(dirfd(proc_dir), ent->d_name,
+                       O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (pse.dirfd < 0) {
+      /* The process exited in the meantime. */
+      continue;
+    }
+
     status = ps_read_process(pid, &pse, &state);
     if (status != 0) {
       DEBUG("ps_read_process failed: %i", status);
+      close(pse.dirfd);
       continue;
     }
 
@@ -2078,11 +2476,23 @@ static int ps_read(void) {
       break;
     }
 
-    ps_list_add(pse.name,
-                ps_get_cmdline(pid, pse.name, cmdline, sizeof(cmdline)), &pse);
+    if (incremental_scan) {
+      ps_cache_entry_t *ce = ps_cache_get(&pse);
+      for (size_t i = 0; (ce != NULL) && (i < ce->matches_num); i++)
+        ps_list_add_entry(ce->matches[i], &pse);
+    } else {
+      ps_list_add(pse.name,
+                  want_cmdline ? ps_get_cmdline(pid, pse.dirfd, pse.name,
+                                                cmdline, sizeof(cmdline))
+                               : NULL,
+                  &pse);
+    }
+
+    close(pse.dirfd);
   }
 
-  closedir(proc);
+  if (incremental_scan)
+    ps_cache_sweep();
 
   ps_submit_state("running", running);
   ps_submit_state("sleeping", sleeping);
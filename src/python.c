@@ -42,6 +42,16 @@ typedef struct cpy_callback_s {
   struct cpy_callback_s *next;
 } cpy_callback_t;
 
+/* A write callback registered with register_write_batch(). */
+typedef struct {
+  cpy_callback_t cb; /* Must be the first member, see cpy_destroy_batch(). */
+  /* Values objects the callback didn't keep a reference to. These are reused
+   * by later batches. Protected by the GIL. */
+  Values **pool;
+  size_t pool_num;
+  size_t pool_size;
+} cpy_batch_t;
+
 static char log_doc[] = "This function sends a string to all logging plugins.";
 
 static char get_ds_doc[] =
@@ -172,6 +182,27 @@ static char reg_write_doc[] =
     "data: The optional data parameter passed to the register function.\n"
     "    If the parameter was omitted it will be omitted here, too.";
 
+static char reg_write_batch_doc[] =
+    "register_write_batch(callback[, data][, name]) -> identifier\n"
+    "\n"
+    "Register a callback function to receive values dispatched by other "
+    "plugins in batches.\n"
+    "'callback' is a callable object that will be called with all values a\n"
+    "    write thread took from the write queue at once (see the global\n"
+    "    WriteBatchSize option).\n"
+    "'data' is an optional object that will be passed back to the callback\n"
+    "    function every time it is called.\n"
+    "'name' is an optional identifier for this callback. The default name\n"
+    "    is 'python.<module>'.\n"
+    "'identifier' is the full identifier assigned to this callback.\n"
+    "\n"
+    "The callback function will be called with one or two parameters:\n"
+    "values: A list of Values objects which are copies of the dispatched\n"
+    "    values. Values objects the callback doesn't hold on to are reused\n"
+    "    for later batches.\n"
+    "data: The optional data parameter passed to the register function.\n"
+    "    If the parameter was omitted it will be omitted here, too.";
+
 static char reg_notification_doc[] =
     "register_notification(callback[, data][, name]) -> identifier\n"
     "\n"
@@ -398,18 +429,18 @@ static int cpy_read_callback(user_data_t *data) {
   return 0;
 }
 
-static int cpy_write_callback(const data_set_t *ds,
-                              const value_list_t *value_list,
-                              user_data_t *data) {
-  cpy_callback_t *c = data->data;
-  PyObject *ret, *list, *temp, *dict = NULL;
-  Values *v;
+/* Converts a value list into a Values object. If "v" is not NULL, it is
+ * reused instead of allocating a new object. Returns a new reference, or NULL
+ * after logging the exception. You must hold the GIL to call this function. */
+static Values *cpy_values_from_value_list(Values *v, const data_set_t *ds,
+                                          const value_list_t *value_list) {
+  PyObject *list, *temp, *dict = NULL;
 
-  CPY_LOCK_THREADS
   list = PyList_New(value_list->values_len); /* New reference. */
   if (list == NULL) {
     cpy_log_exception("write callback");
-    CPY_RETURN_FROM_THREADS 0;
+    Py_XDECREF(v);
+    return NULL;
   }
   for (size_t i = 0; i < value_list->values_len; ++i) {
     if (ds->ds[i].type == DS_TYPE_COUNTER) {
@@ -428,12 +459,14 @@ static int cpy_write_callback(const data_set_t *ds,
       ERROR("cpy_write_callback: Unknown value type %d.", ds->ds[i].type);
       Py_END_ALLOW_THREADS;
       Py_DECREF(list);
-      CPY_RETURN_FROM_THREADS 0;
+      Py_XDECREF(v);
+      return NULL;
     }
     if (PyErr_Occurred() != NULL) {
       cpy_log_exception("value building for write callback");
       Py_DECREF(list);
-      CPY_RETURN_FROM_THREADS 0;
+      Py_XDECREF(v);
+      return NULL;
     }
   }
   dict = PyDict_New(); /* New reference. */
@@ -494,7 +527,15 @@ static int cpy_write_callback(const data_set_t *ds,
     }
     free(table);
   }
-  v = (Values *)Values_New(); /* New reference. */
+  if (v == NULL) {
+    v = (Values *)Values_New(); /* New reference. */
+    if (v == NULL) {
+      cpy_log_exception("write callback");
+      Py_DECREF(list);
+      Py_XDECREF(dict);
+      return NULL;
+    }
+  }
   sstrncpy(v->data.host, value_list->host, sizeof(v->data.host));
   sstrncpy(v->data.type, value_list->type, sizeof(v->data.type));
   sstrncpy(v->data.type_instance, value_list->type_instance,
@@ -508,6 +549,21 @@ static int cpy_write_callback(const data_set_t *ds,
   v->values = list;
   Py_CLEAR(v->meta);
   v->meta = dict; /* Steals a reference. */
+  return v;
+} /* Values *cpy_values_from_value_list */
+
+static int cpy_write_callback(const data_set_t *ds,
+                              const value_list_t *value_list,
+                              user_data_t *data) {
+  cpy_callback_t *c = data->data;
+  PyObject *ret;
+  Values *v;
+
+  CPY_LOCK_THREADS
+  v = cpy_values_from_value_list(NULL, ds, value_list); /* New reference. */
+  if (v == NULL) {
+    CPY_RETURN_FROM_THREADS 0;
+  }
   ret = PyObject_CallFunctionObjArgs(c->callback, v, c->data,
                                      (void *)0); /* New reference. */
   Py_XDECREF(v);
@@ -520,6 +576,76 @@ static int cpy_write_callback(const data_set_t *ds,
   return 0;
 }
 
+static int cpy_write_batch_callback(const plugin_write_entry_t *entries,
+                                    size_t entries_num, user_data_t *data) {
+  cpy_batch_t *b = data->data;
+  PyObject *list, *ret;
+
+  CPY_LOCK_THREADS
+  list = PyList_New(entries_num); /* New reference. */
+  if (list == NULL) {
+    cpy_log_exception("write batch callback");
+    CPY_RETURN_FROM_THREADS 0;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < entries_num; i++) {
+    Values *v = (b->pool_num > 0) ? b->pool[--b->pool_num] : NULL;
+
+    v = cpy_values_from_value_list(v, entries[i].ds, entries[i].vl);
+    if (v != NULL)
+      PyList_SET_ITEM(list, n++, (PyObject *)v); /* Steals a reference. */
+  }
+  if (n < entries_num)
+    PyList_SetSlice(list, n, entries_num, NULL);
+
+  ret = PyObject_CallFunctionObjArgs(b->cb.callback, list, b->cb.data,
+                                     (void *)0); /* New reference. */
+  if (ret == NULL) {
+    cpy_log_exception("write batch callback");
+  } else {
+    Py_DECREF(ret);
+  }
+
+  if (b->pool_size < n) {
+    Values **tmp = realloc(b->pool, n * sizeof(*b->pool));
+    if (tmp != NULL) {
+      b->pool = tmp;
+      b->pool_size = n;
+    }
+  }
+
+  /* If neither the list nor an object in it has been kept by the callback,
+   * the objects can be refilled for the next batch. */
+  if (Py_REFCNT(list) == 1) {
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(list); i++) {
+      PyObject *v = PyList_GET_ITEM(list, i);
+
+      if ((b->pool_num >= b->pool_size) || (Py_REFCNT(v) != 1) ||
+          (Py_TYPE(v) != &ValuesType))
+        continue;
+      Py_INCREF(v);
+      b->pool[b->pool_num++] = (Values *)v;
+    }
+  }
+  Py_DECREF(list);
+  CPY_RELEASE_THREADS
+  return 0;
+} /* int cpy_write_batch_callback */
+
+static void cpy_destroy_batch(void *data) {
+  cpy_batch_t *b = data;
+
+  CPY_LOCK_THREADS
+  while (b->pool_num > 0)
+    Py_DECREF(b->pool[--b->pool_num]);
+  CPY_RELEASE_THREADS
+  sfree(b->pool);
+
+  /* Releases the Python objects and "b" itself. */
+  cpy_destroy_user_data(&b->cb);
+} /* void cpy_destroy_batch */
+
 static int cpy_notification_callback(const notification_t *notification,
                                      user_data_t *data) {
   cpy_callback_t *c = data->data;
@@ -835,6 +961,48 @@ static PyObject *cpy_register_write(PyObject *self, PyObject *args,
                                        (void *)cpy_write_callback, args, kwds);
 }
 
+static PyObject *cpy_register_write_batch(PyObject *self, PyObject *args,
+                                          PyObject *kwds) {
+  char buf[512];
+  cpy_batch_t *b = NULL;
+  char *name = NULL;
+  PyObject *callback = NULL, *data = NULL;
+  static char *kwlist[] = {"callback", "data", "name", NULL};
+
+  if (PyArg_ParseTupleAndKeywords(args, kwds, "O|Oet", kwlist, &callback, &data,
+                                  NULL, &name) == 0)
+    return NULL;
+  if (PyCallable_Check(callback) == 0) {
+    PyMem_Free(name);
+    PyErr_SetString(PyExc_TypeError, "callback needs a be a callable object.");
+    return NULL;
+  }
+  cpy_build_name(buf, sizeof(buf), callback, name);
+  PyMem_Free(name);
+
+  b = calloc(1, sizeof(*b));
+  if (b == NULL)
+    return PyErr_NoMemory();
+  b->cb.name = strdup(buf);
+  if (b->cb.name == NULL) {
+    free(b);
+    return PyErr_NoMemory();
+  }
+
+  Py_INCREF(callback);
+  Py_XINCREF(data);
+  b->cb.callback = callback;
+  b->cb.data = data;
+
+  plugin_register_write_batch(buf, cpy_write_batch_callback,
+                              &(user_data_t){
+                                  .data = b, .free_func = cpy_destroy_batch,
+                              });
+
+  ++cpy_num_callbacks;
+  return cpy_string_to_unicode_or_bytes(buf);
+}
+
 static PyObject *cpy_register_notification(PyObject *self, PyObject *args,
                                            PyObject *kwds) {
   return cpy_register_generic_userdata((void *)plugin_register_notification,
@@ -1042,6 +1210,8 @@ static PyMethodDef cpy_methods[] = {
      METH_VARARGS | METH_KEYWORDS, reg_read_doc},
     {"register_write", (PyCFunction)cpy_register_write,
      METH_VARARGS | METH_KEYWORDS, reg_write_doc},
+    {"register_write_batch", (PyCFunction)cpy_register_write_batch,
+     METH_VARARGS | METH_KEYWORDS, reg_write_batch_doc},
     {"register_notification", (PyCFunction)cpy_register_notification,
      METH_VARARGS | METH_KEYWORDS, reg_notification_doc},
     {"register_flush", (PyCFunction)cpy_register_flush,
@@ -24,6 +24,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_conn_pool.h"
 
 #include <hiredis/hiredis.h>
 #include <sys/time.h>
@@ -32,7 +33,7 @@
 #define REDIS_DEF_PASSWD ""
 #define REDIS_DEF_PORT 6379
 #define REDIS_DEF_TIMEOUT_SEC 2
-#define REDIS_DEF_DB_COUNT 256
+#define REDIS_CHECK_INTERVAL TIME_T_TO_CDTIME_T(30)
 #define MAX_REDIS_VAL_SIZE 256
 #define MAX_REDIS_QUERY 2048
 
@@ -55,6 +56,7 @@ struct redis_query_s {
   char type[DATA_MAX_NAME_LEN];
   char instance[DATA_MAX_NAME_LEN];
   int database;
+  bool select; /* SELECT has been sent along with the query */
 
   redis_query_t *next;
 };
@@ -65,6 +67,15 @@ struct prev_s {
 };
 typedef struct prev_s prev_t;
 
+/* A connection of the pool of a node. */
+struct redis_conn_s;
+typedef struct redis_conn_s redis_conn_t;
+struct redis_conn_s {
+  redisContext *ctx;
+  int database; /* currently selected database or -1 */
+  bool broken;  /* an error occurred, the connection must not be reused */
+};
+
 struct redis_node_s;
 typedef struct redis_node_s redis_node_t;
 struct redis_node_s {
@@ -75,7 +86,7 @@ struct redis_node_s {
   struct timeval timeout;
   bool report_command_stats;
   bool report_cpu_usage;
-  redisContext *redisContext;
+  conn_pool_t *pool;
   redis_query_t *queries;
   prev_t prev;
 
@@ -97,7 +108,7 @@ static void redis_node_free(void *arg) {
     rq = next;
   }
 
-  redisFree(rn->redisContext);
+  conn_pool_destroy(rn->pool);
   sfree(rn->name);
   sfree(rn->host);
   sfree(rn->passwd);
@@ -333,35 +344,122 @@ static int redis_init(void) /* {{{ */
   return redis_node_add(rn);
 } /* }}} int redis_init */
 
-static void *c_redisCommand(redis_node_t *rn, const char *format, ...) {
-  redisContext *c = rn->redisContext;
+/* The commands of a read are appended to the output buffer and sent in one
+ * go by the first redis_get_reply(), so that a read takes a single round
+ * trip. Replies are returned in the order of the commands. */
+static int redis_append_command(redis_conn_t *conn, const char *format, ...) {
+  redisContext *c = conn->ctx;
 
-  if (c == NULL)
-    return NULL;
+  if (conn->broken)
+    return -1;
 
   va_list ap;
   va_start(ap, format);
-  void *reply = redisvCommand(c, format, ap);
+  int status = redisvAppendCommand(c, format, ap);
   va_end(ap);
 
-  if (reply == NULL) {
+  if (status != REDIS_OK) {
+    ERROR("redis plugin: Appending a command failed: %s", c->errstr);
+    conn->broken = true;
+    return -1;
+  }
+
+  return 0;
+} /* int redis_append_command */
+
+static redisReply *redis_get_reply(redis_conn_t *conn) {
+  redisContext *c = conn->ctx;
+  void *reply = NULL;
+
+  if (conn->broken)
+    return NULL;
+
+  if (redisGetReply(c, &reply) != REDIS_OK) {
     ERROR("redis plugin: Connection error: %s", c->errstr);
-    redisFree(rn->redisContext);
-    rn->redisContext = NULL;
+    conn->broken = true;
+    return NULL;
   }
 
   return reply;
-} /* void c_redisCommand */
+} /* redisReply *redis_get_reply */
+
+/* The "field:value" lines of an INFO reply, sorted by field. */
+typedef struct {
+  char const *name;
+  char const *value;
+} redis_info_field_t;
+
+typedef struct {
+  redis_info_field_t *fields;
+  size_t fields_num;
+} redis_info_t;
+
+static int redis_info_field_compare(void const *a, void const *b) {
+  redis_info_field_t const *f_a = a;
+  redis_info_field_t const *f_b = b;
+  return strcmp(f_a->name, f_b->name);
+} /* int redis_info_field_compare */
+
+/* Splits the INFO reply into its fields, in place. */
+static int redis_info_parse(redis_info_t *info, char *str) {
+  size_t lines_num = 1;
+  for (char const *ptr = str; *ptr != 0; ptr++)
+    if (*ptr == '\n')
+      lines_num++;
+
+  info->fields = calloc(lines_num, sizeof(*info->fields));
+  if (info->fields == NULL) {
+    ERROR("redis plugin: calloc failed.");
+    return ENOMEM;
+  }
+  info->fields_num = 0;
 
-static int redis_get_info_value(char const *info_line, char const *field_name,
-                                int ds_type, value_t *val) {
-  char *str = strstr(info_line, field_name);
-  static char buf[MAX_REDIS_VAL_SIZE];
+  char *line;
+  char *ptr = str;
+  char *saveptr = NULL;
+  while ((line = strtok_r(ptr, "\n\r", &saveptr)) != NULL) {
+    ptr = NULL;
+
+    /* Section headers */
+    if (line[0] == '#')
+      continue;
+
+    char *value = strchr(line, ':');
+    if (value == NULL)
+      continue;
+    *value = 0;
+    value++;
+
+    info->fields[info->fields_num] = (redis_info_field_t){
+        .name = line, .value = value,
+    };
+    info->fields_num++;
+  }
+
+  qsort(info->fields, info->fields_num, sizeof(*info->fields),
+        redis_info_field_compare);
+  return 0;
+} /* int redis_info_parse */
+
+static char const *redis_info_get(redis_info_t const *info,
+                                  char const *field_name) {
+  redis_info_field_t key = {.name = field_name};
+  redis_info_field_t const *field =
+      bsearch(&key, info->fields, info->fields_num, sizeof(*info->fields),
+              redis_info_field_compare);
+  return (field != NULL) ? field->value : NULL;
+} /* char const *redis_info_get */
+
+static int redis_get_info_value(redis_info_t const *info,
+                                char const *field_name, int ds_type,
+                                value_t *val) {
+  char const *str = redis_info_get(info, field_name);
+  char buf[MAX_REDIS_VAL_SIZE];
   if (str) {
-    int i;
+    size_t i;
 
-    str += strlen(field_name) + 1; /* also skip the ':' */
-    for (i = 0; (*str && (isdigit((unsigned char)*str) || *str == '.'));
+    for (i = 0; (*str && (isdigit((unsigned char)*str) || *str == '.')) &&
+                (i < sizeof(buf) - 1);
          i++, str++)
       buf[i] = *str;
     buf[i] = '\0';
@@ -376,27 +474,28 @@ static int redis_get_info_value(char const *info_line, char const *field_name,
   return -1;
 } /* int redis_get_info_value */
 
-static int redis_handle_info(char *node, char const *info_line,
+static int redis_handle_info(char *node, redis_info_t const *info,
                              char const *type, char const *type_instance,
                              char const *field_name, int ds_type) /* {{{ */
 {
   value_t val;
-  if (redis_get_info_value(info_line, field_name, ds_type, &val) != 0)
+  if (redis_get_info_value(info, field_name, ds_type, &val) != 0)
     return -1;
 
   redis_submit(node, type, type_instance, val);
   return 0;
 } /* }}} int redis_handle_info */
 
-static int redis_handle_query(redis_node_t *rn, redis_query_t *rq) /* {{{ */
+static int redis_handle_query(redis_node_t *rn, redis_query_t *rq,
+                              redisReply *rr) /* {{{ */
 {
-  redisReply *rr;
   const data_set_t *ds;
   value_t val;
 
   ds = plugin_get_ds(rq->type);
   if (!ds) {
     ERROR("redis plugin: DS type `%s' not defined.", rq->type);
+    freeReplyObject(rr);
     return -1;
   }
 
@@ -404,17 +503,7 @@ static int redis_handle_query(redis_node_t *rn, redis_query_t *rq) /* {{{ */
     ERROR("redis plugin: DS type `%s' has too many datasources. This is not "
           "supported currently.",
           rq->type);
-    return -1;
-  }
-
-  if ((rr = c_redisCommand(rn, "SELECT %d", rq->database)) == NULL) {
-    WARNING("redis plugin: unable to switch to database `%d' on node `%s'.",
-            rq->database, rn->name);
-    return -1;
-  }
-
-  if ((rr = c_redisCommand(rn, rq->query)) == NULL) {
-    WARNING("redis plugin: unable to carry out query `%s'.", rq->query);
+    freeReplyObject(rr);
     return -1;
   }
 
@@ -465,55 +554,55 @@ static int redis_handle_query(redis_node_t *rn, redis_query_t *rq) /* {{{ */
   return 0;
 } /* }}} int redis_handle_query */
 
-static int redis_db_stats(const char *node, char const *info_line) /* {{{ */
+static int redis_db_stats(const char *node,
+                          redis_info_t const *info) /* {{{ */
 {
   /* redis_db_stats parses and dispatches Redis database statistics,
    * currently the number of keys for each database.
-   * info_line needs to have the following format:
+   * The fields need to have the following format:
    *   db0:keys=4,expires=0,avg_ttl=0
    */
 
-  for (int db = 0; db < REDIS_DEF_DB_COUNT; db++) {
-    static char buf[MAX_REDIS_VAL_SIZE];
-    static char field_name[12];
-    static char db_id[4];
+  for (size_t i = 0; i < info->fields_num; i++) {
+    char const *name = info->fields[i].name;
+    char const *str = info->fields[i].value;
+    char buf[MAX_REDIS_VAL_SIZE];
     value_t val;
-    char *str;
-    int i;
-
-    snprintf(field_name, sizeof(field_name), "db%d:keys=", db);
+    size_t j;
 
-    str = strstr(info_line, field_name);
-    if (!str)
+    if ((strncmp("db", name, 2) != 0) || !isdigit((int)name[2]))
+      continue;
+    if (strncmp("keys=", str, strlen("keys=")) != 0)
       continue;
 
-    str += strlen(field_name);
-    for (i = 0; (*str && isdigit((int)*str)); i++, str++)
-      buf[i] = *str;
-    buf[i] = '\0';
+    str += strlen("keys=");
+    for (j = 0; (*str && isdigit((int)*str)) && (j < sizeof(buf) - 1);
+         j++, str++)
+      buf[j] = *str;
+    buf[j] = '\0';
 
     if (parse_value(buf, &val, DS_TYPE_GAUGE) != 0) {
-      WARNING("redis plugin: Unable to parse field `%s'.", field_name);
+      WARNING("redis plugin: Unable to parse field `%s'.", name);
       return -1;
     }
 
-    snprintf(db_id, sizeof(db_id), "%d", db);
-    redis_submit(node, "records", db_id, val);
+    /* database id */
+    redis_submit(node, "records", name + 2, val);
   }
   return 0;
 
 } /* }}} int redis_db_stats */
 
-static void redis_cpu_usage(const char *node, char const *info_line) {
+static void redis_cpu_usage(const char *node, redis_info_t const *info) {
   while (42) {
     value_t rusage_user;
     value_t rusage_syst;
 
-    if (redis_get_info_value(info_line, "used_cpu_user", DS_TYPE_GAUGE,
+    if (redis_get_info_value(info, "used_cpu_user", DS_TYPE_GAUGE,
                              &rusage_user) != 0)
       break;
 
-    if (redis_get_info_value(info_line, "used_cpu_sys", DS_TYPE_GAUGE,
+    if (redis_get_info_value(info, "used_cpu_sys", DS_TYPE_GAUGE,
                              &rusage_syst) != 0)
       break;
 
@@ -527,11 +616,11 @@ static void redis_cpu_usage(const char *node, char const *info_line) {
     value_t rusage_user;
     value_t rusage_syst;
 
-    if (redis_get_info_value(info_line, "used_cpu_user_children", DS_TYPE_GAUGE,
+    if (redis_get_info_value(info, "used_cpu_user_children", DS_TYPE_GAUGE,
                              &rusage_user) != 0)
       break;
 
-    if (redis_get_info_value(info_line, "used_cpu_sys_children", DS_TYPE_GAUGE,
+    if (redis_get_info_value(info, "used_cpu_sys_children", DS_TYPE_GAUGE,
                              &rusage_syst) != 0)
       break;
 
@@ -565,14 +654,13 @@ static gauge_t calculate_ratio_percent(derive_t part1, derive_t part2,
   return 100.0 * (gauge_t)num / (gauge_t)denom;
 } /* gauge_t calculate_ratio_percent */
 
-static void redis_keyspace_usage(redis_node_t *rn, char const *info_line) {
+static void redis_keyspace_usage(redis_node_t *rn, redis_info_t const *info) {
   value_t hits, misses;
 
-  if (redis_get_info_value(info_line, "keyspace_hits", DS_TYPE_DERIVE, &hits) !=
-      0)
+  if (redis_get_info_value(info, "keyspace_hits", DS_TYPE_DERIVE, &hits) != 0)
     return;
 
-  if (redis_get_info_value(info_line, "keyspace_misses", DS_TYPE_DERIVE,
+  if (redis_get_info_value(info, "keyspace_misses", DS_TYPE_DERIVE,
                            &misses) != 0)
     return;
 
@@ -586,108 +674,139 @@ static void redis_keyspace_usage(redis_node_t *rn, char const *info_line) {
 
 } /* void redis_keyspace_usage */
 
-static void redis_check_connection(redis_node_t *rn) {
-  if (rn->redisContext)
-    return;
+/* Connections are established, authenticated and pinged by the thread of
+ * the pool, so that an unreachable node does not block the read thread. */
+static void *redis_pool_connect(void *arg) {
+  redis_node_t *rn = arg;
 
   redisContext *rh = redisConnectWithTimeout(rn->host, rn->port, rn->timeout);
 
   if (rh == NULL) {
     ERROR("redis plugin: can't allocate redis context");
-    return;
+    return NULL;
   }
   if (rh->err) {
     ERROR("redis plugin: unable to connect to node `%s' (%s:%d): %s.", rn->name,
           rn->host, rn->port, rh->errstr);
     redisFree(rh);
-    return;
+    return NULL;
   }
 
-  rn->redisContext = rh;
-
   if (rn->passwd) {
     redisReply *rr;
 
     DEBUG("redis plugin: authenticating node `%s' passwd(%s).", rn->name,
           rn->passwd);
 
-    if ((rr = c_redisCommand(rn, "AUTH %s", rn->passwd)) == NULL) {
-      WARNING("redis plugin: unable to authenticate on node `%s'.", rn->name);
-      return;
+    if ((rr = redisCommand(rh, "AUTH %s", rn->passwd)) == NULL) {
+      WARNING("redis plugin: unable to authenticate on node `%s': %s.",
+              rn->name, rh->errstr);
+      redisFree(rh);
+      return NULL;
     }
 
     if (rr->type != REDIS_REPLY_STATUS) {
       WARNING("redis plugin: invalid authentication on node `%s'.", rn->name);
       freeReplyObject(rr);
-      redisFree(rn->redisContext);
-      rn->redisContext = NULL;
-      return;
+      redisFree(rh);
+      return NULL;
     }
 
     freeReplyObject(rr);
   }
-  return;
-} /* void redis_check_connection */
 
-static void redis_read_server_info(redis_node_t *rn) {
-  redisReply *rr;
+  redis_conn_t *conn = calloc(1, sizeof(*conn));
+  if (conn == NULL) {
+    redisFree(rh);
+    return NULL;
+  }
+  conn->ctx = rh;
+  conn->database = 0;
 
-  if ((rr = c_redisCommand(rn, "INFO")) == NULL) {
-    WARNING("redis plugin: unable to get INFO from node `%s'.", rn->name);
+  return conn;
+} /* void *redis_pool_connect */
+
+static int redis_pool_check(void *conn, __attribute__((unused)) void *arg) {
+  redisReply *rr = redisCommand(((redis_conn_t *)conn)->ctx, "PING");
+  if (rr == NULL)
+    return -1;
+
+  int status = (rr->type == REDIS_REPLY_STATUS) ? 0 : -1;
+  freeReplyObject(rr);
+  return status;
+} /* int redis_pool_check */
+
+static void redis_pool_close(void *conn, __attribute__((unused)) void *arg) {
+  redisFree(((redis_conn_t *)conn)->ctx);
+  free(conn);
+} /* void redis_pool_close */
+
+static conn_pool_ops_t const redis_pool_ops = {
+    .connect = redis_pool_connect,
+    .check = redis_pool_check,
+    .close = redis_pool_close,
+};
+
+static void redis_read_server_info(redis_node_t *rn, redisReply *rr) {
+  redis_info_t info = {0};
+
+  if (rr->type != REDIS_REPLY_STRING) {
+    WARNING("redis plugin: node `%s' `INFO' returned unsupported redis type "
+            "%i.",
+            rn->name, rr->type);
+    freeReplyObject(rr);
+    return;
+  }
+
+  if (redis_info_parse(&info, rr->str) != 0) {
+    freeReplyObject(rr);
     return;
   }
 
-  redis_handle_info(rn->name, rr->str, "uptime", NULL, "uptime_in_seconds",
+  redis_handle_info(rn->name, &info, "uptime", NULL, "uptime_in_seconds",
                     DS_TYPE_GAUGE);
-  redis_handle_info(rn->name, rr->str, "current_connections", "clients",
+  redis_handle_info(rn->name, &info, "current_connections", "clients",
                     "connected_clients", DS_TYPE_GAUGE);
-  redis_handle_info(rn->name, rr->str, "blocked_clients", NULL,
+  redis_handle_info(rn->name, &info, "blocked_clients", NULL,
                     "blocked_clients", DS_TYPE_GAUGE);
-  redis_handle_info(rn->name, rr->str, "memory", NULL, "used_memory",
+  redis_handle_info(rn->name, &info, "memory", NULL, "used_memory",
                     DS_TYPE_GAUGE);
-  redis_handle_info(rn->name, rr->str, "memory_lua", NULL, "used_memory_lua",
+  redis_handle_info(rn->name, &info, "memory_lua", NULL, "used_memory_lua",
                     DS_TYPE_GAUGE);
   /* changes_since_last_save: Deprecated in redis version 2.6 and above */
-  redis_handle_info(rn->name, rr->str, "volatile_changes", NULL,
+  redis_handle_info(rn->name, &info, "volatile_changes", NULL,
                     "changes_since_last_save", DS_TYPE_GAUGE);
-  redis_handle_info(rn->name, rr->str, "total_connections", NULL,
+  redis_handle_info(rn->name, &info, "total_connections", NULL,
                     "total_connections_received", DS_TYPE_DERIVE);
-  redis_handle_info(rn->name, rr->str, "total_operations", NULL,
+  redis_handle_info(rn->name, &info, "total_operations", NULL,
                     "total_commands_processed", DS_TYPE_DERIVE);
-  redis_handle_info(rn->name, rr->str, "expired_keys", NULL, "expired_keys",
+  redis_handle_info(rn->name, &info, "expired_keys", NULL, "expired_keys",
                     DS_TYPE_DERIVE);
-  redis_handle_info(rn->name, rr->str, "evicted_keys", NULL, "evicted_keys",
+  redis_handle_info(rn->name, &info, "evicted_keys", NULL, "evicted_keys",
                     DS_TYPE_DERIVE);
-  redis_handle_info(rn->name, rr->str, "pubsub", "channels", "pubsub_channels",
+  redis_handle_info(rn->name, &info, "pubsub", "channels", "pubsub_channels",
                     DS_TYPE_GAUGE);
-  redis_handle_info(rn->name, rr->str, "pubsub", "patterns", "pubsub_patterns",
+  redis_handle_info(rn->name, &info, "pubsub", "patterns", "pubsub_patterns",
                     DS_TYPE_GAUGE);
-  redis_handle_info(rn->name, rr->str, "current_connections", "slaves",
+  redis_handle_info(rn->name, &info, "current_connections", "slaves",
                     "connected_slaves", DS_TYPE_GAUGE);
-  redis_handle_info(rn->name, rr->str, "total_bytes", "input",
+  redis_handle_info(rn->name, &info, "total_bytes", "input",
                     "total_net_input_bytes", DS_TYPE_DERIVE);
-  redis_handle_info(rn->name, rr->str, "total_bytes", "output",
+  redis_handle_info(rn->name, &info, "total_bytes", "output",
                     "total_net_output_bytes", DS_TYPE_DERIVE);
 
-  redis_keyspace_usage(rn, rr->str);
+  redis_keyspace_usage(rn, &info);
 
-  redis_db_stats(rn->name, rr->str);
+  redis_db_stats(rn->name, &info);
 
   if (rn->report_cpu_usage)
-    redis_cpu_usage(rn->name, rr->str);
+    redis_cpu_usage(rn->name, &info);
 
+  sfree(info.fields);
   freeReplyObject(rr);
 } /* void redis_read_server_info */
 
-static void redis_read_command_stats(redis_node_t *rn) {
-  redisReply *rr;
-
-  if ((rr = c_redisCommand(rn, "INFO commandstats")) == NULL) {
-    WARNING("redis plugin: node `%s': unable to get `INFO commandstats'.",
-            rn->name);
-    return;
-  }
-
+static void redis_read_command_stats(redis_node_t *rn, redisReply *rr) {
   if (rr->type != REDIS_REPLY_STRING) {
     WARNING("redis plugin: node `%s' `INFO commandstats' returned unsupported "
             "redis type %i.",
@@ -755,40 +874,121 @@ static void redis_read_command_stats(redis_node_t *rn) {
   freeReplyObject(rr);
 } /* void redis_read_command_stats */
 
-static int redis_read(user_data_t *user_data) /* {{{ */
+static int redis_read_conn(redis_node_t *rn, redis_conn_t *conn) /* {{{ */
 {
-  redis_node_t *rn = user_data->data;
+  redisReply *rr;
 
-  DEBUG("redis plugin: querying info from node `%s' (%s:%d).", rn->name,
-        rn->host, rn->port);
+  /* The database selected when the replies are read */
+  int database = conn->database;
 
-  redis_check_connection(rn);
+  if (redis_append_command(conn, "INFO") != 0)
+    return -1;
 
-  if (!rn->redisContext) /* no connection */
+  if (rn->report_command_stats &&
+      (redis_append_command(conn, "INFO commandstats") != 0))
     return -1;
 
-  redis_read_server_info(rn);
+  for (redis_query_t *rq = rn->queries; rq != NULL; rq = rq->next) {
+    /* Queries run in the database selected last, so SELECT is only needed
+     * when switching. */
+    rq->select = (rq->database != conn->database);
+    if (rq->select) {
+      if (redis_append_command(conn, "SELECT %d", rq->database) != 0)
+        return -1;
+      conn->database = rq->database;
+    }
 
-  if (!rn->redisContext) /* connection lost */
+    if (redis_append_command(conn, rq->query) != 0)
+      return -1;
+  }
+
+  if ((rr = redis_get_reply(conn)) == NULL) {
+    WARNING("redis plugin: unable to get INFO from node `%s'.", rn->name);
     return -1;
+  }
+  redis_read_server_info(rn, rr);
 
   if (rn->report_command_stats) {
-    redis_read_command_stats(rn);
-
-    if (!rn->redisContext) /* connection lost */
+    if ((rr = redis_get_reply(conn)) == NULL) {
+      WARNING("redis plugin: node `%s': unable to get `INFO commandstats'.",
+              rn->name);
       return -1;
+    }
+    redis_read_command_stats(rn, rr);
   }
 
   for (redis_query_t *rq = rn->queries; rq != NULL; rq = rq->next) {
-    redis_handle_query(rn, rq);
-    if (!rn->redisContext) /* connection lost */
+    if (rq->select) {
+      if ((rr = redis_get_reply(conn)) == NULL) {
+        WARNING("redis plugin: unable to switch to database `%d' on node "
+                "`%s'.",
+                rq->database, rn->name);
+        return -1;
+      }
+      if (rr->type == REDIS_REPLY_ERROR) {
+        WARNING("redis plugin: unable to switch to database `%d' on node "
+                "`%s': %s.",
+                rq->database, rn->name, rr->str);
+        database = -1;
+      } else {
+        database = rq->database;
+      }
+      freeReplyObject(rr);
+    }
+
+    if ((rr = redis_get_reply(conn)) == NULL) {
+      WARNING("redis plugin: unable to carry out query `%s'.", rq->query);
       return -1;
+    }
+
+    /* The query ran in another database. */
+    if (database != rq->database) {
+      freeReplyObject(rr);
+      continue;
+    }
+
+    redis_handle_query(rn, rq, rr);
   }
 
+  /* Select again on the next read if switching failed. */
+  conn->database = database;
+
   return 0;
 }
 /* }}} */
 
+static int redis_read(user_data_t *user_data) /* {{{ */
+{
+  redis_node_t *rn = user_data->data;
+
+  DEBUG("redis plugin: querying info from node `%s' (%s:%d).", rn->name,
+        rn->host, rn->port);
+
+  /* Created here rather than in the config callback, because the thread of
+   * the pool must not be started before the daemon forks. */
+  if (rn->pool == NULL) {
+    char pool_name[sizeof("redis/") + DATA_MAX_NAME_LEN];
+    snprintf(pool_name, sizeof(pool_name), "redis/%s", rn->name);
+    rn->pool = conn_pool_create(pool_name, &redis_pool_ops, rn, /* size = */ 1,
+                                REDIS_CHECK_INTERVAL);
+    if (rn->pool == NULL) {
+      ERROR("redis plugin: Creating the connection pool of node `%s' failed.",
+            rn->name);
+      return -1;
+    }
+  }
+
+  redis_conn_t *conn = conn_pool_get(rn->pool);
+  if (conn == NULL) /* no connection */
+    return -1;
+
+  int status = redis_read_conn(rn, conn);
+  conn_pool_put(rn->pool, conn, conn->broken);
+
+  return status;
+}
+/* }}} */
+
 void module_register(void) /* {{{ */
 {
   plugin_register_complex_config("redis", redis_config);
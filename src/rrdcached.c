@@ -28,8 +28,13 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_complain.h"
 #include "utils_rrdcreate.h"
 
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
 #undef HAVE_CONFIG_H
 #include <rrd.h>
 #include <rrd_client.h>
@@ -53,7 +58,47 @@ static rrdcreate_config_t rrdcreate_config = {
     /* consolidation_functions = */ NULL,
     /* consolidation_functions_num = */ 0,
 
-    /* async = */ 0};
+    /* async = */ 0,
+    /* async_threads = */ 4,
+    /* create_rate = */ 0.0,
+    /* preallocate = */ 0};
+
+#define RC_DEFAULT_PORT "42217"
+
+/* Socket timeout of the BATCH connection. */
+#define RC_BATCH_IO_TIMEOUT 10
+
+/* In BATCH mode, the write callbacks append "UPDATE" commands to a shared
+ * buffer. A sender thread sends the buffer as one BATCH block over its own,
+ * persistent connection once it holds "BatchSize" updates or its oldest update
+ * is "BatchTimeout" old. While a block is in flight, the next one is being
+ * collected. Everything except batch_fd is protected by batch_lock. */
+static bool config_batch;
+static int config_batch_size = 100;
+static cdtime_t config_batch_timeout;
+
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t batch_done_cond = PTHREAD_COND_INITIALIZER;
+static char *batch_buffer;
+static size_t batch_buffer_size;
+static size_t batch_buffer_fill;
+static int batch_count;
+static cdtime_t batch_first;
+static bool batch_flush_now;
+static uint64_t batch_taken;
+static uint64_t batch_done;
+static pthread_t batch_thread;
+static bool batch_thread_running;
+static bool batch_loop;
+static c_complain_t batch_complaint = C_COMPLAIN_INIT_STATIC;
+static c_complain_t batch_backlog_complaint = C_COMPLAIN_INIT_STATIC;
+
+/* Only used by the sender thread. */
+static int batch_fd = -1;
+static char batch_rbuf[4096];
+static size_t batch_rbuf_fill;
+static char *batch_cwd;
 
 /*
  * Prototypes.
@@ -226,6 +271,22 @@ static int rc_config(oconfig_item_t *ci) {
       status = cf_util_get_boolean(child, &config_create_files);
     else if (strcasecmp("CreateFilesAsync", key) == 0)
       status = cf_util_get_boolean(child, &rrdcreate_config.async);
+    else if (strcasecmp("CreateFilesThreads", key) == 0) {
+      int tmp = 0;
+      status = rc_config_get_int_positive(child, &tmp);
+      if ((status == 0) && (tmp == 0))
+        status = EINVAL;
+      if (status == 0)
+        rrdcreate_config.async_threads = tmp;
+    } else if (strcasecmp("CreateFilesRate", key) == 0) {
+      double tmp = 0.0;
+      status = cf_util_get_double(child, &tmp);
+      if ((status == 0) && !(tmp >= 0.0))
+        status = EINVAL;
+      if (status == 0)
+        rrdcreate_config.create_rate = tmp;
+    } else if (strcasecmp("CreateFilesPreallocate", key) == 0)
+      status = cf_util_get_boolean(child, &rrdcreate_config.preallocate);
     else if (strcasecmp("CollectStatistics", key) == 0)
       status = cf_util_get_boolean(child, &config_collect_stats);
     else if (strcasecmp("StepSize", key) == 0) {
@@ -245,6 +306,17 @@ static int rc_config(oconfig_item_t *ci) {
         status = rc_config_add_timespan(tmp);
     } else if (strcasecmp("XFF", key) == 0)
       status = rc_config_get_xff(child, &rrdcreate_config.xff);
+    else if (strcasecmp("Batch", key) == 0)
+      status = cf_util_get_boolean(child, &config_batch);
+    else if (strcasecmp("BatchSize", key) == 0) {
+      int tmp = 0;
+      status = rc_config_get_int_positive(child, &tmp);
+      if ((status == 0) && (tmp == 0))
+        status = EINVAL;
+      if (status == 0)
+        config_batch_size = tmp;
+    } else if (strcasecmp("BatchTimeout", key) == 0)
+      status = cf_util_get_cdtime(child, &config_batch_timeout);
     else {
       WARNING("rrdcached plugin: Ignoring invalid option %s.", key);
       continue;
@@ -281,6 +353,337 @@ static int try_reconnect(void) {
   return 0;
 } /* int try_reconnect */
 
+/* Connects the BATCH socket to "DaemonAddress", which is either a UNIX socket
+ * ("unix:/path" or "/path") or "host", "host:port" or "[address]:port". */
+static int rc_batch_connect(void) {
+  const char *path = NULL;
+
+  if (strncmp("unix:", daemon_address, strlen("unix:")) == 0)
+    path = daemon_address + strlen("unix:");
+  else if (daemon_address[0] == '/')
+    path = daemon_address;
+
+  if (path != NULL) {
+    struct sockaddr_un sa = {.sun_family = AF_UNIX};
+
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+      ERROR("rrdcached plugin: Socket path too long: %s", path);
+      return -1;
+    }
+    sstrncpy(sa.sun_path, path, sizeof(sa.sun_path));
+
+    batch_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (batch_fd < 0)
+      return -1;
+    if (connect(batch_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+      close(batch_fd);
+      batch_fd = -1;
+      return -1;
+    }
+  } else {
+    char host[NI_MAXHOST];
+    const char *port = RC_DEFAULT_PORT;
+
+    if (daemon_address[0] == '[') {
+      sstrncpy(host, daemon_address + 1, sizeof(host));
+      char *end = strchr(host, ']');
+      if (end == NULL) {
+        ERROR("rrdcached plugin: Invalid address: %s", daemon_address);
+        return -1;
+      }
+      *end = 0;
+      const char *colon = strchr(daemon_address, ']');
+      if ((colon != NULL) && (colon[1] == ':'))
+        port = colon + 2;
+    } else {
+      sstrncpy(host, daemon_address, sizeof(host));
+      char *colon = strchr(host, ':');
+      /* More than one colon: an IPv6 address without a port. */
+      if ((colon != NULL) && (strchr(colon + 1, ':') == NULL)) {
+        *colon = 0;
+        port = daemon_address + (colon - host) + 1;
+      }
+    }
+
+    struct addrinfo ai_hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_flags = AI_ADDRCONFIG,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *ai_list = NULL;
+
+    int status = getaddrinfo(host, port, &ai_hints, &ai_list);
+    if (status != 0) {
+      ERROR("rrdcached plugin: getaddrinfo(%s, %s) failed: %s", host, port,
+            gai_strerror(status));
+      return -1;
+    }
+
+    for (struct addrinfo *ai = ai_list; ai != NULL; ai = ai->ai_next) {
+      batch_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (batch_fd < 0)
+        continue;
+      if (connect(batch_fd, ai->ai_addr, ai->ai_addrlen) == 0)
+        break;
+      close(batch_fd);
+      batch_fd = -1;
+    }
+    freeaddrinfo(ai_list);
+
+    if (batch_fd < 0)
+      return -1;
+  }
+
+  struct timeval tv = {.tv_sec = RC_BATCH_IO_TIMEOUT};
+  setsockopt(batch_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(batch_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  batch_rbuf_fill = 0;
+
+  return 0;
+} /* int rc_batch_connect */
+
+static void rc_batch_disconnect(void) {
+  if (batch_fd >= 0)
+    close(batch_fd);
+  batch_fd = -1;
+  batch_rbuf_fill = 0;
+} /* void rc_batch_disconnect */
+
+/* Reads one line of the daemon's response into "buffer", without the
+ * newline. */
+static int rc_batch_read_line(char *buffer, size_t buffer_size) {
+  while (42) {
+    char *eol = memchr(batch_rbuf, '\n', batch_rbuf_fill);
+    if (eol != NULL) {
+      size_t len = (size_t)(eol - batch_rbuf);
+
+      *eol = 0;
+      sstrncpy(buffer, batch_rbuf, buffer_size);
+      batch_rbuf_fill -= len + 1;
+      memmove(batch_rbuf, eol + 1, batch_rbuf_fill);
+      return 0;
+    }
+
+    /* Lines longer than the buffer are truncated. */
+    if (batch_rbuf_fill >= sizeof(batch_rbuf) - 1)
+      batch_rbuf_fill = 0;
+
+    ssize_t status = read(batch_fd, batch_rbuf + batch_rbuf_fill,
+                          sizeof(batch_rbuf) - 1 - batch_rbuf_fill);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    } else if (status == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    batch_rbuf_fill += (size_t)status;
+  }
+} /* int rc_batch_read_line */
+
+/* Sends one BATCH block and reads the daemon's response. Returns -1 if the
+ * connection failed, so the caller can reconnect and try again. */
+static int rc_batch_send_block(const char *data, size_t data_len, int count) {
+  char line[1024];
+
+  if ((swrite(batch_fd, "BATCH\n", strlen("BATCH\n")) != 0) ||
+      (swrite(batch_fd, data, data_len) != 0) ||
+      (swrite(batch_fd, ".\n", strlen(".\n")) != 0))
+    return -1;
+
+  /* "0 Go ahead.  End with dot '.' on its own line." */
+  if (rc_batch_read_line(line, sizeof(line)) != 0)
+    return -1;
+  if (atoi(line) != 0) {
+    c_complain(LOG_ERR, &batch_complaint,
+               "rrdcached plugin: BATCH rejected by %s: %s", daemon_address,
+               line);
+    return 0;
+  }
+
+  /* "<n> errors", followed by one "<command number> <message>" line each. */
+  if (rc_batch_read_line(line, sizeof(line)) != 0)
+    return -1;
+  int errors = atoi(line);
+
+  for (int i = 0; i < errors; i++) {
+    if (rc_batch_read_line(line, sizeof(line)) != 0)
+      return -1;
+    if (i == 0) {
+      WARNING("rrdcached plugin: %i of %i updates sent to %s failed. "
+              "The first error was: %s",
+              errors, count, daemon_address, line);
+    } else {
+      DEBUG("rrdcached plugin: BATCH error: %s", line);
+    }
+  }
+
+  c_release(LOG_INFO, &batch_complaint,
+            "rrdcached plugin: Sending updates to %s succeeded.",
+            daemon_address);
+  return 0;
+} /* int rc_batch_send_block */
+
+static void rc_batch_send(const char *data, size_t data_len, int count) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if ((batch_fd < 0) && (rc_batch_connect() != 0)) {
+      c_complain(LOG_ERR, &batch_complaint,
+                 "rrdcached plugin: Connecting to %s failed: %s",
+                 daemon_address, STRERRNO);
+      return;
+    }
+
+    if (rc_batch_send_block(data, data_len, count) == 0)
+      return;
+
+    /* The daemon may have closed an idle connection. Reconnect once. */
+    rc_batch_disconnect();
+  }
+
+  c_complain(LOG_ERR, &batch_complaint,
+             "rrdcached plugin: Sending %i updates to %s failed: %s", count,
+             daemon_address, STRERRNO);
+} /* void rc_batch_send */
+
+static void *rc_batch_thread(void __attribute__((unused)) * arg) {
+  pthread_mutex_lock(&batch_lock);
+  while (42) {
+    if (batch_count == 0) {
+      batch_flush_now = false;
+      if (!batch_loop)
+        break;
+      pthread_cond_wait(&batch_cond, &batch_lock);
+      continue;
+    }
+
+    cdtime_t deadline = batch_first + config_batch_timeout;
+    if (batch_loop && !batch_flush_now &&
+        (batch_count < config_batch_size) && (cdtime() < deadline)) {
+      pthread_cond_timedwait(&batch_cond, &batch_lock,
+                             &CDTIME_T_TO_TIMESPEC(deadline));
+      continue;
+    }
+
+    char *data = batch_buffer;
+    size_t data_len = batch_buffer_fill;
+    int count = batch_count;
+    uint64_t generation = ++batch_taken;
+
+    batch_buffer = NULL;
+    batch_buffer_size = 0;
+    batch_buffer_fill = 0;
+    batch_count = 0;
+    batch_flush_now = false;
+    pthread_mutex_unlock(&batch_lock);
+
+    rc_batch_send(data, data_len, count);
+    sfree(data);
+
+    pthread_mutex_lock(&batch_lock);
+    batch_done = generation;
+    pthread_cond_broadcast(&batch_done_cond);
+  }
+  pthread_mutex_unlock(&batch_lock);
+
+  rc_batch_disconnect();
+  return NULL;
+} /* void *rc_batch_thread */
+
+/* Appends "str" to "buffer", escaping spaces and backslashes like the RRD
+ * client library does. */
+static int rc_batch_escape(char *buffer, size_t buffer_size, const char *str) {
+  size_t pos = 0;
+
+  for (; *str != 0; str++) {
+    if (pos + 2 >= buffer_size)
+      return ENOMEM;
+    if ((*str == ' ') || (*str == '\\'))
+      buffer[pos++] = '\\';
+    buffer[pos++] = *str;
+  }
+  buffer[pos] = 0;
+
+  return 0;
+} /* int rc_batch_escape */
+
+static int rc_batch_add(const char *filename, const char *values) {
+  char path[PATH_MAX + 1];
+  char escaped[2 * sizeof(path)];
+  char command[sizeof(escaped) + 512];
+
+  /* The daemon resolves relative paths against its own base directory, so
+   * local daemons get absolute paths, like librrd would send. */
+  if ((batch_cwd != NULL) && (filename[0] != '/')) {
+    snprintf(path, sizeof(path), "%s/%s", batch_cwd, filename);
+    filename = path;
+  }
+
+  if (rc_batch_escape(escaped, sizeof(escaped), filename) != 0)
+    return ENOMEM;
+
+  int len = snprintf(command, sizeof(command), "UPDATE %s %s\n", escaped,
+                     values);
+  if ((len < 0) || ((size_t)len >= sizeof(command)))
+    return ENOMEM;
+
+  pthread_mutex_lock(&batch_lock);
+
+  /* Don't grow without bounds while the daemon is unreachable. */
+  if (batch_count >= 16 * config_batch_size) {
+    c_complain(LOG_WARNING, &batch_backlog_complaint,
+               "rrdcached plugin: Too many updates are waiting to be sent to "
+               "%s. Dropping updates.",
+               daemon_address);
+    pthread_mutex_unlock(&batch_lock);
+    return -1;
+  }
+
+  if (batch_buffer_fill + (size_t)len + 1 > batch_buffer_size) {
+    size_t new_size = (batch_buffer_size > 0) ? batch_buffer_size : 4096;
+    while (new_size < batch_buffer_fill + (size_t)len + 1)
+      new_size *= 2;
+
+    char *tmp = realloc(batch_buffer, new_size);
+    if (tmp == NULL) {
+      pthread_mutex_unlock(&batch_lock);
+      ERROR("rrdcached plugin: realloc failed.");
+      return ENOMEM;
+    }
+    batch_buffer = tmp;
+    batch_buffer_size = new_size;
+  }
+
+  memcpy(batch_buffer + batch_buffer_fill, command, (size_t)len + 1);
+  batch_buffer_fill += (size_t)len;
+  if (batch_count == 0)
+    batch_first = cdtime();
+  batch_count++;
+
+  if ((batch_count == 1) || (batch_count >= config_batch_size))
+    pthread_cond_signal(&batch_cond);
+
+  c_release(LOG_INFO, &batch_backlog_complaint,
+            "rrdcached plugin: Queueing updates for %s again.", daemon_address);
+  pthread_mutex_unlock(&batch_lock);
+  return 0;
+} /* int rc_batch_add */
+
+/* Makes the sender thread send all pending updates and waits until they have
+ * been sent. */
+static void rc_batch_flush(void) {
+  pthread_mutex_lock(&batch_lock);
+  if (batch_thread_running && (batch_count > 0)) {
+    uint64_t generation = batch_taken + 1;
+
+    batch_flush_now = true;
+    pthread_cond_signal(&batch_cond);
+    while (batch_thread_running && (batch_done < generation))
+      pthread_cond_wait(&batch_done_cond, &batch_lock);
+  }
+  pthread_mutex_unlock(&batch_lock);
+} /* void rc_batch_flush */
+
 static int rc_read(void) {
   int status;
   rrdc_stats_t *head;
@@ -383,6 +786,29 @@ static int rc_init(void) {
   if (config_collect_stats)
     plugin_register_read("rrdcached", rc_read);
 
+  if (config_batch && (daemon_address != NULL) && !batch_thread_running) {
+    if (config_batch_timeout == 0)
+      config_batch_timeout = TIME_T_TO_CDTIME_T(1);
+
+    if ((strncmp("unix:", daemon_address, strlen("unix:")) == 0) ||
+        (daemon_address[0] == '/')) {
+      char cwd[PATH_MAX];
+      if (getcwd(cwd, sizeof(cwd)) != NULL)
+        batch_cwd = strdup(cwd);
+    }
+
+    batch_loop = true;
+    int status = plugin_thread_create(&batch_thread, /* attr = */ NULL,
+                                      rc_batch_thread, /* arg = */ NULL,
+                                      "rrdcached batch");
+    if (status != 0) {
+      ERROR("rrdcached plugin: Starting the BATCH thread failed: %s",
+            STRERROR(status));
+      return -1;
+    }
+    batch_thread_running = true;
+  }
+
   return 0;
 } /* int rc_init */
 
@@ -415,9 +841,6 @@ static int rc_write(const data_set_t *ds, const value_list_t *vl,
     return -1;
   }
 
-  values_array[0] = values;
-  values_array[1] = NULL;
-
   if (config_create_files) {
     struct stat statbuf;
 
@@ -437,6 +860,12 @@ static int rc_write(const data_set_t *ds, const value_list_t *vl,
     }
   }
 
+  if (config_batch)
+    return rc_batch_add(filename, values);
+
+  values_array[0] = values;
+  values_array[1] = NULL;
+
   rrd_clear_error();
   status = rrdc_connect(daemon_address);
   if (status != 0) {
@@ -476,8 +905,11 @@ static int rc_flush(__attribute__((unused)) cdtime_t timeout, /* {{{ */
   int status;
   bool retried = false;
 
+  if (config_batch)
+    rc_batch_flush();
+
   if (identifier == NULL)
-    return EINVAL;
+    return config_batch ? 0 : EINVAL;
 
   if (datadir != NULL)
     snprintf(filename, sizeof(filename), "%s/%s.rrd", datadir, identifier);
@@ -518,6 +950,24 @@ static int rc_flush(__attribute__((unused)) cdtime_t timeout, /* {{{ */
 } /* }}} int rc_flush */
 
 static int rc_shutdown(void) {
+  if (batch_thread_running) {
+    pthread_mutex_lock(&batch_lock);
+    batch_loop = false;
+    pthread_cond_signal(&batch_cond);
+    pthread_mutex_unlock(&batch_lock);
+
+    /* The thread sends the updates that are still pending before exiting. */
+    pthread_join(batch_thread, NULL);
+
+    pthread_mutex_lock(&batch_lock);
+    batch_thread_running = false;
+    pthread_cond_broadcast(&batch_done_cond);
+    pthread_mutex_unlock(&batch_lock);
+  }
+  sfree(batch_buffer);
+  sfree(batch_cwd);
+
+  cu_rrd_create_shutdown();
   rrdc_disconnect();
   return 0;
 } /* int rc_shutdown */
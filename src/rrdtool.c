@@ -28,6 +28,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_avltree.h"
+#include "utils_memstats.h"
 #include "utils_random.h"
 #include "utils_rrdcreate.h"
 
@@ -50,17 +51,38 @@ typedef enum rrd_queue_dir_e rrd_queue_dir_t;
 
 struct rrd_queue_s {
   char *filename;
+  cdtime_t queued;
   struct rrd_queue_s *next;
 };
 typedef struct rrd_queue_s rrd_queue_t;
 
+/* Files are sharded across the queue threads by the hash of their name, so
+ * that a file is always updated by the same thread and updates of one file
+ * stay in order. */
+struct rrd_queue_thread_s {
+  rrd_queue_t *queue_head;
+  rrd_queue_t *queue_tail;
+  rrd_queue_t *flushq_head;
+  rrd_queue_t *flushq_tail;
+  /* number of entries in both queues */
+  size_t queue_length;
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+typedef struct rrd_queue_thread_s rrd_queue_thread_t;
+
 /*
  * Private variables
  */
 static const char *config_keys[] = {
     "CacheTimeout", "CacheFlush",      "CreateFilesAsync", "DataDir",
     "StepSize",     "HeartBeat",       "RRARows",          "RRATimespan",
-    "XFF",          "WritesPerSecond", "RandomTimeout"};
+    "XFF",          "WritesPerSecond", "RandomTimeout",    "WriteThreads",
+    "ReportStats",  "AdaptiveCacheTimeout", "CacheTimeoutMin",
+    "CacheTimeoutMax", "CreateFilesThreads", "CreateFilesRate",
+    "CreateFilesPreallocate"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 /* If datadir is zero, the daemon's basedir is used. If stepsize or heartbeat
@@ -80,10 +102,13 @@ static rrdcreate_config_t rrdcreate_config = {
     /* consolidation_functions = */ NULL,
     /* consolidation_functions_num = */ 0,
 
-    /* async = */ 0};
+    /* async = */ 0,
+    /* async_threads = */ 4,
+    /* create_rate = */ 0.0,
+    /* preallocate = */ 0};
 
-/* XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
- * ALWAYS lock `cache_lock' first! */
+/* XXX: If you need to lock both, cache_lock and the lock of a queue thread, at
+ * the same time, ALWAYS lock `cache_lock' first! */
 static cdtime_t cache_timeout;
 static cdtime_t cache_flush_timeout;
 static cdtime_t random_timeout;
@@ -91,14 +116,21 @@ static cdtime_t cache_flush_last;
 static c_avl_tree_t *cache;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static rrd_queue_t *queue_head;
-static rrd_queue_t *queue_tail;
-static rrd_queue_t *flushq_head;
-static rrd_queue_t *flushq_tail;
-static pthread_t queue_thread;
-static int queue_thread_running = 1;
-static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+/* With "AdaptiveCacheTimeout", the timeout used by the cache moves between
+ * "CacheTimeoutMin" and "CacheTimeoutMax", depending on how long the queue
+ * threads would need to write everything that is queued. Protected by
+ * cache_lock. */
+static bool adaptive_timeout;
+static cdtime_t cache_timeout_min;
+static cdtime_t cache_timeout_max;
+static cdtime_t cache_timeout_effective;
+static cdtime_t update_latency;
+static cdtime_t adaptive_last_update;
+
+static rrd_queue_thread_t *queue_threads;
+static size_t queue_threads_num;
+static size_t write_threads_num = 1;
+static bool report_stats;
 
 #if !HAVE_THREADSAFE_LIBRRD
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -106,6 +138,9 @@ static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int do_shutdown;
 
+/* Memory of the cache entries, including the values not written yet. */
+static memstat_t *cache_memstat;
+
 #if HAVE_THREADSAFE_LIBRRD
 static int srrd_update(char *filename, char *template, int argc,
                        const char **argv) {
@@ -279,10 +314,87 @@ static int value_list_to_filename(char *buffer, size_t buffer_size,
   return 0;
 } /* int value_list_to_filename */
 
-static void *rrd_queue_thread(void __attribute__((unused)) * data) {
+static rrd_queue_thread_t *rrd_queue_thread_get(const char *filename) {
+  if (queue_threads_num == 1)
+    return queue_threads;
+  return queue_threads + (identifier_hash(filename) % queue_threads_num);
+} /* rrd_queue_thread_t *rrd_queue_thread_get */
+
+/* Returns the total number of queued files. */
+static size_t rrd_queue_length(void) {
+  size_t total = 0;
+
+  for (size_t i = 0; i < queue_threads_num; i++) {
+    pthread_mutex_lock(&queue_threads[i].lock);
+    total += queue_threads[i].queue_length;
+    pthread_mutex_unlock(&queue_threads[i].lock);
+  }
+
+  return total;
+} /* size_t rrd_queue_length */
+
+/* Updates the average update latency and, at most once per second, the
+ * effective cache timeout. The timeout aims at twice the time it takes to
+ * write all queued files, so that files are not due again before they have
+ * been written. */
+static void rrd_adapt_timeout(cdtime_t latency) {
+  cdtime_t now = cdtime();
+
+  pthread_mutex_lock(&cache_lock);
+
+  if (update_latency == 0)
+    update_latency = latency;
+  else
+    update_latency = (7 * update_latency + latency) / 8;
+
+  if ((now - adaptive_last_update) < TIME_T_TO_CDTIME_T(1)) {
+    pthread_mutex_unlock(&cache_lock);
+    return;
+  }
+  adaptive_last_update = now;
+
+  /* A thread does no more than its share of "WritesPerSecond" updates. */
+  cdtime_t cost = update_latency;
+  cdtime_t rate_cost = DOUBLE_TO_CDTIME_T(write_rate * (double)queue_threads_num);
+  if (cost < rate_cost)
+    cost = rate_cost;
+
+  cdtime_t target =
+      2 * (cdtime_t)rrd_queue_length() * cost / (cdtime_t)queue_threads_num;
+  if (target < cache_timeout_min)
+    target = cache_timeout_min;
+  else if (target > cache_timeout_max)
+    target = cache_timeout_max;
+
+  cache_timeout_effective = (cache_timeout_effective + target) / 2;
+
+  pthread_mutex_unlock(&cache_lock);
+} /* void rrd_adapt_timeout */
+
+static int64_t rrd_cache_entry_bytes(char const *filename) {
+  return (int64_t)(sizeof(rrd_cache_t) + strlen(filename) + 1);
+} /* int64_t rrd_cache_entry_bytes */
+
+static void rrd_cache_values_free(char **values, int values_num) {
+  int64_t bytes = (int64_t)(values_num * sizeof(*values));
+
+  for (int i = 0; i < values_num; i++) {
+    bytes += (int64_t)strlen(values[i]) + 1;
+    sfree(values[i]);
+  }
+  sfree(values);
+  memstat_add(cache_memstat, -bytes, 0);
+} /* void rrd_cache_values_free */
+
+static void *rrd_queue_thread(void *data) {
+  rrd_queue_thread_t *qt = data;
   struct timeval tv_next_update;
   struct timeval tv_now;
 
+  /* "WritesPerSecond" is a limit for the plugin, so each of the threads may
+   * only use its share of it. */
+  double thread_write_rate = write_rate * (double)queue_threads_num;
+
   gettimeofday(&tv_next_update, /* timezone = */ NULL);
 
   while (42) {
@@ -295,20 +407,20 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
     values = NULL;
     values_num = 0;
 
-    pthread_mutex_lock(&queue_lock);
+    pthread_mutex_lock(&qt->lock);
     /* Wait for values to arrive */
     while (42) {
       struct timespec ts_wait;
 
-      while ((flushq_head == NULL) && (queue_head == NULL) &&
+      while ((qt->flushq_head == NULL) && (qt->queue_head == NULL) &&
              (do_shutdown == 0))
-        pthread_cond_wait(&queue_cond, &queue_lock);
+        pthread_cond_wait(&qt->cond, &qt->lock);
 
-      if ((flushq_head == NULL) && (queue_head == NULL))
+      if ((qt->flushq_head == NULL) && (qt->queue_head == NULL))
         break;
 
       /* Don't delay if there's something to flush */
-      if (flushq_head != NULL)
+      if (qt->flushq_head != NULL)
         break;
 
       /* Don't delay if we're shutting down */
@@ -316,7 +428,7 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
         break;
 
       /* Don't delay if no delay was configured. */
-      if (write_rate <= 0.0)
+      if (thread_write_rate <= 0.0)
         break;
 
       gettimeofday(&tv_now, /* timezone = */ NULL);
@@ -331,39 +443,40 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
       ts_wait.tv_sec = tv_next_update.tv_sec;
       ts_wait.tv_nsec = 1000 * tv_next_update.tv_usec;
 
-      status = pthread_cond_timedwait(&queue_cond, &queue_lock, &ts_wait);
+      status = pthread_cond_timedwait(&qt->cond, &qt->lock, &ts_wait);
       if (status == ETIMEDOUT)
         break;
     } /* while (42) */
 
-    /* XXX: If you need to lock both, cache_lock and queue_lock, at
+    /* XXX: If you need to lock both, cache_lock and the queue lock, at
      * the same time, ALWAYS lock `cache_lock' first! */
 
     /* We're in the shutdown phase */
-    if ((flushq_head == NULL) && (queue_head == NULL)) {
-      pthread_mutex_unlock(&queue_lock);
+    if ((qt->flushq_head == NULL) && (qt->queue_head == NULL)) {
+      pthread_mutex_unlock(&qt->lock);
       break;
     }
 
-    if (flushq_head != NULL) {
+    if (qt->flushq_head != NULL) {
       /* Dequeue the first flush entry */
-      queue_entry = flushq_head;
-      if (flushq_head == flushq_tail)
-        flushq_head = flushq_tail = NULL;
+      queue_entry = qt->flushq_head;
+      if (qt->flushq_head == qt->flushq_tail)
+        qt->flushq_head = qt->flushq_tail = NULL;
       else
-        flushq_head = flushq_head->next;
+        qt->flushq_head = qt->flushq_head->next;
     } else /* if (queue_head != NULL) */
     {
       /* Dequeue the first regular entry */
-      queue_entry = queue_head;
-      if (queue_head == queue_tail)
-        queue_head = queue_tail = NULL;
+      queue_entry = qt->queue_head;
+      if (qt->queue_head == qt->queue_tail)
+        qt->queue_head = qt->queue_tail = NULL;
       else
-        queue_head = queue_head->next;
+        qt->queue_head = qt->queue_head->next;
     }
+    qt->queue_length--;
 
     /* Unlock the queue again */
-    pthread_mutex_unlock(&queue_lock);
+    pthread_mutex_unlock(&qt->lock);
 
     /* We now need the cache lock so the entry isn't updated while
      * we make a copy of its values */
@@ -389,11 +502,11 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
     }
 
     /* Update `tv_next_update' */
-    if (write_rate > 0.0) {
+    if (thread_write_rate > 0.0) {
       gettimeofday(&tv_now, /* timezone = */ NULL);
       tv_next_update.tv_sec = tv_now.tv_sec;
       tv_next_update.tv_usec =
-          tv_now.tv_usec + ((suseconds_t)(1000000 * write_rate));
+          tv_now.tv_usec + ((suseconds_t)(1000000 * thread_write_rate));
       while (tv_next_update.tv_usec > 1000000) {
         tv_next_update.tv_sec++;
         tv_next_update.tv_usec -= 1000000;
@@ -401,14 +514,14 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
     }
 
     /* Write the values to the RRD-file */
+    cdtime_t update_start = adaptive_timeout ? cdtime() : 0;
     srrd_update(queue_entry->filename, NULL, values_num, (const char **)values);
+    if (adaptive_timeout)
+      rrd_adapt_timeout(cdtime() - update_start);
     DEBUG("rrdtool plugin: queue thread: Wrote %i value%s to %s", values_num,
           (values_num == 1) ? "" : "s", queue_entry->filename);
 
-    for (int i = 0; i < values_num; i++) {
-      sfree(values[i]);
-    }
-    sfree(values);
+    rrd_cache_values_free(values, values_num);
     sfree(queue_entry->filename);
     sfree(queue_entry);
   } /* while (42) */
@@ -417,9 +530,13 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
   return (void *)0;
 } /* void *rrd_queue_thread */
 
-static int rrd_queue_enqueue(const char *filename, rrd_queue_t **head,
-                             rrd_queue_t **tail) {
+/* Appends "filename" to the flush queue if "flush" is true and to the regular
+ * queue otherwise. */
+static int rrd_queue_enqueue(const char *filename, bool flush) {
+  rrd_queue_thread_t *qt = rrd_queue_thread_get(filename);
   rrd_queue_t *queue_entry;
+  rrd_queue_t **head;
+  rrd_queue_t **tail;
 
   queue_entry = malloc(sizeof(*queue_entry));
   if (queue_entry == NULL)
@@ -431,31 +548,37 @@ static int rrd_queue_enqueue(const char *filename, rrd_queue_t **head,
     return -1;
   }
 
+  queue_entry->queued = cdtime();
   queue_entry->next = NULL;
 
-  pthread_mutex_lock(&queue_lock);
+  pthread_mutex_lock(&qt->lock);
+
+  head = flush ? &qt->flushq_head : &qt->queue_head;
+  tail = flush ? &qt->flushq_tail : &qt->queue_tail;
 
   if (*tail == NULL)
     *head = queue_entry;
   else
     (*tail)->next = queue_entry;
   *tail = queue_entry;
+  qt->queue_length++;
 
-  pthread_cond_signal(&queue_cond);
-  pthread_mutex_unlock(&queue_lock);
+  pthread_cond_signal(&qt->cond);
+  pthread_mutex_unlock(&qt->lock);
 
   return 0;
 } /* int rrd_queue_enqueue */
 
-static int rrd_queue_dequeue(const char *filename, rrd_queue_t **head,
-                             rrd_queue_t **tail) {
+/* Removes "filename" from the regular queue. */
+static int rrd_queue_dequeue(const char *filename) {
+  rrd_queue_thread_t *qt = rrd_queue_thread_get(filename);
   rrd_queue_t *this;
   rrd_queue_t *prev;
 
-  pthread_mutex_lock(&queue_lock);
+  pthread_mutex_lock(&qt->lock);
 
   prev = NULL;
-  this = *head;
+  this = qt->queue_head;
 
   while (this != NULL) {
     if (strcmp(this->filename, filename) == 0)
@@ -466,19 +589,20 @@ static int rrd_queue_dequeue(const char *filename, rrd_queue_t **head,
   }
 
   if (this == NULL) {
-    pthread_mutex_unlock(&queue_lock);
+    pthread_mutex_unlock(&qt->lock);
     return -1;
   }
 
   if (prev == NULL)
-    *head = this->next;
+    qt->queue_head = this->next;
   else
     prev->next = this->next;
 
   if (this->next == NULL)
-    *tail = prev;
+    qt->queue_tail = prev;
+  qt->queue_length--;
 
-  pthread_mutex_unlock(&queue_lock);
+  pthread_mutex_unlock(&qt->lock);
 
   sfree(this->filename);
   sfree(this);
@@ -513,7 +637,7 @@ static void rrd_cache_flush(cdtime_t timeout) {
     else if (rc->values_num > 0) {
       int status;
 
-      status = rrd_queue_enqueue(key, &queue_head, &queue_tail);
+      status = rrd_queue_enqueue(key, /* flush = */ false);
       if (status == 0)
         rc->flags = FLAG_QUEUED;
     } else /* ancient and no values -> waste of memory */
@@ -541,6 +665,7 @@ static void rrd_cache_flush(cdtime_t timeout) {
     assert(rc->values == NULL);
     assert(rc->values_num == 0);
 
+    memstat_add(cache_memstat, -rrd_cache_entry_bytes(key), -1);
     sfree(rc);
     sfree(key);
     keys[i] = NULL;
@@ -582,14 +707,14 @@ static int rrd_cache_flush_identifier(cdtime_t timeout,
   if (rc->flags == FLAG_FLUSHQ) {
     status = 0;
   } else if (rc->flags == FLAG_QUEUED) {
-    rrd_queue_dequeue(key, &queue_head, &queue_tail);
-    status = rrd_queue_enqueue(key, &flushq_head, &flushq_tail);
+    rrd_queue_dequeue(key);
+    status = rrd_queue_enqueue(key, /* flush = */ true);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   } else if ((now - rc->first_value) < timeout) {
     status = 0;
   } else if (rc->values_num > 0) {
-    status = rrd_queue_enqueue(key, &flushq_head, &flushq_tail);
+    status = rrd_queue_enqueue(key, /* flush = */ true);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   }
@@ -656,16 +781,21 @@ static int rrd_cache_insert(const char *filename, const char *value,
 
     ERROR("rrdtool plugin: realloc failed: %s", STRERRNO);
 
+    if (!new_rc)
+      memstat_add(cache_memstat, -rrd_cache_entry_bytes(filename), -1);
     sfree(cache_key);
-    sfree(rc->values);
+    rrd_cache_values_free(rc->values, rc->values_num);
     sfree(rc);
     return -1;
   }
   rc->values = values_new;
 
+  int64_t value_bytes = 0;
   rc->values[rc->values_num] = strdup(value);
-  if (rc->values[rc->values_num] != NULL)
+  if (rc->values[rc->values_num] != NULL) {
     rc->values_num++;
+    value_bytes = (int64_t)(strlen(value) + 1 + sizeof(*rc->values));
+  }
 
   if (rc->values_num == 1)
     rc->first_value = value_time;
@@ -687,7 +817,9 @@ static int rrd_cache_insert(const char *filename, const char *value,
     }
 
     c_avl_insert(cache, cache_key, rc);
+    memstat_add(cache_memstat, rrd_cache_entry_bytes(filename), 1);
   }
+  memstat_add(cache_memstat, value_bytes, 0);
 
   DEBUG("rrdtool plugin: rrd_cache_insert: file = %s; "
         "values_num = %i; age = %.3f;",
@@ -695,13 +827,13 @@ static int rrd_cache_insert(const char *filename, const char *value,
         CDTIME_T_TO_DOUBLE(rc->last_value - rc->first_value));
 
   if ((rc->last_value - rc->first_value) >=
-      (cache_timeout + rc->random_variation)) {
-    /* XXX: If you need to lock both, cache_lock and queue_lock, at
+      (cache_timeout_effective + rc->random_variation)) {
+    /* XXX: If you need to lock both, cache_lock and the queue lock, at
      * the same time, ALWAYS lock `cache_lock' first! */
     if (rc->flags == FLAG_NONE) {
       int status;
 
-      status = rrd_queue_enqueue(filename, &queue_head, &queue_tail);
+      status = rrd_queue_enqueue(filename, /* flush = */ false);
       if (status == 0)
         rc->flags = FLAG_QUEUED;
 
@@ -713,7 +845,7 @@ static int rrd_cache_insert(const char *filename, const char *value,
 
   if ((cache_timeout > 0) &&
       ((cdtime() - cache_flush_last) > cache_flush_timeout))
-    rrd_cache_flush(cache_timeout + random_timeout);
+    rrd_cache_flush(cache_timeout_effective + random_timeout);
 
   pthread_mutex_unlock(&cache_lock);
 
@@ -737,6 +869,7 @@ static int rrd_cache_destroy(void) /* {{{ */
   while (c_avl_pick(cache, &key, &value) == 0) {
     rrd_cache_t *rc;
 
+    memstat_add(cache_memstat, -rrd_cache_entry_bytes(key), -1);
     sfree(key);
     key = NULL;
 
@@ -746,9 +879,7 @@ static int rrd_cache_destroy(void) /* {{{ */
     if (rc->values_num > 0)
       non_empty++;
 
-    for (int i = 0; i < rc->values_num; i++)
-      sfree(rc->values[i]);
-    sfree(rc->values);
+    rrd_cache_values_free(rc->values, rc->values_num);
     sfree(rc);
   }
 
@@ -899,6 +1030,28 @@ static int rrd_config(const char *key, const char *value) {
       rrdcreate_config.async = 1;
     else
       rrdcreate_config.async = 0;
+  } else if (strcasecmp("CreateFilesThreads", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp <= 0) {
+      fprintf(stderr, "rrdtool: `CreateFilesThreads' must "
+                      "be greater than 0.\n");
+      ERROR("rrdtool: `CreateFilesThreads' must "
+            "be greater than 0.\n");
+      return 1;
+    }
+    rrdcreate_config.async_threads = tmp;
+  } else if (strcasecmp("CreateFilesRate", key) == 0) {
+    double tmp = atof(value);
+    if (tmp < 0.0) {
+      fprintf(stderr, "rrdtool: `CreateFilesRate' must "
+                      "not be negative.\n");
+      ERROR("rrdtool: `CreateFilesRate' must "
+            "not be negative.\n");
+      return 1;
+    }
+    rrdcreate_config.create_rate = tmp;
+  } else if (strcasecmp("CreateFilesPreallocate", key) == 0) {
+    rrdcreate_config.preallocate = IS_TRUE(value);
   } else if (strcasecmp("RRARows", key) == 0) {
     int tmp = atoi(value);
     if (tmp <= 0) {
@@ -966,6 +1119,28 @@ static int rrd_config(const char *key, const char *value) {
     } else {
       write_rate = 1.0 / wps;
     }
+  } else if (strcasecmp("WriteThreads", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 1) {
+      ERROR("rrdtool plugin: `WriteThreads' must be at least 1.");
+      return 1;
+    }
+    write_threads_num = (size_t)tmp;
+  } else if (strcasecmp("ReportStats", key) == 0) {
+    report_stats = IS_TRUE(value);
+  } else if (strcasecmp("AdaptiveCacheTimeout", key) == 0) {
+    adaptive_timeout = IS_TRUE(value);
+  } else if ((strcasecmp("CacheTimeoutMin", key) == 0) ||
+             (strcasecmp("CacheTimeoutMax", key) == 0)) {
+    double tmp = atof(value);
+    if (tmp <= 0) {
+      ERROR("rrdtool plugin: `%s' must be greater than 0.", key);
+      return 1;
+    }
+    if (strcasecmp("CacheTimeoutMin", key) == 0)
+      cache_timeout_min = DOUBLE_TO_CDTIME_T(tmp);
+    else
+      cache_timeout_max = DOUBLE_TO_CDTIME_T(tmp);
   } else if (strcasecmp("RandomTimeout", key) == 0) {
     double tmp;
 
@@ -989,32 +1164,109 @@ static int rrd_shutdown(void) {
   rrd_cache_flush(0);
   pthread_mutex_unlock(&cache_lock);
 
-  pthread_mutex_lock(&queue_lock);
-  do_shutdown = 1;
-  pthread_cond_signal(&queue_cond);
-  pthread_mutex_unlock(&queue_lock);
-
-  if ((queue_thread_running != 0) &&
-      ((queue_head != NULL) || (flushq_head != NULL))) {
-    INFO("rrdtool plugin: Shutting down the queue thread. "
-         "This may take a while.");
-  } else if (queue_thread_running != 0) {
-    INFO("rrdtool plugin: Shutting down the queue thread.");
+  size_t queue_length = 0;
+  size_t running = 0;
+  for (size_t i = 0; i < queue_threads_num; i++) {
+    rrd_queue_thread_t *qt = queue_threads + i;
+
+    pthread_mutex_lock(&qt->lock);
+    do_shutdown = 1;
+    queue_length += qt->queue_length;
+    if (qt->running)
+      running++;
+    pthread_cond_signal(&qt->cond);
+    pthread_mutex_unlock(&qt->lock);
+  }
+
+  if ((running > 0) && (queue_length > 0)) {
+    INFO("rrdtool plugin: Shutting down %" PRIsz " queue thread%s. "
+         "This may take a while.",
+         running, (running == 1) ? "" : "s");
+  } else if (running > 0) {
+    INFO("rrdtool plugin: Shutting down %" PRIsz " queue thread%s.", running,
+         (running == 1) ? "" : "s");
   }
 
   /* Wait for all the values to be written to disk before returning. */
-  if (queue_thread_running != 0) {
-    pthread_join(queue_thread, NULL);
-    memset(&queue_thread, 0, sizeof(queue_thread));
-    queue_thread_running = 0;
-    DEBUG("rrdtool plugin: queue_thread exited.");
+  for (size_t i = 0; i < queue_threads_num; i++) {
+    rrd_queue_thread_t *qt = queue_threads + i;
+
+    if (!qt->running)
+      continue;
+
+    pthread_join(qt->thread, NULL);
+    memset(&qt->thread, 0, sizeof(qt->thread));
+    qt->running = false;
+    DEBUG("rrdtool plugin: queue thread %" PRIsz " exited.", i);
   }
 
   rrd_cache_destroy();
+  cu_rrd_create_shutdown();
+
+  for (size_t i = 0; i < queue_threads_num; i++) {
+    pthread_mutex_destroy(&queue_threads[i].lock);
+    pthread_cond_destroy(&queue_threads[i].cond);
+  }
+  sfree(queue_threads);
+  queue_threads_num = 0;
 
   return 0;
 } /* int rrd_shutdown */
 
+static int rrd_stats_read(void) {
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t value;
+
+  vl.values = &value;
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "rrdtool", sizeof(vl.plugin));
+
+  cdtime_t now = cdtime();
+
+  for (size_t i = 0; i < queue_threads_num; i++) {
+    rrd_queue_thread_t *qt = queue_threads + i;
+    cdtime_t oldest = now;
+
+    pthread_mutex_lock(&qt->lock);
+    value.gauge = (gauge_t)qt->queue_length;
+    if ((qt->queue_head != NULL) && (qt->queue_head->queued < oldest))
+      oldest = qt->queue_head->queued;
+    if ((qt->flushq_head != NULL) && (qt->flushq_head->queued < oldest))
+      oldest = qt->flushq_head->queued;
+    pthread_mutex_unlock(&qt->lock);
+
+    sstrncpy(vl.type, "queue_length", sizeof(vl.type));
+    snprintf(vl.type_instance, sizeof(vl.type_instance), "thread%" PRIsz, i);
+    plugin_dispatch_values(&vl);
+
+    /* Time the oldest queued file has been waiting to be written. */
+    value.gauge = CDTIME_T_TO_DOUBLE(now - oldest);
+    sstrncpy(vl.type, "duration", sizeof(vl.type));
+    snprintf(vl.type_instance, sizeof(vl.type_instance),
+             "queue_age-thread%" PRIsz, i);
+    plugin_dispatch_values(&vl);
+  }
+
+  if (adaptive_timeout) {
+    pthread_mutex_lock(&cache_lock);
+    cdtime_t timeout = cache_timeout_effective;
+    cdtime_t latency = update_latency;
+    pthread_mutex_unlock(&cache_lock);
+
+    value.gauge = CDTIME_T_TO_DOUBLE(timeout);
+    sstrncpy(vl.type, "duration", sizeof(vl.type));
+    sstrncpy(vl.type_instance, "cache_timeout", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+
+    value.gauge = CDTIME_T_TO_DOUBLE(latency);
+    sstrncpy(vl.type, "latency", sizeof(vl.type));
+    sstrncpy(vl.type_instance, "update", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+  }
+
+  return 0;
+} /* int rrd_stats_read */
+
 static int rrd_init(void) {
   static int init_once;
 
@@ -1022,9 +1274,30 @@ static int rrd_init(void) {
     return 0;
   init_once = 1;
 
+  cache_memstat = memstat_get("rrdtool_cache");
+
   if (rrdcreate_config.heartbeat <= 0)
     rrdcreate_config.heartbeat = 2 * rrdcreate_config.stepsize;
 
+#if !HAVE_THREADSAFE_LIBRRD
+  if (write_threads_num > 1)
+    WARNING("rrdtool plugin: librrd is not thread-safe, so the updates of "
+            "the %" PRIsz " write threads will be serialized.",
+            write_threads_num);
+#endif
+
+  /* The queues must exist before the cache, which enqueues files. */
+  queue_threads = calloc(write_threads_num, sizeof(*queue_threads));
+  if (queue_threads == NULL) {
+    ERROR("rrdtool plugin: calloc failed.");
+    return -1;
+  }
+  queue_threads_num = write_threads_num;
+  for (size_t i = 0; i < queue_threads_num; i++) {
+    pthread_mutex_init(&queue_threads[i].lock, /* attr = */ NULL);
+    pthread_cond_init(&queue_threads[i].cond, /* attr = */ NULL);
+  }
+
   /* Set the cache up */
   pthread_mutex_lock(&cache_lock);
 
@@ -1036,6 +1309,34 @@ static int rrd_init(void) {
   }
 
   cache_flush_last = cdtime();
+  if ((cache_timeout == 0) && adaptive_timeout) {
+    WARNING("rrdtool plugin: \"AdaptiveCacheTimeout\" requires "
+            "\"CacheTimeout\" to be set. Disabling it.");
+    adaptive_timeout = false;
+  }
+
+  if (adaptive_timeout) {
+    if (cache_timeout_min == 0)
+      cache_timeout_min = cache_timeout / 4;
+    if (cache_timeout_max == 0)
+      cache_timeout_max = 10 * cache_timeout;
+    if (cache_timeout_min > cache_timeout_max) {
+      WARNING("rrdtool plugin: \"CacheTimeoutMin\" is greater than "
+              "\"CacheTimeoutMax\". Adjusting \"CacheTimeoutMax\" to %.3f "
+              "seconds.",
+              CDTIME_T_TO_DOUBLE(cache_timeout_min));
+      cache_timeout_max = cache_timeout_min;
+    }
+  } else {
+    cache_timeout_min = cache_timeout_max = cache_timeout;
+  }
+
+  cache_timeout_effective = cache_timeout;
+  if (cache_timeout_effective < cache_timeout_min)
+    cache_timeout_effective = cache_timeout_min;
+  else if (cache_timeout_effective > cache_timeout_max)
+    cache_timeout_effective = cache_timeout_max;
+
   if (cache_timeout == 0) {
     random_timeout = 0;
     cache_flush_timeout = 0;
@@ -1049,22 +1350,34 @@ static int rrd_init(void) {
   }
 
   /* Assure that "cache_timeout + random_variation" is never negative. */
-  if (random_timeout > cache_timeout) {
+  if (random_timeout > cache_timeout_min) {
     INFO("rrdtool plugin: Adjusting \"RandomTimeout\" to %.3f seconds.",
-         CDTIME_T_TO_DOUBLE(cache_timeout));
-    random_timeout = cache_timeout;
+         CDTIME_T_TO_DOUBLE(cache_timeout_min));
+    random_timeout = cache_timeout_min;
   }
 
   pthread_mutex_unlock(&cache_lock);
 
-  int status =
-      plugin_thread_create(&queue_thread, /* attr = */ NULL, rrd_queue_thread,
-                           /* args = */ NULL, "rrdtool queue");
-  if (status != 0) {
-    ERROR("rrdtool plugin: Cannot create queue-thread.");
-    return -1;
+  for (size_t i = 0; i < queue_threads_num; i++) {
+    rrd_queue_thread_t *qt = queue_threads + i;
+    char name[16];
+
+    if (queue_threads_num == 1)
+      sstrncpy(name, "rrdtool queue", sizeof(name));
+    else
+      snprintf(name, sizeof(name), "rrdtool q#%" PRIsz, i);
+
+    int status = plugin_thread_create(&qt->thread, /* attr = */ NULL,
+                                      rrd_queue_thread, qt, name);
+    if (status != 0) {
+      ERROR("rrdtool plugin: Cannot create queue-thread.");
+      return -1;
+    }
+    qt->running = true;
   }
-  queue_thread_running = 1;
+
+  if (report_stats)
+    plugin_register_read("rrdtool", rrd_stats_read);
 
   DEBUG("rrdtool plugin: rrd_init: datadir = %s; stepsize = %lu;"
         " heartbeat = %i; rrarows = %i; xff = %lf;",
@@ -37,14 +37,61 @@
 #include <sys/capability.h>
 #endif
 
-static const char *config_keys[] = {"Disk", "IgnoreSelected", "IgnoreSleepMode",
-                                    "UseSerial"};
+static const char *config_keys[] = {"Disk",      "IgnoreSelected",
+                                    "IgnoreSleepMode", "UseSerial",
+                                    "RefreshInterval", "Timeout"};
 
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static ignorelist_t *ignorelist;
 static int ignore_sleep_mode;
 static int use_serial;
+static cdtime_t refresh_interval;
+static cdtime_t smart_timeout;
+
+/*
+ * Each disk is queried by its own worker thread, so a slow or hanging disk
+ * doesn't hold up the others. The read callback requests a refresh from the
+ * workers whose results are older than `refresh_interval', waits up to
+ * `smart_timeout' for them and dispatches the results of the last refresh of
+ * every disk. A disk which doesn't answer within `smart_timeout' is skipped
+ * until its worker returns.
+ */
+typedef struct {
+  char type[DATA_MAX_NAME_LEN];
+  char type_instance[DATA_MAX_NAME_LEN];
+  gauge_t values[4];
+  size_t values_num;
+} smart_value_t;
+
+typedef struct {
+  char const *name;
+  smart_value_t *values;
+  size_t values_num;
+} smart_result_t;
+
+typedef struct smart_disk_s {
+  char *dev;
+  char *name;
+
+  bool refresh; /* a refresh has been requested */
+  bool busy;    /* the worker is querying the disk */
+  bool timed_out;
+  bool seen; /* found by the last enumeration */
+  bool stop;
+  pthread_cond_t cond;
+  cdtime_t started;
+  cdtime_t last_refresh;
+
+  smart_value_t *values;
+  size_t values_num;
+
+  struct smart_disk_s *next;
+} smart_disk_t;
+
+static pthread_mutex_t smart_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t smart_done_cond = PTHREAD_COND_INITIALIZER;
+static smart_disk_t *smart_disks;
 
 static int smart_config(const char *key, const char *value) {
   if (ignorelist == NULL)
@@ -65,6 +112,20 @@ static int smart_config(const char *key, const char *value) {
   } else if (strcasecmp("UseSerial", key) == 0) {
     if (IS_TRUE(value))
       use_serial = 1;
+  } else if (strcasecmp("RefreshInterval", key) == 0) {
+    double t = atof(value);
+    if (t < 0.0) {
+      ERROR("smart plugin: RefreshInterval must not be negative.");
+      return 1;
+    }
+    refresh_interval = DOUBLE_TO_CDTIME_T(t);
+  } else if (strcasecmp("Timeout", key) == 0) {
+    double t = atof(value);
+    if (t <= 0.0) {
+      ERROR("smart plugin: Timeout must be a positive number.");
+      return 1;
+    }
+    smart_timeout = DOUBLE_TO_CDTIME_T(t);
   } else {
     return -1;
   }
@@ -72,43 +133,62 @@ static int smart_config(const char *key, const char *value) {
   return 0;
 } /* int smart_config */
 
-static void smart_submit(const char *dev, const char *type,
-                         const char *type_inst, double value) {
+static void smart_submit(smart_result_t *res, const char *type,
+                         const char *type_inst, gauge_t const *values,
+                         size_t values_num) {
+  smart_value_t *tmp =
+      realloc(res->values, (res->values_num + 1) * sizeof(*res->values));
+  if (tmp == NULL) {
+    ERROR("smart plugin: realloc failed.");
+    return;
+  }
+  res->values = tmp;
+
+  smart_value_t *v = res->values + res->values_num;
+  sstrncpy(v->type, type, sizeof(v->type));
+  sstrncpy(v->type_instance, type_inst, sizeof(v->type_instance));
+  memcpy(v->values, values, values_num * sizeof(*values));
+  v->values_num = values_num;
+  res->values_num++;
+}
+
+static void smart_dispatch(smart_disk_t const *disk) {
   value_list_t vl = VALUE_LIST_INIT;
+  value_t values[4];
 
-  vl.values = &(value_t){.gauge = value};
-  vl.values_len = 1;
   sstrncpy(vl.plugin, "smart", sizeof(vl.plugin));
-  sstrncpy(vl.plugin_instance, dev, sizeof(vl.plugin_instance));
-  sstrncpy(vl.type, type, sizeof(vl.type));
-  sstrncpy(vl.type_instance, type_inst, sizeof(vl.type_instance));
+  sstrncpy(vl.plugin_instance, disk->name, sizeof(vl.plugin_instance));
+
+  for (size_t i = 0; i < disk->values_num; i++) {
+    smart_value_t const *v = disk->values + i;
 
-  plugin_dispatch_values(&vl);
+    for (size_t j = 0; j < v->values_num; j++)
+      values[j].gauge = v->values[j];
+    vl.values = values;
+    vl.values_len = v->values_num;
+    sstrncpy(vl.type, v->type, sizeof(vl.type));
+    sstrncpy(vl.type_instance, v->type_instance, sizeof(vl.type_instance));
+
+    plugin_dispatch_values(&vl);
+  }
 }
 
 static void handle_attribute(SkDisk *d, const SkSmartAttributeParsedData *a,
                              void *userdata) {
-  char const *name = userdata;
+  smart_result_t *res = userdata;
+  char const *name = res->name;
 
   if (!a->current_value_valid || !a->worst_value_valid)
     return;
 
-  value_list_t vl = VALUE_LIST_INIT;
-  value_t values[] = {
-      {.gauge = a->current_value},
-      {.gauge = a->worst_value},
-      {.gauge = a->threshold_valid ? a->threshold : 0},
-      {.gauge = a->pretty_value},
+  gauge_t values[] = {
+      a->current_value,
+      a->worst_value,
+      a->threshold_valid ? a->threshold : 0,
+      a->pretty_value,
   };
-
-  vl.values = values;
-  vl.values_len = STATIC_ARRAY_SIZE(values);
-  sstrncpy(vl.plugin, "smart", sizeof(vl.plugin));
-  sstrncpy(vl.plugin_instance, name, sizeof(vl.plugin_instance));
-  sstrncpy(vl.type, "smart_attribute", sizeof(vl.type));
-  sstrncpy(vl.type_instance, a->name, sizeof(vl.type_instance));
-
-  plugin_dispatch_values(&vl);
+  smart_submit(res, "smart_attribute", a->name, values,
+               STATIC_ARRAY_SIZE(values));
 
   if (a->threshold_valid && a->current_value <= a->threshold) {
     notification_t notif = {NOTIF_WARNING,     cdtime(), "",  "", "smart", "",
@@ -123,7 +203,9 @@ static void handle_attribute(SkDisk *d, const SkSmartAttributeParsedData *a,
   }
 }
 
-static void smart_read_disk(SkDisk *d, char const *name) {
+static void smart_read_disk(SkDisk *d, smart_result_t *res) {
+  char const *name = res->name;
+
   SkBool available = FALSE;
   if (sk_disk_identify_is_available(d, &available) < 0 || !available) {
     DEBUG("smart plugin: disk %s cannot be identified.", name);
@@ -134,6 +216,8 @@ static void smart_read_disk(SkDisk *d, char const *name) {
     return;
   }
   if (!ignore_sleep_mode) {
+    /* CHECK POWER MODE doesn't spin up a drive in standby, but reading the
+     * SMART data would. */
     SkBool awake = FALSE;
     if (sk_disk_check_sleep_mode(d, &awake) < 0 || !awake) {
       DEBUG("smart plugin: disk %s is sleeping.", name);
@@ -153,37 +237,143 @@ static void smart_read_disk(SkDisk *d, char const *name) {
   /* Get some specific values */
   uint64_t value;
   if (sk_disk_smart_get_power_on(d, &value) >= 0)
-    smart_submit(name, "smart_poweron", "", ((gauge_t)value) / 1000.);
+    smart_submit(res, "smart_poweron", "",
+                 &(gauge_t){((gauge_t)value) / 1000.}, 1);
   else
     DEBUG("smart plugin: unable to get milliseconds since power on for %s.",
           name);
 
   if (sk_disk_smart_get_power_cycle(d, &value) >= 0)
-    smart_submit(name, "smart_powercycles", "", (gauge_t)value);
+    smart_submit(res, "smart_powercycles", "", &(gauge_t){(gauge_t)value}, 1);
   else
     DEBUG("smart plugin: unable to get number of power cycles for %s.", name);
 
   if (sk_disk_smart_get_bad(d, &value) >= 0)
-    smart_submit(name, "smart_badsectors", "", (gauge_t)value);
+    smart_submit(res, "smart_badsectors", "", &(gauge_t){(gauge_t)value}, 1);
   else
     DEBUG("smart plugin: unable to get number of bad sectors for %s.", name);
 
   if (sk_disk_smart_get_temperature(d, &value) >= 0)
-    smart_submit(name, "smart_temperature", "",
-                 ((gauge_t)value) / 1000. - 273.15);
+    smart_submit(res, "smart_temperature", "",
+                 &(gauge_t){((gauge_t)value) / 1000. - 273.15}, 1);
   else
     DEBUG("smart plugin: unable to get temperature for %s.", name);
 
   /* Grab all attributes */
-  if (sk_disk_smart_parse_attributes(d, handle_attribute, (void *)name) < 0) {
+  if (sk_disk_smart_parse_attributes(d, handle_attribute, res) < 0) {
     ERROR("smart plugin: unable to handle SMART attributes for %s.", name);
   }
 }
 
-static void smart_handle_disk(const char *dev, const char *serial) {
+static void smart_handle_disk(const char *dev, smart_result_t *res) {
   SkDisk *d = NULL;
+
+  DEBUG("smart plugin: checking SMART status of %s.", dev);
+  if (sk_disk_open(dev, &d) < 0) {
+    ERROR("smart plugin: unable to open %s.", dev);
+    return;
+  }
+
+  smart_read_disk(d, res);
+  sk_disk_free(d);
+}
+
+static void smart_disk_free(smart_disk_t *disk) {
+  if (disk == NULL)
+    return;
+
+  pthread_cond_destroy(&disk->cond);
+  sfree(disk->dev);
+  sfree(disk->name);
+  sfree(disk->values);
+  sfree(disk);
+}
+
+/* The worker owns its disk once it's taken off `smart_disks' and frees it
+ * when it exits. */
+static void *smart_disk_worker(void *arg) {
+  smart_disk_t *disk = arg;
+
+  pthread_mutex_lock(&smart_lock);
+  while (!disk->stop) {
+    if (!disk->refresh) {
+      pthread_cond_wait(&disk->cond, &smart_lock);
+      continue;
+    }
+
+    disk->refresh = false;
+    disk->busy = true;
+    disk->started = cdtime();
+    pthread_mutex_unlock(&smart_lock);
+
+    smart_result_t res = {.name = disk->name};
+    smart_handle_disk(disk->dev, &res);
+
+    pthread_mutex_lock(&smart_lock);
+    if (disk->timed_out)
+      INFO("smart plugin: disk %s answered after %.3f seconds.", disk->name,
+           CDTIME_T_TO_DOUBLE(cdtime() - disk->started));
+    disk->busy = false;
+    disk->timed_out = false;
+    disk->last_refresh = disk->started;
+    sfree(disk->values);
+    disk->values = res.values;
+    disk->values_num = res.values_num;
+    pthread_cond_broadcast(&smart_done_cond);
+  }
+  pthread_mutex_unlock(&smart_lock);
+
+  smart_disk_free(disk);
+  return NULL;
+}
+
+/* Must be called with smart_lock held */
+static smart_disk_t *smart_disk_get(char const *dev, char const *name) {
+  for (smart_disk_t *disk = smart_disks; disk != NULL; disk = disk->next)
+    if ((strcmp(disk->dev, dev) == 0) && (strcmp(disk->name, name) == 0))
+      return disk;
+
+  smart_disk_t *disk = calloc(1, sizeof(*disk));
+  if (disk == NULL) {
+    ERROR("smart plugin: calloc failed.");
+    return NULL;
+  }
+  disk->dev = strdup(dev);
+  disk->name = strdup(name);
+  if ((disk->dev == NULL) || (disk->name == NULL)) {
+    ERROR("smart plugin: strdup failed.");
+    sfree(disk->dev);
+    sfree(disk->name);
+    sfree(disk);
+    return NULL;
+  }
+  pthread_cond_init(&disk->cond, /* attr = */ NULL);
+
+  pthread_t thread;
+  int status = plugin_thread_create(&thread, /* attr = */ NULL,
+                                    smart_disk_worker, disk, "smart disk");
+  if (status != 0) {
+    ERROR("smart plugin: Starting worker thread for %s failed: %s", dev,
+          STRERROR(status));
+    smart_disk_free(disk);
+    return NULL;
+  }
+  /* a worker stuck in an ioctl() can't be joined */
+  pthread_detach(thread);
+
+  disk->next = smart_disks;
+  smart_disks = disk;
+  return disk;
+}
+
+/* Must be called with smart_lock held */
+static void smart_disk_update(char const *dev, char const *serial,
+                              cdtime_t now) {
   const char *name;
 
+  if (dev == NULL)
+    return;
+
   if (use_serial && serial) {
     name = serial;
   } else {
@@ -197,14 +387,55 @@ static void smart_handle_disk(const char *dev, const char *serial) {
     return;
   }
 
-  DEBUG("smart plugin: checking SMART status of %s.", dev);
-  if (sk_disk_open(dev, &d) < 0) {
-    ERROR("smart plugin: unable to open %s.", dev);
+  smart_disk_t *disk = smart_disk_get(dev, name);
+  if (disk == NULL)
     return;
-  }
 
-  smart_read_disk(d, name);
-  sk_disk_free(d);
+  disk->seen = true;
+  if (disk->busy || disk->refresh)
+    return;
+  if ((disk->last_refresh != 0) &&
+      (now < disk->last_refresh + refresh_interval))
+    return;
+
+  disk->refresh = true;
+  pthread_cond_signal(&disk->cond);
+}
+
+/* Waits up to `smart_timeout' for the requested refreshes. Must be called
+ * with smart_lock held. */
+static void smart_wait(void) {
+  cdtime_t timeout =
+      (smart_timeout > 0) ? smart_timeout : plugin_get_interval();
+  cdtime_t deadline = cdtime() + timeout;
+
+  while (42) {
+    bool pending = false;
+    cdtime_t now = cdtime();
+
+    for (smart_disk_t *disk = smart_disks; disk != NULL; disk = disk->next) {
+      if ((!disk->busy && !disk->refresh) || disk->timed_out)
+        continue;
+
+      if (now < deadline) {
+        pending = true;
+        continue;
+      }
+
+      WARNING("smart plugin: disk %s timed out. It is skipped until it "
+              "answers.",
+              disk->name);
+      disk->timed_out = true;
+      sfree(disk->values);
+      disk->values_num = 0;
+    }
+
+    if (!pending)
+      break;
+
+    struct timespec ts = CDTIME_T_TO_TIMESPEC(deadline);
+    pthread_cond_timedwait(&smart_done_cond, &smart_lock, &ts);
+  }
 }
 
 static int smart_read(void) {
@@ -219,6 +450,12 @@ static int smart_read(void) {
     ERROR("smart plugin: unable to initialize udev.");
     return -1;
   }
+
+  cdtime_t now = cdtime();
+  pthread_mutex_lock(&smart_lock);
+  for (smart_disk_t *disk = smart_disks; disk != NULL; disk = disk->next)
+    disk->seen = false;
+
   enumerate = udev_enumerate_new(handle_udev);
   udev_enumerate_add_match_subsystem(enumerate, "block");
   udev_enumerate_add_match_property(enumerate, "DEVTYPE", "disk");
@@ -232,13 +469,38 @@ static int smart_read(void) {
     serial = udev_device_get_property_value(dev, "ID_SERIAL");
 
     /* Query status with libatasmart */
-    smart_handle_disk(devpath, serial);
+    smart_disk_update(devpath, serial, now);
     udev_device_unref(dev);
   }
 
   udev_enumerate_unref(enumerate);
   udev_unref(handle_udev);
 
+  smart_wait();
+
+  smart_disk_t *prev = NULL;
+  smart_disk_t *disk = smart_disks;
+  while (disk != NULL) {
+    smart_disk_t *next = disk->next;
+
+    if (!disk->seen) {
+      /* The disk is gone, let its worker exit. */
+      if (prev == NULL)
+        smart_disks = next;
+      else
+        prev->next = next;
+      disk->stop = true;
+      pthread_cond_signal(&disk->cond);
+    } else {
+      if (!disk->timed_out)
+        smart_dispatch(disk);
+      prev = disk;
+    }
+
+    disk = next;
+  }
+  pthread_mutex_unlock(&smart_lock);
+
   return 0;
 } /* int smart_read */
 
@@ -259,8 +521,23 @@ static int smart_init(void) {
   return 0;
 } /* int smart_init */
 
+static int smart_shutdown(void) {
+  pthread_mutex_lock(&smart_lock);
+  while (smart_disks != NULL) {
+    smart_disk_t *disk = smart_disks;
+    smart_disks = disk->next;
+    /* Workers stuck talking to a disk exit whenever the call returns. */
+    disk->stop = true;
+    pthread_cond_signal(&disk->cond);
+  }
+  pthread_mutex_unlock(&smart_lock);
+
+  return 0;
+} /* int smart_shutdown */
+
 void module_register(void) {
   plugin_register_config("smart", smart_config, config_keys, config_keys_num);
   plugin_register_init("smart", smart_init);
   plugin_register_read("smart", smart_read);
+  plugin_register_shutdown("smart", smart_shutdown);
 } /* void module_register */
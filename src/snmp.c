@@ -35,6 +35,7 @@
 #include <net-snmp/net-snmp-includes.h>
 
 #include <fnmatch.h>
+#include <sys/select.h>
 
 /*
  * Private data structes
@@ -71,6 +72,10 @@ struct data_definition_s {
   char **ignores;
   size_t ignores_len;
   bool invert_match;
+  /* When non-zero, the instance columns of a table are only walked this
+   * often; polls in between fetch the value columns of the known rows. */
+  cdtime_t instance_cache_interval;
+  oid_t last_change_oid;
 };
 typedef struct data_definition_s data_definition_t;
 
@@ -99,6 +104,16 @@ struct host_definition_s {
   c_complain_t complaint;
   data_definition_t **data_list;
   int data_list_len;
+
+  /* Upper bound for GETBULK's max-repetitions; zero selects GETNEXT.
+   * `bulk_size' is the current value, adapted to what the agent handles. */
+  int max_repetitions;
+  int bulk_size;
+  bool async;
+  bool report_duration;
+
+  /* One entry per `data_list' element, allocated on first use. */
+  struct csnmp_table_cache_s *table_cache;
 };
 typedef struct host_definition_s host_definition_t;
 
@@ -118,6 +133,23 @@ struct csnmp_cell_value_s {
 };
 typedef struct csnmp_cell_value_s csnmp_cell_value_t;
 
+/* Instance columns of a table, kept from the last complete walk. `rows' holds
+ * the suffixes whose values are fetched while the cache is valid. */
+struct csnmp_table_cache_s {
+  bool valid;
+  cdtime_t last_refresh;
+  csnmp_cell_char_t *type_instance_cells;
+  csnmp_cell_char_t *plugin_instance_cells;
+  csnmp_cell_char_t *hostname_cells;
+  csnmp_cell_char_t *filter_cells;
+  oid_t *rows;
+  size_t rows_num;
+  /* Last value of the data's `LastChangeOID'. */
+  bool last_change_known;
+  gauge_t last_change;
+};
+typedef struct csnmp_table_cache_s csnmp_table_cache_t;
+
 typedef enum {
   OID_TYPE_SKIP = 0,
   OID_TYPE_VARIABLE,
@@ -127,10 +159,69 @@ typedef enum {
   OID_TYPE_FILTER,
 } csnmp_oid_type_t;
 
+/* State of reading one `Data' block from a host. Tables are walked with a
+ * sequence of GETNEXT or GETBULK requests, other values are read with a
+ * single GET. */
+struct csnmp_walk_s {
+  host_definition_t *host;
+  data_definition_t *data;
+  const data_set_t *ds;
+
+  /* Holds the last OID returned by the device for each column. We use this in
+   * the next request to proceed. */
+  oid_t *oid_list;
+  /* Set to zero when an OID has left its subtree so we don't re-request it
+   * again. */
+  csnmp_oid_type_t *oid_list_todo;
+  size_t oid_list_len;
+  /* Maps the variables of the outstanding request to `oid_list'. */
+  size_t *var_idx;
+  size_t var_num;
+  /* max-repetitions of the outstanding request; zero for GETNEXT. */
+  int bulk;
+
+  /* Set while the instance cells come from `cache'. Values are then fetched
+   * with GET requests for `rows_sent' rows at a time, starting at
+   * `row_next'. */
+  csnmp_table_cache_t *cache;
+  bool cached;
+  size_t row_next;
+  size_t rows_sent;
+  size_t get_rows;
+  bool change_sent;
+  bool change_checked;
+
+  /* `value_cells_head' and `value_cells_tail' implement a linked list for each
+   * value. The `*_cells_head' and `*_cells_tail' pairs implement linked lists
+   * of instance names. This is used to jump gaps in the table. */
+  csnmp_cell_char_t *type_instance_cells_head;
+  csnmp_cell_char_t *type_instance_cells_tail;
+  csnmp_cell_char_t *plugin_instance_cells_head;
+  csnmp_cell_char_t *plugin_instance_cells_tail;
+  csnmp_cell_char_t *hostname_cells_head;
+  csnmp_cell_char_t *hostname_cells_tail;
+  csnmp_cell_char_t *filter_cells_head;
+  csnmp_cell_char_t *filter_cells_tail;
+  csnmp_cell_value_t **value_cells_head;
+  csnmp_cell_value_t **value_cells_tail;
+
+  bool pending;
+  bool timed_out;
+  bool done;
+  int status;
+};
+typedef struct csnmp_walk_s csnmp_walk_t;
+
+/* Number of variables in the GET requests for cached table rows. */
+#define CSNMP_CACHE_GET_VARS 48
+
 /*
  * Private variables
  */
 static data_definition_t *data_head;
+/* Data definitions replaced when the configuration was reloaded. Hosts still
+ * being read may use them, so they are only freed on shutdown. */
+static data_definition_t *data_retired;
 
 /*
  * Prototypes
@@ -187,6 +278,29 @@ static void csnmp_host_close_session(host_definition_t *host) /* {{{ */
   host->sess_handle = NULL;
 } /* }}} void csnmp_host_close_session */
 
+static void csnmp_cells_free(csnmp_cell_char_t *head) {
+  while (head != NULL) {
+    csnmp_cell_char_t *next = head->next;
+    sfree(head);
+    head = next;
+  }
+}
+
+static void csnmp_table_cache_clear(csnmp_table_cache_t *cache) {
+  csnmp_cells_free(cache->type_instance_cells);
+  csnmp_cells_free(cache->plugin_instance_cells);
+  csnmp_cells_free(cache->hostname_cells);
+  csnmp_cells_free(cache->filter_cells);
+  sfree(cache->rows);
+
+  cache->type_instance_cells = NULL;
+  cache->plugin_instance_cells = NULL;
+  cache->hostname_cells = NULL;
+  cache->filter_cells = NULL;
+  cache->rows_num = 0;
+  cache->valid = false;
+} /* void csnmp_table_cache_clear */
+
 static void csnmp_host_definition_destroy(void *arg) /* {{{ */
 {
   host_definition_t *hd;
@@ -202,6 +316,12 @@ static void csnmp_host_definition_destroy(void *arg) /* {{{ */
 
   csnmp_host_close_session(hd);
 
+  if (hd->table_cache != NULL) {
+    for (int i = 0; i < hd->data_list_len; i++)
+      csnmp_table_cache_clear(hd->table_cache + i);
+    sfree(hd->table_cache);
+  }
+
   sfree(hd->name);
   sfree(hd->address);
   sfree(hd->community);
@@ -375,6 +495,23 @@ static int csnmp_config_add_data_filter_oid(data_definition_t *data,
   return 0;
 } /* int csnmp_config_add_data_filter_oid */
 
+static int csnmp_config_add_data_last_change_oid(data_definition_t *data,
+                                                 oconfig_item_t *ci) {
+  char buffer[DATA_MAX_NAME_LEN];
+  int status = cf_util_get_string_buffer(ci, buffer, sizeof(buffer));
+  if (status != 0)
+    return status;
+
+  data->last_change_oid.oid_len = MAX_OID_LEN;
+
+  if (!read_objid(buffer, data->last_change_oid.oid,
+                  &data->last_change_oid.oid_len)) {
+    ERROR("snmp plugin: read_objid (%s) failed.", buffer);
+    return -1;
+  }
+  return 0;
+} /* int csnmp_config_add_data_last_change_oid */
+
 static int csnmp_config_add_data(oconfig_item_t *ci) {
   data_definition_t *dd = calloc(1, sizeof(*dd));
   if (dd == NULL)
@@ -472,7 +609,11 @@ static int csnmp_config_add_data(oconfig_item_t *ci) {
       status = cf_util_get_boolean(option, &t);
       if (status == 0)
         ignorelist_set_invert(dd->ignorelist, /* invert = */ !t);
-    } else {
+    } else if (strcasecmp("InstanceCacheInterval", option->key) == 0)
+      status = cf_util_get_cdtime(option, &dd->instance_cache_interval);
+    else if (strcasecmp("LastChangeOID", option->key) == 0)
+      status = csnmp_config_add_data_last_change_oid(dd, option);
+    else {
       WARNING("snmp plugin: data %s: Option `%s' not allowed here.", dd->name,
               option->key);
       status = -1;
@@ -540,6 +681,12 @@ static int csnmp_config_add_data(oconfig_item_t *ci) {
             "set to `false'.",
             dd->name);
       }
+      if (dd->instance_cache_interval > 0) {
+        WARNING("snmp plugin: data %s: Option `InstanceCacheInterval' is "
+                "ignored when `Table' set to `false'.",
+                dd->name);
+        dd->instance_cache_interval = 0;
+      }
     }
 
     if (dd->type == NULL) {
@@ -794,6 +941,12 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
       status = csnmp_config_add_host_security_level(hd, option);
     else if (strcasecmp("Context", option->key) == 0)
       status = cf_util_get_string(option, &hd->context);
+    else if (strcasecmp("MaxRepetitions", option->key) == 0)
+      status = cf_util_get_int(option, &hd->max_repetitions);
+    else if (strcasecmp("AsyncPolling", option->key) == 0)
+      status = cf_util_get_boolean(option, &hd->async);
+    else if (strcasecmp("ReportPollDuration", option->key) == 0)
+      status = cf_util_get_boolean(option, &hd->report_duration);
     else {
       WARNING(
           "snmp plugin: csnmp_config_add_host: Option `%s' not allowed here.",
@@ -806,6 +959,21 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
   } /* for (ci->children) */
 
   while (status == 0) {
+    if (hd->max_repetitions < 0) {
+      WARNING("snmp plugin: `MaxRepetitions' must not be negative for host "
+              "`%s'",
+              hd->name);
+      status = -1;
+      break;
+    }
+    if ((hd->max_repetitions > 0) && (hd->version == 1)) {
+      WARNING("snmp plugin: host `%s': SNMPv1 does not support GETBULK, "
+              "ignoring `MaxRepetitions'.",
+              hd->name);
+      hd->max_repetitions = 0;
+    }
+    hd->bulk_size = hd->max_repetitions;
+
     if (hd->address == NULL) {
       WARNING("snmp plugin: `Address' not given for host `%s'", hd->name);
       status = -1;
@@ -874,7 +1042,7 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
   snprintf(cb_name, sizeof(cb_name), "snmp-%s", hd->name);
 
   status = plugin_register_complex_read(
-      /* group = */ NULL, cb_name, csnmp_read_host, interval,
+      /* group = */ "snmp", cb_name, csnmp_read_host, interval,
       &(user_data_t){
           .data = hd, .free_func = csnmp_host_definition_destroy,
       });
@@ -1542,493 +1710,671 @@ static int csnmp_dispatch_table(host_definition_t *host,
   return (0);
 } /* int csnmp_dispatch_table */
 
-static int csnmp_read_table(host_definition_t *host, data_definition_t *data) {
-  struct snmp_pdu *req;
-  struct snmp_pdu *res = NULL;
-  struct variable_list *vb;
+static int csnmp_walk_init(csnmp_walk_t *w, host_definition_t *host,
+                           data_definition_t *data,
+                           csnmp_table_cache_t *cache) {
+  memset(w, 0, sizeof(*w));
+  w->host = host;
+  w->data = data;
+  w->cache = cache;
 
-  const data_set_t *ds;
+  w->ds = plugin_get_ds(data->type);
+  if (!w->ds) {
+    ERROR("snmp plugin: DataSet `%s' not defined.", data->type);
+    return -1;
+  }
 
-  size_t oid_list_len = data->values_len;
+  if (w->ds->ds_num != data->values_len) {
+    ERROR("snmp plugin: DataSet `%s' requires %" PRIsz
+          " values, but config talks "
+          "about %" PRIsz,
+          data->type, w->ds->ds_num, data->values_len);
+    return -1;
+  }
+  assert(data->values_len > 0);
+
+  if (!data->is_table)
+    return 0;
+
+  w->oid_list_len = data->values_len;
 
   if (data->type_instance.oid.oid_len > 0)
-    oid_list_len++;
+    w->oid_list_len++;
 
   if (data->plugin_instance.oid.oid_len > 0)
-    oid_list_len++;
+    w->oid_list_len++;
 
   if (data->host.oid.oid_len > 0)
-    oid_list_len++;
+    w->oid_list_len++;
 
   if (data->filter_oid.oid_len > 0)
-    oid_list_len++;
-
-  /* Holds the last OID returned by the device. We use this in the GETNEXT
-   * request to proceed. */
-  oid_t oid_list[oid_list_len];
-  /* Set to false when an OID has left its subtree so we don't re-request it
-   * again. */
-  csnmp_oid_type_t oid_list_todo[oid_list_len];
-
-  int status;
-  size_t i;
-
-  /* `value_list_head' and `value_cells_tail' implement a linked list for each
-   * value. `instance_cells_head' and `instance_cells_tail' implement a linked
-   * list of instance names. This is used to jump gaps in the table. */
-  csnmp_cell_char_t *type_instance_cells_head = NULL;
-  csnmp_cell_char_t *type_instance_cells_tail = NULL;
-  csnmp_cell_char_t *plugin_instance_cells_head = NULL;
-  csnmp_cell_char_t *plugin_instance_cells_tail = NULL;
-  csnmp_cell_char_t *hostname_cells_head = NULL;
-  csnmp_cell_char_t *hostname_cells_tail = NULL;
-  csnmp_cell_char_t *filter_cells_head = NULL;
-  csnmp_cell_char_t *filter_cells_tail = NULL;
-  csnmp_cell_value_t **value_cells_head;
-  csnmp_cell_value_t **value_cells_tail;
-
-  DEBUG("snmp plugin: csnmp_read_table (host = %s, data = %s)", host->name,
-        data->name);
-
-  if (host->sess_handle == NULL) {
-    DEBUG("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
-    return -1;
-  }
-
-  ds = plugin_get_ds(data->type);
-  if (!ds) {
-    ERROR("snmp plugin: DataSet `%s' not defined.", data->type);
-    return -1;
-  }
+    w->oid_list_len++;
 
-  if (ds->ds_num != data->values_len) {
-    ERROR("snmp plugin: DataSet `%s' requires %" PRIsz
-          " values, but config talks "
-          "about %" PRIsz,
-          data->type, ds->ds_num, data->values_len);
+  w->oid_list = calloc(w->oid_list_len, sizeof(*w->oid_list));
+  w->oid_list_todo = calloc(w->oid_list_len, sizeof(*w->oid_list_todo));
+  w->var_idx = calloc(w->oid_list_len, sizeof(*w->var_idx));
+  /* We're going to construct n linked lists, one for each "value".
+   * value_cells_head will contain pointers to the heads of these linked lists,
+   * value_cells_tail will contain pointers to the tail of the lists. */
+  w->value_cells_head = calloc(data->values_len, sizeof(*w->value_cells_head));
+  w->value_cells_tail = calloc(data->values_len, sizeof(*w->value_cells_tail));
+  if ((w->oid_list == NULL) || (w->oid_list_todo == NULL) ||
+      (w->var_idx == NULL) || (w->value_cells_head == NULL) ||
+      (w->value_cells_tail == NULL)) {
+    ERROR("snmp plugin: csnmp_walk_init: calloc failed.");
     return -1;
   }
-  assert(data->values_len > 0);
 
+  size_t i;
   for (i = 0; i < data->values_len; i++)
-    oid_list_todo[i] = OID_TYPE_VARIABLE;
+    w->oid_list_todo[i] = OID_TYPE_VARIABLE;
 
   /* We need a copy of all the OIDs, because GETNEXT will destroy them. */
-  memcpy(oid_list, data->values, data->values_len * sizeof(oid_t));
+  memcpy(w->oid_list, data->values, data->values_len * sizeof(oid_t));
 
   if (data->type_instance.oid.oid_len > 0) {
-    memcpy(oid_list + i, &data->type_instance.oid, sizeof(oid_t));
-    oid_list_todo[i] = OID_TYPE_TYPEINSTANCE;
+    memcpy(w->oid_list + i, &data->type_instance.oid, sizeof(oid_t));
+    w->oid_list_todo[i] = OID_TYPE_TYPEINSTANCE;
     i++;
   }
 
   if (data->plugin_instance.oid.oid_len > 0) {
-    memcpy(oid_list + i, &data->plugin_instance.oid, sizeof(oid_t));
-    oid_list_todo[i] = OID_TYPE_PLUGININSTANCE;
+    memcpy(w->oid_list + i, &data->plugin_instance.oid, sizeof(oid_t));
+    w->oid_list_todo[i] = OID_TYPE_PLUGININSTANCE;
     i++;
   }
 
   if (data->host.oid.oid_len > 0) {
-    memcpy(oid_list + i, &data->host.oid, sizeof(oid_t));
-    oid_list_todo[i] = OID_TYPE_HOST;
+    memcpy(w->oid_list + i, &data->host.oid, sizeof(oid_t));
+    w->oid_list_todo[i] = OID_TYPE_HOST;
     i++;
   }
 
   if (data->filter_oid.oid_len > 0) {
-    memcpy(oid_list + i, &data->filter_oid, sizeof(oid_t));
-    oid_list_todo[i] = OID_TYPE_FILTER;
+    memcpy(w->oid_list + i, &data->filter_oid, sizeof(oid_t));
+    w->oid_list_todo[i] = OID_TYPE_FILTER;
     i++;
   }
 
-  /* We're going to construct n linked lists, one for each "value".
-   * value_cells_head will contain pointers to the heads of these linked lists,
-   * value_cells_tail will contain pointers to the tail of the lists. */
-  value_cells_head = calloc(data->values_len, sizeof(*value_cells_head));
-  value_cells_tail = calloc(data->values_len, sizeof(*value_cells_tail));
-  if ((value_cells_head == NULL) || (value_cells_tail == NULL)) {
-    ERROR("snmp plugin: csnmp_read_table: calloc failed.");
-    sfree(value_cells_head);
-    sfree(value_cells_tail);
-    return -1;
+  if ((cache != NULL) && cache->valid &&
+      ((cdtime() - cache->last_refresh) < data->instance_cache_interval)) {
+    w->cached = true;
+    w->type_instance_cells_head = cache->type_instance_cells;
+    w->plugin_instance_cells_head = cache->plugin_instance_cells;
+    w->hostname_cells_head = cache->hostname_cells;
+    w->filter_cells_head = cache->filter_cells;
+    w->get_rows = CSNMP_CACHE_GET_VARS / data->values_len;
+    if (w->get_rows < 1)
+      w->get_rows = 1;
   }
 
-  status = 0;
-  while (status == 0) {
-    req = snmp_pdu_create(SNMP_MSG_GETNEXT);
-    if (req == NULL) {
-      ERROR("snmp plugin: snmp_pdu_create failed.");
-      status = -1;
-      break;
-    }
+  return 0;
+} /* int csnmp_walk_init */
+
+static void csnmp_walk_free_values(csnmp_walk_t *w) {
+  if (w->value_cells_head == NULL)
+    return;
 
-    size_t oid_list_todo_num = 0;
-    size_t var_idx[oid_list_len];
-    memset(var_idx, 0, sizeof(var_idx));
+  for (size_t i = 0; i < w->data->values_len; i++) {
+    while (w->value_cells_head[i] != NULL) {
+      csnmp_cell_value_t *next = w->value_cells_head[i]->next;
+      sfree(w->value_cells_head[i]);
+      w->value_cells_head[i] = next;
+    }
+    w->value_cells_tail[i] = NULL;
+  }
+} /* void csnmp_walk_free_values */
+
+/* Drops the cache of a walk and restarts it as a complete walk. Used when
+ * the cached rows no longer match the agent's table. */
+static void csnmp_walk_uncache(csnmp_walk_t *w, char const *reason) {
+  INFO("snmp plugin: host %s; data %s: %s, walking the table again.",
+        w->host->name, w->data->name, reason);
+
+  csnmp_walk_free_values(w);
+  w->type_instance_cells_head = NULL;
+  w->plugin_instance_cells_head = NULL;
+  w->hostname_cells_head = NULL;
+  w->filter_cells_head = NULL;
+
+  w->cache->valid = false;
+  w->cached = false;
+} /* void csnmp_walk_uncache */
+
+/* Keeps the instance cells of a complete walk and records the rows to fetch
+ * until the next refresh. Rows are those with a value in the first column and,
+ * if configured, a (not ignored) type instance. */
+static void csnmp_walk_store_cache(csnmp_walk_t *w) {
+  csnmp_table_cache_t *cache = w->cache;
+
+  csnmp_table_cache_clear(cache);
+
+  size_t rows_num = 0;
+  for (csnmp_cell_value_t *v = w->value_cells_head[0]; v != NULL; v = v->next)
+    rows_num++;
+
+  cache->rows = calloc(rows_num + 1, sizeof(*cache->rows));
+  if (cache->rows == NULL) {
+    ERROR("snmp plugin: csnmp_walk_store_cache: calloc failed.");
+    return;
+  }
 
-    for (i = 0; i < oid_list_len; i++) {
-      /* Do not rerequest already finished OIDs */
-      if (!oid_list_todo[i])
+  csnmp_cell_char_t *ti = w->type_instance_cells_head;
+  for (csnmp_cell_value_t *v = w->value_cells_head[0]; v != NULL;
+       v = v->next) {
+    if (w->type_instance_cells_head != NULL) {
+      while ((ti != NULL) && (csnmp_oid_compare(&ti->suffix, &v->suffix) < 0))
+        ti = ti->next;
+      if ((ti == NULL) || (csnmp_oid_compare(&ti->suffix, &v->suffix) != 0))
         continue;
-      snmp_add_null_var(req, oid_list[i].oid, oid_list[i].oid_len);
-      var_idx[oid_list_todo_num] = i;
-      oid_list_todo_num++;
     }
+    memcpy(cache->rows + cache->rows_num, &v->suffix, sizeof(v->suffix));
+    cache->rows_num++;
+  }
 
-    if (oid_list_todo_num == 0) {
-      /* The request is still empty - so we are finished */
-      DEBUG("snmp plugin: all variables have left their subtree");
-      snmp_free_pdu(req);
-      status = 0;
-      break;
-    }
+  cache->type_instance_cells = w->type_instance_cells_head;
+  cache->plugin_instance_cells = w->plugin_instance_cells_head;
+  cache->hostname_cells = w->hostname_cells_head;
+  cache->filter_cells = w->filter_cells_head;
+  w->type_instance_cells_head = NULL;
+  w->plugin_instance_cells_head = NULL;
+  w->hostname_cells_head = NULL;
+  w->filter_cells_head = NULL;
+
+  cache->last_refresh = cdtime();
+  cache->valid = true;
+} /* void csnmp_walk_store_cache */
+
+static void csnmp_walk_destroy(csnmp_walk_t *w) {
+  /* Cached instance cells are owned by the cache. */
+  if (w->cached) {
+    w->type_instance_cells_head = NULL;
+    w->plugin_instance_cells_head = NULL;
+    w->hostname_cells_head = NULL;
+    w->filter_cells_head = NULL;
+  }
 
-    res = NULL;
-    status = snmp_sess_synch_response(host->sess_handle, req, &res);
+  csnmp_cells_free(w->type_instance_cells_head);
+  csnmp_cells_free(w->plugin_instance_cells_head);
+  csnmp_cells_free(w->hostname_cells_head);
+  csnmp_cells_free(w->filter_cells_head);
+
+  csnmp_walk_free_values(w);
+
+  sfree(w->value_cells_head);
+  sfree(w->value_cells_tail);
+  sfree(w->oid_list);
+  sfree(w->oid_list_todo);
+  sfree(w->var_idx);
+} /* void csnmp_walk_destroy */
+
+/* Builds a GET for the value columns of the next `get_rows' cached rows. The
+ * first request also carries the `LastChangeOID', if configured. */
+static struct snmp_pdu *csnmp_walk_cached_pdu(csnmp_walk_t *w) {
+  data_definition_t *data = w->data;
+  csnmp_table_cache_t *cache = w->cache;
+  bool check_change = (data->last_change_oid.oid_len > 0) && !w->change_checked;
+
+  if ((w->row_next >= cache->rows_num) && !check_change) {
+    w->done = true;
+    return NULL;
+  }
 
-    /* snmp_sess_synch_response always frees our req PDU */
-    req = NULL;
+  struct snmp_pdu *req = snmp_pdu_create(SNMP_MSG_GET);
+  if (req == NULL) {
+    ERROR("snmp plugin: snmp_pdu_create failed.");
+    w->status = -1;
+    w->done = true;
+    return NULL;
+  }
 
-    if ((status != STAT_SUCCESS) || (res == NULL)) {
-      char *errstr = NULL;
+  w->change_sent = check_change;
+  if (check_change)
+    snmp_add_null_var(req, data->last_change_oid.oid,
+                      data->last_change_oid.oid_len);
 
-      snmp_sess_error(host->sess_handle, NULL, NULL, &errstr);
+  w->rows_sent = cache->rows_num - w->row_next;
+  if (w->rows_sent > w->get_rows)
+    w->rows_sent = w->get_rows;
 
-      c_complain(LOG_ERR, &host->complaint,
-                 "snmp plugin: host %s: snmp_sess_synch_response failed: %s",
-                 host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+  for (size_t r = w->row_next; r < w->row_next + w->rows_sent; r++) {
+    oid_t *suffix = cache->rows + r;
 
-      if (res != NULL)
-        snmp_free_pdu(res);
-      res = NULL;
+    for (size_t i = 0; i < data->values_len; i++) {
+      oid_t o;
 
-      sfree(errstr);
-      csnmp_host_close_session(host);
+      if (data->values[i].oid_len + suffix->oid_len > MAX_OID_LEN) {
+        ERROR("snmp plugin: host %s; data %s: OID too long.", w->host->name,
+              data->name);
+        snmp_free_pdu(req);
+        w->status = -1;
+        w->done = true;
+        return NULL;
+      }
 
-      status = -1;
-      break;
+      memcpy(o.oid, data->values[i].oid,
+             sizeof(oid) * data->values[i].oid_len);
+      memcpy(o.oid + data->values[i].oid_len, suffix->oid,
+             sizeof(oid) * suffix->oid_len);
+      o.oid_len = data->values[i].oid_len + suffix->oid_len;
+
+      snmp_add_null_var(req, o.oid, o.oid_len);
     }
+  }
 
-    status = 0;
-    assert(res != NULL);
-    c_release(LOG_INFO, &host->complaint,
-              "snmp plugin: host %s: snmp_sess_synch_response successful.",
-              host->name);
+  return req;
+} /* struct snmp_pdu *csnmp_walk_cached_pdu */
 
-    vb = res->variables;
-    if (vb == NULL) {
-      status = -1;
-      break;
-    }
+/* Builds the next request of a walk. Returns NULL and sets `done' when there
+ * is nothing left to request or on failure. */
+static struct snmp_pdu *csnmp_walk_next_pdu(csnmp_walk_t *w) {
+  host_definition_t *host = w->host;
+  data_definition_t *data = w->data;
+  struct snmp_pdu *req;
 
-    if (res->errstat != SNMP_ERR_NOERROR) {
-      if (res->errindex != 0) {
-        /* Find the OID which caused error */
-        for (i = 1, vb = res->variables; vb != NULL && i != res->errindex;
-             vb = vb->next_variable, i++)
-          /* do nothing */;
-      }
+  if (!data->is_table) {
+    req = snmp_pdu_create(SNMP_MSG_GET);
+    if (req == NULL) {
+      ERROR("snmp plugin: snmp_pdu_create failed.");
+      w->status = -1;
+      w->done = true;
+      return NULL;
+    }
 
-      if ((res->errindex == 0) || (vb == NULL)) {
-        ERROR("snmp plugin: host %s; data %s: response error: %s (%li) ",
-              host->name, data->name, snmp_errstring(res->errstat),
-              res->errstat);
-        status = -1;
-        break;
-      }
+    for (size_t i = 0; i < data->values_len; i++)
+      snmp_add_null_var(req, data->values[i].oid, data->values[i].oid_len);
 
-      char oid_buffer[1024] = {0};
-      snprint_objid(oid_buffer, sizeof(oid_buffer) - 1, vb->name,
-                    vb->name_length);
-      NOTICE("snmp plugin: host %s; data %s: OID `%s` failed: %s", host->name,
-             data->name, oid_buffer, snmp_errstring(res->errstat));
+    return req;
+  }
 
-      /* Get value index from todo list and skip OID found */
-      assert(res->errindex <= oid_list_todo_num);
-      i = var_idx[res->errindex - 1];
-      assert(i < oid_list_len);
-      oid_list_todo[i] = 0;
+  if (w->cached)
+    return csnmp_walk_cached_pdu(w);
 
-      snmp_free_pdu(res);
-      res = NULL;
+  w->var_num = 0;
+  for (size_t i = 0; i < w->oid_list_len; i++) {
+    /* Do not rerequest already finished OIDs */
+    if (!w->oid_list_todo[i])
       continue;
-    }
+    w->var_idx[w->var_num] = i;
+    w->var_num++;
+  }
 
-    for (vb = res->variables, i = 0; (vb != NULL);
-         vb = vb->next_variable, i++) {
-      /* Calculate value index from todo list */
-      while ((i < oid_list_len) && !oid_list_todo[i]) {
-        i++;
-      }
-      if (i >= oid_list_len) {
-        break;
-      }
+  if (w->var_num == 0) {
+    /* The request would be empty - so we are finished */
+    DEBUG("snmp plugin: all variables have left their subtree");
+    w->done = true;
+    return NULL;
+  }
 
-      /* An instance is configured and the res variable we process is the
-       * instance value */
-      if (oid_list_todo[i] == OID_TYPE_TYPEINSTANCE) {
-        if ((vb->type == SNMP_ENDOFMIBVIEW) ||
-            (snmp_oid_ncompare(data->type_instance.oid.oid,
-                               data->type_instance.oid.oid_len, vb->name,
-                               vb->name_length,
-                               data->type_instance.oid.oid_len) != 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; TypeInstance left its "
-                "subtree.",
-                host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+  /* SNMPv1 has no GETBULK; with it, the agent returns up to `bulk'
+   * successors of every requested column. */
+  w->bulk = (host->version != 1) ? host->bulk_size : 0;
 
-        /* Allocate a new `csnmp_cell_char_t', insert the instance name and
-         * add it to the list */
-        csnmp_cell_char_t *cell =
-            csnmp_get_char_cell(vb, &data->type_instance.oid, host, data);
-        if (cell == NULL) {
-          ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
-                host->name);
-          status = -1;
-          break;
-        }
+  req = snmp_pdu_create((w->bulk > 0) ? SNMP_MSG_GETBULK : SNMP_MSG_GETNEXT);
+  if (req == NULL) {
+    ERROR("snmp plugin: snmp_pdu_create failed.");
+    w->status = -1;
+    w->done = true;
+    return NULL;
+  }
 
-        if (csnmp_ignore_instance(cell, data)) {
-          sfree(cell);
-        } else {
-          csnmp_cell_replace_reserved_chars(cell);
+  if (w->bulk > 0) {
+    req->non_repeaters = 0;
+    req->max_repetitions = w->bulk;
+  }
 
-          DEBUG("snmp plugin: il->type_instance = `%s';", cell->value);
-          csnmp_cells_append(&type_instance_cells_head,
-                             &type_instance_cells_tail, cell);
-        }
-      } else if (oid_list_todo[i] == OID_TYPE_PLUGININSTANCE) {
-        if ((vb->type == SNMP_ENDOFMIBVIEW) ||
-            (snmp_oid_ncompare(data->plugin_instance.oid.oid,
-                               data->plugin_instance.oid.oid_len, vb->name,
-                               vb->name_length,
-                               data->plugin_instance.oid.oid_len) != 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; TypeInstance left its "
-                "subtree.",
-                host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+  for (size_t i = 0; i < w->var_num; i++) {
+    oid_t *o = w->oid_list + w->var_idx[i];
+    snmp_add_null_var(req, o->oid, o->oid_len);
+  }
 
-        /* Allocate a new `csnmp_cell_char_t', insert the instance name and
-         * add it to the list */
-        csnmp_cell_char_t *cell =
-            csnmp_get_char_cell(vb, &data->plugin_instance.oid, host, data);
-        if (cell == NULL) {
-          ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
-                host->name);
-          status = -1;
-          break;
-        }
+  return req;
+} /* struct snmp_pdu *csnmp_walk_next_pdu */
+
+/* Handles a single variable of a table response. `i' is the index of the
+ * column in `oid_list'. */
+static int csnmp_walk_table_vb(csnmp_walk_t *w, size_t i,
+                               struct variable_list *vb) {
+  host_definition_t *host = w->host;
+  data_definition_t *data = w->data;
+
+  /* An instance is configured and the res variable we process is the
+   * instance value */
+  if (w->oid_list_todo[i] == OID_TYPE_TYPEINSTANCE) {
+    if ((vb->type == SNMP_ENDOFMIBVIEW) ||
+        (snmp_oid_ncompare(data->type_instance.oid.oid,
+                           data->type_instance.oid.oid_len, vb->name,
+                           vb->name_length,
+                           data->type_instance.oid.oid_len) != 0)) {
+      DEBUG("snmp plugin: host = %s; data = %s; TypeInstance left its "
+            "subtree.",
+            host->name, data->name);
+      w->oid_list_todo[i] = 0;
+      return 0;
+    }
 
-        csnmp_cell_replace_reserved_chars(cell);
-
-        DEBUG("snmp plugin: il->plugin_instance = `%s';", cell->value);
-        csnmp_cells_append(&plugin_instance_cells_head,
-                           &plugin_instance_cells_tail, cell);
-      } else if (oid_list_todo[i] == OID_TYPE_HOST) {
-        if ((vb->type == SNMP_ENDOFMIBVIEW) ||
-            (snmp_oid_ncompare(data->host.oid.oid, data->host.oid.oid_len,
-                               vb->name, vb->name_length,
-                               data->host.oid.oid_len) != 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; Host left its subtree.",
-                host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+    /* Allocate a new `csnmp_cell_char_t', insert the instance name and
+     * add it to the list */
+    csnmp_cell_char_t *cell =
+        csnmp_get_char_cell(vb, &data->type_instance.oid, host, data);
+    if (cell == NULL) {
+      ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.", host->name);
+      return -1;
+    }
 
-        /* Allocate a new `csnmp_cell_char_t', insert the instance name and
-         * add it to the list */
-        csnmp_cell_char_t *cell =
-            csnmp_get_char_cell(vb, &data->host.oid, host, data);
-        if (cell == NULL) {
-          ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
-                host->name);
-          status = -1;
-          break;
-        }
+    if (csnmp_ignore_instance(cell, data)) {
+      sfree(cell);
+    } else {
+      csnmp_cell_replace_reserved_chars(cell);
 
-        csnmp_cell_replace_reserved_chars(cell);
-
-        DEBUG("snmp plugin: il->hostname = `%s';", cell->value);
-        csnmp_cells_append(&hostname_cells_head, &hostname_cells_tail, cell);
-      } else if (oid_list_todo[i] == OID_TYPE_FILTER) {
-        if ((vb->type == SNMP_ENDOFMIBVIEW) ||
-            (snmp_oid_ncompare(data->filter_oid.oid, data->filter_oid.oid_len,
-                               vb->name, vb->name_length,
-                               data->filter_oid.oid_len) != 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; Host left its subtree.",
-                host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+      DEBUG("snmp plugin: il->type_instance = `%s';", cell->value);
+      csnmp_cells_append(&w->type_instance_cells_head,
+                         &w->type_instance_cells_tail, cell);
+    }
+  } else if (w->oid_list_todo[i] == OID_TYPE_PLUGININSTANCE) {
+    if ((vb->type == SNMP_ENDOFMIBVIEW) ||
+        (snmp_oid_ncompare(data->plugin_instance.oid.oid,
+                           data->plugin_instance.oid.oid_len, vb->name,
+                           vb->name_length,
+                           data->plugin_instance.oid.oid_len) != 0)) {
+      DEBUG("snmp plugin: host = %s; data = %s; TypeInstance left its "
+            "subtree.",
+            host->name, data->name);
+      w->oid_list_todo[i] = 0;
+      return 0;
+    }
 
-        /* Allocate a new `csnmp_cell_char_t', insert the instance name and
-         * add it to the list */
-        csnmp_cell_char_t *cell =
-            csnmp_get_char_cell(vb, &data->filter_oid, host, data);
-        if (cell == NULL) {
-          ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
-                host->name);
-          status = -1;
-          break;
-        }
+    /* Allocate a new `csnmp_cell_char_t', insert the instance name and
+     * add it to the list */
+    csnmp_cell_char_t *cell =
+        csnmp_get_char_cell(vb, &data->plugin_instance.oid, host, data);
+    if (cell == NULL) {
+      ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.", host->name);
+      return -1;
+    }
 
-        csnmp_cell_replace_reserved_chars(cell);
-
-        DEBUG("snmp plugin: il->filter = `%s';", cell->value);
-        csnmp_cells_append(&filter_cells_head, &filter_cells_tail, cell);
-      } else /* The variable we are processing is a normal value */
-      {
-        assert(oid_list_todo[i] == OID_TYPE_VARIABLE);
-
-        csnmp_cell_value_t *vt;
-        oid_t vb_name;
-        oid_t suffix;
-        int ret;
-
-        csnmp_oid_init(&vb_name, vb->name, vb->name_length);
-
-        /* Calculate the current suffix. This is later used to check that the
-         * suffix is increasing. This also checks if we left the subtree */
-        ret = csnmp_oid_suffix(&suffix, &vb_name, data->values + i);
-        if (ret != 0) {
-          DEBUG("snmp plugin: host = %s; data = %s; i = %" PRIsz "; "
-                "Value probably left its subtree.",
-                host->name, data->name, i);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+    csnmp_cell_replace_reserved_chars(cell);
+
+    DEBUG("snmp plugin: il->plugin_instance = `%s';", cell->value);
+    csnmp_cells_append(&w->plugin_instance_cells_head,
+                       &w->plugin_instance_cells_tail, cell);
+  } else if (w->oid_list_todo[i] == OID_TYPE_HOST) {
+    if ((vb->type == SNMP_ENDOFMIBVIEW) ||
+        (snmp_oid_ncompare(data->host.oid.oid, data->host.oid.oid_len,
+                           vb->name, vb->name_length,
+                           data->host.oid.oid_len) != 0)) {
+      DEBUG("snmp plugin: host = %s; data = %s; Host left its subtree.",
+            host->name, data->name);
+      w->oid_list_todo[i] = 0;
+      return 0;
+    }
 
-        /* Make sure the OIDs returned by the agent are increasing. Otherwise
-         * our table matching algorithm will get confused. */
-        if ((value_cells_tail[i] != NULL) &&
-            (csnmp_oid_compare(&suffix, &value_cells_tail[i]->suffix) <= 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; i = %" PRIsz "; "
-                "Suffix is not increasing.",
-                host->name, data->name, i);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+    /* Allocate a new `csnmp_cell_char_t', insert the instance name and
+     * add it to the list */
+    csnmp_cell_char_t *cell =
+        csnmp_get_char_cell(vb, &data->host.oid, host, data);
+    if (cell == NULL) {
+      ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.", host->name);
+      return -1;
+    }
 
-        vt = calloc(1, sizeof(*vt));
-        if (vt == NULL) {
-          ERROR("snmp plugin: calloc failed.");
-          status = -1;
-          break;
-        }
+    csnmp_cell_replace_reserved_chars(cell);
+
+    DEBUG("snmp plugin: il->hostname = `%s';", cell->value);
+    csnmp_cells_append(&w->hostname_cells_head, &w->hostname_cells_tail, cell);
+  } else if (w->oid_list_todo[i] == OID_TYPE_FILTER) {
+    if ((vb->type == SNMP_ENDOFMIBVIEW) ||
+        (snmp_oid_ncompare(data->filter_oid.oid, data->filter_oid.oid_len,
+                           vb->name, vb->name_length,
+                           data->filter_oid.oid_len) != 0)) {
+      DEBUG("snmp plugin: host = %s; data = %s; Host left its subtree.",
+            host->name, data->name);
+      w->oid_list_todo[i] = 0;
+      return 0;
+    }
 
-        vt->value =
-            csnmp_value_list_to_value(vb, ds->ds[i].type, data->scale,
-                                      data->shift, host->name, data->name);
-        memcpy(&vt->suffix, &suffix, sizeof(vt->suffix));
-        vt->next = NULL;
-
-        if (value_cells_tail[i] == NULL)
-          value_cells_head[i] = vt;
-        else
-          value_cells_tail[i]->next = vt;
-        value_cells_tail[i] = vt;
-      }
+    /* Allocate a new `csnmp_cell_char_t', insert the instance name and
+     * add it to the list */
+    csnmp_cell_char_t *cell =
+        csnmp_get_char_cell(vb, &data->filter_oid, host, data);
+    if (cell == NULL) {
+      ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.", host->name);
+      return -1;
+    }
 
-      /* Copy OID to oid_list[i] */
-      memcpy(oid_list[i].oid, vb->name, sizeof(oid) * vb->name_length);
-      oid_list[i].oid_len = vb->name_length;
+    csnmp_cell_replace_reserved_chars(cell);
 
-    } /* for (vb = res->variables ...) */
+    DEBUG("snmp plugin: il->filter = `%s';", cell->value);
+    csnmp_cells_append(&w->filter_cells_head, &w->filter_cells_tail, cell);
+  } else /* The variable we are processing is a normal value */
+  {
+    assert(w->oid_list_todo[i] == OID_TYPE_VARIABLE);
+
+    csnmp_cell_value_t *vt;
+    oid_t vb_name;
+    oid_t suffix;
+    int ret;
+
+    csnmp_oid_init(&vb_name, vb->name, vb->name_length);
+
+    /* Calculate the current suffix. This is later used to check that the
+     * suffix is increasing. This also checks if we left the subtree */
+    ret = csnmp_oid_suffix(&suffix, &vb_name, data->values + i);
+    if (ret != 0) {
+      DEBUG("snmp plugin: host = %s; data = %s; i = %" PRIsz "; "
+            "Value probably left its subtree.",
+            host->name, data->name, i);
+      w->oid_list_todo[i] = 0;
+      return 0;
+    }
 
-    if (res != NULL)
-      snmp_free_pdu(res);
-    res = NULL;
-  } /* while (status == 0) */
+    /* Make sure the OIDs returned by the agent are increasing. Otherwise
+     * our table matching algorithm will get confused. */
+    if ((w->value_cells_tail[i] != NULL) &&
+        (csnmp_oid_compare(&suffix, &w->value_cells_tail[i]->suffix) <= 0)) {
+      DEBUG("snmp plugin: host = %s; data = %s; i = %" PRIsz "; "
+            "Suffix is not increasing.",
+            host->name, data->name, i);
+      w->oid_list_todo[i] = 0;
+      return 0;
+    }
 
-  if (res != NULL)
-    snmp_free_pdu(res);
-  res = NULL;
+    vt = calloc(1, sizeof(*vt));
+    if (vt == NULL) {
+      ERROR("snmp plugin: calloc failed.");
+      return -1;
+    }
 
-  if (status == 0)
-    csnmp_dispatch_table(host, data, type_instance_cells_head,
-                         plugin_instance_cells_head, hostname_cells_head,
-                         filter_cells_head, value_cells_head);
+    vt->value = csnmp_value_list_to_value(vb, w->ds->ds[i].type, data->scale,
+                                          data->shift, host->name, data->name);
+    memcpy(&vt->suffix, &suffix, sizeof(vt->suffix));
+    vt->next = NULL;
 
-  /* Free all allocated variables here */
-  while (type_instance_cells_head != NULL) {
-    csnmp_cell_char_t *next = type_instance_cells_head->next;
-    sfree(type_instance_cells_head);
-    type_instance_cells_head = next;
+    if (w->value_cells_tail[i] == NULL)
+      w->value_cells_head[i] = vt;
+    else
+      w->value_cells_tail[i]->next = vt;
+    w->value_cells_tail[i] = vt;
   }
 
-  while (plugin_instance_cells_head != NULL) {
-    csnmp_cell_char_t *next = plugin_instance_cells_head->next;
-    sfree(plugin_instance_cells_head);
-    plugin_instance_cells_head = next;
-  }
+  /* Copy OID to oid_list[i] */
+  memcpy(w->oid_list[i].oid, vb->name, sizeof(oid) * vb->name_length);
+  w->oid_list[i].oid_len = vb->name_length;
+
+  return 0;
+} /* int csnmp_walk_table_vb */
 
-  while (hostname_cells_head != NULL) {
-    csnmp_cell_char_t *next = hostname_cells_head->next;
-    sfree(hostname_cells_head);
-    hostname_cells_head = next;
+static void csnmp_walk_cached_response(csnmp_walk_t *w, struct snmp_pdu *res) {
+  host_definition_t *host = w->host;
+  data_definition_t *data = w->data;
+  csnmp_table_cache_t *cache = w->cache;
+  struct variable_list *vb = res->variables;
+
+  if ((res->errstat == SNMP_ERR_TOOBIG) && (w->get_rows > 1)) {
+    /* Retry the same rows in smaller requests. */
+    w->get_rows /= 2;
+    return;
   }
 
-  while (filter_cells_head != NULL) {
-    csnmp_cell_char_t *next = filter_cells_head->next;
-    sfree(filter_cells_head);
-    filter_cells_head = next;
+  if (res->errstat != SNMP_ERR_NOERROR) {
+    csnmp_walk_uncache(w, snmp_errstring(res->errstat));
+    return;
   }
 
-  for (i = 0; i < data->values_len; i++) {
-    while (value_cells_head[i] != NULL) {
-      csnmp_cell_value_t *next = value_cells_head[i]->next;
-      sfree(value_cells_head[i]);
-      value_cells_head[i] = next;
+  if (w->change_sent) {
+    if (vb == NULL) {
+      csnmp_walk_uncache(w, "short response");
+      return;
+    }
+
+    w->change_checked = true;
+    gauge_t last_change =
+        csnmp_value_list_to_value(vb, DS_TYPE_GAUGE, 1.0, 0.0, host->name,
+                                  data->name)
+            .gauge;
+    bool changed =
+        cache->last_change_known && (last_change != cache->last_change);
+
+    cache->last_change = last_change;
+    cache->last_change_known = true;
+    if (changed) {
+      csnmp_walk_uncache(w, "table changed");
+      return;
     }
+    vb = vb->next_variable;
   }
 
-  sfree(value_cells_head);
-  sfree(value_cells_tail);
+  for (size_t r = w->row_next; r < w->row_next + w->rows_sent; r++) {
+    for (size_t i = 0; i < data->values_len; i++) {
+      if (vb == NULL) {
+        csnmp_walk_uncache(w, "short response");
+        return;
+      }
 
-  return 0;
-} /* int csnmp_read_table */
+      /* The row is gone. */
+      if ((vb->type == SNMP_NOSUCHOBJECT) ||
+          (vb->type == SNMP_NOSUCHINSTANCE) ||
+          (vb->type == SNMP_ENDOFMIBVIEW)) {
+        csnmp_walk_uncache(w, "row disappeared");
+        return;
+      }
 
-static int csnmp_read_value(host_definition_t *host, data_definition_t *data) {
-  struct snmp_pdu *req;
-  struct snmp_pdu *res = NULL;
-  struct variable_list *vb;
+      csnmp_cell_value_t *vt = calloc(1, sizeof(*vt));
+      if (vt == NULL) {
+        ERROR("snmp plugin: calloc failed.");
+        w->status = -1;
+        w->done = true;
+        return;
+      }
 
-  const data_set_t *ds;
-  value_list_t vl = VALUE_LIST_INIT;
+      vt->value =
+          csnmp_value_list_to_value(vb, w->ds->ds[i].type, data->scale,
+                                    data->shift, host->name, data->name);
+      memcpy(&vt->suffix, cache->rows + r, sizeof(vt->suffix));
 
-  int status;
-  size_t i;
+      if (w->value_cells_tail[i] == NULL)
+        w->value_cells_head[i] = vt;
+      else
+        w->value_cells_tail[i]->next = vt;
+      w->value_cells_tail[i] = vt;
+
+      vb = vb->next_variable;
+    }
+  }
 
-  DEBUG("snmp plugin: csnmp_read_value (host = %s, data = %s)", host->name,
-        data->name);
+  w->row_next += w->rows_sent;
+} /* void csnmp_walk_cached_response */
 
-  if (host->sess_handle == NULL) {
-    DEBUG("snmp plugin: csnmp_read_value: host->sess_handle == NULL");
-    return -1;
+static void csnmp_walk_table_response(csnmp_walk_t *w, struct snmp_pdu *res) {
+  host_definition_t *host = w->host;
+  data_definition_t *data = w->data;
+  struct variable_list *vb;
+
+  if ((res->errstat == SNMP_ERR_TOOBIG) && (w->bulk > 1)) {
+    /* Retry the same request with fewer repetitions. */
+    host->bulk_size = w->bulk / 2;
+    DEBUG("snmp plugin: host %s: response too big, reducing MaxRepetitions "
+          "to %d.",
+          host->name, host->bulk_size);
+    return;
   }
 
-  ds = plugin_get_ds(data->type);
-  if (!ds) {
-    ERROR("snmp plugin: DataSet `%s' not defined.", data->type);
-    return -1;
+  vb = res->variables;
+  if (vb == NULL) {
+    w->status = -1;
+    w->done = true;
+    return;
   }
 
-  if (ds->ds_num != data->values_len) {
-    ERROR("snmp plugin: DataSet `%s' requires %" PRIsz
-          " values, but config talks "
-          "about %" PRIsz,
-          data->type, ds->ds_num, data->values_len);
-    return -1;
+  if (res->errstat != SNMP_ERR_NOERROR) {
+    size_t i;
+
+    if (res->errindex != 0) {
+      /* Find the OID which caused error */
+      for (i = 1, vb = res->variables; vb != NULL && i != res->errindex;
+           vb = vb->next_variable, i++)
+        /* do nothing */;
+    }
+
+    if ((res->errindex == 0) || (vb == NULL)) {
+      ERROR("snmp plugin: host %s; data %s: response error: %s (%li) ",
+            host->name, data->name, snmp_errstring(res->errstat),
+            res->errstat);
+      w->status = -1;
+      w->done = true;
+      return;
+    }
+
+    char oid_buffer[1024] = {0};
+    snprint_objid(oid_buffer, sizeof(oid_buffer) - 1, vb->name,
+                  vb->name_length);
+    NOTICE("snmp plugin: host %s; data %s: OID `%s` failed: %s", host->name,
+           data->name, oid_buffer, snmp_errstring(res->errstat));
+
+    /* Get value index from todo list and skip OID found */
+    assert((size_t)res->errindex <= w->var_num);
+    i = w->var_idx[res->errindex - 1];
+    assert(i < w->oid_list_len);
+    w->oid_list_todo[i] = 0;
+    return;
+  }
+
+  if ((w->bulk > 0) && (host->bulk_size < host->max_repetitions))
+    host->bulk_size++;
+
+  /* A GETBULK response holds up to `bulk' rows of `var_num' variables each,
+   * in the order they were requested. */
+  size_t k = 0;
+  for (vb = res->variables; vb != NULL; vb = vb->next_variable, k++) {
+    size_t i = w->var_idx[k % w->var_num];
+
+    /* The column has left its subtree earlier in this response. */
+    if (!w->oid_list_todo[i])
+      continue;
+
+    if (csnmp_walk_table_vb(w, i, vb) != 0) {
+      w->status = -1;
+      w->done = true;
+      return;
+    }
   }
+} /* void csnmp_walk_table_response */
+
+static void csnmp_walk_value_response(csnmp_walk_t *w, struct snmp_pdu *res) {
+  host_definition_t *host = w->host;
+  data_definition_t *data = w->data;
+  const data_set_t *ds = w->ds;
+  value_list_t vl = VALUE_LIST_INIT;
+
+  w->done = true;
 
   vl.values_len = ds->ds_num;
   vl.values = malloc(sizeof(*vl.values) * vl.values_len);
-  if (vl.values == NULL)
-    return -1;
-  for (i = 0; i < vl.values_len; i++) {
+  if (vl.values == NULL) {
+    w->status = -1;
+    return;
+  }
+  for (size_t i = 0; i < vl.values_len; i++) {
     if (ds->ds[i].type == DS_TYPE_COUNTER)
       vl.values[i].counter = 0;
     else
@@ -2045,43 +2391,15 @@ static int csnmp_read_value(host_definition_t *host, data_definition_t *data) {
     sstrncpy(vl.plugin_instance, data->plugin_instance.value,
              sizeof(vl.plugin_instance));
 
-  req = snmp_pdu_create(SNMP_MSG_GET);
-  if (req == NULL) {
-    ERROR("snmp plugin: snmp_pdu_create failed.");
-    sfree(vl.values);
-    return -1;
-  }
-
-  for (i = 0; i < data->values_len; i++)
-    snmp_add_null_var(req, data->values[i].oid, data->values[i].oid_len);
-
-  status = snmp_sess_synch_response(host->sess_handle, req, &res);
-
-  if ((status != STAT_SUCCESS) || (res == NULL)) {
-    char *errstr = NULL;
-
-    snmp_sess_error(host->sess_handle, NULL, NULL, &errstr);
-    ERROR("snmp plugin: host %s: snmp_sess_synch_response failed: %s",
-          host->name, (errstr == NULL) ? "Unknown problem" : errstr);
-
-    if (res != NULL)
-      snmp_free_pdu(res);
-
-    sfree(errstr);
-    sfree(vl.values);
-    csnmp_host_close_session(host);
-
-    return -1;
-  }
-
-  for (vb = res->variables; vb != NULL; vb = vb->next_variable) {
+  for (struct variable_list *vb = res->variables; vb != NULL;
+       vb = vb->next_variable) {
 #if COLLECT_DEBUG
     char buffer[1024];
     snprint_variable(buffer, sizeof(buffer), vb->name, vb->name_length, vb);
     DEBUG("snmp plugin: Got this variable: %s", buffer);
 #endif /* COLLECT_DEBUG */
 
-    for (i = 0; i < data->values_len; i++)
+    for (size_t i = 0; i < data->values_len; i++)
       if (snmp_oid_compare(data->values[i].oid, data->values[i].oid_len,
                            vb->name, vb->name_length) == 0)
         vl.values[i] =
@@ -2089,20 +2407,202 @@ static int csnmp_read_value(host_definition_t *host, data_definition_t *data) {
                                       data->shift, host->name, data->name);
   } /* for (res->variables) */
 
-  snmp_free_pdu(res);
-
   DEBUG("snmp plugin: -> plugin_dispatch_values (&vl);");
   plugin_dispatch_values(&vl);
   sfree(vl.values);
+} /* void csnmp_walk_value_response */
 
-  return 0;
-} /* int csnmp_read_value */
+static void csnmp_walk_response(csnmp_walk_t *w, struct snmp_pdu *res) {
+  c_release(LOG_INFO, &w->host->complaint,
+            "snmp plugin: host %s: request successful.", w->host->name);
+
+  if (w->cached)
+    csnmp_walk_cached_response(w, res);
+  else if (w->data->is_table)
+    csnmp_walk_table_response(w, res);
+  else
+    csnmp_walk_value_response(w, res);
+} /* void csnmp_walk_response */
+
+/* Dispatches the values collected by a table walk and frees the walk. */
+static void csnmp_walk_finish(csnmp_walk_t *w) {
+  if (w->data->is_table && (w->status == 0)) {
+    csnmp_dispatch_table(w->host, w->data, w->type_instance_cells_head,
+                         w->plugin_instance_cells_head, w->hostname_cells_head,
+                         w->filter_cells_head, w->value_cells_head);
+
+    if ((w->cache != NULL) && !w->cached)
+      csnmp_walk_store_cache(w);
+  }
+
+  csnmp_walk_destroy(w);
+} /* void csnmp_walk_finish */
+
+static int csnmp_walk_sync(csnmp_walk_t *w) {
+  host_definition_t *host = w->host;
+
+  DEBUG("snmp plugin: csnmp_walk_sync (host = %s, data = %s)", host->name,
+        w->data->name);
+
+  while (!w->done) {
+    struct snmp_pdu *req = csnmp_walk_next_pdu(w);
+    if (req == NULL)
+      break;
+
+    struct snmp_pdu *res = NULL;
+    int status = snmp_sess_synch_response(host->sess_handle, req, &res);
+
+    /* snmp_sess_synch_response always frees our req PDU */
+    req = NULL;
+
+    if ((status != STAT_SUCCESS) || (res == NULL)) {
+      char *errstr = NULL;
+
+      snmp_sess_error(host->sess_handle, NULL, NULL, &errstr);
+
+      c_complain(LOG_ERR, &host->complaint,
+                 "snmp plugin: host %s: snmp_sess_synch_response failed: %s",
+                 host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+
+      if (res != NULL)
+        snmp_free_pdu(res);
+
+      sfree(errstr);
+      csnmp_host_close_session(host);
+
+      w->status = -1;
+      break;
+    }
+
+    csnmp_walk_response(w, res);
+    snmp_free_pdu(res);
+  }
+
+  return w->status;
+} /* int csnmp_walk_sync */
+
+static void csnmp_walk_send(csnmp_walk_t *w);
+
+static int csnmp_walk_callback(int op, __attribute__((unused))
+                               netsnmp_session *sess,
+                               __attribute__((unused)) int reqid,
+                               netsnmp_pdu *pdu, void *magic) {
+  csnmp_walk_t *w = magic;
+
+  w->pending = false;
+
+  if (op != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) {
+    c_complain(LOG_ERR, &w->host->complaint,
+               "snmp plugin: host %s: request for data %s timed out.",
+               w->host->name, w->data->name);
+    /* Large responses are the likely victims of packet loss. */
+    if (w->bulk > 1)
+      w->host->bulk_size = w->bulk / 2;
+    w->timed_out = true;
+    w->status = -1;
+    w->done = true;
+    return 1;
+  }
+
+  /* The library frees `pdu' when we return. */
+  csnmp_walk_response(w, pdu);
+  csnmp_walk_send(w);
+
+  return 1;
+} /* int csnmp_walk_callback */
+
+static void csnmp_walk_send(csnmp_walk_t *w) {
+  if (w->done)
+    return;
+
+  struct snmp_pdu *req = csnmp_walk_next_pdu(w);
+  if (req == NULL)
+    return;
+
+  if (snmp_sess_async_send(w->host->sess_handle, req, csnmp_walk_callback,
+                           w) == 0) {
+    char *errstr = NULL;
+
+    snmp_sess_error(w->host->sess_handle, NULL, NULL, &errstr);
+    ERROR("snmp plugin: host %s: snmp_sess_async_send failed: %s",
+          w->host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+    sfree(errstr);
+
+    snmp_free_pdu(req);
+    w->status = -1;
+    w->done = true;
+    return;
+  }
+
+  w->pending = true;
+} /* void csnmp_walk_send */
+
+/* Runs all walks of a host concurrently: each walk keeps one request in
+ * flight and sends its next request from the response callback, so the
+ * round trips of different `Data' blocks overlap. */
+static void csnmp_walk_async(host_definition_t *host, csnmp_walk_t *walks,
+                             size_t walks_num) {
+  bool timed_out = false;
+
+  for (size_t i = 0; i < walks_num; i++)
+    csnmp_walk_send(walks + i);
+
+  while (42) {
+    size_t pending = 0;
+    for (size_t i = 0; i < walks_num; i++)
+      if (walks[i].pending)
+        pending++;
+    if (pending == 0)
+      break;
+
+    int numfds = 0;
+    int block = 1;
+    fd_set fdset;
+    struct timeval timeout = {0};
+
+    FD_ZERO(&fdset);
+    snmp_sess_select_info(host->sess_handle, &numfds, &fdset, &timeout,
+                          &block);
+
+    int status = select(numfds, &fdset, NULL, NULL, block ? NULL : &timeout);
+    if (status > 0) {
+      snmp_sess_read(host->sess_handle, &fdset);
+    } else if (status == 0) {
+      /* Retransmits or expires requests, calling back on expiry. */
+      snmp_sess_timeout(host->sess_handle);
+    } else if (errno != EINTR) {
+      ERROR("snmp plugin: host %s: select failed: %s", host->name, STRERRNO);
+      timed_out = true;
+      break;
+    }
+  }
+
+  for (size_t i = 0; i < walks_num; i++)
+    if (walks[i].timed_out)
+      timed_out = true;
+
+  /* Closing the session also drops requests still in flight. */
+  if (timed_out)
+    csnmp_host_close_session(host);
+} /* void csnmp_walk_async */
+
+static void csnmp_submit_duration(host_definition_t *host, cdtime_t duration) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &(value_t){.gauge = CDTIME_T_TO_DOUBLE(duration)};
+  vl.values_len = 1;
+  sstrncpy(vl.host, host->name, sizeof(vl.host));
+  sstrncpy(vl.plugin, "snmp", sizeof(vl.plugin));
+  sstrncpy(vl.type, "duration", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "poll", sizeof(vl.type_instance));
+
+  plugin_dispatch_values(&vl);
+} /* void csnmp_submit_duration */
 
 static int csnmp_read_host(user_data_t *ud) {
   host_definition_t *host;
-  int status;
   int success;
-  int i;
+  cdtime_t start = cdtime();
 
   host = ud->data;
 
@@ -2112,19 +2612,60 @@ static int csnmp_read_host(user_data_t *ud) {
   if (host->sess_handle == NULL)
     return -1;
 
+  /* Only used with `AsyncPolling'; otherwise each walk is finished right
+   * away. */
+  csnmp_walk_t walks[host->data_list_len];
+  size_t walks_num = 0;
+
   success = 0;
-  for (i = 0; i < host->data_list_len; i++) {
+
+  for (int i = 0; i < host->data_list_len; i++) {
+    csnmp_walk_t *w = walks + walks_num;
     data_definition_t *data = host->data_list[i];
+    csnmp_table_cache_t *cache = NULL;
+
+    if (data->instance_cache_interval > 0) {
+      if (host->table_cache == NULL)
+        host->table_cache =
+            calloc(host->data_list_len, sizeof(*host->table_cache));
+      if (host->table_cache != NULL)
+        cache = host->table_cache + i;
+    }
 
-    if (data->is_table)
-      status = csnmp_read_table(host, data);
-    else
-      status = csnmp_read_value(host, data);
+    if (csnmp_walk_init(w, host, data, cache) != 0) {
+      csnmp_walk_destroy(w);
+      continue;
+    }
+
+    if (host->async) {
+      walks_num++;
+      continue;
+    }
+
+    if (host->sess_handle == NULL) {
+      DEBUG("snmp plugin: csnmp_read_host: host->sess_handle == NULL");
+      w->status = -1;
+    } else {
+      csnmp_walk_sync(w);
+    }
+
+    if (w->status == 0)
+      success++;
+    csnmp_walk_finish(w);
+  }
+
+  if (host->async)
+    csnmp_walk_async(host, walks, walks_num);
 
-    if (status == 0)
+  for (size_t i = 0; i < walks_num; i++) {
+    if (walks[i].status == 0)
       success++;
+    csnmp_walk_finish(walks + i);
   }
 
+  if (host->report_duration)
+    csnmp_submit_duration(host, cdtime() - start);
+
   if (success == 0)
     return -1;
 
@@ -2137,23 +2678,42 @@ static int csnmp_init(void) {
   return 0;
 } /* int csnmp_init */
 
-static int csnmp_shutdown(void) {
-  data_definition_t *data_this;
-  data_definition_t *data_next;
-
-  /* When we get here, the read threads have been stopped and all the
-   * `host_definition_t' will be freed. */
-  DEBUG("snmp plugin: Destroying all data definitions.");
-
-  data_this = data_head;
-  data_head = NULL;
+static void csnmp_data_list_destroy(data_definition_t *data_this) {
   while (data_this != NULL) {
-    data_next = data_this->next;
+    data_definition_t *data_next = data_this->next;
 
     csnmp_data_definition_destroy(data_this);
 
     data_this = data_next;
   }
+} /* void csnmp_data_list_destroy */
+
+/* The hosts' read callbacks have been unregistered; each host is freed once
+ * it's no longer being read. */
+static int csnmp_reconfigure(void) {
+  if (data_head == NULL)
+    return 0;
+
+  data_definition_t *last = data_head;
+  while (last->next != NULL)
+    last = last->next;
+
+  last->next = data_retired;
+  data_retired = data_head;
+  data_head = NULL;
+
+  return 0;
+} /* int csnmp_reconfigure */
+
+static int csnmp_shutdown(void) {
+  /* When we get here, the read threads have been stopped and all the
+   * `host_definition_t' will be freed. */
+  DEBUG("snmp plugin: Destroying all data definitions.");
+
+  csnmp_data_list_destroy(data_head);
+  data_head = NULL;
+  csnmp_data_list_destroy(data_retired);
+  data_retired = NULL;
 
   return 0;
 } /* int csnmp_shutdown */
@@ -2162,4 +2722,5 @@ void module_register(void) {
   plugin_register_complex_config("snmp", csnmp_config);
   plugin_register_init("snmp", csnmp_init);
   plugin_register_shutdown("snmp", csnmp_shutdown);
+  plugin_register_reconfigure("snmp", csnmp_reconfigure);
 } /* void module_register */
@@ -121,6 +121,18 @@ struct data_definition_s {
 };
 typedef struct data_definition_s data_definition_t;
 
+/* Latest value of a registered data OID, kept up to date by the write
+ * callback, so that requests are answered without formatting an identifier
+ * and querying the value cache. */
+struct oid_value_s {
+  oid_t oid; /* Key in snmp_agent_ctx_t.oid_values */
+  data_definition_t *dd;
+  size_t oid_index; /* Position in dd->oids, i.e. the data source */
+  int ds_type;
+  value_t value;
+};
+typedef struct oid_value_s oid_value_t;
+
 struct snmp_agent_ctx_s {
   pthread_t thread;
   pthread_mutex_t lock;
@@ -130,6 +142,8 @@ struct snmp_agent_ctx_s {
   llist_t *tables;
   llist_t *scalars;
   c_avl_tree_t *registered_oids; /* AVL tree containing all registered OIDs */
+  c_avl_tree_t *oid_values;      /* Values of the registered data OIDs, sorted
+                                    by OID */
 };
 typedef struct snmp_agent_ctx_s snmp_agent_ctx_t;
 
@@ -650,10 +664,17 @@ static int snmp_agent_register_oid_string(const oid_t *oid,
 }
 
 static int snmp_agent_unregister_oid(oid_t *oid) {
-  int ret = c_avl_remove(g_agent->registered_oids, (void *)oid, NULL, NULL);
+  oid_value_t *ov = NULL;
+  if (c_avl_remove(g_agent->oid_values, (void *)oid, NULL, (void **)&ov) == 0)
+    sfree(ov);
+
+  oid_t *key = NULL;
+  int ret =
+      c_avl_remove(g_agent->registered_oids, (void *)oid, (void **)&key, NULL);
 
   if (ret != 0)
     ERROR(PLUGIN_NAME ": Could not delete registration info");
+  sfree(key);
 
   return unregister_mib(oid->oid, oid->oid_len);
 }
@@ -770,6 +791,26 @@ static int snmp_agent_clear_missing(const value_list_t *vl,
   if (vl == NULL)
     return -EINVAL;
 
+  pthread_mutex_lock(&g_agent->lock);
+
+  /* Scalars stay registered, answering "no such instance" until the next
+   * value arrives. */
+  for (llentry_t *de = llist_head(g_agent->scalars); de != NULL;
+       de = de->next) {
+    data_definition_t *dd = de->value;
+
+    if (!CHECK_DD_TYPE(dd, vl->plugin, vl->plugin_instance, vl->type,
+                       vl->type_instance))
+      continue;
+
+    for (size_t i = 0; i < dd->oids_len; i++) {
+      oid_value_t *ov = NULL;
+      if (c_avl_remove(g_agent->oid_values, &dd->oids[i], NULL,
+                       (void **)&ov) == 0)
+        sfree(ov);
+    }
+  }
+
   for (llentry_t *te = llist_head(g_agent->tables); te != NULL; te = te->next) {
     table_definition_t *td = te->value;
 
@@ -783,6 +824,7 @@ static int snmp_agent_clear_missing(const value_list_t *vl,
 
           if (index_oid == NULL) {
             ERROR(PLUGIN_NAME ": Could not allocate memory for index_oid");
+            pthread_mutex_unlock(&g_agent->lock);
             return -ENOMEM;
           }
 
@@ -792,12 +834,14 @@ static int snmp_agent_clear_missing(const value_list_t *vl,
             snmp_agent_table_data_remove(dd, td, index_oid);
           sfree(index_oid);
 
+          pthread_mutex_unlock(&g_agent->lock);
           return ret;
         }
       }
     }
   }
 
+  pthread_mutex_unlock(&g_agent->lock);
   return 0;
 }
 
@@ -1042,6 +1086,41 @@ static int snmp_agent_format_name(char *name, int name_len,
   return 0;
 }
 
+static int snmp_agent_set_reply(struct netsnmp_request_info_s *requests,
+                                data_definition_t const *dd, size_t oid_index,
+                                value_t const *value, int ds_type) {
+  char data[DATA_MAX_NAME_LEN];
+  size_t data_len = sizeof(data);
+  int ret = snmp_agent_set_vardata(data, &data_len, dd->oids[oid_index].type,
+                                   dd->scale, dd->shift, value,
+                                   sizeof(*value), ds_type);
+  if (ret != 0) {
+    ERROR(PLUGIN_NAME ": Failed to convert '%s' value to snmp data", dd->name);
+    return SNMP_NOSUCHINSTANCE;
+  }
+
+  requests->requestvb->type = dd->oids[oid_index].type;
+  snmp_set_var_typed_value(requests->requestvb, requests->requestvb->type,
+                           (const u_char *)data, data_len);
+
+  return SNMP_ERR_NOERROR;
+}
+
+/* Answers a request for a data OID from the index of values. Returns -ENOENT
+ * if the OID has no value in the index.
+ * g_agent->lock must be held when calling this function. */
+static int
+snmp_agent_form_indexed_reply(struct netsnmp_request_info_s *requests,
+                              oid_t const *oid) {
+  oid_value_t *ov = NULL;
+
+  if (c_avl_get(g_agent->oid_values, oid, (void **)&ov) != 0)
+    return -ENOENT;
+
+  return snmp_agent_set_reply(requests, ov->dd, ov->oid_index, &ov->value,
+                              ov->ds_type);
+}
+
 static int snmp_agent_form_reply(struct netsnmp_request_info_s *requests,
                                  data_definition_t *dd, oid_t *index_oid,
                                  int oid_index) {
@@ -1081,8 +1160,6 @@ static int snmp_agent_form_reply(struct netsnmp_request_info_s *requests,
                                strlen((const char *)key->val.string));
 #endif
 
-    pthread_mutex_unlock(&g_agent->lock);
-
     return SNMP_ERR_NOERROR;
   }
 
@@ -1112,24 +1189,11 @@ static int snmp_agent_form_reply(struct netsnmp_request_info_s *requests,
   assert(ds->ds_num == values_num);
   assert(oid_index < (int)values_num);
 
-  char data[DATA_MAX_NAME_LEN];
-  size_t data_len = sizeof(data);
-  ret = snmp_agent_set_vardata(
-      data, &data_len, dd->oids[oid_index].type, dd->scale, dd->shift,
-      &values[oid_index], sizeof(values[oid_index]), ds->ds[oid_index].type);
-
+  ret = snmp_agent_set_reply(requests, dd, oid_index, &values[oid_index],
+                             ds->ds[oid_index].type);
   sfree(values);
 
-  if (ret != 0) {
-    ERROR(PLUGIN_NAME ": Failed to convert '%s' value to snmp data", name);
-    return SNMP_NOSUCHINSTANCE;
-  }
-
-  requests->requestvb->type = dd->oids[oid_index].type;
-  snmp_set_var_typed_value(requests->requestvb, requests->requestvb->type,
-                           (const u_char *)data, data_len);
-
-  return SNMP_ERR_NOERROR;
+  return ret;
 }
 
 static int
@@ -1155,6 +1219,13 @@ snmp_agent_table_oid_handler(struct netsnmp_mib_handler_s *handler,
   snmp_agent_oid_to_string(oid_str, sizeof(oid_str), &oid);
   DEBUG(PLUGIN_NAME ": Get request received for table OID '%s'", oid_str);
 #endif
+
+  int ret = snmp_agent_form_indexed_reply(requests, &oid);
+  if (ret != -ENOENT) {
+    pthread_mutex_unlock(&g_agent->lock);
+    return ret;
+  }
+
   oid_t index_oid; /* Index part of requested OID */
 
   for (llentry_t *te = llist_head(g_agent->tables); te != NULL; te = te->next) {
@@ -1164,9 +1235,9 @@ snmp_agent_table_oid_handler(struct netsnmp_mib_handler_s *handler,
       data_definition_t *dd = de->value;
 
       for (size_t i = 0; i < dd->oids_len; i++) {
-        int ret = snmp_oid_ncompare(oid.oid, oid.oid_len, dd->oids[i].oid,
-                                    dd->oids[i].oid_len,
-                                    SNMP_MIN(oid.oid_len, dd->oids[i].oid_len));
+        ret = snmp_oid_ncompare(oid.oid, oid.oid_len, dd->oids[i].oid,
+                                dd->oids[i].oid_len,
+                                SNMP_MIN(oid.oid_len, dd->oids[i].oid_len));
         if (ret != 0)
           continue;
 
@@ -1187,7 +1258,8 @@ snmp_agent_table_oid_handler(struct netsnmp_mib_handler_s *handler,
           assert(index_oid.oid_len == 1);
           ret = c_avl_get(td->index_instance, (int *)&index_oid.oid[0],
                           (void **)&temp_oid);
-          memcpy(&index_oid, temp_oid, sizeof(index_oid));
+          if (ret == 0)
+            memcpy(&index_oid, temp_oid, sizeof(index_oid));
         }
 
         if (ret != 0) {
@@ -1335,14 +1407,20 @@ snmp_agent_scalar_oid_handler(struct netsnmp_mib_handler_s *handler,
   DEBUG(PLUGIN_NAME ": Get request received for scalar OID '%s'", oid_str);
 #endif
 
+  int ret = snmp_agent_form_indexed_reply(requests, &oid);
+  if (ret != -ENOENT) {
+    pthread_mutex_unlock(&g_agent->lock);
+    return ret;
+  }
+
   for (llentry_t *de = llist_head(g_agent->scalars); de != NULL;
        de = de->next) {
     data_definition_t *dd = de->value;
 
     for (size_t i = 0; i < dd->oids_len; i++) {
 
-      int ret = snmp_oid_compare(oid.oid, oid.oid_len, dd->oids[i].oid,
-                                 dd->oids[i].oid_len);
+      ret = snmp_oid_compare(oid.oid, oid.oid_len, dd->oids[i].oid,
+                             dd->oids[i].oid_len);
       if (ret != 0)
         continue;
 
@@ -2028,10 +2106,99 @@ error:
   return ret;
 }
 
-static int snmp_agent_write(value_list_t const *vl) {
+/* Stores the value of data source "oid_index" of "vl" as the value of "oid".
+ * g_agent->lock must be held when calling this function. */
+static int snmp_agent_oid_value_update(oid_t const *oid, data_definition_t *dd,
+                                       size_t oid_index, data_set_t const *ds,
+                                       value_list_t const *vl) {
+  oid_value_t *ov = NULL;
+
+  if ((oid_index >= ds->ds_num) || (oid_index >= vl->values_len))
+    return -EINVAL;
+
+  if (c_avl_get(g_agent->oid_values, oid, (void **)&ov) != 0) {
+    ov = calloc(1, sizeof(*ov));
+    if (ov == NULL) {
+      ERROR(PLUGIN_NAME ": Could not allocate memory for OID value");
+      return -ENOMEM;
+    }
+    memcpy(&ov->oid, oid, sizeof(*oid));
+    ov->dd = dd;
+    ov->oid_index = oid_index;
+
+    if (c_avl_insert(g_agent->oid_values, &ov->oid, ov) != 0) {
+      ERROR(PLUGIN_NAME ": Could not allocate memory for OID value");
+      sfree(ov);
+      return -ENOMEM;
+    }
+  }
+
+  ov->ds_type = ds->ds[oid_index].type;
+  ov->value = vl->values[oid_index];
+
+  return 0;
+}
+
+/* Updates the values of the OIDs "dd" has registered for "vl". "index_oid" is
+ * NULL for scalars.
+ * g_agent->lock must be held when calling this function. */
+static int snmp_agent_update_oid_values(data_definition_t *dd,
+                                        oid_t const *index_oid,
+                                        data_set_t const *ds,
+                                        value_list_t const *vl) {
+  const table_definition_t *td = dd->table;
+  int *index = NULL;
+  bool host_is_key = false;
+
+  if (td != NULL) {
+    if (td->index_oid.oid_len &&
+        (c_avl_get(td->instance_index, index_oid, (void **)&index) != 0))
+      return -ENOENT;
+
+    for (int i = 0; i < td->index_keys_len; i++)
+      if (td->index_keys[i].source == INDEX_HOST)
+        host_is_key = true;
+  }
+
+  /* Without a host index key, requests refer to the local host's values. */
+  if (!host_is_key && (strcmp(vl->host, hostname_g) != 0))
+    return 0;
+
+  for (size_t i = 0; i < dd->oids_len; i++) {
+    oid_t oid;
+    int ret = 0;
+
+    memcpy(&oid, &dd->oids[i], sizeof(oid));
+    if (index != NULL) {
+      if (oid.oid_len >= MAX_OID_LEN)
+        return -EINVAL;
+      oid.oid[oid.oid_len++] = *index;
+    } else if (index_oid != NULL) {
+      ret = snmp_agent_append_oid(&oid, index_oid);
+    }
+
+    if (ret == 0)
+      ret = snmp_agent_oid_value_update(&oid, dd, i, ds, vl);
+    if (ret != 0)
+      return ret;
+  }
+
+  return 0;
+}
+
+static int snmp_agent_write(data_set_t const *ds, value_list_t const *vl) {
   if (vl == NULL)
     return -EINVAL;
 
+  for (llentry_t *de = llist_head(g_agent->scalars); de != NULL;
+       de = de->next) {
+    data_definition_t *dd = de->value;
+
+    if (CHECK_DD_TYPE(dd, vl->plugin, vl->plugin_instance, vl->type,
+                      vl->type_instance))
+      snmp_agent_update_oid_values(dd, NULL, ds, vl);
+  }
+
   for (llentry_t *te = llist_head(g_agent->tables); te != NULL; te = te->next) {
     table_definition_t *td = te->value;
 
@@ -2053,6 +2220,8 @@ static int snmp_agent_write(value_list_t const *vl) {
 
           if (ret == 0)
             ret = snmp_agent_update_index(dd, td, index_oid, &free_index_oid);
+          if (ret == 0)
+            ret = snmp_agent_update_oid_values(dd, index_oid, ds, vl);
 
           /* Index exists or update failed */
           if (free_index_oid)
@@ -2072,7 +2241,7 @@ static int snmp_agent_collect(const data_set_t *ds, const value_list_t *vl,
 
   pthread_mutex_lock(&g_agent->lock);
 
-  snmp_agent_write(vl);
+  snmp_agent_write(ds, vl);
 
   pthread_mutex_unlock(&g_agent->lock);
 
@@ -2091,12 +2260,16 @@ static int snmp_agent_preinit(void) {
   g_agent->scalars = llist_create();
   g_agent->registered_oids =
       c_avl_create((int (*)(const void *, const void *))oid_compare);
+  g_agent->oid_values =
+      c_avl_create((int (*)(const void *, const void *))oid_compare);
 
-  if (g_agent->tables == NULL || g_agent->scalars == NULL) {
+  if (g_agent->tables == NULL || g_agent->scalars == NULL ||
+      g_agent->registered_oids == NULL || g_agent->oid_values == NULL) {
     ERROR(PLUGIN_NAME ": llist_create() failed");
     llist_destroy(g_agent->scalars);
     llist_destroy(g_agent->tables);
     c_avl_destroy(g_agent->registered_oids);
+    c_avl_destroy(g_agent->oid_values);
     return -ENOMEM;
   }
 
@@ -2109,6 +2282,7 @@ static int snmp_agent_preinit(void) {
     llist_destroy(g_agent->scalars);
     llist_destroy(g_agent->tables);
     c_avl_destroy(g_agent->registered_oids);
+    c_avl_destroy(g_agent->oid_values);
     return -1;
   }
 
@@ -2123,6 +2297,7 @@ static int snmp_agent_preinit(void) {
     llist_destroy(g_agent->scalars);
     llist_destroy(g_agent->tables);
     c_avl_destroy(g_agent->registered_oids);
+    c_avl_destroy(g_agent->oid_values);
     return -1;
   }
 
@@ -2171,10 +2346,8 @@ static int snmp_agent_init(void) {
     return ret;
   }
 
-  if (llist_head(g_agent->tables) != NULL) {
-    plugin_register_write(PLUGIN_NAME, snmp_agent_collect, NULL);
-    plugin_register_missing(PLUGIN_NAME, snmp_agent_clear_missing, NULL);
-  }
+  plugin_register_write(PLUGIN_NAME, snmp_agent_collect, NULL);
+  plugin_register_missing(PLUGIN_NAME, snmp_agent_clear_missing, NULL);
 
   return 0;
 }
@@ -2303,6 +2476,15 @@ static int snmp_agent_shutdown(void) {
     c_avl_destroy(g_agent->registered_oids);
   }
 
+  /* The keys are part of the values */
+  if (g_agent->oid_values != NULL) {
+    oid_value_t *ov;
+    while (c_avl_pick(g_agent->oid_values, &oid, (void **)&ov) == 0) {
+      sfree(ov);
+    }
+    c_avl_destroy(g_agent->oid_values);
+  }
+
   sfree(g_agent);
 
   return ret;
@@ -24,15 +24,24 @@
  *   Florian octo Forster <octo at collectd.org>
  */
 
+#define _GNU_SOURCE /* For recvmmsg(2) */
+
 #include "collectd.h"
 
 #include "common.h"
 #include "plugin.h"
 #include "utils_avltree.h"
+#include "utils_complain.h"
+#include "utils_histogram.h"
+#include "utils_hll.h"
 #include "utils_latency.h"
+#include "utils_memstats.h"
 
 #include <netdb.h>
 #include <poll.h>
+#if HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+#endif
 #include <sys/types.h>
 
 /* AIX doesn't have MSG_DONTWAIT */
@@ -48,6 +57,9 @@
 #define STATSD_DEFAULT_SERVICE "8125"
 #endif
 
+/* Number of datagrams a receive thread reads with one recvmmsg(2) call. */
+#define STATSD_RECEIVE_BATCH_SIZE 16
+
 enum metric_type_e { STATSD_COUNTER, STATSD_TIMER, STATSD_GAUGE, STATSD_SET };
 typedef enum metric_type_e metric_type_t;
 
@@ -57,20 +69,58 @@ struct statsd_metric_s {
   derive_t counter;
   latency_counter_t *latency;
   c_avl_tree_t *set;
+  /* Sets only: replaces "set" once it has grown beyond conf_set_exact_limit
+   * members. */
+  c_hll_var_t *set_hll;
   unsigned long updates_num;
+
+  /* Gauges in a shard only: whether "value" has been set, rather than only
+   * been changed, since the shard was last merged. */
+  bool value_set;
+
+  /* Timers only, if "TimerHistogram" is configured: the number of events in
+   * each bucket (not cumulative) and the totals since the timer was created. */
+  uint64_t *histogram;
+  uint64_t histogram_count;
+  double histogram_sum;
+
+  /* Memory accounted for the metric, its key and its histogram. */
+  size_t bytes;
 };
 typedef struct statsd_metric_s statsd_metric_t;
 
 static c_avl_tree_t *metrics_tree;
+/* Memory of the metrics in "metrics_tree" and the receivers' shards and of
+ * the members of sets. Latency counters and HyperLogLog sketches are not
+ * included. */
+static memstat_t *statsd_memstat;
 static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static pthread_t network_thread;
-static bool network_thread_running;
+/* Each receive thread parses the lines it receives into its own metrics
+ * shard, which statsd_read() merges into "metrics_tree". The shard's lock is
+ * taken once per batch of datagrams and is only contended while statsd_read()
+ * swaps the shard for an empty one. */
+struct statsd_receiver_s {
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t lock;
+  c_avl_tree_t *metrics;
+};
+typedef struct statsd_receiver_s statsd_receiver_t;
+
+static statsd_receiver_t *receivers;
+static size_t receivers_num;
 static bool network_thread_shutdown;
 
 static char *conf_node;
 static char *conf_service;
 
+static size_t conf_receive_threads = 1;
+/* CPUs the receive threads are pinned to, in turn. */
+static int *conf_receive_cpus;
+static size_t conf_receive_cpus_num;
+static size_t conf_buffer_size = 65535;
+
 static bool conf_delete_counters;
 static bool conf_delete_timers;
 static bool conf_delete_gauges;
@@ -79,14 +129,29 @@ static bool conf_delete_sets;
 static double *conf_timer_percentile;
 static size_t conf_timer_percentile_num;
 
+/* Upper bounds of the histogram buckets in seconds, in increasing order. */
+static double *conf_timer_histogram;
+static size_t conf_timer_histogram_num;
+
+/* If true, timers use a quantile sketch with a relative accuracy of
+ * conf_timer_accuracy instead of a histogram, see utils_latency.h. */
+static bool conf_timer_sketch;
+static double conf_timer_accuracy = 0.01;
+
+/* Sets with more members than this are estimated with a HyperLogLog sketch.
+ * Zero means sets are always counted exactly. */
+static size_t conf_set_exact_limit;
+static int conf_set_precision = 14;
+
 static bool conf_counter_sum;
 static bool conf_timer_lower;
 static bool conf_timer_upper;
 static bool conf_timer_sum;
 static bool conf_timer_count;
 
-/* Must hold metrics_lock when calling this function. */
-static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
+/* Must hold the lock protecting "tree" when calling this function. */
+static statsd_metric_t *statsd_metric_lookup_unsafe(c_avl_tree_t *tree, /* {{{ */
+                                                    char const *name,
                                                     metric_type_t type) {
   char key[DATA_MAX_NAME_LEN + 2];
   char *key_copy;
@@ -113,7 +178,7 @@ static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
   key[1] = ':';
   sstrncpy(&key[2], name, sizeof(key) - 2);
 
-  status = c_avl_get(metrics_tree, key, (void *)&metric);
+  status = c_avl_get(tree, key, (void *)&metric);
   if (status == 0)
     return metric;
 
@@ -133,58 +198,79 @@ static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
   metric->type = type;
   metric->latency = NULL;
   metric->set = NULL;
+  metric->bytes = sizeof(*metric) + strlen(key_copy) + 1;
 
-  status = c_avl_insert(metrics_tree, key_copy, metric);
+  status = c_avl_insert(tree, key_copy, metric);
   if (status != 0) {
     ERROR("statsd plugin: c_avl_insert failed.");
     sfree(key_copy);
     sfree(metric);
     return NULL;
   }
+  memstat_add(statsd_memstat, (int64_t)metric->bytes, 1);
 
   return metric;
 } /* }}} statsd_metric_lookup_unsafe */
 
-static int statsd_metric_set(char const *name, double value, /* {{{ */
-                             metric_type_t type) {
-  statsd_metric_t *metric;
+static latency_counter_t *statsd_latency_create(void) /* {{{ */
+{
+  if (conf_timer_sketch)
+    return latency_counter_create_sketch(conf_timer_accuracy);
+  return latency_counter_create();
+} /* }}} latency_counter_t *statsd_latency_create */
 
-  pthread_mutex_lock(&metrics_lock);
+static int statsd_metric_set(c_avl_tree_t *tree, char const *name, /* {{{ */
+                             double value, metric_type_t type) {
+  statsd_metric_t *metric;
 
-  metric = statsd_metric_lookup_unsafe(name, type);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_lookup_unsafe(tree, name, type);
+  if (metric == NULL)
     return -1;
-  }
 
   metric->value = value;
+  metric->value_set = true;
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
-
   return 0;
 } /* }}} int statsd_metric_set */
 
-static int statsd_metric_add(char const *name, double delta, /* {{{ */
-                             metric_type_t type) {
+static int statsd_metric_add(c_avl_tree_t *tree, char const *name, /* {{{ */
+                             double delta, metric_type_t type) {
   statsd_metric_t *metric;
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, type);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_lookup_unsafe(tree, name, type);
+  if (metric == NULL)
     return -1;
-  }
 
   metric->value += delta;
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
-
   return 0;
 } /* }}} int statsd_metric_add */
 
+/* Allocates the histogram of a timer, if it doesn't have one yet. */
+static int statsd_histogram_alloc(statsd_metric_t *metric) /* {{{ */
+{
+  if (metric->histogram != NULL)
+    return 0;
+
+  metric->histogram =
+      calloc(conf_timer_histogram_num, sizeof(*metric->histogram));
+  if (metric->histogram == NULL)
+    return ENOMEM;
+
+  size_t bytes = conf_timer_histogram_num * sizeof(*metric->histogram);
+  metric->bytes += bytes;
+  memstat_add(statsd_memstat, (int64_t)bytes, 0);
+  return 0;
+} /* }}} int statsd_histogram_alloc */
+
+static void statsd_set_key_free(char *set_key) /* {{{ */
+{
+  memstat_add(statsd_memstat, -(int64_t)(strlen(set_key) + 1), 0);
+  sfree(set_key);
+} /* }}} void statsd_set_key_free */
+
 static void statsd_metric_free(statsd_metric_t *metric) /* {{{ */
 {
   if (metric == NULL)
@@ -194,23 +280,58 @@ static void statsd_metric_free(statsd_metric_t *metric) /* {{{ */
     latency_counter_destroy(metric->latency);
     metric->latency = NULL;
   }
+  sfree(metric->histogram);
 
   if (metric->set != NULL) {
     void *key;
     void *value;
 
     while (c_avl_pick(metric->set, &key, &value) == 0) {
-      sfree(key);
+      statsd_set_key_free(key);
       assert(value == NULL);
     }
 
     c_avl_destroy(metric->set);
     metric->set = NULL;
   }
+  c_hll_var_destroy(metric->set_hll);
 
+  memstat_add(statsd_memstat, -(int64_t)metric->bytes, -1);
   sfree(metric);
 } /* }}} void statsd_metric_free */
 
+/* Replaces the members of a set with a HyperLogLog sketch if there are more of
+ * them than conf_set_exact_limit, or if "force" is true. */
+static int statsd_set_check_limit(statsd_metric_t *metric, /* {{{ */
+                                  bool force) {
+  if (metric->set_hll != NULL)
+    return 0;
+
+  if (!force && ((conf_set_exact_limit == 0) || (metric->set == NULL) ||
+                 ((size_t)c_avl_size(metric->set) <= conf_set_exact_limit)))
+    return 0;
+
+  metric->set_hll = c_hll_var_create(conf_set_precision);
+  if (metric->set_hll == NULL) {
+    ERROR("statsd plugin: c_hll_var_create failed.");
+    return ENOMEM;
+  }
+
+  if (metric->set != NULL) {
+    char *set_key;
+    void *value;
+
+    while (c_avl_pick(metric->set, (void *)&set_key, &value) == 0) {
+      c_hll_var_add(metric->set_hll, identifier_hash(set_key));
+      statsd_set_key_free(set_key);
+    }
+    c_avl_destroy(metric->set);
+    metric->set = NULL;
+  }
+
+  return 0;
+} /* }}} int statsd_set_check_limit */
+
 static int statsd_parse_value(char const *str, value_t *ret_value) /* {{{ */
 {
   char *endptr = NULL;
@@ -222,7 +343,9 @@ static int statsd_parse_value(char const *str, value_t *ret_value) /* {{{ */
   return 0;
 } /* }}} int statsd_parse_value */
 
-static int statsd_handle_counter(char const *name, /* {{{ */
+/* The statsd_handle_* functions update the metrics shard "tree". The caller
+ * must hold the shard's lock. */
+static int statsd_handle_counter(c_avl_tree_t *tree, char const *name, /* {{{ */
                                  char const *value_str, char const *extra) {
   value_t value;
   value_t scale;
@@ -248,11 +371,11 @@ static int statsd_handle_counter(char const *name, /* {{{ */
 
   /* Changes to the counter are added to (statsd_metric_t*)->value. ->counter is
    * only updated in statsd_metric_submit_unsafe(). */
-  return statsd_metric_add(name, (double)(value.gauge / scale.gauge),
+  return statsd_metric_add(tree, name, (double)(value.gauge / scale.gauge),
                            STATSD_COUNTER);
 } /* }}} int statsd_handle_counter */
 
-static int statsd_handle_gauge(char const *name, /* {{{ */
+static int statsd_handle_gauge(c_avl_tree_t *tree, char const *name, /* {{{ */
                                char const *value_str) {
   value_t value;
   int status;
@@ -263,12 +386,12 @@ static int statsd_handle_gauge(char const *name, /* {{{ */
     return status;
 
   if ((value_str[0] == '+') || (value_str[0] == '-'))
-    return statsd_metric_add(name, (double)value.gauge, STATSD_GAUGE);
+    return statsd_metric_add(tree, name, (double)value.gauge, STATSD_GAUGE);
   else
-    return statsd_metric_set(name, (double)value.gauge, STATSD_GAUGE);
+    return statsd_metric_set(tree, name, (double)value.gauge, STATSD_GAUGE);
 } /* }}} int statsd_handle_gauge */
 
-static int statsd_handle_timer(char const *name, /* {{{ */
+static int statsd_handle_timer(c_avl_tree_t *tree, char const *name, /* {{{ */
                                char const *value_str, char const *extra) {
   statsd_metric_t *metric;
   value_t value_ms;
@@ -296,40 +419,57 @@ static int statsd_handle_timer(char const *name, /* {{{ */
 
   value = MS_TO_CDTIME_T(value_ms.gauge / scale.gauge);
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, STATSD_TIMER);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_lookup_unsafe(tree, name, STATSD_TIMER);
+  if (metric == NULL)
     return -1;
-  }
 
   if (metric->latency == NULL)
-    metric->latency = latency_counter_create();
-  if (metric->latency == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+    metric->latency = statsd_latency_create();
+  if (metric->latency == NULL)
     return -1;
-  }
 
   latency_counter_add(metric->latency, value);
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  if (conf_timer_histogram_num > 0) {
+    if (statsd_histogram_alloc(metric) != 0)
+      return -1;
+
+    double seconds = CDTIME_T_TO_DOUBLE(value);
+    /* Find the first bucket whose upper bound is >= the value. Events above
+     * the last bound only go into the total count. */
+    size_t lo = 0;
+    size_t hi = conf_timer_histogram_num;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (conf_timer_histogram[mid] < seconds)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo < conf_timer_histogram_num)
+      metric->histogram[lo]++;
+    metric->histogram_count++;
+    metric->histogram_sum += seconds;
+  }
+
   return 0;
 } /* }}} int statsd_handle_timer */
 
-static int statsd_handle_set(char const *name, /* {{{ */
+static int statsd_handle_set(c_avl_tree_t *tree, char const *name, /* {{{ */
                              char const *set_key_orig) {
   statsd_metric_t *metric = NULL;
   char *set_key;
   int status;
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, STATSD_SET);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_lookup_unsafe(tree, name, STATSD_SET);
+  if (metric == NULL)
     return -1;
+
+  if (metric->set_hll != NULL) {
+    c_hll_var_add(metric->set_hll, identifier_hash(set_key_orig));
+    metric->updates_num++;
+    return 0;
   }
 
   /* Make sure metric->set exists. */
@@ -337,21 +477,18 @@ static int statsd_handle_set(char const *name, /* {{{ */
     metric->set = c_avl_create((int (*)(const void *, const void *))strcmp);
 
   if (metric->set == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
     ERROR("statsd plugin: c_avl_create failed.");
     return -1;
   }
 
   set_key = strdup(set_key_orig);
   if (set_key == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
     ERROR("statsd plugin: strdup failed.");
     return -1;
   }
 
   status = c_avl_insert(metric->set, set_key, /* value = */ NULL);
   if (status < 0) {
-    pthread_mutex_unlock(&metrics_lock);
     ERROR("statsd plugin: c_avl_insert (\"%s\") failed with status %i.",
           set_key, status);
     sfree(set_key);
@@ -359,15 +496,16 @@ static int statsd_handle_set(char const *name, /* {{{ */
   } else if (status > 0) /* key already exists */
   {
     sfree(set_key);
+  } else {
+    memstat_add(statsd_memstat, (int64_t)(strlen(set_key) + 1), 0);
   }
 
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
-  return 0;
+  return statsd_set_check_limit(metric, /* force = */ false);
 } /* }}} int statsd_handle_set */
 
-static int statsd_parse_line(char *buffer) /* {{{ */
+static int statsd_parse_line(c_avl_tree_t *tree, char *buffer) /* {{{ */
 {
   char *name = buffer;
   char *value;
@@ -393,23 +531,23 @@ static int statsd_parse_line(char *buffer) /* {{{ */
   }
 
   if (strcmp("c", type) == 0)
-    return statsd_handle_counter(name, value, extra);
+    return statsd_handle_counter(tree, name, value, extra);
   else if (strcmp("ms", type) == 0)
-    return statsd_handle_timer(name, value, extra);
+    return statsd_handle_timer(tree, name, value, extra);
 
   /* extra is only valid for counters and timers */
   if (extra != NULL)
     return -1;
 
   if (strcmp("g", type) == 0)
-    return statsd_handle_gauge(name, value);
+    return statsd_handle_gauge(tree, name, value);
   else if (strcmp("s", type) == 0)
-    return statsd_handle_set(name, value);
+    return statsd_handle_set(tree, name, value);
   else
     return -1;
 } /* }}} void statsd_parse_line */
 
-static void statsd_parse_buffer(char *buffer) /* {{{ */
+static void statsd_parse_buffer(c_avl_tree_t *tree, char *buffer) /* {{{ */
 {
   while (buffer != NULL) {
     char orig[64];
@@ -429,7 +567,7 @@ static void statsd_parse_buffer(char *buffer) /* {{{ */
 
     sstrncpy(orig, buffer, sizeof(orig));
 
-    status = statsd_parse_line(buffer);
+    status = statsd_parse_line(tree, buffer);
     if (status != 0)
       ERROR("statsd plugin: Unable to parse line: \"%s\"", orig);
 
@@ -437,29 +575,41 @@ static void statsd_parse_buffer(char *buffer) /* {{{ */
   }
 } /* }}} void statsd_parse_buffer */
 
-static void statsd_network_read(int fd) /* {{{ */
-{
-  char buffer[4096];
-  size_t buffer_size;
-  ssize_t status;
-
-  status = recv(fd, buffer, sizeof(buffer), /* flags = */ MSG_DONTWAIT);
-  if (status < 0) {
-
-    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
-      return;
-
-    ERROR("statsd plugin: recv(2) failed: %s", STRERRNO);
-    return;
+/* Reads up to STATSD_RECEIVE_BATCH_SIZE datagrams from "fd" into "buffers",
+ * each conf_buffer_size + 1 bytes long, and null-terminates them. Datagrams
+ * which did not fit into their buffer are flagged in "truncated". Returns the
+ * number of datagrams or -1 on error. */
+static int statsd_network_recv(int fd, char *buffers, /* {{{ */
+                               bool truncated[STATSD_RECEIVE_BATCH_SIZE]) {
+  size_t stride = conf_buffer_size + 1;
+
+#if HAVE_RECVMMSG
+  struct mmsghdr msgs[STATSD_RECEIVE_BATCH_SIZE] = {{{0}}};
+  struct iovec iovs[STATSD_RECEIVE_BATCH_SIZE];
+
+  for (size_t i = 0; i < STATSD_RECEIVE_BATCH_SIZE; i++) {
+    iovs[i].iov_base = buffers + i * stride;
+    iovs[i].iov_len = conf_buffer_size;
+    msgs[i].msg_hdr.msg_iov = iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
   }
 
-  buffer_size = (size_t)status;
-  if (buffer_size >= sizeof(buffer))
-    buffer_size = sizeof(buffer) - 1;
-  buffer[buffer_size] = 0;
-
-  statsd_parse_buffer(buffer);
-} /* }}} void statsd_network_read */
+  int status = recvmmsg(fd, msgs, STATSD_RECEIVE_BATCH_SIZE, MSG_DONTWAIT,
+                        /* timeout = */ NULL);
+  for (int i = 0; i < status; i++) {
+    buffers[i * stride + msgs[i].msg_len] = 0;
+    truncated[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+  }
+  return status;
+#else
+  ssize_t status = recv(fd, buffers, conf_buffer_size, MSG_DONTWAIT);
+  if (status < 0)
+    return -1;
+  buffers[status] = 0;
+  truncated[0] = false;
+  return 1;
+#endif
+} /* }}} int statsd_network_recv */
 
 static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
                                size_t *ret_fds_num) {
@@ -473,6 +623,8 @@ static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
   char const *service =
       (conf_service != NULL) ? conf_service : STATSD_DEFAULT_SERVICE;
 
+  int yes = 1;
+
   struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
                               .ai_flags = AI_PASSIVE | AI_ADDRCONFIG,
                               .ai_socktype = SOCK_DGRAM};
@@ -504,6 +656,17 @@ static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
     DEBUG("statsd plugin: Trying to bind to [%s]:%s ...", str_node,
           str_service);
 
+#ifdef SO_REUSEPORT
+    /* let the kernel distribute the datagrams over the receive threads'
+     * sockets */
+    if ((conf_receive_threads > 1) &&
+        (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) != 0)) {
+      ERROR("statsd plugin: setsockopt (reuseport): %s", STRERRNO);
+      close(fd);
+      continue;
+    }
+#endif
+
     status = bind(fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
     if (status != 0) {
       ERROR("statsd plugin: bind(2) to [%s]:%s failed: %s", str_node,
@@ -542,18 +705,31 @@ static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
 
 static void *statsd_network_thread(void *args) /* {{{ */
 {
+  statsd_receiver_t *r = args;
   struct pollfd *fds = NULL;
   size_t fds_num = 0;
+  bool truncated[STATSD_RECEIVE_BATCH_SIZE];
+  size_t stride = conf_buffer_size + 1;
   int status;
 
+  char *buffers = malloc(STATSD_RECEIVE_BATCH_SIZE * stride);
+  if (buffers == NULL) {
+    ERROR("statsd plugin: malloc failed.");
+    return (void *)0;
+  }
+
   status = statsd_network_init(&fds, &fds_num);
   if (status != 0) {
     ERROR("statsd plugin: Unable to open listening sockets.");
+    sfree(buffers);
     pthread_exit((void *)0);
   }
 
   while (!network_thread_shutdown) {
-    status = poll(fds, (nfds_t)fds_num, /* timeout = */ -1);
+    /* The timeout makes sure the thread notices `network_thread_shutdown'
+     * even if the signal sent by statsd_shutdown() arrives before poll(2) is
+     * called. */
+    status = poll(fds, (nfds_t)fds_num, /* timeout = */ 1000);
     if (status < 0) {
 
       if ((errno == EINTR) || (errno == EAGAIN))
@@ -566,9 +742,37 @@ static void *statsd_network_thread(void *args) /* {{{ */
     for (size_t i = 0; i < fds_num; i++) {
       if ((fds[i].revents & (POLLIN | POLLPRI)) == 0)
         continue;
-
-      statsd_network_read(fds[i].fd);
       fds[i].revents = 0;
+
+      int num = statsd_network_recv(fds[i].fd, buffers, truncated);
+      if (num < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+          continue;
+        ERROR("statsd plugin: recvmmsg(2) failed: %s", STRERRNO);
+        continue;
+      }
+
+      pthread_mutex_lock(&r->lock);
+      for (int j = 0; j < num; j++) {
+        char *buffer = buffers + j * stride;
+
+        if (truncated[j]) {
+          static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+          c_complain(LOG_WARNING, &complaint,
+                     "statsd plugin: Received a datagram larger than "
+                     "BufferSize (%" PRIsz " bytes). Its last line is "
+                     "ignored.",
+                     conf_buffer_size);
+
+          char *end = strrchr(buffer, '\n');
+          if (end == NULL)
+            continue;
+          *end = 0;
+        }
+
+        statsd_parse_buffer(r->metrics, buffer);
+      }
+      pthread_mutex_unlock(&r->lock);
     }
   } /* while (!network_thread_shutdown) */
 
@@ -576,6 +780,7 @@ static void *statsd_network_thread(void *args) /* {{{ */
   for (size_t i = 0; i < fds_num; i++)
     close(fds[i].fd);
   sfree(fds);
+  sfree(buffers);
 
   return (void *)0;
 } /* }}} void *statsd_network_thread */
@@ -611,6 +816,207 @@ static int statsd_config_timer_percentile(oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int statsd_config_timer_percentile */
 
+static int statsd_config_timer_histogram(oconfig_item_t *ci) /* {{{ */
+{
+  if (ci->values_num < 1) {
+    ERROR("statsd plugin: The \"%s\" option requires one or more numbers.",
+          ci->key);
+    return EINVAL;
+  }
+
+  for (int i = 0; i < ci->values_num; i++) {
+    if (ci->values[i].type != OCONFIG_TYPE_NUMBER) {
+      ERROR("statsd plugin: The \"%s\" option requires one or more numbers.",
+            ci->key);
+      return EINVAL;
+    }
+
+    double bound = ci->values[i].value.number;
+    if (!(bound > 0.0)) {
+      ERROR("statsd plugin: The bucket bounds of \"%s\" must be positive.",
+            ci->key);
+      return ERANGE;
+    }
+
+    /* Insert in order, ignoring duplicates. */
+    size_t pos = 0;
+    while ((pos < conf_timer_histogram_num) &&
+           (conf_timer_histogram[pos] < bound))
+      pos++;
+    if ((pos < conf_timer_histogram_num) &&
+        (conf_timer_histogram[pos] == bound))
+      continue;
+
+    double *tmp = realloc(conf_timer_histogram,
+                          sizeof(*tmp) * (conf_timer_histogram_num + 1));
+    if (tmp == NULL) {
+      ERROR("statsd plugin: realloc failed.");
+      return ENOMEM;
+    }
+    conf_timer_histogram = tmp;
+    memmove(conf_timer_histogram + pos + 1, conf_timer_histogram + pos,
+            sizeof(*conf_timer_histogram) * (conf_timer_histogram_num - pos));
+    conf_timer_histogram[pos] = bound;
+    conf_timer_histogram_num++;
+  }
+
+  return 0;
+} /* }}} int statsd_config_timer_histogram */
+
+static int statsd_config_timer_backend(oconfig_item_t *ci) /* {{{ */
+{
+  char *backend = NULL;
+
+  int status = cf_util_get_string(ci, &backend);
+  if (status != 0)
+    return status;
+
+  if (strcasecmp("Histogram", backend) == 0)
+    conf_timer_sketch = false;
+  else if (strcasecmp("Sketch", backend) == 0)
+    conf_timer_sketch = true;
+  else {
+    ERROR("statsd plugin: Invalid \"%s\" \"%s\". Valid backends are "
+          "\"Histogram\" and \"Sketch\".",
+          ci->key, backend);
+    status = EINVAL;
+  }
+
+  sfree(backend);
+  return status;
+} /* }}} int statsd_config_timer_backend */
+
+static int statsd_config_timer_accuracy(oconfig_item_t *ci) /* {{{ */
+{
+  double accuracy = NAN;
+
+  int status = cf_util_get_double(ci, &accuracy);
+  if (status != 0)
+    return status;
+
+  if (!(accuracy >= 0.0001) || !(accuracy <= 0.5)) {
+    ERROR("statsd plugin: The value for \"%s\" must be between 0.0001 and "
+          "0.5.",
+          ci->key);
+    return ERANGE;
+  }
+
+  conf_timer_accuracy = accuracy;
+  return 0;
+} /* }}} int statsd_config_timer_accuracy */
+
+static int statsd_config_set_exact_limit(oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+
+  int status = cf_util_get_int(ci, &tmp);
+  if (status != 0)
+    return status;
+
+  if (tmp < 0) {
+    ERROR("statsd plugin: The \"%s\" option must not be negative.", ci->key);
+    return ERANGE;
+  }
+
+  conf_set_exact_limit = (size_t)tmp;
+  return 0;
+} /* }}} int statsd_config_set_exact_limit */
+
+static int statsd_config_set_precision(oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+
+  int status = cf_util_get_int(ci, &tmp);
+  if (status != 0)
+    return status;
+
+  if ((tmp < HLL_PRECISION_MIN) || (tmp > HLL_PRECISION_MAX)) {
+    ERROR("statsd plugin: The \"%s\" option must be between %d and %d.",
+          ci->key, HLL_PRECISION_MIN, HLL_PRECISION_MAX);
+    return ERANGE;
+  }
+
+  conf_set_precision = tmp;
+  return 0;
+} /* }}} int statsd_config_set_precision */
+
+static int statsd_config_receive_threads(oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+
+  int status = cf_util_get_int(ci, &tmp);
+  if (status != 0)
+    return status;
+
+  if ((tmp < 1) || (tmp > 256)) {
+    ERROR("statsd plugin: The \"%s\" option must be between 1 and 256.",
+          ci->key);
+    return ERANGE;
+  }
+
+#ifndef SO_REUSEPORT
+  if (tmp > 1) {
+    WARNING("statsd plugin: SO_REUSEPORT is not available on this system, "
+            "using a single receive thread.");
+    tmp = 1;
+  }
+#endif
+
+  conf_receive_threads = (size_t)tmp;
+  return 0;
+} /* }}} int statsd_config_receive_threads */
+
+static int statsd_config_receive_cpus(oconfig_item_t *ci) /* {{{ */
+{
+  if (ci->values_num < 1) {
+    ERROR("statsd plugin: The \"%s\" option needs at least one argument.",
+          ci->key);
+    return EINVAL;
+  }
+
+  int *cpus = calloc(ci->values_num, sizeof(*cpus));
+  if (cpus == NULL) {
+    ERROR("statsd plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  for (int i = 0; i < ci->values_num; i++) {
+    if ((ci->values[i].type != OCONFIG_TYPE_NUMBER) ||
+        (ci->values[i].value.number < 0) ||
+        (ci->values[i].value.number > INT_MAX)) {
+      ERROR("statsd plugin: The arguments of the \"%s\" option must be CPU "
+            "numbers.",
+            ci->key);
+      sfree(cpus);
+      return EINVAL;
+    }
+    cpus[i] = (int)ci->values[i].value.number;
+  }
+
+  sfree(conf_receive_cpus);
+  conf_receive_cpus = cpus;
+  conf_receive_cpus_num = (size_t)ci->values_num;
+  return 0;
+} /* }}} int statsd_config_receive_cpus */
+
+static int statsd_config_buffer_size(oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+
+  int status = cf_util_get_int(ci, &tmp);
+  if (status != 0)
+    return status;
+
+  if ((tmp < 1024) || (tmp > 65535)) {
+    ERROR("statsd plugin: The \"%s\" option must be between 1024 and 65535.",
+          ci->key);
+    return ERANGE;
+  }
+
+  conf_buffer_size = (size_t)tmp;
+  return 0;
+} /* }}} int statsd_config_buffer_size */
+
 static int statsd_config(oconfig_item_t *ci) /* {{{ */
 {
   for (int i = 0; i < ci->children_num; i++) {
@@ -620,6 +1026,12 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_string(child, &conf_node);
     else if (strcasecmp("Port", child->key) == 0)
       cf_util_get_service(child, &conf_service);
+    else if (strcasecmp("ReceiveThreads", child->key) == 0)
+      statsd_config_receive_threads(child);
+    else if (strcasecmp("ReceiveThreadCPUs", child->key) == 0)
+      statsd_config_receive_cpus(child);
+    else if (strcasecmp("BufferSize", child->key) == 0)
+      statsd_config_buffer_size(child);
     else if (strcasecmp("DeleteCounters", child->key) == 0)
       cf_util_get_boolean(child, &conf_delete_counters);
     else if (strcasecmp("DeleteTimers", child->key) == 0)
@@ -640,6 +1052,16 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_boolean(child, &conf_timer_count);
     else if (strcasecmp("TimerPercentile", child->key) == 0)
       statsd_config_timer_percentile(child);
+    else if (strcasecmp("TimerHistogram", child->key) == 0)
+      statsd_config_timer_histogram(child);
+    else if (strcasecmp("SetExactLimit", child->key) == 0)
+      statsd_config_set_exact_limit(child);
+    else if (strcasecmp("SetPrecision", child->key) == 0)
+      statsd_config_set_precision(child);
+    else if (strcasecmp("TimerBackend", child->key) == 0)
+      statsd_config_timer_backend(child);
+    else if (strcasecmp("TimerAccuracy", child->key) == 0)
+      statsd_config_timer_accuracy(child);
     else
       ERROR("statsd plugin: The \"%s\" config option is not valid.",
             child->key);
@@ -648,31 +1070,184 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int statsd_config */
 
+static void statsd_metrics_free(c_avl_tree_t *tree) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  if (tree == NULL)
+    return;
+
+  while (c_avl_pick(tree, &key, &value) == 0) {
+    sfree(key);
+    statsd_metric_free(value);
+  }
+  c_avl_destroy(tree);
+} /* }}} void statsd_metrics_free */
+
+/* Pins a receive thread to a CPU, ideally the one handling the interrupts of
+ * the NIC queue its SO_REUSEPORT socket is fed by. */
+static void statsd_receiver_set_affinity(statsd_receiver_t *r, /* {{{ */
+                                         int cpu) {
+#if HAVE_PTHREAD_SETAFFINITY_NP
+  if (cpu >= CPU_SETSIZE) {
+    WARNING("statsd plugin: CPU %i is out of range.", cpu);
+    return;
+  }
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  int status = pthread_setaffinity_np(r->thread, sizeof(set), &set);
+  if (status != 0)
+    WARNING("statsd plugin: Pinning a receive thread to CPU %i failed: %s",
+            cpu, STRERROR(status));
+#else
+  static bool warned;
+  if (!warned) {
+    WARNING("statsd plugin: The \"ReceiveThreadCPUs\" option is not "
+            "supported on this system.");
+    warned = true;
+  }
+#endif
+} /* }}} void statsd_receiver_set_affinity */
+
 static int statsd_init(void) /* {{{ */
 {
+  statsd_memstat = memstat_get("statsd");
+
   pthread_mutex_lock(&metrics_lock);
   if (metrics_tree == NULL)
     metrics_tree = c_avl_create((int (*)(const void *, const void *))strcmp);
 
-  if (!network_thread_running) {
-    int status;
-
-    status = pthread_create(&network_thread,
-                            /* attr = */ NULL, statsd_network_thread,
-                            /* args = */ NULL);
-    if (status != 0) {
+  if (receivers == NULL) {
+    receivers = calloc(conf_receive_threads, sizeof(*receivers));
+    if (receivers == NULL) {
       pthread_mutex_unlock(&metrics_lock);
-      ERROR("statsd plugin: pthread_create failed: %s", STRERRNO);
-      return status;
+      ERROR("statsd plugin: calloc failed.");
+      return ENOMEM;
+    }
+    network_thread_shutdown = false;
+
+    for (size_t i = 0; i < conf_receive_threads; i++) {
+      statsd_receiver_t *r = receivers + i;
+
+      r->metrics = c_avl_create((int (*)(const void *, const void *))strcmp);
+      if (r->metrics == NULL) {
+        pthread_mutex_unlock(&metrics_lock);
+        ERROR("statsd plugin: c_avl_create failed.");
+        return ENOMEM;
+      }
+      pthread_mutex_init(&r->lock, /* attr = */ NULL);
+      receivers_num++;
+
+      int status = plugin_thread_create(&r->thread, /* attr = */ NULL,
+                                        statsd_network_thread, r,
+                                        "statsd recv");
+      if (status != 0) {
+        pthread_mutex_unlock(&metrics_lock);
+        ERROR("statsd plugin: pthread_create failed: %s", STRERROR(status));
+        return status;
+      }
+      r->running = true;
+
+      if (conf_receive_cpus_num > 0)
+        statsd_receiver_set_affinity(
+            r, conf_receive_cpus[i % conf_receive_cpus_num]);
     }
   }
-  network_thread_running = true;
 
   pthread_mutex_unlock(&metrics_lock);
 
   return 0;
 } /* }}} int statsd_init */
 
+/* Adds the updates collected in a shard to the metric of the same name in
+ * "metrics_tree". Must hold metrics_lock when calling this function. */
+static int statsd_metric_merge_unsafe(char const *key, /* {{{ */
+                                      statsd_metric_t *src) {
+  statsd_metric_t *dst;
+
+  /* Keys have a prefix, e.g. "c:", which determines the (statsd) type. */
+  dst = statsd_metric_lookup_unsafe(metrics_tree, key + 2, src->type);
+  if (dst == NULL)
+    return -1;
+
+  switch (src->type) {
+  case STATSD_COUNTER:
+    dst->value += src->value;
+    break;
+
+  case STATSD_GAUGE:
+    if (src->value_set)
+      dst->value = src->value;
+    else
+      dst->value += src->value;
+    break;
+
+  case STATSD_TIMER:
+    if (src->latency != NULL) {
+      if (dst->latency == NULL)
+        dst->latency = statsd_latency_create();
+      if (dst->latency == NULL)
+        return ENOMEM;
+      latency_counter_merge(dst->latency, src->latency);
+    }
+
+    if (src->histogram != NULL) {
+      if (statsd_histogram_alloc(dst) != 0)
+        return ENOMEM;
+      for (size_t i = 0; i < conf_timer_histogram_num; i++)
+        dst->histogram[i] += src->histogram[i];
+      dst->histogram_count += src->histogram_count;
+      dst->histogram_sum += src->histogram_sum;
+    }
+    break;
+
+  case STATSD_SET:
+    /* Once either side is estimated, the result is, too. */
+    if (src->set_hll != NULL) {
+      if (statsd_set_check_limit(dst, /* force = */ true) != 0)
+        return ENOMEM;
+      c_hll_var_merge(dst->set_hll, src->set_hll);
+      break;
+    }
+
+    if (src->set == NULL)
+      break;
+
+    if (dst->set_hll != NULL) {
+      char *set_key;
+      void *value;
+      while (c_avl_pick(src->set, (void *)&set_key, &value) == 0) {
+        c_hll_var_add(dst->set_hll, identifier_hash(set_key));
+        statsd_set_key_free(set_key);
+      }
+      break;
+    }
+
+    if (dst->set == NULL)
+      dst->set = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (dst->set == NULL)
+      return ENOMEM;
+
+    /* Move the keys over, so they are not copied. */
+    char *set_key;
+    void *value;
+    while (c_avl_pick(src->set, (void *)&set_key, &value) == 0) {
+      if (c_avl_insert(dst->set, set_key, /* value = */ NULL) != 0)
+        statsd_set_key_free(set_key);
+    }
+    if (statsd_set_check_limit(dst, /* force = */ false) != 0)
+      return ENOMEM;
+    break;
+  }
+
+  dst->updates_num += src->updates_num;
+  return 0;
+} /* }}} int statsd_metric_merge_unsafe */
+
 /* Must hold metrics_lock when calling this function. */
 static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
 {
@@ -682,11 +1257,15 @@ static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
   if ((metric == NULL) || (metric->type != STATSD_SET))
     return EINVAL;
 
+  /* Start counting exactly again. */
+  c_hll_var_destroy(metric->set_hll);
+  metric->set_hll = NULL;
+
   if (metric->set == NULL)
     return 0;
 
   while (c_avl_pick(metric->set, &key, &value) == 0) {
-    sfree(key);
+    statsd_set_key_free(key);
     sfree(value);
   }
 
@@ -766,6 +1345,37 @@ static int statsd_metric_submit_unsafe(char const *name,
       plugin_dispatch_values(&vl);
     }
 
+    /* The histogram is dispatched as the number of events, with the buckets in
+     * the meta data, see utils_histogram.h. */
+    if (metric->histogram != NULL) {
+      histogram_bucket_t buckets[conf_timer_histogram_num];
+      uint64_t cumulative_count = 0;
+      for (size_t i = 0; i < conf_timer_histogram_num; i++) {
+        cumulative_count += metric->histogram[i];
+        buckets[i] = (histogram_bucket_t){
+            .upper_bound = conf_timer_histogram[i],
+            .cumulative_count = cumulative_count,
+        };
+      }
+      histogram_t h = {
+          .buckets = buckets,
+          .buckets_num = conf_timer_histogram_num,
+          .count = metric->histogram_count,
+          .sum = metric->histogram_sum,
+      };
+
+      value_list_t hvl = vl;
+      hvl.values = &(value_t){.derive = (derive_t)metric->histogram_count};
+      sstrncpy(hvl.type, "latency_histogram", sizeof(hvl.type));
+      sstrncpy(hvl.type_instance, name, sizeof(hvl.type_instance));
+      hvl.meta = meta_data_create();
+      if ((hvl.meta != NULL) && (histogram_meta_add(hvl.meta, &h) == 0))
+        plugin_dispatch_values(&hvl);
+      else
+        ERROR("statsd plugin: Adding the histogram of \"%s\" failed.", name);
+      meta_data_destroy(hvl.meta);
+    }
+
     /* Keep this at the end, since vl.type is set to "gauge" here. The
      * vl.type's above are implicitly set to "latency". */
     if (conf_timer_count) {
@@ -778,7 +1388,9 @@ static int statsd_metric_submit_unsafe(char const *name,
     latency_counter_reset(metric->latency);
     return 0;
   } else if (metric->type == STATSD_SET) {
-    if (metric->set == NULL)
+    if (metric->set_hll != NULL)
+      vl.values[0].gauge = (gauge_t)nearbyint(c_hll_var_count(metric->set_hll));
+    else if (metric->set == NULL)
       vl.values[0].gauge = 0.0;
     else
       vl.values[0].gauge = (gauge_t)c_avl_size(metric->set);
@@ -818,8 +1430,44 @@ static int statsd_read(void) /* {{{ */
   char **to_be_deleted = NULL;
   size_t to_be_deleted_num = 0;
 
+  if (receivers_num == 0)
+    return 0;
+
+  /* Swap each shard for an empty one, so the receive threads are only blocked
+   * for as long as that takes, and merge the full ones below. */
+  c_avl_tree_t *shards[receivers_num];
+  for (size_t i = 0; i < receivers_num; i++) {
+    shards[i] = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (shards[i] == NULL) {
+      ERROR("statsd plugin: c_avl_create failed.");
+      continue;
+    }
+
+    pthread_mutex_lock(&receivers[i].lock);
+    c_avl_tree_t *tmp = receivers[i].metrics;
+    receivers[i].metrics = shards[i];
+    shards[i] = tmp;
+    pthread_mutex_unlock(&receivers[i].lock);
+  }
+
   pthread_mutex_lock(&metrics_lock);
 
+  for (size_t i = 0; i < receivers_num; i++) {
+    if (shards[i] == NULL)
+      continue;
+
+    if (metrics_tree != NULL) {
+      iter = c_avl_get_iterator(shards[i]);
+      while (c_avl_iterator_next(iter, (void *)&name, (void *)&metric) == 0) {
+        if (statsd_metric_merge_unsafe(name, metric) != 0)
+          ERROR("statsd plugin: Merging metric \"%s\" failed.", name);
+      }
+      c_avl_iterator_destroy(iter);
+    }
+
+    statsd_metrics_free(shards[i]);
+  }
+
   if (metrics_tree == NULL) {
     pthread_mutex_unlock(&metrics_lock);
     return 0;
@@ -872,27 +1520,34 @@ static int statsd_read(void) /* {{{ */
 
 static int statsd_shutdown(void) /* {{{ */
 {
-  void *key;
-  void *value;
+  network_thread_shutdown = true;
+  for (size_t i = 0; i < receivers_num; i++) {
+    if (!receivers[i].running)
+      continue;
 
-  if (network_thread_running) {
-    network_thread_shutdown = true;
-    pthread_kill(network_thread, SIGTERM);
-    pthread_join(network_thread, /* retval = */ NULL);
+    pthread_kill(receivers[i].thread, SIGTERM);
+    pthread_join(receivers[i].thread, /* retval = */ NULL);
+    receivers[i].running = false;
   }
-  network_thread_running = false;
 
   pthread_mutex_lock(&metrics_lock);
 
-  while (c_avl_pick(metrics_tree, &key, &value) == 0) {
-    sfree(key);
-    statsd_metric_free(value);
+  for (size_t i = 0; i < receivers_num; i++) {
+    statsd_metrics_free(receivers[i].metrics);
+    pthread_mutex_destroy(&receivers[i].lock);
   }
-  c_avl_destroy(metrics_tree);
+  sfree(receivers);
+  receivers_num = 0;
+
+  statsd_metrics_free(metrics_tree);
   metrics_tree = NULL;
 
   sfree(conf_node);
   sfree(conf_service);
+  sfree(conf_timer_histogram);
+  conf_timer_histogram_num = 0;
+  sfree(conf_receive_cpus);
+  conf_receive_cpus_num = 0;
 
   pthread_mutex_unlock(&metrics_lock);
 
@@ -34,9 +34,15 @@
 
 #include "plugin.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #define log_err(...) ERROR("table plugin: " __VA_ARGS__)
 #define log_warn(...) WARNING("table plugin: " __VA_ARGS__)
 
+/* Size of the chunks in which the files are read. */
+#define TBL_CHUNK_SIZE 65536
+
 /*
  * private data types
  */
@@ -62,6 +68,21 @@ typedef struct {
   size_t results_num;
 
   size_t max_colnum;
+  bool sep_map[256];
+
+  /* Content of the file, kept between reads while the file is unchanged */
+  char *buffer;
+  size_t buffer_size;
+  size_t buffer_len;
+  bool cached;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+
+  /* Copy of the columns of the current line */
+  char *line;
+  size_t line_size;
 } tbl_t;
 
 static void tbl_result_setup(tbl_result_t *res) {
@@ -104,6 +125,15 @@ static void tbl_setup(tbl_t *tbl, char *file) {
   tbl->results_num = 0;
 
   tbl->max_colnum = 0;
+  memset(tbl->sep_map, 0, sizeof(tbl->sep_map));
+
+  tbl->buffer = NULL;
+  tbl->buffer_size = 0;
+  tbl->buffer_len = 0;
+  tbl->cached = false;
+
+  tbl->line = NULL;
+  tbl->line_size = 0;
 } /* tbl_setup */
 
 static void tbl_clear(tbl_t *tbl) {
@@ -124,6 +154,14 @@ static void tbl_clear(tbl_t *tbl) {
   tbl->results_num = 0;
 
   tbl->max_colnum = 0;
+
+  sfree(tbl->buffer);
+  tbl->buffer_size = 0;
+  tbl->buffer_len = 0;
+  tbl->cached = false;
+
+  sfree(tbl->line);
+  tbl->line_size = 0;
 } /* tbl_clear */
 
 static tbl_t *tables;
@@ -260,6 +298,8 @@ static int tbl_config_table(oconfig_item_t *ci) {
     status = 1;
   } else {
     strunescape(tbl->sep, strlen(tbl->sep) + 1);
+    for (char const *c = tbl->sep; *c != '\0'; c++)
+      tbl->sep_map[(unsigned char)*c] = true;
   }
 
   if (tbl->instance == NULL) {
@@ -392,18 +432,25 @@ static int tbl_result_dispatch(tbl_t *tbl, tbl_result_t *res, char **fields,
   return 0;
 } /* tbl_result_dispatch */
 
-static int tbl_parse_line(tbl_t *tbl, char *line, size_t len) {
-  char *fields[tbl->max_colnum + 1];
+/* Splits the line into fields like strtok(3) would, but only up to the highest
+ * configured column, and copies only the part of the line holding them. */
+static int tbl_parse_line(tbl_t *tbl, char const *line, size_t len) {
+  size_t starts[tbl->max_colnum + 1];
+  size_t ends[tbl->max_colnum + 1];
   size_t i = 0;
 
-  char *ptr = line;
-  char *saveptr = NULL;
-  while ((fields[i] = strtok_r(ptr, tbl->sep, &saveptr)) != NULL) {
-    ptr = NULL;
-    i++;
-
-    if (i > tbl->max_colnum)
+  size_t pos = 0;
+  while (i <= tbl->max_colnum) {
+    while ((pos < len) && tbl->sep_map[(unsigned char)line[pos]])
+      pos++;
+    if (pos >= len)
       break;
+
+    starts[i] = pos;
+    while ((pos < len) && !tbl->sep_map[(unsigned char)line[pos]])
+      pos++;
+    ends[i] = pos;
+    i++;
   }
 
   if (i <= tbl->max_colnum) {
@@ -413,6 +460,24 @@ static int tbl_parse_line(tbl_t *tbl, char *line, size_t len) {
     return -1;
   }
 
+  size_t size = ends[tbl->max_colnum] + 1;
+  if (tbl->line_size < size) {
+    char *tmp = realloc(tbl->line, size);
+    if (tmp == NULL) {
+      log_err("realloc failed: %s.", STRERRNO);
+      return -1;
+    }
+    tbl->line = tmp;
+    tbl->line_size = size;
+  }
+  memcpy(tbl->line, line, size - 1);
+
+  char *fields[tbl->max_colnum + 1];
+  for (i = 0; i <= tbl->max_colnum; ++i) {
+    tbl->line[ends[i]] = '\0';
+    fields[i] = tbl->line + starts[i];
+  }
+
   for (i = 0; i < tbl->results_num; ++i)
     if (tbl_result_dispatch(tbl, tbl->results + i, fields,
                             STATIC_ARRAY_SIZE(fields)) != 0) {
@@ -422,35 +487,95 @@ static int tbl_parse_line(tbl_t *tbl, char *line, size_t len) {
   return 0;
 } /* tbl_parse_line */
 
-static int tbl_read_table(tbl_t *tbl) {
-  char buf[4096];
+/* Reads the file into tbl->buffer, unless the content read last time is still
+ * current. */
+static int tbl_read_file(tbl_t *tbl) {
+  struct stat st;
 
-  FILE *fh = fopen(tbl->file, "r");
-  if (fh == NULL) {
+  if (tbl->cached && (stat(tbl->file, &st) == 0) && (st.st_dev == tbl->dev) &&
+      (st.st_ino == tbl->ino) && (st.st_size == tbl->size) &&
+      (st.st_mtime == tbl->mtime))
+    return 0;
+  tbl->cached = false;
+
+  int fd = open(tbl->file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
     log_err("Failed to open file \"%s\": %s.", tbl->file, STRERRNO);
     return -1;
   }
 
-  buf[sizeof(buf) - 1] = '\0';
-  while (fgets(buf, sizeof(buf), fh) != NULL) {
-    if (buf[sizeof(buf) - 1] != '\0') {
-      buf[sizeof(buf) - 1] = '\0';
-      log_warn("Table %s: Truncated line: %s", tbl->file, buf);
+  if (fstat(fd, &st) != 0) {
+    log_err("Failed to stat file \"%s\": %s.", tbl->file, STRERRNO);
+    close(fd);
+    return -1;
+  }
+
+  tbl->buffer_len = 0;
+  while (true) {
+    if (tbl->buffer_size - tbl->buffer_len < TBL_CHUNK_SIZE) {
+      size_t size = tbl->buffer_size + TBL_CHUNK_SIZE;
+      if ((off_t)size <= st.st_size)
+        size = (size_t)st.st_size + 1;
+
+      char *tmp = realloc(tbl->buffer, size);
+      if (tmp == NULL) {
+        log_err("realloc failed: %s.", STRERRNO);
+        close(fd);
+        return -1;
+      }
+      tbl->buffer = tmp;
+      tbl->buffer_size = size;
     }
 
-    if (tbl_parse_line(tbl, buf, sizeof(buf)) != 0) {
-      log_warn("Table %s: Failed to parse line: %s", tbl->file, buf);
-      continue;
+    ssize_t status = read(fd, tbl->buffer + tbl->buffer_len,
+                          tbl->buffer_size - tbl->buffer_len);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      log_err("Failed to read from file \"%s\": %s.", tbl->file, STRERRNO);
+      close(fd);
+      return -1;
     }
+    if (status == 0)
+      break;
+    tbl->buffer_len += (size_t)status;
+  }
+  close(fd);
+
+  /* Files in /proc and /sys report sizes not matching their content and are
+   * read every time. So are files modified within the last second, which may
+   * be modified again without their mtime changing. */
+  if (S_ISREG(st.st_mode) && (st.st_size == (off_t)tbl->buffer_len) &&
+      (st.st_mtime < time(NULL) - 1)) {
+    tbl->cached = true;
+    tbl->dev = st.st_dev;
+    tbl->ino = st.st_ino;
+    tbl->size = st.st_size;
+    tbl->mtime = st.st_mtime;
   }
 
-  if (ferror(fh) != 0) {
-    log_err("Failed to read from file \"%s\": %s.", tbl->file, STRERRNO);
-    fclose(fh);
+  return 0;
+} /* tbl_read_file */
+
+static int tbl_read_table(tbl_t *tbl) {
+  if (tbl_read_file(tbl) != 0)
     return -1;
+
+  char const *ptr = tbl->buffer;
+  char const *end = tbl->buffer + tbl->buffer_len;
+  while (ptr < end) {
+    char const *eol = memchr(ptr, '\n', (size_t)(end - ptr));
+    if (eol == NULL)
+      eol = end;
+
+    size_t len = (size_t)(eol - ptr);
+    if (tbl_parse_line(tbl, ptr, len) != 0)
+      log_warn("Table %s: Failed to parse line: %.*s", tbl->file, (int)len,
+               ptr);
+
+    ptr = eol + 1;
   }
 
-  fclose(fh);
   return 0;
 } /* tbl_read_table */
 
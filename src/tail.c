@@ -241,7 +241,13 @@ static int ctail_config_add_file(oconfig_item_t *ci) {
       status = cf_util_get_string(option, &plugin_instance);
     else if (strcasecmp("Interval", option->key) == 0)
       cf_util_get_cdtime(option, &interval);
-    else if (strcasecmp("Match", option->key) == 0) {
+    else if (strcasecmp("ReportStats", option->key) == 0) {
+      bool report_stats = false;
+      status = cf_util_get_boolean(option, &report_stats);
+      if ((status == 0) && report_stats)
+        tail_match_set_stats(
+            tm, (plugin_name != NULL) ? plugin_name : "tail", plugin_instance);
+    } else if (strcasecmp("Match", option->key) == 0) {
       status = ctail_config_add_match(tm, plugin_name, plugin_instance, option);
       if (status == 0)
         num_matches++;
@@ -38,6 +38,7 @@ struct metric_definition_s {
   char *type;
   char *instance;
   int data_source_type;
+  data_set_t const *ds;
   ssize_t value_from;
   struct metric_definition_s *next;
 };
@@ -51,6 +52,9 @@ struct instance_definition_s {
   metric_definition_t **metric_list;
   size_t metric_list_len;
   ssize_t time_from;
+  /* Only the columns up to the highest one referenced are split. */
+  char **fields;
+  size_t fields_num;
   struct instance_definition_s *next;
 };
 typedef struct instance_definition_s instance_definition_t;
@@ -58,32 +62,161 @@ typedef struct instance_definition_s instance_definition_t;
 /* Private */
 static metric_definition_t *metric_head;
 
-static int tcsv_submit(instance_definition_t *id, metric_definition_t *md,
-                       value_t v, cdtime_t t) {
-  /* Registration variables */
-  value_list_t vl = VALUE_LIST_INIT;
+static const double tcsv_pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                    1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                    1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* Parses a decimal floating point number without strtod(3) and its locale
+ * handling. Only numbers whose mantissa and power of ten are exactly
+ * representable as doubles are handled, so that the result is correctly
+ * rounded; false is returned for everything else, including hexadecimal
+ * numbers, "nan" and "inf", and the caller has to fall back to strtod(3). */
+static bool tcsv_parse_double(char const *str, double *ret_value) {
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool negative = false;
+  bool have_digits = false;
+
+  while ((*str == ' ') || (*str == '\t'))
+    str++;
+  if ((*str == '-') || (*str == '+')) {
+    negative = (*str == '-');
+    str++;
+  }
 
-  /* Register */
-  vl.values_len = 1;
-  vl.values = &v;
+  for (; (*str >= '0') && (*str <= '9'); str++) {
+    if (digits >= 19)
+      return false;
+    mantissa = 10 * mantissa + (uint64_t)(*str - '0');
+    if (mantissa != 0)
+      digits++;
+    have_digits = true;
+  }
+  if (*str == '.') {
+    for (str++; (*str >= '0') && (*str <= '9'); str++) {
+      if (digits >= 19)
+        return false;
+      mantissa = 10 * mantissa + (uint64_t)(*str - '0');
+      if (mantissa != 0)
+        digits++;
+      exponent--;
+      have_digits = true;
+    }
+  }
+  if (!have_digits)
+    return false;
 
-  sstrncpy(vl.plugin, (id->plugin_name != NULL) ? id->plugin_name : "tail_csv",
-           sizeof(vl.plugin));
-  if (id->instance != NULL)
-    sstrncpy(vl.plugin_instance, id->instance, sizeof(vl.plugin_instance));
-  sstrncpy(vl.type, md->type, sizeof(vl.type));
-  if (md->instance != NULL)
-    sstrncpy(vl.type_instance, md->instance, sizeof(vl.type_instance));
+  if ((*str == 'e') || (*str == 'E')) {
+    bool exp_negative = false;
+    int exp_value = 0;
 
-  vl.time = t;
+    str++;
+    if ((*str == '-') || (*str == '+')) {
+      exp_negative = (*str == '-');
+      str++;
+    }
+    if ((*str < '0') || (*str > '9'))
+      return false;
+    for (; (*str >= '0') && (*str <= '9'); str++) {
+      if (exp_value > 1000)
+        return false;
+      exp_value = 10 * exp_value + (*str - '0');
+    }
+    exponent += exp_negative ? -exp_value : exp_value;
+  }
+
+  while ((*str == ' ') || (*str == '\t'))
+    str++;
+  if (*str != 0)
+    return false;
+
+  if ((mantissa > (UINT64_C(1) << 53)) || (exponent < -22) || (exponent > 22))
+    return false;
 
-  return plugin_dispatch_values(&vl);
+  double value = (double)mantissa;
+  if (exponent < 0)
+    value /= tcsv_pow10[-exponent];
+  else
+    value *= tcsv_pow10[exponent];
+
+  *ret_value = negative ? -value : value;
+  return true;
+}
+
+/* Parses a decimal integer. Like tcsv_parse_double(), this returns false for
+ * anything strtoll(3) with base zero may interpret differently, i.e. octal
+ * and hexadecimal numbers, and for numbers that overflow. */
+static bool tcsv_parse_integer(char const *str, bool is_signed,
+                               uint64_t *ret_value) {
+  uint64_t value = 0;
+  bool negative = false;
+
+  while ((*str == ' ') || (*str == '\t'))
+    str++;
+  if ((*str == '-') || (*str == '+')) {
+    if (!is_signed)
+      return false;
+    negative = (*str == '-');
+    str++;
+  }
+
+  char const *begin = str;
+  for (; (*str >= '0') && (*str <= '9'); str++) {
+    if (str - begin >= 18)
+      return false;
+    value = 10 * value + (uint64_t)(*str - '0');
+  }
+  if ((str == begin) || ((*begin == '0') && (str - begin > 1)))
+    return false;
+
+  while ((*str == ' ') || (*str == '\t'))
+    str++;
+  if (*str != 0)
+    return false;
+
+  *ret_value = negative ? (uint64_t)(-(int64_t)value) : value;
+  return true;
+}
+
+static int tcsv_parse_value(char const *str, value_t *ret_value,
+                            int ds_type) {
+  uint64_t integer;
+
+  switch (ds_type) {
+  case DS_TYPE_GAUGE:
+    if (tcsv_parse_double(str, &ret_value->gauge))
+      return 0;
+    break;
+  case DS_TYPE_DERIVE:
+    if (tcsv_parse_integer(str, /* is_signed = */ true, &integer)) {
+      ret_value->derive = (derive_t)integer;
+      return 0;
+    }
+    break;
+  case DS_TYPE_COUNTER:
+  case DS_TYPE_ABSOLUTE:
+    if (tcsv_parse_integer(str, /* is_signed = */ false, &integer)) {
+      if (ds_type == DS_TYPE_COUNTER)
+        ret_value->counter = (counter_t)integer;
+      else
+        ret_value->absolute = (absolute_t)integer;
+      return 0;
+    }
+    break;
+  }
+
+  return parse_value(str, ret_value, ds_type);
 }
 
 static cdtime_t parse_time(char const *tbuf) {
   double t;
   char *endptr = NULL;
 
+  if (tcsv_parse_double(tbuf, &t))
+    return DOUBLE_TO_CDTIME_T(t);
+
   errno = 0;
   t = strtod(tbuf, &endptr);
   if ((errno != 0) || (endptr == NULL) || (endptr[0] != 0))
@@ -92,32 +225,6 @@ static cdtime_t parse_time(char const *tbuf) {
   return DOUBLE_TO_CDTIME_T(t);
 }
 
-static int tcsv_read_metric(instance_definition_t *id, metric_definition_t *md,
-                            char **fields, size_t fields_num) {
-  value_t v;
-  cdtime_t t = 0;
-  int status;
-
-  if (md->data_source_type == -1)
-    return EINVAL;
-
-  assert(md->value_from >= 0);
-  if (((size_t)md->value_from) >= fields_num)
-    return EINVAL;
-
-  status = parse_value(fields[md->value_from], &v, md->data_source_type);
-  if (status != 0)
-    return status;
-
-  if (id->time_from >= 0) {
-    if (((size_t)id->time_from) >= fields_num)
-      return EINVAL;
-    t = parse_time(fields[id->time_from]);
-  }
-
-  return tcsv_submit(id, md, v, t);
-}
-
 static bool tcsv_check_index(ssize_t index, size_t fields_num,
                              char const *name) {
   if (index < 0)
@@ -131,13 +238,38 @@ static bool tcsv_check_index(ssize_t index, size_t fields_num,
   return false;
 }
 
+/* Splits the line into id->fields, stopping after the last field needed.
+ * Returns the number of fields found and sets "ret_more" if the last one is
+ * followed by a separator. */
+static size_t tcsv_split(instance_definition_t *id, char *buffer,
+                         size_t buffer_size, bool *ret_more) {
+  char *ptr = buffer;
+  char *end = buffer + buffer_size;
+  size_t fields_num = 0;
+
+  *ret_more = false;
+  while (fields_num < id->fields_num) {
+    id->fields[fields_num] = ptr;
+    fields_num++;
+
+    char *comma = memchr(ptr, ',', (size_t)(end - ptr));
+    if (comma == NULL)
+      return fields_num;
+    *comma = 0;
+    ptr = comma + 1;
+  }
+
+  *ret_more = true;
+  return fields_num;
+}
+
+/* Dispatches all metrics of one line. The parts of the value list shared by
+ * the metrics are only set up once. */
 static int tcsv_read_buffer(instance_definition_t *id, char *buffer,
                             size_t buffer_size) {
-  char **metrics;
-  size_t metrics_num;
-
-  char *ptr;
-  size_t i;
+  value_list_t vl = VALUE_LIST_INIT;
+  size_t fields_num;
+  bool more;
 
   /* Remove newlines at the end of line. */
   while (buffer_size > 0) {
@@ -154,53 +286,51 @@ static int tcsv_read_buffer(instance_definition_t *id, char *buffer,
   if ((buffer_size == 0) || (buffer[0] == '#'))
     return 0;
 
-  /* Count the number of fields. */
-  metrics_num = 1;
-  for (i = 0; i < buffer_size; i++) {
-    if (buffer[i] == ',')
-      metrics_num++;
-  }
-
-  if (metrics_num == 1) {
+  fields_num = tcsv_split(id, buffer, buffer_size, &more);
+  if ((fields_num == 1) && !more) {
     ERROR("tail_csv plugin: last line of `%s' does not contain "
           "enough values.",
           id->path);
     return -1;
   }
 
-  /* Create a list of all values */
-  metrics = calloc(metrics_num, sizeof(*metrics));
-  if (metrics == NULL) {
-    ERROR("tail_csv plugin: calloc failed.");
-    return ENOMEM;
-  }
-
-  ptr = buffer;
-  metrics[0] = ptr;
-  i = 1;
-  for (ptr = buffer; *ptr != 0; ptr++) {
-    if (*ptr != ',')
-      continue;
+  if ((id->time_from >= 0) && (((size_t)id->time_from) < fields_num))
+    vl.time = parse_time(id->fields[id->time_from]);
 
-    *ptr = 0;
-    metrics[i] = ptr + 1;
-    i++;
-  }
-  assert(i == metrics_num);
+  sstrncpy(vl.plugin, (id->plugin_name != NULL) ? id->plugin_name : "tail_csv",
+           sizeof(vl.plugin));
+  if (id->instance != NULL)
+    sstrncpy(vl.plugin_instance, id->instance, sizeof(vl.plugin_instance));
+  vl.values_len = 1;
 
-  /* Register values */
-  for (i = 0; i < id->metric_list_len; ++i) {
+  for (size_t i = 0; i < id->metric_list_len; ++i) {
     metric_definition_t *md = id->metric_list[i];
+    value_t v;
+
+    if (md->data_source_type == -1)
+      continue;
 
-    if (!tcsv_check_index(md->value_from, metrics_num, md->name) ||
-        !tcsv_check_index(id->time_from, metrics_num, md->name))
+    if (!tcsv_check_index(md->value_from, fields_num, md->name) ||
+        !tcsv_check_index(id->time_from, fields_num, md->name))
       continue;
 
-    tcsv_read_metric(id, md, metrics, metrics_num);
+    if (tcsv_parse_value(id->fields[md->value_from], &v,
+                         md->data_source_type) != 0)
+      continue;
+
+    vl.values = &v;
+    sstrncpy(vl.type, md->type, sizeof(vl.type));
+    sstrncpy(vl.type_instance, (md->instance != NULL) ? md->instance : "",
+             sizeof(vl.type_instance));
+
+    plugin_dispatch_values_ds(md->ds, &vl);
   }
 
-  /* Free up resources */
-  sfree(metrics);
+  return 0;
+}
+
+static int tcsv_read_line(void *data, char *buffer, int buffer_len) {
+  tcsv_read_buffer(data, buffer, (size_t)buffer_len);
   return 0;
 }
 
@@ -216,24 +346,12 @@ static int tcsv_read(user_data_t *ud) {
     }
   }
 
-  while (42) {
-    char buffer[1024];
-    size_t buffer_len;
-    int status;
-
-    status = cu_tail_readline(id->tail, buffer, (int)sizeof(buffer));
-    if (status != 0) {
-      ERROR("tail_csv plugin: File \"%s\": cu_tail_readline failed "
-            "with status %i.",
-            id->path, status);
-      return -1;
-    }
-
-    buffer_len = strlen(buffer);
-    if (buffer_len == 0)
-      break;
-
-    tcsv_read_buffer(id, buffer, buffer_len);
+  int status = cu_tail_read(id->tail, tcsv_read_line, id);
+  if (status != 0) {
+    ERROR("tail_csv plugin: File \"%s\": cu_tail_read failed "
+          "with status %i.",
+          id->path, status);
+    return -1;
   }
 
   return 0;
@@ -362,6 +480,7 @@ static void tcsv_instance_definition_destroy(void *arg) {
   sfree(id->instance);
   sfree(id->path);
   sfree(id->metric_list);
+  sfree(id->fields);
   sfree(id);
 }
 
@@ -477,6 +596,18 @@ static int tcsv_config_add_file(oconfig_item_t *ci) {
     return -1;
   }
 
+  id->fields_num = (id->time_from >= 0) ? (size_t)id->time_from + 1 : 1;
+  for (size_t i = 0; i < id->metric_list_len; i++)
+    if ((size_t)id->metric_list[i]->value_from >= id->fields_num)
+      id->fields_num = (size_t)id->metric_list[i]->value_from + 1;
+
+  id->fields = calloc(id->fields_num, sizeof(*id->fields));
+  if (id->fields == NULL) {
+    ERROR("tail_csv plugin: calloc failed.");
+    tcsv_instance_definition_destroy(id);
+    return -1;
+  }
+
   snprintf(cb_name, sizeof(cb_name), "tail_csv/%s", id->path);
 
   status = plugin_register_complex_read(
@@ -535,6 +666,7 @@ static int tcsv_init(void) { /* {{{ */
     }
 
     md->data_source_type = ds->ds->type;
+    md->ds = ds;
   }
 
   return 0;
@@ -0,0 +1,467 @@
+/**
+ * collectd - src/target_cardinality.c
+ * Copyright (C) 2018 The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * The "cardinality" target limits the number of new series per plugin and
+ * per host. Value lists whose identifier is already in the value cache pass
+ * unchanged. The identifiers of all others are added to a HyperLogLog sketch
+ * of their plugin and host, which estimates how many distinct new series have
+ * been seen in the current window. Once the estimate exceeds the budget,
+ * further new series are dropped or rewritten until the window ends. The
+ * sketch, unlike a counter, is not fooled by a rejected series that keeps
+ * sending values.
+ */
+
+#include "collectd.h"
+
+#include "common.h"
+#include "filter_chain.h"
+#include "utils_avltree.h"
+#include "utils_cache.h"
+#include "utils_hll.h"
+
+#define TC_DEFAULT_WINDOW TIME_T_TO_CDTIME_T(3600)
+#define TC_DEFAULT_TYPE_INSTANCE "overflow"
+
+typedef enum {
+  TC_ACTION_DROP,
+  TC_ACTION_REWRITE,
+} tc_action_t;
+
+struct tc_key_s {
+  char name[DATA_MAX_NAME_LEN];
+  c_hll_t sketch;
+  /* c_hll_count(&sketch), updated when the sketch changes. */
+  double count;
+  /* Number of rejected value lists, kept across windows. */
+  uint64_t rejected;
+};
+typedef struct tc_key_s tc_key_t;
+
+struct tc_data_s {
+  pthread_mutex_t lock;
+  /* One reference is held by the target, one by the read callback. */
+  int refs;
+  char read_name[DATA_MAX_NAME_LEN];
+
+  int plugin_budget;
+  int host_budget;
+  cdtime_t window;
+  tc_action_t action;
+  char *plugin_instance;
+  char *type_instance;
+
+  cdtime_t window_start;
+  c_avl_tree_t *plugins;
+  c_avl_tree_t *hosts;
+};
+typedef struct tc_data_s tc_data_t;
+
+/* Snapshot of a key's statistics, dispatched without holding the lock. */
+struct tc_stat_s {
+  char name[DATA_MAX_NAME_LEN];
+  char const *kind;
+  double count;
+  uint64_t rejected;
+};
+typedef struct tc_stat_s tc_stat_t;
+
+static void tc_tree_destroy(c_avl_tree_t *tree) /* {{{ */
+{
+  if (tree == NULL)
+    return;
+
+  void *key;
+  void *value;
+  while (c_avl_pick(tree, &key, &value) == 0)
+    sfree(value);
+  c_avl_destroy(tree);
+} /* }}} void tc_tree_destroy */
+
+static void tc_data_unref(void *arg) /* {{{ */
+{
+  tc_data_t *data = arg;
+  if (data == NULL)
+    return;
+
+  pthread_mutex_lock(&data->lock);
+  int refs = --data->refs;
+  pthread_mutex_unlock(&data->lock);
+  if (refs > 0)
+    return;
+
+  tc_tree_destroy(data->plugins);
+  tc_tree_destroy(data->hosts);
+  sfree(data->plugin_instance);
+  sfree(data->type_instance);
+  pthread_mutex_destroy(&data->lock);
+  sfree(data);
+} /* }}} void tc_data_unref */
+
+/* Starts a new window: forgets the new series seen so far and the keys that
+ * never rejected anything. Must be called with data->lock held. */
+static void tc_tree_reset(c_avl_tree_t *tree) /* {{{ */
+{
+  char *stale[64];
+  size_t stale_num;
+
+  do {
+    stale_num = 0;
+
+    c_avl_iterator_t *iter = c_avl_get_iterator(tree);
+    char *name;
+    tc_key_t *k;
+    while (c_avl_iterator_next(iter, (void *)&name, (void *)&k) == 0) {
+      if (k->rejected != 0) {
+        c_hll_reset(&k->sketch);
+        k->count = 0.0;
+      } else if (stale_num < STATIC_ARRAY_SIZE(stale)) {
+        stale[stale_num++] = name;
+      }
+    }
+    c_avl_iterator_destroy(iter);
+
+    for (size_t i = 0; i < stale_num; i++) {
+      void *value = NULL;
+      c_avl_remove(tree, stale[i], NULL, &value);
+      sfree(value);
+    }
+  } while (stale_num == STATIC_ARRAY_SIZE(stale));
+} /* }}} void tc_tree_reset */
+
+static void tc_rotate(tc_data_t *data, cdtime_t now) /* {{{ */
+{
+  if ((now - data->window_start) < data->window)
+    return;
+
+  tc_tree_reset(data->plugins);
+  tc_tree_reset(data->hosts);
+  data->window_start = now;
+} /* }}} void tc_rotate */
+
+/* Adds "hash" to the sketch of "name" and returns true if the estimated number
+ * of new series exceeds "budget". Must be called with data->lock held. */
+static bool tc_key_add(c_avl_tree_t *tree, char const *name, /* {{{ */
+                       uint32_t hash, int budget) {
+  tc_key_t *k = NULL;
+  if (c_avl_get(tree, name, (void *)&k) != 0) {
+    k = calloc(1, sizeof(*k));
+    if (k == NULL) {
+      ERROR("Target `cardinality': calloc failed.");
+      return false;
+    }
+    sstrncpy(k->name, name, sizeof(k->name));
+    if (c_avl_insert(tree, k->name, k) != 0) {
+      ERROR("Target `cardinality': c_avl_insert failed.");
+      sfree(k);
+      return false;
+    }
+  }
+
+  if (c_hll_add(&k->sketch, hash))
+    k->count = c_hll_count(&k->sketch);
+
+  if (k->count <= (double)budget)
+    return false;
+
+  k->rejected++;
+  return true;
+} /* }}} bool tc_key_add */
+
+static size_t tc_tree_stats(c_avl_tree_t *tree, char const *kind, /* {{{ */
+                            tc_stat_t **stats, size_t *stats_size,
+                            size_t stats_num) {
+  c_avl_iterator_t *iter = c_avl_get_iterator(tree);
+  char *name;
+  tc_key_t *k;
+  while (c_avl_iterator_next(iter, (void *)&name, (void *)&k) == 0) {
+    /* Only keys that have exceeded their budget are reported. */
+    if (k->rejected == 0)
+      continue;
+
+    if (stats_num >= *stats_size) {
+      size_t size = (*stats_size == 0) ? 16 : 2 * *stats_size;
+      tc_stat_t *tmp = realloc(*stats, size * sizeof(*tmp));
+      if (tmp == NULL)
+        break;
+      *stats = tmp;
+      *stats_size = size;
+    }
+
+    tc_stat_t *st = *stats + stats_num;
+    sstrncpy(st->name, k->name, sizeof(st->name));
+    st->kind = kind;
+    st->count = k->count;
+    st->rejected = k->rejected;
+    stats_num++;
+  }
+  c_avl_iterator_destroy(iter);
+
+  return stats_num;
+} /* }}} size_t tc_tree_stats */
+
+static void tc_submit(tc_stat_t const *st, char const *type, /* {{{ */
+                      char const *suffix, value_t value) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &value;
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "cardinality", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, st->name, sizeof(vl.plugin_instance));
+  sstrncpy(vl.type, type, sizeof(vl.type));
+  snprintf(vl.type_instance, sizeof(vl.type_instance), "%s_%s", st->kind,
+           suffix);
+
+  plugin_dispatch_values(&vl);
+} /* }}} void tc_submit */
+
+static int tc_read(user_data_t *ud) /* {{{ */
+{
+  tc_data_t *data = ud->data;
+  tc_stat_t *stats = NULL;
+  size_t stats_size = 0;
+  size_t stats_num = 0;
+
+  pthread_mutex_lock(&data->lock);
+  tc_rotate(data, cdtime_coarse());
+  stats_num = tc_tree_stats(data->plugins, "plugin", &stats, &stats_size,
+                            stats_num);
+  stats_num =
+      tc_tree_stats(data->hosts, "host", &stats, &stats_size, stats_num);
+  pthread_mutex_unlock(&data->lock);
+
+  /* Dispatched values pass through the filter chains, and thereby possibly
+   * through this target, again. */
+  for (size_t i = 0; i < stats_num; i++) {
+    tc_submit(stats + i, "derive", "rejected",
+              (value_t){.derive = (derive_t)stats[i].rejected});
+    tc_submit(stats + i, "gauge", "new_series",
+              (value_t){.gauge = (gauge_t)stats[i].count});
+  }
+
+  sfree(stats);
+  return 0;
+} /* }}} int tc_read */
+
+static int tc_config_action(oconfig_item_t const *ci, /* {{{ */
+                            tc_action_t *ret_action) {
+  char buffer[16];
+  int status = cf_util_get_string_buffer(ci, buffer, sizeof(buffer));
+  if (status != 0)
+    return status;
+
+  if (strcasecmp("Drop", buffer) == 0)
+    *ret_action = TC_ACTION_DROP;
+  else if (strcasecmp("Rewrite", buffer) == 0)
+    *ret_action = TC_ACTION_REWRITE;
+  else {
+    ERROR("Target `cardinality': Unknown action `%s'. Valid actions are "
+          "`Drop' and `Rewrite'.",
+          buffer);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int tc_config_action */
+
+static int tc_destroy(void **user_data) /* {{{ */
+{
+  if (user_data == NULL)
+    return -EINVAL;
+
+  tc_data_t *data = *user_data;
+  if (data == NULL)
+    return 0;
+
+  /* The read callback's reference is released when it is removed. */
+  if ((data->read_name[0] == 0) ||
+      (plugin_unregister_read(data->read_name) != 0))
+    tc_data_unref(data);
+  tc_data_unref(data);
+
+  *user_data = NULL;
+  return 0;
+} /* }}} int tc_destroy */
+
+static int tc_create(const oconfig_item_t *ci, void **user_data) /* {{{ */
+{
+  static int instances = 0;
+
+  tc_data_t *data = calloc(1, sizeof(*data));
+  if (data == NULL) {
+    ERROR("tc_create: calloc failed.");
+    return -ENOMEM;
+  }
+
+  pthread_mutex_init(&data->lock, NULL);
+  data->refs = 1;
+  data->window = TC_DEFAULT_WINDOW;
+  data->action = TC_ACTION_DROP;
+
+  int status = 0;
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("PluginBudget", child->key) == 0)
+      status = cf_util_get_int(child, &data->plugin_budget);
+    else if (strcasecmp("HostBudget", child->key) == 0)
+      status = cf_util_get_int(child, &data->host_budget);
+    else if (strcasecmp("Window", child->key) == 0)
+      status = cf_util_get_cdtime(child, &data->window);
+    else if (strcasecmp("Action", child->key) == 0)
+      status = tc_config_action(child, &data->action);
+    else if (strcasecmp("PluginInstance", child->key) == 0)
+      status = cf_util_get_string(child, &data->plugin_instance);
+    else if (strcasecmp("TypeInstance", child->key) == 0)
+      status = cf_util_get_string(child, &data->type_instance);
+    else {
+      ERROR("Target `cardinality': The `%s' configuration option is not "
+            "understood and will be ignored.",
+            child->key);
+      status = 0;
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  /* Additional sanity-checking */
+  while (status == 0) {
+    if ((data->plugin_budget <= 0) && (data->host_budget <= 0)) {
+      ERROR("Target `cardinality': You need to set at least one of the "
+            "`PluginBudget' and `HostBudget' options to a positive value!");
+      status = -1;
+      break;
+    }
+
+    if (data->window == 0) {
+      ERROR("Target `cardinality': `Window' must be positive.");
+      status = -1;
+      break;
+    }
+
+    if ((data->action == TC_ACTION_REWRITE) &&
+        (data->plugin_instance == NULL) && (data->type_instance == NULL)) {
+      data->type_instance = strdup(TC_DEFAULT_TYPE_INSTANCE);
+      if (data->type_instance == NULL) {
+        status = -ENOMEM;
+        break;
+      }
+    }
+
+    data->plugins = c_avl_create((int (*)(const void *, const void *))strcmp);
+    data->hosts = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if ((data->plugins == NULL) || (data->hosts == NULL)) {
+      ERROR("Target `cardinality': c_avl_create failed.");
+      status = -ENOMEM;
+      break;
+    }
+
+    break;
+  }
+
+  if (status != 0) {
+    tc_data_unref(data);
+    return status;
+  }
+
+  data->window_start = cdtime_coarse();
+
+  snprintf(data->read_name, sizeof(data->read_name), "target_cardinality-%i",
+           instances++);
+  data->refs++;
+  status = plugin_register_complex_read(
+      /* group = */ NULL, data->read_name, tc_read, cf_get_default_interval(),
+      &(user_data_t){
+          .data = data, .free_func = tc_data_unref,
+      });
+  if (status != 0) {
+    /* The reference has been released by now. The statistics are missing,
+     * but the target still works. */
+    WARNING("Target `cardinality': Registering the read callback failed.");
+    data->read_name[0] = 0;
+  }
+
+  *user_data = data;
+  return 0;
+} /* }}} int tc_create */
+
+static int tc_invoke(const data_set_t *ds, value_list_t *vl, /* {{{ */
+                     notification_meta_t __attribute__((unused)) * *meta,
+                     void **user_data) {
+  if ((ds == NULL) || (vl == NULL) || (user_data == NULL))
+    return -EINVAL;
+
+  tc_data_t *data = *user_data;
+  if (data == NULL) {
+    ERROR("Target `cardinality': Invoke: `data' is NULL.");
+    return -EINVAL;
+  }
+
+  /* Known series always pass. This is the common case; it doesn't take the
+   * target's lock. */
+  if (uc_exists(vl))
+    return FC_TARGET_CONTINUE;
+
+  uint32_t hash = vl->identifier.hash;
+  if (hash == 0) {
+    char name[6 * DATA_MAX_NAME_LEN];
+    if (FORMAT_VL(name, sizeof(name), vl) != 0)
+      return FC_TARGET_CONTINUE;
+    hash = identifier_hash(name);
+  }
+
+  pthread_mutex_lock(&data->lock);
+  tc_rotate(data, cdtime_coarse());
+
+  bool reject = false;
+  if (data->plugin_budget > 0)
+    reject |= tc_key_add(data->plugins, vl->plugin, hash, data->plugin_budget);
+  if (data->host_budget > 0)
+    reject |= tc_key_add(data->hosts, vl->host, hash, data->host_budget);
+  pthread_mutex_unlock(&data->lock);
+
+  if (!reject)
+    return FC_TARGET_CONTINUE;
+
+  if (data->action == TC_ACTION_DROP)
+    return FC_TARGET_STOP;
+
+  if (data->plugin_instance != NULL)
+    sstrncpy(vl->plugin_instance, data->plugin_instance,
+             sizeof(vl->plugin_instance));
+  if (data->type_instance != NULL)
+    sstrncpy(vl->type_instance, data->type_instance,
+             sizeof(vl->type_instance));
+
+  return FC_TARGET_CONTINUE;
+} /* }}} int tc_invoke */
+
+void module_register(void) {
+  target_proc_t tproc = {0};
+
+  tproc.create = tc_create;
+  tproc.destroy = tc_destroy;
+  tproc.invoke = tc_invoke;
+  fc_register_target("cardinality", tproc);
+} /* module_register */
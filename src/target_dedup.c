@@ -0,0 +1,241 @@
+/**
+ * collectd - src/target_dedup.c
+ * Copyright (C) 2018 The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * The "dedup" target stops the processing of value lists whose values equal
+ * those of the last value list that passed, unless the last one passed more
+ * than "Heartbeat" ago. In the PostCacheChain, the cache already holds the
+ * current values, so the values that passed last are kept in the cache's meta
+ * data, like the "scale" target does.
+ */
+
+#include "collectd.h"
+
+#include "common.h"
+#include "filter_chain.h"
+#include "meta_data.h"
+#include "utils_cache.h"
+
+#include <math.h>
+
+#define TDD_DEFAULT_HEARTBEAT TIME_T_TO_CDTIME_T(300)
+
+struct tdd_data_s {
+  cdtime_t heartbeat;
+  bool add_meta_data;
+};
+typedef struct tdd_data_s tdd_data_t;
+
+static void tdd_key(char *buffer, size_t buffer_size, /* {{{ */
+                    tdd_data_t const *data, int dsrc_index, char const *name) {
+  if (dsrc_index < 0)
+    snprintf(buffer, buffer_size, "target_dedup[%p]:%s", (void *)data, name);
+  else
+    snprintf(buffer, buffer_size, "target_dedup[%p,%i]:%s", (void *)data,
+             dsrc_index, name);
+} /* }}} void tdd_key */
+
+/* Returns true if the values of "vl" equal the stored ones. NaN equals NaN
+ * here, so that a gauge stuck at NaN is suppressed, too. */
+static bool tdd_unchanged(tdd_data_t const *data, /* {{{ */
+                          const data_set_t *ds, const value_list_t *vl) {
+  char key[128];
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    value_t v = vl->values[i];
+    int status;
+
+    tdd_key(key, sizeof(key), data, (int)i, "value");
+    if (ds->ds[i].type == DS_TYPE_GAUGE) {
+      double prev = NAN;
+      status = uc_meta_data_get_double(vl, key, &prev);
+      if ((status != 0) ||
+          ((prev != v.gauge) && !(isnan(prev) && isnan(v.gauge))))
+        return false;
+    } else if (ds->ds[i].type == DS_TYPE_DERIVE) {
+      int64_t prev = 0;
+      status = uc_meta_data_get_signed_int(vl, key, &prev);
+      if ((status != 0) || (prev != (int64_t)v.derive))
+        return false;
+    } else if (ds->ds[i].type == DS_TYPE_COUNTER) {
+      uint64_t prev = 0;
+      status = uc_meta_data_get_unsigned_int(vl, key, &prev);
+      if ((status != 0) || (prev != (uint64_t)v.counter))
+        return false;
+    } else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
+      uint64_t prev = 0;
+      status = uc_meta_data_get_unsigned_int(vl, key, &prev);
+      if ((status != 0) || (prev != (uint64_t)v.absolute))
+        return false;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+} /* }}} bool tdd_unchanged */
+
+static void tdd_store(tdd_data_t const *data, /* {{{ */
+                      const data_set_t *ds, const value_list_t *vl) {
+  char key[128];
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    value_t v = vl->values[i];
+
+    tdd_key(key, sizeof(key), data, (int)i, "value");
+    if (ds->ds[i].type == DS_TYPE_GAUGE)
+      uc_meta_data_add_double(vl, key, v.gauge);
+    else if (ds->ds[i].type == DS_TYPE_DERIVE)
+      uc_meta_data_add_signed_int(vl, key, (int64_t)v.derive);
+    else if (ds->ds[i].type == DS_TYPE_COUNTER)
+      uc_meta_data_add_unsigned_int(vl, key, (uint64_t)v.counter);
+    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+      uc_meta_data_add_unsigned_int(vl, key, (uint64_t)v.absolute);
+  }
+} /* }}} void tdd_store */
+
+/* Tells writers that unchanged values may be left out for up to "Heartbeat"
+ * and how many have been left out before this one. */
+static void tdd_add_meta_data(tdd_data_t const *data, /* {{{ */
+                              value_list_t *vl, uint64_t suppressed) {
+  if (vl->meta == NULL) {
+    /* Freed by plugin_dispatch_values(). */
+    vl->meta = meta_data_create();
+    if (vl->meta == NULL) {
+      ERROR("Target `dedup': meta_data_create failed.");
+      return;
+    }
+  }
+
+  meta_data_add_double(vl->meta, "dedup:heartbeat",
+                       CDTIME_T_TO_DOUBLE(data->heartbeat));
+  meta_data_add_unsigned_int(vl->meta, "dedup:suppressed", suppressed);
+} /* }}} void tdd_add_meta_data */
+
+static int tdd_destroy(void **user_data) /* {{{ */
+{
+  if (user_data == NULL)
+    return -EINVAL;
+
+  sfree(*user_data);
+  return 0;
+} /* }}} int tdd_destroy */
+
+static int tdd_create(const oconfig_item_t *ci, void **user_data) /* {{{ */
+{
+  tdd_data_t *data;
+  int status;
+
+  data = calloc(1, sizeof(*data));
+  if (data == NULL) {
+    ERROR("tdd_create: calloc failed.");
+    return -ENOMEM;
+  }
+
+  data->heartbeat = TDD_DEFAULT_HEARTBEAT;
+
+  status = 0;
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Heartbeat", child->key) == 0)
+      status = cf_util_get_cdtime(child, &data->heartbeat);
+    else if (strcasecmp("AddMetaData", child->key) == 0)
+      status = cf_util_get_boolean(child, &data->add_meta_data);
+    else {
+      ERROR("Target `dedup': The `%s' configuration option is not "
+            "understood and will be ignored.",
+            child->key);
+      status = 0;
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  if (status != 0) {
+    tdd_destroy((void *)&data);
+    return status;
+  }
+
+  *user_data = data;
+  return 0;
+} /* }}} int tdd_create */
+
+static int tdd_invoke(const data_set_t *ds, value_list_t *vl, /* {{{ */
+                      notification_meta_t __attribute__((unused)) * *meta,
+                      void **user_data) {
+  tdd_data_t *data;
+
+  if ((ds == NULL) || (vl == NULL) || (user_data == NULL))
+    return -EINVAL;
+
+  data = *user_data;
+  if (data == NULL) {
+    ERROR("Target `dedup': Invoke: `data' is NULL.");
+    return -EINVAL;
+  }
+
+  if (ds->ds_num != vl->values_len)
+    return FC_TARGET_CONTINUE;
+
+  char key_time[128];
+  char key_suppressed[128];
+  tdd_key(key_time, sizeof(key_time), data, -1, "time");
+  tdd_key(key_suppressed, sizeof(key_suppressed), data, -1, "suppressed");
+
+  uint64_t last = 0;
+  uint64_t suppressed = 0;
+  bool have_last = (uc_meta_data_get_unsigned_int(vl, key_time, &last) == 0);
+  if (uc_meta_data_get_unsigned_int(vl, key_suppressed, &suppressed) != 0)
+    suppressed = 0;
+
+  /* A heartbeat of zero means unchanged values are never written again. */
+  bool due = (data->heartbeat != 0) &&
+             ((vl->time < (cdtime_t)last) ||
+              ((vl->time - (cdtime_t)last) >= data->heartbeat));
+
+  if (have_last && !due && tdd_unchanged(data, ds, vl)) {
+    uc_meta_data_add_unsigned_int(vl, key_suppressed, suppressed + 1);
+    return FC_TARGET_STOP;
+  }
+
+  tdd_store(data, ds, vl);
+  uc_meta_data_add_unsigned_int(vl, key_time, (uint64_t)vl->time);
+  if (suppressed != 0)
+    uc_meta_data_add_unsigned_int(vl, key_suppressed, 0);
+
+  if (data->add_meta_data)
+    tdd_add_meta_data(data, vl, suppressed);
+
+  return FC_TARGET_CONTINUE;
+} /* }}} int tdd_invoke */
+
+void module_register(void) {
+  target_proc_t tproc = {0};
+
+  tproc.create = tdd_create;
+  tproc.destroy = tdd_destroy;
+  tproc.invoke = tdd_invoke;
+  fc_register_target("dedup", tproc);
+} /* module_register */
@@ -0,0 +1,513 @@
+/**
+ * collectd - src/target_downsample.c
+ * Copyright (C) 2018 The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * The "downsample" target aggregates the values of each identifier over
+ * windows of a fixed length and writes one value list per window to the
+ * configured write plugins. The state of the current window is kept in the
+ * value cache's meta data, like the "scale" target does, so it goes away with
+ * the cache entry. The target must be used in the PostCacheChain for that
+ * reason. The value list being processed is not changed.
+ */
+
+#include "collectd.h"
+
+#include "common.h"
+#include "filter_chain.h"
+#include "utils_cache.h"
+#include "utils_complain.h"
+
+#define TD_FUNC_AVERAGE 0x01
+#define TD_FUNC_MIN 0x02
+#define TD_FUNC_MAX 0x04
+#define TD_FUNC_LAST 0x08
+
+static struct {
+  char const *name;
+  unsigned int flag;
+} const td_functions[] = {
+    {"average", TD_FUNC_AVERAGE},
+    {"min", TD_FUNC_MIN},
+    {"max", TD_FUNC_MAX},
+    {"last", TD_FUNC_LAST},
+};
+
+struct td_writer_s {
+  char *plugin;
+  c_complain_t complaint;
+};
+typedef struct td_writer_s td_writer_t;
+
+struct td_data_s {
+  cdtime_t interval;
+  unsigned int functions;
+
+  td_writer_t *writers;
+  size_t writers_num;
+};
+typedef struct td_data_s td_data_t;
+
+/* Aggregate of one data source within the current window. Gauges use all
+ * fields; for the other types, "last" holds the last value (or, for ABSOLUTE,
+ * the sum of all values). */
+struct td_state_s {
+  gauge_t sum;
+  gauge_t min;
+  gauge_t max;
+  value_t last;
+};
+typedef struct td_state_s td_state_t;
+
+static void td_key(char *buffer, size_t buffer_size, /* {{{ */
+                   td_data_t const *data, int dsrc_index, char const *name) {
+  if (dsrc_index < 0)
+    snprintf(buffer, buffer_size, "target_downsample[%p]:%s", (void *)data,
+             name);
+  else
+    snprintf(buffer, buffer_size, "target_downsample[%p,%i]:%s", (void *)data,
+             dsrc_index, name);
+} /* }}} void td_key */
+
+static int td_get_double(td_data_t const *data, /* {{{ */
+                         const value_list_t *vl, int dsrc_index,
+                         char const *name, gauge_t *ret) {
+  char key[128];
+  td_key(key, sizeof(key), data, dsrc_index, name);
+  return uc_meta_data_get_double(vl, key, ret);
+} /* }}} int td_get_double */
+
+static int td_state_load(td_data_t const *data, /* {{{ */
+                         const data_set_t *ds, const value_list_t *vl,
+                         td_state_t *state) {
+  char key[128];
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    td_state_t *st = state + i;
+    int status;
+
+    td_key(key, sizeof(key), data, (int)i, "last");
+    switch (ds->ds[i].type) {
+    case DS_TYPE_GAUGE:
+      status = uc_meta_data_get_double(vl, key, &st->last.gauge);
+      if (status == 0)
+        status = td_get_double(data, vl, (int)i, "sum", &st->sum);
+      if (status == 0)
+        status = td_get_double(data, vl, (int)i, "min", &st->min);
+      if (status == 0)
+        status = td_get_double(data, vl, (int)i, "max", &st->max);
+      break;
+    case DS_TYPE_DERIVE: {
+      int64_t v = 0;
+      status = uc_meta_data_get_signed_int(vl, key, &v);
+      st->last.derive = (derive_t)v;
+      break;
+    }
+    case DS_TYPE_COUNTER: {
+      uint64_t v = 0;
+      status = uc_meta_data_get_unsigned_int(vl, key, &v);
+      st->last.counter = (counter_t)v;
+      break;
+    }
+    case DS_TYPE_ABSOLUTE: {
+      uint64_t v = 0;
+      status = uc_meta_data_get_unsigned_int(vl, key, &v);
+      st->last.absolute = (absolute_t)v;
+      break;
+    }
+    default:
+      status = -1;
+    }
+
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+} /* }}} int td_state_load */
+
+static void td_state_store(td_data_t const *data, /* {{{ */
+                           const data_set_t *ds, const value_list_t *vl,
+                           td_state_t const *state) {
+  char key[128];
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    td_state_t const *st = state + i;
+
+    td_key(key, sizeof(key), data, (int)i, "last");
+    switch (ds->ds[i].type) {
+    case DS_TYPE_GAUGE:
+      uc_meta_data_add_double(vl, key, st->last.gauge);
+      td_key(key, sizeof(key), data, (int)i, "sum");
+      uc_meta_data_add_double(vl, key, st->sum);
+      td_key(key, sizeof(key), data, (int)i, "min");
+      uc_meta_data_add_double(vl, key, st->min);
+      td_key(key, sizeof(key), data, (int)i, "max");
+      uc_meta_data_add_double(vl, key, st->max);
+      break;
+    case DS_TYPE_DERIVE:
+      uc_meta_data_add_signed_int(vl, key, (int64_t)st->last.derive);
+      break;
+    case DS_TYPE_COUNTER:
+      uc_meta_data_add_unsigned_int(vl, key, (uint64_t)st->last.counter);
+      break;
+    case DS_TYPE_ABSOLUTE:
+      uc_meta_data_add_unsigned_int(vl, key, (uint64_t)st->last.absolute);
+      break;
+    }
+  }
+} /* }}} void td_state_store */
+
+/* Adds the values of "vl" to the aggregate. "num" is the number of value lists
+ * aggregated so far. */
+static void td_state_add(const data_set_t *ds, /* {{{ */
+                         const value_list_t *vl, td_state_t *state,
+                         uint64_t num) {
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    td_state_t *st = state + i;
+    value_t v = vl->values[i];
+
+    if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
+      st->last.absolute =
+          (num == 0) ? v.absolute : st->last.absolute + v.absolute;
+      continue;
+    }
+
+    st->last = v;
+    if (ds->ds[i].type != DS_TYPE_GAUGE)
+      continue;
+
+    if (num == 0) {
+      st->sum = v.gauge;
+      st->min = v.gauge;
+      st->max = v.gauge;
+    } else {
+      st->sum += v.gauge;
+      if (v.gauge < st->min)
+        st->min = v.gauge;
+      if (v.gauge > st->max)
+        st->max = v.gauge;
+    }
+  }
+} /* }}} void td_state_add */
+
+static void td_write(td_data_t *data, const data_set_t *ds, /* {{{ */
+                     value_list_t const *vl) {
+  for (size_t i = 0; i < data->writers_num; i++) {
+    td_writer_t *w = data->writers + i;
+
+    int status = plugin_write(w->plugin, ds, vl);
+    if (status != 0)
+      c_complain(LOG_INFO, &w->complaint,
+                 "Target `downsample': Dispatching value to the `%s' plugin "
+                 "failed with status %i.",
+                 w->plugin, status);
+    else
+      c_release(LOG_INFO, &w->complaint,
+                "Target `downsample': Plugin `%s' is back to normal "
+                "operation.",
+                w->plugin);
+  }
+} /* }}} void td_write */
+
+/* Writes the aggregate of one window. With more than one function, the
+ * function's name is appended to the type instance. */
+static void td_emit(td_data_t *data, const data_set_t *ds, /* {{{ */
+                    value_list_t const *orig, td_state_t const *state,
+                    uint64_t num, cdtime_t time) {
+  value_t values[ds->ds_num];
+  value_list_t vl = *orig;
+
+  vl.values = values;
+  vl.values_len = ds->ds_num;
+  vl.time = time;
+  vl.interval = data->interval;
+  vl.meta = NULL;
+
+  bool have_gauge = false;
+  for (size_t i = 0; i < ds->ds_num; i++)
+    if (ds->ds[i].type == DS_TYPE_GAUGE)
+      have_gauge = true;
+
+  size_t functions_num = 0;
+  for (size_t f = 0; f < STATIC_ARRAY_SIZE(td_functions); f++)
+    if (data->functions & td_functions[f].flag)
+      functions_num++;
+
+  for (size_t f = 0; f < STATIC_ARRAY_SIZE(td_functions); f++) {
+    unsigned int flag = td_functions[f].flag;
+    if ((data->functions & flag) == 0)
+      continue;
+
+    for (size_t i = 0; i < ds->ds_num; i++) {
+      td_state_t const *st = state + i;
+
+      if (ds->ds[i].type != DS_TYPE_GAUGE)
+        values[i] = st->last;
+      else if (flag == TD_FUNC_AVERAGE)
+        values[i].gauge = st->sum / (gauge_t)num;
+      else if (flag == TD_FUNC_MIN)
+        values[i].gauge = st->min;
+      else if (flag == TD_FUNC_MAX)
+        values[i].gauge = st->max;
+      else
+        values[i].gauge = st->last.gauge;
+    }
+
+    if (have_gauge && (functions_num > 1)) {
+      char type_instance[2 * DATA_MAX_NAME_LEN];
+      if (orig->type_instance[0] != 0)
+        snprintf(type_instance, sizeof(type_instance), "%s-%s",
+                 orig->type_instance, td_functions[f].name);
+      else
+        sstrncpy(type_instance, td_functions[f].name, sizeof(type_instance));
+      sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+      vl.identifier.hash = 0;
+    }
+
+    td_write(data, ds, &vl);
+
+    /* The other functions only differ in the gauges' values. */
+    if (!have_gauge)
+      break;
+  }
+} /* }}} void td_emit */
+
+static int td_config_function(oconfig_item_t const *ci, /* {{{ */
+                              unsigned int *functions) {
+  if (ci->values_num < 1) {
+    ERROR("Target `downsample': The `%s' option requires at least one "
+          "argument.",
+          ci->key);
+    return -1;
+  }
+
+  for (int i = 0; i < ci->values_num; i++) {
+    if (ci->values[i].type != OCONFIG_TYPE_STRING) {
+      ERROR("Target `downsample': The `%s' option accepts only string "
+            "arguments.",
+            ci->key);
+      return -1;
+    }
+
+    char const *name = ci->values[i].value.string;
+    size_t f;
+    for (f = 0; f < STATIC_ARRAY_SIZE(td_functions); f++)
+      if (strcasecmp(td_functions[f].name, name) == 0)
+        break;
+
+    if (f >= STATIC_ARRAY_SIZE(td_functions)) {
+      ERROR("Target `downsample': Unknown function `%s'. Valid functions are "
+            "`Average', `Min', `Max' and `Last'.",
+            name);
+      return -1;
+    }
+    *functions |= td_functions[f].flag;
+  }
+
+  return 0;
+} /* }}} int td_config_function */
+
+static int td_config_add_writer(td_data_t *data, /* {{{ */
+                                oconfig_item_t const *ci) {
+  for (int i = 0; i < ci->values_num; i++) {
+    if (ci->values[i].type != OCONFIG_TYPE_STRING) {
+      ERROR("Target `downsample': The `%s' option accepts only string "
+            "arguments.",
+            ci->key);
+      return -1;
+    }
+
+    td_writer_t *tmp = realloc(data->writers,
+                               (data->writers_num + 1) * sizeof(*tmp));
+    if (tmp == NULL) {
+      ERROR("td_config_add_writer: realloc failed.");
+      return -1;
+    }
+    data->writers = tmp;
+
+    td_writer_t *w = data->writers + data->writers_num;
+    w->plugin = strdup(ci->values[i].value.string);
+    if (w->plugin == NULL) {
+      ERROR("td_config_add_writer: strdup failed.");
+      return -1;
+    }
+    C_COMPLAIN_INIT(&w->complaint);
+    data->writers_num++;
+  }
+
+  return 0;
+} /* }}} int td_config_add_writer */
+
+static int td_destroy(void **user_data) /* {{{ */
+{
+  td_data_t *data;
+
+  if (user_data == NULL)
+    return -EINVAL;
+
+  data = *user_data;
+  if (data == NULL)
+    return 0;
+
+  for (size_t i = 0; i < data->writers_num; i++)
+    sfree(data->writers[i].plugin);
+  sfree(data->writers);
+  sfree(data);
+  *user_data = NULL;
+
+  return 0;
+} /* }}} int td_destroy */
+
+static int td_create(const oconfig_item_t *ci, void **user_data) /* {{{ */
+{
+  td_data_t *data;
+  int status;
+
+  data = calloc(1, sizeof(*data));
+  if (data == NULL) {
+    ERROR("td_create: calloc failed.");
+    return -ENOMEM;
+  }
+
+  status = 0;
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Interval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &data->interval);
+    else if (strcasecmp("Function", child->key) == 0)
+      status = td_config_function(child, &data->functions);
+    else if (strcasecmp("Plugin", child->key) == 0)
+      status = td_config_add_writer(data, child);
+    else {
+      ERROR("Target `downsample': The `%s' configuration option is not "
+            "understood and will be ignored.",
+            child->key);
+      status = 0;
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  /* Additional sanity-checking */
+  while (status == 0) {
+    if (data->interval == 0) {
+      ERROR("Target `downsample': The `Interval' option is required.");
+      status = -1;
+      break;
+    }
+
+    if (data->writers_num == 0) {
+      ERROR("Target `downsample': You need to specify at least one write "
+            "plugin with the `Plugin' option.");
+      status = -1;
+      break;
+    }
+
+    if (data->functions == 0)
+      data->functions = TD_FUNC_AVERAGE;
+
+    break;
+  }
+
+  if (status != 0) {
+    td_destroy((void *)&data);
+    return status;
+  }
+
+  *user_data = data;
+  return 0;
+} /* }}} int td_create */
+
+static int td_invoke(const data_set_t *ds, value_list_t *vl, /* {{{ */
+                     notification_meta_t __attribute__((unused)) * *meta,
+                     void **user_data) {
+  td_data_t *data;
+
+  if ((ds == NULL) || (vl == NULL) || (user_data == NULL))
+    return -EINVAL;
+
+  data = *user_data;
+  if (data == NULL) {
+    ERROR("Target `downsample': Invoke: `data' is NULL.");
+    return -EINVAL;
+  }
+
+  if (ds->ds_num != vl->values_len)
+    return FC_TARGET_CONTINUE;
+
+  char key_start[128];
+  char key_num[128];
+  char key_time[128];
+  td_key(key_start, sizeof(key_start), data, -1, "start");
+  td_key(key_num, sizeof(key_num), data, -1, "num");
+  td_key(key_time, sizeof(key_time), data, -1, "time");
+
+  cdtime_t start = vl->time - (vl->time % data->interval);
+  td_state_t state[ds->ds_num];
+
+  /* Restore the aggregate of the current window, if any. */
+  uint64_t prev_start = 0;
+  uint64_t num = 0;
+  uint64_t prev_time = 0;
+  if ((uc_meta_data_get_unsigned_int(vl, key_num, &num) != 0) ||
+      (uc_meta_data_get_unsigned_int(vl, key_start, &prev_start) != 0) ||
+      (uc_meta_data_get_unsigned_int(vl, key_time, &prev_time) != 0) ||
+      ((num != 0) && (td_state_load(data, ds, vl, state) != 0)))
+    num = 0;
+
+  /* A value list has been missed at the end of the previous window, or the
+   * clock has been set back. */
+  if ((num != 0) && ((cdtime_t)prev_start != start)) {
+    if ((cdtime_t)prev_start < start)
+      td_emit(data, ds, vl, state, num, (cdtime_t)prev_time);
+    num = 0;
+  }
+
+  td_state_add(ds, vl, state, num);
+  num++;
+
+  /* If the next value list is due after this window, it's complete. */
+  if ((vl->time + vl->interval) >= (start + data->interval)) {
+    td_emit(data, ds, vl, state, num, vl->time);
+    uc_meta_data_add_unsigned_int(vl, key_num, 0);
+    return FC_TARGET_CONTINUE;
+  }
+
+  td_state_store(data, ds, vl, state);
+  uc_meta_data_add_unsigned_int(vl, key_start, (uint64_t)start);
+  uc_meta_data_add_unsigned_int(vl, key_time, (uint64_t)vl->time);
+  uc_meta_data_add_unsigned_int(vl, key_num, num);
+
+  return FC_TARGET_CONTINUE;
+} /* }}} int td_invoke */
+
+void module_register(void) {
+  target_proc_t tproc = {0};
+
+  tproc.create = td_create;
+  tproc.destroy = td_destroy;
+  tproc.invoke = td_invoke;
+  fc_register_target("downsample", tproc);
+} /* module_register */
@@ -0,0 +1,319 @@
+/**
+ * collectd - src/target_shard.c
+ * Copyright (C) 2018 The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * The "shard" target writes each value list to "Replicas" of the configured
+ * write plugins, chosen by weighted rendezvous (highest random weight)
+ * hashing of the identifier: every writer gets a pseudo-random score for the
+ * identifier, and the writers with the highest scores win. Adding or removing
+ * a writer only moves the series that the writer gains or loses; unlike with
+ * a modulo hash, all other series stay where they are.
+ */
+
+#include "collectd.h"
+
+#include "common.h"
+#include "filter_chain.h"
+#include "utils_complain.h"
+
+#include <math.h>
+
+struct tsh_writer_s {
+  char *plugin;
+  double weight;
+  uint64_t seed;
+  c_complain_t complaint;
+};
+typedef struct tsh_writer_s tsh_writer_t;
+
+struct tsh_data_s {
+  tsh_writer_t *writers;
+  size_t writers_num;
+  size_t replicas;
+  bool by_host;
+  /* True if the writers' weights differ. Otherwise, the raw hashes can be
+   * compared, saving a logarithm per writer and value list. */
+  bool weighted;
+};
+typedef struct tsh_data_s tsh_data_t;
+
+/* The finalizer of SplitMix64. */
+static uint64_t tsh_mix(uint64_t h) /* {{{ */
+{
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebull;
+  h ^= h >> 31;
+  return h;
+} /* }}} uint64_t tsh_mix */
+
+/* Returns the score of writer "w" for the identifier's hash. With weights, the
+ * hash is mapped to u in (0, 1) and the score is -weight / ln(u), which makes
+ * the probability of a writer having the highest score proportional to its
+ * weight. */
+static double tsh_score(tsh_data_t const *data, /* {{{ */
+                        tsh_writer_t const *w, uint32_t hash) {
+  uint64_t h = tsh_mix(w->seed ^ (uint64_t)hash);
+
+  if (!data->weighted)
+    return (double)h;
+
+  double u = ((double)(h >> 11) + 0.5) / 9007199254740992.0; /* 2^53 */
+  return -w->weight / log(u);
+} /* }}} double tsh_score */
+
+static void tsh_write(tsh_writer_t *w, const data_set_t *ds, /* {{{ */
+                      value_list_t const *vl) {
+  int status = plugin_write(w->plugin, ds, vl);
+  if (status != 0)
+    c_complain(LOG_INFO, &w->complaint,
+               "Target `shard': Dispatching value to the `%s' plugin failed "
+               "with status %i.",
+               w->plugin, status);
+  else
+    c_release(LOG_INFO, &w->complaint,
+              "Target `shard': Plugin `%s' is back to normal operation.",
+              w->plugin);
+} /* }}} void tsh_write */
+
+static int tsh_config_add_writer(tsh_data_t *data, /* {{{ */
+                                 oconfig_item_t const *ci) {
+  if ((ci->values_num < 1) || (ci->values_num > 2) ||
+      (ci->values[0].type != OCONFIG_TYPE_STRING) ||
+      ((ci->values_num == 2) &&
+       (ci->values[1].type != OCONFIG_TYPE_NUMBER))) {
+    ERROR("Target `shard': The `%s' option requires a plugin name and an "
+          "optional weight.",
+          ci->key);
+    return -1;
+  }
+
+  double weight = 1.0;
+  if (ci->values_num == 2)
+    weight = ci->values[1].value.number;
+  if (!(weight > 0.0)) {
+    ERROR("Target `shard': The weight of `%s' must be positive.",
+          ci->values[0].value.string);
+    return -1;
+  }
+
+  tsh_writer_t *tmp =
+      realloc(data->writers, (data->writers_num + 1) * sizeof(*tmp));
+  if (tmp == NULL) {
+    ERROR("tsh_config_add_writer: realloc failed.");
+    return -1;
+  }
+  data->writers = tmp;
+
+  tsh_writer_t *w = data->writers + data->writers_num;
+  w->plugin = strdup(ci->values[0].value.string);
+  if (w->plugin == NULL) {
+    ERROR("tsh_config_add_writer: strdup failed.");
+    return -1;
+  }
+  w->weight = weight;
+  /* The seed only depends on the name, so the writers' order in the
+   * configuration doesn't matter. */
+  w->seed = tsh_mix((uint64_t)identifier_hash(w->plugin));
+  C_COMPLAIN_INIT(&w->complaint);
+  data->writers_num++;
+
+  return 0;
+} /* }}} int tsh_config_add_writer */
+
+static int tsh_config_hash_by(oconfig_item_t const *ci, /* {{{ */
+                              bool *by_host) {
+  char buffer[16];
+  int status = cf_util_get_string_buffer(ci, buffer, sizeof(buffer));
+  if (status != 0)
+    return status;
+
+  if (strcasecmp("Identifier", buffer) == 0)
+    *by_host = false;
+  else if (strcasecmp("Host", buffer) == 0)
+    *by_host = true;
+  else {
+    ERROR("Target `shard': `HashBy' must be `Identifier' or `Host', got "
+          "`%s'.",
+          buffer);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int tsh_config_hash_by */
+
+static int tsh_destroy(void **user_data) /* {{{ */
+{
+  tsh_data_t *data;
+
+  if (user_data == NULL)
+    return -EINVAL;
+
+  data = *user_data;
+  if (data == NULL)
+    return 0;
+
+  for (size_t i = 0; i < data->writers_num; i++)
+    sfree(data->writers[i].plugin);
+  sfree(data->writers);
+  sfree(data);
+  *user_data = NULL;
+
+  return 0;
+} /* }}} int tsh_destroy */
+
+static int tsh_create(const oconfig_item_t *ci, void **user_data) /* {{{ */
+{
+  tsh_data_t *data;
+  int replicas = 1;
+  int status;
+
+  data = calloc(1, sizeof(*data));
+  if (data == NULL) {
+    ERROR("tsh_create: calloc failed.");
+    return -ENOMEM;
+  }
+
+  status = 0;
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Plugin", child->key) == 0)
+      status = tsh_config_add_writer(data, child);
+    else if (strcasecmp("Replicas", child->key) == 0)
+      status = cf_util_get_int(child, &replicas);
+    else if (strcasecmp("HashBy", child->key) == 0)
+      status = tsh_config_hash_by(child, &data->by_host);
+    else {
+      ERROR("Target `shard': The `%s' configuration option is not "
+            "understood and will be ignored.",
+            child->key);
+      status = 0;
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  /* Additional sanity-checking */
+  while (status == 0) {
+    if (data->writers_num == 0) {
+      ERROR("Target `shard': You need to specify at least one write plugin "
+            "with the `Plugin' option.");
+      status = -1;
+      break;
+    }
+
+    if ((replicas < 1) || ((size_t)replicas > data->writers_num)) {
+      ERROR("Target `shard': `Replicas' must be between 1 and the number of "
+            "plugins (%" PRIsz ").",
+            data->writers_num);
+      status = -1;
+      break;
+    }
+    data->replicas = (size_t)replicas;
+
+    for (size_t i = 1; i < data->writers_num; i++)
+      if (data->writers[i].weight != data->writers[0].weight)
+        data->weighted = true;
+
+    break;
+  }
+
+  if (status != 0) {
+    tsh_destroy((void *)&data);
+    return status;
+  }
+
+  *user_data = data;
+  return 0;
+} /* }}} int tsh_create */
+
+static int tsh_invoke(const data_set_t *ds, value_list_t *vl, /* {{{ */
+                      notification_meta_t __attribute__((unused)) * *meta,
+                      void **user_data) {
+  tsh_data_t *data;
+
+  if ((ds == NULL) || (vl == NULL) || (user_data == NULL))
+    return -EINVAL;
+
+  data = *user_data;
+  if (data == NULL) {
+    ERROR("Target `shard': Invoke: `data' is NULL.");
+    return -EINVAL;
+  }
+
+  uint32_t hash;
+  if (data->by_host) {
+    hash = identifier_hash(vl->host);
+  } else if (vl->identifier.hash != 0) {
+    hash = vl->identifier.hash;
+  } else {
+    char name[6 * DATA_MAX_NAME_LEN];
+    if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+      ERROR("Target `shard': FORMAT_VL failed.");
+      return -1;
+    }
+    hash = identifier_hash(name);
+  }
+
+  /* Keep the "replicas" highest scores, sorted in descending order. */
+  size_t best[data->replicas];
+  double best_score[data->replicas];
+  size_t best_num = 0;
+
+  for (size_t i = 0; i < data->writers_num; i++) {
+    double score = tsh_score(data, data->writers + i, hash);
+
+    size_t pos = best_num;
+    while ((pos > 0) && (best_score[pos - 1] < score))
+      pos--;
+    if (pos >= data->replicas)
+      continue;
+
+    size_t last = (best_num < data->replicas) ? best_num : best_num - 1;
+    for (size_t j = last; j > pos; j--) {
+      best[j] = best[j - 1];
+      best_score[j] = best_score[j - 1];
+    }
+    best[pos] = i;
+    best_score[pos] = score;
+    if (best_num < data->replicas)
+      best_num++;
+  }
+
+  for (size_t i = 0; i < best_num; i++)
+    tsh_write(data->writers + best[i], ds, vl);
+
+  return FC_TARGET_CONTINUE;
+} /* }}} int tsh_invoke */
+
+void module_register(void) {
+  target_proc_t tproc = {0};
+
+  tproc.create = tsh_create;
+  tproc.destroy = tsh_destroy;
+  tproc.invoke = tsh_invoke;
+  fc_register_target("shard", tproc);
+} /* module_register */
@@ -266,12 +266,28 @@ static int port_collect_total;
 static port_entry_t *port_list_head;
 static uint32_t count_total[TCP_STATE_MAX + 1];
 
+/* One bit per port which has an entry in port_list_head. This avoids walking
+ * the list twice for every connection when only a few ports are
+ * configured. */
+static uint8_t port_bitmap[65536 / 8];
+#define PORT_BITMAP_SET(port) port_bitmap[(port) / 8] |= (1 << ((port) % 8))
+#define PORT_BITMAP_ISSET(port) (port_bitmap[(port) / 8] & (1 << ((port) % 8)))
+
 #if KERNEL_LINUX
 #if HAVE_STRUCT_LINUX_INET_DIAG_REQ
 /* This depends on linux inet_diag_req because if this structure is missing,
  * sequence_number is useless and we get a compilation warning.
  */
 static uint32_t sequence_number;
+
+/* The inet_diag socket is kept open between reads. */
+static int diag_fd = -1;
+
+/* In-kernel filter passed as INET_DIAG_REQ_BYTECODE, so that only the
+ * connections of the configured ports are dumped. NULL if all connections are
+ * needed, i.e. with "ListeningPorts" or "AllPortsSummary". */
+static struct inet_diag_bc_op *diag_filter;
+static size_t diag_filter_len; /* in bytes */
 #endif
 
 static enum { SRC_DUNNO, SRC_NETLINK, SRC_PROC } linux_source = SRC_DUNNO;
@@ -361,6 +377,7 @@ static port_entry_t *conn_get_port_entry(uint16_t port, int create) {
     ret->port = port;
     ret->next = port_list_head;
     port_list_head = ret;
+    PORT_BITMAP_SET(port);
   }
 
   return ret;
@@ -373,6 +390,7 @@ static void conn_reset_port_entry(void) {
   port_entry_t *pe = port_list_head;
 
   memset(&count_total, '\0', sizeof(count_total));
+  memset(&port_bitmap, '\0', sizeof(port_bitmap));
 
   while (pe != NULL) {
     /* If this entry was created while reading the files (ant not when handling
@@ -399,6 +417,7 @@ static void conn_reset_port_entry(void) {
     memset(pe->count_local, '\0', sizeof(pe->count_local));
     memset(pe->count_remote, '\0', sizeof(pe->count_remote));
     pe->flags &= ~PORT_IS_LISTENING;
+    PORT_BITMAP_SET(pe->port);
 
     prev = pe;
     pe = pe->next;
@@ -432,34 +451,111 @@ static int conn_handle_ports(uint16_t port_local, uint16_t port_remote,
   DEBUG("tcpconns plugin: Connection %" PRIu16 " <-> %" PRIu16 " (%s)",
         port_local, port_remote, tcp_state[state]);
 
-  pe = conn_get_port_entry(port_local, 0 /* no create */);
-  if (pe != NULL)
-    pe->count_local[state]++;
+  if (PORT_BITMAP_ISSET(port_local)) {
+    pe = conn_get_port_entry(port_local, 0 /* no create */);
+    if (pe != NULL)
+      pe->count_local[state]++;
+  }
 
-  pe = conn_get_port_entry(port_remote, 0 /* no create */);
-  if (pe != NULL)
-    pe->count_remote[state]++;
+  if (PORT_BITMAP_ISSET(port_remote)) {
+    pe = conn_get_port_entry(port_remote, 0 /* no create */);
+    if (pe != NULL)
+      pe->count_remote[state]++;
+  }
 
   return 0;
 } /* int conn_handle_ports */
 
 #if KERNEL_LINUX
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ
+/* Builds the bytecode for "sport == P1 || dport == P2 || ...".
+ *
+ * Each comparison is compiled to a pair of ">=" and "<=" operations, which
+ * are supported by all kernels. In the bytecode, jumping to the end accepts a
+ * socket and jumping four bytes beyond the end rejects it. Alternatives are
+ * chained with a JMP operation between them, which is how ss(8) compiles
+ * them, so that every instruction is reachable for the kernel's audit. */
+static int conn_build_filter(void) {
+  size_t cond_num = 0;
+
+  sfree(diag_filter);
+  diag_filter_len = 0;
+
+  if (port_collect_listening || port_collect_total)
+    return 0;
+
+  for (port_entry_t *pe = port_list_head; pe != NULL; pe = pe->next) {
+    if (pe->flags & PORT_COLLECT_LOCAL)
+      cond_num++;
+    if (pe->flags & PORT_COLLECT_REMOTE)
+      cond_num++;
+  }
+  if (cond_num == 0)
+    return 0;
+
+  /* Two operations with two words each, plus one JMP between conditions. */
+  size_t ops_num = (5 * cond_num) - 1;
+  diag_filter = calloc(ops_num, sizeof(*diag_filter));
+  if (diag_filter == NULL)
+    return ENOMEM;
+  diag_filter_len = ops_num * sizeof(*diag_filter);
+
+  struct inet_diag_bc_op *op = diag_filter;
+  size_t cond_index = 0;
+  for (port_entry_t *pe = port_list_head; pe != NULL; pe = pe->next) {
+    for (int remote = 0; remote < 2; remote++) {
+      if (!(pe->flags & (remote ? PORT_COLLECT_REMOTE : PORT_COLLECT_LOCAL)))
+        continue;
+
+      op[0] = (struct inet_diag_bc_op){
+          .code = remote ? INET_DIAG_BC_D_GE : INET_DIAG_BC_S_GE,
+          .yes = 8,
+          .no = 20,
+      };
+      op[1] = (struct inet_diag_bc_op){.no = pe->port};
+      op[2] = (struct inet_diag_bc_op){
+          .code = remote ? INET_DIAG_BC_D_LE : INET_DIAG_BC_S_LE,
+          .yes = 8,
+          .no = 12,
+      };
+      op[3] = (struct inet_diag_bc_op){.no = pe->port};
+      op += 4;
+
+      cond_index++;
+      if (cond_index < cond_num) {
+        /* A match jumps to the end; otherwise continue with the next
+         * condition. */
+        size_t remaining = (size_t)((char *)(diag_filter + ops_num) -
+                                    (char *)op);
+        *op = (struct inet_diag_bc_op){
+            .code = INET_DIAG_BC_JMP, .yes = 4, .no = (uint16_t)remaining,
+        };
+        op++;
+      }
+    }
+  }
+
+  return 0;
+} /* int conn_build_filter */
+#endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ */
+
 /* Returns zero on success, less than zero on socket error and greater than
  * zero on other errors. */
 static int conn_read_netlink(void) {
 #if HAVE_STRUCT_LINUX_INET_DIAG_REQ
-  int fd;
   struct inet_diag_msg *r;
-  char buf[8192];
+  static char buf[32768];
 
   /* If this fails, it's likely a permission problem. We'll fall back to
    * reading this information from files below. */
-  fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
-  if (fd < 0) {
-    ERROR("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, SOCK_RAW, "
-          "NETLINK_INET_DIAG) failed: %s",
-          STRERRNO);
-    return -1;
+  if (diag_fd < 0) {
+    diag_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_INET_DIAG);
+    if (diag_fd < 0) {
+      ERROR("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, SOCK_RAW, "
+            "NETLINK_INET_DIAG) failed: %s",
+            STRERRNO);
+      return -1;
+    }
   }
 
   struct sockaddr_nl nladdr = {.nl_family = AF_NETLINK};
@@ -480,22 +576,37 @@ static int conn_read_netlink(void) {
       .r.idiag_states = 0xfff,
       .r.idiag_ext = 0};
 
-  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct nlattr bc_attr = {
+      .nla_len = (uint16_t)(NLA_HDRLEN + diag_filter_len),
+      .nla_type = INET_DIAG_REQ_BYTECODE,
+  };
+
+  struct iovec iov[3] = {
+      {.iov_base = &req, .iov_len = sizeof(req)},
+      {.iov_base = &bc_attr, .iov_len = NLA_HDRLEN},
+      {.iov_base = diag_filter, .iov_len = diag_filter_len},
+  };
+  size_t iov_num = 1;
+  if (diag_filter != NULL) {
+    req.nlh.nlmsg_len += NLA_HDRLEN + diag_filter_len;
+    iov_num = 3;
+  }
 
   struct msghdr msg = {.msg_name = (void *)&nladdr,
                        .msg_namelen = sizeof(nladdr),
-                       .msg_iov = &iov,
-                       .msg_iovlen = 1};
+                       .msg_iov = iov,
+                       .msg_iovlen = iov_num};
 
-  if (sendmsg(fd, &msg, 0) < 0) {
+  if (sendmsg(diag_fd, &msg, 0) < 0) {
     ERROR("tcpconns plugin: conn_read_netlink: sendmsg(2) failed: %s",
           STRERRNO);
-    close(fd);
+    close(diag_fd);
+    diag_fd = -1;
     return -1;
   }
 
-  iov.iov_base = buf;
-  iov.iov_len = sizeof(buf);
+  iov[0].iov_base = buf;
+  iov[0].iov_len = sizeof(buf);
 
   while (1) {
     struct nlmsghdr *h;
@@ -503,20 +614,20 @@ static int conn_read_netlink(void) {
     memset(&msg, 0, sizeof(msg));
     msg.msg_name = (void *)&nladdr;
     msg.msg_namelen = sizeof(nladdr);
-    msg.msg_iov = &iov;
+    msg.msg_iov = iov;
     msg.msg_iovlen = 1;
 
-    ssize_t status = recvmsg(fd, (void *)&msg, /* flags = */ 0);
+    ssize_t status = recvmsg(diag_fd, (void *)&msg, /* flags = */ 0);
     if (status < 0) {
       if ((errno == EINTR) || (errno == EAGAIN))
         continue;
 
       ERROR("tcpconns plugin: conn_read_netlink: recvmsg(2) failed: %s",
             STRERRNO);
-      close(fd);
+      close(diag_fd);
+      diag_fd = -1;
       return -1;
     } else if (status == 0) {
-      close(fd);
       DEBUG("tcpconns plugin: conn_read_netlink: Unexpected zero-sized "
             "reply from netlink socket.");
       return 0;
@@ -530,16 +641,27 @@ static int conn_read_netlink(void) {
       }
 
       if (h->nlmsg_type == NLMSG_DONE) {
-        close(fd);
         return 0;
       } else if (h->nlmsg_type == NLMSG_ERROR) {
         struct nlmsgerr *msg_error;
 
         msg_error = NLMSG_DATA(h);
+
+        /* Older kernels may reject the filter. Filter in user space
+         * instead. */
+        if (diag_filter != NULL) {
+          WARNING("tcpconns plugin: conn_read_netlink: The kernel rejected "
+                  "the port filter (error %i). Filtering in collectd "
+                  "instead.",
+                  msg_error->error);
+          sfree(diag_filter);
+          diag_filter_len = 0;
+          return conn_read_netlink();
+        }
+
         WARNING("tcpconns plugin: conn_read_netlink: Received error %i.",
                 msg_error->error);
 
-        close(fd);
         return 1;
       }
 
@@ -681,6 +803,13 @@ static int conn_init(void) {
   if (port_collect_total == 0 && port_list_head == NULL)
     port_collect_listening = 1;
 
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ
+  if (conn_build_filter() != 0) {
+    ERROR("tcpconns plugin: Building the port filter failed.");
+    return -1;
+  }
+#endif
+
   return 0;
 } /* int conn_init */
 
@@ -55,30 +55,76 @@ static void thermal_submit(const char *plugin_instance, enum dev_type dt,
   plugin_dispatch_values(&vl);
 }
 
-static int thermal_sysfs_device_read(const char __attribute__((unused)) * dir,
-                                     const char *name,
-                                     void __attribute__((unused)) * user_data) {
+/* The sysfs files of a thermal zone or cooling device, as index into
+ * "thermal_files" or -1 if the device doesn't have the file. */
+struct thermal_device_s {
+  char *name;
+  int temp;
+  int cur_state;
+};
+typedef struct thermal_device_s thermal_device_t;
+
+/* Built by the first read and after reading a file failed, e.g. because the
+ * device disappeared. */
+static read_batch_t *thermal_files;
+static thermal_device_t *thermal_devices;
+static size_t thermal_devices_num;
+
+static void thermal_sysfs_devices_free(void) {
+  for (size_t i = 0; i < thermal_devices_num; i++)
+    sfree(thermal_devices[i].name);
+  sfree(thermal_devices);
+  thermal_devices_num = 0;
+
+  read_batch_destroy(thermal_files);
+  thermal_files = NULL;
+}
+
+static int thermal_sysfs_file_add(const char *name, const char *file) {
   char filename[PATH_MAX];
-  bool success = false;
-  value_t value;
 
+  snprintf(filename, sizeof(filename), "%s/%s/%s", dirname_sysfs, name, file);
+  if (access(filename, R_OK) != 0)
+    return -1;
+
+  int index = read_batch_add(thermal_files, filename);
+  return (index < 0) ? -1 : index;
+}
+
+static int thermal_sysfs_device_add(const char __attribute__((unused)) * dir,
+                                    const char *name,
+                                    void __attribute__((unused)) * user_data) {
   if (device_list && ignorelist_match(device_list, name))
     return -1;
 
-  snprintf(filename, sizeof(filename), "%s/%s/temp", dirname_sysfs, name);
-  if (parse_value_file(filename, &value, DS_TYPE_GAUGE) == 0) {
-    value.gauge /= 1000.0;
-    thermal_submit(name, TEMP, value);
-    success = true;
-  }
+  thermal_device_t d = {
+      .temp = thermal_sysfs_file_add(name, "temp"),
+      .cur_state = thermal_sysfs_file_add(name, "cur_state"),
+  };
+  if ((d.temp < 0) && (d.cur_state < 0))
+    return -1;
 
-  snprintf(filename, sizeof(filename), "%s/%s/cur_state", dirname_sysfs, name);
-  if (parse_value_file(filename, &value, DS_TYPE_GAUGE) == 0) {
-    thermal_submit(name, COOLING_DEV, value);
-    success = true;
-  }
+  thermal_device_t *tmp = realloc(
+      thermal_devices, (thermal_devices_num + 1) * sizeof(*thermal_devices));
+  if (tmp == NULL)
+    return -1;
+  thermal_devices = tmp;
 
-  return success ? 0 : -1;
+  if ((d.name = strdup(name)) == NULL)
+    return -1;
+  thermal_devices[thermal_devices_num++] = d;
+
+  return 0;
+}
+
+static int thermal_sysfs_parse(int index, value_t *ret_value) {
+  char *buffer = NULL;
+
+  if ((index < 0) || (read_batch_get(thermal_files, index, &buffer) <= 0))
+    return -1;
+
+  strstripnewline(buffer);
+  return parse_value(buffer, ret_value, DS_TYPE_GAUGE);
 }
 
 static int thermal_procfs_device_read(const char __attribute__((unused)) * dir,
@@ -168,7 +214,41 @@ static int thermal_config(const char *key, const char *value) {
 }
 
 static int thermal_sysfs_read(void) {
-  return walk_directory(dirname_sysfs, thermal_sysfs_device_read, NULL, 0);
+  if (thermal_files == NULL) {
+    thermal_files = read_batch_create(32);
+    if (thermal_files == NULL)
+      return -1;
+
+    if (walk_directory(dirname_sysfs, thermal_sysfs_device_add, NULL, 0) != 0) {
+      thermal_sysfs_devices_free();
+      return -1;
+    }
+  }
+
+  bool failed = (read_batch_read(thermal_files) != 0);
+  bool success = false;
+
+  for (size_t i = 0; i < thermal_devices_num; i++) {
+    thermal_device_t *d = thermal_devices + i;
+    value_t value;
+
+    if (thermal_sysfs_parse(d->temp, &value) == 0) {
+      value.gauge /= 1000.0;
+      thermal_submit(d->name, TEMP, value);
+      success = true;
+    }
+
+    if (thermal_sysfs_parse(d->cur_state, &value) == 0) {
+      thermal_submit(d->name, COOLING_DEV, value);
+      success = true;
+    }
+  }
+
+  /* Look for added and removed devices with the next read. */
+  if (failed)
+    thermal_sysfs_devices_free();
+
+  return success ? 0 : -1;
 }
 
 static int thermal_procfs_read(void) {
@@ -188,6 +268,7 @@ static int thermal_init(void) {
 }
 
 static int thermal_shutdown(void) {
+  thermal_sysfs_devices_free();
   ignorelist_free(device_list);
 
   return 0;
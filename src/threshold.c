@@ -92,6 +92,9 @@ static int ut_threshold_add(const threshold_t *th) { /* {{{ */
     sfree(name_copy);
   }
 
+  if (status == 0)
+    threshold_generation++;
+
   pthread_mutex_unlock(&threshold_lock);
 
   if (status != 0) {
@@ -272,14 +275,15 @@ static int ut_config_host(const threshold_t *th_orig, oconfig_item_t *ci) {
 /*
  * int ut_report_state
  *
- * Checks if the `state' differs from the old state and creates a notification
- * if appropriate.
+ * Checks if the `state' differs from `state_old', the state stored in the
+ * cache, and creates a notification if appropriate. The cache is only updated
+ * if the state has changed.
  * Does not fail.
  */
 static int ut_report_state(const data_set_t *ds, const value_list_t *vl,
                            const threshold_t *th, const gauge_t *values,
-                           int ds_index, int state) { /* {{{ */
-  int state_old;
+                           int ds_index, int state,
+                           int state_old) { /* {{{ */
   notification_t n;
 
   char *buf;
@@ -304,8 +308,6 @@ static int ut_report_state(const data_set_t *ds, const value_list_t *vl,
     }
   } /* end check hits */
 
-  state_old = uc_get_state(ds, vl);
-
   /* If the state didn't change, report if `persistent' is specified. If the
    * state is `okay', then only report if `persist_ok` flag is set. */
   if (state == state_old) {
@@ -433,107 +435,26 @@ static int ut_report_state(const data_set_t *ds, const value_list_t *vl,
   return 0;
 } /* }}} int ut_report_state */
 
-/*
- * int ut_check_one_data_source
- *
- * Checks one data source against the given threshold configuration. If the
- * `DataSource' option is set in the threshold, and the name does NOT match,
- * `okay' is returned. If the threshold does match, its failure and warning
- * min and max values are checked and `failure' or `warning' is returned if
- * appropriate.
- * Does not fail.
- */
-static int ut_check_one_data_source(
-    const data_set_t *ds, const value_list_t __attribute__((unused)) * vl,
-    const threshold_t *th, const gauge_t *values, int ds_index) { /* {{{ */
-  const char *ds_name;
-  int is_warning = 0;
-  int is_failure = 0;
-  int prev_state = STATE_OKAY;
-
-  /* check if this threshold applies to this data source */
-  if (ds != NULL) {
-    ds_name = ds->ds[ds_index].name;
-    if ((th->data_source[0] != 0) && (strcmp(ds_name, th->data_source) != 0))
-      return STATE_OKAY;
-  }
-
-  if ((th->flags & UT_FLAG_INVERT) != 0) {
-    is_warning--;
-    is_failure--;
-  }
-
-  /* XXX: This is an experimental code, not optimized, not fast, not reliable,
-   * and probably, do not work as you expect. Enjoy! :D */
-  if (th->hysteresis > 0) {
-    prev_state = uc_get_state(ds, vl);
-    /* The purpose of hysteresis is elliminating flapping state when the value
-     * oscilates around the thresholds. In other words, what is important is
-     * the previous state; if the new value would trigger a transition, make
-     * sure that we artificially widen the range which is considered to apply
-     * for the previous state, and only trigger the notification if the value
-     * is outside of this expanded range.
-     *
-     * There is no hysteresis for the OKAY state.
-     * */
-    gauge_t hysteresis_for_warning = 0, hysteresis_for_failure = 0;
-    switch (prev_state) {
-    case STATE_ERROR:
-      hysteresis_for_failure = th->hysteresis;
-      break;
-    case STATE_WARNING:
-      hysteresis_for_warning = th->hysteresis;
-      break;
-    case STATE_OKAY:
-      /* do nothing -- the hysteresis only applies to the non-normal states */
-      break;
-    }
-
-    if ((!isnan(th->failure_min) &&
-         (th->failure_min + hysteresis_for_failure > values[ds_index])) ||
-        (!isnan(th->failure_max) &&
-         (th->failure_max - hysteresis_for_failure < values[ds_index])))
-      is_failure++;
-
-    if ((!isnan(th->warning_min) &&
-         (th->warning_min + hysteresis_for_warning > values[ds_index])) ||
-        (!isnan(th->warning_max) &&
-         (th->warning_max - hysteresis_for_warning < values[ds_index])))
-      is_warning++;
-
-  } else { /* no hysteresis */
-    if ((!isnan(th->failure_min) && (th->failure_min > values[ds_index])) ||
-        (!isnan(th->failure_max) && (th->failure_max < values[ds_index])))
-      is_failure++;
-
-    if ((!isnan(th->warning_min) && (th->warning_min > values[ds_index])) ||
-        (!isnan(th->warning_max) && (th->warning_max < values[ds_index])))
-      is_warning++;
-  }
-
-  if (is_failure != 0)
-    return STATE_ERROR;
-
-  if (is_warning != 0)
-    return STATE_WARNING;
-
-  return STATE_OKAY;
-} /* }}} int ut_check_one_data_source */
-
 /*
  * int ut_check_one_threshold
  *
- * Checks all data sources of a value list against the given threshold, using
- * the ut_check_one_data_source function above. Returns the worst status,
- * which is `okay' if nothing has failed.
+ * Checks all data sources of a value list against the given threshold. If the
+ * `DataSource' option is set in the threshold, all other data sources are
+ * `okay'. For the others, the failure and warning min and max values are
+ * checked and `failure' or `warning' is returned if appropriate. `state_old'
+ * is the state stored in the cache and is used for the hysteresis. Returns
+ * the worst status, which is `okay' if nothing has failed.
  * Returns less than zero if the data set doesn't have any data sources.
  */
-static int ut_check_one_threshold(const data_set_t *ds, const value_list_t *vl,
-                                  const threshold_t *th, const gauge_t *values,
+static int ut_check_one_threshold(const data_set_t *ds, const threshold_t *th,
+                                  const gauge_t *values, int state_old,
                                   int *ret_ds_index) { /* {{{ */
+  size_t ds_num = ds->ds_num;
+  size_t first = 0;
   int ret = -1;
   int ds_index = -1;
-  gauge_t values_copy[ds->ds_num];
+  gauge_t values_copy[ds_num];
+  int states[ds_num];
 
   memcpy(values_copy, values, sizeof(values_copy));
 
@@ -541,7 +462,7 @@ static int ut_check_one_threshold(const data_set_t *ds, const value_list_t *vl,
     int num = 0;
     gauge_t sum = 0.0;
 
-    if (ds->ds_num == 1) {
+    if (ds_num == 1) {
       WARNING(
           "ut_check_one_threshold: The %s type has only one data "
           "source, but you have configured to check this as a percentage. "
@@ -551,7 +472,7 @@ static int ut_check_one_threshold(const data_set_t *ds, const value_list_t *vl,
     }
 
     /* Prepare `sum' and `num'. */
-    for (size_t i = 0; i < ds->ds_num; i++)
+    for (size_t i = 0; i < ds_num; i++)
       if (!isnan(values[i])) {
         num++;
         sum += values[i];
@@ -560,21 +481,70 @@ static int ut_check_one_threshold(const data_set_t *ds, const value_list_t *vl,
     if ((num == 0)       /* All data sources are undefined. */
         || (sum == 0.0)) /* Sum is zero, cannot calculate percentage. */
     {
-      for (size_t i = 0; i < ds->ds_num; i++)
+      for (size_t i = 0; i < ds_num; i++)
         values_copy[i] = NAN;
     } else /* We can actually calculate the percentage. */
     {
-      for (size_t i = 0; i < ds->ds_num; i++)
+      for (size_t i = 0; i < ds_num; i++)
         values_copy[i] = 100.0 * values[i] / sum;
     }
   } /* if (UT_FLAG_PERCENTAGE) */
 
-  for (size_t i = 0; i < ds->ds_num; i++) {
-    int status;
+  /* The purpose of hysteresis is elliminating flapping state when the value
+   * oscilates around the thresholds. In other words, what is important is the
+   * previous state; if the new value would trigger a transition, make sure
+   * that we artificially widen the range which is considered to apply for the
+   * previous state, and only trigger the notification if the value is outside
+   * of this expanded range.
+   *
+   * There is no hysteresis for the OKAY state. */
+  gauge_t hysteresis_for_warning = 0, hysteresis_for_failure = 0;
+  if (th->hysteresis > 0) {
+    if (state_old == STATE_ERROR)
+      hysteresis_for_failure = th->hysteresis;
+    else if (state_old == STATE_WARNING)
+      hysteresis_for_warning = th->hysteresis;
+  }
+
+  /* Unset bounds become infinite, so that all data sources can be checked
+   * with the same comparisons. Comparisons with NAN values are false. */
+  gauge_t failure_min = isnan(th->failure_min)
+                            ? -INFINITY
+                            : th->failure_min + hysteresis_for_failure;
+  gauge_t failure_max = isnan(th->failure_max)
+                            ? INFINITY
+                            : th->failure_max - hysteresis_for_failure;
+  gauge_t warning_min = isnan(th->warning_min)
+                            ? -INFINITY
+                            : th->warning_min + hysteresis_for_warning;
+  gauge_t warning_max = isnan(th->warning_max)
+                            ? INFINITY
+                            : th->warning_max - hysteresis_for_warning;
+  int invert = ((th->flags & UT_FLAG_INVERT) != 0);
+
+  for (size_t i = 0; i < ds_num; i++) {
+    gauge_t v = values_copy[i];
+    int is_failure = ((v < failure_min) | (v > failure_max)) ^ invert;
+    int is_warning = ((v < warning_min) | (v > warning_max)) ^ invert;
+
+    states[i] =
+        is_failure ? STATE_ERROR : (is_warning ? STATE_WARNING : STATE_OKAY);
+  }
+
+  /* check if this threshold applies to one data source only */
+  if (th->data_source[0] != 0) {
+    for (first = 0; first < ds_num; first++)
+      if (strcmp(ds->ds[first].name, th->data_source) == 0)
+        break;
+
+    for (size_t i = 0; i < ds_num; i++)
+      if (i != first)
+        states[i] = STATE_OKAY;
+  }
 
-    status = ut_check_one_data_source(ds, vl, th, values_copy, i);
-    if (ret < status) {
-      ret = status;
+  for (size_t i = 0; i < ds_num; i++) {
+    if (ret < states[i]) {
+      ret = states[i];
       ds_index = i;
     }
   } /* for (ds->ds_num) */
@@ -594,11 +564,11 @@ static int ut_check_one_threshold(const data_set_t *ds, const value_list_t *vl,
  * Returns zero on success and if no threshold has been configured. Returns
  * less than zero on failure.
  */
-static int ut_check_threshold(const data_set_t *ds, const value_list_t *vl,
-                              __attribute__((unused))
-                              user_data_t *ud) { /* {{{ */
+static int ut_check_threshold(const data_set_t *ds,
+                              const value_list_t *vl) { /* {{{ */
   threshold_t *th;
   gauge_t *values;
+  int state_old;
   int status;
 
   int worst_state = -1;
@@ -618,14 +588,18 @@ static int ut_check_threshold(const data_set_t *ds, const value_list_t *vl,
 
   DEBUG("ut_check_threshold: Found matching threshold(s)");
 
+  /* The rates have usually just been computed by uc_update() in this thread
+   * and are returned without locking the cache. */
   values = uc_get_rate(ds, vl);
   if (values == NULL)
     return 0;
 
+  state_old = uc_get_state(ds, vl);
+
   while (th != NULL) {
     int ds_index = -1;
 
-    status = ut_check_one_threshold(ds, vl, th, values, &ds_index);
+    status = ut_check_one_threshold(ds, th, values, state_old, &ds_index);
     if (status < 0) {
       ERROR("ut_check_threshold: ut_check_one_threshold failed.");
       sfree(values);
@@ -641,8 +615,8 @@ static int ut_check_threshold(const data_set_t *ds, const value_list_t *vl,
     th = th->next;
   } /* while (th) */
 
-  status =
-      ut_report_state(ds, vl, worst_th, values, worst_ds_index, worst_state);
+  status = ut_report_state(ds, vl, worst_th, values, worst_ds_index,
+                           worst_state, state_old);
   if (status != 0) {
     ERROR("ut_check_threshold: ut_report_state failed.");
     sfree(values);
@@ -654,6 +628,22 @@ static int ut_check_threshold(const data_set_t *ds, const value_list_t *vl,
   return 0;
 } /* }}} int ut_check_threshold */
 
+static int ut_check_threshold_batch(const plugin_write_entry_t *entries,
+                                    size_t entries_num,
+                                    __attribute__((unused))
+                                    user_data_t *ud) { /* {{{ */
+  int ret = 0;
+
+  if (threshold_tree == NULL)
+    return 0;
+
+  for (size_t i = 0; i < entries_num; i++)
+    if (ut_check_threshold(entries[i].ds, entries[i].vl) != 0)
+      ret = -1;
+
+  return ret;
+} /* }}} int ut_check_threshold_batch */
+
 /*
  * int ut_missing
  *
@@ -732,8 +722,8 @@ static int ut_config(oconfig_item_t *ci) { /* {{{ */
   if ((old_size == 0) && (c_avl_size(threshold_tree) > 0)) {
     plugin_register_missing("threshold", ut_missing,
                             /* user data = */ NULL);
-    plugin_register_write("threshold", ut_check_threshold,
-                          /* user data = */ NULL);
+    plugin_register_write_batch("threshold", ut_check_threshold_batch,
+                                /* user data = */ NULL);
   }
 
   return status;
@@ -155,6 +155,15 @@ static cpu_set_t *cpu_present_set, *cpu_affinity_set, *cpu_saved_affinity_set;
 static size_t cpu_present_setsize, cpu_affinity_setsize,
     cpu_saved_affinity_setsize;
 
+/*
+ * MSR device of each CPU, indexed by CPU id. Opened on first use and kept open
+ * until the buffers are freed, so that a read cycle only costs the preads.
+ */
+static int *msr_fds;
+
+/* Number of threads reading the counters in parallel */
+static unsigned int config_read_threads = 1;
+
 static struct thread_data {
   unsigned long long tsc;
   unsigned long long aperf;
@@ -233,6 +242,7 @@ static const char *config_keys[] = {
     "TCCActivationTemp",
     "RunningAveragePowerLimit",
     "LogicalCoreNames",
+    "ReadThreads",
 };
 static const int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
@@ -241,31 +251,30 @@ static const int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
  *****************************/
 
 /*
- * Open a MSR device for reading
- * Can change the scheduling affinity of the current process if multiple_read is
- * true
+ * Migrate the calling thread to the given CPU
+ * If we need to do multiple read, let's migrate to the CPU
+ * Otherwise, we would lose time calling functions on another CPU
+ *
+ * "set" is used as scratch space, each reader thread passes its own.
  */
 static int __attribute__((warn_unused_result))
-open_msr(unsigned int cpu, bool multiple_read) {
+migrate_to_cpu(unsigned int cpu, cpu_set_t *set) {
+  CPU_ZERO_S(cpu_affinity_setsize, set);
+  CPU_SET_S(cpu, cpu_affinity_setsize, set);
+  if (sched_setaffinity(0, cpu_affinity_setsize, set) == -1) {
+    ERROR("turbostat plugin: Could not migrate to CPU %d", cpu);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Open a MSR device for reading
+ */
+static int __attribute__((warn_unused_result)) open_msr(unsigned int cpu) {
   char pathname[32];
   int fd;
 
-  /*
-   * If we need to do multiple read, let's migrate to the CPU
-   * Otherwise, we would lose time calling functions on another CPU
-   *
-   * If we are not yet initialized (cpu_affinity_setsize = 0),
-   * we need to skip this optimisation.
-   */
-  if (multiple_read && cpu_affinity_setsize) {
-    CPU_ZERO_S(cpu_affinity_setsize, cpu_affinity_set);
-    CPU_SET_S(cpu, cpu_affinity_setsize, cpu_affinity_set);
-    if (sched_setaffinity(0, cpu_affinity_setsize, cpu_affinity_set) == -1) {
-      ERROR("turbostat plugin: Could not migrate to CPU %d", cpu);
-      return -1;
-    }
-  }
-
   snprintf(pathname, sizeof(pathname), "/dev/cpu/%d/msr", cpu);
   fd = open(pathname, O_RDONLY);
   if (fd < 0) {
@@ -301,7 +310,7 @@ get_msr(unsigned int cpu, off_t offset, unsigned long long *msr) {
   ssize_t retval;
   int fd;
 
-  fd = open_msr(cpu, 0);
+  fd = open_msr(cpu);
   if (fd < 0)
     return fd;
   retval = read_msr(fd, offset, msr);
@@ -309,6 +318,15 @@ get_msr(unsigned int cpu, off_t offset, unsigned long long *msr) {
   return retval;
 }
 
+/*
+ * Return the cached MSR device of a CPU, opening it if needed
+ */
+static int __attribute__((warn_unused_result)) get_msr_fd(unsigned int cpu) {
+  if (msr_fds[cpu] < 0)
+    msr_fds[cpu] = open_msr(cpu);
+  return msr_fds[cpu];
+}
+
 /********************************
  * Raw data acquisition (1 CPU) *
  ********************************/
@@ -321,16 +339,20 @@ get_msr(unsigned int cpu, off_t offset, unsigned long long *msr) {
  * Package data is shared for all core in one package: extracted only for the
  * first thread of the first core
  *
- * Side effect: migrates to the targeted CPU
+ * Side effect: migrates to the targeted CPU, using "affinity_set" as scratch
  */
 static int __attribute__((warn_unused_result))
-get_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p) {
+read_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p,
+              cpu_set_t *affinity_set) {
   unsigned int cpu = t->cpu_id;
   unsigned long long msr;
   int msr_fd;
   int retval = 0;
 
-  msr_fd = open_msr(cpu, 1);
+  if (migrate_to_cpu(cpu, affinity_set) != 0)
+    return -1;
+
+  msr_fd = get_msr_fd(cpu);
   if (msr_fd < 0)
     return msr_fd;
 
@@ -414,10 +436,14 @@ get_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p) {
   }
 
 out:
-  close(msr_fd);
   return retval;
 }
 
+static int __attribute__((warn_unused_result))
+get_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p) {
+  return read_counters(t, c, p, cpu_affinity_set);
+}
+
 /**********************************
  * Evaluating the changes (1 CPU) *
  **********************************/
@@ -693,6 +719,103 @@ for_all_cpus(int(func)(struct thread_data *, struct core_data *,
   return 0;
 }
 
+/*
+ * Reader thread: collects the counters of every n-th present CPU
+ */
+struct counters_worker {
+  pthread_t thread;
+  unsigned int index;
+  cpu_set_t *affinity_set;
+  struct thread_data *thread_base;
+  struct core_data *core_base;
+  struct pkg_data *pkg_base;
+  int retval;
+};
+
+static void *counters_worker_main(void *arg) {
+  struct counters_worker *w = arg;
+  unsigned int n = 0;
+
+  w->retval = 0;
+  for (unsigned int pkg_no = 0; pkg_no < topology.num_packages; ++pkg_no) {
+    for (unsigned int core_no = 0; core_no < topology.num_cores; ++core_no) {
+      for (unsigned int thread_no = 0; thread_no < topology.num_threads;
+           ++thread_no) {
+        struct thread_data *t;
+
+        t = GET_THREAD(w->thread_base, thread_no, core_no, pkg_no);
+
+        if (cpu_is_not_present(t->cpu_id))
+          continue;
+        if ((n++ % config_read_threads) != w->index)
+          continue;
+
+        /* Core and package data is only written by the thread owning the
+         * first thread in core / first core in package. */
+        w->retval = read_counters(t, GET_CORE(w->core_base, core_no, pkg_no),
+                                  GET_PKG(w->pkg_base, pkg_no),
+                                  w->affinity_set);
+        if (w->retval)
+          return NULL;
+      }
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Collect the counters of all CPUs, spreading the CPUs over
+ * "config_read_threads" threads which migrate to the CPU they read from.
+ *
+ * Return the error code of the first failing thread or 0
+ */
+static int __attribute__((warn_unused_result))
+get_all_counters(struct thread_data *thread_base, struct core_data *core_base,
+                 struct pkg_data *pkg_base) {
+  if (config_read_threads <= 1)
+    return for_all_cpus(get_counters, thread_base, core_base, pkg_base);
+
+  struct counters_worker workers[config_read_threads];
+  int retval = 0;
+
+  memset(workers, 0, sizeof(workers));
+  for (unsigned int i = 0; i < config_read_threads; ++i) {
+    struct counters_worker *w = workers + i;
+
+    w->index = i;
+    w->thread_base = thread_base;
+    w->core_base = core_base;
+    w->pkg_base = pkg_base;
+    w->retval = -1;
+    w->affinity_set = CPU_ALLOC(topology.max_cpu_id + 1);
+    if (w->affinity_set == NULL) {
+      ERROR("turbostat plugin: Unable to allocate CPU state");
+      continue;
+    }
+
+    /* If no thread can be started, do the work here */
+    if (pthread_create(&w->thread, NULL, counters_worker_main, w) != 0) {
+      WARNING("turbostat plugin: Unable to start reader thread %u", i);
+      counters_worker_main(w);
+      CPU_FREE(w->affinity_set);
+      w->affinity_set = NULL;
+    }
+  }
+
+  for (unsigned int i = 0; i < config_read_threads; ++i) {
+    struct counters_worker *w = workers + i;
+
+    if (w->affinity_set != NULL) {
+      pthread_join(w->thread, NULL);
+      CPU_FREE(w->affinity_set);
+    }
+    if (w->retval && !retval)
+      retval = w->retval;
+  }
+
+  return retval;
+}
+
 /*
  * Dedicated loop: Extract every data evolution for all CPU
  *
@@ -1304,6 +1427,19 @@ static int allocate_counters(struct thread_data **threads,
   return 0;
 }
 
+static int allocate_msr_fds(void) {
+  msr_fds = calloc(topology.max_cpu_id + 1, sizeof(*msr_fds));
+  if (msr_fds == NULL) {
+    ERROR("turbostat plugin: calloc failed");
+    return -1;
+  }
+
+  for (unsigned int cpu = 0; cpu <= topology.max_cpu_id; ++cpu)
+    msr_fds[cpu] = -1;
+
+  return 0;
+}
+
 static void init_counter(struct thread_data *thread_base,
                          struct core_data *core_base, struct pkg_data *pkg_base,
                          unsigned int cpu_id) {
@@ -1376,6 +1512,13 @@ static void free_all_buffers(void) {
   thread_delta = NULL;
   core_delta = NULL;
   package_delta = NULL;
+
+  if (msr_fds != NULL) {
+    for (unsigned int cpu = 0; cpu <= topology.max_cpu_id; ++cpu)
+      if (msr_fds[cpu] >= 0)
+        close(msr_fds[cpu]);
+    sfree(msr_fds);
+  }
 }
 
 /**********************
@@ -1396,6 +1539,7 @@ static int setup_all_buffers(void) {
   DO_OR_GOTO_ERR(allocate_counters(&thread_even, &core_even, &package_even));
   DO_OR_GOTO_ERR(allocate_counters(&thread_odd, &core_odd, &package_odd));
   DO_OR_GOTO_ERR(allocate_counters(&thread_delta, &core_delta, &package_delta));
+  DO_OR_GOTO_ERR(allocate_msr_fds());
   initialize_counters();
   DO_OR_GOTO_ERR(for_all_cpus(set_temperature_target, EVEN_COUNTERS));
   DO_OR_GOTO_ERR(for_all_cpus(set_temperature_target, ODD_COUNTERS));
@@ -1434,7 +1578,7 @@ static int turbostat_read(void) {
   }
 
   if (!initialized) {
-    if ((ret = for_all_cpus(get_counters, EVEN_COUNTERS)) < 0)
+    if ((ret = get_all_counters(EVEN_COUNTERS)) < 0)
       goto out;
     time_even = cdtime();
     is_even = true;
@@ -1444,7 +1588,7 @@ static int turbostat_read(void) {
   }
 
   if (is_even) {
-    if ((ret = for_all_cpus(get_counters, ODD_COUNTERS)) < 0)
+    if ((ret = get_all_counters(ODD_COUNTERS)) < 0)
       goto out;
     time_odd = cdtime();
     is_even = false;
@@ -1454,7 +1598,7 @@ static int turbostat_read(void) {
     if ((ret = for_all_cpus(submit_counters, DELTA_COUNTERS)) < 0)
       goto out;
   } else {
-    if ((ret = for_all_cpus(get_counters, EVEN_COUNTERS)) < 0)
+    if ((ret = get_all_counters(EVEN_COUNTERS)) < 0)
       goto out;
     time_even = cdtime();
     is_even = true;
@@ -1589,6 +1733,13 @@ static int turbostat_config(const char *key, const char *value) {
       return -1;
     }
     tcc_activation_temp = (unsigned int)tmp_val;
+  } else if (strcasecmp("ReadThreads", key) == 0) {
+    tmp_val = strtoul(value, &end, 0);
+    if (*end != '\0' || tmp_val < 1 || tmp_val > 1024) {
+      ERROR("turbostat plugin: Invalid ReadThreads '%s'", value);
+      return -1;
+    }
+    config_read_threads = (unsigned int)tmp_val;
   } else {
     ERROR("turbostat plugin: Invalid configuration option '%s'", key);
     return -1;
@@ -30,9 +30,11 @@
 #include "plugin.h"
 
 #include "utils_cmd_flush.h"
+#include "utils_cmd_gethistory.h"
 #include "utils_cmd_getthreshold.h"
 #include "utils_cmd_getval.h"
 #include "utils_cmd_listval.h"
+#include "utils_cmd_memstats.h"
 #include "utils_cmd_putnotif.h"
 #include "utils_cmd_putval.h"
 
@@ -41,6 +43,10 @@
 
 #include <grp.h>
 
+#if HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #ifndef UNIX_PATH_MAX
 #define UNIX_PATH_MAX sizeof(((struct sockaddr_un *)0)->sun_path)
 #endif
@@ -52,7 +58,7 @@
  */
 /* valid configuration file keys */
 static const char *config_keys[] = {"SocketFile", "SocketGroup", "SocketPerms",
-                                    "DeleteSocket"};
+                                    "DeleteSocket", "WorkerThreads"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int loop;
@@ -66,6 +72,47 @@ static bool delete_socket;
 
 static pthread_t listen_thread = (pthread_t)0;
 
+/* Maximum length of a command line, including the newline. */
+#define US_LINE_MAX 1024
+
+#if HAVE_SYS_EPOLL_H
+/* With "WorkerThreads", each worker waits for the listening socket and the
+ * connections it accepted with epoll(7), instead of one thread being started
+ * per connection. The commands received on a connection are handled in order
+ * and their responses collected in "out". While not all of them could be
+ * written, no more commands are read from the connection. */
+struct us_conn_s {
+  int fd;
+  char in[US_LINE_MAX];
+  size_t in_fill;
+  char *out;
+  size_t out_size;
+  size_t out_offset;
+  bool writing; /* waiting for EPOLLOUT rather than EPOLLIN */
+  bool eof;     /* closed by the client, close once "out" is written */
+  cmd_putvals_t putvals;
+  struct us_conn_s *prev;
+  struct us_conn_s *next;
+};
+typedef struct us_conn_s us_conn_t;
+
+struct us_worker_s {
+  pthread_t id;
+  bool running;
+  int epoll_fd;
+  us_conn_t *conns;
+};
+typedef struct us_worker_s us_worker_t;
+
+/* Maximum number of events handled per epoll_wait(2) call. */
+#define US_EVENTS_MAX 64
+
+static us_worker_t *workers;
+static size_t workers_num;
+#endif /* HAVE_SYS_EPOLL_H */
+
+static size_t conf_workers_num;
+
 /*
  * Functions
  */
@@ -158,6 +205,64 @@ static int us_open_socket(void) {
   return 0;
 } /* int us_open_socket */
 
+static void us_close_socket(void) {
+  close(sock_fd);
+  sock_fd = -1;
+
+  int status = unlink((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
+  if (status != 0) {
+    NOTICE("unixsock plugin: unlink (%s) failed: %s",
+           (sock_file != NULL) ? sock_file : US_DEFAULT_PATH, STRERRNO);
+  }
+} /* void us_close_socket */
+
+/* Handles one command line and writes the response to "fhout". "command" is
+ * the line's first field. "putvals" holds the state of a PUTVALS block and
+ * must be kept per connection. Returns non-zero if writing the response
+ * failed. */
+static int us_handle_command(FILE *fhout, char *buffer, char const *command,
+                             cmd_putvals_t *putvals) {
+  if (putvals->lines_num > 0) {
+    cmd_handle_putvals_line(fhout, buffer, putvals);
+  } else if (strcasecmp(command, "getval") == 0) {
+    cmd_handle_getval(fhout, buffer);
+  } else if (strcasecmp(command, "getvals") == 0) {
+    cmd_handle_getvals(fhout, buffer);
+  } else if (strcasecmp(command, "gethistory") == 0) {
+    handle_gethistory(fhout, buffer);
+  } else if (strcasecmp(command, "getthreshold") == 0) {
+    handle_getthreshold(fhout, buffer);
+  } else if (strcasecmp(command, "putval") == 0) {
+    cmd_handle_putval(fhout, buffer);
+  } else if (strcasecmp(command, "putvals") == 0) {
+    cmd_parse_putvals(fhout, buffer, putvals);
+  } else if (strcasecmp(command, "memstats") == 0) {
+    handle_memstats(fhout, buffer);
+  } else if (strcasecmp(command, "listval") == 0) {
+    cmd_handle_listval(fhout, buffer);
+  } else if (strcasecmp(command, "putnotif") == 0) {
+    handle_putnotif(fhout, buffer);
+  } else if (strcasecmp(command, "flush") == 0) {
+    cmd_handle_flush(fhout, buffer);
+  } else if (strcasecmp(command, "reload") == 0) {
+    /* Done by the main loop, which owns the configuration. */
+    plugin_request_reload();
+    if (fprintf(fhout, "0 Reload scheduled\n") < 0) {
+      WARNING("unixsock plugin: failed to write to socket #%i: %s",
+              fileno(fhout), STRERRNO);
+      return -1;
+    }
+  } else {
+    if (fprintf(fhout, "-1 Unknown command: %s\n", command) < 0) {
+      WARNING("unixsock plugin: failed to write to socket #%i: %s",
+              fileno(fhout), STRERRNO);
+      return -1;
+    }
+  }
+
+  return 0;
+} /* int us_handle_command */
+
 static void *us_handle_client(void *arg) {
   int fdin;
   int fdout;
@@ -203,9 +308,10 @@ static void *us_handle_client(void *arg) {
     return (void *)0;
   }
 
+  cmd_putvals_t putvals = {0};
   while (42) {
-    char buffer[1024];
-    char buffer_copy[1024];
+    char buffer[US_LINE_MAX];
+    char buffer_copy[US_LINE_MAX];
     char *fields[128];
     int fields_num;
 
@@ -241,25 +347,8 @@ static void *us_handle_client(void *arg) {
       return (void *)1;
     }
 
-    if (strcasecmp(fields[0], "getval") == 0) {
-      cmd_handle_getval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "getthreshold") == 0) {
-      handle_getthreshold(fhout, buffer);
-    } else if (strcasecmp(fields[0], "putval") == 0) {
-      cmd_handle_putval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "listval") == 0) {
-      cmd_handle_listval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "putnotif") == 0) {
-      handle_putnotif(fhout, buffer);
-    } else if (strcasecmp(fields[0], "flush") == 0) {
-      cmd_handle_flush(fhout, buffer);
-    } else {
-      if (fprintf(fhout, "-1 Unknown command: %s\n", fields[0]) < 0) {
-        WARNING("unixsock plugin: failed to write to socket #%i: %s",
-                fileno(fhout), STRERRNO);
-        break;
-      }
-    }
+    if (us_handle_command(fhout, buffer, fields[0], &putvals) != 0)
+      break;
   } /* while (fgets) */
 
   DEBUG("unixsock plugin: us_handle_client: Exiting..");
@@ -317,19 +406,329 @@ static void *us_server_thread(void __attribute__((unused)) * arg) {
     }
   } /* while (loop) */
 
-  close(sock_fd);
-  sock_fd = -1;
+  us_close_socket();
   pthread_attr_destroy(&th_attr);
 
-  status = unlink((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
-  if (status != 0) {
-    NOTICE("unixsock plugin: unlink (%s) failed: %s",
-           (sock_file != NULL) ? sock_file : US_DEFAULT_PATH, STRERRNO);
-  }
-
   return (void *)0;
 } /* void *us_server_thread */
 
+#if HAVE_SYS_EPOLL_H
+static int us_conn_add(us_worker_t *w, int fd) /* {{{ */
+{
+  us_conn_t *c = calloc(1, sizeof(*c));
+  if (c == NULL) {
+    ERROR("unixsock plugin: calloc failed.");
+    return ENOMEM;
+  }
+  c->fd = fd;
+
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+  if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    int status = errno;
+    ERROR("unixsock plugin: epoll_ctl(2) failed: %s", STRERROR(status));
+    sfree(c);
+    return status;
+  }
+
+  c->next = w->conns;
+  if (w->conns != NULL)
+    w->conns->prev = c;
+  w->conns = c;
+  return 0;
+} /* }}} int us_conn_add */
+
+static void us_conn_close(us_worker_t *w, us_conn_t *c) /* {{{ */
+{
+  if (c->prev != NULL)
+    c->prev->next = c->next;
+  else
+    w->conns = c->next;
+  if (c->next != NULL)
+    c->next->prev = c->prev;
+
+  close(c->fd);
+  sfree(c->out);
+  sfree(c);
+} /* }}} void us_conn_close */
+
+static void us_accept(us_worker_t *w) /* {{{ */
+{
+  /* The listening socket is non-blocking and shared by all workers: accept
+   * until the backlog is empty, but let the connections have their turn now
+   * and then. */
+  for (int i = 0; i < US_EVENTS_MAX; i++) {
+    int fd = accept(sock_fd, NULL, NULL);
+    if (fd < 0) {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) &&
+          (errno != ECONNABORTED))
+        ERROR("unixsock plugin: accept failed: %s", STRERRNO);
+      return;
+    }
+
+    int flags = fcntl(fd, F_GETFL);
+    if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)) {
+      ERROR("unixsock plugin: fcntl failed: %s", STRERRNO);
+      close(fd);
+      continue;
+    }
+
+    if (us_conn_add(w, fd) != 0)
+      close(fd);
+  }
+} /* }}} void us_accept */
+
+/* Writes as much of the pending responses as possible and waits for the
+ * connection to become writable, rather than readable, if some remain.
+ * Returns non-zero if the connection should be closed, including when all
+ * responses have been written to a client which closed the connection. */
+static int us_conn_write(us_worker_t *w, us_conn_t *c) /* {{{ */
+{
+  while (c->out_offset < c->out_size) {
+    ssize_t status = send(c->fd, c->out + c->out_offset,
+                          c->out_size - c->out_offset, MSG_NOSIGNAL);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+      WARNING("unixsock plugin: failed to write to socket #%i: %s", c->fd,
+              STRERRNO);
+      return -1;
+    }
+    c->out_offset += (size_t)status;
+  }
+
+  bool done = (c->out_offset >= c->out_size);
+  if (done) {
+    sfree(c->out);
+    c->out_size = 0;
+    c->out_offset = 0;
+    if (c->eof)
+      return -1;
+  }
+
+  if (c->writing == !done)
+    return 0;
+
+  struct epoll_event ev = {.events = done ? EPOLLIN : EPOLLOUT,
+                           .data.ptr = c};
+  if (epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) != 0) {
+    ERROR("unixsock plugin: epoll_ctl(2) failed: %s", STRERRNO);
+    return -1;
+  }
+  c->writing = !done;
+  return 0;
+} /* }}} int us_conn_write */
+
+/* Handles the complete lines in c->in, collecting the responses in c->out.
+ * Returns non-zero if the connection should be closed. */
+static int us_conn_handle_lines(us_conn_t *c) /* {{{ */
+{
+  char *out = NULL;
+  size_t out_size = 0;
+  FILE *fhout = NULL;
+  int status = 0;
+
+  size_t offset = 0;
+  while (offset < c->in_fill) {
+    char *line = c->in + offset;
+    char *end = memchr(line, '\n', c->in_fill - offset);
+    if (end == NULL)
+      break;
+    *end = 0;
+    offset = (size_t)(end - c->in) + 1;
+
+    size_t len = (size_t)(end - line);
+    while ((len > 0) && (line[len - 1] == '\r'))
+      line[--len] = 0;
+    if (len == 0)
+      continue;
+
+    if (fhout == NULL) {
+      fhout = open_memstream(&out, &out_size);
+      if (fhout == NULL) {
+        ERROR("unixsock plugin: open_memstream failed: %s", STRERRNO);
+        return -1;
+      }
+    }
+
+    char buffer_copy[US_LINE_MAX];
+    char *fields[128];
+    sstrncpy(buffer_copy, line, sizeof(buffer_copy));
+    int fields_num = strsplit(buffer_copy, fields, STATIC_ARRAY_SIZE(fields));
+    if (fields_num < 1) {
+      fprintf(fhout, "-1 Internal error\n");
+      status = -1;
+      break;
+    }
+
+    if (us_handle_command(fhout, line, fields[0], &c->putvals) != 0) {
+      status = -1;
+      break;
+    }
+  }
+
+  memmove(c->in, c->in + offset, c->in_fill - offset);
+  c->in_fill -= offset;
+
+  if (fhout == NULL)
+    return status;
+
+  if (fclose(fhout) != 0) {
+    ERROR("unixsock plugin: fclose failed: %s", STRERRNO);
+    sfree(out);
+    return -1;
+  }
+
+  /* c->out is empty: commands are not read while responses are pending. */
+  c->out = out;
+  c->out_size = out_size;
+  c->out_offset = 0;
+  return status;
+} /* }}} int us_conn_handle_lines */
+
+/* Returns non-zero if the connection should be closed. */
+static int us_conn_read(us_worker_t *w, us_conn_t *c) /* {{{ */
+{
+  ssize_t status =
+      recv(c->fd, c->in + c->in_fill, sizeof(c->in) - c->in_fill, 0);
+  if (status < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+      return 0;
+    WARNING("unixsock plugin: failed to read from socket #%i: %s", c->fd,
+            STRERRNO);
+    return -1;
+  }
+  /* The responses of the last commands are still sent: the client may only
+   * have shut down its writing side. */
+  c->eof = (status == 0);
+  c->in_fill += (size_t)status;
+
+  if (us_conn_handle_lines(c) != 0) {
+    us_conn_write(w, c);
+    return -1;
+  }
+
+  if (c->in_fill >= sizeof(c->in)) {
+    WARNING("unixsock plugin: Received a line longer than %d bytes on "
+            "socket #%i. Closing the connection.",
+            US_LINE_MAX - 1, c->fd);
+    return -1;
+  }
+
+  return us_conn_write(w, c);
+} /* }}} int us_conn_read */
+
+static void *us_worker_thread(void *arg) /* {{{ */
+{
+  us_worker_t *w = arg;
+  struct epoll_event events[US_EVENTS_MAX];
+
+  while (loop != 0) {
+    /* The timeout makes sure the thread notices `loop' even if the signal
+     * sent by us_shutdown() arrives before epoll_wait(2) is called. */
+    int num = epoll_wait(w->epoll_fd, events, US_EVENTS_MAX,
+                         /* timeout = */ 1000);
+    if (num < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("unixsock plugin: epoll_wait(2) failed: %s", STRERRNO);
+      break;
+    }
+
+    for (int i = 0; i < num; i++) {
+      us_conn_t *c = events[i].data.ptr;
+
+      if (c == NULL)
+        us_accept(w);
+      else if (events[i].events & EPOLLOUT) {
+        if (us_conn_write(w, c) != 0)
+          us_conn_close(w, c);
+      } else if (us_conn_read(w, c) != 0)
+        us_conn_close(w, c);
+    }
+  } /* while (loop != 0) */
+
+  return NULL;
+} /* }}} void *us_worker_thread */
+
+static int us_workers_create(void) /* {{{ */
+{
+  int flags = fcntl(sock_fd, F_GETFL);
+  if ((flags < 0) || (fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK) != 0)) {
+    ERROR("unixsock plugin: fcntl failed: %s", STRERRNO);
+    return -1;
+  }
+
+  workers = calloc(conf_workers_num, sizeof(*workers));
+  if (workers == NULL) {
+    ERROR("unixsock plugin: calloc failed.");
+    return ENOMEM;
+  }
+  workers_num = conf_workers_num;
+
+  for (size_t i = 0; i < workers_num; i++)
+    workers[i].epoll_fd = -1;
+
+  for (size_t i = 0; i < workers_num; i++) {
+    us_worker_t *w = workers + i;
+
+    w->epoll_fd = epoll_create(/* size = */ 1);
+    if (w->epoll_fd < 0) {
+      int status = errno;
+      ERROR("unixsock plugin: epoll_create(2) failed: %s", STRERROR(status));
+      return status;
+    }
+
+    /* The listening socket is the only one with a NULL pointer. */
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+#ifdef EPOLLEXCLUSIVE
+    /* wake up one worker per new connection only */
+    ev.events |= EPOLLEXCLUSIVE;
+#endif
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, sock_fd, &ev) != 0) {
+      int status = errno;
+      ERROR("unixsock plugin: epoll_ctl(2) failed: %s", STRERROR(status));
+      return status;
+    }
+
+    char name[16];
+    snprintf(name, sizeof(name), "unixsock wrk%u", (unsigned int)i);
+    int status =
+        plugin_thread_create(&w->id, /* attr = */ NULL, us_worker_thread, w,
+                             name);
+    if (status != 0) {
+      ERROR("unixsock plugin: pthread_create failed: %s", STRERRNO);
+      continue;
+    }
+    w->running = true;
+  }
+
+  return 0;
+} /* }}} int us_workers_create */
+
+static void us_workers_destroy(void) /* {{{ */
+{
+  for (size_t i = 0; i < workers_num; i++) {
+    us_worker_t *w = workers + i;
+
+    if (w->running) {
+      pthread_kill(w->id, SIGTERM);
+      pthread_join(w->id, /* retval = */ NULL);
+      w->running = false;
+    }
+
+    while (w->conns != NULL)
+      us_conn_close(w, w->conns);
+    if (w->epoll_fd >= 0)
+      close(w->epoll_fd);
+  }
+
+  sfree(workers);
+  workers_num = 0;
+} /* }}} void us_workers_destroy */
+#endif /* HAVE_SYS_EPOLL_H */
+
 static int us_config(const char *key, const char *val) {
   if (strcasecmp(key, "SocketFile") == 0) {
     char *new_sock_file = strdup(val);
@@ -352,6 +751,20 @@ static int us_config(const char *key, const char *val) {
       delete_socket = true;
     else
       delete_socket = false;
+  } else if (strcasecmp(key, "WorkerThreads") == 0) {
+    int tmp = atoi(val);
+    if ((tmp < 0) || (tmp > 64)) {
+      ERROR("unixsock plugin: The `WorkerThreads' must be between 0 and 64.");
+      return 1;
+    }
+#if !HAVE_SYS_EPOLL_H
+    if (tmp > 0) {
+      WARNING("unixsock plugin: The `WorkerThreads' option is not supported "
+              "on this system, because epoll(7) is not available.");
+      tmp = 0;
+    }
+#endif
+    conf_workers_num = (size_t)tmp;
   } else {
     return -1;
   }
@@ -371,6 +784,21 @@ static int us_init(void) {
 
   loop = 1;
 
+#if HAVE_SYS_EPOLL_H
+  if (conf_workers_num > 0) {
+    if (us_open_socket() != 0)
+      return -1;
+
+    status = us_workers_create();
+    if (status != 0) {
+      us_workers_destroy();
+      us_close_socket();
+      return -1;
+    }
+    return 0;
+  }
+#endif
+
   status = plugin_thread_create(&listen_thread, NULL, us_server_thread, NULL,
                                 "unixsock listen");
   if (status != 0) {
@@ -392,6 +820,13 @@ static int us_shutdown(void) {
     listen_thread = (pthread_t)0;
   }
 
+#if HAVE_SYS_EPOLL_H
+  if (workers != NULL) {
+    us_workers_destroy();
+    us_close_socket();
+  }
+#endif
+
   plugin_unregister_init("unixsock");
   plugin_unregister_shutdown("unixsock");
 
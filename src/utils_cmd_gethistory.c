@@ -0,0 +1,196 @@
+/**
+ * collectd - src/utils_cmd_gethistory.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+
+#include "utils_cache.h"
+#include "utils_cmd_gethistory.h"
+#include "utils_parse_option.h" /* for `parse_string' and `parse_option' */
+
+#define print_to_socket(fh, ...)                                               \
+  do {                                                                         \
+    if (fprintf(fh, __VA_ARGS__) < 0) {                                        \
+      WARNING("handle_gethistory: failed to write to socket #%i: %s",          \
+              fileno(fh), STRERRNO);                                           \
+      status = -1;                                                             \
+      goto out;                                                                \
+    }                                                                          \
+  } while (0)
+
+/* Parses an epoch time. Negative values are relative to "now". */
+static int parse_history_time(const char *str, cdtime_t now,
+                              cdtime_t *ret) /* {{{ */
+{
+  char *endptr = NULL;
+
+  errno = 0;
+  double t = strtod(str, &endptr);
+  if ((errno != 0) || (endptr == str) || (*endptr != 0) || isnan(t))
+    return EINVAL;
+
+  if (t < 0.0) {
+    cdtime_t offset = DOUBLE_TO_CDTIME_T(-t);
+    *ret = (offset < now) ? now - offset : 0;
+  } else {
+    *ret = DOUBLE_TO_CDTIME_T(t);
+  }
+
+  return 0;
+} /* }}} int parse_history_time */
+
+int handle_gethistory(FILE *fh, char *buffer) {
+  char *command = NULL;
+  char *identifier = NULL;
+  char name[6 * DATA_MAX_NAME_LEN];
+
+  cdtime_t now = cdtime();
+  cdtime_t start = 0;
+  cdtime_t end = now;
+
+  cdtime_t *times = NULL;
+  gauge_t *values = NULL;
+  size_t num = 0;
+  size_t values_num = 0;
+
+  int status;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return -1;
+
+  DEBUG("utils_cmd_gethistory: handle_gethistory (fh = %p, buffer = %s);",
+        (void *)fh, buffer);
+
+  status = parse_string(&buffer, &command);
+  if (status != 0) {
+    print_to_socket(fh, "-1 Cannot parse command.\n");
+    status = -1;
+    goto out;
+  }
+  assert(command != NULL);
+
+  if (strcasecmp("GETHISTORY", command) != 0) {
+    print_to_socket(fh, "-1 Unexpected command: `%s'.\n", command);
+    status = -1;
+    goto out;
+  }
+
+  status = parse_string(&buffer, &identifier);
+  if (status != 0) {
+    print_to_socket(fh, "-1 Cannot parse identifier.\n");
+    status = -1;
+    goto out;
+  }
+  assert(identifier != NULL);
+
+  while (*buffer != 0) {
+    char *key = NULL;
+    char *value = NULL;
+    cdtime_t *dst;
+
+    status = parse_option(&buffer, &key, &value);
+    if (status != 0) {
+      print_to_socket(fh, "-1 Cannot parse option: %s\n", buffer);
+      status = -1;
+      goto out;
+    }
+
+    if (strcasecmp("start", key) == 0)
+      dst = &start;
+    else if (strcasecmp("end", key) == 0)
+      dst = &end;
+    else {
+      print_to_socket(fh, "-1 Unknown option: %s\n", key);
+      status = -1;
+      goto out;
+    }
+
+    if (parse_history_time(value, now, dst) != 0) {
+      print_to_socket(fh, "-1 Cannot parse time: %s\n", value);
+      status = -1;
+      goto out;
+    }
+  }
+
+  value_list_t vl = {.values = NULL};
+  if (parse_identifier_vl(identifier, &vl) != 0) {
+    print_to_socket(fh, "-1 Cannot parse identifier `%s'.\n", identifier);
+    status = -1;
+    goto out;
+  }
+  FORMAT_VL(name, sizeof(name), &vl);
+
+  data_set_t const *ds = plugin_get_ds(vl.type);
+  if (ds == NULL) {
+    print_to_socket(fh, "-1 Type `%s' is unknown.\n", vl.type);
+    status = -1;
+    goto out;
+  }
+
+  status = uc_get_history_range_by_name(name, start, end, &times, &values,
+                                        &num, &values_num);
+  if (status == ENOENT) {
+    print_to_socket(fh, "-1 No such value\n");
+    status = -1;
+    goto out;
+  } else if (status == ENOTSUP) {
+    print_to_socket(fh, "-1 History is disabled (see CacheHistoryRetention)\n");
+    status = -1;
+    goto out;
+  } else if (status != 0) {
+    print_to_socket(fh, "-1 Error while looking up history: %i\n", status);
+    status = -1;
+    goto out;
+  }
+
+  if (values_num != ds->ds_num) {
+    print_to_socket(fh, "-1 Error reading value from cache.\n");
+    status = -1;
+    goto out;
+  }
+
+  print_to_socket(fh, "%" PRIsz " Value%s found\n", num,
+                  (num == 1) ? "" : "s");
+  for (size_t i = 0; i < num; i++) {
+    print_to_socket(fh, "%.3f", CDTIME_T_TO_DOUBLE(times[i]));
+    for (size_t j = 0; j < values_num; j++) {
+      gauge_t v = values[i * values_num + j];
+      if (isnan(v))
+        print_to_socket(fh, "%c%s=NaN", (j == 0) ? ' ' : ',',
+                        ds->ds[j].name);
+      else
+        print_to_socket(fh, "%c%s=%.15g", (j == 0) ? ' ' : ',',
+                        ds->ds[j].name, v);
+    }
+    print_to_socket(fh, "\n");
+  }
+
+  status = 0;
+
+out:
+  sfree(times);
+  sfree(values);
+  return status;
+} /* int handle_gethistory */
@@ -33,6 +33,8 @@
 #include "utils_cmd_getval.h"
 #include "utils_parse_option.h"
 
+#include <fnmatch.h>
+
 cmd_status_t cmd_parse_getval(size_t argc, char **argv,
                               cmd_getval_t *ret_getval,
                               const cmd_options_t *opts,
@@ -157,6 +159,138 @@ cmd_status_t cmd_handle_getval(FILE *fh, char *buffer) {
   return CMD_OK;
 } /* cmd_status_t cmd_handle_getval */
 
+static bool getvals_match(const char *name, void *user_data) {
+  return fnmatch((const char *)user_data, name, /* flags = */ 0) == 0;
+} /* bool getvals_match */
+
+/* Copies the n bytes at "src" to "dst" if they contain no wildcards. */
+static bool getvals_exact(char *dst, size_t dst_size, const char *src,
+                          size_t n) {
+  if ((n == 0) || (n >= dst_size) || (strcspn(src, "*?[\\") < n))
+    return false;
+
+  memcpy(dst, src, n);
+  dst[n] = 0;
+  return true;
+} /* bool getvals_exact */
+
+#undef print_to_socket
+#define print_to_socket(fh, ...)                                               \
+  do {                                                                         \
+    if (fprintf(fh, __VA_ARGS__) < 0) {                                        \
+      WARNING("cmd_handle_getvals: failed to write to socket #%i: %s",         \
+              fileno(fh), STRERRNO);                                           \
+      status = CMD_ERROR;                                                      \
+      goto out;                                                                \
+    }                                                                          \
+  } while (0)
+
+cmd_status_t cmd_handle_getvals(FILE *fh, char *buffer) {
+  char *command = NULL;
+  char *pattern = NULL;
+  char host[DATA_MAX_NAME_LEN];
+  char plugin[DATA_MAX_NAME_LEN];
+
+  uc_snapshot_t *snapshots = NULL;
+  size_t snapshots_num = 0;
+  data_set_t const **data_sets = NULL;
+  size_t found = 0;
+
+  cmd_status_t status;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return CMD_ERROR;
+
+  DEBUG("utils_cmd_getval: cmd_handle_getvals (fh = %p, buffer = %s);",
+        (void *)fh, buffer);
+
+  if ((parse_string(&buffer, &command) != 0) ||
+      (strcasecmp("GETVALS", command) != 0)) {
+    print_to_socket(fh, "-1 Unexpected command.\n");
+    status = CMD_UNKNOWN_COMMAND;
+    goto out;
+  }
+
+  if (parse_string(&buffer, &pattern) != 0) {
+    print_to_socket(fh, "-1 Missing pattern.\n");
+    status = CMD_PARSE_ERROR;
+    goto out;
+  }
+  if (*buffer != 0) {
+    print_to_socket(fh, "-1 Garbage after pattern: `%s'.\n", buffer);
+    status = CMD_PARSE_ERROR;
+    goto out;
+  }
+
+  /* Use the cache's host and plugin indexes if the pattern allows. */
+  uc_query_t query = {.match = getvals_match, .user_data = pattern};
+  size_t host_len = strcspn(pattern, "/");
+  if ((pattern[host_len] == '/') &&
+      getvals_exact(host, sizeof(host), pattern, host_len)) {
+    const char *p = pattern + host_len + 1;
+
+    query.host = host;
+    if (getvals_exact(plugin, sizeof(plugin), p, strcspn(p, "-/")))
+      query.plugin = plugin;
+  }
+
+  if (uc_query(&query, &snapshots, &snapshots_num) != 0) {
+    print_to_socket(fh, "-1 Querying the cache failed.\n");
+    status = CMD_ERROR;
+    goto out;
+  }
+
+  data_sets = calloc(snapshots_num + 1, sizeof(*data_sets));
+  if (data_sets == NULL) {
+    print_to_socket(fh, "-1 calloc failed.\n");
+    status = CMD_ERROR;
+    goto out;
+  }
+
+  /* Look up the data sets first, so the number of matches is known before
+   * anything is written. */
+  for (size_t i = 0; i < snapshots_num; i++) {
+    value_list_t vl = {.values = NULL};
+
+    if (parse_identifier_vl(snapshots[i].name, &vl) != 0)
+      continue;
+
+    data_set_t const *ds = plugin_get_ds(vl.type);
+    if ((ds == NULL) || (ds->ds_num != snapshots[i].values_num))
+      continue;
+
+    data_sets[i] = ds;
+    found++;
+  }
+
+  print_to_socket(fh, "%" PRIsz " Value%s found\n", found,
+                  (found == 1) ? "" : "s");
+  for (size_t i = 0; i < snapshots_num; i++) {
+    uc_snapshot_t const *s = snapshots + i;
+    data_set_t const *ds = data_sets[i];
+
+    if (ds == NULL)
+      continue;
+
+    print_to_socket(fh, "%.3f %s ", CDTIME_T_TO_DOUBLE(s->time), s->name);
+    for (size_t j = 0; j < ds->ds_num; j++) {
+      if (isnan(s->rates[j]))
+        print_to_socket(fh, "%s%s=NaN", (j == 0) ? "" : ",", ds->ds[j].name);
+      else
+        print_to_socket(fh, "%s%s=%e", (j == 0) ? "" : ",", ds->ds[j].name,
+                        s->rates[j]);
+    }
+    print_to_socket(fh, "\n");
+  }
+  status = CMD_OK;
+
+out:
+  fflush(fh);
+  sfree(data_sets);
+  uc_snapshots_free(snapshots, snapshots_num);
+  return status;
+} /* cmd_status_t cmd_handle_getvals */
+
 void cmd_destroy_getval(cmd_getval_t *getval) {
   if (getval == NULL)
     return;
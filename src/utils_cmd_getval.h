@@ -38,6 +38,11 @@ cmd_status_t cmd_parse_getval(size_t argc, char **argv,
 
 cmd_status_t cmd_handle_getval(FILE *fh, char *buffer);
 
+/* Handles "GETVALS <pattern>": returns the current values of all cache
+ * entries whose identifier matches the shell wildcard pattern, from one pass
+ * over the cache. */
+cmd_status_t cmd_handle_getvals(FILE *fh, char *buffer);
+
 void cmd_destroy_getval(cmd_getval_t *getval);
 
 #endif /* UTILS_CMD_GETVAL_H */
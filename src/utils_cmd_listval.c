@@ -34,18 +34,54 @@
 #include "utils_parse_option.h"
 
 cmd_status_t cmd_parse_listval(size_t argc, char **argv,
+                               cmd_listval_t *ret_listval,
                                const cmd_options_t *opts
                                __attribute__((unused)),
                                cmd_error_handler_t *err) {
-  if (argc != 0) {
-    cmd_error(CMD_PARSE_ERROR, err, "Garbage after end of command: `%s'.",
-              argv[0]);
-    return CMD_PARSE_ERROR;
+  for (size_t i = 0; i < argc; i++) {
+    char *opt_key = NULL;
+    char *opt_value = NULL;
+
+    cmd_status_t status = cmd_parse_option(argv[i], &opt_key, &opt_value, err);
+    if (status != CMD_OK) {
+      if (status == CMD_NO_OPTION)
+        cmd_error(CMD_PARSE_ERROR, err, "Garbage after end of command: `%s'.",
+                  argv[i]);
+      cmd_destroy_listval(ret_listval);
+      return CMD_PARSE_ERROR;
+    }
+
+    char **field = NULL;
+    if (strcasecmp("host", opt_key) == 0)
+      field = &ret_listval->host;
+    else if (strcasecmp("plugin", opt_key) == 0)
+      field = &ret_listval->plugin;
+    else {
+      cmd_error(CMD_PARSE_ERROR, err, "Cannot parse option `%s'.", opt_key);
+      cmd_destroy_listval(ret_listval);
+      return CMD_PARSE_ERROR;
+    }
+
+    sfree(*field);
+    *field = strdup(opt_value);
+    if (*field == NULL) {
+      cmd_error(CMD_ERROR, err, "strdup failed.");
+      cmd_destroy_listval(ret_listval);
+      return CMD_ERROR;
+    }
   }
 
   return CMD_OK;
 } /* cmd_status_t cmd_parse_listval */
 
+void cmd_destroy_listval(cmd_listval_t *listval) {
+  if (listval == NULL)
+    return;
+
+  sfree(listval->host);
+  sfree(listval->plugin);
+} /* void cmd_destroy_listval */
+
 #define free_everything_and_return(status)                                     \
   do {                                                                         \
     for (size_t j = 0; j < number; j++) {                                      \
@@ -54,6 +90,7 @@ cmd_status_t cmd_parse_listval(size_t argc, char **argv,
     }                                                                          \
     sfree(names);                                                              \
     sfree(times);                                                              \
+    cmd_destroy(&cmd);                                                         \
     return status;                                                             \
   } while (0)
 
@@ -87,7 +124,8 @@ cmd_status_t cmd_handle_listval(FILE *fh, char *buffer) {
     free_everything_and_return(CMD_UNKNOWN_COMMAND);
   }
 
-  status = uc_get_names(&names, &times, &number);
+  status = uc_get_names_filtered(cmd.cmd.listval.host, cmd.cmd.listval.plugin,
+                                 &names, &times, &number);
   if (status != 0) {
     DEBUG("command listval: uc_get_names failed with status %i", status);
     cmd_error(CMD_ERROR, &err, "uc_get_names failed.");
@@ -32,9 +32,12 @@
 #include "utils_cmds.h"
 
 cmd_status_t cmd_parse_listval(size_t argc, char **argv,
+                               cmd_listval_t *ret_listval,
                                const cmd_options_t *opts,
                                cmd_error_handler_t *err);
 
+void cmd_destroy_listval(cmd_listval_t *listval);
+
 cmd_status_t cmd_handle_listval(FILE *fh, char *buffer);
 
 #endif /* UTILS_CMD_LISTVAL_H */
@@ -0,0 +1,121 @@
+/**
+ * collectd - src/utils_cmd_memstats.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+
+#include "utils_cmd_memstats.h"
+#include "utils_memstats.h"
+#include "utils_parse_option.h" /* for `parse_string' */
+
+#define print_to_socket(fh, ...)                                               \
+  do {                                                                         \
+    if (fprintf(fh, __VA_ARGS__) < 0) {                                        \
+      WARNING("handle_memstats: failed to write to socket #%i: %s",            \
+              fileno(fh), STRERRNO);                                           \
+      status = -1;                                                             \
+      goto out;                                                                \
+    }                                                                          \
+  } while (0)
+
+typedef struct {
+  char **lines;
+  size_t lines_num;
+  int64_t bytes;
+} memstats_reply_t;
+
+/* The counters are formatted first, so that the number of lines is known
+ * before the first one is sent. */
+static int memstats_format(char const *name, int64_t bytes, /* {{{ */
+                           int64_t objects, void *user_data) {
+  memstats_reply_t *r = user_data;
+  char line[DATA_MAX_NAME_LEN + 64];
+
+  char **tmp = realloc(r->lines, (r->lines_num + 1) * sizeof(*r->lines));
+  if (tmp == NULL)
+    return ENOMEM;
+  r->lines = tmp;
+
+  snprintf(line, sizeof(line), "%s bytes=%" PRIi64 ",objects=%" PRIi64, name,
+           bytes, objects);
+  r->lines[r->lines_num] = strdup(line);
+  if (r->lines[r->lines_num] == NULL)
+    return ENOMEM;
+  r->lines_num++;
+
+  r->bytes += bytes;
+  return 0;
+} /* }}} int memstats_format */
+
+int handle_memstats(FILE *fh, char *buffer) {
+  char *command = NULL;
+  memstats_reply_t r = {0};
+  int status;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return -1;
+
+  DEBUG("utils_cmd_memstats: handle_memstats (fh = %p, buffer = %s);",
+        (void *)fh, buffer);
+
+  status = parse_string(&buffer, &command);
+  if (status != 0) {
+    print_to_socket(fh, "-1 Cannot parse command.\n");
+    status = -1;
+    goto out;
+  }
+  assert(command != NULL);
+
+  if (strcasecmp("MEMSTATS", command) != 0) {
+    print_to_socket(fh, "-1 Unexpected command: `%s'.\n", command);
+    status = -1;
+    goto out;
+  }
+
+  if (*buffer != 0) {
+    print_to_socket(fh, "-1 Garbage after end of command: %s\n", buffer);
+    status = -1;
+    goto out;
+  }
+
+  if (memstat_foreach(memstats_format, &r) != 0) {
+    print_to_socket(fh, "-1 Formatting the memory statistics failed.\n");
+    status = -1;
+    goto out;
+  }
+
+  /* The last line is the sum of all counters' bytes. */
+  print_to_socket(fh, "%" PRIsz " Value%s found\n", r.lines_num + 1,
+                  (r.lines_num == 0) ? "" : "s");
+  for (size_t i = 0; i < r.lines_num; i++)
+    print_to_socket(fh, "%s\n", r.lines[i]);
+  print_to_socket(fh, "total bytes=%" PRIi64 "\n", r.bytes);
+
+  status = 0;
+
+out:
+  strarray_free(r.lines, r.lines_num);
+  return status;
+} /* int handle_memstats */
@@ -229,19 +229,17 @@ void cmd_destroy_putval(cmd_putval_t *putval) {
   putval->vl_num = 0;
 } /* void cmd_destroy_putval */
 
-cmd_status_t cmd_handle_putval(FILE *fh, char *buffer) {
-  cmd_error_handler_t err = {cmd_error_fh, fh};
+/* Parses a PUTVAL line and dispatches its values. Errors are reported to
+ * "err"; the number of dispatched values is returned in "ret_num". */
+static cmd_status_t putval_dispatch(char *buffer, cmd_error_handler_t *err,
+                                    size_t *ret_num) {
   cmd_t cmd;
+  cmd_status_t status;
 
-  int status;
-
-  DEBUG("utils_cmd_putval: cmd_handle_putval (fh = %p, buffer = %s);",
-        (void *)fh, buffer);
-
-  if ((status = cmd_parse(buffer, &cmd, NULL, &err)) != CMD_OK)
+  if ((status = cmd_parse(buffer, &cmd, NULL, err)) != CMD_OK)
     return status;
   if (cmd.type != CMD_PUTVAL) {
-    cmd_error(CMD_UNKNOWN_COMMAND, &err, "Unexpected command: `%s'.",
+    cmd_error(CMD_UNKNOWN_COMMAND, err, "Unexpected command: `%s'.",
               CMD_TO_STRING(cmd.type));
     cmd_destroy(&cmd);
     return CMD_UNKNOWN_COMMAND;
@@ -250,15 +248,99 @@ cmd_status_t cmd_handle_putval(FILE *fh, char *buffer) {
   for (size_t i = 0; i < cmd.cmd.putval.vl_num; ++i)
     plugin_dispatch_values(&cmd.cmd.putval.vl[i]);
 
+  *ret_num = cmd.cmd.putval.vl_num;
+  cmd_destroy(&cmd);
+  return CMD_OK;
+} /* cmd_status_t putval_dispatch */
+
+cmd_status_t cmd_handle_putval(FILE *fh, char *buffer) {
+  cmd_error_handler_t err = {cmd_error_fh, fh};
+  size_t num = 0;
+  cmd_status_t status;
+
+  DEBUG("utils_cmd_putval: cmd_handle_putval (fh = %p, buffer = %s);",
+        (void *)fh, buffer);
+
+  status = putval_dispatch(buffer, &err, &num);
+  if (status != CMD_OK)
+    return status;
+
   if (fh != stdout)
-    cmd_error(CMD_OK, &err, "Success: %i %s been dispatched.",
-              (int)cmd.cmd.putval.vl_num,
-              (cmd.cmd.putval.vl_num == 1) ? "value has" : "values have");
+    cmd_error(CMD_OK, &err, "Success: %i %s been dispatched.", (int)num,
+              (num == 1) ? "value has" : "values have");
 
-  cmd_destroy(&cmd);
   return CMD_OK;
 } /* int cmd_handle_putval */
 
+cmd_status_t cmd_parse_putvals(FILE *fh, char *buffer, /* {{{ */
+                               cmd_putvals_t *ret_putvals) {
+  cmd_error_handler_t err = {cmd_error_fh, fh};
+  char *fields[3];
+  char *endptr = NULL;
+  unsigned long num;
+
+  memset(ret_putvals, 0, sizeof(*ret_putvals));
+
+  if (strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields)) != 2) {
+    cmd_error(CMD_PARSE_ERROR, &err, "Usage: PUTVALS <number of lines>");
+    return CMD_PARSE_ERROR;
+  }
+
+  errno = 0;
+  num = strtoul(fields[1], &endptr, 10);
+  if ((errno != 0) || (endptr == fields[1]) || (*endptr != 0) || (num < 1) ||
+      (num > CMD_PUTVALS_MAX)) {
+    cmd_error(CMD_PARSE_ERROR, &err,
+              "Invalid number of lines: `%s' (expected 1 to %i).", fields[1],
+              CMD_PUTVALS_MAX);
+    return CMD_PARSE_ERROR;
+  }
+
+  ret_putvals->lines_num = (size_t)num;
+  return CMD_OK;
+} /* }}} cmd_status_t cmd_parse_putvals */
+
+/* Error handler which remembers the first error of a PUTVALS block instead
+ * of writing it to the client right away. */
+static void putvals_error(void *ud, cmd_status_t status, const char *format,
+                          va_list ap) {
+  cmd_putvals_t *putvals = ud;
+
+  if ((status == CMD_OK) || (putvals->error[0] != 0))
+    return;
+
+  vsnprintf(putvals->error, sizeof(putvals->error), format, ap);
+} /* void putvals_error */
+
+bool cmd_handle_putvals_line(FILE *fh, char *buffer, /* {{{ */
+                             cmd_putvals_t *putvals) {
+  cmd_error_handler_t err = {putvals_error, putvals};
+  size_t num = 0;
+
+  assert(putvals->lines_done < putvals->lines_num);
+
+  if (putval_dispatch(buffer, &err, &num) == CMD_OK)
+    putvals->values_num += num;
+  else
+    putvals->lines_failed++;
+  putvals->lines_done++;
+
+  if (putvals->lines_done < putvals->lines_num)
+    return false;
+
+  err = (cmd_error_handler_t){cmd_error_fh, fh};
+  if (putvals->lines_failed == 0)
+    cmd_error(CMD_OK, &err, "Success: %zu %s been dispatched.",
+              putvals->values_num,
+              (putvals->values_num == 1) ? "value has" : "values have");
+  else
+    cmd_error(CMD_ERROR, &err, "%zu of %zu lines failed, first error: %s",
+              putvals->lines_failed, putvals->lines_num, putvals->error);
+
+  memset(putvals, 0, sizeof(*putvals));
+  return true;
+} /* }}} bool cmd_handle_putvals_line */
+
 int cmd_create_putval(char *ret, size_t ret_len, /* {{{ */
                       const data_set_t *ds, const value_list_t *vl) {
   char buffer_ident[6 * DATA_MAX_NAME_LEN];
@@ -39,6 +39,32 @@ cmd_status_t cmd_parse_putval(size_t argc, char **argv,
 
 cmd_status_t cmd_handle_putval(FILE *fh, char *buffer);
 
+/*
+ * PUTVALS <n>
+ *
+ * Announces that the next "n" lines are PUTVAL commands. They are dispatched
+ * as they arrive, but acknowledged with a single status line after the last
+ * one, which saves clients a round trip per value list.
+ */
+#define CMD_PUTVALS_MAX 1000000
+
+typedef struct {
+  size_t lines_num;
+  size_t lines_done;
+  size_t lines_failed;
+  size_t values_num;
+  char error[256];
+} cmd_putvals_t;
+
+/* Parses the "PUTVALS <n>" line. Errors are written to "fh". */
+cmd_status_t cmd_parse_putvals(FILE *fh, char *buffer,
+                               cmd_putvals_t *ret_putvals);
+
+/* Handles one of the announced PUTVAL lines. After the last line, the status
+ * of the whole block is written to "fh", "putvals" is reset and true is
+ * returned. */
+bool cmd_handle_putvals_line(FILE *fh, char *buffer, cmd_putvals_t *putvals);
+
 void cmd_destroy_putval(cmd_putval_t *putval);
 
 int cmd_create_putval(char *ret, size_t ret_len, const data_set_t *ds,
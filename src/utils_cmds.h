@@ -61,6 +61,12 @@ typedef struct {
   identifier_t identifier;
 } cmd_getval_t;
 
+typedef struct {
+  /* Only list the values of this host and plugin, if not NULL. */
+  char *host;
+  char *plugin;
+} cmd_listval_t;
+
 typedef struct {
   /* The raw identifier as provided by the user. */
   char *raw_identifier;
@@ -83,6 +89,7 @@ typedef struct {
   union {
     cmd_flush_t flush;
     cmd_getval_t getval;
+    cmd_listval_t listval;
     cmd_putval_t putval;
   } cmd;
 } cmd_t;
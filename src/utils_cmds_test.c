@@ -107,11 +107,17 @@ static struct {
     {
         "LISTVAL", NULL, CMD_OK, CMD_LISTVAL,
     },
+    {
+        "LISTVAL host=myhost plugin=cpu", NULL, CMD_OK, CMD_LISTVAL,
+    },
 
     /* Invalid LISTVAL commands. */
     {
         "LISTVAL invalid", NULL, CMD_PARSE_ERROR, CMD_UNKNOWN,
     },
+    {
+        "LISTVAL type=cpu", NULL, CMD_PARSE_ERROR, CMD_UNKNOWN,
+    },
 
     /* Valid PUTVAL commands. */
     {
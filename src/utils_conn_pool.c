@@ -0,0 +1,295 @@
+/**
+ * collectd - src/utils_conn_pool.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_conn_pool.h"
+
+#define CONN_POOL_RETRY_MIN TIME_T_TO_CDTIME_T(1)
+#define CONN_POOL_RETRY_MAX TIME_T_TO_CDTIME_T(60)
+
+typedef struct {
+  void *conn;
+  cdtime_t last_used;
+} conn_pool_entry_t;
+
+struct conn_pool_s {
+  char *name;
+  conn_pool_ops_t ops;
+  void *arg;
+  size_t size;
+  cdtime_t check_interval;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  bool thread_running;
+  bool stop;
+
+  /* Connections which are established, whether idle, in use or being
+   * checked, plus the one being established. At most "size". */
+  size_t open;
+  conn_pool_entry_t *idle;
+  size_t idle_num;
+  void **broken;
+  size_t broken_num;
+  size_t checking;
+
+  uint64_t attempts;     /* finished connection attempts */
+  unsigned int failures; /* consecutive failed attempts */
+  cdtime_t retry_time;
+};
+
+/* Must be called with "lock" held. Returns the next time the thread has
+ * something to do, or zero if it only has to wait for a signal. */
+static cdtime_t conn_pool_next_time(conn_pool_t *pool) {
+  cdtime_t next = 0;
+
+  if (pool->open < pool->size)
+    next = pool->retry_time;
+
+  if ((pool->ops.check != NULL) && (pool->check_interval > 0)) {
+    for (size_t i = 0; i < pool->idle_num; i++) {
+      cdtime_t t = pool->idle[i].last_used + pool->check_interval;
+      if ((next == 0) || (t < next))
+        next = t;
+    }
+  }
+
+  return next;
+} /* cdtime_t conn_pool_next_time */
+
+/* Must be called with "lock" held, which is released while connecting. */
+static void conn_pool_connect(conn_pool_t *pool) {
+  pool->open++;
+  pthread_mutex_unlock(&pool->lock);
+  void *conn = pool->ops.connect(pool->arg);
+  pthread_mutex_lock(&pool->lock);
+
+  pool->attempts++;
+  if (conn == NULL) {
+    pool->open--;
+    pool->failures++;
+
+    cdtime_t delay = CONN_POOL_RETRY_MIN;
+    for (unsigned int i = 1;
+         (i < pool->failures) && (delay < CONN_POOL_RETRY_MAX); i++)
+      delay *= 2;
+    if (delay > CONN_POOL_RETRY_MAX)
+      delay = CONN_POOL_RETRY_MAX;
+
+    DEBUG("conn_pool: \"%s\": Connecting failed %u times, retrying in %.3f s.",
+          pool->name, pool->failures, CDTIME_T_TO_DOUBLE(delay));
+    pool->retry_time = cdtime() + delay;
+  } else {
+    if (pool->failures > 0)
+      INFO("conn_pool: \"%s\": Connected after %u failed attempts.",
+           pool->name, pool->failures);
+    pool->failures = 0;
+    pool->retry_time = 0;
+    pool->idle[pool->idle_num++] =
+        (conn_pool_entry_t){.conn = conn, .last_used = cdtime()};
+  }
+
+  pthread_cond_broadcast(&pool->cond);
+} /* void conn_pool_connect */
+
+/* Must be called with "lock" held, which is released while checking. Checks
+ * the connections which have been idle for "check_interval". */
+static void conn_pool_check(conn_pool_t *pool, cdtime_t now) {
+  void *conns[pool->size];
+  size_t conns_num = 0;
+
+  for (size_t i = 0; i < pool->idle_num;) {
+    if (pool->idle[i].last_used + pool->check_interval > now) {
+      i++;
+      continue;
+    }
+    conns[conns_num++] = pool->idle[i].conn;
+    pool->idle[i] = pool->idle[--pool->idle_num];
+  }
+  if (conns_num == 0)
+    return;
+
+  pool->checking = conns_num;
+  pthread_mutex_unlock(&pool->lock);
+
+  bool healthy[conns_num];
+  for (size_t i = 0; i < conns_num; i++)
+    healthy[i] = (pool->ops.check(conns[i], pool->arg) == 0);
+
+  pthread_mutex_lock(&pool->lock);
+  for (size_t i = 0; i < conns_num; i++) {
+    if (healthy[i]) {
+      pool->idle[pool->idle_num++] =
+          (conn_pool_entry_t){.conn = conns[i], .last_used = cdtime()};
+    } else {
+      WARNING("conn_pool: \"%s\": Connection check failed, reconnecting.",
+              pool->name);
+      pool->broken[pool->broken_num++] = conns[i];
+    }
+  }
+  pool->checking = 0;
+  pthread_cond_broadcast(&pool->cond);
+} /* void conn_pool_check */
+
+static void *conn_pool_thread(void *arg) {
+  conn_pool_t *pool = arg;
+
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->stop) {
+    if (pool->broken_num > 0) {
+      void *conn = pool->broken[--pool->broken_num];
+      pthread_mutex_unlock(&pool->lock);
+      pool->ops.close(conn, pool->arg);
+      pthread_mutex_lock(&pool->lock);
+      pool->open--;
+      continue;
+    }
+
+    cdtime_t now = cdtime();
+    if ((pool->open < pool->size) && (pool->retry_time <= now)) {
+      conn_pool_connect(pool);
+      continue;
+    }
+
+    if ((pool->ops.check != NULL) && (pool->check_interval > 0))
+      conn_pool_check(pool, now);
+
+    cdtime_t next = conn_pool_next_time(pool);
+    if ((pool->broken_num > 0) || pool->stop ||
+        ((next != 0) && (next <= cdtime())))
+      continue;
+
+    if (next == 0) {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    } else {
+      struct timespec ts = CDTIME_T_TO_TIMESPEC(next);
+      pthread_cond_timedwait(&pool->cond, &pool->lock, &ts);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+} /* void *conn_pool_thread */
+
+conn_pool_t *conn_pool_create(char const *name, conn_pool_ops_t const *ops,
+                              void *arg, size_t size, cdtime_t check_interval) {
+  if ((name == NULL) || (ops == NULL) || (ops->connect == NULL) ||
+      (ops->close == NULL) || (size == 0))
+    return NULL;
+
+  conn_pool_t *pool = calloc(1, sizeof(*pool));
+  if (pool == NULL)
+    return NULL;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+
+  pool->name = strdup(name);
+  pool->idle = calloc(size, sizeof(*pool->idle));
+  pool->broken = calloc(size, sizeof(*pool->broken));
+  if ((pool->name == NULL) || (pool->idle == NULL) || (pool->broken == NULL)) {
+    conn_pool_destroy(pool);
+    return NULL;
+  }
+  pool->ops = *ops;
+  pool->arg = arg;
+  pool->size = size;
+  pool->check_interval = check_interval;
+
+  char thread_name[16];
+  snprintf(thread_name, sizeof(thread_name), "pool %s", name);
+  int status = plugin_thread_create(&pool->thread, /* attr = */ NULL,
+                                    conn_pool_thread, pool, thread_name);
+  if (status != 0) {
+    ERROR("conn_pool: \"%s\": Starting the thread failed: %s", name,
+          STRERROR(status));
+    conn_pool_destroy(pool);
+    return NULL;
+  }
+  pool->thread_running = true;
+
+  return pool;
+} /* conn_pool_t *conn_pool_create */
+
+void conn_pool_destroy(conn_pool_t *pool) {
+  if (pool == NULL)
+    return;
+
+  if (pool->thread_running) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_join(pool->thread, NULL);
+    pool->thread_running = false;
+  }
+
+  /* The thread has quit, so nothing is being connected or checked. */
+  for (size_t i = 0; i < pool->idle_num; i++)
+    pool->ops.close(pool->idle[i].conn, pool->arg);
+  for (size_t i = 0; i < pool->broken_num; i++)
+    pool->ops.close(pool->broken[i], pool->arg);
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->cond);
+  sfree(pool->idle);
+  sfree(pool->broken);
+  sfree(pool->name);
+  sfree(pool);
+} /* void conn_pool_destroy */
+
+void *conn_pool_get(conn_pool_t *pool) {
+  if (pool == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  while ((pool->idle_num == 0) &&
+         ((pool->checking > 0) || (pool->attempts == 0)))
+    pthread_cond_wait(&pool->cond, &pool->lock);
+
+  void *conn = NULL;
+  if (pool->idle_num > 0)
+    conn = pool->idle[--pool->idle_num].conn;
+  pthread_mutex_unlock(&pool->lock);
+
+  return conn;
+} /* void *conn_pool_get */
+
+void conn_pool_put(conn_pool_t *pool, void *conn, bool broken) {
+  if ((pool == NULL) || (conn == NULL))
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  if (broken) {
+    pool->broken[pool->broken_num++] = conn;
+    pthread_cond_broadcast(&pool->cond);
+  } else {
+    pool->idle[pool->idle_num++] =
+        (conn_pool_entry_t){.conn = conn, .last_used = cdtime()};
+  }
+  pthread_mutex_unlock(&pool->lock);
+} /* void conn_pool_put */
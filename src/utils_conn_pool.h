@@ -0,0 +1,70 @@
+/**
+ * collectd - src/utils_conn_pool.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_CONN_POOL_H
+#define UTILS_CONN_POOL_H 1
+
+#include "utils_time.h"
+
+/* Connections to a server, established and checked by a thread of the pool,
+ * so that read callbacks never wait for a connection to be set up. A read
+ * callback takes a connection with conn_pool_get() and hands it back with
+ * conn_pool_put(), flagging it as broken if it failed. Broken connections are
+ * closed and replaced in the background; while no connection is available,
+ * conn_pool_get() returns NULL right away and the read is skipped. Failed
+ * connection attempts are retried with an exponential backoff.
+ *
+ * Connections which have not been used for "check_interval" are checked with
+ * the "check" callback, if any, and replaced if that fails. */
+struct conn_pool_s;
+typedef struct conn_pool_s conn_pool_t;
+
+struct conn_pool_ops_s {
+  /* Returns a new connection or NULL on failure, after logging the error. */
+  void *(*connect)(void *arg);
+  /* Returns zero if "conn" is still usable. May be NULL. */
+  int (*check)(void *conn, void *arg);
+  /* Closes and frees "conn". */
+  void (*close)(void *conn, void *arg);
+};
+typedef struct conn_pool_ops_s conn_pool_ops_t;
+
+/* Creates a pool of up to "size" connections and starts connecting. "arg" is
+ * passed to the callbacks, which are called from the thread of the pool. The
+ * thread must not be started before the daemon has forked, i.e. create pools
+ * in init or read callbacks rather than config callbacks. */
+conn_pool_t *conn_pool_create(char const *name, conn_pool_ops_t const *ops,
+                              void *arg, size_t size, cdtime_t check_interval);
+
+/* Closes all connections. None of them may be in use. */
+void conn_pool_destroy(conn_pool_t *pool);
+
+/* Returns an idle connection, or NULL if none is available. Only waits for
+ * the first connection attempt and for running checks. */
+void *conn_pool_get(conn_pool_t *pool);
+
+/* Returns "conn" to the pool. If "broken" is true, it is closed and replaced
+ * in the background. */
+void conn_pool_put(conn_pool_t *pool, void *conn, bool broken);
+
+#endif /* UTILS_CONN_POOL_H */
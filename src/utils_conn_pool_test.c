@@ -0,0 +1,195 @@
+/**
+ * collectd - src/utils_conn_pool_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "testing.h"
+
+#include "collectd.h"
+
+#include "common.h"
+#include "utils_conn_pool.h"
+
+/* A fake server: connections are numbered, "down" makes connecting and
+ * checking fail. */
+typedef struct {
+  pthread_mutex_t lock;
+  bool down;
+  int connects;
+  int checks;
+  int closes;
+} fake_server_t;
+
+static void *fake_connect(void *arg) {
+  fake_server_t *srv = arg;
+
+  pthread_mutex_lock(&srv->lock);
+  int *conn = NULL;
+  if (!srv->down) {
+    conn = malloc(sizeof(*conn));
+    if (conn != NULL)
+      *conn = ++srv->connects;
+  }
+  pthread_mutex_unlock(&srv->lock);
+
+  return conn;
+}
+
+static int fake_check(__attribute__((unused)) void *conn, void *arg) {
+  fake_server_t *srv = arg;
+
+  pthread_mutex_lock(&srv->lock);
+  srv->checks++;
+  int status = srv->down ? -1 : 0;
+  pthread_mutex_unlock(&srv->lock);
+
+  return status;
+}
+
+static void fake_close(void *conn, void *arg) {
+  fake_server_t *srv = arg;
+
+  pthread_mutex_lock(&srv->lock);
+  srv->closes++;
+  pthread_mutex_unlock(&srv->lock);
+  free(conn);
+}
+
+static conn_pool_ops_t fake_ops = {
+    .connect = fake_connect, .check = fake_check, .close = fake_close,
+};
+
+/* cdtime() is mocked. It is kept in step with the clock the thread of the
+ * pool waits for. */
+static void sleep_ms(int ms) {
+  for (int i = 0; i < ms; i++) {
+    usleep(1000);
+    cdtime_mock += MS_TO_CDTIME_T(1);
+  }
+}
+
+/* Polls for up to two seconds until a connection is available. */
+static int *get_eventually(conn_pool_t *pool) {
+  for (int i = 0; i < 200; i++) {
+    int *conn = conn_pool_get(pool);
+    if (conn != NULL)
+      return conn;
+    sleep_ms(10);
+  }
+  return NULL;
+}
+
+DEF_TEST(get_put) {
+  fake_server_t srv = {.lock = PTHREAD_MUTEX_INITIALIZER};
+  conn_pool_t *pool;
+  int *conn;
+
+  CHECK_NOT_NULL(pool = conn_pool_create("test", &fake_ops, &srv, 1, 0));
+
+  /* The first get waits for the first connection attempt. */
+  CHECK_NOT_NULL(conn = conn_pool_get(pool));
+  EXPECT_EQ_INT(1, *conn);
+  /* The only connection is in use. */
+  EXPECT_EQ_PTR(NULL, conn_pool_get(pool));
+
+  conn_pool_put(pool, conn, /* broken = */ false);
+  CHECK_NOT_NULL(conn = conn_pool_get(pool));
+  EXPECT_EQ_INT(1, *conn);
+
+  /* A broken connection is replaced in the background. */
+  conn_pool_put(pool, conn, /* broken = */ true);
+  CHECK_NOT_NULL(conn = get_eventually(pool));
+  EXPECT_EQ_INT(2, *conn);
+  EXPECT_EQ_INT(1, srv.closes);
+
+  conn_pool_put(pool, conn, /* broken = */ false);
+  conn_pool_destroy(pool);
+  EXPECT_EQ_INT(2, srv.closes);
+
+  return 0;
+}
+
+DEF_TEST(server_down) {
+  fake_server_t srv = {.lock = PTHREAD_MUTEX_INITIALIZER, .down = true};
+  conn_pool_t *pool;
+  int *conn;
+
+  CHECK_NOT_NULL(pool = conn_pool_create("test", &fake_ops, &srv, 1, 0));
+
+  /* Only the first attempt is waited for. */
+  EXPECT_EQ_PTR(NULL, conn_pool_get(pool));
+  EXPECT_EQ_PTR(NULL, conn_pool_get(pool));
+
+  /* Retried after a second. */
+  pthread_mutex_lock(&srv.lock);
+  srv.down = false;
+  pthread_mutex_unlock(&srv.lock);
+  CHECK_NOT_NULL(conn = get_eventually(pool));
+  EXPECT_EQ_INT(1, *conn);
+
+  conn_pool_put(pool, conn, /* broken = */ false);
+  conn_pool_destroy(pool);
+  EXPECT_EQ_INT(1, srv.closes);
+
+  return 0;
+}
+
+DEF_TEST(check) {
+  fake_server_t srv = {.lock = PTHREAD_MUTEX_INITIALIZER};
+  conn_pool_t *pool;
+  int *conn;
+
+  CHECK_NOT_NULL(pool = conn_pool_create("test", &fake_ops, &srv, 2,
+                                         MS_TO_CDTIME_T(50)));
+  CHECK_NOT_NULL(conn = conn_pool_get(pool));
+  conn_pool_put(pool, conn, /* broken = */ false);
+
+  /* Idle connections are checked. */
+  sleep_ms(200);
+  pthread_mutex_lock(&srv.lock);
+  OK(srv.checks > 0);
+  /* Failing checks close the connections and reconnecting fails. */
+  srv.down = true;
+  pthread_mutex_unlock(&srv.lock);
+  sleep_ms(200);
+
+  pthread_mutex_lock(&srv.lock);
+  EXPECT_EQ_INT(srv.connects, srv.closes);
+  pthread_mutex_unlock(&srv.lock);
+  EXPECT_EQ_PTR(NULL, conn_pool_get(pool));
+
+  conn_pool_destroy(pool);
+  EXPECT_EQ_INT(srv.connects, srv.closes);
+
+  return 0;
+}
+
+int main(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  cdtime_mock = TIMESPEC_TO_CDTIME_T(&ts);
+
+  RUN_TEST(get_put);
+  RUN_TEST(server_down);
+  RUN_TEST(check);
+
+  END_TEST;
+}
@@ -0,0 +1,364 @@
+/**
+ * collectd - src/utils_curl_engine.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_curl_engine.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+
+#define CE_STATE_IDLE 0
+#define CE_STATE_QUEUED 1
+#define CE_STATE_ACTIVE 2
+
+/* How long the engine thread sleeps when there is nothing to do. New
+ * requests interrupt the wait through the wakeup pipe. */
+#define CE_WAIT_TIMEOUT_MS 1000
+
+static pthread_mutex_t ce_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ce_cond = PTHREAD_COND_INITIALIZER;
+
+static CURLM *ce_multi;
+static pthread_t ce_thread;
+static bool ce_running;
+static bool ce_stop;
+static int ce_pipe[2] = {-1, -1};
+
+/* Requests waiting to be added to the multi handle. */
+static curl_engine_request_t *ce_queue_head;
+static curl_engine_request_t *ce_queue_tail;
+/* Requests currently attached to the multi handle. */
+static curl_engine_request_t *ce_active;
+
+static void ce_wakeup(void) /* {{{ */
+{
+  char c = 0;
+
+  /* The pipe is non-blocking: if it is full, the engine is going to wake up
+   * anyway. */
+  if (write(ce_pipe[1], &c, sizeof(c)) < 0 && errno != EAGAIN) {
+    DEBUG("curl engine: write to wakeup pipe failed: %s", STRERRNO);
+  }
+} /* }}} void ce_wakeup */
+
+static void ce_active_unlink(curl_engine_request_t *req) /* {{{ */
+{
+  curl_engine_request_t *prev = NULL;
+
+  for (curl_engine_request_t *ptr = ce_active; ptr != NULL; ptr = ptr->next) {
+    if (ptr != req) {
+      prev = ptr;
+      continue;
+    }
+
+    if (prev == NULL)
+      ce_active = ptr->next;
+    else
+      prev->next = ptr->next;
+    req->next = NULL;
+    return;
+  }
+} /* }}} void ce_active_unlink */
+
+/* Attaches queued requests to the multi handle and detaches cancelled ones.
+ * Requests which could not be attached are prepended to "finished". Must be
+ * called with ce_lock held. */
+static void ce_sync_handles(curl_engine_request_t **finished) /* {{{ */
+{
+  curl_engine_request_t *ptr = ce_active;
+  bool cancelled = false;
+
+  while (ptr != NULL) {
+    curl_engine_request_t *next = ptr->next;
+
+    if (ptr->cancel) {
+      curl_multi_remove_handle(ce_multi, ptr->curl);
+      ce_active_unlink(ptr);
+      ptr->cancel = false;
+      ptr->state = CE_STATE_IDLE;
+      cancelled = true;
+    }
+    ptr = next;
+  }
+  if (cancelled)
+    pthread_cond_broadcast(&ce_cond);
+
+  while (ce_queue_head != NULL) {
+    curl_engine_request_t *req = ce_queue_head;
+
+    ce_queue_head = req->next;
+    if (ce_queue_head == NULL)
+      ce_queue_tail = NULL;
+
+    curl_easy_setopt(req->curl, CURLOPT_PRIVATE, (void *)req);
+
+    CURLMcode status = curl_multi_add_handle(ce_multi, req->curl);
+    req->state = CE_STATE_ACTIVE;
+    if (status != CURLM_OK) {
+      ERROR("curl engine: curl_multi_add_handle failed: %s",
+            curl_multi_strerror(status));
+      req->status = CURLE_FAILED_INIT;
+      req->next = *finished;
+      *finished = req;
+      continue;
+    }
+
+    req->next = ce_active;
+    ce_active = req;
+  }
+} /* }}} void ce_sync_handles */
+
+static void *ce_thread_main(void *arg) /* {{{ */
+{
+  while (42) {
+    curl_engine_request_t *finished = NULL;
+    CURLMsg *msg;
+    int msgs_left;
+    int running;
+
+    pthread_mutex_lock(&ce_lock);
+    if (ce_stop) {
+      pthread_mutex_unlock(&ce_lock);
+      break;
+    }
+    ce_sync_handles(&finished);
+    pthread_mutex_unlock(&ce_lock);
+
+    curl_multi_perform(ce_multi, &running);
+
+    while ((msg = curl_multi_info_read(ce_multi, &msgs_left)) != NULL) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      /* "msg" becomes invalid once the handle has been removed. */
+      CURL *curl = msg->easy_handle;
+      CURLcode result = msg->data.result;
+      curl_engine_request_t *req = NULL;
+
+      curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&req);
+      curl_multi_remove_handle(ce_multi, curl);
+      if (req == NULL)
+        continue;
+
+      pthread_mutex_lock(&ce_lock);
+      ce_active_unlink(req);
+      pthread_mutex_unlock(&ce_lock);
+
+      req->status = result;
+      req->next = finished;
+      finished = req;
+    }
+
+    /* Completion callbacks run without the lock held so that they may
+     * dispatch values or submit other requests. curl_engine_cancel() on a
+     * finishing request waits for the state to become idle. */
+    while (finished != NULL) {
+      curl_engine_request_t *req = finished;
+      finished = req->next;
+      req->next = NULL;
+
+      pthread_mutex_lock(&ce_lock);
+      bool cancelled = req->cancel;
+      pthread_mutex_unlock(&ce_lock);
+
+      if (!cancelled) {
+        plugin_set_ctx(req->ctx);
+        req->done(req, req->status);
+      }
+
+      pthread_mutex_lock(&ce_lock);
+      req->cancel = false;
+      req->state = CE_STATE_IDLE;
+      pthread_cond_broadcast(&ce_cond);
+      pthread_mutex_unlock(&ce_lock);
+    }
+
+    struct curl_waitfd wake = {
+        .fd = ce_pipe[0], .events = CURL_WAIT_POLLIN,
+    };
+    curl_multi_wait(ce_multi, &wake, 1, CE_WAIT_TIMEOUT_MS, NULL);
+    if (wake.revents != 0) {
+      char buffer[64];
+      while (read(ce_pipe[0], buffer, sizeof(buffer)) > 0)
+        /* drain */;
+    }
+  }
+
+  return NULL;
+} /* }}} void *ce_thread_main */
+
+/* Must be called with ce_lock held. */
+static int ce_start(void) /* {{{ */
+{
+  if (ce_running)
+    return 0;
+
+  if (pipe(ce_pipe) != 0) {
+    int status = errno;
+    ERROR("curl engine: pipe failed: %s", STRERRNO);
+    return status;
+  }
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(ce_pipe); i++) {
+    int flags = fcntl(ce_pipe[i], F_GETFL);
+    fcntl(ce_pipe[i], F_SETFL, flags | O_NONBLOCK);
+  }
+
+  ce_multi = curl_multi_init();
+  if (ce_multi == NULL) {
+    ERROR("curl engine: curl_multi_init failed.");
+    close(ce_pipe[0]);
+    close(ce_pipe[1]);
+    ce_pipe[0] = ce_pipe[1] = -1;
+    return ENOMEM;
+  }
+#ifdef CURLPIPE_MULTIPLEX
+  curl_multi_setopt(ce_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+  ce_stop = false;
+  int status = plugin_thread_create(&ce_thread, /* attr = */ NULL,
+                                    ce_thread_main, /* arg = */ NULL,
+                                    "curl engine");
+  if (status != 0) {
+    ERROR("curl engine: plugin_thread_create failed: %s", STRERROR(status));
+    curl_multi_cleanup(ce_multi);
+    ce_multi = NULL;
+    close(ce_pipe[0]);
+    close(ce_pipe[1]);
+    ce_pipe[0] = ce_pipe[1] = -1;
+    return status;
+  }
+
+  ce_running = true;
+  return 0;
+} /* }}} int ce_start */
+
+int curl_engine_submit(curl_engine_request_t *req) /* {{{ */
+{
+  if ((req == NULL) || (req->curl == NULL) || (req->done == NULL))
+    return EINVAL;
+
+  pthread_mutex_lock(&ce_lock);
+  if (req->state != CE_STATE_IDLE) {
+    pthread_mutex_unlock(&ce_lock);
+    return EBUSY;
+  }
+
+  int status = ce_start();
+  if (status != 0) {
+    pthread_mutex_unlock(&ce_lock);
+    return status;
+  }
+
+  req->ctx = plugin_get_ctx();
+  req->cancel = false;
+  req->status = CURLE_OK;
+  req->state = CE_STATE_QUEUED;
+  req->next = NULL;
+  if (ce_queue_tail == NULL)
+    ce_queue_head = req;
+  else
+    ce_queue_tail->next = req;
+  ce_queue_tail = req;
+
+  ce_wakeup();
+  pthread_mutex_unlock(&ce_lock);
+  return 0;
+} /* }}} int curl_engine_submit */
+
+bool curl_engine_busy(curl_engine_request_t *req) /* {{{ */
+{
+  pthread_mutex_lock(&ce_lock);
+  bool busy = (req->state != CE_STATE_IDLE);
+  pthread_mutex_unlock(&ce_lock);
+  return busy;
+} /* }}} bool curl_engine_busy */
+
+void curl_engine_cancel(curl_engine_request_t *req) /* {{{ */
+{
+  if (req == NULL)
+    return;
+
+  pthread_mutex_lock(&ce_lock);
+  if (req->state == CE_STATE_QUEUED) {
+    curl_engine_request_t *prev = NULL;
+    for (curl_engine_request_t *ptr = ce_queue_head; ptr != NULL;
+         ptr = ptr->next) {
+      if (ptr != req) {
+        prev = ptr;
+        continue;
+      }
+      if (prev == NULL)
+        ce_queue_head = ptr->next;
+      else
+        prev->next = ptr->next;
+      if (ce_queue_tail == ptr)
+        ce_queue_tail = prev;
+      break;
+    }
+    req->next = NULL;
+    req->state = CE_STATE_IDLE;
+  } else if (req->state == CE_STATE_ACTIVE) {
+    req->cancel = true;
+    ce_wakeup();
+    while (req->state != CE_STATE_IDLE)
+      pthread_cond_wait(&ce_cond, &ce_lock);
+  }
+  pthread_mutex_unlock(&ce_lock);
+} /* }}} void curl_engine_cancel */
+
+void curl_engine_shutdown(void) /* {{{ */
+{
+  pthread_mutex_lock(&ce_lock);
+  if (!ce_running) {
+    pthread_mutex_unlock(&ce_lock);
+    return;
+  }
+  ce_stop = true;
+  ce_wakeup();
+  pthread_mutex_unlock(&ce_lock);
+
+  pthread_join(ce_thread, /* retval = */ NULL);
+
+  pthread_mutex_lock(&ce_lock);
+  for (curl_engine_request_t *ptr = ce_active; ptr != NULL; ptr = ptr->next) {
+    curl_multi_remove_handle(ce_multi, ptr->curl);
+    ptr->state = CE_STATE_IDLE;
+  }
+  for (curl_engine_request_t *ptr = ce_queue_head; ptr != NULL;
+       ptr = ptr->next)
+    ptr->state = CE_STATE_IDLE;
+  ce_active = ce_queue_head = ce_queue_tail = NULL;
+
+  curl_multi_cleanup(ce_multi);
+  ce_multi = NULL;
+  close(ce_pipe[0]);
+  close(ce_pipe[1]);
+  ce_pipe[0] = ce_pipe[1] = -1;
+  ce_running = false;
+  pthread_cond_broadcast(&ce_cond);
+  pthread_mutex_unlock(&ce_lock);
+} /* }}} void curl_engine_shutdown */
@@ -0,0 +1,90 @@
+/**
+ * collectd - src/utils_curl_engine.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_CURL_ENGINE_H
+#define UTILS_CURL_ENGINE_H 1
+
+#include "plugin.h"
+
+#include <curl/curl.h>
+
+/*
+ * The cURL engine runs transfers for all requests of one plugin on a single
+ * thread driving a cURL multi handle. Connections and DNS lookups are cached
+ * by the multi handle and shared between all requests, and HTTP/2 streams
+ * to the same server are multiplexed over one connection where possible.
+ *
+ * A request is usually embedded in the plugin's per-URL structure. The
+ * caller sets up "curl" (an easy handle with all options applied), "done"
+ * and "user_data", then hands it to curl_engine_submit(). Once the transfer
+ * has finished, "done" is called from the engine thread with the plugin
+ * context of the submitting thread restored. Until then, the easy handle
+ * belongs to the engine and must not be touched.
+ */
+struct curl_engine_request_s;
+typedef struct curl_engine_request_s curl_engine_request_t;
+
+typedef void (*curl_engine_done_cb)(curl_engine_request_t *req,
+                                    CURLcode status);
+
+struct curl_engine_request_s {
+  CURL *curl;
+  curl_engine_done_cb done;
+  void *user_data;
+
+  /* private */
+  plugin_ctx_t ctx;
+  int state;
+  CURLcode status;
+  bool cancel;
+  curl_engine_request_t *next;
+};
+
+/*
+ * curl_engine_submit queues a request. The engine thread is started on first
+ * use. Returns EBUSY if the request is still queued or being transferred,
+ * zero on success and an errno value otherwise.
+ */
+int curl_engine_submit(curl_engine_request_t *req);
+
+/*
+ * curl_engine_busy returns true if the request has been submitted and its
+ * "done" callback has not returned yet.
+ */
+bool curl_engine_busy(curl_engine_request_t *req);
+
+/*
+ * curl_engine_cancel aborts a pending request without calling its "done"
+ * callback. If the request is currently being transferred, it blocks until
+ * the engine has let go of the easy handle. Must not be called from a "done"
+ * callback.
+ */
+void curl_engine_cancel(curl_engine_request_t *req);
+
+/*
+ * curl_engine_shutdown stops the engine thread and releases the multi
+ * handle. All requests must have finished or been cancelled.
+ */
+void curl_engine_shutdown(void);
+
+#endif /* UTILS_CURL_ENGINE_H */
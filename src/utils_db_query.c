@@ -67,11 +67,17 @@ struct udb_result_preparation_area_s /* {{{ */
   size_t *instances_pos;
   size_t *values_pos;
   size_t *metadata_pos;
+  /* instances_buffer[0] holds the instance prefix, followed by one entry per
+   * `InstancesFrom' column. */
   char **instances_buffer;
   char **values_buffer;
   char **metadata_buffer;
   char *plugin_instance;
 
+  /* Value list filled in by `udb_result_prepare_result' with everything that
+   * doesn't change from row to row, and reused for every row. */
+  value_list_t vl;
+
   struct udb_result_preparation_area_s *next;
 }; /* }}} */
 typedef struct udb_result_preparation_area_s udb_result_preparation_area_t;
@@ -160,111 +166,61 @@ static int udb_result_submit(udb_result_t *r, /* {{{ */
                              udb_result_preparation_area_t *r_area,
                              udb_query_t const *q,
                              udb_query_preparation_area_t *q_area) {
-  value_list_t vl = VALUE_LIST_INIT;
+  value_list_t *vl = &r_area->vl;
 
   assert(r != NULL);
   assert(r_area->ds != NULL);
   assert(((size_t)r_area->ds->ds_num) == r->values_num);
   assert(r->values_num > 0);
-
-  vl.values = calloc(r->values_num, sizeof(*vl.values));
-  if (vl.values == NULL) {
-    P_ERROR("udb_result_submit: calloc failed.");
-    return -1;
-  }
-  vl.values_len = r_area->ds->ds_num;
+  assert(vl->values != NULL);
 
   for (size_t i = 0; i < r->values_num; i++) {
     char *value_str = r_area->values_buffer[i];
 
-    if (0 != parse_value(value_str, &vl.values[i], r_area->ds->ds[i].type)) {
+    if (0 != parse_value(value_str, &vl->values[i], r_area->ds->ds[i].type)) {
       P_ERROR("udb_result_submit: Parsing `%s' as %s failed.", value_str,
               DS_TYPE_TO_STRING(r_area->ds->ds[i].type));
       errno = EINVAL;
-      free(vl.values);
       return -1;
     }
   }
 
-  sstrncpy(vl.host, q_area->host, sizeof(vl.host));
-  sstrncpy(vl.plugin, q_area->plugin, sizeof(vl.plugin));
-  sstrncpy(vl.type, r->type, sizeof(vl.type));
-
   /* Set vl.plugin_instance */
-  if (q->plugin_instance_from != NULL) {
-    sstrncpy(vl.plugin_instance, r_area->plugin_instance,
-             sizeof(vl.plugin_instance));
-  } else {
-    sstrncpy(vl.plugin_instance, q_area->db_name, sizeof(vl.plugin_instance));
-  }
-
-  /* Set vl.type_instance {{{ */
-  if (r->instances_num == 0) {
-    if (r->instance_prefix == NULL)
-      vl.type_instance[0] = 0;
-    else
-      sstrncpy(vl.type_instance, r->instance_prefix, sizeof(vl.type_instance));
-  } else /* if ((r->instances_num > 0) */
-  {
-    if (r->instance_prefix == NULL) {
-      int status = strjoin(vl.type_instance, sizeof(vl.type_instance),
-                           r_area->instances_buffer, r->instances_num, "-");
-      if (status < 0) {
-        P_ERROR(
-            "udb_result_submit: creating type_instance failed with status %d.",
-            status);
-        return status;
-      }
-    } else {
-      char tmp[DATA_MAX_NAME_LEN];
-
-      int status = strjoin(tmp, sizeof(tmp), r_area->instances_buffer,
-                           r->instances_num, "-");
-      if (status < 0) {
-        P_ERROR(
-            "udb_result_submit: creating type_instance failed with status %d.",
-            status);
-        return status;
-      }
-      tmp[sizeof(tmp) - 1] = 0;
+  if (q->plugin_instance_from != NULL)
+    sstrncpy(vl->plugin_instance, r_area->plugin_instance,
+             sizeof(vl->plugin_instance));
 
-      snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-%s",
-               r->instance_prefix, tmp);
+  /* Set vl.type_instance. Without `InstancesFrom' it has been set by
+   * `udb_result_prepare_result'. {{{ */
+  if (r->instances_num > 0) {
+    /* Include the prefix in instances_buffer[0] if there is one. */
+    size_t skip = (r->instance_prefix == NULL) ? 1 : 0;
+
+    int status = strjoin(vl->type_instance, sizeof(vl->type_instance),
+                         r_area->instances_buffer + skip,
+                         r->instances_num + 1 - skip, "-");
+    if (status < 0) {
+      P_ERROR("udb_result_submit: creating type_instance failed with status %d.",
+              status);
+      return status;
     }
   }
-  vl.type_instance[sizeof(vl.type_instance) - 1] = 0;
   /* }}} */
 
-  /* Annotate meta data. {{{ */
-  if (r->metadata_num > 0) {
-    vl.meta = meta_data_create();
-    if (vl.meta == NULL) {
-      P_ERROR("udb_result_submit: meta_data_create failed.");
-      free(vl.values);
-      return -ENOMEM;
-    }
-
-    for (size_t i = 0; i < r->metadata_num; i++) {
-      int status = meta_data_add_string(vl.meta, r->metadata[i],
-                                        r_area->metadata_buffer[i]);
-      if (status != 0) {
-        P_ERROR("udb_result_submit: meta_data_add_string failed.");
-        meta_data_destroy(vl.meta);
-        vl.meta = NULL;
-        free(vl.values);
-        return status;
-      }
+  /* Annotate meta data. Existing entries are replaced. {{{ */
+  for (size_t i = 0; i < r->metadata_num; i++) {
+    int status = meta_data_add_string(vl->meta, r->metadata[i],
+                                      r_area->metadata_buffer[i]);
+    if (status != 0) {
+      P_ERROR("udb_result_submit: meta_data_add_string failed.");
+      return status;
     }
   }
   /* }}} */
 
-  plugin_dispatch_values(&vl);
+  /* The data set has been looked up when preparing the result. */
+  plugin_dispatch_values_ds(r_area->ds, vl);
 
-  if (r->metadata_num > 0) {
-    meta_data_destroy(vl.meta);
-    vl.meta = NULL;
-  }
-  sfree(vl.values);
   return 0;
 } /* }}} void udb_result_submit */
 
@@ -280,6 +236,10 @@ static void udb_result_finish_result(udb_result_t const *r, /* {{{ */
   sfree(prep_area->instances_buffer);
   sfree(prep_area->values_buffer);
   sfree(prep_area->metadata_buffer);
+
+  sfree(prep_area->vl.values);
+  meta_data_destroy(prep_area->vl.meta);
+  prep_area->vl.meta = NULL;
 } /* }}} void udb_result_finish_result */
 
 static int udb_result_handle_result(udb_result_t *r, /* {{{ */
@@ -290,7 +250,7 @@ static int udb_result_handle_result(udb_result_t *r, /* {{{ */
   assert(r && q_area && r_area);
 
   for (size_t i = 0; i < r->instances_num; i++)
-    r_area->instances_buffer[i] = column_values[r_area->instances_pos[i]];
+    r_area->instances_buffer[i + 1] = column_values[r_area->instances_pos[i]];
 
   for (size_t i = 0; i < r->values_num; i++)
     r_area->values_buffer[i] = column_values[r_area->values_pos[i]];
@@ -306,6 +266,8 @@ static int udb_result_handle_result(udb_result_t *r, /* {{{ */
 
 static int udb_result_prepare_result(udb_result_t const *r, /* {{{ */
                                      udb_result_preparation_area_t *prep_area,
+                                     udb_query_t const *q,
+                                     udb_query_preparation_area_t *q_area,
                                      char **column_names, size_t column_num) {
   if ((r == NULL) || (prep_area == NULL))
     return -EINVAL;
@@ -318,6 +280,8 @@ static int udb_result_prepare_result(udb_result_t const *r, /* {{{ */
   assert(prep_area->instances_buffer == NULL);
   assert(prep_area->values_buffer == NULL);
   assert(prep_area->metadata_buffer == NULL);
+  assert(prep_area->vl.values == NULL);
+  assert(prep_area->vl.meta == NULL);
 #endif
 
 #define BAIL_OUT(status)                                                       \
@@ -354,11 +318,12 @@ static int udb_result_prepare_result(udb_result_t const *r, /* {{{ */
     }
 
     prep_area->instances_buffer =
-        (char **)calloc(r->instances_num, sizeof(char *));
+        (char **)calloc(r->instances_num + 1, sizeof(char *));
     if (prep_area->instances_buffer == NULL) {
       P_ERROR("udb_result_prepare_result: calloc failed.");
       BAIL_OUT(-ENOMEM);
     }
+    prep_area->instances_buffer[0] = r->instance_prefix;
   } /* if (r->instances_num > 0) */
 
   prep_area->values_pos = (size_t *)calloc(r->values_num, sizeof(size_t));
@@ -387,6 +352,35 @@ static int udb_result_prepare_result(udb_result_t const *r, /* {{{ */
 
   /* }}} */
 
+  /* Fill in the parts of the value list that are the same for all rows. {{{ */
+  prep_area->vl = (value_list_t)VALUE_LIST_INIT;
+
+  prep_area->vl.values = calloc(r->values_num, sizeof(*prep_area->vl.values));
+  if (prep_area->vl.values == NULL) {
+    P_ERROR("udb_result_prepare_result: calloc failed.");
+    BAIL_OUT(-ENOMEM);
+  }
+  prep_area->vl.values_len = r->values_num;
+
+  if (r->metadata_num > 0) {
+    prep_area->vl.meta = meta_data_create();
+    if (prep_area->vl.meta == NULL) {
+      P_ERROR("udb_result_prepare_result: meta_data_create failed.");
+      BAIL_OUT(-ENOMEM);
+    }
+  }
+
+  sstrncpy(prep_area->vl.host, q_area->host, sizeof(prep_area->vl.host));
+  sstrncpy(prep_area->vl.plugin, q_area->plugin, sizeof(prep_area->vl.plugin));
+  sstrncpy(prep_area->vl.type, r->type, sizeof(prep_area->vl.type));
+  if (q->plugin_instance_from == NULL)
+    sstrncpy(prep_area->vl.plugin_instance, q_area->db_name,
+             sizeof(prep_area->vl.plugin_instance));
+  if ((r->instances_num == 0) && (r->instance_prefix != NULL))
+    sstrncpy(prep_area->vl.type_instance, r->instance_prefix,
+             sizeof(prep_area->vl.type_instance));
+  /* }}} */
+
   /* Determine the position of the plugin instance column {{{ */
   for (size_t i = 0; i < r->instances_num; i++) {
     size_t j;
@@ -886,6 +880,33 @@ int udb_query_handle_result(udb_query_t const *q, /* {{{ */
   return 0;
 } /* }}} int udb_query_handle_result */
 
+int udb_query_handle_results(udb_query_t const *q, /* {{{ */
+                             udb_query_preparation_area_t *prep_area,
+                             char **column_values, size_t rows_num) {
+  size_t failed = 0;
+
+  if ((q == NULL) || (prep_area == NULL))
+    return -EINVAL;
+
+  for (size_t i = 0; i < rows_num; i++) {
+    int status = udb_query_handle_result(
+        q, prep_area, column_values + i * prep_area->column_num);
+    if (status == -EINVAL)
+      return status;
+    if (status != 0)
+      failed++;
+  }
+
+  if (failed > 0) {
+    P_ERROR("udb_query_handle_results (%s, %s): "
+            "Handling %" PRIsz " of %" PRIsz " rows failed.",
+            prep_area->db_name, q->name, failed, rows_num);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int udb_query_handle_results */
+
 int udb_query_prepare_result(udb_query_t const *q, /* {{{ */
                              udb_query_preparation_area_t *prep_area,
                              const char *host, const char *plugin,
@@ -958,7 +979,8 @@ int udb_query_prepare_result(udb_query_t const *q, /* {{{ */
       return -EINVAL;
     }
 
-    status = udb_result_prepare_result(r, r_area, column_names, column_num);
+    status = udb_result_prepare_result(r, r_area, q, prep_area, column_names,
+                                       column_num);
     if (status != 0) {
       udb_query_finish_result(q, prep_area);
       return status;
@@ -1020,8 +1042,12 @@ void udb_query_delete_preparation_area(
 
     sfree(area->instances_pos);
     sfree(area->values_pos);
+    sfree(area->metadata_pos);
     sfree(area->instances_buffer);
     sfree(area->values_buffer);
+    sfree(area->metadata_buffer);
+    sfree(area->vl.values);
+    meta_data_destroy(area->vl.meta);
     free(area);
   }
 
@@ -75,6 +75,19 @@ int udb_query_prepare_result(udb_query_t const *q,
 int udb_query_handle_result(udb_query_t const *q,
                             udb_query_preparation_area_t *prep_area,
                             char **column_values);
+
+/*
+ * udb_query_handle_results
+ *
+ * Like `udb_query_handle_result', but for `rows_num' rows at once.
+ * `column_values' holds the values of all rows one after the other, i.e. the
+ * value of column `c' in row `r' is `column_values[r * column_num + c]'.
+ *
+ * Returns zero if all rows have been handled and non-zero otherwise.
+ */
+int udb_query_handle_results(udb_query_t const *q,
+                             udb_query_preparation_area_t *prep_area,
+                             char **column_values, size_t rows_num);
 void udb_query_finish_result(udb_query_t const *q,
                              udb_query_preparation_area_t *prep_area);
 
@@ -82,6 +82,9 @@ void ignore_list_add_name(const char *name);
 #if HAVE_PCAP_H
 void handle_pcap(u_char *udata, const struct pcap_pkthdr *hdr,
                  const u_char *pkt);
+/* Parses a packet starting at its IPv4 or IPv6 header, as delivered by
+ * SOCK_DGRAM packet sockets. Returns non-zero if it was a DNS message. */
+int handle_ip_packet(const u_char *pkt, int len);
 #endif
 
 const char *qtype_str(int t);
@@ -74,6 +74,9 @@ struct dpdk_helper_ctx_s {
   sem_t sema_cmd_start;
   sem_t sema_cmd_complete;
   cdtime_t cmd_wait_time;
+  /* if non-zero, the helper calls the command handler with DPDK_CMD_REFRESH
+   * this often while no command arrives */
+  cdtime_t refresh_interval;
 
   pid_t pid;
   int pipes[2];
@@ -261,6 +264,16 @@ static void dpdk_shm_cleanup(const char *name, size_t size, void *map) {
   }
 }
 
+int dpdk_helper_refresh_set(dpdk_helper_ctx_t *phc, cdtime_t interval) {
+  if (phc == NULL) {
+    ERROR("Invalid argument(phc)");
+    return -EINVAL;
+  }
+
+  phc->refresh_interval = interval;
+  return 0;
+}
+
 void *dpdk_helper_priv_get(dpdk_helper_ctx_t *phc) {
   if (phc)
     return phc->priv_data;
@@ -532,6 +545,10 @@ static int dpdk_helper_cmd_wait(dpdk_helper_ctx_t *phc, pid_t ppid) {
   struct timespec ts;
   cdtime_t now = cdtime();
   cdtime_t cmd_wait_time = MS_TO_CDTIME_T(1500) + phc->cmd_wait_time * 2;
+  bool refresh = (phc->refresh_interval > 0) &&
+                 (phc->status == DPDK_HELPER_ALIVE_SENDING_EVENTS);
+  if (refresh)
+    cmd_wait_time = phc->refresh_interval;
   ts = CDTIME_T_TO_TIMESPEC(now + cmd_wait_time);
 
   int ret = sem_timedwait(&phc->sema_cmd_start, &ts);
@@ -544,7 +561,13 @@ static int dpdk_helper_cmd_wait(dpdk_helper_ctx_t *phc, pid_t ppid) {
                    __LINE__, (long)getpid());
     exit(0);
   } else if (ret == -1 && errno == ETIMEDOUT) {
-    if (phc->status == DPDK_HELPER_ALIVE_SENDING_EVENTS) {
+    /* When refreshing, a timeout is the normal case; a dead collectd is
+     * caught by the parent PID check below. */
+    if (refresh) {
+      if (ppid == getppid() && phc->eal_initialized &&
+          rte_eal_primary_proc_alive(phc->eal_config.file_prefix))
+        return 1;
+    } else if (phc->status == DPDK_HELPER_ALIVE_SENDING_EVENTS) {
       DPDK_CHILD_LOG("%s:dpdk_helper_cmd_wait: sem timedwait()"
                      " timeout, did collectd terminate?\n",
                      phc->shm_name);
@@ -602,7 +625,12 @@ static int dpdk_helper_worker(dpdk_helper_ctx_t *phc) {
   pid_t ppid = getppid();
 
   while (1) {
-    if (dpdk_helper_cmd_wait(phc, ppid) == 0) {
+    int wait_status = dpdk_helper_cmd_wait(phc, ppid);
+    if (wait_status > 0) {
+      /* periodic refresh: nobody is waiting for a result */
+      dpdk_helper_command_handler(phc, DPDK_CMD_REFRESH);
+      continue;
+    } else if (wait_status == 0) {
       DPDK_CHILD_LOG("%s:%s:%d DPDK command handle (cmd=%d, pid=%lu)\n",
                      phc->shm_name, __FUNCTION__, __LINE__, phc->cmd,
                      (long)getpid());
@@ -716,6 +744,28 @@ static void dpdk_helper_check_pipe(dpdk_helper_ctx_t *phc) {
   }
 }
 
+/*
+ * Checks that the helper is alive without sending it a command, restarting it
+ * if needed, and forwards its log output. Returns a negative value if the
+ * helper is not ready for commands (same as dpdk_helper_command()), 1 if it
+ * is not attached to the DPDK primary process yet and 0 if it is.
+ */
+int dpdk_helper_poll(dpdk_helper_ctx_t *phc) {
+  if (phc == NULL) {
+    ERROR("Invalid argument(phc)");
+    return -EINVAL;
+  }
+
+  int ret = dpdk_helper_status_check(phc);
+
+  dpdk_helper_check_pipe(phc);
+
+  if (ret != 0)
+    return ret;
+
+  return (phc->status == DPDK_HELPER_ALIVE_SENDING_EVENTS) ? 0 : 1;
+}
+
 int dpdk_helper_command(dpdk_helper_ctx_t *phc, enum DPDK_CMD cmd, int *result,
                         cdtime_t cmd_wait_time) {
   if (phc == NULL) {
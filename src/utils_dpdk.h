@@ -43,6 +43,9 @@ enum DPDK_CMD {
   DPDK_CMD_INIT,
   DPDK_CMD_GET_STATS,
   DPDK_CMD_GET_EVENTS,
+  /* not sent by collectd: periodic tick of the helper, see
+   * dpdk_helper_refresh_set() */
+  DPDK_CMD_REFRESH,
   __DPDK_CMD_LAST,
 };
 
@@ -72,6 +75,8 @@ int dpdk_helper_eal_config_set(dpdk_helper_ctx_t *phc, dpdk_eal_config_t *ec);
 int dpdk_helper_eal_config_get(dpdk_helper_ctx_t *phc, dpdk_eal_config_t *ec);
 int dpdk_helper_command(dpdk_helper_ctx_t *phc, enum DPDK_CMD cmd, int *result,
                         cdtime_t cmd_wait_time);
+int dpdk_helper_refresh_set(dpdk_helper_ctx_t *phc, cdtime_t interval);
+int dpdk_helper_poll(dpdk_helper_ctx_t *phc);
 void *dpdk_helper_priv_get(dpdk_helper_ctx_t *phc);
 int dpdk_helper_data_size_get(dpdk_helper_ctx_t *phc);
 uint8_t dpdk_helper_eth_dev_count(void);
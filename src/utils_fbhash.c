@@ -26,94 +26,158 @@
 
 #include "collectd.h"
 
+#include "common.h"
 #include "plugin.h"
 
-#include "utils_avltree.h"
+#include "utils_atomic.h"
 #include "utils_fbhash.h"
 
+#include <sys/mman.h>
+
+/* The contents of the file are kept in an immutable snapshot: an open
+ * addressing hash table followed by the keys and values, in a single
+ * anonymous mapping which is made read-only once it has been filled in. When
+ * the file changes, a new snapshot is built and swapped in atomically, so
+ * lookups never take a lock. */
+struct fbh_slot_s {
+  uint32_t hash;
+  const char *key; /* NULL if the slot is empty */
+  const char *value;
+};
+typedef struct fbh_slot_s fbh_slot_t;
+
+struct fbh_snapshot_s {
+  size_t map_size;
+  uint64_t generation;
+  size_t mask;
+  fbh_slot_t slots[];
+};
+typedef struct fbh_snapshot_s fbh_snapshot_t;
+
+/* The snapshots themselves are read-only, so replaced ones are tracked in a
+ * list of their own. */
+struct fbh_retired_s {
+  fbh_snapshot_t *snapshot;
+  struct fbh_retired_s *next;
+};
+typedef struct fbh_retired_s fbh_retired_t;
+
 struct fbhash_s {
   char *filename;
   time_t mtime;
+  /* The file's modification time has a resolution of one second, so it is
+   * checked at most once per second. */
+  time_t checked;
+  uint64_t generation;
 
+  /* Serializes reloads; never taken by lookups. */
   pthread_mutex_t lock;
-  c_avl_tree_t *tree;
+  fbh_snapshot_t *snapshot;
+  /* Snapshots which have been replaced but may still be in use. They are
+   * unmapped once no lookup is in progress. */
+  fbh_retired_t *retired;
+  /* Number of lookups in progress. */
+  uint64_t readers;
 };
 
 /*
  * Private functions
  */
-static void fbh_free_tree(c_avl_tree_t *tree) /* {{{ */
+static uint32_t fbh_hash(const char *key) /* {{{ */
 {
-  int status;
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)key; *p != 0; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+  return hash;
+} /* }}} uint32_t fbh_hash */
 
-  if (tree == NULL)
+static void fbh_snapshot_free(fbh_snapshot_t *snap) /* {{{ */
+{
+  if (snap == NULL)
     return;
+  munmap(snap, snap->map_size);
+} /* }}} void fbh_snapshot_free */
 
-  while (42) {
-    char *key = NULL;
-    char *value = NULL;
-
-    status = c_avl_pick(tree, (void *)&key, (void *)&value);
-    if (status != 0)
-      break;
-
-    free(key);
-    free(value);
+static void fbh_retired_free(fbh_retired_t *r) /* {{{ */
+{
+  while (r != NULL) {
+    fbh_retired_t *next = r->next;
+    fbh_snapshot_free(r->snapshot);
+    free(r);
+    r = next;
   }
+} /* }}} void fbh_retired_free */
 
-  c_avl_destroy(tree);
-} /* }}} void fbh_free_tree */
-
-static int fbh_read_file(fbhash_t *h) /* {{{ */
+static const fbh_slot_t *fbh_snapshot_lookup(fbh_snapshot_t const *snap,
+                                             const char *key) /* {{{ */
 {
-  FILE *fh;
-  char buffer[4096];
-  struct flock fl = {0};
-  c_avl_tree_t *tree;
-  int status;
-
-  fh = fopen(h->filename, "r");
-  if (fh == NULL)
-    return -1;
-
-  fl.l_type = F_RDLCK;
-  fl.l_whence = SEEK_SET;
-  /* TODO: Lock file? -> fcntl */
-
-  status = fcntl(fileno(fh), F_SETLK, &fl);
-  if (status != 0) {
-    fclose(fh);
-    return -1;
+  uint32_t hash = fbh_hash(key);
+
+  for (size_t i = hash & snap->mask;; i = (i + 1) & snap->mask) {
+    const fbh_slot_t *slot = snap->slots + i;
+    if (slot->key == NULL)
+      return NULL;
+    if ((slot->hash == hash) && (strcmp(slot->key, key) == 0))
+      return slot;
   }
+} /* }}} const fbh_slot_t *fbh_snapshot_lookup */
 
-  tree = c_avl_create((int (*)(const void *, const void *))strcmp);
-  if (tree == NULL) {
-    fclose(fh);
-    return -1;
-  }
+/* Reads the whole file into a newly allocated, null-terminated buffer. */
+static char *fbh_read_contents(FILE *fh, size_t *ret_size) /* {{{ */
+{
+  struct stat statbuf = {0};
+  if (fstat(fileno(fh), &statbuf) != 0)
+    return NULL;
 
-  /* Read `fh' into `tree' */
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) /* {{{ */
-  {
-    size_t len;
-    char *key;
-    char *value;
+  /* The file may grow while it's being read; anything beyond its size at
+   * the time of the fstat() is left for the next reload. */
+  size_t size = (size_t)statbuf.st_size;
+  char *buffer = malloc(size + 1);
+  if (buffer == NULL)
+    return NULL;
 
-    char *key_copy;
-    char *value_copy;
+  size_t len = fread(buffer, 1, size, fh);
+  if (ferror(fh)) {
+    free(buffer);
+    return NULL;
+  }
+  buffer[len] = 0;
+
+  *ret_size = len;
+  return buffer;
+} /* }}} char *fbh_read_contents */
+
+/* Splits "buffer" into "key: value" lines in place: the keys and values are
+ * null-terminated and pointers to them are stored in "*ret_keys" and
+ * "*ret_values". Returns the number of entries or -1 on error. */
+static ssize_t fbh_parse(char *buffer, size_t size, char ***ret_keys, /* {{{ */
+                         char ***ret_values, size_t *ret_strings_size) {
+  char **keys = NULL;
+  char **values = NULL;
+  size_t num = 0;
+  size_t size_alloc = 0;
+  size_t strings_size = 0;
+  char *end = buffer + size;
+
+  for (char *line = buffer; line < end;) {
+    char *eol = memchr(line, '\n', (size_t)(end - line));
+    if (eol == NULL)
+      eol = end;
 
-    buffer[sizeof(buffer) - 1] = 0;
-    len = strlen(buffer);
+    /* Seek first non-space character */
+    char *key = line;
+    line = (eol < end) ? eol + 1 : end;
 
     /* Remove trailing newline characters. */
-    while ((len > 0) &&
-           ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r'))) {
-      len--;
-      buffer[len] = 0;
+    *eol = 0;
+    while ((eol > key) && (eol[-1] == '\r')) {
+      eol--;
+      *eol = 0;
     }
 
-    /* Seek first non-space character */
-    key = buffer;
     while ((*key != 0) && isspace((int)*key))
       key++;
 
@@ -122,7 +186,7 @@ static int fbh_read_file(fbhash_t *h) /* {{{ */
       continue;
 
     /* Seek first colon */
-    value = strchr(key, ':');
+    char *value = strchr(key, ':');
     if (value == NULL)
       continue;
 
@@ -138,38 +202,172 @@ static int fbh_read_file(fbhash_t *h) /* {{{ */
     if (value[0] == 0)
       continue;
 
-    key_copy = strdup(key);
-    value_copy = strdup(value);
-
-    if ((key_copy == NULL) || (value_copy == NULL)) {
-      free(key_copy);
-      free(value_copy);
-      continue;
+    if (num == size_alloc) {
+      size_t new_size = (size_alloc == 0) ? 16 : 2 * size_alloc;
+      char **tmp = realloc(keys, new_size * sizeof(*keys));
+      if (tmp != NULL) {
+        keys = tmp;
+        tmp = realloc(values, new_size * sizeof(*values));
+      }
+      if (tmp == NULL) {
+        free(keys);
+        free(values);
+        return -1;
+      }
+      values = tmp;
+      size_alloc = new_size;
     }
 
-    status = c_avl_insert(tree, key_copy, value_copy);
-    if (status != 0) {
-      free(key_copy);
-      free(value_copy);
-      continue;
+    keys[num] = key;
+    values[num] = value;
+    strings_size += strlen(key) + strlen(value) + 2;
+    num++;
+  }
+
+  *ret_keys = keys;
+  *ret_values = values;
+  *ret_strings_size = strings_size;
+  return (ssize_t)num;
+} /* }}} ssize_t fbh_parse */
+
+static fbh_snapshot_t *fbh_snapshot_create(char *buffer, /* {{{ */
+                                           size_t size) {
+  char **keys = NULL;
+  char **values = NULL;
+  size_t strings_size = 0;
+  ssize_t status = fbh_parse(buffer, size, &keys, &values, &strings_size);
+  if (status < 0)
+    return NULL;
+  size_t num = (size_t)status;
+
+  /* Keep the table at most half full, so that probe sequences stay short. */
+  size_t slots_num = 4;
+  while (slots_num < 2 * num)
+    slots_num *= 2;
+
+  size_t map_size = sizeof(fbh_snapshot_t) + slots_num * sizeof(fbh_slot_t) +
+                    strings_size;
+  fbh_snapshot_t *snap = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (snap == MAP_FAILED) {
+    ERROR("utils_fbhash: mmap(%" PRIsz ") failed: %s", map_size, STRERRNO);
+    free(keys);
+    free(values);
+    return NULL;
+  }
+  snap->map_size = map_size;
+  snap->mask = slots_num - 1;
+
+  char *strings = (char *)(snap->slots + slots_num);
+  for (size_t i = 0; i < num; i++) {
+    uint32_t hash = fbh_hash(keys[i]);
+    fbh_slot_t *slot = snap->slots + (hash & snap->mask);
+    bool duplicate = false;
+
+    while (slot->key != NULL) {
+      if ((slot->hash == hash) && (strcmp(slot->key, keys[i]) == 0)) {
+        duplicate = true;
+        break;
+      }
+      slot = snap->slots + (((size_t)(slot - snap->slots) + 1) & snap->mask);
     }
+    /* The first occurrence of a key wins. */
+    if (duplicate)
+      continue;
 
-    DEBUG("utils_fbhash: fbh_read_file: key = %s; value = %s;", key, value);
-  } /* }}} while (fgets) */
+    size_t key_len = strlen(keys[i]) + 1;
+    size_t value_len = strlen(values[i]) + 1;
+    memcpy(strings, keys[i], key_len);
+    slot->key = strings;
+    strings += key_len;
+    memcpy(strings, values[i], value_len);
+    slot->value = strings;
+    strings += value_len;
+    slot->hash = hash;
+
+    DEBUG("utils_fbhash: fbh_snapshot_create: key = %s; value = %s;", keys[i],
+          values[i]);
+  }
+
+  free(keys);
+  free(values);
+  return snap;
+} /* }}} fbh_snapshot_t *fbh_snapshot_create */
 
+/* Unmaps the retired snapshots if no lookup is in progress. Any lookup
+ * starting later sees the current snapshot. Must be called with `h->lock'
+ * held. */
+static void fbh_reclaim(fbhash_t *h) /* {{{ */
+{
+  if ((h->retired == NULL) || (C_ATOMIC_LOAD(&h->readers) != 0))
+    return;
+
+  fbh_retired_free(h->retired);
+  h->retired = NULL;
+} /* }}} void fbh_reclaim */
+
+static int fbh_read_file(fbhash_t *h) /* {{{ */
+{
+  FILE *fh;
+  struct flock fl = {0};
+  int status;
+
+  fh = fopen(h->filename, "r");
+  if (fh == NULL)
+    return -1;
+
+  fl.l_type = F_RDLCK;
+  fl.l_whence = SEEK_SET;
+  /* TODO: Lock file? -> fcntl */
+
+  status = fcntl(fileno(fh), F_SETLK, &fl);
+  if (status != 0) {
+    fclose(fh);
+    return -1;
+  }
+
+  size_t size = 0;
+  char *buffer = fbh_read_contents(fh, &size);
   fclose(fh);
+  if (buffer == NULL)
+    return -1;
+
+  fbh_snapshot_t *snap = fbh_snapshot_create(buffer, size);
+  free(buffer);
+  if (snap == NULL)
+    return -1;
 
-  fbh_free_tree(h->tree);
-  h->tree = tree;
+  fbh_retired_t *retired = NULL;
+  if (h->snapshot != NULL) {
+    retired = calloc(1, sizeof(*retired));
+    if (retired == NULL) {
+      fbh_snapshot_free(snap);
+      return -1;
+    }
+    retired->snapshot = h->snapshot;
+  }
+
+  snap->generation = ++h->generation;
+  mprotect(snap, snap->map_size, PROT_READ);
+  C_ATOMIC_STORE_REL(&h->snapshot, snap);
+
+  if (retired != NULL) {
+    retired->next = h->retired;
+    h->retired = retired;
+  }
+  fbh_reclaim(h);
 
   return 0;
 } /* }}} int fbh_read_file */
 
+/* Must be called with `h->lock' held. */
 static int fbh_check_file(fbhash_t *h) /* {{{ */
 {
   struct stat statbuf = {0};
   int status;
 
+  fbh_reclaim(h);
+
   status = stat(h->filename, &statbuf);
   if (status != 0)
     return -1;
@@ -184,6 +382,23 @@ static int fbh_check_file(fbhash_t *h) /* {{{ */
   return status;
 } /* }}} int fbh_check_file */
 
+/* Re-reads the file if it may have changed. Only one thread checks the file
+ * at a time; the others keep using the current snapshot in the meantime.
+ * Must not be called with a lookup in progress, or the retired snapshots
+ * could never be reclaimed. */
+static void fbh_maybe_check_file(fbhash_t *h) /* {{{ */
+{
+  time_t now = time(NULL);
+  time_t checked = C_ATOMIC_LOAD(&h->checked);
+
+  if ((checked == now) || !C_ATOMIC_CAS(&h->checked, checked, now))
+    return;
+
+  pthread_mutex_lock(&h->lock);
+  fbh_check_file(h);
+  pthread_mutex_unlock(&h->lock);
+} /* }}} void fbh_maybe_check_file */
+
 /*
  * Public functions
  */
@@ -206,9 +421,12 @@ fbhash_t *fbh_create(const char *file) /* {{{ */
   }
 
   h->mtime = 0;
+  h->checked = time(NULL);
   pthread_mutex_init(&h->lock, /* attr = */ NULL);
 
   status = fbh_check_file(h);
+  if ((status == 0) && (h->snapshot == NULL))
+    status = -1;
   if (status != 0) {
     fbh_destroy(h);
     free(h);
@@ -225,33 +443,48 @@ void fbh_destroy(fbhash_t *h) /* {{{ */
 
   pthread_mutex_destroy(&h->lock);
   free(h->filename);
-  fbh_free_tree(h->tree);
+  fbh_snapshot_free(h->snapshot);
+  h->snapshot = NULL;
+  fbh_retired_free(h->retired);
+  h->retired = NULL;
 } /* }}} void fbh_destroy */
 
 char *fbh_get(fbhash_t *h, const char *key) /* {{{ */
 {
-  char *value;
-  char *value_copy;
-  int status;
+  char *value_copy = NULL;
 
   if ((h == NULL) || (key == NULL))
     return NULL;
 
-  value = NULL;
-  value_copy = NULL;
+  fbh_maybe_check_file(h);
 
-  pthread_mutex_lock(&h->lock);
+  /* Announce the lookup before loading the snapshot, so that a concurrent
+   * reload does not unmap it under our feet. */
+  C_ATOMIC_ADD(&h->readers, 1);
 
-  /* TODO: Checking this every time may be a bit much..? */
-  fbh_check_file(h);
-
-  status = c_avl_get(h->tree, key, (void *)&value);
-  if (status == 0) {
-    assert(value != NULL);
-    value_copy = strdup(value);
+  fbh_snapshot_t *snap = C_ATOMIC_LOAD_ACQ(&h->snapshot);
+  if (snap != NULL) {
+    const fbh_slot_t *slot = fbh_snapshot_lookup(snap, key);
+    if (slot != NULL)
+      value_copy = strdup(slot->value);
   }
 
-  pthread_mutex_unlock(&h->lock);
+  C_ATOMIC_SUB(&h->readers, 1);
 
   return value_copy;
 } /* }}} char *fbh_get */
+
+uint64_t fbh_generation(fbhash_t *h) /* {{{ */
+{
+  if (h == NULL)
+    return 0;
+
+  fbh_maybe_check_file(h);
+
+  C_ATOMIC_ADD(&h->readers, 1);
+  fbh_snapshot_t *snap = C_ATOMIC_LOAD_ACQ(&h->snapshot);
+  uint64_t generation = (snap != NULL) ? snap->generation : 0;
+  C_ATOMIC_SUB(&h->readers, 1);
+
+  return generation;
+} /* }}} uint64_t fbh_generation */
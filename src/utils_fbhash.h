@@ -35,6 +35,9 @@
  * into a hash, which can then be queried. The file is given to `fbh_create',
  * the hash is queried using `fbh_get'. If the file is changed during runtime,
  * it will automatically be re-read.
+ *
+ * Lookups do not take a lock: they use an immutable snapshot of the file,
+ * which is replaced atomically when the file is re-read.
  */
 
 struct fbhash_s;
@@ -47,4 +50,8 @@ void fbh_destroy(fbhash_t *h);
  * responsibility to free this memory. */
 char *fbh_get(fbhash_t *h, const char *key);
 
+/* Returns a number which changes whenever the file is re-read, so that users
+ * can tell whether values they derived from it are still valid. */
+uint64_t fbh_generation(fbhash_t *h);
+
 #endif /* UTILS_FBHASH_H */
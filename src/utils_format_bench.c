@@ -0,0 +1,159 @@
+/**
+ * collectd - src/utils_format_bench.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Benchmarks for the output formats used by the write plugins. Rates are not
+ * computed, because that requires the value cache.
+ */
+
+#include "collectd.h"
+
+#include "benchmark.h"
+#include "common.h"
+#include "utils_format_graphite.h"
+#include "utils_format_json.h"
+
+static data_set_t ds_octets = {
+    .type = "if_octets",
+    .ds_num = 2,
+    .ds =
+        (data_source_t[]){
+            {"rx", DS_TYPE_DERIVE, 0, NAN}, {"tx", DS_TYPE_DERIVE, 0, NAN},
+        },
+};
+
+static value_list_t bench_vl(void) {
+  static value_t values[] = {{.derive = 1234567}, {.derive = 7654321}};
+
+  value_list_t vl = {
+      .values = values,
+      .values_len = STATIC_ARRAY_SIZE(values),
+      .time = TIME_T_TO_CDTIME_T(1480063672),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "host.example.com",
+      .plugin = "interface",
+      .plugin_instance = "eth0",
+      .type = "if_octets",
+  };
+  return vl;
+}
+
+/* One value list per message, as write_kafka and amqp format them. */
+DEF_BENCH(format_json_value_list) {
+  value_list_t vl = bench_vl();
+  char buffer[4096];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    size_t fill = 0;
+    size_t free = sizeof(buffer);
+
+    format_json_initialize(buffer, &fill, &free);
+    format_json_value_list(buffer, &fill, &free, &ds_octets, &vl,
+                           /* store rates = */ 0);
+    format_json_finalize(buffer, &fill, &free);
+    BENCH_SINK(fill);
+  }
+}
+
+/* Value lists batched into a send buffer, as write_http does it: the buffer is
+ * started anew whenever it is full. */
+DEF_BENCH(format_json_batch) {
+  value_list_t vl = bench_vl();
+  char buffer[4096];
+  size_t fill = 0;
+  size_t free = sizeof(buffer);
+
+  format_json_initialize(buffer, &fill, &free);
+  for (uint64_t i = 0; i < iterations; i++) {
+    if (format_json_value_list(buffer, &fill, &free, &ds_octets, &vl,
+                               /* store rates = */ 0) == -ENOMEM) {
+      format_json_finalize(buffer, &fill, &free);
+      BENCH_SINK(fill);
+      format_json_initialize(buffer, &fill, &free);
+      format_json_value_list(buffer, &fill, &free, &ds_octets, &vl,
+                             /* store rates = */ 0);
+    }
+  }
+  BENCH_SINK(fill);
+}
+
+DEF_BENCH(format_graphite) {
+  value_list_t vl = bench_vl();
+  char buffer[4096];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    format_graphite(buffer, sizeof(buffer), &ds_octets, &vl, "collectd.",
+                    /* postfix = */ NULL, '_', /* flags = */ 0);
+    BENCH_SINK(buffer[0]);
+  }
+}
+
+/* With the identifier interned, as it is in the write path of the daemon. */
+DEF_BENCH(format_graphite_interned) {
+  value_list_t vl = bench_vl();
+  char buffer[4096];
+
+  identifier_update(&vl);
+  for (uint64_t i = 0; i < iterations; i++) {
+    format_graphite(buffer, sizeof(buffer), &ds_octets, &vl, "collectd.",
+                    /* postfix = */ NULL, '_', /* flags = */ 0);
+    BENCH_SINK(buffer[0]);
+  }
+}
+
+/* Tagged names, "<plugin>.<type>.<ds>;host=...;ds_name=<ds>", built anew for
+ * every value list. */
+DEF_BENCH(format_graphite_tagged) {
+  value_list_t vl = bench_vl();
+  char buffer[4096];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    format_graphite(buffer, sizeof(buffer), &ds_octets, &vl, "collectd.",
+                    /* postfix = */ NULL, '_', GRAPHITE_USE_TAGS);
+    BENCH_SINK(buffer[0]);
+  }
+}
+
+/* Tagged names taken from the per-thread cache. */
+DEF_BENCH(format_graphite_tagged_interned) {
+  value_list_t vl = bench_vl();
+  char buffer[4096];
+
+  identifier_update(&vl);
+  for (uint64_t i = 0; i < iterations; i++) {
+    format_graphite(buffer, sizeof(buffer), &ds_octets, &vl, "collectd.",
+                    /* postfix = */ NULL, '_', GRAPHITE_USE_TAGS);
+    BENCH_SINK(buffer[0]);
+  }
+}
+
+int main(void) {
+  RUN_BENCH(format_json_value_list, 1000000);
+  RUN_BENCH(format_json_batch, 1000000);
+  RUN_BENCH(format_graphite, 1000000);
+  RUN_BENCH(format_graphite_interned, 1000000);
+  RUN_BENCH(format_graphite_tagged, 1000000);
+  RUN_BENCH(format_graphite_tagged_interned, 1000000);
+
+  END_BENCH;
+}
@@ -34,50 +34,230 @@
 /* Utils functions to format data sets in graphite format.
  * Largely taken from write_graphite.c as it remains the same formatting */
 
+/* Classes of the characters in `gr_escape_table'. A character is replaced by
+ * the escape character if its class matches the mask passed to the escaping
+ * functions. */
+#define GR_ESCAPE_DOT 0x01       /* the separator, unless it is preserved */
+#define GR_ESCAPE_PART 0x02      /* white space and control characters */
+#define GR_ESCAPE_FORBIDDEN 0x04 /* GRAPHITE_FORBIDDEN */
+
+/* Number of formatted names each thread remembers. */
+#ifndef GR_CACHE_SIZE
+#define GR_CACHE_SIZE 1024
+#endif
+
+/* The escaped name of a value list without the data source name. If a data
+ * source name is appended, it is inserted after the first `head_len'
+ * characters and, if tags are used, added as the "ds_name" tag. */
+typedef struct {
+  char text[10 * DATA_MAX_NAME_LEN];
+  size_t head_len;
+  size_t len;
+} gr_name_t;
+
+/* Names are cached per thread in a direct mapped table, indexed by the hash of
+ * the interned identifier. The host, plugin and type parts of a name are
+ * escaped once per identifier rather than for every value. */
+typedef struct {
+  uint32_t hash; /* zero if the entry is unused */
+  unsigned int flags;
+  char escape_char;
+  bool append_ds;
+  /* "<identifier>\0<prefix>\0<postfix>\0<name>" in a single allocation. */
+  char *data;
+  char const *prefix;
+  char const *postfix;
+  char const *name;
+  size_t head_len;
+  size_t len;
+} gr_cache_entry_t;
+
+static uint8_t gr_escape_table[256];
+static pthread_key_t gr_cache_key;
+static bool gr_cache_key_initialized;
+static pthread_once_t gr_once = PTHREAD_ONCE_INIT;
+
+static void gr_cache_free(void *arg) /* {{{ */
+{
+  gr_cache_entry_t *cache = arg;
+
+  if (cache == NULL)
+    return;
+
+  for (size_t i = 0; i < GR_CACHE_SIZE; i++)
+    sfree(cache[i].data);
+  sfree(cache);
+} /* }}} void gr_cache_free */
+
+static void gr_init_once(void) /* {{{ */
+{
+  for (int c = 0; c < 256; c++) {
+    uint8_t class = 0;
+
+    if (c == '.')
+      class |= GR_ESCAPE_DOT;
+    /* Same as isspace() and iscntrl() in the "C" locale. */
+    if ((c < 0x80) && (isspace(c) || iscntrl(c)))
+      class |= GR_ESCAPE_PART;
+    if ((c != 0) && (strchr(GRAPHITE_FORBIDDEN, c) != NULL))
+      class |= GR_ESCAPE_FORBIDDEN;
+
+    gr_escape_table[c] = class;
+  }
+
+  gr_cache_key_initialized =
+      (pthread_key_create(&gr_cache_key, gr_cache_free) == 0);
+} /* }}} void gr_init_once */
+
+/* Returns the cache entry an identifier maps to, or NULL if the identifier has
+ * not been interned or the cache is not available. */
+static gr_cache_entry_t *gr_cache_slot(value_list_t const *vl) /* {{{ */
+{
+  if ((vl->identifier.hash == 0) || !gr_cache_key_initialized)
+    return NULL;
+
+  gr_cache_entry_t *cache = pthread_getspecific(gr_cache_key);
+  if (cache == NULL) {
+    cache = calloc(GR_CACHE_SIZE, sizeof(*cache));
+    if (cache == NULL)
+      return NULL;
+    if (pthread_setspecific(gr_cache_key, cache) != 0) {
+      sfree(cache);
+      return NULL;
+    }
+  }
+
+  return cache + (vl->identifier.hash % GR_CACHE_SIZE);
+} /* }}} gr_cache_entry_t *gr_cache_slot */
+
+static bool gr_cache_match(gr_cache_entry_t const *e, value_list_t const *vl,
+                           char const *prefix, char const *postfix,
+                           char escape_char, unsigned int flags,
+                           bool append_ds) {
+  return (e->hash == vl->identifier.hash) && (e->flags == flags) &&
+         (e->escape_char == escape_char) && (e->append_ds == append_ds) &&
+         (strcmp(e->data, vl->identifier.name) == 0) &&
+         (strcmp(e->prefix, prefix) == 0) && (strcmp(e->postfix, postfix) == 0);
+} /* bool gr_cache_match */
+
+static void gr_cache_store(gr_cache_entry_t *e, value_list_t const *vl,
+                           char const *prefix, char const *postfix,
+                           char escape_char, unsigned int flags,
+                           bool append_ds, gr_name_t const *name) /* {{{ */
+{
+  size_t identifier_len = strlen(vl->identifier.name);
+  size_t prefix_len = strlen(prefix);
+  size_t postfix_len = strlen(postfix);
+
+  e->hash = 0;
+
+  char *data = realloc(e->data, identifier_len + prefix_len + postfix_len +
+                                    name->len + 4);
+  if (data == NULL)
+    return;
+  e->data = data;
+
+  memcpy(data, vl->identifier.name, identifier_len + 1);
+  data += identifier_len + 1;
+  e->prefix = memcpy(data, prefix, prefix_len + 1);
+  data += prefix_len + 1;
+  e->postfix = memcpy(data, postfix, postfix_len + 1);
+  data += postfix_len + 1;
+  memcpy(data, name->text, name->len);
+  data[name->len] = 0;
+  e->name = data;
+
+  e->head_len = name->head_len;
+  e->len = name->len;
+  e->flags = flags;
+  e->escape_char = escape_char;
+  e->append_ds = append_ds;
+  e->hash = vl->identifier.hash;
+} /* }}} void gr_cache_store */
+
+/* Formats "value" in decimal. "buffer" must hold at least 20 characters. */
+static size_t gr_format_uint(char *buffer, uint64_t value) {
+  char tmp[20];
+  size_t len = 0;
+
+  do {
+    tmp[len++] = (char)('0' + (value % 10));
+    value /= 10;
+  } while (value != 0);
+
+  for (size_t i = 0; i < len; i++)
+    buffer[i] = tmp[len - 1 - i];
+  return len;
+} /* size_t gr_format_uint */
+
+static size_t gr_format_int(char *buffer, int64_t value) {
+  if (value >= 0)
+    return gr_format_uint(buffer, (uint64_t)value);
+
+  buffer[0] = '-';
+  return 1 + gr_format_uint(buffer + 1, (uint64_t)0 - (uint64_t)value);
+} /* size_t gr_format_int */
+
+/* Formats a double like snprintf(3) with "format" would. Integral values
+ * below 10^15 are printed without a fraction by both "%.15g" and "%f"
+ * (followed by ".000000"), so these are formatted by hand. */
+static int gr_format_double(char *buffer, size_t buffer_size,
+                            char const *format, double value, bool fixed) {
+  if ((buffer_size > 32) && (fabs(value) < 1e15) &&
+      (value == (double)(int64_t)value) && ((value != 0) || !signbit(value))) {
+    size_t len = gr_format_int(buffer, (int64_t)value);
+    if (fixed) {
+      memcpy(buffer + len, ".000000", strlen(".000000"));
+      len += strlen(".000000");
+    }
+    buffer[len] = 0;
+    return (int)len;
+  }
+
+  int status = snprintf(buffer, buffer_size, format, value);
+  if ((status < 1) || ((size_t)status >= buffer_size))
+    return -1;
+  return status;
+} /* int gr_format_double */
+
+/* Formats the value of data source "ds_num" into "ret" and returns the number
+ * of characters written, or a negative value on error. */
 static int gr_format_values(char *ret, size_t ret_len, int ds_num,
                             const data_set_t *ds, const value_list_t *vl,
                             gauge_t const *rates) {
-  size_t offset = 0;
-  int status;
-
   assert(0 == strcmp(ds->type, vl->type));
 
-  memset(ret, 0, ret_len);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    status = snprintf(ret + offset, ret_len - offset, __VA_ARGS__);            \
-    if (status < 1) {                                                          \
-      return -1;                                                               \
-    } else if (((size_t)status) >= (ret_len - offset)) {                       \
-      return -1;                                                               \
-    } else                                                                     \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
   if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
-    BUFFER_ADD(GAUGE_FORMAT, vl->values[ds_num].gauge);
+    return gr_format_double(ret, ret_len, GAUGE_FORMAT,
+                            vl->values[ds_num].gauge, /* fixed = */ false);
   else if (rates != NULL)
-    BUFFER_ADD("%f", rates[ds_num]);
-  else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-    BUFFER_ADD("%" PRIu64, (uint64_t)vl->values[ds_num].counter);
+    return gr_format_double(ret, ret_len, "%f", rates[ds_num],
+                            /* fixed = */ true);
+
+  if (ret_len < 21)
+    return -1;
+
+  size_t len;
+  if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
+    len = gr_format_uint(ret, (uint64_t)vl->values[ds_num].counter);
   else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
-    BUFFER_ADD("%" PRIi64, vl->values[ds_num].derive);
+    len = gr_format_int(ret, (int64_t)vl->values[ds_num].derive);
   else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-    BUFFER_ADD("%" PRIu64, vl->values[ds_num].absolute);
+    len = gr_format_uint(ret, (uint64_t)vl->values[ds_num].absolute);
   else {
     P_ERROR("gr_format_values: Unknown data source type: %i",
             ds->ds[ds_num].type);
     return -1;
   }
 
-#undef BUFFER_ADD
-
-  return 0;
+  ret[len] = 0;
+  return (int)len;
 }
 
 static void gr_copy_escape_part(char *dst, const char *src, size_t dst_len,
                                 char escape_char, bool preserve_separator) {
+  uint8_t mask = GR_ESCAPE_PART | (preserve_separator ? 0 : GR_ESCAPE_DOT);
+
   memset(dst, 0, dst_len);
 
   if (src == NULL)
@@ -89,96 +269,98 @@ static void gr_copy_escape_part(char *dst, const char *src, size_t dst_len,
       break;
     }
 
-    if ((!preserve_separator && (src[i] == '.')) || isspace((int)src[i]) ||
-        iscntrl((int)src[i]))
+    if (gr_escape_table[(unsigned char)src[i]] & mask)
       dst[i] = escape_char;
     else
       dst[i] = src[i];
   }
 }
 
-static int gr_format_name_tagged(char *ret, int ret_len, value_list_t const *vl,
-                                 char const *ds_name, char const *prefix,
-                                 char const *postfix, char const escape_char,
-                                 unsigned int flags) {
-  char n_host[DATA_MAX_NAME_LEN];
-  char n_plugin[DATA_MAX_NAME_LEN];
-  char n_plugin_instance[DATA_MAX_NAME_LEN];
-  char n_type[DATA_MAX_NAME_LEN];
-  char n_type_instance[DATA_MAX_NAME_LEN];
-
-  char tmp_plugin[DATA_MAX_NAME_LEN + 8];
-  char tmp_plugin_instance[DATA_MAX_NAME_LEN + 17];
-  char tmp_type[DATA_MAX_NAME_LEN + 6];
-  char tmp_type_instance[DATA_MAX_NAME_LEN + 15];
-  char tmp_metric[3 * DATA_MAX_NAME_LEN + 2];
-  char tmp_ds_name[DATA_MAX_NAME_LEN + 9];
-
-  if (prefix == NULL)
-    prefix = "";
-
-  if (postfix == NULL)
-    postfix = "";
-
-  gr_copy_escape_part(n_host, vl->host, sizeof(n_host), escape_char, 1);
-  gr_copy_escape_part(n_plugin, vl->plugin, sizeof(n_plugin), escape_char, 1);
-  gr_copy_escape_part(n_plugin_instance, vl->plugin_instance,
-                      sizeof(n_plugin_instance), escape_char, 1);
-  gr_copy_escape_part(n_type, vl->type, sizeof(n_type), escape_char, 1);
-  gr_copy_escape_part(n_type_instance, vl->type_instance,
-                      sizeof(n_type_instance), escape_char, 1);
-
-  snprintf(tmp_plugin, sizeof(tmp_plugin), ";plugin=%s", n_plugin);
-
-  if (n_plugin_instance[0] != '\0')
-    snprintf(tmp_plugin_instance, sizeof(tmp_plugin_instance),
-             ";plugin_instance=%s", n_plugin_instance);
-  else
-    tmp_plugin_instance[0] = '\0';
-
-  if (!(flags & GRAPHITE_DROP_DUPE_FIELDS) || strcmp(n_plugin, n_type) != 0)
-    snprintf(tmp_type, sizeof(tmp_type), ";type=%s", n_type);
-  else
-    tmp_type[0] = '\0';
-
-  if (n_type_instance[0] != '\0') {
-    if (!(flags & GRAPHITE_DROP_DUPE_FIELDS) ||
-        strcmp(n_plugin_instance, n_type_instance) != 0)
-      snprintf(tmp_type_instance, sizeof(tmp_type_instance),
-               ";type_instance=%s", n_type_instance);
+/* Appends "str" to "name", truncating it if necessary. */
+static void gr_name_append(gr_name_t *name, char const *str) {
+  size_t len = strlen(str);
+
+  if (len >= sizeof(name->text) - name->len)
+    len = sizeof(name->text) - name->len - 1;
+
+  memcpy(name->text + name->len, str, len);
+  name->len += len;
+  name->text[name->len] = 0;
+} /* void gr_name_append */
+
+/* Appends "src", escaping the characters of the classes in "mask", like
+ * gr_copy_escape_part() does. */
+static void gr_name_append_escaped(gr_name_t *name, char const *src,
+                                   char escape_char, uint8_t mask) {
+  for (size_t i = 0; (i < DATA_MAX_NAME_LEN) && (src[i] != 0) &&
+                     (name->len < sizeof(name->text) - 1);
+       i++) {
+    if (gr_escape_table[(unsigned char)src[i]] & mask)
+      name->text[name->len++] = escape_char;
     else
-      tmp_type_instance[0] = '\0';
-  } else
-    tmp_type_instance[0] = '\0';
-
-  /* Assert always_append_ds -> ds_name */
-  assert(!(flags & GRAPHITE_ALWAYS_APPEND_DS) || (ds_name != NULL));
-  if (ds_name != NULL) {
-    snprintf(tmp_ds_name, sizeof(tmp_ds_name), ";ds_name=%s", ds_name);
-
-    if ((flags & GRAPHITE_DROP_DUPE_FIELDS) && strcmp(n_plugin, n_type) == 0)
-      snprintf(tmp_metric, sizeof(tmp_metric), "%s.%s", n_plugin, ds_name);
-    else
-      snprintf(tmp_metric, sizeof(tmp_metric), "%s.%s.%s", n_plugin, n_type,
-               ds_name);
-  } else {
-    tmp_ds_name[0] = '\0';
-
-    if ((flags & GRAPHITE_DROP_DUPE_FIELDS) && strcmp(n_plugin, n_type) == 0)
-      snprintf(tmp_metric, sizeof(tmp_metric), "%s", n_plugin);
-    else
-      snprintf(tmp_metric, sizeof(tmp_metric), "%s.%s", n_plugin, n_type);
+      name->text[name->len++] = src[i];
+  }
+  name->text[name->len] = 0;
+} /* void gr_name_append_escaped */
+
+/* Returns whether "a" and "b" are equal once escaped. */
+static bool gr_escaped_equal(char const *a, char const *b, char escape_char,
+                             uint8_t mask) {
+  for (; (*a != 0) && (*b != 0); a++, b++) {
+    char ea = (gr_escape_table[(unsigned char)*a] & mask) ? escape_char : *a;
+    char eb = (gr_escape_table[(unsigned char)*b] & mask) ? escape_char : *b;
+    if (ea != eb)
+      return false;
   }
+  return *a == *b;
+} /* bool gr_escaped_equal */
 
-  snprintf(ret, ret_len, "%s%s%s;host=%s%s%s%s%s%s", prefix, tmp_metric,
-           postfix, n_host, tmp_plugin, tmp_plugin_instance, tmp_type,
-           tmp_type_instance, tmp_ds_name);
+/* The parts are escaped straight into "ret", without intermediate copies. */
+static int gr_format_name_tagged(gr_name_t *ret, value_list_t const *vl,
+                                 char const *prefix,
+                                 char const *postfix, char const escape_char,
+                                 unsigned int flags) {
+  /* The separator is always preserved in tags. */
+  uint8_t mask = GR_ESCAPE_PART;
+  bool drop_dupes = (flags & GRAPHITE_DROP_DUPE_FIELDS);
+  bool append_type =
+      !drop_dupes || !gr_escaped_equal(vl->plugin, vl->type, escape_char, mask);
+
+  /* The metric, "<plugin>[.<type>]", is followed by the data source name and
+   * the postfix. The "ds_name" tag is added by format_graphite(). */
+  gr_name_append(ret, prefix);
+  gr_name_append_escaped(ret, vl->plugin, escape_char, mask);
+  if (append_type) {
+    gr_name_append(ret, ".");
+    gr_name_append_escaped(ret, vl->type, escape_char, mask);
+  }
+  ret->head_len = ret->len;
+
+  gr_name_append(ret, postfix);
+  gr_name_append(ret, ";host=");
+  gr_name_append_escaped(ret, vl->host, escape_char, mask);
+  gr_name_append(ret, ";plugin=");
+  gr_name_append_escaped(ret, vl->plugin, escape_char, mask);
+  if (vl->plugin_instance[0] != '\0') {
+    gr_name_append(ret, ";plugin_instance=");
+    gr_name_append_escaped(ret, vl->plugin_instance, escape_char, mask);
+  }
+  if (append_type) {
+    gr_name_append(ret, ";type=");
+    gr_name_append_escaped(ret, vl->type, escape_char, mask);
+  }
+  if ((vl->type_instance[0] != '\0') &&
+      (!drop_dupes || !gr_escaped_equal(vl->plugin_instance, vl->type_instance,
+                                        escape_char, mask))) {
+    gr_name_append(ret, ";type_instance=");
+    gr_name_append_escaped(ret, vl->type_instance, escape_char, mask);
+  }
 
   return 0;
 }
 
-static int gr_format_name(char *ret, int ret_len, value_list_t const *vl,
-                          char const *ds_name, char const *prefix,
+static int gr_format_name(gr_name_t *ret, value_list_t const *vl,
+                          bool append_ds, char const *prefix,
                           char const *postfix, char const escape_char,
                           unsigned int flags) {
   char n_host[DATA_MAX_NAME_LEN];
@@ -190,12 +372,6 @@ static int gr_format_name(char *ret, int ret_len, value_list_t const *vl,
   char tmp_plugin[2 * DATA_MAX_NAME_LEN + 1];
   char tmp_type[2 * DATA_MAX_NAME_LEN + 1];
 
-  if (prefix == NULL)
-    prefix = "";
-
-  if (postfix == NULL)
-    postfix = "";
-
   bool preserve_separator = (flags & GRAPHITE_PRESERVE_SEPARATOR);
 
   gr_copy_escape_part(n_host, vl->host, sizeof(n_host), escape_char,
@@ -227,19 +403,17 @@ static int gr_format_name(char *ret, int ret_len, value_list_t const *vl,
   } else
     sstrncpy(tmp_type, n_type, sizeof(tmp_type));
 
-  /* Assert always_append_ds -> ds_name */
-  assert(!(flags & GRAPHITE_ALWAYS_APPEND_DS) || (ds_name != NULL));
-  if (ds_name != NULL) {
-    if ((flags & GRAPHITE_DROP_DUPE_FIELDS) &&
-        strcmp(tmp_plugin, tmp_type) == 0)
-      snprintf(ret, ret_len, "%s%s%s.%s.%s", prefix, n_host, postfix,
-               tmp_plugin, ds_name);
-    else
-      snprintf(ret, ret_len, "%s%s%s.%s.%s.%s", prefix, n_host, postfix,
-               tmp_plugin, tmp_type, ds_name);
-  } else
-    snprintf(ret, ret_len, "%s%s%s.%s.%s", prefix, n_host, postfix, tmp_plugin,
-             tmp_type);
+  gr_name_append(ret, prefix);
+  gr_name_append(ret, n_host);
+  gr_name_append(ret, postfix);
+  gr_name_append(ret, ".");
+  gr_name_append(ret, tmp_plugin);
+  if (!append_ds || !(flags & GRAPHITE_DROP_DUPE_FIELDS) ||
+      strcmp(tmp_plugin, tmp_type) != 0) {
+    gr_name_append(ret, ".");
+    gr_name_append(ret, tmp_type);
+  }
+  ret->head_len = ret->len;
 
   return 0;
 }
@@ -247,17 +421,52 @@ static int gr_format_name(char *ret, int ret_len, value_list_t const *vl,
 static void escape_graphite_string(char *buffer, char escape_char) {
   assert(strchr(GRAPHITE_FORBIDDEN, escape_char) == NULL);
 
-  for (char *head = buffer + strcspn(buffer, GRAPHITE_FORBIDDEN); *head != '\0';
-       head += strcspn(head, GRAPHITE_FORBIDDEN))
-    *head = escape_char;
+  for (char *head = buffer; *head != '\0'; head++)
+    if (gr_escape_table[(unsigned char)*head] & GR_ESCAPE_FORBIDDEN)
+      *head = escape_char;
 }
 
+/* Appends "len" bytes of "str" to "buffer". Fails if that would leave no room
+ * for the terminating null byte. */
+static bool gr_append(char *buffer, size_t buffer_size, size_t *pos,
+                      char const *str, size_t len) {
+  if (*pos + len >= buffer_size)
+    return false;
+
+  memcpy(buffer + *pos, str, len);
+  *pos += len;
+  return true;
+} /* bool gr_append */
+
+static bool gr_append_escaped(char *buffer, size_t buffer_size, size_t *pos,
+                              char const *str, char escape_char) {
+  for (; *str != 0; str++) {
+    if (*pos + 1 >= buffer_size)
+      return false;
+
+    if (gr_escape_table[(unsigned char)*str] & GR_ESCAPE_FORBIDDEN)
+      buffer[*pos] = escape_char;
+    else
+      buffer[*pos] = *str;
+    (*pos)++;
+  }
+  return true;
+} /* bool gr_append_escaped */
+
 int format_graphite(char *buffer, size_t buffer_size, data_set_t const *ds,
                     value_list_t const *vl, char const *prefix,
                     char const *postfix, char const escape_char,
                     unsigned int flags) {
   int status = 0;
-  int buffer_pos = 0;
+  size_t buffer_pos = 0;
+
+  pthread_once(&gr_once, gr_init_once);
+
+  if (prefix == NULL)
+    prefix = "";
+
+  if (postfix == NULL)
+    postfix = "";
 
   gauge_t *rates = NULL;
   if (flags & GRAPHITE_STORE_RATES) {
@@ -268,27 +477,36 @@ int format_graphite(char *buffer, size_t buffer_size, data_set_t const *ds,
     }
   }
 
-  for (size_t i = 0; i < ds->ds_num; i++) {
-    char const *ds_name = NULL;
-    char key[10 * DATA_MAX_NAME_LEN];
-    char values[512];
-    size_t message_len;
-    char message[1024];
-
-    if ((flags & GRAPHITE_ALWAYS_APPEND_DS) || (ds->ds_num > 1))
-      ds_name = ds->ds[i].name;
-
-    /* Copy the identifier to `key' and escape it. */
-    if (flags & GRAPHITE_USE_TAGS) {
-      status = gr_format_name_tagged(key, sizeof(key), vl, ds_name, prefix,
-                                     postfix, escape_char, flags);
+  /* Whether the data source name is appended is the same for all data
+   * sources. */
+  bool append_ds = (flags & GRAPHITE_ALWAYS_APPEND_DS) || (ds->ds_num > 1);
+  bool use_tags = (flags & GRAPHITE_USE_TAGS);
+
+  /* Copy the identifier to `name' and escape it, unless this thread has
+   * formatted it before. */
+  char const *name_text;
+  size_t name_head_len;
+  size_t name_len;
+
+  gr_name_t name = {.len = 0};
+  gr_cache_entry_t *slot = gr_cache_slot(vl);
+  if ((slot != NULL) && gr_cache_match(slot, vl, prefix, postfix, escape_char,
+                                       flags, append_ds)) {
+    name_text = slot->name;
+    name_head_len = slot->head_len;
+    name_len = slot->len;
+  } else {
+    name.text[0] = 0;
+    if (use_tags) {
+      status = gr_format_name_tagged(&name, vl, prefix, postfix, escape_char,
+                                     flags);
       if (status != 0) {
         P_ERROR("format_graphite: error with gr_format_name_tagged");
         sfree(rates);
         return status;
       }
     } else {
-      status = gr_format_name(key, sizeof(key), vl, ds_name, prefix, postfix,
+      status = gr_format_name(&name, vl, append_ds, prefix, postfix,
                               escape_char, flags);
       if (status != 0) {
         P_ERROR("format_graphite: error with gr_format_name");
@@ -297,37 +515,65 @@ int format_graphite(char *buffer, size_t buffer_size, data_set_t const *ds,
       }
     }
 
-    escape_graphite_string(key, escape_char);
+    escape_graphite_string(name.text, escape_char);
+
+    if (slot != NULL)
+      gr_cache_store(slot, vl, prefix, postfix, escape_char, flags, append_ds,
+                     &name);
+
+    name_text = name.text;
+    name_head_len = name.head_len;
+    name_len = name.len;
+  }
+
+  char timestamp[24];
+  size_t timestamp_len = gr_format_uint(
+      timestamp, (unsigned int)CDTIME_T_TO_TIME_T(vl->time));
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    char const *ds_name = append_ds ? ds->ds[i].name : NULL;
+    char values[512];
+    size_t line_start = buffer_pos;
 
     /* Convert the values to an ASCII representation and put that into
      * `values'. */
-    status = gr_format_values(values, sizeof(values), i, ds, vl, rates);
-    if (status != 0) {
+    int values_len = gr_format_values(values, sizeof(values), i, ds, vl, rates);
+    if (values_len < 0) {
       P_ERROR("format_graphite: error with gr_format_values");
       sfree(rates);
-      return status;
-    }
-
-    /* Compute the graphite command */
-    message_len =
-        (size_t)snprintf(message, sizeof(message), "%s %s %u\r\n", key, values,
-                         (unsigned int)CDTIME_T_TO_TIME_T(vl->time));
-    if (message_len >= sizeof(message)) {
-      P_ERROR("format_graphite: message buffer too small: "
-              "Need %" PRIsz " bytes.",
-              message_len + 1);
-      sfree(rates);
-      return -ENOMEM;
+      return -1;
     }
 
-    /* Append it in case we got multiple data set */
-    if ((buffer_pos + message_len) >= buffer_size) {
+    /* Compute the graphite command and append it in case we got multiple
+     * data sources. */
+    bool ok = gr_append(buffer, buffer_size, &buffer_pos, name_text,
+                        name_head_len);
+    if (ok && (ds_name != NULL))
+      ok = gr_append(buffer, buffer_size, &buffer_pos, ".", 1) &&
+           gr_append_escaped(buffer, buffer_size, &buffer_pos, ds_name,
+                             escape_char);
+    ok = ok && gr_append(buffer, buffer_size, &buffer_pos,
+                         name_text + name_head_len, name_len - name_head_len);
+    if (ok && use_tags && (ds_name != NULL))
+      ok = gr_append(buffer, buffer_size, &buffer_pos, ";ds_name=",
+                     strlen(";ds_name=")) &&
+           gr_append_escaped(buffer, buffer_size, &buffer_pos, ds_name,
+                             escape_char);
+    ok = ok && gr_append(buffer, buffer_size, &buffer_pos, " ", 1) &&
+         gr_append(buffer, buffer_size, &buffer_pos, values,
+                   (size_t)values_len) &&
+         gr_append(buffer, buffer_size, &buffer_pos, " ", 1) &&
+         gr_append(buffer, buffer_size, &buffer_pos, timestamp,
+                   timestamp_len) &&
+         gr_append(buffer, buffer_size, &buffer_pos, "\r\n", 2);
+    if (!ok) {
       P_ERROR("format_graphite: target buffer too small");
+      if (line_start < buffer_size)
+        buffer[line_start] = '\0';
       sfree(rates);
       return -ENOMEM;
     }
-    memcpy((void *)(buffer + buffer_pos), message, message_len);
-    buffer_pos += message_len;
+
     buffer[buffer_pos] = '\0';
   }
   sfree(rates);
@@ -36,16 +36,14 @@ static data_set_t ds_single = {
     .ds = &(data_source_t){"value", DS_TYPE_GAUGE, NAN, NAN},
 };
 
-/*
 static data_set_t ds_double = {
     .type = "double",
     .ds_num = 2,
     .ds =
         (data_source_t[]){
-            {"one", DS_TYPE_DERIVE, 0, NAN}, {"two", DS_TYPE_DERIVE, 0, NAN},
+            {"one", DS_TYPE_DERIVE, 0, NAN}, {"two", DS_TYPE_GAUGE, NAN, NAN},
         },
 };
-*/
 
 DEF_TEST(metric_name) {
   struct {
@@ -163,11 +161,18 @@ DEF_TEST(metric_name) {
       sstrncpy(vl.type_instance, cases[i].type_instance,
                sizeof(vl.type_instance));
 
-    char got[1024];
-    EXPECT_EQ_INT(0, format_graphite(got, sizeof(got), &ds_single, &vl,
-                                     cases[i].prefix, cases[i].suffix, '@',
-                                     cases[i].flags));
-    EXPECT_EQ_STR(want, got);
+    /* Without an interned identifier, then once to fill the name cache and
+     * once more to use it. */
+    for (int pass = 0; pass < 3; pass++) {
+      if (pass > 0)
+        EXPECT_EQ_INT(0, identifier_update(&vl));
+
+      char got[1024];
+      EXPECT_EQ_INT(0, format_graphite(got, sizeof(got), &ds_single, &vl,
+                                       cases[i].prefix, cases[i].suffix, '@',
+                                       cases[i].flags));
+      EXPECT_EQ_STR(want, got);
+    }
   }
 
   return 0;
@@ -199,9 +204,63 @@ DEF_TEST(null_termination) {
   return 0;
 }
 
+DEF_TEST(values) {
+  struct {
+    derive_t derive;
+    gauge_t gauge;
+    unsigned int flags;
+    const char *want;
+  } cases[] = {
+      {
+          .derive = -42,
+          .gauge = 0.5,
+          .want = "example@com.test.double.one -42 1480063672\r\n"
+                  "example@com.test.double.two 0.5 1480063672\r\n",
+      },
+      {
+          .derive = 9223372036854775807LL,
+          .gauge = -1e20,
+          .want = "example@com.test.double.one 9223372036854775807 "
+                  "1480063672\r\n"
+                  "example@com.test.double.two -1e+20 1480063672\r\n",
+      },
+      {
+          .derive = 0,
+          .gauge = 123456789012345,
+          .flags = GRAPHITE_USE_TAGS,
+          .want = "test.double.one;host=example.com;plugin=test;type=double;"
+                  "ds_name=one 0 1480063672\r\n"
+                  "test.double.two;host=example.com;plugin=test;type=double;"
+                  "ds_name=two 123456789012345 1480063672\r\n",
+      },
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    value_list_t vl = {
+        .values = (value_t[]){{.derive = cases[i].derive},
+                              {.gauge = cases[i].gauge}},
+        .values_len = 2,
+        .time = TIME_T_TO_CDTIME_T_STATIC(1480063672),
+        .interval = TIME_T_TO_CDTIME_T_STATIC(10),
+        .host = "example.com",
+        .plugin = "test",
+        .type = "double",
+    };
+    EXPECT_EQ_INT(0, identifier_update(&vl));
+
+    char got[1024];
+    EXPECT_EQ_INT(0, format_graphite(got, sizeof(got), &ds_double, &vl, NULL,
+                                     NULL, '@', cases[i].flags));
+    EXPECT_EQ_STR(cases[i].want, got);
+  }
+
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(metric_name);
   RUN_TEST(null_termination);
+  RUN_TEST(values);
 
   END_TEST;
 }
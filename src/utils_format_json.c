@@ -43,366 +43,281 @@
 #endif
 #endif
 
-static int json_escape_string(char *buffer, size_t buffer_size, /* {{{ */
-                              const char *string) {
-  size_t dst_pos;
+/* How json_add_escaped() writes each byte of a string: copied (0), prefixed
+ * with a backslash (1) or replaced with a question mark (2). Control
+ * characters and bytes above 0x7f are replaced, which is what the previous
+ * encoder did where "char" is signed. */
+static const uint8_t json_escape_table[256] = {
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0x00 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0x10 */
+    0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x20, '"' */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x30 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x40 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, /* 0x50, '\\' */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x60 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x70 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0x80 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0x90 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xa0 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xb0 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xc0 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xd0 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xe0 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xf0 */
+};
+
+/* The value list encoder writes directly into the destination buffer. Once
+ * the buffer is full, `overflow' is set and all further output is discarded,
+ * so that callers only need to check for errors once at the end. At least one
+ * byte remains free for the terminating null byte. */
+typedef struct {
+  char *buffer;
+  size_t size;
+  size_t pos;
+  bool overflow;
+} json_out_t;
 
-  if ((buffer == NULL) || (string == NULL))
-    return -EINVAL;
+static void json_add(json_out_t *out, char const *str, size_t len) {
+  if (out->overflow || (len >= (out->size - out->pos))) {
+    out->overflow = true;
+    return;
+  }
 
-  if (buffer_size < 3)
-    return -ENOMEM;
+  memcpy(out->buffer + out->pos, str, len);
+  out->pos += len;
+} /* void json_add */
 
-  dst_pos = 0;
+#define JSON_ADD_LITERAL(out, str) json_add((out), (str), sizeof(str) - 1)
 
-#define BUFFER_ADD(c)                                                          \
-  do {                                                                         \
-    if (dst_pos >= (buffer_size - 1)) {                                        \
-      buffer[buffer_size - 1] = 0;                                             \
-      return -ENOMEM;                                                          \
-    }                                                                          \
-    buffer[dst_pos] = (c);                                                     \
-    dst_pos++;                                                                 \
-  } while (0)
+static void json_add_str(json_out_t *out, char const *str) {
+  json_add(out, str, strlen(str));
+} /* void json_add_str */
 
-  /* Escape special characters */
-  BUFFER_ADD('"');
-  for (size_t src_pos = 0; string[src_pos] != 0; src_pos++) {
-    if ((string[src_pos] == '"') || (string[src_pos] == '\\')) {
-      BUFFER_ADD('\\');
-      BUFFER_ADD(string[src_pos]);
-    } else if (string[src_pos] <= 0x001F)
-      BUFFER_ADD('?');
-    else
-      BUFFER_ADD(string[src_pos]);
-  } /* for */
-  BUFFER_ADD('"');
-  buffer[dst_pos] = 0;
+/* Adds "str" as a quoted JSON string. */
+static void json_add_escaped(json_out_t *out, char const *str) /* {{{ */
+{
+  JSON_ADD_LITERAL(out, "\"");
 
-#undef BUFFER_ADD
+  for (; !out->overflow && (*str != 0); str++) {
+    uint8_t class = json_escape_table[(unsigned char)*str];
+    size_t len = (class == 1) ? 2 : 1;
 
-  return 0;
-} /* }}} int json_escape_string */
+    if (len >= (out->size - out->pos)) {
+      out->overflow = true;
+      return;
+    }
 
-static int values_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                          const data_set_t *ds, const value_list_t *vl,
-                          int store_rates) {
-  size_t offset = 0;
-  gauge_t *rates = NULL;
+    if (class == 1)
+      out->buffer[out->pos++] = '\\';
+    out->buffer[out->pos++] = (class == 2) ? '?' : *str;
+  }
 
-  memset(buffer, 0, buffer_size);
+  JSON_ADD_LITERAL(out, "\"");
+} /* }}} void json_add_escaped */
 
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    int status;                                                                \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1) {                                                          \
-      sfree(rates);                                                            \
-      return -1;                                                               \
-    } else if (((size_t)status) >= (buffer_size - offset)) {                   \
-      sfree(rates);                                                            \
-      return -ENOMEM;                                                          \
-    } else                                                                     \
-      offset += ((size_t)status);                                              \
-  } while (0)
+static void json_add_uint(json_out_t *out, uint64_t value) {
+  char tmp[20];
+  size_t pos = sizeof(tmp);
+
+  do {
+    tmp[--pos] = (char)('0' + (value % 10));
+    value /= 10;
+  } while (value != 0);
+
+  json_add(out, tmp + pos, sizeof(tmp) - pos);
+} /* void json_add_uint */
+
+static void json_add_int(json_out_t *out, int64_t value) {
+  if (value < 0) {
+    JSON_ADD_LITERAL(out, "-");
+    json_add_uint(out, (uint64_t)0 - (uint64_t)value);
+  } else {
+    json_add_uint(out, (uint64_t)value);
+  }
+} /* void json_add_int */
+
+static void json_add_double(json_out_t *out, char const *format,
+                            double value) {
+  if (out->overflow)
+    return;
+
+  size_t avail = out->size - out->pos;
+  int status = snprintf(out->buffer + out->pos, avail, format, value);
+  if ((status < 1) || ((size_t)status >= avail)) {
+    out->overflow = true;
+    return;
+  }
+  out->pos += (size_t)status;
+} /* void json_add_double */
+
+static void json_add_gauge(json_out_t *out, gauge_t value) {
+  if (isfinite(value))
+    json_add_double(out, JSON_GAUGE_FORMAT, value);
+  else
+    JSON_ADD_LITERAL(out, "null");
+} /* void json_add_gauge */
 
-  BUFFER_ADD("[");
+static int json_add_values(json_out_t *out, const data_set_t *ds, /* {{{ */
+                           const value_list_t *vl, int store_rates) {
+  gauge_t *rates = NULL;
+
+  JSON_ADD_LITERAL(out, "[");
   for (size_t i = 0; i < ds->ds_num; i++) {
     if (i > 0)
-      BUFFER_ADD(",");
+      JSON_ADD_LITERAL(out, ",");
 
     if (ds->ds[i].type == DS_TYPE_GAUGE) {
-      if (isfinite(vl->values[i].gauge))
-        BUFFER_ADD(JSON_GAUGE_FORMAT, vl->values[i].gauge);
-      else
-        BUFFER_ADD("null");
+      json_add_gauge(out, vl->values[i].gauge);
     } else if (store_rates) {
       if (rates == NULL)
         rates = uc_get_rate(ds, vl);
       if (rates == NULL) {
         WARNING("utils_format_json: uc_get_rate failed.");
-        sfree(rates);
         return -1;
       }
 
-      if (isfinite(rates[i]))
-        BUFFER_ADD(JSON_GAUGE_FORMAT, rates[i]);
-      else
-        BUFFER_ADD("null");
+      json_add_gauge(out, rates[i]);
     } else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BUFFER_ADD("%" PRIu64, (uint64_t)vl->values[i].counter);
+      json_add_uint(out, (uint64_t)vl->values[i].counter);
     else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BUFFER_ADD("%" PRIi64, vl->values[i].derive);
+      json_add_int(out, (int64_t)vl->values[i].derive);
     else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BUFFER_ADD("%" PRIu64, vl->values[i].absolute);
+      json_add_uint(out, (uint64_t)vl->values[i].absolute);
     else {
       ERROR("format_json: Unknown data source type: %i", ds->ds[i].type);
       sfree(rates);
       return -1;
     }
   } /* for ds->ds_num */
-  BUFFER_ADD("]");
+  JSON_ADD_LITERAL(out, "]");
 
-#undef BUFFER_ADD
-
-  DEBUG("format_json: values_to_json: buffer = %s;", buffer);
   sfree(rates);
   return 0;
-} /* }}} int values_to_json */
-
-static int dstypes_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                           const data_set_t *ds) {
-  size_t offset = 0;
+} /* }}} int json_add_values */
 
-  memset(buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    int status;                                                                \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
-  BUFFER_ADD("[");
-  for (size_t i = 0; i < ds->ds_num; i++) {
-    if (i > 0)
-      BUFFER_ADD(",");
-
-    BUFFER_ADD("\"%s\"", DS_TYPE_TO_STRING(ds->ds[i].type));
-  } /* for ds->ds_num */
-  BUFFER_ADD("]");
-
-#undef BUFFER_ADD
-
-  DEBUG("format_json: dstypes_to_json: buffer = %s;", buffer);
-
-  return 0;
-} /* }}} int dstypes_to_json */
-
-static int dsnames_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                           const data_set_t *ds) {
-  size_t offset = 0;
-
-  memset(buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    int status;                                                                \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
-  BUFFER_ADD("[");
-  for (size_t i = 0; i < ds->ds_num; i++) {
-    if (i > 0)
-      BUFFER_ADD(",");
-
-    BUFFER_ADD("\"%s\"", ds->ds[i].name);
-  } /* for ds->ds_num */
-  BUFFER_ADD("]");
-
-#undef BUFFER_ADD
-
-  DEBUG("format_json: dsnames_to_json: buffer = %s;", buffer);
-
-  return 0;
-} /* }}} int dsnames_to_json */
+static void json_add_meta_key(json_out_t *out, bool *first, char const *key) {
+  if (*first)
+    JSON_ADD_LITERAL(out, ",\"meta\":{");
+  else
+    JSON_ADD_LITERAL(out, ",");
+  *first = false;
 
-static int meta_data_keys_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                                  meta_data_t *meta, char **keys,
-                                  size_t keys_num) {
-  size_t offset = 0;
-  int status;
+  json_add_escaped(out, key);
+  JSON_ADD_LITERAL(out, ":");
+} /* void json_add_meta_key */
 
-  buffer[0] = 0;
+/* Adds the "meta" member. It is omitted if there is no meta data. */
+static void json_add_meta_data(json_out_t *out, meta_data_t *meta) /* {{{ */
+{
+  char **keys = NULL;
+  bool first = true;
 
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
+  int status = meta_data_toc(meta, &keys);
+  if (status <= 0)
+    return;
+  size_t keys_num = (size_t)status;
 
   for (size_t i = 0; i < keys_num; ++i) {
-    int type;
     char *key = keys[i];
+    int type = meta_data_type(meta, key);
 
-    type = meta_data_type(meta, key);
     if (type == MD_TYPE_STRING) {
       char *value = NULL;
       if (meta_data_get_string(meta, key, &value) == 0) {
-        char temp[512] = "";
-
-        status = json_escape_string(temp, sizeof(temp), value);
+        json_add_meta_key(out, &first, key);
+        json_add_escaped(out, value);
         sfree(value);
-        if (status != 0)
-          return status;
-
-        BUFFER_ADD(",\"%s\":%s", key, temp);
       }
     } else if (type == MD_TYPE_SIGNED_INT) {
       int64_t value = 0;
-      if (meta_data_get_signed_int(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%" PRIi64, key, value);
+      if (meta_data_get_signed_int(meta, key, &value) == 0) {
+        json_add_meta_key(out, &first, key);
+        json_add_int(out, value);
+      }
     } else if (type == MD_TYPE_UNSIGNED_INT) {
       uint64_t value = 0;
-      if (meta_data_get_unsigned_int(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%" PRIu64, key, value);
+      if (meta_data_get_unsigned_int(meta, key, &value) == 0) {
+        json_add_meta_key(out, &first, key);
+        json_add_uint(out, value);
+      }
     } else if (type == MD_TYPE_DOUBLE) {
       double value = 0.0;
-      if (meta_data_get_double(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%f", key, value);
+      if (meta_data_get_double(meta, key, &value) == 0) {
+        json_add_meta_key(out, &first, key);
+        json_add_double(out, "%f", value);
+      }
     } else if (type == MD_TYPE_BOOLEAN) {
       bool value = false;
-      if (meta_data_get_boolean(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%s", key, value ? "true" : "false");
+      if (meta_data_get_boolean(meta, key, &value) == 0) {
+        json_add_meta_key(out, &first, key);
+        if (value)
+          JSON_ADD_LITERAL(out, "true");
+        else
+          JSON_ADD_LITERAL(out, "false");
+      }
     }
   } /* for (keys) */
 
-  if (offset == 0)
-    return ENOENT;
-
-  buffer[0] = '{'; /* replace leading ',' */
-  BUFFER_ADD("}");
-
-#undef BUFFER_ADD
-
-  return 0;
-} /* }}} int meta_data_keys_to_json */
-
-static int meta_data_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                             meta_data_t *meta) {
-  char **keys = NULL;
-  size_t keys_num;
-  int status;
-
-  if ((buffer == NULL) || (buffer_size == 0) || (meta == NULL))
-    return EINVAL;
-
-  status = meta_data_toc(meta, &keys);
-  if (status <= 0)
-    return status;
-  keys_num = (size_t)status;
-
-  status = meta_data_keys_to_json(buffer, buffer_size, meta, keys, keys_num);
+  if (!first)
+    JSON_ADD_LITERAL(out, "}");
 
   for (size_t i = 0; i < keys_num; ++i)
     sfree(keys[i]);
   sfree(keys);
+} /* }}} void json_add_meta_data */
 
-  return status;
-} /* }}} int meta_data_to_json */
-
-static int value_list_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                              const data_set_t *ds, const value_list_t *vl,
-                              int store_rates) {
-  char temp[512];
-  size_t offset = 0;
-  int status;
-
-  memset(buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
+static int json_add_value_list(json_out_t *out, /* {{{ */
+                               const data_set_t *ds, const value_list_t *vl,
+                               int store_rates) {
   /* All value lists have a leading comma. The first one will be replaced with
    * a square bracket in `format_json_finalize'. */
-  BUFFER_ADD(",{");
+  JSON_ADD_LITERAL(out, ",{\"values\":");
 
-  status = values_to_json(temp, sizeof(temp), ds, vl, store_rates);
+  int status = json_add_values(out, ds, vl, store_rates);
   if (status != 0)
     return status;
-  BUFFER_ADD("\"values\":%s", temp);
 
-  status = dstypes_to_json(temp, sizeof(temp), ds);
-  if (status != 0)
-    return status;
-  BUFFER_ADD(",\"dstypes\":%s", temp);
-
-  status = dsnames_to_json(temp, sizeof(temp), ds);
-  if (status != 0)
-    return status;
-  BUFFER_ADD(",\"dsnames\":%s", temp);
-
-  BUFFER_ADD(",\"time\":%.3f", CDTIME_T_TO_DOUBLE(vl->time));
-  BUFFER_ADD(",\"interval\":%.3f", CDTIME_T_TO_DOUBLE(vl->interval));
-
-#define BUFFER_ADD_KEYVAL(key, value)                                          \
-  do {                                                                         \
-    status = json_escape_string(temp, sizeof(temp), (value));                  \
-    if (status != 0)                                                           \
-      return status;                                                           \
-    BUFFER_ADD(",\"%s\":%s", (key), temp);                                     \
-  } while (0)
-
-  BUFFER_ADD_KEYVAL("host", vl->host);
-  BUFFER_ADD_KEYVAL("plugin", vl->plugin);
-  BUFFER_ADD_KEYVAL("plugin_instance", vl->plugin_instance);
-  BUFFER_ADD_KEYVAL("type", vl->type);
-  BUFFER_ADD_KEYVAL("type_instance", vl->type_instance);
-
-  if (vl->meta != NULL) {
-    char meta_buffer[buffer_size];
-    memset(meta_buffer, 0, sizeof(meta_buffer));
-    status = meta_data_to_json(meta_buffer, sizeof(meta_buffer), vl->meta);
-    if (status != 0)
-      return status;
-
-    BUFFER_ADD(",\"meta\":%s", meta_buffer);
-  } /* if (vl->meta != NULL) */
+  JSON_ADD_LITERAL(out, ",\"dstypes\":[");
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    if (i > 0)
+      JSON_ADD_LITERAL(out, ",");
+    JSON_ADD_LITERAL(out, "\"");
+    json_add_str(out, DS_TYPE_TO_STRING(ds->ds[i].type));
+    JSON_ADD_LITERAL(out, "\"");
+  }
 
-  BUFFER_ADD("}");
+  JSON_ADD_LITERAL(out, "],\"dsnames\":[");
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    if (i > 0)
+      JSON_ADD_LITERAL(out, ",");
+    JSON_ADD_LITERAL(out, "\"");
+    json_add_str(out, ds->ds[i].name);
+    JSON_ADD_LITERAL(out, "\"");
+  }
 
-#undef BUFFER_ADD_KEYVAL
-#undef BUFFER_ADD
+  JSON_ADD_LITERAL(out, "],\"time\":");
+  json_add_double(out, "%.3f", CDTIME_T_TO_DOUBLE(vl->time));
+  JSON_ADD_LITERAL(out, ",\"interval\":");
+  json_add_double(out, "%.3f", CDTIME_T_TO_DOUBLE(vl->interval));
 
-  DEBUG("format_json: value_list_to_json: buffer = %s;", buffer);
+  JSON_ADD_LITERAL(out, ",\"host\":");
+  json_add_escaped(out, vl->host);
+  JSON_ADD_LITERAL(out, ",\"plugin\":");
+  json_add_escaped(out, vl->plugin);
+  JSON_ADD_LITERAL(out, ",\"plugin_instance\":");
+  json_add_escaped(out, vl->plugin_instance);
+  JSON_ADD_LITERAL(out, ",\"type\":");
+  json_add_escaped(out, vl->type);
+  JSON_ADD_LITERAL(out, ",\"type_instance\":");
+  json_add_escaped(out, vl->type_instance);
 
-  return 0;
-} /* }}} int value_list_to_json */
-
-static int format_json_value_list_nocheck(char *buffer, /* {{{ */
-                                          size_t *ret_buffer_fill,
-                                          size_t *ret_buffer_free,
-                                          const data_set_t *ds,
-                                          const value_list_t *vl,
-                                          int store_rates, size_t temp_size) {
-  char temp[temp_size];
-  int status;
-
-  status = value_list_to_json(temp, sizeof(temp), ds, vl, store_rates);
-  if (status != 0)
-    return status;
-  temp_size = strlen(temp);
+  if (vl->meta != NULL)
+    json_add_meta_data(out, vl->meta);
 
-  memcpy(buffer + (*ret_buffer_fill), temp, temp_size + 1);
-  (*ret_buffer_fill) += temp_size;
-  (*ret_buffer_free) -= temp_size;
+  JSON_ADD_LITERAL(out, "}");
 
-  return 0;
-} /* }}} int format_json_value_list_nocheck */
+  return out->overflow ? -ENOMEM : 0;
+} /* }}} int json_add_value_list */
 
 int format_json_initialize(char *buffer, /* {{{ */
                            size_t *ret_buffer_fill, size_t *ret_buffer_free) {
@@ -422,7 +337,9 @@ int format_json_initialize(char *buffer, /* {{{ */
   if (buffer_free < 3)
     return -ENOMEM;
 
-  memset(buffer, 0, buffer_free);
+  /* The encoder keeps the output null terminated, so there is no need to
+   * clear the whole buffer. */
+  buffer[0] = 0;
   *ret_buffer_fill = buffer_fill;
   *ret_buffer_free = buffer_free;
 
@@ -440,7 +357,7 @@ int format_json_finalize(char *buffer, /* {{{ */
   if (*ret_buffer_free < 2)
     return -ENOMEM;
 
-  /* Replace the leading comma added in `value_list_to_json' with a square
+  /* Replace the leading comma added in `json_add_value_list' with a square
    * bracket. */
   if (buffer[0] != ',')
     return -EINVAL;
@@ -467,9 +384,24 @@ int format_json_value_list(char *buffer, /* {{{ */
   if (*ret_buffer_free < 3)
     return -ENOMEM;
 
-  return format_json_value_list_nocheck(buffer, ret_buffer_fill,
-                                        ret_buffer_free, ds, vl, store_rates,
-                                        (*ret_buffer_free) - 2);
+  /* Leave room for the closing bracket added by `format_json_finalize'. */
+  json_out_t out = {
+      .buffer = buffer + (*ret_buffer_fill),
+      .size = (*ret_buffer_free) - 2,
+  };
+
+  int status = json_add_value_list(&out, ds, vl, store_rates);
+  if (status != 0) {
+    /* Discard the partial output. */
+    out.buffer[0] = 0;
+    return status;
+  }
+
+  out.buffer[out.pos] = 0;
+  (*ret_buffer_fill) += out.pos;
+  (*ret_buffer_free) -= out.pos;
+
+  return 0;
 } /* }}} int format_json_value_list */
 
 #if HAVE_LIBYAJL
@@ -176,8 +176,56 @@ DEF_TEST(notification) {
   return expect_json_labels(got, labels, STATIC_ARRAY_SIZE(labels));
 }
 
+DEF_TEST(value_list) {
+  data_set_t ds = {
+      .type = "single",
+      .ds_num = 1,
+      .ds = &(data_source_t){"value", DS_TYPE_DERIVE, 0, NAN},
+  };
+  value_list_t vl = {
+      .values = &(value_t){.derive = -42},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T_STATIC(1480063672),
+      .interval = TIME_T_TO_CDTIME_T_STATIC(10),
+      .host = "example.com",
+      .plugin = "test",
+      .plugin_instance = "a\"b\\c",
+      .type = "single",
+  };
+  char const *want_one =
+      "{\"values\":[-42],\"dstypes\":[\"derive\"],\"dsnames\":[\"value\"],"
+      "\"time\":1480063672.000,\"interval\":10.000,\"host\":\"example.com\","
+      "\"plugin\":\"test\",\"plugin_instance\":\"a\\\"b\\\\c\","
+      "\"type\":\"single\",\"type_instance\":\"\"}";
+
+  char want[1024];
+  snprintf(want, sizeof(want), "[%s,%s]", want_one, want_one);
+
+  char got[1024];
+  size_t fill = 0;
+  size_t free = sizeof(got);
+  CHECK_ZERO(format_json_initialize(got, &fill, &free));
+  CHECK_ZERO(format_json_value_list(got, &fill, &free, &ds, &vl, 0));
+  CHECK_ZERO(format_json_value_list(got, &fill, &free, &ds, &vl, 0));
+  CHECK_ZERO(format_json_finalize(got, &fill, &free));
+  EXPECT_EQ_STR(want, got);
+  EXPECT_EQ_UINT64(strlen(want), fill);
+
+  /* A value list which does not fit leaves the buffer unchanged. */
+  fill = 0;
+  free = strlen(want_one) + 2;
+  CHECK_ZERO(format_json_initialize(got, &fill, &free));
+  EXPECT_EQ_INT(-ENOMEM, format_json_value_list(got, &fill, &free, &ds, &vl,
+                                                0));
+  EXPECT_EQ_UINT64(0, fill);
+  EXPECT_EQ_STR("", got);
+
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(notification);
+  RUN_TEST(value_list);
 
   END_TEST;
 }
@@ -0,0 +1,129 @@
+/**
+ * collectd - src/utils_histogram.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_histogram.h"
+
+int histogram_meta_add(meta_data_t *meta, histogram_t const *h) /* {{{ */
+{
+  if ((meta == NULL) || (h == NULL))
+    return EINVAL;
+
+  int status = meta_data_add_unsigned_int(meta, HISTOGRAM_META_COUNT, h->count);
+  if (status == 0)
+    status = meta_data_add_double(meta, HISTOGRAM_META_SUM, h->sum);
+
+  for (size_t i = 0; (status == 0) && (i < h->buckets_num); i++) {
+    char key[64];
+    snprintf(key, sizeof(key), HISTOGRAM_META_BUCKET_PREFIX "%.9g",
+             h->buckets[i].upper_bound);
+    status = meta_data_add_unsigned_int(meta, key,
+                                        h->buckets[i].cumulative_count);
+  }
+
+  return (status == 0) ? 0 : ENOMEM;
+} /* }}} int histogram_meta_add */
+
+static int histogram_bucket_cmp(void const *a, void const *b) /* {{{ */
+{
+  histogram_bucket_t const *b_a = a;
+  histogram_bucket_t const *b_b = b;
+
+  if (b_a->upper_bound < b_b->upper_bound)
+    return -1;
+  else if (b_a->upper_bound > b_b->upper_bound)
+    return 1;
+  return 0;
+} /* }}} int histogram_bucket_cmp */
+
+int histogram_meta_get(meta_data_t *meta, histogram_t *h) /* {{{ */
+{
+  if (h == NULL)
+    return EINVAL;
+  memset(h, 0, sizeof(*h));
+
+  if ((meta == NULL) || (meta_data_exists(meta, HISTOGRAM_META_COUNT) <= 0))
+    return ENOENT;
+
+  if ((meta_data_get_unsigned_int(meta, HISTOGRAM_META_COUNT, &h->count) !=
+       0) ||
+      (meta_data_get_double(meta, HISTOGRAM_META_SUM, &h->sum) != 0))
+    return EINVAL;
+
+  char **toc = NULL;
+  int toc_num = meta_data_toc(meta, &toc);
+  if (toc_num < 0)
+    return ENOMEM;
+
+  size_t prefix_len = strlen(HISTOGRAM_META_BUCKET_PREFIX);
+  int status = 0;
+  for (int i = 0; i < toc_num; i++) {
+    if ((status != 0) ||
+        (strncmp(toc[i], HISTOGRAM_META_BUCKET_PREFIX, prefix_len) != 0)) {
+      sfree(toc[i]);
+      continue;
+    }
+
+    histogram_bucket_t b = {0};
+    char *endptr = NULL;
+    b.upper_bound = strtod(toc[i] + prefix_len, &endptr);
+    if ((endptr == toc[i] + prefix_len) || (*endptr != 0) ||
+        (meta_data_get_unsigned_int(meta, toc[i], &b.cumulative_count) != 0)) {
+      P_WARNING("histogram_meta_get: Ignoring invalid bucket \"%s\".", toc[i]);
+      sfree(toc[i]);
+      continue;
+    }
+
+    histogram_bucket_t *tmp =
+        realloc(h->buckets, (h->buckets_num + 1) * sizeof(*h->buckets));
+    if (tmp == NULL) {
+      status = ENOMEM;
+    } else {
+      h->buckets = tmp;
+      h->buckets[h->buckets_num] = b;
+      h->buckets_num++;
+    }
+    sfree(toc[i]);
+  }
+  sfree(toc);
+
+  if (status != 0) {
+    histogram_reset(h);
+    return status;
+  }
+
+  qsort(h->buckets, h->buckets_num, sizeof(*h->buckets), histogram_bucket_cmp);
+  return 0;
+} /* }}} int histogram_meta_get */
+
+void histogram_reset(histogram_t *h) /* {{{ */
+{
+  if (h == NULL)
+    return;
+
+  sfree(h->buckets);
+  memset(h, 0, sizeof(*h));
+} /* }}} void histogram_reset */
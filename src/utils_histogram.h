@@ -0,0 +1,100 @@
+/**
+ * collectd - src/utils_histogram.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_HISTOGRAM_H
+#define UTILS_HISTOGRAM_H 1
+
+#include "meta_data.h"
+
+#include <stdint.h>
+
+/*
+ * Histograms in value lists
+ *
+ * A value list can carry a histogram of the events it accounts for in its meta
+ * data, so that write plugins which support histograms can export the
+ * distribution instead of one value per percentile. The histogram is stored in
+ * the following entries:
+ *
+ *   "histogram:count"     unsigned int  number of events
+ *   "histogram:sum"       double        sum of all events
+ *   "histogram:le:<x>"    unsigned int  number of events less than or equal
+ *                                       to <x>, one per bucket
+ *
+ * Counts and sums are cumulative, i.e. never reset, like a DERIVE value.
+ */
+
+#define HISTOGRAM_META_COUNT "histogram:count"
+#define HISTOGRAM_META_SUM "histogram:sum"
+#define HISTOGRAM_META_BUCKET_PREFIX "histogram:le:"
+
+struct histogram_bucket_s {
+  double upper_bound;
+  uint64_t cumulative_count;
+};
+typedef struct histogram_bucket_s histogram_bucket_t;
+
+struct histogram_s {
+  histogram_bucket_t *buckets; /* ordered by upper_bound */
+  size_t buckets_num;
+  uint64_t count;
+  double sum;
+};
+typedef struct histogram_s histogram_t;
+
+/*
+ * NAME
+ *   histogram_meta_add
+ *
+ * DESCRIPTION
+ *   Stores a histogram in the meta data of a value list.
+ *
+ * RETURN VALUE
+ *   Zero on success, an errno value otherwise.
+ */
+int histogram_meta_add(meta_data_t *meta, histogram_t const *h);
+
+/*
+ * NAME
+ *   histogram_meta_get
+ *
+ * DESCRIPTION
+ *   Reads the histogram stored in meta data by histogram_meta_add(). The
+ *   buckets are allocated and have to be freed with histogram_reset().
+ *
+ * RETURN VALUE
+ *   Zero on success, ENOENT if the meta data does not contain a histogram, or
+ *   another errno value otherwise.
+ */
+int histogram_meta_get(meta_data_t *meta, histogram_t *h);
+
+/*
+ * NAME
+ *   histogram_reset
+ *
+ * DESCRIPTION
+ *   Frees the buckets of a histogram and zeroes it.
+ */
+void histogram_reset(histogram_t *h);
+
+#endif /* UTILS_HISTOGRAM_H */
@@ -0,0 +1,85 @@
+/**
+ * collectd - src/utils_histogram_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+#include "collectd.h"
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+
+#include "testing.h"
+#include "utils_histogram.h"
+
+DEF_TEST(roundtrip) {
+  /* The buckets are added out of order on purpose. */
+  histogram_bucket_t buckets[] = {
+      {.upper_bound = 0.5, .cumulative_count = 7},
+      {.upper_bound = 0.01, .cumulative_count = 2},
+      {.upper_bound = 0.1, .cumulative_count = 5},
+  };
+  histogram_t h = {
+      .buckets = buckets,
+      .buckets_num = STATIC_ARRAY_SIZE(buckets),
+      .count = 8,
+      .sum = 1.25,
+  };
+
+  meta_data_t *meta = meta_data_create();
+  CHECK_NOT_NULL(meta);
+  EXPECT_EQ_INT(0, histogram_meta_add(meta, &h));
+  /* Unrelated entries are ignored. */
+  EXPECT_EQ_INT(0, meta_data_add_string(meta, "foo", "bar"));
+
+  histogram_t got = {0};
+  EXPECT_EQ_INT(0, histogram_meta_get(meta, &got));
+  EXPECT_EQ_UINT64(8, got.count);
+  EXPECT_EQ_DOUBLE(1.25, got.sum);
+  EXPECT_EQ_INT(3, (int)got.buckets_num);
+
+  double want_bounds[] = {0.01, 0.1, 0.5};
+  uint64_t want_counts[] = {2, 5, 7};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(want_bounds); i++) {
+    EXPECT_EQ_DOUBLE(want_bounds[i], got.buckets[i].upper_bound);
+    EXPECT_EQ_UINT64(want_counts[i], got.buckets[i].cumulative_count);
+  }
+
+  histogram_reset(&got);
+  EXPECT_EQ_PTR(NULL, got.buckets);
+  meta_data_destroy(meta);
+  return 0;
+}
+
+DEF_TEST(missing) {
+  histogram_t got = {0};
+
+  EXPECT_EQ_INT(ENOENT, histogram_meta_get(NULL, &got));
+
+  meta_data_t *meta = meta_data_create();
+  CHECK_NOT_NULL(meta);
+  EXPECT_EQ_INT(ENOENT, histogram_meta_get(meta, &got));
+  meta_data_destroy(meta);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(roundtrip);
+  RUN_TEST(missing);
+
+  END_TEST;
+}
@@ -0,0 +1,153 @@
+/**
+ * collectd - src/utils_hll.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "utils_hll.h"
+
+#include <math.h>
+
+/* The finalizer of MurmurHash3: every input bit affects every output bit. */
+static uint32_t hll_mix(uint32_t h) /* {{{ */
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+} /* }}} uint32_t hll_mix */
+
+struct c_hll_var_s {
+  int precision;
+  uint8_t registers[];
+};
+
+static bool hll_add(uint8_t *registers, int precision, /* {{{ */
+                    uint32_t hash) {
+  hash = hll_mix(hash);
+
+  /* The upper bits select the register, the others are stored as the
+   * position of their first set bit. */
+  uint32_t index = hash >> (32 - precision);
+  uint32_t rest = hash << precision;
+
+  uint8_t rank = 1;
+  while ((rank <= (32 - precision)) && ((rest & 0x80000000u) == 0)) {
+    rank++;
+    rest <<= 1;
+  }
+
+  if (registers[index] >= rank)
+    return false;
+
+  registers[index] = rank;
+  return true;
+} /* }}} bool hll_add */
+
+static void hll_merge(uint8_t *dst, uint8_t const *src, /* {{{ */
+                      size_t registers_num) {
+  for (size_t i = 0; i < registers_num; i++)
+    if (dst[i] < src[i])
+      dst[i] = src[i];
+} /* }}} void hll_merge */
+
+static double hll_count(uint8_t const *registers, /* {{{ */
+                        size_t registers_num) {
+  double const m = (double)registers_num;
+  double const alpha = 0.7213 / (1.0 + 1.079 / m);
+
+  double sum = 0.0;
+  size_t zeros = 0;
+  for (size_t i = 0; i < registers_num; i++) {
+    sum += ldexp(1.0, -(int)registers[i]);
+    if (registers[i] == 0)
+      zeros++;
+  }
+
+  double estimate = alpha * m * m / sum;
+
+  /* Small range correction: linear counting is more accurate while many
+   * registers are still empty. */
+  if ((estimate <= 2.5 * m) && (zeros != 0))
+    estimate = m * log(m / (double)zeros);
+
+  return estimate;
+} /* }}} double hll_count */
+
+void c_hll_reset(c_hll_t *h) /* {{{ */
+{
+  memset(h->registers, 0, sizeof(h->registers));
+} /* }}} void c_hll_reset */
+
+bool c_hll_add(c_hll_t *h, uint32_t hash) /* {{{ */
+{
+  return hll_add(h->registers, HLL_PRECISION, hash);
+} /* }}} bool c_hll_add */
+
+void c_hll_merge(c_hll_t *dst, c_hll_t const *src) /* {{{ */
+{
+  hll_merge(dst->registers, src->registers, HLL_REGISTERS);
+} /* }}} void c_hll_merge */
+
+double c_hll_count(c_hll_t const *h) /* {{{ */
+{
+  return hll_count(h->registers, HLL_REGISTERS);
+} /* }}} double c_hll_count */
+
+c_hll_var_t *c_hll_var_create(int precision) /* {{{ */
+{
+  if ((precision < HLL_PRECISION_MIN) || (precision > HLL_PRECISION_MAX))
+    return NULL;
+
+  c_hll_var_t *h = calloc(1, sizeof(*h) + (((size_t)1) << precision));
+  if (h == NULL)
+    return NULL;
+
+  h->precision = precision;
+  return h;
+} /* }}} c_hll_var_t *c_hll_var_create */
+
+void c_hll_var_destroy(c_hll_var_t *h) /* {{{ */
+{
+  free(h);
+} /* }}} void c_hll_var_destroy */
+
+void c_hll_var_add(c_hll_var_t *h, uint32_t hash) /* {{{ */
+{
+  hll_add(h->registers, h->precision, hash);
+} /* }}} void c_hll_var_add */
+
+int c_hll_var_merge(c_hll_var_t *dst, c_hll_var_t const *src) /* {{{ */
+{
+  if (dst->precision != src->precision)
+    return EINVAL;
+
+  hll_merge(dst->registers, src->registers, ((size_t)1) << dst->precision);
+  return 0;
+} /* }}} int c_hll_var_merge */
+
+double c_hll_var_count(c_hll_var_t const *h) /* {{{ */
+{
+  return hll_count(h->registers, ((size_t)1) << h->precision);
+} /* }}} double c_hll_var_count */
@@ -0,0 +1,132 @@
+/**
+ * collectd - src/utils_hll.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_HLL_H
+#define UTILS_HLL_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * HyperLogLog sketch
+ *
+ * Estimates the number of distinct 32-bit hashes added to it in a fixed
+ * amount of memory. With 2^HLL_PRECISION registers, the standard error is
+ * about 1.04 / sqrt(2^HLL_PRECISION), i.e. 3.3%.
+ */
+
+#define HLL_PRECISION 10
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+struct c_hll_s {
+  uint8_t registers[HLL_REGISTERS];
+};
+typedef struct c_hll_s c_hll_t;
+
+/*
+ * NAME
+ *   c_hll_reset
+ *
+ * DESCRIPTION
+ *   Empties the sketch. A zeroed c_hll_t is empty, too.
+ */
+void c_hll_reset(c_hll_t *h);
+
+/*
+ * NAME
+ *   c_hll_add
+ *
+ * DESCRIPTION
+ *   Adds a hash, e.g. an identifier's "identifier.hash", to the sketch. The
+ *   hash is mixed again, so it does not need to be uniformly distributed.
+ *
+ * RETURN VALUE
+ *   True if the sketch changed, i.e. if c_hll_count() may return a different
+ *   estimate now.
+ */
+bool c_hll_add(c_hll_t *h, uint32_t hash);
+
+/*
+ * NAME
+ *   c_hll_merge
+ *
+ * DESCRIPTION
+ *   Adds all hashes added to "src" to "dst".
+ */
+void c_hll_merge(c_hll_t *dst, c_hll_t const *src);
+
+/*
+ * NAME
+ *   c_hll_count
+ *
+ * DESCRIPTION
+ *   Returns the estimated number of distinct hashes added to the sketch.
+ */
+double c_hll_count(c_hll_t const *h);
+
+/*
+ * Variable precision HyperLogLog sketch
+ *
+ * Like c_hll_t, but with 2^precision registers, "precision" being chosen at
+ * run time. The standard error is about 1.04 / sqrt(2^precision), e.g. 0.8%
+ * with a precision of 14, which takes 16 KiB.
+ */
+
+#define HLL_PRECISION_MIN 4
+#define HLL_PRECISION_MAX 16
+
+struct c_hll_var_s;
+typedef struct c_hll_var_s c_hll_var_t;
+
+/*
+ * NAME
+ *   c_hll_var_create
+ *
+ * DESCRIPTION
+ *   Allocates an empty sketch with 2^precision registers. "precision" must be
+ *   between HLL_PRECISION_MIN and HLL_PRECISION_MAX.
+ *
+ * RETURN VALUE
+ *   A c_hll_var_t-pointer upon success or NULL upon failure.
+ */
+c_hll_var_t *c_hll_var_create(int precision);
+
+void c_hll_var_destroy(c_hll_var_t *h);
+
+void c_hll_var_add(c_hll_var_t *h, uint32_t hash);
+
+/*
+ * NAME
+ *   c_hll_var_merge
+ *
+ * DESCRIPTION
+ *   Adds all hashes added to "src" to "dst".
+ *
+ * RETURN VALUE
+ *   Zero upon success, EINVAL if the sketches differ in precision.
+ */
+int c_hll_var_merge(c_hll_var_t *dst, c_hll_var_t const *src);
+
+double c_hll_var_count(c_hll_var_t const *h);
+
+#endif /* UTILS_HLL_H */
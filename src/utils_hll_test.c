@@ -0,0 +1,129 @@
+/**
+ * collectd - src/utils_hll_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+
+#include "testing.h"
+#include "utils_hll.h"
+
+/* Three times the standard error of 2^HLL_PRECISION registers. */
+#define HLL_TOLERANCE 0.1
+
+DEF_TEST(empty) {
+  c_hll_t h = {{0}};
+
+  EXPECT_EQ_DOUBLE(0.0, c_hll_count(&h));
+
+  /* Duplicates are only counted once and don't change the sketch. */
+  OK(c_hll_add(&h, 42));
+  for (int i = 0; i < 100; i++)
+    OK(!c_hll_add(&h, 42));
+  OK(c_hll_count(&h) > 0.5);
+  OK(c_hll_count(&h) < 1.5);
+
+  c_hll_reset(&h);
+  EXPECT_EQ_DOUBLE(0.0, c_hll_count(&h));
+  return 0;
+}
+
+DEF_TEST(count) {
+  uint32_t sizes[] = {10, 100, 1000, 10000, 100000};
+  c_hll_t h = {{0}};
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(sizes); i++) {
+    c_hll_reset(&h);
+    /* Sequential hashes, like similar identifiers may produce. Each is added
+     * twice. */
+    for (uint32_t j = 0; j < 2 * sizes[i]; j++)
+      c_hll_add(&h, j / 2);
+
+    double got = c_hll_count(&h);
+    printf("# %" PRIu32 " distinct hashes: estimate %g\n", sizes[i], got);
+    OK(got > (1.0 - HLL_TOLERANCE) * (double)sizes[i]);
+    OK(got < (1.0 + HLL_TOLERANCE) * (double)sizes[i]);
+  }
+
+  return 0;
+}
+
+DEF_TEST(merge) {
+  c_hll_t a = {{0}};
+  c_hll_t b = {{0}};
+
+  /* 0 - 5999 and 4000 - 9999 overlap: 10000 distinct hashes. */
+  for (uint32_t i = 0; i < 6000; i++)
+    c_hll_add(&a, i);
+  for (uint32_t i = 4000; i < 10000; i++)
+    c_hll_add(&b, i);
+
+  c_hll_merge(&a, &b);
+  double got = c_hll_count(&a);
+  OK(got > (1.0 - HLL_TOLERANCE) * 10000.0);
+  OK(got < (1.0 + HLL_TOLERANCE) * 10000.0);
+  return 0;
+}
+
+DEF_TEST(var) {
+  c_hll_var_t *a;
+  c_hll_var_t *b;
+
+  EXPECT_EQ_PTR(NULL, c_hll_var_create(HLL_PRECISION_MIN - 1));
+  EXPECT_EQ_PTR(NULL, c_hll_var_create(HLL_PRECISION_MAX + 1));
+
+  CHECK_NOT_NULL(a = c_hll_var_create(14));
+  CHECK_NOT_NULL(b = c_hll_var_create(14));
+  EXPECT_EQ_DOUBLE(0.0, c_hll_var_count(a));
+
+  for (uint32_t i = 0; i < 60000; i++)
+    c_hll_var_add(a, i);
+  for (uint32_t i = 40000; i < 100000; i++)
+    c_hll_var_add(b, i);
+
+  /* A precision of 14 has a standard error of 0.8%. */
+  double got = c_hll_var_count(a);
+  OK(got > 0.975 * 60000.0);
+  OK(got < 1.025 * 60000.0);
+
+  EXPECT_EQ_INT(0, c_hll_var_merge(a, b));
+  got = c_hll_var_count(a);
+  OK(got > 0.975 * 100000.0);
+  OK(got < 1.025 * 100000.0);
+
+  c_hll_var_destroy(b);
+  CHECK_NOT_NULL(b = c_hll_var_create(12));
+  EXPECT_EQ_INT(EINVAL, c_hll_var_merge(a, b));
+
+  c_hll_var_destroy(a);
+  c_hll_var_destroy(b);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(empty);
+  RUN_TEST(count);
+  RUN_TEST(merge);
+  RUN_TEST(var);
+
+  END_TEST;
+}
@@ -46,6 +46,11 @@
  * the information whether this entry would be collected or not:
  *   if (ignorelist_match (myconfig_ignore, thisentry))
  *     return;
+ *
+ * Literal entries are kept in a hash table and all regular expressions are
+ * combined into one, so a match doesn't depend on the number of entries. The
+ * result of the regular expressions is cached per entry name, because plugins
+ * look up the same device names in each interval.
  **/
 
 #if HAVE_CONFIG_H
@@ -62,15 +67,44 @@
 struct ignorelist_item_s {
 #if HAVE_REGEX_H
   regex_t *rmatch; /* regular expression entry identification */
+  char *rsource;   /* source of the regular expression */
 #endif
   char *smatch; /* string entry identification */
+  uint32_t hash;
+  struct ignorelist_item_s *hash_next;
   struct ignorelist_item_s *next;
 };
 typedef struct ignorelist_item_s ignorelist_item_t;
 
+#if HAVE_REGEX_H
+/* Upper limit of the number of cached regex results. Once it is reached the
+ * cache is flushed, so that short-lived devices don't grow it forever. */
+#define IGNORELIST_CACHE_MAX 4096
+
+struct ignorelist_cache_s {
+  char *name;
+  uint32_t hash;
+  bool match;
+};
+typedef struct ignorelist_cache_s ignorelist_cache_t;
+#endif
+
 struct ignorelist_s {
   int ignore;              /* ignore entries */
   ignorelist_item_t *head; /* pointer to the first entry */
+
+  /* Index built from the list by the first match after an entry was added. */
+  pthread_mutex_t lock;
+  bool dirty;
+  ignorelist_item_t **strings; /* hash table of the string entries */
+  uint32_t strings_mask;
+#if HAVE_REGEX_H
+  size_t regex_num;
+  regex_t *combined; /* all regex entries, NULL if they don't combine */
+  ignorelist_cache_t *cache; /* open addressing, size is cache_mask + 1 */
+  uint32_t cache_mask;
+  size_t cache_num;
+#endif
 };
 
 /* *** *** *** ********************************************* *** *** *** */
@@ -83,6 +117,10 @@ static inline void ignorelist_append(ignorelist_t *il,
 
   item->next = il->head;
   il->head = item;
+
+  pthread_mutex_lock(&il->lock);
+  il->dirty = true;
+  pthread_mutex_unlock(&il->lock);
 }
 
 #if HAVE_REGEX_H
@@ -97,7 +135,7 @@ static int ignorelist_append_regex(ignorelist_t *il, const char *re_str) {
     return ENOMEM;
   }
 
-  status = regcomp(re, re_str, REG_EXTENDED);
+  status = regcomp(re, re_str, REG_EXTENDED | REG_NOSUB);
   if (status != 0) {
     char errbuf[1024];
     (void)regerror(status, re, errbuf, sizeof(errbuf));
@@ -117,6 +155,7 @@ static int ignorelist_append_regex(ignorelist_t *il, const char *re_str) {
     return ENOMEM;
   }
   entry->rmatch = re;
+  entry->rsource = sstrdup(re_str);
 
   ignorelist_append(il, entry);
   return 0;
@@ -132,6 +171,7 @@ static int ignorelist_append_string(ignorelist_t *il, const char *entry) {
     return 1;
   }
   new->smatch = sstrdup(entry);
+  new->hash = identifier_hash(entry);
 
   /* append new entry */
   ignorelist_append(il, new);
@@ -139,36 +179,217 @@ static int ignorelist_append_string(ignorelist_t *il, const char *entry) {
   return 0;
 } /* int ignorelist_append_string(ignorelist_t *il, const char *entry) */
 
+#if HAVE_REGEX_H
+static void ignorelist_cache_clear(ignorelist_t *il) {
+  if (il->cache != NULL) {
+    for (uint32_t i = 0; i <= il->cache_mask; i++)
+      sfree(il->cache[i].name);
+  }
+  sfree(il->cache);
+  il->cache_mask = 0;
+  il->cache_num = 0;
+} /* void ignorelist_cache_clear */
+
+/* Returns the cache slot of "entry": either the slot holding it, or the empty
+ * slot it would be stored in. Returns NULL if the cache is empty. */
+static ignorelist_cache_t *ignorelist_cache_slot(ignorelist_t *il,
+                                                 const char *entry,
+                                                 uint32_t hash) {
+  if (il->cache == NULL)
+    return NULL;
+
+  for (uint32_t i = hash & il->cache_mask;; i = (i + 1) & il->cache_mask) {
+    ignorelist_cache_t *c = il->cache + i;
+    if (c->name == NULL)
+      return c;
+    if ((c->hash == hash) && (strcmp(c->name, entry) == 0))
+      return c;
+  }
+} /* ignorelist_cache_t *ignorelist_cache_slot */
+
+static void ignorelist_cache_add(ignorelist_t *il, const char *entry,
+                                 uint32_t hash, bool match) {
+  if ((2 * (il->cache_num + 1)) > (il->cache_mask + 1)) {
+    uint32_t size = (il->cache == NULL) ? 64 : 2 * (il->cache_mask + 1);
+    if ((size / 2) > IGNORELIST_CACHE_MAX) {
+      ignorelist_cache_clear(il);
+      size = 64;
+    }
+
+    ignorelist_cache_t *old = il->cache;
+    uint32_t old_size = (old == NULL) ? 0 : il->cache_mask + 1;
+
+    il->cache = calloc(size, sizeof(*il->cache));
+    if (il->cache == NULL) {
+      il->cache = old;
+      return;
+    }
+    il->cache_mask = size - 1;
+
+    for (uint32_t i = 0; i < old_size; i++) {
+      if (old[i].name == NULL)
+        continue;
+      *ignorelist_cache_slot(il, old[i].name, old[i].hash) = old[i];
+    }
+    sfree(old);
+  }
+
+  char *name = strdup(entry);
+  if (name == NULL)
+    return;
+
+  ignorelist_cache_t *c = ignorelist_cache_slot(il, entry, hash);
+  *c = (ignorelist_cache_t){.name = name, .hash = hash, .match = match};
+  il->cache_num++;
+} /* void ignorelist_cache_add */
+
+/* Combines all regular expressions into "(re0)|(re1)|...". If that fails,
+ * they are matched one after the other. Back-references (a GNU extension)
+ * would refer to the wrong group in the combined expression. */
+static void ignorelist_combine_regex(ignorelist_t *il) {
+  size_t len = 0;
+  for (ignorelist_item_t *i = il->head; i != NULL; i = i->next) {
+    if (i->rmatch == NULL)
+      continue;
+    for (const char *c = strchr(i->rsource, '\\'); c != NULL;
+         c = strchr(c + 2, '\\')) {
+      if (isdigit((unsigned char)c[1]))
+        return;
+      if (c[1] == 0)
+        break;
+    }
+    len += strlen(i->rsource) + strlen("()|");
+  }
+
+  char *source = malloc(len + 1);
+  if (source == NULL)
+    return;
+
+  size_t offset = 0;
+  for (ignorelist_item_t *i = il->head; i != NULL; i = i->next) {
+    if (i->rmatch == NULL)
+      continue;
+    offset += (size_t)snprintf(source + offset, len + 1 - offset, "%s(%s)",
+                               (offset == 0) ? "" : "|", i->rsource);
+  }
+
+  il->combined = calloc(1, sizeof(*il->combined));
+  if ((il->combined != NULL) &&
+      (regcomp(il->combined, source, REG_EXTENDED | REG_NOSUB) != 0)) {
+    DEBUG("ignorelist_combine_regex: Combining %" PRIsz
+          " regular expressions failed, matching them one by one.",
+          il->regex_num);
+    sfree(il->combined);
+  }
+  sfree(source);
+} /* void ignorelist_combine_regex */
+#endif
+
+/* Builds the hash table of the string entries and the combined regular
+ * expression. Called with the lock held. */
+static void ignorelist_index(ignorelist_t *il) {
+  size_t strings_num = 0;
+
+  sfree(il->strings);
+  il->strings_mask = 0;
+#if HAVE_REGEX_H
+  if (il->combined != NULL) {
+    regfree(il->combined);
+    sfree(il->combined);
+  }
+  ignorelist_cache_clear(il);
+  il->regex_num = 0;
+#endif
+
+  for (ignorelist_item_t *i = il->head; i != NULL; i = i->next) {
+#if HAVE_REGEX_H
+    if (i->rmatch != NULL) {
+      il->regex_num++;
+      continue;
+    }
+#endif
+    strings_num++;
+  }
+
+  if (strings_num > 0) {
+    uint32_t size = 16;
+    while (size < 2 * strings_num)
+      size *= 2;
+
+    il->strings = calloc(size, sizeof(*il->strings));
+    if (il->strings != NULL) {
+      il->strings_mask = size - 1;
+      for (ignorelist_item_t *i = il->head; i != NULL; i = i->next) {
+        if (i->smatch == NULL)
+          continue;
+        uint32_t bucket = i->hash & il->strings_mask;
+        i->hash_next = il->strings[bucket];
+        il->strings[bucket] = i;
+      }
+    }
+  }
+
+#if HAVE_REGEX_H
+  if (il->regex_num > 1)
+    ignorelist_combine_regex(il);
+#endif
+
+  il->dirty = false;
+} /* void ignorelist_index */
+
 #if HAVE_REGEX_H
 /*
  * check list for entry regex match
  * return 1 if found
  */
-static int ignorelist_match_regex(ignorelist_item_t *item, const char *entry) {
-  assert((item != NULL) && (item->rmatch != NULL) && (entry != NULL) &&
-         (strlen(entry) > 0));
+static int ignorelist_match_regex(ignorelist_t *il, const char *entry,
+                                  uint32_t hash) {
+  assert((il != NULL) && (entry != NULL) && (strlen(entry) > 0));
 
-  /* match regex */
-  if (regexec(item->rmatch, entry, 0, NULL, 0) == 0)
-    return 1;
+  if (il->regex_num == 0)
+    return 0;
 
-  return 0;
-} /* int ignorelist_match_regex (ignorelist_item_t *item, const char *entry) */
+  ignorelist_cache_t *c = ignorelist_cache_slot(il, entry, hash);
+  if ((c != NULL) && (c->name != NULL))
+    return c->match ? 1 : 0;
+
+  bool match = false;
+  if (il->combined != NULL) {
+    match = (regexec(il->combined, entry, 0, NULL, 0) == 0);
+  } else {
+    for (ignorelist_item_t *i = il->head; (i != NULL) && !match; i = i->next)
+      if (i->rmatch != NULL)
+        match = (regexec(i->rmatch, entry, 0, NULL, 0) == 0);
+  }
+
+  ignorelist_cache_add(il, entry, hash, match);
+  return match ? 1 : 0;
+} /* int ignorelist_match_regex (ignorelist_t *il, const char *entry) */
 #endif
 
 /*
  * check list for entry string match
  * return 1 if found
  */
-static int ignorelist_match_string(ignorelist_item_t *item, const char *entry) {
-  assert((item != NULL) && (item->smatch != NULL) && (entry != NULL) &&
-         (strlen(entry) > 0));
+static int ignorelist_match_string(ignorelist_t *il, const char *entry,
+                                   uint32_t hash) {
+  assert((il != NULL) && (entry != NULL) && (strlen(entry) > 0));
+
+  if (il->strings != NULL) {
+    for (ignorelist_item_t *i = il->strings[hash & il->strings_mask];
+         i != NULL; i = i->hash_next)
+      if ((i->hash == hash) && (strcmp(entry, i->smatch) == 0))
+        return 1;
+    return 0;
+  }
 
-  if (strcmp(entry, item->smatch) == 0)
-    return 1;
+  /* The hash table couldn't be allocated. */
+  for (ignorelist_item_t *i = il->head; i != NULL; i = i->next)
+    if ((i->smatch != NULL) && (strcmp(entry, i->smatch) == 0))
+      return 1;
 
   return 0;
-} /* int ignorelist_match_string (ignorelist_item_t *item, const char *entry) */
+} /* int ignorelist_match_string (ignorelist_t *il, const char *entry) */
 
 /* *** *** *** ******************************************** *** *** *** */
 /* *** *** *** *** *** ***   public functions   *** *** *** *** *** *** */
@@ -190,6 +411,7 @@ ignorelist_t *ignorelist_create(int invert) {
    * ->ignore == 1  =>  ignore
    */
   il->ignore = invert ? 0 : 1;
+  pthread_mutex_init(&il->lock, NULL);
 
   return il;
 } /* ignorelist_t *ignorelist_create (int ignore) */
@@ -212,6 +434,7 @@ void ignorelist_free(ignorelist_t *il) {
       sfree(this->rmatch);
       this->rmatch = NULL;
     }
+    sfree(this->rsource);
 #endif
     if (this->smatch != NULL) {
       sfree(this->smatch);
@@ -220,9 +443,18 @@ void ignorelist_free(ignorelist_t *il) {
     sfree(this);
   }
 
+  sfree(il->strings);
+#if HAVE_REGEX_H
+  if (il->combined != NULL) {
+    regfree(il->combined);
+    sfree(il->combined);
+  }
+  ignorelist_cache_clear(il);
+#endif
+  pthread_mutex_destroy(&il->lock);
+
   sfree(il);
 } /* void ignorelist_destroy (ignorelist_t *il) */
-
 /*
  * set ignore state of the ignorelist_t
  */
@@ -290,20 +522,19 @@ int ignorelist_match(ignorelist_t *il, const char *entry) {
   if ((entry == NULL) || (strlen(entry) == 0))
     return 0;
 
-  /* traverse list and check entries */
-  for (ignorelist_item_t *traverse = il->head; traverse != NULL;
-       traverse = traverse->next) {
+  uint32_t hash = identifier_hash(entry);
+  int match;
+
+  pthread_mutex_lock(&il->lock);
+  if (il->dirty)
+    ignorelist_index(il);
+
+  match = ignorelist_match_string(il, entry, hash);
 #if HAVE_REGEX_H
-    if (traverse->rmatch != NULL) {
-      if (ignorelist_match_regex(traverse, entry))
-        return il->ignore;
-    } else
+  if (!match)
+    match = ignorelist_match_regex(il, entry, hash);
 #endif
-    {
-      if (ignorelist_match_string(traverse, entry))
-        return il->ignore;
-    }
-  } /* for traverse */
+  pthread_mutex_unlock(&il->lock);
 
-  return 1 - il->ignore;
+  return match ? il->ignore : 1 - il->ignore;
 } /* int ignorelist_match (ignorelist_t *il, const char *entry) */
@@ -0,0 +1,120 @@
+/**
+ * collectd - src/utils_ignorelist_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+
+#include "testing.h"
+#include "utils_ignorelist.h"
+
+DEF_TEST(string) {
+  ignorelist_t *il = ignorelist_create(/* invert = */ 0);
+  CHECK_NOT_NULL(il);
+
+  /* An empty list collects everything. */
+  EXPECT_EQ_INT(0, ignorelist_match(il, "eth0"));
+
+  /* Enough entries to need more than the initial hash table. */
+  for (int i = 0; i < 100; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "veth%d", i);
+    CHECK_ZERO(ignorelist_add(il, name));
+  }
+
+  EXPECT_EQ_INT(1, ignorelist_match(il, "veth0"));
+  EXPECT_EQ_INT(1, ignorelist_match(il, "veth99"));
+  EXPECT_EQ_INT(0, ignorelist_match(il, "veth100"));
+  EXPECT_EQ_INT(0, ignorelist_match(il, "veth"));
+  EXPECT_EQ_INT(0, ignorelist_match(il, ""));
+
+  /* Entries added after a match are found, too. */
+  CHECK_ZERO(ignorelist_add(il, "veth100"));
+  EXPECT_EQ_INT(1, ignorelist_match(il, "veth100"));
+
+  ignorelist_set_invert(il, 1);
+  EXPECT_EQ_INT(0, ignorelist_match(il, "veth1"));
+  EXPECT_EQ_INT(1, ignorelist_match(il, "eth0"));
+
+  ignorelist_free(il);
+  return 0;
+}
+
+DEF_TEST(regex) {
+  struct {
+    char const *entry;
+    int want;
+  } cases[] = {
+      {"sda", 1},     {"sda1", 1},   {"sdb", 0},      {"loop0", 1},
+      {"loop", 0},    {"dm-0", 1},   {"nvme0n1", 0},  {"ram12", 1},
+      {"abab", 1},    {"abba", 0},   {"lo", 1},       {"xloop1", 0},
+  };
+
+  for (int combine = 0; combine < 2; combine++) {
+    ignorelist_t *il = ignorelist_create(/* invert = */ 1);
+    CHECK_NOT_NULL(il);
+
+    CHECK_ZERO(ignorelist_add(il, "sda"));
+    CHECK_ZERO(ignorelist_add(il, "/^sda[0-9]+$/"));
+    CHECK_ZERO(ignorelist_add(il, "/^loop[0-9]/"));
+    CHECK_ZERO(ignorelist_add(il, "/^(dm|ram)-?[0-9]+$/"));
+    CHECK_ZERO(ignorelist_add(il, "lo"));
+    if (combine)
+      CHECK_ZERO(ignorelist_add(il, "/^abab$/"));
+    else /* A back-reference prevents combining the expressions. */
+      CHECK_ZERO(ignorelist_add(il, "/^(ab)\\1$/"));
+    OK(ignorelist_add(il, "/[/") != 0);
+
+    /* Twice, the second time the results come from the cache. */
+    for (int round = 0; round < 2; round++) {
+      for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+        printf("# entry = \"%s\", combine = %d, round = %d\n",
+               cases[i].entry, combine, round);
+        EXPECT_EQ_INT(cases[i].want, 1 - ignorelist_match(il, cases[i].entry));
+      }
+    }
+
+    /* More names than the cache holds. */
+    int failed = 0;
+    for (int i = 0; i < 10000; i++) {
+      char name[16];
+      snprintf(name, sizeof(name), "loop%d", i);
+      if (ignorelist_match(il, name) != 0)
+        failed++;
+      snprintf(name, sizeof(name), "sdc%d", i);
+      if (ignorelist_match(il, name) != 1)
+        failed++;
+    }
+    EXPECT_EQ_INT(0, failed);
+
+    ignorelist_free(il);
+  }
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(string);
+  RUN_TEST(regex);
+
+  END_TEST;
+}
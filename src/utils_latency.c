@@ -42,6 +42,12 @@
 #define HISTOGRAM_DEFAULT_BIN_WIDTH 1048576
 #endif
 
+#ifndef SKETCH_NUM_BINS
+/* With a relative accuracy of 1%, covers latencies from 1 ms to more than a
+ * week. */
+#define SKETCH_NUM_BINS 1024
+#endif
+
 struct latency_counter_s {
   cdtime_t start_time;
 
@@ -53,6 +59,17 @@ struct latency_counter_s {
 
   cdtime_t bin_width;
   int histogram[HISTOGRAM_NUM_BINS];
+
+  /* Only used by counters created with latency_counter_create_sketch(). The
+   * bin with key "k" counts the latencies in (gamma^(k-1), gamma^k], in
+   * cdtime_t units. sketch[0] holds the bin with key "sketch_offset". Keys
+   * below the range covered by the array are collapsed into sketch[0]. */
+  uint64_t *sketch;
+  double sketch_gamma;
+  double sketch_log_gamma;
+  int sketch_offset;
+  int sketch_key_min;
+  int sketch_key_max;
 };
 
 /*
@@ -72,19 +89,8 @@ struct latency_counter_s {
 * So, if the required bin width is 300, then new bin width will be 512 as it is
 * the next nearest power of 2.
 */
-static void change_bin_width(latency_counter_t *lc, cdtime_t latency) /* {{{ */
-{
-  /* This function is called because the new value is above histogram's range.
-   * First find the required bin width:
-   *           requiredBinWidth = (value + 1) / numBins
-   * then get the next nearest power of 2
-   *           newBinWidth = 2^(ceil(log2(requiredBinWidth)))
-   */
-  double required_bin_width =
-      ((double)(latency + 1)) / ((double)HISTOGRAM_NUM_BINS);
-  double required_bin_width_logbase2 = log(required_bin_width) / log(2.0);
-  cdtime_t new_bin_width =
-      (cdtime_t)(pow(2.0, ceil(required_bin_width_logbase2)) + .5);
+static void set_bin_width(latency_counter_t *lc, /* {{{ */
+                          cdtime_t new_bin_width) {
   cdtime_t old_bin_width = lc->bin_width;
 
   lc->bin_width = new_bin_width;
@@ -106,13 +112,134 @@ static void change_bin_width(latency_counter_t *lc, cdtime_t latency) /* {{{ */
       lc->histogram[i] = 0;
     }
   }
+} /* }}} void set_bin_width */
+
+static void change_bin_width(latency_counter_t *lc, cdtime_t latency) /* {{{ */
+{
+  /* This function is called because the new value is above histogram's range.
+   * First find the required bin width:
+   *           requiredBinWidth = (value + 1) / numBins
+   * then get the next nearest power of 2
+   *           newBinWidth = 2^(ceil(log2(requiredBinWidth)))
+   */
+  double required_bin_width =
+      ((double)(latency + 1)) / ((double)HISTOGRAM_NUM_BINS);
+  double required_bin_width_logbase2 = log(required_bin_width) / log(2.0);
+  cdtime_t new_bin_width =
+      (cdtime_t)(pow(2.0, ceil(required_bin_width_logbase2)) + .5);
 
   DEBUG("utils_latency: change_bin_width: latency = %.3f; "
         "old_bin_width = %.3f; new_bin_width = %.3f;",
-        CDTIME_T_TO_DOUBLE(latency), CDTIME_T_TO_DOUBLE(old_bin_width),
+        CDTIME_T_TO_DOUBLE(latency), CDTIME_T_TO_DOUBLE(lc->bin_width),
         CDTIME_T_TO_DOUBLE(new_bin_width));
+
+  set_bin_width(lc, new_bin_width);
 } /* }}} void change_bin_width */
 
+/*
+* The sketch is a DDSketch, described in "DDSketch: A Fast and Fully-Mergeable
+* Quantile Sketch with Relative-Error Guarantees" (Masson et al., 2019): the
+* bin boundaries grow exponentially, so that every quantile is returned with a
+* relative error of at most "alpha", where gamma = (1 + alpha) / (1 - alpha).
+* Two sketches with the same accuracy are merged by adding their bins.
+*/
+static int sketch_key(latency_counter_t const *lc, double latency) /* {{{ */
+{
+  return (int)ceil(log(latency) / lc->sketch_log_gamma);
+} /* }}} int sketch_key */
+
+/* Returns the latency each event in the bin with key "key" is assumed to
+ * have: the point having the same relative distance to both boundaries. */
+static cdtime_t sketch_value(latency_counter_t const *lc, int key) /* {{{ */
+{
+  return (cdtime_t)(2.0 * exp(((double)key) * lc->sketch_log_gamma) /
+                        (1.0 + lc->sketch_gamma) +
+                    .5);
+} /* }}} cdtime_t sketch_value */
+
+/* Moves the range of keys covered by the bins so that it starts with
+ * "offset". When the range moves up, the bins dropping out are collapsed into
+ * the new lowest bin. When it moves down, the bins dropping out must be
+ * empty. */
+static void sketch_set_offset(latency_counter_t *lc, int offset) /* {{{ */
+{
+  int delta = offset - lc->sketch_offset;
+
+  if (delta > 0) {
+    uint64_t collapsed = 0;
+    for (int i = 0; (i < delta) && (i < SKETCH_NUM_BINS); i++)
+      collapsed += lc->sketch[i];
+
+    if (delta < SKETCH_NUM_BINS) {
+      memmove(lc->sketch, lc->sketch + delta,
+              sizeof(*lc->sketch) * (SKETCH_NUM_BINS - delta));
+      memset(lc->sketch + SKETCH_NUM_BINS - delta, 0,
+             sizeof(*lc->sketch) * delta);
+    } else {
+      memset(lc->sketch, 0, sizeof(*lc->sketch) * SKETCH_NUM_BINS);
+    }
+    lc->sketch[0] += collapsed;
+
+    if (lc->sketch_key_min < offset)
+      lc->sketch_key_min = offset;
+    if (lc->sketch_key_max < offset)
+      lc->sketch_key_max = offset;
+  } else if (delta < 0) {
+    delta = -delta;
+    assert(delta < SKETCH_NUM_BINS);
+    memmove(lc->sketch + delta, lc->sketch,
+            sizeof(*lc->sketch) * (SKETCH_NUM_BINS - delta));
+    memset(lc->sketch, 0, sizeof(*lc->sketch) * delta);
+  }
+
+  lc->sketch_offset = offset;
+} /* }}} void sketch_set_offset */
+
+static void sketch_add(latency_counter_t *lc, int key, /* {{{ */
+                       uint64_t count) {
+  if (lc->sketch_key_min > lc->sketch_key_max) {
+    /* empty: center the range on the first key */
+    lc->sketch_offset = key - SKETCH_NUM_BINS / 2;
+  } else if (key >= lc->sketch_offset + SKETCH_NUM_BINS) {
+    sketch_set_offset(lc, key - SKETCH_NUM_BINS + 1);
+  } else if (key < lc->sketch_offset) {
+    int offset = lc->sketch_key_max - SKETCH_NUM_BINS + 1;
+    sketch_set_offset(lc, (key > offset) ? key : offset);
+    if (key < lc->sketch_offset)
+      key = lc->sketch_offset;
+  }
+
+  lc->sketch[key - lc->sketch_offset] += count;
+  if (lc->sketch_key_min > key)
+    lc->sketch_key_min = key;
+  if (lc->sketch_key_max < key)
+    lc->sketch_key_max = key;
+} /* }}} void sketch_add */
+
+/* Adds "count" events of "latency" to the histogram or sketch, leaving the
+ * sum, number, minimum and maximum untouched. */
+static void bins_add(latency_counter_t *lc, cdtime_t latency, /* {{{ */
+                     uint64_t count) {
+  if (lc->sketch != NULL) {
+    sketch_add(lc, sketch_key(lc, (double)latency), count);
+    return;
+  }
+
+  /* A latency of _exactly_ 1.0 ms is stored in the buffer 0, so
+   * subtract one from the cdtime_t value so that exactly 1.0 ms get sorted
+   * accordingly. */
+  cdtime_t bin = (latency - 1) / lc->bin_width;
+  if (bin >= HISTOGRAM_NUM_BINS) {
+    change_bin_width(lc, latency);
+    bin = (latency - 1) / lc->bin_width;
+    if (bin >= HISTOGRAM_NUM_BINS) {
+      P_ERROR("latency_counter_add: Invalid bin: %" PRIu64, bin);
+      return;
+    }
+  }
+  lc->histogram[bin] += (int)count;
+} /* }}} void bins_add */
+
 latency_counter_t *latency_counter_create(void) /* {{{ */
 {
   latency_counter_t *lc;
@@ -126,15 +253,37 @@ latency_counter_t *latency_counter_create(void) /* {{{ */
   return lc;
 } /* }}} latency_counter_t *latency_counter_create */
 
+latency_counter_t *latency_counter_create_sketch(double alpha) /* {{{ */
+{
+  if (!(alpha > 0.0) || !(alpha < 1.0))
+    return NULL;
+
+  latency_counter_t *lc = latency_counter_create();
+  if (lc == NULL)
+    return NULL;
+
+  lc->sketch = calloc(SKETCH_NUM_BINS, sizeof(*lc->sketch));
+  if (lc->sketch == NULL) {
+    sfree(lc);
+    return NULL;
+  }
+  lc->sketch_gamma = (1.0 + alpha) / (1.0 - alpha);
+  lc->sketch_log_gamma = log(lc->sketch_gamma);
+  latency_counter_reset(lc);
+  return lc;
+} /* }}} latency_counter_t *latency_counter_create_sketch */
+
 void latency_counter_destroy(latency_counter_t *lc) /* {{{ */
 {
+  if (lc == NULL)
+    return;
+
+  sfree(lc->sketch);
   sfree(lc);
 } /* }}} void latency_counter_destroy */
 
 void latency_counter_add(latency_counter_t *lc, cdtime_t latency) /* {{{ */
 {
-  cdtime_t bin;
-
   if ((lc == NULL) || (latency == 0) || (latency > ((cdtime_t)LLONG_MAX)))
     return;
 
@@ -148,20 +297,72 @@ void latency_counter_add(latency_counter_t *lc, cdtime_t latency) /* {{{ */
   if (lc->max < latency)
     lc->max = latency;
 
-  /* A latency of _exactly_ 1.0 ms is stored in the buffer 0, so
-   * subtract one from the cdtime_t value so that exactly 1.0 ms get sorted
-   * accordingly. */
-  bin = (latency - 1) / lc->bin_width;
-  if (bin >= HISTOGRAM_NUM_BINS) {
-    change_bin_width(lc, latency);
-    bin = (latency - 1) / lc->bin_width;
-    if (bin >= HISTOGRAM_NUM_BINS) {
-      P_ERROR("latency_counter_add: Invalid bin: %" PRIu64, bin);
-      return;
+  bins_add(lc, latency, 1);
+} /* }}} void latency_counter_add */
+
+void latency_counter_merge(latency_counter_t *dst, /* {{{ */
+                           latency_counter_t const *src) {
+  if ((dst == NULL) || (src == NULL) || (src->num == 0))
+    return;
+
+  if (dst->num == 0) {
+    dst->min = src->min;
+    dst->max = src->max;
+  } else {
+    if (dst->min > src->min)
+      dst->min = src->min;
+    if (dst->max < src->max)
+      dst->max = src->max;
+  }
+  dst->sum += src->sum;
+
+  if (src->sketch != NULL) {
+    bool same_keys = (dst->sketch != NULL) &&
+                     (dst->sketch_log_gamma == src->sketch_log_gamma);
+    /* The bins of "src" which are set lie between its minimum and maximum
+     * key. */
+    for (int key = src->sketch_key_min; key <= src->sketch_key_max; key++) {
+      uint64_t count = src->sketch[key - src->sketch_offset];
+      if (count == 0)
+        continue;
+
+      if (same_keys)
+        sketch_add(dst, key, count);
+      else
+        bins_add(dst, sketch_value(src, key), count);
     }
+    dst->num += src->num;
+    return;
   }
-  lc->histogram[bin]++;
-} /* }}} void latency_counter_add */
+
+  if (dst->sketch != NULL) {
+    /* Assume the events of each histogram bin lie in its middle. */
+    for (size_t i = 0; i < HISTOGRAM_NUM_BINS; i++) {
+      if (src->histogram[i] != 0)
+        bins_add(dst, ((cdtime_t)i) * src->bin_width + src->bin_width / 2,
+                 (uint64_t)src->histogram[i]);
+    }
+    dst->num += src->num;
+    return;
+  }
+
+  /* Use the wider of both bin widths, so that every bin of "src" maps onto
+   * exactly one bin of "dst". */
+  if (dst->bin_width < src->bin_width)
+    set_bin_width(dst, src->bin_width);
+  dst->num += src->num;
+
+  double width_ratio = ((double)src->bin_width) / ((double)dst->bin_width);
+  for (size_t i = 0; i < HISTOGRAM_NUM_BINS; i++) {
+    if (src->histogram[i] == 0)
+      continue;
+
+    size_t bin = (size_t)(((double)i) * width_ratio);
+    if (bin >= HISTOGRAM_NUM_BINS)
+      bin = HISTOGRAM_NUM_BINS - 1;
+    dst->histogram[bin] += src->histogram[i];
+  }
+} /* }}} void latency_counter_merge */
 
 void latency_counter_reset(latency_counter_t *lc) /* {{{ */
 {
@@ -188,11 +389,25 @@ void latency_counter_reset(latency_counter_t *lc) /* {{{ */
           CDTIME_T_TO_DOUBLE(lc->bin_width), CDTIME_T_TO_DOUBLE(bin_width));
   }
 
+  uint64_t *sketch = lc->sketch;
+  double sketch_gamma = lc->sketch_gamma;
+  double sketch_log_gamma = lc->sketch_log_gamma;
+
   memset(lc, 0, sizeof(*lc));
 
   /* preserve bin width */
   lc->bin_width = bin_width;
   lc->start_time = cdtime();
+
+  /* preserve the sketch, and mark it empty */
+  if (sketch != NULL) {
+    memset(sketch, 0, sizeof(*sketch) * SKETCH_NUM_BINS);
+    lc->sketch = sketch;
+    lc->sketch_gamma = sketch_gamma;
+    lc->sketch_log_gamma = sketch_log_gamma;
+    lc->sketch_key_min = INT_MAX;
+    lc->sketch_key_max = INT_MIN;
+  }
 } /* }}} void latency_counter_reset */
 
 cdtime_t latency_counter_get_min(latency_counter_t *lc) /* {{{ */
@@ -247,6 +462,25 @@ cdtime_t latency_counter_get_percentile(latency_counter_t *lc, /* {{{ */
   if ((lc == NULL) || (lc->num == 0) || !((percent > 0.0) && (percent < 100.0)))
     return 0;
 
+  if (lc->sketch != NULL) {
+    /* Return the value of the bin containing the event with this rank. */
+    double rank = ceil(percent * ((double)lc->num) / 100.0);
+    uint64_t count = 0;
+    int key;
+    for (key = lc->sketch_key_min; key < lc->sketch_key_max; key++) {
+      count += lc->sketch[key - lc->sketch_offset];
+      if ((double)count >= rank)
+        break;
+    }
+
+    cdtime_t latency = sketch_value(lc, key);
+    if (latency < lc->min)
+      return lc->min;
+    if (latency > lc->max)
+      return lc->max;
+    return latency;
+  }
+
   /* Find index i so that at least "percent" events are within i+1 ms. */
   percent_upper = 0.0;
   percent_lower = 0.0;
@@ -294,6 +528,17 @@ double latency_counter_get_rate(const latency_counter_t *lc, /* {{{ */
   if (lower == upper)
     return 0;
 
+  if (lc->sketch != NULL) {
+    /* Counts the bins whose value is in the interval. */
+    double sum = 0;
+    for (int key = lc->sketch_key_min; key <= lc->sketch_key_max; key++) {
+      cdtime_t value = sketch_value(lc, key);
+      if ((value > lower) && ((upper == 0) || (value <= upper)))
+        sum += (double)lc->sketch[key - lc->sketch_offset];
+    }
+    return sum / (CDTIME_T_TO_DOUBLE(now - lc->start_time));
+  }
+
   /* Buckets have an exclusive lower bound and an inclusive upper bound. That
    * means that the first bucket, index 0, represents (0-bin_width]. That means
    * that latency==bin_width needs to result in bin=0, that's why we need to
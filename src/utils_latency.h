@@ -36,9 +36,36 @@ struct latency_counter_s;
 typedef struct latency_counter_s latency_counter_t;
 
 latency_counter_t *latency_counter_create(void);
+
+/*
+ * NAME
+ *  latency_counter_create_sketch(alpha)
+ *
+ * DESCRIPTION
+ *   Creates a latency counter which keeps a quantile sketch instead of the
+ *   histogram with equal-width bins used by latency_counter_create(). Each
+ *   percentile is returned with a relative error of at most "alpha", which
+ *   must be between zero and one exclusively, e.g. 0.01 for 1%. Counters with
+ *   the same "alpha" merge without losing accuracy.
+ *
+ * RETURN VALUE
+ *   A latency_counter_t-pointer upon success or NULL upon failure.
+ */
+latency_counter_t *latency_counter_create_sketch(double alpha);
 void latency_counter_destroy(latency_counter_t *lc);
 
 void latency_counter_add(latency_counter_t *lc, cdtime_t latency);
+
+/*
+ * NAME
+ *  latency_counter_merge(dst,src)
+ *
+ * DESCRIPTION
+ *   Adds all latencies recorded by "src" to "dst", as if they had been added
+ *   to "dst" with latency_counter_add(). "src" is not modified.
+ */
+void latency_counter_merge(latency_counter_t *dst,
+                           latency_counter_t const *src);
 void latency_counter_reset(latency_counter_t *lc);
 
 cdtime_t latency_counter_get_min(latency_counter_t *lc);
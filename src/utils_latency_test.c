@@ -101,6 +101,97 @@ DEF_TEST(percentile) {
   return 0;
 }
 
+DEF_TEST(merge) {
+  latency_counter_t *l;
+  latency_counter_t *m;
+
+  CHECK_NOT_NULL(l = latency_counter_create());
+  CHECK_NOT_NULL(m = latency_counter_create());
+
+  /* "m" ends up with a wider bin width than "l". */
+  for (size_t i = 0; i < 100; i++) {
+    if (i % 2)
+      latency_counter_add(l, MS_TO_CDTIME_T(((uint64_t)i) + 1));
+    else
+      latency_counter_add(m, TIME_T_TO_CDTIME_T(((time_t)i) + 1));
+  }
+
+  latency_counter_merge(l, m);
+  EXPECT_EQ_INT(100, (int)latency_counter_get_num(l));
+  EXPECT_EQ_DOUBLE(0.002, CDTIME_T_TO_DOUBLE(latency_counter_get_min(l)));
+  EXPECT_EQ_DOUBLE(99.0, CDTIME_T_TO_DOUBLE(latency_counter_get_max(l)));
+  EXPECT_EQ_DOUBLE(50.0 * 51.0 / 1000.0 + 50.0 * 50.0,
+                   CDTIME_T_TO_DOUBLE(latency_counter_get_sum(l)));
+  /* Half of the values are below 0.1 seconds, the other half are spread
+   * between 1 and 99 seconds. */
+  EXPECT_EQ_DOUBLE(
+      49.0, CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(l, 75.0)));
+
+  /* "m" is unchanged. */
+  EXPECT_EQ_INT(50, (int)latency_counter_get_num(m));
+
+  latency_counter_destroy(l);
+  latency_counter_destroy(m);
+  return 0;
+}
+
+DEF_TEST(sketch) {
+  latency_counter_t *l;
+  latency_counter_t *m;
+  latency_counter_t *h;
+
+  CHECK_NOT_NULL(l = latency_counter_create_sketch(0.01));
+  CHECK_NOT_NULL(m = latency_counter_create_sketch(0.01));
+  CHECK_NOT_NULL(h = latency_counter_create());
+  EXPECT_EQ_PTR(NULL, latency_counter_create_sketch(0.0));
+  EXPECT_EQ_PTR(NULL, latency_counter_create_sketch(1.0));
+
+  for (size_t i = 0; i < 100; i++) {
+    latency_counter_add((i % 2) ? l : m, TIME_T_TO_CDTIME_T(((time_t)i) + 1));
+    latency_counter_add(h, TIME_T_TO_CDTIME_T(((time_t)i) + 1));
+  }
+
+  latency_counter_merge(l, m);
+  EXPECT_EQ_INT(100, (int)latency_counter_get_num(l));
+  EXPECT_EQ_DOUBLE(1.0, CDTIME_T_TO_DOUBLE(latency_counter_get_min(l)));
+  EXPECT_EQ_DOUBLE(100.0, CDTIME_T_TO_DOUBLE(latency_counter_get_max(l)));
+  EXPECT_EQ_DOUBLE(50.5, CDTIME_T_TO_DOUBLE(latency_counter_get_average(l)));
+
+  double percentiles[] = {1.0, 50.0, 80.0, 95.0, 99.0};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(percentiles); i++) {
+    double got = CDTIME_T_TO_DOUBLE(
+        latency_counter_get_percentile(l, percentiles[i]));
+    /* The relative error is bounded by the accuracy. */
+    OK(fabs(got - percentiles[i]) <= 0.01 * percentiles[i]);
+  }
+
+  /* Latencies spanning more orders of magnitude than the sketch has bins are
+   * collapsed into the lowest bin, affecting the lowest percentiles only. */
+  latency_counter_add(m, 1);
+  latency_counter_add(m, TIME_T_TO_CDTIME_T(86400 * 365));
+  double got = CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(m, 50.0));
+  OK(fabs(got - 49.0) <= 0.01 * 49.0);
+
+  /* Histograms can be merged into sketches, and vice versa. */
+  latency_counter_reset(m);
+  latency_counter_merge(m, h);
+  EXPECT_EQ_INT(100, (int)latency_counter_get_num(m));
+  got = CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(m, 50.0));
+  /* relative error plus half the histogram's bin width */
+  OK(fabs(got - 50.0) <= 0.01 * 50.0 + 0.0625);
+
+  latency_counter_reset(h);
+  latency_counter_merge(h, l);
+  EXPECT_EQ_INT(100, (int)latency_counter_get_num(h));
+  got = CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(h, 50.0));
+  OK(fabs(got - 50.0) <= 0.5);
+
+  latency_counter_destroy(l);
+  latency_counter_destroy(m);
+  latency_counter_destroy(h);
+  return 0;
+}
+
 DEF_TEST(get_rate) {
   /* We re-declare the struct here so we can inspect its content. */
   struct {
@@ -228,6 +319,8 @@ DEF_TEST(get_rate) {
 int main(void) {
   RUN_TEST(simple);
   RUN_TEST(percentile);
+  RUN_TEST(merge);
+  RUN_TEST(sketch);
   RUN_TEST(get_rate);
 
   END_TEST;
@@ -0,0 +1,347 @@
+/**
+ * collectd - src/utils_log_writer.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_atomic.h"
+#include "utils_log_writer.h"
+#include "utils_ring.h"
+
+#include <signal.h>
+
+typedef struct {
+  cdtime_t time;
+  int severity;
+  char msg[];
+} log_writer_entry_t;
+
+struct log_writer_s {
+  const char *name;
+  char *file;
+  log_writer_format_cb format;
+
+  /* Serializes synchronous writes. */
+  pthread_mutex_t lock;
+
+  c_ring_t *ring;
+  pthread_t thread;
+  int running;
+  int waiting;
+  pthread_mutex_t wait_lock;
+  pthread_cond_t wait_cond;
+  uint64_t dropped;
+
+  /* Owned by the writer thread. */
+  FILE *fh;
+  dev_t fh_dev;
+  ino_t fh_ino;
+  int hup_seen;
+};
+
+/* SIGHUP is counted rather than flagged, so that every writer notices it. */
+static volatile sig_atomic_t log_writer_hup;
+static struct sigaction log_writer_hup_old;
+static bool log_writer_hup_installed;
+static pthread_mutex_t log_writer_hup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void log_writer_sighup(int signal) {
+  log_writer_hup++;
+
+  if ((log_writer_hup_old.sa_handler != SIG_DFL) &&
+      (log_writer_hup_old.sa_handler != SIG_IGN) &&
+      (log_writer_hup_old.sa_handler != NULL))
+    log_writer_hup_old.sa_handler(signal);
+} /* void log_writer_sighup */
+
+static void log_writer_install_sighup(void) {
+  pthread_mutex_lock(&log_writer_hup_lock);
+  if (!log_writer_hup_installed) {
+    struct sigaction sa = {.sa_handler = log_writer_sighup,
+                           .sa_flags = SA_RESTART};
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGHUP, &sa, &log_writer_hup_old) == 0)
+      log_writer_hup_installed = true;
+  }
+  pthread_mutex_unlock(&log_writer_hup_lock);
+} /* void log_writer_install_sighup */
+
+/* Returns true if messages go to a file rather than stdout or stderr. */
+static bool log_writer_is_file(log_writer_t const *w) {
+  return (w->file != NULL) && (strcasecmp(w->file, "stderr") != 0) &&
+         (strcasecmp(w->file, "stdout") != 0);
+} /* bool log_writer_is_file */
+
+static FILE *log_writer_std_stream(log_writer_t const *w) {
+  if ((w->file != NULL) && (strcasecmp(w->file, "stdout") == 0))
+    return stdout;
+  return stderr;
+} /* FILE *log_writer_std_stream */
+
+log_writer_t *log_writer_create(const char *name,
+                                log_writer_format_cb format) {
+  log_writer_t *w = calloc(1, sizeof(*w));
+  if (w == NULL)
+    return NULL;
+
+  w->name = name;
+  w->format = format;
+  pthread_mutex_init(&w->lock, /* attr = */ NULL);
+  pthread_mutex_init(&w->wait_lock, /* attr = */ NULL);
+  pthread_cond_init(&w->wait_cond, /* attr = */ NULL);
+
+  return w;
+} /* log_writer_t *log_writer_create */
+
+int log_writer_set_file(log_writer_t *w, const char *file) {
+  char *tmp = NULL;
+
+  if (C_ATOMIC_LOAD(&w->running))
+    return EBUSY;
+
+  if (file != NULL) {
+    tmp = strdup(file);
+    if (tmp == NULL)
+      return ENOMEM;
+  }
+
+  pthread_mutex_lock(&w->lock);
+  sfree(w->file);
+  w->file = tmp;
+  pthread_mutex_unlock(&w->lock);
+
+  return 0;
+} /* int log_writer_set_file */
+
+static void log_writer_write_sync(log_writer_t *w, int severity,
+                                  cdtime_t time, const char *msg) {
+  FILE *fh;
+  bool do_close = false;
+
+  pthread_mutex_lock(&w->lock);
+
+  if (log_writer_is_file(w)) {
+    fh = fopen(w->file, "a");
+    do_close = true;
+  } else {
+    fh = log_writer_std_stream(w);
+  }
+
+  if (fh == NULL) {
+    fprintf(stderr, "%s plugin: fopen (%s) failed: %s\n", w->name, w->file,
+            STRERRNO);
+  } else {
+    w->format(fh, severity, time, msg);
+
+    if (do_close) {
+      fclose(fh);
+    } else {
+      fflush(fh);
+    }
+  }
+
+  pthread_mutex_unlock(&w->lock);
+} /* void log_writer_write_sync */
+
+void log_writer_write(log_writer_t *w, int severity, cdtime_t time,
+                      const char *msg) {
+  if (!C_ATOMIC_LOAD(&w->running)) {
+    log_writer_write_sync(w, severity, time, msg);
+    return;
+  }
+
+  size_t msg_len = strlen(msg);
+  log_writer_entry_t *e = malloc(sizeof(*e) + msg_len + 1);
+  if (e == NULL) {
+    C_ATOMIC_ADD(&w->dropped, 1);
+    return;
+  }
+  e->time = time;
+  e->severity = severity;
+  memcpy(e->msg, msg, msg_len + 1);
+
+  if (c_ring_push(w->ring, e) != 0) {
+    free(e);
+    C_ATOMIC_ADD(&w->dropped, 1);
+    return;
+  }
+
+  if (C_ATOMIC_LOAD(&w->waiting)) {
+    pthread_mutex_lock(&w->wait_lock);
+    pthread_cond_signal(&w->wait_cond);
+    pthread_mutex_unlock(&w->wait_lock);
+  }
+} /* void log_writer_write */
+
+/* (Re-)opens the file if SIGHUP has been received or if the file has been
+ * moved or removed. Only called by the writer thread. */
+static void log_writer_check_reopen(log_writer_t *w) {
+  struct stat st;
+
+  if (!log_writer_is_file(w)) {
+    w->fh = log_writer_std_stream(w);
+    return;
+  }
+
+  int hup = log_writer_hup;
+  if ((w->fh != NULL) && (hup == w->hup_seen) && (stat(w->file, &st) == 0) &&
+      (st.st_dev == w->fh_dev) && (st.st_ino == w->fh_ino))
+    return;
+
+  w->hup_seen = hup;
+  if (w->fh != NULL)
+    fclose(w->fh);
+
+  w->fh = fopen(w->file, "a");
+  if (w->fh == NULL) {
+    fprintf(stderr, "%s plugin: fopen (%s) failed: %s\n", w->name, w->file,
+            STRERRNO);
+    return;
+  }
+
+  if (fstat(fileno(w->fh), &st) == 0) {
+    w->fh_dev = st.st_dev;
+    w->fh_ino = st.st_ino;
+  }
+} /* void log_writer_check_reopen */
+
+static void log_writer_write_entry(log_writer_t *w, log_writer_entry_t *e) {
+  if (w->fh != NULL)
+    w->format(w->fh, e->severity, e->time, e->msg);
+  free(e);
+} /* void log_writer_write_entry */
+
+static void *log_writer_thread(void *arg) {
+  log_writer_t *w = arg;
+  uint64_t dropped_reported = 0;
+  cdtime_t last_check = cdtime();
+
+  while (true) {
+    log_writer_entry_t *e;
+    bool wrote = false;
+
+    cdtime_t now = cdtime();
+    if ((log_writer_hup != w->hup_seen) ||
+        ((now - last_check) >= TIME_T_TO_CDTIME_T(1))) {
+      log_writer_check_reopen(w);
+      last_check = now;
+    }
+
+    while ((e = c_ring_pop(w->ring)) != NULL) {
+      log_writer_write_entry(w, e);
+      wrote = true;
+    }
+
+    if (wrote && (w->fh != NULL))
+      fflush(w->fh);
+
+    /* Goes through plugin_log(), so this ends up in the ring, too. */
+    uint64_t dropped = C_ATOMIC_LOAD(&w->dropped);
+    if (dropped != dropped_reported) {
+      WARNING("%s plugin: %" PRIu64 " log messages have been dropped "
+              "because the buffer was full.",
+              w->name, dropped - dropped_reported);
+      dropped_reported = dropped;
+    }
+
+    pthread_mutex_lock(&w->wait_lock);
+    if (!C_ATOMIC_LOAD(&w->running)) {
+      pthread_mutex_unlock(&w->wait_lock);
+      break;
+    }
+
+    /* Check the ring once more after announcing that we're about to wait, so
+     * that a message pushed in between isn't left behind. */
+    C_ATOMIC_STORE(&w->waiting, 1);
+    e = c_ring_pop(w->ring);
+    if (e == NULL) {
+      struct timespec ts =
+          CDTIME_T_TO_TIMESPEC(cdtime() + TIME_T_TO_CDTIME_T(1));
+      pthread_cond_timedwait(&w->wait_cond, &w->wait_lock, &ts);
+    }
+    C_ATOMIC_STORE(&w->waiting, 0);
+    pthread_mutex_unlock(&w->wait_lock);
+
+    if (e != NULL)
+      log_writer_write_entry(w, e);
+  }
+
+  /* Write out what is left. */
+  log_writer_entry_t *e;
+  while ((e = c_ring_pop(w->ring)) != NULL)
+    log_writer_write_entry(w, e);
+  if (w->fh != NULL)
+    fflush(w->fh);
+
+  return NULL;
+} /* void *log_writer_thread */
+
+int log_writer_start(log_writer_t *w, size_t buffer_size) {
+  if ((buffer_size == 0) || C_ATOMIC_LOAD(&w->running))
+    return 0;
+
+  if (w->ring == NULL)
+    w->ring = c_ring_create(buffer_size);
+  if (w->ring == NULL) {
+    ERROR("%s plugin: c_ring_create failed.", w->name);
+    return ENOMEM;
+  }
+
+  w->hup_seen = log_writer_hup;
+  log_writer_check_reopen(w);
+
+  C_ATOMIC_STORE(&w->running, 1);
+  int status = plugin_thread_create(&w->thread, /* attr = */ NULL,
+                                    log_writer_thread, w, w->name);
+  if (status != 0) {
+    C_ATOMIC_STORE(&w->running, 0);
+    ERROR("%s plugin: pthread_create failed: %s", w->name, STRERROR(status));
+    return status;
+  }
+
+  if (log_writer_is_file(w))
+    log_writer_install_sighup();
+
+  return 0;
+} /* int log_writer_start */
+
+void log_writer_stop(log_writer_t *w) {
+  if (!C_ATOMIC_LOAD(&w->running))
+    return;
+
+  /* Messages logged from now on are written synchronously. */
+  pthread_mutex_lock(&w->wait_lock);
+  C_ATOMIC_STORE(&w->running, 0);
+  pthread_cond_signal(&w->wait_cond);
+  pthread_mutex_unlock(&w->wait_lock);
+
+  pthread_join(w->thread, NULL);
+
+  if ((w->fh != NULL) && (w->fh != stdout) && (w->fh != stderr))
+    fclose(w->fh);
+  w->fh = NULL;
+
+  /* The ring is not destroyed: another thread may be about to push a message
+   * it started before the flag above was cleared. */
+} /* void log_writer_stop */
@@ -0,0 +1,67 @@
+/**
+ * collectd - src/utils_log_writer.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_LOG_WRITER_H
+#define UTILS_LOG_WRITER_H 1
+
+#include "plugin.h"
+
+/*
+ * A log writer appends messages to a file, or to stdout or stderr. Once
+ * started, messages are copied into a ring buffer and written by a dedicated
+ * thread, which keeps the file open, so the logging thread doesn't wait for
+ * disk I/O. The file is reopened on SIGHUP and when it has been moved or
+ * removed. Before log_writer_start(), after log_writer_stop() and with a
+ * buffer size of zero, each message is written synchronously by opening,
+ * appending to and closing the file.
+ */
+struct log_writer_s;
+typedef struct log_writer_s log_writer_t;
+
+/* Writes one message, including the trailing newline, to "fh". Called from
+ * the writer thread, or with the writer's lock held. */
+typedef void (*log_writer_format_cb)(FILE *fh, int severity, cdtime_t time,
+                                     const char *msg);
+
+/* "name" is used in error messages and must be a string constant. Returns
+ * NULL on error. */
+log_writer_t *log_writer_create(const char *name, log_writer_format_cb format);
+
+/* Sets the file to write to. The special names "stdout" and "stderr" write
+ * to the standard output and error channels; NULL means stderr. Must be
+ * called before log_writer_start(). */
+int log_writer_set_file(log_writer_t *w, const char *file);
+
+/* Starts the writer thread with room for "buffer_size" messages. A size of
+ * zero keeps writing messages synchronously. */
+int log_writer_start(log_writer_t *w, size_t buffer_size);
+
+/* Writes out all buffered messages and stops the writer thread. */
+void log_writer_stop(log_writer_t *w);
+
+/* Queues a message. If the buffer is full, the message is dropped; the number
+ * of dropped messages is logged later. Safe to call from any thread. */
+void log_writer_write(log_writer_t *w, int severity, cdtime_t time,
+                      const char *msg);
+
+#endif /* UTILS_LOG_WRITER_H */
@@ -34,31 +34,26 @@ static int ltoc_values(lua_State *L, /* {{{ */
     return -1;
   }
 
-  /* Push initial key */
-  lua_pushnil(L); /* +1 = 1 */
-  size_t i = 0;
-  while (lua_next(L, -2) != 0) /* -1+2 = 2 || -1 = 0 */
-  {
-    if (i >= ds->ds_num) {
-      lua_pop(L, 2); /* -2 = 0 */
-      i++;
-      break;
-    }
-
-    ret_values[i] = luaC_tovalue(L, -1, ds->ds[i].type);
-
-    /* Pop the value */
-    lua_pop(L, 1); /* -1 = 1 */
-    i++;
-  } /* while (lua_next) */
-
-  if (i != ds->ds_num) {
+#if LUA_VERSION_NUM < 502
+  size_t len = lua_objlen(L, -1);
+#else
+  size_t len = lua_rawlen(L, -1);
+#endif
+  if (len != ds->ds_num) {
     WARNING("ltoc_values: invalid size for datasource \"%s\": expected %" PRIsz
             ", got %" PRIsz,
-            ds->type, ds->ds_num, i);
+            ds->type, ds->ds_num, len);
     return -1;
   }
 
+  /* Index the array directly rather than iterating with lua_next(), which
+   * doesn't guarantee any order. */
+  for (size_t i = 0; i < len; i++) {
+    lua_rawgeti(L, -1, (int)i + 1); /* +1 = 1 */
+    ret_values[i] = luaC_tovalue(L, -1, ds->ds[i].type);
+    lua_pop(L, 1); /* -1 = 0 */
+  }
+
   return 0;
 } /* }}} int ltoc_values */
 
@@ -168,13 +163,13 @@ value_t luaC_tovalue(lua_State *L, int idx, int ds_type) /* {{{ */
     return v;
 
   if (ds_type == DS_TYPE_GAUGE)
-    v.gauge = (gauge_t)lua_tonumber(L, /* stack pos = */ -1);
+    v.gauge = (gauge_t)lua_tonumber(L, idx);
   else if (ds_type == DS_TYPE_DERIVE)
-    v.derive = (derive_t)lua_tointeger(L, /* stack pos = */ -1);
+    v.derive = (derive_t)lua_tointeger(L, idx);
   else if (ds_type == DS_TYPE_COUNTER)
-    v.counter = (counter_t)lua_tointeger(L, /* stack pos = */ -1);
+    v.counter = (counter_t)lua_tointeger(L, idx);
   else if (ds_type == DS_TYPE_ABSOLUTE)
-    v.absolute = (absolute_t)lua_tointeger(L, /* stack pos = */ -1);
+    v.absolute = (absolute_t)lua_tointeger(L, idx);
 
   return v;
 } /* }}} value_t luaC_tovalue */
@@ -41,6 +41,10 @@ struct cu_match_s {
   regex_t excluderegex;
   int flags;
 
+  /* A string every line matched by "regex" contains, or NULL. Lines not
+   * containing it are rejected without running the regular expression. */
+  char *literal;
+
   int (*callback)(const char *str, char *const *matches, size_t matches_num,
                   void *user_data);
   void *user_data;
@@ -72,6 +76,163 @@ static char *match_substr(const char *str, int begin, int end) {
   return ret;
 } /* char *match_substr */
 
+/* Returns the (first) end of the bracket expression starting at "p", i.e.
+ * the position after the closing bracket. */
+static const char *match_skip_bracket(const char *p) {
+  p++; /* '[' */
+  if (*p == '^')
+    p++;
+  if (*p == ']')
+    p++;
+
+  while ((*p != 0) && (*p != ']')) {
+    if ((p[0] == '[') && ((p[1] == ':') || (p[1] == '.') || (p[1] == '='))) {
+      char delim = p[1];
+      p += 2;
+      while ((*p != 0) && !((p[0] == delim) && (p[1] == ']')))
+        p++;
+      if (*p != 0)
+        p += 2;
+      continue;
+    }
+    p++;
+  }
+
+  return (*p == ']') ? p + 1 : p;
+} /* const char *match_skip_bracket */
+
+/* Returns the position after the parenthesized group starting at "p". */
+static const char *match_skip_group(const char *p) {
+  int depth = 0;
+
+  while (*p != 0) {
+    if (*p == '\\') {
+      p++;
+      if (*p != 0)
+        p++;
+      continue;
+    } else if (*p == '[') {
+      p = match_skip_bracket(p);
+      continue;
+    } else if (*p == '(') {
+      depth++;
+    } else if (*p == ')') {
+      depth--;
+      if (depth == 0)
+        return p + 1;
+    }
+    p++;
+  }
+
+  return p;
+} /* const char *match_skip_group */
+
+/* Returns the position after a quantifier at "p", or "p" if there is none. */
+static const char *match_skip_quantifier(const char *p) {
+  while ((*p == '*') || (*p == '+') || (*p == '?') || (*p == '{')) {
+    if (*p == '{') {
+      const char *end = strchr(p, '}');
+      if (end == NULL)
+        return p + strlen(p);
+      p = end;
+    }
+    p++;
+  }
+  return p;
+} /* const char *match_skip_quantifier */
+
+/*
+ * Determines the longest string of literal characters which every string
+ * matched by the extended regular expression "regex" contains. This is
+ * conservative: anything not understood ends the current string, and
+ * alternatives outside of groups make the function return NULL.
+ */
+static char *match_required_literal(const char *regex) {
+  size_t regex_len = strlen(regex);
+  char *best = calloc(1, regex_len + 1);
+  char *cur = calloc(1, regex_len + 1);
+  size_t best_len = 0;
+  size_t cur_len = 0;
+
+  if ((best == NULL) || (cur == NULL)) {
+    sfree(best);
+    sfree(cur);
+    return NULL;
+  }
+
+#define END_RUN()                                                              \
+  do {                                                                         \
+    if (cur_len > best_len) {                                                  \
+      memcpy(best, cur, cur_len);                                              \
+      best[cur_len] = 0;                                                       \
+      best_len = cur_len;                                                      \
+    }                                                                          \
+    cur_len = 0;                                                               \
+  } while (0)
+
+  const char *p = regex;
+  while (*p != 0) {
+    char c;
+
+    if (*p == '|') {
+      /* Alternatives: nothing is required by all of them. */
+      sfree(best);
+      sfree(cur);
+      return NULL;
+    } else if (*p == '(') {
+      END_RUN();
+      p = match_skip_quantifier(match_skip_group(p));
+      continue;
+    } else if (*p == '[') {
+      END_RUN();
+      p = match_skip_quantifier(match_skip_bracket(p));
+      continue;
+    } else if ((*p == '.') || (*p == '^') || (*p == '$') || (*p == ')') ||
+               (*p == '*') || (*p == '+') || (*p == '?') || (*p == '{')) {
+      END_RUN();
+      p = match_skip_quantifier(p + 1);
+      continue;
+    } else if (*p == '\\') {
+      /* Escaped letters and digits are character classes, anchors or back
+       * references, e.g. "\w" or "\<". */
+      c = p[1];
+      if ((c == 0) || isalnum((unsigned char)c) || (strchr("<>`'", c) != NULL)) {
+        END_RUN();
+        p = match_skip_quantifier(p + ((c == 0) ? 1 : 2));
+        continue;
+      }
+      p += 2;
+    } else {
+      c = *p;
+      p++;
+    }
+
+    if ((*p == '*') || (*p == '?') || (*p == '{')) {
+      /* The character may not appear at all. */
+      END_RUN();
+      p = match_skip_quantifier(p);
+      continue;
+    }
+
+    cur[cur_len++] = c;
+    if (*p == '+') {
+      /* The character appears at least once, but what follows is not
+       * adjacent to it. */
+      END_RUN();
+      p = match_skip_quantifier(p);
+    }
+  }
+  END_RUN();
+#undef END_RUN
+
+  sfree(cur);
+  if (best_len == 0) {
+    sfree(best);
+    return NULL;
+  }
+  return best;
+} /* char *match_required_literal */
+
 static int default_callback(const char __attribute__((unused)) * str,
                             char *const *matches, size_t matches_num,
                             void *user_data) {
@@ -237,11 +398,19 @@ match_create_callback(const char *regex, const char *excluderegex,
   }
   obj->flags |= UTILS_MATCH_FLAGS_REGEX;
 
+  obj->literal = match_required_literal(regex);
+  if (obj->literal != NULL)
+    DEBUG("utils_match: match_create_callback: Lines not containing \"%s\" "
+          "are skipped.",
+          obj->literal);
+
   if (excluderegex && strcmp(excluderegex, "") != 0) {
     status = regcomp(&obj->excluderegex, excluderegex, REG_EXTENDED);
     if (status != 0) {
       ERROR("Compiling the excluding regular expression \"%s\" failed.",
             excluderegex);
+      regfree(&obj->regex);
+      sfree(obj->literal);
       sfree(obj);
       return NULL;
     }
@@ -307,6 +476,7 @@ void match_destroy(cu_match_t *obj) {
     regfree(&obj->regex);
   if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX)
     regfree(&obj->excluderegex);
+  sfree(obj->literal);
   if ((obj->user_data != NULL) && (obj->free != NULL))
     (*obj->free)(obj->user_data);
 
@@ -322,16 +492,10 @@ int match_apply(cu_match_t *obj, const char *str) {
   if ((obj == NULL) || (str == NULL))
     return -1;
 
-  if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX) {
-    status =
-        regexec(&obj->excluderegex, str, STATIC_ARRAY_SIZE(re_match), re_match,
-                /* eflags = */ 0);
-    /* Regex did match, so exclude this line */
-    if (status == 0) {
-      DEBUG("ExludeRegex matched, don't count that line\n");
-      return 0;
-    }
-  }
+  /* The line can not match without the literal; most lines are rejected
+   * here. */
+  if ((obj->literal != NULL) && (strstr(str, obj->literal) == NULL))
+    return 0;
 
   status = regexec(&obj->regex, str, STATIC_ARRAY_SIZE(re_match), re_match,
                    /* eflags = */ 0);
@@ -340,6 +504,16 @@ int match_apply(cu_match_t *obj, const char *str) {
   if (status != 0)
     return 0;
 
+  /* Only lines which match are checked against the exclude regex. */
+  if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX) {
+    regmatch_t exclude_match[1];
+    if (regexec(&obj->excluderegex, str, STATIC_ARRAY_SIZE(exclude_match),
+                exclude_match, /* eflags = */ 0) == 0) {
+      DEBUG("ExludeRegex matched, don't count that line\n");
+      return 0;
+    }
+  }
+
   for (matches_num = 0; matches_num < STATIC_ARRAY_SIZE(matches);
        matches_num++) {
     if ((re_match[matches_num].rm_so < 0) || (re_match[matches_num].rm_eo < 0))
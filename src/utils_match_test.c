@@ -0,0 +1,107 @@
+/**
+ * collectd - src/utils_match_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "testing.h"
+#include "utils_match.c" /* sic */
+
+DEF_TEST(required_literal) {
+  struct {
+    char const *regex;
+    char const *want;
+  } cases[] = {
+      {"S=([1-9][0-9]*)", "S="},
+      {"\\<R=local_user\\>", "R=local_user"},
+      {"l=([0-9]*\\.[0-9]*)", "l="},
+      {"^foo bar$", "foo bar"},
+      {"ab?cdef", "cdef"},
+      {"abc+def", "abc"},
+      {"ab{0,2}cd", "cd"},
+      {"x[a-z]*yz\\.log", "yz.log"},
+      {"[[:alpha:]]]one", "]one"},
+      {"(a|b)long", "long"},
+      {"foo|barbaz", NULL},
+      {"\\w+\\s", NULL},
+      {".*", NULL},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    char *got = match_required_literal(cases[i].regex);
+    printf("# regex \"%s\"\n", cases[i].regex);
+    if (cases[i].want == NULL) {
+      EXPECT_EQ_PTR(NULL, got);
+    } else {
+      EXPECT_EQ_STR(cases[i].want, got);
+    }
+    sfree(got);
+  }
+
+  return 0;
+}
+
+static int count_callback(__attribute__((unused)) const char *str,
+                          __attribute__((unused)) char *const *matches,
+                          __attribute__((unused)) size_t matches_num,
+                          void *user_data) {
+  (*(int *)user_data)++;
+  return 0;
+}
+
+DEF_TEST(apply) {
+  struct {
+    char const *regex;
+    char const *excluderegex;
+    char const *line;
+    int want;
+  } cases[] = {
+      {"S=([1-9][0-9]*)", NULL, "from=<a> S=1234 id=x", 1},
+      {"S=([1-9][0-9]*)", NULL, "from=<a> id=x", 0},
+      {"S=([1-9][0-9]*)", NULL, "from=<a> S=0", 0},
+      {"\\<R=local_user\\>", "mail_spool defer", "R=local_user T=x", 1},
+      {"\\<R=local_user\\>", "mail_spool defer", "R=local_user mail_spool defer",
+       0},
+      {"\\<R=local_user\\>", "mail_spool defer", "XR=local_user", 0},
+      {"foo|bar", NULL, "a bar b", 1},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    int got = 0;
+    cu_match_t *m = match_create_callback(
+        cases[i].regex, cases[i].excluderegex, count_callback, &got, NULL);
+    CHECK_NOT_NULL(m);
+
+    printf("# regex \"%s\", line \"%s\"\n", cases[i].regex, cases[i].line);
+    EXPECT_EQ_INT(0, match_apply(m, cases[i].line));
+    EXPECT_EQ_INT(cases[i].want, got);
+
+    match_destroy(m);
+  }
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(required_literal);
+  RUN_TEST(apply);
+
+  END_TEST;
+}
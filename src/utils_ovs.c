@@ -52,7 +52,7 @@
  * |                |  |  +------------------------+                      |       |
  * |                |  |                                                  |       |
  * |                |  |    +------------------+             +------------+----+  |
- * |  +----------+  |  |    |thread|           |             |thread|          |  |
+ * |  +----------+  |  |    |thread|           |             |event loop|      |  |
  * |  |   init   |  |  |    |                  |  reconnect  |                 |  |
  * |  | callback +<---------+   EVENT WORKER   +<------------+   POLL WORKER   |  |
  * |  +----------+  |  |    +------------------+             +--------+--------+  |
@@ -101,19 +101,15 @@
           ##__VA_ARGS__);                                                      \
   } while (0)
 
-#define OVS_DB_POLL_TIMEOUT 1           /* poll receive timeout (sec) */
+#define OVS_DB_RECONNECT_INTERVAL 1     /* reconnect interval (sec) */
 #define OVS_DB_POLL_READ_BLOCK_SIZE 512 /* read block size (bytes) */
 #define OVS_DB_DEFAULT_DB_NAME "Open_vSwitch"
 
 #define OVS_DB_EVENT_NONE 0
-#define OVS_DB_EVENT_TIMEOUT 5 /* event thread timeout (sec) */
 #define OVS_DB_EVENT_TERMINATE 1
 #define OVS_DB_EVENT_CONN_ESTABLISHED 2
 #define OVS_DB_EVENT_CONN_TERMINATED 3
 
-#define OVS_DB_POLL_STATE_RUNNING 1
-#define OVS_DB_POLL_STATE_EXITING 2
-
 #define OVS_DB_SEND_REQ_TIMEOUT 5 /* send request timeout (sec) */
 
 #define OVS_YAJL_CALL(func, ...)                                               \
@@ -139,6 +135,8 @@ typedef struct ovs_json_reader_s ovs_json_reader_t;
 struct ovs_result_cb_s {
   sem_t sync;
   ovs_db_result_cb_t call;
+  bool quiet_error; /* do not pass error replies to `call' */
+  bool error;       /* error reply has been received */
 };
 typedef struct ovs_result_cb_s ovs_result_cb_t;
 
@@ -169,17 +167,19 @@ struct ovs_event_thread_s {
 };
 typedef struct ovs_event_thread_s ovs_event_thread_t;
 
-/* Poll thread data declaration */
-struct ovs_poll_thread_s {
-  pthread_t tid;
-  pthread_mutex_t mutex;
-  int state;
+/* Poll data declaration. The connection is watched by the daemon's event
+ * loop, which also runs the reconnect timer while it is down. */
+struct ovs_poll_s {
+  ovs_json_reader_t *jreader;
+  char fd_name[DATA_MAX_NAME_LEN];
+  char timer_name[DATA_MAX_NAME_LEN];
+  bool started;
 };
-typedef struct ovs_poll_thread_s ovs_poll_thread_t;
+typedef struct ovs_poll_s ovs_poll_t;
 
 /* OVS DB internal data declaration */
 struct ovs_db_s {
-  ovs_poll_thread_t poll_thread;
+  ovs_poll_t poll;
   ovs_event_thread_t event_thread;
   pthread_mutex_t mutex;
   ovs_callback_t *remote_cb;
@@ -188,6 +188,7 @@ struct ovs_db_s {
   char node[OVS_DB_ADDR_NODE_SIZE];
   char unix_path[OVS_DB_ADDR_NODE_SIZE];
   int sock;
+  bool monitor_cond_unsupported; /* server rejected "monitor_cond" */
 };
 
 /* Global variables */
@@ -207,16 +208,6 @@ static void ovs_db_event_post(ovs_db_t *pdb, int event) {
   pthread_cond_signal(&pdb->event_thread.cond);
 }
 
-/* Check if POLL thread is still running. Returns
- * 1 if running otherwise 0 is returned */
-static bool ovs_db_poll_is_running(ovs_db_t *pdb) {
-  int state = 0;
-  pthread_mutex_lock(&pdb->poll_thread.mutex);
-  state = pdb->poll_thread.state;
-  pthread_mutex_unlock(&pdb->poll_thread.mutex);
-  return state == OVS_DB_POLL_STATE_RUNNING;
-}
-
 /* Generate unique identifier (UID). It is used by OVS DB API
  * to set "id" field for any OVS DB JSON request. */
 static uint64_t ovs_uid_generate() {
@@ -530,8 +521,10 @@ static int ovs_db_result_cb(ovs_db_t *pdb, yajl_val jnode) {
   pthread_mutex_lock(&pdb->mutex);
   cb = ovs_db_table_callback_get(pdb, jid);
   if (cb != NULL && cb->result.call != NULL) {
+    cb->result.error = !YAJL_IS_NULL(jerror);
     /* call registered callback */
-    cb->result.call(jresult, jerror);
+    if (!cb->result.error || !cb->result.quiet_error)
+      cb->result.call(jresult, jerror);
     /* unlock owner of the reply */
     sem_post(&cb->result.sync);
   }
@@ -542,7 +535,8 @@ static int ovs_db_result_cb(ovs_db_t *pdb, yajl_val jnode) {
 
 /* Handle JSON data (one request) and call
  * appropriate event OVS DB handler. Currently,
- * update callback 'ovs_db_table_update_cb' and
+ * update callback 'ovs_db_table_update_cb' (for both
+ * "update" and "update2" notifications) and
  * result callback 'ovs_db_result_cb' is supported.
  */
 static int ovs_db_json_data_process(ovs_db_t *pdb, const char *data,
@@ -581,8 +575,9 @@ static int ovs_db_json_data_process(ovs_db_t *pdb, const char *data,
       /* echo request from the server */
       if (ovs_db_table_echo_cb(pdb, jnode) < 0)
         OVS_ERROR("handle echo request failed");
-    } else if (strcmp("update", method) == 0) {
-      /* update notification */
+    } else if ((strcmp("update", method) == 0) ||
+               (strcmp("update2", method) == 0)) {
+      /* update notification, "update2" carries <table-updates2> */
       if (ovs_db_table_update_cb(pdb, jnode) < 0)
         OVS_ERROR("handle update notification failed");
     }
@@ -773,79 +768,93 @@ static void ovs_db_reconnect(ovs_db_t *pdb) {
   freeaddrinfo(result);
 }
 
-/* POLL worker thread.
- * It listens on OVS DB connection for incoming
- * requests/reply/events etc. Also, it reconnects to OVS DB
- * if connection has been lost.
+static int ovs_db_poll_cb(int fd, int revents, user_data_t *ud);
+
+/* Reconnect timer. Runs in the event loop while the connection is down and
+ * starts watching the new connection once it has been established. */
+static int ovs_db_reconnect_cb(user_data_t *ud) {
+  ovs_db_t *pdb = ud->data;
+
+  ovs_db_reconnect(pdb);
+  if (pdb->sock < 0)
+    return 0;
+
+  if (plugin_register_fd(pdb->poll.fd_name, pdb->sock, POLLIN | POLLPRI,
+                         ovs_db_poll_cb, &(user_data_t){.data = pdb}) != 0) {
+    OVS_ERROR("watching the OVS DB connection failed");
+    close(pdb->sock);
+    pdb->sock = -1;
+    return 0;
+  }
+
+  plugin_unregister_timer(pdb->poll.timer_name);
+  return 0;
+}
+
+/* Start the reconnect timer */
+static int ovs_db_reconnect_start(ovs_db_t *pdb) {
+  return plugin_register_timer(
+      pdb->poll.timer_name, TIME_T_TO_CDTIME_T(OVS_DB_RECONNECT_INTERVAL),
+      ovs_db_reconnect_cb, &(user_data_t){.data = pdb});
+}
+
+/* Stop watching the broken connection, clean-up and start reconnecting */
+static void ovs_db_poll_terminate(ovs_db_t *pdb) {
+  /* stop watching the socket before closing it, so that its number can't
+   * be reused in the meantime */
+  plugin_unregister_fd(pdb->poll.fd_name);
+  close(pdb->sock);
+  pdb->sock = -1;
+  ovs_db_event_post(pdb, OVS_DB_EVENT_CONN_TERMINATED);
+  ovs_db_callback_remove_all(pdb);
+  ovs_json_reader_reset(pdb->poll.jreader);
+
+  if (ovs_db_reconnect_start(pdb) != 0)
+    OVS_ERROR("starting the reconnect timer failed");
+}
+
+/* POLL callback.
+ * It is called by the event loop for incoming
+ * requests/reply/events etc. on the OVS DB connection.
  */
-static void *ovs_poll_worker(void *arg) {
-  ovs_db_t *pdb = (ovs_db_t *)arg; /* pointer to OVS DB */
-  ovs_json_reader_t *jreader = NULL;
-  struct pollfd poll_fd = {
-      .fd = pdb->sock, .events = POLLIN | POLLPRI, .revents = 0,
-  };
+static int ovs_db_poll_cb(int fd, int revents, user_data_t *ud) {
+  ovs_db_t *pdb = ud->data;
 
-  /* create JSON reader instance */
-  if ((jreader = ovs_json_reader_alloc()) == NULL) {
-    OVS_ERROR("initialize json reader failed");
-    return NULL;
+  if (revents & (POLLERR | POLLHUP)) {
+    /* connection is broken */
+    OVS_ERROR("poll() peer closed its end of the channel");
+    ovs_db_poll_terminate(pdb);
+    return 0;
   }
+  if (!(revents & (POLLIN | POLLPRI)))
+    return 0;
 
-  /* poll data */
-  while (ovs_db_poll_is_running(pdb)) {
-    poll_fd.fd = pdb->sock;
-    int poll_ret = poll(&poll_fd, 1, /* ms */ OVS_DB_POLL_TIMEOUT * 1000);
-    if (poll_ret < 0) {
-      OVS_ERROR("poll(): %s", STRERRNO);
-      break;
-    } else if (poll_ret == 0) {
-      OVS_DEBUG("poll(): timeout");
-      if (pdb->sock < 0)
-        /* invalid fd, so try to reconnect */
-        ovs_db_reconnect(pdb);
-      continue;
-    }
-    if (poll_fd.revents & POLLNVAL) {
-      /* invalid file descriptor, clean-up */
-      ovs_db_callback_remove_all(pdb);
-      ovs_json_reader_reset(jreader);
-      /* setting poll FD to -1 tells poll() call to ignore this FD.
-       * In that case poll() call will return timeout all the time */
-      pdb->sock = (-1);
-    } else if ((poll_fd.revents & POLLERR) || (poll_fd.revents & POLLHUP)) {
-      /* connection is broken */
-      close(poll_fd.fd);
-      ovs_db_event_post(pdb, OVS_DB_EVENT_CONN_TERMINATED);
-      OVS_ERROR("poll() peer closed its end of the channel");
-    } else if ((poll_fd.revents & POLLIN) || (poll_fd.revents & POLLPRI)) {
-      /* read incoming data */
-      char buff[OVS_DB_POLL_READ_BLOCK_SIZE];
-      ssize_t nbytes = recv(poll_fd.fd, buff, sizeof(buff), 0);
-      if (nbytes < 0) {
-        OVS_ERROR("recv(): %s", STRERRNO);
-        /* read error? Try to reconnect */
-        close(poll_fd.fd);
-        continue;
-      } else if (nbytes == 0) {
-        close(poll_fd.fd);
-        ovs_db_event_post(pdb, OVS_DB_EVENT_CONN_TERMINATED);
-        OVS_ERROR("recv() peer has performed an orderly shutdown");
-        continue;
-      }
-      /* read incoming data */
-      size_t json_len = 0;
-      const char *json = NULL;
-      OVS_DEBUG("recv(): received %zd bytes of data", nbytes);
-      ovs_json_reader_push_data(jreader, buff, nbytes);
-      while (!ovs_json_reader_pop(jreader, &json, &json_len))
-        /* process JSON data */
-        ovs_db_json_data_process(pdb, json, json_len);
-    }
+  /* read incoming data */
+  char buff[OVS_DB_POLL_READ_BLOCK_SIZE];
+  ssize_t nbytes = recv(fd, buff, sizeof(buff), 0);
+  if (nbytes < 0) {
+    if ((errno == EAGAIN) || (errno == EINTR))
+      return 0;
+    OVS_ERROR("recv(): %s", STRERRNO);
+    /* read error? Try to reconnect */
+    ovs_db_poll_terminate(pdb);
+    return 0;
+  } else if (nbytes == 0) {
+    OVS_ERROR("recv() peer has performed an orderly shutdown");
+    ovs_db_poll_terminate(pdb);
+    return 0;
   }
 
-  OVS_DEBUG("poll thread has been completed");
-  ovs_json_reader_free(jreader);
-  return NULL;
+  /* process incoming data */
+  size_t json_len = 0;
+  const char *json = NULL;
+  OVS_DEBUG("recv(): received %zd bytes of data", nbytes);
+  ovs_json_reader_push_data(pdb->poll.jreader, buff, nbytes);
+  while (!ovs_json_reader_pop(pdb->poll.jreader, &json, &json_len))
+    /* process JSON data */
+    ovs_db_json_data_process(pdb, json, json_len);
+
+  return 0;
 }
 
 /* EVENT worker thread.
@@ -857,17 +866,19 @@ static void *ovs_event_worker(void *arg) {
   ovs_db_t *pdb = (ovs_db_t *)arg;
 
   while (pdb->event_thread.value != OVS_DB_EVENT_TERMINATE) {
-    /* wait for an event */
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    ts.tv_sec += (OVS_DB_EVENT_TIMEOUT);
-    int ret = pthread_cond_timedwait(&pdb->event_thread.cond,
-                                     &pdb->event_thread.mutex, &ts);
-    if (!ret || ret == ETIMEDOUT) {
+    /* wait for an event. The mutex is only released while waiting, so no
+     * event can be posted without waking the thread up. */
+    int ret = pthread_cond_wait(&pdb->event_thread.cond,
+                                &pdb->event_thread.mutex);
+    if (!ret) {
       /* handle the event */
       OVS_DEBUG("handle event %d", pdb->event_thread.value);
       switch (pdb->event_thread.value) {
       case OVS_DB_EVENT_CONN_ESTABLISHED:
+        /* the server may have been upgraded, probe "monitor_cond" again */
+        pthread_mutex_lock(&pdb->mutex);
+        pdb->monitor_cond_unsupported = false;
+        pthread_mutex_unlock(&pdb->mutex);
         if (pdb->cb.post_conn_init)
           pdb->cb.post_conn_init(pdb);
         /* reset event */
@@ -880,8 +891,7 @@ static void *ovs_event_worker(void *arg) {
         pdb->event_thread.value = OVS_DB_EVENT_NONE;
         break;
       case OVS_DB_EVENT_NONE:
-        /* wait timeout */
-        OVS_DEBUG("no event received (timeout)");
+        /* spurious wakeup */
         break;
       default:
         OVS_DEBUG("unknown event received");
@@ -889,7 +899,7 @@ static void *ovs_event_worker(void *arg) {
       }
     } else {
       /* unexpected error */
-      OVS_ERROR("pthread_cond_timedwait() failed");
+      OVS_ERROR("pthread_cond_wait() failed");
       break;
     }
   }
@@ -957,42 +967,39 @@ static void ovs_db_event_thread_data_destroy(ovs_db_t *pdb) {
   pthread_cond_destroy(&pdb->event_thread.cond);
 }
 
-/* Initialize POLL thread */
-static int ovs_db_poll_thread_init(ovs_db_t *pdb) {
-  pdb->poll_thread.tid = (pthread_t){0};
-  /* init event thread mutex */
-  if (pthread_mutex_init(&pdb->poll_thread.mutex, NULL)) {
+/* Start polling the OVS DB connection. The first connection attempt is made
+ * by the reconnect timer, so that it doesn't delay the caller. */
+static int ovs_db_poll_init(ovs_db_t *pdb) {
+  if ((pdb->poll.jreader = ovs_json_reader_alloc()) == NULL) {
+    OVS_ERROR("initialize json reader failed");
     return -1;
   }
-  /* start poll thread */
-  pthread_t tid;
-  pdb->poll_thread.state = OVS_DB_POLL_STATE_RUNNING;
-  if (plugin_thread_create(&tid, NULL, ovs_poll_worker, pdb,
-                           "utils_ovs:poll") != 0) {
-    pthread_mutex_destroy(&pdb->poll_thread.mutex);
+  snprintf(pdb->poll.fd_name, sizeof(pdb->poll.fd_name), "utils_ovs/%p/poll",
+           (void *)pdb);
+  snprintf(pdb->poll.timer_name, sizeof(pdb->poll.timer_name),
+           "utils_ovs/%p/reconnect", (void *)pdb);
+  if (ovs_db_reconnect_start(pdb) != 0) {
+    ovs_json_reader_free(pdb->poll.jreader);
+    pdb->poll.jreader = NULL;
     return -1;
   }
-  pdb->poll_thread.tid = tid;
+  pdb->poll.started = true;
   return 0;
 }
 
-/* Destroy POLL thread */
-/* XXX: Must hold pdb->mutex when calling! */
-static int ovs_db_poll_thread_destroy(ovs_db_t *pdb) {
-  if (pthread_equal(pdb->poll_thread.tid, (pthread_t){0})) {
+/* Stop polling. Must not be called with pdb->mutex held, because the poll
+ * callback, which may be running, takes it. */
+static void ovs_db_poll_destroy(ovs_db_t *pdb) {
+  if (!pdb->poll.started) {
     /* already destroyed */
-    return 0;
+    return;
   }
-  /* change thread state */
-  pthread_mutex_lock(&pdb->poll_thread.mutex);
-  pdb->poll_thread.state = OVS_DB_POLL_STATE_EXITING;
-  pthread_mutex_unlock(&pdb->poll_thread.mutex);
-  /* join the thread */
-  if (pthread_join(pdb->poll_thread.tid, NULL) != 0)
-    return -1;
-  pthread_mutex_destroy(&pdb->poll_thread.mutex);
-  pdb->poll_thread.tid = (pthread_t){0};
-  return 0;
+  plugin_unregister_fd(pdb->poll.fd_name);
+  plugin_unregister_timer(pdb->poll.timer_name);
+  ovs_json_reader_free(pdb->poll.jreader);
+  pdb->poll.jreader = NULL;
+  pdb->poll.started = false;
+  OVS_DEBUG("polling has been stopped");
 }
 
 /*
@@ -1055,8 +1062,8 @@ ovs_db_t *ovs_db_init(const char *node, const char *service,
       return NULL;
   }
 
-  /* init polling thread */
-  if (ovs_db_poll_thread_init(pdb) < 0) {
+  /* init polling */
+  if (ovs_db_poll_init(pdb) < 0) {
     ret = ovs_db_destroy(pdb);
     if (ret > 0) {
       ovs_db_event_thread_data_destroy(pdb);
@@ -1073,8 +1080,12 @@ failure:
   return NULL;
 }
 
-int ovs_db_send_request(ovs_db_t *pdb, const char *method, const char *params,
-                        ovs_db_result_cb_t cb) {
+/* Send the request and wait for the reply if `cb' is set. If `quiet_error'
+ * is true, an error reply is not passed to `cb' and is reported through
+ * `error' instead. */
+static int ovs_db_send_request_ex(ovs_db_t *pdb, const char *method,
+                                  const char *params, ovs_db_result_cb_t cb,
+                                  bool quiet_error, bool *error) {
   int ret = 0;
   yajl_gen_status yajl_gen_ret;
   yajl_val jparams;
@@ -1127,6 +1138,7 @@ int ovs_db_send_request(ovs_db_t *pdb, const char *method, const char *params,
     /* add new callback to front */
     sem_init(&new_cb->result.sync, 0, 0);
     new_cb->result.call = cb;
+    new_cb->result.quiet_error = quiet_error;
     new_cb->uid = uid;
     ovs_db_callback_add(pdb, new_cb);
   }
@@ -1143,6 +1155,10 @@ int ovs_db_send_request(ovs_db_t *pdb, const char *method, const char *params,
         OVS_ERROR("%s() no replay received within %d sec", __FUNCTION__,
                   OVS_DB_SEND_REQ_TIMEOUT);
         ret = (-1);
+      } else if (error != NULL) {
+        pthread_mutex_lock(&pdb->mutex);
+        *error = new_cb->result.error;
+        pthread_mutex_unlock(&pdb->mutex);
       }
     }
   } else {
@@ -1162,6 +1178,16 @@ yajl_gen_failure:
   return (yajl_gen_ret != yajl_gen_status_ok) ? (-1) : ret;
 }
 
+int ovs_db_send_request(ovs_db_t *pdb, const char *method, const char *params,
+                        ovs_db_result_cb_t cb) {
+  return ovs_db_send_request_ex(pdb, method, params, cb, false, NULL);
+}
+
+/* Result callback used to wait for "monitor_cond" reply if
+ * the caller hasn't provided its own result callback */
+static void ovs_db_result_ignore_cb(__attribute__((unused)) yajl_val jresult,
+                                    __attribute__((unused)) yajl_val jerror) {}
+
 int ovs_db_table_cb_register(ovs_db_t *pdb, const char *tb_name,
                              const char **tb_column,
                              ovs_db_table_cb_t update_cb,
@@ -1173,6 +1199,7 @@ int ovs_db_table_cb_register(ovs_db_t *pdb, const char *tb_name,
   char *params;
   size_t params_len;
   int ovs_db_ret = 0;
+  bool monitor_cond = false;
 
   /* sanity check */
   if (pdb == NULL || tb_name == NULL || update_cb == NULL)
@@ -1252,6 +1279,35 @@ int ovs_db_table_cb_register(ovs_db_t *pdb, const char *tb_name,
   /* make a request to subscribe to given table */
   OVS_YAJL_CALL(yajl_gen_get_buf, jgen, (const unsigned char **)&params,
                 &params_len);
+
+  if (flags & OVS_DB_TABLE_CB_FLAG_UPDATE2) {
+    pthread_mutex_lock(&pdb->mutex);
+    monitor_cond = !pdb->monitor_cond_unsupported;
+    pthread_mutex_unlock(&pdb->mutex);
+  }
+
+  if (monitor_cond) {
+    /* <monitor-cond-requests> without "where" clause have the same format
+     * as <monitor-requests>, so same params are used for both methods */
+    bool error = false;
+    if (ovs_db_send_request_ex(pdb, "monitor_cond", params,
+                               (result_cb != NULL) ? result_cb
+                                                   : ovs_db_result_ignore_cb,
+                               true, &error) < 0) {
+      OVS_ERROR("Failed to subscribe to \"%s\" table", tb_name);
+      ovs_db_ret = (-1);
+      goto yajl_gen_failure;
+    }
+    if (!error)
+      goto yajl_gen_failure;
+
+    /* older servers do not support "monitor_cond", use "monitor" */
+    OVS_DEBUG("\"monitor_cond\" is not supported, fall back to \"monitor\"");
+    pthread_mutex_lock(&pdb->mutex);
+    pdb->monitor_cond_unsupported = true;
+    pthread_mutex_unlock(&pdb->mutex);
+  }
+
   if (ovs_db_send_request(pdb, "monitor", params, result_cb) < 0) {
     OVS_ERROR("Failed to subscribe to \"%s\" table", tb_name);
     ovs_db_ret = (-1);
@@ -1271,6 +1327,9 @@ int ovs_db_destroy(ovs_db_t *pdb) {
   if (pdb == NULL)
     return -1;
 
+  /* stop polling */
+  ovs_db_poll_destroy(pdb);
+
   /* stop event thread */
   if (ovs_db_event_thread_terminate(pdb) < 0) {
     OVS_ERROR("stop event thread failed");
@@ -1283,12 +1342,6 @@ int ovs_db_destroy(ovs_db_t *pdb) {
     return ret;
   }
 
-  /* stop poll thread and destroy thread's private data */
-  if (ovs_db_poll_thread_destroy(pdb) < 0) {
-    OVS_ERROR("destroy poll thread failed");
-    ovs_db_ret = -1;
-  }
-
   /* destroy event thread private data */
   ovs_db_event_thread_data_destroy(pdb);
 
@@ -161,6 +161,7 @@ int ovs_db_send_request(ovs_db_t *pdb, const char *method, const char *params,
 #define OVS_DB_TABLE_CB_FLAG_DELETE 0x04U
 #define OVS_DB_TABLE_CB_FLAG_MODIFY 0x08U
 #define OVS_DB_TABLE_CB_FLAG_ALL 0x0FU
+#define OVS_DB_TABLE_CB_FLAG_UPDATE2 0x10U
 
 /*
  * NAME
@@ -188,6 +189,16 @@ int ovs_db_send_request(ovs_db_t *pdb, const char *method, const char *params,
  *                   OVS_DB_TABLE_CB_FLAG_DELETE  Receive table remove events.
  *                   OVS_DB_TABLE_CB_FLAG_MODIFY  Receive table update events.
  *                   OVS_DB_TABLE_CB_FLAG_ALL     Receive all events.
+ *                   OVS_DB_TABLE_CB_FLAG_UPDATE2 Subscribe with "monitor_cond"
+ *                                               and receive <table-updates2>
+ *                                               ("initial", "insert", "delete"
+ *                                               and "modify" rows, where
+ *                                               "modify" holds changed columns
+ *                                               only). If the server doesn't
+ *                                               support it, "monitor" is used
+ *                                               and <table-updates> ("old" and
+ *                                               "new" rows) are received, so
+ *                                               callbacks must handle both.
  *
  * RETURN VALUE
  *   Zero upon success or non-zero if an error occurred.
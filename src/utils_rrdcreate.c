@@ -38,6 +38,9 @@ struct srrd_create_args_s {
   time_t last_up;
   int argc;
   char **argv;
+  bool preallocate;
+
+  struct srrd_create_args_s *next;
 };
 typedef struct srrd_create_args_s srrd_create_args_t;
 
@@ -64,6 +67,21 @@ static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
 static async_create_file_t *async_creation_list;
 static pthread_mutex_t async_creation_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Asynchronous creations are queued and handled by a fixed number of worker
+ * threads. A token bucket holding up to one second worth of tokens limits the
+ * rate at which files are created; a rate of zero disables the limit. */
+static srrd_create_args_t *create_queue_head;
+static srrd_create_args_t *create_queue_tail;
+static size_t create_queue_length;
+static pthread_t *create_threads;
+static size_t create_threads_num;
+static bool create_pool_running;
+static double create_rate;
+static double create_tokens;
+static cdtime_t create_tokens_last;
+static pthread_mutex_t create_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t create_pool_cond = PTHREAD_COND_INITIALIZER;
+
 /*
  * Private functions
  */
@@ -478,92 +496,219 @@ static int unlock_file(char const *filename) /* {{{ */
   return 0;
 } /* }}} int unlock_file */
 
-static void *srrd_create_thread(void *targs) /* {{{ */
+#if HAVE_POSIX_FALLOCATE
+/* Reserves the blocks backing "filename" so that the file's extents are
+ * allocated in one go rather than piecemeal by later updates. */
+static void srrd_preallocate(const char *filename) /* {{{ */
 {
-  srrd_create_args_t *args = targs;
-  char tmpfile[PATH_MAX];
-  int status;
+  int fd = open(filename, O_RDWR);
+  if (fd < 0) {
+    P_WARNING("srrd_preallocate: open (%s) failed: %s", filename, STRERRNO);
+    return;
+  }
 
-  status = lock_file(args->filename);
-  if (status != 0) {
-    if (status == EEXIST)
-      P_NOTICE("srrd_create_thread: File \"%s\" is already being created.",
-               args->filename);
-    else
-      P_ERROR("srrd_create_thread: Unable to lock file \"%s\".",
-              args->filename);
-    srrd_create_args_destroy(args);
-    return 0;
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    P_WARNING("srrd_preallocate: fstat (%s) failed: %s", filename, STRERRNO);
+    close(fd);
+    return;
   }
 
+  int status = posix_fallocate(fd, 0, sb.st_size);
+  if ((status != 0) && (status != EOPNOTSUPP) && (status != EINVAL))
+    P_WARNING("srrd_preallocate: posix_fallocate (%s) failed: %s", filename,
+              STRERROR(status));
+
+  close(fd);
+} /* }}} void srrd_preallocate */
+#else
+static void srrd_preallocate(__attribute__((unused)) const char *filename) {
+} /* void srrd_preallocate */
+#endif
+
+static int srrd_create_file(srrd_create_args_t *args) /* {{{ */
+{
+  char tmpfile[PATH_MAX];
+  int status;
+
   snprintf(tmpfile, sizeof(tmpfile), "%s.async", args->filename);
 
   status = srrd_create(tmpfile, args->pdp_step, args->last_up, args->argc,
                        (void *)args->argv);
   if (status != 0) {
-    P_WARNING("srrd_create_thread: srrd_create (%s) returned status %i.",
+    P_WARNING("srrd_create_file: srrd_create (%s) returned status %i.",
               args->filename, status);
     unlink(tmpfile);
-    unlock_file(args->filename);
-    srrd_create_args_destroy(args);
-    return 0;
+    return status;
   }
 
+  if (args->preallocate)
+    srrd_preallocate(tmpfile);
+
   status = rename(tmpfile, args->filename);
   if (status != 0) {
-    P_ERROR("srrd_create_thread: rename (\"%s\", \"%s\") failed: %s", tmpfile,
+    P_ERROR("srrd_create_file: rename (\"%s\", \"%s\") failed: %s", tmpfile,
             args->filename, STRERRNO);
     unlink(tmpfile);
+    return status;
+  }
+
+  DEBUG("srrd_create_file: Successfully created RRD file \"%s\".",
+        args->filename);
+  return 0;
+} /* }}} int srrd_create_file */
+
+/* Takes one token from the creation rate limiter, waiting for the bucket to
+ * refill if necessary. Returns false if the pool is shutting down. Must be
+ * called with create_pool_lock held. */
+static bool srrd_create_take_token(void) /* {{{ */
+{
+  while (create_pool_running) {
+    if (create_rate <= 0.0)
+      return true;
+
+    cdtime_t now = cdtime();
+    double burst = (create_rate > 1.0) ? create_rate : 1.0;
+
+    create_tokens += CDTIME_T_TO_DOUBLE(now - create_tokens_last) * create_rate;
+    if (create_tokens > burst)
+      create_tokens = burst;
+    create_tokens_last = now;
+
+    if (create_tokens >= 1.0) {
+      create_tokens -= 1.0;
+      return true;
+    }
+
+    cdtime_t wait = DOUBLE_TO_CDTIME_T((1.0 - create_tokens) / create_rate);
+    pthread_cond_timedwait(&create_pool_cond, &create_pool_lock,
+                           &CDTIME_T_TO_TIMESPEC(now + wait));
+  }
+
+  return false;
+} /* }}} bool srrd_create_take_token */
+
+static void *srrd_create_thread(__attribute__((unused)) void *arg) /* {{{ */
+{
+  pthread_mutex_lock(&create_pool_lock);
+  while (true) {
+    while (create_pool_running && (create_queue_head == NULL))
+      pthread_cond_wait(&create_pool_cond, &create_pool_lock);
+
+    if (!create_pool_running || !srrd_create_take_token())
+      break;
+
+    /* Another worker may have emptied the queue while we were waiting for a
+     * token; give the token back in that case. */
+    srrd_create_args_t *args = create_queue_head;
+    if (args == NULL) {
+      create_tokens += 1.0;
+      continue;
+    }
+
+    create_queue_head = args->next;
+    if (create_queue_head == NULL)
+      create_queue_tail = NULL;
+    args->next = NULL;
+    create_queue_length--;
+    pthread_mutex_unlock(&create_pool_lock);
+
+    srrd_create_file(args);
     unlock_file(args->filename);
     srrd_create_args_destroy(args);
-    return 0;
+
+    pthread_mutex_lock(&create_pool_lock);
   }
+  pthread_mutex_unlock(&create_pool_lock);
 
-  DEBUG("srrd_create_thread: Successfully created RRD file \"%s\".",
-        args->filename);
+  return NULL;
+} /* }}} void *srrd_create_thread */
+
+/* Starts the worker pool. Must be called with create_pool_lock held. */
+static int srrd_create_pool_start(const rrdcreate_config_t *cfg) /* {{{ */
+{
+  size_t num = (cfg->async_threads > 0) ? (size_t)cfg->async_threads : 1;
+
+  create_threads = calloc(num, sizeof(*create_threads));
+  if (create_threads == NULL) {
+    P_ERROR("srrd_create_pool_start: calloc failed.");
+    return ENOMEM;
+  }
+
+  create_rate = cfg->create_rate;
+  create_tokens = (create_rate > 1.0) ? create_rate : 1.0;
+  create_tokens_last = cdtime();
+  create_pool_running = true;
 
-  unlock_file(args->filename);
-  srrd_create_args_destroy(args);
+  for (size_t i = 0; i < num; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "rrdcreate#%" PRIsz, i);
+
+    int status = plugin_thread_create(&create_threads[create_threads_num],
+                                      NULL, srrd_create_thread, NULL, name);
+    if (status != 0) {
+      P_ERROR("srrd_create_pool_start: plugin_thread_create failed: %s",
+              STRERROR(status));
+      continue;
+    }
+    create_threads_num++;
+  }
+
+  if (create_threads_num == 0) {
+    create_pool_running = false;
+    sfree(create_threads);
+    return -1;
+  }
 
   return 0;
-} /* }}} void *srrd_create_thread */
+} /* }}} int srrd_create_pool_start */
 
 static int srrd_create_async(const char *filename, /* {{{ */
                              unsigned long pdp_step, time_t last_up, int argc,
-                             const char **argv) {
+                             const char **argv,
+                             const rrdcreate_config_t *cfg) {
   srrd_create_args_t *args;
-  pthread_t thread;
-  pthread_attr_t attr;
   int status;
 
-  DEBUG("srrd_create_async: Creating \"%s\" in the background.", filename);
-
-  args = srrd_create_args_create(filename, pdp_step, last_up, argc, argv);
-  if (args == NULL)
-    return -1;
-
-  status = pthread_attr_init(&attr);
+  status = lock_file(filename);
   if (status != 0) {
-    srrd_create_args_destroy(args);
-    return -1;
+    if (status == EEXIST) {
+      DEBUG("srrd_create_async: File \"%s\" is already being created.",
+            filename);
+      return 0;
+    }
+    P_ERROR("srrd_create_async: Unable to lock file \"%s\".", filename);
+    return status;
   }
 
-  status = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-  if (status != 0) {
-    pthread_attr_destroy(&attr);
-    srrd_create_args_destroy(args);
+  DEBUG("srrd_create_async: Creating \"%s\" in the background.", filename);
+
+  args = srrd_create_args_create(filename, pdp_step, last_up, argc, argv);
+  if (args == NULL) {
+    unlock_file(filename);
     return -1;
   }
+  args->preallocate = cfg->preallocate;
 
-  status = pthread_create(&thread, &attr, srrd_create_thread, args);
-  if (status != 0) {
-    P_ERROR("srrd_create_async: pthread_create failed: %s", STRERROR(status));
-    pthread_attr_destroy(&attr);
+  pthread_mutex_lock(&create_pool_lock);
+  if ((create_threads_num == 0) &&
+      ((status = srrd_create_pool_start(cfg)) != 0)) {
+    pthread_mutex_unlock(&create_pool_lock);
+    unlock_file(filename);
     srrd_create_args_destroy(args);
     return status;
   }
 
-  pthread_attr_destroy(&attr);
+  if (create_queue_tail == NULL)
+    create_queue_head = args;
+  else
+    create_queue_tail->next = args;
+  create_queue_tail = args;
+  create_queue_length++;
+
+  pthread_cond_signal(&create_pool_cond);
+  pthread_mutex_unlock(&create_pool_lock);
+
   /* args is freed in srrd_create_thread(). */
   return 0;
 } /* }}} int srrd_create_async */
@@ -623,7 +768,7 @@ int cu_rrd_create_file(const char *filename, /* {{{ */
 
   if (cfg->async) {
     status = srrd_create_async(filename, stepsize, last_up, argc,
-                               (const char **)argv);
+                               (const char **)argv, cfg);
     if (status != 0)
       P_WARNING("cu_rrd_create_file: srrd_create_async (%s) "
                 "returned status %i.",
@@ -645,6 +790,8 @@ int cu_rrd_create_file(const char *filename, /* {{{ */
         P_WARNING("cu_rrd_create_file: srrd_create (%s) returned status %i.",
                   filename, status);
       } else {
+        if (cfg->preallocate)
+          srrd_preallocate(filename);
         DEBUG("cu_rrd_create_file: Successfully created RRD file \"%s\".",
               filename);
       }
@@ -658,3 +805,33 @@ int cu_rrd_create_file(const char *filename, /* {{{ */
 
   return status;
 } /* }}} int cu_rrd_create_file */
+
+void cu_rrd_create_shutdown(void) /* {{{ */
+{
+  pthread_mutex_lock(&create_pool_lock);
+  create_pool_running = false;
+  pthread_cond_broadcast(&create_pool_cond);
+  pthread_mutex_unlock(&create_pool_lock);
+
+  for (size_t i = 0; i < create_threads_num; i++)
+    pthread_join(create_threads[i], NULL);
+  sfree(create_threads);
+  create_threads_num = 0;
+
+  pthread_mutex_lock(&create_pool_lock);
+  if (create_queue_length > 0)
+    P_INFO("cu_rrd_create_shutdown: Dropping %" PRIsz " pending RRD "
+           "file creation%s.",
+           create_queue_length, (create_queue_length == 1) ? "" : "s");
+
+  while (create_queue_head != NULL) {
+    srrd_create_args_t *args = create_queue_head;
+    create_queue_head = args->next;
+
+    unlock_file(args->filename);
+    srrd_create_args_destroy(args);
+  }
+  create_queue_tail = NULL;
+  create_queue_length = 0;
+  pthread_mutex_unlock(&create_pool_lock);
+} /* }}} void cu_rrd_create_shutdown */
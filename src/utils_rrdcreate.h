@@ -44,10 +44,17 @@ struct rrdcreate_config_s {
   size_t consolidation_functions_num;
 
   bool async;
+  int async_threads;
+  double create_rate;
+  bool preallocate;
 };
 typedef struct rrdcreate_config_s rrdcreate_config_t;
 
 int cu_rrd_create_file(const char *filename, const data_set_t *ds,
                        const value_list_t *vl, const rrdcreate_config_t *cfg);
 
+/* Stops the workers creating files asynchronously. Creations that have not
+ * been started yet are dropped. */
+void cu_rrd_create_shutdown(void);
+
 #endif /* UTILS_RRDCREATE_H */
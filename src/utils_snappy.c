@@ -0,0 +1,269 @@
+/**
+ * collectd - src/utils_snappy.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "utils_snappy.h"
+
+/*
+ * The block format is a varint holding the uncompressed size, followed by
+ * elements whose tag byte's lower two bits select the element type:
+ *
+ *   00  literal: the upper six bits hold the length minus one, or 60 - 63 for
+ *       a one to four byte little endian length minus one following the tag
+ *   01  copy of 4 - 11 bytes (upper bits 2 - 4) with an 11 bit offset (upper
+ *       bits 5 - 7 and the next byte)
+ *   10  copy of 1 - 64 bytes (upper six bits) with a two byte offset
+ *   11  copy of 1 - 64 bytes (upper six bits) with a four byte offset
+ *
+ * The input is compressed in blocks of 64 KiB, so that positions fit the
+ * 16 bit hash table and all copies can use two byte offsets.
+ */
+
+#define SNAPPY_BLOCK_SIZE 65536
+#define SNAPPY_HASH_BITS 14
+#define SNAPPY_MIN_MATCH 4
+
+static uint32_t snappy_load32(uint8_t const *p) /* {{{ */
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+} /* }}} uint32_t snappy_load32 */
+
+static uint32_t snappy_hash(uint32_t v) /* {{{ */
+{
+  return (v * 0x1e35a7bdu) >> (32 - SNAPPY_HASH_BITS);
+} /* }}} uint32_t snappy_hash */
+
+static uint8_t *snappy_emit_literal(uint8_t *op, /* {{{ */
+                                    uint8_t const *literal, size_t len) {
+  size_t n = len - 1;
+
+  if (n < 60) {
+    *op++ = (uint8_t)(n << 2);
+  } else {
+    uint8_t *tag = op++;
+    int bytes = 0;
+    while (n > 0) {
+      *op++ = (uint8_t)(n & 0xff);
+      n >>= 8;
+      bytes++;
+    }
+    *tag = (uint8_t)((59 + bytes) << 2);
+  }
+
+  memcpy(op, literal, len);
+  return op + len;
+} /* }}} uint8_t *snappy_emit_literal */
+
+static uint8_t *snappy_emit_copy(uint8_t *op, size_t offset, /* {{{ */
+                                 size_t len) {
+  /* Long matches are split into copies of 64 bytes. A remainder of less than
+   * four bytes isn't allowed for one byte offsets, hence the copy of 60. */
+  while (len >= 68) {
+    *op++ = (uint8_t)(2 | (63 << 2));
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    len -= 64;
+  }
+  if (len > 64) {
+    *op++ = (uint8_t)(2 | (59 << 2));
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    len -= 60;
+  }
+
+  if ((len < 12) && (offset < 2048)) {
+    *op++ = (uint8_t)(1 | ((len - 4) << 2) | ((offset >> 8) << 5));
+    *op++ = (uint8_t)(offset & 0xff);
+  } else {
+    *op++ = (uint8_t)(2 | ((len - 1) << 2));
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+  }
+
+  return op;
+} /* }}} uint8_t *snappy_emit_copy */
+
+static uint8_t *snappy_compress_block(uint8_t *op, /* {{{ */
+                                      uint8_t const *in, size_t in_size,
+                                      uint16_t *table) {
+  memset(table, 0, sizeof(*table) << SNAPPY_HASH_BITS);
+
+  size_t pos = 0;
+  size_t literal = 0;
+  while (pos + SNAPPY_MIN_MATCH <= in_size) {
+    uint32_t v = snappy_load32(in + pos);
+    uint32_t h = snappy_hash(v);
+    size_t candidate = table[h];
+    table[h] = (uint16_t)pos;
+
+    if ((candidate >= pos) || (snappy_load32(in + candidate) != v)) {
+      /* Skip ahead faster the longer no match has been found, so that
+       * incompressible data is passed through quickly. */
+      pos += 1 + ((pos - literal) >> 5);
+      continue;
+    }
+
+    size_t len = SNAPPY_MIN_MATCH;
+    while ((pos + len < in_size) && (in[candidate + len] == in[pos + len]))
+      len++;
+
+    if (pos > literal)
+      op = snappy_emit_literal(op, in + literal, pos - literal);
+    op = snappy_emit_copy(op, pos - candidate, len);
+
+    pos += len;
+    literal = pos;
+  }
+
+  if (literal < in_size)
+    op = snappy_emit_literal(op, in + literal, in_size - literal);
+
+  return op;
+} /* }}} uint8_t *snappy_compress_block */
+
+size_t snappy_max_compressed_length(size_t size) /* {{{ */
+{
+  return 32 + size + size / 6;
+} /* }}} size_t snappy_max_compressed_length */
+
+size_t snappy_compress(char *out, char const *in, size_t in_size) /* {{{ */
+{
+  uint8_t *op = (uint8_t *)out;
+  uint16_t table[1 << SNAPPY_HASH_BITS];
+
+  size_t n = in_size;
+  do {
+    uint8_t b = (uint8_t)(n & 0x7f);
+    n >>= 7;
+    *op++ = (n != 0) ? (b | 0x80) : b;
+  } while (n != 0);
+
+  for (size_t pos = 0; pos < in_size; pos += SNAPPY_BLOCK_SIZE) {
+    size_t block_size = in_size - pos;
+    if (block_size > SNAPPY_BLOCK_SIZE)
+      block_size = SNAPPY_BLOCK_SIZE;
+    op = snappy_compress_block(op, (uint8_t const *)in + pos, block_size,
+                               table);
+  }
+
+  return (size_t)(op - (uint8_t *)out);
+} /* }}} size_t snappy_compress */
+
+/* Returns the number of bytes of the header or zero if it's malformed. */
+static size_t snappy_read_header(uint8_t const *in, size_t in_size, /* {{{ */
+                                 size_t *ret_size) {
+  uint64_t size = 0;
+
+  for (size_t i = 0; (i < in_size) && (i < 5); i++) {
+    size |= ((uint64_t)(in[i] & 0x7f)) << (7 * i);
+    if ((in[i] & 0x80) != 0)
+      continue;
+
+    if (size > UINT32_MAX)
+      return 0;
+    *ret_size = (size_t)size;
+    return i + 1;
+  }
+
+  return 0;
+} /* }}} size_t snappy_read_header */
+
+int snappy_uncompressed_length(char const *in, size_t in_size, /* {{{ */
+                               size_t *ret_size) {
+  if (snappy_read_header((uint8_t const *)in, in_size, ret_size) == 0)
+    return EINVAL;
+  return 0;
+} /* }}} int snappy_uncompressed_length */
+
+int snappy_uncompress(char *out, size_t out_size, /* {{{ */
+                      char const *in, size_t in_size) {
+  uint8_t const *ip = (uint8_t const *)in;
+  uint8_t const *end = ip + in_size;
+  uint8_t *op = (uint8_t *)out;
+  size_t size = 0;
+
+  size_t header = snappy_read_header(ip, in_size, &size);
+  if ((header == 0) || (size > out_size))
+    return EINVAL;
+  ip += header;
+
+  size_t pos = 0;
+  while (ip < end) {
+    uint8_t tag = *ip++;
+    size_t len;
+    size_t offset;
+
+    if ((tag & 0x03) == 0) {
+      len = tag >> 2;
+      if (len >= 60) {
+        size_t bytes = len - 59;
+        if ((size_t)(end - ip) < bytes)
+          return EINVAL;
+        len = 0;
+        for (size_t i = 0; i < bytes; i++)
+          len |= ((size_t)ip[i]) << (8 * i);
+        ip += bytes;
+      }
+      len++;
+
+      if (((size_t)(end - ip) < len) || ((size - pos) < len))
+        return EINVAL;
+      memcpy(op + pos, ip, len);
+      ip += len;
+      pos += len;
+      continue;
+    }
+
+    if ((tag & 0x03) == 1) {
+      if (ip >= end)
+        return EINVAL;
+      len = 4 + ((tag >> 2) & 0x07);
+      offset = (((size_t)(tag >> 5)) << 8) | *ip++;
+    } else {
+      size_t bytes = ((tag & 0x03) == 2) ? 2 : 4;
+      if ((size_t)(end - ip) < bytes)
+        return EINVAL;
+      len = 1 + (tag >> 2);
+      offset = 0;
+      for (size_t i = 0; i < bytes; i++)
+        offset |= ((size_t)ip[i]) << (8 * i);
+      ip += bytes;
+    }
+
+    if ((offset == 0) || (offset > pos) || ((size - pos) < len))
+      return EINVAL;
+
+    /* Copies may overlap their own output, e.g. to repeat a single byte, so
+     * they have to be done byte by byte. */
+    for (size_t i = 0; i < len; i++)
+      op[pos + i] = op[pos + i - offset];
+    pos += len;
+  }
+
+  if (pos != size)
+    return EINVAL;
+  return 0;
+} /* }}} int snappy_uncompress */
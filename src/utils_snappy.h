@@ -0,0 +1,89 @@
+/**
+ * collectd - src/utils_snappy.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_SNAPPY_H
+#define UTILS_SNAPPY_H 1
+
+#include <stddef.h>
+
+/*
+ * Snappy compression
+ *
+ * Compresses into and decompresses the raw Snappy block format, i.e. the
+ * format of the "snappy" Content-Encoding used by Prometheus' remote write
+ * protocol, not the framed stream format. The encoder is a greedy one like
+ * the reference implementation's, favouring speed over compression ratio.
+ */
+
+/*
+ * NAME
+ *   snappy_max_compressed_length
+ *
+ * DESCRIPTION
+ *   Returns the size of a buffer large enough for the compressed version of
+ *   "size" bytes of any input.
+ */
+size_t snappy_max_compressed_length(size_t size);
+
+/*
+ * NAME
+ *   snappy_compress
+ *
+ * DESCRIPTION
+ *   Compresses "in_size" bytes at "in" into "out", which must be at least
+ *   snappy_max_compressed_length(in_size) bytes large.
+ *
+ * RETURN VALUE
+ *   The size of the compressed data.
+ */
+size_t snappy_compress(char *out, char const *in, size_t in_size);
+
+/*
+ * NAME
+ *   snappy_uncompressed_length
+ *
+ * DESCRIPTION
+ *   Reads the size of the uncompressed data from the header of "in" and
+ *   stores it in "ret_size".
+ *
+ * RETURN VALUE
+ *   Zero on success, EINVAL if the header is malformed.
+ */
+int snappy_uncompressed_length(char const *in, size_t in_size,
+                               size_t *ret_size);
+
+/*
+ * NAME
+ *   snappy_uncompress
+ *
+ * DESCRIPTION
+ *   Decompresses "in_size" bytes at "in" into "out", which must be
+ *   "out_size" bytes large, at least snappy_uncompressed_length() bytes.
+ *
+ * RETURN VALUE
+ *   Zero on success, EINVAL if the data is malformed or doesn't fit "out".
+ */
+int snappy_uncompress(char *out, size_t out_size, char const *in,
+                      size_t in_size);
+
+#endif /* UTILS_SNAPPY_H */
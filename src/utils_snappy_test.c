@@ -0,0 +1,140 @@
+/**
+ * collectd - src/utils_snappy_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+
+#include "testing.h"
+#include "utils_snappy.h"
+
+/* Compresses and uncompresses "in" and returns the compressed size. */
+static size_t round_trip(char const *in, size_t in_size) {
+  size_t max_size = snappy_max_compressed_length(in_size);
+  char *compressed = malloc(max_size);
+  char *uncompressed = malloc(in_size + 1);
+  size_t size = 0;
+
+  size_t compressed_size = snappy_compress(compressed, in, in_size);
+  OK(compressed_size <= max_size);
+
+  EXPECT_EQ_INT(0, snappy_uncompressed_length(compressed, compressed_size,
+                                              &size));
+  EXPECT_EQ_UINT64(in_size, size);
+  EXPECT_EQ_INT(0, snappy_uncompress(uncompressed, in_size + 1, compressed,
+                                     compressed_size));
+  OK(memcmp(in, uncompressed, in_size) == 0);
+
+  free(compressed);
+  free(uncompressed);
+  return compressed_size;
+}
+
+DEF_TEST(uncompress) {
+  struct {
+    char const *in;
+    size_t in_size;
+    char const *want;
+  } cases[] = {
+      {"\x00", 1, ""},
+      /* A literal "abc", then a copy of eight bytes at offset three. */
+      {"\x0b\x08" "abc" "\x11\x03", 7, "abcabcabcab"},
+      /* The same copy with a two byte offset. */
+      {"\x0b\x08" "abc" "\x1e\x03\x00", 8, "abcabcabcab"},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    char out[32] = {0};
+
+    EXPECT_EQ_INT(0, snappy_uncompress(out, sizeof(out), cases[i].in,
+                                       cases[i].in_size));
+    EXPECT_EQ_STR(cases[i].want, out);
+  }
+
+  return 0;
+}
+
+DEF_TEST(malformed) {
+  struct {
+    char const *in;
+    size_t in_size;
+  } cases[] = {
+      /* Truncated header. */
+      {"\x80", 1},
+      /* The literal is longer than the data. */
+      {"\x03\x08" "ab", 4},
+      /* The output is shorter than announced. */
+      {"\x04\x08" "abc", 5},
+      /* The offset points before the start of the output. */
+      {"\x0b\x08" "abc" "\x11\x04", 7},
+      /* Zero offset. */
+      {"\x0b\x08" "abc" "\x11\x00", 7},
+      /* The output is larger than the buffer. */
+      {"\x40\x08" "abc", 5},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    char out[32];
+    EXPECT_EQ_INT(EINVAL, snappy_uncompress(out, sizeof(out), cases[i].in,
+                                            cases[i].in_size));
+  }
+
+  return 0;
+}
+
+DEF_TEST(round_trip) {
+  round_trip("", 0);
+  round_trip("a", 1);
+  round_trip("hello, world", strlen("hello, world"));
+
+  /* Repetitive data, larger than a block, with long literals in between. */
+  size_t size = 300000;
+  char *data = malloc(size);
+  for (size_t i = 0; i < size; i++)
+    data[i] = (char)('a' + (i % 7));
+  for (size_t i = 70000; i < 71000; i++)
+    data[i] = (char)(i * 2654435761u >> 24);
+
+  size_t compressed_size = round_trip(data, size);
+  printf("# %" PRIsz " repetitive bytes compressed to %" PRIsz "\n", size,
+         compressed_size);
+  OK(compressed_size < size / 10);
+
+  /* Pseudo-random data, which doesn't compress. */
+  uint32_t x = 42;
+  for (size_t i = 0; i < size; i++) {
+    x = x * 1103515245u + 12345u;
+    data[i] = (char)(x >> 24);
+  }
+  round_trip(data, size);
+
+  free(data);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(uncompress);
+  RUN_TEST(malformed);
+  RUN_TEST(round_trip);
+
+  END_TEST;
+}
@@ -0,0 +1,125 @@
+/**
+ * collectd - src/utils_summary.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_summary.h"
+
+#include <math.h>
+
+int summary_add(summary_t *s, gauge_t value) /* {{{ */
+{
+  if (isnan(value))
+    return 0;
+
+  if (s->values_num >= s->values_size) {
+    size_t new_size = (s->values_size == 0) ? 16 : 2 * s->values_size;
+    gauge_t *tmp = realloc(s->values, new_size * sizeof(*s->values));
+    if (tmp == NULL)
+      return ENOMEM;
+    s->values = tmp;
+    s->values_size = new_size;
+  }
+
+  if ((s->values_num == 0) || (value < s->min))
+    s->min = value;
+  if ((s->values_num == 0) || (value > s->max))
+    s->max = value;
+  s->sum += value;
+
+  s->values[s->values_num] = value;
+  s->values_num++;
+  s->sorted = false;
+  return 0;
+} /* }}} int summary_add */
+
+size_t summary_num(summary_t const *s) /* {{{ */
+{
+  return s->values_num;
+} /* }}} size_t summary_num */
+
+gauge_t summary_mean(summary_t const *s) /* {{{ */
+{
+  if (s->values_num == 0)
+    return NAN;
+  return s->sum / (gauge_t)s->values_num;
+} /* }}} gauge_t summary_mean */
+
+gauge_t summary_min(summary_t const *s) /* {{{ */
+{
+  return (s->values_num == 0) ? NAN : s->min;
+} /* }}} gauge_t summary_min */
+
+gauge_t summary_max(summary_t const *s) /* {{{ */
+{
+  return (s->values_num == 0) ? NAN : s->max;
+} /* }}} gauge_t summary_max */
+
+static int summary_compare(void const *a, void const *b) /* {{{ */
+{
+  gauge_t x = *(gauge_t const *)a;
+  gauge_t y = *(gauge_t const *)b;
+
+  if (x < y)
+    return -1;
+  if (x > y)
+    return 1;
+  return 0;
+} /* }}} int summary_compare */
+
+gauge_t summary_percentile(summary_t *s, double percent) /* {{{ */
+{
+  if ((s->values_num == 0) || !(percent > 0.0) || (percent > 100.0))
+    return NAN;
+
+  if (!s->sorted) {
+    qsort(s->values, s->values_num, sizeof(*s->values), summary_compare);
+    s->sorted = true;
+  }
+
+  size_t rank = (size_t)ceil(percent / 100.0 * (double)s->values_num);
+  if (rank < 1)
+    rank = 1;
+  if (rank > s->values_num)
+    rank = s->values_num;
+
+  return s->values[rank - 1];
+} /* }}} gauge_t summary_percentile */
+
+void summary_reset(summary_t *s) /* {{{ */
+{
+  s->values_num = 0;
+  s->sorted = false;
+  s->sum = 0.0;
+  s->min = NAN;
+  s->max = NAN;
+} /* }}} void summary_reset */
+
+void summary_destroy(summary_t *s) /* {{{ */
+{
+  sfree(s->values);
+  s->values_size = 0;
+  summary_reset(s);
+} /* }}} void summary_destroy */
@@ -0,0 +1,74 @@
+/**
+ * collectd - src/utils_summary.h
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_SUMMARY_H
+#define UTILS_SUMMARY_H 1
+
+#include "plugin.h"
+
+/*
+ * Summaries of gauge samples
+ *
+ * Used by plugins which sample faster than they dispatch: every sample is
+ * added to the summary, and once per interval the mean, minimum, maximum and
+ * percentiles of those samples are dispatched instead of each sample. The
+ * samples are kept so that percentiles are exact; the buffer is reused after
+ * summary_reset().
+ */
+
+struct summary_s {
+  gauge_t *values;
+  size_t values_num;
+  size_t values_size;
+  bool sorted;
+
+  gauge_t sum;
+  gauge_t min;
+  gauge_t max;
+};
+typedef struct summary_s summary_t;
+/* A zero-initialized summary_t is empty and ready for use. */
+
+/* Adds a sample. NAN samples are ignored. Returns zero on success and ENOMEM
+ * if the sample buffer could not be grown. */
+int summary_add(summary_t *s, gauge_t value);
+
+/* Returns the number of samples added since the last reset. */
+size_t summary_num(summary_t const *s);
+
+/* The following return NAN if no samples have been added. */
+gauge_t summary_mean(summary_t const *s);
+gauge_t summary_min(summary_t const *s);
+gauge_t summary_max(summary_t const *s);
+
+/* Returns the sample at the given percentile (0 < percent <= 100) using the
+ * nearest-rank method. Sorts the samples in place. */
+gauge_t summary_percentile(summary_t *s, double percent);
+
+/* Forgets all samples but keeps the buffer for reuse. */
+void summary_reset(summary_t *s);
+
+/* Frees the sample buffer. The summary may be reused afterwards. */
+void summary_destroy(summary_t *s);
+
+#endif /* UTILS_SUMMARY_H */
@@ -0,0 +1,92 @@
+/**
+ * collectd - src/utils_summary_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+
+#include "testing.h"
+#include "utils_summary.h"
+
+DEF_TEST(empty) {
+  summary_t s = {0};
+
+  EXPECT_EQ_INT(0, (int)summary_num(&s));
+  OK(isnan(summary_mean(&s)));
+  OK(isnan(summary_min(&s)));
+  OK(isnan(summary_max(&s)));
+  OK(isnan(summary_percentile(&s, 99.0)));
+
+  CHECK_ZERO(summary_add(&s, NAN));
+  EXPECT_EQ_INT(0, (int)summary_num(&s));
+
+  summary_destroy(&s);
+  return 0;
+}
+
+DEF_TEST(stats) {
+  summary_t s = {0};
+
+  /* Add 1 .. 100 in an order that is not sorted. */
+  for (int i = 0; i < 100; i++)
+    CHECK_ZERO(summary_add(&s, (gauge_t)(((i * 37) % 100) + 1)));
+
+  EXPECT_EQ_INT(100, (int)summary_num(&s));
+  EXPECT_EQ_DOUBLE(50.5, summary_mean(&s));
+  EXPECT_EQ_DOUBLE(1.0, summary_min(&s));
+  EXPECT_EQ_DOUBLE(100.0, summary_max(&s));
+
+  struct {
+    double percent;
+    gauge_t want;
+  } cases[] = {
+      {50.0, 50.0}, {99.0, 99.0}, {100.0, 100.0}, {0.1, 1.0},
+  };
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++)
+    EXPECT_EQ_DOUBLE(cases[i].want, summary_percentile(&s, cases[i].percent));
+  OK(isnan(summary_percentile(&s, 0.0)));
+  OK(isnan(summary_percentile(&s, 101.0)));
+
+  /* Samples added after sorting are taken into account. */
+  CHECK_ZERO(summary_add(&s, 1000.0));
+  EXPECT_EQ_DOUBLE(1000.0, summary_percentile(&s, 100.0));
+  EXPECT_EQ_DOUBLE(1000.0, summary_max(&s));
+
+  summary_reset(&s);
+  EXPECT_EQ_INT(0, (int)summary_num(&s));
+  OK(isnan(summary_max(&s)));
+
+  CHECK_ZERO(summary_add(&s, 3.0));
+  EXPECT_EQ_DOUBLE(3.0, summary_mean(&s));
+  EXPECT_EQ_DOUBLE(3.0, summary_min(&s));
+  EXPECT_EQ_DOUBLE(3.0, summary_percentile(&s, 99.0));
+
+  summary_destroy(&s);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(empty);
+  RUN_TEST(stats);
+
+  END_TEST;
+}
@@ -35,12 +35,72 @@
 #include "common.h"
 #include "utils_tail.h"
 
+#if HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+/* Size of the read buffer. Lines longer than this are handed out in pieces. */
+#define CU_TAIL_BUFFER_SIZE 65536
+
 struct cu_tail_s {
   char *file;
-  FILE *fh;
+  int fd;
   struct stat stat;
+
+  /* Data read from the file but not handed out yet is in
+   * buffer[buffer_pos..buffer_fill). One extra byte is allocated so a line
+   * ending at the end of the buffer can be null-terminated in place. */
+  char *buffer;
+  size_t buffer_pos;
+  size_t buffer_fill;
+
+#if HAVE_SYS_INOTIFY_H
+  /* With inotify, the file is only stat'ed at EOF if it has been modified,
+   * moved or deleted since the last check. */
+  int inotify_fd;
+  int watch;
+  bool changed;
+#endif
 };
 
+#if HAVE_SYS_INOTIFY_H
+static void cu_tail_watch(cu_tail_t *obj) {
+  if (obj->inotify_fd < 0)
+    return;
+
+  if (obj->watch >= 0)
+    inotify_rm_watch(obj->inotify_fd, obj->watch);
+
+  obj->watch =
+      inotify_add_watch(obj->inotify_fd, obj->file,
+                        IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+  if (obj->watch < 0) {
+    DEBUG("utils_tail: inotify_add_watch (%s) failed: %s", obj->file,
+            STRERRNO);
+    obj->changed = true;
+  }
+} /* void cu_tail_watch */
+#endif
+
+/* Returns true if the file may have been truncated, rotated or removed
+ * since the last call. */
+static bool cu_tail_changed(cu_tail_t *obj) {
+#if HAVE_SYS_INOTIFY_H
+  if ((obj->inotify_fd < 0) || (obj->watch < 0))
+    return true;
+
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (read(obj->inotify_fd, events, sizeof(events)) > 0)
+    obj->changed = true;
+
+  bool changed = obj->changed;
+  obj->changed = false;
+  return changed;
+#else
+  return true;
+#endif
+} /* bool cu_tail_changed */
+
 static int cu_tail_reopen(cu_tail_t *obj) {
   int seek_end = 0;
   struct stat stat_buf = {0};
@@ -52,17 +112,17 @@ static int cu_tail_reopen(cu_tail_t *obj) {
   }
 
   /* The file is already open.. */
-  if ((obj->fh != NULL) && (stat_buf.st_ino == obj->stat.st_ino)) {
+  if ((obj->fd >= 0) && (stat_buf.st_ino == obj->stat.st_ino)) {
     /* Seek to the beginning if file was truncated */
     if (stat_buf.st_size < obj->stat.st_size) {
       P_INFO("utils_tail: File `%s' was truncated.", obj->file);
-      status = fseek(obj->fh, 0, SEEK_SET);
-      if (status != 0) {
-        P_ERROR("utils_tail: fseek (%s) failed: %s", obj->file, STRERRNO);
-        fclose(obj->fh);
-        obj->fh = NULL;
+      if (lseek(obj->fd, 0, SEEK_SET) == (off_t)-1) {
+        P_ERROR("utils_tail: lseek (%s) failed: %s", obj->file, STRERRNO);
+        close(obj->fd);
+        obj->fd = -1;
         return -1;
       }
+      obj->buffer_pos = obj->buffer_fill = 0;
     }
     memcpy(&obj->stat, &stat_buf, sizeof(struct stat));
     return 1;
@@ -73,29 +133,132 @@ static int cu_tail_reopen(cu_tail_t *obj) {
   if ((obj->stat.st_ino == 0) || (obj->stat.st_ino == stat_buf.st_ino))
     seek_end = 1;
 
-  FILE *fh = fopen(obj->file, "r");
-  if (fh == NULL) {
-    P_ERROR("utils_tail: fopen (%s) failed: %s", obj->file, STRERRNO);
+  int fd = open(obj->file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    P_ERROR("utils_tail: open (%s) failed: %s", obj->file, STRERRNO);
     return -1;
   }
 
   if (seek_end != 0) {
-    status = fseek(fh, 0, SEEK_END);
-    if (status != 0) {
-      P_ERROR("utils_tail: fseek (%s) failed: %s", obj->file, STRERRNO);
-      fclose(fh);
+    if (lseek(fd, 0, SEEK_END) == (off_t)-1) {
+      P_ERROR("utils_tail: lseek (%s) failed: %s", obj->file, STRERRNO);
+      close(fd);
       return -1;
     }
   }
 
-  if (obj->fh != NULL)
-    fclose(obj->fh);
-  obj->fh = fh;
+  if (obj->fd >= 0)
+    close(obj->fd);
+  obj->fd = fd;
+  obj->buffer_pos = obj->buffer_fill = 0;
   memcpy(&obj->stat, &stat_buf, sizeof(struct stat));
 
+#if HAVE_SYS_INOTIFY_H
+  cu_tail_watch(obj);
+#endif
+
   return 0;
 } /* int cu_tail_reopen */
 
+/* Reads more data into the buffer. Returns the number of bytes read, zero on
+ * EOF and -1 on error. */
+static ssize_t cu_tail_fill(cu_tail_t *obj) {
+  if (obj->buffer_pos > 0) {
+    memmove(obj->buffer, obj->buffer + obj->buffer_pos,
+            obj->buffer_fill - obj->buffer_pos);
+    obj->buffer_fill -= obj->buffer_pos;
+    obj->buffer_pos = 0;
+  }
+
+  while (42) {
+    ssize_t status = read(obj->fd, obj->buffer + obj->buffer_fill,
+                          CU_TAIL_BUFFER_SIZE - obj->buffer_fill);
+    if (status >= 0) {
+      obj->buffer_fill += (size_t)status;
+      return status;
+    }
+    if (errno == EINTR)
+      continue;
+
+    P_WARNING("utils_tail: read (%s) failed: %s", obj->file, STRERRNO);
+    return -1;
+  }
+} /* ssize_t cu_tail_fill */
+
+/*
+ * Finds the next line in the buffer, reading from the file as needed. The
+ * line, including its newline character, is returned as a view into the
+ * buffer. Lines longer than "max_len" are returned in pieces; at EOF, an
+ * incomplete line is returned as is. Returns zero on success and sets
+ * "ret_len" to zero on EOF.
+ */
+static int cu_tail_next(cu_tail_t *obj, size_t max_len, char **ret_line,
+                        size_t *ret_len) {
+  bool reopened = false;
+
+  if (obj->fd < 0) {
+    int status = cu_tail_reopen(obj);
+    if (status < 0)
+      return status;
+  }
+  assert(obj->fd >= 0);
+
+  while (42) {
+    char *begin = obj->buffer + obj->buffer_pos;
+    size_t avail = obj->buffer_fill - obj->buffer_pos;
+    size_t len = (avail < max_len) ? avail : max_len;
+
+    char *newline = memchr(begin, '\n', len);
+    if (newline != NULL)
+      len = (size_t)(newline - begin) + 1;
+
+    if ((newline != NULL) || (avail >= max_len)) {
+      obj->buffer_pos += len;
+      *ret_line = begin;
+      *ret_len = len;
+      return 0;
+    }
+
+    ssize_t status = cu_tail_fill(obj);
+    if (status < 0) {
+      /* Force `cu_tail_reopen' to reopen the file.. */
+      close(obj->fd);
+      obj->fd = -1;
+      obj->buffer_pos = obj->buffer_fill = 0;
+      if (reopened)
+        return -1;
+    } else if (status > 0) {
+      continue;
+    } else if (obj->buffer_fill > obj->buffer_pos) {
+      /* EOF in the middle of a line: hand out what we have. */
+      len = obj->buffer_fill - obj->buffer_pos;
+      *ret_line = obj->buffer + obj->buffer_pos;
+      *ret_len = len;
+      obj->buffer_pos = obj->buffer_fill;
+      return 0;
+    } else if (reopened || ((obj->fd >= 0) && !cu_tail_changed(obj))) {
+      /* EOf, well, apparently the new file is empty.. */
+      *ret_len = 0;
+      return 0;
+    }
+
+    /* eof or error -> check if the file was moved away and reopen the new
+     * file if so.. */
+    int reopen_status = cu_tail_reopen(obj);
+    /* error -> return with error */
+    if (reopen_status < 0)
+      return reopen_status;
+    /* file end reached and file not reopened -> nothing more to read */
+    else if (reopen_status > 0) {
+      *ret_len = 0;
+      return 0;
+    }
+
+    /* If we get here: file was re-opened and there may be more to read.. */
+    reopened = true;
+  }
+} /* int cu_tail_next */
+
 cu_tail_t *cu_tail_create(const char *file) {
   cu_tail_t *obj;
 
@@ -104,19 +267,34 @@ cu_tail_t *cu_tail_create(const char *file) {
     return NULL;
 
   obj->file = strdup(file);
-  if (obj->file == NULL) {
+  obj->buffer = malloc(CU_TAIL_BUFFER_SIZE + 1);
+  if ((obj->file == NULL) || (obj->buffer == NULL)) {
+    free(obj->file);
+    free(obj->buffer);
     free(obj);
     return NULL;
   }
 
-  obj->fh = NULL;
+  obj->fd = -1;
+
+#if HAVE_SYS_INOTIFY_H
+  obj->watch = -1;
+  obj->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (obj->inotify_fd < 0)
+    DEBUG("utils_tail: inotify_init1 failed: %s", STRERRNO);
+#endif
 
   return obj;
 } /* cu_tail_t *cu_tail_create */
 
 int cu_tail_destroy(cu_tail_t *obj) {
-  if (obj->fh != NULL)
-    fclose(obj->fh);
+  if (obj->fd >= 0)
+    close(obj->fd);
+#if HAVE_SYS_INOTIFY_H
+  if (obj->inotify_fd >= 0)
+    close(obj->inotify_fd);
+#endif
+  free(obj->buffer);
   free(obj->file);
   free(obj);
 
@@ -124,94 +302,51 @@ int cu_tail_destroy(cu_tail_t *obj) {
 } /* int cu_tail_destroy */
 
 int cu_tail_readline(cu_tail_t *obj, char *buf, int buflen) {
-  int status;
+  char *line;
+  size_t len;
 
   if (buflen < 1) {
     ERROR("utils_tail: cu_tail_readline: buflen too small: %i bytes.", buflen);
     return -1;
   }
 
-  if (obj->fh == NULL) {
-    status = cu_tail_reopen(obj);
-    if (status < 0)
-      return status;
-  }
-  assert(obj->fh != NULL);
-
-  /* Try to read from the filehandle. If that succeeds, everything appears to
-   * be fine and we can return. */
-  clearerr(obj->fh);
-  if (fgets(buf, buflen, obj->fh) != NULL) {
-    buf[buflen - 1] = 0;
-    return 0;
-  }
-
-  /* Check if we encountered an error */
-  if (ferror(obj->fh) != 0) {
-    /* Jupp, error. Force `cu_tail_reopen' to reopen the file.. */
-    fclose(obj->fh);
-    obj->fh = NULL;
-  }
-  /* else: eof -> check if the file was moved away and reopen the new file if
-   * so.. */
+  size_t max_len = (size_t)buflen - 1;
+  if (max_len > CU_TAIL_BUFFER_SIZE)
+    max_len = CU_TAIL_BUFFER_SIZE;
 
-  status = cu_tail_reopen(obj);
-  /* error -> return with error */
-  if (status < 0)
+  int status = cu_tail_next(obj, max_len, &line, &len);
+  if (status != 0)
     return status;
-  /* file end reached and file not reopened -> nothing more to read */
-  else if (status > 0) {
-    buf[0] = 0;
-    return 0;
-  }
-
-  /* If we get here: file was re-opened and there may be more to read.. Let's
-   * try again. */
-  if (fgets(buf, buflen, obj->fh) != NULL) {
-    buf[buflen - 1] = 0;
-    return 0;
-  }
-
-  if (ferror(obj->fh) != 0) {
-    WARNING("utils_tail: fgets (%s) returned an error: %s", obj->file,
-            STRERRNO);
-    fclose(obj->fh);
-    obj->fh = NULL;
-    return -1;
-  }
 
-  /* EOf, well, apparently the new file is empty.. */
-  buf[0] = 0;
+  memcpy(buf, line, len);
+  buf[len] = 0;
   return 0;
 } /* int cu_tail_readline */
 
-int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
-                 void *data) {
+int cu_tail_read(cu_tail_t *obj, tailfunc_t *callback, void *data) {
   int status;
 
   while (42) {
+    char *line;
     size_t len;
 
-    status = cu_tail_readline(obj, buf, buflen);
+    status = cu_tail_next(obj, CU_TAIL_BUFFER_SIZE, &line, &len);
     if (status != 0) {
-      ERROR("utils_tail: cu_tail_read: cu_tail_readline "
-            "failed.");
+      ERROR("utils_tail: cu_tail_read: reading `%s' failed.", obj->file);
       break;
     }
 
     /* check for EOF */
-    if (buf[0] == 0)
+    if (len == 0)
       break;
 
-    len = strlen(buf);
-    while (len > 0) {
-      if (buf[len - 1] != '\n')
-        break;
-      buf[len - 1] = '\0';
+    /* The buffer has room for the terminating null byte behind the last
+     * line, so lines can be handed out without copying them. */
+    if (line[len - 1] == '\n')
       len--;
-    }
+    line[len] = 0;
 
-    status = callback(data, buf, buflen);
+    status = callback(data, line, (int)len);
     if (status != 0) {
       ERROR("utils_tail: cu_tail_read: callback returned "
             "status %i.",
@@ -35,6 +35,11 @@
 struct cu_tail_s;
 typedef struct cu_tail_s cu_tail_t;
 
+/*
+ * Called by `cu_tail_read' for each line. `buf' points to the line without
+ * the trailing newline character; it is null-terminated and `buflen' bytes
+ * long. The line is only valid until the function returns.
+ */
 typedef int tailfunc_t(void *data, char *buf, int buflen);
 
 /*
@@ -76,13 +81,15 @@ int cu_tail_destroy(cu_tail_t *obj);
 int cu_tail_readline(cu_tail_t *obj, char *buf, int buflen);
 
 /*
- * cu_tail_readline
+ * cu_tail_read
  *
- * Reads from the file until eof condition or an error is encountered.
+ * Reads from the file until eof condition or an error is encountered and
+ * calls `callback' for each line read. The file is read in large chunks and
+ * the lines are handed to `callback' without copying them; lines longer than
+ * the internal buffer (64 kByte) are passed in pieces.
  *
  * Returns 0 when successful and non-zero otherwise.
  */
-int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
-                 void *data);
+int cu_tail_read(cu_tail_t *obj, tailfunc_t *callback, void *data);
 
 #endif /* UTILS_TAIL_H */
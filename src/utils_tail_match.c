@@ -59,6 +59,13 @@ struct cu_tail_match_s {
   cu_tail_t *tail;
   cu_tail_match_match_t *matches;
   size_t matches_num;
+
+  /* Statistics about the file, dispatched if "stats" is set. */
+  bool stats;
+  char stats_plugin[DATA_MAX_NAME_LEN];
+  char stats_plugin_instance[DATA_MAX_NAME_LEN];
+  derive_t lines;
+  cdtime_t match_time;
 };
 
 /*
@@ -170,13 +177,38 @@ static int latency_submit_match(cu_match_t *match, void *user_data) {
 static int tail_callback(void *data, char *buf,
                          int __attribute__((unused)) buflen) {
   cu_tail_match_t *obj = (cu_tail_match_t *)data;
+  cdtime_t start = obj->stats ? cdtime() : 0;
 
   for (size_t i = 0; i < obj->matches_num; i++)
     match_apply(obj->matches[i].match, buf);
 
+  if (obj->stats) {
+    obj->lines++;
+    obj->match_time += cdtime() - start;
+  }
+
   return 0;
 } /* int tail_callback */
 
+static void tail_match_submit_stats(cu_tail_match_t *obj) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  sstrncpy(vl.plugin, obj->stats_plugin, sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, obj->stats_plugin_instance,
+           sizeof(vl.plugin_instance));
+
+  vl.values = &(value_t){.derive = obj->lines};
+  vl.values_len = 1;
+  sstrncpy(vl.type, "derive", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "lines", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.derive = (derive_t)CDTIME_T_TO_MS(obj->match_time)};
+  sstrncpy(vl.type, "total_time_in_ms", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "match", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+} /* void tail_match_submit_stats */
+
 static void tail_match_simple_free(void *data) {
   cu_tail_match_simple_t *user_data = (cu_tail_match_simple_t *)data;
   latency_config_free(user_data->latency_config);
@@ -252,6 +284,15 @@ int tail_match_add_match(cu_tail_match_t *obj, cu_match_t *match,
   return 0;
 } /* int tail_match_add_match */
 
+void tail_match_set_stats(cu_tail_match_t *obj, const char *plugin,
+                          const char *plugin_instance) {
+  obj->stats = true;
+  sstrncpy(obj->stats_plugin, plugin, sizeof(obj->stats_plugin));
+  if (plugin_instance != NULL)
+    sstrncpy(obj->stats_plugin_instance, plugin_instance,
+             sizeof(obj->stats_plugin_instance));
+} /* void tail_match_set_stats */
+
 int tail_match_add_match_simple(cu_tail_match_t *obj, const char *regex,
                                 const char *excluderegex, int ds_type,
                                 const char *plugin, const char *plugin_instance,
@@ -307,11 +348,9 @@ out:
 } /* int tail_match_add_match_simple */
 
 int tail_match_read(cu_tail_match_t *obj) {
-  char buffer[4096];
   int status;
 
-  status = cu_tail_read(obj->tail, buffer, sizeof(buffer), tail_callback,
-                        (void *)obj);
+  status = cu_tail_read(obj->tail, tail_callback, (void *)obj);
   if (status != 0) {
     ERROR("tail_match: cu_tail_read failed.");
     return status;
@@ -326,5 +365,8 @@ int tail_match_read(cu_tail_match_t *obj) {
     (*lt_match->submit)(lt_match->match, lt_match->user_data);
   }
 
+  if (obj->stats)
+    tail_match_submit_stats(obj);
+
   return 0;
 } /* int tail_match_read */
@@ -92,6 +92,18 @@ int tail_match_add_match(cu_tail_match_t *obj, cu_match_t *match,
                          void *user_data,
                          void (*free_user_data)(void *user_data));
 
+/*
+ * NAME
+ *   tail_match_set_stats
+ * DESCRIPTION
+ *   Enables statistics about the file: the number of lines read, dispatched
+ *   as `derive-lines', and the time spent matching them, dispatched as
+ *   `total_time_in_ms-match'. Both are dispatched by `tail_match_read' using
+ *   `plugin' and `plugin_instance'.
+ */
+void tail_match_set_stats(cu_tail_match_t *obj, const char *plugin,
+                          const char *plugin_instance);
+
 /*
  * NAME
  *  tail_match_add_match_simple
@@ -37,6 +37,11 @@ typedef struct {
   uint64_t freepages_ns;
 } ts_delay_t;
 
+typedef struct {
+  uint64_t voluntary;
+  uint64_t involuntary;
+} ts_cswitch_t;
+
 ts_t *ts_create(void);
 void ts_destroy(ts_t *);
 
@@ -44,4 +49,9 @@ void ts_destroy(ts_t *);
  * identified by tgid. Returns zero on success and an errno otherwise. */
 int ts_delay_by_tgid(ts_t *ts, uint32_t tgid, ts_delay_t *out);
 
+/* ts_cswitch_by_tgid returns the number of context switches of all threads of
+ * the task identified by tgid, including threads which have already exited.
+ * Returns zero on success and an errno otherwise. */
+int ts_cswitch_by_tgid(ts_t *ts, uint32_t tgid, ts_cswitch_t *out);
+
 #endif /* UTILS_TASKSTATS_H */
@@ -30,6 +30,7 @@
 #include <regex.h>
 
 #include "common.h"
+#include "utils_atomic.h"
 #include "utils_avltree.h"
 #include "utils_vl_lookup.h"
 
@@ -72,17 +73,72 @@ struct identifier_match_s {
 };
 typedef struct identifier_match_s identifier_match_t;
 
+/* Identifier fields which are literal strings rather than regular
+ * expressions. The type is always literal. */
+#define LU_LITERAL_HOST 0x01
+#define LU_LITERAL_PLUGIN 0x02
+#define LU_LITERAL_PLUGIN_INSTANCE 0x04
+#define LU_LITERAL_TYPE_INSTANCE 0x08
+#define LU_LITERAL_MASKS 16
+
+/* Upper bound for the number of identifiers remembered by the memo. Value
+ * lists with identifiers beyond that are looked up in the index every time. */
+#define LU_MEMO_MAX 131072
+
+#define LU_KEY_SIZE (5 * DATA_MAX_NAME_LEN)
+
+struct user_class_s;
+typedef struct user_class_s user_class_t;
+struct user_obj_s;
+typedef struct user_obj_s user_obj_t;
+
+struct lu_class_vec_s {
+  user_class_t **ptr;
+  size_t num;
+};
+typedef struct lu_class_vec_s lu_class_vec_t;
+
+/* Hash table mapping binary keys, i.e. identifier fields separated by their
+ * null bytes, to a lu_class_vec_t. */
+struct lu_table_entry_s;
+typedef struct lu_table_entry_s lu_table_entry_t;
+struct lu_table_entry_s {
+  lu_table_entry_t *next;
+  uint32_t hash;
+  lu_class_vec_t vec;
+  /* Memo only: the user object of each class for this identifier, filled in
+   * lazily. */
+  user_obj_t **objs;
+  size_t key_len;
+  char key[];
+};
+
+struct lu_table_s {
+  lu_table_entry_t **buckets;
+  size_t size;
+  size_t num;
+};
+typedef struct lu_table_s lu_table_t;
+
 struct lookup_s {
+  /* Owns the user classes. */
   c_avl_tree_t *by_type_tree;
 
+  /* Classes by their literal fields, one table per literal mask in use. */
+  lu_table_t index[LU_LITERAL_MASKS];
+  unsigned int index_masks;
+  size_t classes_num;
+
+  /* Identifier -> classes matching it. Cleared by lookup_add(). */
+  lu_table_t memo;
+  pthread_rwlock_t memo_lock;
+
   lookup_class_callback_t cb_user_class;
   lookup_obj_callback_t cb_user_obj;
   lookup_free_class_callback_t cb_free_class;
   lookup_free_obj_callback_t cb_free_obj;
 };
 
-struct user_obj_s;
-typedef struct user_obj_s user_obj_t;
 struct user_obj_s {
   void *user_obj;
   lookup_identifier_t ident;
@@ -94,9 +150,10 @@ struct user_class_s {
   pthread_mutex_t lock;
   void *user_class;
   identifier_match_t match;
+  unsigned int literal_mask;
+  size_t seq; /* order of lookup_add() calls */
   user_obj_t *user_obj_list; /* list of user_obj */
 };
-typedef struct user_class_s user_class_t;
 
 struct user_class_list_s;
 typedef struct user_class_list_s user_class_list_t;
@@ -134,6 +191,127 @@ static bool lu_part_matches(part_match_t const *match, /* {{{ */
     return false;
 } /* }}} bool lu_part_matches */
 
+static uint32_t lu_hash(char const *key, size_t key_len) /* {{{ */
+{
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < key_len; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+} /* }}} uint32_t lu_hash */
+
+static lu_table_entry_t *lu_table_get(lu_table_t *t, /* {{{ */
+                                      char const *key, size_t key_len,
+                                      uint32_t hash) {
+  if (t->size == 0)
+    return NULL;
+
+  for (lu_table_entry_t *e = t->buckets[hash & (t->size - 1)]; e != NULL;
+       e = e->next)
+    if ((e->hash == hash) && (e->key_len == key_len) &&
+        (memcmp(e->key, key, key_len) == 0))
+      return e;
+
+  return NULL;
+} /* }}} lu_table_entry_t *lu_table_get */
+
+static lu_table_entry_t *lu_table_insert(lu_table_t *t, /* {{{ */
+                                         char const *key, size_t key_len,
+                                         uint32_t hash) {
+  if (t->num >= t->size) {
+    size_t new_size = (t->size == 0) ? 16 : 2 * t->size;
+    lu_table_entry_t **new_buckets = calloc(new_size, sizeof(*new_buckets));
+    if (new_buckets == NULL)
+      return NULL;
+
+    for (size_t i = 0; i < t->size; i++) {
+      lu_table_entry_t *e = t->buckets[i];
+      while (e != NULL) {
+        lu_table_entry_t *next = e->next;
+        e->next = new_buckets[e->hash & (new_size - 1)];
+        new_buckets[e->hash & (new_size - 1)] = e;
+        e = next;
+      }
+    }
+
+    free(t->buckets);
+    t->buckets = new_buckets;
+    t->size = new_size;
+  }
+
+  lu_table_entry_t *e = calloc(1, sizeof(*e) + key_len);
+  if (e == NULL)
+    return NULL;
+
+  e->hash = hash;
+  e->key_len = key_len;
+  memcpy(e->key, key, key_len);
+
+  e->next = t->buckets[hash & (t->size - 1)];
+  t->buckets[hash & (t->size - 1)] = e;
+  t->num++;
+
+  return e;
+} /* }}} lu_table_entry_t *lu_table_insert */
+
+static void lu_table_clear(lu_table_t *t) /* {{{ */
+{
+  for (size_t i = 0; i < t->size; i++) {
+    lu_table_entry_t *e = t->buckets[i];
+    while (e != NULL) {
+      lu_table_entry_t *next = e->next;
+      free(e->vec.ptr);
+      free(e->objs);
+      free(e);
+      e = next;
+    }
+  }
+
+  sfree(t->buckets);
+  t->size = 0;
+  t->num = 0;
+} /* }}} void lu_table_clear */
+
+static int lu_class_vec_append(lu_class_vec_t *vec, /* {{{ */
+                               user_class_t *user_class) {
+  user_class_t **tmp = realloc(vec->ptr, (vec->num + 1) * sizeof(*vec->ptr));
+  if (tmp == NULL)
+    return ENOMEM;
+
+  vec->ptr = tmp;
+  vec->ptr[vec->num] = user_class;
+  vec->num++;
+  return 0;
+} /* }}} int lu_class_vec_append */
+
+/* Builds the binary key of the fields selected by "mask". The type is always
+ * part of the key. Returns the key length. */
+static size_t lu_build_key(char *buffer, unsigned int mask, /* {{{ */
+                           char const *host, char const *plugin,
+                           char const *plugin_instance, char const *type,
+                           char const *type_instance) {
+  size_t len = 0;
+
+#define APPEND_FIELD(field)                                                      do {                                                                             size_t field_len = strnlen(field, DATA_MAX_NAME_LEN - 1);                      memcpy(buffer + len, field, field_len);                                        len += field_len;                                                              buffer[len++] = 0;                                                           } while (0)
+
+  APPEND_FIELD(type);
+  if (mask & LU_LITERAL_HOST)
+    APPEND_FIELD(host);
+  if (mask & LU_LITERAL_PLUGIN)
+    APPEND_FIELD(plugin);
+  if (mask & LU_LITERAL_PLUGIN_INSTANCE)
+    APPEND_FIELD(plugin_instance);
+  if (mask & LU_LITERAL_TYPE_INSTANCE)
+    APPEND_FIELD(type_instance);
+
+#undef APPEND_FIELD
+
+  return len;
+} /* }}} size_t lu_build_key */
+
 static int lu_copy_ident_to_match_part(part_match_t *match_part, /* {{{ */
                                        char const *ident_part) {
   size_t len = strlen(ident_part);
@@ -269,35 +447,48 @@ static user_obj_t *lu_find_user_obj(user_class_t *user_class, /* {{{ */
   return NULL;
 } /* }}} user_obj_t *lu_find_user_obj */
 
+/* Checks the regex parts of a class. The literal parts have been matched by
+ * the index already. */
+static bool lu_class_matches(user_class_t const *user_class, /* {{{ */
+                             value_list_t const *vl) {
+  identifier_match_t const *m = &user_class->match;
+
+  return (!m->type_instance.is_regex ||
+          lu_part_matches(&m->type_instance, vl->type_instance)) &&
+         (!m->plugin_instance.is_regex ||
+          lu_part_matches(&m->plugin_instance, vl->plugin_instance)) &&
+         (!m->plugin.is_regex || lu_part_matches(&m->plugin, vl->plugin)) &&
+         (!m->host.is_regex || lu_part_matches(&m->host, vl->host));
+} /* }}} bool lu_class_matches */
+
+/* "cache", if not NULL, points to the memoized user object of this class. */
 static int lu_handle_user_class(lookup_t *obj, /* {{{ */
                                 data_set_t const *ds, value_list_t const *vl,
-                                user_class_t *user_class) {
-  user_obj_t *user_obj;
+                                user_class_t *user_class,
+                                user_obj_t **cache) {
+  user_obj_t *user_obj = NULL;
   int status;
 
-  assert(strcmp(vl->type, user_class->match.type.str) == 0);
-  assert(user_class->match.plugin.is_regex ||
-         (strcmp(vl->plugin, user_class->match.plugin.str)) == 0);
-
-  if (!lu_part_matches(&user_class->match.type_instance, vl->type_instance) ||
-      !lu_part_matches(&user_class->match.plugin_instance,
-                       vl->plugin_instance) ||
-      !lu_part_matches(&user_class->match.plugin, vl->plugin) ||
-      !lu_part_matches(&user_class->match.host, vl->host))
-    return 1;
+  if (cache != NULL)
+    user_obj = C_ATOMIC_LOAD_ACQ(cache);
 
-  pthread_mutex_lock(&user_class->lock);
-  user_obj = lu_find_user_obj(user_class, vl);
   if (user_obj == NULL) {
-    /* call lookup_class_callback_t() and insert into the list of user objects.
-     */
-    user_obj = lu_create_user_obj(obj, ds, vl, user_class);
+    pthread_mutex_lock(&user_class->lock);
+    user_obj = lu_find_user_obj(user_class, vl);
     if (user_obj == NULL) {
-      pthread_mutex_unlock(&user_class->lock);
-      return -1;
+      /* call lookup_class_callback_t() and insert into the list of user
+       * objects. */
+      user_obj = lu_create_user_obj(obj, ds, vl, user_class);
+      if (user_obj == NULL) {
+        pthread_mutex_unlock(&user_class->lock);
+        return -1;
+      }
     }
+    pthread_mutex_unlock(&user_class->lock);
+
+    if (cache != NULL)
+      C_ATOMIC_STORE_REL(cache, user_obj);
   }
-  pthread_mutex_unlock(&user_class->lock);
 
   status = obj->cb_user_obj(ds, vl, user_class->user_class, user_obj->user_obj);
   if (status != 0) {
@@ -313,25 +504,47 @@ static int lu_handle_user_class(lookup_t *obj, /* {{{ */
   return 0;
 } /* }}} int lu_handle_user_class */
 
-static int lu_handle_user_class_list(lookup_t *obj, /* {{{ */
-                                     data_set_t const *ds,
-                                     value_list_t const *vl,
-                                     user_class_list_t *user_class_list) {
-  user_class_list_t *ptr;
-  int retval = 0;
+static int lu_compare_class_seq(void const *a, void const *b) /* {{{ */
+{
+  user_class_t const *c0 = *(user_class_t *const *)a;
+  user_class_t const *c1 = *(user_class_t *const *)b;
 
-  for (ptr = user_class_list; ptr != NULL; ptr = ptr->next) {
-    int status;
+  return (c0->seq > c1->seq) - (c0->seq < c1->seq);
+} /* }}} int lu_compare_class_seq */
 
-    status = lu_handle_user_class(obj, ds, vl, &ptr->entry);
-    if (status < 0)
-      return status;
-    else if (status == 0)
-      retval++;
+/* Collects all classes matching vl, in the order they were added. */
+static int lu_find_classes(lookup_t *obj, value_list_t const *vl, /* {{{ */
+                           lu_class_vec_t *ret) {
+  char key[LU_KEY_SIZE];
+
+  for (unsigned int mask = 0; mask < LU_LITERAL_MASKS; mask++) {
+    if ((obj->index_masks & (1u << mask)) == 0)
+      continue;
+
+    size_t key_len = lu_build_key(key, mask, vl->host, vl->plugin,
+                                  vl->plugin_instance, vl->type,
+                                  vl->type_instance);
+    lu_table_entry_t *e = lu_table_get(&obj->index[mask], key, key_len,
+                                       lu_hash(key, key_len));
+    if (e == NULL)
+      continue;
+
+    for (size_t i = 0; i < e->vec.num; i++) {
+      if (!lu_class_matches(e->vec.ptr[i], vl))
+        continue;
+      if (lu_class_vec_append(ret, e->vec.ptr[i]) != 0) {
+        sfree(ret->ptr);
+        ret->num = 0;
+        return ENOMEM;
+      }
+    }
   }
 
-  return retval;
-} /* }}} int lu_handle_user_class_list */
+  if (ret->num > 1)
+    qsort(ret->ptr, ret->num, sizeof(*ret->ptr), lu_compare_class_seq);
+
+  return 0;
+} /* }}} int lu_find_classes */
 
 static by_type_entry_t *lu_search_by_type(lookup_t *obj, /* {{{ */
                                           char const *type,
@@ -536,6 +749,8 @@ lookup_t *lookup_create(lookup_class_callback_t cb_user_class, /* {{{ */
     return NULL;
   }
 
+  pthread_rwlock_init(&obj->memo_lock, /* attr = */ NULL);
+
   obj->cb_user_class = cb_user_class;
   obj->cb_user_obj = cb_user_obj;
   obj->cb_free_class = cb_free_class;
@@ -567,6 +782,11 @@ void lookup_destroy(lookup_t *obj) /* {{{ */
   c_avl_destroy(obj->by_type_tree);
   obj->by_type_tree = NULL;
 
+  for (size_t i = 0; i < LU_LITERAL_MASKS; i++)
+    lu_table_clear(&obj->index[i]);
+  lu_table_clear(&obj->memo);
+  pthread_rwlock_destroy(&obj->memo_lock);
+
   sfree(obj);
 } /* }}} void lookup_destroy */
 
@@ -591,40 +811,106 @@ int lookup_add(lookup_t *obj, /* {{{ */
   user_class_obj->entry.user_obj_list = NULL;
   user_class_obj->next = NULL;
 
-  return lu_add_by_plugin(by_type, user_class_obj);
+  user_class_t *uc = &user_class_obj->entry;
+  identifier_match_t const *m = &uc->match;
+  uc->seq = obj->classes_num++;
+  uc->literal_mask = (m->host.is_regex ? 0 : LU_LITERAL_HOST) |
+                     (m->plugin.is_regex ? 0 : LU_LITERAL_PLUGIN) |
+                     (m->plugin_instance.is_regex ? 0
+                                                  : LU_LITERAL_PLUGIN_INSTANCE) |
+                     (m->type_instance.is_regex ? 0 : LU_LITERAL_TYPE_INSTANCE);
+
+  int status = lu_add_by_plugin(by_type, user_class_obj);
+  if (status != 0)
+    return status;
+
+  char key[LU_KEY_SIZE];
+  size_t key_len = lu_build_key(key, uc->literal_mask, m->host.str,
+                                m->plugin.str, m->plugin_instance.str,
+                                ident->type, m->type_instance.str);
+  uint32_t hash = lu_hash(key, key_len);
+  lu_table_t *index = &obj->index[uc->literal_mask];
+
+  lu_table_entry_t *e = lu_table_get(index, key, key_len, hash);
+  if (e == NULL)
+    e = lu_table_insert(index, key, key_len, hash);
+  if ((e == NULL) || (lu_class_vec_append(&e->vec, uc) != 0)) {
+    ERROR("utils_vl_lookup: Adding the class to the index failed.");
+    return ENOMEM;
+  }
+  obj->index_masks |= 1u << uc->literal_mask;
+
+  /* The set of classes changed: forget all memoized results. */
+  pthread_rwlock_wrlock(&obj->memo_lock);
+  lu_table_clear(&obj->memo);
+  pthread_rwlock_unlock(&obj->memo_lock);
+
+  return 0;
 } /* }}} int lookup_add */
 
 /* returns the number of successful calls to the callback function */
 int lookup_search(lookup_t *obj, /* {{{ */
                   data_set_t const *ds, value_list_t const *vl) {
-  by_type_entry_t *by_type = NULL;
-  user_class_list_t *user_class_list = NULL;
+  char key[LU_KEY_SIZE];
+  lu_class_vec_t classes = {0};
+  bool memoized = false;
   int retval = 0;
-  int status;
 
   if ((obj == NULL) || (ds == NULL) || (vl == NULL))
     return -EINVAL;
 
-  by_type = lu_search_by_type(obj, vl->type, /* allocate = */ false);
-  if (by_type == NULL)
-    return 0;
+  size_t key_len = lu_build_key(
+      key, LU_LITERAL_MASKS - 1, vl->host, vl->plugin, vl->plugin_instance,
+      vl->type, vl->type_instance);
+  uint32_t hash = lu_hash(key, key_len);
+
+  /* Memo entries are only removed by lookup_add(), which must not run
+   * concurrently with lookup_search(). They can therefore be used after the
+   * lock has been released. */
+  pthread_rwlock_rdlock(&obj->memo_lock);
+  lu_table_entry_t *e = lu_table_get(&obj->memo, key, key_len, hash);
+  pthread_rwlock_unlock(&obj->memo_lock);
+
+  if (e != NULL) {
+    classes = e->vec;
+    memoized = true;
+  } else {
+    user_obj_t **objs = NULL;
 
-  status =
-      c_avl_get(by_type->by_plugin_tree, vl->plugin, (void *)&user_class_list);
-  if (status == 0) {
-    status = lu_handle_user_class_list(obj, ds, vl, user_class_list);
-    if (status < 0)
-      return status;
-    retval += status;
+    int status = lu_find_classes(obj, vl, &classes);
+    if (status != 0)
+      return -status;
+
+    if (classes.num > 0)
+      objs = calloc(classes.num, sizeof(*objs));
+
+    pthread_rwlock_wrlock(&obj->memo_lock);
+    e = lu_table_get(&obj->memo, key, key_len, hash);
+    if ((e == NULL) && (obj->memo.num < LU_MEMO_MAX))
+      e = lu_table_insert(&obj->memo, key, key_len, hash);
+    if ((e != NULL) && (e->vec.ptr == NULL) && (objs != NULL)) {
+      e->vec = classes;
+      e->objs = objs;
+      memoized = true;
+    } else {
+      sfree(objs);
+      e = NULL;
+    }
+    pthread_rwlock_unlock(&obj->memo_lock);
   }
 
-  if (by_type->wildcard_plugin_list != NULL) {
-    status =
-        lu_handle_user_class_list(obj, ds, vl, by_type->wildcard_plugin_list);
-    if (status < 0)
-      return status;
-    retval += status;
+  for (size_t i = 0; i < classes.num; i++) {
+    int status = lu_handle_user_class(obj, ds, vl, classes.ptr[i],
+                                      (e != NULL) ? e->objs + i : NULL);
+    if (status < 0) {
+      retval = status;
+      break;
+    } else if (status == 0)
+      retval++;
   }
 
+  if (!memoized)
+    free(classes.ptr);
+
   return retval;
 } /* }}} lookup_search */
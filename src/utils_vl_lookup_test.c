@@ -231,12 +231,47 @@ DEF_TEST(regex) {
   return 0;
 }
 
+DEF_TEST(add_after_search) {
+  lookup_t *obj;
+  int status;
+
+  CHECK_NOT_NULL(obj = lookup_create(lookup_class_callback, lookup_obj_callback,
+                                     (void *)free, (void *)free));
+
+  checked_lookup_add(obj, "/.*/", "plugin0", "", "test", "/.*/",
+                     LU_GROUP_BY_HOST);
+  status = checked_lookup_search(obj, "host0", "plugin1", "", "test", "ti0",
+                                 /* expect new = */ 0);
+  EXPECT_EQ_INT(0, status);
+  status = checked_lookup_search(obj, "host0", "plugin1", "", "test", "ti0",
+                                 /* expect new = */ 0);
+  EXPECT_EQ_INT(0, status);
+
+  /* the memoized result must not hide classes added later */
+  checked_lookup_add(obj, "host0", "plugin1", "", "test", "ti0", 0);
+  status = checked_lookup_search(obj, "host0", "plugin1", "", "test", "ti0",
+                                 /* expect new = */ 1);
+  EXPECT_EQ_INT(1, status);
+  EXPECT_EQ_STR("host0", last_class_ident.host);
+
+  status = checked_lookup_search(obj, "host0", "plugin1", "", "test", "ti0",
+                                 /* expect new = */ 0);
+  EXPECT_EQ_INT(1, status);
+  status = checked_lookup_search(obj, "host1", "plugin1", "", "test", "ti0",
+                                 /* expect new = */ 0);
+  EXPECT_EQ_INT(0, status);
+
+  lookup_destroy(obj);
+  return 0;
+}
+
 int main(int argc, char **argv) /* {{{ */
 {
   RUN_TEST(group_by_specific_host);
   RUN_TEST(group_by_any_host);
   RUN_TEST(multiple_lookups);
   RUN_TEST(regex);
+  RUN_TEST(add_after_search);
 
   END_TEST;
 } /* }}} int main */
@@ -28,6 +28,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 
 #if HAVE_VARNISH_V4 || HAVE_VARNISH_V5
 #include <vapi/vsc.h>
@@ -90,9 +91,33 @@ struct user_config_s {
   bool collect_vbe;
   bool collect_mse;
 #endif
+
+#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
+  struct VSM_data *vd;
+#elif HAVE_VARNISH_V5
+  struct vsm *vd;
+  struct vsc *vsc;
+#endif
+#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4 || HAVE_VARNISH_V5
+  /* counter name -> varnish_metric_t */
+  c_avl_tree_t *metrics;
+#endif
 };
 typedef struct user_config_s user_config_t; /* }}} */
 
+#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4 || HAVE_VARNISH_V5
+/* Where a counter is dispatched to, as determined by varnish_metric_resolve()
+ * the first time the counter is seen. Counters that aren't collected have a
+ * NULL type. */
+struct varnish_metric_s {
+  int ds_type;
+  char category[DATA_MAX_NAME_LEN];
+  const char *type;
+  const char *type_instance;
+};
+typedef struct varnish_metric_s varnish_metric_t;
+#endif
+
 static bool have_instance;
 
 static int varnish_submit(const char *plugin_instance, /* {{{ */
@@ -139,636 +164,606 @@ static int varnish_submit_derive(const char *plugin_instance, /* {{{ */
 } /* }}} int varnish_submit_derive */
 
 #if HAVE_VARNISH_V3 || HAVE_VARNISH_V4 || HAVE_VARNISH_V5
-static int varnish_monitor(void *priv,
-                           const struct VSC_point *const pt) /* {{{ */
-{
-  uint64_t val;
-  const user_config_t *conf;
-  const char *name;
-
-  if (pt == NULL)
-    return 0;
-
-  conf = priv;
-
-#if HAVE_VARNISH_V5
-  char namebuff[DATA_MAX_NAME_LEN];
-
-  char const *c = strrchr(pt->name, '.');
-  if (c == NULL) {
-    return EINVAL;
-  }
-  sstrncpy(namebuff, c + 1, sizeof(namebuff));
-  name = namebuff;
-
-#elif HAVE_VARNISH_V4
-  if (strcmp(pt->section->fantom->type, "MAIN") != 0)
-    return 0;
-
-  name = pt->desc->name;
-#elif HAVE_VARNISH_V3
-  if (strcmp(pt->class, "") != 0)
-    return 0;
-
-  name = pt->name;
-#endif
-
-  val = *(const volatile uint64_t *)pt->ptr;
+static int varnish_metric_set(varnish_metric_t *m, int ds_type, /* {{{ */
+                              const char *category, const char *type,
+                              const char *type_instance) {
+  m->ds_type = ds_type;
+  sstrncpy(m->category, category, sizeof(m->category));
+  m->type = type;
+  m->type_instance = type_instance;
+  return 0;
+} /* }}} int varnish_metric_set */
 
+/* Looks up the category, type and type instance of the counter "name". Returns
+ * ENOENT if the counter isn't collected with this configuration. */
+static int varnish_metric_resolve(const user_config_t *conf, /* {{{ */
+                                  const char *name, varnish_metric_t *m) {
   if (conf->collect_cache) {
     if (strcmp(name, "cache_hit") == 0)
-      return varnish_submit_derive(conf->instance, "cache", "cache_result",
-                                   "hit", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "cache", "cache_result",
+                                "hit");
     else if (strcmp(name, "cache_miss") == 0)
-      return varnish_submit_derive(conf->instance, "cache", "cache_result",
-                                   "miss", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "cache", "cache_result",
+                                "miss");
     else if (strcmp(name, "cache_hitpass") == 0)
-      return varnish_submit_derive(conf->instance, "cache", "cache_result",
-                                   "hitpass", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "cache", "cache_result",
+                                "hitpass");
   }
 
   if (conf->collect_connections) {
     if (strcmp(name, "client_conn") == 0)
-      return varnish_submit_derive(conf->instance, "connections", "connections",
-                                   "accepted", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "connections", "connections",
+                                "accepted");
     else if (strcmp(name, "client_drop") == 0)
-      return varnish_submit_derive(conf->instance, "connections", "connections",
-                                   "dropped", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "connections", "connections",
+                                "dropped");
     else if (strcmp(name, "client_req") == 0)
-      return varnish_submit_derive(conf->instance, "connections", "connections",
-                                   "received", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "connections", "connections",
+                                "received");
 #if HAVE_VARNISH_V4 || HAVE_VARNISH_V5
     else if (strcmp(name, "client_req_400") == 0)
-      return varnish_submit_derive(conf->instance, "connections", "connections",
-                                   "error_400", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "connections", "connections",
+                                "error_400");
     else if (strcmp(name, "client_req_417") == 0)
-      return varnish_submit_derive(conf->instance, "connections", "connections",
-                                   "error_417", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "connections", "connections",
+                                "error_417");
 #endif
   }
 
 #ifdef HAVE_VARNISH_V3
   if (conf->collect_dirdns) {
     if (strcmp(name, "dir_dns_lookups") == 0)
-      return varnish_submit_derive(conf->instance, "dirdns", "cache_operation",
-                                   "lookups", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "dirdns", "cache_operation",
+                                "lookups");
     else if (strcmp(name, "dir_dns_failed") == 0)
-      return varnish_submit_derive(conf->instance, "dirdns", "cache_result",
-                                   "failed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "dirdns", "cache_result",
+                                "failed");
     else if (strcmp(name, "dir_dns_hit") == 0)
-      return varnish_submit_derive(conf->instance, "dirdns", "cache_result",
-                                   "hits", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "dirdns", "cache_result",
+                                "hits");
     else if (strcmp(name, "dir_dns_cache_full") == 0)
-      return varnish_submit_derive(conf->instance, "dirdns", "cache_result",
-                                   "cache_full", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "dirdns", "cache_result",
+                                "cache_full");
   }
 #endif
 
   if (conf->collect_esi) {
     if (strcmp(name, "esi_errors") == 0)
-      return varnish_submit_derive(conf->instance, "esi", "total_operations",
-                                   "error", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "esi", "total_operations",
+                                "error");
     else if (strcmp(name, "esi_parse") == 0)
-      return varnish_submit_derive(conf->instance, "esi", "total_operations",
-                                   "parsed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "esi", "total_operations",
+                                "parsed");
     else if (strcmp(name, "esi_warnings") == 0)
-      return varnish_submit_derive(conf->instance, "esi", "total_operations",
-                                   "warning", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "esi", "total_operations",
+                                "warning");
     else if (strcmp(name, "esi_maxdepth") == 0)
-      return varnish_submit_derive(conf->instance, "esi", "total_operations",
-                                   "max_depth", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "esi", "total_operations",
+                                "max_depth");
   }
 
   if (conf->collect_backend) {
     if (strcmp(name, "backend_conn") == 0)
-      return varnish_submit_derive(conf->instance, "backend", "connections",
-                                   "success", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "backend", "connections",
+                                "success");
     else if (strcmp(name, "backend_unhealthy") == 0)
-      return varnish_submit_derive(conf->instance, "backend", "connections",
-                                   "not-attempted", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "backend", "connections",
+                                "not-attempted");
     else if (strcmp(name, "backend_busy") == 0)
-      return varnish_submit_derive(conf->instance, "backend", "connections",
-                                   "too-many", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "backend", "connections",
+                                "too-many");
     else if (strcmp(name, "backend_fail") == 0)
-      return varnish_submit_derive(conf->instance, "backend", "connections",
-                                   "failures", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "backend", "connections",
+                                "failures");
     else if (strcmp(name, "backend_reuse") == 0)
-      return varnish_submit_derive(conf->instance, "backend", "connections",
-                                   "reuses", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "backend", "connections",
+                                "reuses");
     else if (strcmp(name, "backend_toolate") == 0)
-      return varnish_submit_derive(conf->instance, "backend", "connections",
-                                   "was-closed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "backend", "connections",
+                                "was-closed");
     else if (strcmp(name, "backend_recycle") == 0)
-      return varnish_submit_derive(conf->instance, "backend", "connections",
-                                   "recycled", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "backend", "connections",
+                                "recycled");
     else if (strcmp(name, "backend_unused") == 0)
-      return varnish_submit_derive(conf->instance, "backend", "connections",
-                                   "unused", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "backend", "connections",
+                                "unused");
     else if (strcmp(name, "backend_retry") == 0)
-      return varnish_submit_derive(conf->instance, "backend", "connections",
-                                   "retries", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "backend", "connections",
+                                "retries");
     else if (strcmp(name, "backend_req") == 0)
-      return varnish_submit_derive(conf->instance, "backend", "http_requests",
-                                   "requests", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "backend", "http_requests",
+                                "requests");
     else if (strcmp(name, "n_backend") == 0)
-      return varnish_submit_gauge(conf->instance, "backend", "backends",
-                                  "n_backends", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "backend", "backends",
+                                "n_backends");
   }
 
   if (conf->collect_fetch) {
     if (strcmp(name, "fetch_head") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "head", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "head");
     else if (strcmp(name, "fetch_length") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "length", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "length");
     else if (strcmp(name, "fetch_chunked") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "chunked", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "chunked");
     else if (strcmp(name, "fetch_eof") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "eof", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "eof");
     else if (strcmp(name, "fetch_bad") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "bad_headers", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "bad_headers");
     else if (strcmp(name, "fetch_close") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "close", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "close");
     else if (strcmp(name, "fetch_oldhttp") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "oldhttp", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "oldhttp");
     else if (strcmp(name, "fetch_zero") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "zero", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "zero");
     else if (strcmp(name, "fetch_failed") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "failed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "failed");
     else if (strcmp(name, "fetch_1xx") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "no_body_1xx", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "no_body_1xx");
     else if (strcmp(name, "fetch_204") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "no_body_204", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "no_body_204");
     else if (strcmp(name, "fetch_304") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "no_body_304", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "no_body_304");
 #if HAVE_VARNISH_V4 || HAVE_VARNISH_V5
     else if (strcmp(name, "fetch_no_thread") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "no_thread", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "no_thread");
     else if (strcmp(name, "fetch_none") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "none", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "none");
     else if (strcmp(name, "busy_sleep") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "busy_sleep", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "busy_sleep");
     else if (strcmp(name, "busy_wakeup") == 0)
-      return varnish_submit_derive(conf->instance, "fetch", "http_requests",
-                                   "busy_wakeup", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "fetch", "http_requests",
+                                "busy_wakeup");
 #endif
   }
 
   if (conf->collect_hcb) {
     if (strcmp(name, "hcb_nolock") == 0)
-      return varnish_submit_derive(conf->instance, "hcb", "cache_operation",
-                                   "lookup_nolock", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "hcb", "cache_operation",
+                                "lookup_nolock");
     else if (strcmp(name, "hcb_lock") == 0)
-      return varnish_submit_derive(conf->instance, "hcb", "cache_operation",
-                                   "lookup_lock", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "hcb", "cache_operation",
+                                "lookup_lock");
     else if (strcmp(name, "hcb_insert") == 0)
-      return varnish_submit_derive(conf->instance, "hcb", "cache_operation",
-                                   "insert", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "hcb", "cache_operation",
+                                "insert");
   }
 
   if (conf->collect_objects) {
     if (strcmp(name, "n_expired") == 0)
-      return varnish_submit_derive(conf->instance, "objects", "total_objects",
-                                   "expired", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "objects", "total_objects",
+                                "expired");
     else if (strcmp(name, "n_lru_nuked") == 0)
-      return varnish_submit_derive(conf->instance, "objects", "total_objects",
-                                   "lru_nuked", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "objects", "total_objects",
+                                "lru_nuked");
     else if (strcmp(name, "n_lru_saved") == 0)
-      return varnish_submit_derive(conf->instance, "objects", "total_objects",
-                                   "lru_saved", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "objects", "total_objects",
+                                "lru_saved");
     else if (strcmp(name, "n_lru_moved") == 0)
-      return varnish_submit_derive(conf->instance, "objects", "total_objects",
-                                   "lru_moved", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "objects", "total_objects",
+                                "lru_moved");
     else if (strcmp(name, "n_deathrow") == 0)
-      return varnish_submit_derive(conf->instance, "objects", "total_objects",
-                                   "deathrow", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "objects", "total_objects",
+                                "deathrow");
     else if (strcmp(name, "losthdr") == 0)
-      return varnish_submit_derive(conf->instance, "objects", "total_objects",
-                                   "header_overflow", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "objects", "total_objects",
+                                "header_overflow");
     else if (strcmp(name, "n_obj_purged") == 0)
-      return varnish_submit_derive(conf->instance, "objects", "total_objects",
-                                   "purged", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "objects", "total_objects",
+                                "purged");
     else if (strcmp(name, "n_objsendfile") == 0)
-      return varnish_submit_derive(conf->instance, "objects", "total_objects",
-                                   "sent_sendfile", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "objects", "total_objects",
+                                "sent_sendfile");
     else if (strcmp(name, "n_objwrite") == 0)
-      return varnish_submit_derive(conf->instance, "objects", "total_objects",
-                                   "sent_write", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "objects", "total_objects",
+                                "sent_write");
     else if (strcmp(name, "n_objoverflow") == 0)
-      return varnish_submit_derive(conf->instance, "objects", "total_objects",
-                                   "workspace_overflow", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "objects", "total_objects",
+                                "workspace_overflow");
 #if HAVE_VARNISH_V4 || HAVE_VARNISH_V5
     else if (strcmp(name, "exp_mailed") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects",
-                                  "exp_mailed", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects",
+                                "exp_mailed");
     else if (strcmp(name, "exp_received") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects",
-                                  "exp_received", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects",
+                                "exp_received");
 #endif
   }
 
 #if HAVE_VARNISH_V3
   if (conf->collect_ban) {
     if (strcmp(name, "n_ban") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "total", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "total");
     else if (strcmp(name, "n_ban_add") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "added", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "added");
     else if (strcmp(name, "n_ban_retire") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "deleted", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "deleted");
     else if (strcmp(name, "n_ban_obj_test") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "objects_tested", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "objects_tested");
     else if (strcmp(name, "n_ban_re_test") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "regexps_tested", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "regexps_tested");
     else if (strcmp(name, "n_ban_dups") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "duplicate", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "duplicate");
   }
 #endif
 #if HAVE_VARNISH_V4 || HAVE_VARNISH_V5
   if (conf->collect_ban) {
     if (strcmp(name, "bans") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "total", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "total");
     else if (strcmp(name, "bans_added") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "added", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "added");
     else if (strcmp(name, "bans_obj") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "obj", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "obj");
     else if (strcmp(name, "bans_req") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "req", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "req");
     else if (strcmp(name, "bans_completed") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "completed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "completed");
     else if (strcmp(name, "bans_deleted") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "deleted", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "deleted");
     else if (strcmp(name, "bans_tested") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "tested", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "tested");
     else if (strcmp(name, "bans_dups") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "duplicate", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "duplicate");
     else if (strcmp(name, "bans_tested") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "tested", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "tested");
     else if (strcmp(name, "bans_lurker_contention") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "lurker_contention", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "lurker_contention");
     else if (strcmp(name, "bans_lurker_obj_killed") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "lurker_obj_killed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "lurker_obj_killed");
     else if (strcmp(name, "bans_lurker_tested") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "lurker_tested", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "lurker_tested");
     else if (strcmp(name, "bans_lurker_tests_tested") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "lurker_tests_tested", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "lurker_tests_tested");
     else if (strcmp(name, "bans_obj_killed") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "obj_killed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "obj_killed");
     else if (strcmp(name, "bans_persisted_bytes") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_bytes",
-                                   "persisted_bytes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_bytes",
+                                "persisted_bytes");
     else if (strcmp(name, "bans_persisted_fragmentation") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_bytes",
-                                   "persisted_fragmentation", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_bytes",
+                                "persisted_fragmentation");
     else if (strcmp(name, "bans_tests_tested") == 0)
-      return varnish_submit_derive(conf->instance, "ban", "total_operations",
-                                   "tests_tested", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "ban", "total_operations",
+                                "tests_tested");
   }
 #endif
 
   if (conf->collect_session) {
     if (strcmp(name, "sess_closed") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "closed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "closed");
     else if (strcmp(name, "sess_pipeline") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "pipeline", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "pipeline");
     else if (strcmp(name, "sess_readahead") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "readahead", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "readahead");
     else if (strcmp(name, "sess_conn") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "accepted", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "accepted");
     else if (strcmp(name, "sess_drop") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "dropped", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "dropped");
     else if (strcmp(name, "sess_fail") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "failed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "failed");
     else if (strcmp(name, "sess_pipe_overflow") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "overflow", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "overflow");
     else if (strcmp(name, "sess_queued") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "queued", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "queued");
     else if (strcmp(name, "sess_linger") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "linger", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "linger");
     else if (strcmp(name, "sess_herd") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "herd", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "herd");
 #if HAVE_VARNISH_V4 || HAVE_VARNISH_V5
     else if (strcmp(name, "sess_closed_err") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "closed_err", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "closed_err");
     else if (strcmp(name, "sess_dropped") == 0)
-      return varnish_submit_derive(conf->instance, "session",
-                                   "total_operations", "dropped_for_thread",
-                                   val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "session",
+                                "total_operations", "dropped_for_thread");
 #endif
   }
 
   if (conf->collect_shm) {
     if (strcmp(name, "shm_records") == 0)
-      return varnish_submit_derive(conf->instance, "shm", "total_operations",
-                                   "records", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "shm", "total_operations",
+                                "records");
     else if (strcmp(name, "shm_writes") == 0)
-      return varnish_submit_derive(conf->instance, "shm", "total_operations",
-                                   "writes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "shm", "total_operations",
+                                "writes");
     else if (strcmp(name, "shm_flushes") == 0)
-      return varnish_submit_derive(conf->instance, "shm", "total_operations",
-                                   "flushes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "shm", "total_operations",
+                                "flushes");
     else if (strcmp(name, "shm_cont") == 0)
-      return varnish_submit_derive(conf->instance, "shm", "total_operations",
-                                   "contention", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "shm", "total_operations",
+                                "contention");
     else if (strcmp(name, "shm_cycles") == 0)
-      return varnish_submit_derive(conf->instance, "shm", "total_operations",
-                                   "cycles", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "shm", "total_operations",
+                                "cycles");
   }
 
   if (conf->collect_sms) {
     if (strcmp(name, "sms_nreq") == 0)
-      return varnish_submit_derive(conf->instance, "sms", "total_requests",
-                                   "allocator", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "sms", "total_requests",
+                                "allocator");
     else if (strcmp(name, "sms_nobj") == 0)
-      return varnish_submit_gauge(conf->instance, "sms", "requests",
-                                  "outstanding", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "sms", "requests",
+                                "outstanding");
     else if (strcmp(name, "sms_nbytes") == 0)
-      return varnish_submit_gauge(conf->instance, "sms", "bytes", "outstanding",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "sms", "bytes",
+                                "outstanding");
     else if (strcmp(name, "sms_balloc") == 0)
-      return varnish_submit_derive(conf->instance, "sms", "total_bytes",
-                                   "allocated", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "sms", "total_bytes",
+                                "allocated");
     else if (strcmp(name, "sms_bfree") == 0)
-      return varnish_submit_derive(conf->instance, "sms", "total_bytes", "free",
-                                   val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "sms", "total_bytes",
+                                "free");
   }
 
   if (conf->collect_struct) {
     if (strcmp(name, "n_sess_mem") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "current_sessions",
-                                  "sess_mem", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "current_sessions",
+                                "sess_mem");
     else if (strcmp(name, "n_sess") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "current_sessions",
-                                  "sess", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "current_sessions",
+                                "sess");
     else if (strcmp(name, "n_object") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects", "object",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects",
+                                "object");
     else if (strcmp(name, "n_vampireobject") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects",
-                                  "vampireobject", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects",
+                                "vampireobject");
     else if (strcmp(name, "n_objectcore") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects",
-                                  "objectcore", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects",
+                                "objectcore");
     else if (strcmp(name, "n_waitinglist") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects",
-                                  "waitinglist", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects",
+                                "waitinglist");
     else if (strcmp(name, "n_objecthead") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects",
-                                  "objecthead", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects",
+                                "objecthead");
     else if (strcmp(name, "n_smf") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects", "smf",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects", "smf");
     else if (strcmp(name, "n_smf_frag") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects",
-                                  "smf_frag", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects",
+                                "smf_frag");
     else if (strcmp(name, "n_smf_large") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects",
-                                  "smf_large", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects",
+                                "smf_large");
     else if (strcmp(name, "n_vbe_conn") == 0)
-      return varnish_submit_gauge(conf->instance, "struct", "objects",
-                                  "vbe_conn", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "struct", "objects",
+                                "vbe_conn");
   }
 
   if (conf->collect_totals) {
     if (strcmp(name, "s_sess") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_sessions",
-                                   "sessions", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_sessions",
+                                "sessions");
     else if (strcmp(name, "s_req") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_requests",
-                                   "requests", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_requests",
+                                "requests");
     else if (strcmp(name, "s_pipe") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_operations",
-                                   "pipe", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_operations",
+                                "pipe");
     else if (strcmp(name, "s_pass") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_operations",
-                                   "pass", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_operations",
+                                "pass");
     else if (strcmp(name, "s_fetch") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_operations",
-                                   "fetches", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_operations",
+                                "fetches");
     else if (strcmp(name, "s_synth") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "synth", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "synth");
     else if (strcmp(name, "s_req_hdrbytes") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "req_header", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "req_header");
     else if (strcmp(name, "s_req_bodybytes") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "req_body", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "req_body");
     else if (strcmp(name, "s_req_protobytes") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "req_proto", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "req_proto");
     else if (strcmp(name, "s_resp_hdrbytes") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "resp_header", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "resp_header");
     else if (strcmp(name, "s_resp_bodybytes") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "resp_body", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "resp_body");
     else if (strcmp(name, "s_resp_protobytes") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "resp_proto", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "resp_proto");
     else if (strcmp(name, "s_pipe_hdrbytes") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "pipe_header", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "pipe_header");
     else if (strcmp(name, "s_pipe_in") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "pipe_in", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "pipe_in");
     else if (strcmp(name, "s_pipe_out") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "pipe_out", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "pipe_out");
     else if (strcmp(name, "n_purges") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_operations",
-                                   "purges", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_operations",
+                                "purges");
     else if (strcmp(name, "s_hdrbytes") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "header-bytes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "header-bytes");
     else if (strcmp(name, "s_bodybytes") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_bytes",
-                                   "body-bytes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_bytes",
+                                "body-bytes");
     else if (strcmp(name, "n_gzip") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_operations",
-                                   "gzip", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_operations",
+                                "gzip");
     else if (strcmp(name, "n_gunzip") == 0)
-      return varnish_submit_derive(conf->instance, "totals", "total_operations",
-                                   "gunzip", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "totals", "total_operations",
+                                "gunzip");
   }
 
   if (conf->collect_uptime) {
     if (strcmp(name, "uptime") == 0)
-      return varnish_submit_gauge(conf->instance, "uptime", "uptime",
-                                  "client_uptime", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "uptime", "uptime",
+                                "client_uptime");
   }
 
   if (conf->collect_vcl) {
     if (strcmp(name, "n_vcl") == 0)
-      return varnish_submit_gauge(conf->instance, "vcl", "vcl", "total_vcl",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "vcl", "vcl", "total_vcl");
     else if (strcmp(name, "n_vcl_avail") == 0)
-      return varnish_submit_gauge(conf->instance, "vcl", "vcl", "avail_vcl",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "vcl", "vcl", "avail_vcl");
     else if (strcmp(name, "n_vcl_discard") == 0)
-      return varnish_submit_gauge(conf->instance, "vcl", "vcl", "discarded_vcl",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "vcl", "vcl",
+                                "discarded_vcl");
     else if (strcmp(name, "vmods") == 0)
-      return varnish_submit_gauge(conf->instance, "vcl", "objects", "vmod",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "vcl", "objects", "vmod");
   }
 
   if (conf->collect_workers) {
     if (strcmp(name, "threads") == 0)
-      return varnish_submit_gauge(conf->instance, "workers", "threads",
-                                  "worker", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "workers", "threads",
+                                "worker");
     else if (strcmp(name, "threads_created") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_threads",
-                                   "created", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_threads",
+                                "created");
     else if (strcmp(name, "threads_failed") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_threads",
-                                   "failed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_threads",
+                                "failed");
     else if (strcmp(name, "threads_limited") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_threads",
-                                   "limited", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_threads",
+                                "limited");
     else if (strcmp(name, "threads_destroyed") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_threads",
-                                   "dropped", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_threads",
+                                "dropped");
     else if (strcmp(name, "thread_queue_len") == 0)
-      return varnish_submit_gauge(conf->instance, "workers", "queue_length",
-                                  "threads", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "workers", "queue_length",
+                                "threads");
     else if (strcmp(name, "n_wrk") == 0)
-      return varnish_submit_gauge(conf->instance, "workers", "threads",
-                                  "worker", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "workers", "threads",
+                                "worker");
     else if (strcmp(name, "n_wrk_create") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_threads",
-                                   "created", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_threads",
+                                "created");
     else if (strcmp(name, "n_wrk_failed") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_threads",
-                                   "failed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_threads",
+                                "failed");
     else if (strcmp(name, "n_wrk_max") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_threads",
-                                   "limited", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_threads",
+                                "limited");
     else if (strcmp(name, "n_wrk_drop") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_threads",
-                                   "dropped", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_threads",
+                                "dropped");
     else if (strcmp(name, "n_wrk_queue") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_requests",
-                                   "queued", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_requests",
+                                "queued");
     else if (strcmp(name, "n_wrk_overflow") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_requests",
-                                   "overflowed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_requests",
+                                "overflowed");
     else if (strcmp(name, "n_wrk_queued") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_requests",
-                                   "queued", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_requests",
+                                "queued");
     else if (strcmp(name, "n_wrk_lqueue") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "total_requests",
-                                   "queue_length", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "total_requests",
+                                "queue_length");
 #if HAVE_VARNISH_V4 || HAVE_VARNISH_V5
     else if (strcmp(name, "pools") == 0)
-      return varnish_submit_gauge(conf->instance, "workers", "pools", "pools",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "workers", "pools", "pools");
     else if (strcmp(name, "busy_killed") == 0)
-      return varnish_submit_derive(conf->instance, "workers", "http_requests",
-                                   "busy_killed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "workers", "http_requests",
+                                "busy_killed");
 #endif
   }
 
 #if HAVE_VARNISH_V4 || HAVE_VARNISH_V5
   if (conf->collect_vsm) {
     if (strcmp(name, "vsm_free") == 0)
-      return varnish_submit_gauge(conf->instance, "vsm", "bytes", "free", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "vsm", "bytes", "free");
     else if (strcmp(name, "vsm_used") == 0)
-      return varnish_submit_gauge(conf->instance, "vsm", "bytes", "used", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "vsm", "bytes", "used");
     else if (strcmp(name, "vsm_cooling") == 0)
-      return varnish_submit_gauge(conf->instance, "vsm", "bytes", "cooling",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "vsm", "bytes", "cooling");
     else if (strcmp(name, "vsm_overflow") == 0)
-      return varnish_submit_gauge(conf->instance, "vsm", "bytes", "overflow",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "vsm", "bytes", "overflow");
     else if (strcmp(name, "vsm_overflowed") == 0)
-      return varnish_submit_derive(conf->instance, "vsm", "total_bytes",
-                                   "overflowed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vsm", "total_bytes",
+                                "overflowed");
   }
 
   if (conf->collect_vbe) {
     /* @TODO figure out the collectd type for bitmap
     if (strcmp(name, "happy") == 0)
-      return varnish_submit_derive(conf->instance, "vbe",
-                                   "bitmap", "happy_hprobes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "bitmap",
+                                "happy_hprobes");
     */
     if (strcmp(name, "bereq_hdrbytes") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "total_bytes",
-                                   "bereq_hdrbytes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "total_bytes",
+                                "bereq_hdrbytes");
     else if (strcmp(name, "bereq_bodybytes") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "total_bytes",
-                                   "bereq_bodybytes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "total_bytes",
+                                "bereq_bodybytes");
     else if (strcmp(name, "bereq_protobytes") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "total_bytes",
-                                   "bereq_protobytes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "total_bytes",
+                                "bereq_protobytes");
     else if (strcmp(name, "beresp_hdrbytes") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "total_bytes",
-                                   "beresp_hdrbytes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "total_bytes",
+                                "beresp_hdrbytes");
     else if (strcmp(name, "beresp_bodybytes") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "total_bytes",
-                                   "beresp_bodybytes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "total_bytes",
+                                "beresp_bodybytes");
     else if (strcmp(name, "beresp_protobytes") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "total_bytes",
-                                   "beresp_protobytes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "total_bytes",
+                                "beresp_protobytes");
     else if (strcmp(name, "pipe_hdrbytes") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "total_bytes",
-                                   "pipe_hdrbytes", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "total_bytes",
+                                "pipe_hdrbytes");
     else if (strcmp(name, "pipe_out") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "total_bytes",
-                                   "pipe_out", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "total_bytes",
+                                "pipe_out");
     else if (strcmp(name, "pipe_in") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "total_bytes",
-                                   "pipe_in", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "total_bytes",
+                                "pipe_in");
     else if (strcmp(name, "conn") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "connections",
-                                   "c_conns", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "connections",
+                                "c_conns");
     else if (strcmp(name, "req") == 0)
-      return varnish_submit_derive(conf->instance, "vbe", "http_requests",
-                                   "b_reqs", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "vbe", "http_requests",
+                                "b_reqs");
   }
 
   /* All Stevedores support these counters */
@@ -783,209 +778,274 @@ static int varnish_monitor(void *priv,
       strncpy(category, "mse", 4);
 
     if (strcmp(name, "c_req") == 0)
-      return varnish_submit_derive(conf->instance, category, "total_operations",
-                                   "alloc_req", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, category, "total_operations",
+                                "alloc_req");
     else if (strcmp(name, "c_fail") == 0)
-      return varnish_submit_derive(conf->instance, category, "total_operations",
-                                   "alloc_fail", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, category, "total_operations",
+                                "alloc_fail");
     else if (strcmp(name, "c_bytes") == 0)
-      return varnish_submit_derive(conf->instance, category, "total_bytes",
-                                   "bytes_allocated", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, category, "total_bytes",
+                                "bytes_allocated");
     else if (strcmp(name, "c_freed") == 0)
-      return varnish_submit_derive(conf->instance, category, "total_bytes",
-                                   "bytes_freed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, category, "total_bytes",
+                                "bytes_freed");
     else if (strcmp(name, "g_alloc") == 0)
-      return varnish_submit_derive(conf->instance, category, "total_operations",
-                                   "alloc_outstanding", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, category, "total_operations",
+                                "alloc_outstanding");
     else if (strcmp(name, "g_bytes") == 0)
-      return varnish_submit_gauge(conf->instance, category, "bytes",
-                                  "bytes_outstanding", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, category, "bytes",
+                                "bytes_outstanding");
     else if (strcmp(name, "g_space") == 0)
-      return varnish_submit_gauge(conf->instance, category, "bytes",
-                                  "bytes_available", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, category, "bytes",
+                                "bytes_available");
   }
 
   /* No SMA specific counters */
 
   if (conf->collect_smf) {
     if (strcmp(name, "g_smf") == 0)
-      return varnish_submit_gauge(conf->instance, "smf", "objects",
-                                  "n_struct_smf", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "smf", "objects",
+                                "n_struct_smf");
     else if (strcmp(name, "g_smf_frag") == 0)
-      return varnish_submit_gauge(conf->instance, "smf", "objects",
-                                  "n_small_free_smf", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "smf", "objects",
+                                "n_small_free_smf");
     else if (strcmp(name, "g_smf_large") == 0)
-      return varnish_submit_gauge(conf->instance, "smf", "objects",
-                                  "n_large_free_smf", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "smf", "objects",
+                                "n_large_free_smf");
   }
 
   if (conf->collect_mgt) {
     if (strcmp(name, "uptime") == 0)
-      return varnish_submit_gauge(conf->instance, "mgt", "uptime",
-                                  "mgt_proc_uptime", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mgt", "uptime",
+                                "mgt_proc_uptime");
     else if (strcmp(name, "child_start") == 0)
-      return varnish_submit_derive(conf->instance, "mgt", "total_operations",
-                                   "child_start", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mgt", "total_operations",
+                                "child_start");
     else if (strcmp(name, "child_exit") == 0)
-      return varnish_submit_derive(conf->instance, "mgt", "total_operations",
-                                   "child_exit", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mgt", "total_operations",
+                                "child_exit");
     else if (strcmp(name, "child_stop") == 0)
-      return varnish_submit_derive(conf->instance, "mgt", "total_operations",
-                                   "child_stop", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mgt", "total_operations",
+                                "child_stop");
     else if (strcmp(name, "child_died") == 0)
-      return varnish_submit_derive(conf->instance, "mgt", "total_operations",
-                                   "child_died", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mgt", "total_operations",
+                                "child_died");
     else if (strcmp(name, "child_dump") == 0)
-      return varnish_submit_derive(conf->instance, "mgt", "total_operations",
-                                   "child_dump", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mgt", "total_operations",
+                                "child_dump");
     else if (strcmp(name, "child_panic") == 0)
-      return varnish_submit_derive(conf->instance, "mgt", "total_operations",
-                                   "child_panic", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mgt", "total_operations",
+                                "child_panic");
   }
 
   if (conf->collect_lck) {
     if (strcmp(name, "creat") == 0)
-      return varnish_submit_gauge(conf->instance, "lck", "objects", "created",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "lck", "objects", "created");
     else if (strcmp(name, "destroy") == 0)
-      return varnish_submit_gauge(conf->instance, "lck", "objects", "destroyed",
-                                  val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "lck", "objects",
+                                "destroyed");
     else if (strcmp(name, "locks") == 0)
-      return varnish_submit_derive(conf->instance, "lck", "total_operations",
-                                   "lock_ops", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "lck", "total_operations",
+                                "lock_ops");
   }
 
   if (conf->collect_mempool) {
     if (strcmp(name, "live") == 0)
-      return varnish_submit_gauge(conf->instance, "mempool", "objects",
-                                  "in_use", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mempool", "objects",
+                                "in_use");
     else if (strcmp(name, "pool") == 0)
-      return varnish_submit_gauge(conf->instance, "mempool", "objects",
-                                  "in_pool", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mempool", "objects",
+                                "in_pool");
     else if (strcmp(name, "sz_wanted") == 0)
-      return varnish_submit_gauge(conf->instance, "mempool", "bytes",
-                                  "size_requested", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mempool", "bytes",
+                                "size_requested");
     else if (strcmp(name, "sz_actual") == 0)
-      return varnish_submit_gauge(conf->instance, "mempool", "bytes",
-                                  "size_allocated", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mempool", "bytes",
+                                "size_allocated");
     else if (strcmp(name, "allocs") == 0)
-      return varnish_submit_derive(conf->instance, "mempool",
-                                   "total_operations", "allocations", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mempool",
+                                "total_operations", "allocations");
     else if (strcmp(name, "frees") == 0)
-      return varnish_submit_derive(conf->instance, "mempool",
-                                   "total_operations", "frees", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mempool",
+                                "total_operations", "frees");
     else if (strcmp(name, "recycle") == 0)
-      return varnish_submit_gauge(conf->instance, "mempool", "objects",
-                                  "recycled", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mempool", "objects",
+                                "recycled");
     else if (strcmp(name, "timeout") == 0)
-      return varnish_submit_gauge(conf->instance, "mempool", "objects",
-                                  "timed_out", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mempool", "objects",
+                                "timed_out");
     else if (strcmp(name, "toosmall") == 0)
-      return varnish_submit_gauge(conf->instance, "mempool", "objects",
-                                  "too_small", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mempool", "objects",
+                                "too_small");
     else if (strcmp(name, "surplus") == 0)
-      return varnish_submit_gauge(conf->instance, "mempool", "objects",
-                                  "surplus", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mempool", "objects",
+                                "surplus");
     else if (strcmp(name, "randry") == 0)
-      return varnish_submit_gauge(conf->instance, "mempool", "objects",
-                                  "ran_dry", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mempool", "objects",
+                                "ran_dry");
   }
 
   if (conf->collect_mse) {
     if (strcmp(name, "c_full") == 0)
-      return varnish_submit_derive(conf->instance, "mse", "total_operations",
-                                   "full_allocs", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse", "total_operations",
+                                "full_allocs");
     else if (strcmp(name, "c_truncated") == 0)
-      return varnish_submit_derive(conf->instance, "mse", "total_operations",
-                                   "truncated_allocs", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse", "total_operations",
+                                "truncated_allocs");
     else if (strcmp(name, "c_expanded") == 0)
-      return varnish_submit_derive(conf->instance, "mse", "total_operations",
-                                   "expanded_allocs", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse", "total_operations",
+                                "expanded_allocs");
     else if (strcmp(name, "c_failed") == 0)
-      return varnish_submit_derive(conf->instance, "mse", "total_operations",
-                                   "failed_allocs", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse", "total_operations",
+                                "failed_allocs");
     else if (strcmp(name, "c_bytes") == 0)
-      return varnish_submit_derive(conf->instance, "mse", "total_bytes",
-                                   "bytes_allocated", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse", "total_bytes",
+                                "bytes_allocated");
     else if (strcmp(name, "c_freed") == 0)
-      return varnish_submit_derive(conf->instance, "mse", "total_bytes",
-                                   "bytes_freed", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse", "total_bytes",
+                                "bytes_freed");
     else if (strcmp(name, "g_fo_alloc") == 0)
-      return varnish_submit_derive(conf->instance, "mse", "total_operations",
-                                   "fo_allocs_outstanding", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse", "total_operations",
+                                "fo_allocs_outstanding");
     else if (strcmp(name, "g_fo_bytes") == 0)
-      return varnish_submit_gauge(conf->instance, "mse", "bytes",
-                                  "fo_bytes_outstanding", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse", "bytes",
+                                "fo_bytes_outstanding");
     else if (strcmp(name, "g_membuf_alloc") == 0)
-      return varnish_submit_gauge(conf->instance, "mse", "objects",
-                                  "membufs_allocated", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse", "objects",
+                                "membufs_allocated");
     else if (strcmp(name, "g_membuf_inuse") == 0)
-      return varnish_submit_gauge(conf->instance, "mse", "objects",
-                                  "membufs_inuse", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse", "objects",
+                                "membufs_inuse");
     else if (strcmp(name, "g_bans_bytes") == 0)
-      return varnish_submit_gauge(conf->instance, "mse", "bytes",
-                                  "persisted_banspace_used", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse", "bytes",
+                                "persisted_banspace_used");
     else if (strcmp(name, "g_bans_space") == 0)
-      return varnish_submit_gauge(conf->instance, "mse", "bytes",
-                                  "persisted_banspace_available", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse", "bytes",
+                                "persisted_banspace_available");
     else if (strcmp(name, "g_bans_persisted") == 0)
-      return varnish_submit_derive(conf->instance, "mse", "total_operations",
-                                   "bans_persisted", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse", "total_operations",
+                                "bans_persisted");
     else if (strcmp(name, "g_bans_lost") == 0)
-      return varnish_submit_derive(conf->instance, "mse", "total_operations",
-                                   "bans_lost", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse", "total_operations",
+                                "bans_lost");
 
     /* mse seg */
     else if (strcmp(name, "g_journal_bytes") == 0)
-      return varnish_submit_gauge(conf->instance, "mse_reg", "bytes",
-                                  "journal_bytes_used", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse_reg", "bytes",
+                                "journal_bytes_used");
     else if (strcmp(name, "g_journal_space") == 0)
-      return varnish_submit_gauge(conf->instance, "mse_reg", "bytes",
-                                  "journal_bytes_free", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse_reg", "bytes",
+                                "journal_bytes_free");
 
     /* mse segagg */
     else if (strcmp(name, "g_bigspace") == 0)
-      return varnish_submit_gauge(conf->instance, "mse_segagg", "bytes",
-                                  "big_extents_bytes_available", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse_segagg", "bytes",
+                                "big_extents_bytes_available");
     else if (strcmp(name, "g_extfree") == 0)
-      return varnish_submit_gauge(conf->instance, "mse_segagg", "objects",
-                                  "free_extents", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse_segagg", "objects",
+                                "free_extents");
     else if (strcmp(name, "g_sparenode") == 0)
-      return varnish_submit_gauge(conf->instance, "mse_segagg", "objects",
-                                  "spare_nodes_available", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse_segagg", "objects",
+                                "spare_nodes_available");
     else if (strcmp(name, "g_objnode") == 0)
-      return varnish_submit_gauge(conf->instance, "mse_segagg", "objects",
-                                  "object_nodes_in_use", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse_segagg", "objects",
+                                "object_nodes_in_use");
     else if (strcmp(name, "g_extnode") == 0)
-      return varnish_submit_gauge(conf->instance, "mse_segagg", "objects",
-                                  "extent_nodes_in_use", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse_segagg", "objects",
+                                "extent_nodes_in_use");
     else if (strcmp(name, "g_bigextfree") == 0)
-      return varnish_submit_gauge(conf->instance, "mse_segagg", "objects",
-                                  "free_big_extents", val);
+      return varnish_metric_set(m, DS_TYPE_GAUGE, "mse_segagg", "objects",
+                                "free_big_extents");
     else if (strcmp(name, "c_pruneloop") == 0)
-      return varnish_submit_derive(conf->instance, "mse_segagg",
-                                   "total_operations", "prune_loops", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse_segagg",
+                                "total_operations", "prune_loops");
     else if (strcmp(name, "c_pruned") == 0)
-      return varnish_submit_derive(conf->instance, "mse_segagg",
-                                   "total_objects", "pruned_objects", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse_segagg",
+                                "total_objects", "pruned_objects");
     else if (strcmp(name, "c_spared") == 0)
-      return varnish_submit_derive(conf->instance, "mse_segagg",
-                                   "total_operations", "spared_objects", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse_segagg",
+                                "total_operations", "spared_objects");
     else if (strcmp(name, "c_skipped") == 0)
-      return varnish_submit_derive(conf->instance, "mse_segagg",
-                                   "total_operations", "missed_objects", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse_segagg",
+                                "total_operations", "missed_objects");
     else if (strcmp(name, "c_nuked") == 0)
-      return varnish_submit_derive(conf->instance, "mse_segagg",
-                                   "total_operations", "nuked_objects", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse_segagg",
+                                "total_operations", "nuked_objects");
     else if (strcmp(name, "c_sniped") == 0)
-      return varnish_submit_derive(conf->instance, "mse_segagg",
-                                   "total_operations", "sniped_objects", val);
+      return varnish_metric_set(m, DS_TYPE_DERIVE, "mse_segagg",
+                                "total_operations", "sniped_objects");
   }
 
 #endif
 
-  return 0;
+  return ENOENT;
+} /* }}} int varnish_metric_resolve */
+
+static int varnish_monitor(void *priv,
+                           const struct VSC_point *const pt) /* {{{ */
+{
+  uint64_t val;
+  user_config_t *conf;
+  const char *name;
+
+  if (pt == NULL)
+    return 0;
+
+  conf = priv;
+
+#if HAVE_VARNISH_V5
+  char namebuff[DATA_MAX_NAME_LEN];
+
+  char const *c = strrchr(pt->name, '.');
+  if (c == NULL) {
+    return EINVAL;
+  }
+  sstrncpy(namebuff, c + 1, sizeof(namebuff));
+  name = namebuff;
+
+#elif HAVE_VARNISH_V4
+  if (strcmp(pt->section->fantom->type, "MAIN") != 0)
+    return 0;
+
+  name = pt->desc->name;
+#elif HAVE_VARNISH_V3
+  if (strcmp(pt->class, "") != 0)
+    return 0;
+
+  name = pt->name;
+#endif
+
+  val = *(const volatile uint64_t *)pt->ptr;
+
+  varnish_metric_t *m = NULL;
+  if (c_avl_get(conf->metrics, name, (void *)&m) != 0) {
+    char *key = strdup(name);
+    m = calloc(1, sizeof(*m));
+    if ((key == NULL) || (m == NULL)) {
+      ERROR("varnish plugin: malloc failed.");
+      sfree(key);
+      sfree(m);
+      return ENOMEM;
+    }
+
+    if (varnish_metric_resolve(conf, name, m) != 0)
+      m->type = NULL;
 
+    if (c_avl_insert(conf->metrics, key, m) != 0) {
+      sfree(key);
+      sfree(m);
+      return -1;
+    }
+  }
+
+  if (m->type == NULL)
+    return 0;
+
+  if (m->ds_type == DS_TYPE_GAUGE)
+    return varnish_submit_gauge(conf->instance, m->category, m->type,
+                                m->type_instance, val);
+  return varnish_submit_derive(conf->instance, m->category, m->type,
+                               m->type_instance, val);
 } /* }}} static int varnish_monitor */
 #else /* if HAVE_VARNISH_V2 */
 static void varnish_monitor(const user_config_t *conf, /* {{{ */
@@ -1327,51 +1387,43 @@ static void varnish_monitor(const user_config_t *conf, /* {{{ */
 #endif
 
 #if HAVE_VARNISH_V3 || HAVE_VARNISH_V4 || HAVE_VARNISH_V5
-static int varnish_read(user_data_t *ud) /* {{{ */
+static void varnish_close(user_config_t *conf) /* {{{ */
 {
+  if (conf->vd == NULL)
+    return;
+
 #if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
-  struct VSM_data *vd;
-  bool ok;
-  const c_varnish_stats_t *stats;
+  VSM_Delete(conf->vd);
 #elif HAVE_VARNISH_V5
-  struct vsm *vd;
-  struct vsc *vsc;
-  int vsm_status;
+  VSC_Destroy(&conf->vsc, conf->vd);
+  VSM_Destroy(&conf->vd);
 #endif
+  conf->vd = NULL;
+} /* }}} void varnish_close */
 
-  user_config_t *conf;
-
-  if ((ud == NULL) || (ud->data == NULL))
-    return EINVAL;
-
-  conf = ud->data;
-
-  vd = VSM_New();
+static int varnish_open(user_config_t *conf) /* {{{ */
+{
+  conf->vd = VSM_New();
 
 #if HAVE_VARNISH_V5
-  vsc = VSC_New();
+  conf->vsc = VSC_New();
 #endif
 
 #if HAVE_VARNISH_V3
-  VSC_Setup(vd);
+  VSC_Setup(conf->vd);
 #endif
 
   if (conf->instance != NULL) {
     int status;
 
 #if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
-    status = VSM_n_Arg(vd, conf->instance);
+    status = VSM_n_Arg(conf->vd, conf->instance);
 #elif HAVE_VARNISH_V5
-    status = VSM_Arg(vd, 'n', conf->instance);
+    status = VSM_Arg(conf->vd, 'n', conf->instance);
 #endif
 
     if (status < 0) {
-#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
-      VSM_Delete(vd);
-#elif HAVE_VARNISH_V5
-      VSC_Destroy(&vsc, vd);
-      VSM_Destroy(&vd);
-#endif
+      varnish_close(conf);
       ERROR("varnish plugin: VSM_Arg (\"%s\") failed "
             "with status %i.",
             conf->instance, status);
@@ -1379,62 +1431,86 @@ static int varnish_read(user_data_t *ud) /* {{{ */
     }
   }
 
+#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
 #if HAVE_VARNISH_V3
-  ok = (VSC_Open(vd, /* diag = */ 1) == 0);
-#elif HAVE_VARNISH_V4
-  ok = (VSM_Open(vd) == 0);
+  bool ok = (VSC_Open(conf->vd, /* diag = */ 1) == 0);
+#else
+  bool ok = (VSM_Open(conf->vd) == 0);
 #endif
-#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
   if (!ok) {
-    VSM_Delete(vd);
+    varnish_close(conf);
     ERROR("varnish plugin: Unable to open connection.");
     return -1;
   }
+#elif HAVE_VARNISH_V5
+  if (VSM_Attach(conf->vd, STDERR_FILENO)) {
+    ERROR("varnish plugin: Cannot attach to varnish. %s", VSM_Error(conf->vd));
+    varnish_close(conf);
+    return -1;
+  }
 #endif
 
+  return 0;
+} /* }}} int varnish_open */
+
+static int varnish_read(user_data_t *ud) /* {{{ */
+{
+  user_config_t *conf;
+
+  if ((ud == NULL) || (ud->data == NULL))
+    return EINVAL;
+
+  conf = ud->data;
+
+  if (conf->metrics == NULL) {
+    conf->metrics = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (conf->metrics == NULL) {
+      ERROR("varnish plugin: c_avl_create failed.");
+      return -1;
+    }
+  }
+
+  /* The shared memory segment stays mapped between reads. It is only opened
+   * again after varnishd has been restarted or a previous read failed. */
 #if HAVE_VARNISH_V3
-  stats = VSC_Main(vd);
+  if ((conf->vd != NULL) && (VSM_ReOpen(conf->vd, /* diag = */ 0) < 0))
+    varnish_close(conf);
 #elif HAVE_VARNISH_V4
-  stats = VSC_Main(vd, NULL);
+  if ((conf->vd != NULL) && VSM_Abandoned(conf->vd))
+    varnish_close(conf);
 #endif
+
+  if ((conf->vd == NULL) && (varnish_open(conf) != 0))
+    return -1;
+
 #if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
+#if HAVE_VARNISH_V3
+  const c_varnish_stats_t *stats = VSC_Main(conf->vd);
+#else
+  const c_varnish_stats_t *stats = VSC_Main(conf->vd, NULL);
+#endif
   if (!stats) {
-    VSM_Delete(vd);
+    varnish_close(conf);
     ERROR("varnish plugin: Unable to get statistics.");
     return -1;
   }
-#endif
-
-#if HAVE_VARNISH_V5
-  if (VSM_Attach(vd, STDERR_FILENO)) {
-    ERROR("varnish plugin: Cannot attach to varnish. %s", VSM_Error(vd));
-    VSC_Destroy(&vsc, vd);
-    VSM_Destroy(&vd);
-    return -1;
-  }
-
-  vsm_status = VSM_Status(vd);
-  if (vsm_status & ~(VSM_MGT_RUNNING | VSM_WRK_RUNNING)) {
+#elif HAVE_VARNISH_V5
+  /* A restarted child is picked up by VSC_Iter() itself, so only a missing
+   * one is an error here. */
+  int vsm_status = VSM_Status(conf->vd);
+  if (!(vsm_status & VSM_WRK_RUNNING)) {
     ERROR("varnish plugin: Unable to get statistics.");
-    VSC_Destroy(&vsc, vd);
-    VSM_Destroy(&vd);
+    varnish_close(conf);
     return -1;
   }
 #endif
 
 #if HAVE_VARNISH_V3
-  VSC_Iter(vd, varnish_monitor, conf);
+  VSC_Iter(conf->vd, varnish_monitor, conf);
 #elif HAVE_VARNISH_V4
-  VSC_Iter(vd, NULL, varnish_monitor, conf);
+  VSC_Iter(conf->vd, NULL, varnish_monitor, conf);
 #elif HAVE_VARNISH_V5
-  VSC_Iter(vsc, vd, varnish_monitor, conf);
-#endif
-
-#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
-  VSM_Delete(vd);
-#elif HAVE_VARNISH_V5
-  VSC_Destroy(&vsc, vd);
-  VSM_Destroy(&vd);
+  VSC_Iter(conf->vsc, conf->vd, varnish_monitor, conf);
 #endif
 
   return 0;
@@ -1471,6 +1547,20 @@ static void varnish_config_free(void *ptr) /* {{{ */
   if (conf == NULL)
     return;
 
+#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4 || HAVE_VARNISH_V5
+  varnish_close(conf);
+
+  if (conf->metrics != NULL) {
+    void *key;
+    void *value;
+    while (c_avl_pick(conf->metrics, &key, &value) == 0) {
+      sfree(key);
+      sfree(value);
+    }
+    c_avl_destroy(conf->metrics);
+  }
+#endif
+
   sfree(conf->instance);
   sfree(conf);
 } /* }}} */
@@ -84,6 +84,11 @@
 
 #if LIBVIR_CHECK_VERSION(1, 1, 1)
 #define HAVE_DOM_REASON_PAUSED_CRASHED 1
+#define HAVE_DEVICE_REMOVED_EVENT 1
+#endif
+
+#if LIBVIR_CHECK_VERSION(1, 2, 8)
+#define HAVE_DOMAIN_STATS 1
 #endif
 
 #if LIBVIR_CHECK_VERSION(1, 2, 9)
@@ -104,15 +109,22 @@
 
 #if LIBVIR_CHECK_VERSION(1, 3, 3)
 #define HAVE_PERF_STATS 1
+#define HAVE_DEVICE_ADDED_EVENT 1
 #define HAVE_DOM_REASON_POSTCOPY 1
 #endif
 
+#if LIBVIR_CHECK_VERSION(2, 1, 0)
+#define HAVE_DOMAIN_STATS_BALLOON 1
+#endif
+
 #endif /* LIBVIR_CHECK_VERSION */
 
 /* structure used for aggregating notification-thread data*/
 typedef struct virt_notif_thread_s {
   pthread_t event_loop_tid;
   int domain_event_cb_id;
+  int device_added_cb_id;
+  int device_removed_cb_id;
   pthread_mutex_t active_mutex; /* protects 'is_active' member access*/
   bool is_active;
 } virt_notif_thread_t;
@@ -540,10 +552,35 @@ static int add_interface_device(struct lv_read_state *state, virDomainPtr dom,
 #define BUFFER_MAX_LEN 256
 #define PARTITION_TAG_MAX_LEN 32
 
+/* Interface found in a domain's XML description. */
+struct domain_xml_iface {
+  char *path;
+  char *address;
+  unsigned int number;
+};
+
+/* Devices parsed from a domain's XML description. Entries are kept across
+ * list refreshes and only parsed again when the description changes. */
+typedef struct domain_xml_s {
+  char uuid[VIR_UUID_STRING_BUFLEN];
+  char *xml; /* description the entry was parsed from */
+  char tag[PARTITION_TAG_MAX_LEN];
+  char **block_paths;
+  size_t block_paths_num;
+  struct domain_xml_iface *ifaces;
+  size_t ifaces_num;
+  bool seen;
+} domain_xml_t;
+
 struct lv_read_instance {
   struct lv_read_state read_state;
   char tag[PARTITION_TAG_MAX_LEN];
   size_t id;
+
+  time_t last_refresh;
+  unsigned long events_seen; /* value of domain_events at last refresh */
+  domain_xml_t *xml_cache;
+  size_t xml_cache_num;
 };
 
 struct lv_user_data {
@@ -635,9 +672,13 @@ static enum bd_field blockdevice_format = target;
 static enum if_field interface_format = if_name;
 
 /* Time that we last refreshed. */
-static time_t last_refresh = (time_t)0;
+/* Incremented by the event callbacks whenever a domain or one of its devices
+ * appears or goes away; readers refresh their lists when it changes. */
+static unsigned long domain_events;
+static pthread_mutex_t domain_events_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int refresh_lists(struct lv_read_instance *inst);
+static void lv_domain_xml_free_all(struct lv_read_instance *inst);
 
 struct lv_info {
   virDomainInfo di;
@@ -1362,14 +1403,18 @@ static int lv_domain_block_info(virDomainPtr dom, const char *path,
 }
 
 #ifdef HAVE_PERF_STATS
-static void perf_submit(virDomainStatsRecordPtr stats) {
+static void perf_submit(virDomainPtr dom, virDomainStatsRecordPtr stats) {
   for (int i = 0; i < stats->nparams; ++i) {
+    /* Bulk stats records carry other groups, too. */
+    if (strncmp(stats->params[i].field, "perf.", strlen("perf.")) != 0)
+      continue;
+
     /* Replace '.' with '_' in event field to match other metrics' naming
      * convention */
     char *c = strchr(stats->params[i].field, '.');
     if (c)
       *c = '_';
-    submit(stats->dom, "perf", stats->params[i].field,
+    submit(dom, "perf", stats->params[i].field,
            &(value_t){.derive = stats->params[i].value.ul}, 1);
   }
 }
@@ -1387,7 +1432,7 @@ static int get_perf_events(virDomainPtr domain) {
   }
 
   for (int i = 0; i < status; ++i)
-    perf_submit(stats[i]);
+    perf_submit(domain, stats[i]);
 
   virDomainStatsRecordListFree(stats);
   return 0;
@@ -1715,6 +1760,27 @@ static int get_job_stats(virDomainPtr domain) {
 }
 #endif /* HAVE_JOB_STATS */
 
+/* Extra stats which have no equivalent in the bulk stats API. */
+static void get_domain_extra_stats(__attribute__((unused)) virDomainPtr dom) {
+  __attribute__((unused)) int status;
+
+#ifdef HAVE_FS_INFO
+  if (extra_stats & ex_stats_fs_info)
+    GET_STATS(get_fs_info, "file system info", dom);
+#endif
+
+#ifdef HAVE_DISK_ERR
+  if (extra_stats & ex_stats_disk_err)
+    GET_STATS(get_disk_err, "disk errors", dom);
+#endif
+
+#ifdef HAVE_JOB_STATS
+  if (extra_stats &
+      (ex_stats_job_stats_completed | ex_stats_job_stats_background))
+    GET_STATS(get_job_stats, "job stats", dom);
+#endif
+}
+
 static int get_domain_metrics(domain_t *domain) {
   struct lv_info info;
 
@@ -1758,21 +1824,7 @@ static int get_domain_metrics(domain_t *domain) {
     GET_STATS(get_perf_events, "performance monitoring events", domain->ptr);
 #endif
 
-#ifdef HAVE_FS_INFO
-  if (extra_stats & ex_stats_fs_info)
-    GET_STATS(get_fs_info, "file system info", domain->ptr);
-#endif
-
-#ifdef HAVE_DISK_ERR
-  if (extra_stats & ex_stats_disk_err)
-    GET_STATS(get_disk_err, "disk errors", domain->ptr);
-#endif
-
-#ifdef HAVE_JOB_STATS
-  if (extra_stats &
-      (ex_stats_job_stats_completed | ex_stats_job_stats_background))
-    GET_STATS(get_job_stats, "job stats", domain->ptr);
-#endif
+  get_domain_extra_stats(domain->ptr);
 
   /* Update cached virDomainInfo. It has to be done after cpu_submit */
   memcpy(&domain->info, &info.di, sizeof(domain->info));
@@ -1780,15 +1832,10 @@ static int get_domain_metrics(domain_t *domain) {
   return 0;
 }
 
-static int get_if_dev_stats(struct interface_device *if_dev) {
-  virDomainInterfaceStatsStruct stats = {0};
+static void if_dev_submit(struct interface_device *if_dev,
+                          virDomainInterfaceStatsStruct const *stats) {
   char *display_name = NULL;
 
-  if (!if_dev) {
-    ERROR(PLUGIN_NAME " plugin: get_if_dev_stats: NULL pointer");
-    return -1;
-  }
-
   switch (interface_format) {
   case if_address:
     display_name = if_dev->address;
@@ -1801,30 +1848,358 @@ static int get_if_dev_stats(struct interface_device *if_dev) {
     display_name = if_dev->path;
   }
 
+  if ((stats->rx_bytes != -1) && (stats->tx_bytes != -1))
+    submit_derive2("if_octets", (derive_t)stats->rx_bytes,
+                   (derive_t)stats->tx_bytes, if_dev->dom, display_name);
+
+  if ((stats->rx_packets != -1) && (stats->tx_packets != -1))
+    submit_derive2("if_packets", (derive_t)stats->rx_packets,
+                   (derive_t)stats->tx_packets, if_dev->dom, display_name);
+
+  if ((stats->rx_errs != -1) && (stats->tx_errs != -1))
+    submit_derive2("if_errors", (derive_t)stats->rx_errs,
+                   (derive_t)stats->tx_errs, if_dev->dom, display_name);
+
+  if ((stats->rx_drop != -1) && (stats->tx_drop != -1))
+    submit_derive2("if_dropped", (derive_t)stats->rx_drop,
+                   (derive_t)stats->tx_drop, if_dev->dom, display_name);
+}
+
+static int get_if_dev_stats(struct interface_device *if_dev) {
+  virDomainInterfaceStatsStruct stats = {0};
+
+  if (!if_dev) {
+    ERROR(PLUGIN_NAME " plugin: get_if_dev_stats: NULL pointer");
+    return -1;
+  }
+
   if (virDomainInterfaceStats(if_dev->dom, if_dev->path, &stats,
                               sizeof(stats)) != 0) {
     ERROR(PLUGIN_NAME " plugin: virDomainInterfaceStats failed");
     return -1;
   }
 
-  if ((stats.rx_bytes != -1) && (stats.tx_bytes != -1))
-    submit_derive2("if_octets", (derive_t)stats.rx_bytes,
-                   (derive_t)stats.tx_bytes, if_dev->dom, display_name);
+  if_dev_submit(if_dev, &stats);
+  return 0;
+}
+
+#ifdef HAVE_DOMAIN_STATS
+/* Cleared when the hypervisor driver does not implement the bulk stats API;
+ * the per-domain calls are used from then on. */
+static bool bulk_stats_supported = true;
+
+static int stats_get_ullong(virDomainStatsRecordPtr record, const char *group,
+                            int idx, const char *name,
+                            unsigned long long *ret_value) {
+  char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+  snprintf(field, sizeof(field), "%s.%d.%s", group, idx, name);
+  return virTypedParamsGetULLong(record->params, record->nparams, field,
+                                 ret_value);
+}
+
+static const char *stats_get_string(virDomainStatsRecordPtr record,
+                                    const char *group, int idx,
+                                    const char *name) {
+  char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+  const char *value = NULL;
+
+  snprintf(field, sizeof(field), "%s.%d.%s", group, idx, name);
+  if (virTypedParamsGetString(record->params, record->nparams, field,
+                              &value) != 1)
+    return NULL;
+  return value;
+}
+
+/* Copies a counter into a libvirt stats struct field, which uses -1 for
+ * "not available". */
+#define STATS_GET_LL(record, group, idx, name, dst)                            \
+  do {                                                                         \
+    unsigned long long _v;                                                     \
+    if (stats_get_ullong((record), (group), (idx), (name), &_v) == 1)          \
+      (dst) = (long long)_v;                                                   \
+  } while (0)
+
+static void stats_block_submit(struct lv_read_state *state, domain_t *dom,
+                               virDomainStatsRecordPtr record) {
+  unsigned int count = 0;
+
+  if (virTypedParamsGetUInt(record->params, record->nparams, "block.count",
+                            &count) != 1)
+    return;
+
+  for (unsigned int i = 0; i < count; i++) {
+    const char *field = (blockdevice_format == source) ? "path" : "name";
+    const char *path = stats_get_string(record, "block", i, field);
+    if (path == NULL)
+      continue;
+
+    /* Only devices which passed the ignore list during refresh. */
+    struct block_device *block_dev = NULL;
+    for (int j = 0; j < state->nr_block_devices; j++) {
+      if ((state->block_devices[j].dom == dom->ptr) &&
+          (strcmp(state->block_devices[j].path, path) == 0)) {
+        block_dev = &state->block_devices[j];
+        break;
+      }
+    }
+    if (block_dev == NULL)
+      continue;
+
+    struct lv_block_info binfo;
+    init_block_info(&binfo);
+
+    STATS_GET_LL(record, "block", i, "rd.reqs", binfo.bi.rd_req);
+    STATS_GET_LL(record, "block", i, "wr.reqs", binfo.bi.wr_req);
+    STATS_GET_LL(record, "block", i, "rd.bytes", binfo.bi.rd_bytes);
+    STATS_GET_LL(record, "block", i, "wr.bytes", binfo.bi.wr_bytes);
+    STATS_GET_LL(record, "block", i, "rd.times", binfo.rd_total_times);
+    STATS_GET_LL(record, "block", i, "wr.times", binfo.wr_total_times);
+    STATS_GET_LL(record, "block", i, "fl.reqs", binfo.fl_req);
+    STATS_GET_LL(record, "block", i, "fl.times", binfo.fl_total_times);
+
+    disk_submit(&binfo, block_dev->dom, block_dev->path);
+  }
+}
+
+static void stats_interface_submit(struct lv_read_state *state, domain_t *dom,
+                                   virDomainStatsRecordPtr record) {
+  unsigned int count = 0;
+
+  if (virTypedParamsGetUInt(record->params, record->nparams, "net.count",
+                            &count) != 1)
+    return;
+
+  for (unsigned int i = 0; i < count; i++) {
+    const char *name = stats_get_string(record, "net", i, "name");
+    if (name == NULL)
+      continue;
+
+    struct interface_device *if_dev = NULL;
+    for (int j = 0; j < state->nr_interface_devices; j++) {
+      if ((state->interface_devices[j].dom == dom->ptr) &&
+          (strcmp(state->interface_devices[j].path, name) == 0)) {
+        if_dev = &state->interface_devices[j];
+        break;
+      }
+    }
+    if (if_dev == NULL)
+      continue;
+
+    virDomainInterfaceStatsStruct stats = {
+        .rx_bytes = -1, .rx_packets = -1, .rx_errs = -1, .rx_drop = -1,
+        .tx_bytes = -1, .tx_packets = -1, .tx_errs = -1, .tx_drop = -1,
+    };
 
-  if ((stats.rx_packets != -1) && (stats.tx_packets != -1))
-    submit_derive2("if_packets", (derive_t)stats.rx_packets,
-                   (derive_t)stats.tx_packets, if_dev->dom, display_name);
+    STATS_GET_LL(record, "net", i, "rx.bytes", stats.rx_bytes);
+    STATS_GET_LL(record, "net", i, "rx.pkts", stats.rx_packets);
+    STATS_GET_LL(record, "net", i, "rx.errs", stats.rx_errs);
+    STATS_GET_LL(record, "net", i, "rx.drop", stats.rx_drop);
+    STATS_GET_LL(record, "net", i, "tx.bytes", stats.tx_bytes);
+    STATS_GET_LL(record, "net", i, "tx.pkts", stats.tx_packets);
+    STATS_GET_LL(record, "net", i, "tx.errs", stats.tx_errs);
+    STATS_GET_LL(record, "net", i, "tx.drop", stats.tx_drop);
+
+    if_dev_submit(if_dev, &stats);
+  }
+}
+
+#undef STATS_GET_LL
+
+static void stats_memory_submit(domain_t *dom,
+                                virDomainStatsRecordPtr record) {
+#ifdef HAVE_DOMAIN_STATS_BALLOON
+  /* Same order as the VIR_DOMAIN_MEMORY_STAT_* tags. */
+  static const char *fields[] = {
+      "balloon.swap_in",     "balloon.swap_out", "balloon.major_fault",
+      "balloon.minor_fault", "balloon.unused",   "balloon.available",
+      "balloon.current",     "balloon.rss",      "balloon.usable",
+      "balloon.last-update"};
+
+  for (int i = 0; i < (int)STATIC_ARRAY_SIZE(fields); i++) {
+    unsigned long long value;
+    if (virTypedParamsGetULLong(record->params, record->nparams, fields[i],
+                                &value) == 1)
+      memory_stats_submit((gauge_t)value * 1024, dom->ptr, i);
+  }
+#else
+  int status;
+  GET_STATS(get_memory_stats, "memory stats", dom->ptr);
+#endif /* HAVE_DOMAIN_STATS_BALLOON */
+}
+
+static int stats_domain_submit(struct lv_read_state *state, domain_t *dom,
+                               virDomainStatsRecordPtr record) {
+  int domain_state = 0;
+  int domain_reason = 0;
+  int status;
+
+  virTypedParamsGetInt(record->params, record->nparams, "state.state",
+                       &domain_state);
+  virTypedParamsGetInt(record->params, record->nparams, "state.reason",
+                       &domain_reason);
+
+#ifdef HAVE_DOM_REASON
+  if (!dom->active || (extra_stats & ex_stats_domain_state))
+    domain_state_submit(dom->ptr, domain_state, domain_reason);
+#endif
+
+  /* Gather remaining stats only for running domains */
+  if (!dom->active || (domain_state != VIR_DOMAIN_RUNNING))
+    return 0;
 
-  if ((stats.rx_errs != -1) && (stats.tx_errs != -1))
-    submit_derive2("if_errors", (derive_t)stats.rx_errs,
-                   (derive_t)stats.tx_errs, if_dev->dom, display_name);
+  unsigned long long cpu_time = 0;
+  virTypedParamsGetULLong(record->params, record->nparams, "cpu.time",
+                          &cpu_time);
+
+#ifdef HAVE_CPU_STATS
+  if (extra_stats & ex_stats_pcpu) {
+    unsigned long long user_time = 0;
+    unsigned long long system_time = 0;
+
+    virTypedParamsGetULLong(record->params, record->nparams, "cpu.user",
+                            &user_time);
+    virTypedParamsGetULLong(record->params, record->nparams, "cpu.system",
+                            &system_time);
+    submit_derive2("ps_cputime", user_time, system_time, dom->ptr, NULL);
+  }
+#endif /* HAVE_CPU_STATS */
+
+  cpu_submit(dom, cpu_time);
+
+  unsigned long long memory = 0;
+  if (virTypedParamsGetULLong(record->params, record->nparams,
+                              "balloon.current", &memory) == 1)
+    memory_submit(dom->ptr, (gauge_t)memory * 1024);
+
+  unsigned int nr_virt_cpu = 0;
+  virTypedParamsGetUInt(record->params, record->nparams, "vcpu.current",
+                        &nr_virt_cpu);
+
+  /* CPU affinity is not part of the bulk stats. */
+  if (extra_stats & ex_stats_vcpupin) {
+    GET_STATS(get_vcpu_stats, "vcpu stats", dom->ptr, nr_virt_cpu);
+  } else {
+    unsigned int max_virt_cpu = nr_virt_cpu;
+    virTypedParamsGetUInt(record->params, record->nparams, "vcpu.maximum",
+                          &max_virt_cpu);
+
+    for (unsigned int i = 0; i < max_virt_cpu; i++) {
+      unsigned long long vcpu_time;
+      if (stats_get_ullong(record, "vcpu", i, "time", &vcpu_time) == 1)
+        vcpu_submit(vcpu_time, dom->ptr, i, "virt_vcpu");
+    }
+  }
+
+  stats_memory_submit(dom, record);
+
+#ifdef HAVE_PERF_STATS
+  if (extra_stats & ex_stats_perf)
+    perf_submit(dom->ptr, record);
+#endif
+
+  stats_block_submit(state, dom, record);
+  stats_interface_submit(state, dom, record);
+
+  get_domain_extra_stats(dom->ptr);
+
+  /* Update cached virDomainInfo. It has to be done after cpu_submit */
+  dom->info.state = domain_state;
+  dom->info.cpuTime = cpu_time;
+  dom->info.memory = memory;
+  dom->info.nrVirtCpu = nr_virt_cpu;
 
-  if ((stats.rx_drop != -1) && (stats.tx_drop != -1))
-    submit_derive2("if_dropped", (derive_t)stats.rx_drop,
-                   (derive_t)stats.tx_drop, if_dev->dom, display_name);
   return 0;
 }
 
+/* Finds the domain a stats record belongs to. Records normally come back in
+ * the order the domains were passed in, so `hint' is checked first. */
+static domain_t *stats_find_domain(struct lv_read_state *state, int hint,
+                                   virDomainPtr dom) {
+  const char *name = virDomainGetName(dom);
+  if (name == NULL)
+    return NULL;
+
+  if ((hint < state->nr_domains) &&
+      (strcmp(virDomainGetName(state->domains[hint].ptr), name) == 0))
+    return &state->domains[hint];
+
+  for (int i = 0; i < state->nr_domains; i++)
+    if (strcmp(virDomainGetName(state->domains[i].ptr), name) == 0)
+      return &state->domains[i];
+
+  return NULL;
+}
+
+/* Reads the stats of all domains of an instance with a single
+ * virDomainListGetStats() call, instead of several calls per domain and
+ * device. */
+static int get_bulk_stats(struct lv_read_state *state) {
+  if (state->nr_domains == 0)
+    return 0;
+
+  /* virDomainListGetStats requires a NULL terminated list of domains */
+  virDomainPtr domain_array[state->nr_domains + 1];
+  for (int i = 0; i < state->nr_domains; i++)
+    domain_array[i] = state->domains[i].ptr;
+  domain_array[state->nr_domains] = NULL;
+
+  unsigned int stats_flags = VIR_DOMAIN_STATS_STATE |
+                             VIR_DOMAIN_STATS_CPU_TOTAL |
+                             VIR_DOMAIN_STATS_BALLOON | VIR_DOMAIN_STATS_VCPU |
+                             VIR_DOMAIN_STATS_INTERFACE |
+                             VIR_DOMAIN_STATS_BLOCK;
+#ifdef HAVE_PERF_STATS
+  if (extra_stats & ex_stats_perf)
+    stats_flags |= VIR_DOMAIN_STATS_PERF;
+#endif
+
+  virDomainStatsRecordPtr *records = NULL;
+  int records_num =
+      virDomainListGetStats(domain_array, stats_flags, &records, 0);
+  if (records_num < 0) {
+    virErrorPtr err = virGetLastError();
+    if ((err != NULL) && (err->code == VIR_ERR_NO_SUPPORT)) {
+      WARNING(PLUGIN_NAME " plugin: virDomainListGetStats is not supported, "
+                          "falling back to per-domain calls.");
+      bulk_stats_supported = false;
+    } else {
+      VIRT_ERROR(conn, PLUGIN_NAME " plugin: virDomainListGetStats failed");
+    }
+    return -1;
+  }
+
+  for (int i = 0; i < records_num; i++) {
+    domain_t *dom = stats_find_domain(state, i, records[i]->dom);
+    if (dom == NULL)
+      continue;
+
+    if (stats_domain_submit(state, dom, records[i]) != 0)
+      ERROR(PLUGIN_NAME " failed to get metrics for domain=%s",
+            virDomainGetName(dom->ptr));
+  }
+
+  virDomainStatsRecordListFree(records);
+  return 0;
+}
+#endif /* HAVE_DOMAIN_STATS */
+
+static void domain_events_mark(void) {
+  pthread_mutex_lock(&domain_events_lock);
+  domain_events++;
+  pthread_mutex_unlock(&domain_events_lock);
+}
+
+static unsigned long domain_events_get(void) {
+  unsigned long ret;
+
+  pthread_mutex_lock(&domain_events_lock);
+  ret = domain_events;
+  pthread_mutex_unlock(&domain_events_lock);
+
+  return ret;
+}
+
 static int domain_lifecycle_event_cb(__attribute__((unused)) virConnectPtr con_,
                                      virDomainPtr dom, int event, int detail,
                                      __attribute__((unused)) void *opaque) {
@@ -1834,10 +2209,21 @@ static int domain_lifecycle_event_cb(__attribute__((unused)) virConnectPtr con_,
   domain_reason = map_domain_event_detail_to_reason(event, detail);
 #endif
   domain_state_submit_notif(dom, domain_state, domain_reason);
+  domain_events_mark();
 
   return 0;
 }
 
+#if HAVE_DEVICE_ADDED_EVENT || HAVE_DEVICE_REMOVED_EVENT
+static void domain_device_event_cb(__attribute__((unused)) virConnectPtr con_,
+                                   virDomainPtr dom, const char *dev_alias,
+                                   __attribute__((unused)) void *opaque) {
+  DEBUG(PLUGIN_NAME " plugin: device %s of domain %s changed", dev_alias,
+        virDomainGetName(dom));
+  domain_events_mark();
+}
+#endif
+
 static int register_event_impl(void) {
   if (virEventRegisterDefaultImpl() < 0) {
     virErrorPtr err = virGetLastError();
@@ -1899,6 +2285,8 @@ static int virt_notif_thread_init(virt_notif_thread_t *thread_data) {
    * domain_event_cb_id to '-1'
    */
   thread_data->domain_event_cb_id = -1;
+  thread_data->device_added_cb_id = -1;
+  thread_data->device_removed_cb_id = -1;
   pthread_mutex_lock(&thread_data->active_mutex);
   thread_data->is_active = false;
   pthread_mutex_unlock(&thread_data->active_mutex);
@@ -1906,6 +2294,18 @@ static int virt_notif_thread_init(virt_notif_thread_t *thread_data) {
   return 0;
 }
 
+static void deregister_event_callbacks(virt_notif_thread_t *thread_data) {
+  int *ids[] = {&thread_data->domain_event_cb_id,
+                &thread_data->device_added_cb_id,
+                &thread_data->device_removed_cb_id};
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(ids); i++) {
+    if (conn != NULL && *ids[i] != -1)
+      virConnectDomainEventDeregisterAny(conn, *ids[i]);
+    *ids[i] = -1;
+  }
+}
+
 /* register domain event callback and start event loop thread */
 static int start_event_loop(virt_notif_thread_t *thread_data) {
   assert(thread_data != NULL);
@@ -1917,11 +2317,31 @@ static int start_event_loop(virt_notif_thread_t *thread_data) {
     return -1;
   }
 
+  /* Device events only speed up list refreshes; failing to register them is
+   * not fatal since RefreshInterval still applies. */
+#ifdef HAVE_DEVICE_ADDED_EVENT
+  thread_data->device_added_cb_id = virConnectDomainEventRegisterAny(
+      conn, NULL, VIR_DOMAIN_EVENT_ID_DEVICE_ADDED,
+      VIR_DOMAIN_EVENT_CALLBACK(domain_device_event_cb), NULL, NULL);
+  if (thread_data->device_added_cb_id == -1)
+    WARNING(PLUGIN_NAME " plugin: registering device-added callback failed");
+#endif
+#ifdef HAVE_DEVICE_REMOVED_EVENT
+  thread_data->device_removed_cb_id = virConnectDomainEventRegisterAny(
+      conn, NULL, VIR_DOMAIN_EVENT_ID_DEVICE_REMOVED,
+      VIR_DOMAIN_EVENT_CALLBACK(domain_device_event_cb), NULL, NULL);
+  if (thread_data->device_removed_cb_id == -1)
+    WARNING(PLUGIN_NAME " plugin: registering device-removed callback failed");
+#endif
+
+  /* Events may have been missed while no callback was registered. */
+  domain_events_mark();
+
   virt_notif_thread_set_active(thread_data, 1);
   if (pthread_create(&thread_data->event_loop_tid, NULL, event_loop_worker,
                      thread_data)) {
     ERROR(PLUGIN_NAME " plugin: failed event loop thread creation");
-    virConnectDomainEventDeregisterAny(conn, thread_data->domain_event_cb_id);
+    deregister_event_callbacks(thread_data);
     return -1;
   }
 
@@ -1932,8 +2352,7 @@ static int start_event_loop(virt_notif_thread_t *thread_data) {
 static void stop_event_loop(virt_notif_thread_t *thread_data) {
   /* stopping loop and de-registering event handler*/
   virt_notif_thread_set_active(thread_data, 0);
-  if (conn != NULL && thread_data->domain_event_cb_id != -1)
-    virConnectDomainEventDeregisterAny(conn, thread_data->domain_event_cb_id);
+  deregister_event_callbacks(thread_data);
 
   if (pthread_join(notif_thread.event_loop_tid, NULL) != 0)
     ERROR(PLUGIN_NAME " plugin: stopping notification thread failed");
@@ -2041,9 +2460,13 @@ static int lv_read(user_data_t *ud) {
 
   time(&t);
 
-  /* Need to refresh domain or device lists? */
-  if ((last_refresh == (time_t)0) ||
-      ((interval > 0) && ((last_refresh + interval) <= t))) {
+  /* Need to refresh domain or device lists? Without an event loop only
+   * RefreshInterval applies. */
+  unsigned long events = domain_events_get();
+  if ((inst->last_refresh == (time_t)0) || (events != inst->events_seen) ||
+      ((interval > 0) && ((inst->last_refresh + interval) <= t))) {
+    /* Events arriving while refreshing trigger another refresh. */
+    inst->events_seen = events;
     if (refresh_lists(inst) != 0) {
       if (inst->id == 0) {
         if (!persistent_notification)
@@ -2052,7 +2475,7 @@ static int lv_read(user_data_t *ud) {
       }
       return -1;
     }
-    last_refresh = t;
+    inst->last_refresh = t;
   }
 
   /* persistent domains state notifications are handled by instance 0 */
@@ -2078,6 +2501,12 @@ static int lv_read(user_data_t *ud) {
           state->interface_devices[i].path);
 #endif
 
+#ifdef HAVE_DOMAIN_STATS
+  /* On failure, fall back to the per-domain calls for this interval. */
+  if (bulk_stats_supported && (get_bulk_stats(state) == 0))
+    return 0;
+#endif
+
   /* Get domains' metrics */
   for (int i = 0; i < state->nr_domains; ++i) {
     domain_t *dom = &state->domains[i];
@@ -2146,6 +2575,7 @@ static void lv_fini_instance(size_t i) {
   struct lv_read_state *state = &(inst->read_state);
 
   lv_clean_read_state(state);
+  lv_domain_xml_free_all(inst);
 
   INFO(PLUGIN_NAME " plugin: reader %s finalized", inst->tag);
 }
@@ -2273,6 +2703,244 @@ static int lv_instance_include_domain(struct lv_read_instance *inst,
   return 0;
 }
 
+static void lv_domain_xml_clear(domain_xml_t *dx) {
+  sfree(dx->xml);
+  dx->tag[0] = '\0';
+  for (size_t i = 0; i < dx->block_paths_num; i++)
+    sfree(dx->block_paths[i]);
+  sfree(dx->block_paths);
+  dx->block_paths_num = 0;
+  for (size_t i = 0; i < dx->ifaces_num; i++) {
+    sfree(dx->ifaces[i].path);
+    sfree(dx->ifaces[i].address);
+  }
+  sfree(dx->ifaces);
+  dx->ifaces_num = 0;
+}
+
+static void lv_domain_xml_free_all(struct lv_read_instance *inst) {
+  for (size_t i = 0; i < inst->xml_cache_num; i++)
+    lv_domain_xml_clear(inst->xml_cache + i);
+  sfree(inst->xml_cache);
+  inst->xml_cache_num = 0;
+}
+
+/* Drops entries for domains which were not seen during the last refresh. */
+static void lv_domain_xml_prune(struct lv_read_instance *inst) {
+  size_t n = 0;
+
+  for (size_t i = 0; i < inst->xml_cache_num; i++) {
+    domain_xml_t *dx = inst->xml_cache + i;
+
+    if (!dx->seen) {
+      lv_domain_xml_clear(dx);
+      continue;
+    }
+
+    dx->seen = false;
+    if (n != i)
+      inst->xml_cache[n] = *dx;
+    n++;
+  }
+
+  inst->xml_cache_num = n;
+}
+
+static int lv_domain_xml_parse(domain_xml_t *dx, const char *name,
+                               const char *xml) {
+  xmlDocPtr xml_doc;
+  xmlXPathContextPtr xpath_ctx = NULL;
+  xmlXPathObjectPtr xpath_obj = NULL;
+  int ret = -1;
+
+  /* Yuck, XML.  Parse out the devices. */
+  xml_doc = xmlReadDoc((const xmlChar *)xml, NULL, NULL, XML_PARSE_NONET);
+  if (xml_doc == NULL) {
+    VIRT_ERROR(conn, "xmlReadDoc");
+    return -1;
+  }
+
+  xpath_ctx = xmlXPathNewContext(xml_doc);
+
+  if (lv_domain_get_tag(xpath_ctx, name, dx->tag) < 0) {
+    ERROR(PLUGIN_NAME " plugin: lv_domain_get_tag failed.");
+    goto done;
+  }
+
+  /* From here on a missing device section just means there are none. */
+  ret = 0;
+
+  /* Block devices. */
+  const char *bd_xmlpath = "/domain/devices/disk/target[@dev]";
+  if (blockdevice_format == source)
+    bd_xmlpath = "/domain/devices/disk/source[@dev]";
+  xpath_obj = xmlXPathEval((const xmlChar *)bd_xmlpath, xpath_ctx);
+
+  if (xpath_obj == NULL || xpath_obj->type != XPATH_NODESET ||
+      xpath_obj->nodesetval == NULL)
+    goto done;
+
+  dx->block_paths =
+      calloc(xpath_obj->nodesetval->nodeNr + 1, sizeof(*dx->block_paths));
+  if (dx->block_paths == NULL) {
+    ERROR(PLUGIN_NAME " plugin: calloc failed.");
+    ret = -1;
+    goto done;
+  }
+
+  for (int j = 0; j < xpath_obj->nodesetval->nodeNr; ++j) {
+    xmlNodePtr node = xpath_obj->nodesetval->nodeTab[j];
+    char *path;
+
+    if (!node)
+      continue;
+    path = (char *)xmlGetProp(node, (xmlChar *)"dev");
+    if (!path)
+      continue;
+
+    dx->block_paths[dx->block_paths_num] = strdup(path);
+    if (dx->block_paths[dx->block_paths_num] != NULL)
+      dx->block_paths_num++;
+    xmlFree(path);
+  }
+  xmlXPathFreeObject(xpath_obj);
+
+  /* Network interfaces. */
+  xpath_obj = xmlXPathEval(
+      (xmlChar *)"/domain/devices/interface[target[@dev]]", xpath_ctx);
+  if (xpath_obj == NULL || xpath_obj->type != XPATH_NODESET ||
+      xpath_obj->nodesetval == NULL)
+    goto done;
+
+  xmlNodeSetPtr xml_interfaces = xpath_obj->nodesetval;
+
+  dx->ifaces = calloc(xml_interfaces->nodeNr + 1, sizeof(*dx->ifaces));
+  if (dx->ifaces == NULL) {
+    ERROR(PLUGIN_NAME " plugin: calloc failed.");
+    ret = -1;
+    goto done;
+  }
+
+  for (int j = 0; j < xml_interfaces->nodeNr; ++j) {
+    char *path = NULL;
+    char *address = NULL;
+    xmlNodePtr xml_interface;
+
+    xml_interface = xml_interfaces->nodeTab[j];
+    if (!xml_interface)
+      continue;
+
+    for (xmlNodePtr child = xml_interface->children; child;
+         child = child->next) {
+      if (child->type != XML_ELEMENT_NODE)
+        continue;
+
+      if (xmlStrEqual(child->name, (const xmlChar *)"target")) {
+        path = (char *)xmlGetProp(child, (const xmlChar *)"dev");
+        if (!path)
+          continue;
+      } else if (xmlStrEqual(child->name, (const xmlChar *)"mac")) {
+        address = (char *)xmlGetProp(child, (const xmlChar *)"address");
+        if (!address)
+          continue;
+      }
+    }
+
+    /* add_interface_device() requires both. */
+    if (path != NULL && address != NULL) {
+      struct domain_xml_iface *iface = dx->ifaces + dx->ifaces_num;
+
+      iface->path = strdup(path);
+      iface->address = strdup(address);
+      iface->number = j + 1;
+      if (iface->path != NULL && iface->address != NULL) {
+        dx->ifaces_num++;
+      } else {
+        sfree(iface->path);
+        sfree(iface->address);
+      }
+    }
+
+    if (path)
+      xmlFree(path);
+    if (address)
+      xmlFree(address);
+  }
+
+done:
+  if (xpath_obj)
+    xmlXPathFreeObject(xpath_obj);
+  if (xpath_ctx)
+    xmlXPathFreeContext(xpath_ctx);
+  xmlFreeDoc(xml_doc);
+
+  return ret;
+}
+
+/* Returns the parsed devices of "dom". The domain XML is only parsed when it
+ * differs from the description the cached entry was built from. */
+static domain_xml_t *lv_domain_xml_get(struct lv_read_instance *inst,
+                                       virDomainPtr dom, const char *name) {
+  char uuid[VIR_UUID_STRING_BUFLEN];
+  domain_xml_t *dx = NULL;
+  char *xml;
+
+  if (virDomainGetUUIDString(dom, uuid) != 0) {
+    VIRT_ERROR(conn, "virDomainGetUUIDString");
+    return NULL;
+  }
+
+  /* Get a list of devices for this domain. */
+  xml = virDomainGetXMLDesc(dom, 0);
+  if (!xml) {
+    VIRT_ERROR(conn, "virDomainGetXMLDesc");
+    return NULL;
+  }
+
+  for (size_t i = 0; i < inst->xml_cache_num; i++) {
+    if (strcmp(inst->xml_cache[i].uuid, uuid) == 0) {
+      dx = inst->xml_cache + i;
+      break;
+    }
+  }
+
+  if (dx != NULL && dx->xml != NULL && strcmp(dx->xml, xml) == 0) {
+    sfree(xml);
+    dx->seen = true;
+    return dx;
+  }
+
+  if (dx == NULL) {
+    domain_xml_t *tmp = realloc(inst->xml_cache, (inst->xml_cache_num + 1) *
+                                                     sizeof(*inst->xml_cache));
+    if (tmp == NULL) {
+      ERROR(PLUGIN_NAME " plugin: realloc failed.");
+      sfree(xml);
+      return NULL;
+    }
+    inst->xml_cache = tmp;
+    dx = inst->xml_cache + inst->xml_cache_num;
+    inst->xml_cache_num++;
+
+    memset(dx, 0, sizeof(*dx));
+    sstrncpy(dx->uuid, uuid, sizeof(dx->uuid));
+  } else {
+    lv_domain_xml_clear(dx);
+  }
+
+  dx->seen = true;
+  DEBUG(PLUGIN_NAME " plugin#%s: parsing XML of domain %s", inst->tag, name);
+  if (lv_domain_xml_parse(dx, name, xml) != 0) {
+    /* Keep the entry without a description so it is parsed again. */
+    lv_domain_xml_clear(dx);
+    sfree(xml);
+    return NULL;
+  }
+
+  dx->xml = xml;
+  return dx;
+}
+
 static int refresh_lists(struct lv_read_instance *inst) {
   struct lv_read_state *state = &inst->read_state;
   int n;
@@ -2335,11 +3003,6 @@ static int refresh_lists(struct lv_read_instance *inst) {
   /* Fetch each domain and add it to the list, unless ignore. */
   for (int i = 0; i < n; ++i) {
     const char *name;
-    char *xml = NULL;
-    xmlDocPtr xml_doc = NULL;
-    xmlXPathContextPtr xpath_ctx = NULL;
-    xmlXPathObjectPtr xpath_obj = NULL;
-    char tag[PARTITION_TAG_MAX_LEN] = {'\0'};
     virDomainInfo info;
     int status;
 
@@ -2366,13 +3029,13 @@ static int refresh_lists(struct lv_read_instance *inst) {
        */
       ERROR(PLUGIN_NAME " plugin: malloc failed.");
       virDomainFree(dom);
-      goto cont;
+      continue;
     }
 
     name = virDomainGetName(dom);
     if (name == NULL) {
       VIRT_ERROR(conn, "virDomainGetName");
-      goto cont;
+      continue;
     }
 
     status = virDomainGetInfo(dom, &info);
@@ -2388,121 +3051,41 @@ static int refresh_lists(struct lv_read_instance *inst) {
     }
 
     if (il_domains && ignorelist_match(il_domains, name) != 0)
-      goto cont;
-
-    /* Get a list of devices for this domain. */
-    xml = virDomainGetXMLDesc(dom, 0);
-    if (!xml) {
-      VIRT_ERROR(conn, "virDomainGetXMLDesc");
-      goto cont;
-    }
-
-    /* Yuck, XML.  Parse out the devices. */
-    xml_doc = xmlReadDoc((xmlChar *)xml, NULL, NULL, XML_PARSE_NONET);
-    if (xml_doc == NULL) {
-      VIRT_ERROR(conn, "xmlReadDoc");
-      goto cont;
-    }
-
-    xpath_ctx = xmlXPathNewContext(xml_doc);
-
-    if (lv_domain_get_tag(xpath_ctx, name, tag) < 0) {
-      ERROR(PLUGIN_NAME " plugin: lv_domain_get_tag failed.");
-      goto cont;
-    }
-
-    if (!lv_instance_include_domain(inst, name, tag))
-      goto cont;
-
-    /* Block devices. */
-    const char *bd_xmlpath = "/domain/devices/disk/target[@dev]";
-    if (blockdevice_format == source)
-      bd_xmlpath = "/domain/devices/disk/source[@dev]";
-    xpath_obj = xmlXPathEval((const xmlChar *)bd_xmlpath, xpath_ctx);
+      continue;
 
-    if (xpath_obj == NULL || xpath_obj->type != XPATH_NODESET ||
-        xpath_obj->nodesetval == NULL)
-      goto cont;
+    domain_xml_t *dx = lv_domain_xml_get(inst, dom, name);
+    if (dx == NULL)
+      continue;
 
-    for (int j = 0; j < xpath_obj->nodesetval->nodeNr; ++j) {
-      xmlNodePtr node;
-      char *path = NULL;
+    if (!lv_instance_include_domain(inst, name, dx->tag))
+      continue;
 
-      node = xpath_obj->nodesetval->nodeTab[j];
-      if (!node)
-        continue;
-      path = (char *)xmlGetProp(node, (xmlChar *)"dev");
-      if (!path)
-        continue;
+    for (size_t j = 0; j < dx->block_paths_num; ++j) {
+      const char *path = dx->block_paths[j];
 
       if (il_block_devices &&
           ignore_device_match(il_block_devices, name, path) != 0)
-        goto cont2;
+        continue;
 
       add_block_device(state, dom, path);
-    cont2:
-      if (path)
-        xmlFree(path);
     }
-    xmlXPathFreeObject(xpath_obj);
-
-    /* Network interfaces. */
-    xpath_obj = xmlXPathEval(
-        (xmlChar *)"/domain/devices/interface[target[@dev]]", xpath_ctx);
-    if (xpath_obj == NULL || xpath_obj->type != XPATH_NODESET ||
-        xpath_obj->nodesetval == NULL)
-      goto cont;
-
-    xmlNodeSetPtr xml_interfaces = xpath_obj->nodesetval;
 
-    for (int j = 0; j < xml_interfaces->nodeNr; ++j) {
-      char *path = NULL;
-      char *address = NULL;
-      xmlNodePtr xml_interface;
+    for (size_t j = 0; j < dx->ifaces_num; ++j) {
+      struct domain_xml_iface *iface = dx->ifaces + j;
 
-      xml_interface = xml_interfaces->nodeTab[j];
-      if (!xml_interface)
+      if (il_interface_devices &&
+          (ignore_device_match(il_interface_devices, name, iface->path) != 0 ||
+           ignore_device_match(il_interface_devices, name, iface->address) !=
+               0))
         continue;
 
-      for (xmlNodePtr child = xml_interface->children; child;
-           child = child->next) {
-        if (child->type != XML_ELEMENT_NODE)
-          continue;
-
-        if (xmlStrEqual(child->name, (const xmlChar *)"target")) {
-          path = (char *)xmlGetProp(child, (const xmlChar *)"dev");
-          if (!path)
-            continue;
-        } else if (xmlStrEqual(child->name, (const xmlChar *)"mac")) {
-          address = (char *)xmlGetProp(child, (const xmlChar *)"address");
-          if (!address)
-            continue;
-        }
-      }
-
-      if (il_interface_devices &&
-          (ignore_device_match(il_interface_devices, name, path) != 0 ||
-           ignore_device_match(il_interface_devices, name, address) != 0))
-        goto cont3;
-
-      add_interface_device(state, dom, path, address, j + 1);
-    cont3:
-      if (path)
-        xmlFree(path);
-      if (address)
-        xmlFree(address);
+      add_interface_device(state, dom, iface->path, iface->address,
+                           iface->number);
     }
-
-  cont:
-    if (xpath_obj)
-      xmlXPathFreeObject(xpath_obj);
-    if (xpath_ctx)
-      xmlXPathFreeContext(xpath_ctx);
-    if (xml_doc)
-      xmlFreeDoc(xml_doc);
-    sfree(xml);
   }
 
+  lv_domain_xml_prune(inst);
+
 #ifdef HAVE_LIST_ALL_DOMAINS
   /* NOTE: domains_active and domains_inactive data will be cleared during
      refresh of all domains (inside lv_clean_read_state function) so we need
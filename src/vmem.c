@@ -99,38 +99,37 @@ static int vmem_read(void) {
   derive_t pgmajfault = 0;
   int pgfaultvalid = 0;
 
-  FILE *fh;
-  char buffer[1024];
+  static proc_file_t *pf;
+  char *buffer;
+  char *line;
 
-  fh = fopen("/proc/vmstat", "r");
-  if (fh == NULL) {
-    ERROR("vmem plugin: fopen (/proc/vmstat) failed: %s", STRERRNO);
+  if ((pf == NULL) && ((pf = proc_file_open("/proc/vmstat")) == NULL)) {
+    ERROR("vmem plugin: open (/proc/vmstat) failed: %s", STRERRNO);
     return -1;
   }
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
-    char *fields[4];
-    int fields_num;
+  if (proc_file_read(pf, &buffer) < 0)
+    return -1;
+
+  for (char *ptr = buffer; (line = proc_file_line(&ptr)) != NULL;) {
     char *key;
-    char *endptr;
+    char *sep;
+    uint64_t raw;
+    char const *end;
     derive_t counter;
     gauge_t gauge;
 
-    fields_num = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
-    if (fields_num != 2)
+    /* Every line is "<key> <value>". */
+    if ((sep = strchr(line, ' ')) == NULL)
       continue;
+    *sep = 0;
+    key = line;
 
-    key = fields[0];
-
-    endptr = NULL;
-    counter = strtoll(fields[1], &endptr, 10);
-    if (fields[1] == endptr)
+    if ((parse_uint64_fields(sep + 1, &raw, 1, &end) != 1) || (*end != 0))
       continue;
 
-    endptr = NULL;
-    gauge = strtod(fields[1], &endptr);
-    if (fields[1] == endptr)
-      continue;
+    counter = (derive_t)raw;
+    gauge = (gauge_t)raw;
 
     /*
      * Number of pages
@@ -236,10 +235,7 @@ static int vmem_read(void) {
       value_t value = {.derive = counter};
       submit_one(NULL, "vmpage_action", "deactivate", value);
     }
-  } /* while (fgets) */
-
-  fclose(fh);
-  fh = NULL;
+  } /* for (line) */
 
   if (pgfaultvalid == 0x03)
     submit_two(NULL, "vmpage_faults", NULL, pgfault, pgmajfault);
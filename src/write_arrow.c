@@ -0,0 +1,1100 @@
+/**
+ * collectd - src/write_arrow.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Writes value lists to files in the Apache Arrow IPC file format ("Feather
+ * V2"), one file per time window. Each row holds one data source of a value
+ * list; the identifier columns are dictionary encoded. Rows are buffered in
+ * columnar form and written as one record batch ("row group") when the
+ * buffer is full or the plugin is flushed.
+ *
+ * The format is written directly: the metadata uses FlatBuffers, which is
+ * simple enough to emit with the small builder below, so no Arrow library is
+ * required.
+ */
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_cache.h"
+
+#include <pthread.h>
+
+#define WA_MAGIC "ARROW1"
+#define WA_CONTINUATION 0xFFFFFFFF
+
+/* Arrow "MetadataVersion" V5 */
+#define WA_METADATA_VERSION 4
+
+/* "MessageHeader" union */
+#define WA_HEADER_SCHEMA 1
+#define WA_HEADER_DICTIONARY_BATCH 2
+#define WA_HEADER_RECORD_BATCH 3
+
+/* "Type" union */
+#define WA_TYPE_INT 2
+#define WA_TYPE_FLOATING_POINT 3
+#define WA_TYPE_UTF8 5
+#define WA_TYPE_TIMESTAMP 10
+
+#define WA_PRECISION_DOUBLE 2
+#define WA_TIME_UNIT_NANOSECOND 3
+
+#define WA_FB_FIELDS_MAX 8
+
+/* Columns of the record batches. The dictionary encoded columns come first,
+ * so that their index doubles as dictionary ID. */
+#define WA_COL_HOST 0
+#define WA_COL_PLUGIN 1
+#define WA_COL_PLUGIN_INSTANCE 2
+#define WA_COL_TYPE 3
+#define WA_COL_TYPE_INSTANCE 4
+#define WA_COL_DS_NAME 5
+#define WA_COL_DS_TYPE 6
+#define WA_DICT_NUM 7
+#define WA_COL_TIME 7
+#define WA_COL_VALUE 8
+#define WA_COL_VALUE_INT 9
+#define WA_COL_NUM 10
+
+static const char *const wa_column_names[WA_COL_NUM] = {
+    "host",          "plugin",  "plugin_instance", "type",
+    "type_instance", "ds_name", "ds_type",         "time",
+    "value",         "value_int"};
+
+/* Builds a FlatBuffer back to front, like the reference implementation does.
+ * Objects are referred to by their distance from the end of the buffer, which
+ * does not change while the buffer grows. */
+struct wa_fb_s {
+  uint8_t *data;
+  size_t size;
+  size_t used;
+  bool error;
+
+  size_t table_start;
+  size_t fields[WA_FB_FIELDS_MAX];
+  size_t fields_num;
+};
+typedef struct wa_fb_s wa_fb_t;
+
+/* "Block" in the file footer */
+struct wa_block_s {
+  int64_t offset;
+  int64_t meta_length;
+  int64_t body_length;
+};
+typedef struct wa_block_s wa_block_t;
+
+struct wa_buffer_s {
+  uint8_t *data;
+  size_t size;
+  size_t fill;
+};
+typedef struct wa_buffer_s wa_buffer_t;
+
+struct wa_dict_s {
+  c_avl_tree_t *index;
+  char **values;
+  size_t values_num;
+  size_t values_written;
+};
+typedef struct wa_dict_s wa_dict_t;
+
+/*
+ * Private variables
+ */
+static char *datadir;
+static char *file_prefix;
+static cdtime_t file_interval = TIME_T_TO_CDTIME_T_STATIC(3600);
+static size_t row_group_size = 65536;
+static bool store_rates;
+
+static pthread_mutex_t wa_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Current file */
+static FILE *wa_fh;
+static char wa_filename[PATH_MAX];
+static char wa_tmpname[PATH_MAX + sizeof(".tmp")];
+static uint64_t wa_window;
+static int64_t wa_offset;
+static wa_block_t *wa_dict_blocks;
+static size_t wa_dict_blocks_num;
+static wa_block_t *wa_batch_blocks;
+static size_t wa_batch_blocks_num;
+static wa_dict_t wa_dicts[WA_DICT_NUM];
+
+/* Current row group */
+static size_t wa_rows;
+static int32_t *wa_indices[WA_DICT_NUM];
+static int64_t *wa_time;
+static double *wa_value;
+static uint8_t *wa_value_valid;
+static size_t wa_value_nulls;
+static int64_t *wa_value_int;
+static uint8_t *wa_value_int_valid;
+static size_t wa_value_int_nulls;
+
+static wa_fb_t wa_fb;
+static wa_buffer_t wa_body;
+
+/*
+ * FlatBuffer builder
+ */
+static uint8_t *wa_fb_reserve(wa_fb_t *fb, size_t n) /* {{{ */
+{
+  if (fb->error)
+    return NULL;
+
+  if ((fb->used + n) > fb->size) {
+    size_t size = (fb->size > 0) ? fb->size : 1024;
+    while ((fb->used + n) > size)
+      size *= 2;
+
+    uint8_t *data = malloc(size);
+    if (data == NULL) {
+      ERROR("write_arrow plugin: malloc failed.");
+      fb->error = true;
+      return NULL;
+    }
+    if (fb->used > 0)
+      memcpy(data + size - fb->used, fb->data + fb->size - fb->used, fb->used);
+    free(fb->data);
+    fb->data = data;
+    fb->size = size;
+  }
+
+  fb->used += n;
+  return fb->data + fb->size - fb->used;
+} /* }}} uint8_t *wa_fb_reserve */
+
+/* Pads the buffer so that an object of "len" bytes pushed next is aligned to
+ * "align" bytes. The final buffer is a multiple of eight bytes long, so
+ * aligning the distance from the end aligns the offset from the start. */
+static void wa_fb_align(wa_fb_t *fb, size_t len, size_t align) /* {{{ */
+{
+  size_t pad = (align - ((fb->used + len) % align)) % align;
+  uint8_t *ptr = wa_fb_reserve(fb, pad);
+  if (ptr != NULL)
+    memset(ptr, 0, pad);
+} /* }}} void wa_fb_align */
+
+static void wa_put_le(uint8_t *ptr, uint64_t v, size_t n) /* {{{ */
+{
+  for (size_t i = 0; i < n; i++)
+    ptr[i] = (uint8_t)(v >> (8 * i));
+} /* }}} void wa_put_le */
+
+static size_t wa_fb_scalar(wa_fb_t *fb, uint64_t v, size_t n) /* {{{ */
+{
+  wa_fb_align(fb, n, n);
+  uint8_t *ptr = wa_fb_reserve(fb, n);
+  if (ptr != NULL)
+    wa_put_le(ptr, v, n);
+  return fb->used;
+} /* }}} size_t wa_fb_scalar */
+
+static size_t wa_fb_uoffset(wa_fb_t *fb, size_t ref) /* {{{ */
+{
+  wa_fb_align(fb, 4, 4);
+  return wa_fb_scalar(fb, (uint64_t)(fb->used + 4 - ref), 4);
+} /* }}} size_t wa_fb_uoffset */
+
+static size_t wa_fb_string(wa_fb_t *fb, const char *s) /* {{{ */
+{
+  size_t len = strlen(s);
+
+  wa_fb_align(fb, len + 1, 4);
+  uint8_t *ptr = wa_fb_reserve(fb, len + 1);
+  if (ptr != NULL) {
+    memcpy(ptr, s, len);
+    ptr[len] = 0;
+  }
+  return wa_fb_scalar(fb, (uint64_t)len, 4);
+} /* }}} size_t wa_fb_string */
+
+/* Pushes a vector of structs which consist of 64 bit integers only. */
+static size_t wa_fb_struct_vector(wa_fb_t *fb, const int64_t *v, /* {{{ */
+                                  size_t v_num, size_t count) {
+  wa_fb_align(fb, 8 * v_num, 8);
+  for (size_t i = v_num; i > 0; i--)
+    wa_fb_scalar(fb, (uint64_t)v[i - 1], 8);
+  return wa_fb_scalar(fb, (uint64_t)count, 4);
+} /* }}} size_t wa_fb_struct_vector */
+
+static size_t wa_fb_offset_vector(wa_fb_t *fb, const size_t *refs, /* {{{ */
+                                  size_t refs_num) {
+  for (size_t i = refs_num; i > 0; i--)
+    wa_fb_uoffset(fb, refs[i - 1]);
+  return wa_fb_scalar(fb, (uint64_t)refs_num, 4);
+} /* }}} size_t wa_fb_offset_vector */
+
+static void wa_fb_table_start(wa_fb_t *fb) /* {{{ */
+{
+  fb->table_start = fb->used;
+  memset(fb->fields, 0, sizeof(fb->fields));
+  fb->fields_num = 0;
+} /* }}} void wa_fb_table_start */
+
+static void wa_fb_field(wa_fb_t *fb, size_t id) /* {{{ */
+{
+  assert(id < WA_FB_FIELDS_MAX);
+  fb->fields[id] = fb->used;
+  if (fb->fields_num <= id)
+    fb->fields_num = id + 1;
+} /* }}} void wa_fb_field */
+
+static void wa_fb_add_scalar(wa_fb_t *fb, size_t id, uint64_t v, /* {{{ */
+                             size_t n) {
+  wa_fb_scalar(fb, v, n);
+  wa_fb_field(fb, id);
+} /* }}} void wa_fb_add_scalar */
+
+static void wa_fb_add_offset(wa_fb_t *fb, size_t id, size_t ref) /* {{{ */
+{
+  if (ref == 0)
+    return;
+  wa_fb_uoffset(fb, ref);
+  wa_fb_field(fb, id);
+} /* }}} void wa_fb_add_offset */
+
+static size_t wa_fb_table_end(wa_fb_t *fb) /* {{{ */
+{
+  /* The table starts with the signed offset to its vtable, which is written
+   * right in front of it. */
+  size_t table = wa_fb_scalar(fb, 0, 4);
+  size_t table_size = table - fb->table_start;
+
+  for (size_t i = fb->fields_num; i > 0; i--) {
+    size_t field = fb->fields[i - 1];
+    wa_fb_scalar(fb, (field != 0) ? (uint64_t)(table - field) : 0, 2);
+  }
+  wa_fb_scalar(fb, (uint64_t)table_size, 2);
+  size_t vtable = wa_fb_scalar(fb, (uint64_t)(4 + 2 * fb->fields_num), 2);
+
+  if (!fb->error)
+    wa_put_le(fb->data + fb->size - table, (uint64_t)(vtable - table), 4);
+
+  return table;
+} /* }}} size_t wa_fb_table_end */
+
+static void wa_fb_finish(wa_fb_t *fb, size_t root) /* {{{ */
+{
+  wa_fb_align(fb, 4, 8);
+  wa_fb_uoffset(fb, root);
+} /* }}} void wa_fb_finish */
+
+static void wa_fb_reset(wa_fb_t *fb) /* {{{ */
+{
+  fb->used = 0;
+  fb->error = false;
+} /* }}} void wa_fb_reset */
+
+/*
+ * Arrow metadata
+ */
+static size_t wa_fb_field_type(wa_fb_t *fb, int col) /* {{{ */
+{
+  if (col < WA_DICT_NUM) {
+    wa_fb_table_start(fb);
+    return wa_fb_table_end(fb); /* Utf8 */
+  }
+
+  if (col == WA_COL_TIME) {
+    size_t tz = wa_fb_string(fb, "UTC");
+    wa_fb_table_start(fb);
+    wa_fb_add_scalar(fb, 0, WA_TIME_UNIT_NANOSECOND, 2);
+    wa_fb_add_offset(fb, 1, tz);
+    return wa_fb_table_end(fb); /* Timestamp */
+  }
+
+  if (col == WA_COL_VALUE) {
+    wa_fb_table_start(fb);
+    wa_fb_add_scalar(fb, 0, WA_PRECISION_DOUBLE, 2);
+    return wa_fb_table_end(fb); /* FloatingPoint */
+  }
+
+  wa_fb_table_start(fb);
+  wa_fb_add_scalar(fb, 0, 64, 4);
+  wa_fb_add_scalar(fb, 1, 1, 1);
+  return wa_fb_table_end(fb); /* Int */
+} /* }}} size_t wa_fb_field_type */
+
+static size_t wa_fb_schema(wa_fb_t *fb) /* {{{ */
+{
+  size_t fields[WA_COL_NUM];
+
+  for (int col = 0; col < WA_COL_NUM; col++) {
+    uint8_t type_type;
+    if (col < WA_DICT_NUM)
+      type_type = WA_TYPE_UTF8;
+    else if (col == WA_COL_TIME)
+      type_type = WA_TYPE_TIMESTAMP;
+    else if (col == WA_COL_VALUE)
+      type_type = WA_TYPE_FLOATING_POINT;
+    else
+      type_type = WA_TYPE_INT;
+
+    size_t name = wa_fb_string(fb, wa_column_names[col]);
+    size_t type = wa_fb_field_type(fb, col);
+
+    size_t dictionary = 0;
+    if (col < WA_DICT_NUM) {
+      wa_fb_table_start(fb);
+      wa_fb_add_scalar(fb, 0, 32, 4);
+      wa_fb_add_scalar(fb, 1, 1, 1);
+      size_t index_type = wa_fb_table_end(fb);
+
+      wa_fb_table_start(fb);
+      wa_fb_add_scalar(fb, 0, (uint64_t)col, 8);
+      wa_fb_add_offset(fb, 1, index_type);
+      dictionary = wa_fb_table_end(fb);
+    }
+
+    size_t children = wa_fb_offset_vector(fb, NULL, 0);
+
+    wa_fb_table_start(fb);
+    wa_fb_add_offset(fb, 0, name);
+    wa_fb_add_scalar(fb, 1, (col >= WA_COL_VALUE) ? 1 : 0, 1);
+    wa_fb_add_scalar(fb, 2, type_type, 1);
+    wa_fb_add_offset(fb, 3, type);
+    wa_fb_add_offset(fb, 4, dictionary);
+    wa_fb_add_offset(fb, 5, children);
+    fields[col] = wa_fb_table_end(fb);
+  }
+
+  size_t fields_vector = wa_fb_offset_vector(fb, fields, WA_COL_NUM);
+
+  wa_fb_table_start(fb);
+#if BYTE_ORDER == BIG_ENDIAN
+  wa_fb_add_scalar(fb, 0, 1, 2);
+#else
+  wa_fb_add_scalar(fb, 0, 0, 2);
+#endif
+  wa_fb_add_offset(fb, 1, fields_vector);
+  return wa_fb_table_end(fb);
+} /* }}} size_t wa_fb_schema */
+
+/* Nodes and buffers are arrays of (length, null_count) and (offset, length)
+ * pairs, respectively. */
+static size_t wa_fb_record_batch(wa_fb_t *fb, int64_t length, /* {{{ */
+                                 const int64_t *nodes, size_t nodes_num,
+                                 const int64_t *buffers, size_t buffers_num) {
+  size_t nodes_vector =
+      wa_fb_struct_vector(fb, nodes, 2 * nodes_num, nodes_num);
+  size_t buffers_vector =
+      wa_fb_struct_vector(fb, buffers, 2 * buffers_num, buffers_num);
+
+  wa_fb_table_start(fb);
+  wa_fb_add_scalar(fb, 0, (uint64_t)length, 8);
+  wa_fb_add_offset(fb, 1, nodes_vector);
+  wa_fb_add_offset(fb, 2, buffers_vector);
+  return wa_fb_table_end(fb);
+} /* }}} size_t wa_fb_record_batch */
+
+static void wa_fb_message(wa_fb_t *fb, uint8_t header_type, /* {{{ */
+                          size_t header, int64_t body_length) {
+  wa_fb_table_start(fb);
+  wa_fb_add_scalar(fb, 3, (uint64_t)body_length, 8);
+  wa_fb_add_offset(fb, 2, header);
+  wa_fb_add_scalar(fb, 0, WA_METADATA_VERSION, 2);
+  wa_fb_add_scalar(fb, 1, header_type, 1);
+  wa_fb_finish(fb, wa_fb_table_end(fb));
+} /* }}} void wa_fb_message */
+
+/*
+ * Message bodies
+ */
+static int wa_body_add(wa_buffer_t *body, const void *data, /* {{{ */
+                       size_t len, int64_t *buffers, size_t *buffers_num) {
+  size_t padded = (len + 7) & ~((size_t)7);
+
+  if ((body->fill + padded) > body->size) {
+    size_t size = (body->size > 0) ? body->size : 65536;
+    while ((body->fill + padded) > size)
+      size *= 2;
+
+    uint8_t *tmp = realloc(body->data, size);
+    if (tmp == NULL) {
+      ERROR("write_arrow plugin: realloc failed.");
+      return ENOMEM;
+    }
+    body->data = tmp;
+    body->size = size;
+  }
+
+  buffers[2 * *buffers_num] = (int64_t)body->fill;
+  buffers[2 * *buffers_num + 1] = (int64_t)len;
+  (*buffers_num)++;
+
+  /* A NULL "data" reserves zero-filled space for the caller to fill in. */
+  if (data != NULL)
+    memcpy(body->data + body->fill, data, len);
+  else
+    memset(body->data + body->fill, 0, len);
+  memset(body->data + body->fill + len, 0, padded - len);
+  body->fill += padded;
+
+  return 0;
+} /* }}} int wa_body_add */
+
+/* Writes an encapsulated message: continuation marker, metadata size, the
+ * FlatBuffer in "wa_fb" and the body in "wa_body". */
+static int wa_write_message(wa_block_t *block) /* {{{ */
+{
+  uint8_t prefix[8];
+
+  if (wa_fb.error)
+    return ENOMEM;
+
+  wa_put_le(prefix, WA_CONTINUATION, 4);
+  wa_put_le(prefix + 4, (uint64_t)wa_fb.used, 4);
+
+  if ((fwrite(prefix, sizeof(prefix), 1, wa_fh) != 1) ||
+      (fwrite(wa_fb.data + wa_fb.size - wa_fb.used, wa_fb.used, 1, wa_fh) !=
+       1) ||
+      ((wa_body.fill > 0) &&
+       (fwrite(wa_body.data, wa_body.fill, 1, wa_fh) != 1))) {
+    ERROR("write_arrow plugin: Writing to \"%s\" failed: %s", wa_tmpname,
+          STRERRNO);
+    return errno ? errno : EIO;
+  }
+
+  if (block != NULL) {
+    block->offset = wa_offset;
+    block->meta_length = (int64_t)(sizeof(prefix) + wa_fb.used);
+    block->body_length = (int64_t)wa_body.fill;
+  }
+  wa_offset += (int64_t)(sizeof(prefix) + wa_fb.used + wa_body.fill);
+
+  return 0;
+} /* }}} int wa_write_message */
+
+static int wa_block_append(wa_block_t **blocks, size_t *blocks_num, /* {{{ */
+                           wa_block_t const *block) {
+  wa_block_t *tmp = realloc(*blocks, (*blocks_num + 1) * sizeof(**blocks));
+  if (tmp == NULL) {
+    ERROR("write_arrow plugin: realloc failed.");
+    return ENOMEM;
+  }
+  tmp[*blocks_num] = *block;
+  *blocks = tmp;
+  (*blocks_num)++;
+  return 0;
+} /* }}} int wa_block_append */
+
+/* Writes the dictionary entries added since the last row group. The first
+ * batch of a dictionary defines it, later ones are deltas. */
+static int wa_write_dictionary(int id) /* {{{ */
+{
+  wa_dict_t *dict = wa_dicts + id;
+  size_t num = dict->values_num - dict->values_written;
+  int64_t buffers[6];
+  size_t buffers_num = 0;
+  int status;
+
+  if (num == 0)
+    return 0;
+
+  int32_t *offsets = malloc((num + 1) * sizeof(*offsets));
+  if (offsets == NULL) {
+    ERROR("write_arrow plugin: malloc failed.");
+    return ENOMEM;
+  }
+  offsets[0] = 0;
+  for (size_t i = 0; i < num; i++)
+    offsets[i + 1] =
+        offsets[i] + (int32_t)strlen(dict->values[dict->values_written + i]);
+
+  wa_body.fill = 0;
+  status = wa_body_add(&wa_body, NULL, 0, buffers, &buffers_num);
+  if (status == 0)
+    status = wa_body_add(&wa_body, offsets, (num + 1) * sizeof(*offsets),
+                         buffers, &buffers_num);
+  if (status == 0) {
+    /* Reserve the space for the concatenated strings and copy them in. */
+    size_t start = wa_body.fill;
+    status = wa_body_add(&wa_body, NULL, (size_t)offsets[num], buffers,
+                         &buffers_num);
+    for (size_t i = 0; (status == 0) && (i < num); i++)
+      memcpy(wa_body.data + start + offsets[i],
+             dict->values[dict->values_written + i],
+             (size_t)(offsets[i + 1] - offsets[i]));
+  }
+  sfree(offsets);
+  if (status != 0)
+    return status;
+
+  int64_t nodes[2] = {(int64_t)num, 0};
+
+  wa_fb_reset(&wa_fb);
+  size_t data = wa_fb_record_batch(&wa_fb, (int64_t)num, nodes, 1, buffers,
+                                   buffers_num);
+  wa_fb_table_start(&wa_fb);
+  wa_fb_add_scalar(&wa_fb, 0, (uint64_t)id, 8);
+  wa_fb_add_offset(&wa_fb, 1, data);
+  wa_fb_add_scalar(&wa_fb, 2, (dict->values_written > 0) ? 1 : 0, 1);
+  size_t batch = wa_fb_table_end(&wa_fb);
+  wa_fb_message(&wa_fb, WA_HEADER_DICTIONARY_BATCH, batch,
+                (int64_t)wa_body.fill);
+
+  wa_block_t block;
+  status = wa_write_message(&block);
+  if (status == 0)
+    status = wa_block_append(&wa_dict_blocks, &wa_dict_blocks_num, &block);
+  if (status == 0)
+    dict->values_written = dict->values_num;
+
+  return status;
+} /* }}} int wa_write_dictionary */
+
+static void wa_rows_reset(void) /* {{{ */
+{
+  wa_rows = 0;
+  wa_value_nulls = 0;
+  wa_value_int_nulls = 0;
+  if (wa_value_valid != NULL)
+    memset(wa_value_valid, 0, (row_group_size + 7) / 8);
+  if (wa_value_int_valid != NULL)
+    memset(wa_value_int_valid, 0, (row_group_size + 7) / 8);
+} /* }}} void wa_rows_reset */
+
+/* Writes the buffered rows as a record batch, preceded by the dictionary
+ * entries they introduced. The rows are dropped on error. */
+static int wa_write_row_group(void) /* {{{ */
+{
+  int64_t nodes[2 * WA_COL_NUM];
+  int64_t buffers[4 * WA_COL_NUM];
+  size_t buffers_num = 0;
+  size_t bitmap_size = (wa_rows + 7) / 8;
+  int status = 0;
+
+  if ((wa_fh == NULL) || (wa_rows == 0))
+    return 0;
+
+  for (int id = 0; (status == 0) && (id < WA_DICT_NUM); id++)
+    status = wa_write_dictionary(id);
+  if (status != 0) {
+    wa_rows_reset();
+    return status;
+  }
+
+  wa_body.fill = 0;
+  for (int col = 0; (status == 0) && (col < WA_COL_NUM); col++) {
+    nodes[2 * col] = (int64_t)wa_rows;
+    nodes[2 * col + 1] = 0;
+
+    if (col < WA_DICT_NUM) {
+      status = wa_body_add(&wa_body, NULL, 0, buffers, &buffers_num);
+      if (status == 0)
+        status = wa_body_add(&wa_body, wa_indices[col],
+                             wa_rows * sizeof(*wa_indices[col]), buffers,
+                             &buffers_num);
+    } else if (col == WA_COL_TIME) {
+      status = wa_body_add(&wa_body, NULL, 0, buffers, &buffers_num);
+      if (status == 0)
+        status = wa_body_add(&wa_body, wa_time, wa_rows * sizeof(*wa_time),
+                             buffers, &buffers_num);
+    } else if (col == WA_COL_VALUE) {
+      nodes[2 * col + 1] = (int64_t)wa_value_nulls;
+      status = wa_body_add(&wa_body, wa_value_valid,
+                           (wa_value_nulls > 0) ? bitmap_size : 0, buffers,
+                           &buffers_num);
+      if (status == 0)
+        status = wa_body_add(&wa_body, wa_value, wa_rows * sizeof(*wa_value),
+                             buffers, &buffers_num);
+    } else {
+      nodes[2 * col + 1] = (int64_t)wa_value_int_nulls;
+      status = wa_body_add(&wa_body, wa_value_int_valid,
+                           (wa_value_int_nulls > 0) ? bitmap_size : 0,
+                           buffers, &buffers_num);
+      if (status == 0)
+        status = wa_body_add(&wa_body, wa_value_int,
+                             wa_rows * sizeof(*wa_value_int), buffers,
+                             &buffers_num);
+    }
+  }
+  if (status != 0) {
+    wa_rows_reset();
+    return status;
+  }
+
+  wa_fb_reset(&wa_fb);
+  size_t batch = wa_fb_record_batch(&wa_fb, (int64_t)wa_rows, nodes,
+                                    WA_COL_NUM, buffers, buffers_num);
+  wa_fb_message(&wa_fb, WA_HEADER_RECORD_BATCH, batch, (int64_t)wa_body.fill);
+
+  wa_block_t block;
+  status = wa_write_message(&block);
+  if (status == 0)
+    status = wa_block_append(&wa_batch_blocks, &wa_batch_blocks_num, &block);
+
+  DEBUG("write_arrow plugin: Wrote %" PRIsz " rows to \"%s\".", wa_rows,
+        wa_tmpname);
+
+  wa_rows_reset();
+  return status;
+} /* }}} int wa_write_row_group */
+
+/*
+ * Files
+ */
+static void wa_dicts_reset(void) /* {{{ */
+{
+  for (int id = 0; id < WA_DICT_NUM; id++) {
+    wa_dict_t *dict = wa_dicts + id;
+
+    if (dict->index != NULL)
+      c_avl_destroy(dict->index);
+    dict->index = NULL;
+
+    for (size_t i = 0; i < dict->values_num; i++)
+      sfree(dict->values[i]);
+    sfree(dict->values);
+    dict->values_num = 0;
+    dict->values_written = 0;
+  }
+} /* }}} void wa_dicts_reset */
+
+static int wa_file_open(cdtime_t t) /* {{{ */
+{
+  uint64_t window = t / file_interval;
+  time_t start = CDTIME_T_TO_TIME_T(window * file_interval);
+  struct tm tm;
+  char timestamp[32];
+
+  if ((gmtime_r(&start, &tm) == NULL) ||
+      (strftime(timestamp, sizeof(timestamp), "%Y%m%dT%H%M%SZ", &tm) == 0)) {
+    ERROR("write_arrow plugin: Formatting the file name failed.");
+    return -1;
+  }
+
+  /* Do not overwrite files written before a restart. */
+  for (int i = 0;; i++) {
+    char suffix[16] = "";
+    if (i > 0)
+      snprintf(suffix, sizeof(suffix), "-%d", i);
+
+    int status = snprintf(wa_filename, sizeof(wa_filename), "%s%s%s-%s%s.arrow",
+                          (datadir != NULL) ? datadir : "",
+                          (datadir != NULL) ? "/" : "",
+                          (file_prefix != NULL) ? file_prefix : "collectd",
+                          timestamp, suffix);
+    if ((status < 0) || ((size_t)status >= sizeof(wa_filename))) {
+      ERROR("write_arrow plugin: File name too long.");
+      return ENAMETOOLONG;
+    }
+    if (access(wa_filename, F_OK) != 0)
+      break;
+  }
+  snprintf(wa_tmpname, sizeof(wa_tmpname), "%s.tmp", wa_filename);
+
+  if (check_create_dir(wa_tmpname) != 0)
+    return -1;
+
+  wa_fh = fopen(wa_tmpname, "w");
+  if (wa_fh == NULL) {
+    ERROR("write_arrow plugin: fopen (%s) failed: %s", wa_tmpname, STRERRNO);
+    return -1;
+  }
+
+  wa_window = window;
+  wa_offset = 8;
+  wa_dict_blocks_num = 0;
+  wa_batch_blocks_num = 0;
+  wa_dicts_reset();
+
+  int status = 0;
+  if (fwrite(WA_MAGIC "\0\0", 8, 1, wa_fh) != 1) {
+    ERROR("write_arrow plugin: Writing to \"%s\" failed: %s", wa_tmpname,
+          STRERRNO);
+    status = -1;
+  }
+
+  if (status == 0) {
+    wa_fb_reset(&wa_fb);
+    wa_fb_message(&wa_fb, WA_HEADER_SCHEMA, wa_fb_schema(&wa_fb), 0);
+    wa_body.fill = 0;
+    status = wa_write_message(NULL);
+  }
+
+  if (status != 0) {
+    fclose(wa_fh);
+    wa_fh = NULL;
+    unlink(wa_tmpname);
+    return status;
+  }
+
+  DEBUG("write_arrow plugin: Opened \"%s\".", wa_tmpname);
+  return 0;
+} /* }}} int wa_file_open */
+
+static size_t wa_fb_blocks(wa_fb_t *fb, wa_block_t const *blocks, /* {{{ */
+                           size_t blocks_num) {
+  int64_t *v = calloc(3 * blocks_num + 1, sizeof(*v));
+  if (v == NULL) {
+    fb->error = true;
+    return 0;
+  }
+
+  for (size_t i = 0; i < blocks_num; i++) {
+    v[3 * i] = blocks[i].offset;
+    v[3 * i + 1] = blocks[i].meta_length; /* int32 followed by padding */
+    v[3 * i + 2] = blocks[i].body_length;
+  }
+
+  size_t ref = wa_fb_struct_vector(fb, v, 3 * blocks_num, blocks_num);
+  sfree(v);
+  return ref;
+} /* }}} size_t wa_fb_blocks */
+
+/* Writes the pending rows and the footer and moves the file into place. */
+static int wa_file_close(void) /* {{{ */
+{
+  uint8_t trailer[16];
+  int status;
+
+  if (wa_fh == NULL)
+    return 0;
+
+  status = wa_write_row_group();
+
+  if (status == 0) {
+    wa_fb_reset(&wa_fb);
+    size_t schema = wa_fb_schema(&wa_fb);
+    size_t dictionaries =
+        wa_fb_blocks(&wa_fb, wa_dict_blocks, wa_dict_blocks_num);
+    size_t batches = wa_fb_blocks(&wa_fb, wa_batch_blocks, wa_batch_blocks_num);
+
+    wa_fb_table_start(&wa_fb);
+    wa_fb_add_offset(&wa_fb, 1, schema);
+    wa_fb_add_offset(&wa_fb, 2, dictionaries);
+    wa_fb_add_offset(&wa_fb, 3, batches);
+    wa_fb_add_scalar(&wa_fb, 0, WA_METADATA_VERSION, 2);
+    wa_fb_finish(&wa_fb, wa_fb_table_end(&wa_fb));
+
+    /* End-of-stream marker, footer, footer size and magic. */
+    wa_put_le(trailer, WA_CONTINUATION, 4);
+    wa_put_le(trailer + 4, 0, 4);
+    if (wa_fb.error || (fwrite(trailer, 8, 1, wa_fh) != 1) ||
+        (fwrite(wa_fb.data + wa_fb.size - wa_fb.used, wa_fb.used, 1, wa_fh) !=
+         1)) {
+      status = -1;
+    }
+
+    wa_put_le(trailer, (uint64_t)wa_fb.used, 4);
+    memcpy(trailer + 4, WA_MAGIC, 6);
+    if ((status == 0) && (fwrite(trailer, 10, 1, wa_fh) != 1))
+      status = -1;
+  }
+
+  if (fclose(wa_fh) != 0)
+    status = -1;
+  wa_fh = NULL;
+
+  if (status != 0) {
+    ERROR("write_arrow plugin: Writing \"%s\" failed.", wa_tmpname);
+    unlink(wa_tmpname);
+  } else if (rename(wa_tmpname, wa_filename) != 0) {
+    ERROR("write_arrow plugin: rename (\"%s\", \"%s\") failed: %s", wa_tmpname,
+          wa_filename, STRERRNO);
+    status = -1;
+  } else {
+    DEBUG("write_arrow plugin: Closed \"%s\".", wa_filename);
+  }
+
+  wa_rows_reset();
+  wa_dicts_reset();
+
+  return status;
+} /* }}} int wa_file_close */
+
+static int32_t wa_dict_lookup(int id, const char *value) /* {{{ */
+{
+  wa_dict_t *dict = wa_dicts + id;
+  void *index;
+
+  if (dict->index == NULL) {
+    dict->index = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (dict->index == NULL)
+      return -1;
+  }
+
+  if (c_avl_get(dict->index, value, &index) == 0)
+    return (int32_t)(intptr_t)index;
+
+  if (dict->values_num >= INT32_MAX)
+    return -1;
+
+  char **tmp =
+      realloc(dict->values, (dict->values_num + 1) * sizeof(*dict->values));
+  if (tmp == NULL)
+    return -1;
+  dict->values = tmp;
+
+  char *copy = strdup(value);
+  if (copy == NULL)
+    return -1;
+
+  if (c_avl_insert(dict->index, copy,
+                   (void *)(intptr_t)dict->values_num) != 0) {
+    sfree(copy);
+    return -1;
+  }
+  dict->values[dict->values_num] = copy;
+  return (int32_t)dict->values_num++;
+} /* }}} int32_t wa_dict_lookup */
+
+static int wa_write(const data_set_t *ds, const value_list_t *vl, /* {{{ */
+                    __attribute__((unused)) user_data_t *ud) {
+  gauge_t *rates = NULL;
+  int status = 0;
+
+  if (strcmp(ds->type, vl->type) != 0) {
+    ERROR("write_arrow plugin: DS type does not match value list type");
+    return -1;
+  }
+
+  if (store_rates) {
+    rates = uc_get_rate(ds, vl);
+    if (rates == NULL) {
+      ERROR("write_arrow plugin: uc_get_rate failed.");
+      return -1;
+    }
+  }
+
+  pthread_mutex_lock(&wa_lock);
+
+  if ((wa_fh != NULL) && ((vl->time / file_interval) > wa_window))
+    wa_file_close();
+  if ((wa_fh == NULL) && ((status = wa_file_open(vl->time)) != 0)) {
+    pthread_mutex_unlock(&wa_lock);
+    sfree(rates);
+    return status;
+  }
+
+  int32_t indices[WA_DICT_NUM - 2];
+  const char *fields[WA_DICT_NUM - 2] = {vl->host, vl->plugin,
+                                         vl->plugin_instance, vl->type,
+                                         vl->type_instance};
+  for (int id = 0; id < WA_DICT_NUM - 2; id++) {
+    indices[id] = wa_dict_lookup(id, fields[id]);
+    if (indices[id] < 0) {
+      ERROR("write_arrow plugin: Adding \"%s\" to the dictionary failed.",
+            fields[id]);
+      pthread_mutex_unlock(&wa_lock);
+      sfree(rates);
+      return -1;
+    }
+  }
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    int32_t ds_name = wa_dict_lookup(WA_COL_DS_NAME, ds->ds[i].name);
+    int32_t ds_type =
+        wa_dict_lookup(WA_COL_DS_TYPE, DS_TYPE_TO_STRING(ds->ds[i].type));
+    if ((ds_name < 0) || (ds_type < 0)) {
+      ERROR("write_arrow plugin: Adding \"%s\" to the dictionary failed.",
+            ds->ds[i].name);
+      status = -1;
+      break;
+    }
+
+    size_t row = wa_rows;
+    for (int id = 0; id < WA_DICT_NUM - 2; id++)
+      wa_indices[id][row] = indices[id];
+    wa_indices[WA_COL_DS_NAME][row] = ds_name;
+    wa_indices[WA_COL_DS_TYPE][row] = ds_type;
+    wa_time[row] = (int64_t)CDTIME_T_TO_NS(vl->time);
+
+    bool is_double = true;
+    double value = 0.0;
+    int64_t value_int = 0;
+    if (ds->ds[i].type == DS_TYPE_GAUGE)
+      value = vl->values[i].gauge;
+    else if (rates != NULL)
+      value = rates[i];
+    else {
+      is_double = false;
+      if (ds->ds[i].type == DS_TYPE_COUNTER)
+        value_int = (int64_t)vl->values[i].counter;
+      else if (ds->ds[i].type == DS_TYPE_DERIVE)
+        value_int = vl->values[i].derive;
+      else
+        value_int = (int64_t)vl->values[i].absolute;
+    }
+
+    wa_value[row] = value;
+    wa_value_int[row] = value_int;
+    if (is_double) {
+      wa_value_valid[row / 8] |= (uint8_t)(1 << (row % 8));
+      wa_value_int_nulls++;
+    } else {
+      wa_value_int_valid[row / 8] |= (uint8_t)(1 << (row % 8));
+      wa_value_nulls++;
+    }
+
+    wa_rows++;
+    if (wa_rows >= row_group_size) {
+      status = wa_write_row_group();
+      if (status != 0)
+        break;
+    }
+  }
+
+  pthread_mutex_unlock(&wa_lock);
+  sfree(rates);
+  return status;
+} /* }}} int wa_write */
+
+/* Writes the buffered rows as a row group. Files whose time window has ended
+ * are closed, so they become available even if no new values arrive. */
+static int wa_flush(__attribute__((unused)) cdtime_t timeout, /* {{{ */
+                    __attribute__((unused)) const char *identifier,
+                    __attribute__((unused)) user_data_t *ud) {
+  int status = 0;
+
+  pthread_mutex_lock(&wa_lock);
+  if ((wa_fh != NULL) && ((cdtime() / file_interval) > wa_window)) {
+    status = wa_file_close();
+  } else if (wa_fh != NULL) {
+    status = wa_write_row_group();
+    if ((status == 0) && (fflush(wa_fh) != 0)) {
+      ERROR("write_arrow plugin: fflush (%s) failed: %s", wa_tmpname,
+            STRERRNO);
+      status = -1;
+    }
+  }
+  pthread_mutex_unlock(&wa_lock);
+
+  return status;
+} /* }}} int wa_flush */
+
+static int wa_config(oconfig_item_t *ci) /* {{{ */
+{
+  int status = 0;
+
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("DataDir", child->key) == 0) {
+      status = cf_util_get_string(child, &datadir);
+      if (status == 0) {
+        size_t len = strlen(datadir);
+        while ((len > 0) && (datadir[len - 1] == '/'))
+          datadir[--len] = '\0';
+        if (len == 0)
+          sfree(datadir);
+      }
+    } else if (strcasecmp("FilePrefix", child->key) == 0)
+      status = cf_util_get_string(child, &file_prefix);
+    else if (strcasecmp("FileInterval", child->key) == 0) {
+      cdtime_t tmp = 0;
+      status = cf_util_get_cdtime(child, &tmp);
+      if ((status == 0) && (tmp == 0)) {
+        ERROR("write_arrow plugin: `FileInterval' must be positive.");
+        status = EINVAL;
+      }
+      if (status == 0)
+        file_interval = tmp;
+    } else if (strcasecmp("RowGroupSize", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < 1)) {
+        ERROR("write_arrow plugin: `RowGroupSize' must be positive.");
+        status = EINVAL;
+      }
+      if (status == 0)
+        row_group_size = (size_t)tmp;
+    } else if (strcasecmp("StoreRates", child->key) == 0)
+      status = cf_util_get_boolean(child, &store_rates);
+    else {
+      ERROR("write_arrow plugin: Invalid configuration option: %s.",
+            child->key);
+      status = EINVAL;
+    }
+
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+} /* }}} int wa_config */
+
+static int wa_init(void) /* {{{ */
+{
+  size_t bitmap_size = (row_group_size + 7) / 8;
+
+  bool ok = true;
+  for (int id = 0; id < WA_DICT_NUM; id++) {
+    wa_indices[id] = calloc(row_group_size, sizeof(*wa_indices[id]));
+    ok = ok && (wa_indices[id] != NULL);
+  }
+  wa_time = calloc(row_group_size, sizeof(*wa_time));
+  wa_value = calloc(row_group_size, sizeof(*wa_value));
+  wa_value_int = calloc(row_group_size, sizeof(*wa_value_int));
+  wa_value_valid = calloc(bitmap_size, 1);
+  wa_value_int_valid = calloc(bitmap_size, 1);
+
+  if (!ok || (wa_time == NULL) || (wa_value == NULL) ||
+      (wa_value_int == NULL) || (wa_value_valid == NULL) ||
+      (wa_value_int_valid == NULL)) {
+    ERROR("write_arrow plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  return 0;
+} /* }}} int wa_init */
+
+static int wa_shutdown(void) /* {{{ */
+{
+  pthread_mutex_lock(&wa_lock);
+  wa_file_close();
+
+  for (int id = 0; id < WA_DICT_NUM; id++)
+    sfree(wa_indices[id]);
+  sfree(wa_time);
+  sfree(wa_value);
+  sfree(wa_value_int);
+  sfree(wa_value_valid);
+  sfree(wa_value_int_valid);
+  sfree(wa_dict_blocks);
+  sfree(wa_batch_blocks);
+  sfree(wa_fb.data);
+  wa_fb.size = 0;
+  sfree(wa_body.data);
+  wa_body.size = 0;
+  pthread_mutex_unlock(&wa_lock);
+
+  sfree(datadir);
+  sfree(file_prefix);
+  return 0;
+} /* }}} int wa_shutdown */
+
+void module_register(void) {
+  plugin_register_complex_config("write_arrow", wa_config);
+  plugin_register_init("write_arrow", wa_init);
+  plugin_register_write("write_arrow", wa_write, /* user_data = */ NULL);
+  plugin_register_flush("write_arrow", wa_flush, /* user_data = */ NULL);
+  plugin_register_shutdown("write_arrow", wa_shutdown);
+} /* void module_register */
@@ -0,0 +1,239 @@
+/**
+ * collectd - src/write_arrow_test.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "write_arrow.c" /* sic */
+#include "testing.h"
+
+/* A file read back into memory. */
+static uint8_t *file_data;
+static size_t file_size;
+
+static uint64_t get_le(size_t pos, size_t n) {
+  uint64_t v = 0;
+  assert(pos + n <= file_size);
+  for (size_t i = n; i > 0; i--)
+    v = (v << 8) | file_data[pos + i - 1];
+  return v;
+}
+
+/* Minimal FlatBuffer reader: returns the position of field "id" of the table
+ * at "table", or zero if the field is not set. */
+static size_t fb_field(size_t table, size_t id) {
+  size_t vtable = table - (int32_t)get_le(table, 4);
+  size_t vtable_size = get_le(vtable, 2);
+  if ((4 + 2 * id) >= vtable_size)
+    return 0;
+  size_t offset = get_le(vtable + 4 + 2 * id, 2);
+  return (offset != 0) ? table + offset : 0;
+}
+
+/* Follows the offset stored at "pos" to a table, vector or string. */
+static size_t fb_deref(size_t pos) { return pos + get_le(pos, 4); }
+
+/* Checks the message starting at "offset" and returns its header table in
+ * "header" and the length of its body in "body_length". */
+static int read_message(size_t offset, int expect_header_type,
+                        size_t *header, uint64_t *body_length) {
+  EXPECT_EQ_UINT64(0, offset % 8);
+  EXPECT_EQ_UINT64(WA_CONTINUATION, get_le(offset, 4));
+  size_t meta_length = get_le(offset + 4, 4);
+  EXPECT_EQ_UINT64(0, (8 + meta_length) % 8);
+
+  size_t message = fb_deref(offset + 8);
+  EXPECT_EQ_UINT64(WA_METADATA_VERSION, get_le(fb_field(message, 0), 2));
+  EXPECT_EQ_UINT64(expect_header_type, get_le(fb_field(message, 1), 1));
+  *body_length = get_le(fb_field(message, 3), 8);
+  EXPECT_EQ_UINT64(0, *body_length % 8);
+  OK(offset + 8 + meta_length + *body_length <= file_size);
+
+  *header = fb_deref(fb_field(message, 2));
+  return 0;
+}
+
+static int check_string(size_t pos, const char *expect) {
+  size_t str = fb_deref(pos);
+  size_t len = get_le(str, 4);
+  char buffer[64] = {0};
+  assert(len < sizeof(buffer));
+  memcpy(buffer, file_data + str + 4, len);
+  EXPECT_EQ_STR(expect, buffer);
+  return 0;
+}
+
+/* Checks a RecordBatch table: the number of rows, one field node per column
+ * and buffers which are aligned and within the body. */
+static int check_record_batch(size_t batch, uint64_t rows, size_t nodes_num,
+                              uint64_t body_length) {
+  EXPECT_EQ_UINT64(rows, get_le(fb_field(batch, 0), 8));
+
+  size_t nodes = fb_deref(fb_field(batch, 1));
+  EXPECT_EQ_UINT64(nodes_num, get_le(nodes, 4));
+  for (size_t i = 0; i < nodes_num; i++)
+    EXPECT_EQ_UINT64(rows, get_le(nodes + 4 + 16 * i, 8));
+
+  size_t buffers = fb_deref(fb_field(batch, 2));
+  size_t buffers_num = get_le(buffers, 4);
+  OK(buffers_num >= 2 * nodes_num);
+  for (size_t i = 0; i < buffers_num; i++) {
+    uint64_t offset = get_le(buffers + 4 + 16 * i, 8);
+    uint64_t length = get_le(buffers + 4 + 16 * i + 8, 8);
+    EXPECT_EQ_UINT64(0, offset % 8);
+    OK(offset + length <= body_length);
+  }
+
+  return 0;
+}
+
+static int read_file(const char *filename) {
+  FILE *fh = fopen(filename, "r");
+  if (fh == NULL)
+    return errno;
+
+  struct stat st;
+  if (fstat(fileno(fh), &st) != 0) {
+    fclose(fh);
+    return errno;
+  }
+  file_size = (size_t)st.st_size;
+  file_data = malloc(file_size);
+  if ((file_data == NULL) || (fread(file_data, file_size, 1, fh) != 1)) {
+    fclose(fh);
+    return -1;
+  }
+
+  fclose(fh);
+  return 0;
+}
+
+DEF_TEST(write_file) {
+  char dir[] = "/tmp/write_arrow_test.XXXXXX";
+  CHECK_NOT_NULL(mkdtemp(dir));
+
+  datadir = strdup(dir);
+  file_prefix = strdup("test");
+  row_group_size = 2;
+  CHECK_ZERO(wa_init());
+
+  data_source_t dsrc[] = {
+      {"rx", DS_TYPE_DERIVE, 0, NAN}, {"load", DS_TYPE_GAUGE, 0, NAN},
+  };
+  data_set_t ds = {"test", STATIC_ARRAY_SIZE(dsrc), dsrc};
+  value_list_t vl = {
+      .values = (value_t[]){{.derive = 42}, {.gauge = 1.5}},
+      .values_len = 2,
+      .time = TIME_T_TO_CDTIME_T(1500000000),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "test",
+  };
+
+  /* Two rows: one row group. The third row is written when closing. */
+  CHECK_ZERO(wa_write(&ds, &vl, NULL));
+  vl.time += vl.interval;
+  vl.values_len = 1;
+  ds.ds_num = 1;
+  CHECK_ZERO(wa_write(&ds, &vl, NULL));
+
+  char filename[sizeof(wa_filename)];
+  sstrncpy(filename, wa_filename, sizeof(filename));
+  CHECK_ZERO(wa_shutdown());
+  CHECK_ZERO(read_file(filename));
+
+  /* Leading and trailing magic. */
+  OK(file_size > 24);
+  EXPECT_EQ_INT(0, memcmp(file_data, WA_MAGIC "\0\0", 8));
+  EXPECT_EQ_INT(0, memcmp(file_data + file_size - 6, WA_MAGIC, 6));
+
+  /* The schema message directly follows the magic. */
+  size_t schema;
+  uint64_t body_length;
+  CHECK_ZERO(read_message(8, WA_HEADER_SCHEMA, &schema, &body_length));
+  EXPECT_EQ_UINT64(0, body_length);
+  size_t fields = fb_deref(fb_field(schema, 1));
+  EXPECT_EQ_UINT64(WA_COL_NUM, get_le(fields, 4));
+  for (size_t i = 0; i < WA_COL_NUM; i++) {
+    size_t field = fb_deref(fields + 4 + 4 * i);
+    CHECK_ZERO(check_string(fb_field(field, 0), wa_column_names[i]));
+    /* Only the identifier columns are dictionary encoded. */
+    EXPECT_EQ_INT(i < WA_DICT_NUM, fb_field(field, 4) != 0);
+  }
+
+  /* The footer, preceded by the end-of-stream marker. */
+  size_t footer_size = get_le(file_size - 10, 4);
+  size_t footer_start = file_size - 10 - footer_size;
+  EXPECT_EQ_UINT64(WA_CONTINUATION, get_le(footer_start - 8, 4));
+  EXPECT_EQ_UINT64(0, get_le(footer_start - 4, 4));
+  EXPECT_EQ_UINT64(0, footer_start % 8);
+
+  size_t footer = fb_deref(footer_start);
+  EXPECT_EQ_UINT64(WA_METADATA_VERSION, get_le(fb_field(footer, 0), 2));
+  size_t footer_schema = fb_deref(fb_field(footer, 1));
+  EXPECT_EQ_UINT64(WA_COL_NUM,
+                   get_le(fb_deref(fb_field(footer_schema, 1)), 4));
+
+  /* Every dictionary batch holds the values of one identifier column. */
+  size_t dictionaries = fb_deref(fb_field(footer, 2));
+  EXPECT_EQ_UINT64(WA_DICT_NUM, get_le(dictionaries, 4));
+  for (size_t i = 0; i < WA_DICT_NUM; i++) {
+    size_t block = dictionaries + 4 + 24 * i;
+    size_t offset = get_le(block, 8);
+    size_t dict;
+    CHECK_ZERO(read_message(offset, WA_HEADER_DICTIONARY_BATCH, &dict,
+                            &body_length));
+    EXPECT_EQ_UINT64(get_le(block + 16, 8), body_length);
+    EXPECT_EQ_UINT64(i, get_le(fb_field(dict, 0), 8));
+    /* Both data sources differ in name and type. */
+    uint64_t values_num = (i < WA_COL_DS_NAME) ? 1 : 2;
+    CHECK_ZERO(check_record_batch(fb_deref(fb_field(dict, 1)), values_num, 1,
+                                  body_length));
+  }
+
+  /* Two row groups: the full one and the one written on close. */
+  size_t batches = fb_deref(fb_field(footer, 3));
+  EXPECT_EQ_UINT64(2, get_le(batches, 4));
+  uint64_t expect_rows[] = {2, 1};
+  for (size_t i = 0; i < 2; i++) {
+    size_t block = batches + 4 + 24 * i;
+    size_t offset = get_le(block, 8);
+    size_t meta_length = get_le(block + 8, 4);
+    size_t batch;
+    CHECK_ZERO(
+        read_message(offset, WA_HEADER_RECORD_BATCH, &batch, &body_length));
+    EXPECT_EQ_UINT64(8 + get_le(offset + 4, 4), meta_length);
+    EXPECT_EQ_UINT64(get_le(block + 16, 8), body_length);
+    CHECK_ZERO(
+        check_record_batch(batch, expect_rows[i], WA_COL_NUM, body_length));
+  }
+
+  sfree(file_data);
+  unlink(filename);
+  rmdir(dir);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(write_file);
+
+  END_TEST;
+}
@@ -82,12 +82,51 @@
 #define WG_MIN_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T(1)
 #endif
 
+#ifndef WG_DEFAULT_CONNECTIONS
+#define WG_DEFAULT_CONNECTIONS 1
+#endif
+
+/* Bytes buffered per TCP connection while the server does not accept data. */
+#ifndef WG_DEFAULT_BACKLOG_SIZE
+#define WG_DEFAULT_BACKLOG_SIZE 1048576
+#endif
+
 /*
  * Private variables
  */
-struct wg_callback {
+struct wg_callback;
+
+/* A connection to the node. Metrics are assigned to one of a node's
+ * connections by the hash of their identifier, so the values of a metric are
+ * sent in order. */
+struct wg_connection {
+  struct wg_callback *cb;
+
+  pthread_mutex_t lock;
   int sock_fd;
+  /* Set while a thread connects without holding "lock". */
+  bool connecting;
+
+  /* Lines not sent yet are in buf[buf_pos, buf_fill). With TCP, "buf" holds up
+   * to "backlog_size" bytes, which are sent without blocking once a packet's
+   * worth has been buffered. With UDP, "buf" holds one datagram. */
+  char *buf;
+  size_t buf_size;
+  size_t buf_pos;
+  size_t buf_fill;
+  cdtime_t buf_init_time;
+  /* The last send ended in the middle of a line. */
+  bool mid_line;
+
+  c_complain_t init_complaint;
+  c_complain_t backlog_complaint;
+  cdtime_t last_connect_time;
 
+  /* Force reconnect useful for load balanced environments */
+  cdtime_t last_reconnect_time;
+};
+
+struct wg_callback {
   char *name;
 
   char *node;
@@ -100,126 +139,158 @@ struct wg_callback {
 
   unsigned int format_flags;
 
-  char send_buf[WG_SEND_BUF_SIZE];
-  size_t send_buf_free;
-  size_t send_buf_fill;
-  cdtime_t send_buf_init_time;
-
-  pthread_mutex_t send_lock;
-  c_complain_t init_complaint;
-  cdtime_t last_connect_time;
-
-  /* Force reconnect useful for load balanced environments */
-  cdtime_t last_reconnect_time;
   cdtime_t reconnect_interval;
-  bool reconnect_interval_reached;
+
+  bool stream; /* TCP, as opposed to UDP */
+  size_t backlog_size;
+  struct wg_connection *conns;
+  size_t conns_num;
 };
 
-/* wg_force_reconnect_check closes cb->sock_fd when it was open for longer
- * than cb->reconnect_interval. Must hold cb->send_lock when calling. */
-static void wg_force_reconnect_check(struct wg_callback *cb) {
+/*
+ * Functions
+ */
+/* wg_close closes a connection's socket. If the last send ended in the middle
+ * of a line, the remainder of that line is discarded: it would be garbage on a
+ * new connection. Must hold conn->lock when calling. */
+static void wg_close(struct wg_connection *conn) {
+  if (conn->sock_fd >= 0) {
+    close(conn->sock_fd);
+    conn->sock_fd = -1;
+  }
+
+  if (conn->mid_line) {
+    char *eol = memchr(conn->buf + conn->buf_pos, '\n',
+                       conn->buf_fill - conn->buf_pos);
+    conn->buf_pos = (eol != NULL) ? (size_t)(eol - conn->buf) + 1
+                                  : conn->buf_fill;
+    conn->mid_line = false;
+  }
+}
+
+/* wg_force_reconnect_check closes conn->sock_fd when it was open for longer
+ * than cb->reconnect_interval. Buffered data is kept and sent over the next
+ * connection. Must hold conn->lock when calling. */
+static void wg_force_reconnect_check(struct wg_connection *conn) {
+  struct wg_callback *cb = conn->cb;
   cdtime_t now;
 
-  if (cb->reconnect_interval == 0)
+  if ((cb->reconnect_interval == 0) || (conn->sock_fd < 0))
     return;
 
   /* check if address changes if addr_timeout */
   now = cdtime();
-  if ((now - cb->last_reconnect_time) < cb->reconnect_interval)
+  if ((now - conn->last_reconnect_time) < cb->reconnect_interval)
     return;
 
-  /* here we should close connection on next */
-  close(cb->sock_fd);
-  cb->sock_fd = -1;
-  cb->last_reconnect_time = now;
-  cb->reconnect_interval_reached = true;
-
   INFO("write_graphite plugin: Connection closed after %.3f seconds.",
-       CDTIME_T_TO_DOUBLE(now - cb->last_reconnect_time));
-}
+       CDTIME_T_TO_DOUBLE(now - conn->last_reconnect_time));
 
-/*
- * Functions
- */
-static void wg_reset_buffer(struct wg_callback *cb) {
-  memset(cb->send_buf, 0, sizeof(cb->send_buf));
-  cb->send_buf_free = sizeof(cb->send_buf);
-  cb->send_buf_fill = 0;
-  cb->send_buf_init_time = cdtime();
+  /* here we should close connection on next */
+  wg_close(conn);
+  conn->last_reconnect_time = now;
 }
 
-static int wg_send_buffer(struct wg_callback *cb) {
-  ssize_t status;
+/* wg_send_buffer sends buffered data. With TCP, it sends as much as the socket
+ * accepts without blocking and keeps the rest. With UDP, the buffer is sent as
+ * one datagram and emptied, whether sending succeeded or not. Must hold
+ * conn->lock when calling. */
+static int wg_send_buffer(struct wg_connection *conn) {
+  struct wg_callback *cb = conn->cb;
 
-  if (cb->sock_fd < 0)
+  if (!cb->stream && (conn->sock_fd < 0)) {
+    conn->buf_pos = conn->buf_fill = 0;
     return -1;
+  }
 
-  status = swrite(cb->sock_fd, cb->send_buf, strlen(cb->send_buf));
-  if (status != 0) {
-    if (cb->log_send_errors) {
-      ERROR("write_graphite plugin: send to %s:%s (%s) failed with status %zi "
-            "(%s)",
-            cb->node, cb->service, cb->protocol, status, STRERRNO);
+  while ((conn->sock_fd >= 0) && (conn->buf_pos < conn->buf_fill)) {
+    ssize_t status = send(conn->sock_fd, conn->buf + conn->buf_pos,
+                          conn->buf_fill - conn->buf_pos, MSG_DONTWAIT);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if (cb->stream && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        break;
+
+      if (cb->log_send_errors) {
+        ERROR("write_graphite plugin: send to %s:%s (%s) failed with status "
+              "%zi (%s)",
+              cb->node, cb->service, cb->protocol, status, STRERRNO);
+      }
+
+      wg_close(conn);
+      if (!cb->stream)
+        conn->buf_pos = conn->buf_fill = 0;
+      return -1;
     }
 
-    close(cb->sock_fd);
-    cb->sock_fd = -1;
+    conn->buf_pos += (size_t)status;
+    conn->mid_line = (conn->buf[conn->buf_pos - 1] != '\n');
+  }
 
-    return -1;
+  if (conn->buf_pos >= conn->buf_fill) {
+    conn->buf_pos = conn->buf_fill = 0;
+    conn->buf_init_time = cdtime();
   }
 
   return 0;
 }
 
-/* NOTE: You must hold cb->send_lock when calling this function! */
-static int wg_flush_nolock(cdtime_t timeout, struct wg_callback *cb) {
-  int status;
-
+/* NOTE: You must hold conn->lock when calling this function! */
+static int wg_flush_nolock(cdtime_t timeout, struct wg_connection *conn) {
   DEBUG("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
-        "send_buf_fill = %" PRIsz ";",
-        (double)timeout, cb->send_buf_fill);
+        "buf_fill = %" PRIsz ";",
+        (double)timeout, conn->buf_fill - conn->buf_pos);
 
   /* timeout == 0  => flush unconditionally */
   if (timeout > 0) {
     cdtime_t now;
 
     now = cdtime();
-    if ((cb->send_buf_init_time + timeout) > now)
+    if ((conn->buf_init_time + timeout) > now)
       return 0;
   }
 
-  if (cb->send_buf_fill == 0) {
-    cb->send_buf_init_time = cdtime();
+  if (conn->buf_pos >= conn->buf_fill) {
+    conn->buf_init_time = cdtime();
     return 0;
   }
 
-  status = wg_send_buffer(cb);
-  wg_reset_buffer(cb);
-
-  return status;
+  return wg_send_buffer(conn);
 }
 
-static int wg_callback_init(struct wg_callback *cb) {
+/* wg_connect opens conn->sock_fd. The lock is released while resolving the
+ * node's address and connecting, so that other threads keep buffering; only
+ * one thread connects at a time. Must hold conn->lock when calling; it is held
+ * again when this function returns. */
+static int wg_connect(struct wg_connection *conn) {
+  struct wg_callback *cb = conn->cb;
   struct addrinfo *ai_list;
   cdtime_t now;
   int status;
+  int fd = -1;
 
   char connerr[1024] = "";
 
-  if (cb->sock_fd > 0)
+  if (conn->sock_fd >= 0)
     return 0;
+  if (conn->connecting)
+    return EAGAIN;
 
   /* Don't try to reconnect too often. By default, one reconnection attempt
    * is made per second. */
   now = cdtime();
-  if ((now - cb->last_connect_time) < WG_MIN_RECONNECT_INTERVAL)
+  if ((now - conn->last_connect_time) < WG_MIN_RECONNECT_INTERVAL)
     return EAGAIN;
-  cb->last_connect_time = now;
+  conn->last_connect_time = now;
+
+  conn->connecting = true;
+  pthread_mutex_unlock(&conn->lock);
 
   struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
                               .ai_flags = AI_ADDRCONFIG};
 
-  if (0 == strcasecmp("tcp", cb->protocol))
+  if (cb->stream)
     ai_hints.ai_socktype = SOCK_STREAM;
   else
     ai_hints.ai_socktype = SOCK_DGRAM;
@@ -228,27 +299,38 @@ static int wg_callback_init(struct wg_callback *cb) {
   if (status != 0) {
     ERROR("write_graphite plugin: getaddrinfo (%s, %s, %s) failed: %s",
           cb->node, cb->service, cb->protocol, gai_strerror(status));
+    pthread_mutex_lock(&conn->lock);
+    conn->connecting = false;
     return -1;
   }
 
   assert(ai_list != NULL);
   for (struct addrinfo *ai_ptr = ai_list; ai_ptr != NULL;
        ai_ptr = ai_ptr->ai_next) {
-    cb->sock_fd =
-        socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
-    if (cb->sock_fd < 0) {
+    fd = socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+    if (fd < 0) {
       snprintf(connerr, sizeof(connerr), "failed to open socket: %s", STRERRNO);
       continue;
     }
 
-    set_sock_opts(cb->sock_fd);
+    set_sock_opts(fd);
 
-    status = connect(cb->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+    status = connect(fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
     if (status != 0) {
       snprintf(connerr, sizeof(connerr), "failed to connect to remote host: %s",
                STRERRNO);
-      close(cb->sock_fd);
-      cb->sock_fd = -1;
+      close(fd);
+      fd = -1;
+      continue;
+    }
+
+    /* Sends must not block the write threads. */
+    int flags = fcntl(fd, F_GETFL);
+    if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)) {
+      snprintf(connerr, sizeof(connerr), "fcntl(O_NONBLOCK) failed: %s",
+               STRERRNO);
+      close(fd);
+      fd = -1;
       continue;
     }
 
@@ -257,26 +339,23 @@ static int wg_callback_init(struct wg_callback *cb) {
 
   freeaddrinfo(ai_list);
 
-  if (cb->sock_fd < 0) {
-    c_complain(LOG_ERR, &cb->init_complaint,
+  pthread_mutex_lock(&conn->lock);
+  conn->connecting = false;
+
+  if (fd < 0) {
+    c_complain(LOG_ERR, &conn->init_complaint,
                "write_graphite plugin: Connecting to %s:%s via %s failed. "
                "The last error was: %s",
                cb->node, cb->service, cb->protocol, connerr);
     return -1;
   } else {
-    c_release(LOG_INFO, &cb->init_complaint,
+    c_release(LOG_INFO, &conn->init_complaint,
               "write_graphite plugin: Successfully connected to %s:%s via %s.",
               cb->node, cb->service, cb->protocol);
   }
 
-  /* wg_force_reconnect_check does not flush the buffer before closing a
-   * sending socket, so only call wg_reset_buffer() if the socket was closed
-   * for a different reason (tracked in cb->reconnect_interval_reached). */
-  if (!cb->reconnect_interval_reached || (cb->send_buf_free == 0))
-    wg_reset_buffer(cb);
-  else
-    cb->reconnect_interval_reached = false;
-
+  conn->sock_fd = fd;
+  conn->last_reconnect_time = cdtime();
   return 0;
 }
 
@@ -288,14 +367,17 @@ static void wg_callback_free(void *data) {
 
   cb = data;
 
-  pthread_mutex_lock(&cb->send_lock);
-
-  wg_flush_nolock(/* timeout = */ 0, cb);
+  for (size_t i = 0; (cb->conns != NULL) && (i < cb->conns_num); i++) {
+    struct wg_connection *conn = cb->conns + i;
 
-  if (cb->sock_fd >= 0) {
-    close(cb->sock_fd);
-    cb->sock_fd = -1;
+    pthread_mutex_lock(&conn->lock);
+    wg_flush_nolock(/* timeout = */ 0, conn);
+    wg_close(conn);
+    sfree(conn->buf);
+    pthread_mutex_unlock(&conn->lock);
+    pthread_mutex_destroy(&conn->lock);
   }
+  sfree(cb->conns);
 
   sfree(cb->name);
   sfree(cb->node);
@@ -304,9 +386,6 @@ static void wg_callback_free(void *data) {
   sfree(cb->prefix);
   sfree(cb->postfix);
 
-  pthread_mutex_unlock(&cb->send_lock);
-  pthread_mutex_destroy(&cb->send_lock);
-
   sfree(cb);
 }
 
@@ -314,78 +393,125 @@ static int wg_flush(cdtime_t timeout,
                     const char *identifier __attribute__((unused)),
                     user_data_t *user_data) {
   struct wg_callback *cb;
-  int status;
+  int ret = 0;
 
   if (user_data == NULL)
     return -EINVAL;
 
   cb = user_data->data;
 
-  pthread_mutex_lock(&cb->send_lock);
+  for (size_t i = 0; i < cb->conns_num; i++) {
+    struct wg_connection *conn = cb->conns + i;
+    int status;
 
-  if (cb->sock_fd < 0) {
-    status = wg_callback_init(cb);
-    if (status != 0) {
-      /* An error message has already been printed. */
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
+    pthread_mutex_lock(&conn->lock);
+
+    if (conn->sock_fd < 0) {
+      status = wg_connect(conn);
+      if (status != 0) {
+        /* An error message has already been printed. */
+        pthread_mutex_unlock(&conn->lock);
+        ret = -1;
+        continue;
+      }
     }
-  }
 
-  status = wg_flush_nolock(timeout, cb);
-  pthread_mutex_unlock(&cb->send_lock);
+    status = wg_flush_nolock(timeout, conn);
+    pthread_mutex_unlock(&conn->lock);
 
-  return status;
+    if (status != 0)
+      ret = status;
+  }
+
+  return ret;
 }
 
-static int wg_send_message(char const *message, struct wg_callback *cb) {
-  int status;
+/* wg_send_message appends a message to the connection's buffer and sends the
+ * buffer without blocking if it holds a packet's worth of data. If the
+ * connection is down, messages are kept until the backlog is full. */
+static int wg_send_message(char const *message, struct wg_connection *conn) {
+  struct wg_callback *cb = conn->cb;
   size_t message_len;
 
   message_len = strlen(message);
 
-  pthread_mutex_lock(&cb->send_lock);
+  pthread_mutex_lock(&conn->lock);
 
-  wg_force_reconnect_check(cb);
+  wg_force_reconnect_check(conn);
 
-  if (cb->sock_fd < 0) {
-    status = wg_callback_init(cb);
-    if (status != 0) {
-      /* An error message has already been printed. */
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
+  if (conn->sock_fd < 0)
+    wg_connect(conn); /* Errors are reported by wg_connect(). */
+
+  if (message_len > conn->buf_size - conn->buf_fill) {
+    wg_send_buffer(conn);
+
+    /* Move the unsent data to the front of the buffer. */
+    if (conn->buf_pos > 0) {
+      memmove(conn->buf, conn->buf + conn->buf_pos,
+              conn->buf_fill - conn->buf_pos);
+      conn->buf_fill -= conn->buf_pos;
+      conn->buf_pos = 0;
     }
   }
 
-  if (message_len >= cb->send_buf_free) {
-    status = wg_flush_nolock(/* timeout = */ 0, cb);
-    if (status != 0) {
-      pthread_mutex_unlock(&cb->send_lock);
-      return status;
-    }
+  if (message_len > conn->buf_size - conn->buf_fill) {
+    c_complain(LOG_WARNING, &conn->backlog_complaint,
+               "write_graphite plugin: The backlog for %s:%s (%s) is full, "
+               "dropping metrics.",
+               cb->node, cb->service, cb->protocol);
+    pthread_mutex_unlock(&conn->lock);
+    return -1;
   }
+  c_release(LOG_INFO, &conn->backlog_complaint,
+            "write_graphite plugin: The backlog for %s:%s (%s) accepts metrics "
+            "again.",
+            cb->node, cb->service, cb->protocol);
 
-  /* Assert that we have enough space for this message. */
-  assert(message_len < cb->send_buf_free);
+  if (conn->buf_pos >= conn->buf_fill)
+    conn->buf_init_time = cdtime();
 
-  /* `message_len + 1' because `message_len' does not include the
-   * trailing null byte. Neither does `send_buffer_fill'. */
-  memcpy(cb->send_buf + cb->send_buf_fill, message, message_len + 1);
-  cb->send_buf_fill += message_len;
-  cb->send_buf_free -= message_len;
+  memcpy(conn->buf + conn->buf_fill, message, message_len);
+  conn->buf_fill += message_len;
 
   DEBUG("write_graphite plugin: [%s]:%s (%s) buf %" PRIsz "/%" PRIsz
         " (%.1f %%) \"%s\"",
-        cb->node, cb->service, cb->protocol, cb->send_buf_fill,
-        sizeof(cb->send_buf),
-        100.0 * ((double)cb->send_buf_fill) / ((double)sizeof(cb->send_buf)),
+        cb->node, cb->service, cb->protocol, conn->buf_fill - conn->buf_pos,
+        conn->buf_size,
+        100.0 * ((double)(conn->buf_fill - conn->buf_pos)) /
+            ((double)conn->buf_size),
         message);
 
-  pthread_mutex_unlock(&cb->send_lock);
+  if (cb->stream && (conn->buf_fill - conn->buf_pos >= WG_SEND_BUF_SIZE))
+    wg_send_buffer(conn);
+
+  pthread_mutex_unlock(&conn->lock);
 
   return 0;
 }
 
+/* wg_connection_get returns the connection for a value list, chosen by the
+ * hash (FNV-1a) of its identifier. */
+static struct wg_connection *wg_connection_get(struct wg_callback *cb,
+                                               value_list_t const *vl) {
+  if (cb->conns_num == 1)
+    return cb->conns;
+
+  char const *fields[] = {vl->host, vl->plugin, vl->plugin_instance, vl->type,
+                          vl->type_instance};
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fields); i++) {
+    /* Include the null byte to separate the fields. */
+    for (char const *ptr = fields[i];; ptr++) {
+      hash ^= (uint8_t)*ptr;
+      hash *= 16777619u;
+      if (*ptr == 0)
+        break;
+    }
+  }
+
+  return cb->conns + (hash % cb->conns_num);
+}
+
 static int wg_write_messages(const data_set_t *ds, const value_list_t *vl,
                              struct wg_callback *cb) {
   char buffer[WG_SEND_BUF_SIZE] = {0};
@@ -403,7 +529,7 @@ static int wg_write_messages(const data_set_t *ds, const value_list_t *vl,
     return status;
 
   /* Send the message to graphite */
-  status = wg_send_message(buffer, cb);
+  status = wg_send_message(buffer, wg_connection_get(cb, vl));
   if (status != 0) /* error message has been printed already. */
     return status;
 
@@ -460,14 +586,13 @@ static int wg_config_node(oconfig_item_t *ci) {
     ERROR("write_graphite plugin: calloc failed.");
     return -1;
   }
-  cb->sock_fd = -1;
   cb->name = NULL;
   cb->node = strdup(WG_DEFAULT_NODE);
   cb->service = strdup(WG_DEFAULT_SERVICE);
   cb->protocol = strdup(WG_DEFAULT_PROTOCOL);
-  cb->last_reconnect_time = cdtime();
   cb->reconnect_interval = 0;
-  cb->reconnect_interval_reached = false;
+  cb->conns_num = WG_DEFAULT_CONNECTIONS;
+  cb->backlog_size = WG_DEFAULT_BACKLOG_SIZE;
   cb->log_send_errors = WG_DEFAULT_LOG_SEND_ERRORS;
   cb->prefix = NULL;
   cb->postfix = NULL;
@@ -483,9 +608,6 @@ static int wg_config_node(oconfig_item_t *ci) {
     }
   }
 
-  pthread_mutex_init(&cb->send_lock, /* attr = */ NULL);
-  C_COMPLAIN_INIT(&cb->init_complaint);
-
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
 
@@ -503,7 +625,26 @@ static int wg_config_node(oconfig_item_t *ci) {
       }
     } else if (strcasecmp("ReconnectInterval", child->key) == 0)
       cf_util_get_cdtime(child, &cb->reconnect_interval);
-    else if (strcasecmp("LogSendErrors", child->key) == 0)
+    else if (strcasecmp("Connections", child->key) == 0) {
+      int tmp = (int)cb->conns_num;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < 1)) {
+        ERROR("write_graphite plugin: \"Connections\" must be at least 1.");
+        status = -1;
+      }
+      if (status == 0)
+        cb->conns_num = (size_t)tmp;
+    } else if (strcasecmp("BacklogSize", child->key) == 0) {
+      int tmp = (int)cb->backlog_size;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < WG_SEND_BUF_SIZE)) {
+        ERROR("write_graphite plugin: \"BacklogSize\" must be at least %d.",
+              WG_SEND_BUF_SIZE);
+        status = -1;
+      }
+      if (status == 0)
+        cb->backlog_size = (size_t)tmp;
+    } else if (strcasecmp("LogSendErrors", child->key) == 0)
       cf_util_get_boolean(child, &cb->log_send_errors);
     else if (strcasecmp("Prefix", child->key) == 0)
       cf_util_get_string(child, &cb->prefix);
@@ -539,6 +680,35 @@ static int wg_config_node(oconfig_item_t *ci) {
     return status;
   }
 
+  cb->stream = (strcasecmp("TCP", cb->protocol) == 0);
+
+  cb->conns = calloc(cb->conns_num, sizeof(*cb->conns));
+  if (cb->conns == NULL) {
+    ERROR("write_graphite plugin: calloc failed.");
+    cb->conns_num = 0;
+    wg_callback_free(cb);
+    return -1;
+  }
+  for (size_t i = 0; i < cb->conns_num; i++) {
+    struct wg_connection *conn = cb->conns + i;
+
+    conn->cb = cb;
+    conn->sock_fd = -1;
+    pthread_mutex_init(&conn->lock, /* attr = */ NULL);
+    C_COMPLAIN_INIT(&conn->init_complaint);
+    C_COMPLAIN_INIT(&conn->backlog_complaint);
+    conn->buf_size = cb->stream ? cb->backlog_size : WG_SEND_BUF_SIZE;
+    conn->buf = malloc(conn->buf_size);
+    conn->buf_init_time = cdtime();
+    conn->last_reconnect_time = cdtime();
+    if (conn->buf == NULL) {
+      ERROR("write_graphite plugin: malloc failed.");
+      cb->conns_num = i + 1;
+      wg_callback_free(cb);
+      return -1;
+    }
+  }
+
   /* FIXME: Legacy configuration syntax. */
   if (cb->name == NULL)
     snprintf(callback_name, sizeof(callback_name), "write_graphite/%s/%s/%s",
@@ -27,15 +27,46 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_complain.h"
 #include "utils_format_json.h"
 #include "utils_format_kairosdb.h"
 
 #include <curl/curl.h>
 
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+/* curl_multi_poll() and curl_multi_wakeup() were added in libcurl 7.68.0.
+ * Without them, the sender thread polls the transfers in short intervals. */
+#if LIBCURL_VERSION_NUM >= 0x074400
+#define WH_HAVE_MULTI_WAKEUP 1
+#endif
+
 #ifndef WRITE_HTTP_DEFAULT_BUFFER_SIZE
 #define WRITE_HTTP_DEFAULT_BUFFER_SIZE 4096
 #endif
 
+#ifndef WRITE_HTTP_DEFAULT_BACKLOG_SIZE
+#define WRITE_HTTP_DEFAULT_BACKLOG_SIZE 1048576
+#endif
+
+#ifndef WRITE_HTTP_DEFAULT_CONNECTIONS
+#define WRITE_HTTP_DEFAULT_CONNECTIONS 1
+#endif
+
+#ifndef WRITE_HTTP_DEFAULT_MAX_RETRIES
+#define WRITE_HTTP_DEFAULT_MAX_RETRIES 3
+#endif
+
+#ifndef WRITE_HTTP_DEFAULT_RETRY_INTERVAL
+#define WRITE_HTTP_DEFAULT_RETRY_INTERVAL TIME_T_TO_CDTIME_T_STATIC(1)
+#endif
+
+/* The delay between retries doubles up to 2^WH_MAX_BACKOFF_SHIFT times the
+ * RetryInterval. */
+#define WH_MAX_BACKOFF_SHIFT 6
+
 #ifndef WRITE_HTTP_DEFAULT_PREFIX
 #define WRITE_HTTP_DEFAULT_PREFIX "collectd"
 #endif
@@ -43,6 +74,27 @@
 /*
  * Private variables
  */
+
+/* A filled send buffer (or a notification) waiting to be posted. */
+typedef struct wh_request_s wh_request_t;
+struct wh_request_s {
+  char *data;
+  size_t size;
+  bool compressed;
+  int attempts;
+  cdtime_t next_attempt;
+  wh_request_t *next;
+};
+
+/* Each in-flight request is posted with its own easy handle, so that up to
+ * "Connections" requests are sent concurrently. */
+typedef struct {
+  CURL *curl;
+  char curl_errbuf[CURL_ERROR_SIZE];
+  wh_request_t *request;
+  bool active;
+} wh_handle_t;
+
 struct wh_callback_s {
   char *name;
 
@@ -63,6 +115,11 @@ struct wh_callback_s {
   int low_speed_limit;
   time_t low_speed_time;
   int timeout;
+  int connections;
+  int max_retries;
+  cdtime_t retry_interval;
+  size_t backlog_size;
+  bool compress;
 
 #define WH_FORMAT_COMMAND 0
 #define WH_FORMAT_JSON 1
@@ -71,9 +128,7 @@ struct wh_callback_s {
   bool send_metrics;
   bool send_notifications;
 
-  CURL *curl;
   struct curl_slist *headers;
-  char curl_errbuf[CURL_ERROR_SIZE];
 
   char *send_buffer;
   size_t send_buffer_size;
@@ -83,6 +138,21 @@ struct wh_callback_s {
 
   pthread_mutex_t send_lock;
 
+  /* Filled buffers are queued and posted by the sender thread of the node,
+   * so that the write threads never wait for the HTTP server. `queue_lock'
+   * protects the queue and `sender_loop'. */
+  CURLM *multi;
+  wh_handle_t *handles;
+  pthread_t sender_thread;
+  bool sender_running;
+  bool sender_loop;
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;
+  wh_request_t *queue_head;
+  wh_request_t *queue_tail;
+  size_t queue_bytes;
+  c_complain_t backlog_complaint;
+
   int data_ttl;
   char *metrics_prefix;
 };
@@ -91,18 +161,6 @@ typedef struct wh_callback_s wh_callback_t;
 static char **http_attrs;
 static size_t http_attrs_num;
 
-static void wh_log_http_error(wh_callback_t *cb) {
-  if (!cb->log_http_error)
-    return;
-
-  long http_code = 0;
-
-  curl_easy_getinfo(cb->curl, CURLINFO_RESPONSE_CODE, &http_code);
-
-  if (http_code != 200)
-    INFO("write_http plugin: HTTP Error code: %lu", http_code);
-}
-
 static void wh_reset_buffer(wh_callback_t *cb) /* {{{ */
 {
   if ((cb == NULL) || (cb->send_buffer == NULL))
@@ -119,104 +177,429 @@ static void wh_reset_buffer(wh_callback_t *cb) /* {{{ */
   }
 } /* }}} wh_reset_buffer */
 
-/* must hold cb->send_lock when calling */
-static int wh_post_nolock(wh_callback_t *cb, char const *data) /* {{{ */
+static void wh_request_free(wh_request_t *req) /* {{{ */
 {
-  int status = 0;
+  if (req == NULL)
+    return;
+
+  sfree(req->data);
+  sfree(req);
+} /* }}} void wh_request_free */
 
-  curl_easy_setopt(cb->curl, CURLOPT_URL, cb->location);
-  curl_easy_setopt(cb->curl, CURLOPT_POSTFIELDS, data);
-  status = curl_easy_perform(cb->curl);
+#if HAVE_LIBZ
+/* Replaces the body of "req" with its gzip compressed version. */
+static int wh_compress(wh_request_t *req) /* {{{ */
+{
+  z_stream z = {0};
 
-  wh_log_http_error(cb);
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   /* gzip header = */ 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
 
-  if (status != CURLE_OK) {
-    ERROR("write_http plugin: curl_easy_perform failed with "
-          "status %i: %s",
-          status, cb->curl_errbuf);
+  size_t size = (size_t)deflateBound(&z, (uLong)req->size);
+  char *data = malloc(size);
+  if (data == NULL) {
+    deflateEnd(&z);
+    return ENOMEM;
   }
-  return status;
-} /* }}} wh_post_nolock */
 
-static int wh_callback_init(wh_callback_t *cb) /* {{{ */
+  z.next_in = (Bytef *)req->data;
+  z.avail_in = (uInt)req->size;
+  z.next_out = (Bytef *)data;
+  z.avail_out = (uInt)size;
+
+  int status = deflate(&z, Z_FINISH);
+  size = (size_t)z.total_out;
+  deflateEnd(&z);
+  if (status != Z_STREAM_END) {
+    sfree(data);
+    return -1;
+  }
+
+  sfree(req->data);
+  req->data = data;
+  req->size = size;
+  req->compressed = true;
+  return 0;
+} /* }}} int wh_compress */
+#endif
+
+static void wh_sender_wakeup(wh_callback_t *cb) /* {{{ */
 {
-  if (cb->curl != NULL)
-    return 0;
+#ifdef WH_HAVE_MULTI_WAKEUP
+  if (cb->multi != NULL)
+    curl_multi_wakeup(cb->multi);
+#endif
+} /* }}} void wh_sender_wakeup */
+
+/* Queues a copy of "data" to be posted by the sender thread. If the backlog is
+ * full, the oldest queued requests are dropped. */
+static int wh_post(wh_callback_t *cb, char const *data) /* {{{ */
+{
+  wh_request_t *req = calloc(1, sizeof(*req));
+  if (req == NULL) {
+    ERROR("write_http plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  req->size = strlen(data);
+  req->data = malloc(req->size + 1);
+  if (req->data == NULL) {
+    ERROR("write_http plugin: malloc failed.");
+    sfree(req);
+    return ENOMEM;
+  }
+  memcpy(req->data, data, req->size + 1);
+
+  pthread_mutex_lock(&cb->queue_lock);
+
+  bool dropped = false;
+  while ((cb->queue_head != NULL) &&
+         ((cb->queue_bytes + req->size) > cb->backlog_size)) {
+    wh_request_t *old = cb->queue_head;
+
+    cb->queue_head = old->next;
+    if (cb->queue_head == NULL)
+      cb->queue_tail = NULL;
+    cb->queue_bytes -= old->size;
+    wh_request_free(old);
+    dropped = true;
+  }
+
+  if (dropped)
+    c_complain(LOG_WARNING, &cb->backlog_complaint,
+               "write_http plugin: The backlog of <%s> is full. "
+               "Dropping the oldest requests.",
+               cb->location);
+  else
+    c_release(LOG_INFO, &cb->backlog_complaint,
+              "write_http plugin: The backlog of <%s> is no longer full.",
+              cb->location);
+
+  if (cb->queue_tail == NULL)
+    cb->queue_head = req;
+  else
+    cb->queue_tail->next = req;
+  cb->queue_tail = req;
+  cb->queue_bytes += req->size;
+
+  pthread_cond_signal(&cb->queue_cond);
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  wh_sender_wakeup(cb);
+  return 0;
+} /* }}} int wh_post */
+
+/* Removes the first request which is due from the queue. Requests waiting for
+ * a retry are due at their `next_attempt' time, which is reported in
+ * "next_attempt". When shutting down, all requests are due.
+ * Must hold cb->queue_lock when calling. */
+static wh_request_t *wh_queue_take_nolock(wh_callback_t *cb, cdtime_t now,
+                                          cdtime_t *next_attempt) /* {{{ */
+{
+  wh_request_t *prev = NULL;
+
+  for (wh_request_t *req = cb->queue_head; req != NULL;
+       prev = req, req = req->next) {
+    if (cb->sender_loop && (req->next_attempt > now)) {
+      if ((*next_attempt == 0) || (req->next_attempt < *next_attempt))
+        *next_attempt = req->next_attempt;
+      continue;
+    }
+
+    if (prev == NULL)
+      cb->queue_head = req->next;
+    else
+      prev->next = req->next;
+    if (cb->queue_tail == req)
+      cb->queue_tail = prev;
+    cb->queue_bytes -= req->size;
+
+    req->next = NULL;
+    return req;
+  }
+
+  return NULL;
+} /* }}} wh_request_t *wh_queue_take_nolock */
+
+static int wh_handle_start(wh_callback_t *cb, wh_handle_t *h) /* {{{ */
+{
+  wh_request_t *req = h->request;
+
+#if HAVE_LIBZ
+  if (cb->compress && !req->compressed) {
+    if (wh_compress(req) != 0) {
+      ERROR("write_http plugin: Compressing a request to <%s> failed.",
+            cb->location);
+      return -1;
+    }
+  }
+#endif
+
+  curl_easy_setopt(h->curl, CURLOPT_POSTFIELDS, req->data);
+  curl_easy_setopt(h->curl, CURLOPT_POSTFIELDSIZE, (long)req->size);
+  h->curl_errbuf[0] = 0;
+
+  CURLMcode status = curl_multi_add_handle(cb->multi, h->curl);
+  if (status != CURLM_OK) {
+    ERROR("write_http plugin: curl_multi_add_handle failed: %s",
+          curl_multi_strerror(status));
+    return -1;
+  }
+
+  req->attempts++;
+  h->active = true;
+  return 0;
+} /* }}} int wh_handle_start */
+
+/* Called by the sender thread when the request on "h" has completed. Failed
+ * requests are queued again with exponential backoff, up to "MaxRetries"
+ * times. */
+static void wh_handle_done(wh_callback_t *cb, wh_handle_t *h, /* {{{ */
+                           CURLcode result) {
+  wh_request_t *req = h->request;
+  long http_code = 0;
+  bool failed;
+
+  curl_easy_getinfo(h->curl, CURLINFO_RESPONSE_CODE, &http_code);
+  curl_multi_remove_handle(cb->multi, h->curl);
+  h->request = NULL;
+  h->active = false;
+
+  if (cb->log_http_error && (http_code != 200))
+    INFO("write_http plugin: HTTP Error code: %lu", http_code);
+
+  if (result != CURLE_OK) {
+    ERROR("write_http plugin: Posting to <%s> failed with status %i: %s",
+          cb->location, result,
+          (h->curl_errbuf[0] != 0) ? h->curl_errbuf
+                                   : curl_easy_strerror(result));
+    failed = true;
+  } else {
+    /* Server errors and throttling are temporary. Other HTTP errors are not
+     * worth retrying. */
+    failed = (http_code >= 500) || (http_code == 408) || (http_code == 429);
+  }
+
+  if (!failed) {
+    wh_request_free(req);
+    return;
+  }
+
+  pthread_mutex_lock(&cb->queue_lock);
+  if (cb->sender_loop && (req->attempts <= cb->max_retries)) {
+    int shift = req->attempts - 1;
+    if (shift > WH_MAX_BACKOFF_SHIFT)
+      shift = WH_MAX_BACKOFF_SHIFT;
+    req->next_attempt = cdtime() + (cb->retry_interval << shift);
+
+    req->next = cb->queue_head;
+    cb->queue_head = req;
+    if (cb->queue_tail == NULL)
+      cb->queue_tail = req;
+    cb->queue_bytes += req->size;
+    pthread_mutex_unlock(&cb->queue_lock);
+    return;
+  }
+  pthread_mutex_unlock(&cb->queue_lock);
 
-  cb->curl = curl_easy_init();
-  if (cb->curl == NULL) {
+  ERROR("write_http plugin: Giving up on a request to <%s> after %i "
+        "attempt(s).",
+        cb->location, req->attempts);
+  wh_request_free(req);
+} /* }}} void wh_handle_done */
+
+static void *wh_sender_thread(void *arg) /* {{{ */
+{
+  wh_callback_t *cb = arg;
+  int running = 0;
+
+  pthread_mutex_lock(&cb->queue_lock);
+  while (cb->sender_loop || (cb->queue_head != NULL) || (running > 0)) {
+    cdtime_t now = cdtime();
+    cdtime_t next_attempt = 0;
+    int taken = 0;
+
+    for (int i = 0; i < cb->connections; i++) {
+      wh_handle_t *h = cb->handles + i;
+      if (h->request != NULL)
+        continue;
+
+      h->request = wh_queue_take_nolock(cb, now, &next_attempt);
+      if (h->request == NULL)
+        break;
+      taken++;
+    }
+
+    if ((running == 0) && (taken == 0)) {
+      if (!cb->sender_loop)
+        break;
+
+      if (next_attempt == 0) {
+        pthread_cond_wait(&cb->queue_cond, &cb->queue_lock);
+      } else {
+        struct timespec ts = CDTIME_T_TO_TIMESPEC(next_attempt);
+        pthread_cond_timedwait(&cb->queue_cond, &cb->queue_lock, &ts);
+      }
+      continue;
+    }
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    for (int i = 0; i < cb->connections; i++) {
+      wh_handle_t *h = cb->handles + i;
+      if ((h->request == NULL) || h->active)
+        continue;
+
+      if (wh_handle_start(cb, h) == 0) {
+        running++;
+      } else {
+        wh_request_free(h->request);
+        h->request = NULL;
+      }
+    }
+
+    int still_running = 0;
+    curl_multi_perform(cb->multi, &still_running);
+
+    CURLMsg *msg;
+    int msgs_left = 0;
+    while ((msg = curl_multi_info_read(cb->multi, &msgs_left)) != NULL) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      /* "msg" is invalidated by curl_multi_remove_handle(). */
+      CURL *curl = msg->easy_handle;
+      CURLcode result = msg->data.result;
+      for (int i = 0; i < cb->connections; i++) {
+        if (cb->handles[i].curl != curl)
+          continue;
+        wh_handle_done(cb, cb->handles + i, result);
+        running--;
+        break;
+      }
+    }
+
+    if (running > 0) {
+#ifdef WH_HAVE_MULTI_WAKEUP
+      curl_multi_poll(cb->multi, NULL, 0, /* timeout_ms = */ 1000, NULL);
+#else
+      curl_multi_wait(cb->multi, NULL, 0, /* timeout_ms = */ 100, NULL);
+#endif
+    }
+
+    pthread_mutex_lock(&cb->queue_lock);
+  }
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  return NULL;
+} /* }}} void *wh_sender_thread */
+
+static int wh_curl_init(wh_callback_t *cb, wh_handle_t *h) /* {{{ */
+{
+  h->curl = curl_easy_init();
+  if (h->curl == NULL) {
     ERROR("curl plugin: curl_easy_init failed.");
     return -1;
   }
 
   if (cb->low_speed_limit > 0 && cb->low_speed_time > 0) {
-    curl_easy_setopt(cb->curl, CURLOPT_LOW_SPEED_LIMIT,
+    curl_easy_setopt(h->curl, CURLOPT_LOW_SPEED_LIMIT,
                      (long)(cb->low_speed_limit * cb->low_speed_time));
-    curl_easy_setopt(cb->curl, CURLOPT_LOW_SPEED_TIME,
+    curl_easy_setopt(h->curl, CURLOPT_LOW_SPEED_TIME,
                      (long)cb->low_speed_time);
   }
 
 #ifdef HAVE_CURLOPT_TIMEOUT_MS
   if (cb->timeout > 0)
-    curl_easy_setopt(cb->curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
+    curl_easy_setopt(h->curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
 #endif
 
-  curl_easy_setopt(cb->curl, CURLOPT_NOSIGNAL, 1L);
-  curl_easy_setopt(cb->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  curl_easy_setopt(h->curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(h->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  curl_easy_setopt(h->curl, CURLOPT_URL, cb->location);
+  curl_easy_setopt(h->curl, CURLOPT_HTTPHEADER, cb->headers);
 
-  cb->headers = curl_slist_append(cb->headers, "Accept:  */*");
-  if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB)
-    cb->headers =
-        curl_slist_append(cb->headers, "Content-Type: application/json");
-  else
-    cb->headers = curl_slist_append(cb->headers, "Content-Type: text/plain");
-  cb->headers = curl_slist_append(cb->headers, "Expect:");
-  curl_easy_setopt(cb->curl, CURLOPT_HTTPHEADER, cb->headers);
-
-  curl_easy_setopt(cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
-  curl_easy_setopt(cb->curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(cb->curl, CURLOPT_MAXREDIRS, 50L);
+  curl_easy_setopt(h->curl, CURLOPT_ERRORBUFFER, h->curl_errbuf);
+  curl_easy_setopt(h->curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(h->curl, CURLOPT_MAXREDIRS, 50L);
 
   if (cb->user != NULL) {
 #ifdef HAVE_CURLOPT_USERNAME
-    curl_easy_setopt(cb->curl, CURLOPT_USERNAME, cb->user);
-    curl_easy_setopt(cb->curl, CURLOPT_PASSWORD,
+    curl_easy_setopt(h->curl, CURLOPT_USERNAME, cb->user);
+    curl_easy_setopt(h->curl, CURLOPT_PASSWORD,
                      (cb->pass == NULL) ? "" : cb->pass);
 #else
-    size_t credentials_size;
+    if (cb->credentials == NULL) {
+      size_t credentials_size;
 
-    credentials_size = strlen(cb->user) + 2;
-    if (cb->pass != NULL)
-      credentials_size += strlen(cb->pass);
+      credentials_size = strlen(cb->user) + 2;
+      if (cb->pass != NULL)
+        credentials_size += strlen(cb->pass);
 
-    cb->credentials = malloc(credentials_size);
-    if (cb->credentials == NULL) {
-      ERROR("curl plugin: malloc failed.");
-      return -1;
-    }
+      cb->credentials = malloc(credentials_size);
+      if (cb->credentials == NULL) {
+        ERROR("curl plugin: malloc failed.");
+        return -1;
+      }
 
-    snprintf(cb->credentials, credentials_size, "%s:%s", cb->user,
-             (cb->pass == NULL) ? "" : cb->pass);
-    curl_easy_setopt(cb->curl, CURLOPT_USERPWD, cb->credentials);
+      snprintf(cb->credentials, credentials_size, "%s:%s", cb->user,
+               (cb->pass == NULL) ? "" : cb->pass);
+    }
+    curl_easy_setopt(h->curl, CURLOPT_USERPWD, cb->credentials);
 #endif
-    curl_easy_setopt(cb->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+    curl_easy_setopt(h->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
   }
 
-  curl_easy_setopt(cb->curl, CURLOPT_SSL_VERIFYPEER, (long)cb->verify_peer);
-  curl_easy_setopt(cb->curl, CURLOPT_SSL_VERIFYHOST, cb->verify_host ? 2L : 0L);
-  curl_easy_setopt(cb->curl, CURLOPT_SSLVERSION, cb->sslversion);
+  curl_easy_setopt(h->curl, CURLOPT_SSL_VERIFYPEER, (long)cb->verify_peer);
+  curl_easy_setopt(h->curl, CURLOPT_SSL_VERIFYHOST, cb->verify_host ? 2L : 0L);
+  curl_easy_setopt(h->curl, CURLOPT_SSLVERSION, cb->sslversion);
   if (cb->cacert != NULL)
-    curl_easy_setopt(cb->curl, CURLOPT_CAINFO, cb->cacert);
+    curl_easy_setopt(h->curl, CURLOPT_CAINFO, cb->cacert);
   if (cb->capath != NULL)
-    curl_easy_setopt(cb->curl, CURLOPT_CAPATH, cb->capath);
+    curl_easy_setopt(h->curl, CURLOPT_CAPATH, cb->capath);
 
   if (cb->clientkey != NULL && cb->clientcert != NULL) {
-    curl_easy_setopt(cb->curl, CURLOPT_SSLKEY, cb->clientkey);
-    curl_easy_setopt(cb->curl, CURLOPT_SSLCERT, cb->clientcert);
+    curl_easy_setopt(h->curl, CURLOPT_SSLKEY, cb->clientkey);
+    curl_easy_setopt(h->curl, CURLOPT_SSLCERT, cb->clientcert);
 
     if (cb->clientkeypass != NULL)
-      curl_easy_setopt(cb->curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+      curl_easy_setopt(h->curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+  }
+
+  return 0;
+} /* }}} int wh_curl_init */
+
+/* Sets up the curl handles and starts the sender thread.
+ * Must hold cb->send_lock when calling. */
+static int wh_callback_init(wh_callback_t *cb) /* {{{ */
+{
+  if (cb->sender_running)
+    return 0;
+
+  if (cb->multi == NULL) {
+    cb->multi = curl_multi_init();
+    if (cb->multi == NULL) {
+      ERROR("write_http plugin: curl_multi_init failed.");
+      return -1;
+    }
+  }
+
+  for (int i = 0; i < cb->connections; i++) {
+    if (cb->handles[i].curl != NULL)
+      continue;
+    if (wh_curl_init(cb, cb->handles + i) != 0)
+      return -1;
+  }
+
+  cb->sender_loop = true;
+  int status = plugin_thread_create(&cb->sender_thread, /* attr = */ NULL,
+                                    wh_sender_thread, cb, "write_http");
+  if (status != 0) {
+    ERROR("write_http plugin: Starting the sender thread failed: %s",
+          STRERROR(status));
+    return -1;
   }
+  cb->sender_running = true;
 
   wh_reset_buffer(cb);
 
@@ -246,7 +629,7 @@ static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
       return 0;
     }
 
-    status = wh_post_nolock(cb, cb->send_buffer);
+    status = wh_post(cb, cb->send_buffer);
     wh_reset_buffer(cb);
   } else if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB) {
     if (cb->send_buffer_fill <= 2) {
@@ -263,7 +646,7 @@ static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
       return status;
     }
 
-    status = wh_post_nolock(cb, cb->send_buffer);
+    status = wh_post(cb, cb->send_buffer);
     wh_reset_buffer(cb);
   } else {
     ERROR("write_http: wh_flush_nolock: "
@@ -312,9 +695,36 @@ static void wh_callback_free(void *data) /* {{{ */
   if (cb->send_buffer != NULL)
     wh_flush_nolock(/* timeout = */ 0, cb);
 
-  if (cb->curl != NULL) {
-    curl_easy_cleanup(cb->curl);
-    cb->curl = NULL;
+  /* The sender thread tries to post each remaining request once more before
+   * it exits. */
+  if (cb->sender_running) {
+    pthread_mutex_lock(&cb->queue_lock);
+    cb->sender_loop = false;
+    pthread_cond_signal(&cb->queue_cond);
+    pthread_mutex_unlock(&cb->queue_lock);
+    wh_sender_wakeup(cb);
+
+    pthread_join(cb->sender_thread, /* retval = */ NULL);
+    cb->sender_running = false;
+  }
+
+  while (cb->queue_head != NULL) {
+    wh_request_t *req = cb->queue_head;
+    cb->queue_head = req->next;
+    wh_request_free(req);
+  }
+  cb->queue_tail = NULL;
+
+  if (cb->handles != NULL) {
+    for (int i = 0; i < cb->connections; i++)
+      if (cb->handles[i].curl != NULL)
+        curl_easy_cleanup(cb->handles[i].curl);
+    sfree(cb->handles);
+  }
+
+  if (cb->multi != NULL) {
+    curl_multi_cleanup(cb->multi);
+    cb->multi = NULL;
   }
 
   if (cb->headers != NULL) {
@@ -322,6 +732,9 @@ static void wh_callback_free(void *data) /* {{{ */
     cb->headers = NULL;
   }
 
+  pthread_cond_destroy(&cb->queue_cond);
+  pthread_mutex_destroy(&cb->queue_lock);
+
   sfree(cb->name);
   sfree(cb->location);
   sfree(cb->user);
@@ -470,13 +883,10 @@ static int wh_write_kairosdb(const data_set_t *ds,
 
   pthread_mutex_lock(&cb->send_lock);
 
-  if (cb->curl == NULL) {
-    status = wh_callback_init(cb);
-    if (status != 0) {
-      ERROR("write_http plugin: wh_callback_init failed.");
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
-    }
+  if (wh_callback_init(cb) != 0) {
+    ERROR("write_http plugin: wh_callback_init failed.");
+    pthread_mutex_unlock(&cb->send_lock);
+    return -1;
   }
 
   status = format_kairosdb_value_list(
@@ -562,7 +972,7 @@ static int wh_notify(notification_t const *n, user_data_t *ud) /* {{{ */
     return -1;
   }
 
-  status = wh_post_nolock(cb, alert);
+  status = wh_post(cb, alert);
   pthread_mutex_unlock(&cb->send_lock);
 
   return status;
@@ -616,6 +1026,7 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
 {
   wh_callback_t *cb;
   int buffer_size = 0;
+  int backlog_size = 0;
   char callback_name[DATA_MAX_NAME_LEN];
   int status = 0;
 
@@ -635,6 +1046,12 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   cb->send_metrics = true;
   cb->send_notifications = false;
   cb->data_ttl = 0;
+  cb->connections = WRITE_HTTP_DEFAULT_CONNECTIONS;
+  cb->max_retries = WRITE_HTTP_DEFAULT_MAX_RETRIES;
+  cb->retry_interval = WRITE_HTTP_DEFAULT_RETRY_INTERVAL;
+  cb->backlog_size = WRITE_HTTP_DEFAULT_BACKLOG_SIZE;
+  cb->compress = false;
+  C_COMPLAIN_INIT(&cb->backlog_complaint);
   cb->metrics_prefix = strdup(WRITE_HTTP_DEFAULT_PREFIX);
 
   if (cb->metrics_prefix == NULL) {
@@ -644,6 +1061,8 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   }
 
   pthread_mutex_init(&cb->send_lock, /* attr = */ NULL);
+  pthread_mutex_init(&cb->queue_lock, /* attr = */ NULL);
+  pthread_cond_init(&cb->queue_cond, /* attr = */ NULL);
 
   cf_util_get_string(ci, &cb->name);
 
@@ -722,6 +1141,16 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_int(child, &cb->timeout);
     else if (strcasecmp("LogHttpError", child->key) == 0)
       status = cf_util_get_boolean(child, &cb->log_http_error);
+    else if (strcasecmp("Connections", child->key) == 0)
+      status = cf_util_get_int(child, &cb->connections);
+    else if (strcasecmp("MaxRetries", child->key) == 0)
+      status = cf_util_get_int(child, &cb->max_retries);
+    else if (strcasecmp("RetryInterval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &cb->retry_interval);
+    else if (strcasecmp("BacklogSize", child->key) == 0)
+      status = cf_util_get_int(child, &backlog_size);
+    else if (strcasecmp("Compress", child->key) == 0)
+      status = cf_util_get_boolean(child, &cb->compress);
     else if (strcasecmp("Header", child->key) == 0)
       status = wh_config_append_string("Header", &cb->headers, child);
     else if (strcasecmp("Attribute", child->key) == 0) {
@@ -799,6 +1228,54 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
     ERROR("write_http plugin: Ignoring invalid BufferSize setting (%d).",
           buffer_size);
 
+  if (cb->connections < 1) {
+    ERROR("write_http plugin: Connections must be at least 1.");
+    wh_callback_free(cb);
+    return -1;
+  }
+
+  if (cb->max_retries < 0) {
+    ERROR("write_http plugin: MaxRetries must not be negative.");
+    wh_callback_free(cb);
+    return -1;
+  }
+
+  if (cb->retry_interval == 0)
+    cb->retry_interval = WRITE_HTTP_DEFAULT_RETRY_INTERVAL;
+
+  if (backlog_size > 0)
+    cb->backlog_size = (size_t)backlog_size;
+  else if (backlog_size < 0)
+    ERROR("write_http plugin: Ignoring invalid BacklogSize setting (%d).",
+          backlog_size);
+  if (cb->backlog_size < cb->send_buffer_size)
+    cb->backlog_size = cb->send_buffer_size;
+
+#if !HAVE_LIBZ
+  if (cb->compress) {
+    WARNING("write_http plugin: Compress is not supported, because the plugin "
+            "has been built without zlib.");
+    cb->compress = false;
+  }
+#endif
+
+  cb->headers = curl_slist_append(cb->headers, "Accept:  */*");
+  if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB)
+    cb->headers =
+        curl_slist_append(cb->headers, "Content-Type: application/json");
+  else
+    cb->headers = curl_slist_append(cb->headers, "Content-Type: text/plain");
+  if (cb->compress)
+    cb->headers = curl_slist_append(cb->headers, "Content-Encoding: gzip");
+  cb->headers = curl_slist_append(cb->headers, "Expect:");
+
+  cb->handles = calloc((size_t)cb->connections, sizeof(*cb->handles));
+  if (cb->handles == NULL) {
+    ERROR("write_http plugin: calloc failed.");
+    wh_callback_free(cb);
+    return -1;
+  }
+
   /* Allocate the buffer. */
   cb->send_buffer = malloc(cb->send_buffer_size);
   if (cb->send_buffer == NULL) {
@@ -37,6 +37,27 @@
 #include <librdkafka/rdkafka.h>
 #include <stdint.h>
 
+/* Room reserved in a message buffer before a value list is formatted into it.
+ * This is the size of the stack buffer single messages used to be formatted
+ * into. */
+#define KAFKA_MESSAGE_SIZE 8192
+
+/* Number of batches a topic without a configured key spreads its value lists
+ * over. Value lists are assigned to a batch by their identifier hash, and each
+ * batch is sent with its own key, so the same identifier always ends up in the
+ * same partition. */
+#define KAFKA_BATCH_SLOTS 64
+
+struct kafka_batch_s {
+  pthread_mutex_t lock;
+  char *data;
+  size_t size;
+  size_t fill;
+  size_t count;
+  char key[9]; /* 8 byte hex string + null byte */
+};
+typedef struct kafka_batch_s kafka_batch_t;
+
 struct kafka_topic_context {
 #define KAFKA_FORMAT_JSON 0
 #define KAFKA_FORMAT_COMMAND 1
@@ -54,6 +75,10 @@ struct kafka_topic_context {
   char escape_char;
   char *topic_name;
   pthread_mutex_t lock;
+
+  size_t batch_size;
+  kafka_batch_t *batches;
+  size_t batches_num;
 };
 
 static int kafka_handle(struct kafka_topic_context *);
@@ -170,70 +195,262 @@ static int kafka_handle(struct kafka_topic_context *ctx) /* {{{ */
 
 } /* }}} int kafka_handle */
 
-static int kafka_write(const data_set_t *ds, /* {{{ */
-                       const value_list_t *vl, user_data_t *ud) {
-  int status = 0;
-  void *key;
-  size_t keylen = 0;
-  char buffer[8192];
-  size_t bfree = sizeof(buffer);
-  size_t bfill = 0;
-  size_t blen = 0;
-  struct kafka_topic_context *ctx = ud->data;
+/* Hands "data" over to librdkafka, which frees it once the message has been
+ * delivered. On failure the caller still owns "data". */
+static int kafka_produce(struct kafka_topic_context *ctx, /* {{{ */
+                         char *data, size_t data_len, const char *key) {
+  int status;
 
-  if ((ds == NULL) || (vl == NULL) || (ctx == NULL))
-    return EINVAL;
+  status = rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA,
+                            RD_KAFKA_MSG_F_FREE, data, data_len, key,
+                            strlen(key), NULL);
+  if (status != 0) {
+    ERROR("write_kafka plugin: rd_kafka_produce (topic \"%s\") failed: %s",
+          ctx->topic_name, rd_kafka_err2str(kafka_error()));
+    return -1;
+  }
 
-  pthread_mutex_lock(&ctx->lock);
-  status = kafka_handle(ctx);
-  pthread_mutex_unlock(&ctx->lock);
-  if (status != 0)
-    return status;
+  return 0;
+} /* }}} int kafka_produce */
+
+/* Makes sure there is room for another value list in "data". */
+static int kafka_buffer_reserve(char **data, size_t *size, /* {{{ */
+                                size_t fill) {
+  size_t new_size;
+  char *tmp;
 
-  bzero(buffer, sizeof(buffer));
+  if ((*data != NULL) && (*size - fill >= KAFKA_MESSAGE_SIZE))
+    return 0;
+
+  new_size = (*size > 0) ? 2 * (*size) : KAFKA_MESSAGE_SIZE;
+  while (new_size - fill < KAFKA_MESSAGE_SIZE)
+    new_size *= 2;
+
+  tmp = realloc(*data, new_size);
+  if (tmp == NULL)
+    return ENOMEM;
+
+  *data = tmp;
+  *size = new_size;
+  return 0;
+} /* }}} int kafka_buffer_reserve */
+
+/* Appends the formatted value list to "buffer". "count" is the number of value
+ * lists already in the buffer. On failure "buffer" is left unchanged. */
+static int kafka_format(struct kafka_topic_context *ctx, /* {{{ */
+                        char *buffer, size_t buffer_size, size_t *fill,
+                        size_t count, const data_set_t *ds,
+                        const value_list_t *vl) {
+  size_t bfill = *fill;
+  size_t bfree = buffer_size - bfill;
+  size_t len;
+  int status;
 
   switch (ctx->format) {
   case KAFKA_FORMAT_COMMAND:
-    status = cmd_create_putval(buffer, sizeof(buffer), ds, vl);
+    if (count > 0) {
+      buffer[bfill] = '\n';
+      bfill++;
+      bfree--;
+    }
+    status = cmd_create_putval(buffer + bfill, bfree, ds, vl);
     if (status != 0) {
       ERROR("write_kafka plugin: cmd_create_putval failed with status %i.",
             status);
+      buffer[*fill] = 0;
       return status;
     }
-    blen = strlen(buffer);
+    len = strlen(buffer + bfill);
+    *fill = bfill + len;
     break;
   case KAFKA_FORMAT_JSON:
-    format_json_initialize(buffer, &bfill, &bfree);
-    format_json_value_list(buffer, &bfill, &bfree, ds, vl, ctx->store_rates);
-    format_json_finalize(buffer, &bfill, &bfree);
-    blen = strlen(buffer);
+    if (count == 0)
+      format_json_initialize(buffer, &bfill, &bfree);
+    status = format_json_value_list(buffer, &bfill, &bfree, ds, vl,
+                                    ctx->store_rates);
+    if (status != 0) {
+      ERROR("write_kafka plugin: format_json_value_list failed with "
+            "status %i.",
+            status);
+      buffer[*fill] = 0;
+      return status;
+    }
+    *fill = bfill;
     break;
   case KAFKA_FORMAT_GRAPHITE:
     status =
-        format_graphite(buffer, sizeof(buffer), ds, vl, ctx->prefix,
+        format_graphite(buffer + bfill, bfree, ds, vl, ctx->prefix,
                         ctx->postfix, ctx->escape_char, ctx->graphite_flags);
     if (status != 0) {
       ERROR("write_kafka plugin: format_graphite failed with status %i.",
             status);
+      buffer[*fill] = 0;
       return status;
     }
-    blen = strlen(buffer);
+    *fill = bfill + strlen(buffer + bfill);
     break;
   default:
     ERROR("write_kafka plugin: invalid format %i.", ctx->format);
     return -1;
   }
 
-  key =
-      (ctx->key != NULL) ? ctx->key : kafka_random_key(KAFKA_RANDOM_KEY_BUFFER);
-  keylen = strlen(key);
+  return 0;
+} /* }}} int kafka_format */
+
+/* Closes the message in "buffer" and shrinks it to its final size, so that
+ * librdkafka doesn't hold on to the reserved room while the message is
+ * queued. */
+static char *kafka_message_finish(struct kafka_topic_context *ctx, /* {{{ */
+                                  char *buffer, size_t buffer_size,
+                                  size_t *fill) {
+  char *tmp;
+
+  if (ctx->format == KAFKA_FORMAT_JSON) {
+    size_t bfree = buffer_size - *fill;
+    format_json_finalize(buffer, fill, &bfree);
+  }
+
+  tmp = realloc(buffer, *fill + 1);
+  return (tmp != NULL) ? tmp : buffer;
+} /* }}} char *kafka_message_finish */
+
+/* Sends the value lists collected in "batch". The caller must hold
+ * batch->lock. */
+static int kafka_batch_send(struct kafka_topic_context *ctx, /* {{{ */
+                            kafka_batch_t *batch) {
+  char *data;
+  size_t fill;
+  int status;
+
+  if (batch->count == 0)
+    return 0;
+
+  fill = batch->fill;
+  data = kafka_message_finish(ctx, batch->data, batch->size, &fill);
 
-  rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
-                   buffer, blen, key, keylen, NULL);
+  batch->data = NULL;
+  batch->size = 0;
+  batch->fill = 0;
+  batch->count = 0;
+
+  status = kafka_produce(ctx, data, fill,
+                         (ctx->key != NULL) ? ctx->key : batch->key);
+  if (status != 0)
+    sfree(data);
+
+  return status;
+} /* }}} int kafka_batch_send */
+
+static uint32_t kafka_identifier_hash(const value_list_t *vl) /* {{{ */
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+
+  if (vl->identifier.hash != 0)
+    return vl->identifier.hash;
+
+  if (FORMAT_VL(name, sizeof(name), vl) != 0)
+    return 0;
+  return kafka_hash(name, strlen(name));
+} /* }}} uint32_t kafka_identifier_hash */
+
+static int kafka_write_single(struct kafka_topic_context *ctx, /* {{{ */
+                              const data_set_t *ds, const value_list_t *vl) {
+  char key[KAFKA_RANDOM_KEY_SIZE];
+  char *data = NULL;
+  size_t size = 0;
+  size_t fill = 0;
+  int status;
+
+  if (kafka_buffer_reserve(&data, &size, fill) != 0) {
+    ERROR("write_kafka plugin: malloc failed.");
+    return ENOMEM;
+  }
+  data[0] = 0;
+
+  status = kafka_format(ctx, data, size, &fill, /* count = */ 0, ds, vl);
+  if (status != 0) {
+    sfree(data);
+    return status;
+  }
+  data = kafka_message_finish(ctx, data, size, &fill);
+
+  if (ctx->key == NULL)
+    snprintf(key, sizeof(key), "%08" PRIX32, kafka_identifier_hash(vl));
+
+  status =
+      kafka_produce(ctx, data, fill, (ctx->key != NULL) ? ctx->key : key);
+  if (status != 0)
+    sfree(data);
+
+  return status;
+} /* }}} int kafka_write_single */
+
+static int kafka_write(const data_set_t *ds, /* {{{ */
+                       const value_list_t *vl, user_data_t *ud) {
+  int status = 0;
+  struct kafka_topic_context *ctx = ud->data;
+  kafka_batch_t *batch;
+
+  if ((ds == NULL) || (vl == NULL) || (ctx == NULL))
+    return EINVAL;
+
+  pthread_mutex_lock(&ctx->lock);
+  status = kafka_handle(ctx);
+  pthread_mutex_unlock(&ctx->lock);
+  if (status != 0)
+    return status;
+
+  if (ctx->batch_size <= 1)
+    return kafka_write_single(ctx, ds, vl);
+
+  batch = ctx->batches;
+  if (ctx->batches_num > 1)
+    batch += kafka_identifier_hash(vl) % ctx->batches_num;
+
+  pthread_mutex_lock(&batch->lock);
+
+  if (kafka_buffer_reserve(&batch->data, &batch->size, batch->fill) != 0) {
+    pthread_mutex_unlock(&batch->lock);
+    ERROR("write_kafka plugin: realloc failed.");
+    return ENOMEM;
+  }
+  if (batch->count == 0)
+    batch->data[0] = 0;
+
+  status = kafka_format(ctx, batch->data, batch->size, &batch->fill,
+                        batch->count, ds, vl);
+  if (status == 0) {
+    batch->count++;
+    if (batch->count >= ctx->batch_size)
+      status = kafka_batch_send(ctx, batch);
+  }
+
+  pthread_mutex_unlock(&batch->lock);
 
   return status;
 } /* }}} int kafka_write */
 
+static int kafka_flush(cdtime_t timeout, /* {{{ */
+                       const char *identifier __attribute__((unused)),
+                       user_data_t *ud) {
+  struct kafka_topic_context *ctx = ud->data;
+  int status = 0;
+
+  if (ctx == NULL)
+    return EINVAL;
+
+  for (size_t i = 0; i < ctx->batches_num; i++) {
+    kafka_batch_t *batch = ctx->batches + i;
+
+    pthread_mutex_lock(&batch->lock);
+    if (kafka_batch_send(ctx, batch) != 0)
+      status = -1;
+    pthread_mutex_unlock(&batch->lock);
+  }
+
+  return status;
+} /* }}} int kafka_flush */
+
 static void kafka_topic_context_free(void *p) /* {{{ */
 {
   struct kafka_topic_context *ctx = p;
@@ -241,6 +458,22 @@ static void kafka_topic_context_free(void *p) /* {{{ */
   if (ctx == NULL)
     return;
 
+  for (size_t i = 0; i < ctx->batches_num; i++) {
+    kafka_batch_t *batch = ctx->batches + i;
+
+    if (ctx->topic != NULL)
+      kafka_batch_send(ctx, batch);
+    sfree(batch->data);
+    pthread_mutex_destroy(&batch->lock);
+  }
+  sfree(ctx->batches);
+
+#if RD_KAFKA_VERSION >= 0x000902ff
+  /* Give queued messages a chance to be delivered. */
+  if (ctx->kafka != NULL)
+    rd_kafka_flush(ctx->kafka, /* timeout_ms = */ 1000);
+#endif
+
   if (ctx->topic_name != NULL)
     sfree(ctx->topic_name);
   if (ctx->topic != NULL)
@@ -276,6 +509,7 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
   tctx->store_rates = true;
   tctx->format = KAFKA_FORMAT_JSON;
   tctx->key = NULL;
+  tctx->batch_size = 1;
 
   if ((tctx->kafka_conf = rd_kafka_conf_dup(conf)) == NULL) {
     sfree(tctx);
@@ -399,6 +633,16 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
                 "only one character. Others will be ignored.");
       tctx->escape_char = tmp_buff[0];
       sfree(tmp_buff);
+    } else if (strcasecmp("BatchSize", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < 1)) {
+        WARNING("write_kafka plugin: The \"BatchSize\" option must be at "
+                "least 1.");
+        status = -1;
+      } else if (status == 0) {
+        tctx->batch_size = (size_t)tmp;
+      }
     } else {
       WARNING("write_kafka plugin: Invalid directive: %s.", child->key);
     }
@@ -407,6 +651,21 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
       break;
   }
 
+  if (tctx->batch_size > 1) {
+    tctx->batches_num = (tctx->key != NULL) ? 1 : KAFKA_BATCH_SLOTS;
+    tctx->batches = calloc(tctx->batches_num, sizeof(*tctx->batches));
+    if (tctx->batches == NULL) {
+      ERROR("write_kafka plugin: calloc failed.");
+      tctx->batches_num = 0;
+      goto errout;
+    }
+    for (size_t i = 0; i < tctx->batches_num; i++) {
+      pthread_mutex_init(&tctx->batches[i].lock, /* attr = */ NULL);
+      snprintf(tctx->batches[i].key, sizeof(tctx->batches[i].key),
+               "%08" PRIX32, (uint32_t)i);
+    }
+  }
+
   rd_kafka_topic_conf_set_partitioner_cb(tctx->conf, kafka_partition);
   rd_kafka_topic_conf_set_opaque(tctx->conf, tctx);
 
@@ -425,10 +684,17 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
     goto errout;
   }
 
+  if (tctx->batches_num > 0)
+    plugin_register_flush(callback_name, kafka_flush,
+                          &(user_data_t){.data = tctx});
+
   pthread_mutex_init(&tctx->lock, /* attr = */ NULL);
 
   return;
 errout:
+  for (size_t i = 0; i < tctx->batches_num; i++)
+    pthread_mutex_destroy(&tctx->batches[i].lock);
+  sfree(tctx->batches);
   if (tctx->topic_name != NULL)
     free(tctx->topic_name);
   if (tctx->conf != NULL)
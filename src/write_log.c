@@ -40,9 +40,126 @@
 #define WL_FORMAT_GRAPHITE 1
 #define WL_FORMAT_JSON 2
 
+#define WL_FLUSH_INTERVAL TIME_T_TO_CDTIME_T(1)
+
 /* Plugin:WriteLog has to also operate without a config, so use a global. */
 int wl_format = WL_FORMAT_GRAPHITE;
 
+/* With "File", value lists are formatted straight into the active one of two
+ * buffers. A thread swaps the buffers once per second, or when the active one
+ * is half full, and writes the other one out, so write threads never wait for
+ * the file. When the active buffer is full, value lists are dropped. */
+struct wl_buffer_s {
+  char *data;
+  size_t len;
+};
+typedef struct wl_buffer_s wl_buffer_t;
+
+static char *wl_file;
+static size_t wl_buffer_size = 1048576;
+static int wl_fd = -1;
+
+static wl_buffer_t wl_buffers[2];
+static wl_buffer_t *wl_active = wl_buffers;
+static uint64_t wl_dropped;
+
+static pthread_mutex_t wl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wl_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t wl_thread;
+static bool wl_thread_running;
+static bool wl_shutdown;
+
+static void wl_write_buffer(wl_buffer_t *buf) {
+  size_t pos = 0;
+  while (pos < buf->len) {
+    ssize_t status = write(wl_fd, buf->data + pos, buf->len - pos);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("write_log plugin: Writing to \"%s\" failed: %s", wl_file,
+            STRERRNO);
+      break;
+    }
+    pos += (size_t)status;
+  }
+  buf->len = 0;
+} /* void wl_write_buffer */
+
+static void *wl_flush_thread(__attribute__((unused)) void *arg) {
+  pthread_mutex_lock(&wl_lock);
+  while (true) {
+    cdtime_t deadline = cdtime() + WL_FLUSH_INTERVAL;
+    while (!wl_shutdown && (wl_active->len < wl_buffer_size / 2)) {
+      struct timespec ts = CDTIME_T_TO_TIMESPEC(deadline);
+      if (pthread_cond_timedwait(&wl_cond, &wl_lock, &ts) == ETIMEDOUT)
+        break;
+    }
+
+    if (wl_shutdown && (wl_active->len == 0))
+      break;
+
+    wl_buffer_t *full = wl_active;
+    wl_active = (full == wl_buffers) ? wl_buffers + 1 : wl_buffers;
+    uint64_t dropped = wl_dropped;
+    wl_dropped = 0;
+    pthread_mutex_unlock(&wl_lock);
+
+    wl_write_buffer(full);
+    if (dropped > 0)
+      WARNING("write_log plugin: Dropped %" PRIu64 " value lists because "
+              "\"%s\" couldn't keep up.",
+              dropped, wl_file);
+
+    pthread_mutex_lock(&wl_lock);
+  }
+  pthread_mutex_unlock(&wl_lock);
+
+  return NULL;
+} /* void *wl_flush_thread */
+
+/* Formats the value list at the end of the active buffer. */
+static int wl_write_file(const data_set_t *ds, const value_list_t *vl) {
+  pthread_mutex_lock(&wl_lock);
+
+  wl_buffer_t *buf = wl_active;
+  size_t bfree = wl_buffer_size - buf->len;
+  /* Leave room for the largest value list the log output allows. */
+  if (bfree < WL_BUF_SIZE) {
+    wl_dropped++;
+    pthread_cond_signal(&wl_cond);
+    pthread_mutex_unlock(&wl_lock);
+    return ENOBUFS;
+  }
+
+  char *buffer = buf->data + buf->len;
+  int status;
+  if (wl_format == WL_FORMAT_JSON) {
+    size_t bfill = 0;
+    /* Leave room for the newline. */
+    bfree--;
+    status = format_json_initialize(buffer, &bfill, &bfree);
+    if (status == 0)
+      status = format_json_value_list(buffer, &bfill, &bfree, ds, vl,
+                                      /* store rates = */ 0);
+    if (status == 0)
+      status = format_json_finalize(buffer, &bfill, &bfree);
+    if (status == 0) {
+      buffer[bfill++] = '\n';
+      buf->len += bfill;
+    }
+  } else {
+    status = format_graphite(buffer, bfree, ds, vl, NULL, NULL, '_', 0);
+    if (status == 0)
+      buf->len += strlen(buffer);
+  }
+
+  if (buf->len >= wl_buffer_size / 2)
+    pthread_cond_signal(&wl_cond);
+  pthread_mutex_unlock(&wl_lock);
+
+  return status;
+} /* int wl_write_file */
+
 static int wl_write_graphite(const data_set_t *ds, const value_list_t *vl) {
   char buffer[WL_BUF_SIZE] = {0};
   int status;
@@ -85,7 +202,13 @@ static int wl_write(const data_set_t *ds, const value_list_t *vl,
                     __attribute__((unused)) user_data_t *user_data) {
   int status = 0;
 
-  if (wl_format == WL_FORMAT_GRAPHITE) {
+  if (wl_fd >= 0) {
+    if (0 != strcmp(ds->type, vl->type)) {
+      ERROR("write_log plugin: DS type does not match value list type");
+      return -1;
+    }
+    status = wl_write_file(ds, vl);
+  } else if (wl_format == WL_FORMAT_GRAPHITE) {
     status = wl_write_graphite(ds, vl);
   } else if (wl_format == WL_FORMAT_JSON) {
     status = wl_write_json(ds, vl);
@@ -121,6 +244,19 @@ static int wl_config(oconfig_item_t *ci) /* {{{ */
               child->key);
         return -EINVAL;
       }
+    } else if (strcasecmp("File", child->key) == 0) {
+      if (cf_util_get_string(child, &wl_file) != 0)
+        return -EINVAL;
+    } else if (strcasecmp("BufferSize", child->key) == 0) {
+      int tmp = 0;
+      if (cf_util_get_int(child, &tmp) != 0)
+        return -EINVAL;
+      if (tmp < 2 * WL_BUF_SIZE) {
+        ERROR("write_log plugin: `%s' must be at least %d.", child->key,
+              2 * WL_BUF_SIZE);
+        return -EINVAL;
+      }
+      wl_buffer_size = (size_t)tmp;
     } else {
       ERROR("write_log plugin: Invalid configuration option: `%s'.",
             child->key);
@@ -131,8 +267,79 @@ static int wl_config(oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int wl_config */
 
+static int wl_init(void) /* {{{ */
+{
+  if ((wl_file == NULL) || (wl_fd >= 0))
+    return 0;
+
+  int fd;
+  if (strcasecmp("stdout", wl_file) == 0)
+    fd = dup(STDOUT_FILENO);
+  else if (strcasecmp("stderr", wl_file) == 0)
+    fd = dup(STDERR_FILENO);
+  else
+    fd = open(wl_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    ERROR("write_log plugin: Opening \"%s\" failed: %s", wl_file, STRERRNO);
+    return -1;
+  }
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(wl_buffers); i++) {
+    wl_buffers[i].data = malloc(wl_buffer_size);
+    if (wl_buffers[i].data == NULL) {
+      ERROR("write_log plugin: malloc failed.");
+      close(fd);
+      return -1;
+    }
+    wl_buffers[i].len = 0;
+  }
+  wl_fd = fd;
+
+  int status = plugin_thread_create(&wl_thread, /* attr = */ NULL,
+                                    wl_flush_thread, /* arg = */ NULL,
+                                    "write_log");
+  if (status != 0) {
+    ERROR("write_log plugin: Starting the flush thread failed: %s",
+          STRERROR(status));
+    close(wl_fd);
+    wl_fd = -1;
+    return -1;
+  }
+  wl_thread_running = true;
+
+  return 0;
+} /* }}} int wl_init */
+
+static int wl_shutdown_cb(void) /* {{{ */
+{
+  if (wl_thread_running) {
+    pthread_mutex_lock(&wl_lock);
+    wl_shutdown = true;
+    pthread_cond_signal(&wl_cond);
+    pthread_mutex_unlock(&wl_lock);
+
+    pthread_join(wl_thread, NULL);
+    wl_thread_running = false;
+  }
+
+  /* Write threads have stopped, anything left is written right here. */
+  if (wl_fd >= 0) {
+    wl_write_buffer(wl_active);
+    close(wl_fd);
+    wl_fd = -1;
+  }
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(wl_buffers); i++)
+    sfree(wl_buffers[i].data);
+  sfree(wl_file);
+
+  return 0;
+} /* }}} int wl_shutdown_cb */
+
 void module_register(void) {
   plugin_register_complex_config("write_log", wl_config);
+  plugin_register_init("write_log", wl_init);
+  plugin_register_shutdown("write_log", wl_shutdown_cb);
   /* If config is supplied, the global wl_format will be set. */
   plugin_register_write("write_log", wl_write, NULL);
 }
@@ -34,10 +34,29 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_cache.h"
 
 #include <mongoc.h>
 
+#ifndef MONGOC_CHECK_VERSION
+#define MONGOC_CHECK_VERSION(major, minor, micro) 0
+#endif
+
+/* Server error code returned when creating a collection which exists. */
+#define WM_NAMESPACE_EXISTS 48
+
+/* Documents waiting to be inserted into one collection. */
+struct wm_batch_s {
+  char *name;
+  mongoc_collection_t *collection;
+  mongoc_bulk_operation_t *bulk;
+  size_t num;
+  cdtime_t first;
+  bool created;
+};
+typedef struct wm_batch_s wm_batch_t;
+
 struct wm_node_s {
   char name[DATA_MAX_NAME_LEN];
 
@@ -53,8 +72,14 @@ struct wm_node_s {
   bool store_rates;
   bool connected;
 
+  int bulk_size;
+  cdtime_t flush_interval;
+  bool timeseries;
+
   mongoc_client_t *client;
   mongoc_database_t *database;
+  /* Collection name -> wm_batch_t */
+  c_avl_tree_t *batches;
   pthread_mutex_t lock;
 };
 typedef struct wm_node_s wm_node_t;
@@ -63,9 +88,12 @@ typedef struct wm_node_s wm_node_t;
  * Functions
  */
 static bson_t *wm_create_bson(const data_set_t *ds, /* {{{ */
-                              const value_list_t *vl, bool store_rates) {
+                              const value_list_t *vl, bool store_rates,
+                              bool timeseries) {
   bson_t *ret;
   bson_t subarray;
+  bson_t meta;
+  bson_t *parent;
   gauge_t *rates;
 
   ret = bson_new();
@@ -86,11 +114,20 @@ static bson_t *wm_create_bson(const data_set_t *ds, /* {{{ */
   }
 
   BSON_APPEND_DATE_TIME(ret, "timestamp", CDTIME_T_TO_MS(vl->time));
-  BSON_APPEND_UTF8(ret, "host", vl->host);
-  BSON_APPEND_UTF8(ret, "plugin", vl->plugin);
-  BSON_APPEND_UTF8(ret, "plugin_instance", vl->plugin_instance);
-  BSON_APPEND_UTF8(ret, "type", vl->type);
-  BSON_APPEND_UTF8(ret, "type_instance", vl->type_instance);
+
+  /* Time series collections bucket documents by their "meta" field, so
+   * everything identifying the value list goes there. */
+  parent = ret;
+  if (timeseries) {
+    BSON_APPEND_DOCUMENT_BEGIN(ret, "meta", &meta);
+    parent = &meta;
+  }
+
+  BSON_APPEND_UTF8(parent, "host", vl->host);
+  BSON_APPEND_UTF8(parent, "plugin", vl->plugin);
+  BSON_APPEND_UTF8(parent, "plugin_instance", vl->plugin_instance);
+  BSON_APPEND_UTF8(parent, "type", vl->type);
+  BSON_APPEND_UTF8(parent, "type_instance", vl->type_instance);
 
   BSON_APPEND_ARRAY_BEGIN(ret, "values", &subarray); /* {{{ */
   for (size_t i = 0; i < ds->ds_num; i++) {
@@ -117,7 +154,7 @@ static bson_t *wm_create_bson(const data_set_t *ds, /* {{{ */
   }
   bson_append_array_end(ret, &subarray); /* }}} values */
 
-  BSON_APPEND_ARRAY_BEGIN(ret, "dstypes", &subarray); /* {{{ */
+  BSON_APPEND_ARRAY_BEGIN(parent, "dstypes", &subarray); /* {{{ */
   for (size_t i = 0; i < ds->ds_num; i++) {
     char key[16];
 
@@ -128,16 +165,19 @@ static bson_t *wm_create_bson(const data_set_t *ds, /* {{{ */
     else
       BSON_APPEND_UTF8(&subarray, key, DS_TYPE_TO_STRING(ds->ds[i].type));
   }
-  bson_append_array_end(ret, &subarray); /* }}} dstypes */
+  bson_append_array_end(parent, &subarray); /* }}} dstypes */
 
-  BSON_APPEND_ARRAY_BEGIN(ret, "dsnames", &subarray); /* {{{ */
+  BSON_APPEND_ARRAY_BEGIN(parent, "dsnames", &subarray); /* {{{ */
   for (size_t i = 0; i < ds->ds_num; i++) {
     char key[16];
 
     snprintf(key, sizeof(key), "%" PRIsz, i);
     BSON_APPEND_UTF8(&subarray, key, ds->ds[i].name);
   }
-  bson_append_array_end(ret, &subarray); /* }}} dsnames */
+  bson_append_array_end(parent, &subarray); /* }}} dsnames */
+
+  if (timeseries)
+    bson_append_document_end(ret, &meta);
 
   sfree(rates);
 
@@ -218,15 +258,212 @@ static int wm_initialize(wm_node_t *node) /* {{{ */
   return 0;
 } /* }}} int wm_initialize */
 
+static void wm_batch_free(wm_batch_t *batch) /* {{{ */
+{
+  if (batch == NULL)
+    return;
+
+  if (batch->bulk != NULL)
+    mongoc_bulk_operation_destroy(batch->bulk);
+  if (batch->collection != NULL)
+    mongoc_collection_destroy(batch->collection);
+  sfree(batch->name);
+  sfree(batch);
+} /* }}} void wm_batch_free */
+
+/* Drops the connection and all documents not inserted yet.
+ * node->lock must be held when calling this function. */
+static void wm_disconnect(wm_node_t *node) /* {{{ */
+{
+  if (node->batches != NULL) {
+    char *name;
+    wm_batch_t *batch;
+
+    while (c_avl_pick(node->batches, (void *)&name, (void *)&batch) == 0) {
+      if (batch->num > 0)
+        WARNING("write_mongodb plugin: Node \"%s\": Dropping %" PRIsz
+                " documents for collection \"%s\".",
+                node->name, batch->num, batch->name);
+      wm_batch_free(batch);
+    }
+  }
+
+  if (node->database != NULL)
+    mongoc_database_destroy(node->database);
+  if (node->client != NULL)
+    mongoc_client_destroy(node->client);
+  node->database = NULL;
+  node->client = NULL;
+  node->connected = false;
+} /* }}} void wm_disconnect */
+
+/* Creates a time series collection, unless it exists already. */
+static int wm_create_timeseries(wm_node_t *node, /* {{{ */
+                                char const *name) {
+  bson_t opts = BSON_INITIALIZER;
+  bson_t timeseries;
+  bson_error_t error;
+  mongoc_collection_t *collection;
+
+  BSON_APPEND_DOCUMENT_BEGIN(&opts, "timeseries", &timeseries);
+  BSON_APPEND_UTF8(&timeseries, "timeField", "timestamp");
+  BSON_APPEND_UTF8(&timeseries, "metaField", "meta");
+  BSON_APPEND_UTF8(&timeseries, "granularity", "seconds");
+  bson_append_document_end(&opts, &timeseries);
+
+  collection =
+      mongoc_database_create_collection(node->database, name, &opts, &error);
+  bson_destroy(&opts);
+
+  if (collection != NULL) {
+    INFO("write_mongodb plugin: Node \"%s\": Created time series collection "
+         "\"%s\".",
+         node->name, name);
+    mongoc_collection_destroy(collection);
+    return 0;
+  }
+
+  if (error.code == WM_NAMESPACE_EXISTS)
+    return 0;
+
+  ERROR("write_mongodb plugin: Node \"%s\": Creating time series collection "
+        "\"%s\" failed: %s",
+        node->name, name, error.message);
+  return -1;
+} /* }}} int wm_create_timeseries */
+
+/* Returns the batch of collection "name", ready to add a document to.
+ * node->lock must be held when calling this function. */
+static wm_batch_t *wm_batch_get(wm_node_t *node, char const *name) /* {{{ */
+{
+  wm_batch_t *batch = NULL;
+
+  if (c_avl_get(node->batches, name, (void *)&batch) != 0) {
+    batch = calloc(1, sizeof(*batch));
+    if (batch == NULL) {
+      ERROR("write_mongodb plugin: calloc failed.");
+      return NULL;
+    }
+    batch->name = strdup(name);
+    if ((batch->name == NULL) ||
+        (c_avl_insert(node->batches, batch->name, batch) != 0)) {
+      ERROR("write_mongodb plugin: Adding collection \"%s\" failed.", name);
+      wm_batch_free(batch);
+      return NULL;
+    }
+  }
+
+  if (node->timeseries && !batch->created) {
+    if (wm_create_timeseries(node, name) != 0)
+      return NULL;
+    batch->created = true;
+  }
+
+  if (batch->collection == NULL) {
+    batch->collection =
+        mongoc_client_get_collection(node->client, "collectd", name);
+    if (batch->collection == NULL) {
+      ERROR("write_mongodb plugin: error creating/getting collection");
+      return NULL;
+    }
+  }
+
+  if (batch->bulk == NULL) {
+#if MONGOC_CHECK_VERSION(1, 9, 0)
+    bson_t opts = BSON_INITIALIZER;
+    BSON_APPEND_BOOL(&opts, "ordered", false);
+    batch->bulk =
+        mongoc_collection_create_bulk_operation_with_opts(batch->collection,
+                                                          &opts);
+    bson_destroy(&opts);
+#else
+    batch->bulk = mongoc_collection_create_bulk_operation(
+        batch->collection, /* ordered = */ false, /* write_concern = */ NULL);
+#endif
+    if (batch->bulk == NULL) {
+      ERROR("write_mongodb plugin: Creating a bulk operation failed.");
+      return NULL;
+    }
+    batch->num = 0;
+  }
+
+  return batch;
+} /* }}} wm_batch_t *wm_batch_get */
+
+/* Inserts the documents of "batch".
+ * node->lock must be held when calling this function. */
+static int wm_batch_flush(wm_node_t *node, wm_batch_t *batch) /* {{{ */
+{
+  bson_t reply;
+  bson_error_t error;
+  uint32_t status;
+  size_t num = batch->num;
+
+  if ((batch->bulk == NULL) || (num == 0))
+    return 0;
+
+  status = mongoc_bulk_operation_execute(batch->bulk, &reply, &error);
+  bson_destroy(&reply);
+  mongoc_bulk_operation_destroy(batch->bulk);
+  batch->bulk = NULL;
+  batch->num = 0;
+
+  if (status != 0)
+    return 0;
+
+  ERROR("write_mongodb plugin: Node \"%s\": Inserting %" PRIsz
+        " documents into \"%s\" failed: %s",
+        node->name, num, batch->name, error.message);
+
+  /* With unordered inserts, only connection problems make the other documents
+   * fail, too. */
+  if ((error.domain == MONGOC_ERROR_STREAM) ||
+      (error.domain == MONGOC_ERROR_SERVER_SELECTION) ||
+      (error.domain == MONGOC_ERROR_CLIENT))
+    wm_disconnect(node);
+
+  return -1;
+} /* }}} int wm_batch_flush */
+
+/* Inserts the documents of all batches older than "timeout", or of all
+ * batches if "timeout" is zero.
+ * node->lock must be held when calling this function. */
+static int wm_flush_nolock(wm_node_t *node, cdtime_t timeout) /* {{{ */
+{
+  cdtime_t now = cdtime();
+  int status = 0;
+
+  if (node->batches == NULL)
+    return 0;
+
+  c_avl_iterator_t *iter = c_avl_get_iterator(node->batches);
+  char *name;
+  wm_batch_t *batch;
+  while (node->connected &&
+         (c_avl_iterator_next(iter, (void *)&name, (void *)&batch) == 0)) {
+    if ((batch->num == 0) ||
+        ((timeout != 0) && ((now - batch->first) < timeout)))
+      continue;
+
+    /* wm_batch_flush() may disconnect, which empties the tree. The loop
+     * condition checks for that before the iterator is used again. */
+    if (wm_batch_flush(node, batch) != 0)
+      status = -1;
+  }
+  c_avl_iterator_destroy(iter);
+
+  return status;
+} /* }}} int wm_flush_nolock */
+
 static int wm_write(const data_set_t *ds, /* {{{ */
                     const value_list_t *vl, user_data_t *ud) {
   wm_node_t *node = ud->data;
-  mongoc_collection_t *collection = NULL;
+  wm_batch_t *batch;
   bson_t *bson_record;
-  bson_error_t error;
-  int status;
+  int status = 0;
 
-  bson_record = wm_create_bson(ds, vl, node->store_rates);
+  bson_record =
+      wm_create_bson(ds, vl, node->store_rates, node->timeseries);
   if (!bson_record) {
     ERROR("write_mongodb plugin: error making insert bson");
     return -1;
@@ -240,45 +477,42 @@ static int wm_write(const data_set_t *ds, /* {{{ */
     return -1;
   }
 
-  collection =
-      mongoc_client_get_collection(node->client, "collectd", vl->plugin);
-  if (!collection) {
-    ERROR("write_mongodb plugin: error creating/getting collection");
-    mongoc_database_destroy(node->database);
-    mongoc_client_destroy(node->client);
-    node->database = NULL;
-    node->client = NULL;
-    node->connected = false;
+  batch = wm_batch_get(node, vl->plugin);
+  if (batch == NULL) {
+    wm_disconnect(node);
     pthread_mutex_unlock(&node->lock);
     bson_destroy(bson_record);
     return -1;
   }
 
-  status = mongoc_collection_insert(collection, MONGOC_INSERT_NONE, bson_record,
-                                    NULL, &error);
+  mongoc_bulk_operation_insert(batch->bulk, bson_record);
+  bson_destroy(bson_record);
 
-  if (!status) {
-    ERROR("write_mongodb plugin: error inserting record: %s", error.message);
-    mongoc_database_destroy(node->database);
-    mongoc_client_destroy(node->client);
-    node->database = NULL;
-    node->client = NULL;
-    node->connected = false;
-    pthread_mutex_unlock(&node->lock);
-    bson_destroy(bson_record);
-    mongoc_collection_destroy(collection);
-    return -1;
-  }
+  if (batch->num == 0)
+    batch->first = cdtime();
+  batch->num++;
 
-  /* free our resource as not to leak memory */
-  mongoc_collection_destroy(collection);
+  if (batch->num >= (size_t)node->bulk_size)
+    status = wm_batch_flush(node, batch);
+  if ((status == 0) && (node->flush_interval > 0))
+    status = wm_flush_nolock(node, node->flush_interval);
 
   pthread_mutex_unlock(&node->lock);
+  return status;
+} /* }}} int wm_write */
 
-  bson_destroy(bson_record);
+static int wm_flush(cdtime_t timeout, /* {{{ */
+                    const char *identifier __attribute__((unused)),
+                    user_data_t *ud) {
+  wm_node_t *node = ud->data;
+  int status;
 
-  return 0;
-} /* }}} int wm_write */
+  pthread_mutex_lock(&node->lock);
+  status = wm_flush_nolock(node, timeout);
+  pthread_mutex_unlock(&node->lock);
+
+  return status;
+} /* }}} int wm_flush */
 
 static void wm_config_free(void *ptr) /* {{{ */
 {
@@ -287,11 +521,11 @@ static void wm_config_free(void *ptr) /* {{{ */
   if (node == NULL)
     return;
 
-  mongoc_database_destroy(node->database);
-  mongoc_client_destroy(node->client);
-  node->database = NULL;
-  node->client = NULL;
-  node->connected = false;
+  if (node->connected)
+    wm_flush_nolock(node, /* timeout = */ 0);
+  wm_disconnect(node);
+  if (node->batches != NULL)
+    c_avl_destroy(node->batches);
 
   sfree(node->host);
   sfree(node);
@@ -313,13 +547,21 @@ static int wm_config_node(oconfig_item_t *ci) /* {{{ */
   }
   node->port = MONGOC_DEFAULT_PORT;
   node->store_rates = true;
+  node->bulk_size = 1;
+  node->flush_interval = 0;
+  node->timeseries = false;
+  node->batches = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (node->batches == NULL) {
+    sfree(node->host);
+    sfree(node);
+    return ENOMEM;
+  }
   pthread_mutex_init(&node->lock, /* attr = */ NULL);
 
   status = cf_util_get_string_buffer(ci, node->name, sizeof(node->name));
 
   if (status != 0) {
-    sfree(node->host);
-    sfree(node);
+    wm_config_free(node);
     return status;
   }
 
@@ -344,6 +586,16 @@ static int wm_config_node(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_string(child, &node->user);
     else if (strcasecmp("Password", child->key) == 0)
       status = cf_util_get_string(child, &node->passwd);
+    else if (strcasecmp("BulkSize", child->key) == 0) {
+      status = cf_util_get_int(child, &node->bulk_size);
+      if ((status == 0) && (node->bulk_size < 1)) {
+        ERROR("write_mongodb plugin: BulkSize must be at least 1.");
+        status = EINVAL;
+      }
+    } else if (strcasecmp("FlushInterval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &node->flush_interval);
+    else if (strcasecmp("TimeSeries", child->key) == 0)
+      status = cf_util_get_boolean(child, &node->timeseries);
     else
       WARNING("write_mongodb plugin: Ignoring unknown config option \"%s\".",
               child->key);
@@ -377,6 +629,11 @@ static int wm_config_node(oconfig_item_t *ci) /* {{{ */
                               });
     INFO("write_mongodb plugin: registered write plugin %s %d", cb_name,
          status);
+    if (status == 0)
+      plugin_register_flush(cb_name, wm_flush,
+                            &(user_data_t){
+                                .data = node,
+                            });
   }
 
   if (status != 0)
@@ -0,0 +1,775 @@
+/**
+ * collectd - src/write_otlp.cc
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * The "write_otlp" plugin exports value lists to an OpenTelemetry collector
+ * with the OTLP/gRPC protocol. Value lists are batched into
+ * ExportMetricsServiceRequests with one resource per host and one
+ * instrumentation scope per plugin. Requests are sent asynchronously: a
+ * thread per node drives a completion queue, retries failed requests with
+ * exponential backoff and limits the number of requests in flight. Writers
+ * only block when that limit has been reached.
+ *
+ * Only the client side of a single RPC is needed, so the plugin uses the
+ * generic stub instead of generated service code.
+ */
+
+#include <grpc++/alarm.h>
+#include <grpc++/generic/generic_stub.h>
+#include <grpc++/grpc++.h>
+
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "otlp_metrics.pb.h"
+
+extern "C" {
+#include <math.h>
+#include <stdbool.h>
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_complain.h"
+#include "utils_histogram.h"
+
+#include "daemon/utils_cache.h"
+}
+
+namespace otlp = opentelemetry::proto::metrics::v1;
+
+typedef google::protobuf::RepeatedPtrField<otlp::KeyValue> WoAttributes;
+
+#define WO_EXPORT_METHOD                                                       \
+  "/opentelemetry.proto.collector.metrics.v1.MetricsService/Export"
+#define WO_DEFAULT_ENDPOINT "localhost:4317"
+#define WO_DEFAULT_BATCH_SIZE 1000
+#define WO_DEFAULT_MAX_IN_FLIGHT 4
+#define WO_DEFAULT_MAX_RETRIES 5
+#define WO_BACKOFF_INITIAL TIME_T_TO_CDTIME_T(1)
+#define WO_BACKOFF_MAX TIME_T_TO_CDTIME_T(30)
+
+/* Key of the cache's meta data holding the time a series was first written,
+ * which is the start time of cumulative sums. */
+#define WO_META_START_TIME "write_otlp:start_time"
+
+/*
+ * private types
+ */
+
+/* A request being assembled. The maps point into "req", so that data points
+ * of the same resource, scope and metric are grouped. */
+struct WoBatch {
+  otlp::ExportMetricsServiceRequest req;
+  std::unordered_map<std::string, otlp::ResourceMetrics *> resources;
+  std::unordered_map<std::string, otlp::ScopeMetrics *> scopes;
+  std::unordered_map<std::string, otlp::Metric *> metrics;
+  size_t points = 0;
+  cdtime_t first = 0;
+};
+
+struct WoNode;
+
+/* A request in flight. The call is the tag of both the RPC and the alarm of
+ * its backoff, so that the completion queue thread can tell what finished
+ * from "state". */
+struct WoCall {
+  enum { SENDING, BACKOFF } state = SENDING;
+  WoNode *node;
+  grpc::ByteBuffer request;
+  size_t points;
+  int attempts = 0;
+
+  std::unique_ptr<grpc::ClientContext> ctx;
+  std::unique_ptr<grpc::GenericClientAsyncResponseReader> reader;
+  grpc::ByteBuffer response;
+  grpc::Status status;
+  grpc::Alarm alarm;
+
+  WoCall(WoNode *n, grpc::ByteBuffer const &r, size_t p)
+      : node(n), request(r), points(p) {}
+};
+
+struct WoNode {
+  std::string name;
+  std::string endpoint = WO_DEFAULT_ENDPOINT;
+  std::string prefix = "collectd.";
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::vector<std::pair<std::string, std::string>> resource_attributes;
+
+  bool use_ssl = false;
+  grpc::SslCredentialsOptions ssl_opts;
+  grpc_compression_algorithm compression = GRPC_COMPRESS_GZIP;
+
+  size_t batch_size = WO_DEFAULT_BATCH_SIZE;
+  cdtime_t flush_interval = 0;
+  cdtime_t timeout = TIME_T_TO_CDTIME_T(10);
+  int max_retries = WO_DEFAULT_MAX_RETRIES;
+  size_t max_in_flight = WO_DEFAULT_MAX_IN_FLIGHT;
+
+  /* Created by wo_init(): creating any of them initializes gRPC, which
+   * doesn't survive the daemon's fork(2). */
+  std::unique_ptr<grpc::GenericStub> stub;
+  std::unique_ptr<grpc::CompletionQueue> cq;
+  pthread_t thread;
+  bool thread_running = false;
+
+  /* Protects the members below. */
+  std::mutex lock;
+  std::condition_variable cond;
+  std::unique_ptr<WoBatch> batch;
+  std::unordered_set<WoCall *> calls;
+  bool shutting_down = false;
+  c_complain_t complaint;
+
+  WoNode() { C_COMPLAIN_INIT(&complaint); }
+};
+
+/* Configured nodes, until wo_init() registers their callbacks. */
+static std::vector<WoNode *> nodes;
+
+/*
+ * helper functions
+ */
+
+static std::string wo_read_file(char const *filename) {
+  std::ifstream f(filename);
+  if (!f.is_open()) {
+    ERROR("write_otlp plugin: Failed to open \"%s\".", filename);
+    return "";
+  }
+
+  return std::string(std::istreambuf_iterator<char>(f),
+                     std::istreambuf_iterator<char>());
+} /* wo_read_file */
+
+static void wo_attribute(WoAttributes *kv, std::string const &key,
+                         std::string const &value) {
+  otlp::KeyValue *attr = kv->Add();
+  attr->set_key(key);
+  attr->mutable_value()->set_string_value(value);
+} /* wo_attribute */
+
+/* Returns the status codes the OTLP specification considers transient. */
+static bool wo_retryable(grpc::StatusCode code) {
+  switch (code) {
+  case grpc::StatusCode::CANCELLED:
+  case grpc::StatusCode::DEADLINE_EXCEEDED:
+  case grpc::StatusCode::RESOURCE_EXHAUSTED:
+  case grpc::StatusCode::ABORTED:
+  case grpc::StatusCode::OUT_OF_RANGE:
+  case grpc::StatusCode::UNAVAILABLE:
+  case grpc::StatusCode::DATA_LOSS:
+    return true;
+  default:
+    return false;
+  }
+} /* wo_retryable */
+
+static gpr_timespec wo_deadline(cdtime_t delta) {
+  return gpr_time_add(gpr_now(GPR_CLOCK_MONOTONIC),
+                      gpr_time_from_nanos((int64_t)CDTIME_T_TO_NS(delta),
+                                          GPR_TIMESPAN));
+} /* wo_deadline */
+
+/*
+ * proto conversion
+ */
+
+/* Returns the metric "name" of the value list's host and plugin in "b",
+ * creating the resource, scope and metric as needed. */
+static otlp::Metric *wo_batch_metric(WoNode const *node, WoBatch *b,
+                                     value_list_t const *vl,
+                                     std::string const &name, char kind) {
+  std::string key(vl->host);
+  auto r = b->resources.find(key);
+  otlp::ResourceMetrics *rm;
+  if (r == b->resources.end()) {
+    rm = b->req.add_resource_metrics();
+    auto attrs = rm->mutable_resource()->mutable_attributes();
+    wo_attribute(attrs, "host.name", vl->host);
+    for (auto const &a : node->resource_attributes)
+      wo_attribute(attrs, a.first, a.second);
+    b->resources[key] = rm;
+  } else {
+    rm = r->second;
+  }
+
+  key.push_back('\0');
+  key.append(vl->plugin);
+  auto s = b->scopes.find(key);
+  otlp::ScopeMetrics *sm;
+  if (s == b->scopes.end()) {
+    sm = rm->add_scope_metrics();
+    sm->mutable_scope()->set_name(vl->plugin);
+    sm->mutable_scope()->set_version(PACKAGE_VERSION);
+    b->scopes[key] = sm;
+  } else {
+    sm = s->second;
+  }
+
+  /* The kind keeps e.g. a histogram apart from a gauge of the same name. */
+  key.push_back('\0');
+  key.push_back(kind);
+  key.append(name);
+  auto m = b->metrics.find(key);
+  if (m != b->metrics.end())
+    return m->second;
+
+  otlp::Metric *metric = sm->add_metrics();
+  metric->set_name(name);
+  b->metrics[key] = metric;
+  return metric;
+} /* wo_batch_metric */
+
+static void wo_point_attributes(WoAttributes *attrs, value_list_t const *vl) {
+  if (vl->plugin_instance[0] != '\0')
+    wo_attribute(attrs, "plugin_instance", vl->plugin_instance);
+  if (vl->type_instance[0] != '\0')
+    wo_attribute(attrs, "type_instance", vl->type_instance);
+} /* wo_point_attributes */
+
+/* Converts the cumulative buckets of "h" to OTLP's explicit bounds and
+ * per-bucket counts, with an overflow bucket after the last finite bound. */
+static void wo_histogram_point(otlp::HistogramDataPoint *dp,
+                               histogram_t const *h) {
+  uint64_t prev = 0;
+  for (size_t i = 0; i < h->buckets_num; i++) {
+    histogram_bucket_t const *bucket = h->buckets + i;
+    if (isinf(bucket->upper_bound))
+      break;
+
+    uint64_t cum = bucket->cumulative_count;
+    dp->add_explicit_bounds(bucket->upper_bound);
+    dp->add_bucket_counts((cum > prev) ? cum - prev : 0);
+    prev = (cum > prev) ? cum : prev;
+  }
+  dp->add_bucket_counts((h->count > prev) ? h->count - prev : 0);
+
+  dp->set_count(h->count);
+  dp->set_sum(h->sum);
+} /* wo_histogram_point */
+
+/* Adds the value list to the node's batch. node->lock must be held. */
+static int wo_batch_add(WoNode *node, data_set_t const *ds,
+                        value_list_t const *vl, histogram_t const *h) {
+  if (node->batch == nullptr) {
+    node->batch = std::unique_ptr<WoBatch>(new WoBatch());
+    node->batch->first = cdtime();
+  }
+  WoBatch *b = node->batch.get();
+
+  uint64_t time_ns = CDTIME_T_TO_NS(vl->time);
+  uint64_t start_ns = 0;
+  uint64_t start = 0;
+  if (uc_meta_data_get_unsigned_int(vl, WO_META_START_TIME, &start) != 0) {
+    start = (uint64_t)vl->time;
+    uc_meta_data_add_unsigned_int(vl, WO_META_START_TIME, start);
+  }
+  start_ns = CDTIME_T_TO_NS((cdtime_t)start);
+
+  std::string base = node->prefix + vl->plugin + "." + vl->type;
+
+  if (h != nullptr) {
+    otlp::Metric *m = wo_batch_metric(node, b, vl, base, 'h');
+    otlp::Histogram *hist = m->mutable_histogram();
+    hist->set_aggregation_temporality(
+        otlp::AGGREGATION_TEMPORALITY_CUMULATIVE);
+
+    otlp::HistogramDataPoint *dp = hist->add_data_points();
+    wo_point_attributes(dp->mutable_attributes(), vl);
+    dp->set_start_time_unix_nano(start_ns);
+    dp->set_time_unix_nano(time_ns);
+    wo_histogram_point(dp, h);
+    b->points++;
+    return 0;
+  }
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    std::string name = base;
+    if (ds->ds_num > 1)
+      name += std::string(".") + ds->ds[i].name;
+
+    int type = ds->ds[i].type;
+    otlp::Metric *m =
+        wo_batch_metric(node, b, vl, name, (type == DS_TYPE_GAUGE) ? 'g' : 's');
+
+    otlp::NumberDataPoint *dp;
+    if (type == DS_TYPE_GAUGE) {
+      dp = m->mutable_gauge()->add_data_points();
+      dp->set_as_double(vl->values[i].gauge);
+    } else {
+      otlp::Sum *sum = m->mutable_sum();
+      dp = sum->add_data_points();
+      if (type == DS_TYPE_ABSOLUTE) {
+        /* Absolute values are reset when read, i.e. are deltas. */
+        sum->set_aggregation_temporality(otlp::AGGREGATION_TEMPORALITY_DELTA);
+        sum->set_is_monotonic(true);
+        dp->set_start_time_unix_nano(CDTIME_T_TO_NS(vl->time - vl->interval));
+        dp->set_as_int((int64_t)vl->values[i].absolute);
+      } else {
+        sum->set_aggregation_temporality(
+            otlp::AGGREGATION_TEMPORALITY_CUMULATIVE);
+        sum->set_is_monotonic(type == DS_TYPE_COUNTER);
+        dp->set_start_time_unix_nano(start_ns);
+        if (type == DS_TYPE_COUNTER)
+          dp->set_as_int((int64_t)vl->values[i].counter);
+        else
+          dp->set_as_int((int64_t)vl->values[i].derive);
+      }
+    }
+    wo_point_attributes(dp->mutable_attributes(), vl);
+    dp->set_time_unix_nano(time_ns);
+    b->points++;
+  }
+
+  return 0;
+} /* wo_batch_add */
+
+/*
+ * sending
+ */
+
+/* Starts an attempt of "call". node->lock must not be held. */
+static void wo_call_start(WoCall *call) {
+  WoNode *node = call->node;
+
+  call->state = WoCall::SENDING;
+  call->attempts++;
+  call->response.Clear();
+
+  call->ctx = std::unique_ptr<grpc::ClientContext>(new grpc::ClientContext());
+  call->ctx->set_deadline(wo_deadline(node->timeout));
+  call->ctx->set_compression_algorithm(node->compression);
+  for (auto const &h : node->headers)
+    call->ctx->AddMetadata(h.first, h.second);
+
+  call->reader = node->stub->PrepareUnaryCall(call->ctx.get(), WO_EXPORT_METHOD,
+                                              call->request, node->cq.get());
+  call->reader->StartCall();
+  call->reader->Finish(&call->response, &call->status, call);
+} /* wo_call_start */
+
+static void wo_call_done(WoCall *call) {
+  WoNode *node = call->node;
+
+  std::unique_lock<std::mutex> lock(node->lock);
+  node->calls.erase(call);
+  node->cond.notify_all();
+  lock.unlock();
+
+  delete call;
+} /* wo_call_done */
+
+/* Handles the "partial success" of an accepted request. */
+static void wo_call_response(WoCall *call) {
+  std::vector<grpc::Slice> slices;
+  if (!call->response.Dump(&slices).ok())
+    return;
+
+  std::string data;
+  for (auto const &s : slices)
+    data.append((char const *)s.begin(), s.size());
+
+  otlp::ExportMetricsServiceResponse res;
+  if (!res.ParseFromString(data) || !res.has_partial_success())
+    return;
+
+  auto const &ps = res.partial_success();
+  if ((ps.rejected_data_points() != 0) || !ps.error_message().empty())
+    WARNING("write_otlp plugin: Node \"%s\": The collector rejected %" PRIi64
+            " of %" PRIsz " data points: %s",
+            call->node->name.c_str(), (int64_t)ps.rejected_data_points(),
+            call->points, ps.error_message().c_str());
+} /* wo_call_response */
+
+/* Called by the completion queue thread when an attempt or a backoff of
+ * "call" has finished. */
+static void wo_call_proceed(WoCall *call, bool ok) {
+  WoNode *node = call->node;
+
+  if (call->state == WoCall::BACKOFF) {
+    /* The alarm is cancelled on shutdown. */
+    if (!ok) {
+      wo_call_done(call);
+      return;
+    }
+    wo_call_start(call);
+    return;
+  }
+
+  if (call->status.ok()) {
+    c_release(LOG_INFO, &node->complaint,
+              "write_otlp plugin: Node \"%s\": Exporting succeeded again.",
+              node->name.c_str());
+    wo_call_response(call);
+    wo_call_done(call);
+    return;
+  }
+
+  grpc::StatusCode code = call->status.error_code();
+  bool retry = wo_retryable(code) && (call->attempts <= node->max_retries);
+
+  std::unique_lock<std::mutex> lock(node->lock);
+  if (node->shutting_down)
+    retry = false;
+
+  if (!retry) {
+    c_complain(LOG_ERR, &node->complaint,
+               "write_otlp plugin: Node \"%s\": Exporting %" PRIsz
+               " data points failed after %d attempt%s: %s (code %d)",
+               node->name.c_str(), call->points, call->attempts,
+               (call->attempts == 1) ? "" : "s",
+               call->status.error_message().c_str(), (int)code);
+    lock.unlock();
+    wo_call_done(call);
+    return;
+  }
+
+  cdtime_t backoff = WO_BACKOFF_INITIAL << (call->attempts - 1);
+  if ((call->attempts > 5) || (backoff > WO_BACKOFF_MAX))
+    backoff = WO_BACKOFF_MAX;
+
+  DEBUG("write_otlp plugin: Node \"%s\": Attempt %d failed: %s. Retrying in "
+        "%.3f seconds.",
+        node->name.c_str(), call->attempts,
+        call->status.error_message().c_str(), CDTIME_T_TO_DOUBLE(backoff));
+
+  /* Set with the lock held, so that a concurrent shutdown cancels it. */
+  call->state = WoCall::BACKOFF;
+  call->alarm.Set(node->cq.get(), wo_deadline(backoff), call);
+} /* wo_call_proceed */
+
+static void *wo_cq_thread(void *arg) {
+  WoNode *node = (WoNode *)arg;
+  void *tag;
+  bool ok;
+
+  while (node->cq->Next(&tag, &ok))
+    wo_call_proceed(static_cast<WoCall *>(tag), ok);
+  return NULL;
+} /* wo_cq_thread */
+
+/* Serializes and sends "batch", waiting for a free slot if "max_in_flight"
+ * requests are outstanding. node->lock must not be held. */
+static int wo_send(WoNode *node, std::unique_ptr<WoBatch> batch) {
+  if ((batch == nullptr) || (batch->points == 0))
+    return 0;
+
+  std::string payload;
+  if (!batch->req.SerializeToString(&payload)) {
+    ERROR("write_otlp plugin: Node \"%s\": Serializing the request failed.",
+          node->name.c_str());
+    return -1;
+  }
+
+  grpc::Slice slice(payload);
+  WoCall *call = new WoCall(node, grpc::ByteBuffer(&slice, 1), batch->points);
+  batch.reset();
+
+  std::unique_lock<std::mutex> lock(node->lock);
+  node->cond.wait(lock,
+                  [node] { return node->calls.size() < node->max_in_flight; });
+  node->calls.insert(call);
+  lock.unlock();
+
+  wo_call_start(call);
+  return 0;
+} /* wo_send */
+
+/* Takes the node's batch if "force" is set or it is due. */
+static std::unique_ptr<WoBatch> wo_take_batch(WoNode *node, cdtime_t timeout,
+                                              bool force) {
+  std::unique_lock<std::mutex> lock(node->lock);
+  if (node->batch == nullptr)
+    return nullptr;
+
+  cdtime_t now = cdtime();
+  if (!force && (node->batch->points < node->batch_size) &&
+      ((timeout == 0) || ((now - node->batch->first) < timeout)))
+    return nullptr;
+
+  return std::move(node->batch);
+} /* wo_take_batch */
+
+static void wo_node_destroy(WoNode *node) {
+  if (node == nullptr)
+    return;
+
+  if (node->stub != nullptr) {
+    wo_send(node, wo_take_batch(node, 0, /* force = */ true));
+
+    /* Cancel the backoffs and wait for the requests in flight, which are
+     * bounded by "Timeout". */
+    std::unique_lock<std::mutex> lock(node->lock);
+    node->shutting_down = true;
+    for (WoCall *call : node->calls)
+      if (call->state == WoCall::BACKOFF)
+        call->alarm.Cancel();
+    node->cond.wait(lock, [node] { return node->calls.empty(); });
+    lock.unlock();
+
+    node->cq->Shutdown();
+    if (node->thread_running)
+      pthread_join(node->thread, NULL);
+  }
+
+  delete node;
+} /* wo_node_destroy */
+
+/*
+ * collectd plugin interface
+ */
+
+extern "C" {
+static void wo_free(void *ptr) { wo_node_destroy((WoNode *)ptr); }
+
+static int wo_write(data_set_t const *ds, value_list_t const *vl,
+                    user_data_t *ud) {
+  WoNode *node = (WoNode *)ud->data;
+
+  /* A histogram in the meta data, see utils_histogram.h, replaces the value of
+   * single-value metrics. */
+  histogram_t h = {0};
+  bool histogram = (ds->ds_num == 1) && (histogram_meta_get(vl->meta, &h) == 0);
+
+  std::unique_lock<std::mutex> lock(node->lock);
+  int status = wo_batch_add(node, ds, vl, histogram ? &h : nullptr);
+  lock.unlock();
+  histogram_reset(&h);
+  if (status != 0)
+    return status;
+
+  return wo_send(node, wo_take_batch(node, node->flush_interval,
+                                     /* force = */ false));
+} /* wo_write */
+
+static int wo_flush(cdtime_t timeout,
+                    char const *identifier __attribute__((unused)),
+                    user_data_t *ud) {
+  WoNode *node = (WoNode *)ud->data;
+
+  return wo_send(node,
+                 wo_take_batch(node, timeout, /* force = */ timeout == 0));
+} /* wo_flush */
+
+static int wo_config_pair(oconfig_item_t *ci,
+                          std::vector<std::pair<std::string, std::string>> *v) {
+  if ((ci->values_num != 2) || (ci->values[0].type != OCONFIG_TYPE_STRING) ||
+      (ci->values[1].type != OCONFIG_TYPE_STRING)) {
+    ERROR("write_otlp plugin: The `%s' option needs exactly two string "
+          "arguments.",
+          ci->key);
+    return -1;
+  }
+
+  v->push_back(std::make_pair(std::string(ci->values[0].value.string),
+                              std::string(ci->values[1].value.string)));
+  return 0;
+} /* wo_config_pair */
+
+static int wo_config_file(oconfig_item_t *ci, std::string *ret) {
+  char *filename = NULL;
+  if (cf_util_get_string(ci, &filename) != 0)
+    return -1;
+
+  *ret = wo_read_file(filename);
+  sfree(filename);
+  return ret->empty() ? -1 : 0;
+} /* wo_config_file */
+
+static int wo_config_compression(oconfig_item_t *ci,
+                                 grpc_compression_algorithm *ret) {
+  char buffer[16];
+  int status = cf_util_get_string_buffer(ci, buffer, sizeof(buffer));
+  if (status != 0)
+    return status;
+
+  if (strcasecmp("None", buffer) == 0)
+    *ret = GRPC_COMPRESS_NONE;
+  else if (strcasecmp("Gzip", buffer) == 0)
+    *ret = GRPC_COMPRESS_GZIP;
+  else if (strcasecmp("Deflate", buffer) == 0)
+    *ret = GRPC_COMPRESS_DEFLATE;
+  else {
+    ERROR("write_otlp plugin: `%s' must be `None', `Gzip' or `Deflate', got "
+          "`%s'.",
+          ci->key, buffer);
+    return -1;
+  }
+
+  return 0;
+} /* wo_config_compression */
+
+static int wo_config_positive(oconfig_item_t *ci, size_t *ret) {
+  int tmp = 0;
+  if (cf_util_get_int(ci, &tmp) != 0)
+    return -1;
+  if (tmp < 1) {
+    ERROR("write_otlp plugin: `%s' must be positive.", ci->key);
+    return -1;
+  }
+
+  *ret = (size_t)tmp;
+  return 0;
+} /* wo_config_positive */
+
+static int wo_config_node(oconfig_item_t *ci) {
+  char *name = NULL;
+  if (cf_util_get_string(ci, &name) != 0)
+    return -1;
+
+  WoNode *node = new WoNode();
+  node->name = name;
+  sfree(name);
+
+  int status = 0;
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Endpoint", child->key) == 0) {
+      char *endpoint = NULL;
+      status = cf_util_get_string(child, &endpoint);
+      if (status == 0)
+        node->endpoint = endpoint;
+      sfree(endpoint);
+    } else if (strcasecmp("EnableSSL", child->key) == 0)
+      status = cf_util_get_boolean(child, &node->use_ssl);
+    else if (strcasecmp("SSLCACertificateFile", child->key) == 0)
+      status = wo_config_file(child, &node->ssl_opts.pem_root_certs);
+    else if (strcasecmp("SSLCertificateFile", child->key) == 0)
+      status = wo_config_file(child, &node->ssl_opts.pem_cert_chain);
+    else if (strcasecmp("SSLCertificateKeyFile", child->key) == 0)
+      status = wo_config_file(child, &node->ssl_opts.pem_private_key);
+    else if (strcasecmp("Header", child->key) == 0)
+      status = wo_config_pair(child, &node->headers);
+    else if (strcasecmp("ResourceAttribute", child->key) == 0)
+      status = wo_config_pair(child, &node->resource_attributes);
+    else if (strcasecmp("MetricPrefix", child->key) == 0) {
+      char *prefix = NULL;
+      status = cf_util_get_string(child, &prefix);
+      if (status == 0)
+        node->prefix = prefix;
+      sfree(prefix);
+    } else if (strcasecmp("Compression", child->key) == 0)
+      status = wo_config_compression(child, &node->compression);
+    else if (strcasecmp("BatchSize", child->key) == 0)
+      status = wo_config_positive(child, &node->batch_size);
+    else if (strcasecmp("FlushInterval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &node->flush_interval);
+    else if (strcasecmp("Timeout", child->key) == 0)
+      status = cf_util_get_cdtime(child, &node->timeout);
+    else if (strcasecmp("MaxRetries", child->key) == 0) {
+      status = cf_util_get_int(child, &node->max_retries);
+      if ((status == 0) && (node->max_retries < 0)) {
+        ERROR("write_otlp plugin: `MaxRetries' must not be negative.");
+        status = -1;
+      }
+    } else if (strcasecmp("MaxInFlight", child->key) == 0)
+      status = wo_config_positive(child, &node->max_in_flight);
+    else {
+      WARNING("write_otlp plugin: Option `%s' not allowed in <%s> block.",
+              child->key, ci->key);
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  if ((status == 0) && (node->timeout == 0)) {
+    ERROR("write_otlp plugin: `Timeout' must be positive.");
+    status = -1;
+  }
+
+  if (status != 0) {
+    wo_node_destroy(node);
+    return status;
+  }
+
+  nodes.push_back(node);
+  return 0;
+} /* wo_config_node */
+
+static int wo_config(oconfig_item_t *ci) {
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Node", child->key) == 0) {
+      if (wo_config_node(child) != 0)
+        return -1;
+    } else {
+      WARNING("write_otlp plugin: Option `%s' not allowed here.", child->key);
+    }
+  }
+
+  return 0;
+} /* wo_config */
+
+/* gRPC is only initialized here rather than when reading the configuration,
+ * because its threads don't survive the daemon's fork(2). */
+static int wo_init(void) {
+  for (WoNode *node : nodes) {
+    std::shared_ptr<grpc::ChannelCredentials> creds =
+        node->use_ssl ? grpc::SslCredentials(node->ssl_opts)
+                      : grpc::InsecureChannelCredentials();
+    node->stub = std::unique_ptr<grpc::GenericStub>(
+        new grpc::GenericStub(grpc::CreateChannel(node->endpoint, creds)));
+    node->cq =
+        std::unique_ptr<grpc::CompletionQueue>(new grpc::CompletionQueue());
+    /* Started with the plugin's context, for c_complain() and logging. */
+    int status = plugin_thread_create(&node->thread, NULL, wo_cq_thread, node,
+                                      "write_otlp cq");
+    if (status != 0) {
+      char errbuf[256];
+      ERROR("write_otlp plugin: Node \"%s\": plugin_thread_create failed: %s",
+            node->name.c_str(), sstrerror(status, errbuf, sizeof(errbuf)));
+      wo_node_destroy(node);
+      continue;
+    }
+    node->thread_running = true;
+
+    std::string cb_name = "write_otlp/" + node->name;
+    user_data_t ud = {
+        .data = node, .free_func = wo_free,
+    };
+    plugin_register_write(cb_name.c_str(), wo_write, &ud);
+
+    ud.free_func = NULL;
+    plugin_register_flush(cb_name.c_str(), wo_flush, &ud);
+  }
+
+  /* The nodes are owned by their write callbacks now. */
+  nodes.clear();
+  return 0;
+} /* wo_init */
+
+void module_register(void) {
+  plugin_register_complex_config("write_otlp", wo_config);
+  plugin_register_init("write_otlp", wo_init);
+} /* module_register */
+} /* extern "C" */
@@ -30,12 +30,18 @@
 #include "plugin.h"
 #include "utils_avltree.h"
 #include "utils_complain.h"
+#include "utils_histogram.h"
+#include "utils_memstats.h"
 #include "utils_time.h"
 
 #include "prometheus.pb-c.h"
 
 #include <microhttpd.h>
 
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -51,14 +57,113 @@
   "encoding=delimited"
 #define CONTENT_TYPE_TEXT "text/plain; version=0.0.4"
 
+/* Field number and wire type ("length-delimited") of MetricFamily.metric. */
+#define METRIC_FAMILY_METRIC_TAG ((4 << 3) | 2)
+
+/* The metric families and metrics in "metrics" keep their exposition in both
+ * formats pre-rendered, so that a scrape only has to concatenate these
+ * fragments while holding "metrics_lock". The "m" and "fam" members have to
+ * come first: the protobuf structures point to them directly. */
+typedef struct {
+  Io__Prometheus__Client__Metric m;
+
+  /* "name{labels} value timestamp\n", with the "name{labels} " prefix of
+   * "text_prefix_len" bytes rendered once. */
+  char *text;
+  size_t text_size;
+  size_t text_prefix_len;
+  size_t text_len;
+  bool text_dirty;
+
+  /* The metric as an element of MetricFamily.metric: tag, length and the
+   * packed message. */
+  uint8_t *proto;
+  size_t proto_size;
+  size_t proto_len;
+  bool proto_dirty;
+
+  uint32_t hash; /* of the label values, see metric_hash() */
+  size_t pos;    /* in the family's "metric" array */
+
+  /* Memory accounted for the metric and of its labels, see metric_account(). */
+  size_t bytes;
+  size_t label_bytes;
+} prom_metric_t;
+
+typedef struct {
+  Io__Prometheus__Client__MetricFamily fam;
+
+  char *text_header; /* "# HELP" and "# TYPE" lines */
+  uint8_t *proto_header; /* the family without its metrics, packed */
+  size_t proto_header_len;
+
+  /* "fam.metric" has room for "metric_size" metrics. It is only sorted when
+   * "sorted" is set; lookups go through "index", an open addressing hash
+   * table with "index_size" slots (a power of two) and linear probing. */
+  size_t metric_size;
+  bool sorted;
+  prom_metric_t **index;
+  size_t index_size;
+
+  size_t bytes; /* accounted, see metric_family_account() */
+} prom_family_t;
+
 static c_avl_tree_t *metrics;
 static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Memory of the families and metrics, including their pre-rendered
+ * exposition. Counts the metrics as objects. */
+static memstat_t *prom_memstat;
+
+/* Set once a format has been scraped: from then on, prom_write() keeps it
+ * rendered. */
+static bool render_text;
+static bool render_proto;
+
 static unsigned short httpd_port = 9103;
 static struct MHD_Daemon *httpd;
 
 static cdtime_t staleness_delta = PROMETHEUS_DEFAULT_STALENESS_DELTA;
 
+/* metric_account updates the memory accounted for a metric after it may have
+ * (re)allocated parts of it. Must be called with "metrics_lock" held. */
+static void metric_account(prom_metric_t *pm) {
+  Io__Prometheus__Client__Metric const *m = &pm->m;
+  size_t bytes = sizeof(*pm) + pm->label_bytes + pm->text_size + pm->proto_size;
+
+  if (m->gauge != NULL)
+    bytes += sizeof(*m->gauge);
+  if (m->counter != NULL)
+    bytes += sizeof(*m->counter);
+  if (m->histogram != NULL)
+    bytes += sizeof(*m->histogram) +
+             m->histogram->n_bucket *
+                 (sizeof(*m->histogram->bucket) +
+                  sizeof(**m->histogram->bucket));
+
+  int64_t objects = (pm->bytes == 0) ? 1 : 0;
+  memstat_add(prom_memstat, (int64_t)bytes - (int64_t)pm->bytes, objects);
+  pm->bytes = bytes;
+}
+
+/* metric_family_account is metric_account for the family itself. */
+static void metric_family_account(prom_family_t *pf) {
+  Io__Prometheus__Client__MetricFamily const *fam = &pf->fam;
+  size_t bytes = sizeof(*pf) + pf->proto_header_len +
+                 pf->metric_size * sizeof(*fam->metric) +
+                 pf->index_size * sizeof(*pf->index);
+
+  if (fam->name != NULL)
+    bytes += strlen(fam->name) + 1;
+  if (fam->help != NULL)
+    bytes += strlen(fam->help) + 1;
+  if (pf->text_header != NULL)
+    bytes += strlen(pf->text_header) + 1;
+
+  memstat_add(prom_memstat, (int64_t)bytes - (int64_t)pf->bytes, 0);
+  pf->bytes = bytes;
+}
+
 /* Unfortunately, protoc-c doesn't export its implementation of varint, so we
  * need to implement our own. */
 static size_t varint(uint8_t buffer[static VARINT_UINT32_BYTES],
@@ -76,30 +181,67 @@ static size_t varint(uint8_t buffer[static VARINT_UINT32_BYTES],
   return 0;
 }
 
-/* format_protobuf iterates over all metric families in "metrics" and adds them
- * to a buffer in ProtoBuf format. It prefixes each protobuf with its encoded
- * size, the so called "delimited" format. */
-static void format_protobuf(ProtobufCBuffer *buffer) {
-  pthread_mutex_lock(&metrics_lock);
+static void metric_family_sort(prom_family_t *pf);
 
-  char *unused_name;
-  Io__Prometheus__Client__MetricFamily *fam;
-  c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
-  while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0) {
-    /* Prometheus uses a message length prefix to determine where one
-     * MetricFamily ends and the next begins. This delimiter is encoded as a
-     * "varint", which is common in Protobufs. */
-    uint8_t delim[VARINT_UINT32_BYTES] = {0};
-    size_t delim_len = varint(
-        delim,
-        (uint32_t)io__prometheus__client__metric_family__get_packed_size(fam));
-    buffer->append(buffer, delim_len, delim);
-
-    io__prometheus__client__metric_family__pack_to_buffer(fam, buffer);
+/* metric_render_proto packs a metric as an element of its family's "metric"
+ * field. */
+static int metric_render_proto(prom_metric_t *pm) {
+  size_t packed_size = io__prometheus__client__metric__get_packed_size(&pm->m);
+
+  uint8_t len[VARINT_UINT32_BYTES] = {0};
+  size_t len_len = varint(len, (uint32_t)packed_size);
+
+  size_t size = 1 + len_len + packed_size;
+  if (size > pm->proto_size) {
+    uint8_t *tmp = realloc(pm->proto, size);
+    if (tmp == NULL)
+      return ENOMEM;
+    pm->proto = tmp;
+    pm->proto_size = size;
   }
-  c_avl_iterator_destroy(iter);
 
-  pthread_mutex_unlock(&metrics_lock);
+  pm->proto[0] = METRIC_FAMILY_METRIC_TAG;
+  memcpy(pm->proto + 1, len, len_len);
+  io__prometheus__client__metric__pack(&pm->m, pm->proto + 1 + len_len);
+  pm->proto_len = size;
+  pm->proto_dirty = false;
+  return 0;
+}
+
+/* format_protobuf adds a metric family to a buffer in ProtoBuf format. It
+ * prefixes the protobuf with its encoded size, the so called "delimited"
+ * format. The encoding of a family is the concatenation of its fields, so the
+ * pre-rendered fragments are simply appended. Must be called with
+ * "metrics_lock" held. */
+static void format_protobuf(ProtobufCBuffer *buffer, prom_family_t *pf) {
+  Io__Prometheus__Client__MetricFamily *fam = &pf->fam;
+  size_t fam_size = pf->proto_header_len;
+
+  metric_family_sort(pf);
+
+  for (size_t i = 0; i < fam->n_metric; i++) {
+    prom_metric_t *pm = (prom_metric_t *)fam->metric[i];
+    if (pm->proto_dirty && (metric_render_proto(pm) != 0)) {
+      ERROR("write_prometheus plugin: Rendering a metric of \"%s\" failed.",
+            fam->name);
+      pm->proto_len = 0;
+    }
+    metric_account(pm);
+    fam_size += pm->proto_len;
+  }
+
+  /* Prometheus uses a message length prefix to determine where one
+   * MetricFamily ends and the next begins. This delimiter is encoded as a
+   * "varint", which is common in Protobufs. */
+  uint8_t delim[VARINT_UINT32_BYTES] = {0};
+  size_t delim_len = varint(delim, (uint32_t)fam_size);
+  buffer->append(buffer, delim_len, delim);
+
+  buffer->append(buffer, pf->proto_header_len, pf->proto_header);
+  for (size_t i = 0; i < fam->n_metric; i++) {
+    prom_metric_t *pm = (prom_metric_t *)fam->metric[i];
+    buffer->append(buffer, pm->proto_len, pm->proto);
+  }
 }
 
 static char const *escape_label_value(char *buffer, size_t buffer_size,
@@ -171,58 +313,414 @@ static char *format_labels(char *buffer, size_t buffer_size,
   return buffer;
 }
 
-/* format_protobuf iterates over all metric families in "metrics" and adds them
- * to a buffer in plain text format. */
-static void format_text(ProtobufCBuffer *buffer) {
-  pthread_mutex_lock(&metrics_lock);
+/* metric_text_append appends a line to the text of a histogram metric. */
+static int metric_text_append(prom_metric_t *pm, char const *line) {
+  size_t len = strlen(line);
 
-  char *unused_name;
-  Io__Prometheus__Client__MetricFamily *fam;
-  c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
-  while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0) {
-    char line[1024]; /* 4x DATA_MAX_NAME_LEN? */
+  if (pm->text_len + len + 1 > pm->text_size) {
+    size_t size = (pm->text_size != 0) ? 2 * pm->text_size : 1024;
+    while (pm->text_len + len + 1 > size)
+      size *= 2;
+
+    char *tmp = realloc(pm->text, size);
+    if (tmp == NULL)
+      return ENOMEM;
+    pm->text = tmp;
+    pm->text_size = size;
+  }
+
+  memcpy(pm->text + pm->text_len, line, len + 1);
+  pm->text_len += len;
+  return 0;
+}
+
+/* metric_render_text_histogram formats the lines of a histogram metric in
+ * plain text format: one "_bucket" line per bucket, including the implicit
+ * "+Inf" bucket, followed by the "_sum" and "_count" lines. */
+static int
+metric_render_text_histogram(Io__Prometheus__Client__MetricFamily const *fam,
+                             prom_metric_t *pm) {
+  Io__Prometheus__Client__Metric const *m = &pm->m;
+  Io__Prometheus__Client__Histogram const *h = m->histogram;
+
+  char labels[1024];
+  format_labels(labels, sizeof(labels), m);
+
+  char timestamp_ms[24] = "";
+  if (m->has_timestamp_ms)
+    snprintf(timestamp_ms, sizeof(timestamp_ms), " %" PRIi64, m->timestamp_ms);
+
+  uint64_t count = (h != NULL) ? h->sample_count : 0;
+  double sum = (h != NULL) ? h->sample_sum : 0.0;
+
+  char line[2048];
+  int status = 0;
+  pm->text_len = 0;
+
+  for (size_t i = 0; (h != NULL) && (i < h->n_bucket) && (status == 0); i++) {
+    snprintf(line, sizeof(line),
+             "%s_bucket{%s,le=\"" GAUGE_FORMAT "\"} %" PRIu64 "%s\n",
+             fam->name, labels, h->bucket[i]->upper_bound,
+             h->bucket[i]->cumulative_count, timestamp_ms);
+    status = metric_text_append(pm, line);
+  }
 
-    snprintf(line, sizeof(line), "# HELP %s %s\n", fam->name, fam->help);
-    buffer->append(buffer, strlen(line), (uint8_t *)line);
+  if (status == 0) {
+    snprintf(line, sizeof(line),
+             "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "%s\n"
+             "%s_sum{%s} " GAUGE_FORMAT "%s\n"
+             "%s_count{%s} %" PRIu64 "%s\n",
+             fam->name, labels, count, timestamp_ms, fam->name, labels, sum,
+             timestamp_ms, fam->name, labels, count, timestamp_ms);
+    status = metric_text_append(pm, line);
+  }
 
-    snprintf(line, sizeof(line), "# TYPE %s %s\n", fam->name,
-             (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
-                 ? "gauge"
-                 : "counter");
-    buffer->append(buffer, strlen(line), (uint8_t *)line);
+  if (status != 0)
+    return status;
 
-    for (size_t i = 0; i < fam->n_metric; i++) {
-      Io__Prometheus__Client__Metric *m = fam->metric[i];
+  pm->text_dirty = false;
+  return 0;
+}
 
-      char labels[1024];
+/* Room for the value, the timestamp and the newline after a metric's
+ * "name{labels} " prefix. */
+#define METRIC_TEXT_VALUE_SIZE 64
 
-      char timestamp_ms[24] = "";
-      if (m->has_timestamp_ms)
-        snprintf(timestamp_ms, sizeof(timestamp_ms), " %" PRIi64,
-                 m->timestamp_ms);
+/* metric_render_text formats a metric's line in plain text format. The prefix
+ * with the name and labels is formatted the first time only. */
+static int metric_render_text(Io__Prometheus__Client__MetricFamily const *fam,
+                              prom_metric_t *pm) {
+  Io__Prometheus__Client__Metric const *m = &pm->m;
 
-      if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
-        snprintf(line, sizeof(line), "%s{%s} " GAUGE_FORMAT "%s\n", fam->name,
-                 format_labels(labels, sizeof(labels), m), m->gauge->value,
-                 timestamp_ms);
-      else /* if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER) */
-        snprintf(line, sizeof(line), "%s{%s} %.0f%s\n", fam->name,
-                 format_labels(labels, sizeof(labels), m), m->counter->value,
-                 timestamp_ms);
+  if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__HISTOGRAM)
+    return metric_render_text_histogram(fam, pm);
+
+  if (pm->text == NULL) {
+    char line[1024]; /* 4x DATA_MAX_NAME_LEN? */
+    char labels[1024];
+
+    snprintf(line, sizeof(line), "%s{%s} ", fam->name,
+             format_labels(labels, sizeof(labels), m));
+    size_t prefix_len = strlen(line);
+
+    pm->text = malloc(prefix_len + METRIC_TEXT_VALUE_SIZE);
+    if (pm->text == NULL)
+      return ENOMEM;
+    memcpy(pm->text, line, prefix_len);
+    pm->text_size = prefix_len + METRIC_TEXT_VALUE_SIZE;
+    pm->text_prefix_len = prefix_len;
+  }
+
+  char timestamp_ms[24] = "";
+  if (m->has_timestamp_ms)
+    snprintf(timestamp_ms, sizeof(timestamp_ms), " %" PRIi64, m->timestamp_ms);
+
+  char *value = pm->text + pm->text_prefix_len;
+  size_t value_size = pm->text_size - pm->text_prefix_len;
+  if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
+    snprintf(value, value_size, GAUGE_FORMAT "%s\n",
+             (m->gauge != NULL) ? m->gauge->value : NAN, timestamp_ms);
+  else /* if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER) */
+    snprintf(value, value_size, "%.0f%s\n",
+             (m->counter != NULL) ? m->counter->value : NAN, timestamp_ms);
+
+  pm->text_len = pm->text_prefix_len + strlen(value);
+  pm->text_dirty = false;
+  return 0;
+}
 
-      buffer->append(buffer, strlen(line), (uint8_t *)line);
+/* format_text adds a metric family to a buffer in plain text format. Must be
+ * called with "metrics_lock" held. */
+static void format_text(ProtobufCBuffer *buffer, prom_family_t *pf) {
+  Io__Prometheus__Client__MetricFamily *fam = &pf->fam;
+
+  metric_family_sort(pf);
+
+  buffer->append(buffer, strlen(pf->text_header), (uint8_t *)pf->text_header);
+
+  for (size_t i = 0; i < fam->n_metric; i++) {
+    prom_metric_t *pm = (prom_metric_t *)fam->metric[i];
+
+    int status = pm->text_dirty ? metric_render_text(fam, pm) : 0;
+    metric_account(pm);
+    if (status != 0) {
+      ERROR("write_prometheus plugin: Rendering a metric of \"%s\" failed.",
+            fam->name);
+      continue;
     }
+
+    buffer->append(buffer, pm->text_len, (uint8_t *)pm->text);
   }
-  c_avl_iterator_destroy(iter);
+}
 
+/* format_text_footer adds the comment closing the plain text format. */
+static void format_text_footer(ProtobufCBuffer *buffer) {
   char server[1024];
   snprintf(server, sizeof(server), "\n# collectd/write_prometheus %s at %s\n",
            PACKAGE_VERSION, hostname_g);
   buffer->append(buffer, strlen(server), (uint8_t *)server);
+}
+
+/*
+ * Streaming responses. The metric families are formatted a chunk at a time
+ * while microhttpd sends the response, so that a scrape neither holds
+ * "metrics_lock" for the time it takes to send, nor needs memory for the entire
+ * response. The names of the families are copied when the scrape starts; a
+ * family removed in the meantime is skipped, one added in the meantime is
+ * exported by the next scrape.
+ * {{{ */
+/* Amount of output formatted while holding "metrics_lock" once. */
+#define STREAM_CHUNK_SIZE 32768
+
+#ifndef MHD_CONTENT_READER_END_OF_STREAM
+#define MHD_CONTENT_READER_END_OF_STREAM ((ssize_t)-1)
+#endif
+#ifndef MHD_CONTENT_READER_END_WITH_ERROR
+#define MHD_CONTENT_READER_END_WITH_ERROR ((ssize_t)-2)
+#endif
+#ifndef MHD_SIZE_UNKNOWN
+#define MHD_SIZE_UNKNOWN ((uint64_t)-1)
+#endif
+
+/* stream_buffer_t is a ProtobufCBuffer growing on the heap. */
+typedef struct {
+  ProtobufCBuffer base;
+  uint8_t *data;
+  size_t size;
+  size_t len;
+  bool failed;
+} stream_buffer_t;
+
+typedef struct {
+  bool want_proto;
+  bool want_gzip;
+
+  char **names;
+  size_t names_num;
+  size_t names_pos;
+  bool eof;
+
+  stream_buffer_t raw;
+  size_t raw_pos;
+
+#if HAVE_LIBZ
+  z_stream z;
+  bool z_done;
+#endif
+} prom_stream_t;
+
+static void stream_buffer_append(ProtobufCBuffer *buffer, size_t len,
+                                 uint8_t const *data) {
+  stream_buffer_t *b = (stream_buffer_t *)buffer;
+
+  if (b->failed)
+    return;
+
+  if (b->len + len > b->size) {
+    size_t size = (b->size != 0) ? b->size : STREAM_CHUNK_SIZE;
+    while (b->len + len > size)
+      size *= 2;
+
+    uint8_t *tmp = realloc(b->data, size);
+    if (tmp == NULL) {
+      ERROR("write_prometheus plugin: realloc failed.");
+      b->failed = true;
+      return;
+    }
+    b->data = tmp;
+    b->size = size;
+  }
+
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+/* accepts_gzip parses an "Accept-Encoding" header and returns true if the
+ * client accepts gzip compressed responses. */
+static bool accepts_gzip(char const *accept_encoding) {
+  if (accept_encoding == NULL)
+    return false;
+
+  char const *ptr = accept_encoding;
+  while (*ptr != 0) {
+    ptr += strspn(ptr, " \t,");
+    size_t len = strcspn(ptr, " \t,;");
+    bool is_gzip = ((len == 4) && (strncasecmp(ptr, "gzip", len) == 0)) ||
+                   ((len == 1) && (ptr[0] == '*'));
+    ptr += len;
+
+    /* Parameters, e.g. "gzip;q=0.5". A weight of zero means "not
+     * acceptable". */
+    double q = 1.0;
+    size_t params_len = strcspn(ptr, ",");
+    char const *q_ptr = strstr(ptr, "q=");
+    if ((q_ptr != NULL) && (q_ptr < ptr + params_len))
+      q = atof(q_ptr + strlen("q="));
+    ptr += params_len;
+
+    if (is_gzip)
+      return q > 0.0;
+  }
+
+  return false;
+}
+
+static void stream_destroy(void *arg) {
+  prom_stream_t *s = arg;
+  if (s == NULL)
+    return;
+
+  for (size_t i = 0; i < s->names_num; i++)
+    sfree(s->names[i]);
+  sfree(s->names);
+  sfree(s->raw.data);
+
+#if HAVE_LIBZ
+  if (s->want_gzip)
+    deflateEnd(&s->z);
+#endif
+
+  sfree(s);
+}
+
+static prom_stream_t *stream_create(bool want_proto, bool want_gzip) {
+  prom_stream_t *s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+
+  s->want_proto = want_proto;
+  s->raw.base.append = stream_buffer_append;
+
+#if HAVE_LIBZ
+  if (want_gzip) {
+    /* 16 added to the window bits selects the gzip format. */
+    if (deflateInit2(&s->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+                     /* memLevel = */ 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      ERROR("write_prometheus plugin: deflateInit2 failed.");
+      sfree(s);
+      return NULL;
+    }
+    s->want_gzip = true;
+  }
+#endif
+
+  pthread_mutex_lock(&metrics_lock);
+  if (want_proto)
+    render_proto = true;
+  else
+    render_text = true;
+
+  int size = c_avl_size(metrics);
+  if (size > 0)
+    s->names = calloc((size_t)size, sizeof(*s->names));
+
+  char *name;
+  void *unused_fam;
+  c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
+  while ((s->names != NULL) &&
+         (c_avl_iterator_next(iter, (void *)&name, &unused_fam) == 0)) {
+    s->names[s->names_num] = strdup(name);
+    if (s->names[s->names_num] == NULL)
+      break;
+    s->names_num++;
+  }
+  c_avl_iterator_destroy(iter);
+  pthread_mutex_unlock(&metrics_lock);
 
+  if ((size > 0) && (s->names_num != (size_t)size)) {
+    ERROR("write_prometheus plugin: Copying the metric family names failed.");
+    stream_destroy(s);
+    return NULL;
+  }
+
+  return s;
+}
+
+/* stream_fill formats the next metric families. */
+static int stream_fill(prom_stream_t *s) {
+  ProtobufCBuffer *buffer = (ProtobufCBuffer *)&s->raw;
+
+  s->raw.len = 0;
+  s->raw_pos = 0;
+
+  pthread_mutex_lock(&metrics_lock);
+  while ((s->names_pos < s->names_num) && (s->raw.len < STREAM_CHUNK_SIZE)) {
+    prom_family_t *pf;
+    if (c_avl_get(metrics, s->names[s->names_pos], (void *)&pf) == 0) {
+      if (s->want_proto)
+        format_protobuf(buffer, pf);
+      else
+        format_text(buffer, pf);
+    }
+    s->names_pos++;
+  }
+
+  if (s->names_pos >= s->names_num) {
+    if (!s->want_proto)
+      format_text_footer(buffer);
+    s->eof = true;
+  }
   pthread_mutex_unlock(&metrics_lock);
+
+  return s->raw.failed ? ENOMEM : 0;
 }
 
+/* stream_read is the microhttpd content reader callback. It copies, or
+ * compresses, formatted data into "buf" and formats more when needed. */
+static ssize_t stream_read(void *cls, __attribute__((unused)) uint64_t pos,
+                           char *buf, size_t max) {
+  prom_stream_t *s = cls;
+  size_t n = 0;
+
+  while (n < max) {
+    if ((s->raw_pos >= s->raw.len) && !s->eof) {
+      if (stream_fill(s) != 0)
+        return MHD_CONTENT_READER_END_WITH_ERROR;
+      continue;
+    }
+
+#if HAVE_LIBZ
+    if (s->want_gzip) {
+      if (s->z_done)
+        break;
+
+      s->z.next_in = s->raw.data + s->raw_pos;
+      s->z.avail_in = (uInt)(s->raw.len - s->raw_pos);
+      s->z.next_out = (Bytef *)buf + n;
+      s->z.avail_out = (uInt)(max - n);
+
+      int status = deflate(&s->z, s->eof ? Z_FINISH : Z_NO_FLUSH);
+      if (status == Z_STREAM_END) {
+        s->z_done = true;
+      } else if ((status != Z_OK) && (status != Z_BUF_ERROR)) {
+        ERROR("write_prometheus plugin: deflate failed with status %d.",
+              status);
+        return MHD_CONTENT_READER_END_WITH_ERROR;
+      }
+
+      s->raw_pos = s->raw.len - s->z.avail_in;
+      n = max - s->z.avail_out;
+      continue;
+    }
+#endif
+
+    if (s->raw_pos >= s->raw.len) /* && s->eof */
+      break;
+
+    size_t len = s->raw.len - s->raw_pos;
+    if (len > max - n)
+      len = max - n;
+    memcpy(buf + n, s->raw.data + s->raw_pos, len);
+    s->raw_pos += len;
+    n += len;
+  }
+
+  if (n == 0)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  return (ssize_t)n;
+}
+/* }}} */
+
 /* http_handler is the callback called by the microhttpd library. It essentially
  * handles all HTTP request aspects and creates an HTTP response. */
 static int http_handler(void *cls, struct MHD_Connection *connection,
@@ -247,29 +745,35 @@ static int http_handler(void *cls, struct MHD_Connection *connection,
   bool want_proto = (accept != NULL) &&
                     (strstr(accept, "application/vnd.google.protobuf") != NULL);
 
-  uint8_t scratch[4096] = {0};
-  ProtobufCBufferSimple simple = PROTOBUF_C_BUFFER_SIMPLE_INIT(scratch);
-  ProtobufCBuffer *buffer = (ProtobufCBuffer *)&simple;
-
-  if (want_proto)
-    format_protobuf(buffer);
-  else
-    format_text(buffer);
-
-#if defined(MHD_VERSION) && MHD_VERSION >= 0x00090500
-  struct MHD_Response *res = MHD_create_response_from_buffer(
-      simple.len, simple.data, MHD_RESPMEM_MUST_COPY);
+#if HAVE_LIBZ
+  bool want_gzip = accepts_gzip(MHD_lookup_connection_value(
+      connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING));
 #else
-  struct MHD_Response *res = MHD_create_response_from_data(
-      simple.len, simple.data, /* must_free = */ 0, /* must_copy = */ 1);
+  bool want_gzip = false;
 #endif
+
+  prom_stream_t *s = stream_create(want_proto, want_gzip);
+  if (s == NULL)
+    return MHD_NO;
+
+  /* The response is sent with chunked transfer encoding. */
+  struct MHD_Response *res =
+      MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, STREAM_CHUNK_SIZE,
+                                        stream_read, s, stream_destroy);
+  if (res == NULL) {
+    stream_destroy(s);
+    return MHD_NO;
+  }
   MHD_add_response_header(res, MHD_HTTP_HEADER_CONTENT_TYPE,
                           want_proto ? CONTENT_TYPE_PROTO : CONTENT_TYPE_TEXT);
+  MHD_add_response_header(res, MHD_HTTP_HEADER_VARY,
+                          MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  if (want_gzip)
+    MHD_add_response_header(res, MHD_HTTP_HEADER_CONTENT_ENCODING, "gzip");
 
   int status = MHD_queue_response(connection, MHD_HTTP_OK, res);
 
   MHD_destroy_response(res);
-  PROTOBUF_C_BUFFER_SIMPLE_CLEAR(&simple);
   return status;
 }
 
@@ -318,6 +822,17 @@ label_pair_clone(Io__Prometheus__Client__LabelPair const *orig) {
   return copy;
 }
 
+/* metric_histogram_destroy frees the histogram of a metric, if any. */
+static void metric_histogram_destroy(Io__Prometheus__Client__Metric *msg) {
+  if (msg->histogram == NULL)
+    return;
+
+  for (size_t i = 0; i < msg->histogram->n_bucket; i++)
+    sfree(msg->histogram->bucket[i]);
+  sfree(msg->histogram->bucket);
+  sfree(msg->histogram);
+}
+
 /* metric_destroy frees the memory used by a metric. */
 static void metric_destroy(Io__Prometheus__Client__Metric *msg) {
   if (msg == NULL)
@@ -330,7 +845,14 @@ static void metric_destroy(Io__Prometheus__Client__Metric *msg) {
 
   sfree(msg->gauge);
   sfree(msg->counter);
+  metric_histogram_destroy(msg);
+
+  prom_metric_t *pm = (prom_metric_t *)msg;
+  sfree(pm->text);
+  sfree(pm->proto);
 
+  if (pm->bytes != 0)
+    memstat_add(prom_memstat, -(int64_t)pm->bytes, -1);
   sfree(msg);
 }
 
@@ -425,32 +947,66 @@ static int metric_cmp(void const *a, void const *b) {
 /* metric_clone allocates and initializes a new metric based on orig. */
 static Io__Prometheus__Client__Metric *
 metric_clone(Io__Prometheus__Client__Metric const *orig) {
-  Io__Prometheus__Client__Metric *copy = calloc(1, sizeof(*copy));
-  if (copy == NULL)
+  prom_metric_t *pm = calloc(1, sizeof(*pm));
+  if (pm == NULL)
     return NULL;
+  Io__Prometheus__Client__Metric *copy = &pm->m;
   io__prometheus__client__metric__init(copy);
+  pm->text_dirty = true;
+  pm->proto_dirty = true;
 
   copy->n_label = orig->n_label;
   copy->label = calloc(copy->n_label, sizeof(*copy->label));
   if (copy->label == NULL) {
-    sfree(copy);
+    sfree(pm);
     return NULL;
   }
 
+  pm->label_bytes = copy->n_label * sizeof(*copy->label);
   for (size_t i = 0; i < copy->n_label; i++) {
     copy->label[i] = label_pair_clone(orig->label[i]);
     if (copy->label[i] == NULL) {
       metric_destroy(copy);
       return NULL;
     }
+    pm->label_bytes += sizeof(*copy->label[i]) +
+                       strlen(copy->label[i]->name) + 1 +
+                       strlen(copy->label[i]->value) + 1;
   }
 
+  metric_account(pm);
   return copy;
 }
 
+/* metric_update_timestamp stores the timestamp of the latest value in m. */
+static void metric_update_timestamp(Io__Prometheus__Client__Metric *m,
+                                    cdtime_t t, cdtime_t interval) {
+  /* Prometheus has a globally configured timeout after which metrics are
+   * considered stale. This causes problems when metrics have an interval
+   * exceeding that limit. We emulate the behavior of "pushgateway" and *not*
+   * send a timestamp value – Prometheus will fill in the current time. */
+  if (interval <= staleness_delta) {
+    m->timestamp_ms = CDTIME_T_TO_MS(t);
+    m->has_timestamp_ms = 1;
+  } else {
+    static c_complain_t long_metric = C_COMPLAIN_INIT_STATIC;
+    c_complain(
+        LOG_NOTICE, &long_metric,
+        "write_prometheus plugin: You have metrics with an interval exceeding "
+        "\"StalenessDelta\" setting (%.3fs). This is suboptimal, please check "
+        "the collectd.conf(5) manual page to understand what's going on.",
+        CDTIME_T_TO_DOUBLE(staleness_delta));
+
+    m->timestamp_ms = 0;
+    m->has_timestamp_ms = 0;
+  }
+}
+
 /* metric_update stores the new value and timestamp in m. */
 static int metric_update(Io__Prometheus__Client__Metric *m, value_t value,
                          int ds_type, cdtime_t t, cdtime_t interval) {
+  metric_histogram_destroy(m);
+
   if (ds_type == DS_TYPE_GAUGE) {
     sfree(m->counter);
     if (m->gauge == NULL) {
@@ -485,43 +1041,185 @@ static int metric_update(Io__Prometheus__Client__Metric *m, value_t value,
     m->counter->has_value = 1;
   }
 
-  /* Prometheus has a globally configured timeout after which metrics are
-   * considered stale. This causes problems when metrics have an interval
-   * exceeding that limit. We emulate the behavior of "pushgateway" and *not*
-   * send a timestamp value – Prometheus will fill in the current time. */
-  if (interval <= staleness_delta) {
-    m->timestamp_ms = CDTIME_T_TO_MS(t);
-    m->has_timestamp_ms = 1;
-  } else {
-    static c_complain_t long_metric = C_COMPLAIN_INIT_STATIC;
-    c_complain(
-        LOG_NOTICE, &long_metric,
-        "write_prometheus plugin: You have metrics with an interval exceeding "
-        "\"StalenessDelta\" setting (%.3fs). This is suboptimal, please check "
-        "the collectd.conf(5) manual page to understand what's going on.",
-        CDTIME_T_TO_DOUBLE(staleness_delta));
+  metric_update_timestamp(m, t, interval);
+  return 0;
+}
 
-    m->timestamp_ms = 0;
-    m->has_timestamp_ms = 0;
+/* metric_update_histogram stores the new histogram and timestamp in m. */
+static int metric_update_histogram(Io__Prometheus__Client__Metric *m,
+                                   histogram_t const *h, cdtime_t t,
+                                   cdtime_t interval) {
+  sfree(m->gauge);
+  sfree(m->counter);
+
+  Io__Prometheus__Client__Histogram *hist = m->histogram;
+  if ((hist != NULL) && (hist->n_bucket != h->buckets_num)) {
+    metric_histogram_destroy(m);
+    hist = NULL;
+  }
+
+  if (hist == NULL) {
+    hist = calloc(1, sizeof(*hist));
+    if (hist == NULL)
+      return ENOMEM;
+    io__prometheus__client__histogram__init(hist);
+    m->histogram = hist;
+
+    if (h->buckets_num > 0) {
+      hist->bucket = calloc(h->buckets_num, sizeof(*hist->bucket));
+      if (hist->bucket == NULL) {
+        metric_histogram_destroy(m);
+        return ENOMEM;
+      }
+    }
+
+    for (size_t i = 0; i < h->buckets_num; i++) {
+      hist->bucket[i] = calloc(1, sizeof(*hist->bucket[i]));
+      if (hist->bucket[i] == NULL) {
+        metric_histogram_destroy(m);
+        return ENOMEM;
+      }
+      io__prometheus__client__bucket__init(hist->bucket[i]);
+      hist->n_bucket++;
+    }
+  }
+
+  hist->sample_count = h->count;
+  hist->has_sample_count = 1;
+  hist->sample_sum = h->sum;
+  hist->has_sample_sum = 1;
+
+  for (size_t i = 0; i < h->buckets_num; i++) {
+    hist->bucket[i]->upper_bound = h->buckets[i].upper_bound;
+    hist->bucket[i]->has_upper_bound = 1;
+    hist->bucket[i]->cumulative_count = h->buckets[i].cumulative_count;
+    hist->bucket[i]->has_cumulative_count = 1;
   }
 
+  metric_update_timestamp(m, t, interval);
   return 0;
 }
 
+/* metric_hash hashes the label values of a metric (FNV-1a). As explained in
+ * metric_cmp(), the values identify a metric within its family. */
+static uint32_t metric_hash(Io__Prometheus__Client__Metric const *m) {
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < m->n_label; i++) {
+    /* Include the terminating null byte to separate the values. */
+    for (char const *ptr = m->label[i]->value;; ptr++) {
+      hash ^= (uint8_t)*ptr;
+      hash *= 16777619u;
+      if (*ptr == 0)
+        break;
+    }
+  }
+
+  return hash;
+}
+
+/* metric_family_index_find returns the slot of the metric matching key, or the
+ * empty slot where it would be inserted. */
+static prom_metric_t **
+metric_family_index_find(prom_family_t *pf, Io__Prometheus__Client__Metric *key,
+                         uint32_t hash) {
+  size_t mask = pf->index_size - 1;
+
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    prom_metric_t **slot = &pf->index[i];
+    if (*slot == NULL)
+      return slot;
+
+    Io__Prometheus__Client__Metric *m = &(*slot)->m;
+    if (((*slot)->hash == hash) && (metric_cmp(&key, &m) == 0))
+      return slot;
+  }
+}
+
+/* metric_family_index_grow doubles the size of the hash table. */
+static int metric_family_index_grow(prom_family_t *pf) {
+  size_t size = (pf->index_size != 0) ? 2 * pf->index_size : 16;
+  prom_metric_t **index = calloc(size, sizeof(*index));
+  if (index == NULL)
+    return ENOMEM;
+
+  sfree(pf->index);
+  pf->index = index;
+  pf->index_size = size;
+
+  for (size_t i = 0; i < pf->fam.n_metric; i++) {
+    prom_metric_t *pm = (prom_metric_t *)pf->fam.metric[i];
+    *metric_family_index_find(pf, &pm->m, pm->hash) = pm;
+  }
+
+  return 0;
+}
+
+/* metric_family_index_remove empties a slot of the hash table, moving back the
+ * entries following it as necessary to keep them reachable. */
+static void metric_family_index_remove(prom_family_t *pf,
+                                       prom_metric_t **slot) {
+  size_t mask = pf->index_size - 1;
+  size_t hole = (size_t)(slot - pf->index);
+
+  pf->index[hole] = NULL;
+  for (size_t i = (hole + 1) & mask; pf->index[i] != NULL; i = (i + 1) & mask) {
+    size_t home = pf->index[i]->hash & mask;
+
+    /* The entry can fill the hole unless its home slot lies cyclically in
+     * (hole, i]. */
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      pf->index[hole] = pf->index[i];
+      pf->index[i] = NULL;
+      hole = i;
+    }
+  }
+}
+
+/* metric_family_sort sorts the metrics of a family, which are appended in
+ * whatever order they are created, so that they are exported in a stable
+ * order. Called when formatting a family. */
+static void metric_family_sort(prom_family_t *pf) {
+  if (pf->sorted)
+    return;
+
+  qsort(pf->fam.metric, pf->fam.n_metric, sizeof(*pf->fam.metric), metric_cmp);
+  for (size_t i = 0; i < pf->fam.n_metric; i++)
+    ((prom_metric_t *)pf->fam.metric[i])->pos = i;
+  pf->sorted = true;
+}
+
 /* metric_family_add_metric adds m to the metric list of fam. */
 static int metric_family_add_metric(Io__Prometheus__Client__MetricFamily *fam,
                                     Io__Prometheus__Client__Metric *m) {
-  Io__Prometheus__Client__Metric **tmp =
-      realloc(fam->metric, (fam->n_metric + 1) * sizeof(*fam->metric));
-  if (tmp == NULL)
-    return ENOMEM;
-  fam->metric = tmp;
+  prom_family_t *pf = (prom_family_t *)fam;
+  prom_metric_t *pm = (prom_metric_t *)m;
+
+  /* Keep the hash table at most 3/4 full. */
+  if (4 * (fam->n_metric + 1) > 3 * pf->index_size) {
+    int status = metric_family_index_grow(pf);
+    if (status != 0)
+      return status;
+  }
 
+  if (fam->n_metric >= pf->metric_size) {
+    size_t size = (pf->metric_size != 0) ? 2 * pf->metric_size : 4;
+    Io__Prometheus__Client__Metric **tmp =
+        realloc(fam->metric, size * sizeof(*fam->metric));
+    if (tmp == NULL)
+      return ENOMEM;
+    fam->metric = tmp;
+    pf->metric_size = size;
+  }
+
+  pm->pos = fam->n_metric;
   fam->metric[fam->n_metric] = m;
   fam->n_metric++;
+  pf->sorted = false;
+  metric_family_account(pf);
 
-  /* Sort the metrics so that lookup is fast. */
-  qsort(fam->metric, fam->n_metric, sizeof(*fam->metric), metric_cmp);
+  pm->hash = metric_hash(m);
+  *metric_family_index_find(pf, m, pm->hash) = pm;
 
   return 0;
 }
@@ -531,34 +1229,32 @@ static int metric_family_add_metric(Io__Prometheus__Client__MetricFamily *fam,
 static int
 metric_family_delete_metric(Io__Prometheus__Client__MetricFamily *fam,
                             value_list_t const *vl) {
+  prom_family_t *pf = (prom_family_t *)fam;
   Io__Prometheus__Client__Metric *key = METRIC_INIT;
   METRIC_ADD_LABELS(key, vl);
 
-  size_t i;
-  for (i = 0; i < fam->n_metric; i++) {
-    if (metric_cmp(&key, &fam->metric[i]) == 0)
-      break;
-  }
+  if (pf->index_size == 0)
+    return ENOENT;
 
-  if (i >= fam->n_metric)
+  prom_metric_t **slot = metric_family_index_find(pf, key, metric_hash(key));
+  if (*slot == NULL)
     return ENOENT;
+  prom_metric_t *pm = *slot;
+  metric_family_index_remove(pf, slot);
 
+  /* Move the last metric into the gap; the order is restored when the family
+   * is formatted next. */
+  size_t i = pm->pos;
+  assert(fam->metric[i] == &pm->m);
   metric_destroy(fam->metric[i]);
-  if ((fam->n_metric - 1) > i)
-    memmove(&fam->metric[i], &fam->metric[i + 1],
-            ((fam->n_metric - 1) - i) * sizeof(fam->metric[i]));
-  fam->n_metric--;
 
-  if (fam->n_metric == 0) {
-    sfree(fam->metric);
-    return 0;
+  fam->n_metric--;
+  if (i < fam->n_metric) {
+    fam->metric[i] = fam->metric[fam->n_metric];
+    ((prom_metric_t *)fam->metric[i])->pos = i;
+    pf->sorted = false;
   }
 
-  Io__Prometheus__Client__Metric **tmp =
-      realloc(fam->metric, fam->n_metric * sizeof(*fam->metric));
-  if (tmp != NULL)
-    fam->metric = tmp;
-
   return 0;
 }
 
@@ -567,16 +1263,14 @@ metric_family_delete_metric(Io__Prometheus__Client__MetricFamily *fam,
 static Io__Prometheus__Client__Metric *
 metric_family_get_metric(Io__Prometheus__Client__MetricFamily *fam,
                          value_list_t const *vl) {
+  prom_family_t *pf = (prom_family_t *)fam;
   Io__Prometheus__Client__Metric *key = METRIC_INIT;
   METRIC_ADD_LABELS(key, vl);
 
-  /* Metrics are sorted in metric_family_add_metric() so that we can do a binary
-   * search here. */
-  Io__Prometheus__Client__Metric **m = bsearch(
-      &key, fam->metric, fam->n_metric, sizeof(*fam->metric), metric_cmp);
-
-  if (m != NULL) {
-    return *m;
+  if (pf->index_size != 0) {
+    prom_metric_t *pm = *metric_family_index_find(pf, key, metric_hash(key));
+    if (pm != NULL)
+      return &pm->m;
   }
 
   Io__Prometheus__Client__Metric *new_metric = metric_clone(key);
@@ -594,16 +1288,35 @@ metric_family_get_metric(Io__Prometheus__Client__MetricFamily *fam,
 }
 
 /* metric_family_update looks up the matching metric in a metric family,
- * allocating it if necessary, and updates the metric to the latest value. */
+ * allocating it if necessary, and updates the metric to the latest value, or
+ * to the histogram h of a histogram family. The formats which are being
+ * scraped are rendered right away, the others when they are scraped. */
 static int metric_family_update(Io__Prometheus__Client__MetricFamily *fam,
                                 data_set_t const *ds, value_list_t const *vl,
-                                size_t ds_index) {
+                                size_t ds_index, histogram_t const *h) {
   Io__Prometheus__Client__Metric *m = metric_family_get_metric(fam, vl);
   if (m == NULL)
     return -1;
 
-  return metric_update(m, vl->values[ds_index], ds->ds[ds_index].type, vl->time,
-                       vl->interval);
+  prom_metric_t *pm = (prom_metric_t *)m;
+  int status;
+  if (h != NULL)
+    status = metric_update_histogram(m, h, vl->time, vl->interval);
+  else
+    status = metric_update(m, vl->values[ds_index], ds->ds[ds_index].type,
+                           vl->time, vl->interval);
+  if (status == 0) {
+    pm->text_dirty = true;
+    pm->proto_dirty = true;
+
+    if (render_text)
+      status = metric_render_text(fam, pm);
+    if ((status == 0) && render_proto)
+      status = metric_render_proto(pm);
+  }
+
+  metric_account(pm);
+  return status;
 }
 
 /* metric_family_destroy frees the memory used by a metric family. */
@@ -619,16 +1332,23 @@ static void metric_family_destroy(Io__Prometheus__Client__MetricFamily *msg) {
   }
   sfree(msg->metric);
 
+  prom_family_t *pf = (prom_family_t *)msg;
+  sfree(pf->text_header);
+  sfree(pf->proto_header);
+  sfree(pf->index);
+
+  memstat_add(prom_memstat, -(int64_t)pf->bytes, 0);
   sfree(msg);
 }
 
 /* metric_family_create allocates and initializes a new metric family. */
 static Io__Prometheus__Client__MetricFamily *
 metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
-                     size_t ds_index) {
-  Io__Prometheus__Client__MetricFamily *msg = calloc(1, sizeof(*msg));
-  if (msg == NULL)
+                     size_t ds_index, bool histogram) {
+  prom_family_t *pf = calloc(1, sizeof(*pf));
+  if (pf == NULL)
     return NULL;
+  Io__Prometheus__Client__MetricFamily *msg = &pf->fam;
   io__prometheus__client__metric_family__init(msg);
 
   msg->name = name;
@@ -641,11 +1361,38 @@ metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
       ds->ds[ds_index].name);
   msg->help = strdup(help);
 
-  msg->type = (ds->ds[ds_index].type == DS_TYPE_GAUGE)
-                  ? IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE
-                  : IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER;
+  if (histogram)
+    msg->type = IO__PROMETHEUS__CLIENT__METRIC_TYPE__HISTOGRAM;
+  else
+    msg->type = (ds->ds[ds_index].type == DS_TYPE_GAUGE)
+                    ? IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE
+                    : IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER;
   msg->has_type = 1;
 
+  char const *type = "counter";
+  if (msg->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
+    type = "gauge";
+  else if (msg->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__HISTOGRAM)
+    type = "histogram";
+
+  char header[2048];
+  snprintf(header, sizeof(header), "# HELP %s %s\n# TYPE %s %s\n", msg->name,
+           (msg->help != NULL) ? msg->help : "", msg->name, type);
+  pf->text_header = strdup(header);
+
+  /* The family has no metrics yet, so this packs the other fields. */
+  pf->proto_header_len =
+      io__prometheus__client__metric_family__get_packed_size(msg);
+  pf->proto_header = malloc(pf->proto_header_len);
+  if ((pf->text_header == NULL) || (pf->proto_header == NULL)) {
+    /* "name" is owned by the caller until this function succeeds. */
+    msg->name = NULL;
+    metric_family_destroy(msg);
+    return NULL;
+  }
+  io__prometheus__client__metric_family__pack(msg, pf->proto_header);
+
+  metric_family_account(pf);
   return msg;
 }
 
@@ -653,9 +1400,11 @@ metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
  * done in the same way as done by the "collectd_exporter" for best possible
  * compatibility. In essence, the plugin, type and data source name go in the
  * metric family name, while hostname, plugin instance and type instance go into
- * the labels of a metric. */
-static char *metric_family_name(data_set_t const *ds, value_list_t const *vl,
-                                size_t ds_index) {
+ * the labels of a metric. Histograms get no "total" suffix: the series of a
+ * histogram have their own suffixes. */
+static void metric_family_name(char *buffer, size_t buffer_size,
+                               data_set_t const *ds, value_list_t const *vl,
+                               size_t ds_index, bool histogram) {
   char const *fields[5] = {"collectd"};
   size_t fields_num = 1;
 
@@ -673,41 +1422,39 @@ static char *metric_family_name(data_set_t const *ds, value_list_t const *vl,
 
   /* Prometheus best practices:
    * cumulative metrics should have a "total" suffix. */
-  if ((ds->ds[ds_index].type == DS_TYPE_COUNTER) ||
-      (ds->ds[ds_index].type == DS_TYPE_DERIVE)) {
+  if (!histogram && ((ds->ds[ds_index].type == DS_TYPE_COUNTER) ||
+                     (ds->ds[ds_index].type == DS_TYPE_DERIVE))) {
     fields[fields_num] = "total";
     fields_num++;
   }
 
-  char name[5 * DATA_MAX_NAME_LEN];
-  strjoin(name, sizeof(name), (char **)fields, fields_num, "_");
-  return strdup(name);
+  strjoin(buffer, buffer_size, (char **)fields, fields_num, "_");
 }
 
 /* metric_family_get looks up the matching metric family, allocating it if
- * necessary. */
+ * necessary. The name is only copied to the heap for new families. */
 static Io__Prometheus__Client__MetricFamily *
 metric_family_get(data_set_t const *ds, value_list_t const *vl, size_t ds_index,
-                  bool allocate) {
-  char *name = metric_family_name(ds, vl, ds_index);
-  if (name == NULL) {
-    ERROR("write_prometheus plugin: Allocating metric family name failed.");
-    return NULL;
-  }
+                  bool histogram, bool allocate) {
+  char buffer[5 * DATA_MAX_NAME_LEN];
+  metric_family_name(buffer, sizeof(buffer), ds, vl, ds_index, histogram);
 
   Io__Prometheus__Client__MetricFamily *fam = NULL;
-  if (c_avl_get(metrics, name, (void *)&fam) == 0) {
-    sfree(name);
+  if (c_avl_get(metrics, buffer, (void *)&fam) == 0) {
     assert(fam != NULL);
     return fam;
   }
 
-  if (!allocate) {
-    sfree(name);
+  if (!allocate)
+    return NULL;
+
+  char *name = strdup(buffer);
+  if (name == NULL) {
+    ERROR("write_prometheus plugin: Allocating metric family name failed.");
     return NULL;
   }
 
-  fam = metric_family_create(name, ds, vl, ds_index);
+  fam = metric_family_create(name, ds, vl, ds_index, histogram);
   if (fam == NULL) {
     ERROR("write_prometheus plugin: Allocating metric family failed.");
     sfree(name);
@@ -862,6 +1609,8 @@ static int prom_config(oconfig_item_t *ci) {
 }
 
 static int prom_init() {
+  prom_memstat = memstat_get("write_prometheus");
+
   if (metrics == NULL) {
     metrics = c_avl_create((void *)strcmp);
     if (metrics == NULL) {
@@ -885,15 +1634,20 @@ static int prom_init() {
 
 static int prom_write(data_set_t const *ds, value_list_t const *vl,
                       __attribute__((unused)) user_data_t *ud) {
+  /* A histogram in the meta data, see utils_histogram.h, replaces the value of
+   * single-value metrics. */
+  histogram_t h = {0};
+  bool histogram = (ds->ds_num == 1) && (histogram_meta_get(vl->meta, &h) == 0);
+
   pthread_mutex_lock(&metrics_lock);
 
   for (size_t i = 0; i < ds->ds_num; i++) {
     Io__Prometheus__Client__MetricFamily *fam =
-        metric_family_get(ds, vl, i, /* allocate = */ true);
+        metric_family_get(ds, vl, i, histogram, /* allocate = */ true);
     if (fam == NULL)
       continue;
 
-    int status = metric_family_update(fam, ds, vl, i);
+    int status = metric_family_update(fam, ds, vl, i, histogram ? &h : NULL);
     if (status != 0) {
       ERROR("write_prometheus plugin: Updating metric \"%s\" failed with "
             "status %d",
@@ -903,6 +1657,7 @@ static int prom_write(data_set_t const *ds, value_list_t const *vl,
   }
 
   pthread_mutex_unlock(&metrics_lock);
+  histogram_reset(&h);
   return 0;
 }
 
@@ -915,8 +1670,14 @@ static int prom_missing(value_list_t const *vl,
   pthread_mutex_lock(&metrics_lock);
 
   for (size_t i = 0; i < ds->ds_num; i++) {
+    /* The meta data is not available here, so look for a histogram family,
+     * too. */
     Io__Prometheus__Client__MetricFamily *fam =
-        metric_family_get(ds, vl, i, /* allocate = */ false);
+        metric_family_get(ds, vl, i, /* histogram = */ false,
+                          /* allocate = */ false);
+    if ((fam == NULL) && (ds->ds_num == 1))
+      fam = metric_family_get(ds, vl, i, /* histogram = */ true,
+                              /* allocate = */ false);
     if (fam == NULL)
       continue;
 
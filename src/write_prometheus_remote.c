@@ -0,0 +1,1074 @@
+/**
+ * collectd - src/write_prometheus_remote.c
+ * Copyright (C) 2018       The collectd authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * The "write_prometheus_remote" plugin pushes samples to a receiver of
+ * Prometheus' remote write protocol, e.g. Prometheus, Cortex or Thanos. Unlike
+ * the "write_prometheus" plugin, it doesn't keep the metrics in memory: each
+ * value is encoded as a TimeSeries message with a single sample right away and
+ * appended to a batch, which is sent as a snappy compressed WriteRequest.
+ *
+ * Receivers require the samples of a series to arrive in order. Series are
+ * therefore distributed over "Shards" by the hash of their identifier: each
+ * shard has its own batch, queue and sender thread, so that the shards are
+ * sent concurrently while all samples of a series go through the same queue.
+ *
+ * Synopsis:
+ *
+ * <Plugin write_prometheus_remote>
+ *   <Node "prometheus">
+ *     URL "http://localhost:9090/api/v1/write"
+ *     Shards 4
+ *     BatchSize 500
+ *   </Node>
+ * </Plugin>
+ */
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_complain.h"
+#include "utils_histogram.h"
+#include "utils_memstats.h"
+#include "utils_snappy.h"
+
+#include <curl/curl.h>
+
+#ifndef WRITE_PROMETHEUS_REMOTE_DEFAULT_SHARDS
+#define WRITE_PROMETHEUS_REMOTE_DEFAULT_SHARDS 4
+#endif
+
+#ifndef WRITE_PROMETHEUS_REMOTE_DEFAULT_BATCH_SIZE
+#define WRITE_PROMETHEUS_REMOTE_DEFAULT_BATCH_SIZE 500
+#endif
+
+#ifndef WRITE_PROMETHEUS_REMOTE_DEFAULT_BACKLOG_SIZE
+#define WRITE_PROMETHEUS_REMOTE_DEFAULT_BACKLOG_SIZE 8388608
+#endif
+
+#ifndef WRITE_PROMETHEUS_REMOTE_DEFAULT_RETRY_INTERVAL
+#define WRITE_PROMETHEUS_REMOTE_DEFAULT_RETRY_INTERVAL                        \
+  TIME_T_TO_CDTIME_T_STATIC(1)
+#endif
+
+/* The delay between retries doubles up to 2^WPR_MAX_BACKOFF_SHIFT times the
+ * RetryInterval. */
+#define WPR_MAX_BACKOFF_SHIFT 5
+
+/* Prometheus' staleness marker, a NaN which is distinguishable from the NaN
+ * values of gauges. */
+#define WPR_STALE_NAN 0x7ff0000000000002ull
+
+/* __name__, plugin, type, instance and le. */
+#define WPR_MAX_LABELS 5
+
+/*
+ * Private variables
+ */
+
+/* A WriteRequest message waiting to be sent. It's a plain concatenation of
+ * the encoded "timeseries" fields. */
+typedef struct wpr_request_s wpr_request_t;
+struct wpr_request_s {
+  char *data;
+  size_t size;
+  size_t capacity;
+  size_t samples;
+  wpr_request_t *next;
+};
+
+typedef struct wpr_node_s wpr_node_t;
+
+/* All members but the curl handle, which only the sender thread uses, are
+ * protected by "lock". */
+typedef struct {
+  wpr_node_t *node;
+  size_t index;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  wpr_request_t *batch;
+  cdtime_t batch_init_time;
+
+  wpr_request_t *queue_head;
+  wpr_request_t *queue_tail;
+  size_t queue_bytes;
+  c_complain_t backlog_complaint;
+  c_complain_t post_complaint;
+
+  pthread_t sender_thread;
+  bool sender_running;
+  bool sender_loop;
+
+  CURL *curl;
+  char curl_errbuf[CURL_ERROR_SIZE];
+} wpr_shard_t;
+
+struct wpr_node_s {
+  char *name;
+
+  char *url;
+  char *user;
+  char *pass;
+  bool verify_peer;
+  bool verify_host;
+  char *cacert;
+  char *capath;
+  char *clientkey;
+  char *clientcert;
+  char *clientkeypass;
+  struct curl_slist *headers;
+  int timeout;
+
+  size_t batch_size;
+  cdtime_t flush_interval;
+  size_t backlog_size;
+  cdtime_t retry_interval;
+
+  wpr_shard_t *shards;
+  size_t shards_num;
+};
+
+typedef struct {
+  char const *name;
+  char const *value;
+} wpr_label_t;
+
+static memstat_t *wpr_memstat;
+
+/*
+ * Protocol buffer encoding
+ *
+ * message WriteRequest { repeated TimeSeries timeseries = 1; }
+ * message TimeSeries   { repeated Label labels = 1;
+ *                        repeated Sample samples = 2; }
+ * message Label        { string name = 1; string value = 2; }
+ * message Sample       { double value = 1; int64 timestamp = 2; }
+ */
+static size_t wpr_varint_size(uint64_t v) /* {{{ */
+{
+  size_t size = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    size++;
+  }
+  return size;
+} /* }}} size_t wpr_varint_size */
+
+static char *wpr_put_varint(char *p, uint64_t v) /* {{{ */
+{
+  while (v >= 0x80) {
+    *p++ = (char)((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  *p++ = (char)v;
+  return p;
+} /* }}} char *wpr_put_varint */
+
+static char *wpr_put_bytes(char *p, uint8_t tag, /* {{{ */
+                           char const *data, size_t size) {
+  *p++ = (char)tag;
+  p = wpr_put_varint(p, (uint64_t)size);
+  memcpy(p, data, size);
+  return p + size;
+} /* }}} char *wpr_put_bytes */
+
+static size_t wpr_label_size(wpr_label_t const *l) /* {{{ */
+{
+  size_t name_len = strlen(l->name);
+  size_t value_len = strlen(l->value);
+
+  return 1 + wpr_varint_size(name_len) + name_len + 1 +
+         wpr_varint_size(value_len) + value_len;
+} /* }}} size_t wpr_label_size */
+
+static size_t wpr_sample_size(int64_t timestamp) /* {{{ */
+{
+  return 1 + sizeof(uint64_t) + 1 + wpr_varint_size((uint64_t)timestamp);
+} /* }}} size_t wpr_sample_size */
+
+/* Metric and label names are restricted to [a-zA-Z_:][a-zA-Z0-9_:]*, colons
+ * being reserved for recording rules. Other characters, e.g. the dashes in
+ * some plugin names, are replaced by underscores. */
+static void wpr_sanitize_name(char *name) /* {{{ */
+{
+  for (char *c = name; *c != 0; c++) {
+    if (((*c >= 'a') && (*c <= 'z')) || ((*c >= 'A') && (*c <= 'Z')) ||
+        (*c == '_') || ((c != name) && (*c >= '0') && (*c <= '9')))
+      continue;
+    *c = '_';
+  }
+} /* }}} void wpr_sanitize_name */
+
+/*
+ * Batches and queues
+ */
+static void wpr_request_free(wpr_request_t *req) /* {{{ */
+{
+  if (req == NULL)
+    return;
+
+  memstat_add(wpr_memstat, -(int64_t)(sizeof(*req) + req->capacity), -1);
+  sfree(req->data);
+  sfree(req);
+} /* }}} void wpr_request_free */
+
+/* Moves the current batch to the send queue, dropping the oldest requests if
+ * the backlog is full.
+ * NOTE: You must hold shard->lock when calling this function! */
+static void wpr_batch_queue_nolock(wpr_shard_t *shard) /* {{{ */
+{
+  wpr_node_t *node = shard->node;
+  wpr_request_t *req = shard->batch;
+
+  if (req == NULL)
+    return;
+
+  shard->batch = NULL;
+  shard->batch_init_time = cdtime();
+
+  while ((shard->queue_head != NULL) &&
+         (shard->queue_bytes + req->size > node->backlog_size)) {
+    wpr_request_t *old = shard->queue_head;
+
+    shard->queue_head = old->next;
+    if (shard->queue_head == NULL)
+      shard->queue_tail = NULL;
+    shard->queue_bytes -= old->size;
+
+    c_complain(LOG_WARNING, &shard->backlog_complaint,
+               "write_prometheus_remote plugin: The backlog of shard %" PRIsz
+               " of <%s> is full. Dropping the oldest samples.",
+               shard->index, node->url);
+    wpr_request_free(old);
+  }
+
+  if (shard->queue_tail == NULL)
+    shard->queue_head = req;
+  else
+    shard->queue_tail->next = req;
+  shard->queue_tail = req;
+  shard->queue_bytes += req->size;
+
+  pthread_cond_signal(&shard->cond);
+} /* }}} void wpr_batch_queue_nolock */
+
+/* Appends a TimeSeries with the labels and a single sample to the batch of the
+ * shard. The labels must be sorted by name.
+ * NOTE: You must hold shard->lock when calling this function! */
+static int wpr_batch_add(wpr_shard_t *shard, /* {{{ */
+                         wpr_label_t const *labels, size_t labels_num,
+                         double value, int64_t timestamp) {
+  size_t series_size = 1 + wpr_varint_size(wpr_sample_size(timestamp)) +
+                       wpr_sample_size(timestamp);
+  for (size_t i = 0; i < labels_num; i++) {
+    size_t label_size = wpr_label_size(labels + i);
+    series_size += 1 + wpr_varint_size(label_size) + label_size;
+  }
+  size_t need = 1 + wpr_varint_size(series_size) + series_size;
+
+  wpr_request_t *req = shard->batch;
+  if (req == NULL) {
+    req = calloc(1, sizeof(*req));
+    if (req == NULL) {
+      ERROR("write_prometheus_remote plugin: calloc failed.");
+      return ENOMEM;
+    }
+    memstat_add(wpr_memstat, (int64_t)sizeof(*req), 1);
+    shard->batch = req;
+    shard->batch_init_time = cdtime();
+  }
+
+  if (req->size + need > req->capacity) {
+    size_t capacity = (req->capacity > 0) ? req->capacity : 4096;
+    while (capacity < req->size + need)
+      capacity *= 2;
+
+    char *tmp = realloc(req->data, capacity);
+    if (tmp == NULL) {
+      ERROR("write_prometheus_remote plugin: realloc failed.");
+      return ENOMEM;
+    }
+    memstat_add(wpr_memstat, (int64_t)(capacity - req->capacity), 0);
+    req->data = tmp;
+    req->capacity = capacity;
+  }
+
+  char *p = req->data + req->size;
+  *p++ = 0x0a; /* WriteRequest.timeseries */
+  p = wpr_put_varint(p, (uint64_t)series_size);
+
+  for (size_t i = 0; i < labels_num; i++) {
+    *p++ = 0x0a; /* TimeSeries.labels */
+    p = wpr_put_varint(p, (uint64_t)wpr_label_size(labels + i));
+    p = wpr_put_bytes(p, 0x0a, labels[i].name, strlen(labels[i].name));
+    p = wpr_put_bytes(p, 0x12, labels[i].value, strlen(labels[i].value));
+  }
+
+  *p++ = 0x12; /* TimeSeries.samples */
+  p = wpr_put_varint(p, (uint64_t)wpr_sample_size(timestamp));
+  *p++ = 0x09; /* Sample.value, 64 bit */
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  for (size_t i = 0; i < sizeof(bits); i++)
+    *p++ = (char)((bits >> (8 * i)) & 0xff);
+  *p++ = 0x10; /* Sample.timestamp, varint */
+  p = wpr_put_varint(p, (uint64_t)timestamp);
+
+  assert((size_t)(p - req->data) == req->size + need);
+  req->size += need;
+  req->samples++;
+
+  if (req->samples >= shard->node->batch_size)
+    wpr_batch_queue_nolock(shard);
+
+  return 0;
+} /* }}} int wpr_batch_add */
+
+/*
+ * Sender threads
+ */
+static size_t wpr_curl_discard(void *buf __attribute__((unused)), /* {{{ */
+                               size_t size, size_t nmemb,
+                               void *user_data __attribute__((unused))) {
+  return size * nmemb;
+} /* }}} size_t wpr_curl_discard */
+
+/* Compresses and posts one request. Returns EAGAIN if the request failed in a
+ * way that is worth retrying, i.e. the receiver could not be reached or was
+ * overloaded. Other errors, e.g. samples being rejected as out of order, would
+ * fail again. */
+static int wpr_post(wpr_shard_t *shard, wpr_request_t *req) /* {{{ */
+{
+  wpr_node_t *node = shard->node;
+
+  size_t size = snappy_max_compressed_length(req->size);
+  char *data = malloc(size);
+  if (data == NULL) {
+    ERROR("write_prometheus_remote plugin: malloc failed.");
+    return ENOMEM;
+  }
+  size = snappy_compress(data, req->data, req->size);
+
+  curl_easy_setopt(shard->curl, CURLOPT_POSTFIELDS, data);
+  curl_easy_setopt(shard->curl, CURLOPT_POSTFIELDSIZE, (long)size);
+  shard->curl_errbuf[0] = 0;
+
+  CURLcode status = curl_easy_perform(shard->curl);
+  sfree(data);
+  if (status != CURLE_OK) {
+    c_complain(LOG_ERR, &shard->post_complaint,
+               "write_prometheus_remote plugin: Posting to <%s> failed: %s",
+               node->url,
+               (shard->curl_errbuf[0] != 0) ? shard->curl_errbuf
+                                            : curl_easy_strerror(status));
+    return EAGAIN;
+  }
+
+  long rc = 0;
+  curl_easy_getinfo(shard->curl, CURLINFO_RESPONSE_CODE, &rc);
+  if ((rc < 200) || (rc >= 300)) {
+    c_complain(LOG_ERR, &shard->post_complaint,
+               "write_prometheus_remote plugin: <%s> responded with HTTP "
+               "status %ld.",
+               node->url, rc);
+    return ((rc >= 500) || (rc == 429)) ? EAGAIN : -1;
+  }
+
+  c_release(LOG_INFO, &shard->post_complaint,
+            "write_prometheus_remote plugin: Posting to <%s> succeeded.",
+            node->url);
+  return 0;
+} /* }}} int wpr_post */
+
+static void *wpr_sender_thread(void *arg) /* {{{ */
+{
+  wpr_shard_t *shard = arg;
+  wpr_node_t *node = shard->node;
+  int failures = 0;
+  cdtime_t retry_time = 0;
+
+  pthread_mutex_lock(&shard->lock);
+  while (true) {
+    cdtime_t now = cdtime();
+
+    if ((shard->batch != NULL) &&
+        (!shard->sender_loop ||
+         (shard->batch_init_time + node->flush_interval <= now))) {
+      wpr_batch_queue_nolock(shard);
+      continue;
+    }
+
+    if ((shard->queue_head == NULL) && !shard->sender_loop)
+      break;
+
+    if ((shard->queue_head == NULL) ||
+        (shard->sender_loop && (retry_time > now))) {
+      cdtime_t deadline = now + node->flush_interval;
+      if ((shard->batch != NULL) &&
+          (shard->batch_init_time + node->flush_interval < deadline))
+        deadline = shard->batch_init_time + node->flush_interval;
+      if ((shard->queue_head != NULL) && (retry_time < deadline))
+        deadline = retry_time;
+
+      pthread_cond_timedwait(&shard->cond, &shard->lock,
+                             &CDTIME_T_TO_TIMESPEC(deadline));
+      continue;
+    }
+
+    wpr_request_t *req = shard->queue_head;
+    shard->queue_head = req->next;
+    if (shard->queue_head == NULL)
+      shard->queue_tail = NULL;
+    shard->queue_bytes -= req->size;
+    req->next = NULL;
+
+    pthread_mutex_unlock(&shard->lock);
+    int status = wpr_post(shard, req);
+    pthread_mutex_lock(&shard->lock);
+
+    /* Put the request back in front, so that the samples of each series stay
+     * in order, and wait before trying again. Requests queued in the meantime
+     * count against the backlog, so this can't grow without bounds. When
+     * shutting down, each request is tried once. */
+    if ((status == EAGAIN) && shard->sender_loop) {
+      req->next = shard->queue_head;
+      shard->queue_head = req;
+      if (shard->queue_tail == NULL)
+        shard->queue_tail = req;
+      shard->queue_bytes += req->size;
+
+      int shift = (failures < WPR_MAX_BACKOFF_SHIFT) ? failures
+                                                     : WPR_MAX_BACKOFF_SHIFT;
+      retry_time = cdtime() + (node->retry_interval << shift);
+      failures++;
+    } else {
+      wpr_request_free(req);
+      failures = 0;
+      retry_time = 0;
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  return NULL;
+} /* }}} void *wpr_sender_thread */
+
+static int wpr_curl_init(wpr_shard_t *shard) /* {{{ */
+{
+  wpr_node_t *node = shard->node;
+
+  shard->curl = curl_easy_init();
+  if (shard->curl == NULL) {
+    ERROR("write_prometheus_remote plugin: curl_easy_init failed.");
+    return -1;
+  }
+
+  curl_easy_setopt(shard->curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(shard->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  curl_easy_setopt(shard->curl, CURLOPT_URL, node->url);
+  curl_easy_setopt(shard->curl, CURLOPT_HTTPHEADER, node->headers);
+  curl_easy_setopt(shard->curl, CURLOPT_ERRORBUFFER, shard->curl_errbuf);
+  curl_easy_setopt(shard->curl, CURLOPT_WRITEFUNCTION, wpr_curl_discard);
+#ifdef HAVE_CURLOPT_TIMEOUT_MS
+  if (node->timeout > 0)
+    curl_easy_setopt(shard->curl, CURLOPT_TIMEOUT_MS, (long)node->timeout);
+#endif
+
+  if (node->user != NULL) {
+#ifdef HAVE_CURLOPT_USERNAME
+    curl_easy_setopt(shard->curl, CURLOPT_USERNAME, node->user);
+    curl_easy_setopt(shard->curl, CURLOPT_PASSWORD,
+                     (node->pass == NULL) ? "" : node->pass);
+#else
+    char credentials[1024];
+    snprintf(credentials, sizeof(credentials), "%s:%s", node->user,
+             (node->pass == NULL) ? "" : node->pass);
+    /* libcurl copies the string. */
+    curl_easy_setopt(shard->curl, CURLOPT_USERPWD, credentials);
+#endif
+    curl_easy_setopt(shard->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+  }
+
+  curl_easy_setopt(shard->curl, CURLOPT_SSL_VERIFYPEER,
+                   (long)node->verify_peer);
+  curl_easy_setopt(shard->curl, CURLOPT_SSL_VERIFYHOST,
+                   node->verify_host ? 2L : 0L);
+  if (node->cacert != NULL)
+    curl_easy_setopt(shard->curl, CURLOPT_CAINFO, node->cacert);
+  if (node->capath != NULL)
+    curl_easy_setopt(shard->curl, CURLOPT_CAPATH, node->capath);
+
+  if ((node->clientkey != NULL) && (node->clientcert != NULL)) {
+    curl_easy_setopt(shard->curl, CURLOPT_SSLKEY, node->clientkey);
+    curl_easy_setopt(shard->curl, CURLOPT_SSLCERT, node->clientcert);
+
+    if (node->clientkeypass != NULL)
+      curl_easy_setopt(shard->curl, CURLOPT_SSLKEYPASSWD,
+                       node->clientkeypass);
+  }
+
+  return 0;
+} /* }}} int wpr_curl_init */
+
+/* Sets up the curl handle and starts the sender thread of the shard. This is
+ * done on the first write, i.e. after collectd has forked.
+ * NOTE: You must hold shard->lock when calling this function! */
+static int wpr_shard_start_nolock(wpr_shard_t *shard) /* {{{ */
+{
+  if (shard->sender_running)
+    return 0;
+
+  if ((shard->curl == NULL) && (wpr_curl_init(shard) != 0))
+    return -1;
+
+  shard->sender_loop = true;
+  int status =
+      plugin_thread_create(&shard->sender_thread, /* attr = */ NULL,
+                           wpr_sender_thread, shard, "write_prom_rmt");
+  if (status != 0) {
+    ERROR("write_prometheus_remote plugin: Starting the sender thread "
+          "failed: %s",
+          STRERROR(status));
+    return -1;
+  }
+  shard->sender_running = true;
+
+  return 0;
+} /* }}} int wpr_shard_start_nolock */
+
+/*
+ * Callbacks
+ */
+static void wpr_node_free(void *data) /* {{{ */
+{
+  wpr_node_t *node = data;
+
+  if (node == NULL)
+    return;
+
+  for (size_t i = 0; (node->shards != NULL) && (i < node->shards_num); i++) {
+    wpr_shard_t *shard = node->shards + i;
+
+    /* The sender thread posts everything that's still queued before it
+     * exits. */
+    pthread_mutex_lock(&shard->lock);
+    if (shard->sender_running) {
+      shard->sender_loop = false;
+      pthread_cond_signal(&shard->cond);
+      pthread_mutex_unlock(&shard->lock);
+      pthread_join(shard->sender_thread, NULL);
+      pthread_mutex_lock(&shard->lock);
+      shard->sender_running = false;
+    }
+
+    wpr_request_free(shard->batch);
+    shard->batch = NULL;
+    while (shard->queue_head != NULL) {
+      wpr_request_t *req = shard->queue_head;
+      shard->queue_head = req->next;
+      wpr_request_free(req);
+    }
+    shard->queue_tail = NULL;
+    pthread_mutex_unlock(&shard->lock);
+
+    if (shard->curl != NULL)
+      curl_easy_cleanup(shard->curl);
+
+    pthread_cond_destroy(&shard->cond);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  sfree(node->shards);
+
+  if (node->headers != NULL)
+    curl_slist_free_all(node->headers);
+
+  sfree(node->name);
+  sfree(node->url);
+  sfree(node->user);
+  sfree(node->pass);
+  sfree(node->cacert);
+  sfree(node->capath);
+  sfree(node->clientkey);
+  sfree(node->clientcert);
+  sfree(node->clientkeypass);
+  sfree(node);
+} /* }}} void wpr_node_free */
+
+/* Creates the name of a data source's series in the same way as the
+ * "write_prometheus" plugin, i.e. like the "collectd_exporter" does, so that
+ * queries work with either plugin. */
+static void wpr_metric_name(char *buffer, size_t buffer_size, /* {{{ */
+                            data_set_t const *ds, value_list_t const *vl,
+                            size_t ds_index, char const *suffix) {
+  char const *fields[5] = {"collectd"};
+  size_t fields_num = 1;
+
+  if (strcmp(vl->plugin, vl->type) != 0) {
+    fields[fields_num] = vl->plugin;
+    fields_num++;
+  }
+  fields[fields_num] = vl->type;
+  fields_num++;
+
+  if (strcmp("value", ds->ds[ds_index].name) != 0) {
+    fields[fields_num] = ds->ds[ds_index].name;
+    fields_num++;
+  }
+
+  if (suffix != NULL) {
+    fields[fields_num] = suffix;
+    fields_num++;
+  }
+
+  strjoin(buffer, buffer_size, (char **)fields, fields_num, "_");
+  wpr_sanitize_name(buffer);
+} /* }}} void wpr_metric_name */
+
+/* Fills "labels" with the labels of a value list and returns their number.
+ * "name" and "le" are filled in by the caller. The label holding the plugin
+ * instance is named after the plugin, which is sanitized into "plugin_name",
+ * like the "write_prometheus" plugin does. */
+static size_t wpr_labels(wpr_label_t *labels, /* {{{ */
+                         value_list_t const *vl, char *plugin_name,
+                         size_t plugin_name_size) {
+  size_t labels_num = 1; /* __name__ */
+
+  sstrncpy(plugin_name, vl->plugin, plugin_name_size);
+  wpr_sanitize_name(plugin_name);
+
+  if (strlen(vl->plugin_instance) != 0) {
+    labels[labels_num].name = plugin_name;
+    labels[labels_num].value = vl->plugin_instance;
+    labels_num++;
+  }
+
+  if (strlen(vl->type_instance) != 0) {
+    labels[labels_num].name =
+        (strlen(vl->plugin_instance) == 0) ? plugin_name : "type";
+    labels[labels_num].value = vl->type_instance;
+    labels_num++;
+  }
+
+  labels[labels_num].name = "instance";
+  labels[labels_num].value = vl->host;
+  labels_num++;
+
+  return labels_num;
+} /* }}} size_t wpr_labels */
+
+/* Receivers require the labels to be sorted by name. */
+static void wpr_labels_sort(wpr_label_t *labels, size_t labels_num) /* {{{ */
+{
+  for (size_t i = 1; i < labels_num; i++) {
+    wpr_label_t l = labels[i];
+    size_t j = i;
+    while ((j > 0) && (strcmp(labels[j - 1].name, l.name) > 0)) {
+      labels[j] = labels[j - 1];
+      j--;
+    }
+    labels[j] = l;
+  }
+} /* }}} void wpr_labels_sort */
+
+/* Adds one series with the given name to the batch.
+ * NOTE: You must hold shard->lock when calling this function! */
+static int wpr_add_series(wpr_shard_t *shard, /* {{{ */
+                          wpr_label_t const *base, size_t base_num,
+                          char const *name, char const *le, double value,
+                          int64_t timestamp) {
+  wpr_label_t labels[WPR_MAX_LABELS];
+
+  memcpy(labels, base, base_num * sizeof(*labels));
+  labels[0].name = "__name__";
+  labels[0].value = name;
+  size_t labels_num = base_num;
+  if (le != NULL) {
+    labels[labels_num].name = "le";
+    labels[labels_num].value = le;
+    labels_num++;
+  }
+  wpr_labels_sort(labels, labels_num);
+
+  return wpr_batch_add(shard, labels, labels_num, value, timestamp);
+} /* }}} int wpr_add_series */
+
+/* Adds the "_bucket", "_sum" and "_count" series of a histogram.
+ * NOTE: You must hold shard->lock when calling this function! */
+static int wpr_add_histogram(wpr_shard_t *shard, /* {{{ */
+                             data_set_t const *ds, value_list_t const *vl,
+                             wpr_label_t const *labels, size_t labels_num,
+                             histogram_t const *h, int64_t timestamp) {
+  char name[5 * DATA_MAX_NAME_LEN];
+  char le[64];
+  int status = 0;
+
+  wpr_metric_name(name, sizeof(name), ds, vl, 0, "bucket");
+  for (size_t i = 0; (i < h->buckets_num) && (status == 0); i++) {
+    snprintf(le, sizeof(le), GAUGE_FORMAT, h->buckets[i].upper_bound);
+    status = wpr_add_series(shard, labels, labels_num, name, le,
+                            (double)h->buckets[i].cumulative_count, timestamp);
+  }
+  if (status == 0)
+    status = wpr_add_series(shard, labels, labels_num, name, "+Inf",
+                            (double)h->count, timestamp);
+
+  wpr_metric_name(name, sizeof(name), ds, vl, 0, "sum");
+  if (status == 0)
+    status = wpr_add_series(shard, labels, labels_num, name, NULL, h->sum,
+                            timestamp);
+
+  wpr_metric_name(name, sizeof(name), ds, vl, 0, "count");
+  if (status == 0)
+    status = wpr_add_series(shard, labels, labels_num, name, NULL,
+                            (double)h->count, timestamp);
+
+  return status;
+} /* }}} int wpr_add_histogram */
+
+static wpr_shard_t *wpr_shard_get(wpr_node_t *node, /* {{{ */
+                                  value_list_t const *vl) {
+  uint32_t hash = vl->identifier.hash;
+  if (hash == 0) {
+    char name[6 * DATA_MAX_NAME_LEN];
+    if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+      ERROR("write_prometheus_remote plugin: FORMAT_VL failed.");
+      return NULL;
+    }
+    hash = identifier_hash(name);
+  }
+
+  return node->shards + (hash % node->shards_num);
+} /* }}} wpr_shard_t *wpr_shard_get */
+
+/* Writes the values of "vl", or staleness markers for its series if "stale" is
+ * true. */
+static int wpr_write_vl(wpr_node_t *node, data_set_t const *ds, /* {{{ */
+                        value_list_t const *vl, bool stale) {
+  wpr_shard_t *shard = wpr_shard_get(node, vl);
+  if (shard == NULL)
+    return -1;
+
+  wpr_label_t labels[WPR_MAX_LABELS];
+  char plugin_name[DATA_MAX_NAME_LEN];
+  size_t labels_num =
+      wpr_labels(labels, vl, plugin_name, sizeof(plugin_name));
+
+  cdtime_t t = stale ? cdtime() : vl->time;
+  int64_t timestamp = (int64_t)CDTIME_T_TO_MS(t);
+
+  /* A histogram in the meta data, see utils_histogram.h, replaces the value of
+   * single-value metrics. */
+  histogram_t h = {0};
+  bool histogram = !stale && (ds->ds_num == 1) &&
+                   (histogram_meta_get(vl->meta, &h) == 0);
+
+  pthread_mutex_lock(&shard->lock);
+
+  int status = wpr_shard_start_nolock(shard);
+  if (status != 0) {
+    pthread_mutex_unlock(&shard->lock);
+    histogram_reset(&h);
+    return status;
+  }
+
+  if (histogram) {
+    status = wpr_add_histogram(shard, ds, vl, labels, labels_num, &h,
+                               timestamp);
+  } else {
+    for (size_t i = 0; (i < ds->ds_num) && (status == 0); i++) {
+      char name[5 * DATA_MAX_NAME_LEN];
+      bool cumulative = (ds->ds[i].type == DS_TYPE_COUNTER) ||
+                        (ds->ds[i].type == DS_TYPE_DERIVE);
+      wpr_metric_name(name, sizeof(name), ds, vl, i,
+                      cumulative ? "total" : NULL);
+
+      double value;
+      if (stale) {
+        uint64_t bits = WPR_STALE_NAN;
+        memcpy(&value, &bits, sizeof(value));
+      } else if (ds->ds[i].type == DS_TYPE_GAUGE) {
+        value = (double)vl->values[i].gauge;
+      } else if (ds->ds[i].type == DS_TYPE_COUNTER) {
+        value = (double)vl->values[i].counter;
+      } else if (ds->ds[i].type == DS_TYPE_DERIVE) {
+        value = (double)vl->values[i].derive;
+      } else {
+        value = (double)vl->values[i].absolute;
+      }
+
+      status = wpr_add_series(shard, labels, labels_num, name, NULL, value,
+                              timestamp);
+    }
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+  histogram_reset(&h);
+
+  return status;
+} /* }}} int wpr_write_vl */
+
+static int wpr_write(data_set_t const *ds, value_list_t const *vl, /* {{{ */
+                     user_data_t *ud) {
+  if ((ds == NULL) || (vl == NULL) || (ud == NULL))
+    return EINVAL;
+
+  return wpr_write_vl(ud->data, ds, vl, /* stale = */ false);
+} /* }}} int wpr_write */
+
+/* Marks the series of value lists which have not been updated in time as
+ * stale, so that queries stop returning them right away instead of after
+ * Prometheus' lookback delta. */
+static int wpr_missing(value_list_t const *vl, user_data_t *ud) /* {{{ */
+{
+  if ((vl == NULL) || (ud == NULL))
+    return EINVAL;
+
+  data_set_t const *ds = plugin_get_ds(vl->type);
+  if (ds == NULL)
+    return ENOENT;
+
+  return wpr_write_vl(ud->data, ds, vl, /* stale = */ true);
+} /* }}} int wpr_missing */
+
+static int wpr_flush(cdtime_t timeout, /* {{{ */
+                     char const *identifier __attribute__((unused)),
+                     user_data_t *ud) {
+  if (ud == NULL)
+    return EINVAL;
+
+  wpr_node_t *node = ud->data;
+  cdtime_t now = cdtime();
+
+  for (size_t i = 0; i < node->shards_num; i++) {
+    wpr_shard_t *shard = node->shards + i;
+
+    pthread_mutex_lock(&shard->lock);
+    /* timeout == 0  => flush unconditionally */
+    if ((shard->batch != NULL) &&
+        ((timeout == 0) || (shard->batch_init_time + timeout <= now)))
+      wpr_batch_queue_nolock(shard);
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  return 0;
+} /* }}} int wpr_flush */
+
+/*
+ * Configuration
+ */
+static int wpr_config_header(wpr_node_t *node, /* {{{ */
+                             oconfig_item_t *ci) {
+  char *value = NULL;
+
+  int status = cf_util_get_string(ci, &value);
+  if (status != 0)
+    return status;
+
+  struct curl_slist *tmp = curl_slist_append(node->headers, value);
+  sfree(value);
+  if (tmp == NULL) {
+    ERROR("write_prometheus_remote plugin: curl_slist_append failed.");
+    return ENOMEM;
+  }
+  node->headers = tmp;
+
+  return 0;
+} /* }}} int wpr_config_header */
+
+static int wpr_config_node(oconfig_item_t *ci) /* {{{ */
+{
+  wpr_node_t *node = calloc(1, sizeof(*node));
+  if (node == NULL) {
+    ERROR("write_prometheus_remote plugin: calloc failed.");
+    return ENOMEM;
+  }
+  node->verify_peer = true;
+  node->verify_host = true;
+  node->batch_size = WRITE_PROMETHEUS_REMOTE_DEFAULT_BATCH_SIZE;
+  node->backlog_size = WRITE_PROMETHEUS_REMOTE_DEFAULT_BACKLOG_SIZE;
+  node->retry_interval = WRITE_PROMETHEUS_REMOTE_DEFAULT_RETRY_INTERVAL;
+
+  int shards = WRITE_PROMETHEUS_REMOTE_DEFAULT_SHARDS;
+  int batch_size = WRITE_PROMETHEUS_REMOTE_DEFAULT_BATCH_SIZE;
+  int backlog_size = WRITE_PROMETHEUS_REMOTE_DEFAULT_BACKLOG_SIZE;
+
+  int status = cf_util_get_string(ci, &node->name);
+  if (status != 0) {
+    wpr_node_free(node);
+    return status;
+  }
+
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("URL", child->key) == 0)
+      status = cf_util_get_string(child, &node->url);
+    else if (strcasecmp("User", child->key) == 0)
+      status = cf_util_get_string(child, &node->user);
+    else if (strcasecmp("Password", child->key) == 0)
+      status = cf_util_get_string(child, &node->pass);
+    else if (strcasecmp("VerifyPeer", child->key) == 0)
+      status = cf_util_get_boolean(child, &node->verify_peer);
+    else if (strcasecmp("VerifyHost", child->key) == 0)
+      status = cf_util_get_boolean(child, &node->verify_host);
+    else if (strcasecmp("CACert", child->key) == 0)
+      status = cf_util_get_string(child, &node->cacert);
+    else if (strcasecmp("CAPath", child->key) == 0)
+      status = cf_util_get_string(child, &node->capath);
+    else if (strcasecmp("ClientKey", child->key) == 0)
+      status = cf_util_get_string(child, &node->clientkey);
+    else if (strcasecmp("ClientCert", child->key) == 0)
+      status = cf_util_get_string(child, &node->clientcert);
+    else if (strcasecmp("ClientKeyPass", child->key) == 0)
+      status = cf_util_get_string(child, &node->clientkeypass);
+    else if (strcasecmp("Header", child->key) == 0)
+      status = wpr_config_header(node, child);
+    else if (strcasecmp("Timeout", child->key) == 0)
+      status = cf_util_get_int(child, &node->timeout);
+    else if (strcasecmp("Shards", child->key) == 0)
+      status = cf_util_get_int(child, &shards);
+    else if (strcasecmp("BatchSize", child->key) == 0)
+      status = cf_util_get_int(child, &batch_size);
+    else if (strcasecmp("FlushInterval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &node->flush_interval);
+    else if (strcasecmp("BacklogSize", child->key) == 0)
+      status = cf_util_get_int(child, &backlog_size);
+    else if (strcasecmp("RetryInterval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &node->retry_interval);
+    else {
+      ERROR("write_prometheus_remote plugin: Invalid configuration "
+            "option: %s.",
+            child->key);
+      status = EINVAL;
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  if ((status == 0) && (node->url == NULL)) {
+    ERROR("write_prometheus_remote plugin: No URL defined for node \"%s\".",
+          node->name);
+    status = EINVAL;
+  }
+  if ((status == 0) && (shards < 1)) {
+    ERROR("write_prometheus_remote plugin: Shards must be at least 1.");
+    status = EINVAL;
+  }
+  if ((status == 0) && (batch_size < 1)) {
+    ERROR("write_prometheus_remote plugin: BatchSize must be at least 1.");
+    status = EINVAL;
+  }
+  if ((status == 0) && (backlog_size < 1)) {
+    ERROR("write_prometheus_remote plugin: BacklogSize must be positive.");
+    status = EINVAL;
+  }
+  if (status != 0) {
+    wpr_node_free(node);
+    return status;
+  }
+
+  node->batch_size = (size_t)batch_size;
+  if (node->flush_interval == 0)
+    node->flush_interval = plugin_get_interval();
+  if (node->retry_interval == 0)
+    node->retry_interval = WRITE_PROMETHEUS_REMOTE_DEFAULT_RETRY_INTERVAL;
+
+  /* The backlog is shared evenly by the shards, so that a node's memory use
+   * doesn't depend on the number of shards. */
+  node->backlog_size = (size_t)backlog_size / (size_t)shards;
+
+  node->headers = curl_slist_append(node->headers, "Content-Encoding: snappy");
+  node->headers =
+      curl_slist_append(node->headers, "Content-Type: application/x-protobuf");
+  node->headers = curl_slist_append(node->headers,
+                                    "X-Prometheus-Remote-Write-Version: 0.1.0");
+  node->headers = curl_slist_append(node->headers, "Expect:");
+
+  node->shards = calloc((size_t)shards, sizeof(*node->shards));
+  if (node->shards == NULL) {
+    ERROR("write_prometheus_remote plugin: calloc failed.");
+    wpr_node_free(node);
+    return ENOMEM;
+  }
+  node->shards_num = (size_t)shards;
+
+  for (size_t i = 0; i < node->shards_num; i++) {
+    wpr_shard_t *shard = node->shards + i;
+
+    shard->node = node;
+    shard->index = i;
+    pthread_mutex_init(&shard->lock, /* attr = */ NULL);
+    pthread_cond_init(&shard->cond, /* attr = */ NULL);
+    C_COMPLAIN_INIT(&shard->backlog_complaint);
+    C_COMPLAIN_INIT(&shard->post_complaint);
+  }
+
+  char callback_name[DATA_MAX_NAME_LEN];
+  snprintf(callback_name, sizeof(callback_name), "write_prometheus_remote/%s",
+           node->name);
+
+  user_data_t user_data = {
+      .data = node, .free_func = wpr_node_free,
+  };
+  plugin_register_write(callback_name, wpr_write, &user_data);
+  user_data.free_func = NULL;
+  plugin_register_flush(callback_name, wpr_flush, &user_data);
+  plugin_register_missing(callback_name, wpr_missing, &user_data);
+
+  return 0;
+} /* }}} int wpr_config_node */
+
+static int wpr_config(oconfig_item_t *ci) /* {{{ */
+{
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Node", child->key) == 0)
+      wpr_config_node(child);
+    else
+      ERROR("write_prometheus_remote plugin: Invalid configuration "
+            "option: %s.",
+            child->key);
+  }
+
+  return 0;
+} /* }}} int wpr_config */
+
+static int wpr_init(void) /* {{{ */
+{
+  memstat_lazy(&wpr_memstat, "write_prometheus_remote");
+
+  /* Call this while collectd is still single-threaded to avoid
+   * initialization issues in libgcrypt. */
+  curl_global_init(CURL_GLOBAL_SSL);
+  return 0;
+} /* }}} int wpr_init */
+
+void module_register(void) /* {{{ */
+{
+  plugin_register_complex_config("write_prometheus_remote", wpr_config);
+  plugin_register_init("write_prometheus_remote", wpr_init);
+} /* }}} void module_register */
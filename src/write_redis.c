@@ -36,6 +36,20 @@
 #define REDIS_DEFAULT_PREFIX "collectd/"
 #endif
 
+/* A connection and the commands sent over it whose replies have not been read
+ * yet. */
+struct wr_conn_s {
+  pthread_mutex_t lock;
+  redisContext *ctx;
+
+  int commands_pending;
+  int values_pending;
+  cdtime_t first_pending;
+
+  struct wr_conn_s *next;
+};
+typedef struct wr_conn_s wr_conn_t;
+
 struct wr_node_s {
   char name[DATA_MAX_NAME_LEN];
 
@@ -47,8 +61,16 @@ struct wr_node_s {
   int max_set_size;
   int max_set_duration;
   bool store_rates;
-
-  redisContext *conn;
+  bool use_streams;
+  int batch_size;
+  cdtime_t flush_interval;
+  bool conn_per_thread;
+
+  /* All connections of this node. Without "ConnectionPerThread", there is
+   * only one. */
+  wr_conn_t *conns;
+  pthread_key_t conn_key;
+  bool conn_key_init;
   pthread_mutex_t lock;
 };
 typedef struct wr_node_s wr_node_t;
@@ -56,24 +78,232 @@ typedef struct wr_node_s wr_node_t;
 /*
  * Functions
  */
+static void wr_disconnect(wr_conn_t *c) /* {{{ */
+{
+  if (c->ctx != NULL) {
+    redisFree(c->ctx);
+    c->ctx = NULL;
+  }
+  c->commands_pending = 0;
+  c->values_pending = 0;
+} /* }}} void wr_disconnect */
+
+/* c->lock must be held when calling this function. */
+static int wr_connect(wr_node_t *node, wr_conn_t *c) /* {{{ */
+{
+  redisReply *rr;
+
+  if (c->ctx != NULL)
+    return 0;
+
+  c->ctx =
+      redisConnectWithTimeout((char *)node->host, node->port, node->timeout);
+  if (c->ctx == NULL) {
+    ERROR("write_redis plugin: Connecting to host \"%s\" (port %i) failed: "
+          "Unknown reason",
+          (node->host != NULL) ? node->host : "localhost",
+          (node->port != 0) ? node->port : 6379);
+    return -1;
+  } else if (c->ctx->err) {
+    ERROR("write_redis plugin: Connecting to host \"%s\" (port %i) failed: %s",
+          (node->host != NULL) ? node->host : "localhost",
+          (node->port != 0) ? node->port : 6379, c->ctx->errstr);
+    wr_disconnect(c);
+    return -1;
+  }
+
+  rr = redisCommand(c->ctx, "SELECT %d", node->database);
+  if (rr == NULL)
+    WARNING("SELECT command error. database:%d message:%s", node->database,
+            c->ctx->errstr);
+  else
+    freeReplyObject(rr);
+
+  return 0;
+} /* }}} int wr_connect */
+
+/* Reads the replies of all pending commands.
+ * c->lock must be held when calling this function. */
+static int wr_flush_conn(wr_node_t *node, wr_conn_t *c) /* {{{ */
+{
+  while ((c->ctx != NULL) && (c->commands_pending > 0)) {
+    redisReply *rr = NULL;
+
+    if (redisGetReply(c->ctx, (void **)&rr) != REDIS_OK) {
+      ERROR("write_redis plugin: Node \"%s\": Sending %d commands failed: %s",
+            node->name, c->commands_pending, c->ctx->errstr);
+      wr_disconnect(c);
+      return -1;
+    }
+    c->commands_pending--;
+
+    if ((rr != NULL) && (rr->type == REDIS_REPLY_ERROR))
+      WARNING("write_redis plugin: Node \"%s\": Command failed: %s",
+              node->name, rr->str);
+    if (rr != NULL)
+      freeReplyObject(rr);
+  }
+
+  c->values_pending = 0;
+  return 0;
+} /* }}} int wr_flush_conn */
+
+/* Queues a command. The reply is read by wr_flush_conn().
+ * c->lock must be held when calling this function. */
+static int wr_append(wr_conn_t *c, const char *format, ...) /* {{{ */
+{
+  va_list ap;
+  int status;
+
+  va_start(ap, format);
+  status = redisvAppendCommand(c->ctx, format, ap);
+  va_end(ap);
+
+  if (status != REDIS_OK)
+    return -1;
+
+  c->commands_pending++;
+  return 0;
+} /* }}} int wr_append */
+
+static wr_conn_t *wr_conn_create(wr_node_t *node) /* {{{ */
+{
+  wr_conn_t *c = calloc(1, sizeof(*c));
+  if (c == NULL) {
+    ERROR("write_redis plugin: calloc failed.");
+    return NULL;
+  }
+  pthread_mutex_init(&c->lock, /* attr = */ NULL);
+
+  pthread_mutex_lock(&node->lock);
+  c->next = node->conns;
+  node->conns = c;
+  pthread_mutex_unlock(&node->lock);
+
+  return c;
+} /* }}} wr_conn_t *wr_conn_create */
+
+/* Returns the connection to use by the calling thread, locked. */
+static wr_conn_t *wr_conn_get(wr_node_t *node) /* {{{ */
+{
+  wr_conn_t *c;
+
+  if (!node->conn_per_thread) {
+    c = node->conns;
+  } else {
+    c = pthread_getspecific(node->conn_key);
+    if (c == NULL) {
+      c = wr_conn_create(node);
+      if (c == NULL)
+        return NULL;
+      pthread_setspecific(node->conn_key, c);
+    }
+  }
+
+  pthread_mutex_lock(&c->lock);
+  return c;
+} /* }}} wr_conn_t *wr_conn_get */
+
+static int wr_append_zset(wr_node_t *node, wr_conn_t *c, /* {{{ */
+                          const value_list_t *vl, char const *key,
+                          char const *value) {
+  char time[24];
+
+  snprintf(time, sizeof(time), "%.9f", CDTIME_T_TO_DOUBLE(vl->time));
+
+  if (wr_append(c, "ZADD %s %s %s", key, time, value) != 0)
+    return -1;
+
+  if (node->max_set_size >= 0) {
+    if (wr_append(c, "ZREMRANGEBYRANK %s %d %d", key, 0,
+                  (-1 * node->max_set_size) - 1) != 0)
+      return -1;
+  }
+
+  if (node->max_set_duration > 0) {
+    /*
+     * remove element, scored less than 'current-max_set_duration'
+     * '(...' indicates 'less than' in redis CLI.
+     */
+    if (wr_append(c, "ZREMRANGEBYSCORE %s -1 (%.9f", key,
+                  (CDTIME_T_TO_DOUBLE(vl->time) - node->max_set_duration)) !=
+        0)
+      return -1;
+  }
+
+  return 0;
+} /* }}} int wr_append_zset */
+
+/* Appends an entry with one field per data source to a stream. "value" is the
+ * output of format_values(). */
+static int wr_append_stream(wr_node_t *node, wr_conn_t *c, /* {{{ */
+                            const data_set_t *ds, const value_list_t *vl,
+                            char const *key, char *value) {
+  /* XADD key [MAXLEN|MINID ~ limit] * time <time> <ds> <value> ... */
+  size_t argc_max = 8 + 2 * ds->ds_num;
+  char const *argv[argc_max];
+  size_t argc = 0;
+  char limit[32];
+  char time[24];
+
+  argv[argc++] = "XADD";
+  argv[argc++] = key;
+  if (node->max_set_size >= 0) {
+    snprintf(limit, sizeof(limit), "%d", node->max_set_size);
+    argv[argc++] = "MAXLEN";
+    argv[argc++] = "~";
+    argv[argc++] = limit;
+  } else if (node->max_set_duration > 0) {
+    /* Entry IDs start with the milliseconds since the epoch. */
+    snprintf(limit, sizeof(limit), "%" PRIu64,
+             CDTIME_T_TO_MS(vl->time) - 1000 * (uint64_t)node->max_set_duration);
+    argv[argc++] = "MINID";
+    argv[argc++] = "~";
+    argv[argc++] = limit;
+  }
+  argv[argc++] = "*";
+
+  snprintf(time, sizeof(time), "%.9f", CDTIME_T_TO_DOUBLE(vl->time));
+  argv[argc++] = "time";
+  argv[argc++] = time;
+
+  /* Skip the time, format_values() prints it with millisecond precision. */
+  char *ptr = strchr(value, ':');
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    if (ptr == NULL)
+      return -1;
+    *ptr = 0;
+    char *next = strchr(ptr + 1, ':');
+
+    argv[argc++] = ds->ds[i].name;
+    argv[argc++] = ptr + 1;
+    ptr = next;
+  }
+
+  if (redisAppendCommandArgv(c->ctx, (int)argc, argv, /* argvlen = */ NULL) !=
+      REDIS_OK)
+    return -1;
+
+  c->commands_pending++;
+  return 0;
+} /* }}} int wr_append_stream */
+
 static int wr_write(const data_set_t *ds, /* {{{ */
                     const value_list_t *vl, user_data_t *ud) {
   wr_node_t *node = ud->data;
   char ident[512];
   char key[512];
   char value[512] = {0};
-  char time[24];
   size_t value_size;
   char *value_ptr;
   int status;
-  redisReply *rr;
+  wr_conn_t *c;
 
   status = FORMAT_VL(ident, sizeof(ident), vl);
   if (status != 0)
     return status;
   snprintf(key, sizeof(key), "%s%s",
            (node->prefix != NULL) ? node->prefix : REDIS_DEFAULT_PREFIX, ident);
-  snprintf(time, sizeof(time), "%.9f", CDTIME_T_TO_DOUBLE(vl->time));
 
   value_size = sizeof(value);
   value_ptr = &value[0];
@@ -81,82 +311,76 @@ static int wr_write(const data_set_t *ds, /* {{{ */
   if (status != 0)
     return status;
 
-  pthread_mutex_lock(&node->lock);
+  c = wr_conn_get(node);
+  if (c == NULL)
+    return -1;
 
-  if (node->conn == NULL) {
-    node->conn =
-        redisConnectWithTimeout((char *)node->host, node->port, node->timeout);
-    if (node->conn == NULL) {
-      ERROR("write_redis plugin: Connecting to host \"%s\" (port %i) failed: "
-            "Unknown reason",
-            (node->host != NULL) ? node->host : "localhost",
-            (node->port != 0) ? node->port : 6379);
-      pthread_mutex_unlock(&node->lock);
-      return -1;
-    } else if (node->conn->err) {
-      ERROR(
-          "write_redis plugin: Connecting to host \"%s\" (port %i) failed: %s",
-          (node->host != NULL) ? node->host : "localhost",
-          (node->port != 0) ? node->port : 6379, node->conn->errstr);
-      pthread_mutex_unlock(&node->lock);
-      return -1;
-    }
-
-    rr = redisCommand(node->conn, "SELECT %d", node->database);
-    if (rr == NULL)
-      WARNING("SELECT command error. database:%d message:%s", node->database,
-              node->conn->errstr);
-    else
-      freeReplyObject(rr);
+  if (wr_connect(node, c) != 0) {
+    pthread_mutex_unlock(&c->lock);
+    return -1;
   }
 
-  rr = redisCommand(node->conn, "ZADD %s %s %s", key, time, value);
-  if (rr == NULL)
-    WARNING("ZADD command error. key:%s message:%s", key, node->conn->errstr);
+  if (node->use_streams)
+    status = wr_append_stream(node, c, ds, vl, key, value);
   else
-    freeReplyObject(rr);
-
-  if (node->max_set_size >= 0) {
-    rr = redisCommand(node->conn, "ZREMRANGEBYRANK %s %d %d", key, 0,
-                      (-1 * node->max_set_size) - 1);
-    if (rr == NULL)
-      WARNING("ZREMRANGEBYRANK command error. key:%s message:%s", key,
-              node->conn->errstr);
-    else
-      freeReplyObject(rr);
-  }
-
-  if (node->max_set_duration > 0) {
-    /*
-     * remove element, scored less than 'current-max_set_duration'
-     * '(...' indicates 'less than' in redis CLI.
-     */
-    rr = redisCommand(node->conn, "ZREMRANGEBYSCORE %s -1 (%.9f", key,
-                      (CDTIME_T_TO_DOUBLE(vl->time) - node->max_set_duration));
-    if (rr == NULL)
-      WARNING("ZREMRANGEBYSCORE command error. key:%s message:%s", key,
-              node->conn->errstr);
-    else
-      freeReplyObject(rr);
-  }
+    status = wr_append_zset(node, c, vl, key, value);
 
   /* TODO(octo): This is more overhead than necessary. Use the cache and
    * metadata to determine if it is a new metric and call SADD only once for
    * each metric. */
-  rr = redisCommand(
-      node->conn, "SADD %svalues %s",
-      (node->prefix != NULL) ? node->prefix : REDIS_DEFAULT_PREFIX, ident);
-  if (rr == NULL)
-    WARNING("SADD command error. ident:%s message:%s", ident,
-            node->conn->errstr);
-  else
-    freeReplyObject(rr);
+  if (status == 0)
+    status = wr_append(
+        c, "SADD %svalues %s",
+        (node->prefix != NULL) ? node->prefix : REDIS_DEFAULT_PREFIX, ident);
 
-  pthread_mutex_unlock(&node->lock);
+  if (status != 0) {
+    ERROR("write_redis plugin: Node \"%s\": Queuing commands for \"%s\" "
+          "failed: %s",
+          node->name, ident, c->ctx->errstr);
+    wr_disconnect(c);
+    pthread_mutex_unlock(&c->lock);
+    return -1;
+  }
 
-  return 0;
+  cdtime_t now = cdtime();
+  if (c->values_pending == 0)
+    c->first_pending = now;
+  c->values_pending++;
+
+  if ((c->values_pending >= node->batch_size) ||
+      ((now - c->first_pending) >= node->flush_interval))
+    status = wr_flush_conn(node, c);
+
+  pthread_mutex_unlock(&c->lock);
+  return status;
 } /* }}} int wr_write */
 
+static int wr_flush(cdtime_t timeout, /* {{{ */
+                    const char *identifier __attribute__((unused)),
+                    user_data_t *ud) {
+  wr_node_t *node = ud->data;
+  cdtime_t now = cdtime();
+  int status = 0;
+
+  pthread_mutex_lock(&node->lock);
+  wr_conn_t *head = node->conns;
+  pthread_mutex_unlock(&node->lock);
+
+  /* Connections are only ever prepended, so the list starting at "head" does
+   * not change. */
+  for (wr_conn_t *c = head; c != NULL; c = c->next) {
+    pthread_mutex_lock(&c->lock);
+    if ((c->values_pending > 0) &&
+        ((timeout == 0) || ((now - c->first_pending) >= timeout))) {
+      if (wr_flush_conn(node, c) != 0)
+        status = -1;
+    }
+    pthread_mutex_unlock(&c->lock);
+  }
+
+  return status;
+} /* }}} int wr_flush */
+
 static void wr_config_free(void *ptr) /* {{{ */
 {
   wr_node_t *node = ptr;
@@ -164,12 +388,22 @@ static void wr_config_free(void *ptr) /* {{{ */
   if (node == NULL)
     return;
 
-  if (node->conn != NULL) {
-    redisFree(node->conn);
-    node->conn = NULL;
+  while (node->conns != NULL) {
+    wr_conn_t *c = node->conns;
+    node->conns = c->next;
+
+    wr_flush_conn(node, c);
+    wr_disconnect(c);
+    pthread_mutex_destroy(&c->lock);
+    sfree(c);
   }
 
+  if (node->conn_key_init)
+    pthread_key_delete(node->conn_key);
+
+  pthread_mutex_destroy(&node->lock);
   sfree(node->host);
+  sfree(node->prefix);
   sfree(node);
 } /* }}} void wr_config_free */
 
@@ -186,17 +420,20 @@ static int wr_config_node(oconfig_item_t *ci) /* {{{ */
   node->port = 0;
   node->timeout.tv_sec = 1;
   node->timeout.tv_usec = 0;
-  node->conn = NULL;
   node->prefix = NULL;
   node->database = 0;
   node->max_set_size = -1;
   node->max_set_duration = -1;
   node->store_rates = true;
+  node->use_streams = false;
+  node->batch_size = 1;
+  node->flush_interval = 0;
+  node->conn_per_thread = false;
   pthread_mutex_init(&node->lock, /* attr = */ NULL);
 
   status = cf_util_get_string_buffer(ci, node->name, sizeof(node->name));
   if (status != 0) {
-    sfree(node);
+    wr_config_free(node);
     return status;
   }
 
@@ -228,6 +465,31 @@ static int wr_config_node(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_int(child, &node->max_set_duration);
     } else if (strcasecmp("StoreRates", child->key) == 0) {
       status = cf_util_get_boolean(child, &node->store_rates);
+    } else if (strcasecmp("DataType", child->key) == 0) {
+      char tmp[16];
+      status = cf_util_get_string_buffer(child, tmp, sizeof(tmp));
+      if (status != 0)
+        break;
+      if (strcasecmp("SortedSet", tmp) == 0)
+        node->use_streams = false;
+      else if (strcasecmp("Stream", tmp) == 0)
+        node->use_streams = true;
+      else {
+        ERROR("write_redis plugin: Invalid DataType \"%s\": Use either "
+              "\"SortedSet\" or \"Stream\".",
+              tmp);
+        status = EINVAL;
+      }
+    } else if (strcasecmp("BatchSize", child->key) == 0) {
+      status = cf_util_get_int(child, &node->batch_size);
+      if ((status == 0) && (node->batch_size < 1)) {
+        ERROR("write_redis plugin: BatchSize must be at least 1.");
+        status = EINVAL;
+      }
+    } else if (strcasecmp("FlushInterval", child->key) == 0) {
+      status = cf_util_get_cdtime(child, &node->flush_interval);
+    } else if (strcasecmp("ConnectionPerThread", child->key) == 0) {
+      status = cf_util_get_boolean(child, &node->conn_per_thread);
     } else
       WARNING("write_redis plugin: Ignoring unknown config option \"%s\".",
               child->key);
@@ -236,6 +498,24 @@ static int wr_config_node(oconfig_item_t *ci) /* {{{ */
       break;
   } /* for (i = 0; i < ci->children_num; i++) */
 
+  if ((status == 0) && node->use_streams && (node->max_set_size >= 0) &&
+      (node->max_set_duration > 0))
+    WARNING("write_redis plugin: Node \"%s\": Streams can only be trimmed by "
+            "one criterion. Ignoring MaxSetDuration in favor of MaxSetSize.",
+            node->name);
+
+  if ((status == 0) && node->conn_per_thread) {
+    status = pthread_key_create(&node->conn_key, /* destructor = */ NULL);
+    if (status != 0)
+      ERROR("write_redis plugin: pthread_key_create failed: %s",
+            STRERROR(status));
+    else
+      node->conn_key_init = true;
+  } else if (status == 0) {
+    if (wr_conn_create(node) == NULL)
+      status = ENOMEM;
+  }
+
   if (status == 0) {
     char cb_name[sizeof("write_redis/") + DATA_MAX_NAME_LEN];
 
@@ -246,6 +526,11 @@ static int wr_config_node(oconfig_item_t *ci) /* {{{ */
                               &(user_data_t){
                                   .data = node, .free_func = wr_config_free,
                               });
+    if (status == 0)
+      plugin_register_flush(cb_name, wr_flush,
+                            &(user_data_t){
+                                .data = node,
+                            });
   }
 
   if (status != 0)
@@ -32,6 +32,7 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
 #include "write_riemann_threshold.h"
@@ -42,13 +43,40 @@
 #define RIEMANN_PORT 5555
 #define RIEMANN_TTL_FACTOR 2.0
 #define RIEMANN_BATCH_MAX 8192
+#define RIEMANN_QUEUE_LIMIT 64
+
+/* Templates unused for this many intervals are freed. */
+#define RIEMANN_TEMPLATE_TIMEOUT_FACTOR 10
+
+/*
+ * The parts of the events of one value list which never change: host,
+ * service, tags and attributes, one event per data source. Events built from
+ * a template point into it and need to be detached before being freed, see
+ * wrr_message_free().
+ */
+typedef struct {
+  size_t events_num;
+  riemann_event_t **events;
+  cdtime_t last_used;
+  cdtime_t timeout;
+} wrr_template_t;
+
+typedef struct wrr_queue_entry_s {
+  riemann_message_t *msg;
+  struct wrr_queue_entry_s *next;
+} wrr_queue_entry_t;
 
 struct riemann_host {
   c_complain_t init_complaint;
   char *name;
   char *event_service_prefix;
+  /* Protects everything but the client. */
   pthread_mutex_t lock;
+  /* Protects "client". Lock after "lock", if both are needed. */
+  pthread_mutex_t send_lock;
   bool batch_mode;
+  bool async;
+  bool report_stats;
   bool notifications;
   bool check_thresholds;
   bool store_rates;
@@ -67,6 +95,26 @@ struct riemann_host {
   char *tls_cert_file;
   char *tls_key_file;
   struct timeval timeout;
+
+  c_avl_tree_t *templates;
+  cdtime_t templates_expired;
+
+  /* Batches waiting for the sender thread. */
+  wrr_queue_entry_t *queue_head;
+  wrr_queue_entry_t *queue_tail;
+  int queue_length;
+  int queue_limit;
+  pthread_cond_t queue_cond;
+  pthread_t sender;
+  bool sender_running;
+  bool sending;
+  bool shutdown;
+
+  /* Statistics, protected by "lock". */
+  derive_t stats_events_sent;
+  derive_t stats_events_dropped;
+  derive_t stats_batches_sent;
+  derive_t stats_batches_failed;
 };
 
 static char **riemann_tags;
@@ -74,7 +122,7 @@ static size_t riemann_tags_num;
 static char **riemann_attrs;
 static size_t riemann_attrs_num;
 
-/* host->lock must be held when calling this function. */
+/* host->send_lock must be held when calling this function. */
 static int wrr_connect(struct riemann_host *host) /* {{{ */
 {
   char const *node;
@@ -121,7 +169,7 @@ static int wrr_connect(struct riemann_host *host) /* {{{ */
   return 0;
 } /* }}} int wrr_connect */
 
-/* host->lock must be held when calling this function. */
+/* host->send_lock must be held when calling this function. */
 static int wrr_disconnect(struct riemann_host *host) /* {{{ */
 {
   if (!host->client)
@@ -136,7 +184,7 @@ static int wrr_disconnect(struct riemann_host *host) /* {{{ */
 /**
  * Function to send messages to riemann.
  *
- * Acquires the host lock, disconnects on errors.
+ * Requires the send lock, disconnects on errors.
  */
 static int wrr_send_nolock(struct riemann_host *host,
                            riemann_message_t *msg) /* {{{ */
@@ -175,12 +223,35 @@ static int wrr_send_nolock(struct riemann_host *host,
 static int wrr_send(struct riemann_host *host, riemann_message_t *msg) {
   int status = 0;
 
-  pthread_mutex_lock(&host->lock);
+  pthread_mutex_lock(&host->send_lock);
   status = wrr_send_nolock(host, msg);
-  pthread_mutex_unlock(&host->lock);
+  pthread_mutex_unlock(&host->send_lock);
   return status;
 }
 
+/* Unlinks the parts owned by the template the event was built from. */
+static void wrr_event_detach(riemann_event_t *event) /* {{{ */
+{
+  event->host = NULL;
+  event->service = NULL;
+  event->n_tags = 0;
+  event->tags = NULL;
+  event->n_attributes = 0;
+  event->attributes = NULL;
+} /* }}} void wrr_event_detach */
+
+/* Frees a message holding events built by wrr_value_to_event(). */
+static void wrr_message_free(riemann_message_t *msg) /* {{{ */
+{
+  if (msg == NULL)
+    return;
+
+  for (size_t i = 0; i < msg->n_events; i++)
+    wrr_event_detach(msg->events[i]);
+
+  riemann_message_free(msg);
+} /* }}} void wrr_message_free */
+
 static riemann_message_t *wrr_notification_to_message(notification_t const *n) {
   riemann_message_t *msg;
   riemann_event_t *event;
@@ -272,9 +343,9 @@ static riemann_message_t *wrr_notification_to_message(notification_t const *n) {
 }
 
 static riemann_event_t *
-wrr_value_to_event(struct riemann_host const *host, /* {{{ */
-                   data_set_t const *ds, value_list_t const *vl, size_t index,
-                   gauge_t const *rates, int status) {
+wrr_template_event(struct riemann_host const *host, /* {{{ */
+                   data_set_t const *ds, value_list_t const *vl,
+                   size_t index) {
   riemann_event_t *event;
   char name_buffer[5 * DATA_MAX_NAME_LEN];
   char service_buffer[6 * DATA_MAX_NAME_LEN];
@@ -304,40 +375,11 @@ wrr_value_to_event(struct riemann_host const *host, /* {{{ */
                host->event_service_prefix, &name_buffer[1]);
   }
 
-  riemann_event_set(
-      event, RIEMANN_EVENT_FIELD_HOST, vl->host, RIEMANN_EVENT_FIELD_TIME,
-      (int64_t)CDTIME_T_TO_TIME_T(vl->time), RIEMANN_EVENT_FIELD_TTL,
-      (float)CDTIME_T_TO_DOUBLE(vl->interval) * host->ttl_factor,
-      RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES, "plugin", vl->plugin, "type",
-      vl->type, "ds_name", ds->ds[index].name, NULL,
-      RIEMANN_EVENT_FIELD_SERVICE, service_buffer, RIEMANN_EVENT_FIELD_NONE);
-
-#if RCC_VERSION_NUMBER >= 0x010A00
-  riemann_event_set(event, RIEMANN_EVENT_FIELD_TIME_MICROS,
-                    (int64_t)CDTIME_T_TO_US(vl->time));
-#endif
-
-  if (host->check_thresholds) {
-    const char *state = NULL;
-
-    switch (status) {
-    case STATE_OKAY:
-      state = "ok";
-      break;
-    case STATE_ERROR:
-      state = "critical";
-      break;
-    case STATE_WARNING:
-      state = "warning";
-      break;
-    case STATE_MISSING:
-      state = "unknown";
-      break;
-    }
-    if (state)
-      riemann_event_set(event, RIEMANN_EVENT_FIELD_STATE, state,
-                        RIEMANN_EVENT_FIELD_NONE);
-  }
+  riemann_event_set(event, RIEMANN_EVENT_FIELD_HOST, vl->host,
+                    RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES, "plugin", vl->plugin,
+                    "type", vl->type, "ds_name", ds->ds[index].name, NULL,
+                    RIEMANN_EVENT_FIELD_SERVICE, service_buffer,
+                    RIEMANN_EVENT_FIELD_NONE);
 
   if (vl->plugin_instance[0] != 0)
     riemann_event_string_attribute_add(event, "plugin_instance",
@@ -346,7 +388,7 @@ wrr_value_to_event(struct riemann_host const *host, /* {{{ */
     riemann_event_string_attribute_add(event, "type_instance",
                                        vl->type_instance);
 
-  if ((ds->ds[index].type != DS_TYPE_GAUGE) && (rates != NULL)) {
+  if ((ds->ds[index].type != DS_TYPE_GAUGE) && host->store_rates) {
     char ds_type[DATA_MAX_NAME_LEN];
 
     snprintf(ds_type, sizeof(ds_type), "%s:rate",
@@ -371,6 +413,181 @@ wrr_value_to_event(struct riemann_host const *host, /* {{{ */
   for (i = 0; i < riemann_tags_num; i++)
     riemann_event_tag_add(event, riemann_tags[i]);
 
+  return event;
+} /* }}} riemann_event_t *wrr_template_event */
+
+static void wrr_template_free(wrr_template_t *t) /* {{{ */
+{
+  if (t == NULL)
+    return;
+
+  for (size_t i = 0; i < t->events_num; i++)
+    if (t->events[i] != NULL)
+      riemann_event_free(t->events[i]);
+  sfree(t->events);
+  sfree(t);
+} /* }}} void wrr_template_free */
+
+/* host->lock must be held when calling this function. */
+static wrr_template_t *wrr_template_get(struct riemann_host *host, /* {{{ */
+                                        data_set_t const *ds,
+                                        value_list_t const *vl) {
+  char name[6 * DATA_MAX_NAME_LEN];
+  wrr_template_t *t = NULL;
+
+  if (FORMAT_VL(name, sizeof(name), vl) != 0)
+    return NULL;
+
+  if (host->templates == NULL) {
+    host->templates =
+        c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (host->templates == NULL) {
+      ERROR("write_riemann plugin: c_avl_create failed.");
+      return NULL;
+    }
+  }
+
+  if (c_avl_get(host->templates, name, (void *)&t) == 0) {
+    if (t->events_num == ds->ds_num)
+      goto found;
+
+    /* The data set has been changed. */
+    char *key = NULL;
+    c_avl_remove(host->templates, name, (void *)&key, (void *)&t);
+    sfree(key);
+    wrr_template_free(t);
+  }
+
+  t = calloc(1, sizeof(*t));
+  char *key = strdup(name);
+  if ((t == NULL) || (key == NULL) ||
+      ((t->events = calloc(ds->ds_num, sizeof(*t->events))) == NULL)) {
+    ERROR("write_riemann plugin: calloc failed.");
+    sfree(key);
+    wrr_template_free(t);
+    return NULL;
+  }
+  t->events_num = ds->ds_num;
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    t->events[i] = wrr_template_event(host, ds, vl, i);
+    if (t->events[i] == NULL) {
+      sfree(key);
+      wrr_template_free(t);
+      return NULL;
+    }
+  }
+
+  if (c_avl_insert(host->templates, key, t) != 0) {
+    ERROR("write_riemann plugin: c_avl_insert failed.");
+    sfree(key);
+    wrr_template_free(t);
+    return NULL;
+  }
+
+found:
+  t->last_used = cdtime();
+  t->timeout = RIEMANN_TEMPLATE_TIMEOUT_FACTOR * vl->interval;
+  return t;
+} /* }}} wrr_template_t *wrr_template_get */
+
+/* Frees templates which have not been used for a while. Only templates not
+ * referenced by any event in flight may be freed: the sender thread must be
+ * idle, and the batch being built must have been started after the last use.
+ * host->lock must be held when calling this function. */
+static void wrr_templates_expire(struct riemann_host *host) /* {{{ */
+{
+  cdtime_t now = cdtime();
+
+  if ((host->templates == NULL) || (host->queue_length > 0) || host->sending)
+    return;
+  if ((now - host->templates_expired) < TIME_T_TO_CDTIME_T(60))
+    return;
+  host->templates_expired = now;
+
+  char **expired = NULL;
+  size_t expired_num = 0;
+
+  c_avl_iterator_t *iter = c_avl_get_iterator(host->templates);
+  char *key;
+  wrr_template_t *t;
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&t) == 0) {
+    bool in_batch =
+        (host->batch_msg != NULL) && (t->last_used >= host->batch_init);
+    if (in_batch || ((now - t->last_used) < t->timeout))
+      continue;
+
+    char **tmp = realloc(expired, (expired_num + 1) * sizeof(*expired));
+    if (tmp == NULL)
+      break;
+    expired = tmp;
+    expired[expired_num++] = key;
+  }
+  c_avl_iterator_destroy(iter);
+
+  for (size_t i = 0; i < expired_num; i++) {
+    if (c_avl_remove(host->templates, expired[i], (void *)&key, (void *)&t) !=
+        0)
+      continue;
+    sfree(key);
+    wrr_template_free(t);
+  }
+  sfree(expired);
+} /* }}} void wrr_templates_expire */
+
+static riemann_event_t *
+wrr_value_to_event(struct riemann_host const *host, /* {{{ */
+                   riemann_event_t const *template, data_set_t const *ds,
+                   value_list_t const *vl, size_t index, gauge_t const *rates,
+                   int status) {
+  riemann_event_t *event;
+
+  event = riemann_event_new();
+  if (event == NULL) {
+    ERROR("write_riemann plugin: riemann_event_new() failed.");
+    return NULL;
+  }
+
+  event->host = template->host;
+  event->service = template->service;
+  event->n_tags = template->n_tags;
+  event->tags = template->tags;
+  event->n_attributes = template->n_attributes;
+  event->attributes = template->attributes;
+
+  riemann_event_set(
+      event, RIEMANN_EVENT_FIELD_TIME, (int64_t)CDTIME_T_TO_TIME_T(vl->time),
+      RIEMANN_EVENT_FIELD_TTL,
+      (float)CDTIME_T_TO_DOUBLE(vl->interval) * host->ttl_factor,
+      RIEMANN_EVENT_FIELD_NONE);
+
+#if RCC_VERSION_NUMBER >= 0x010A00
+  riemann_event_set(event, RIEMANN_EVENT_FIELD_TIME_MICROS,
+                    (int64_t)CDTIME_T_TO_US(vl->time));
+#endif
+
+  if (host->check_thresholds) {
+    const char *state = NULL;
+
+    switch (status) {
+    case STATE_OKAY:
+      state = "ok";
+      break;
+    case STATE_ERROR:
+      state = "critical";
+      break;
+    case STATE_WARNING:
+      state = "warning";
+      break;
+    case STATE_MISSING:
+      state = "unknown";
+      break;
+    }
+    if (state)
+      riemann_event_set(event, RIEMANN_EVENT_FIELD_STATE, state,
+                        RIEMANN_EVENT_FIELD_NONE);
+  }
+
   if (ds->ds[index].type == DS_TYPE_GAUGE) {
     riemann_event_set(event, RIEMANN_EVENT_FIELD_METRIC_D,
                       (double)vl->values[index].gauge,
@@ -398,45 +615,196 @@ wrr_value_to_event(struct riemann_host const *host, /* {{{ */
   return event;
 } /* }}} riemann_event_t *wrr_value_to_event */
 
-static riemann_message_t *
-wrr_value_list_to_message(struct riemann_host const *host, /* {{{ */
-                          data_set_t const *ds, value_list_t const *vl,
-                          int *statuses) {
-  riemann_message_t *msg;
-  size_t i;
-  gauge_t *rates = NULL;
+/* Appends the events of "vl" to "msg".
+ * host->lock must be held when calling this function. */
+static int wrr_value_list_append(struct riemann_host *host, /* {{{ */
+                                 riemann_message_t *msg, data_set_t const *ds,
+                                 value_list_t const *vl, gauge_t const *rates,
+                                 int const *statuses) {
+  wrr_template_t *t = wrr_template_get(host, ds, vl);
+  if (t == NULL)
+    return -1;
 
-  /* Initialize the Msg structure. */
-  msg = riemann_message_new();
-  if (msg == NULL) {
-    ERROR("write_riemann plugin: riemann_message_new failed.");
-    return NULL;
+  for (size_t i = 0; i < vl->values_len; i++) {
+    riemann_event_t *event;
+
+    event = wrr_value_to_event(host, t->events[i], ds, vl, i, rates,
+                               statuses[i]);
+    if (event == NULL)
+      return -1;
+
+    if (riemann_message_append_events(msg, event, NULL) != 0) {
+      ERROR("write_riemann plugin: out of memory");
+      wrr_event_detach(event);
+      riemann_event_free(event);
+      return -1;
+    }
   }
 
-  if (host->store_rates) {
-    rates = uc_get_rate(ds, vl);
-    if (rates == NULL) {
-      ERROR("write_riemann plugin: uc_get_rate failed.");
-      riemann_message_free(msg);
-      return NULL;
+  return 0;
+} /* }}} int wrr_value_list_append */
+
+/* host->lock must be held when calling this function. */
+static void wrr_stats_update(struct riemann_host *host, /* {{{ */
+                             size_t events_num, int status) {
+  if (status != 0) {
+    host->stats_batches_failed++;
+    host->stats_events_dropped += (derive_t)events_num;
+    c_complain(
+        LOG_ERR, &host->init_complaint,
+        "write_riemann plugin: riemann_client_send failed with status %i",
+        status);
+  } else {
+    host->stats_batches_sent++;
+    host->stats_events_sent += (derive_t)events_num;
+    c_release(LOG_DEBUG, &host->init_complaint,
+              "write_riemann plugin: riemann_client_send succeeded");
+  }
+} /* }}} void wrr_stats_update */
+
+static void *wrr_sender_thread(void *arg) /* {{{ */
+{
+  struct riemann_host *host = arg;
+
+  pthread_mutex_lock(&host->lock);
+  while (true) {
+    while ((host->queue_head == NULL) && !host->shutdown)
+      pthread_cond_wait(&host->queue_cond, &host->lock);
+    if (host->queue_head == NULL)
+      break;
+
+    wrr_queue_entry_t *entry = host->queue_head;
+    host->queue_head = entry->next;
+    if (host->queue_head == NULL)
+      host->queue_tail = NULL;
+    host->queue_length--;
+    host->sending = true;
+    pthread_mutex_unlock(&host->lock);
+
+    size_t events_num = entry->msg->n_events;
+    int status = wrr_send(host, entry->msg);
+    wrr_message_free(entry->msg);
+    sfree(entry);
+
+    pthread_mutex_lock(&host->lock);
+    host->sending = false;
+    wrr_stats_update(host, events_num, status);
+
+    /* Don't delay the shutdown by trying each remaining batch in turn. */
+    if ((status != 0) && host->shutdown) {
+      while ((entry = host->queue_head) != NULL) {
+        host->queue_head = entry->next;
+        host->stats_events_dropped += (derive_t)entry->msg->n_events;
+        wrr_message_free(entry->msg);
+        sfree(entry);
+      }
+      host->queue_tail = NULL;
+      host->queue_length = 0;
     }
   }
+  pthread_mutex_unlock(&host->lock);
 
-  for (i = 0; i < vl->values_len; i++) {
-    riemann_event_t *event;
+  return NULL;
+} /* }}} void *wrr_sender_thread */
 
-    event = wrr_value_to_event(host, ds, vl, (int)i, rates, statuses[i]);
-    if (event == NULL) {
-      riemann_message_free(msg);
-      sfree(rates);
-      return NULL;
+/* Hands "msg" to the sender thread. If the queue is full, the oldest batch is
+ * dropped: fresh values are more useful than old ones.
+ * host->lock must be held when calling this function. */
+static int wrr_queue_push_nolock(struct riemann_host *host, /* {{{ */
+                                 riemann_message_t *msg) {
+  wrr_queue_entry_t *entry = calloc(1, sizeof(*entry));
+  if (entry == NULL) {
+    ERROR("write_riemann plugin: calloc failed.");
+    host->stats_events_dropped += (derive_t)msg->n_events;
+    wrr_message_free(msg);
+    return ENOMEM;
+  }
+  entry->msg = msg;
+
+  if (!host->sender_running) {
+    int status = plugin_thread_create(&host->sender, /* attr = */ NULL,
+                                      wrr_sender_thread, host, "riemann send");
+    if (status != 0) {
+      ERROR("write_riemann plugin: Starting the sender thread failed: %s",
+            STRERROR(status));
+      host->stats_events_dropped += (derive_t)msg->n_events;
+      wrr_message_free(msg);
+      sfree(entry);
+      return status;
     }
-    riemann_message_append_events(msg, event, NULL);
+    host->sender_running = true;
   }
 
-  sfree(rates);
-  return msg;
-} /* }}} riemann_message_t *wrr_value_list_to_message */
+  while ((host->queue_limit > 0) && (host->queue_length >= host->queue_limit)) {
+    wrr_queue_entry_t *oldest = host->queue_head;
+    host->queue_head = oldest->next;
+    if (host->queue_head == NULL)
+      host->queue_tail = NULL;
+    host->queue_length--;
+
+    if (host->stats_events_dropped == 0)
+      WARNING("write_riemann plugin: Node \"%s\": The send queue is full, "
+              "dropping the oldest batch. Is the Riemann server too slow?",
+              host->name);
+    host->stats_events_dropped += (derive_t)oldest->msg->n_events;
+    wrr_message_free(oldest->msg);
+    sfree(oldest);
+  }
+
+  if (host->queue_tail == NULL)
+    host->queue_head = entry;
+  else
+    host->queue_tail->next = entry;
+  host->queue_tail = entry;
+  host->queue_length++;
+
+  pthread_cond_signal(&host->queue_cond);
+  return 0;
+} /* }}} int wrr_queue_push_nolock */
+
+static int wrr_stats_read(user_data_t *ud) /* {{{ */
+{
+  struct riemann_host *host = ud->data;
+  value_list_t vl = VALUE_LIST_INIT;
+
+  pthread_mutex_lock(&host->lock);
+  derive_t events_sent = host->stats_events_sent;
+  derive_t events_dropped = host->stats_events_dropped;
+  derive_t batches_sent = host->stats_batches_sent;
+  derive_t batches_failed = host->stats_batches_failed;
+  gauge_t queue_length = (gauge_t)host->queue_length;
+  pthread_mutex_unlock(&host->lock);
+
+  vl.values = &(value_t){.derive = 0};
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "write_riemann", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, host->name, sizeof(vl.plugin_instance));
+
+  sstrncpy(vl.type, "total_values", sizeof(vl.type));
+  vl.values[0].derive = events_sent;
+  sstrncpy(vl.type_instance, "sent", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values[0].derive = events_dropped;
+  sstrncpy(vl.type_instance, "dropped", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  sstrncpy(vl.type, "total_requests", sizeof(vl.type));
+  vl.values[0].derive = batches_sent;
+  sstrncpy(vl.type_instance, "sent", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values[0].derive = batches_failed;
+  sstrncpy(vl.type_instance, "failed", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  sstrncpy(vl.type, "queue_length", sizeof(vl.type));
+  vl.values[0].gauge = queue_length;
+  vl.type_instance[0] = 0;
+  plugin_dispatch_values(&vl);
+
+  return 0;
+} /* }}} int wrr_stats_read */
 
 /*
  * Always call while holding host->lock !
@@ -451,11 +819,20 @@ static int wrr_batch_flush_nolock(cdtime_t timeout, struct riemann_host *host) {
       return status;
     }
   }
-  wrr_send_nolock(host, host->batch_msg);
-  riemann_message_free(host->batch_msg);
 
+  riemann_message_t *msg = host->batch_msg;
   host->batch_init = now;
   host->batch_msg = NULL;
+  if (msg == NULL)
+    return 0;
+
+  if (host->async)
+    return wrr_queue_push_nolock(host, msg);
+
+  size_t events_num = msg->n_events;
+  status = wrr_send(host, msg);
+  wrr_message_free(msg);
+  wrr_stats_update(host, events_num, status);
   return status;
 }
 
@@ -471,15 +848,6 @@ static int wrr_batch_flush(cdtime_t timeout,
   host = user_data->data;
   pthread_mutex_lock(&host->lock);
   status = wrr_batch_flush_nolock(timeout, host);
-  if (status != 0)
-    c_complain(
-        LOG_ERR, &host->init_complaint,
-        "write_riemann plugin: riemann_client_send failed with status %i",
-        status);
-  else
-    c_release(LOG_DEBUG, &host->init_complaint,
-              "write_riemann plugin: batch sent.");
-
   pthread_mutex_unlock(&host->lock);
   return status;
 }
@@ -487,38 +855,42 @@ static int wrr_batch_flush(cdtime_t timeout,
 static int wrr_batch_add_value_list(struct riemann_host *host, /* {{{ */
                                     data_set_t const *ds,
                                     value_list_t const *vl, int *statuses) {
-  riemann_message_t *msg;
   size_t len;
   int ret;
   cdtime_t timeout;
+  gauge_t *rates = NULL;
 
-  msg = wrr_value_list_to_message(host, ds, vl, statuses);
-  if (msg == NULL)
-    return -1;
+  if (host->store_rates) {
+    rates = uc_get_rate(ds, vl);
+    if (rates == NULL) {
+      ERROR("write_riemann plugin: uc_get_rate failed.");
+      return -1;
+    }
+  }
 
   pthread_mutex_lock(&host->lock);
 
-  if (host->batch_msg == NULL) {
-    host->batch_msg = msg;
-  } else {
-    int status;
-
-    status = riemann_message_append_events_n(host->batch_msg, msg->n_events,
-                                             msg->events);
-    msg->n_events = 0;
-    msg->events = NULL;
+  wrr_templates_expire(host);
 
-    riemann_message_free(msg);
-
-    if (status != 0) {
+  if (host->batch_msg == NULL) {
+    host->batch_msg = riemann_message_new();
+    if (host->batch_msg == NULL) {
       pthread_mutex_unlock(&host->lock);
-      ERROR("write_riemann plugin: out of memory");
+      ERROR("write_riemann plugin: riemann_message_new failed.");
+      sfree(rates);
       return -1;
     }
+    host->batch_init = cdtime();
+  }
+
+  ret = wrr_value_list_append(host, host->batch_msg, ds, vl, rates, statuses);
+  sfree(rates);
+  if (ret != 0) {
+    pthread_mutex_unlock(&host->lock);
+    return ret;
   }
 
   len = riemann_message_get_packed_size(host->batch_msg);
-  ret = 0;
   if ((host->batch_max < 0) || (((size_t)host->batch_max) <= len)) {
     ret = wrr_batch_flush_nolock(0, host);
   } else {
@@ -568,6 +940,7 @@ static int wrr_write(const data_set_t *ds, /* {{{ */
   int statuses[vl->values_len];
   struct riemann_host *host = ud->data;
   riemann_message_t *msg;
+  gauge_t *rates = NULL;
 
   if (host->check_thresholds) {
     status = write_riemann_threshold_check(ds, vl, statuses);
@@ -577,17 +950,37 @@ static int wrr_write(const data_set_t *ds, /* {{{ */
     memset(statuses, 0, sizeof(statuses));
   }
 
-  if (host->client_type != RIEMANN_CLIENT_UDP && host->batch_mode) {
-    wrr_batch_add_value_list(host, ds, vl, statuses);
-  } else {
-    msg = wrr_value_list_to_message(host, ds, vl, statuses);
-    if (msg == NULL)
+  if (host->client_type != RIEMANN_CLIENT_UDP && host->batch_mode)
+    return wrr_batch_add_value_list(host, ds, vl, statuses);
+
+  if (host->store_rates) {
+    rates = uc_get_rate(ds, vl);
+    if (rates == NULL) {
+      ERROR("write_riemann plugin: uc_get_rate failed.");
       return -1;
+    }
+  }
 
-    status = wrr_send(host, msg);
+  msg = riemann_message_new();
+  if (msg == NULL) {
+    ERROR("write_riemann plugin: riemann_message_new failed.");
+    sfree(rates);
+    return -1;
+  }
 
-    riemann_message_free(msg);
+  /* The message points into the templates, so keep them from expiring until
+   * it has been sent. */
+  pthread_mutex_lock(&host->lock);
+  wrr_templates_expire(host);
+  status = wrr_value_list_append(host, msg, ds, vl, rates, statuses);
+  if (status == 0) {
+    status = wrr_send(host, msg);
+    wrr_stats_update(host, msg->n_events, status);
   }
+  pthread_mutex_unlock(&host->lock);
+
+  wrr_message_free(msg);
+  sfree(rates);
   return status;
 } /* }}} int wrr_write */
 
@@ -606,9 +999,35 @@ static void wrr_free(void *p) /* {{{ */
     return;
   }
 
+  if (host->async && (host->batch_msg != NULL))
+    wrr_batch_flush_nolock(0, host);
+
+  host->shutdown = true;
+  pthread_cond_signal(&host->queue_cond);
+  pthread_mutex_unlock(&host->lock);
+
+  if (host->sender_running) {
+    pthread_join(host->sender, NULL);
+    host->sender_running = false;
+  }
+
+  wrr_message_free(host->batch_msg);
+  host->batch_msg = NULL;
+
   wrr_disconnect(host);
 
-  pthread_mutex_lock(&host->lock);
+  if (host->templates != NULL) {
+    char *key;
+    wrr_template_t *t;
+    while (c_avl_pick(host->templates, (void *)&key, (void *)&t) == 0) {
+      sfree(key);
+      wrr_template_free(t);
+    }
+    c_avl_destroy(host->templates);
+  }
+
+  pthread_cond_destroy(&host->queue_cond);
+  pthread_mutex_destroy(&host->send_lock);
   pthread_mutex_destroy(&host->lock);
   sfree(host);
 } /* }}} void wrr_free */
@@ -626,6 +1045,8 @@ static int wrr_config_node(oconfig_item_t *ci) /* {{{ */
     return ENOMEM;
   }
   pthread_mutex_init(&host->lock, NULL);
+  pthread_mutex_init(&host->send_lock, NULL);
+  pthread_cond_init(&host->queue_cond, NULL);
   C_COMPLAIN_INIT(&host->init_complaint);
   host->reference_count = 1;
   host->node = NULL;
@@ -638,6 +1059,9 @@ static int wrr_config_node(oconfig_item_t *ci) /* {{{ */
   host->batch_max = RIEMANN_BATCH_MAX; /* typical MSS */
   host->batch_init = cdtime();
   host->batch_timeout = 0;
+  host->async = true;
+  host->queue_limit = RIEMANN_QUEUE_LIMIT;
+  host->report_stats = false;
   host->ttl_factor = RIEMANN_TTL_FACTOR;
   host->client = NULL;
   host->client_type = RIEMANN_CLIENT_TCP;
@@ -687,6 +1111,18 @@ static int wrr_config_node(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_int(child, &host->batch_timeout);
       if (status != 0)
         break;
+    } else if (strcasecmp("AsyncSend", child->key) == 0) {
+      status = cf_util_get_boolean(child, &host->async);
+      if (status != 0)
+        break;
+    } else if (strcasecmp("SendQueueLimit", child->key) == 0) {
+      status = cf_util_get_int(child, &host->queue_limit);
+      if (status != 0)
+        break;
+    } else if (strcasecmp("ReportStats", child->key) == 0) {
+      status = cf_util_get_boolean(child, &host->report_stats);
+      if (status != 0)
+        break;
     } else if (strcasecmp("Timeout", child->key) == 0) {
 #if RCC_VERSION_NUMBER >= 0x010800
       status = cf_util_get_int(child, (int *)&host->timeout.tv_sec);
@@ -777,6 +1213,10 @@ static int wrr_config_node(oconfig_item_t *ci) /* {{{ */
     return status;
   }
 
+  /* The sender thread only handles batches. */
+  if ((host->client_type == RIEMANN_CLIENT_UDP) || !host->batch_mode)
+    host->async = false;
+
   snprintf(callback_name, sizeof(callback_name), "write_riemann/%s",
            host->name);
 
@@ -786,10 +1226,14 @@ static int wrr_config_node(oconfig_item_t *ci) /* {{{ */
 
   status = plugin_register_write(callback_name, wrr_write, &ud);
 
-  if (host->client_type != RIEMANN_CLIENT_UDP && host->batch_mode) {
-    ud.free_func = NULL;
-    plugin_register_flush(callback_name, wrr_batch_flush, &ud);
-  }
+  /* The flush and read callbacks don't hold a reference: they are
+   * unregistered before the write and notification callbacks. */
+  user_data_t ud_noref = {.data = host};
+  if (host->client_type != RIEMANN_CLIENT_UDP && host->batch_mode)
+    plugin_register_flush(callback_name, wrr_batch_flush, &ud_noref);
+  if (host->report_stats)
+    plugin_register_complex_read(/* group = */ NULL, callback_name,
+                                 wrr_stats_read, /* interval = */ 0, &ud_noref);
   if (status != 0)
     WARNING("write_riemann plugin: plugin_register_write (\"%s\") "
             "failed with status %i.",
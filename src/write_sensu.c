@@ -30,7 +30,9 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_complain.h"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <inttypes.h>
@@ -40,6 +42,11 @@
 #include <stdlib.h>
 #define SENSU_HOST "localhost"
 #define SENSU_PORT "3030"
+#define SENSU_BATCH_MAX 8192
+#define SENSU_QUEUE_LIMIT 1024
+
+/* Templates unused for this many intervals are freed. */
+#define SENSU_TEMPLATE_TIMEOUT_FACTOR 10
 
 #ifdef HAVE_ASPRINTF
 #define my_asprintf asprintf
@@ -99,24 +106,74 @@ struct str_list {
   char **strs;
 };
 
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+} sensu_buffer_t;
+
+/*
+ * The parts of the events of one value list which never change, one string
+ * per data source: everything up to and including the service name in the
+ * "output" field. Only the value and the time are appended per event.
+ */
+typedef struct {
+  size_t events_num;
+  char **events;
+  cdtime_t last_used;
+  cdtime_t timeout;
+} sensu_template_t;
+
+typedef struct sensu_queue_entry_s {
+  char *msg;
+  size_t msg_len;
+  struct sensu_queue_entry_s *next;
+} sensu_queue_entry_t;
+
 struct sensu_host {
+  c_complain_t send_complaint;
+  c_complain_t queue_complaint;
   char *name;
   char *event_service_prefix;
   struct str_list metric_handlers;
   struct str_list notification_handlers;
 #define F_READY 0x01
   uint8_t flags;
+  /* Protects everything but the connection. */
   pthread_mutex_t lock;
+  /* Protects "flags", "s" and "res". Lock after "lock", if both are needed. */
+  pthread_mutex_t send_lock;
   bool notifications;
   bool metrics;
   bool store_rates;
   bool always_append_ds;
+  bool batch_mode;
+  bool async;
   char *separator;
   char *node;
   char *service;
   int s;
   struct addrinfo *res;
   int reference_count;
+
+  /* Events waiting to be sent as one JSON array. */
+  sensu_buffer_t batch;
+  cdtime_t batch_init;
+  int batch_max;
+  int batch_timeout;
+
+  c_avl_tree_t *templates;
+  cdtime_t templates_expired;
+
+  /* Messages waiting for the sender thread. */
+  sensu_queue_entry_t *queue_head;
+  sensu_queue_entry_t *queue_tail;
+  int queue_length;
+  int queue_limit;
+  pthread_cond_t queue_cond;
+  pthread_t sender;
+  bool sender_running;
+  bool shutdown;
 };
 
 static char *sensu_tags;
@@ -132,7 +189,8 @@ static int add_str_to_list(struct str_list *strs,
     ERROR("write_sensu plugin: Unable to alloc memory");
     return -1;
   }
-  strs->strs = realloc(strs->strs, strs->nb_strs + 1);
+  strs->strs =
+      realloc(strs->strs, (strs->nb_strs + 1) * sizeof(*strs->strs));
   if (strs->strs == NULL) {
     strs->strs = old_strs_ptr;
     free(newstr);
@@ -335,14 +393,15 @@ static void in_place_replace_sensu_name_reserved(char *orig_name) /* {{{ */
   }
 } /* }}} char *replace_sensu_name_reserved */
 
-static char *sensu_value_to_json(struct sensu_host const *host, /* {{{ */
-                                 data_set_t const *ds, value_list_t const *vl,
-                                 size_t index, gauge_t const *rates) {
+/* Builds the part of the JSON event of data source "index" which doesn't
+ * change between values, see sensu_template_t. */
+static char *sensu_template_event(struct sensu_host const *host, /* {{{ */
+                                  data_set_t const *ds, value_list_t const *vl,
+                                  size_t index, bool rates) {
   char name_buffer[5 * DATA_MAX_NAME_LEN];
   char service_buffer[6 * DATA_MAX_NAME_LEN];
   char *ret_str;
   char *temp_str;
-  char *value_str;
   int res;
   // First part of the JSON string
   const char *part1 = "{\"name\": \"collectd\", \"type\": \"metric\"";
@@ -417,7 +476,7 @@ static char *sensu_value_to_json(struct sensu_host const *host, /* {{{ */
   }
 
   // incorporate the data source type
-  if ((ds->ds[index].type != DS_TYPE_GAUGE) && (rates != NULL)) {
+  if ((ds->ds[index].type != DS_TYPE_GAUGE) && rates) {
     char ds_type[DATA_MAX_NAME_LEN];
     snprintf(ds_type, sizeof(ds_type), "%s:rate",
              DS_TYPE_TO_STRING(ds->ds[index].type));
@@ -487,47 +546,6 @@ static char *sensu_value_to_json(struct sensu_host const *host, /* {{{ */
     ret_str = temp_str;
   }
 
-  // calculate the value and set to a string
-  if (ds->ds[index].type == DS_TYPE_GAUGE) {
-    res = my_asprintf(&value_str, GAUGE_FORMAT, vl->values[index].gauge);
-    if (res == -1) {
-      free(ret_str);
-      ERROR("write_sensu plugin: Unable to alloc memory");
-      return NULL;
-    }
-  } else if (rates != NULL) {
-    res = my_asprintf(&value_str, GAUGE_FORMAT, rates[index]);
-    if (res == -1) {
-      free(ret_str);
-      ERROR("write_sensu plugin: Unable to alloc memory");
-      return NULL;
-    }
-  } else {
-    if (ds->ds[index].type == DS_TYPE_DERIVE) {
-      res = my_asprintf(&value_str, "%" PRIi64, vl->values[index].derive);
-      if (res == -1) {
-        free(ret_str);
-        ERROR("write_sensu plugin: Unable to alloc memory");
-        return NULL;
-      }
-    } else if (ds->ds[index].type == DS_TYPE_ABSOLUTE) {
-      res = my_asprintf(&value_str, "%" PRIu64, vl->values[index].absolute);
-      if (res == -1) {
-        free(ret_str);
-        ERROR("write_sensu plugin: Unable to alloc memory");
-        return NULL;
-      }
-    } else {
-      res = my_asprintf(&value_str, "%" PRIu64,
-                        (uint64_t)vl->values[index].counter);
-      if (res == -1) {
-        free(ret_str);
-        ERROR("write_sensu plugin: Unable to alloc memory");
-        return NULL;
-      }
-    }
-  }
-
   // Generate the full service name
   sensu_format_name2(name_buffer, sizeof(name_buffer), vl->host, vl->plugin,
                      vl->plugin_instance, vl->type, vl->type_instance,
@@ -551,23 +569,189 @@ static char *sensu_value_to_json(struct sensu_host const *host, /* {{{ */
   // happy
   in_place_replace_sensu_name_reserved(service_buffer);
 
-  // finalize the buffer by setting the output and closing curly bracket
-  res = my_asprintf(&temp_str, "%s, \"output\": \"%s %s %lld\"}\n", ret_str,
-                    service_buffer, value_str,
-                    (long long)CDTIME_T_TO_TIME_T(vl->time));
+  // the value and the time are appended by sensu_value_append()
+  res = my_asprintf(&temp_str, "%s, \"output\": \"%s ", ret_str,
+                    service_buffer);
   free(ret_str);
-  free(value_str);
   if (res == -1) {
     ERROR("write_sensu plugin: Unable to alloc memory");
     return NULL;
   }
   ret_str = temp_str;
 
-  DEBUG("write_sensu plugin: Successfully created json for metric: "
+  DEBUG("write_sensu plugin: Successfully created json template for metric: "
         "host = \"%s\", service = \"%s\"",
         vl->host, service_buffer);
   return ret_str;
-} /* }}} char *sensu_value_to_json */
+} /* }}} char *sensu_template_event */
+
+static void sensu_template_free(sensu_template_t *t) /* {{{ */
+{
+  if (t == NULL)
+    return;
+
+  for (size_t i = 0; i < t->events_num; i++)
+    sfree(t->events[i]);
+  sfree(t->events);
+  sfree(t);
+} /* }}} void sensu_template_free */
+
+/* host->lock must be held when calling this function. */
+static sensu_template_t *sensu_template_get(struct sensu_host *host, /* {{{ */
+                                            data_set_t const *ds,
+                                            value_list_t const *vl) {
+  char name[6 * DATA_MAX_NAME_LEN];
+  sensu_template_t *t = NULL;
+
+  if (FORMAT_VL(name, sizeof(name), vl) != 0)
+    return NULL;
+
+  if (host->templates == NULL) {
+    host->templates =
+        c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (host->templates == NULL) {
+      ERROR("write_sensu plugin: c_avl_create failed.");
+      return NULL;
+    }
+  }
+
+  if (c_avl_get(host->templates, name, (void *)&t) == 0) {
+    if (t->events_num == ds->ds_num)
+      goto found;
+
+    /* The data set has been changed. */
+    char *key = NULL;
+    c_avl_remove(host->templates, name, (void *)&key, (void *)&t);
+    sfree(key);
+    sensu_template_free(t);
+  }
+
+  t = calloc(1, sizeof(*t));
+  char *key = strdup(name);
+  if ((t == NULL) || (key == NULL) ||
+      ((t->events = calloc(ds->ds_num, sizeof(*t->events))) == NULL)) {
+    ERROR("write_sensu plugin: calloc failed.");
+    sfree(key);
+    sensu_template_free(t);
+    return NULL;
+  }
+  t->events_num = ds->ds_num;
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    t->events[i] = sensu_template_event(host, ds, vl, i, host->store_rates);
+    if (t->events[i] == NULL) {
+      sfree(key);
+      sensu_template_free(t);
+      return NULL;
+    }
+  }
+
+  if (c_avl_insert(host->templates, key, t) != 0) {
+    ERROR("write_sensu plugin: c_avl_insert failed.");
+    sfree(key);
+    sensu_template_free(t);
+    return NULL;
+  }
+
+found:
+  t->last_used = cdtime();
+  t->timeout = SENSU_TEMPLATE_TIMEOUT_FACTOR * vl->interval;
+  return t;
+} /* }}} sensu_template_t *sensu_template_get */
+
+/* Frees templates which have not been used for a while. Events are copied out
+ * of the templates, so nothing in flight references them.
+ * host->lock must be held when calling this function. */
+static void sensu_templates_expire(struct sensu_host *host) /* {{{ */
+{
+  cdtime_t now = cdtime();
+
+  if (host->templates == NULL)
+    return;
+  if ((now - host->templates_expired) < TIME_T_TO_CDTIME_T(60))
+    return;
+  host->templates_expired = now;
+
+  char **expired = NULL;
+  size_t expired_num = 0;
+
+  c_avl_iterator_t *iter = c_avl_get_iterator(host->templates);
+  char *key;
+  sensu_template_t *t;
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&t) == 0) {
+    if ((now - t->last_used) < t->timeout)
+      continue;
+
+    char **tmp = realloc(expired, (expired_num + 1) * sizeof(*expired));
+    if (tmp == NULL)
+      break;
+    expired = tmp;
+    expired[expired_num++] = key;
+  }
+  c_avl_iterator_destroy(iter);
+
+  for (size_t i = 0; i < expired_num; i++) {
+    if (c_avl_remove(host->templates, expired[i], (void *)&key, (void *)&t) !=
+        0)
+      continue;
+    sfree(key);
+    sensu_template_free(t);
+  }
+  sfree(expired);
+} /* }}} void sensu_templates_expire */
+
+static int sensu_buffer_append(sensu_buffer_t *buf, /* {{{ */
+                               char const *str, size_t len) {
+  if ((buf->size - buf->len) <= len) {
+    size_t size = (buf->size > 0) ? buf->size : 1024;
+    while ((size - buf->len) <= len)
+      size *= 2;
+
+    char *tmp = realloc(buf->data, size);
+    if (tmp == NULL) {
+      ERROR("write_sensu plugin: Unable to alloc memory");
+      return ENOMEM;
+    }
+    buf->data = tmp;
+    buf->size = size;
+  }
+
+  memcpy(buf->data + buf->len, str, len);
+  buf->len += len;
+  buf->data[buf->len] = 0;
+  return 0;
+} /* }}} int sensu_buffer_append */
+
+/* Appends the event of data source "index" to "buf", without a newline. */
+static int sensu_value_append(sensu_buffer_t *buf, /* {{{ */
+                              char const *template, data_set_t const *ds,
+                              value_list_t const *vl, size_t index,
+                              gauge_t const *rates) {
+  char value[64];
+
+  if (ds->ds[index].type == DS_TYPE_GAUGE)
+    snprintf(value, sizeof(value), GAUGE_FORMAT, vl->values[index].gauge);
+  else if (rates != NULL)
+    snprintf(value, sizeof(value), GAUGE_FORMAT, rates[index]);
+  else if (ds->ds[index].type == DS_TYPE_DERIVE)
+    snprintf(value, sizeof(value), "%" PRIi64, vl->values[index].derive);
+  else if (ds->ds[index].type == DS_TYPE_ABSOLUTE)
+    snprintf(value, sizeof(value), "%" PRIu64, vl->values[index].absolute);
+  else
+    snprintf(value, sizeof(value), "%" PRIu64,
+             (uint64_t)vl->values[index].counter);
+
+  char tail[128];
+  int len = snprintf(tail, sizeof(tail), "%s %lld\"}", value,
+                     (long long)CDTIME_T_TO_TIME_T(vl->time));
+  if ((len < 0) || ((size_t)len >= sizeof(tail)))
+    return EINVAL;
+
+  int status = sensu_buffer_append(buf, template, strlen(template));
+  if (status != 0)
+    return status;
+  return sensu_buffer_append(buf, tail, (size_t)len);
+} /* }}} int sensu_value_append */
 
 /*
  * Uses replace_str2() implementation from
@@ -864,18 +1048,15 @@ static char *sensu_notification_to_json(struct sensu_host *host, /* {{{ */
   return ret_str;
 } /* }}} char *sensu_notification_to_json */
 
-static int sensu_send_msg(struct sensu_host *host, const char *msg) /* {{{ */
-{
+static int sensu_send_msg(struct sensu_host *host, /* {{{ */
+                          char const *msg, size_t msg_len) {
   int status = 0;
-  size_t buffer_len;
 
   status = sensu_connect(host);
   if (status != 0)
     return status;
 
-  buffer_len = strlen(msg);
-
-  status = (int)swrite(host->s, msg, buffer_len);
+  status = (int)swrite(host->s, msg, msg_len);
   sensu_close_socket(host);
 
   if (status != 0) {
@@ -888,11 +1069,12 @@ static int sensu_send_msg(struct sensu_host *host, const char *msg) /* {{{ */
   return 0;
 } /* }}} int sensu_send_msg */
 
-static int sensu_send(struct sensu_host *host, char const *msg) /* {{{ */
-{
+/* host->send_lock must be held when calling this function. */
+static int sensu_send(struct sensu_host *host, /* {{{ */
+                      char const *msg, size_t msg_len) {
   int status = 0;
 
-  status = sensu_send_msg(host, msg);
+  status = sensu_send_msg(host, msg, msg_len);
   if (status != 0) {
     host->flags &= ~F_READY;
     if (host->res != NULL) {
@@ -905,43 +1087,245 @@ static int sensu_send(struct sensu_host *host, char const *msg) /* {{{ */
   return 0;
 } /* }}} int sensu_send */
 
+static void *sensu_sender_thread(void *arg) /* {{{ */
+{
+  struct sensu_host *host = arg;
+
+  pthread_mutex_lock(&host->lock);
+  while (true) {
+    while ((host->queue_head == NULL) && !host->shutdown)
+      pthread_cond_wait(&host->queue_cond, &host->lock);
+    if (host->queue_head == NULL)
+      break;
+
+    sensu_queue_entry_t *entry = host->queue_head;
+    host->queue_head = entry->next;
+    if (host->queue_head == NULL)
+      host->queue_tail = NULL;
+    host->queue_length--;
+    pthread_mutex_unlock(&host->lock);
+
+    pthread_mutex_lock(&host->send_lock);
+    int status = sensu_send(host, entry->msg, entry->msg_len);
+    pthread_mutex_unlock(&host->send_lock);
+    sfree(entry->msg);
+    sfree(entry);
+
+    pthread_mutex_lock(&host->lock);
+    if (status == 0) {
+      c_release(LOG_INFO, &host->send_complaint,
+                "write_sensu plugin: Node \"%s\": Sending succeeded again.",
+                host->name);
+      continue;
+    }
+
+    c_complain(LOG_ERR, &host->send_complaint,
+               "write_sensu plugin: Node \"%s\": sensu_send failed with "
+               "status %i",
+               host->name, status);
+
+    /* Don't delay the shutdown by trying each remaining message in turn. */
+    if (host->shutdown) {
+      while ((entry = host->queue_head) != NULL) {
+        host->queue_head = entry->next;
+        sfree(entry->msg);
+        sfree(entry);
+      }
+      host->queue_tail = NULL;
+      host->queue_length = 0;
+    }
+  }
+  pthread_mutex_unlock(&host->lock);
+
+  return NULL;
+} /* }}} void *sensu_sender_thread */
+
+/* Hands "msg" to the sender thread, which takes ownership of it. If the queue
+ * is full, the oldest message is dropped: fresh values are more useful than
+ * old ones.
+ * host->lock must be held when calling this function. */
+static int sensu_queue_push_nolock(struct sensu_host *host, /* {{{ */
+                                   char *msg, size_t msg_len) {
+  sensu_queue_entry_t *entry = calloc(1, sizeof(*entry));
+  if (entry == NULL) {
+    ERROR("write_sensu plugin: calloc failed.");
+    sfree(msg);
+    return ENOMEM;
+  }
+  entry->msg = msg;
+  entry->msg_len = msg_len;
+
+  if (!host->sender_running) {
+    int status = plugin_thread_create(&host->sender, /* attr = */ NULL,
+                                      sensu_sender_thread, host, "sensu send");
+    if (status != 0) {
+      ERROR("write_sensu plugin: Starting the sender thread failed: %s",
+            STRERROR(status));
+      sfree(msg);
+      sfree(entry);
+      return status;
+    }
+    host->sender_running = true;
+  }
+
+  if ((host->queue_limit > 0) && (host->queue_length >= host->queue_limit)) {
+    c_complain(LOG_WARNING, &host->queue_complaint,
+               "write_sensu plugin: Node \"%s\": The send queue is full, "
+               "dropping the oldest messages. Is the Sensu client too slow?",
+               host->name);
+    while (host->queue_length >= host->queue_limit) {
+      sensu_queue_entry_t *oldest = host->queue_head;
+      host->queue_head = oldest->next;
+      if (host->queue_head == NULL)
+        host->queue_tail = NULL;
+      host->queue_length--;
+      sfree(oldest->msg);
+      sfree(oldest);
+    }
+  } else {
+    c_release(LOG_INFO, &host->queue_complaint,
+              "write_sensu plugin: Node \"%s\": The send queue is no longer "
+              "full.",
+              host->name);
+  }
+
+  if (host->queue_tail == NULL)
+    host->queue_head = entry;
+  else
+    host->queue_tail->next = entry;
+  host->queue_tail = entry;
+  host->queue_length++;
+
+  pthread_cond_signal(&host->queue_cond);
+  return 0;
+} /* }}} int sensu_queue_push_nolock */
+
+/* Sends "msg" or hands it to the sender thread, taking ownership of it.
+ * host->lock must be held when calling this function. */
+static int sensu_dispatch_nolock(struct sensu_host *host, /* {{{ */
+                                 char *msg, size_t msg_len) {
+  if (host->async)
+    return sensu_queue_push_nolock(host, msg, msg_len);
+
+  pthread_mutex_lock(&host->send_lock);
+  int status = sensu_send(host, msg, msg_len);
+  pthread_mutex_unlock(&host->send_lock);
+  sfree(msg);
+
+  if (status != 0)
+    ERROR("write_sensu plugin: sensu_send failed with status %i", status);
+  return status;
+} /* }}} int sensu_dispatch_nolock */
+
+/* Closes the JSON array of the pending batch and sends it, unless "timeout"
+ * is non-zero and the batch has been started less than "timeout" ago.
+ * host->lock must be held when calling this function. */
+static int sensu_batch_flush_nolock(cdtime_t timeout, /* {{{ */
+                                    struct sensu_host *host) {
+  if (host->batch.len == 0)
+    return 0;
+  if ((timeout > 0) && ((host->batch_init + timeout) > cdtime()))
+    return 0;
+
+  int status = sensu_buffer_append(&host->batch, "]\n", 2);
+  char *msg = host->batch.data;
+  size_t msg_len = host->batch.len;
+  host->batch = (sensu_buffer_t){0};
+
+  if (status != 0) {
+    sfree(msg);
+    return status;
+  }
+  return sensu_dispatch_nolock(host, msg, msg_len);
+} /* }}} int sensu_batch_flush_nolock */
+
+static int sensu_batch_flush(cdtime_t timeout, /* {{{ */
+                             const char __attribute__((unused)) * identifier,
+                             user_data_t *user_data) {
+  struct sensu_host *host = user_data->data;
+
+  pthread_mutex_lock(&host->lock);
+  int status = sensu_batch_flush_nolock(timeout, host);
+  pthread_mutex_unlock(&host->lock);
+  return status;
+} /* }}} int sensu_batch_flush */
+
+/* Adds the events of "vl" to the pending batch, or sends them one by one if
+ * batching is disabled.
+ * host->lock must be held when calling this function. */
+static int sensu_value_list_append(struct sensu_host *host, /* {{{ */
+                                   data_set_t const *ds,
+                                   value_list_t const *vl,
+                                   gauge_t const *rates) {
+  sensu_template_t *t = sensu_template_get(host, ds, vl);
+  if (t == NULL)
+    return -1;
+
+  for (size_t i = 0; i < vl->values_len; i++) {
+    int status;
+
+    if (!host->batch_mode) {
+      sensu_buffer_t msg = {0};
+      status = sensu_value_append(&msg, t->events[i], ds, vl, i, rates);
+      if (status == 0)
+        status = sensu_buffer_append(&msg, "\n", 1);
+      if (status != 0) {
+        sfree(msg.data);
+        return status;
+      }
+
+      status = sensu_dispatch_nolock(host, msg.data, msg.len);
+      if (status != 0)
+        return status;
+      continue;
+    }
+
+    /* Don't leave half an event in the batch on failure. */
+    size_t batch_len = host->batch.len;
+    if (batch_len == 0) {
+      status = sensu_buffer_append(&host->batch, "[", 1);
+      host->batch_init = cdtime();
+    } else {
+      status = sensu_buffer_append(&host->batch, ", ", 2);
+    }
+    if (status == 0)
+      status = sensu_value_append(&host->batch, t->events[i], ds, vl, i, rates);
+    if (status != 0) {
+      host->batch.len = batch_len;
+      return status;
+    }
+  }
+
+  if (!host->batch_mode)
+    return 0;
+
+  if (host->batch.len >= (size_t)host->batch_max)
+    return sensu_batch_flush_nolock(0, host);
+  if (host->batch_timeout > 0)
+    return sensu_batch_flush_nolock(
+        TIME_T_TO_CDTIME_T((time_t)host->batch_timeout), host);
+  return 0;
+} /* }}} int sensu_value_list_append */
+
 static int sensu_write(const data_set_t *ds, /* {{{ */
                        const value_list_t *vl, user_data_t *ud) {
-  int status = 0;
-  int statuses[vl->values_len];
   struct sensu_host *host = ud->data;
   gauge_t *rates = NULL;
-  char *msg;
-
-  pthread_mutex_lock(&host->lock);
-  memset(statuses, 0, vl->values_len * sizeof(*statuses));
 
   if (host->store_rates) {
     rates = uc_get_rate(ds, vl);
     if (rates == NULL) {
       ERROR("write_sensu plugin: uc_get_rate failed.");
-      pthread_mutex_unlock(&host->lock);
-      return -1;
-    }
-  }
-  for (size_t i = 0; i < vl->values_len; i++) {
-    msg = sensu_value_to_json(host, ds, vl, (int)i, rates);
-    if (msg == NULL) {
-      sfree(rates);
-      pthread_mutex_unlock(&host->lock);
       return -1;
     }
-    status = sensu_send(host, msg);
-    free(msg);
-    if (status != 0) {
-      ERROR("write_sensu plugin: sensu_send failed with status %i", status);
-      pthread_mutex_unlock(&host->lock);
-      sfree(rates);
-      return status;
-    }
   }
-  sfree(rates);
+
+  pthread_mutex_lock(&host->lock);
+  sensu_templates_expire(host);
+  int status = sensu_value_list_append(host, ds, vl, rates);
   pthread_mutex_unlock(&host->lock);
+
+  sfree(rates);
   return status;
 } /* }}} int sensu_write */
 
@@ -952,18 +1336,12 @@ static int sensu_notification(const notification_t *n,
   struct sensu_host *host = ud->data;
   char *msg;
 
-  pthread_mutex_lock(&host->lock);
-
   msg = sensu_notification_to_json(host, n);
-  if (msg == NULL) {
-    pthread_mutex_unlock(&host->lock);
+  if (msg == NULL)
     return -1;
-  }
 
-  status = sensu_send(host, msg);
-  free(msg);
-  if (status != 0)
-    ERROR("write_sensu plugin: sensu_send failed with status %i", status);
+  pthread_mutex_lock(&host->lock);
+  status = sensu_dispatch_nolock(host, msg, strlen(msg));
   pthread_mutex_unlock(&host->lock);
 
   return status;
@@ -984,6 +1362,17 @@ static void sensu_free(void *p) /* {{{ */
     return;
   }
 
+  sensu_batch_flush_nolock(0, host);
+
+  host->shutdown = true;
+  pthread_cond_signal(&host->queue_cond);
+  pthread_mutex_unlock(&host->lock);
+
+  if (host->sender_running) {
+    pthread_join(host->sender, NULL);
+    host->sender_running = false;
+  }
+
   sensu_close_socket(host);
   if (host->res != NULL) {
     freeaddrinfo(host->res);
@@ -996,8 +1385,20 @@ static void sensu_free(void *p) /* {{{ */
   sfree(host->separator);
   free_str_list(&(host->metric_handlers));
   free_str_list(&(host->notification_handlers));
+  sfree(host->batch.data);
+
+  if (host->templates != NULL) {
+    char *key;
+    sensu_template_t *t;
+    while (c_avl_pick(host->templates, (void *)&key, (void *)&t) == 0) {
+      sfree(key);
+      sensu_template_free(t);
+    }
+    c_avl_destroy(host->templates);
+  }
 
-  pthread_mutex_unlock(&host->lock);
+  pthread_cond_destroy(&host->queue_cond);
+  pthread_mutex_destroy(&host->send_lock);
   pthread_mutex_destroy(&host->lock);
 
   sfree(host);
@@ -1015,6 +1416,10 @@ static int sensu_config_node(oconfig_item_t *ci) /* {{{ */
     return ENOMEM;
   }
   pthread_mutex_init(&host->lock, NULL);
+  pthread_mutex_init(&host->send_lock, NULL);
+  pthread_cond_init(&host->queue_cond, NULL);
+  C_COMPLAIN_INIT(&host->send_complaint);
+  C_COMPLAIN_INIT(&host->queue_complaint);
   host->reference_count = 1;
   host->node = NULL;
   host->service = NULL;
@@ -1022,6 +1427,12 @@ static int sensu_config_node(oconfig_item_t *ci) /* {{{ */
   host->metrics = false;
   host->store_rates = true;
   host->always_append_ds = false;
+  host->batch_mode = false;
+  host->batch_max = SENSU_BATCH_MAX;
+  host->batch_timeout = 0;
+  host->async = true;
+  host->queue_limit = SENSU_QUEUE_LIMIT;
+  host->s = -1;
   host->metric_handlers.nb_strs = 0;
   host->metric_handlers.strs = NULL;
   host->notification_handlers.nb_strs = 0;
@@ -1094,6 +1505,26 @@ static int sensu_config_node(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_boolean(child, &host->always_append_ds);
       if (status != 0)
         break;
+    } else if (strcasecmp("Batch", child->key) == 0) {
+      status = cf_util_get_boolean(child, &host->batch_mode);
+      if (status != 0)
+        break;
+    } else if (strcasecmp("BatchMaxSize", child->key) == 0) {
+      status = cf_util_get_int(child, &host->batch_max);
+      if (status != 0)
+        break;
+    } else if (strcasecmp("BatchFlushTimeout", child->key) == 0) {
+      status = cf_util_get_int(child, &host->batch_timeout);
+      if (status != 0)
+        break;
+    } else if (strcasecmp("AsyncSend", child->key) == 0) {
+      status = cf_util_get_boolean(child, &host->async);
+      if (status != 0)
+        break;
+    } else if (strcasecmp("SendQueueLimit", child->key) == 0) {
+      status = cf_util_get_int(child, &host->queue_limit);
+      if (status != 0)
+        break;
     } else {
       WARNING("write_sensu plugin: ignoring unknown config "
               "option: \"%s\"",
@@ -1153,6 +1584,12 @@ static int sensu_config_node(oconfig_item_t *ci) /* {{{ */
               callback_name, status);
     else /* success */
       host->reference_count++;
+
+    /* The flush callback doesn't hold a reference: it is unregistered before
+     * the write and notification callbacks. */
+    user_data_t ud_noref = {.data = host};
+    if (host->batch_mode)
+      plugin_register_flush(callback_name, sensu_batch_flush, &ud_noref);
   }
 
   if (host->notifications) {
@@ -38,6 +38,12 @@
  *     Port "4242"
  *     HostTags "status=production deviceclass=www"
  *   </Node>
+ *   <Node "http">
+ *     Host "localhost"
+ *     Port "4242"
+ *     Protocol "HTTP"
+ *     BatchSize 50
+ *   </Node>
  * </Plugin>
  */
 
@@ -46,10 +52,19 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_cache.h"
+#include "utils_complain.h"
 #include "utils_random.h"
 
+#include <math.h>
 #include <netdb.h>
 
+#ifdef HAVE_LIBCURL
+#include <curl/curl.h>
+#endif
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 #ifndef WT_DEFAULT_NODE
 #define WT_DEFAULT_NODE "localhost"
 #endif
@@ -67,9 +82,29 @@
 #define WT_SEND_BUF_SIZE 1428
 #endif
 
+#ifndef WT_DEFAULT_BATCH_SIZE
+#define WT_DEFAULT_BATCH_SIZE 50
+#endif
+
+#ifndef WT_DEFAULT_BACKLOG_SIZE
+#define WT_DEFAULT_BACKLOG_SIZE (1024 * 1024)
+#endif
+
+#define WT_PROTOCOL_TELNET 0
+#define WT_PROTOCOL_HTTP 1
+
 /*
  * Private variables
  */
+
+/* A JSON array of data points waiting to be posted to "/api/put". */
+typedef struct wt_request_s {
+  char *data;
+  size_t size;
+  bool compressed;
+  struct wt_request_s *next;
+} wt_request_t;
+
 struct wt_callback {
   struct addrinfo *ai;
   cdtime_t ai_last_update;
@@ -92,6 +127,39 @@ struct wt_callback {
   bool connect_failed_log_enabled;
   int connect_dns_failed_attempts_remaining;
   cdtime_t next_random_ttl;
+
+  /* HTTP mode: data points are collected into JSON arrays of up to
+   * "batch_size" elements, which a sender thread posts to "/api/put". All of
+   * the following is protected by send_lock. */
+  int protocol;
+  char *url;
+  int batch_size;
+  cdtime_t flush_interval;
+  int timeout;
+  size_t backlog_size;
+  bool compress;
+
+  char *batch;
+  size_t batch_size_alloc;
+  size_t batch_fill;
+  int batch_count;
+  cdtime_t batch_init_time;
+
+  wt_request_t *queue_head;
+  wt_request_t *queue_tail;
+  size_t queue_bytes;
+  pthread_cond_t queue_cond;
+  c_complain_t backlog_complaint;
+  c_complain_t post_complaint;
+
+  pthread_t sender_thread;
+  bool sender_running;
+  bool sender_loop;
+#ifdef HAVE_LIBCURL
+  CURL *curl;
+  char curl_errbuf[CURL_ERROR_SIZE];
+  struct curl_slist *headers;
+#endif
 };
 
 static cdtime_t resolve_interval;
@@ -124,6 +192,70 @@ static int wt_send_buffer(struct wt_callback *cb) {
   return 0;
 }
 
+static void wt_request_free(wt_request_t *req) {
+  if (req == NULL)
+    return;
+
+  sfree(req->data);
+  sfree(req);
+}
+
+/* Moves the current batch to the send queue, dropping the oldest requests if
+ * the backlog is full.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wt_batch_queue_nolock(struct wt_callback *cb) {
+  wt_request_t *req;
+
+  if (cb->batch_count == 0)
+    return 0;
+
+  req = calloc(1, sizeof(*req));
+  if (req == NULL) {
+    ERROR("write_tsdb plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  /* wt_batch_add() always leaves room for the closing bracket. */
+  cb->batch[cb->batch_fill] = ']';
+  cb->batch_fill++;
+  cb->batch[cb->batch_fill] = 0;
+
+  req->data = cb->batch;
+  req->size = cb->batch_fill;
+
+  cb->batch = NULL;
+  cb->batch_size_alloc = 0;
+  cb->batch_fill = 0;
+  cb->batch_count = 0;
+  cb->batch_init_time = cdtime();
+
+  while ((cb->queue_head != NULL) &&
+         (cb->queue_bytes + req->size > cb->backlog_size)) {
+    wt_request_t *old = cb->queue_head;
+
+    cb->queue_head = old->next;
+    if (cb->queue_head == NULL)
+      cb->queue_tail = NULL;
+    cb->queue_bytes -= old->size;
+
+    c_complain(LOG_WARNING, &cb->backlog_complaint,
+               "write_tsdb plugin: The backlog of %s is full. "
+               "Dropping the oldest data points.",
+               cb->url);
+    wt_request_free(old);
+  }
+
+  if (cb->queue_tail == NULL)
+    cb->queue_head = req;
+  else
+    cb->queue_tail->next = req;
+  cb->queue_tail = req;
+  cb->queue_bytes += req->size;
+
+  pthread_cond_signal(&cb->queue_cond);
+  return 0;
+}
+
 /* NOTE: You must hold cb->send_lock when calling this function! */
 static int wt_flush_nolock(cdtime_t timeout, struct wt_callback *cb) {
   int status;
@@ -135,12 +267,18 @@ static int wt_flush_nolock(cdtime_t timeout, struct wt_callback *cb) {
   /* timeout == 0  => flush unconditionally */
   if (timeout > 0) {
     cdtime_t now;
+    cdtime_t init_time = (cb->protocol == WT_PROTOCOL_HTTP)
+                             ? cb->batch_init_time
+                             : cb->send_buf_init_time;
 
     now = cdtime();
-    if ((cb->send_buf_init_time + timeout) > now)
+    if ((init_time + timeout) > now)
       return 0;
   }
 
+  if (cb->protocol == WT_PROTOCOL_HTTP)
+    return wt_batch_queue_nolock(cb);
+
   if (cb->send_buf_fill == 0) {
     cb->send_buf_init_time = cdtime();
     return 0;
@@ -258,6 +396,225 @@ static int wt_callback_init(struct wt_callback *cb) {
   return 0;
 }
 
+#ifdef HAVE_LIBCURL
+#ifdef HAVE_LIBZ
+static int wt_request_compress(wt_request_t *req) {
+  z_stream z = {0};
+
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   /* gzip header = */ 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+
+  size_t size = (size_t)deflateBound(&z, (uLong)req->size);
+  char *data = malloc(size);
+  if (data == NULL) {
+    deflateEnd(&z);
+    return ENOMEM;
+  }
+
+  z.next_in = (Bytef *)req->data;
+  z.avail_in = (uInt)req->size;
+  z.next_out = (Bytef *)data;
+  z.avail_out = (uInt)size;
+
+  int status = deflate(&z, Z_FINISH);
+  size = (size_t)z.total_out;
+  deflateEnd(&z);
+  if (status != Z_STREAM_END) {
+    sfree(data);
+    return -1;
+  }
+
+  sfree(req->data);
+  req->data = data;
+  req->size = size;
+  req->compressed = true;
+  return 0;
+}
+#endif
+
+static size_t wt_curl_discard(void *buf __attribute__((unused)), size_t size,
+                              size_t nmemb,
+                              void *user_data __attribute__((unused))) {
+  return size * nmemb;
+}
+
+/* Posts one request. Returns EAGAIN if the request failed in a way that is
+ * worth retrying, i.e. OpenTSDB could not be reached or was overloaded. */
+static int wt_http_post(struct wt_callback *cb, wt_request_t *req) {
+  CURLcode status;
+  long rc = 0;
+
+  curl_easy_setopt(cb->curl, CURLOPT_POSTFIELDS, req->data);
+  curl_easy_setopt(cb->curl, CURLOPT_POSTFIELDSIZE, (long)req->size);
+
+  status = curl_easy_perform(cb->curl);
+  if (status != CURLE_OK) {
+    c_complain(LOG_ERR, &cb->post_complaint,
+               "write_tsdb plugin: Posting data to %s failed: %s", cb->url,
+               cb->curl_errbuf);
+    return EAGAIN;
+  }
+
+  curl_easy_getinfo(cb->curl, CURLINFO_RESPONSE_CODE, &rc);
+  if ((rc < 200) || (rc >= 300)) {
+    c_complain(LOG_ERR, &cb->post_complaint,
+               "write_tsdb plugin: %s responded with HTTP status %ld.",
+               cb->url, rc);
+    return ((rc >= 500) || (rc == 429)) ? EAGAIN : -1;
+  }
+
+  c_release(LOG_INFO, &cb->post_complaint,
+            "write_tsdb plugin: Posting data to %s succeeded.", cb->url);
+  return 0;
+}
+
+static void *wt_sender_thread(void *arg) {
+  struct wt_callback *cb = arg;
+  bool backoff = false;
+
+  pthread_mutex_lock(&cb->send_lock);
+  while (true) {
+    cdtime_t now = cdtime();
+    cdtime_t deadline = now + cb->flush_interval;
+
+    if ((cb->batch_count > 0) &&
+        (!cb->sender_loop ||
+         (cb->batch_init_time + cb->flush_interval <= now))) {
+      wt_batch_queue_nolock(cb);
+      continue;
+    }
+
+    if ((cb->queue_head == NULL) && !cb->sender_loop)
+      break;
+
+    if ((cb->queue_head == NULL) || backoff) {
+      if ((cb->batch_count > 0) &&
+          (cb->batch_init_time + cb->flush_interval < deadline))
+        deadline = cb->batch_init_time + cb->flush_interval;
+      pthread_cond_timedwait(&cb->queue_cond, &cb->send_lock,
+                             &CDTIME_T_TO_TIMESPEC(deadline));
+      backoff = false;
+      continue;
+    }
+
+    wt_request_t *req = cb->queue_head;
+    cb->queue_head = req->next;
+    if (cb->queue_head == NULL)
+      cb->queue_tail = NULL;
+    cb->queue_bytes -= req->size;
+    req->next = NULL;
+
+    pthread_mutex_unlock(&cb->send_lock);
+#ifdef HAVE_LIBZ
+    if (cb->compress && !req->compressed &&
+        (wt_request_compress(req) != 0)) {
+      ERROR("write_tsdb plugin: Compressing data for %s failed.", cb->url);
+      wt_request_free(req);
+      pthread_mutex_lock(&cb->send_lock);
+      continue;
+    }
+#endif
+    int status = wt_http_post(cb, req);
+    pthread_mutex_lock(&cb->send_lock);
+
+    /* Put the request back and wait before trying again. Requests queued in
+     * the meantime count against the backlog, so this can't grow without
+     * bounds. */
+    if ((status == EAGAIN) && cb->sender_loop) {
+      req->next = cb->queue_head;
+      cb->queue_head = req;
+      if (cb->queue_tail == NULL)
+        cb->queue_tail = req;
+      cb->queue_bytes += req->size;
+      backoff = true;
+    } else {
+      wt_request_free(req);
+    }
+  }
+  pthread_mutex_unlock(&cb->send_lock);
+
+  return NULL;
+}
+#endif /* HAVE_LIBCURL */
+
+/* Sets up the curl handle and starts the sender thread.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wt_http_init(struct wt_callback *cb) {
+#ifdef HAVE_LIBCURL
+  if (cb->sender_running)
+    return 0;
+
+  if (cb->curl == NULL) {
+    cb->curl = curl_easy_init();
+    if (cb->curl == NULL) {
+      ERROR("write_tsdb plugin: curl_easy_init failed.");
+      return -1;
+    }
+
+    curl_easy_setopt(cb->curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(cb->curl, CURLOPT_URL, cb->url);
+    curl_easy_setopt(cb->curl, CURLOPT_HTTPHEADER, cb->headers);
+    curl_easy_setopt(cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
+    curl_easy_setopt(cb->curl, CURLOPT_WRITEFUNCTION, wt_curl_discard);
+#ifdef HAVE_CURLOPT_TIMEOUT_MS
+    if (cb->timeout > 0)
+      curl_easy_setopt(cb->curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
+#endif
+  }
+
+  cb->sender_loop = true;
+  int status = plugin_thread_create(&cb->sender_thread, /* attr = */ NULL,
+                                    wt_sender_thread, cb, "write_tsdb");
+  if (status != 0) {
+    ERROR("write_tsdb plugin: Starting the sender thread failed: %s",
+          STRERROR(status));
+    return -1;
+  }
+  cb->sender_running = true;
+  cb->batch_init_time = cdtime();
+
+  return 0;
+#else
+  return ENOTSUP;
+#endif
+}
+
+/* Appends one JSON data point to the current batch.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wt_batch_add(struct wt_callback *cb, const char *message,
+                        size_t message_len) {
+  /* separator + message + closing bracket + null byte */
+  size_t need = cb->batch_fill + message_len + 3;
+
+  if (need > cb->batch_size_alloc) {
+    size_t new_size = (cb->batch_size_alloc > 0) ? cb->batch_size_alloc : 4096;
+    while (new_size < need)
+      new_size *= 2;
+
+    char *tmp = realloc(cb->batch, new_size);
+    if (tmp == NULL) {
+      ERROR("write_tsdb plugin: realloc failed.");
+      return ENOMEM;
+    }
+    cb->batch = tmp;
+    cb->batch_size_alloc = new_size;
+  }
+
+  if (cb->batch_count == 0)
+    cb->batch_init_time = cdtime();
+
+  cb->batch[cb->batch_fill] = (cb->batch_count == 0) ? '[' : ',';
+  memcpy(cb->batch + cb->batch_fill + 1, message, message_len + 1);
+  cb->batch_fill += message_len + 1;
+  cb->batch_count++;
+
+  if (cb->batch_count >= cb->batch_size)
+    return wt_batch_queue_nolock(cb);
+
+  return 0;
+}
+
 static void wt_callback_free(void *data) {
   struct wt_callback *cb;
 
@@ -270,14 +627,43 @@ static void wt_callback_free(void *data) {
 
   wt_flush_nolock(0, cb);
 
-  close(cb->sock_fd);
+  /* The sender thread posts everything that's still queued before it exits. */
+  if (cb->sender_running) {
+    cb->sender_loop = false;
+    pthread_cond_signal(&cb->queue_cond);
+    pthread_mutex_unlock(&cb->send_lock);
+    pthread_join(cb->sender_thread, NULL);
+    pthread_mutex_lock(&cb->send_lock);
+    cb->sender_running = false;
+  }
+
+  while (cb->queue_head != NULL) {
+    wt_request_t *req = cb->queue_head;
+    cb->queue_head = req->next;
+    wt_request_free(req);
+  }
+  cb->queue_tail = NULL;
+  sfree(cb->batch);
+
+#ifdef HAVE_LIBCURL
+  if (cb->curl != NULL)
+    curl_easy_cleanup(cb->curl);
+  cb->curl = NULL;
+  curl_slist_free_all(cb->headers);
+  cb->headers = NULL;
+#endif
+
+  if (cb->sock_fd >= 0)
+    close(cb->sock_fd);
   cb->sock_fd = -1;
 
   sfree(cb->node);
   sfree(cb->service);
   sfree(cb->host_tags);
+  sfree(cb->url);
 
   pthread_mutex_unlock(&cb->send_lock);
+  pthread_cond_destroy(&cb->queue_cond);
   pthread_mutex_destroy(&cb->send_lock);
 
   sfree(cb);
@@ -296,7 +682,7 @@ static int wt_flush(cdtime_t timeout,
 
   pthread_mutex_lock(&cb->send_lock);
 
-  if (cb->sock_fd < 0) {
+  if ((cb->protocol == WT_PROTOCOL_TELNET) && (cb->sock_fd < 0)) {
     status = wt_callback_init(cb);
     if (status != 0) {
       ERROR("write_tsdb plugin: wt_callback_init failed.");
@@ -425,6 +811,108 @@ static int wt_format_name(char *ret, int ret_len, const value_list_t *vl,
   return 0;
 }
 
+/* Appends "str" to "buffer" as a quoted JSON string. */
+static int wt_json_add_string(char *buffer, size_t buffer_size, size_t *offset,
+                              const char *str, size_t str_len) {
+  size_t pos = *offset;
+
+  if (pos + 2 >= buffer_size)
+    return -1;
+  buffer[pos++] = '"';
+
+  for (size_t i = 0; i < str_len; i++) {
+    unsigned char c = (unsigned char)str[i];
+
+    /* room for an escape sequence, the closing quote and the null byte */
+    if (pos + 8 >= buffer_size)
+      return -1;
+
+    if ((c == '"') || (c == '\\')) {
+      buffer[pos++] = '\\';
+      buffer[pos++] = (char)c;
+    } else if (c < 0x20) {
+      pos += (size_t)snprintf(buffer + pos, buffer_size - pos, "\\u%04x", c);
+    } else {
+      buffer[pos++] = (char)c;
+    }
+  }
+
+  buffer[pos++] = '"';
+  buffer[pos] = 0;
+  *offset = pos;
+  return 0;
+}
+
+/* Converts space separated "key=value" tags into JSON object members. Tags
+ * without a "=" are skipped, like OpenTSDB would reject them. */
+static int wt_json_add_tags(char *buffer, size_t buffer_size, size_t *offset,
+                            const char *tags) {
+  const char *ptr = tags;
+
+  while (*ptr != 0) {
+    size_t len = strcspn(ptr, " \t");
+    const char *eq = memchr(ptr, '=', len);
+
+    if ((eq != NULL) && (eq != ptr) && (eq != ptr + len - 1)) {
+      if (*offset + 2 >= buffer_size)
+        return -1;
+      buffer[(*offset)++] = ',';
+
+      if ((wt_json_add_string(buffer, buffer_size, offset, ptr,
+                              (size_t)(eq - ptr)) != 0) ||
+          (*offset + 2 >= buffer_size))
+        return -1;
+      buffer[(*offset)++] = ':';
+
+      if (wt_json_add_string(buffer, buffer_size, offset, eq + 1,
+                             (size_t)(ptr + len - eq - 1)) != 0)
+        return -1;
+    }
+
+    ptr += len;
+    ptr += strspn(ptr, " \t");
+  }
+
+  return 0;
+}
+
+static int wt_format_json(char *buffer, size_t buffer_size, const char *key,
+                          const char *value, cdtime_t time, const char *host,
+                          const char *tags, const char *host_tags) {
+  size_t offset = 0;
+  int status;
+
+#define JSON_ADD_STRING(str)                                                   \
+  do {                                                                         \
+    if (wt_json_add_string(buffer, buffer_size, &offset, (str),                \
+                           strlen(str)) != 0)                                  \
+      return -1;                                                               \
+  } while (0)
+
+#define JSON_ADD(...)                                                          \
+  do {                                                                         \
+    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
+    if ((status < 0) || ((size_t)status >= (buffer_size - offset)))            \
+      return -1;                                                               \
+    offset += (size_t)status;                                                  \
+  } while (0)
+
+  JSON_ADD("{\"metric\":");
+  JSON_ADD_STRING(key);
+  JSON_ADD(",\"timestamp\":%.0f,\"value\":%s,\"tags\":{\"fqdn\":",
+           CDTIME_T_TO_DOUBLE(time), value);
+  JSON_ADD_STRING(host);
+  if ((wt_json_add_tags(buffer, buffer_size, &offset, tags) != 0) ||
+      (wt_json_add_tags(buffer, buffer_size, &offset, host_tags) != 0))
+    return -1;
+  JSON_ADD("}}");
+
+#undef JSON_ADD
+#undef JSON_ADD_STRING
+
+  return (int)offset;
+}
+
 static int wt_send_message(const char *key, const char *value, cdtime_t time,
                            struct wt_callback *cb, const char *host,
                            meta_data_t *md) {
@@ -454,6 +942,30 @@ static int wt_send_message(const char *key, const char *value, cdtime_t time,
     }
   }
 
+  if (cb->protocol == WT_PROTOCOL_HTTP) {
+    /* JSON has no representation for NaN and infinity. */
+    if (!isfinite(strtod(value, NULL))) {
+      sfree(temp);
+      return 0;
+    }
+
+    status = wt_format_json(message, sizeof(message), key, value, time, host,
+                            tags, host_tags);
+    sfree(temp);
+    if (status < 0) {
+      ERROR("write_tsdb plugin: message buffer too small for \"%s\".", key);
+      return -1;
+    }
+    message_len = (size_t)status;
+
+    pthread_mutex_lock(&cb->send_lock);
+    status = wt_http_init(cb);
+    if (status == 0)
+      status = wt_batch_add(cb, message, message_len);
+    pthread_mutex_unlock(&cb->send_lock);
+    return status;
+  }
+
   status =
       snprintf(message, sizeof(message), "put %s %.0f %s fqdn=%s %s %s\r\n",
                key, CDTIME_T_TO_DOUBLE(time), value, host, tags, host_tags);
@@ -533,7 +1045,9 @@ static int wt_write_messages(const data_set_t *ds, const value_list_t *vl,
       return status;
     }
 
-    escape_string(key, sizeof(key));
+    /* The HTTP API quotes the metric name as a JSON string. */
+    if (cb->protocol == WT_PROTOCOL_TELNET)
+      escape_string(key, sizeof(key));
     /* Convert the values to an ASCII representation and put that into
      * 'values'. */
     status =
@@ -571,6 +1085,58 @@ static int wt_write(const data_set_t *ds, const value_list_t *vl,
   return status;
 }
 
+static int wt_config_http(struct wt_callback *cb, int backlog_size) {
+#ifdef HAVE_LIBCURL
+  if (cb->batch_size < 1) {
+    ERROR("write_tsdb plugin: BatchSize must be at least 1.");
+    return -1;
+  }
+  if (cb->flush_interval == 0)
+    cb->flush_interval = plugin_get_interval();
+  if (backlog_size < 1) {
+    ERROR("write_tsdb plugin: BacklogSize must be positive.");
+    return -1;
+  }
+  cb->backlog_size = (size_t)backlog_size;
+
+#ifndef HAVE_LIBZ
+  if (cb->compress) {
+    WARNING("write_tsdb plugin: Compress is not available because collectd "
+            "was built without zlib. Disabling compression.");
+    cb->compress = false;
+  }
+#endif
+
+  if (cb->url == NULL) {
+    const char *node = cb->node ? cb->node : WT_DEFAULT_NODE;
+    const char *service = cb->service ? cb->service : WT_DEFAULT_SERVICE;
+    bool ipv6 = (strchr(node, ':') != NULL);
+    char url[1024];
+
+    snprintf(url, sizeof(url), "http://%s%s%s:%s/api/put", ipv6 ? "[" : "",
+             node, ipv6 ? "]" : "", service);
+    cb->url = strdup(url);
+    if (cb->url == NULL) {
+      ERROR("write_tsdb plugin: strdup failed.");
+      return -1;
+    }
+  }
+
+  cb->headers = curl_slist_append(cb->headers, "Accept: */*");
+  cb->headers =
+      curl_slist_append(cb->headers, "Content-Type: application/json");
+  if (cb->compress)
+    cb->headers = curl_slist_append(cb->headers, "Content-Encoding: gzip");
+  cb->headers = curl_slist_append(cb->headers, "Expect:");
+
+  return 0;
+#else
+  ERROR("write_tsdb plugin: The HTTP protocol is not available because "
+        "collectd was built without libcurl.");
+  return -1;
+#endif
+}
+
 static int wt_config_tsd(oconfig_item_t *ci) {
   struct wt_callback *cb;
   char callback_name[DATA_MAX_NAME_LEN];
@@ -583,8 +1149,18 @@ static int wt_config_tsd(oconfig_item_t *ci) {
   cb->sock_fd = -1;
   cb->connect_failed_log_enabled = 1;
   cb->next_random_ttl = new_random_ttl();
+  cb->protocol = WT_PROTOCOL_TELNET;
+  cb->batch_size = WT_DEFAULT_BATCH_SIZE;
+  cb->flush_interval = plugin_get_interval();
+  cb->backlog_size = WT_DEFAULT_BACKLOG_SIZE;
+  C_COMPLAIN_INIT(&cb->backlog_complaint);
+  C_COMPLAIN_INIT(&cb->post_complaint);
 
   pthread_mutex_init(&cb->send_lock, NULL);
+  pthread_cond_init(&cb->queue_cond, NULL);
+
+  int backlog_size = WT_DEFAULT_BACKLOG_SIZE;
+  int status = 0;
 
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
@@ -599,11 +1175,48 @@ static int wt_config_tsd(oconfig_item_t *ci) {
       cf_util_get_boolean(child, &cb->store_rates);
     else if (strcasecmp("AlwaysAppendDS", child->key) == 0)
       cf_util_get_boolean(child, &cb->always_append_ds);
+    else if (strcasecmp("Protocol", child->key) == 0) {
+      char *protocol = NULL;
+      status = cf_util_get_string(child, &protocol);
+      if (status != 0)
+        break;
+      if (strcasecmp("Telnet", protocol) == 0)
+        cb->protocol = WT_PROTOCOL_TELNET;
+      else if (strcasecmp("HTTP", protocol) == 0)
+        cb->protocol = WT_PROTOCOL_HTTP;
+      else {
+        ERROR("write_tsdb plugin: Invalid protocol: %s", protocol);
+        status = -1;
+      }
+      sfree(protocol);
+    } else if (strcasecmp("URL", child->key) == 0)
+      status = cf_util_get_string(child, &cb->url);
+    else if (strcasecmp("BatchSize", child->key) == 0)
+      status = cf_util_get_int(child, &cb->batch_size);
+    else if (strcasecmp("FlushInterval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &cb->flush_interval);
+    else if (strcasecmp("Timeout", child->key) == 0)
+      status = cf_util_get_int(child, &cb->timeout);
+    else if (strcasecmp("BacklogSize", child->key) == 0)
+      status = cf_util_get_int(child, &backlog_size);
+    else if (strcasecmp("Compress", child->key) == 0)
+      status = cf_util_get_boolean(child, &cb->compress);
     else {
       ERROR("write_tsdb plugin: Invalid configuration "
             "option: %s.",
             child->key);
     }
+
+    if (status != 0)
+      break;
+  }
+
+  if ((status == 0) && (cb->protocol == WT_PROTOCOL_HTTP))
+    status = wt_config_http(cb, backlog_size);
+
+  if (status != 0) {
+    wt_callback_free(cb);
+    return -1;
   }
 
   snprintf(callback_name, sizeof(callback_name), "write_tsdb/%s/%s",
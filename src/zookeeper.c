@@ -39,8 +39,12 @@
 
 static char *zk_host;
 static char *zk_port;
+static bool zk_response_time;
 
-static const char *config_keys[] = {"Host", "Port"};
+/* Resolved once and reused, until connecting to all addresses failed. */
+static struct addrinfo *zk_ai_list;
+
+static const char *config_keys[] = {"Host", "Port", "MeasureResponseTime"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int zookeeper_config(const char *key, const char *value) {
@@ -50,6 +54,8 @@ static int zookeeper_config(const char *key, const char *value) {
   } else if (strncmp(key, "Port", strlen("Port")) == 0) {
     sfree(zk_port);
     zk_port = strdup(value);
+  } else if (strcasecmp(key, "MeasureResponseTime") == 0) {
+    zk_response_time = IS_TRUE(value);
   } else {
     return -1;
   }
@@ -87,24 +93,31 @@ static void zookeeper_submit_derive(const char *type, const char *type_inst,
 static int zookeeper_connect(void) {
   int sk = -1;
   int status;
-  struct addrinfo *ai_list;
   const char *host;
   const char *port;
 
   host = (zk_host != NULL) ? zk_host : ZOOKEEPER_DEF_HOST;
   port = (zk_port != NULL) ? zk_port : ZOOKEEPER_DEF_PORT;
 
-  struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
-                              .ai_socktype = SOCK_STREAM};
+  if (zk_ai_list == NULL) {
+    struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
+                                .ai_socktype = SOCK_STREAM};
 
-  status = getaddrinfo(host, port, &ai_hints, &ai_list);
-  if (status != 0) {
-    INFO("getaddrinfo failed: %s",
-         (status == EAI_SYSTEM) ? STRERRNO : gai_strerror(status));
-    return -1;
+    status = getaddrinfo(host, port, &ai_hints, &zk_ai_list);
+    if (status != 0) {
+      INFO("getaddrinfo failed: %s",
+           (status == EAI_SYSTEM) ? STRERRNO : gai_strerror(status));
+      zk_ai_list = NULL;
+      return -1;
+    }
   }
 
-  for (struct addrinfo *ai = ai_list; ai != NULL; ai = ai->ai_next) {
+  /* The server closes the connection after answering, so a new one is
+   * needed for every read. A server that accepts connections but doesn't
+   * answer must not block the read thread beyond the interval, though. */
+  struct timeval tv = CDTIME_T_TO_TIMEVAL(plugin_get_interval());
+
+  for (struct addrinfo *ai = zk_ai_list; ai != NULL; ai = ai->ai_next) {
     sk = socket(ai->ai_family, SOCK_STREAM, 0);
     if (sk < 0) {
       WARNING("zookeeper: socket(2) failed: %s", STRERRNO);
@@ -119,10 +132,16 @@ static int zookeeper_connect(void) {
     }
 
     /* connected */
+    setsockopt(sk, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
     break;
   }
 
-  freeaddrinfo(ai_list);
+  if (sk < 0) {
+    /* Resolve the host again next time, in case its address changed. */
+    freeaddrinfo(zk_ai_list);
+    zk_ai_list = NULL;
+  }
+
   return sk;
 } /* int zookeeper_connect */
 
@@ -146,11 +165,13 @@ static int zookeeper_query(char *buffer, size_t buffer_size) {
   memset(buffer, 0, buffer_size);
   buffer_fill = 0;
 
-  while ((status = (int)recv(sk, buffer + buffer_fill,
-                             buffer_size - buffer_fill, /* flags = */ 0)) !=
-         0) {
+  /* Leave room for the terminating null byte. */
+  while ((buffer_fill < buffer_size - 1) &&
+         ((status = (int)recv(sk, buffer + buffer_fill,
+                              buffer_size - 1 - buffer_fill,
+                              /* flags = */ 0)) != 0)) {
     if (status < 0) {
-      if ((errno == EAGAIN) || (errno == EINTR))
+      if (errno == EINTR)
         continue;
       ERROR("zookeeper: Error reading from socket: %s", STRERRNO);
       close(sk);
@@ -177,10 +198,15 @@ static int zookeeper_read(void) {
   char *line;
   char *fields[2];
 
+  cdtime_t start = cdtime();
   if (zookeeper_query(buf, sizeof(buf)) < 0) {
     return -1;
   }
 
+  if (zk_response_time)
+    zookeeper_submit_gauge("response_time", NULL,
+                           CDTIME_T_TO_DOUBLE(cdtime() - start));
+
   ptr = buf;
   save_ptr = NULL;
   while ((line = strtok_r(ptr, "\n\r", &save_ptr)) != NULL) {
@@ -231,8 +257,18 @@ static int zookeeper_read(void) {
   return 0;
 } /* zookeeper_read */
 
+static int zookeeper_shutdown(void) {
+  if (zk_ai_list != NULL) {
+    freeaddrinfo(zk_ai_list);
+    zk_ai_list = NULL;
+  }
+
+  return 0;
+} /* zookeeper_shutdown */
+
 void module_register(void) {
   plugin_register_config("zookeeper", zookeeper_config, config_keys,
                          config_keys_num);
   plugin_register_read("zookeeper", zookeeper_read);
+  plugin_register_shutdown("zookeeper", zookeeper_shutdown);
 } /* void module_register */